@@ -0,0 +1,120 @@
+/*
+ * Open Surge Engine
+ * benchmark.c - microbenchmarks of the hot data structures and algorithms
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "benchmark.h"
+#include "../core/timer.h"
+#include "../core/logfile.h"
+#include "../util/util.h"
+#include "../util/stringutil.h"
+
+/* each benchmark runs for at least MIN_TIME seconds and MIN_RUNS times */
+#define MIN_TIME 0.25
+#define MIN_RUNS 5
+
+static char* filter = NULL;
+static uint64_t state = UINT64_C(0x853c49e6748fea9b);
+
+
+
+/*
+ * benchmark_measure()
+ * Runs a benchmark repeatedly and reports the time per operation,
+ * where each run performs the given number of operations
+ */
+void benchmark_measure(const char* name, int operations, void (*run)(void*), void* data)
+{
+    double total = 0.0, best = 1e30;
+    int runs = 0;
+
+    if(!benchmark_is_selected(name))
+        return;
+
+    /* warm up */
+    run(data);
+
+    /* measure */
+    while(runs < MIN_RUNS || total < MIN_TIME) {
+        double start = timer_get_now();
+        run(data);
+        double elapsed = timer_get_now() - start;
+
+        total += elapsed;
+        best = min(best, elapsed);
+        runs++;
+    }
+
+    /* report */
+    int n = max(operations, 1);
+    printf("%-48s %12.1f ns/op (best %.1f ns/op, %d ops x %d runs)\n",
+        name, 1e9 * total / (runs * n), 1e9 * best / n, n, runs);
+    logfile_message("Benchmark %s: %.1f ns/op (best %.1f ns/op, %d ops x %d runs)",
+        name, 1e9 * total / (runs * n), 1e9 * best / n, n, runs);
+    fflush(stdout);
+}
+
+/*
+ * benchmark_is_selected()
+ * Checks if the name of a benchmark contains the filter given in the command line
+ */
+bool benchmark_is_selected(const char* name)
+{
+    return filter == NULL || strstr(name, filter) != NULL;
+}
+
+/*
+ * benchmark_set_filter()
+ * Selects the benchmarks whose names contain the given string. NULL selects all
+ */
+void benchmark_set_filter(const char* new_filter)
+{
+    if(filter != NULL)
+        free(filter);
+
+    filter = (new_filter != NULL) ? str_dup(new_filter) : NULL;
+}
+
+/*
+ * benchmark_seed()
+ * Seeds the generator of the synthetic data
+ */
+void benchmark_seed(uint64_t seed)
+{
+    state = seed != 0 ? seed : UINT64_C(0x853c49e6748fea9b);
+}
+
+/*
+ * benchmark_random()
+ * A deterministic random integer in [min, max]
+ */
+int benchmark_random(int min, int max)
+{
+    /* xorshift64* */
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    uint64_t r = state * UINT64_C(2685821657736338717);
+
+    if(max <= min)
+        return min;
+
+    return min + (int)((r >> 33) % (uint64_t)(max - min + 1));
+}
@@ -0,0 +1,51 @@
+/*
+ * Open Surge Engine
+ * benchmark.h - microbenchmarks of the hot data structures and algorithms
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BENCHMARK_H
+#define _BENCHMARK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+
+The microbenchmarks are built with -DWANT_BENCHMARKS=1 into a separate
+executable. The engine is initialized as usual, so that the benchmarks can
+use its subsystems, but the main loop isn't run. The data is synthetic and
+sized like that of the levels of the game, unless noted otherwise.
+
+*/
+
+/* harness */
+void benchmark_measure(const char* name, int operations, void (*run)(void*), void* data); /* runs repeatedly and reports the time per operation */
+bool benchmark_is_selected(const char* name); /* checks the name against the filter given in the command line */
+void benchmark_set_filter(const char* filter); /* NULL selects all benchmarks */
+void benchmark_seed(uint64_t seed); /* the synthetic data is deterministic */
+int benchmark_random(int min, int max); /* random integer in [min, max] */
+
+/* suites */
+void benchmark_physics();
+void benchmark_rendering();
+void benchmark_bricks();
+void benchmark_parsing();
+void benchmark_hashtables();
+void benchmark_fonts();
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * Open Surge Engine
+ * bricks.c - microbenchmarks of the brick manager
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "benchmark.h"
+#include "../entities/brick.h"
+#include "../entities/brickmanager.h"
+#include "../core/video.h"
+#include "../util/rect.h"
+#include "../util/v2d.h"
+
+/* a synthetic level, sized like the large levels of the game */
+#define LEVEL_WIDTH         16384
+#define LEVEL_HEIGHT        4096
+#define BRICK_COUNT         5000
+#define CAMERA_STEPS        256
+
+/* the brickset used if none is loaded */
+#define BRICKSET_PATH       "themes/sunshine.brk"
+
+typedef struct brickdata_t brickdata_t;
+struct brickdata_t
+{
+    brickmanager_t* manager;
+    rect_t roi[CAMERA_STEPS];
+};
+
+static brickdata_t data;
+
+static void filter_roi(void* data);
+
+
+
+/*
+ * benchmark_bricks()
+ * Measures the retrieval of the bricks inside the region of interest
+ */
+void benchmark_bricks()
+{
+    bool must_load_brickset = !brickset_loaded();
+    v2d_t screen = video_get_screen_size();
+
+    if(must_load_brickset)
+        brickset_load(BRICKSET_PATH);
+
+    benchmark_seed(2);
+
+    /* scatter bricks of the brickset over the level */
+    data.manager = brickmanager_create();
+    for(int i = 0, n = brickset_size(); i < BRICK_COUNT && n > 0; i++) {
+        int id = benchmark_random(0, n - 1);
+        v2d_t position = v2d_new(benchmark_random(0, LEVEL_WIDTH - 1), benchmark_random(0, LEVEL_HEIGHT - 1));
+
+        if(brick_exists(id) && brick_behavior_preview(id) != BRB_MARKER)
+            brickmanager_add_brick(data.manager, brick_create(id, position, BRL_DEFAULT, BRF_NOFLIP));
+    }
+
+    /* sweep the camera across the level */
+    for(int i = 0; i < CAMERA_STEPS; i++) {
+        int x = (int)((LEVEL_WIDTH - screen.x) * i / (CAMERA_STEPS - 1));
+        int y = benchmark_random(0, LEVEL_HEIGHT - (int)screen.y);
+
+        data.roi[i] = rect_new(x - 128, y - 128, (int)screen.x + 256, (int)screen.y + 256);
+    }
+
+    /* measure */
+    benchmark_measure("brickmanager_active_bricks", CAMERA_STEPS, filter_roi, &data);
+
+    /* done */
+    data.manager = brickmanager_destroy(data.manager);
+    if(must_load_brickset)
+        brickset_unload();
+}
+
+
+
+/* private */
+
+/* moves the ROI and retrieves the active bricks */
+void filter_roi(void* ptr)
+{
+    brickdata_t* d = (brickdata_t*)ptr;
+    int count;
+
+    for(int i = 0; i < CAMERA_STEPS; i++) {
+        brickmanager_set_roi(d->manager, d->roi[i]);
+        brickmanager_active_bricks(d->manager, &count);
+    }
+}
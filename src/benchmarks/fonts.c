@@ -0,0 +1,140 @@
+/*
+ * Open Surge Engine
+ * fonts.c - microbenchmarks of the layout of text
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "benchmark.h"
+#include "../core/font.h"
+#include "../core/video.h"
+#include "../util/util.h"
+#include "../util/stringutil.h"
+#include "../util/v2d.h"
+
+/* thousands of texts, far more than a busy screen has, so that the text path dominates */
+#define INSTANCE_COUNT      2000
+#define WRAP_WIDTH          160 /* wordwrap, in pixels */
+
+/* the text has color tags, variables & arguments */
+static const char TEXT[] =
+    "<color=ffee11>Font %d</color> of $GAME_NAME, "
+    "built with $ENGINE_NAME $ENGINE_VERSION, now showing "
+    "<color=88ccff>word wrap</color>, <color=ff8080>nested <color=ffffff>color</color> tags</color> "
+    "and the arguments $1 and $2 at tick %d";
+
+/* the drivers to be measured */
+static const char* DRIVER[] = { "bmp", "ttf", "sdf" };
+#define DRIVER_COUNT ((int)(sizeof(DRIVER) / sizeof(DRIVER[0])))
+
+typedef struct fontdata_t fontdata_t;
+struct fontdata_t
+{
+    char* font_name[DRIVER_COUNT]; /* a font of each driver; NULL if there is none */
+    font_t* instance[INSTANCE_COUNT];
+    int tick; /* changes the text, so that it's laid out again */
+};
+
+static fontdata_t data;
+
+static void pick_font(const char* font_name, void* data);
+static void layout(void* data);
+static void render(void* data);
+
+
+
+/*
+ * benchmark_fonts()
+ * Measures the layout and the rendering of text with the drivers of the fonts
+ */
+void benchmark_fonts()
+{
+    font_foreach(&data, pick_font);
+
+    for(int j = 0; j < DRIVER_COUNT; j++) {
+        char name[64];
+
+        if(data.font_name[j] == NULL)
+            continue;
+
+        for(int i = 0; i < INSTANCE_COUNT; i++) {
+            data.instance[i] = font_create(data.font_name[j]);
+            font_set_width(data.instance[i], WRAP_WIDTH);
+            font_set_position(data.instance[i], v2d_new((i * 37) % VIDEO_SCREEN_W, (i * 53) % VIDEO_SCREEN_H));
+        }
+
+        snprintf(name, sizeof(name), "font_layout (%s)", DRIVER[j]);
+        benchmark_measure(name, INSTANCE_COUNT, layout, &data);
+
+        /* this measures the submission of the glyphs; the GPU works asynchronously */
+        snprintf(name, sizeof(name), "font_render (%s)", DRIVER[j]);
+        benchmark_measure(name, INSTANCE_COUNT, render, &data);
+
+        for(int i = 0; i < INSTANCE_COUNT; i++)
+            font_destroy(data.instance[i]);
+
+        free(data.font_name[j]);
+        data.font_name[j] = NULL;
+    }
+}
+
+
+
+/* private */
+
+/* picks the first font of each driver */
+void pick_font(const char* font_name, void* ptr)
+{
+    fontdata_t* d = (fontdata_t*)ptr;
+    font_t* probe = font_create(font_name);
+    const char* drv = font_get_driver(probe);
+
+    for(int i = 0; i < DRIVER_COUNT; i++) {
+        if(d->font_name[i] == NULL && strcmp(drv, DRIVER[i]) == 0) {
+            d->font_name[i] = str_dup(font_name);
+            break;
+        }
+    }
+
+    font_destroy(probe);
+}
+
+/* changes the text of the fonts and lays it out */
+void layout(void* ptr)
+{
+    fontdata_t* d = (fontdata_t*)ptr;
+    char argument[16];
+
+    snprintf(argument, sizeof(argument), "#%d", ++(d->tick));
+    for(int i = 0; i < INSTANCE_COUNT; i++) {
+        font_set_textarguments(d->instance[i], 2, argument, "@");
+        font_set_text(d->instance[i], TEXT, i, d->tick);
+        font_get_textsize(d->instance[i]); /* force the layout */
+    }
+}
+
+/* renders the fonts */
+void render(void* ptr)
+{
+    fontdata_t* d = (fontdata_t*)ptr;
+    v2d_t camera_position = v2d_multiply(video_get_screen_size(), 0.5f);
+
+    for(int i = 0; i < INSTANCE_COUNT; i++)
+        font_render(d->instance[i], camera_position);
+}
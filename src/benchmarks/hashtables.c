@@ -0,0 +1,309 @@
+/*
+ * Open Surge Engine
+ * hashtables.c - microbenchmarks of the hash tables
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "benchmark.h"
+#include "../core/asset.h"
+#include "../util/darray.h"
+#include "../util/util.h"
+#include "../util/stringutil.h"
+#include "../util/djb2.h"
+#include "../util/fasthash.h"
+#include "../util/dictionary.h"
+#include "../util/hashtable.h"
+
+/* about the number of entities of a busy level */
+#define ENTITY_COUNT        10000
+
+/* the directories scanned for the asset paths */
+static const char* ASSET_DIRECTORY[] = { "images", "sprites", "scripts", "levels", "samples", "musics", "fonts", "languages" };
+#define ASSET_DIRECTORY_COUNT ((int)(sizeof(ASSET_DIRECTORY) / sizeof(ASSET_DIRECTORY[0])))
+
+/* the values stored in the tables; they can't be NULL */
+typedef struct benchmarkvalue_t benchmarkvalue_t;
+struct benchmarkvalue_t { int dummy; };
+static benchmarkvalue_t value;
+
+HASHTABLE_GENERATE_CODE(benchmarkvalue_t, NULL);
+
+/* a key distribution. The same keys are given to
+   the integer-keyed and to the string-keyed tables */
+typedef struct keyset_t keyset_t;
+struct keyset_t
+{
+    const char* name;
+    DARRAY(uint64_t, key); /* keys of the integer-keyed tables */
+    DARRAY(uint64_t, missing_key); /* keys that are not in the tables */
+    DARRAY(char*, str); /* keys of the string-keyed tables */
+    DARRAY(char*, missing_str);
+    DARRAY(void*, value);
+
+    fasthash_t* fasthash;
+    hashtable_benchmarkvalue_t* hashtable;
+    dictionary_t* dictionary;
+};
+
+static void init_keyset(keyset_t* keyset, const char* name);
+static void release_keyset(keyset_t* keyset);
+static void add_key(keyset_t* keyset, uint64_t key, uint64_t missing_key);
+static int add_asset_path(const char* virtual_path, void* keyset);
+static void measure(keyset_t* keyset);
+static void put_keys(void* keyset);
+static void put_keys_in_bulk(void* keyset);
+static void get_keys(void* keyset);
+static void get_missing_keys(void* keyset);
+static void add_and_remove_strings_in_hashtable(void* keyset);
+static void find_strings_in_hashtable(void* keyset);
+static void find_missing_strings_in_hashtable(void* keyset);
+static void get_strings_from_dictionary(void* keyset);
+static void get_missing_strings_from_dictionary(void* keyset);
+
+
+
+/*
+ * benchmark_hashtables()
+ * Measures fasthash, HASHTABLE and dictionary on typical key distributions
+ */
+void benchmark_hashtables()
+{
+    keyset_t keyset;
+
+    benchmark_seed(4);
+
+    /* SurgeScript handles of the entities are small sequential integers */
+    init_keyset(&keyset, "handles");
+    for(int i = 0; i < ENTITY_COUNT; i++)
+        add_key(&keyset, 1 + i, 1 + i + ENTITY_COUNT);
+    measure(&keyset);
+    release_keyset(&keyset);
+
+    /* entity IDs are random 64-bit numbers */
+    init_keyset(&keyset, "ids");
+    for(int i = 0; i < ENTITY_COUNT; i++) {
+        uint64_t id = ((uint64_t)benchmark_random(0, 0x7FFFFFFF) << 32) | (uint64_t)benchmark_random(0, 0x7FFFFFFF);
+        uint64_t missing_id = ((uint64_t)benchmark_random(0, 0x7FFFFFFF) << 32) | (uint64_t)benchmark_random(0, 0x7FFFFFFF);
+        add_key(&keyset, id, missing_id);
+    }
+    measure(&keyset);
+    release_keyset(&keyset);
+
+    /* the assets are indexed by the hashes of their paths */
+    init_keyset(&keyset, "asset paths");
+    for(int i = 0; i < ASSET_DIRECTORY_COUNT; i++)
+        asset_foreach_file(ASSET_DIRECTORY[i], NULL, add_asset_path, &keyset, true);
+    measure(&keyset);
+    release_keyset(&keyset);
+}
+
+
+
+/* private */
+
+/* initializes a key distribution */
+void init_keyset(keyset_t* keyset, const char* name)
+{
+    keyset->name = name;
+    darray_init(keyset->key);
+    darray_init(keyset->missing_key);
+    darray_init(keyset->str);
+    darray_init(keyset->missing_str);
+    darray_init(keyset->value);
+
+    keyset->fasthash = NULL;
+    keyset->hashtable = NULL;
+    keyset->dictionary = NULL;
+}
+
+/* releases a key distribution */
+void release_keyset(keyset_t* keyset)
+{
+    for(int i = 0; i < darray_length(keyset->missing_str); i++)
+        free(keyset->missing_str[i]);
+
+    for(int i = 0; i < darray_length(keyset->str); i++)
+        free(keyset->str[i]);
+
+    darray_release(keyset->value);
+    darray_release(keyset->missing_str);
+    darray_release(keyset->str);
+    darray_release(keyset->missing_key);
+    darray_release(keyset->key);
+}
+
+/* adds an integer key to a key distribution */
+void add_key(keyset_t* keyset, uint64_t key, uint64_t missing_key)
+{
+    char buffer[32];
+
+    darray_push(keyset->key, key);
+    darray_push(keyset->missing_key, missing_key);
+    darray_push(keyset->value, &value);
+
+    snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)key);
+    darray_push(keyset->str, str_dup(buffer));
+
+    snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)missing_key);
+    darray_push(keyset->missing_str, str_dup(buffer));
+}
+
+/* adds the path of an asset to a key distribution. An asset_foreach_file() callback */
+int add_asset_path(const char* virtual_path, void* ptr)
+{
+    keyset_t* keyset = (keyset_t*)ptr;
+    char buffer[1024];
+
+    snprintf(buffer, sizeof(buffer), "%s~", virtual_path);
+
+    darray_push(keyset->key, djb2(virtual_path));
+    darray_push(keyset->missing_key, djb2(buffer));
+    darray_push(keyset->str, str_dup(virtual_path));
+    darray_push(keyset->missing_str, str_dup(buffer));
+    darray_push(keyset->value, &value);
+
+    return 0;
+}
+
+/* measures the tables on a key distribution */
+void measure(keyset_t* keyset)
+{
+    int n = darray_length(keyset->key);
+    char name[64];
+
+    #define MEASURE(benchmark_name, run) \
+        snprintf(name, sizeof(name), "%s (%s)", (benchmark_name), keyset->name); \
+        benchmark_measure(name, n, (run), keyset)
+
+    /* tables */
+    keyset->fasthash = fasthash_create(NULL, 10);
+    keyset->hashtable = hashtable_benchmarkvalue_t_create();
+    keyset->dictionary = dictionary_create(true, NULL, NULL);
+    for(int i = 0; i < n; i++) {
+        hashtable_benchmarkvalue_t_add(keyset->hashtable, keyset->str[i], &value);
+        dictionary_put(keyset->dictionary, keyset->str[i], &value);
+    }
+
+    /* integer keys */
+    MEASURE("fasthash_put", put_keys);
+    MEASURE("fasthash_put_many", put_keys_in_bulk);
+    MEASURE("fasthash_get", get_keys);
+    MEASURE("fasthash_get, missing", get_missing_keys);
+
+    /* string keys */
+    MEASURE("hashtable_add_remove", add_and_remove_strings_in_hashtable);
+    MEASURE("hashtable_find", find_strings_in_hashtable);
+    MEASURE("hashtable_find, missing", find_missing_strings_in_hashtable);
+    MEASURE("dictionary_get", get_strings_from_dictionary);
+    MEASURE("dictionary_get, missing", get_missing_strings_from_dictionary);
+
+    /* done */
+    keyset->dictionary = dictionary_destroy(keyset->dictionary);
+    keyset->hashtable = hashtable_benchmarkvalue_t_destroy(keyset->hashtable);
+    keyset->fasthash = fasthash_destroy(keyset->fasthash);
+
+    #undef MEASURE
+}
+
+/* puts the keys into an empty fasthash, one at a time */
+void put_keys(void* ptr)
+{
+    keyset_t* k = (keyset_t*)ptr;
+    int n = darray_length(k->key);
+
+    fasthash_delete_many(k->fasthash, k->key, n);
+    for(int i = 0; i < n; i++)
+        fasthash_put(k->fasthash, k->key[i], k->value[i]);
+}
+
+/* puts the keys into an empty fasthash, all at once */
+void put_keys_in_bulk(void* ptr)
+{
+    keyset_t* k = (keyset_t*)ptr;
+    int n = darray_length(k->key);
+
+    fasthash_delete_many(k->fasthash, k->key, n);
+    fasthash_put_many(k->fasthash, k->key, k->value, n);
+}
+
+/* looks up the keys in a fasthash */
+void get_keys(void* ptr)
+{
+    keyset_t* k = (keyset_t*)ptr;
+
+    for(int i = 0; i < darray_length(k->key); i++)
+        fasthash_get(k->fasthash, k->key[i]);
+}
+
+/* looks up keys that aren't in a fasthash */
+void get_missing_keys(void* ptr)
+{
+    keyset_t* k = (keyset_t*)ptr;
+
+    for(int i = 0; i < darray_length(k->missing_key); i++)
+        fasthash_get(k->fasthash, k->missing_key[i]);
+}
+
+/* removes the strings from a HASHTABLE and adds them back */
+void add_and_remove_strings_in_hashtable(void* ptr)
+{
+    keyset_t* k = (keyset_t*)ptr;
+
+    for(int i = 0; i < darray_length(k->str); i++)
+        hashtable_benchmarkvalue_t_remove(k->hashtable, k->str[i]);
+
+    for(int i = 0; i < darray_length(k->str); i++)
+        hashtable_benchmarkvalue_t_add(k->hashtable, k->str[i], &value);
+}
+
+/* looks up the strings in a HASHTABLE */
+void find_strings_in_hashtable(void* ptr)
+{
+    const keyset_t* k = (const keyset_t*)ptr;
+
+    for(int i = 0; i < darray_length(k->str); i++)
+        hashtable_benchmarkvalue_t_find(k->hashtable, k->str[i]);
+}
+
+/* looks up strings that aren't in a HASHTABLE */
+void find_missing_strings_in_hashtable(void* ptr)
+{
+    const keyset_t* k = (const keyset_t*)ptr;
+
+    for(int i = 0; i < darray_length(k->missing_str); i++)
+        hashtable_benchmarkvalue_t_find(k->hashtable, k->missing_str[i]);
+}
+
+/* looks up the strings in a dictionary */
+void get_strings_from_dictionary(void* ptr)
+{
+    const keyset_t* k = (const keyset_t*)ptr;
+
+    for(int i = 0; i < darray_length(k->str); i++)
+        dictionary_get(k->dictionary, k->str[i]);
+}
+
+/* looks up strings that aren't in a dictionary */
+void get_missing_strings_from_dictionary(void* ptr)
+{
+    const keyset_t* k = (const keyset_t*)ptr;
+
+    for(int i = 0; i < darray_length(k->missing_str); i++)
+        dictionary_get(k->dictionary, k->missing_str[i]);
+}
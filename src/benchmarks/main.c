@@ -0,0 +1,68 @@
+/*
+ * Open Surge Engine
+ * main.c - entry point of the microbenchmarks
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <allegro5/allegro.h> /* included for cross-platform compatibility; see src/main.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "benchmark.h"
+#include "../core/global.h"
+#include "../core/engine.h"
+#include "../core/commandline.h"
+
+/*
+ * main()
+ * Entry point of the microbenchmarks. Usage:
+ * benchmarks [--filter substring] [engine options]
+ */
+int main(int argc, char **argv)
+{
+    char** args = malloc((argc + 1) * sizeof(char*));
+    int count = 0;
+
+    /* our options; the others are given to the engine */
+    for(int i = 0; i < argc; i++) {
+        if(strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            benchmark_set_filter(argv[++i]);
+        else
+            args[count++] = argv[i];
+    }
+    args[count] = NULL;
+
+    /* initialize the engine without running the main loop */
+    commandline_t cmd = commandline_parse(count, args);
+    engine_init(&cmd);
+
+    /* run the benchmarks */
+    printf("%s %s microbenchmarks\n", GAME_TITLE, GAME_VERSION_STRING);
+    benchmark_physics();
+    benchmark_rendering();
+    benchmark_bricks();
+    benchmark_parsing();
+    benchmark_hashtables();
+    benchmark_fonts();
+
+    /* done */
+    engine_release();
+    benchmark_set_filter(NULL);
+    free(args);
+
+    return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * Open Surge Engine
+ * parsing.c - microbenchmarks of nanoparser and of the expression evaluator
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "benchmark.h"
+#include "../core/asset.h"
+#include "../core/nanoparser.h"
+#include "../entities/legacy/nanocalc/nanocalc.h"
+#include "../util/darray.h"
+#include "../util/util.h"
+#include "../util/stringutil.h"
+
+/* the scripts parsed by the benchmark; these are the real sprite scripts */
+#define SCRIPT_DIRECTORY    "sprites"
+#define SCRIPT_EXTENSION    ".spr"
+
+/* synthetic expressions of legacy objects */
+#define EXPRESSION_COUNT    1000
+#define EXPRESSION_LENGTH   256
+
+/* the directory of the cache of the parse trees, as set by the engine */
+#define CACHE_DIRECTORY     "cache/nanoparser"
+
+typedef struct parsingdata_t parsingdata_t;
+struct parsingdata_t
+{
+    DARRAY(char*, script); /* absolute paths */
+    symboltable_t* symbol_table;
+    expression_t* expression[EXPRESSION_COUNT];
+};
+
+static parsingdata_t data;
+
+static int add_script(const char* vpath, void* data);
+static void parse_scripts(void* data);
+static void evaluate_expressions(void* data);
+static void evaluate_expressions_in_batch(void* data);
+
+
+
+/*
+ * benchmark_parsing()
+ * Measures the parsing of scripts and the evaluation of expressions
+ */
+void benchmark_parsing()
+{
+    benchmark_seed(3);
+
+    /* scripts */
+    darray_init(data.script);
+    asset_foreach_file(SCRIPT_DIRECTORY, SCRIPT_EXTENSION, add_script, &data, true);
+
+    /* expressions */
+    data.symbol_table = symboltable_new();
+    symboltable_set(data.symbol_table, "$x", 128.0f);
+    symboltable_set(data.symbol_table, "$y", 64.0f);
+    symboltable_set(data.symbol_table, "$speed", 3.5f);
+    symboltable_set(data.symbol_table, "$t", 0.0f);
+
+    for(int i = 0; i < EXPRESSION_COUNT; i++) {
+        static const char* term[] = { "$x", "$y", "$speed", "$t", "2", "0.5", "cos($t)", "abs($x - $y)", "($x + 1)" };
+        static const char* op[] = { "+", "-", "*", ">=", "and" };
+        const int term_count = sizeof(term) / sizeof(*term);
+        const int op_count = sizeof(op) / sizeof(*op);
+        char buf[EXPRESSION_LENGTH];
+        int n;
+
+        /* assignments are common, e.g., $t = $t + 1 */
+        n = snprintf(buf, sizeof(buf), "%s%s", (i % 4 == 0) ? "$t = " : "", term[benchmark_random(0, term_count - 1)]);
+        for(int j = benchmark_random(1, 5); j > 0 && n < (int)sizeof(buf); j--)
+            n += snprintf(buf + n, sizeof(buf) - n, " %s %s", op[benchmark_random(0, op_count - 1)], term[benchmark_random(0, term_count - 1)]);
+
+        data.expression[i] = expression_new(buf, data.symbol_table);
+    }
+
+    /* measure */
+    nanoparser_set_cache_directory(NULL);
+    benchmark_measure("nanoparser_construct_tree", darray_length(data.script), parse_scripts, &data);
+    nanoparser_set_cache_directory(CACHE_DIRECTORY);
+    benchmark_measure("nanoparser_construct_tree (cached)", darray_length(data.script), parse_scripts, &data);
+    benchmark_measure("expression_evaluate", EXPRESSION_COUNT, evaluate_expressions, &data);
+    benchmark_measure("expression_evaluate_batch", EXPRESSION_COUNT, evaluate_expressions_in_batch, &data);
+
+    /* done */
+    for(int i = 0; i < EXPRESSION_COUNT; i++)
+        expression_destroy(data.expression[i]);
+    symboltable_destroy(data.symbol_table);
+
+    for(int i = 0; i < darray_length(data.script); i++)
+        free(data.script[i]);
+    darray_release(data.script);
+}
+
+
+
+/* private */
+
+/* adds a script to the list */
+int add_script(const char* vpath, void* ptr)
+{
+    parsingdata_t* d = (parsingdata_t*)ptr;
+    darray_push(d->script, str_dup(asset_path(vpath)));
+    return 0;
+}
+
+/* parses all scripts */
+void parse_scripts(void* ptr)
+{
+    const parsingdata_t* d = (const parsingdata_t*)ptr;
+
+    for(int i = 0; i < darray_length(d->script); i++) {
+        parsetree_program_t* tree = nanoparser_construct_tree(d->script[i]);
+        nanoparser_deconstruct_tree(tree);
+    }
+}
+
+/* evaluates all expressions, one at a time */
+void evaluate_expressions(void* ptr)
+{
+    const parsingdata_t* d = (const parsingdata_t*)ptr;
+
+    for(int i = 0; i < EXPRESSION_COUNT; i++)
+        expression_evaluate(d->expression[i]);
+}
+
+/* evaluates all expressions at once */
+void evaluate_expressions_in_batch(void* ptr)
+{
+    parsingdata_t* d = (parsingdata_t*)ptr;
+    float result[EXPRESSION_COUNT];
+
+    expression_evaluate_batch(d->expression, EXPRESSION_COUNT, result);
+}
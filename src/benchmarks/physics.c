@@ -0,0 +1,217 @@
+/*
+ * Open Surge Engine
+ * physics.c - microbenchmarks of the obstacle map and of the collision masks
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "benchmark.h"
+#include "../core/image.h"
+#include "../core/color.h"
+#include "../physics/collisionmask.h"
+#include "../physics/obstacle.h"
+#include "../physics/obstaclemap.h"
+#include "../physics/physicsactor.h"
+#include "../util/point2d.h"
+
+/* a synthetic level, sized like the large levels of the game */
+#define LEVEL_WIDTH         16384
+#define LEVEL_HEIGHT        4096
+#define OBSTACLE_COUNT      4000
+#define MASK_COUNT          16
+#define QUERY_COUNT         10000
+
+typedef struct sensorquery_t sensorquery_t;
+struct sensorquery_t
+{
+    int x1, y1, x2, y2;
+};
+
+typedef struct maskquery_t maskquery_t;
+struct maskquery_t
+{
+    const collisionmask_t* mask;
+    int x1, y1, x2, y2;
+};
+
+typedef struct physicsdata_t physicsdata_t;
+struct physicsdata_t
+{
+    collisionmask_t* mask[MASK_COUNT];
+    obstacle_t* obstacle[OBSTACLE_COUNT];
+    obstaclemap_t* obstaclemap;
+    sensorquery_t sensor[QUERY_COUNT];
+    maskquery_t mask_query[QUERY_COUNT];
+};
+
+static physicsdata_t data;
+
+static collisionmask_t* create_slope_mask(int width, int height, bool rising);
+static void build_obstaclemap(void* data);
+static void query_obstaclemap(void* data);
+static void query_obstaclemap_existence(void* data);
+static void locate_ground(void* data);
+static void test_areas(void* data);
+
+
+
+/*
+ * benchmark_physics()
+ * Measures the obstacle map and the collision masks
+ */
+void benchmark_physics()
+{
+    benchmark_seed(1);
+
+    /* collision masks: boxes and slopes of the sizes of typical bricks */
+    for(int i = 0; i < MASK_COUNT; i++) {
+        int width = 16 << (i % 4); /* 16 ... 128 */
+        int height = 16 << ((i / 4) % 3); /* 16 ... 64 */
+
+        if(i % 2 == 0)
+            data.mask[i] = collisionmask_create_box(width, height);
+        else
+            data.mask[i] = create_slope_mask(width, height, i % 4 == 1);
+    }
+
+    /* obstacles: the ground of a level and platforms scattered above it */
+    for(int i = 0; i < OBSTACLE_COUNT; i++) {
+        const collisionmask_t* mask = data.mask[benchmark_random(0, MASK_COUNT - 1)];
+        int x = benchmark_random(0, LEVEL_WIDTH - 1);
+        int y = (i % 2 == 0) ? LEVEL_HEIGHT - benchmark_random(64, 512) : benchmark_random(0, LEVEL_HEIGHT - 1);
+        int flags = (benchmark_random(0, 9) == 0) ? OF_CLOUD : 0;
+
+        data.obstacle[i] = obstacle_create(mask, point2d_new(x, y), OL_DEFAULT, flags);
+    }
+
+    /* the sensors of the physics actors */
+    for(int i = 0; i < QUERY_COUNT; i++) {
+        int x = benchmark_random(0, LEVEL_WIDTH - 1);
+        int y = benchmark_random(0, LEVEL_HEIGHT - 1);
+        bool is_vertical = (i % 2 == 0);
+
+        data.sensor[i].x1 = x;
+        data.sensor[i].y1 = y;
+        data.sensor[i].x2 = x + (is_vertical ? 1 : 20);
+        data.sensor[i].y2 = y + (is_vertical ? 20 : 1);
+    }
+
+    /* areas inside the collision masks */
+    for(int i = 0; i < QUERY_COUNT; i++) {
+        const collisionmask_t* mask = data.mask[benchmark_random(0, MASK_COUNT - 1)];
+        int w = collisionmask_width(mask), h = collisionmask_height(mask);
+        int x = benchmark_random(0, w - 1), y = benchmark_random(0, h - 1);
+
+        data.mask_query[i].mask = mask;
+        data.mask_query[i].x1 = x;
+        data.mask_query[i].y1 = y;
+        data.mask_query[i].x2 = x + benchmark_random(0, w - 1 - x);
+        data.mask_query[i].y2 = y + benchmark_random(0, h - 1 - y);
+    }
+
+    /* measure */
+    data.obstaclemap = obstaclemap_create();
+    benchmark_measure("obstaclemap_build", OBSTACLE_COUNT, build_obstaclemap, &data);
+    build_obstaclemap(&data);
+    benchmark_measure("obstaclemap_get_best_obstacle_at", QUERY_COUNT, query_obstaclemap, &data);
+    benchmark_measure("obstaclemap_obstacle_exists", QUERY_COUNT, query_obstaclemap_existence, &data);
+    benchmark_measure("collisionmask_locate_ground", QUERY_COUNT, locate_ground, &data);
+    benchmark_measure("collisionmask_area_test", QUERY_COUNT, test_areas, &data);
+
+    /* done */
+    data.obstaclemap = obstaclemap_destroy(data.obstaclemap);
+    for(int i = 0; i < OBSTACLE_COUNT; i++)
+        data.obstacle[i] = obstacle_destroy(data.obstacle[i]);
+    for(int i = 0; i < MASK_COUNT; i++)
+        data.mask[i] = collisionmask_destroy(data.mask[i]);
+}
+
+
+
+/* private */
+
+/* creates a collision mask of a slope */
+collisionmask_t* create_slope_mask(int width, int height, bool rising)
+{
+    image_t* image = image_create(width, height);
+    image_t* prev_target = image_drawing_target();
+
+    image_set_drawing_target(image);
+    image_clear(color_rgba(0, 0, 0, 0));
+    for(int x = 0; x < width; x++) {
+        int top = (rising ? width - 1 - x : x) * height / width;
+        image_line(x, top, x, height - 1, color_rgb(255, 255, 255));
+    }
+    image_set_drawing_target(prev_target);
+
+    collisionmask_t* mask = collisionmask_create(image, 0, 0, width, height, 0);
+    image_destroy(image);
+
+    return mask;
+}
+
+/* rebuilds the obstacle map */
+void build_obstaclemap(void* ptr)
+{
+    physicsdata_t* d = (physicsdata_t*)ptr;
+
+    obstaclemap_clear(d->obstaclemap);
+    for(int i = 0; i < OBSTACLE_COUNT; i++)
+        obstaclemap_add_static(d->obstaclemap, d->obstacle[i]);
+    obstaclemap_build(d->obstaclemap);
+}
+
+/* queries the obstacle map like the sensors of the physics actors do */
+void query_obstaclemap(void* ptr)
+{
+    const physicsdata_t* d = (const physicsdata_t*)ptr;
+
+    for(int i = 0; i < QUERY_COUNT; i++) {
+        const sensorquery_t* s = &(d->sensor[i]);
+        obstaclemap_get_best_obstacle_at(d->obstaclemap, s->x1, s->y1, s->x2, s->y2, MM_FLOOR, OL_DEFAULT);
+    }
+}
+
+/* checks if there are obstacles at points of the level */
+void query_obstaclemap_existence(void* ptr)
+{
+    const physicsdata_t* d = (const physicsdata_t*)ptr;
+
+    for(int i = 0; i < QUERY_COUNT; i++)
+        obstaclemap_obstacle_exists(d->obstaclemap, d->sensor[i].x1, d->sensor[i].y1, OL_DEFAULT);
+}
+
+/* locates the ground inside the collision masks */
+void locate_ground(void* ptr)
+{
+    const physicsdata_t* d = (const physicsdata_t*)ptr;
+
+    for(int i = 0; i < QUERY_COUNT; i++) {
+        const maskquery_t* q = &(d->mask_query[i]);
+        collisionmask_locate_ground(q->mask, q->x1, q->y1, (grounddir_t)(i % 4));
+    }
+}
+
+/* tests areas of the collision masks */
+void test_areas(void* ptr)
+{
+    const physicsdata_t* d = (const physicsdata_t*)ptr;
+
+    for(int i = 0; i < QUERY_COUNT; i++) {
+        const maskquery_t* q = &(d->mask_query[i]);
+        collisionmask_area_test(q->mask, q->x1, q->y1, q->x2, q->y2);
+    }
+}
@@ -0,0 +1,50 @@
+/*
+ * Open Surge Engine
+ * rendering.c - microbenchmarks of the render queue
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "benchmark.h"
+#include "../entities/renderqueue.h"
+
+/* about the number of entries enqueued per frame in a busy level */
+#define ENTRY_COUNT         3000
+
+static void sort(void* benchmark);
+
+
+
+/*
+ * benchmark_rendering()
+ * Measures the sorting of the render queue
+ */
+void benchmark_rendering()
+{
+    renderqueue_benchmark_t* benchmark = renderqueue_benchmark_create(ENTRY_COUNT);
+    benchmark_measure("renderqueue_sort", ENTRY_COUNT, sort, benchmark);
+    renderqueue_benchmark_destroy(benchmark);
+}
+
+
+
+/* private */
+
+/* sorts the entries of the render queue */
+void sort(void* benchmark)
+{
+    renderqueue_benchmark_sort((renderqueue_benchmark_t*)benchmark);
+}
@@ -356,6 +356,16 @@ const char* const* animation_user_property(const animation_t* anim, const char*
     return spriteinfo_user_property(anim->sprite, name);
 }
 
+/*
+ * animation_user_property_atom()
+ * Get a NULL-terminated array with the element(s) of a user-defined custom property,
+ * or NULL if no property with the given name exists. The name is given as an atom
+ */
+const char* const* animation_user_property_atom(const animation_t* anim, atom_t name)
+{
+    return spriteinfo_user_property_atom(anim->sprite, name);
+}
+
 
 
 
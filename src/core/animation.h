@@ -23,6 +23,7 @@
 
 #include <stdbool.h>
 #include "../util/v2d.h"
+#include "../util/atom.h"
 
 /* opaque type */
 typedef struct animation_t animation_t;
@@ -108,4 +109,7 @@ float animation_interpolated_opacity(const animation_t* anim, double seconds);
 /* gets a NULL-terminated array with the element(s) of a user-defined custom property, or NULL if no property with the given name exists */
 const char* const* animation_user_property(const animation_t* anim, const char* name);
 
+/* same as animation_user_property(), but the name is given as an atom (see atom_intern) */
+const char* const* animation_user_property_atom(const animation_t* anim, atom_t name);
+
 #endif
\ No newline at end of file
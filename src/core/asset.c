@@ -24,6 +24,7 @@
 #include <physfs.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <time.h>
 #include "asset.h"
 #include "modutils.h"
@@ -32,6 +33,9 @@
 #include "config.h"
 #include "../util/util.h"
 #include "../util/stringutil.h"
+#include "../util/fasthash.h"
+#include "../util/djb2.h"
+#include "../util/darray.h"
 #include "../third_party/ignorecase.h"
 
 /* The default directory of the game assets provided by upstream (*nix only) */
@@ -62,6 +66,17 @@
 #endif
 
 /* Utility macros */
+/* memory-mapped archives */
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP                       1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#define HAVE_MMAP                       0
+#endif
+
 #define ENVIRONMENT_VARIABLE_NAME       "OPENSURGE_USER_PATH"
 #define ASSET_PATH_MAX                  4096
 #define PHYSFSx_getLastErrorMessage()   PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode())
@@ -80,6 +95,35 @@ static char* gamedir = NULL; /* custom asset folder specified by the user */
 static char* writedir = NULL;
 
 static ALLEGRO_STATE state;
+
+/* an index of the files of the virtual filesystem, built at initialization.
+   We use it to fix the case of virtual paths without scanning directories */
+typedef struct assetindexentry_t assetindexentry_t;
+struct assetindexentry_t {
+    char* path; /* actual virtual path */
+    assetindexentry_t* next; /* entries whose lowercase paths have the same hash */
+};
+static fasthash_t* file_index = NULL;
+
+/* a cache of the results of the validation of compressed gamedirs, so that we
+   don't mount the same archives over and over again. Entries are keyed by the
+   hash of the path and are invalidated when the archive is modified */
+typedef struct gamedircacheentry_t gamedircacheentry_t;
+struct gamedircacheentry_t {
+    char* fullpath;
+    time_t mtime;
+    off_t size;
+    bool is_valid;
+    bool is_legacy;
+};
+static fasthash_t* gamedir_cache = NULL;
+static void destroy_gamedir_cache_entry(void* entry);
+static void build_file_index();
+static void release_file_index();
+static int index_file(const char* virtual_path, void* user_data);
+static const char* find_in_file_index(const char* virtual_path);
+static uint64_t hash_ignoring_case(const char* path);
+static void destroy_file_index_entries(void* entry);
 static ALLEGRO_PATH* find_exedir();
 static ALLEGRO_PATH* find_homedir();
 static ALLEGRO_PATH* find_shared_datadir();
@@ -101,7 +145,22 @@ static bool is_writable_folder(const char* absolute_path);
 
 static ALLEGRO_PATH* create_path_at_cache(const char* filename, const char* dirpath);
 static bool clear_cached_games();
-static bool clear_cached_files(const char* folder_name, time_t time_to_live);
+static bool clear_cached_files(const char* folder_name, time_t time_to_live, off_t max_size, const char* file_in_use);
+static void start_cache_maintenance();
+static void finish_cache_maintenance();
+static void* cache_maintenance_thread(ALLEGRO_THREAD* thread, void* arg);
+static ALLEGRO_THREAD* cache_maintenance = NULL;
+static char* cache_file_in_use = NULL; /* a copy of gamedir, which must not be evicted from the cache */
+
+/* an entry of the application cache that is subject to eviction */
+typedef struct cachedfile_t cachedfile_t;
+struct cachedfile_t {
+    char* fullpath;
+    time_t last_access;
+    off_t size;
+};
+static void list_cached_files(ALLEGRO_FS_ENTRY* entry, cachedfile_t** list, size_t* list_len, size_t* list_cap);
+static int compare_cached_files(const void* a, const void* b);
 
 static bool is_uncompressed_gamedir(const char* fullpath, bool* is_legacy_gamedir);
 static bool is_compressed_gamedir(const char* fullpath, bool* is_legacy_gamedir);
@@ -115,6 +174,8 @@ static int append_translations(const char* vpath, void* context);
 static size_t crlf_to_lf(uint8_t* data, size_t size);
 
 static bool has_pak_support();
+static bool mount_mapped_archive(const char* fullpath, const char* mount_point);
+static void unmap_archive(void* data);
 bool generate_pak_file(const char** vpath, int file_count, const void** file_data, const size_t* file_size, void** out_pak_data, size_t* out_pak_size);
 void release_pak_file(void* pak);
 
@@ -189,10 +250,14 @@ void asset_init(const char* argv0, const char* optional_gamedir, const char* com
         /* Get the name of the folder of the game */
         find_gamedirname(gamedir, game_dirname, sizeof(game_dirname));
 
-        /* mount gamedir to the root */
-        if(!PHYSFS_mount(gamedir, "/", 1))
+        /* mount gamedir to the root. Compressed archives are memory-mapped
+           if possible, so that reading an asset doesn't need a syscall */
+        if(!(mode & ALLEGRO_FILEMODE_ISDIR) && mount_mapped_archive(gamedir, "/"))
+            LOG("Mounting memory-mapped gamedir: %s", gamedir);
+        else if(PHYSFS_mount(gamedir, "/", 1))
+            LOG("Mounting gamedir: %s", gamedir);
+        else
             CRASH("Can't mount the game directory at %s. Error: %s", gamedir, PHYSFSx_getLastErrorMessage());
-        LOG("Mounting gamedir: %s", gamedir);
 
         /* if gamedir is a compressed archive, do we need to change the root? */
         if(!(mode & ALLEGRO_FILEMODE_ISDIR)) {
@@ -435,8 +500,11 @@ void asset_init(const char* argv0, const char* optional_gamedir, const char* com
     if(out_compatibility_version_code != NULL)
         *out_compatibility_version_code = compatibility_version_code;
 
-    /* clear cached games */
-    clear_cached_games();
+    /* clear cached games in the background */
+    start_cache_maintenance();
+
+    /* index the virtual filesystem */
+    build_file_index();
 
     /* enable the physfs file interface. This should be the last task
        performed in this function (e.g., see create_dir()) */
@@ -477,6 +545,16 @@ void asset_release()
     /* release the settings of the configuration file */
     config_release();
 
+    /* release the index of the virtual filesystem */
+    release_file_index();
+
+    /* wait for the maintenance of the application cache */
+    finish_cache_maintenance();
+
+    /* release the cache of validated gamedirs */
+    if(gamedir_cache != NULL)
+        gamedir_cache = fasthash_destroy(gamedir_cache);
+
     /* restore the previous I/O backend */
     al_restore_state(&state);
 
@@ -1063,6 +1141,11 @@ const char* case_insensitive_fix(const char* virtual_path)
 {
     static char buffer[ASSET_PATH_MAX];
 
+    /* look it up in the index. Files created after the index has been built
+       are written with their own case, which PHYSFS_exists() can find */
+    if(file_index != NULL)
+        return find_in_file_index(virtual_path);
+
     assertx(strlen(virtual_path) < sizeof(buffer)); /* really?! */
     str_cpy(buffer, virtual_path, sizeof(buffer));
 
@@ -1072,6 +1155,118 @@ const char* case_insensitive_fix(const char* virtual_path)
         return NULL;
 }
 
+/*
+ * build_file_index()
+ * Index the files of the virtual filesystem by their lowercase paths
+ */
+void build_file_index()
+{
+    int count = 0;
+
+    release_file_index();
+    file_index = fasthash_create(destroy_file_index_entries, 12);
+
+    ALLEGRO_PATH* root = al_create_path_for_directory("/");
+    foreach_file(root, NULL, index_file, &count, true);
+    al_destroy_path(root);
+
+    LOG("Indexed %d files", count);
+}
+
+/*
+ * release_file_index()
+ * Release the index of the virtual filesystem
+ */
+void release_file_index()
+{
+    if(file_index != NULL)
+        file_index = fasthash_destroy(file_index);
+}
+
+/*
+ * index_file()
+ * Add a file to the index of the virtual filesystem
+ */
+int index_file(const char* virtual_path, void* user_data)
+{
+    int* count = (int*)user_data;
+
+    while(*virtual_path == '/')
+        virtual_path++;
+
+    uint64_t key = hash_ignoring_case(virtual_path);
+    assetindexentry_t* head = fasthash_get(file_index, key);
+    assetindexentry_t* entry = mallocx(sizeof *entry);
+
+    entry->path = str_dup(virtual_path);
+    entry->next = NULL;
+
+    /* keep the entries of the same key in the order of enumeration */
+    if(head != NULL) {
+        assetindexentry_t* tail = head;
+        while(tail->next != NULL)
+            tail = tail->next;
+        tail->next = entry;
+    }
+    else
+        fasthash_put(file_index, key, entry);
+
+    (*count)++;
+    return 0;
+}
+
+/*
+ * find_in_file_index()
+ * Find the actual path of a file of the index, ignoring the case.
+ * Returns NULL if there is no such file
+ */
+const char* find_in_file_index(const char* virtual_path)
+{
+    while(*virtual_path == '/')
+        virtual_path++;
+
+    uint64_t key = hash_ignoring_case(virtual_path);
+    for(assetindexentry_t* entry = fasthash_get(file_index, key); entry != NULL; entry = entry->next) {
+        if(str_icmp(entry->path, virtual_path) == 0) {
+            /* the file may have been removed after we built the index */
+            return PHYSFS_exists(entry->path) ? entry->path : NULL;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * hash_ignoring_case()
+ * djb2 hash of the lowercase version of a path
+ */
+uint64_t hash_ignoring_case(const char* path)
+{
+    uint64_t hash = 5381;
+    int c;
+
+    while((c = *((const unsigned char*)(path++))))
+        hash = ((hash << 5) + hash) + tolower(c);
+
+    return hash;
+}
+
+/*
+ * destroy_file_index_entries()
+ * Destroy the entries of the index that share the same key
+ */
+void destroy_file_index_entries(void* entry)
+{
+    assetindexentry_t* e = (assetindexentry_t*)entry;
+
+    while(e != NULL) {
+        assetindexentry_t* next = e->next;
+        free(e->path);
+        free(e);
+        e = next;
+    }
+}
+
 /*
  * foreach_file()
  * Enumerate files with an optional extension filter and a callback
@@ -1257,6 +1452,56 @@ bool is_writable_folder(const char* absolute_path)
     return is_writable;
 }
 
+/*
+ * list_cached_files()
+ * Recursively list the regular files of a directory of the application cache
+ */
+void list_cached_files(ALLEGRO_FS_ENTRY* entry, cachedfile_t** list, size_t* list_len, size_t* list_cap)
+{
+    ALLEGRO_FS_ENTRY* next;
+
+    if(!al_open_directory(entry))
+        return;
+
+    while(NULL != (next = al_read_directory(entry))) {
+        uint32_t mode = al_get_fs_entry_mode(next);
+
+        if(mode & ALLEGRO_FILEMODE_ISDIR) {
+            list_cached_files(next, list, list_len, list_cap);
+        }
+        else {
+            cachedfile_t file = {
+                .fullpath = str_dup(al_get_fs_entry_name(next)),
+                .last_access = al_get_fs_entry_atime(next),
+                .size = al_get_fs_entry_size(next)
+            };
+
+            if(*list_len >= *list_cap) {
+                *list_cap = (*list_cap > 0) ? 2 * (*list_cap) : 16;
+                *list = reallocx(*list, *list_cap * sizeof(cachedfile_t));
+            }
+
+            (*list)[(*list_len)++] = file;
+        }
+
+        al_destroy_fs_entry(next);
+    }
+
+    al_close_directory(entry);
+}
+
+/*
+ * compare_cached_files()
+ * Sort cached files by their last access time, least recently used first
+ */
+int compare_cached_files(const void* a, const void* b)
+{
+    const cachedfile_t* x = (const cachedfile_t*)a;
+    const cachedfile_t* y = (const cachedfile_t*)b;
+
+    return (x->last_access > y->last_access) - (x->last_access < y->last_access);
+}
+
 /*
  * create_path_at_cache()
  * Generate the absolute path to a file stored in the application cache.
@@ -1302,26 +1547,81 @@ ALLEGRO_PATH* create_path_at_cache(const char* filename, const char* dirpath)
     return cache;
 }
 
+/*
+ * start_cache_maintenance()
+ * Clear the application cache in a background thread, so that it doesn't block
+ * the initialization. If the thread can't be created, clear it right away
+ */
+void start_cache_maintenance()
+{
+    assertx(cache_maintenance == NULL);
+    cache_file_in_use = (gamedir != NULL) ? str_dup(gamedir) : NULL;
+
+    if(NULL == (cache_maintenance = al_create_thread(cache_maintenance_thread, NULL))) {
+        LOG("Can't create the cache maintenance thread");
+        cache_maintenance_thread(NULL, NULL);
+        return;
+    }
+
+    al_start_thread(cache_maintenance);
+}
+
+/*
+ * finish_cache_maintenance()
+ * Wait for the maintenance of the application cache
+ */
+void finish_cache_maintenance()
+{
+    if(cache_maintenance != NULL) {
+        al_join_thread(cache_maintenance, NULL);
+        al_destroy_thread(cache_maintenance);
+        cache_maintenance = NULL;
+    }
+
+    if(cache_file_in_use != NULL) {
+        free(cache_file_in_use);
+        cache_file_in_use = NULL;
+    }
+}
+
+/*
+ * cache_maintenance_thread()
+ * The thread that maintains the application cache
+ */
+void* cache_maintenance_thread(ALLEGRO_THREAD* thread, void* arg)
+{
+    (void)thread;
+    (void)arg;
+
+    clear_cached_games();
+    return NULL;
+}
+
 /*
  * clear_cached_games()
  * Clear games that have not been accessed lately from the application cache.
- * Return true on success.
+ * If the cached games take too much space, the least recently used are removed
+ * as well. Return true on success.
  */
 bool clear_cached_games()
 {
     const time_t MAX_DAYS = 3;
     const time_t SECONDS_IN_A_DAY = 86400;
     const time_t TIME_TO_LIVE = MAX_DAYS * SECONDS_IN_A_DAY;
+    const off_t MAX_SIZE = (off_t)512 * 1024 * 1024; /* in bytes */
 
-    return clear_cached_files("games", TIME_TO_LIVE);
+    return clear_cached_files("games", TIME_TO_LIVE, MAX_SIZE, cache_file_in_use);
 }
 
 /*
  * clear_cached_files()
  * Clear all files from a sub-folder of the application cache directory that
- * have not been accessed for time_to_live seconds. Return true on success.
+ * have not been accessed for time_to_live seconds. If the remaining files take
+ * more than max_size bytes, the least recently used files are cleared until
+ * they don't. file_in_use, an absolute path that may be NULL, is never cleared
+ * by the size policy. Return true on success.
  */
-bool clear_cached_files(const char* folder_name, time_t time_to_live)
+bool clear_cached_files(const char* folder_name, time_t time_to_live, off_t max_size, const char* file_in_use)
 {
 #if HAVE_CACHE_DIR
 
@@ -1348,6 +1648,34 @@ bool clear_cached_files(const char* folder_name, time_t time_to_live)
     if(al_fs_entry_exists(entry)) {
         LOG("Clearing cached files at %s/...", folder_name);
         clear_dir_ex(entry, &n, clear_dir_predicate_coldfile, &time_to_live);
+
+        /* enforce the size limit, evicting the least recently used files first */
+        DARRAY(cachedfile_t, file);
+        off_t total_size = 0;
+
+        darray_init(file);
+        list_cached_files(entry, &file, &file_len, &file_cap);
+        qsort(file, darray_length(file), sizeof(cachedfile_t), compare_cached_files);
+
+        for(int i = 0; i < darray_length(file); i++)
+            total_size += file[i].size;
+
+        for(int i = 0; i < darray_length(file) && total_size > max_size; i++) {
+            if(file_in_use != NULL && 0 == strcmp(file[i].fullpath, file_in_use))
+                continue;
+
+            if(!al_remove_filename(file[i].fullpath)) {
+                WARN("Can't remove %s. %s. errno = %d", file[i].fullpath, strerror(al_get_errno()), al_get_errno());
+                continue;
+            }
+
+            total_size -= file[i].size;
+            n++;
+        }
+
+        for(int i = 0; i < darray_length(file); i++)
+            free(file[i].fullpath);
+        darray_release(file);
     }
 
     if(n > 0)
@@ -1374,6 +1702,10 @@ bool clear_cached_files(const char* folder_name, time_t time_to_live)
 
     (void)folder_name;
     (void)time_to_live;
+    (void)max_size;
+    (void)file_in_use;
+    (void)list_cached_files;
+    (void)compare_cached_files;
 
     LOG("%s: unsupported", __func__);
 
@@ -1414,6 +1746,24 @@ bool is_compressed_gamedir(const char* fullpath, bool* is_legacy_gamedir)
 
     assertx(PHYSFS_isInit());
 
+    /* have we validated this archive before? */
+    ALLEGRO_FS_ENTRY* e = al_create_fs_entry(fullpath);
+    time_t mtime = al_get_fs_entry_mtime(e);
+    off_t size = al_get_fs_entry_size(e);
+    uint64_t key = djb2(fullpath);
+    al_destroy_fs_entry(e);
+
+    if(gamedir_cache == NULL)
+        gamedir_cache = fasthash_create(destroy_gamedir_cache_entry, 6);
+
+    gamedircacheentry_t* entry = fasthash_get(gamedir_cache, key);
+    if(entry != NULL && entry->mtime == mtime && entry->size == size && 0 == strcmp(entry->fullpath, fullpath)) {
+        if(is_legacy_gamedir != NULL)
+            *is_legacy_gamedir = entry->is_legacy;
+
+        return entry->is_valid;
+    }
+
     if(!PHYSFS_mount(fullpath, PREFIX, 0)) {
         const char* err = PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode());
         logfile_message("%s: can't mount %s. %s", __func__, fullpath, err);
@@ -1424,16 +1774,40 @@ bool is_compressed_gamedir(const char* fullpath, bool* is_legacy_gamedir)
     find_root_directory(PREFIX, root + PREFIX_SIZE, sizeof(root) - PREFIX_SIZE);
     LOG("%s: testing %s", __func__, root + PREFIX_SIZE);
 
-    ret = is_gamedir(root, virtual_file_exists, NULL, '/', is_legacy_gamedir);
+    bool is_legacy = false;
+    ret = is_gamedir(root, virtual_file_exists, NULL, '/', &is_legacy);
+    if(is_legacy_gamedir != NULL)
+        *is_legacy_gamedir = is_legacy;
 
     if(!PHYSFS_unmount(fullpath)) {
         const char* err = PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode());
         logfile_message("%s: can't unmount %s. %s", __func__, fullpath, err);
     }
 
+    /* cache the result */
+    entry = mallocx(sizeof *entry);
+    entry->fullpath = str_dup(fullpath);
+    entry->mtime = mtime;
+    entry->size = size;
+    entry->is_valid = ret;
+    entry->is_legacy = is_legacy;
+    fasthash_put(gamedir_cache, key, entry); /* replaces any previous entry */
+
     return ret;
 }
 
+/*
+ * destroy_gamedir_cache_entry()
+ * Destroys an entry of the cache of validated gamedirs
+ */
+void destroy_gamedir_cache_entry(void* entry)
+{
+    gamedircacheentry_t* e = (gamedircacheentry_t*)entry;
+
+    free(e->fullpath);
+    free(e);
+}
+
 /*
  * is_gamedir()
  * A helper to check if a generic root folder stores an opensurge game
@@ -1836,6 +2210,84 @@ bool has_pak_support()
     return false;
 }
 
+/*
+ * mount_mapped_archive()
+ * Map an archive into memory and mount it, appending it to the search path.
+ * The archive is identified by fullpath in the search path, just as if it
+ * were mounted with PHYSFS_mount(). Returns false if it can't be mapped
+ */
+bool mount_mapped_archive(const char* fullpath, const char* mount_point)
+{
+#if HAVE_MMAP
+    /* the size of the mapping is stored before the data we pass to physfs,
+       so that we can unmap it in the callback. The header keeps the data
+       aligned to the page */
+    const size_t HEADER_SIZE = (size_t)sysconf(_SC_PAGESIZE);
+    struct stat st;
+    int fd;
+
+    if((fd = open(fullpath, O_RDONLY)) < 0)
+        return false;
+
+    if(fstat(fd, &st) != 0 || st.st_size <= 0 || HEADER_SIZE < sizeof(size_t)) {
+        close(fd);
+        return false;
+    }
+
+    size_t file_size = (size_t)st.st_size;
+    size_t map_size = HEADER_SIZE + file_size;
+
+    /* reserve an anonymous header page followed by the file */
+    uint8_t* map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(map == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    if(mmap(map + HEADER_SIZE, file_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(map, map_size);
+        close(fd);
+        return false;
+    }
+
+    /* the mapping stays valid after closing the file */
+    close(fd);
+    memcpy(map, &map_size, sizeof(size_t));
+
+    /* the archive is read sequentially when building the index */
+    madvise(map + HEADER_SIZE, file_size, MADV_WILLNEED);
+
+    /* mount */
+    if(!PHYSFS_mountMemory(map + HEADER_SIZE, file_size, unmap_archive, fullpath, mount_point, 1)) {
+        LOG("Can't mount memory-mapped archive %s. Error: %s", fullpath, PHYSFSx_getLastErrorMessage());
+        munmap(map, map_size);
+        return false;
+    }
+
+    return true;
+#else
+    (void)unmap_archive;
+    return false;
+#endif
+}
+
+/*
+ * unmap_archive()
+ * Called by physfs when a memory-mapped archive is unmounted
+ */
+void unmap_archive(void* data)
+{
+#if HAVE_MMAP
+    size_t map_size;
+    uint8_t* header = (uint8_t*)data - (size_t)sysconf(_SC_PAGESIZE);
+
+    memcpy(&map_size, header, sizeof(size_t));
+    munmap(header, map_size);
+#else
+    (void)data;
+#endif
+}
+
 /*
  * generate_pak_file()
  * Generate a .pak archive with files stored in memory.
@@ -19,51 +19,230 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include "audio.h"
 #include "asset.h"
 #include "resourcemanager.h"
 #include "logfile.h"
 #include "timer.h"
 #include "video.h"
+#include "nanoparser.h"
 #include "../util/util.h"
 #include "../util/stringutil.h"
+#include "../util/darray.h"
 
 #define ALLEGRO_UNSTABLE
 #include <allegro5/allegro.h>
 #include <allegro5/allegro_audio.h>
 #include <allegro5/allegro_acodec.h>
+#include <allegro5/allegro_physfs.h>
 
 /* music structure */
 struct music_t {
-    ALLEGRO_AUDIO_STREAM* stream;
+    ALLEGRO_AUDIO_STREAM* stream; /* NULL if not opened yet */
     bool is_paused;
+    float volume; /* 0: silence; 1: default */
     char* filepath; /* relative path */
+
+    /* deferred opening */
+    bool is_opening; /* has the music been sent to the decoder? */
+    bool wants_to_play; /* play as soon as the stream is opened */
+    bool loop; /* playmode of the pending play */
 };
 
 /* sound structure */
 struct sound_t {
-    ALLEGRO_SAMPLE* sample;
-    ALLEGRO_SAMPLE_ID id;
-    bool valid_id;
+    ALLEGRO_SAMPLE* sample; /* NULL if not decoded yet */
+    bool has_voice; /* has the sample been sent to the mixer thread? */
+    unsigned play_frame; /* the frame of the latest play */
+    size_t original_bytes; /* size of the data of the sample before it was compacted; 0 if it wasn't */
     float duration;
     float end_time;
     float volume; /* 0: silence; 1: default */
+    float pan; /* pan of the latest play */
     char* filepath; /* relative path */
+
+    /* positional audio */
+    unsigned mix_frame; /* the frame of the latest mix of its audio sources */
+    float mix_volume, mix_pan; /* the loudest audio source in that frame */
+    bool is_mixed; /* has the mix been applied? */
+
+    /* deferred decoding */
+    bool is_decoding; /* has the sample been sent to the decoder? */
+    bool wants_to_play; /* play as soon as the sample is decoded */
+    float pending_pan, pending_freq; /* parameters of the pending play */
+    float play_request_time; /* when the pending play was requested */
 };
 
 /* private stuff */
-static const int PREFERRED_NUMBER_OF_SAMPLES = 16; /* how many samples can be played at the same time */
+#define MAX_VOICES 16
+static const int PREFERRED_NUMBER_OF_SAMPLES = MAX_VOICES; /* how many samples can be played at the same time */
 
 static music_t *current_music = NULL; /* music being played at the moment (NULL if none) */
 static float master_volume = 1.0f; /* a value in [0,1] affecting all musics and sounds */
 static bool globally_muted = false; /* global mute / unmute */
 
 static int preload_sample(const char* vpath, void* data);
+static int read_preload_manifest(const parsetree_statement_t* stmt);
 static void set_global_gain(float gain);
+static sound_t* load_sound(const char* path, bool defer_decoding);
+
+/* crossfading musics */
+static struct {
+    music_t* music; /* the music that is fading out; NULL if none */
+    float gain; /* its gain when the fade started */
+    float time, duration; /* in seconds */
+} fadeout = { .music = NULL };
+
+static struct {
+    float time, duration; /* fade in of the current music; no fade if duration is zero */
+} fadein = { .duration = 0.0f };
+
+static void start_music(music_t* music, bool loop);
+static void start_music_stream(music_t* music);
+static void attach_music_stream(music_t* music, ALLEGRO_AUDIO_STREAM* stream);
+static void open_music_later(music_t* music);
+static void stop_fadeout();
+static void update_fades(float dt);
+static float music_gain(const music_t* music);
+
+/* deferred decoding: if the game lists the samples that should be preloaded
+   in a manifest, then the other samples are decoded in a background thread
+   when they are first played. The music streams are always opened in the
+   background thread, if available */
+typedef struct pendingsample_t pendingsample_t;
+struct pendingsample_t {
+    char* path; /* relative path */
+    char* fullpath;
+    bool is_music; /* open a stream instead of decoding a sample */
+    bool compact; /* compact the decoded sample */
+};
+
+typedef struct decodedsample_t decodedsample_t;
+struct decodedsample_t {
+    char* path; /* relative path */
+    ALLEGRO_SAMPLE* sample; /* NULL on error */
+    ALLEGRO_AUDIO_STREAM* stream; /* NULL on error; used if is_music is set */
+    bool is_music;
+    size_t original_bytes; /* size of the sample before it was compacted; 0 if it wasn't */
+};
+
+static struct {
+    ALLEGRO_THREAD* thread; /* NULL if the decoder isn't available */
+    bool defer_samples; /* is deferred decoding of samples enabled? */
+    ALLEGRO_MUTEX* mutex;
+    ALLEGRO_COND* job_available; /* signaled when a path is pushed to pending */
+    DARRAY(pendingsample_t, pending); /* samples to be decoded; access with the mutex locked */
+    DARRAY(decodedsample_t, decoded); /* decoded samples to be picked by the main thread; access with the mutex locked */
+    bool quit;
+} decoder = { .thread = NULL, .defer_samples = false };
+
+static const char PRELOAD_MANIFEST[] = "samples/preload.lst"; /* lists the samples that should be preloaded */
+static const float MAX_PLAY_DELAY = 0.25f; /* in seconds; a sample decoded later than that after it was played will not be played */
+
+static bool start_decoder();
+static void stop_decoder();
+static void decode_later(sound_t* sample);
+static void pick_decoded_samples();
+static void* decoder_thread(ALLEGRO_THREAD* thread, void* arg);
+
+/* sample compaction policy: in low memory settings, the decoded samples are
+   converted to 16-bit mono and resampled down. A game may exempt specific
+   samples with the keep statement of the preload manifest */
+#define COMPACT_MAX_FREQUENCY 24000 /* samples above this frequency are halved */
+static bool compact_samples = false; /* is the compaction enabled? */
+STATIC_DARRAY(char*, kept_samples); /* relative paths of the samples that must not be compacted */
+static bool wants_compaction(const char* path);
+static int read_kept_samples(const parsetree_statement_t* stmt);
+static ALLEGRO_SAMPLE* compact_sample(ALLEGRO_SAMPLE* sample);
+static float read_sample_value(const void* data, ALLEGRO_AUDIO_DEPTH depth, size_t index);
+static size_t sample_bytes(const ALLEGRO_SAMPLE* sample);
+
+/* mixer thread: the game thread doesn't play samples directly. It pushes
+   commands to a lock-free single-producer, single-consumer ring buffer
+   that is consumed by the mixer thread, which owns the voices */
+#define COMMAND_QUEUE_SIZE 256 /* a power of two */
+#define MAX_INSTANCES_PER_SAMPLE 3 /* how many instances of the same sample can be played at the same time */
+
+typedef enum audiocommandtype_t audiocommandtype_t;
+enum audiocommandtype_t {
+    AUDIOCOMMAND_PLAY,
+    AUDIOCOMMAND_STOP,
+    AUDIOCOMMAND_SETGAIN,
+    AUDIOCOMMAND_DESTROY
+};
+
+typedef struct audiocommand_t audiocommand_t;
+struct audiocommand_t {
+    audiocommandtype_t type;
+    sound_t* sound; /* the mixer thread only reads it in AUDIOCOMMAND_DESTROY */
+    ALLEGRO_SAMPLE* sample; /* AUDIOCOMMAND_PLAY */
+    float duration; /* AUDIOCOMMAND_PLAY */
+    float volume, pan, freq;
+};
+
+typedef struct voice_t voice_t;
+struct voice_t {
+    const sound_t* sound; /* NULL if the voice is free */
+    ALLEGRO_SAMPLE_ID id;
+    double start_time;
+    double end_time;
+};
+
+static struct {
+    ALLEGRO_THREAD* thread; /* NULL if the commands run in the game thread */
+    ALLEGRO_MUTEX* mutex;
+    ALLEGRO_COND* wakeup; /* signaled when a command is pushed */
+    ALLEGRO_MUTEX* index_mutex; /* guards the indices if there are no atomic operations */
+    bool quit;
+
+    audiocommand_t queue[COMMAND_QUEUE_SIZE];
+    unsigned head; /* written by the game thread only */
+    unsigned tail; /* written by the mixer thread only */
+
+    voice_t voice[MAX_VOICES]; /* accessed by the mixer thread only */
+    int voice_count;
+
+    unsigned frame; /* incremented by the game thread at every audio_update() */
+} mixer = { .thread = NULL, .voice_count = 0, .frame = 1 };
+
+static bool start_mixer();
+static void stop_mixer();
+static void send_command(const audiocommand_t* command);
+static void run_queued_commands();
+static void run_command(const audiocommand_t* command);
+static void play_voice(const audiocommand_t* command);
+static voice_t* latest_voice(const sound_t* sound);
+static voice_t* steal_voice(voice_t* voice);
+static void* mixer_thread(ALLEGRO_THREAD* thread, void* arg);
+static unsigned load_index(const unsigned* index);
+static void store_index(unsigned* index, unsigned value);
+
+/* positional audio sources */
+struct audiosource_t {
+    sound_t* sound;
+    v2d_t position; /* world position */
+    float mindist, maxdist; /* in pixels */
+    bool horizontal; /* measure the distance to a horizontal line? */
+    float line_height; /* height of that line, in pixels */
+    float volume; /* base volume */
+    bool enabled;
+};
+
+static const float MAX_SOURCE_PAN = 0.5f; /* how much an audio source is panned at most */
+STATIC_DARRAY(audiosource_t*, audio_sources);
+static v2d_t listener_position, listener_camera;
+static unsigned listener_frame = 0; /* the frame in which the listener was set; 0 if never */
+static void update_audio_sources();
+static float audiosource_volume(const audiosource_t* source);
+static float audiosource_pan(const audiosource_t* source);
+static void send_gain(sound_t* sample);
 
 /*
  * music_load()
- * Loads a music from a file
+ * Loads a music from a file. If the background decoder is available,
+ * the stream is opened there and the music will start playing as soon
+ * as it's ready; the game thread doesn't access the disk
  */
 music_t *music_load(const char *path)
 {
@@ -73,20 +252,32 @@ music_t *music_load(const char *path)
         return NULL;
 
     if(NULL == (m = resourcemanager_find_music(path))) {
-        const char* fullpath = asset_path(path);
-        logfile_message("Loading music \"%s\"...", fullpath);
-
         /* build the music object */
         m = mallocx(sizeof *m);
+        m->stream = NULL;
         m->is_paused = false;
+        m->volume = 1.0f;
         m->filepath = str_dup(path);
-        if(NULL == (m->stream = al_load_audio_stream(fullpath, 4, 1024)))
-            fatal_error("Can't load music \"%s\"", path);
-        
-        /* configure the audio stream */
-        al_attach_audio_stream_to_mixer(m->stream, al_get_default_mixer());
-        al_set_audio_stream_playmode(m->stream, ALLEGRO_PLAYMODE_LOOP);
-        al_set_audio_stream_playing(m->stream, false);
+        m->is_opening = false;
+        m->wants_to_play = false;
+        m->loop = false;
+
+        /* open the stream */
+        if(decoder.thread != NULL) {
+            if(!asset_exists(path))
+                fatal_error("Can't load music \"%s\"", path);
+            open_music_later(m);
+        }
+        else {
+            const char* fullpath = asset_path(path);
+            ALLEGRO_AUDIO_STREAM* stream;
+
+            logfile_message("Loading music \"%s\"...", fullpath);
+            if(NULL == (stream = al_load_audio_stream(fullpath, 4, 1024)))
+                fatal_error("Can't load music \"%s\"", path);
+
+            attach_music_stream(m, stream);
+        }
 
         /* adding it to the resource manager */
         resourcemanager_add_music(path, m);
@@ -134,7 +325,11 @@ void music_destroy(music_t *music)
             current_music = NULL;
         }
 
-        al_destroy_audio_stream(music->stream);
+        if(music == fadeout.music)
+            stop_fadeout();
+
+        if(music->stream != NULL)
+            al_destroy_audio_stream(music->stream);
         free(music->filepath);
         free(music);
     }
@@ -150,30 +345,64 @@ void music_play(music_t *music, bool loop)
 {
     music_stop();
 
-    if(music != NULL) {
-        ALLEGRO_PLAYMODE mode = loop ? ALLEGRO_PLAYMODE_LOOP : ALLEGRO_PLAYMODE_ONCE;
-        al_set_audio_stream_playmode(music->stream, mode);
-        al_set_audio_stream_playing(music->stream, true);
-        music->is_paused = false;
-    }
+    if(music != NULL)
+        start_music(music, loop);
 
     current_music = music;
     music_set_volume(1.0f);
 }
 
+/*
+ * music_crossfade()
+ * Plays a music, fading it in while the current
+ * music fades out during the given number of seconds
+ */
+void music_crossfade(music_t *music, bool loop, float seconds)
+{
+    music_t* previous_music = current_music;
+
+    /* nothing to crossfade */
+    if(seconds <= 0.0f || music == previous_music || !music_is_playing()) {
+        music_play(music, loop);
+        return;
+    }
+
+    /* fade out the current music */
+    stop_fadeout();
+    fadeout.music = previous_music;
+    fadeout.gain = music_gain(previous_music);
+    fadeout.time = 0.0f;
+    fadeout.duration = seconds;
+
+    /* fade in the new music */
+    fadein.time = 0.0f;
+    fadein.duration = seconds;
+    current_music = music;
+    if(music != NULL) {
+        music->volume = 1.0f;
+        start_music(music, loop);
+    }
+}
+
 /*
  * music_stop()
  * Stops the current music (if any)
  */
 void music_stop()
 {
+    stop_fadeout();
+
     if(current_music != NULL) {
-        al_set_audio_stream_playing(current_music->stream, false);
-        al_rewind_audio_stream(current_music->stream);
+        if(current_music->stream != NULL) {
+            al_set_audio_stream_playing(current_music->stream, false);
+            al_rewind_audio_stream(current_music->stream);
+        }
+        current_music->wants_to_play = false;
         current_music->is_paused = false; /* it's stopped, not paused */
     }
 
     current_music = NULL;
+    fadein.duration = 0.0f;
 }
 
 /*
@@ -182,8 +411,11 @@ void music_stop()
  */
 void music_pause()
 {
+    stop_fadeout();
+
     if(current_music != NULL && !(current_music->is_paused)) {
-        al_set_audio_stream_playing(current_music->stream, false);
+        if(current_music->stream != NULL)
+            al_set_audio_stream_playing(current_music->stream, false);
         current_music->is_paused = true;
     }
 }
@@ -195,8 +427,13 @@ void music_pause()
 void music_resume()
 {
     if(current_music != NULL && current_music->is_paused) {
-        al_set_audio_stream_playing(current_music->stream, true);
         current_music->is_paused = false;
+        if(current_music->stream != NULL) {
+            if(current_music->wants_to_play)
+                start_music_stream(current_music); /* it was opened while paused */
+            else
+                al_set_audio_stream_playing(current_music->stream, true);
+        }
     }
 }
 
@@ -208,8 +445,9 @@ void music_resume()
 void music_set_volume(float volume)
 {
     if(current_music != NULL) {
-        float gain = max(volume, 0.0f);
-        al_set_audio_stream_gain(current_music->stream, gain);
+        current_music->volume = max(volume, 0.0f);
+        if(current_music->stream != NULL)
+            al_set_audio_stream_gain(current_music->stream, music_gain(current_music));
     }
 }
 
@@ -220,7 +458,7 @@ void music_set_volume(float volume)
 float music_get_volume()
 {
     if(current_music != NULL)
-        return al_get_audio_stream_gain(current_music->stream);
+        return current_music->volume;
     else
         return 0.0f;
 }
@@ -231,7 +469,14 @@ float music_get_volume()
  */
 bool music_is_playing()
 {
-    return (current_music != NULL) && al_get_audio_stream_playing(current_music->stream);
+    if(current_music == NULL)
+        return false;
+
+    /* a music that is being opened will play when it's ready */
+    if(current_music->stream == NULL)
+        return current_music->wants_to_play && !(current_music->is_paused);
+
+    return al_get_audio_stream_playing(current_music->stream);
 }
 
 /*
@@ -240,7 +485,7 @@ bool music_is_playing()
  */
 float music_duration()
 {
-    if(current_music != NULL) {
+    if(current_music != NULL && current_music->stream != NULL) {
         /* this may be zero if the length is unknown */
         return al_get_audio_stream_length_secs(current_music->stream);
     }
@@ -287,29 +532,67 @@ bool music_is_paused()
  * Loads a sample from a file
  */
 sound_t *sound_load(const char *path)
+{
+    return load_sound(path, decoder.defer_samples);
+}
+
+/*
+ * load_sound()
+ * Loads a sample from a file. If defer_decoding is true, the sample
+ * will be decoded in a background thread when it's first played
+ */
+sound_t* load_sound(const char* path, bool defer_decoding)
 {
     sound_t *s;
 
     if(NULL == (s = resourcemanager_find_sample(path))) {
         ALLEGRO_SAMPLE_INSTANCE* spl;
         const char* fullpath = asset_path(path);
-        logfile_message("Loading sound \"%s\"...", fullpath);
 
         /* build the sound object */
         s = mallocx(sizeof *s);
         s->duration = 0.0f;
         s->end_time = 0.0f;
-        s->valid_id = false;
+        s->original_bytes = 0;
+        s->has_voice = false;
+        s->play_frame = 0;
         s->volume = 1.0f;
+        s->pan = 0.0f;
         s->filepath = str_dup(path);
-        if(NULL == (s->sample = al_load_sample(fullpath)))
-            fatal_error("Can't load sound \"%s\"", path);
+        s->mix_frame = 0;
+        s->mix_volume = s->mix_pan = 0.0f;
+        s->is_mixed = false;
+        s->sample = NULL;
+        s->is_decoding = false;
+        s->wants_to_play = false;
+        s->pending_pan = 0.0f;
+        s->pending_freq = 1.0f;
+        s->play_request_time = 0.0f;
+
+        /* decode the sample now? */
+        if(!defer_decoding) {
+            logfile_message("Loading sound \"%s\"...", fullpath);
+            if(NULL == (s->sample = al_load_sample(fullpath)))
+                fatal_error("Can't load sound \"%s\"", path);
+
+            /* compact it */
+            if(wants_compaction(path)) {
+                ALLEGRO_SAMPLE* compact = compact_sample(s->sample);
+                if(compact != NULL) {
+                    s->original_bytes = sample_bytes(s->sample);
+                    al_destroy_sample(s->sample);
+                    s->sample = compact;
+                }
+            }
 
-        /* compute its duration */
-        if(NULL != (spl = al_create_sample_instance(s->sample))) {
-            s->duration = al_get_sample_instance_time(spl);
-            al_destroy_sample_instance(spl);
+            /* compute its duration */
+            if(NULL != (spl = al_create_sample_instance(s->sample))) {
+                s->duration = al_get_sample_instance_time(spl);
+                al_destroy_sample_instance(spl);
+            }
         }
+        else if(!asset_exists(path))
+            fatal_error("Can't load sound \"%s\"", path);
 
         /* adding it to the resource manager */
         resourcemanager_add_sample(path, s);
@@ -348,13 +631,44 @@ int sound_unref(sound_t* sample)
 void sound_destroy(sound_t *sample)
 {
     if(sample != NULL) {
-        sound_stop(sample);
-        al_destroy_sample(sample->sample);
-        free(sample->filepath);
-        free(sample);
+        /* the mixer thread may still refer to the sample;
+           it will release it after stopping its voices */
+        audiocommand_t command = { .type = AUDIOCOMMAND_DESTROY, .sound = sample };
+        send_command(&command);
     }
 }
 
+/*
+ * sound_memory_usage()
+ * The size of the data of the sample, in bytes
+ */
+size_t sound_memory_usage(const sound_t *sample)
+{
+    if(sample->sample == NULL)
+        return 0; /* not decoded yet */
+
+    return sample_bytes(sample->sample);
+}
+
+/*
+ * sound_original_memory_usage()
+ * The size of the data of the sample before it was compacted, in bytes.
+ * This is the same as sound_memory_usage() if it wasn't compacted
+ */
+size_t sound_original_memory_usage(const sound_t *sample)
+{
+    return sample->original_bytes > 0 ? sample->original_bytes : sound_memory_usage(sample);
+}
+
+/*
+ * sound_path()
+ * The relative path of the sample
+ */
+const char *sound_path(const sound_t *sample)
+{
+    return sample->filepath;
+}
+
 /*
  * sound_play()
  * Plays the given sample
@@ -381,17 +695,38 @@ void sound_play_ex(sound_t *sample, float vol, float pan, float freq)
         pan = clip(pan, -1.0f, 1.0f);
         freq = max(freq, 0.0f);
 
-        /* play the sample */
-        if(al_play_sample(sample->sample, vol, pan, freq, ALLEGRO_PLAYMODE_ONCE, &sample->id)) {
-            sample->end_time = timer_get_elapsed() + sample->duration; /* when does it end? */
-            sample->valid_id = true;
-            sample->volume = vol;
-        }
-        else {
-            sample->end_time = 0.0f;
-            sample->valid_id = false;
+        /* the sample hasn't been decoded yet; play it when it is */
+        if(sample->sample == NULL) {
+            decode_later(sample);
+            sample->wants_to_play = true;
             sample->volume = vol;
+            sample->pending_pan = pan;
+            sample->pending_freq = freq;
+            sample->play_request_time = timer_get_elapsed();
+            return;
         }
+
+        /* identical plays in the same frame cost a single voice */
+        sample->volume = vol;
+        sample->pan = pan;
+        if(sample->play_frame == mixer.frame)
+            return;
+
+        /* play the sample */
+        audiocommand_t command = {
+            .type = AUDIOCOMMAND_PLAY,
+            .sound = sample,
+            .sample = sample->sample,
+            .duration = sample->duration,
+            .volume = vol,
+            .pan = pan,
+            .freq = freq
+        };
+        send_command(&command);
+
+        sample->end_time = timer_get_elapsed() + sample->duration; /* when does it end? */
+        sample->has_voice = true;
+        sample->play_frame = mixer.frame;
     }
 }
 
@@ -402,9 +737,12 @@ void sound_play_ex(sound_t *sample, float vol, float pan, float freq)
 void sound_stop(sound_t *sample)
 {
     if(sample != NULL) {
-        if(sample->valid_id) {
-            al_stop_sample(&sample->id);
-            sample->valid_id = false;
+        sample->wants_to_play = false;
+        if(sample->has_voice) {
+            audiocommand_t command = { .type = AUDIOCOMMAND_STOP, .sound = sample };
+            send_command(&command);
+            sample->has_voice = false;
+            sample->play_frame = 0;
             sample->end_time = 0.0f;
         }
     }
@@ -417,7 +755,7 @@ void sound_stop(sound_t *sample)
 bool sound_is_playing(sound_t *sample)
 {
     if(sample != NULL)
-        return timer_get_elapsed() < sample->end_time;
+        return sample->wants_to_play || timer_get_elapsed() < sample->end_time;
     else
         return false;
 
@@ -462,14 +800,7 @@ void sound_set_volume(sound_t *sample, float volume)
     /* Unstable API (since Allegro 5.2.3) */
     if(sample != NULL) {
         sample->volume = max(0.0f, volume);
-        if(sample->valid_id) {
-            ALLEGRO_SAMPLE_INSTANCE* instance = al_lock_sample_id(&sample->id);
-            if(instance != NULL) {
-                if(al_get_sample_instance_playing(instance))
-                    al_set_sample_instance_gain(instance, sample->volume);
-                al_unlock_sample_id(&sample->id);
-            }
-        }
+        send_gain(sample);
     }
 }
 
@@ -499,14 +830,31 @@ void audio_init()
             fatal_error("Can't initialize Allegro's acodec addon");
     }
 
+    mixer.voice_count = 0;
     for(int samples = PREFERRED_NUMBER_OF_SAMPLES; samples > 0; samples /= 2) {
         if(al_reserve_samples(samples)) {
             logfile_message("Reserved %d samples", samples);
+            mixer.voice_count = samples;
             break;
         }
         else
             logfile_message("Can't reserve %d samples", samples);
     }
+
+    for(int i = 0; i < MAX_VOICES; i++)
+        mixer.voice[i].sound = NULL;
+
+    darray_init(audio_sources);
+    darray_init(kept_samples);
+    compact_samples = false;
+    listener_position = listener_camera = v2d_new(0, 0);
+    listener_frame = 0;
+
+    if(!start_mixer())
+        logfile_message("The samples will be played in the game thread");
+
+    if(!start_decoder())
+        logfile_message("The musics will be opened in the game thread");
 }
 
 /*
@@ -516,6 +864,12 @@ void audio_init()
 void audio_release()
 {
     logfile_message("audio_release()");
+    stop_decoder();
+    stop_mixer();
+    darray_release(audio_sources);
+    for(int i = 0; i < darray_length(kept_samples); i++)
+        free(kept_samples[i]);
+    darray_release(kept_samples);
     logfile_message("audio_release() ok");
 }
 
@@ -525,11 +879,27 @@ void audio_release()
  */
 void audio_update()
 {
+    /* a new frame */
+    if(++mixer.frame == 0)
+        mixer.frame = 1;
+
+    /* pick the samples decoded in the background */
+    if(decoder.thread != NULL)
+        pick_decoded_samples();
+
+    /* positional audio */
+    update_audio_sources();
+
+    /* crossfade */
+    update_fades(timer_get_delta());
+
     /* when the music finishes, set current_music to NULL */
     if(current_music != NULL && !(current_music->is_paused)) {
         if(!music_is_playing()) {
-            al_rewind_audio_stream(current_music->stream);
+            if(current_music->stream != NULL)
+                al_rewind_audio_stream(current_music->stream);
             current_music = NULL;
+            fadein.duration = 0.0f;
         }
     }
 }
@@ -541,9 +911,23 @@ void audio_update()
 void audio_preload()
 {
     assertx(resourcemanager_is_initialized());
-    logfile_message("Preloading samples...");
+
+    /* preload only the samples listed in the manifest, if there is one;
+       the other samples will be decoded on demand */
+    if(asset_exists(PRELOAD_MANIFEST) && decoder.thread != NULL) {
+        decoder.defer_samples = true;
+        logfile_message("Preloading the samples listed in %s...", PRELOAD_MANIFEST);
+
+        parsetree_program_t* manifest = nanoparser_construct_tree(asset_path(PRELOAD_MANIFEST));
+        nanoparser_traverse_program(manifest, read_kept_samples);
+        nanoparser_traverse_program(manifest, read_preload_manifest);
+        nanoparser_deconstruct_tree(manifest);
+
+        return;
+    }
 
     /* preload the samples, so that we don't access the disk during gameplay */
+    logfile_message("Preloading samples...");
     asset_foreach_file("samples/", ".wav", preload_sample, NULL, true);
     /*asset_foreach_file("samples/", ".ogg", preload_sample, NULL, true);*/
 }
@@ -589,23 +973,970 @@ void audio_set_muted(bool muted)
 
 
 
+/*
+ * audio_set_sample_compaction()
+ * Enables or disables the compaction of the samples that are decoded
+ * from now on. Compact samples are 16-bit mono at a reduced frequency
+ */
+void audio_set_sample_compaction(bool enabled)
+{
+    compact_samples = enabled;
+    logfile_message("The compaction of samples has been %s", enabled ? "enabled" : "disabled");
+}
+
+/*
+ * audio_set_listener()
+ * Sets the listener of the positional audio sources. The sources are
+ * attenuated by their distance to the listener and panned according
+ * to their position relative to the camera
+ */
+void audio_set_listener(v2d_t position, v2d_t camera)
+{
+    listener_position = position;
+    listener_camera = camera;
+    listener_frame = mixer.frame;
+}
+
+
+
+
+/* positional audio */
+
+/*
+ * audiosource_create()
+ * Creates a positional audio source of the given sample. The audio
+ * sources of the same sample are mixed: the loudest one is heard
+ */
+audiosource_t* audiosource_create(sound_t *sample)
+{
+    audiosource_t* source = mallocx(sizeof *source);
+
+    source->sound = sample;
+    source->position = v2d_new(0, 0);
+    source->mindist = 256.0f;
+    source->maxdist = 512.0f;
+    source->horizontal = false;
+    source->line_height = VIDEO_SCREEN_H;
+    source->volume = 1.0f;
+    source->enabled = true;
+
+    darray_push(audio_sources, source);
+    return source;
+}
+
+/*
+ * audiosource_destroy()
+ * Destroys an audio source. Its sample is stopped if no
+ * other audio source plays it
+ */
+void audiosource_destroy(audiosource_t *source)
+{
+    bool is_shared = false;
+
+    for(int i = darray_length(audio_sources) - 1; i >= 0; i--) {
+        if(audio_sources[i] == source)
+            darray_remove(audio_sources, i);
+        else if(audio_sources[i]->sound == source->sound)
+            is_shared = true;
+    }
+
+    if(!is_shared)
+        sound_stop(source->sound);
+
+    free(source);
+}
+
+/*
+ * audiosource_set_position()
+ * Sets the world position of an audio source
+ */
+void audiosource_set_position(audiosource_t *source, v2d_t position)
+{
+    source->position = position;
+}
+
+/*
+ * audiosource_set_distances()
+ * The sound is the loudest within mindist pixels of the
+ * audio source and silent beyond maxdist pixels
+ */
+void audiosource_set_distances(audiosource_t *source, float mindist, float maxdist)
+{
+    source->mindist = max(0.0f, mindist);
+    source->maxdist = max(source->mindist, maxdist);
+}
+
+/*
+ * audiosource_set_horizontal()
+ * A horizontal audio source measures the distance to a horizontal
+ * line of the given height, which plays nicely on a platformer
+ */
+void audiosource_set_horizontal(audiosource_t *source, bool horizontal, float line_height)
+{
+    source->horizontal = horizontal;
+    source->line_height = max(0.0f, line_height);
+}
+
+/*
+ * audiosource_set_volume()
+ * Sets the base volume of an audio source, a value in [0,1]
+ */
+void audiosource_set_volume(audiosource_t *source, float volume)
+{
+    source->volume = clip01(volume);
+}
+
+/*
+ * audiosource_set_enabled()
+ * Enables or disables an audio source
+ */
+void audiosource_set_enabled(audiosource_t *source, bool enabled)
+{
+    source->enabled = enabled;
+}
+
+
+
 /* private */
 
+/* attenuates all audio sources in a single pass and mixes the ones of the same sample */
+void update_audio_sources()
+{
+    int count = darray_length(audio_sources);
+
+    /* the audio sources are frozen if their listener isn't updated
+       (e.g., the level is paused) */
+    if(listener_frame == 0 || mixer.frame - listener_frame > 1)
+        return;
+
+    /* find the loudest audio source of each sample */
+    for(int i = 0; i < count; i++) {
+        audiosource_t* source = audio_sources[i];
+        sound_t* sample = source->sound;
+        float volume = source->enabled ? audiosource_volume(source) : 0.0f;
+
+        if(sample->mix_frame != mixer.frame) {
+            sample->mix_frame = mixer.frame;
+            sample->mix_volume = -1.0f;
+            sample->is_mixed = false;
+        }
+
+        if(volume > sample->mix_volume) {
+            sample->mix_volume = volume;
+            sample->mix_pan = audiosource_pan(source);
+        }
+    }
+
+    /* apply the mix */
+    for(int i = 0; i < count; i++) {
+        sound_t* sample = audio_sources[i]->sound;
+
+        if(sample->is_mixed)
+            continue;
+        sample->is_mixed = true;
+
+        /* don't stop a silent sample, otherwise it would restart
+           if the listener moved back and forth */
+        if(sample->mix_volume <= 0.0f) {
+            if(sample->volume != 0.0f) {
+                sample->volume = 0.0f;
+                send_gain(sample);
+            }
+            continue;
+        }
+
+        if(!sound_is_playing(sample))
+            sound_play_ex(sample, sample->mix_volume, sample->mix_pan, 1.0f);
+        else if(sample->volume != sample->mix_volume || sample->pan != sample->mix_pan) {
+            sample->volume = sample->mix_volume;
+            sample->pan = sample->mix_pan;
+            send_gain(sample);
+        }
+    }
+}
+
+/* plays a music, or plays it as soon as its stream is opened */
+void start_music(music_t* music, bool loop)
+{
+    music->loop = loop;
+    music->is_paused = false;
+    music->wants_to_play = true;
+
+    if(music->stream != NULL)
+        start_music_stream(music);
+}
+
+/* plays the stream of a music */
+void start_music_stream(music_t* music)
+{
+    ALLEGRO_PLAYMODE mode = music->loop ? ALLEGRO_PLAYMODE_LOOP : ALLEGRO_PLAYMODE_ONCE;
+
+    al_set_audio_stream_playmode(music->stream, mode);
+    al_set_audio_stream_gain(music->stream, music_gain(music));
+    al_set_audio_stream_playing(music->stream, true);
+    music->wants_to_play = false;
+}
+
+/* attaches an opened stream to a music */
+void attach_music_stream(music_t* music, ALLEGRO_AUDIO_STREAM* stream)
+{
+    music->stream = stream;
+
+    /* configure the audio stream */
+    al_attach_audio_stream_to_mixer(stream, al_get_default_mixer());
+    al_set_audio_stream_playmode(stream, ALLEGRO_PLAYMODE_LOOP);
+    al_set_audio_stream_playing(stream, false);
+
+    /* play it if it was requested while opening */
+    if(music->wants_to_play && !(music->is_paused))
+        start_music_stream(music);
+}
+
+/* sends a music to the background decoder, which opens its stream */
+void open_music_later(music_t* music)
+{
+    if(music->is_opening || decoder.thread == NULL)
+        return;
+
+    pendingsample_t pending = {
+        .path = str_dup(music->filepath),
+        .fullpath = str_dup(asset_path(music->filepath)), /* asset_path() isn't thread-safe */
+        .is_music = true,
+        .compact = false
+    };
+
+    al_lock_mutex(decoder.mutex);
+    darray_push(decoder.pending, pending);
+    al_signal_cond(decoder.job_available);
+    al_unlock_mutex(decoder.mutex);
+
+    music->is_opening = true;
+}
+
+/* stops the music that is fading out, if any */
+void stop_fadeout()
+{
+    music_t* music = fadeout.music;
+
+    if(music == NULL)
+        return;
+
+    if(music->stream != NULL) {
+        al_set_audio_stream_playing(music->stream, false);
+        al_rewind_audio_stream(music->stream);
+    }
+    music->wants_to_play = false;
+    music->is_paused = false;
+
+    fadeout.music = NULL;
+}
+
+/* updates the crossfade */
+void update_fades(float dt)
+{
+    /* fade out */
+    if(fadeout.music != NULL) {
+        fadeout.time += dt;
+        if(fadeout.time >= fadeout.duration)
+            stop_fadeout();
+        else if(fadeout.music->stream != NULL)
+            al_set_audio_stream_gain(fadeout.music->stream, music_gain(fadeout.music));
+    }
+
+    /* fade in */
+    if(fadein.duration > 0.0f) {
+        fadein.time += dt;
+        if(current_music != NULL && current_music->stream != NULL)
+            al_set_audio_stream_gain(current_music->stream, music_gain(current_music));
+        if(fadein.time >= fadein.duration)
+            fadein.duration = 0.0f;
+    }
+}
+
+/* the gain of the stream of a music, considering its volume and the crossfade */
+float music_gain(const music_t* music)
+{
+    if(music == fadeout.music && fadeout.duration > 0.0f)
+        return fadeout.gain * max(0.0f, 1.0f - fadeout.time / fadeout.duration);
+
+    if(music == current_music && fadein.duration > 0.0f)
+        return music->volume * min(1.0f, fadein.time / fadein.duration);
+
+    return music->volume;
+}
+
+/* the volume of an audio source at the position of the listener, with a linear falloff */
+float audiosource_volume(const audiosource_t* source)
+{
+    float dx = fabsf(source->position.x - listener_position.x);
+    float dy = fabsf(source->position.y - listener_position.y);
+    float dist;
+
+    if(source->horizontal) {
+        dy -= source->line_height * 0.5f;
+        dist = (dy < 0.0f) ? dx : dx + dy * 2.0f;
+    }
+    else
+        dist = sqrtf(dx * dx + dy * dy);
+
+    if(source->maxdist <= source->mindist)
+        return (dist <= source->maxdist) ? source->volume : 0.0f;
+
+    dist = clip(dist, source->mindist, source->maxdist);
+    return source->volume * (source->maxdist - dist) / (source->maxdist - source->mindist);
+}
+
+/* the pan of an audio source, given its position relative to the camera */
+float audiosource_pan(const audiosource_t* source)
+{
+    float half_width = 0.5f * VIDEO_SCREEN_W;
+    float offset = (source->position.x - listener_camera.x) / half_width;
+
+    return MAX_SOURCE_PAN * clip(offset, -1.0f, 1.0f);
+}
+
+/* sends the volume and the pan of a sample to its latest voice */
+void send_gain(sound_t* sample)
+{
+    if(sample->has_voice) {
+        audiocommand_t command = {
+            .type = AUDIOCOMMAND_SETGAIN,
+            .sound = sample,
+            .volume = sample->volume,
+            .pan = sample->pan
+        };
+        send_command(&command);
+    }
+}
+
 int preload_sample(const char* vpath, void* data)
 {
-    sound_load(vpath);
+    load_sound(vpath, false);
+    return 0;
+}
+
+/* reads a statement of the preload manifest: preload "path/to/sample.wav" */
+int read_preload_manifest(const parsetree_statement_t* stmt)
+{
+    const char* identifier = nanoparser_get_identifier(stmt);
+    const parsetree_parameter_t* param_list = nanoparser_get_parameter_list(stmt);
+
+    if(str_icmp(identifier, "preload") == 0) {
+        const parsetree_parameter_t* p1 = nanoparser_get_nth_parameter(param_list, 1);
+        nanoparser_expect_string(p1, "preload: must provide the path to a sample");
+
+        const char* vpath = nanoparser_get_string(p1);
+        if(asset_exists(vpath))
+            load_sound(vpath, false);
+        else
+            nanoparser_warn(stmt, "Can't find sample \"%s\"", vpath);
+    }
+    else if(str_icmp(identifier, "keep") == 0)
+        ; /* already read */
+    else
+        nanoparser_warn(stmt, "Unknown identifier \"%s\"", identifier);
+
+    return 0;
+}
+
+/* reads the keep statements of the preload manifest: keep "path/to/sample.wav"
+   A kept sample is not compacted, even in low memory settings */
+int read_kept_samples(const parsetree_statement_t* stmt)
+{
+    const char* identifier = nanoparser_get_identifier(stmt);
+    const parsetree_parameter_t* param_list = nanoparser_get_parameter_list(stmt);
+
+    if(str_icmp(identifier, "keep") == 0) {
+        const parsetree_parameter_t* p1 = nanoparser_get_nth_parameter(param_list, 1);
+        nanoparser_expect_string(p1, "keep: must provide the path to a sample");
+
+        char* vpath = str_dup(nanoparser_get_string(p1));
+        darray_push(kept_samples, vpath);
+    }
+
     return 0;
 }
 
+/* should the sample at the given path be compacted? */
+bool wants_compaction(const char* path)
+{
+    if(!compact_samples)
+        return false;
+
+    for(int i = 0; i < darray_length(kept_samples); i++) {
+        if(str_icmp(kept_samples[i], path) == 0)
+            return false;
+    }
+
+    return true;
+}
+
+/* converts a sample to 16-bit mono, halving its frequency if it's above
+   COMPACT_MAX_FREQUENCY. Returns a new sample, or NULL if that wouldn't
+   save memory. This may run in the decoder thread */
+ALLEGRO_SAMPLE* compact_sample(ALLEGRO_SAMPLE* sample)
+{
+    unsigned frequency = al_get_sample_frequency(sample);
+    unsigned length = al_get_sample_length(sample);
+    ALLEGRO_AUDIO_DEPTH depth = al_get_sample_depth(sample);
+    int channels = al_get_channel_count(al_get_sample_channels(sample));
+    int step = (frequency > COMPACT_MAX_FREQUENCY) ? 2 : 1;
+    unsigned compact_length = length / step;
+    const void* data = al_get_sample_data(sample);
+    ALLEGRO_SAMPLE* compact;
+    int16_t* buffer;
+
+    /* nothing to gain */
+    if(channels == 1 && step == 1 && al_get_audio_depth_size(depth) <= (int)sizeof(int16_t))
+        return NULL;
+    else if(compact_length == 0)
+        return NULL;
+
+    /* mix the channels and average pairs of frames */
+    if(NULL == (buffer = al_malloc(compact_length * sizeof(*buffer))))
+        return NULL;
+
+    for(unsigned i = 0; i < compact_length; i++) {
+        size_t first = (size_t)i * step * channels;
+        float value = 0.0f;
+
+        for(int j = 0; j < step * channels; j++)
+            value += read_sample_value(data, depth, first + j);
+
+        value /= (float)(step * channels);
+        buffer[i] = (int16_t)(clip(value, -1.0f, 1.0f) * 32767.0f);
+    }
+
+    /* the new sample owns the buffer */
+    if(NULL == (compact = al_create_sample(buffer, compact_length, frequency / step, ALLEGRO_AUDIO_DEPTH_INT16, ALLEGRO_CHANNEL_CONF_1, true)))
+        al_free(buffer);
+
+    return compact;
+}
+
+/* reads a value of the data of a sample, in [-1,1] */
+float read_sample_value(const void* data, ALLEGRO_AUDIO_DEPTH depth, size_t index)
+{
+    switch(depth) {
+        case ALLEGRO_AUDIO_DEPTH_INT8:
+            return (float)(((const int8_t*)data)[index]) / 128.0f;
+
+        case ALLEGRO_AUDIO_DEPTH_UINT8:
+            return (float)((int)(((const uint8_t*)data)[index]) - 128) / 128.0f;
+
+        case ALLEGRO_AUDIO_DEPTH_INT16:
+            return (float)(((const int16_t*)data)[index]) / 32768.0f;
+
+        case ALLEGRO_AUDIO_DEPTH_UINT16:
+            return (float)((int)(((const uint16_t*)data)[index]) - 32768) / 32768.0f;
+
+        /* 24-bit samples are stored in 32-bit integers */
+        case ALLEGRO_AUDIO_DEPTH_INT24:
+            return (float)(((const int32_t*)data)[index]) / 8388608.0f;
+
+        case ALLEGRO_AUDIO_DEPTH_UINT24:
+            return (float)(((const int32_t*)data)[index] - 0x800000) / 8388608.0f;
+
+        case ALLEGRO_AUDIO_DEPTH_FLOAT32:
+            return ((const float*)data)[index];
+
+        default:
+            return 0.0f;
+    }
+}
+
+/* the size of the data of a sample, in bytes */
+size_t sample_bytes(const ALLEGRO_SAMPLE* sample)
+{
+    ALLEGRO_SAMPLE* spl = (ALLEGRO_SAMPLE*)sample;
+    size_t frame_size = al_get_channel_count(al_get_sample_channels(spl)) * al_get_audio_depth_size(al_get_sample_depth(spl));
+
+    return (size_t)al_get_sample_length(spl) * frame_size;
+}
+
+/* starts the background decoder. Returns true on success */
+bool start_decoder()
+{
+    if(decoder.thread != NULL)
+        return true;
+
+    decoder.mutex = al_create_mutex();
+    decoder.job_available = al_create_cond();
+    darray_init(decoder.pending);
+    darray_init(decoder.decoded);
+    decoder.quit = false;
+    decoder.defer_samples = false;
+
+    if(NULL == (decoder.thread = al_create_thread(decoder_thread, NULL))) {
+        logfile_message("Can't create the decoder thread");
+        darray_release(decoder.decoded);
+        darray_release(decoder.pending);
+        al_destroy_cond(decoder.job_available);
+        al_destroy_mutex(decoder.mutex);
+        return false;
+    }
+
+    al_start_thread(decoder.thread);
+    return true;
+}
+
+/* stops the background decoder, discarding its work */
+void stop_decoder()
+{
+    if(decoder.thread == NULL)
+        return;
+
+    al_lock_mutex(decoder.mutex);
+    decoder.quit = true;
+    al_signal_cond(decoder.job_available);
+    al_unlock_mutex(decoder.mutex);
+
+    al_destroy_thread(decoder.thread); /* joins the thread */
+    decoder.thread = NULL;
+    decoder.defer_samples = false;
+
+    for(int i = 0; i < darray_length(decoder.pending); i++) {
+        free(decoder.pending[i].fullpath);
+        free(decoder.pending[i].path);
+    }
+
+    for(int i = 0; i < darray_length(decoder.decoded); i++) {
+        if(decoder.decoded[i].sample != NULL)
+            al_destroy_sample(decoder.decoded[i].sample);
+        if(decoder.decoded[i].stream != NULL)
+            al_destroy_audio_stream(decoder.decoded[i].stream);
+        free(decoder.decoded[i].path);
+    }
+
+    darray_release(decoder.decoded);
+    darray_release(decoder.pending);
+    al_destroy_cond(decoder.job_available);
+    al_destroy_mutex(decoder.mutex);
+}
+
+/* sends a sample to the background decoder */
+void decode_later(sound_t* sample)
+{
+    if(sample->is_decoding || decoder.thread == NULL)
+        return;
+
+    pendingsample_t pending = {
+        .path = str_dup(sample->filepath),
+        .fullpath = str_dup(asset_path(sample->filepath)), /* asset_path() isn't thread-safe */
+        .is_music = false,
+        .compact = wants_compaction(sample->filepath)
+    };
+
+    al_lock_mutex(decoder.mutex);
+    darray_push(decoder.pending, pending);
+    al_signal_cond(decoder.job_available);
+    al_unlock_mutex(decoder.mutex);
+
+    sample->is_decoding = true;
+}
+
+/* attaches the decoded samples to their sound objects. This runs in the main thread.
+   A sound object may have been released while its sample was being decoded */
+void pick_decoded_samples()
+{
+    al_lock_mutex(decoder.mutex);
+
+    for(int i = 0; i < darray_length(decoder.decoded); i++) {
+        decodedsample_t* decoded = &decoder.decoded[i];
+
+        /* a music stream has been opened */
+        if(decoded->is_music) {
+            music_t* m = resourcemanager_find_music(decoded->path);
+
+            if(m != NULL && m->stream == NULL && decoded->stream != NULL) {
+                m->is_opening = false;
+                attach_music_stream(m, decoded->stream);
+                logfile_message("Opened music \"%s\" in the background", decoded->path);
+            }
+            else {
+                if(m != NULL && decoded->stream == NULL) {
+                    logfile_message("Can't load music \"%s\"", decoded->path);
+                    m->is_opening = false;
+                    m->wants_to_play = false;
+                }
+
+                if(decoded->stream != NULL && (m == NULL || m->stream != decoded->stream))
+                    al_destroy_audio_stream(decoded->stream);
+            }
+
+            free(decoded->path);
+            continue;
+        }
+
+        sound_t* s = resourcemanager_find_sample(decoded->path);
+
+        if(s != NULL && s->sample == NULL && decoded->sample != NULL) {
+            ALLEGRO_SAMPLE_INSTANCE* spl;
+
+            /* attach the sample */
+            s->sample = decoded->sample;
+            s->original_bytes = decoded->original_bytes;
+            if(NULL != (spl = al_create_sample_instance(s->sample))) {
+                s->duration = al_get_sample_instance_time(spl);
+                al_destroy_sample_instance(spl);
+            }
+            resourcemanager_count_sample_bytes(sound_memory_usage(s));
+            logfile_message("Loaded sound \"%s\" in the background", decoded->path);
+
+            /* play it, unless it's too late */
+            if(s->wants_to_play) {
+                s->wants_to_play = false;
+                if(timer_get_elapsed() - s->play_request_time <= MAX_PLAY_DELAY)
+                    sound_play_ex(s, s->volume, s->pending_pan, s->pending_freq);
+            }
+        }
+        else {
+            if(s != NULL && decoded->sample == NULL) {
+                logfile_message("Can't load sound \"%s\"", decoded->path);
+                s->wants_to_play = false;
+            }
+
+            if(decoded->sample != NULL && (s == NULL || s->sample != decoded->sample))
+                al_destroy_sample(decoded->sample);
+        }
+
+        free(decoded->path);
+    }
+
+    darray_clear(decoder.decoded);
+    al_unlock_mutex(decoder.mutex);
+}
+
+/* the decoder thread loads the pending samples */
+void* decoder_thread(ALLEGRO_THREAD* thread, void* arg)
+{
+    /* use the physfs file interface in this thread */
+    al_set_physfs_file_interface();
+
+    al_lock_mutex(decoder.mutex);
+    for(;;) {
+        /* wait for a job */
+        while(!decoder.quit && darray_length(decoder.pending) == 0)
+            al_wait_cond(decoder.job_available, decoder.mutex);
+
+        if(decoder.quit)
+            break;
+
+        /* take the oldest pending sample */
+        pendingsample_t pending = decoder.pending[0];
+        darray_remove(decoder.pending, 0);
+        al_unlock_mutex(decoder.mutex);
+
+        /* decode it */
+        decodedsample_t decoded = {
+            .path = pending.path,
+            .sample = NULL,
+            .stream = NULL,
+            .is_music = pending.is_music,
+            .original_bytes = 0
+        };
+
+        if(pending.is_music)
+            decoded.stream = al_load_audio_stream(pending.fullpath, 4, 1024);
+        else if(NULL != (decoded.sample = al_load_sample(pending.fullpath)) && pending.compact) {
+            ALLEGRO_SAMPLE* compact = compact_sample(decoded.sample);
+            if(compact != NULL) {
+                decoded.original_bytes = sample_bytes(decoded.sample);
+                al_destroy_sample(decoded.sample);
+                decoded.sample = compact;
+            }
+        }
+
+        free(pending.fullpath);
+
+        al_lock_mutex(decoder.mutex);
+        darray_push(decoder.decoded, decoded);
+    }
+    al_unlock_mutex(decoder.mutex);
+
+    return NULL;
+}
+
+/* starts the mixer thread. Returns true on success */
+bool start_mixer()
+{
+    if(mixer.thread != NULL)
+        return true;
+
+    mixer.mutex = al_create_mutex();
+    mixer.index_mutex = al_create_mutex();
+    mixer.wakeup = al_create_cond();
+    mixer.head = mixer.tail = 0;
+    mixer.quit = false;
+
+    if(NULL == (mixer.thread = al_create_thread(mixer_thread, NULL))) {
+        logfile_message("Can't create the mixer thread");
+        al_destroy_cond(mixer.wakeup);
+        al_destroy_mutex(mixer.index_mutex);
+        al_destroy_mutex(mixer.mutex);
+        return false;
+    }
+
+    al_start_thread(mixer.thread);
+    return true;
+}
+
+/* stops the mixer thread after it runs the queued commands */
+void stop_mixer()
+{
+    if(mixer.thread == NULL)
+        return;
+
+    al_lock_mutex(mixer.mutex);
+    mixer.quit = true;
+    al_signal_cond(mixer.wakeup);
+    al_unlock_mutex(mixer.mutex);
+
+    al_destroy_thread(mixer.thread); /* joins the thread */
+    mixer.thread = NULL;
+
+    al_destroy_cond(mixer.wakeup);
+    al_destroy_mutex(mixer.index_mutex);
+    al_destroy_mutex(mixer.mutex);
+}
+
+/* sends a command to the mixer thread. This runs in the game thread, the only producer */
+void send_command(const audiocommand_t* command)
+{
+    /* no mixer thread? run the command now */
+    if(mixer.thread == NULL) {
+        run_command(command);
+        return;
+    }
+
+    /* the queue is full */
+    unsigned head = mixer.head;
+    while(head - load_index(&mixer.tail) >= COMMAND_QUEUE_SIZE) {
+
+        /* we can afford to skip a play if the mixer is this busy */
+        if(command->type == AUDIOCOMMAND_PLAY)
+            return;
+
+        /* other commands must not be lost */
+        al_rest(0.001);
+
+    }
+
+    /* push the command */
+    mixer.queue[head & (COMMAND_QUEUE_SIZE - 1)] = *command;
+    store_index(&mixer.head, head + 1);
+
+    /* wake up the mixer thread */
+    al_lock_mutex(mixer.mutex);
+    al_signal_cond(mixer.wakeup);
+    al_unlock_mutex(mixer.mutex);
+}
+
+/* runs the commands of the queue. This runs in the mixer thread, the only consumer */
+void run_queued_commands()
+{
+    unsigned tail = mixer.tail;
+    unsigned head = load_index(&mixer.head);
+
+    while(tail != head) {
+        run_command(&mixer.queue[tail & (COMMAND_QUEUE_SIZE - 1)]);
+        store_index(&mixer.tail, ++tail);
+
+        if(tail == head)
+            head = load_index(&mixer.head);
+    }
+}
+
+/* runs a command in the mixer thread (or in the game thread if there is no mixer thread) */
+void run_command(const audiocommand_t* command)
+{
+    voice_t* voice;
+
+    switch(command->type) {
+        case AUDIOCOMMAND_PLAY:
+            play_voice(command);
+            break;
+
+        case AUDIOCOMMAND_STOP:
+            if(NULL != (voice = latest_voice(command->sound)))
+                steal_voice(voice);
+            break;
+
+        case AUDIOCOMMAND_SETGAIN:
+            if(NULL != (voice = latest_voice(command->sound))) {
+                /* Unstable API (since Allegro 5.2.3) */
+                ALLEGRO_SAMPLE_INSTANCE* instance = al_lock_sample_id(&voice->id);
+                if(instance != NULL) {
+                    if(al_get_sample_instance_playing(instance)) {
+                        al_set_sample_instance_gain(instance, command->volume);
+                        al_set_sample_instance_pan(instance, command->pan);
+                    }
+                    al_unlock_sample_id(&voice->id);
+                }
+            }
+            break;
+
+        case AUDIOCOMMAND_DESTROY: {
+            sound_t* sound = command->sound;
+
+            for(int i = 0; i < mixer.voice_count; i++) {
+                if(mixer.voice[i].sound == sound)
+                    steal_voice(&mixer.voice[i]);
+            }
+
+            if(sound->sample != NULL)
+                al_destroy_sample(sound->sample);
+            free(sound->filepath);
+            free(sound);
+            break;
+        }
+    }
+}
+
+/* plays a sample in a voice, limiting the number of voices and of instances of the same sample */
+void play_voice(const audiocommand_t* command)
+{
+    double now = al_get_time();
+    voice_t *free_voice = NULL, *oldest_voice = NULL, *oldest_instance = NULL, *voice;
+    int instance_count = 0;
+
+    if(mixer.voice_count == 0)
+        return;
+
+    /* scan the voices */
+    for(int i = 0; i < mixer.voice_count; i++) {
+        voice = &mixer.voice[i];
+
+        if(voice->sound != NULL && voice->end_time <= now)
+            voice->sound = NULL; /* finished playing */
+
+        if(voice->sound == NULL) {
+            if(free_voice == NULL)
+                free_voice = voice;
+            continue;
+        }
+
+        if(oldest_voice == NULL || voice->start_time < oldest_voice->start_time)
+            oldest_voice = voice;
+
+        if(voice->sound == command->sound) {
+            instance_count++;
+            if(oldest_instance == NULL || voice->start_time < oldest_instance->start_time)
+                oldest_instance = voice;
+        }
+    }
+
+    /* pick a voice, stopping the oldest instance or the oldest voice if needed */
+    if(instance_count >= MAX_INSTANCES_PER_SAMPLE)
+        voice = steal_voice(oldest_instance);
+    else if(free_voice != NULL)
+        voice = free_voice;
+    else
+        voice = steal_voice(oldest_voice);
+
+    /* play the sample */
+    if(!al_play_sample(command->sample, command->volume, command->pan, command->freq, ALLEGRO_PLAYMODE_ONCE, &voice->id)) {
+
+        /* Allegro may still be using the voices we assumed to be finished */
+        oldest_voice = NULL;
+        for(int i = 0; i < mixer.voice_count; i++) {
+            if(mixer.voice[i].sound != NULL && (oldest_voice == NULL || mixer.voice[i].start_time < oldest_voice->start_time))
+                oldest_voice = &mixer.voice[i];
+        }
+
+        if(oldest_voice == NULL)
+            return;
+
+        steal_voice(oldest_voice);
+        if(!al_play_sample(command->sample, command->volume, command->pan, command->freq, ALLEGRO_PLAYMODE_ONCE, &voice->id))
+            return;
+
+    }
+
+    voice->sound = command->sound;
+    voice->start_time = now;
+    voice->end_time = now + command->duration / max(command->freq, 0.001f);
+}
+
+/* the most recently played voice of a sound, or NULL if there is none */
+voice_t* latest_voice(const sound_t* sound)
+{
+    voice_t* latest = NULL;
+
+    for(int i = 0; i < mixer.voice_count; i++) {
+        voice_t* voice = &mixer.voice[i];
+        if(voice->sound == sound && (latest == NULL || voice->start_time > latest->start_time))
+            latest = voice;
+    }
+
+    return latest;
+}
+
+/* stops a voice and frees it. Returns the voice */
+voice_t* steal_voice(voice_t* voice)
+{
+    al_stop_sample(&voice->id); /* no-op if it has finished */
+    voice->sound = NULL;
+    return voice;
+}
+
+/* the mixer thread runs the commands sent by the game thread */
+void* mixer_thread(ALLEGRO_THREAD* thread, void* arg)
+{
+    al_lock_mutex(mixer.mutex);
+    for(;;) {
+        /* wait for a command */
+        while(!mixer.quit && load_index(&mixer.head) == mixer.tail)
+            al_wait_cond(mixer.wakeup, mixer.mutex);
+
+        bool quit = mixer.quit;
+        al_unlock_mutex(mixer.mutex);
+
+        /* run the queued commands; the queue is drained before quitting */
+        run_queued_commands();
+        if(quit)
+            break;
+
+        al_lock_mutex(mixer.mutex);
+    }
+
+    return NULL;
+}
+
+/* reads an index of the queue written by the other thread */
+unsigned load_index(const unsigned* index)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+#else
+    al_lock_mutex(mixer.index_mutex);
+    unsigned value = *index;
+    al_unlock_mutex(mixer.index_mutex);
+    return value;
+#endif
+}
+
+/* publishes an index of the queue to the other thread */
+void store_index(unsigned* index, unsigned value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(index, value, __ATOMIC_RELEASE);
+#else
+    al_lock_mutex(mixer.index_mutex);
+    *index = value;
+    al_unlock_mutex(mixer.index_mutex);
+#endif
+}
+
 void set_global_gain(float gain)
 {
-    ALLEGRO_MIXER* mixer = al_get_default_mixer();
+    ALLEGRO_MIXER* default_mixer = al_get_default_mixer();
 
-    if(mixer == NULL) {
+    if(default_mixer == NULL) {
         video_showmessage("Can't set the global gain to %f: no mixer", gain);
         return;
     }
 
-    if(!al_set_mixer_gain(mixer, gain))
+    if(!al_set_mixer_gain(default_mixer, gain))
         video_showmessage("Can't set the global gain to %f", gain);
 }
\ No newline at end of file
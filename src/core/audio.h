@@ -22,10 +22,12 @@
 #define _AUDIO_H
 
 #include <stdbool.h>
+#include "../util/v2d.h"
 
 /* forward declarations */
 typedef struct music_t music_t;
 typedef struct sound_t sound_t;
+typedef struct audiosource_t audiosource_t;
 
 /* audio manager */
 void audio_init();
@@ -37,11 +39,14 @@ float audio_get_master_volume();
 void audio_set_master_volume(float volume); /* 0.0 <= volume <= 1.0 (default) */
 bool audio_is_muted();
 void audio_set_muted(bool muted); /* global mute / unmute */
+void audio_set_listener(v2d_t position, v2d_t camera); /* the listener of the positional audio sources */
+void audio_set_sample_compaction(bool enabled); /* decode samples as 16-bit mono at a reduced frequency to save memory */
 
 /* music management */
 music_t *music_load(const char *path); /* will be unloaded automatically */
 void music_destroy(music_t *music); /* you don't usually need to bother with this. */
 void music_play(music_t *music, bool loop); /* plays a music. Set loop to TRUE to make it loop continuously. */
+void music_crossfade(music_t *music, bool loop, float seconds); /* plays a music, crossfading it with the current one */
 void music_stop();
 void music_pause();
 void music_resume();
@@ -64,5 +69,17 @@ bool sound_is_playing(sound_t *sample);
 int sound_unref(sound_t *sample); /* returns the number of active references */
 float sound_get_volume(sound_t *sample);
 void sound_set_volume(sound_t *sample, float volume); /* volume is in the [0,1] range */
+size_t sound_memory_usage(const sound_t *sample); /* size of the sample data, in bytes */
+size_t sound_original_memory_usage(const sound_t *sample); /* size of the sample data before it was compacted, in bytes */
+const char *sound_path(const sound_t *sample); /* the relative path of the sample */
+
+/* positional audio: sources attenuated by their distance to the listener */
+audiosource_t* audiosource_create(sound_t *sample); /* sources of the same sample are mixed together */
+void audiosource_destroy(audiosource_t *source);
+void audiosource_set_position(audiosource_t *source, v2d_t position); /* world position */
+void audiosource_set_distances(audiosource_t *source, float mindist, float maxdist); /* linear falloff between mindist and maxdist */
+void audiosource_set_horizontal(audiosource_t *source, bool horizontal, float line_height); /* measure the distance to a horizontal line instead of a point */
+void audiosource_set_volume(audiosource_t *source, float volume); /* base volume, in the [0,1] range */
+void audiosource_set_enabled(audiosource_t *source, bool enabled);
 
 #endif
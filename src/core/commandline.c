@@ -70,11 +70,32 @@ commandline_t commandline_parse(int argc, char **argv)
     cmd.hide_fps = COMMANDLINE_UNDEFINED;
 
     cmd.mobile = COMMANDLINE_UNDEFINED;
+    cmd.lazy_sprites = COMMANDLINE_UNDEFINED;
+    cmd.hot_reload = COMMANDLINE_UNDEFINED;
+    cmd.trace_startup = COMMANDLINE_UNDEFINED;
+    cmd.stream_levels = COMMANDLINE_UNDEFINED;
+    cmd.profile_objects = COMMANDLINE_UNDEFINED;
+    cmd.low_latency = COMMANDLINE_UNDEFINED;
+    cmd.adaptive_quality = COMMANDLINE_UNDEFINED;
+    cmd.profile_frames = COMMANDLINE_UNDEFINED;
+    cmd.headless = COMMANDLINE_UNDEFINED;
+    cmd.uncapped = COMMANDLINE_UNDEFINED;
+    cmd.seed = COMMANDLINE_UNDEFINED;
+    cmd.benchmark_frames = COMMANDLINE_UNDEFINED;
+    cmd.export_stats = COMMANDLINE_UNDEFINED;
     cmd.verbose = COMMANDLINE_UNDEFINED;
     cmd.compatibility_mode = COMMANDLINE_UNDEFINED;
     cmd.compatibility_version[0] = '\0';
+    cmd.physics_rate = COMMANDLINE_UNDEFINED;
+    cmd.gc_budget = COMMANDLINE_UNDEFINED;
+    cmd.memory_budget = COMMANDLINE_UNDEFINED;
 
     cmd.custom_level_path[0] = '\0';
+    cmd.record_input_path[0] = '\0';
+    cmd.replay_input_path[0] = '\0';
+    cmd.benchmark_level_path[0] = '\0';
+    cmd.benchmark_json_path[0] = '\0';
+    cmd.export_stats_url[0] = '\0';
     cmd.custom_quest_path[0] = '\0';
     cmd.language_filepath[0] = '\0';
     cmd.gamedir[0] = '\0';
@@ -116,6 +137,27 @@ commandline_t commandline_parse(int argc, char **argv)
                 "    --import-wizard                  import an Open Surge game using a wizard\n"
                 "    --mobile                         enable mobile device simulation\n"
                 "    --verbose                        enable verbose logging with debug messages\n"
+                "    --lazy-sprites                   load each sprite on first use instead of at startup\n"
+                "    --hot-reload                     reload modified sprites, images, language files and scripts while the game runs\n"
+                "    --trace-startup                  measure the phases of the startup and write a report\n"
+                "    --stream-levels                  load the bricks of the levels by region as the camera moves\n"
+                "    --profile-objects                count the work of each kind of legacy object and write a report on exit\n"
+                "    --low-latency                    read the input just before the update and render right after it, reporting the latency\n"
+                "    --adaptive-quality               disable costly effects and skip frames under load to keep the game at full speed\n"
+                "    --profile-frames                 measure the update, render, present & GC times of the frames and write a report on exit\n"
+                "    --headless                       run the simulation without a window, without rendering, as fast as possible\n"
+                "    --uncapped [K]                   update as fast as possible at a fixed timestep, render every K-th frame (default: never) and report the speed\n"
+                "    --physics-rate HZ                run the physics at a fixed rate, independent of the framerate\n"
+                "    --gc-budget US                   spend at most US microseconds per frame releasing unused resources (0: all at once)\n"
+                "    --memory-budget MB               release unused images and sounds early to keep them within MB megabytes (0: unlimited)\n"
+                "    --record-input \"filepath\"        record the user input of each frame to the specified file\n"
+                "    --replay-input \"filepath\"        replay the user input recorded in the specified file, then quit\n"
+                "    --seed N                         seed the random number generators of the scripts with N\n"
+                "    --benchmark \"filepath\"           run the specified level as fast as possible, print performance metrics and quit\n"
+                "    --frames N                       the number of frames of --benchmark (default: 600)\n"
+                "    --benchmark-json \"filepath\"      also write the metrics of --benchmark to the specified file as JSON\n"
+                "    --export-stats SECONDS           every SECONDS, append performance counters to a rolling CSV file in the user directory\n"
+                "    --export-stats-url \"url\"         also send the performance counters of --export-stats to the specified URL\n"
                 "    -- -arg1 -arg2 -arg3...          user-defined arguments to be used in the scripting layer",
                 GAME_COPYRIGHT, program
             );
@@ -190,6 +232,137 @@ commandline_t commandline_parse(int argc, char **argv)
         else if(strcmp(argv[i], "--verbose") == 0)
             cmd.verbose = TRUE;
 
+        else if(strcmp(argv[i], "--lazy-sprites") == 0)
+            cmd.lazy_sprites = TRUE;
+
+        else if(strcmp(argv[i], "--hot-reload") == 0)
+            cmd.hot_reload = TRUE;
+
+        else if(strcmp(argv[i], "--trace-startup") == 0)
+            cmd.trace_startup = TRUE;
+
+        else if(strcmp(argv[i], "--stream-levels") == 0)
+            cmd.stream_levels = TRUE;
+
+        else if(strcmp(argv[i], "--profile-objects") == 0)
+            cmd.profile_objects = TRUE;
+
+        else if(strcmp(argv[i], "--low-latency") == 0)
+            cmd.low_latency = TRUE;
+
+        else if(strcmp(argv[i], "--adaptive-quality") == 0)
+            cmd.adaptive_quality = TRUE;
+
+        else if(strcmp(argv[i], "--profile-frames") == 0)
+            cmd.profile_frames = TRUE;
+
+        else if(strcmp(argv[i], "--headless") == 0)
+            cmd.headless = TRUE;
+
+        else if(strcmp(argv[i], "--uncapped") == 0) {
+            cmd.uncapped = 0;
+            if(i+1 < argc && *(argv[i+1]) != '-') {
+                cmd.uncapped = atoi(argv[++i]);
+                if(cmd.uncapped < 0)
+                    crash("Invalid render interval: %s. Use a non-negative integer", argv[i]);
+            }
+        }
+
+        else if(strcmp(argv[i], "--physics-rate") == 0) {
+            if(++i < argc && *(argv[i]) != '-') {
+                cmd.physics_rate = atoi(argv[i]);
+                if(cmd.physics_rate < 30 || cmd.physics_rate > 1000)
+                    crash("Invalid physics rate: %s. Use a value between 30 and 1000 Hz", argv[i]);
+            }
+            else
+                crash("%s: missing --physics-rate parameter", program);
+        }
+
+        else if(strcmp(argv[i], "--gc-budget") == 0) {
+            if(++i < argc && *(argv[i]) != '-') {
+                cmd.gc_budget = atoi(argv[i]);
+                if(cmd.gc_budget < 0 || cmd.gc_budget > 1000000)
+                    crash("Invalid GC budget: %s. Use a value between 0 and 1000000 microseconds", argv[i]);
+            }
+            else
+                crash("%s: missing --gc-budget parameter", program);
+        }
+
+        else if(strcmp(argv[i], "--memory-budget") == 0) {
+            if(++i < argc && *(argv[i]) != '-') {
+                cmd.memory_budget = atoi(argv[i]);
+                if(cmd.memory_budget < 0 || cmd.memory_budget > 65536)
+                    crash("Invalid memory budget: %s. Use a value between 0 and 65536 megabytes", argv[i]);
+            }
+            else
+                crash("%s: missing --memory-budget parameter", program);
+        }
+
+        else if(strcmp(argv[i], "--seed") == 0) {
+            if(++i < argc && *(argv[i]) != '-') {
+                cmd.seed = atoi(argv[i]);
+                if(cmd.seed < 0)
+                    crash("Invalid seed: %s. Use a non-negative integer", argv[i]);
+            }
+            else
+                crash("%s: missing --seed parameter", program);
+        }
+
+        else if(strcmp(argv[i], "--benchmark") == 0) {
+            if(++i < argc && *(argv[i]) != '-')
+                str_cpy(cmd.benchmark_level_path, argv[i], sizeof(cmd.benchmark_level_path));
+            else
+                crash("%s: missing --benchmark parameter", program);
+        }
+
+        else if(strcmp(argv[i], "--benchmark-json") == 0) {
+            if(++i < argc && *(argv[i]) != '-')
+                str_cpy(cmd.benchmark_json_path, argv[i], sizeof(cmd.benchmark_json_path));
+            else
+                crash("%s: missing --benchmark-json parameter", program);
+        }
+
+        else if(strcmp(argv[i], "--frames") == 0) {
+            if(++i < argc && *(argv[i]) != '-') {
+                cmd.benchmark_frames = atoi(argv[i]);
+                if(cmd.benchmark_frames <= 0)
+                    crash("Invalid number of frames: %s. Use a positive integer", argv[i]);
+            }
+            else
+                crash("%s: missing --frames parameter", program);
+        }
+
+        else if(strcmp(argv[i], "--export-stats") == 0) {
+            if(++i < argc && *(argv[i]) != '-') {
+                cmd.export_stats = atoi(argv[i]);
+                if(cmd.export_stats <= 0)
+                    crash("Invalid interval: %s. Use a positive number of seconds", argv[i]);
+            }
+            else
+                crash("%s: missing --export-stats parameter", program);
+        }
+
+        else if(strcmp(argv[i], "--export-stats-url") == 0) {
+            if(++i < argc && *(argv[i]) != '-')
+                str_cpy(cmd.export_stats_url, argv[i], sizeof(cmd.export_stats_url));
+            else
+                crash("%s: missing --export-stats-url parameter", program);
+        }
+
+        else if(strcmp(argv[i], "--record-input") == 0) {
+            if(++i < argc && *(argv[i]) != '-')
+                str_cpy(cmd.record_input_path, argv[i], sizeof(cmd.record_input_path));
+            else
+                crash("%s: missing --record-input parameter", program);
+        }
+
+        else if(strcmp(argv[i], "--replay-input") == 0) {
+            if(++i < argc && *(argv[i]) != '-')
+                str_cpy(cmd.replay_input_path, argv[i], sizeof(cmd.replay_input_path));
+            else
+                crash("%s: missing --replay-input parameter", program);
+        }
+
         else if(strcmp(argv[i], "--level") == 0) {
             if(++i < argc && *(argv[i]) != '-')
                 str_cpy(cmd.custom_level_path, argv[i], sizeof(cmd.custom_level_path));
@@ -39,12 +39,33 @@ struct commandline_t
     int verbose;
     int compatibility_mode;
     char compatibility_version[16];
+    int physics_rate;
+    int gc_budget;
+    int memory_budget;
+    int lazy_sprites;
+    int hot_reload;
+    int trace_startup;
+    int stream_levels;
+    int profile_objects;
+    int low_latency;
+    int adaptive_quality;
+    int profile_frames;
+    int headless;
+    int uncapped;
+    int seed;
+    int benchmark_frames;
+    int export_stats;
 
     /* filepaths */
     char gamedir[COMMANDLINE_PATHMAX];
     char custom_level_path[COMMANDLINE_PATHMAX];
     char custom_quest_path[COMMANDLINE_PATHMAX];
     char language_filepath[COMMANDLINE_PATHMAX];
+    char record_input_path[COMMANDLINE_PATHMAX];
+    char replay_input_path[COMMANDLINE_PATHMAX];
+    char benchmark_level_path[COMMANDLINE_PATHMAX];
+    char benchmark_json_path[COMMANDLINE_PATHMAX];
+    char export_stats_url[COMMANDLINE_PATHMAX];
 
     /* user arguments: what comes after "--" */
     const char** user_argv;
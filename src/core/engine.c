@@ -18,7 +18,10 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <locale.h>
 #include <time.h>
@@ -30,14 +33,20 @@
 #include "resourcemanager.h"
 #include "logfile.h"
 #include "timer.h"
+#include "jobs.h"
+#include "trace.h"
 #include "video.h"
 #include "audio.h"
 #include "input.h"
+#include "web.h"
+#include "hotreload.h"
 #include "font.h"
 #include "sprite.h"
 #include "lang.h"
 #include "screenshot.h"
 #include "fadefx.h"
+#include "frameprofiler.h"
+#include "inputrecorder.h"
 #include "prefs.h"
 #include "commandline.h"
 #include "modutils.h"
@@ -45,6 +54,10 @@
 #include "config.h"
 #include "../util/util.h"
 #include "../util/stringutil.h"
+#include "../util/profiler.h"
+#include "../util/memtracker.h"
+#include "../util/arena.h"
+#include "../util/atom.h"
 #include "../entities/legacy/enemy.h"
 #include "../entities/legacy/nanocalc/nanocalc.h"
 #include "../entities/legacy/nanocalc/nanocalc_addons.h"
@@ -56,13 +69,23 @@
 #include "../entities/mobilegamepad.h"
 #include "../scripting/scripting.h"
 #include "../scripting/loaderthread.h"
+#include "../physics/physicsactor.h"
+#include "../physics/collisionmask.h"
 #include "../scenes/quest.h"
 #include "../scenes/level.h"
+#include "../scenes/util/levparser.h"
+#include "../scenes/util/levsaver.h"
 
 #include <allegro5/allegro.h>
 #include <allegro5/allegro_audio.h>
 #include <allegro5/allegro_native_dialog.h>
 
+/* OS-specific includes */
+#if !defined(_WIN32) && (defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__)))
+#include <sys/resource.h>
+#define HAVE_GETRUSAGE 1
+#endif
+
 /* minimum Allegro version */
 #if ALLEGRO_VERSION_INT < ALLEGRO_MIN_VERSION_INT
 #error "This build requires a newer version of Allegro"
@@ -102,13 +125,25 @@ static ALLEGRO_EVENT_QUEUE* a5_event_queue = NULL;
 static void a5_handle_timer_event(const ALLEGRO_EVENT* event, void* data);
 static void a5_handle_haltresume_event(const ALLEGRO_EVENT* event, void* data);
 static void a5_handle_hotkey(const ALLEGRO_EVENT* event, void* data);
+static void a5_handle_activity_event(const ALLEGRO_EVENT* event, void* data);
 
 static void a5_handle_remaining_display_events();
+static void update_frame();
+static void render_frame(scene_t* scene);
+static void run_low_latency_loop(const bool* can_draw);
+static void run_uncapped_loop(int render_interval, const bool* can_draw);
+static void report_frame_pacing(int frames, double total_frame_time, double max_frame_time, double total_latency, double max_latency);
+static void report_benchmark(int frames, double elapsed_time);
+static void benchmark_print(const char* fmt, ...);
+static void write_benchmark_json(const char* filepath, int frames, double elapsed_time);
+static size_t peak_memory_usage();
 
 
 
 /* private stuff ;) */
 static void clean_garbage();
+static void report_gc_pauses(int total_steps);
+static int compare_gc_pauses(const void* a, const void* b);
 static void render_overlay();
 static void init_basic_stuff(const commandline_t* cmd);
 static void init_managers(const commandline_t* cmd);
@@ -128,11 +163,69 @@ static const char* INTRO_QUEST = "quests/intro.qst";
 static const char* SSAPP_LEVEL = "levels/surgescript.lev";
 static const double TARGET_FPS = 60.0; /* frames per second */
 static const double GC_INTERVAL = 10.0; /* in seconds (garbage collector) */
+static const int DEFAULT_GC_BUDGET = 500; /* in microseconds per frame; 0 means collecting everything at once */
+#define GC_MAX_PAUSES 256 /* how many pauses of a pass of the garbage collector we keep for the statistics */
+static double gc_pause[GC_MAX_PAUSES]; /* in seconds */
+static int gc_pause_count = 0;
+static int gc_budget = 0; /* in microseconds */
 static ALLEGRO_TIMER* a5_timer = NULL;
+static bool low_latency_mode = false; /* use the latency-optimized main loop */
+static bool headless_mode = false; /* simulate without a display */
+static int uncapped_render_interval = -1; /* if non-negative, update as fast as possible and render every n-th frame (0: never) */
+static int benchmark_frames = 0; /* if positive, run a level for this many frames in the uncapped loop, print its metrics and quit */
+static double benchmark_load_time = 0.0; /* in seconds */
+static const int DEFAULT_BENCHMARK_FRAMES = 600;
+static int gc_total_pauses = 0; /* statistics of all passes of the garbage collector */
+static double gc_total_pause_time = 0.0; /* in seconds */
+static double gc_max_pause_time = 0.0; /* in seconds */
+static double gc_recent_max_pause_time = 0.0; /* in seconds; since the last export of the performance counters */
+static const double LOW_LATENCY_MARGIN = 0.002; /* in seconds; the slack given to the predicted duration of a frame */
 static bool wants_to_quit = false;
 static bool wants_to_restart = false;
 static bool is_initialized = false;
 static commandline_t stored_cmd;
+static arena_t* update_arena = NULL; /* scratch memory of the update phase of the frame */
+static arena_t* render_arena = NULL; /* scratch memory of the render phase of the frame */
+static arena_t* current_arena = NULL; /* one of the above */
+static const size_t FRAME_ARENA_CAPACITY = 64 * 1024; /* initial capacity, in bytes */
+
+/* idle throttling: lower the update rate while the scene is static */
+static const double IDLE_FPS = 15.0; /* frames per second */
+static const int IDLE_THRESHOLD = 30; /* consecutive unchanged frames before throttling */
+static int unchanged_frames = 0;
+static bool is_idle = false;
+static void update_idle_mode();
+static void set_idle_mode(bool idle);
+
+/* power-aware rendering on constrained devices */
+static const double POWER_CHECK_INTERVAL = 10.0; /* in seconds */
+static double power_last_check = -1.0; /* time of the last check, in seconds */
+static void update_power_mode();
+
+/* periodic export of performance counters, for long-running deployments */
+typedef struct perfcounter_t perfcounter_t;
+struct perfcounter_t {
+    const char* name;
+    double value;
+    int precision; /* number of decimal places */
+};
+#define MAX_PERFCOUNTERS 32
+static int stats_interval = 0; /* in seconds; if positive, export the performance counters periodically */
+static double stats_last_time = 0.0; /* time of the last export, in seconds */
+static int64_t stats_last_frame = 0; /* frame of the last export */
+static int stats_last_gc_pauses = 0; /* gc_total_pauses at the last export */
+static double stats_last_gc_pause_time = 0.0; /* gc_total_pause_time at the last export */
+static ALLEGRO_FILE* stats_file = NULL; /* one of the rolling files */
+static int stats_file_index = 0;
+static int64_t stats_file_size = 0; /* in bytes */
+static const char* STATS_FILE[] = { "perf_stats.0.csv", "perf_stats.1.csv" }; /* the files of the write directory in which we roll */
+static const int64_t STATS_MAX_FILE_SIZE = 1024 * 1024; /* in bytes; switch to the other file when this size is reached */
+static void init_stats_export(const commandline_t* cmd);
+static void release_stats_export();
+static void export_stats();
+static int collect_stats(perfcounter_t* counter, int max_counters);
+static void write_stats(const perfcounter_t* counter, int count);
+static void send_stats(const perfcounter_t* counter, int count);
 
 /* Global Prefs */
 prefs_t* prefs = NULL; /* public */
@@ -163,13 +256,18 @@ void engine_init(const commandline_t* cmd)
     /* initialize game data */
     player_set_lives(PLAYER_INITIAL_LIVES);
     player_set_score(0);
+    trace_begin("push_initial_scene");
     push_initial_scene(cmd);
+    trace_end();
 
     /* initialize in immersive mode */
     video_set_immersive(true);
 
     /* perform extra validation */
     perform_extra_validation(cmd);
+
+    /* the startup is complete, except for the loading of the first level */
+    trace_end();
 }
 
 
@@ -181,6 +279,7 @@ void engine_init(const commandline_t* cmd)
 void engine_release()
 {
     is_initialized = false;
+    trace_finish(); /* if we haven't already */
 
     release_accessories();
     release_managers();
@@ -208,10 +307,37 @@ void engine_mainloop()
     if(NULL == (a5_timer = al_create_timer(1.0 / TARGET_FPS)))
         fatal_error("Can't create an Allegro timer");
 
+    /* simulation without a display, or as fast as possible */
+    if(headless_mode || uncapped_render_interval >= 0) {
+        run_uncapped_loop(headless_mode ? 0 : uncapped_render_interval, &can_draw);
+        al_destroy_timer(a5_timer);
+        a5_handle_remaining_display_events();
+        return;
+    }
+
+    /* latency-optimized game loop */
+    if(low_latency_mode) {
+        run_low_latency_loop(&can_draw);
+        al_destroy_timer(a5_timer);
+        a5_handle_remaining_display_events();
+        return;
+    }
+
     engine_add_event_source(al_get_timer_event_source(a5_timer));
     engine_add_event_listener(ALLEGRO_EVENT_TIMER, &is_ready_to_draw, a5_handle_timer_event);
     al_start_timer(a5_timer);
 
+    /* leave the idle mode as soon as the user does something */
+    static const ALLEGRO_EVENT_TYPE activity_events[] = {
+        ALLEGRO_EVENT_KEY_DOWN, ALLEGRO_EVENT_KEY_UP, ALLEGRO_EVENT_KEY_CHAR,
+        ALLEGRO_EVENT_MOUSE_AXES, ALLEGRO_EVENT_MOUSE_BUTTON_DOWN, ALLEGRO_EVENT_MOUSE_BUTTON_UP,
+        ALLEGRO_EVENT_JOYSTICK_AXIS, ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN, ALLEGRO_EVENT_JOYSTICK_BUTTON_UP,
+        ALLEGRO_EVENT_TOUCH_BEGIN, ALLEGRO_EVENT_TOUCH_MOVE, ALLEGRO_EVENT_TOUCH_END,
+        ALLEGRO_EVENT_DISPLAY_RESIZE, ALLEGRO_EVENT_DISPLAY_SWITCH_IN
+    };
+    for(int i = 0; i < sizeof(activity_events) / sizeof(activity_events[0]); i++)
+        engine_add_event_listener(activity_events[i], NULL, a5_handle_activity_event);
+
     /* game loop */
     while(!wants_to_quit && !wants_to_restart && !scenestack_empty()) {
         const scene_t* scene = scenestack_top();
@@ -227,11 +353,11 @@ void engine_mainloop()
 
         /* render */
         if(can_draw && is_ready_to_draw && al_is_event_queue_empty(a5_event_queue)) {
-            current_scene->render();
-            fadefx_update();
-            video_render(render_overlay);
-            screenshot_update();
+            render_frame(current_scene);
             is_ready_to_draw = false;
+
+            /* throttle the update rate if nothing changes */
+            update_idle_mode();
         }
     }
 
@@ -239,10 +365,701 @@ void engine_mainloop()
     al_stop_timer(a5_timer);
     al_destroy_timer(a5_timer);
 
+    /* the next game loop starts at full speed */
+    is_idle = false;
+    unchanged_frames = 0;
+    video_set_idle(false);
+
     /* cleanup */
     a5_handle_remaining_display_events();
 }
 
+/*
+ * run_low_latency_loop()
+ * A game loop that minimizes the time between reading the input and
+ * presenting the frame. Instead of waiting for timer events, it sleeps
+ * until the latest moment that still meets the deadline of the next
+ * frame, handles the pending events (i.e., reads the input), updates
+ * the game and renders right away. With vsync, the deadline follows
+ * the flips of the display
+ */
+void run_low_latency_loop(const bool* can_draw)
+{
+    const double frame_time = 1.0 / TARGET_FPS;
+    double deadline = al_get_time() + frame_time;
+    double work_time = 0.0; /* predicted time to update and render a frame */
+    double last_presentation = al_get_time();
+    double total_frame_time = 0.0, max_frame_time = 0.0;
+    double total_latency = 0.0, max_latency = 0.0;
+    int frames = 0;
+    ALLEGRO_EVENT event;
+
+    logfile_message("Using the low-latency main loop");
+
+    while(!wants_to_quit && !wants_to_restart && !scenestack_empty()) {
+
+        /* the display can't be drawn: wait for it to resume */
+        if(!*can_draw) {
+            al_wait_for_event(a5_event_queue, &event);
+            call_event_listeners(&event);
+            deadline = al_get_time() + frame_time;
+            last_presentation = al_get_time();
+            continue;
+        }
+
+        /* sleep until the latest moment that meets the deadline */
+        double wake_time = deadline - work_time - LOW_LATENCY_MARGIN;
+        double now = al_get_time();
+        if(now < wake_time)
+            al_rest(wake_time - now);
+
+        /* read the input */
+        double start = al_get_time();
+        while(al_get_next_event(a5_event_queue, &event))
+            call_event_listeners(&event);
+        if(wants_to_quit || wants_to_restart || scenestack_empty() || !*can_draw)
+            continue;
+
+        /* update and render, unless the scene changed */
+        const scene_t* scene = scenestack_top();
+        update_frame();
+        scene_t* current_scene = scenestack_top();
+        if(current_scene != scene)
+            continue;
+
+        render_frame(current_scene);
+        double end = al_get_time();
+
+        /* predict the duration of the next frame: follow spikes immediately, decay slowly */
+        double elapsed = end - start;
+        work_time = max(elapsed, 0.9 * work_time + 0.1 * elapsed);
+
+        /* the next deadline. If we've missed this one
+           (e.g., the flip waited for vsync), resynchronize */
+        deadline += frame_time;
+        if(end > deadline)
+            deadline = end + frame_time;
+
+        /* measure: the latency is the time from reading the input to presenting the frame */
+        double interval = end - last_presentation;
+        last_presentation = end;
+        total_frame_time += interval;
+        max_frame_time = max(max_frame_time, interval);
+        total_latency += elapsed;
+        max_latency = max(max_latency, elapsed);
+        frames++;
+    }
+
+    report_frame_pacing(frames, total_frame_time, max_frame_time, total_latency, max_latency);
+}
+
+/*
+ * run_uncapped_loop()
+ * A game loop that updates the game as fast as possible. Time advances
+ * by a fixed step at each frame, so that the simulation doesn't depend
+ * on the speed of the machine. A frame is rendered every render_interval
+ * updates; if render_interval is zero, nothing is rendered and only the
+ * fades, which are timed by their rendering, are advanced. This is used
+ * in headless mode and to measure the throughput of the update path
+ */
+void run_uncapped_loop(int render_interval, const bool* can_draw)
+{
+    double start = al_get_time();
+    int frames = 0, rendered_frames = 0;
+    ALLEGRO_EVENT event;
+
+    if(render_interval > 0)
+        logfile_message("Using the uncapped main loop, rendering every %d frames", render_interval);
+    else
+        logfile_message("Using the uncapped main loop, without rendering");
+    timer_set_fixed_delta(1.0 / TARGET_FPS);
+
+    while(!wants_to_quit && !wants_to_restart && !scenestack_empty()) {
+
+        /* the benchmark is over */
+        if(benchmark_frames > 0 && frames >= benchmark_frames)
+            break;
+
+        /* handle the pending events without waiting */
+        while(al_get_next_event(a5_event_queue, &event))
+            call_event_listeners(&event);
+        if(wants_to_quit || wants_to_restart || scenestack_empty())
+            break;
+
+        /* update */
+        const scene_t* scene = scenestack_top();
+        update_frame();
+        frames++;
+
+        /* render every n-th frame, unless the scene changed */
+        scene_t* current_scene = scenestack_top();
+        if(current_scene != scene)
+            continue;
+
+        if(render_interval > 0 && *can_draw && frames % render_interval == 0) {
+            render_frame(current_scene);
+            rendered_frames++;
+        }
+        else
+            fadefx_update();
+    }
+
+    timer_set_fixed_delta(0.0);
+
+    /* report */
+    double elapsed = al_get_time() - start;
+    logfile_message(
+        "Uncapped loop: %d frames (%.3f seconds of game time) simulated in %.3f seconds, %d of them rendered: %.1f simulated frames per second",
+        frames, frames / TARGET_FPS, elapsed, rendered_frames, elapsed > 0.0 ? frames / elapsed : 0.0
+    );
+
+    /* benchmark */
+    if(benchmark_frames > 0)
+        report_benchmark(frames, elapsed);
+}
+
+/*
+ * report_benchmark()
+ * Prints the performance metrics of a benchmark to stdout and to the logfile
+ */
+void report_benchmark(int frames, double elapsed_time)
+{
+    const char* level_path = commandline_getstring(stored_cmd.benchmark_level_path, "");
+    size_t peak_memory = peak_memory_usage();
+    resourcemanagerstats_t resources = resourcemanager_stats();
+
+    benchmark_print("benchmark: %s", level_path);
+    benchmark_print("frames: %d (%.3f seconds)", frames, elapsed_time);
+    benchmark_print("load_ms: %.3f", 1000.0 * benchmark_load_time);
+
+    benchmark_print("update_ms: mean %.3f, p99 %.3f",
+        1000.0 * frameprofiler_mean(FRAMEPHASE_UPDATE),
+        1000.0 * frameprofiler_percentile(FRAMEPHASE_UPDATE, 99.0)
+    );
+
+    benchmark_print("render_ms: mean %.3f, p99 %.3f",
+        1000.0 * frameprofiler_mean(FRAMEPHASE_RENDER),
+        1000.0 * frameprofiler_percentile(FRAMEPHASE_RENDER, 99.0)
+    );
+
+    benchmark_print("present_ms: mean %.3f, p99 %.3f",
+        1000.0 * frameprofiler_mean(FRAMEPHASE_PRESENT),
+        1000.0 * frameprofiler_percentile(FRAMEPHASE_PRESENT, 99.0)
+    );
+
+    if(peak_memory > 0)
+        benchmark_print("peak_memory_mb: %.1f", peak_memory / (1024.0 * 1024.0));
+    else
+        benchmark_print("peak_memory_mb: unavailable");
+
+    benchmark_print("resource_memory_mb: %.1f (images %.1f, samples %.1f)",
+        (resources.image_bytes + resources.sample_bytes) / (1024.0 * 1024.0),
+        resources.image_bytes / (1024.0 * 1024.0),
+        resources.sample_bytes / (1024.0 * 1024.0)
+    );
+
+    benchmark_print("gc_pauses: %d, total %.3f ms, max %.3f ms",
+        gc_total_pauses, 1000.0 * gc_total_pause_time, 1000.0 * gc_max_pause_time
+    );
+
+    size_t update_arena_peak, render_arena_peak;
+    engine_frame_arena_stats(&update_arena_peak, &render_arena_peak);
+    benchmark_print("frame_arena_kb: update %.1f, render %.1f (high-water marks)",
+        update_arena_peak / 1024.0, render_arena_peak / 1024.0
+    );
+
+    /* entities, as of the last frame */
+    if(!scenestack_empty() && scenestack_top() == storyboard_get_scene(SCENE_LEVEL)) {
+        levelstats_t stats = level_stats();
+
+        benchmark_print("obstacles: %d", stats.obstacles);
+        benchmark_print("bricks: %d (%d active)", stats.bricks, stats.active_bricks);
+        benchmark_print("active_legacy_entities: %d items, %d objects", stats.active_legacy_items, stats.active_legacy_objects);
+        benchmark_print("ssobjects: %d", stats.ssobjects);
+    }
+    else
+        benchmark_print("the level has been left before the end of the benchmark");
+
+    /* render batches, averaged over the last frames */
+    if(renderqueue_is_profiler_enabled()) {
+        const renderqueue_profile_t* profile;
+        int type_count = renderqueue_profile(&profile);
+        const renderqueue_profile_t* total = &profile[type_count];
+
+        benchmark_print("render_batches: %.1f per frame (%.1f entries, %.1f draw calls)",
+            total->batches, total->entries, total->draw_calls
+        );
+    }
+
+    /* machine-readable report */
+    const char* json_path = commandline_getstring(stored_cmd.benchmark_json_path, NULL);
+    if(json_path != NULL)
+        write_benchmark_json(json_path, frames, elapsed_time);
+}
+
+/*
+ * write_benchmark_json()
+ * Writes the performance metrics of a benchmark to a file as a flat JSON
+ * object, so that the results of different builds can be compared by tools
+ */
+void write_benchmark_json(const char* filepath, int frames, double elapsed_time)
+{
+    const char* level_path = commandline_getstring(stored_cmd.benchmark_level_path, "");
+    resourcemanagerstats_t resources = resourcemanager_stats();
+    perfcounter_t counter[MAX_PERFCOUNTERS];
+    size_t update_arena_peak, render_arena_peak;
+    ALLEGRO_FILE* fp;
+    char buffer[256];
+    int n = 0;
+
+    #define COUNTER(counter_name, counter_value, counter_precision) do { \
+        if(n < MAX_PERFCOUNTERS) { \
+            counter[n].name = (counter_name); \
+            counter[n].value = (double)(counter_value); \
+            counter[n].precision = (counter_precision); \
+            n++; \
+        } \
+    } while(0)
+
+    /* time */
+    COUNTER("frames", frames, 0);
+    COUNTER("elapsed_s", elapsed_time, 3);
+    COUNTER("headless", headless_mode ? 1 : 0, 0);
+    COUNTER("load_ms", 1000.0 * benchmark_load_time, 3);
+    COUNTER("update_mean_ms", 1000.0 * frameprofiler_mean(FRAMEPHASE_UPDATE), 3);
+    COUNTER("update_p99_ms", 1000.0 * frameprofiler_percentile(FRAMEPHASE_UPDATE, 99.0), 3);
+    COUNTER("render_mean_ms", 1000.0 * frameprofiler_mean(FRAMEPHASE_RENDER), 3);
+    COUNTER("render_p99_ms", 1000.0 * frameprofiler_percentile(FRAMEPHASE_RENDER, 99.0), 3);
+    COUNTER("present_mean_ms", 1000.0 * frameprofiler_mean(FRAMEPHASE_PRESENT), 3);
+    COUNTER("present_p99_ms", 1000.0 * frameprofiler_percentile(FRAMEPHASE_PRESENT, 99.0), 3);
+
+    /* memory */
+    engine_frame_arena_stats(&update_arena_peak, &render_arena_peak);
+    COUNTER("peak_memory_mb", peak_memory_usage() / (1024.0 * 1024.0), 1);
+    COUNTER("image_mb", resources.image_bytes / (1024.0 * 1024.0), 1);
+    COUNTER("sample_mb", resources.sample_bytes / (1024.0 * 1024.0), 1);
+    COUNTER("update_arena_kb", update_arena_peak / 1024.0, 1);
+    COUNTER("render_arena_kb", render_arena_peak / 1024.0, 1);
+
+    /* garbage collector */
+    COUNTER("gc_pauses", gc_total_pauses, 0);
+    COUNTER("gc_pause_ms", 1000.0 * gc_total_pause_time, 3);
+    COUNTER("gc_max_pause_ms", 1000.0 * gc_max_pause_time, 3);
+
+    /* entities, as of the last frame. Omitted if the level has been left */
+    if(!scenestack_empty() && scenestack_top() == storyboard_get_scene(SCENE_LEVEL)) {
+        levelstats_t stats = level_stats();
+
+        COUNTER("obstacles", stats.obstacles, 0);
+        COUNTER("bricks", stats.bricks, 0);
+        COUNTER("active_bricks", stats.active_bricks, 0);
+        COUNTER("active_legacy_items", stats.active_legacy_items, 0);
+        COUNTER("active_legacy_objects", stats.active_legacy_objects, 0);
+        COUNTER("ssobjects", stats.ssobjects, 0);
+    }
+
+    /* render batches, averaged over the last frames */
+    if(renderqueue_is_profiler_enabled()) {
+        const renderqueue_profile_t* profile;
+        int type_count = renderqueue_profile(&profile);
+
+        COUNTER("render_batches", profile[type_count].batches, 1);
+        COUNTER("render_entries", profile[type_count].entries, 1);
+        COUNTER("draw_calls", profile[type_count].draw_calls, 1);
+    }
+
+    #undef COUNTER
+
+    /* write the file */
+    if(NULL == (fp = al_fopen(filepath, "wb"))) {
+        logfile_message("Can't write the benchmark report to %s", filepath);
+        return;
+    }
+
+    al_fputs(fp, "{\n  \"level\": \"");
+    for(const char* p = level_path; *p; p++) {
+        if(*p == '"' || *p == '\\')
+            al_fputc(fp, '\\');
+        al_fputc(fp, *p);
+    }
+    al_fputs(fp, "\"");
+
+    for(int i = 0; i < n; i++) {
+        snprintf(buffer, sizeof(buffer), ",\n  \"%s\": %.*f", counter[i].name, counter[i].precision, counter[i].value);
+        al_fputs(fp, buffer);
+    }
+
+    al_fputs(fp, "\n}\n");
+    al_fclose(fp);
+
+    logfile_message("The benchmark report has been written to %s", filepath);
+}
+
+/*
+ * benchmark_print()
+ * Prints a line of the report of the benchmark
+ */
+void benchmark_print(const char* fmt, ...)
+{
+    char buffer[1024];
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+
+    fprintf(stdout, "%s\n", buffer);
+    logfile_message("%s", buffer);
+}
+
+/*
+ * peak_memory_usage()
+ * The peak resident set size of this process, in bytes,
+ * or zero if it's not available in this platform
+ */
+size_t peak_memory_usage()
+{
+#if defined(HAVE_GETRUSAGE)
+    struct rusage usage;
+
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+
+#if defined(__APPLE__) && defined(__MACH__)
+    return (size_t)usage.ru_maxrss; /* bytes */
+#else
+    return (size_t)usage.ru_maxrss * 1024; /* kilobytes */
+#endif
+
+#else
+    return 0;
+#endif
+}
+
+/*
+ * init_stats_export()
+ * Prepares the periodic export of the performance counters, if enabled
+ */
+void init_stats_export(const commandline_t* cmd)
+{
+    stats_interval = commandline_getint(cmd->export_stats, 0);
+    if(stats_interval <= 0)
+        return;
+
+    stats_last_time = al_get_time();
+    stats_last_frame = timer_get_frames();
+    stats_last_gc_pauses = gc_total_pauses;
+    stats_last_gc_pause_time = gc_total_pause_time;
+    gc_recent_max_pause_time = 0.0;
+
+    stats_file = NULL;
+    stats_file_index = 0;
+    stats_file_size = 0;
+
+    logfile_message("Exporting the performance counters every %d second(s) to %s", stats_interval, STATS_FILE[0]);
+}
+
+/*
+ * release_stats_export()
+ * Closes the files of the performance counters
+ */
+void release_stats_export()
+{
+    if(stats_file != NULL) {
+        al_fclose(stats_file);
+        stats_file = NULL;
+    }
+
+    stats_interval = 0;
+}
+
+/*
+ * export_stats()
+ * Writes a snapshot of the performance counters to the rolling files
+ * and sends it to the URL specified in the command line, if any
+ */
+void export_stats()
+{
+    perfcounter_t counter[MAX_PERFCOUNTERS];
+    int count = collect_stats(counter, MAX_PERFCOUNTERS);
+
+    write_stats(counter, count);
+    send_stats(counter, count);
+
+    stats_last_time = al_get_time();
+    stats_last_frame = timer_get_frames();
+    stats_last_gc_pauses = gc_total_pauses;
+    stats_last_gc_pause_time = gc_total_pause_time;
+    gc_recent_max_pause_time = 0.0;
+}
+
+/*
+ * collect_stats()
+ * Takes a snapshot of the performance counters. Frame times refer to the
+ * recent frames of the frame profiler; GC pauses and the framerate refer
+ * to the time since the last export. Returns the number of counters
+ */
+int collect_stats(perfcounter_t* counter, int max_counters)
+{
+    double now = al_get_time();
+    double elapsed = now - stats_last_time;
+    int64_t frames = timer_get_frames() - stats_last_frame;
+    resourcemanagerstats_t resources = resourcemanager_stats();
+    const renderqueue_stats_t* queue = renderqueue_stats();
+    int n = 0;
+
+    #define COUNTER(counter_name, counter_value, counter_precision) do { \
+        if(n < max_counters) { \
+            counter[n].name = (counter_name); \
+            counter[n].value = (double)(counter_value); \
+            counter[n].precision = (counter_precision); \
+            n++; \
+        } \
+    } while(0)
+
+    /* time */
+    COUNTER("unix_time", (double)time(NULL), 0);
+    COUNTER("uptime_s", timer_get_elapsed(), 1);
+    COUNTER("fps", elapsed > 0.0 ? frames / elapsed : 0.0, 1);
+
+    /* frame times */
+    COUNTER("frame_p50_ms", 1000.0 * frameprofiler_percentile(FRAMEPHASE_FRAME, 50.0), 3);
+    COUNTER("frame_p95_ms", 1000.0 * frameprofiler_percentile(FRAMEPHASE_FRAME, 95.0), 3);
+    COUNTER("frame_p99_ms", 1000.0 * frameprofiler_percentile(FRAMEPHASE_FRAME, 99.0), 3);
+    COUNTER("frame_max_ms", 1000.0 * frameprofiler_percentile(FRAMEPHASE_FRAME, 100.0), 3);
+    COUNTER("update_p99_ms", 1000.0 * frameprofiler_percentile(FRAMEPHASE_UPDATE, 99.0), 3);
+    COUNTER("render_p99_ms", 1000.0 * frameprofiler_percentile(FRAMEPHASE_RENDER, 99.0), 3);
+
+    /* garbage collector */
+    COUNTER("gc_pauses", gc_total_pauses - stats_last_gc_pauses, 0);
+    COUNTER("gc_pause_ms", 1000.0 * (gc_total_pause_time - stats_last_gc_pause_time), 3);
+    COUNTER("gc_max_pause_ms", 1000.0 * gc_recent_max_pause_time, 3);
+
+    /* memory */
+    COUNTER("peak_memory_mb", peak_memory_usage() / (1024.0 * 1024.0), 1);
+    COUNTER("image_mb", resources.image_bytes / (1024.0 * 1024.0), 1);
+    COUNTER("sample_mb", resources.sample_bytes / (1024.0 * 1024.0), 1);
+    COUNTER("images", resources.image_count, 0);
+    COUNTER("samples", resources.sample_count, 0);
+    COUNTER("evictions", resources.evictions, 0);
+
+    /* entities, as of the last frame */
+    if(!scenestack_empty() && scenestack_top() == storyboard_get_scene(SCENE_LEVEL)) {
+        levelstats_t stats = level_stats();
+
+        COUNTER("ssobjects", stats.ssobjects, 0);
+        COUNTER("active_legacy_items", stats.active_legacy_items, 0);
+        COUNTER("active_legacy_objects", stats.active_legacy_objects, 0);
+        COUNTER("obstacles", stats.obstacles, 0);
+        COUNTER("bricks", stats.bricks, 0);
+        COUNTER("active_bricks", stats.active_bricks, 0);
+    }
+    else {
+        COUNTER("ssobjects", 0, 0);
+        COUNTER("active_legacy_items", 0, 0);
+        COUNTER("active_legacy_objects", 0, 0);
+        COUNTER("obstacles", 0, 0);
+        COUNTER("bricks", 0, 0);
+        COUNTER("active_bricks", 0, 0);
+    }
+
+    /* render queue. The batches are only counted when the profiler is enabled */
+    COUNTER("render_queue_high_water_mark", queue->high_water_mark, 0);
+    COUNTER("render_queue_reallocations", queue->reallocations, 0);
+    if(renderqueue_is_profiler_enabled()) {
+        const renderqueue_profile_t* profile;
+        int type_count = renderqueue_profile(&profile);
+
+        COUNTER("render_batches", profile[type_count].batches, 1);
+        COUNTER("draw_calls", profile[type_count].draw_calls, 1);
+    }
+    else {
+        COUNTER("render_batches", 0, 1);
+        COUNTER("draw_calls", 0, 1);
+    }
+
+    #undef COUNTER
+
+    return n;
+}
+
+/*
+ * write_stats()
+ * Appends a line with the performance counters to the current rolling file,
+ * switching to the other file when the current one gets too large
+ */
+void write_stats(const perfcounter_t* counter, int count)
+{
+    char line[1024];
+    int length = 0;
+
+    /* switch files */
+    if(stats_file != NULL && stats_file_size >= STATS_MAX_FILE_SIZE) {
+        al_fclose(stats_file);
+        stats_file = NULL;
+        stats_file_index = 1 - stats_file_index;
+    }
+
+    /* open a file, overwriting its previous contents */
+    if(stats_file == NULL) {
+        const char* filepath = STATS_FILE[stats_file_index];
+
+        if(NULL == (stats_file = al_fopen(filepath, "wb"))) {
+            logfile_message("Can't write the performance counters to %s", filepath);
+            stats_interval = 0; /* give up */
+            return;
+        }
+
+        for(int i = 0; i < count; i++)
+            length += snprintf(line + length, sizeof(line) - length, "%s%s", i > 0 ? "," : "", counter[i].name);
+        length += snprintf(line + length, sizeof(line) - length, "\n");
+
+        al_fputs(stats_file, line);
+        stats_file_size = length;
+        length = 0;
+    }
+
+    /* write the counters */
+    for(int i = 0; i < count && length < (int)sizeof(line); i++)
+        length += snprintf(line + length, sizeof(line) - length, "%s%.*f", i > 0 ? "," : "", counter[i].precision, counter[i].value);
+    if(length < (int)sizeof(line))
+        length += snprintf(line + length, sizeof(line) - length, "\n");
+
+    al_fputs(stats_file, line);
+    al_fflush(stats_file); /* we want the data even if the process is killed */
+    stats_file_size += length;
+}
+
+/*
+ * send_stats()
+ * Sends the performance counters, as a JSON object, to the URL specified
+ * in the command line, if any. The web client sends them in batches
+ */
+void send_stats(const perfcounter_t* counter, int count)
+{
+    const char* url = commandline_getstring(stored_cmd.export_stats_url, NULL);
+    char json[1024];
+    int length = 0;
+
+    if(url == NULL)
+        return;
+
+    for(int i = 0; i < count && length < (int)sizeof(json); i++)
+        length += snprintf(json + length, sizeof(json) - length, "%s\"%s\":%.*f", i > 0 ? "," : "{", counter[i].name, counter[i].precision, counter[i].value);
+    if(length >= (int)sizeof(json) - 1)
+        return; /* this shouldn't happen */
+
+    json[length++] = '}';
+    json[length] = '\0';
+
+    http_send_telemetry(url, json);
+}
+
+/*
+ * report_frame_pacing()
+ * Reports the frame times and the estimated input latency of the low-latency loop
+ */
+void report_frame_pacing(int frames, double total_frame_time, double max_frame_time, double total_latency, double max_latency)
+{
+    int n = max(1, frames);
+
+    logfile_message(
+        "Low-latency loop: %d frames. "
+        "Frame time: %.3f ms on average (max %.3f ms). "
+        "Input latency (input to flip, estimated): %.3f ms on average (max %.3f ms)",
+        frames,
+        1000.0 * total_frame_time / n, 1000.0 * max_frame_time,
+        1000.0 * total_latency / n, 1000.0 * max_latency
+    );
+}
+
+/*
+ * update_frame()
+ * Updates the managers and the current scene
+ */
+void update_frame()
+{
+    frameprofiler_begin_frame();
+    frameprofiler_begin(FRAMEPHASE_UPDATE);
+    MEMTRACKER_BEGIN_FRAME();
+
+    /* discard the scratch memory of the previous update */
+    arena_reset(update_arena);
+    current_arena = update_arena;
+
+    /* update the managers */
+    update_power_mode();
+    timer_update();
+    audio_update();
+    mobilegamepad_update();
+    input_update();
+    clean_garbage();
+
+    /* reload the modified assets */
+    hotreload_update();
+
+    /* update the current scene */
+    scene_t* current_scene = scenestack_top();
+    current_scene->update();
+
+    frameprofiler_end(FRAMEPHASE_UPDATE);
+
+    /* export the performance counters */
+    if(stats_interval > 0 && al_get_time() >= stats_last_time + stats_interval)
+        export_stats();
+}
+
+/*
+ * render_frame()
+ * Renders the given scene and presents the frame,
+ * unless the adaptive quality skips it
+ */
+void render_frame(scene_t* scene)
+{
+    /* fades are timed and signaled by their rendering; don't skip them */
+    if(video_should_skip_frame() && !fadefx_is_fading() && !fadefx_is_over())
+        return;
+
+    /* discard the scratch memory of the previous render */
+    arena_reset(render_arena);
+    current_arena = render_arena;
+
+    frameprofiler_begin(FRAMEPHASE_RENDER);
+    scene->render();
+    actor_advance_animations();
+    fadefx_update();
+    frameprofiler_end(FRAMEPHASE_RENDER);
+
+    frameprofiler_begin(FRAMEPHASE_PRESENT);
+    video_render(render_overlay);
+    screenshot_update();
+    frameprofiler_end(FRAMEPHASE_PRESENT);
+
+    /* whatever happens until the next render belongs to the update phase */
+    current_arena = update_arena;
+}
+
+/*
+ * engine_frame_arena()
+ * Scratch memory of the current phase of the frame (update or render).
+ * Allocations are valid until the start of the next update or render,
+ * respectively, so they must not be kept across frames
+ */
+arena_t* engine_frame_arena()
+{
+    return current_arena;
+}
+
+/*
+ * engine_frame_arena_stats()
+ * The high-water marks of the scratch memory of the frame, in bytes
+ */
+void engine_frame_arena_stats(size_t* update_high_water_mark, size_t* render_high_water_mark)
+{
+    *update_high_water_mark = update_arena != NULL ? arena_high_water_mark(update_arena) : 0;
+    *render_high_water_mark = render_arena != NULL ? arena_high_water_mark(render_arena) : 0;
+}
+
 /*
  * engine_quit()
  * Quit the application
@@ -386,20 +1203,98 @@ int engine_compatibility_version_code()
 
 /*
  * clean_garbage()
- * Runs the garbage collector.
+ * Runs the garbage collector. A pass starts every GC_INTERVAL seconds and,
+ * unless gc_budget is zero, is spread over as many frames as needed so that
+ * we spend at most gc_budget microseconds per frame on it
  */
 void clean_garbage()
 {
     static double last = 0.0;
+    static bool is_collecting = false;
+    static int steps = 0;
     double now = timer_get_elapsed();
 
-    /* run the GC every GC_INTERVAL seconds (approximately) */
-    if(now >= last + GC_INTERVAL) {
-        last = now;
+    /* start a pass every GC_INTERVAL seconds (approximately) */
+    if(!is_collecting) {
+        if(now >= last + GC_INTERVAL) {
+            last = now;
+            is_collecting = true;
+            gc_pause_count = 0;
+            steps = 0;
+        }
+        else {
+            if(now < last)
+                last = now; /* time overflow... really?! */
+
+            return;
+        }
+    }
+
+    /* run a step of the GC */
+    double start_time = timer_get_now();
+    bool done = true;
+
+    frameprofiler_begin(FRAMEPHASE_GC);
+    if(gc_budget > 0)
+        done = resourcemanager_release_unused_resources_incrementally(gc_budget * 0.000001);
+    else
         resourcemanager_release_unused_resources();
+    frameprofiler_end(FRAMEPHASE_GC);
+
+    /* measure the pause */
+    double pause_time = timer_get_now() - start_time;
+    if(gc_pause_count < GC_MAX_PAUSES)
+        gc_pause[gc_pause_count++] = pause_time;
+
+    gc_total_pauses++;
+    gc_total_pause_time += pause_time;
+    if(pause_time > gc_max_pause_time)
+        gc_max_pause_time = pause_time;
+    if(pause_time > gc_recent_max_pause_time)
+        gc_recent_max_pause_time = pause_time;
+    steps++;
+
+    /* the pass is complete */
+    if(done) {
+        is_collecting = false;
+        report_gc_pauses(steps);
     }
-    else if(now < last)
-        last = now; /* time overflow... really?! */
+}
+
+/*
+ * report_gc_pauses()
+ * Logs percentiles of the pauses of the last pass of the garbage collector
+ */
+void report_gc_pauses(int total_steps)
+{
+    int n = gc_pause_count;
+    double total = 0.0;
+
+    if(n == 0)
+        return;
+
+    for(int i = 0; i < n; i++)
+        total += gc_pause[i];
+
+    qsort(gc_pause, n, sizeof(gc_pause[0]), compare_gc_pauses);
+
+    #define GC_PERCENTILE(p) (1000000.0 * gc_pause[((n - 1) * (p)) / 100])
+    logfile_message(
+        "GC pass: %d step(s), %.0f us in total, pause p50 %.0f us, p90 %.0f us, p99 %.0f us, max %.0f us (budget: %d us)",
+        total_steps, 1000000.0 * total,
+        GC_PERCENTILE(50), GC_PERCENTILE(90), GC_PERCENTILE(99), GC_PERCENTILE(100),
+        gc_budget
+    );
+    #undef GC_PERCENTILE
+}
+
+/* compare two pauses of the garbage collector */
+int compare_gc_pauses(const void* a, const void* b)
+{
+    double x = *((const double*)a);
+    double y = *((const double*)b);
+
+    return (x > y) - (x < y);
 }
 
 /*
@@ -426,6 +1321,7 @@ void init_basic_stuff(const commandline_t* cmd)
     wants_to_quit = false;
     wants_to_restart = false;
     stored_cmd = *cmd;
+    gc_budget = commandline_getint(cmd->gc_budget, DEFAULT_GC_BUDGET);
 
     /* randomize */
     srand(time(NULL));
@@ -443,6 +1339,28 @@ void init_basic_stuff(const commandline_t* cmd)
             fatal_error("Can't initialize Allegro");
     }
 
+    /* initialize the startup tracer */
+    trace_init(commandline_getint(cmd->trace_startup, FALSE));
+    trace_begin("startup");
+
+    /* initialize the frame profiler */
+    frameprofiler_init(
+        commandline_getint(cmd->profile_frames, FALSE) ||
+        commandline_getint(cmd->export_stats, 0) > 0 ||
+        commandline_getstring(cmd->benchmark_level_path, NULL) != NULL
+    );
+
+    /* create the scratch memory of the frame */
+    update_arena = arena_create(FRAME_ARENA_CAPACITY);
+    render_arena = arena_create(FRAME_ARENA_CAPACITY);
+    current_arena = update_arena;
+
+    /* initialize the profiling zones and the memory tracker, if they have been compiled in */
+    PROFILER_INIT();
+    MEMTRACKER_INIT();
+
+    trace_begin("init_basic_stuff");
+
     if(!al_is_native_dialog_addon_initialized()) {
         if(!al_init_native_dialog_addon())
             fatal_error("Can't initialize Allegro's native dialog addon");
@@ -466,13 +1384,25 @@ void init_basic_stuff(const commandline_t* cmd)
     if(commandline_getint(cmd->verbose, FALSE))
         logfile_init(LOGFILE_CONSOLE);
 
+    trace_begin("asset_init");
     asset_init(
         cmd->argv0, gamedir,
         compatibility_mode ? compatibility_version : NULL,
         &game_id, &compatibility_version_code
     );
+    trace_end();
     logfile_init(LOGFILE_TXT);
 
+    /* create the worker threads of the job system */
+    jobs_init();
+
+    /* cache the parse trees and the collision masks in the write directory */
+    nanoparser_set_cache_directory("cache/nanoparser");
+    collisionmask_set_cache_directory("cache/masks");
+
+    /* compile the levels in the write directory */
+    levparser_set_compiled_directory("cache/levels");
+
     /* initialize prefs and nanocalc */
     prefs = prefs_create(NULL);
     init_nanocalc();
@@ -486,6 +1416,7 @@ void init_basic_stuff(const commandline_t* cmd)
 
     logfile_message("Game title: %s", config_game_title("(null)"));
     logfile_message("Game version: %s", config_game_version("(null)"));
+    trace_end();
 }
 
 
@@ -495,14 +1426,29 @@ void init_basic_stuff(const commandline_t* cmd)
  */
 void init_managers(const commandline_t* cmd)
 {
+    trace_begin("init_managers");
+
     timer_init();
+    trace_begin("video_init");
+    video_enable_headless_mode(commandline_getint(cmd->headless, FALSE));
     video_init();
+    trace_end();
+    trace_begin("audio_init");
     audio_init();
+    trace_end();
     input_init();
+    web_init();
+    actor_init_animation_batch();
     resourcemanager_init();
+    resourcemanager_set_memory_budget((size_t)commandline_getint(cmd->memory_budget, 0) * 1024 * 1024);
+    audio_set_sample_compaction(resourcemanager_stats().budget > 0); /* low memory settings */
     lang_init();
 
+    trace_begin("load_managers_preferences");
     load_managers_preferences(cmd);
+    trace_end();
+
+    trace_end();
 }
 
 /*
@@ -591,28 +1537,51 @@ void load_managers_preferences(const commandline_t* cmd)
  */
 void init_accessories(const commandline_t* cmd)
 {
+    trace_begin("init_accessories");
+
     /* we'll load SurgeScript in a different thread */
     ALLEGRO_THREAD* surgescript_thread = surgescriptloaderthread_create(cmd->user_argc, cmd->user_argv);
 
     /* load fonts and display a loading screen */
+    trace_begin("font_init");
     font_init();
     video_display_loading_screen();
+    trace_end();
 
     /* load sprites & images */
-    sprite_init(); /* load images in the same thread of the ALLEGRO_DISPLAY */
+    trace_begin("sprite_init");
+    sprite_init(commandline_getint(cmd->lazy_sprites, FALSE)); /* load images in the same thread of the ALLEGRO_DISPLAY */
+    trace_end();
 
     /* wait for the SurgeScript loading thread & release it */
+    trace_begin("wait_for_scripting");
     surgescriptloaderthread_destroy(surgescript_thread); /* show potential scripting errors before loading the other accessories */
+    trace_end();
+
+    /* record or replay the user input; this seeds the RNGs before the VM is launched */
+    inputrecorder_init(
+        commandline_getstring(cmd->record_input_path, NULL),
+        commandline_getstring(cmd->replay_input_path, NULL),
+        commandline_getint(cmd->seed, -1)
+    );
 
     /* load various accessories */
     storyboard_init();
     scenestack_init();
     screenshot_init();
     fadefx_init();
+    trace_begin("audio_preload");
     audio_preload(); /* preload audio samples */
+    trace_end();
+    trace_begin("charactersystem_init");
     charactersystem_init();
+    trace_end();
+    objects_enable_profiling(commandline_getint(cmd->profile_objects, FALSE));
     objects_init(); /* legacy scripting */
 
+    /* hot reload */
+    hotreload_init(commandline_getint(cmd->hot_reload, FALSE));
+
     /* mobile gamepad */
     bool mobile_mode = (bool)commandline_getint(cmd->mobile, FALSE);
     mobilegamepad_init(mobile_mode ? MOBILEGAMEPAD_DEFAULT_FLAGS : MOBILEGAMEPAD_DISABLED);
@@ -622,8 +1591,38 @@ void init_accessories(const commandline_t* cmd)
             mobilegamepad_set_opacity(opacity);
     }
 
+    /* physics */
+    int physics_rate = commandline_getint(cmd->physics_rate, 0);
+    physicsactor_set_simulation_rate(physics_rate);
+    if(physics_rate > 0)
+        logfile_message("Running the physics at %d Hz", physics_rate);
+
+    /* level streaming */
+    level_enable_streaming(commandline_getint(cmd->stream_levels, FALSE));
+
+    /* main loop */
+    low_latency_mode = (bool)commandline_getint(cmd->low_latency, FALSE);
+    headless_mode = video_is_headless();
+    uncapped_render_interval = commandline_getint(cmd->uncapped, -1);
+
+    /* benchmark: render every frame of the uncapped loop, unless specified otherwise */
+    benchmark_frames = 0;
+    if(commandline_getstring(cmd->benchmark_level_path, NULL) != NULL) {
+        benchmark_frames = commandline_getint(cmd->benchmark_frames, DEFAULT_BENCHMARK_FRAMES);
+        if(uncapped_render_interval < 0)
+            uncapped_render_interval = 1;
+    }
+    video_set_adaptive_quality(commandline_getint(cmd->adaptive_quality, FALSE));
+
+    /* export of the performance counters */
+    init_stats_export(cmd);
+
     /* launch the SurgeScript Virtual Machine */
+    trace_begin("scripting_launch_vm");
     scripting_launch_vm();
+    trace_end();
+
+    trace_end();
 }
 
 
@@ -637,7 +1636,15 @@ void push_initial_scene(const commandline_t* cmd)
     int custom_level = (commandline_getstring(cmd->custom_level_path, NULL) != NULL);
     int custom_quest = (commandline_getstring(cmd->custom_quest_path, NULL) != NULL);
 
-    if(custom_level) {
+    if(benchmark_frames > 0) {
+        double start = al_get_time();
+        scenestack_push(storyboard_get_scene(SCENE_LEVEL), (void*)(commandline_getstring(cmd->benchmark_level_path, "")));
+        benchmark_load_time = al_get_time() - start;
+
+        if(!renderqueue_is_profiler_enabled())
+            renderqueue_toggle_profiler(); /* count the render batches */
+    }
+    else if(custom_level) {
         scenestack_push(storyboard_get_scene(SCENE_LEVEL), (void*)(commandline_getstring(cmd->custom_level_path, "")));
     }
     else if(custom_quest) {
@@ -663,6 +1670,9 @@ void push_initial_scene(const commandline_t* cmd)
  */
 void release_accessories()
 {
+    hotreload_release();
+    release_stats_export();
+    inputrecorder_release();
     scenestack_release();
     storyboard_release();
     scripting_release();
@@ -685,6 +1695,8 @@ void release_managers()
     resourcemanager_release(); /* release bitmaps BEFORE the display! */
     video_release(); /* release the display */
     audio_release();
+    actor_release_animation_batch();
+    web_release();
     input_release();
     timer_release();
 }
@@ -697,10 +1709,34 @@ void release_managers()
  */
 void release_basic_stuff()
 {
+    /* Release the startup tracer and the frame profiler */
+    trace_release();
+    frameprofiler_release();
+    PROFILER_RELEASE();
+    MEMTRACKER_RELEASE();
+
+    /* Release the worker threads of the job system */
+    jobs_release();
+
+    /* Release the scratch memory of the frame */
+    current_arena = NULL;
+    render_arena = arena_destroy(render_arena);
+    update_arena = arena_destroy(update_arena);
+
+    /* Release the interned strings */
+    atom_release();
+
     /* Release nanocalc and prefs */
     release_nanocalc();
     prefs = prefs_destroy(prefs);
 
+    /* Disable the caches of nanoparser, of the collision masks and of the compiled levels */
+    nanoparser_set_cache_directory(NULL);
+    collisionmask_set_cache_directory(NULL);
+    levparser_release_preloaded();
+    levsaver_release();
+    levparser_set_compiled_directory(NULL);
+
     /* Release the logfile module and the asset manager */
     logfile_release(LOGFILE_TXT);
     asset_release();
@@ -992,11 +2028,85 @@ void a5_handle_hotkey(const ALLEGRO_EVENT* event, void* data)
             input_reconfigure_joysticks();
             input_print_joysticks();
             break;
+
+        /* F6: toggle render queue profiler */
+        case ALLEGRO_KEY_F6:
+            if(!renderqueue_toggle_profiler())
+                video_showmessage("Can't toggle the profiler");
+            break;
+
+#if WANT_MEMTRACKER
+        /* F5: toggle memory tracker overlay */
+        case ALLEGRO_KEY_F5:
+            if(!memtracker_toggle_report())
+                video_showmessage("Can't toggle the memory tracker");
+            break;
+#endif
     }
 
     (void)data;
 }
 
+/*
+ * a5_handle_activity_event()
+ * Leaves the idle mode when the user does something
+ */
+void a5_handle_activity_event(const ALLEGRO_EVENT* event, void* data)
+{
+    unchanged_frames = 0;
+    set_idle_mode(false);
+
+    (void)event;
+    (void)data;
+}
+
+/*
+ * update_idle_mode()
+ * Enters the idle mode after a number of consecutive frames that didn't
+ * change. Static scenes, such as menus and the pause screen, opt into this
+ * by enabling the dirty tracking of the video manager
+ */
+void update_idle_mode()
+{
+    if(video_skipped_presentation())
+        unchanged_frames = min(unchanged_frames + 1, IDLE_THRESHOLD);
+    else
+        unchanged_frames = 0;
+
+    set_idle_mode(unchanged_frames >= IDLE_THRESHOLD);
+}
+
+/*
+ * set_idle_mode()
+ * Lowers the update rate while idle; restores it otherwise. Input events
+ * are still handled as soon as they arrive
+ */
+void set_idle_mode(bool idle)
+{
+    if(idle == is_idle)
+        return;
+
+    is_idle = idle;
+    al_set_timer_speed(a5_timer, 1.0 / (idle ? IDLE_FPS : TARGET_FPS));
+    video_set_idle(idle);
+}
+
+/*
+ * update_power_mode()
+ * Periodically checks if the device is saving battery or under thermal
+ * pressure. If it is, we render every other frame to let it cool down
+ */
+void update_power_mode()
+{
+    double now = al_get_time();
+
+    if(power_last_check >= 0.0 && now < power_last_check + POWER_CHECK_INTERVAL)
+        return;
+
+    power_last_check = now;
+    video_set_power_saving(is_power_constrained());
+}
+
 /*
  * a5_handle_timer_event()
  * Update game logic
@@ -1005,16 +2115,11 @@ void a5_handle_timer_event(const ALLEGRO_EVENT* event, void* data)
 {
     bool* is_ready_to_draw = (bool*)data;
 
-    /* update the managers */
-    timer_update();
-    audio_update();
-    mobilegamepad_update();
-    input_update();
-    clean_garbage();
+    /* complete the HTTP requests */
+    web_update();
 
-    /* update the current scene */
-    scene_t* current_scene = scenestack_top();
-    current_scene->update();
+    /* update the game logic */
+    update_frame();
     *is_ready_to_draw = true;
 
     /* prevent locking */
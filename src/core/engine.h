@@ -25,6 +25,7 @@
 #include <allegro5/allegro.h>
 
 struct commandline_t;
+struct arena_t;
 
 void engine_init(const struct commandline_t* cmd);
 bool engine_is_init();
@@ -42,6 +43,9 @@ bool engine_remove_event_listener(ALLEGRO_EVENT_TYPE event_type, void* data, voi
 void engine_add_event_source(ALLEGRO_EVENT_SOURCE* event_source);
 void engine_remove_event_source(ALLEGRO_EVENT_SOURCE* event_source);
 
+struct arena_t* engine_frame_arena();
+void engine_frame_arena_stats(size_t* update_high_water_mark, size_t* render_high_water_mark);
+
 uint32_t engine_game_id();
 int engine_compatibility_version_code();
 
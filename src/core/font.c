@@ -37,11 +37,13 @@
 #include "logfile.h"
 #include "nanoparser.h"
 #include "input.h"
+#include "shader.h"
 #include "../util/stringutil.h"
 #include "../util/hashtable.h"
 #include "../util/darray.h"
 #include "../util/point2d.h"
 #include "../util/rect.h"
+#include "../util/simd.h"
 #include "../entities/player.h"
 #include "../entities/mobilegamepad.h"
 #include "../scenes/level.h"
@@ -54,6 +56,11 @@
 #define FONT_BLANKSMAXSIZE          8192     /* max buffer size for find_blanks() */
 #define FONT_COLORBREAKPOINT     ((char)0x2) /* a control character that delimits a change of color */
 #define FONT_MAXBITMAPGLYPHS        0x500    /* maximum number of bitmap glyphs (we currently support up to codepoint U+04FF) */
+#define FONT_SDFGLYPHSIZE           48       /* size in pixels of the glyphs of a distance field atlas */
+#define FONT_SDFSPREAD              6        /* maximum distance in pixels encoded in a distance field */
+#define FONT_SDFPAGESIZE            1024     /* width and height of a page of a distance field atlas */
+#define FONT_SDFBLOCKSIZE           256      /* number of glyphs of a block of a distance field atlas */
+#define FONT_SDFMAXBLOCKS           (0x110000 / FONT_SDFBLOCKSIZE) /* we support all Unicode codepoints */
 
 /* macros */
 #define IS_VAR_ANYCHAR(c)           ((isalnum((unsigned char)(c))) || ((c) == '_'))
@@ -70,6 +77,7 @@ static void callbacktable_add(const char* variable_name, fontcallback_t callback
 static fontcallback_t callbacktable_find(const char* variable_name);
 HASHTABLE_GENERATE_CODE(fontcallback_t, NULL);
 static HASHTABLE(fontcallback_t, callback_table);
+static unsigned callback_table_version = 0; /* incremented whenever a variable is registered */
 
 /* ------------------------------- */
 
@@ -91,7 +99,7 @@ struct charproperties_t {
 
 typedef struct fontscript_t fontscript_t;
 struct fontscript_t {
-    enum { FONTSCRIPTTYPE_TTF, FONTSCRIPTTYPE_BMP } type;
+    enum { FONTSCRIPTTYPE_TTF, FONTSCRIPTTYPE_BMP, FONTSCRIPTTYPE_SDF } type;
     union {
         /* bitmap */
         struct {
@@ -101,7 +109,7 @@ struct fontscript_t {
             charproperties_t chr[FONT_MAXBITMAPGLYPHS]; /* properties of each glyph */
         } bmp;
 
-        /* true-type */
+        /* true-type & distance field */
         struct {
             char source_file[FONT_PATHMAX]; /* source file (relative file path) */
             int size; /* font size */
@@ -118,6 +126,7 @@ typedef struct fontdrv_t fontdrv_t;
 struct fontdrv_t { /* abstract font: base class */
     void (*textout)(const fontdrv_t*,const char*,int,int,color_t); /* prints an unformatted line of text */
     int (*line_width)(const fontdrv_t*,const char*); /* width in pixels of an unformatted line of text */
+    void (*prefix_width)(const fontdrv_t*,const uint32_t*,int,int*); /* width in pixels of each prefix of a decoded line of text (optional) */
     int (*line_height)(const fontdrv_t*); /* height in pixels of any line of text */
     const char* (*filepath)(const fontdrv_t*); /* relative path of the font */
     const image_t* (*image)(const fontdrv_t*); /* image atlas (if any) */
@@ -125,6 +134,7 @@ struct fontdrv_t { /* abstract font: base class */
 };
 static fontdrv_t* fontdrv_bmp_new(const char* source_file, charproperties_t chr[], int spacing[2]);
 static fontdrv_t* fontdrv_ttf_new(const char* source_file, int size, bool antialias, bool shadow);
+static fontdrv_t* fontdrv_sdf_new(const char* source_file, int size, bool antialias, bool shadow);
 
 typedef struct fontdrv_bmp_t fontdrv_bmp_t;
 struct fontdrv_bmp_t { /* bitmap font */
@@ -132,12 +142,14 @@ struct fontdrv_bmp_t { /* bitmap font */
     const image_t* atlas; /* image atlas */
     image_t* glyph[FONT_MAXBITMAPGLYPHS]; /* glyph indexed by codepoint */
     point2d_t glyph_offset[FONT_MAXBITMAPGLYPHS]; /* offset of a glyph (defaults to zero) */
+    int glyph_width[FONT_MAXBITMAPGLYPHS]; /* width of a glyph, or -1 if there is no such glyph */
     v2d_t spacing; /* character spacing */
     int line_height; /* max({ image_height(glyph[j]) | j >= 0 }) */
     char* filepath; /* relative path */
 };
 static void fontdrv_bmp_textout(const fontdrv_t* fnt, const char* text, int x, int y, color_t color);
 static int fontdrv_bmp_linewidth(const fontdrv_t* fnt, const char* text);
+static void fontdrv_bmp_prefixwidth(const fontdrv_t* fnt, const uint32_t* codepoint, int length, int* out_width);
 static int fontdrv_bmp_lineheight(const fontdrv_t* fnt);
 static const char* fontdrv_bmp_filepath(const fontdrv_t* fnt);
 static const image_t* fontdrv_bmp_image(const fontdrv_t* fnt);
@@ -153,6 +165,7 @@ struct fontdrv_ttf_t { /* truetype font */
     bool shadow; /* enable shadow? */
     int line_height; /* line height */
     char* filepath; /* relative path */
+    char* face_key; /* key of the shared TrueType face */
 };
 static void fontdrv_ttf_textout(const fontdrv_t* fnt, const char* text, int x, int y, color_t color);
 static int fontdrv_ttf_linewidth(const fontdrv_t* fnt, const char* text);
@@ -161,6 +174,70 @@ static const char* fontdrv_ttf_filepath(const fontdrv_t* fnt);
 static const image_t* fontdrv_ttf_image(const fontdrv_t* fnt);
 static void fontdrv_ttf_release(fontdrv_t* fnt);
 
+/* a glyph of a distance field atlas */
+typedef struct sdfglyph_t sdfglyph_t;
+struct sdfglyph_t {
+    bool valid; /* has the glyph been generated? */
+    int page; /* index of the page of the atlas that stores the glyph */
+    struct { int x, y, width, height; } source_rect; /* region of the page */
+    point2d_t offset; /* offset of the glyph relative to the pen position */
+};
+
+/* a distance field atlas is generated once per TrueType file
+   and shared by the sdf drivers of all sizes */
+typedef struct sdfatlas_t sdfatlas_t;
+struct sdfatlas_t {
+    ALLEGRO_FONT* font; /* TrueType font rasterized at FONT_SDFGLYPHSIZE */
+    DARRAY(ALLEGRO_BITMAP*, page); /* pages of the atlas */
+    struct { int x, y, shelf_height; } cursor; /* packing position of the last page */
+    sdfglyph_t* block[FONT_SDFMAXBLOCKS]; /* glyphs indexed by codepoint, lazily generated */
+};
+static void sdfatlas_destroy(sdfatlas_t* atlas);
+HASHTABLE_GENERATE_CODE(sdfatlas_t, sdfatlas_destroy);
+static HASHTABLE(sdfatlas_t, sdf_atlases);
+
+typedef struct fontdrv_sdf_t fontdrv_sdf_t;
+struct fontdrv_sdf_t { /* signed distance field font */
+    fontdrv_t base;
+    sdfatlas_t* atlas; /* shared distance field atlas */
+    int size; /* font size */
+    float scale; /* size / FONT_SDFGLYPHSIZE */
+    bool antialias; /* enable antialiasing? */
+    bool shadow; /* enable shadow? */
+    int line_height; /* line height */
+    char* filepath; /* relative path */
+};
+static void fontdrv_sdf_textout(const fontdrv_t* fnt, const char* text, int x, int y, color_t color);
+static int fontdrv_sdf_linewidth(const fontdrv_t* fnt, const char* text);
+static void fontdrv_sdf_prefixwidth(const fontdrv_t* fnt, const uint32_t* codepoint, int length, int* out_width);
+static int fontdrv_sdf_lineheight(const fontdrv_t* fnt);
+static const char* fontdrv_sdf_filepath(const fontdrv_t* fnt);
+static const image_t* fontdrv_sdf_image(const fontdrv_t* fnt);
+static void fontdrv_sdf_release(fontdrv_t* fnt);
+static void load_sdf(fontdrv_sdf_t* f);
+static void unload_sdf(fontdrv_sdf_t* f);
+static const sdfglyph_t* find_sdf_glyph(sdfatlas_t* atlas, uint32_t codepoint);
+static void generate_sdf_glyph(sdfatlas_t* atlas, uint32_t codepoint, sdfglyph_t* glyph);
+static void compute_distance_field(const uint8_t* coverage, uint8_t* field, int width, int height);
+static void draw_sdf_text(const fontdrv_sdf_t* f, const char* text, float x, float y, ALLEGRO_COLOR color);
+static shader_t* sdf_shader();
+static const char sdf_shader_name[] = "distance field font";
+static const char sdf_shader_glsl[] = ""
+    FRAGMENT_SHADER_GLSL_PREFIX("mediump")
+
+    "uniform sampler2D tex;\n"
+    "uniform bool antialias;\n"
+
+    "void main()\n"
+    "{\n"
+    "   float d = texture(tex, texcoord).a;\n" /* the edge of the glyph is at 0.5 */
+    "   float w = 0.5 * fwidth(d);\n"
+    "   float a = antialias ? smoothstep(0.5 - w, 0.5 + w, d) : step(0.5, d);\n"
+
+    "   color = v_color * a;\n" /* premultiplied alpha */
+    "}\n"
+"";
+
 /* ------------------------------- */
 
 /* list of fontdrv_t */
@@ -178,6 +255,16 @@ static void fontdrv_list_add(const char* name, fontdrv_t* drv);
 static fontdrv_t* fontdrv_list_find(const char* name);
 static fontdrv_t* fontdrv_list_find_ex(const char* name, const char* lang_id);
 
+/* TrueType faces are shared among the ttf drivers that use the same file,
+   size and antialiasing mode, so that they share the same glyph cache */
+typedef struct ttfface_t ttfface_t;
+struct ttfface_t {
+    ALLEGRO_FONT* font; /* TrueType font */
+};
+static void ttfface_destroy(ttfface_t* face);
+HASHTABLE_GENERATE_CODE(ttfface_t, ttfface_destroy);
+static HASHTABLE(ttfface_t, ttf_faces);
+
 /* ------------------------------- */
 
 /* font arguments: for a safe printf-like alternative (when dealing with user-provided format strings) */
@@ -186,12 +273,57 @@ typedef char* fontargs_t[FONTARGS_MAX];
 
 /* ------------------------------- */
 
+/* a text template is a text compiled into a sequence of literals and variables,
+   so that it needn't be parsed again whenever its variables are expanded */
+typedef struct fonttemplatesegment_t fonttemplatesegment_t;
+struct fonttemplatesegment_t
+{
+    enum {
+        FONTTEMPLATE_LITERAL, /* literal text */
+        FONTTEMPLATE_ARGUMENT, /* $1, $2 ... ${FONTARGS_MAX} */
+        FONTTEMPLATE_CALLBACK, /* a registered variable */
+        FONTTEMPLATE_LANGSTRING, /* a string of the language file */
+        FONTTEMPLATE_EXPRESSION /* ${EXPRESSION}, evaluated when expanded */
+    } type;
+    int start; /* offset of the literal text, key or expression in the string pool */
+    int length; /* length of the string */
+    int argument; /* index of the argument */
+    fontcallback_t callback; /* registered callback */
+};
+
+typedef struct fonttemplate_t fonttemplate_t;
+struct fonttemplate_t
+{
+    DARRAY(fonttemplatesegment_t, segment); /* compiled segments */
+    DARRAY(char, pool); /* string pool */
+    unsigned version; /* the version of the callback table at the time of compilation */
+    bool is_dirty; /* do we need to compile the text again? */
+};
+
+static void compile_template(fonttemplate_t* tpl, const char* src);
+static void expand_template(const fonttemplate_t* tpl, char* dest, size_t dest_size, fontargs_t args);
+static void add_template_literal(fonttemplate_t* tpl, char c);
+static void add_template_segment(fonttemplate_t* tpl, int type, const char* str);
+
+/* ------------------------------- */
+
+/* a paragraph is a piece of the laid out text delimited by hard line breaks */
+typedef struct fontparagraph_t fontparagraph_t;
+struct fontparagraph_t
+{
+    int start; /* offset of the paragraph in the string buffer */
+    int first_line; /* index of the first line of the paragraph */
+    int first_segment; /* index of the first segment of the paragraph */
+    int color_cursor; /* index of the initial color of the paragraph in the color sequence */
+    int preceding_width; /* width in pixels of the text that precedes the paragraph */
+};
+
 /* preprocessed font text */
 typedef struct fonttext_t fonttext_t;
 struct fonttext_t
 {
     /* the text is split into single-line, single-color segments */
-    DARRAY(const char*, text_segment); /* preprocessed text segment */
+    DARRAY(int, text_segment); /* offset of each preprocessed text segment in the string buffer */
     DARRAY(color_t, color); /* color of each segment */
     DARRAY(point2d_t, offset); /* (x,y) offset to be applied before each segment is rendered */
     DARRAY(v2d_t, size); /* the size in pixels of each segment */
@@ -200,17 +332,31 @@ struct fonttext_t
     DARRAY(color_t, color_sequence); /* auxiliary array */
     DARRAY(int, line_width); /* the width in pixels of each line */
     DARRAY(char, buffer); /* string buffer */
+    DARRAY(char, source); /* the text to be laid out, i.e., the string buffer before wordwrap */
+    DARRAY(uint32_t, codepoint); /* a line of text decoded once for wordwrap */
+    DARRAY(int, codepoint_offset); /* byte offset of each decoded codepoint */
+    DARRAY(int, prefix_width); /* prefix_width[j] is the width in pixels of codepoint[0..j] */
+    fonttemplate_t text_template; /* the compiled text, before expanding the variables */
+
+    /* layout cache: unchanged paragraphs are not laid out again */
+    DARRAY(fontparagraph_t, paragraph); /* paragraphs of the laid out text */
+    DARRAY(char, layout_source); /* the text that has been laid out */
+    DARRAY(color_t, layout_color_sequence); /* the color sequence of the text that has been laid out */
+    const fontdrv_t* layout_drv; /* the font driver used in the layout */
+    int layout_max_width; /* the wordwrap width used in the layout */
+    fontalign_t layout_align; /* the alignment used in the layout */
 
     /* misc */
     bool is_dirty; /* do we need to preprocess the text? */
     v2d_t total_size; /* total size of the text, in pixels */
 };
 
-static void preprocess_expand(char* dest, char* tmp, size_t dest_size, fontargs_t args);
+static void preprocess_expand(const fonttemplate_t* tpl, char* dest, char* tmp, size_t dest_size, fontargs_t args);
 static char* preprocess_substring(char* text, int index_of_first_char, int max_length);
 static void preprocess_colors(fonttext_t* out, const char* text);
-static void preprocess_wordwrap(fonttext_t* out, const fontdrv_t* drv, int max_width);
-static void preprocess_split(fonttext_t* out, const fontdrv_t* drv, fontalign_t align);
+static void preprocess_wordwrap(fonttext_t* out, const fontdrv_t* drv, int max_width, int start);
+static void preprocess_split(fonttext_t* out, const fontdrv_t* drv, fontalign_t align, const fontparagraph_t* paragraph);
+static void preprocess_layout(fonttext_t* out, const fontdrv_t* drv, int max_width, fontalign_t align);
 static void preprocess_text(fonttext_t* out, const fontdrv_t* drv, const char* text, int max_width, fontalign_t align, fontargs_t argument, int index_of_first_char, int max_length);
 static void preprocess(font_t* f);
 
@@ -229,6 +375,13 @@ struct font_t {
     fonttext_t preprocessed_text; /* preprocessed text */
     char* lang_id; /* current language ID (multilingual support) */
     char* name; /* font name (not language specific) */
+
+    /* render-to-texture cache (opt-in) */
+    struct {
+        bool enabled; /* render the text into a texture when it changes? */
+        bool is_dirty; /* do we need to render the text into the texture again? */
+        image_t* image; /* the rendered text; may be NULL */
+    } cache;
 };
 
 /* misc */
@@ -237,7 +390,12 @@ static const char* read_variable(const char* key, void* data);
 static int expand_vars(char* dest, const char* src, size_t dest_size, const char* (*callback)(const char*,void*), void* data);
 static inline bool has_vars_to_expand(const char* str);
 static char* convert_to_ascii(char* str);
-static char* find_wordwrap(const fontdrv_t* drv, char* text, int max_width);
+static char* find_wordwrap(fonttext_t* out, const fontdrv_t* drv, char* text, int max_width);
+static int find_wordwrap_blank(const fontdrv_t* drv, char* text, const int blank[], int blanks, int max_width);
+static int find_decoded_wordwrap_blank(fonttext_t* out, const fontdrv_t* drv, const char* text, const int blank[], int blanks, int max_width);
+static void decode_line(fonttext_t* out, const char* text);
+static inline uint32_t next_codepoint(const char* text, size_t* i);
+static size_t ascii_run_length(const char* text, size_t length);
 static int find_blanks(const char* text, int blank[], size_t size);
 static char* tagged_text_offset(char* text, int charnum);
 static char* join_names(const char* name, const char* lang_id);
@@ -246,6 +404,11 @@ static void refresh_driver(font_t* fnt);
 static inline bool has_loaded_ttf(const fontdrv_ttf_t* f);
 static void load_ttf(fontdrv_ttf_t* f);
 static void unload_ttf(fontdrv_ttf_t* f);
+static void render_text(const font_t* f, point2d_t position, rect_t target_rect);
+static bool update_cache(font_t* f);
+static void release_cache(font_t* f);
+#define FONT_CACHEMAXSIZE           2048     /* maximum width and height of the render-to-texture cache */
+#define FONT_CACHEPADDING           4        /* border of the cached texture, in pixels, so that shadows aren't clipped */
 
 /*
  * font_init()
@@ -260,6 +423,8 @@ void font_init()
     }
 
     /* basic initialization */
+    ttf_faces = hashtable_ttfface_t_create();
+    sdf_atlases = hashtable_sdfatlas_t_create();
     fontdrv_list_init();
 
     /* reading the font scripts */
@@ -286,6 +451,8 @@ void font_release()
 
     logfile_message("Unloading font scripts...");
     fontdrv_list_release();
+    sdf_atlases = hashtable_sdfatlas_t_destroy(sdf_atlases);
+    ttf_faces = hashtable_ttfface_t_destroy(ttf_faces);
 }
 
 
@@ -301,8 +468,10 @@ void font_release()
  */
 void font_register_variable(const char* variable_name, const char* (*callback)())
 {
-    if(callback_table != NULL)
+    if(callback_table != NULL) {
         callbacktable_add(variable_name, (fontcallback_t)callback);
+        callback_table_version++; /* compiled templates may refer to this variable */
+    }
 }
 
 
@@ -349,9 +518,27 @@ font_t* font_create(const char* font_name)
     darray_init_ex(f->preprocessed_text.color_sequence, 16);
     darray_init_ex(f->preprocessed_text.line_width, 4);
     darray_init_ex(f->preprocessed_text.buffer, 64);
+    darray_init_ex(f->preprocessed_text.source, 64);
+    darray_init_ex(f->preprocessed_text.codepoint, 64);
+    darray_init_ex(f->preprocessed_text.codepoint_offset, 64);
+    darray_init_ex(f->preprocessed_text.prefix_width, 64);
+    darray_init_ex(f->preprocessed_text.paragraph, 4);
+    darray_init_ex(f->preprocessed_text.layout_source, 64);
+    darray_init_ex(f->preprocessed_text.layout_color_sequence, 16);
+    darray_init_ex(f->preprocessed_text.text_template.segment, 4);
+    darray_init_ex(f->preprocessed_text.text_template.pool, 64);
+    f->preprocessed_text.text_template.version = callback_table_version;
+    f->preprocessed_text.text_template.is_dirty = true;
+    f->preprocessed_text.layout_drv = NULL;
+    f->preprocessed_text.layout_max_width = 0;
+    f->preprocessed_text.layout_align = FONTALIGN_LEFT;
     f->preprocessed_text.is_dirty = true;
     f->preprocessed_text.total_size = v2d_new(0, 0);
 
+    f->cache.enabled = false;
+    f->cache.is_dirty = true;
+    f->cache.image = NULL;
+
     return f;
 }
 
@@ -364,6 +551,17 @@ font_t* font_create(const char* font_name)
  */
 void font_destroy(font_t* f)
 {
+    release_cache(f);
+
+    darray_release(f->preprocessed_text.text_template.pool);
+    darray_release(f->preprocessed_text.text_template.segment);
+    darray_release(f->preprocessed_text.layout_color_sequence);
+    darray_release(f->preprocessed_text.layout_source);
+    darray_release(f->preprocessed_text.paragraph);
+    darray_release(f->preprocessed_text.prefix_width);
+    darray_release(f->preprocessed_text.codepoint_offset);
+    darray_release(f->preprocessed_text.codepoint);
+    darray_release(f->preprocessed_text.source);
     darray_release(f->preprocessed_text.buffer);
     darray_release(f->preprocessed_text.line_width);
     darray_release(f->preprocessed_text.color_sequence);
@@ -412,6 +610,7 @@ void font_set_text(font_t* f, const char* fmt, ...)
     f->text = str_dup(buf);
 
     /* preprocess text */
+    f->preprocessed_text.text_template.is_dirty = true;
     f->preprocessed_text.is_dirty = true;
 }
 
@@ -425,19 +624,28 @@ void font_set_text(font_t* f, const char* fmt, ...)
 void font_set_textarguments(font_t* f, int amount, ...)
 {
     int i, m = min(FONTARGS_MAX, amount);
+    bool is_dirty = false;
     va_list ap;
 
     /* update arguments */
     va_start(ap, amount);
     for(i = 0; i < m; i++) {
+        const char* arg = va_arg(ap, const char*);
+
+        /* no change? */
+        if(f->argument[i] != NULL && 0 == strcmp(f->argument[i], arg))
+            continue;
+
         if(f->argument[i] != NULL)
             free(f->argument[i]);
-        f->argument[i] = str_dup(va_arg(ap, const char*));
+        f->argument[i] = str_dup(arg);
+        is_dirty = true;
     }
     va_end(ap);
 
     /* preprocess text */
-    f->preprocessed_text.is_dirty = true;
+    if(!f->preprocessed_text.is_dirty)
+        f->preprocessed_text.is_dirty = is_dirty;
 }
 
 
@@ -449,16 +657,23 @@ void font_set_textarguments(font_t* f, int amount, ...)
 void font_set_textargumentsv(font_t* f, int argc, const char** argv)
 {
     int m = min(FONTARGS_MAX, argc);
+    bool is_dirty = false;
 
     /* update arguments */
     for(int i = 0; i < m; i++) {
+        /* no change? */
+        if(f->argument[i] != NULL && 0 == strcmp(f->argument[i], argv[i]))
+            continue;
+
         if(f->argument[i] != NULL)
             free(f->argument[i]);
         f->argument[i] = str_dup(argv[i]);
+        is_dirty = true;
     }
 
     /* preprocess text */
-    f->preprocessed_text.is_dirty = true;
+    if(!f->preprocessed_text.is_dirty)
+        f->preprocessed_text.is_dirty = is_dirty;
 }
 
 
@@ -520,47 +735,26 @@ void font_render(font_t* f, v2d_t camera_position)
     v2d_t topleft = v2d_subtract(camera_position, half_screen_size);
     v2d_t position = v2d_subtract(f->position, topleft);
 
-    /* render the text */
-    image_hold_drawing(true);
-    do {
-        /* boundaries of the drawing target */
-        const image_t* target = image_drawing_target();
-        int target_width = image_width(target);
-        int target_height = image_height(target);
-        rect_t target_rect = rect_new(0, 0, target_width, target_height);
-
-        /* clip out the entire text if possible */
-        point2d_t initial_position = point2d_new(floorf(position.x + 0.5f), floorf(position.y + 0.5f));
-        v2d_t total_size = f->preprocessed_text.total_size;
-        rect_t bounding_box = rect_new(initial_position.x, initial_position.y, total_size.x, total_size.y);
-        if(!rect_overlaps(target_rect, bounding_box))
-            break;
-
-        /* for each preprocessed text segment */
-        for(int i = 0; i < darray_length(f->preprocessed_text.text_segment); i++) {
-            const char* text_segment = f->preprocessed_text.text_segment[i];
-            color_t color = f->preprocessed_text.color[i];
-            point2d_t offset = f->preprocessed_text.offset[i];
-            v2d_t size = f->preprocessed_text.size[i];
-
-            /* skip empty segments, as in "</color>[__empty__]\n" */
-            if(*text_segment == '\0')
-                continue;
+    /* boundaries of the drawing target */
+    const image_t* target = image_drawing_target();
+    rect_t target_rect = rect_new(0, 0, image_width(target), image_height(target));
 
-            /* find the position of the segment in screen space */
-            point2d_t segment_position = point2d_add(initial_position, offset);
-            rect_t segment_rect = rect_new(segment_position.x, segment_position.y, size.x, size.y);
+    /* clip out the entire text if possible */
+    point2d_t initial_position = point2d_new(floorf(position.x + 0.5f), floorf(position.y + 0.5f));
+    v2d_t total_size = f->preprocessed_text.total_size;
+    rect_t bounding_box = rect_new(initial_position.x, initial_position.y, total_size.x, total_size.y);
+    if(!rect_overlaps(target_rect, bounding_box))
+        return;
 
-            /* clip out the segment if possible */
-            if(segment_rect.y >= target_rect.height) /* exit early */
-                break;
-            if(!rect_overlaps(target_rect, segment_rect))
-                continue;
+    /* render the cached text as a single quad */
+    if(f->cache.enabled && update_cache(f)) {
+        image_draw(f->cache.image, initial_position.x - FONT_CACHEPADDING, initial_position.y - FONT_CACHEPADDING, IF_NONE);
+        return;
+    }
 
-            /* render the segment */
-            f->drv->textout(f->drv, text_segment, segment_position.x, segment_position.y, color);
-        }
-    } while(0);
+    /* render the text */
+    image_hold_drawing(true);
+    render_text(f, initial_position, target_rect);
     image_hold_drawing(false);
 }
 
@@ -724,6 +918,67 @@ const image_t* font_get_image(const font_t* f)
     return f->drv->image(f->drv);
 }
 
+/*
+ * font_get_driver()
+ * The name of the driver of the font: "bmp", "ttf" or "sdf"
+ */
+const char* font_get_driver(const font_t* f)
+{
+    if(f->drv->textout == fontdrv_bmp_textout)
+        return "bmp";
+    else if(f->drv->textout == fontdrv_ttf_textout)
+        return "ttf";
+    else
+        return "sdf";
+}
+
+/*
+ * font_set_cached()
+ * Render the text into a texture whenever it changes and draw the texture
+ * instead of the individual glyphs. Useful for static texts. Variables are
+ * expanded only when the text changes, as usual
+ */
+void font_set_cached(font_t* f, bool cached)
+{
+    f->cache.enabled = cached;
+    f->cache.is_dirty = true;
+
+    if(!cached)
+        release_cache(f);
+}
+
+/*
+ * font_is_cached()
+ * Is the text rendered into a texture?
+ */
+bool font_is_cached(const font_t* f)
+{
+    return f->cache.enabled;
+}
+
+/*
+ * font_get_cached_image()
+ * The texture with the rendered text, if the font is
+ * cached and has been rendered. Otherwise NULL is returned
+ */
+const image_t* font_get_cached_image(const font_t* f)
+{
+    return f->cache.enabled ? f->cache.image : NULL;
+}
+
+/*
+ * font_foreach()
+ * Calls the callback for the name of each font script,
+ * ignoring the language-specific variants
+ */
+void font_foreach(void* data, void (*callback)(const char*,void*))
+{
+    for(const fontdrv_list_t* x = fontdrv_list; x; x = x->next) {
+        if(strchr(x->name, ':') == NULL)
+            callback(x->name, data);
+    }
+}
+
 
 
 /* ------------------------------------------------- */
@@ -900,6 +1155,209 @@ bool has_vars_to_expand(const char* str)
     return false;
 }
 
+/* compiles a text into a template; this follows the rules of expand_vars() */
+void compile_template(fonttemplate_t* tpl, const char* src)
+{
+    char acc[256];
+    const int accsize = sizeof(acc) - 1;
+    enum { COPYING, ACCUMULATING_DIGIT, ACCUMULATING_IDENTIFIER, ACCUMULATING_EXPRESSION } state = COPYING;
+    int curly_counter = 0;
+    int a = 0;
+
+    darray_clear(tpl->segment);
+    darray_clear(tpl->pool);
+
+    for(int i = 0; '\0' != src[i]; i++) {
+        char curr_char = src[i], next_char = src[i+1];
+
+        switch(state) {
+            /* copy char */
+            case COPYING: {
+                if(curr_char == '$') {
+                    a = 0; /* initialize the accumulator */
+
+                    if(next_char == '{') {
+                        state = ACCUMULATING_EXPRESSION;
+                        curly_counter = 0; /* reset curly counter */
+                        i++; /* skip this curly brace */
+                        break;
+                    }
+                    else if(next_char >= '1' && next_char <= '9') {
+                        state = ACCUMULATING_DIGIT;
+                        break;
+                    }
+                    else if(isalpha(next_char) || next_char == '_') {
+                        state = ACCUMULATING_IDENTIFIER;
+                        break;
+                    }
+                }
+
+                add_template_literal(tpl, curr_char);
+                break;
+            }
+
+            /* match $1, $2 ... $9 */
+            case ACCUMULATING_DIGIT: {
+                acc[0] = curr_char;
+                acc[1] = '\0';
+
+                add_template_segment(tpl, FONTTEMPLATE_ARGUMENT, acc);
+                state = COPYING;
+                break;
+            }
+
+            /* match $IDENTIFIER */
+            case ACCUMULATING_IDENTIFIER: {
+                bool match = (isalnum(curr_char) || curr_char == '_');
+                bool last_char = ('\0' == next_char);
+
+                if(match) {
+                    if(a < accsize)
+                        acc[a++] = curr_char;
+                }
+
+                if(last_char || !match) {
+                    acc[a] = '\0';
+                    if(!match)
+                        i--; /* put back */
+
+                    add_template_segment(tpl, FONTTEMPLATE_CALLBACK, acc);
+                    state = COPYING;
+                }
+
+                break;
+            }
+
+            /* match ${EXPRESSION} */
+            case ACCUMULATING_EXPRESSION: {
+                bool match = ((curr_char != '}' || curly_counter > 0) && curr_char != '\0');
+                bool last_char = ('\0' == next_char);
+
+                if(match) {
+                    if(a < accsize)
+                        acc[a++] = curr_char;
+
+                    if(src[i] == '{')
+                        ++curly_counter;
+                    else if(src[i] == '}')
+                        --curly_counter;
+                }
+
+                if(last_char || !match) {
+                    acc[a] = '\0';
+
+                    add_template_segment(tpl, FONTTEMPLATE_EXPRESSION, acc);
+                    state = COPYING;
+                }
+
+                break;
+            }
+        }
+    }
+
+    tpl->version = callback_table_version;
+    tpl->is_dirty = false;
+}
+
+/* appends a character to the literal text at the end of the template */
+void add_template_literal(fonttemplate_t* tpl, char c)
+{
+    int n = darray_length(tpl->segment);
+
+    /* start a new literal */
+    if(n == 0 || tpl->segment[n-1].type != FONTTEMPLATE_LITERAL) {
+        fonttemplatesegment_t segment = {
+            .type = FONTTEMPLATE_LITERAL,
+            .start = darray_length(tpl->pool),
+            .length = 0
+        };
+
+        darray_push(tpl->segment, segment);
+        n++;
+    }
+
+    /* literals are stored at the end of the pool */
+    darray_push(tpl->pool, c);
+    tpl->segment[n-1].length++;
+}
+
+/* adds a variable to the template, resolving it as in read_variable() */
+void add_template_segment(fonttemplate_t* tpl, int type, const char* str)
+{
+    fonttemplatesegment_t segment = {
+        .type = type,
+        .start = darray_length(tpl->pool),
+        .length = strlen(str),
+        .argument = -1,
+        .callback = NULL
+    };
+
+    if(type != FONTTEMPLATE_EXPRESSION) {
+        if(str[0] >= '1' && str[0] <= '9') {
+            segment.type = FONTTEMPLATE_ARGUMENT;
+            segment.argument = str[0] - '1';
+        }
+        else if(NULL != (segment.callback = callbacktable_find(str)))
+            segment.type = FONTTEMPLATE_CALLBACK;
+        else
+            segment.type = FONTTEMPLATE_LANGSTRING;
+    }
+
+    /* store the key or the expression */
+    for(const char* p = str; *p; p++)
+        darray_push(tpl->pool, *p);
+    darray_push(tpl->pool, '\0');
+
+    darray_push(tpl->segment, segment);
+}
+
+/* expands the variables of a template into dest, as expand_vars() would */
+void expand_template(const fonttemplate_t* tpl, char* dest, size_t dest_size, fontargs_t args)
+{
+    static char buf[1024], expr[256];
+    int m = (int)dest_size - 1;
+    int j = 0;
+
+    for(int i = 0; i < darray_length(tpl->segment) && j < m; i++) {
+        const fonttemplatesegment_t* segment = &(tpl->segment[i]);
+        const char* str = tpl->pool + segment->start;
+        const char* value = NULL;
+
+        switch(segment->type) {
+            case FONTTEMPLATE_LITERAL:
+                for(int k = 0; k < segment->length && j < m; k++)
+                    dest[j++] = str[k];
+                continue;
+
+            case FONTTEMPLATE_ARGUMENT:
+                if(segment->argument >= 0 && segment->argument < FONTARGS_MAX)
+                    value = args[segment->argument]; /* may be NULL */
+                break;
+
+            case FONTTEMPLATE_CALLBACK:
+                value = segment->callback();
+                break;
+
+            case FONTTEMPLATE_LANGSTRING:
+                value = lang_getstring(str, buf, sizeof(buf));
+                break;
+
+            case FONTTEMPLATE_EXPRESSION:
+                expand_vars(expr, str, sizeof(expr), read_variable, (void*)args);
+                value = read_variable(expr, (void*)args);
+                break;
+        }
+
+        if(value == NULL)
+            value = "null";
+
+        while(*value && j < m)
+            dest[j++] = *(value++);
+    }
+
+    dest[j] = '\0';
+}
+
 /* convert to ascii */
 char* convert_to_ascii(char* str)
 {
@@ -915,47 +1373,26 @@ char* convert_to_ascii(char* str)
 }
 
 /* find the next point where a wordwrap should be placed */
-char* find_wordwrap(const fontdrv_t* drv, char* text, int max_width)
+char* find_wordwrap(fonttext_t* out, const fontdrv_t* drv, char* text, int max_width)
 {
     if(max_width > 0) {
         static int blank[FONT_BLANKSMAXSIZE]; /* WARNING: using a fixed-length array. We just process single-line of text, though. */
         int blanks = find_blanks(text, blank, sizeof(blank) / sizeof(int));
-        int m, l = 0, r = blanks - 1;
-        int best_m = 0, width;
-        char *wordwrap, chr;
+        int best_m;
+        char *wordwrap;
 
-        /* check if there is no wordwrap */
-        if(blanks == 0 || drv->line_width(drv, text) <= max_width)
+        /* no blanks, no wordwrap */
+        if(blanks == 0)
             return NULL;
 
-        /*
-            the wordwrap problem:
-
-            given a text (string), a max_width (int),
-            a vector of blank indexes (int[]) and
-            a width function (string -> int) ...
-
-            find max j such that
-            width(text[0 .. blank[j]-1]) <= max_width
-       */
-        while(l <= r) {
-            m = (l + r) / 2;
-
-            /* compute the width of text[0 .. blank[m]-1] */
-            chr = text[blank[m]]; text[blank[m]] = 0;
-            width = drv->line_width(drv, text);
-            text[blank[m]] = chr;
+        /* find the last blank that fits the space; -1 means no wordwrap */
+        if(drv->prefix_width != NULL)
+            best_m = find_decoded_wordwrap_blank(out, drv, text, blank, blanks, max_width);
+        else
+            best_m = find_wordwrap_blank(drv, text, blank, blanks, max_width);
 
-            if(width > max_width) {
-                /* the text is too large */
-                r = m-1;
-            }
-            else if(width <= max_width) {
-                /* the text fits the space */
-                best_m = m;
-                l = m+1;
-            }
-        }
+        if(best_m < 0)
+            return NULL;
 
         /* skip spaces */
         /*for(wordwrap = text + blank[best_m] + 1; *wordwrap && isspace(*wordwrap); wordwrap++);*/
@@ -972,6 +1409,161 @@ char* find_wordwrap(const fontdrv_t* drv, char* text, int max_width)
         return NULL; /* no wordwrap */
 }
 
+/* find the wordwrap by measuring the text repeatedly. Returns -1 if there is no wordwrap */
+int find_wordwrap_blank(const fontdrv_t* drv, char* text, const int blank[], int blanks, int max_width)
+{
+    int m, l = 0, r = blanks - 1;
+    int best_m = 0, width;
+    char chr;
+
+    /* check if there is no wordwrap */
+    if(drv->line_width(drv, text) <= max_width)
+        return -1;
+
+    /*
+        the wordwrap problem:
+
+        given a text (string), a max_width (int),
+        a vector of blank indexes (int[]) and
+        a width function (string -> int) ...
+
+        find max j such that
+        width(text[0 .. blank[j]-1]) <= max_width
+   */
+    while(l <= r) {
+        m = (l + r) / 2;
+
+        /* compute the width of text[0 .. blank[m]-1] */
+        chr = text[blank[m]]; text[blank[m]] = 0;
+        width = drv->line_width(drv, text);
+        text[blank[m]] = chr;
+
+        if(width > max_width) {
+            /* the text is too large */
+            r = m-1;
+        }
+        else if(width <= max_width) {
+            /* the text fits the space */
+            best_m = m;
+            l = m+1;
+        }
+    }
+
+    return best_m;
+}
+
+/* find the wordwrap by decoding the text once and measuring all of its prefixes
+   in a single pass. Returns -1 if there is no wordwrap */
+int find_decoded_wordwrap_blank(fonttext_t* out, const fontdrv_t* drv, const char* text, const int blank[], int blanks, int max_width)
+{
+    int length, best_m = 0;
+
+    /* decode the line and measure its prefixes */
+    decode_line(out, text);
+    length = darray_length(out->codepoint);
+    darray_clear(out->prefix_width);
+    for(int j = 0; j < length; j++)
+        darray_push(out->prefix_width, 0);
+    drv->prefix_width(drv, out->codepoint, length, out->prefix_width);
+
+    /* check if there is no wordwrap */
+    if(length == 0 || out->prefix_width[length - 1] <= max_width)
+        return -1;
+
+    /* find max j such that width(text[0 .. blank[j]-1]) <= max_width.
+       The widths of the prefixes are non-decreasing, as are the blanks */
+    for(int m = 0, k = 0; m < blanks; m++) {
+        /* k is the number of codepoints of text[0 .. blank[m]-1] */
+        while(k < length && out->codepoint_offset[k] < blank[m])
+            k++;
+
+        if(k > 0 && out->prefix_width[k - 1] > max_width)
+            break;
+
+        best_m = m;
+    }
+
+    return best_m;
+}
+
+/* decode a line of text into the codepoint array of the preprocessed text */
+void decode_line(fonttext_t* out, const char* text)
+{
+    size_t length = strlen(text);
+
+    darray_clear(out->codepoint);
+    darray_clear(out->codepoint_offset);
+
+    for(size_t i = 0; i < length; ) {
+        /* ASCII fast path */
+        size_t run = ascii_run_length(text + i, length - i);
+        for(size_t end = i + run; i < end; i++) {
+            darray_push(out->codepoint, (uint32_t)text[i]);
+            darray_push(out->codepoint_offset, (int)i);
+        }
+
+        /* multibyte sequence */
+        if(i < length) {
+            int offset = (int)i;
+            uint32_t c = u8_nextchar(text, &i);
+            darray_push(out->codepoint, c);
+            darray_push(out->codepoint_offset, offset);
+        }
+    }
+}
+
+/* reads the next codepoint of a UTF-8 string, updating an index.
+   Returns zero at the end of the string */
+uint32_t next_codepoint(const char* text, size_t* i)
+{
+    unsigned char byte = (unsigned char)text[*i];
+
+    /* ASCII fast path */
+    if(byte < 0x80) {
+        if(byte != 0)
+            ++(*i);
+        return byte;
+    }
+
+    return u8_nextchar(text, i);
+}
+
+/* the number of leading ASCII characters of text[0 .. length-1] */
+size_t ascii_run_length(const char* text, size_t length)
+{
+    size_t i = 0;
+
+#if defined(HAVE_SSE2)
+    /* test the high bits of 16 bytes at a time */
+    for(; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(text + i));
+        if(_mm_movemask_epi8(chunk) != 0)
+            break;
+    }
+#elif defined(HAVE_NEON) && defined(__aarch64__)
+    /* test the high bits of 16 bytes at a time */
+    for(; i + 16 <= length; i += 16) {
+        uint8x16_t chunk = vld1q_u8((const uint8_t*)(text + i));
+        if(vmaxvq_u8(chunk) >= 0x80)
+            break;
+    }
+#else
+    /* test the high bits of 8 bytes at a time */
+    for(; i + 8 <= length; i += 8) {
+        uint64_t chunk;
+        memcpy(&chunk, text + i, sizeof(chunk));
+        if(chunk & UINT64_C(0x8080808080808080))
+            break;
+    }
+#endif
+
+    /* remaining bytes, or the chunk that has a non-ASCII byte */
+    while(i < length && (unsigned char)text[i] < 0x80)
+        i++;
+
+    return i;
+}
+
 /* find all indexes of the text containing blank spaces */
 int find_blanks(const char* text, int blank[], size_t size)
 {
@@ -1057,13 +1649,16 @@ char* join_names(const char* name, const char* lang_id)
 /* text preprocessing */
 /* ------------------------------------------------- */
 
-/* expand variables */
-void preprocess_expand(char* dest, char* tmp, size_t dest_size, fontargs_t args)
+/* expand variables; the first pass uses the compiled template */
+void preprocess_expand(const fonttemplate_t* tpl, char* dest, char* tmp, size_t dest_size, fontargs_t args)
 {
     const int MAX_PASSES = 3;
 
-    /* expand variables */
-    for(int k = 0; k < MAX_PASSES && has_vars_to_expand(dest); k++) {
+    /* expand the template */
+    expand_template(tpl, dest, dest_size, args);
+
+    /* expand the variables that come from the values of other variables */
+    for(int k = 1; k < MAX_PASSES && has_vars_to_expand(dest); k++) {
         int len = strlen(dest);
         memcpy(tmp, dest, len+1);
         expand_vars(dest, tmp, dest_size, read_variable, (void*)args);
@@ -1102,8 +1697,8 @@ void preprocess_colors(fonttext_t* out, const char* text)
     int stack_top = 0;
     bool tag = false;
 
-    /* initialize the string buffer */
-    darray_clear(out->buffer);
+    /* initialize the text to be laid out */
+    darray_clear(out->source);
 
     /* initialize the color stack */
     stack[0] = DEFAULT_COLOR;
@@ -1137,7 +1732,7 @@ void preprocess_colors(fonttext_t* out, const char* text)
                     /* register the color */
                     if(!color_equals(next_color, prev_color)) {
                         darray_push(out->color_sequence, next_color);
-                        darray_push(out->buffer, FONT_COLORBREAKPOINT); /* not matched by isspace() */
+                        darray_push(out->source, FONT_COLORBREAKPOINT); /* not matched by isspace() */
                     }
                 }
 
@@ -1168,39 +1763,38 @@ void preprocess_colors(fonttext_t* out, const char* text)
                     /* register the color */
                     if(!color_equals(next_color, prev_color)) {
                         darray_push(out->color_sequence, next_color);
-                        darray_push(out->buffer, FONT_COLORBREAKPOINT);
+                        darray_push(out->source, FONT_COLORBREAKPOINT);
                     }
                 }
             }
         }
         else {
-            /* add character to the buffer */
-            darray_push(out->buffer, *p);
+            /* add character to the text */
+            darray_push(out->source, *p);
         }
     }
 
-    /* rtrim the string buffer */
-    for(char* p = out->buffer + (darray_length(out->buffer) - 1); p > out->buffer && isspace(*p); p--)
+    /* rtrim the text */
+    for(char* p = out->source + (darray_length(out->source) - 1); p > out->source && isspace(*p); p--)
         *p = '\0';
 
-    /* complete the string buffer */
-    darray_push(out->buffer, '\0');
+    /* complete the text */
+    darray_push(out->source, '\0');
 }
 
-/* preprocess wordwrap */
-void preprocess_wordwrap(fonttext_t* out, const fontdrv_t* drv, int max_width)
+/* preprocess wordwrap, starting at the given offset of the string buffer */
+void preprocess_wordwrap(fonttext_t* out, const fontdrv_t* drv, int max_width, int start)
 {
     char* r;
     int line_width = 0;
-    darray_clear(out->line_width);
 
-    for(char* p = out->buffer, *q, *w ;;) {
+    for(char* p = out->buffer + start, *q, *w ;;) {
         /* we must scan one line at a time */
         if(NULL != (q = strchr(p, '\n')))
             *q = '\0';
 
         /* now p is a single line of text */
-        while(NULL != (w = find_wordwrap(drv, p, max_width))) {
+        while(NULL != (w = find_wordwrap(out, drv, p, max_width))) {
             *w = '\0';
 
             for(r = w-1; r > p && isspace(*r); r--) *r = '\0'; /* rtrim(p) to correctly calculate the width of the line */
@@ -1226,15 +1820,14 @@ void preprocess_wordwrap(fonttext_t* out, const fontdrv_t* drv, int max_width)
     }
 }
 
-/* split the buffer into segments */
-void preprocess_split(fonttext_t* out, const fontdrv_t* drv, fontalign_t align)
+/* split the buffer into segments, starting at the given paragraph */
+void preprocess_split(fonttext_t* out, const fontdrv_t* drv, fontalign_t align, const fontparagraph_t* paragraph)
 {
-    const color_t DEFAULT_COLOR = color_rgb(255, 255, 255); /* we use multiplicative blending */
-    const char* current_segment = out->buffer;
-    color_t color = DEFAULT_COLOR;
+    int current_segment = paragraph->start;
+    color_t color;
     point2d_t offset = point2d_new(0, 0);
-    int color_cursor = 0;
-    int line_cursor = 0;
+    int color_cursor = paragraph->color_cursor;
+    int line_cursor = paragraph->first_line;
     int line_width = 0;
     int line_height = drv->line_height(drv);
     int accum_segment_width = 0;
@@ -1242,27 +1835,25 @@ void preprocess_split(fonttext_t* out, const fontdrv_t* drv, fontalign_t align)
         (float)(align == FONTALIGN_CENTER) * 0.5f + (float)(align == FONTALIGN_RIGHT)
     );
 
-    assertx(darray_length(out->line_width) > 0);
-    assertx(darray_length(out->color_sequence) > 0);
+    assertx(darray_length(out->line_width) > line_cursor);
+    assertx(darray_length(out->color_sequence) > color_cursor);
 
-    darray_clear(out->text_segment);
-    darray_clear(out->color);
-    darray_clear(out->offset);
-    out->total_size = v2d_new(0, 0);
+    out->total_size = v2d_new(paragraph->preceding_width, line_cursor * line_height);
+    darray_push(out->paragraph, *paragraph);
 
-    color = out->color_sequence[0];
-    line_width = out->line_width[0];
+    color = out->color_sequence[color_cursor];
+    line_width = out->line_width[line_cursor];
     offset.x = -line_width * alignment_multiplier;
-    offset.y = 0;
+    offset.y = line_cursor * line_height;
     accum_segment_width = 0;
 
-    for(char* p = out->buffer; p < out->buffer + darray_length(out->buffer); p++) {
+    for(char* p = out->buffer + paragraph->start; p < out->buffer + darray_length(out->buffer); p++) {
         if(*p == FONT_COLORBREAKPOINT) {
             /* close segment */
             *p = '\0';
 
             /* compute the size of the segment */
-            int segment_width = drv->line_width(drv, current_segment);
+            int segment_width = drv->line_width(drv, out->buffer + current_segment);
             int segment_height = line_height;
             v2d_t segment_size = v2d_new(segment_width, segment_height);
 
@@ -1285,9 +1876,12 @@ void preprocess_split(fonttext_t* out, const fontdrv_t* drv, fontalign_t align)
                 color = out->color_sequence[++color_cursor];
 
             /* next segment */
-            current_segment = p + 1;
+            current_segment = (p + 1) - out->buffer;
         }
         else if(*p == '\n') {
+            /* a hard line break starts a new paragraph; wordwraps don't */
+            bool is_hard_break = (out->source[p - out->buffer] == '\n');
+
             /* line break */
             if(line_cursor + 1 < darray_length(out->line_width))
                 line_width = out->line_width[++line_cursor];
@@ -1296,7 +1890,7 @@ void preprocess_split(fonttext_t* out, const fontdrv_t* drv, fontalign_t align)
             *p = '\0';
 
             /* compute the size of the segment */
-            int segment_width = drv->line_width(drv, current_segment);
+            int segment_width = drv->line_width(drv, out->buffer + current_segment);
             int segment_height = line_height;
             v2d_t segment_size = v2d_new(segment_width, segment_height);
 
@@ -1315,7 +1909,20 @@ void preprocess_split(fonttext_t* out, const fontdrv_t* drv, fontalign_t align)
             out->total_size.y += line_height;
 
             /* next segment */
-            current_segment = p + 1;
+            current_segment = (p + 1) - out->buffer;
+
+            /* next paragraph */
+            if(is_hard_break) {
+                fontparagraph_t next_paragraph = {
+                    .start = current_segment,
+                    .first_line = line_cursor,
+                    .first_segment = darray_length(out->text_segment),
+                    .color_cursor = color_cursor,
+                    .preceding_width = out->total_size.x
+                };
+
+                darray_push(out->paragraph, next_paragraph);
+            }
         }
         else if(*p == '\0') {
             /* end of string */
@@ -1324,7 +1931,7 @@ void preprocess_split(fonttext_t* out, const fontdrv_t* drv, fontalign_t align)
             /* *p = '\0'; */
 
             /* compute the size of the segment */
-            int segment_width = drv->line_width(drv, current_segment);
+            int segment_width = drv->line_width(drv, out->buffer + current_segment);
             int segment_height = line_height;
             v2d_t segment_size = v2d_new(segment_width, segment_height);
 
@@ -1345,25 +1952,85 @@ void preprocess_split(fonttext_t* out, const fontdrv_t* drv, fontalign_t align)
     }
 }
 
+/* lay out the text, reusing the paragraphs that haven't changed since the previous layout */
+void preprocess_layout(fonttext_t* out, const fontdrv_t* drv, int max_width, fontalign_t align)
+{
+    fontparagraph_t paragraph = { 0 };
+    int length = darray_length(out->source);
+    int color_count = darray_length(out->color_sequence);
+
+    /* can we reuse the previous layout? */
+    if(darray_length(out->paragraph) > 0 && out->layout_drv == drv && out->layout_max_width == max_width && out->layout_align == align) {
+        int layout_length = darray_length(out->layout_source);
+        int layout_color_count = darray_length(out->layout_color_sequence);
+        int diff = 0, color_diff = 0;
+        int k = darray_length(out->paragraph) - 1;
+
+        /* find the first change of the text */
+        while(diff < length && diff < layout_length && out->source[diff] == out->layout_source[diff])
+            diff++;
+        while(color_diff < color_count && color_diff < layout_color_count && color_equals(out->color_sequence[color_diff], out->layout_color_sequence[color_diff]))
+            color_diff++;
+
+        /* nothing has changed */
+        if(diff == length && length == layout_length && color_diff == color_count && color_count == layout_color_count)
+            return;
+
+        /* the paragraphs that precede the change are kept as they are */
+        while(k > 0 && (out->paragraph[k].start > diff || out->paragraph[k].color_cursor >= color_diff))
+            k--;
+
+        paragraph = out->paragraph[k];
+        darray_truncate(out->paragraph, k);
+    }
+    else
+        darray_clear(out->paragraph);
+
+    /* keep the laid out text of the preceding paragraphs and copy the rest */
+    darray_truncate(out->buffer, paragraph.start);
+    for(int i = paragraph.start; i < length; i++)
+        darray_push(out->buffer, out->source[i]);
+
+    darray_truncate(out->line_width, paragraph.first_line);
+    darray_truncate(out->text_segment, paragraph.first_segment);
+    darray_truncate(out->color, paragraph.first_segment);
+    darray_truncate(out->offset, paragraph.first_segment);
+    darray_truncate(out->size, paragraph.first_segment);
+
+    /* set wordwrap points */
+    preprocess_wordwrap(out, drv, max_width, paragraph.start);
+
+    /* split the text into segments */
+    preprocess_split(out, drv, align, &paragraph);
+
+    /* remember what has been laid out */
+    darray_clear(out->layout_source);
+    for(int i = 0; i < length; i++)
+        darray_push(out->layout_source, out->source[i]);
+
+    darray_clear(out->layout_color_sequence);
+    for(int i = 0; i < color_count; i++)
+        darray_push(out->layout_color_sequence, out->color_sequence[i]);
+
+    out->layout_drv = drv;
+    out->layout_max_width = max_width;
+    out->layout_align = align;
+}
+
 /* preprocess a text for rendering */
 void preprocess_text(fonttext_t* out, const fontdrv_t* drv, const char* text, int max_width, fontalign_t align, fontargs_t args, int index_of_first_char, int max_length)
 {
     static char buf[FONT_TEXTMAXSIZE], tmp[FONT_TEXTMAXSIZE];
     char* substr;
 
-    /* reset arrays */
-    darray_clear(out->text_segment);
-    darray_clear(out->color);
-    darray_clear(out->offset);
-    darray_clear(out->line_width);
-    darray_clear(out->color_sequence);
-    darray_clear(out->buffer);
-
-    /* copy text to a temporary buffer */
-    str_cpy(buf, text, sizeof(buf));
+    /* compile the text if it has changed or if new variables have been registered */
+    if(out->text_template.is_dirty || out->text_template.version != callback_table_version) {
+        str_cpy(buf, text, sizeof(buf));
+        compile_template(&out->text_template, buf);
+    }
 
     /* expand variables */
-    preprocess_expand(buf, tmp, sizeof(buf), args);
+    preprocess_expand(&out->text_template, buf, tmp, sizeof(buf), args);
 
     /* preprocess substring */
     substr = preprocess_substring(buf, index_of_first_char, max_length);
@@ -1371,17 +2038,14 @@ void preprocess_text(fonttext_t* out, const fontdrv_t* drv, const char* text, in
     /* preprocess colors */
     preprocess_colors(out, substr);
 
-    /* set wordwrap points */
-    preprocess_wordwrap(out, drv, max_width);
-
-    /* split the text into segments */
-    preprocess_split(out, drv, align);
+    /* lay out the text */
+    preprocess_layout(out, drv, max_width, align);
 
 #if 0
     /* test */
     for(int i = 0; i < darray_length(out->text_segment); i++) {
         static char hex[32];
-        const char* text = out->text_segment[i];
+        const char* text = out->buffer + out->text_segment[i];
         int x = out->offset[i].x;
         int y = out->offset[i].y;
         color_to_hex(out->color[i], hex, sizeof hex);
@@ -1400,6 +2064,93 @@ void preprocess(font_t* f)
     /* preprocess the font and clear up the is_dirty flag */
     preprocess_text(&f->preprocessed_text, f->drv, f->text, f->max_width, f->align, f->argument, f->index_of_first_char, f->max_length);
     f->preprocessed_text.is_dirty = false;
+
+    /* the cached texture is now outdated */
+    f->cache.is_dirty = true;
+}
+
+/* render the preprocessed text at a position of the drawing target */
+void render_text(const font_t* f, point2d_t initial_position, rect_t target_rect)
+{
+    /* for each preprocessed text segment */
+    for(int i = 0; i < darray_length(f->preprocessed_text.text_segment); i++) {
+        const char* text_segment = f->preprocessed_text.buffer + f->preprocessed_text.text_segment[i];
+        color_t color = f->preprocessed_text.color[i];
+        point2d_t offset = f->preprocessed_text.offset[i];
+        v2d_t size = f->preprocessed_text.size[i];
+
+        /* skip empty segments, as in "</color>[__empty__]\n" */
+        if(*text_segment == '\0')
+            continue;
+
+        /* find the position of the segment in the drawing target */
+        point2d_t segment_position = point2d_add(initial_position, offset);
+        rect_t segment_rect = rect_new(segment_position.x, segment_position.y, size.x, size.y);
+
+        /* clip out the segment if possible */
+        if(segment_rect.y >= target_rect.height) /* exit early */
+            break;
+        if(!rect_overlaps(target_rect, segment_rect))
+            continue;
+
+        /* render the segment */
+        f->drv->textout(f->drv, text_segment, segment_position.x, segment_position.y, color);
+    }
+}
+
+/* render the preprocessed text into the cached texture, if needed.
+   Returns false if the text can't be cached */
+bool update_cache(font_t* f)
+{
+    int text_width = (int)ceilf(f->preprocessed_text.total_size.x);
+    int text_height = (int)ceilf(f->preprocessed_text.total_size.y);
+    int width = text_width + 2 * FONT_CACHEPADDING;
+    int height = text_height + 2 * FONT_CACHEPADDING;
+
+    /* nothing to do */
+    if(!f->cache.is_dirty)
+        return f->cache.image != NULL;
+
+    /* the text is too large (or empty) */
+    f->cache.is_dirty = false;
+    if(text_width <= 0 || text_height <= 0 || width > FONT_CACHEMAXSIZE || height > FONT_CACHEMAXSIZE) {
+        release_cache(f);
+        return false;
+    }
+
+    /* reuse the texture if it has the same size */
+    if(f->cache.image != NULL && (image_width(f->cache.image) != width || image_height(f->cache.image) != height))
+        release_cache(f);
+    if(f->cache.image == NULL)
+        f->cache.image = image_create(width, height);
+
+    /* we can't change the drawing target while drawing is held */
+    bool was_held = al_is_bitmap_drawing_held();
+    al_hold_bitmap_drawing(false);
+
+    /* render the text into the texture */
+    image_t* previous_target = image_drawing_target();
+    image_set_drawing_target(f->cache.image);
+    image_clear(color_rgba(0, 0, 0, 0));
+
+    al_hold_bitmap_drawing(true);
+    render_text(f, point2d_new(FONT_CACHEPADDING, FONT_CACHEPADDING), rect_new(0, 0, width, height));
+    al_hold_bitmap_drawing(false);
+
+    image_set_drawing_target(previous_target);
+    al_hold_bitmap_drawing(was_held);
+
+    /* done */
+    return true;
+}
+
+/* release the cached texture */
+void release_cache(font_t* f)
+{
+    if(f->cache.image != NULL) {
+        image_destroy(f->cache.image);
+        f->cache.image = NULL;
+    }
 }
 
 /* ------------------------------------------------- */
@@ -1467,6 +2218,15 @@ int traverse(const parsetree_statement_t* stmt)
             );
             break;
 
+        case FONTSCRIPTTYPE_SDF:
+            drv = fontdrv_sdf_new(
+                header.data.ttf.source_file,
+                header.data.ttf.size,
+                header.data.ttf.antialias,
+                header.data.ttf.shadow
+            );
+            break;
+
         case FONTSCRIPTTYPE_BMP:
             drv = fontdrv_bmp_new(
                 header.data.bmp.source_file,
@@ -1513,6 +2273,16 @@ int traverse_block(const parsetree_statement_t* stmt, void* data)
 
         nanoparser_traverse_program_ex(nanoparser_get_program(p1), data, traverse_ttf);
     }
+    else if(str_icmp(id, "distancefield") == 0) {
+        /* default configuration (same keywords as truetype) */
+        header->type = FONTSCRIPTTYPE_SDF;
+        strcpy(header->data.ttf.source_file, "");
+        header->data.ttf.size = 12;
+        header->data.ttf.antialias = false;
+        header->data.ttf.shadow = false;
+
+        nanoparser_traverse_program_ex(nanoparser_get_program(p1), data, traverse_ttf);
+    }
     else if(str_icmp(id, "bitmap") == 0) {
         /* default configuration */
         header->type = FONTSCRIPTTYPE_BMP;
@@ -1801,14 +2571,17 @@ fontdrv_t* fontdrv_bmp_new(const char* source_file, charproperties_t chr[], int
     /* initialize the vtable */
     ((fontdrv_t*)f)->textout = fontdrv_bmp_textout;
     ((fontdrv_t*)f)->line_width = fontdrv_bmp_linewidth;
+    ((fontdrv_t*)f)->prefix_width = fontdrv_bmp_prefixwidth;
     ((fontdrv_t*)f)->line_height = fontdrv_bmp_lineheight;
     ((fontdrv_t*)f)->filepath = fontdrv_bmp_filepath;
     ((fontdrv_t*)f)->image = fontdrv_bmp_image;
     ((fontdrv_t*)f)->release = fontdrv_bmp_release;
 
     /* initialize the glyphs */
-    for(int j = 0; j < FONT_MAXBITMAPGLYPHS; j++)
+    for(int j = 0; j < FONT_MAXBITMAPGLYPHS; j++) {
         f->glyph[j] = NULL;
+        f->glyph_width[j] = -1;
+    }
 
     /* set the image atlas */
     f->atlas = img;
@@ -1819,6 +2592,7 @@ fontdrv_t* fontdrv_bmp_new(const char* source_file, charproperties_t chr[], int
         if(chr[j].valid) {
             f->glyph[j] = image_create_shared(img, chr[j].source_rect.x, chr[j].source_rect.y, chr[j].source_rect.width, chr[j].source_rect.height);
             f->glyph_offset[j] = chr[j].offset;
+            f->glyph_width[j] = image_width(f->glyph[j]);
             f->line_height = max(f->line_height, chr[j].source_rect.height);
         }
     }
@@ -1858,13 +2632,13 @@ void fontdrv_bmp_textout(const fontdrv_t* fnt, const char* text, int x, int y, c
     int vsp = f->spacing.y;
     uint32_t c = 0;
 
-    for(size_t i = 0; (c = u8_nextchar(text, &i)) != 0; ) {
+    for(size_t i = 0; (c = next_codepoint(text, &i)) != 0; ) {
         point2d_t glyph_offset;
         const image_t* glyph = find_bmp_glyph(f, c, &glyph_offset);
         if(glyph != NULL) {
             int dy = f->line_height - vsp - image_height(glyph);
             image_draw_tinted(glyph, x + glyph_offset.x, y + dy + glyph_offset.y, color, IF_NONE);
-            x += image_width(glyph) + hsp;
+            x += f->glyph_width[c] + hsp;
         }
     }
 }
@@ -1883,10 +2657,9 @@ int fontdrv_bmp_linewidth(const fontdrv_t* fnt, const char* text)
     int line_width = 0;
     uint32_t c = 0;
 
-    for(size_t i = 0; (c = u8_nextchar(text, &i)) != 0; ) {
-        const image_t* glyph = find_bmp_glyph(f, c, NULL);
-        if(glyph != NULL) {
-            line_width += image_width(glyph) + space;
+    for(size_t i = 0; (c = next_codepoint(text, &i)) != 0; ) {
+        if(c < FONT_MAXBITMAPGLYPHS && f->glyph_width[c] >= 0) {
+            line_width += f->glyph_width[c] + space;
             space = (text[i] != '\0') ? hsp : 0;
         }
     }
@@ -1894,6 +2667,25 @@ int fontdrv_bmp_linewidth(const fontdrv_t* fnt, const char* text)
     return line_width;
 }
 
+void fontdrv_bmp_prefixwidth(const fontdrv_t* fnt, const uint32_t* codepoint, int length, int* out_width)
+{
+    const fontdrv_bmp_t* f = (const fontdrv_bmp_t*)fnt;
+    int hsp = f->spacing.x;
+    int space = 0;
+    int line_width = 0;
+
+    /* same as fontdrv_bmp_linewidth(), measuring all prefixes in a single pass */
+    for(int j = 0; j < length; j++) {
+        uint32_t c = codepoint[j];
+        if(c < FONT_MAXBITMAPGLYPHS && f->glyph_width[c] >= 0) {
+            line_width += f->glyph_width[c] + space;
+            space = hsp;
+        }
+
+        out_width[j] = line_width;
+    }
+}
+
 const char* fontdrv_bmp_filepath(const fontdrv_t* fnt)
 {
     const fontdrv_bmp_t* f = (const fontdrv_bmp_t*)fnt;
@@ -1930,6 +2722,7 @@ fontdrv_t* fontdrv_ttf_new(const char* source_file, int size, bool antialias, bo
     fontdrv_ttf_t* f = mallocx(sizeof *f);
     ((fontdrv_t*)f)->textout = fontdrv_ttf_textout;
     ((fontdrv_t*)f)->line_width = fontdrv_ttf_linewidth;
+    ((fontdrv_t*)f)->prefix_width = NULL;
     ((fontdrv_t*)f)->line_height = fontdrv_ttf_lineheight;
     ((fontdrv_t*)f)->filepath = fontdrv_ttf_filepath;
     ((fontdrv_t*)f)->image = fontdrv_ttf_image;
@@ -1942,6 +2735,11 @@ fontdrv_t* fontdrv_ttf_new(const char* source_file, int size, bool antialias, bo
     f->shadow = shadow;
     f->line_height = 0;
 
+    /* key of the shared face; shadows are drawn by the driver and are not part of it */
+    size_t key_size = strlen(source_file) + 32;
+    f->face_key = mallocx(key_size * sizeof(*(f->face_key)));
+    snprintf(f->face_key, key_size, "%s:%d:%d", source_file, f->size, (int)antialias);
+
     /* lazy loading */
     f->font = NULL;
 
@@ -1957,6 +2755,15 @@ void fontdrv_ttf_textout(const fontdrv_t* fnt, const char* text, int x, int y, c
     if(!has_loaded_ttf(f))
         load_ttf((fontdrv_ttf_t*)f);
 
+    /* dirty tracking */
+    if(video_is_tracking_drawing() && image_drawing_target() == video_get_backbuffer()) {
+        const float param[] = { x, y, color._color.r, color._color.g, color._color.b, color._color.a };
+        video_track_drawing(&(f->font), sizeof(f->font));
+        video_track_drawing(param, sizeof(param));
+        video_track_drawing(al_get_current_transform()->m, sizeof(al_get_current_transform()->m));
+        video_track_drawing(text, strlen(text));
+    }
+
     /* draw shadow */
     if(f->shadow) {
         ALLEGRO_COLOR black = al_map_rgb(0, 0, 0);
@@ -1977,6 +2784,7 @@ void fontdrv_ttf_release(fontdrv_t* fnt)
     if(has_loaded_ttf(f))
         unload_ttf(f);
 
+    free(f->face_key);
     free(f->filepath);
     free(f);
 }
@@ -2032,20 +2840,477 @@ bool has_loaded_ttf(const fontdrv_ttf_t* f)
 
 void load_ttf(fontdrv_ttf_t* f)
 {
-    const char* fullpath = asset_path(f->filepath);
+    ttfface_t* face = hashtable_ttfface_t_find(ttf_faces, f->face_key);
+
+    /* load the face only if no other driver has loaded it */
+    if(face == NULL) {
+        const char* fullpath = asset_path(f->filepath);
 
-    logfile_message("Loading TrueType font \"%s\"...", fullpath);
+        logfile_message("Loading TrueType font \"%s\"...", fullpath);
 
-    f->font = al_load_ttf_font(fullpath, -(f->size), !(f->antialias) ? ALLEGRO_TTF_MONOCHROME : 0);
-    if(f->font == NULL)
-        fatal_error("Failed to load TrueType font \"%s\"", fullpath);
+        face = mallocx(sizeof *face);
+        face->font = al_load_ttf_font(fullpath, -(f->size), !(f->antialias) ? ALLEGRO_TTF_MONOCHROME : 0);
+        if(face->font == NULL)
+            fatal_error("Failed to load TrueType font \"%s\"", fullpath);
 
+        hashtable_ttfface_t_add(ttf_faces, f->face_key, face);
+    }
+
+    /* share the face */
+    hashtable_ttfface_t_ref(ttf_faces, f->face_key);
+    f->font = face->font;
     f->line_height = al_get_font_line_height(f->font);
 }
 
 void unload_ttf(fontdrv_ttf_t* f)
 {
-    al_destroy_font(f->font);
+    /* the face is released when no driver uses it */
+    if(0 == hashtable_ttfface_t_unref(ttf_faces, f->face_key))
+        hashtable_ttfface_t_remove(ttf_faces, f->face_key);
+
+    f->font = NULL;
+}
+
+void ttfface_destroy(ttfface_t* face)
+{
+    al_destroy_font(face->font);
+    free(face);
+}
+
+/* ------------------------------------------------- */
+/* signed distance field fonts */
+/* ------------------------------------------------- */
+
+fontdrv_t* fontdrv_sdf_new(const char* source_file, int size, bool antialias, bool shadow)
+{
+    /* basic setup */
+    fontdrv_sdf_t* f = mallocx(sizeof *f);
+    ((fontdrv_t*)f)->textout = fontdrv_sdf_textout;
+    ((fontdrv_t*)f)->line_width = fontdrv_sdf_linewidth;
+    ((fontdrv_t*)f)->prefix_width = fontdrv_sdf_prefixwidth;
+    ((fontdrv_t*)f)->line_height = fontdrv_sdf_lineheight;
+    ((fontdrv_t*)f)->filepath = fontdrv_sdf_filepath;
+    ((fontdrv_t*)f)->image = fontdrv_sdf_image;
+    ((fontdrv_t*)f)->release = fontdrv_sdf_release;
+
+    /* store font attributes */
+    f->filepath = str_dup(source_file);
+    f->size = max(size, 0); /* height of glyphs in pixels */
+    f->scale = (float)(f->size) / (float)FONT_SDFGLYPHSIZE;
+    f->antialias = antialias;
+    f->shadow = shadow;
+    f->line_height = 0;
+
+    /* lazy loading */
+    f->atlas = NULL;
+
+    /* done! */
+    return (fontdrv_t*)f;
+}
+
+void fontdrv_sdf_textout(const fontdrv_t* fnt, const char* text, int x, int y, color_t color)
+{
+    const fontdrv_sdf_t* f = (const fontdrv_sdf_t*)fnt;
+
+    if(f->atlas == NULL)
+        load_sdf((fontdrv_sdf_t*)f);
+
+    /* dirty tracking */
+    if(video_is_tracking_drawing() && image_drawing_target() == video_get_backbuffer()) {
+        const float param[] = { x, y, f->scale, color._color.r, color._color.g, color._color.b, color._color.a };
+        video_track_drawing(&(f->atlas), sizeof(f->atlas));
+        video_track_drawing(param, sizeof(param));
+        video_track_drawing(al_get_current_transform()->m, sizeof(al_get_current_transform()->m));
+        video_track_drawing(text, strlen(text));
+    }
+
+    /* generate the missing glyphs before drawing anything, since
+       the generation changes the drawing target */
+    uint32_t c = 0;
+    for(size_t i = 0; (c = next_codepoint(text, &i)) != 0; )
+        find_sdf_glyph(f->atlas, c);
+
+    /* temporarily disable deferred drawing, since we'll change the shader */
+    bool is_held = al_is_bitmap_drawing_held();
+    if(is_held)
+        al_hold_bitmap_drawing(false);
+
+    /* use the distance field shader */
+    shader_t* shader = sdf_shader();
+    const shader_t* prev_shader = shader_get_active();
+    shader_set_bool(shader, "antialias", f->antialias);
+    shader_set_active(shader);
+
+    /* the glyphs of the text are batched */
+    al_hold_bitmap_drawing(true);
+
+    /* draw shadow */
+    if(f->shadow) {
+        ALLEGRO_COLOR black = al_map_rgb(0, 0, 0);
+        draw_sdf_text(f, text, x, y + 1.0f, black);
+        draw_sdf_text(f, text, x + 1.0f, y + 1.0f, black);
+        if(f->size >= 18) /* TODO: configurable shadows */
+            draw_sdf_text(f, text, x + 2.0f, y + 2.0f, black);
+    }
+
+    /* draw text */
+    draw_sdf_text(f, text, x, y, color._color);
+
+    /* restore the state */
+    al_hold_bitmap_drawing(false);
+    shader_set_active(prev_shader);
+    if(is_held)
+        al_hold_bitmap_drawing(true);
+}
+
+void fontdrv_sdf_release(fontdrv_t* fnt)
+{
+    fontdrv_sdf_t* f = (fontdrv_sdf_t*)fnt;
+
+    if(f->atlas != NULL)
+        unload_sdf(f);
+
+    free(f->filepath);
+    free(f);
+}
+
+int fontdrv_sdf_lineheight(const fontdrv_t* fnt)
+{
+    const fontdrv_sdf_t* f = (const fontdrv_sdf_t*)fnt;
+
+    if(f->atlas == NULL)
+        load_sdf((fontdrv_sdf_t*)f);
+
+    return f->line_height;
+}
+
+int fontdrv_sdf_linewidth(const fontdrv_t* fnt, const char* text)
+{
+    const fontdrv_sdf_t* f = (const fontdrv_sdf_t*)fnt;
+    int prev = ALLEGRO_NO_KERNING;
+    float width = 0.0f;
+    uint32_t c = 0;
+
+    /* empty string? */
+    if(*text == '\0')
+        return 0;
+
+    /* lazily load the font */
+    if(f->atlas == NULL)
+        load_sdf((fontdrv_sdf_t*)f);
+
+    /* add up the advances of the glyphs, ignoring the characters used as breakpoints */
+    for(size_t i = 0; (c = next_codepoint(text, &i)) != 0; ) {
+        if(c == '\n' || c == (uint32_t)FONT_COLORBREAKPOINT)
+            continue;
+
+        if(prev != ALLEGRO_NO_KERNING)
+            width += al_get_glyph_advance(f->atlas->font, prev, c);
+
+        prev = c;
+    }
+
+    if(prev != ALLEGRO_NO_KERNING)
+        width += al_get_glyph_advance(f->atlas->font, prev, ALLEGRO_NO_KERNING);
+
+    /* done */
+    return (int)ceilf(width * f->scale);
+}
+
+void fontdrv_sdf_prefixwidth(const fontdrv_t* fnt, const uint32_t* codepoint, int length, int* out_width)
+{
+    const fontdrv_sdf_t* f = (const fontdrv_sdf_t*)fnt;
+    int prev = ALLEGRO_NO_KERNING;
+    float width = 0.0f;
+
+    /* lazily load the font */
+    if(f->atlas == NULL && length > 0)
+        load_sdf((fontdrv_sdf_t*)f);
+
+    /* same as fontdrv_sdf_linewidth(), measuring all prefixes in a single pass */
+    for(int j = 0; j < length; j++) {
+        uint32_t c = codepoint[j];
+
+        if(c != '\n' && c != (uint32_t)FONT_COLORBREAKPOINT) {
+            if(prev != ALLEGRO_NO_KERNING)
+                width += al_get_glyph_advance(f->atlas->font, prev, c);
+
+            prev = c;
+        }
+
+        if(prev != ALLEGRO_NO_KERNING)
+            out_width[j] = (int)ceilf((width + al_get_glyph_advance(f->atlas->font, prev, ALLEGRO_NO_KERNING)) * f->scale);
+        else
+            out_width[j] = 0;
+    }
+}
+
+const char* fontdrv_sdf_filepath(const fontdrv_t* fnt)
+{
+    const fontdrv_sdf_t* f = (const fontdrv_sdf_t*)fnt;
+    return f->filepath;
+}
+
+const image_t* fontdrv_sdf_image(const fontdrv_t* fnt)
+{
+    /* the atlas is not exposed as an image */
+    return NULL;
+}
+
+/* draw a line of text using the glyphs of the atlas; the shader must be active */
+void draw_sdf_text(const fontdrv_sdf_t* f, const char* text, float x, float y, ALLEGRO_COLOR color)
+{
+    int prev = ALLEGRO_NO_KERNING;
+    float pen = x;
+    uint32_t c = 0;
+
+    for(size_t i = 0; (c = next_codepoint(text, &i)) != 0; ) {
+        if(c == '\n' || c == (uint32_t)FONT_COLORBREAKPOINT)
+            continue;
+
+        /* advance the pen */
+        if(prev != ALLEGRO_NO_KERNING)
+            pen += f->scale * al_get_glyph_advance(f->atlas->font, prev, c);
+        prev = c;
+
+        /* draw the glyph */
+        const sdfglyph_t* glyph = find_sdf_glyph(f->atlas, c);
+        if(glyph->source_rect.width > 0 && glyph->source_rect.height > 0) {
+            al_draw_tinted_scaled_bitmap(
+                f->atlas->page[glyph->page], color,
+                glyph->source_rect.x, glyph->source_rect.y,
+                glyph->source_rect.width, glyph->source_rect.height,
+                pen + f->scale * glyph->offset.x, y + f->scale * glyph->offset.y,
+                f->scale * glyph->source_rect.width, f->scale * glyph->source_rect.height,
+                0
+            );
+        }
+    }
+}
+
+/* the shader that renders the distance fields */
+shader_t* sdf_shader()
+{
+    if(!shader_exists(sdf_shader_name))
+        return shader_create(sdf_shader_name, sdf_shader_glsl);
+
+    return shader_get(sdf_shader_name);
+}
+
+void load_sdf(fontdrv_sdf_t* f)
+{
+    sdfatlas_t* atlas = hashtable_sdfatlas_t_find(sdf_atlases, f->filepath);
+
+    /* create the atlas only if no other driver has created it */
+    if(atlas == NULL) {
+        const char* fullpath = asset_path(f->filepath);
+
+        logfile_message("Loading TrueType font \"%s\" as a distance field...", fullpath);
+
+        atlas = mallocx(sizeof *atlas);
+        atlas->font = al_load_ttf_font(fullpath, -FONT_SDFGLYPHSIZE, 0);
+        if(atlas->font == NULL)
+            fatal_error("Failed to load TrueType font \"%s\"", fullpath);
+
+        darray_init(atlas->page);
+        atlas->cursor.x = atlas->cursor.y = atlas->cursor.shelf_height = FONT_SDFPAGESIZE; /* no page */
+        for(int i = 0; i < FONT_SDFMAXBLOCKS; i++)
+            atlas->block[i] = NULL;
+
+        hashtable_sdfatlas_t_add(sdf_atlases, f->filepath, atlas);
+    }
+
+    /* share the atlas */
+    hashtable_sdfatlas_t_ref(sdf_atlases, f->filepath);
+    f->atlas = atlas;
+    f->line_height = (int)ceilf(f->scale * al_get_font_line_height(atlas->font));
+}
+
+void unload_sdf(fontdrv_sdf_t* f)
+{
+    /* the atlas is released when no driver uses it */
+    if(0 == hashtable_sdfatlas_t_unref(sdf_atlases, f->filepath))
+        hashtable_sdfatlas_t_remove(sdf_atlases, f->filepath);
+
+    f->atlas = NULL;
+}
+
+void sdfatlas_destroy(sdfatlas_t* atlas)
+{
+    for(int i = 0; i < FONT_SDFMAXBLOCKS; i++) {
+        if(atlas->block[i] != NULL)
+            free(atlas->block[i]);
+    }
+
+    for(int i = 0; i < darray_length(atlas->page); i++)
+        al_destroy_bitmap(atlas->page[i]);
+    darray_release(atlas->page);
+
+    al_destroy_font(atlas->font);
+    free(atlas);
+}
+
+/* finds a glyph of the atlas, generating it if necessary */
+const sdfglyph_t* find_sdf_glyph(sdfatlas_t* atlas, uint32_t codepoint)
+{
+    uint32_t b = codepoint / FONT_SDFBLOCKSIZE;
+    uint32_t j = codepoint % FONT_SDFBLOCKSIZE;
+
+    /* invalid codepoint; use the replacement character */
+    if(b >= FONT_SDFMAXBLOCKS)
+        return find_sdf_glyph(atlas, 0xFFFD);
+
+    /* allocate the block */
+    if(atlas->block[b] == NULL) {
+        atlas->block[b] = mallocx(FONT_SDFBLOCKSIZE * sizeof(*(atlas->block[b])));
+        for(int i = 0; i < FONT_SDFBLOCKSIZE; i++)
+            atlas->block[b][i].valid = false;
+    }
+
+    /* generate the glyph */
+    sdfglyph_t* glyph = &(atlas->block[b][j]);
+    if(!glyph->valid)
+        generate_sdf_glyph(atlas, codepoint, glyph);
+
+    return glyph;
+}
+
+/* rasterizes a glyph, computes its distance field and stores it in the atlas */
+void generate_sdf_glyph(sdfatlas_t* atlas, uint32_t codepoint, sdfglyph_t* glyph)
+{
+    int bbx = 0, bby = 0, bbw = 0, bbh = 0;
+
+    /* an empty glyph, such as a blank */
+    glyph->valid = true;
+    glyph->page = 0;
+    glyph->source_rect.x = glyph->source_rect.y = 0;
+    glyph->source_rect.width = glyph->source_rect.height = 0;
+    glyph->offset = point2d_new(0, 0);
+    if(!al_get_glyph_dimensions(atlas->font, codepoint, &bbx, &bby, &bbw, &bbh) || bbw <= 0 || bbh <= 0)
+        return;
+
+    /* the distance field extends beyond the glyph */
+    int width = bbw + 2 * FONT_SDFSPREAD;
+    int height = bbh + 2 * FONT_SDFSPREAD;
+    if(width + 1 > FONT_SDFPAGESIZE || height + 1 > FONT_SDFPAGESIZE) {
+        logfile_message("WARNING: glyph U+%04X is too large for a distance field", (unsigned)codepoint);
+        return;
+    }
+
+    /* find space for the glyph: use a new shelf or a new page if necessary */
+    if(atlas->cursor.x + width + 1 > FONT_SDFPAGESIZE) {
+        atlas->cursor.x = 0;
+        atlas->cursor.y += atlas->cursor.shelf_height;
+        atlas->cursor.shelf_height = 0;
+    }
+
+    if(atlas->cursor.y + height + 1 > FONT_SDFPAGESIZE) {
+        ALLEGRO_STATE state;
+        al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS | ALLEGRO_STATE_TARGET_BITMAP);
+        al_set_new_bitmap_flags((al_get_current_display() != NULL ? ALLEGRO_VIDEO_BITMAP : ALLEGRO_MEMORY_BITMAP) | ALLEGRO_MIN_LINEAR | ALLEGRO_MAG_LINEAR);
+
+        ALLEGRO_BITMAP* page = al_create_bitmap(FONT_SDFPAGESIZE, FONT_SDFPAGESIZE);
+        if(page == NULL)
+            fatal_error("Can't create a %dx%d page for a distance field atlas", FONT_SDFPAGESIZE, FONT_SDFPAGESIZE);
+
+        al_set_target_bitmap(page);
+        al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+        al_restore_state(&state);
+
+        darray_push(atlas->page, page);
+        atlas->cursor.x = atlas->cursor.y = atlas->cursor.shelf_height = 0;
+    }
+
+    glyph->page = darray_length(atlas->page) - 1;
+    glyph->source_rect.x = atlas->cursor.x;
+    glyph->source_rect.y = atlas->cursor.y;
+    glyph->source_rect.width = width;
+    glyph->source_rect.height = height;
+    glyph->offset = point2d_new(bbx - FONT_SDFSPREAD, bby - FONT_SDFSPREAD);
+
+    atlas->cursor.x += width + 1; /* leave a gap between the glyphs due to linear filtering */
+    atlas->cursor.shelf_height = max(atlas->cursor.shelf_height, height + 1);
+
+    /* rasterize the glyph */
+    uint8_t* coverage = mallocx(width * height * sizeof(*coverage));
+    uint8_t* field = mallocx(width * height * sizeof(*field));
+    ALLEGRO_STATE state;
+
+    al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS | ALLEGRO_STATE_TARGET_BITMAP | ALLEGRO_STATE_BLENDER);
+    al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+    ALLEGRO_BITMAP* raster = al_create_bitmap(width, height);
+    if(raster == NULL)
+        fatal_error("Can't rasterize glyph U+%04X of a distance field atlas", (unsigned)codepoint);
+
+    al_set_target_bitmap(raster);
+    al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+    al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_INVERSE_ALPHA);
+    al_draw_glyph(atlas->font, al_map_rgb(255, 255, 255), FONT_SDFSPREAD - bbx, FONT_SDFSPREAD - bby, codepoint);
+
+    ALLEGRO_LOCKED_REGION* region = al_lock_bitmap(raster, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY);
+    for(int y = 0; y < height; y++) {
+        const uint8_t* row = (const uint8_t*)region->data + y * region->pitch;
+        for(int x = 0; x < width; x++)
+            coverage[y * width + x] = row[4 * x + 3]; /* alpha */
+    }
+    al_unlock_bitmap(raster);
+    al_destroy_bitmap(raster);
+
+    /* compute the distance field */
+    compute_distance_field(coverage, field, width, height);
+
+    /* store it in the page */
+    ALLEGRO_BITMAP* page = atlas->page[glyph->page];
+    region = al_lock_bitmap_region(page, glyph->source_rect.x, glyph->source_rect.y, width, height, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_WRITEONLY);
+    if(region != NULL) {
+        for(int y = 0; y < height; y++) {
+            uint8_t* row = (uint8_t*)region->data + y * region->pitch;
+            for(int x = 0; x < width; x++)
+                memset(row + 4 * x, field[y * width + x], 4); /* premultiplied white */
+        }
+        al_unlock_bitmap(page);
+    }
+    else
+        logfile_message("WARNING: can't store glyph U+%04X in a distance field atlas", (unsigned)codepoint);
+
+    al_restore_state(&state);
+
+    /* done */
+    free(field);
+    free(coverage);
+}
+
+/* computes a signed distance field given the coverage of a glyph;
+   the edge is mapped to 128, the inside to larger values */
+void compute_distance_field(const uint8_t* coverage, uint8_t* field, int width, int height)
+{
+    const int r = FONT_SDFSPREAD;
+
+    for(int y = 0; y < height; y++) {
+        for(int x = 0; x < width; x++) {
+            bool inside = (coverage[y * width + x] >= 128);
+            int nearest = (r + 1) * (r + 1);
+
+            /* find the nearest pixel on the other side of the edge (pixels out of bounds are outside) */
+            for(int dy = -r; dy <= r; dy++) {
+                for(int dx = -r; dx <= r; dx++) {
+                    int u = x + dx, v = y + dy;
+                    bool other = (u >= 0 && u < width && v >= 0 && v < height) && (coverage[v * width + u] >= 128);
+                    int d2 = dx * dx + dy * dy;
+
+                    if(other != inside && d2 < nearest)
+                        nearest = d2;
+                }
+            }
+
+            /* the edge lies between the centers of the pixels */
+            float distance = sqrtf(nearest);
+            distance = min(distance, (float)r) - 0.5f;
+            float s = (inside ? distance : -distance) / (float)r;
+            int value = (int)(128.0f + 127.0f * s + 0.5f);
+            field[y * width + x] = (uint8_t)clip(value, 0, 255);
+        }
+    }
 }
 
 /* ------------------------------------------------- */
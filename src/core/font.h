@@ -53,12 +53,17 @@ int font_get_maxlength(const font_t* f); /* get the maximum number of characters
 void font_set_maxlength(font_t* f, int max_length); /* set the maximum number of characters, ignoring color tags and blanks */
 const char* font_get_filepath(const font_t* f); /* get the relative path of the file (image, truetype font...) that originates this font */
 const struct image_t* font_get_image(const font_t* f); /* get the image atlas if it's a bitmap font; otherwise NULL is returned */
+const char* font_get_driver(const font_t* f); /* get the name of the driver of the font: "bmp", "ttf" or "sdf" */
+void font_set_cached(font_t* f, bool cached); /* render the text into a texture when it changes (useful for static texts) */
+bool font_is_cached(const font_t* f); /* is the text rendered into a texture? */
+const struct image_t* font_get_cached_image(const font_t* f); /* the texture of a cached font, or NULL if not available */
 
 /* misc */
 void font_init(); /* initializes the font module */
 void font_release(); /* releases the font module */
 void font_register_variable(const char* variable_name, const char* (*callback)()); /* variable/text interpolation */
 bool font_exists(const char* font_name); /* checks if a font script (.fnt) of the given name exists */
+void font_foreach(void* data, void (*callback)(const char*,void*)); /* enumerates the names of the fonts */
 
 
 #endif
@@ -0,0 +1,291 @@
+/*
+ * Open Surge Engine
+ * frameprofiler.c - frame profiler
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <allegro5/allegro.h>
+#include <stdlib.h>
+#include <string.h>
+#include "frameprofiler.h"
+#include "timer.h"
+#include "logfile.h"
+#include "../util/util.h"
+
+/* the measurements of a frame, in seconds */
+typedef struct framerecord_t framerecord_t;
+struct framerecord_t
+{
+    int64_t frame; /* frame number */
+    double start_time;
+    double duration[FRAMEPHASE_COUNT];
+};
+
+/* internal data: a ring buffer of the recent frames */
+#define CAPACITY 4096 /* a little more than a minute at 60 fps */
+static const char REPORT_FILE[] = "frame_profile.csv";
+static const char* PHASE_NAME[FRAMEPHASE_COUNT] = {
+    [FRAMEPHASE_FRAME] = "frame",
+    [FRAMEPHASE_UPDATE] = "update",
+    [FRAMEPHASE_RENDER] = "render",
+    [FRAMEPHASE_PRESENT] = "present",
+    [FRAMEPHASE_GC] = "gc",
+    [FRAMEPHASE_OVERLAY] = "overlay"
+};
+static framerecord_t* record = NULL; /* record[CAPACITY] */
+static int64_t frame_count = 0; /* number of frames that have begun */
+static double phase_start[FRAMEPHASE_COUNT];
+static double* scratch = NULL; /* scratch[CAPACITY], used to compute percentiles */
+static bool enabled = false;
+
+static inline framerecord_t* nth_record(int64_t frame);
+static int completed_frames();
+static int compare_durations(const void* a, const void* b);
+static void write_summary();
+static bool write_report_file(const char* filepath);
+
+
+
+/*
+ * frameprofiler_init()
+ * Initializes the frame profiler
+ */
+void frameprofiler_init(bool is_enabled)
+{
+    frameprofiler_release();
+
+    if(!(enabled = is_enabled))
+        return;
+
+    record = mallocx(CAPACITY * sizeof(*record));
+    scratch = mallocx(CAPACITY * sizeof(*scratch));
+    frame_count = 0;
+
+    for(int i = 0; i < FRAMEPHASE_COUNT; i++)
+        phase_start[i] = 0.0;
+}
+
+/*
+ * frameprofiler_release()
+ * Releases the frame profiler, writing a report of the recent
+ * frames to the logfile and to a file in the write directory
+ */
+void frameprofiler_release()
+{
+    if(!enabled)
+        return;
+
+    write_summary();
+    if(write_report_file(REPORT_FILE))
+        logfile_message("The frame profile has been written to %s", REPORT_FILE);
+    else
+        logfile_message("Can't write the frame profile to %s", REPORT_FILE);
+
+    free(scratch);
+    free(record);
+    scratch = NULL;
+    record = NULL;
+    enabled = false;
+}
+
+/*
+ * frameprofiler_is_enabled()
+ * Is the frame profiler enabled?
+ */
+bool frameprofiler_is_enabled()
+{
+    return enabled;
+}
+
+/*
+ * frameprofiler_begin_frame()
+ * Begins a new frame. Call at the start of each update of the main loop
+ */
+void frameprofiler_begin_frame()
+{
+    if(!enabled)
+        return;
+
+    double now = timer_get_now();
+
+    /* the previous frame is complete */
+    if(frame_count > 0) {
+        framerecord_t* previous = nth_record(frame_count - 1);
+        previous->duration[FRAMEPHASE_FRAME] = now - previous->start_time;
+    }
+
+    /* start a new record, overwriting the oldest one */
+    framerecord_t* current = nth_record(frame_count);
+    current->frame = timer_get_frames();
+    current->start_time = now;
+    for(int i = 0; i < FRAMEPHASE_COUNT; i++)
+        current->duration[i] = 0.0;
+
+    frame_count++;
+}
+
+/*
+ * frameprofiler_begin()
+ * Begins measuring a phase of the current frame
+ */
+void frameprofiler_begin(framephase_t phase)
+{
+    if(!enabled)
+        return;
+
+    phase_start[phase] = timer_get_now();
+}
+
+/*
+ * frameprofiler_end()
+ * Ends measuring a phase of the current frame. A phase
+ * may be measured more than once in the same frame
+ */
+void frameprofiler_end(framephase_t phase)
+{
+    if(!enabled || frame_count == 0)
+        return;
+
+    framerecord_t* current = nth_record(frame_count - 1);
+    current->duration[phase] += timer_get_now() - phase_start[phase];
+}
+
+/*
+ * frameprofiler_percentile()
+ * The given percentile, in [0,100], of the duration of a phase in the
+ * recent frames, in seconds. Returns zero if there are no measurements
+ */
+double frameprofiler_percentile(framephase_t phase, double percentile)
+{
+    int n = completed_frames();
+
+    if(!enabled || n == 0 || phase < 0 || phase >= FRAMEPHASE_COUNT)
+        return 0.0;
+
+    for(int i = 0; i < n; i++)
+        scratch[i] = nth_record(frame_count - 1 - n + i)->duration[phase];
+    qsort(scratch, n, sizeof(*scratch), compare_durations);
+
+    percentile = clip(percentile, 0.0, 100.0);
+    return scratch[(int)((n - 1) * percentile / 100.0)];
+}
+
+/*
+ * frameprofiler_mean()
+ * The mean duration of a phase in the recent frames, in seconds.
+ * Returns zero if there are no measurements
+ */
+double frameprofiler_mean(framephase_t phase)
+{
+    int n = completed_frames();
+    double sum = 0.0;
+
+    if(!enabled || n == 0 || phase < 0 || phase >= FRAMEPHASE_COUNT)
+        return 0.0;
+
+    for(int i = 0; i < n; i++)
+        sum += nth_record(frame_count - 1 - n + i)->duration[phase];
+
+    return sum / n;
+}
+
+/*
+ * frameprofiler_find_phase()
+ * Finds a phase by its name, e.g., "render". Returns true on success
+ */
+bool frameprofiler_find_phase(const char* phase_name, framephase_t* phase)
+{
+    for(int i = 0; i < FRAMEPHASE_COUNT; i++) {
+        if(strcmp(PHASE_NAME[i], phase_name) == 0) {
+            *phase = (framephase_t)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+
+/*
+ * private
+ */
+
+/* the record of the given frame in the ring buffer */
+framerecord_t* nth_record(int64_t frame)
+{
+    return &record[frame % CAPACITY];
+}
+
+/* the number of complete frames in the ring buffer. The current frame is not complete */
+int completed_frames()
+{
+    return (int)min(frame_count - 1, (int64_t)(CAPACITY - 1));
+}
+
+/* compare two durations */
+int compare_durations(const void* a, const void* b)
+{
+    double x = *((const double*)a);
+    double y = *((const double*)b);
+
+    return (x > y) - (x < y);
+}
+
+/* writes percentiles of the recent frames to the logfile */
+void write_summary()
+{
+    logfile_message("Frame profile of the last %d frames:", completed_frames());
+
+    for(int i = 0; i < FRAMEPHASE_COUNT; i++) {
+        logfile_message("  %s: p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms",
+            PHASE_NAME[i],
+            1000.0 * frameprofiler_percentile(i, 50.0),
+            1000.0 * frameprofiler_percentile(i, 95.0),
+            1000.0 * frameprofiler_percentile(i, 99.0),
+            1000.0 * frameprofiler_percentile(i, 100.0)
+        );
+    }
+}
+
+/* writes the recent frames, one per line, in CSV format to a file of the virtual filesystem */
+bool write_report_file(const char* filepath)
+{
+    ALLEGRO_FILE* fp = al_fopen(filepath, "wb");
+    int n = completed_frames();
+
+    if(fp == NULL)
+        return false;
+
+    /* header */
+    al_fputs(fp, "frame,start_ms");
+    for(int i = 0; i < FRAMEPHASE_COUNT; i++)
+        al_fprintf(fp, ",%s_ms", PHASE_NAME[i]);
+    al_fputs(fp, "\n");
+
+    /* records, from the oldest to the newest */
+    for(int j = 0; j < n; j++) {
+        const framerecord_t* r = nth_record(frame_count - 1 - n + j);
+
+        al_fprintf(fp, "%.0f,%.3f", (double)r->frame, 1000.0 * r->start_time);
+        for(int i = 0; i < FRAMEPHASE_COUNT; i++)
+            al_fprintf(fp, ",%.3f", 1000.0 * r->duration[i]);
+        al_fputs(fp, "\n");
+    }
+
+    return al_fclose(fp);
+}
@@ -0,0 +1,53 @@
+/*
+ * Open Surge Engine
+ * frameprofiler.h - frame profiler
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FRAMEPROFILER_H
+#define _FRAMEPROFILER_H
+
+#include <stdbool.h>
+
+/* the measured phases of a frame */
+typedef enum framephase_t {
+    FRAMEPHASE_FRAME,   /* the whole frame, from the start of its update to the start of the next one */
+    FRAMEPHASE_UPDATE,  /* the update of the managers and of the scene, including the GC */
+    FRAMEPHASE_RENDER,  /* the rendering of the scene to the backbuffer */
+    FRAMEPHASE_PRESENT, /* the presentation of the backbuffer */
+    FRAMEPHASE_GC,      /* the garbage collector */
+    FRAMEPHASE_OVERLAY, /* the debug texts drawn over the frame, part of the presentation */
+
+    FRAMEPHASE_COUNT
+} framephase_t;
+
+/* frame profiler */
+void frameprofiler_init(bool enabled);
+void frameprofiler_release(); /* writes the report */
+bool frameprofiler_is_enabled();
+
+/* measurements of the main loop */
+void frameprofiler_begin_frame();
+void frameprofiler_begin(framephase_t phase);
+void frameprofiler_end(framephase_t phase);
+
+/* statistics of the recent frames */
+double frameprofiler_percentile(framephase_t phase, double percentile); /* in seconds; percentile in [0,100] */
+double frameprofiler_mean(framephase_t phase); /* in seconds */
+bool frameprofiler_find_phase(const char* phase_name, framephase_t* phase);
+
+#endif
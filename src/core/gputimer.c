@@ -0,0 +1,360 @@
+/*
+ * Open Surge Engine
+ * gputimer.c - GPU timing of render phases
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_opengl.h>
+#include <stdint.h>
+#include <string.h>
+#include "gputimer.h"
+#include "logfile.h"
+#include "../util/util.h"
+
+/* OpenGL symbols */
+#ifndef GL_TIMESTAMP
+#define GL_TIMESTAMP                0x8E28
+#endif
+
+#ifndef GL_QUERY_RESULT
+#define GL_QUERY_RESULT             0x8866
+#endif
+
+#ifndef GL_QUERY_RESULT_AVAILABLE
+#define GL_QUERY_RESULT_AVAILABLE   0x8867
+#endif
+
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT         0x8FBB
+#endif
+
+ALLEGRO_DEFINE_PROC_TYPE(void, fun_glgenqueries_t, (GLsizei, GLuint*));
+ALLEGRO_DEFINE_PROC_TYPE(void, fun_gldeletequeries_t, (GLsizei, const GLuint*));
+ALLEGRO_DEFINE_PROC_TYPE(void, fun_glquerycounter_t, (GLuint, GLenum));
+ALLEGRO_DEFINE_PROC_TYPE(void, fun_glgetqueryobjectiv_t, (GLuint, GLenum, GLint*));
+ALLEGRO_DEFINE_PROC_TYPE(void, fun_glgetqueryobjectui64v_t, (GLuint, GLenum, uint64_t*));
+ALLEGRO_DEFINE_PROC_TYPE(void, fun_glgetintegerv_t, (GLenum, GLint*));
+static fun_glgenqueries_t _glGenQueries = NULL;
+static fun_gldeletequeries_t _glDeleteQueries = NULL;
+static fun_glquerycounter_t _glQueryCounter = NULL;
+static fun_glgetqueryobjectiv_t _glGetQueryObjectiv = NULL;
+static fun_glgetqueryobjectui64v_t _glGetQueryObjectui64v = NULL;
+static fun_glgetintegerv_t _glGetIntegerv = NULL;
+static bool import_opengl_symbols();
+
+/* frames in flight. The queries of a frame are read when the frame
+   is about to be reused, i.e., LATENCY - 1 frames after it ended */
+#define LATENCY             4
+#define MAX_MARKS           64 /* per frame; subsequent marks are ignored */
+#define AVERAGE_FRAMES      60 /* compute the averages over this number of frames */
+
+typedef struct gpuframe_t gpuframe_t;
+struct gpuframe_t {
+    GLuint query[MAX_MARKS + 1]; /* timestamps; the last one ends the frame */
+    gpuphase_t phase[MAX_MARKS]; /* phase[i] begins at query[i] */
+    int mark_count;
+    bool is_pending; /* waiting for the results */
+};
+
+static struct {
+    bool is_available;
+    bool is_enabled;
+    bool check_disjoint; /* EXT_disjoint_timer_query */
+
+    gpuframe_t frame[LATENCY];
+    int current; /* the frame being recorded */
+
+    double sum[GPUPHASE_COUNT]; /* in milliseconds */
+    int sum_frames;
+    float avg[GPUPHASE_COUNT + 1]; /* the last entry is the total */
+} gputimer = {
+    .is_available = false,
+    .is_enabled = false
+};
+
+static const char* PHASE_NAME[] = {
+    [GPUPHASE_BACKGROUND] = "background",
+    [GPUPHASE_BRICKS] = "bricks",
+    [GPUPHASE_ENTITIES] = "entities",
+    [GPUPHASE_WATER] = "water",
+    [GPUPHASE_OTHER] = "other",
+    [GPUPHASE_POSTPROCESSING] = "post-processing",
+    [GPUPHASE_PRESENT] = "present",
+    [GPUPHASE_COUNT] = "total"
+};
+
+static void reset();
+static void collect(const gpuframe_t* frame);
+
+#define LOG(...) logfile_message("GPU timer - " __VA_ARGS__)
+
+
+
+/*
+ * gputimer_init()
+ * Initializes the GPU timer. Call after creating the display
+ */
+void gputimer_init()
+{
+    gputimer.is_available = false;
+
+    if(al_get_current_display() == NULL || !import_opengl_symbols()) {
+        LOG("GPU timing is not available");
+        return;
+    }
+
+    for(int i = 0; i < LATENCY; i++)
+        _glGenQueries(MAX_MARKS + 1, gputimer.frame[i].query);
+
+    gputimer.is_available = true;
+    reset();
+
+    LOG("GPU timing is available");
+}
+
+/*
+ * gputimer_release()
+ * Releases the GPU timer
+ */
+void gputimer_release()
+{
+    if(!gputimer.is_available)
+        return;
+
+    for(int i = 0; i < LATENCY; i++)
+        _glDeleteQueries(MAX_MARKS + 1, gputimer.frame[i].query);
+
+    gputimer.is_available = false;
+}
+
+/*
+ * gputimer_is_available()
+ * Is GPU timing supported by the driver?
+ */
+bool gputimer_is_available()
+{
+    return gputimer.is_available;
+}
+
+/*
+ * gputimer_set_enabled()
+ * Enables or disables GPU timing. The data is cleared
+ */
+void gputimer_set_enabled(bool enabled)
+{
+    gputimer.is_enabled = enabled;
+
+    if(gputimer.is_available)
+        reset();
+}
+
+/*
+ * gputimer_is_enabled()
+ * Is GPU timing enabled?
+ */
+bool gputimer_is_enabled()
+{
+    return gputimer.is_enabled;
+}
+
+/*
+ * gputimer_mark()
+ * Begins a render phase, ending the previous one
+ */
+void gputimer_mark(gpuphase_t phase)
+{
+    gpuframe_t* frame = &gputimer.frame[gputimer.current];
+
+    if(!gputimer.is_enabled || !gputimer.is_available)
+        return;
+
+    /* nothing to do */
+    if(frame->mark_count > 0 && frame->phase[frame->mark_count - 1] == phase)
+        return;
+
+    /* out of queries: the rest of the frame is attributed to the last phase */
+    if(frame->mark_count >= MAX_MARKS)
+        return;
+
+    _glQueryCounter(frame->query[frame->mark_count], GL_TIMESTAMP);
+    frame->phase[frame->mark_count++] = phase;
+}
+
+/*
+ * gputimer_end_frame()
+ * Ends the current frame. Call after presenting a frame
+ */
+void gputimer_end_frame()
+{
+    gpuframe_t* frame = &gputimer.frame[gputimer.current];
+
+    if(!gputimer.is_enabled || !gputimer.is_available)
+        return;
+
+    /* end the frame */
+    if(frame->mark_count > 0) {
+        _glQueryCounter(frame->query[frame->mark_count], GL_TIMESTAMP);
+        frame->is_pending = true;
+    }
+
+    /* read the results of the oldest frame, which we're about to reuse.
+       If they're not available yet, the frame is discarded */
+    gputimer.current = (gputimer.current + 1) % LATENCY;
+    frame = &gputimer.frame[gputimer.current];
+
+    if(frame->is_pending)
+        collect(frame);
+
+    /* begin a new frame */
+    frame->mark_count = 0;
+    frame->is_pending = false;
+    gputimer_mark(GPUPHASE_OTHER);
+}
+
+/*
+ * gputimer_milliseconds()
+ * The average GPU time per frame of a phase, in milliseconds.
+ * The total is given if phase is GPUPHASE_COUNT
+ */
+float gputimer_milliseconds(gpuphase_t phase)
+{
+    if(phase < 0 || phase > GPUPHASE_COUNT)
+        return 0.0f;
+
+    return gputimer.avg[phase];
+}
+
+/*
+ * gputimer_phase_name()
+ * The name of a phase
+ */
+const char* gputimer_phase_name(gpuphase_t phase)
+{
+    if(phase < 0 || phase > GPUPHASE_COUNT)
+        return "?";
+
+    return PHASE_NAME[phase];
+}
+
+
+
+/*
+ * private
+ */
+
+/* clear the data and begin a new frame */
+void reset()
+{
+    for(int i = 0; i < LATENCY; i++) {
+        gputimer.frame[i].mark_count = 0;
+        gputimer.frame[i].is_pending = false;
+    }
+
+    for(int p = 0; p < GPUPHASE_COUNT; p++)
+        gputimer.sum[p] = 0.0;
+
+    for(int p = 0; p <= GPUPHASE_COUNT; p++)
+        gputimer.avg[p] = 0.0f;
+
+    gputimer.sum_frames = 0;
+    gputimer.current = 0;
+
+    gputimer_mark(GPUPHASE_OTHER);
+}
+
+/* accumulate the GPU times of a frame, if its queries are ready */
+void collect(const gpuframe_t* frame)
+{
+    GLint available = 0;
+    uint64_t start, end;
+
+    /* the queries are completed in order */
+    _glGetQueryObjectiv(frame->query[frame->mark_count], GL_QUERY_RESULT_AVAILABLE, &available);
+    if(!available)
+        return;
+
+    /* the timestamps are invalid if the GPU has been disjoint (e.g., changed frequency) */
+    if(gputimer.check_disjoint) {
+        GLint disjoint = 0;
+        _glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+        if(disjoint)
+            return;
+    }
+
+    /* accumulate */
+    _glGetQueryObjectui64v(frame->query[0], GL_QUERY_RESULT, &start);
+    for(int i = 0; i < frame->mark_count; i++) {
+        _glGetQueryObjectui64v(frame->query[i+1], GL_QUERY_RESULT, &end);
+        gputimer.sum[frame->phase[i]] += (double)(end - start) * 1e-6; /* nanoseconds to milliseconds */
+        start = end;
+    }
+
+    if(++gputimer.sum_frames < AVERAGE_FRAMES)
+        return;
+
+    /* compute the averages */
+    gputimer.avg[GPUPHASE_COUNT] = 0.0f;
+    for(int p = 0; p < GPUPHASE_COUNT; p++) {
+        gputimer.avg[p] = (float)(gputimer.sum[p] / gputimer.sum_frames);
+        gputimer.avg[GPUPHASE_COUNT] += gputimer.avg[p];
+        gputimer.sum[p] = 0.0;
+    }
+
+    gputimer.sum_frames = 0;
+}
+
+/* import the OpenGL symbols of the timer queries, returning true on success */
+bool import_opengl_symbols()
+{
+    /* OpenGL ES: EXT_disjoint_timer_query */
+    if(al_get_opengl_variant() == ALLEGRO_OPENGL_ES) {
+        if(!al_have_opengl_extension("GL_EXT_disjoint_timer_query"))
+            return false;
+
+        _glGenQueries = (fun_glgenqueries_t)al_get_opengl_proc_address("glGenQueriesEXT");
+        _glDeleteQueries = (fun_gldeletequeries_t)al_get_opengl_proc_address("glDeleteQueriesEXT");
+        _glQueryCounter = (fun_glquerycounter_t)al_get_opengl_proc_address("glQueryCounterEXT");
+        _glGetQueryObjectiv = (fun_glgetqueryobjectiv_t)al_get_opengl_proc_address("glGetQueryObjectivEXT");
+        _glGetQueryObjectui64v = (fun_glgetqueryobjectui64v_t)al_get_opengl_proc_address("glGetQueryObjectui64vEXT");
+        _glGetIntegerv = (fun_glgetintegerv_t)al_get_opengl_proc_address("glGetIntegerv");
+        gputimer.check_disjoint = true;
+    }
+
+    /* OpenGL 3.3+ or ARB_timer_query */
+    else {
+        if(al_get_opengl_version() < 0x03030000 && !al_have_opengl_extension("GL_ARB_timer_query"))
+            return false;
+
+        _glGenQueries = (fun_glgenqueries_t)al_get_opengl_proc_address("glGenQueries");
+        _glDeleteQueries = (fun_gldeletequeries_t)al_get_opengl_proc_address("glDeleteQueries");
+        _glQueryCounter = (fun_glquerycounter_t)al_get_opengl_proc_address("glQueryCounter");
+        _glGetQueryObjectiv = (fun_glgetqueryobjectiv_t)al_get_opengl_proc_address("glGetQueryObjectiv");
+        _glGetQueryObjectui64v = (fun_glgetqueryobjectui64v_t)al_get_opengl_proc_address("glGetQueryObjectui64v");
+        _glGetIntegerv = (fun_glgetintegerv_t)al_get_opengl_proc_address("glGetIntegerv");
+        gputimer.check_disjoint = false;
+    }
+
+    return
+        _glGenQueries != NULL &&
+        _glDeleteQueries != NULL &&
+        _glQueryCounter != NULL &&
+        _glGetQueryObjectiv != NULL &&
+        _glGetQueryObjectui64v != NULL &&
+        _glGetIntegerv != NULL
+    ;
+}
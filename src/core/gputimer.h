@@ -0,0 +1,63 @@
+/*
+ * Open Surge Engine
+ * gputimer.h - GPU timing of render phases
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GPUTIMER_H
+#define _GPUTIMER_H
+
+#include <stdbool.h>
+
+/*
+ * GPU timing
+ *
+ * A frame is split into render phases by marks. The GPU time elapsed between
+ * gputimer_mark(phase) and the next mark is attributed to the phase. Timing
+ * uses OpenGL timestamp queries (or EXT_disjoint_timer_query on OpenGL ES),
+ * and it's unavailable if the driver doesn't support them. The results are
+ * read a few frames later, so that the CPU never waits for the GPU.
+ *
+ * Marks are not free: use them only while profiling.
+ */
+
+typedef enum gpuphase_t {
+    GPUPHASE_BACKGROUND,    /* backgrounds & foregrounds */
+    GPUPHASE_BRICKS,
+    GPUPHASE_ENTITIES,
+    GPUPHASE_WATER,
+    GPUPHASE_OTHER,         /* everything else rendered to the backbuffer (HUD, editor...) */
+    GPUPHASE_POSTPROCESSING,
+    GPUPHASE_PRESENT,       /* copy to the window & overlays */
+
+    GPUPHASE_COUNT
+} gpuphase_t;
+
+void gputimer_init(); /* call after creating the display */
+void gputimer_release();
+bool gputimer_is_available();
+
+void gputimer_set_enabled(bool enabled);
+bool gputimer_is_enabled();
+
+void gputimer_mark(gpuphase_t phase); /* begin a phase, ending the previous one */
+void gputimer_end_frame(); /* call after presenting a frame */
+
+float gputimer_milliseconds(gpuphase_t phase); /* average GPU time per frame; GPUPHASE_COUNT is the total */
+const char* gputimer_phase_name(gpuphase_t phase);
+
+#endif
@@ -0,0 +1,309 @@
+/*
+ * Open Surge Engine
+ * hotreload.c - reload modified assets while the game runs
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <allegro5/allegro.h>
+#include <stdint.h>
+#include "hotreload.h"
+#include "asset.h"
+#include "logfile.h"
+#include "image.h"
+#include "sprite.h"
+#include "lang.h"
+#include "scene.h"
+#include "storyboard.h"
+#include "resourcemanager.h"
+#include "../scenes/level.h"
+#include "../scripting/scripting.h"
+#include "../util/util.h"
+#include "../util/stringutil.h"
+#include "../util/darray.h"
+#include "../util/atomdict.h"
+
+/*
+
+The hot reload service polls the modification times of the files of the
+assets, a few files per frame, and reloads only what has changed:
+
+- images are reloaded in place, so that sprites, fonts and everything
+  else that refers to them see the new pixels immediately;
+- the sprites of a .spr file are redefined. Sprite handles refer to the
+  new definitions, and actors pick them up as they change animations;
+- language files are recompiled and the current language is restacked;
+- SurgeScript classes can't be replaced in a running VM, so a modified
+  script reloads the VM and restarts the level at the next opportunity.
+
+Font definitions (.fnt) are not reloaded: their images are, but other
+changes require a restart.
+
+*/
+
+typedef enum watchkind_t watchkind_t;
+enum watchkind_t
+{
+    WATCH_IMAGE,
+    WATCH_SPRITE,
+    WATCH_LANGUAGE,
+    WATCH_SCRIPT,
+    WATCH_FONT
+};
+
+typedef struct watchedfile_t watchedfile_t;
+struct watchedfile_t
+{
+    char* vpath; /* virtual path */
+    watchkind_t kind;
+    int64_t mtime; /* last modification time */
+    int64_t size; /* size in bytes; mtime has a coarse resolution */
+    imagehandle_t image; /* WATCH_IMAGE only; stale if the image has been released */
+};
+
+#define FILES_PER_FRAME 64 /* how many files we check per frame */
+
+static bool enabled = false;
+STATIC_DARRAY(watchedfile_t, watched);
+static atomdict_t* watched_index = NULL; /* atom of the virtual path -> 1 + index in watched */
+static int cursor = 0; /* next file to be checked */
+static bool scripts_modified = false; /* the scripts will be reloaded at the next opportunity */
+
+static void watch(const char* vpath, watchkind_t kind);
+static int watch_sprite(const char* vpath, void* data);
+static int watch_language(const char* vpath, void* data);
+static int watch_script(const char* vpath, void* data);
+static int watch_font(const char* vpath, void* data);
+static void watch_image(image_t* image, void* data);
+static bool stat_file(const char* vpath, int64_t* mtime, int64_t* size);
+static void reload(watchedfile_t* file);
+static void reload_scripts();
+
+
+
+/*
+ * hotreload_init()
+ * Initializes the hot reload service
+ */
+void hotreload_init(bool enable)
+{
+    enabled = enable;
+    cursor = 0;
+    scripts_modified = false;
+
+    if(!enabled)
+        return;
+
+    logfile_message("Enabling hot reload...");
+
+    darray_init(watched);
+    watched_index = atomdict_create(NULL, NULL);
+
+    asset_foreach_file("sprites", ".spr", watch_sprite, NULL, true);
+    asset_foreach_file("languages", ".lng", watch_language, NULL, true);
+    asset_foreach_file("scripts", ".ss", watch_script, NULL, true);
+    asset_foreach_file("fonts", ".fnt", watch_font, NULL, true);
+    resourcemanager_foreach_image(NULL, watch_image);
+
+    logfile_message("Hot reload: watching %d files", darray_length(watched));
+}
+
+/*
+ * hotreload_release()
+ * Releases the hot reload service
+ */
+void hotreload_release()
+{
+    if(!enabled)
+        return;
+
+    for(int i = 0; i < darray_length(watched); i++)
+        free(watched[i].vpath);
+
+    darray_release(watched);
+    watched_index = atomdict_destroy(watched_index);
+    enabled = false;
+}
+
+/*
+ * hotreload_update()
+ * Checks a few files for modifications and reloads them.
+ * Call this between frames
+ */
+void hotreload_update()
+{
+    if(!enabled)
+        return;
+
+    /* check the next files */
+    for(int n = min(FILES_PER_FRAME, darray_length(watched)); n > 0; n--) {
+        if(cursor >= darray_length(watched)) {
+            /* a pass is complete; watch the images that have been loaded since */
+            resourcemanager_foreach_image(NULL, watch_image);
+            cursor = 0;
+        }
+
+        watchedfile_t* file = &watched[cursor++];
+        int64_t mtime, size;
+
+        if(!stat_file(file->vpath, &mtime, &size))
+            continue; /* the file is gone */
+
+        if(mtime != file->mtime || size != file->size) {
+            file->mtime = mtime;
+            file->size = size;
+            reload(file);
+        }
+    }
+
+    /* reload the scripts when it's safe to do so */
+    if(scripts_modified && scenestack_top() == storyboard_get_scene(SCENE_LEVEL)) {
+        scripts_modified = false;
+        reload_scripts();
+    }
+}
+
+/*
+ * hotreload_is_enabled()
+ * Is the hot reload service enabled?
+ */
+bool hotreload_is_enabled()
+{
+    return enabled;
+}
+
+
+
+/* private */
+
+/* watches a file for modifications */
+void watch(const char* vpath, watchkind_t kind)
+{
+    atom_t key = atom_intern(vpath);
+    if(atomdict_get(watched_index, key) != NULL)
+        return;
+
+    watchedfile_t file = { .vpath = str_dup(vpath), .kind = kind, .mtime = 0, .size = 0, .image = { 0 } };
+    if(kind == WATCH_IMAGE)
+        file.image = resourcemanager_find_image_handle(vpath);
+    stat_file(vpath, &file.mtime, &file.size);
+
+    darray_push(watched, file);
+    atomdict_put(watched_index, key, (void*)(intptr_t)darray_length(watched));
+}
+
+/* callbacks of asset_foreach_file() and of resourcemanager_foreach_image() */
+int watch_sprite(const char* vpath, void* data)
+{
+    watch(vpath, WATCH_SPRITE);
+    return 0;
+}
+
+int watch_language(const char* vpath, void* data)
+{
+    watch(vpath, WATCH_LANGUAGE);
+    return 0;
+}
+
+int watch_script(const char* vpath, void* data)
+{
+    watch(vpath, WATCH_SCRIPT);
+    return 0;
+}
+
+int watch_font(const char* vpath, void* data)
+{
+    watch(vpath, WATCH_FONT);
+    return 0;
+}
+
+void watch_image(image_t* image, void* data)
+{
+    const char* vpath = image_filepath(image);
+
+    if(vpath != NULL)
+        watch(vpath, WATCH_IMAGE);
+}
+
+/* gets the modification time and the size of a file. Returns false if there is no such file */
+bool stat_file(const char* vpath, int64_t* mtime, int64_t* size)
+{
+    ALLEGRO_FS_ENTRY* entry = al_create_fs_entry(asset_path(vpath));
+    bool exists = false;
+
+    if(entry == NULL)
+        return false;
+
+    if(al_fs_entry_exists(entry) && (al_get_fs_entry_mode(entry) & ALLEGRO_FILEMODE_ISFILE)) {
+        *mtime = (int64_t)al_get_fs_entry_mtime(entry);
+        *size = (int64_t)al_get_fs_entry_size(entry);
+        exists = true;
+    }
+
+    al_destroy_fs_entry(entry);
+    return exists;
+}
+
+/* reloads a modified file */
+void reload(watchedfile_t* file)
+{
+    logfile_message("Hot reload: \"%s\" has been modified", file->vpath);
+
+    switch(file->kind) {
+        case WATCH_IMAGE: {
+            image_t* image = resourcemanager_image_at(file->image);
+            if(image == NULL) {
+                /* the image has been released since we watched it. It may have been loaded again */
+                file->image = resourcemanager_find_image_handle(file->vpath);
+                image = resourcemanager_image_at(file->image);
+            }
+
+            if(image != NULL)
+                image_reload(image);
+            break;
+        }
+
+        case WATCH_SPRITE:
+            sprite_reload_file(file->vpath);
+            break;
+
+        case WATCH_LANGUAGE:
+            if(!lang_reloadfile(file->vpath))
+                logfile_message("Hot reload: \"%s\" isn't in use", file->vpath);
+            break;
+
+        case WATCH_SCRIPT:
+            scripts_modified = true;
+            break;
+
+        case WATCH_FONT:
+            logfile_message("Hot reload: please restart the engine to reload font definitions");
+            break;
+    }
+}
+
+/* reloads the SurgeScript VM and restarts the current level */
+void reload_scripts()
+{
+    char path[1024];
+
+    logfile_message("Hot reload: reloading the scripts and restarting the level...");
+    str_cpy(path, level_file(), sizeof(path));
+
+    scenestack_pop();
+    scripting_reload();
+    scenestack_push(storyboard_get_scene(SCENE_LEVEL), path);
+}
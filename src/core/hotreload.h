@@ -0,0 +1,31 @@
+/*
+ * Open Surge Engine
+ * hotreload.h - reload modified assets while the game runs
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HOTRELOAD_H
+#define _HOTRELOAD_H
+
+#include <stdbool.h>
+
+void hotreload_init(bool enable);
+void hotreload_release();
+void hotreload_update();
+bool hotreload_is_enabled();
+
+#endif
@@ -23,8 +23,10 @@
 #include <allegro5/allegro_image.h>
 #include <allegro5/allegro_primitives.h>
 #include <allegro5/allegro_opengl.h>
+#include <allegro5/allegro_physfs.h>
 
 #include <string.h>
+#include <math.h>
 #include <stdint.h>
 #include "image.h"
 #include "video.h"
@@ -33,6 +35,7 @@
 #include "resourcemanager.h"
 #include "../util/util.h"
 #include "../util/stringutil.h"
+#include "../util/darray.h"
 
 #if defined(ALLEGRO_VERSION_INT) && defined(AL_ID) && ALLEGRO_VERSION_INT >= AL_ID(5,2,8,0)
 #define WANT_WRAP 1
@@ -46,21 +49,120 @@
 /* check if an expression is a power of two */
 #define IS_POWER_OF_TWO(n) (((n) & ((n) - 1)) == 0)
 
+/* texture atlas */
+typedef struct atlaspage_t atlaspage_t;
+typedef struct atlasshelf_t atlasshelf_t;
+
+struct atlasshelf_t {
+    int y; /* top of the shelf */
+    int height; /* height of the shelf */
+    int x; /* left of the free space */
+};
+
+struct atlaspage_t {
+    ALLEGRO_BITMAP* bitmap; /* a large texture */
+    int refs; /* number of images stored in this page */
+    int bottom; /* the free space starts at this y */
+    DARRAY(atlasshelf_t, shelf); /* shelves of images */
+    atlaspage_t* next;
+};
+
+static atlaspage_t* atlas_pack(ALLEGRO_BITMAP* bitmap, int* x, int* y);
+static atlaspage_t* atlas_create_page();
+static atlaspage_t* atlas_destroy_page(atlaspage_t* page);
+static bool atlas_find_space(atlaspage_t* page, int width, int height, int* x, int* y);
+static void atlas_detach(image_t* img);
+
+static atlaspage_t* atlas = NULL; /* linked list of pages */
+static int atlas_depth = 0; /* will pack the loaded images if greater than zero */
+static int atlas_packed_images = 0; /* stats */
+static const int ATLAS_PAGE_SIZE = 2048; /* width and height of a page */
+static const int ATLAS_MAX_IMAGE_SIZE = 1024; /* larger images won't be packed */
+static const int ATLAS_PADDING = 1; /* spacing between packed images, in pixels */
+
+/* prefetching: images are decoded into memory bitmaps in background threads
+   and uploaded to the GPU when they are loaded in the main thread */
+typedef enum prefetchstate_t prefetchstate_t;
+typedef struct prefetchentry_t prefetchentry_t;
+
+enum prefetchstate_t {
+    PREFETCH_QUEUED,
+    PREFETCH_DECODING,
+    PREFETCH_DECODED,
+    PREFETCH_TAKEN
+};
+
+struct prefetchentry_t {
+    char* path; /* relative path */
+    char* fullpath;
+    ALLEGRO_BITMAP* bitmap; /* a memory bitmap; NULL if not decoded or on error */
+    prefetchstate_t state;
+};
+
+#define MAX_PREFETCH_WORKERS 4
+static struct {
+    ALLEGRO_THREAD* thread[MAX_PREFETCH_WORKERS];
+    int thread_count;
+    ALLEGRO_MUTEX* mutex;
+    ALLEGRO_COND* job_available; /* broadcast when there is a new entry in the queue */
+    ALLEGRO_COND* job_done; /* broadcast when an entry has been decoded */
+    DARRAY(prefetchentry_t, queue); /* access with the mutex locked */
+    int next_job; /* index of the next entry to be decoded */
+    int hint; /* where we start looking for an entry of the queue */
+    int depth; /* prefetching is enabled if greater than zero */
+    size_t budget; /* maximum memory of the decoded bitmaps that haven't been taken; 0 means unlimited */
+    size_t pending_bytes; /* memory of the decoded bitmaps that haven't been taken */
+    bool quit;
+} prefetch = { .thread_count = 0, .depth = 0, .budget = 0 };
+
+static void* prefetch_worker(ALLEGRO_THREAD* thread, void* arg);
+static ALLEGRO_BITMAP* take_prefetched_bitmap(const char* path);
+static int find_prefetch_entry(const char* path);
+static inline size_t bitmap_size(ALLEGRO_BITMAP* bitmap);
+
+/* compressed textures: an offline tool may store a DXT-compressed copy of
+   "images/foo.png" at "images/foo.png.dds". If it's up-to-date and the video
+   card supports it, it's uploaded as it is, skipping the PNG decoder */
+static ALLEGRO_BITMAP* load_compressed_texture(const char* path);
+static bool find_compressed_texture(const char* path, char* dds_path, size_t dds_path_size);
+static bool is_compressed_format(int format);
+static const char COMPRESSED_TEXTURE_EXTENSION[] = ".dds";
+
+/* mipmaps: the textures of the images drawn at a reduced scale (e.g., the
+   thumbnails of the editor) get mipmaps on demand. The GPU picks the level
+   from the scale, so that downscaled drawing doesn't sample texels sparsely.
+   At 1:1 the base level is sampled as before */
+static void want_mipmaps(const image_t* img, v2d_t scale);
+static const float MIPMAP_SCALE_THRESHOLD = 0.75f; /* generate mipmaps if drawn at a smaller scale */
+
 /* image type */
 struct image_t {
     ALLEGRO_BITMAP* data; /* this must be the first field */
     int w, h;
     char* path; /* relative path */
+    atlaspage_t* page; /* texture atlas (may be NULL) */
+    ALLEGRO_LOCKED_REGION* read_lock; /* the image locked for reading in RGBA format, or NULL */
 };
 
 /* misc */
 static image_t* target = NULL; /* drawing target */
 static const int MAX_IMAGE_SIZE = 4096; /* maximum image size for broad compatibility with video cards */
+#define USE_BATCHED_LIT_DRAWING 1 /* draw lit images with vertex colors instead of changing the blender */
+
+/* dirty tracking: feed the signature of the frame with the drawing operations on the backbuffer */
+#define TRACK(src, ...) do { \
+    if(target == NULL && video_is_tracking_drawing()) { \
+        const float param[] = { __VA_ARGS__ }; \
+        track_drawing((src), __func__, param, sizeof(param) / sizeof(param[0])); \
+    } \
+} while(0)
+static void track_drawing(const image_t* src, const char* operation, const float* param, int param_count);
 
 /*
  * image_load()
  * Loads a image from a file.
  * Supported types: PNG, JPG, BMP, PCX, TGA
+ * A compressed texture (DDS) at path + ".dds" is preferred, if up-to-date
  */
 image_t* image_load(const char* path)
 {
@@ -74,7 +176,11 @@ image_t* image_load(const char* path)
         img = mallocx(sizeof *img);
 
         /* loading the image */
-        if(NULL == (img->data = al_load_bitmap(fullpath))) {
+        if(
+            NULL == (img->data = load_compressed_texture(path)) &&
+            NULL == (img->data = take_prefetched_bitmap(path)) &&
+            NULL == (img->data = al_load_bitmap(fullpath))
+        ) {
             fatal_error("Failed to load image \"%s\"", fullpath);
             free(img);
             return NULL;
@@ -91,6 +197,25 @@ image_t* image_load(const char* path)
             return NULL;
         }
 
+        /* pack the image into a texture atlas */
+        img->read_lock = NULL;
+        img->page = NULL;
+        if(atlas_depth > 0 && !is_compressed_format(al_get_bitmap_format(img->data))) {
+            int x, y;
+            atlaspage_t* page = atlas_pack(img->data, &x, &y);
+
+            if(page != NULL) {
+                ALLEGRO_BITMAP* sub = al_create_sub_bitmap(page->bitmap, x, y, img->w, img->h);
+                if(sub != NULL) {
+                    al_destroy_bitmap(img->data);
+                    img->data = sub;
+                    img->page = page;
+                    page->refs++;
+                    atlas_packed_images++;
+                }
+            }
+        }
+
         /* adding the image to the resource manager */
         img->path = str_dup(path);
         resourcemanager_add_image(img->path, img);
@@ -104,6 +229,46 @@ image_t* image_load(const char* path)
 
 
 
+/*
+ * image_reload()
+ * Reloads the pixels of an image from its file, which has been modified.
+ * The pixels are replaced in place, so that the image, its sub-images and
+ * the texture atlas remain valid. Returns false if the image can't be
+ * reloaded (e.g., its size has changed)
+ */
+bool image_reload(image_t* img)
+{
+    if(img->path == NULL || img->read_lock != NULL || is_compressed_format(al_get_bitmap_format(img->data)))
+        return false;
+
+    const char* fullpath = asset_path(img->path);
+    ALLEGRO_BITMAP* bitmap = al_load_bitmap(fullpath);
+    if(bitmap == NULL) {
+        logfile_message("Can't reload image \"%s\"", fullpath);
+        return false;
+    }
+
+    if(al_get_bitmap_width(bitmap) != img->w || al_get_bitmap_height(bitmap) != img->h) {
+        logfile_message("Can't reload image \"%s\": its size has changed. Please restart the engine", fullpath);
+        al_destroy_bitmap(bitmap);
+        return false;
+    }
+
+    /* copy the pixels, including the alpha channel */
+    ALLEGRO_STATE state;
+    al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP | ALLEGRO_STATE_BLENDER);
+    al_set_target_bitmap(img->data);
+    al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ZERO);
+    al_draw_bitmap(bitmap, 0, 0, 0);
+    al_restore_state(&state);
+
+    al_destroy_bitmap(bitmap);
+    logfile_message("Reloaded image \"%s\"", fullpath);
+    return true;
+}
+
+
+
 /*
  * image_save()
  * Saves a image to a file
@@ -153,6 +318,8 @@ image_t* image_create(int width, int height)
     img->w = width;
     img->h = height;
     img->path = NULL;
+    img->page = NULL;
+    img->read_lock = NULL;
     
     return img;
 }
@@ -168,6 +335,18 @@ void image_destroy(image_t* img)
     if(img->data != NULL)
         al_destroy_bitmap(img->data);
 
+    if(img->page != NULL) {
+        /* release the page of the texture atlas if it's no longer used */
+        if(--img->page->refs == 0) {
+            for(atlaspage_t** it = &atlas; *it != NULL; it = &(*it)->next) {
+                if(*it == img->page) {
+                    *it = atlas_destroy_page(*it);
+                    break;
+                }
+            }
+        }
+    }
+
     if(img->path != NULL)
         free(img->path);
 
@@ -205,6 +384,8 @@ image_t* image_create_shared(const image_t* parent, int x, int y, int width, int
     img = mallocx(sizeof *img);
     img->w = width;
     img->h = height;
+    img->page = NULL; /* the parent holds the page, if any */
+    img->read_lock = NULL;
     if(NULL == (img->data = al_create_sub_bitmap(parent->data, x, y, width, height)))
         fatal_error("Failed to create shared image of \"%s\": %d, %d, %d, %d", parent->path ? parent->path : "", x, y, width, height);
 
@@ -250,8 +431,12 @@ image_t* image_create_ex(int width, int height, int flags)
 
     /* set the flags for new bitmaps */
     int new_bitmap_flags = ALLEGRO_VIDEO_BITMAP;
+    if(al_get_current_display() == NULL) /* headless mode */
+        new_bitmap_flags = ALLEGRO_MEMORY_BITMAP;
     if(flags & IC_BACKBUFFER)
         new_bitmap_flags |= ALLEGRO_NO_PRESERVE_TEXTURE;
+    if(flags & IC_LINEAR)
+        new_bitmap_flags |= ALLEGRO_MIN_LINEAR | ALLEGRO_MAG_LINEAR;
 
     /* change state */
     al_set_new_bitmap_flags(new_bitmap_flags);
@@ -314,6 +499,8 @@ image_t* image_clone(const image_t* src)
     img->w = src->w;
     img->h = src->h;
     img->path = NULL;
+    img->page = NULL;
+    img->read_lock = NULL;
     if(NULL == (img->data = al_clone_bitmap(src->data)))
         fatal_error("Failed to clone image \"%s\" sized %dx%d", src->path ? src->path : "", src->w, src->h);
 
@@ -327,6 +514,10 @@ image_t* image_clone(const image_t* src)
 void image_enable_linear_filtering(image_t* img)
 {
     ALLEGRO_STATE state;
+
+    /* don't change the filtering of the other images of the atlas */
+    atlas_detach(img);
+
     al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
 
     ALLEGRO_BITMAP* root = img->data;
@@ -366,6 +557,10 @@ void image_enable_linear_filtering(image_t* img)
 void image_disable_linear_filtering(image_t* img)
 {
     ALLEGRO_STATE state;
+
+    /* don't change the filtering of the other images of the atlas */
+    atlas_detach(img);
+
     al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
 
     int flags = al_get_bitmap_flags(img->data);
@@ -410,8 +605,13 @@ void image_lock(image_t* img, const char* mode)
             break;
     }
 
-    /* lock the bitmap */
-    if(!al_lock_bitmap(img->data, al_get_bitmap_format(img->data), flags))
+    /* lock the bitmap. Read-only locks use a fixed RGBA format, so that the
+       pixels can be scanned directly (see image_locked_pixels()) */
+    if(flags == ALLEGRO_LOCK_READONLY) {
+        if(NULL == (img->read_lock = al_lock_bitmap(img->data, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, flags)))
+            logfile_message("WARNING: can't lock image \"%s\" (mode: %s)", img->path, mode);
+    }
+    else if(!al_lock_bitmap(img->data, al_get_bitmap_format(img->data), flags))
         logfile_message("WARNING: can't lock image \"%s\" (mode: %s)", img->path, mode);
 }
 
@@ -422,6 +622,44 @@ void image_lock(image_t* img, const char* mode)
 void image_unlock(image_t* img)
 {
     al_unlock_bitmap(img->data);
+    img->read_lock = NULL;
+}
+
+/*
+ * image_locked_pixels()
+ * The pixels of an image locked with mode "r", in RGBA format (8 bits per
+ * channel), or NULL if the image isn't locked that way. *pitch is the
+ * distance in bytes between two consecutive rows; it may be negative
+ */
+const uint8_t* image_locked_pixels(const image_t* img, int* pitch)
+{
+    if(img->read_lock == NULL)
+        return NULL;
+
+    *pitch = img->read_lock->pitch;
+    return (const uint8_t*)img->read_lock->data;
+}
+
+/*
+ * image_read_pixels()
+ * Copies the pixels of the image to a buffer of width * height * 4 bytes,
+ * row by row, in RGBA format (8 bits per channel). Returns false on error
+ */
+bool image_read_pixels(const image_t* img, uint8_t* rgba_pixels)
+{
+    ALLEGRO_LOCKED_REGION* region = al_lock_bitmap(img->data, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY);
+    int row_size = img->w * 4;
+
+    if(region == NULL) {
+        logfile_message("WARNING: can't read the pixels of image \"%s\"", img->path);
+        return false;
+    }
+
+    for(int y = 0; y < img->h; y++)
+        memcpy(rgba_pixels + y * row_size, (const uint8_t*)region->data + y * region->pitch, row_size);
+
+    al_unlock_bitmap(img->data);
+    return true;
 }
 
 /*
@@ -470,6 +708,7 @@ color_t image_getpixel(const image_t* img, int x, int y)
  */
 void image_putpixel(int x, int y, color_t color)
 {
+    TRACK(NULL, x, y, color._color.r, color._color.g, color._color.b, color._color.a);
     al_put_pixel(x, y, color._color);
 }
 
@@ -480,6 +719,7 @@ void image_putpixel(int x, int y, color_t color)
  */
 void image_line(int x1, int y1, int x2, int y2, color_t color)
 {
+    TRACK(NULL, x1, y1, x2, y2, color._color.r, color._color.g, color._color.b, color._color.a);
     al_draw_line(x1 + 0.5f, y1 + 0.5f, x2 + 0.5f, y2 + 0.5f, color._color, 0.0f);
 }
 
@@ -490,6 +730,7 @@ void image_line(int x1, int y1, int x2, int y2, color_t color)
  */
 void image_ellipse(int cx, int cy, int radius_x, int radius_y, color_t color)
 {
+    TRACK(NULL, cx, cy, radius_x, radius_y, color._color.r, color._color.g, color._color.b, color._color.a);
     al_draw_ellipse(cx + 0.5f, cy + 0.5f, radius_x, radius_y, color._color, 0.0f);
 }
 
@@ -500,6 +741,7 @@ void image_ellipse(int cx, int cy, int radius_x, int radius_y, color_t color)
  */
 void image_ellipsefill(int cx, int cy, int radius_x, int radius_y, color_t color)
 {
+    TRACK(NULL, cx, cy, radius_x, radius_y, color._color.r, color._color.g, color._color.b, color._color.a);
     al_draw_filled_ellipse(cx + 0.5f, cy + 0.5f, radius_x, radius_y, color._color);
 }
 
@@ -510,6 +752,7 @@ void image_ellipsefill(int cx, int cy, int radius_x, int radius_y, color_t color
  */
 void image_rect(int x1, int y1, int x2, int y2, color_t color)
 {
+    TRACK(NULL, x1, y1, x2, y2, color._color.r, color._color.g, color._color.b, color._color.a);
     al_draw_rectangle(x1 + 0.5f, y1 + 0.5f, x2 + 0.5f, y2 + 0.5f, color._color, 0.0f);
 }
 
@@ -520,6 +763,7 @@ void image_rect(int x1, int y1, int x2, int y2, color_t color)
  */
 void image_rectfill(int x1, int y1, int x2, int y2, color_t color)
 {
+    TRACK(NULL, x1, y1, x2, y2, color._color.r, color._color.g, color._color.b, color._color.a);
     al_draw_filled_rectangle(x1, y1, x2 + 1.0f, y2 + 1.0f, color._color);
 }
 
@@ -530,6 +774,7 @@ void image_rectfill(int x1, int y1, int x2, int y2, color_t color)
  */
 void image_clear(color_t color)
 {
+    TRACK(NULL, color._color.r, color._color.g, color._color.b, color._color.a);
     al_clear_to_color(color._color);
 }
 
@@ -540,6 +785,7 @@ void image_clear(color_t color)
  */
 void image_blit(const image_t* src, int src_x, int src_y, int dest_x, int dest_y, int width, int height)
 {
+    TRACK(src, src_x, src_y, dest_x, dest_y, width, height);
     al_draw_bitmap_region(src->data, src_x, src_y, width, height, dest_x, dest_y, 0);
 }
 
@@ -553,6 +799,7 @@ void image_blit(const image_t* src, int src_x, int src_y, int dest_x, int dest_y
  */
 void image_draw(const image_t* src, int x, int y, int flags)
 {
+    TRACK(src, x, y, flags);
     al_draw_bitmap(src->data, x, y, FLIPPY(flags));
 }
 
@@ -568,7 +815,9 @@ void image_draw(const image_t* src, int x, int y, int flags)
  *        (0.5, 0.5) stands for a smaller image
  */
 void image_draw_scaled(const image_t* src, int x, int y, v2d_t scale, int flags)
-{ 
+{
+    TRACK(src, x, y, scale.x, scale.y, flags);
+    want_mipmaps(src, scale);
     al_draw_scaled_bitmap(
         src->data,
         0.0f, 0.0f, src->w, src->h,
@@ -583,6 +832,9 @@ void image_draw_scaled(const image_t* src, int x, int y, v2d_t scale, int flags)
  */
 void image_draw_scaled_trans(const image_t* src, int x, int y, v2d_t scale, float alpha, int flags)
 {
+    TRACK(src, x, y, scale.x, scale.y, alpha, flags);
+    want_mipmaps(src, scale);
+
     float a = clip01(alpha);
     ALLEGRO_COLOR tint = al_map_rgba_f(a, a, a, a);
 
@@ -602,6 +854,7 @@ void image_draw_scaled_trans(const image_t* src, int x, int y, v2d_t scale, floa
  */
 void image_draw_rotated(const image_t* src, int x, int y, int cx, int cy, float radians, int flags)
 {
+    TRACK(src, x, y, cx, cy, radians, flags);
     al_draw_rotated_bitmap(src->data, cx, cy, x, y, -radians, FLIPPY(flags));
 }
 
@@ -611,6 +864,8 @@ void image_draw_rotated(const image_t* src, int x, int y, int cx, int cy, float
  */
 void image_draw_rotated_trans(const image_t* src, int x, int y, int cx, int cy, float radians, float alpha, int flags)
 {
+    TRACK(src, x, y, cx, cy, radians, alpha, flags);
+
     float a = clip01(alpha);
     ALLEGRO_COLOR tint = al_map_rgba_f(a, a, a, a);
 
@@ -623,6 +878,8 @@ void image_draw_rotated_trans(const image_t* src, int x, int y, int cx, int cy,
  */
 void image_draw_scaled_rotated(const image_t* src, int x, int y, int cx, int cy, v2d_t scale, float radians, int flags)
 {
+    TRACK(src, x, y, cx, cy, scale.x, scale.y, radians, flags);
+    want_mipmaps(src, scale);
     al_draw_scaled_rotated_bitmap(src->data, cx, cy, x, y, scale.x, scale.y, -radians, FLIPPY(flags));
 }
 
@@ -632,6 +889,9 @@ void image_draw_scaled_rotated(const image_t* src, int x, int y, int cx, int cy,
  */
 void image_draw_scaled_rotated_trans(const image_t* src, int x, int y, int cx, int cy, v2d_t scale, float radians, float alpha, int flags)
 {
+    TRACK(src, x, y, cx, cy, scale.x, scale.y, radians, alpha, flags);
+    want_mipmaps(src, scale);
+
     float a = clip01(alpha);
     ALLEGRO_COLOR tint = al_map_rgba_f(a, a, a, a);
 
@@ -645,6 +905,8 @@ void image_draw_scaled_rotated_trans(const image_t* src, int x, int y, int cx, i
  */
 void image_draw_trans(const image_t* src, int x, int y, float alpha, int flags)
 {
+    TRACK(src, x, y, alpha, flags);
+
     float a = clip01(alpha);
     ALLEGRO_COLOR tint = al_map_rgba_f(a, a, a, a);
 
@@ -657,6 +919,38 @@ void image_draw_trans(const image_t* src, int x, int y, float alpha, int flags)
  */
 void image_draw_lit(const image_t* src, int x, int y, color_t color, int flags)
 {
+    TRACK(src, x, y, color._color.r, color._color.g, color._color.b, color._color.a, flags);
+
+#if USE_BATCHED_LIT_DRAWING
+
+    /*
+
+    The two-pass method below (see #else) computes, for each of r, g, b:
+
+        y = dx * (1 - sa) + 2 * (sx * sa) * cc
+
+    This is the standard premultiplied alpha blending (ONE, INVERSE_ALPHA)
+    of a source fragment (sx * sa) * (2 * cc). Our shaders compute the
+    fragment as the vertex color times the texel and don't clamp the vertex
+    color, so we get the same result with a tint of 2 * cc and alpha 1. Only
+    the alpha channel of the target differs, and it's not displayed.
+
+    There are no state changes, so lit images are batched with the other
+    images when deferred drawing is enabled.
+
+    */
+
+    ALLEGRO_COLOR tint = al_map_rgba_f(
+        2.0f * color._color.r,
+        2.0f * color._color.g,
+        2.0f * color._color.b,
+        1.0f
+    );
+
+    al_draw_tinted_bitmap(src->data, tint, x, y, FLIPPY(flags));
+
+#else
+
     /*
 
     "While deferred bitmap drawing is enabled, the only functions that can be
@@ -755,6 +1049,8 @@ void image_draw_lit(const image_t* src, int x, int y, color_t color, int flags)
     /* re-enable deferred drawing if it was activated */
     if(is_held)
         al_hold_bitmap_drawing(true);
+
+#endif
 }
 
 /*
@@ -764,6 +1060,7 @@ void image_draw_lit(const image_t* src, int x, int y, color_t color, int flags)
  */
 void image_draw_tinted(const image_t* src, int x, int y, color_t color, int flags)
 {
+    TRACK(src, x, y, color._color.r, color._color.g, color._color.b, color._color.a, flags);
     al_draw_tinted_bitmap(src->data, color._color, x, y, FLIPPY(flags));
 }
 
@@ -836,4 +1133,590 @@ texturehandle_t image_texture(const image_t* img)
     /* we require ALLEGRO_OPENGL to be a display flag */
     texturehandle_t tex = al_get_opengl_texture(img->data);
     return tex;
-}
\ No newline at end of file
+}
+
+
+
+/*
+ * image_texture_size()
+ * Estimated size of the texture of the image, in bytes
+ */
+size_t image_texture_size(const image_t* img)
+{
+    int format = al_get_bitmap_format(img->data);
+
+    if(is_compressed_format(format)) {
+        int block_width = al_get_pixel_block_width(format);
+        int block_height = al_get_pixel_block_height(format);
+        size_t blocks_x = (img->w + block_width - 1) / block_width;
+        size_t blocks_y = (img->h + block_height - 1) / block_height;
+
+        return blocks_x * blocks_y * al_get_pixel_block_size(format);
+    }
+
+    return (size_t)img->w * (size_t)img->h * 4;
+}
+
+
+
+/*
+ * image_begin_atlas()
+ * Images loaded with image_load() after this call will be packed into large
+ * textures that are shared among them, so that they can be batched together
+ * when rendering. Call image_end_atlas() when you're done loading.
+ */
+void image_begin_atlas()
+{
+    if(atlas_depth++ == 0) {
+        logfile_message("Building a texture atlas...");
+        atlas_packed_images = 0;
+    }
+}
+
+/*
+ * image_end_atlas()
+ * Stops packing the loaded images into a texture atlas
+ */
+void image_end_atlas()
+{
+    if(atlas_depth > 0 && --atlas_depth == 0) {
+        int page_count = 0;
+        for(const atlaspage_t* page = atlas; page != NULL; page = page->next)
+            page_count++;
+
+        logfile_message("Packed %d images into %d pages of the texture atlas", atlas_packed_images, page_count);
+    }
+}
+
+
+
+/*
+ * image_begin_prefetch()
+ * Images passed to image_prefetch() after this call will be decoded in
+ * background threads. Call image_end_prefetch() when you're done loading
+ */
+void image_begin_prefetch()
+{
+    if(prefetch.depth++ > 0)
+        return;
+
+    int cpu_count = al_get_cpu_count();
+    int thread_count = cpu_count > 1 ? cpu_count - 1 : 0;
+
+    if(thread_count > MAX_PREFETCH_WORKERS)
+        thread_count = MAX_PREFETCH_WORKERS;
+
+    prefetch.mutex = al_create_mutex();
+    prefetch.job_available = al_create_cond();
+    prefetch.job_done = al_create_cond();
+    darray_init(prefetch.queue);
+    prefetch.next_job = 0;
+    prefetch.hint = 0;
+    prefetch.pending_bytes = 0;
+    prefetch.quit = false;
+
+    prefetch.thread_count = 0;
+    for(int i = 0; i < thread_count; i++) {
+        ALLEGRO_THREAD* thread = al_create_thread(prefetch_worker, NULL);
+        if(thread == NULL) {
+            logfile_message("Can't create image prefetch thread %d", i);
+            break;
+        }
+
+        prefetch.thread[prefetch.thread_count++] = thread;
+        al_start_thread(thread);
+    }
+}
+
+/*
+ * image_end_prefetch()
+ * Stops prefetching images. Prefetched images that haven't been loaded
+ * are discarded
+ */
+void image_end_prefetch()
+{
+    if(prefetch.depth == 0 || --prefetch.depth > 0)
+        return;
+
+    /* stop the workers */
+    al_lock_mutex(prefetch.mutex);
+    prefetch.quit = true;
+    al_broadcast_cond(prefetch.job_available);
+    al_unlock_mutex(prefetch.mutex);
+
+    for(int i = 0; i < prefetch.thread_count; i++)
+        al_destroy_thread(prefetch.thread[i]); /* joins the thread */
+    prefetch.thread_count = 0;
+
+    /* discard the remaining entries */
+    int unused = 0;
+    for(int i = 0; i < darray_length(prefetch.queue); i++) {
+        prefetchentry_t* entry = &prefetch.queue[i];
+
+        if(entry->bitmap != NULL) {
+            al_destroy_bitmap(entry->bitmap);
+            unused++;
+        }
+
+        free(entry->fullpath);
+        free(entry->path);
+    }
+
+    if(unused > 0)
+        logfile_message("Discarded %d prefetched images that haven't been loaded", unused);
+
+    darray_release(prefetch.queue);
+    al_destroy_cond(prefetch.job_done);
+    al_destroy_cond(prefetch.job_available);
+    al_destroy_mutex(prefetch.mutex);
+}
+
+/*
+ * image_set_prefetch_budget()
+ * Limits the memory used by the images that have been prefetched and
+ * haven't been loaded yet. Images that would exceed the budget are not
+ * prefetched; they'll be loaded as usual. 0 means unlimited
+ */
+void image_set_prefetch_budget(size_t bytes)
+{
+    if(prefetch.depth > 0 && prefetch.thread_count > 0) {
+        al_lock_mutex(prefetch.mutex);
+        prefetch.budget = bytes;
+        al_unlock_mutex(prefetch.mutex);
+    }
+    else
+        prefetch.budget = bytes;
+}
+
+/*
+ * image_prefetch()
+ * Schedules an image to be decoded in a background thread, so that a
+ * subsequent image_load() of the same path doesn't have to read the file.
+ * This does nothing unless called between image_begin_prefetch() and
+ * image_end_prefetch(), or if there are no background threads
+ */
+void image_prefetch(const char* path)
+{
+    if(prefetch.depth == 0 || prefetch.thread_count == 0)
+        return;
+
+    /* already loaded? */
+    if(resourcemanager_find_image(path) != NULL)
+        return;
+
+    /* compressed textures don't need to be decoded */
+    char dds_path[1024];
+    if(find_compressed_texture(path, dds_path, sizeof(dds_path)))
+        return;
+
+    al_lock_mutex(prefetch.mutex);
+
+    /* enqueue the image, unless it's already enqueued */
+    if(find_prefetch_entry(path) < 0) {
+        prefetchentry_t entry = {
+            .path = str_dup(path),
+            .fullpath = str_dup(asset_path(path)),
+            .bitmap = NULL,
+            .state = PREFETCH_QUEUED
+        };
+
+        darray_push(prefetch.queue, entry);
+        al_signal_cond(prefetch.job_available);
+    }
+
+    al_unlock_mutex(prefetch.mutex);
+}
+
+
+
+/*
+ * private stuff
+ */
+
+/* a prefetch worker decodes the enqueued images into memory bitmaps */
+void* prefetch_worker(ALLEGRO_THREAD* thread, void* arg)
+{
+    /* these settings are thread-specific */
+    al_set_physfs_file_interface();
+    al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+
+    al_lock_mutex(prefetch.mutex);
+    for(;;) {
+        /* wait for a job */
+        while(!prefetch.quit && prefetch.next_job >= darray_length(prefetch.queue))
+            al_wait_cond(prefetch.job_available, prefetch.mutex);
+
+        if(prefetch.quit)
+            break;
+
+        /* pick the next entry of the queue. It may have been taken by the main thread */
+        prefetchentry_t* entry = &prefetch.queue[prefetch.next_job++];
+        if(entry->state != PREFETCH_QUEUED)
+            continue;
+
+        /* skip the image if we're out of budget; it will be loaded as usual */
+        if(prefetch.budget > 0 && prefetch.pending_bytes >= prefetch.budget) {
+            entry->state = PREFETCH_DECODED;
+            continue;
+        }
+
+        /* decode the image. The queue may be reallocated meanwhile */
+        int index = entry - prefetch.queue;
+        const char* fullpath = entry->fullpath;
+        entry->state = PREFETCH_DECODING;
+        al_unlock_mutex(prefetch.mutex);
+
+        ALLEGRO_BITMAP* bitmap = al_load_bitmap(fullpath);
+
+        al_lock_mutex(prefetch.mutex);
+        entry = &prefetch.queue[index];
+        entry->bitmap = bitmap;
+        entry->state = PREFETCH_DECODED;
+        if(bitmap != NULL)
+            prefetch.pending_bytes += bitmap_size(bitmap);
+        al_broadcast_cond(prefetch.job_done);
+    }
+    al_unlock_mutex(prefetch.mutex);
+
+    return NULL;
+}
+
+/* take a prefetched bitmap and upload it to the GPU. Returns NULL if the
+   image hasn't been prefetched or if it couldn't be decoded */
+ALLEGRO_BITMAP* take_prefetched_bitmap(const char* path)
+{
+    ALLEGRO_BITMAP* bitmap = NULL;
+
+    if(prefetch.depth == 0 || prefetch.thread_count == 0)
+        return NULL;
+
+    al_lock_mutex(prefetch.mutex);
+
+    int index = find_prefetch_entry(path);
+    if(index >= 0) {
+        /* wait for the image to be decoded. If no worker has picked it
+           up yet, we'll just load it ourselves */
+        while(prefetch.queue[index].state == PREFETCH_DECODING)
+            al_wait_cond(prefetch.job_done, prefetch.mutex);
+
+        bitmap = prefetch.queue[index].bitmap;
+        prefetch.queue[index].bitmap = NULL;
+        prefetch.queue[index].state = PREFETCH_TAKEN;
+        if(bitmap != NULL)
+            prefetch.pending_bytes -= min(prefetch.pending_bytes, bitmap_size(bitmap));
+        prefetch.hint = index + 1;
+    }
+
+    al_unlock_mutex(prefetch.mutex);
+
+    /* upload the bitmap using the settings of the calling thread */
+    if(bitmap != NULL)
+        al_convert_bitmap(bitmap);
+
+    return bitmap;
+}
+
+/* the memory used by a decoded bitmap, in bytes */
+size_t bitmap_size(ALLEGRO_BITMAP* bitmap)
+{
+    return (size_t)al_get_bitmap_width(bitmap) * (size_t)al_get_bitmap_height(bitmap) * 4;
+}
+
+/* find the entry of the prefetch queue with the given path, or return -1.
+   Call with the mutex locked. Images are usually loaded in the order they
+   are prefetched, so we start looking from a hint */
+int find_prefetch_entry(const char* path)
+{
+    int n = darray_length(prefetch.queue);
+
+    for(int j = 0; j < n; j++) {
+        int i = (prefetch.hint + j) % n;
+        if(str_icmp(prefetch.queue[i].path, path) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+/* packs a bitmap into the texture atlas, returning the page and the position
+   in which it was stored. Returns NULL if the bitmap can't be packed */
+atlaspage_t* atlas_pack(ALLEGRO_BITMAP* bitmap, int* x, int* y)
+{
+    int width = al_get_bitmap_width(bitmap);
+    int height = al_get_bitmap_height(bitmap);
+    atlaspage_t* page = NULL;
+
+    /* skip large images */
+    if(width > ATLAS_MAX_IMAGE_SIZE || height > ATLAS_MAX_IMAGE_SIZE)
+        return NULL;
+
+    /* find a page with enough free space */
+    for(page = atlas; page != NULL; page = page->next) {
+        if(atlas_find_space(page, width, height, x, y))
+            break;
+    }
+
+    /* create a new page if necessary */
+    if(page == NULL) {
+        if(NULL == (page = atlas_create_page()))
+            return NULL;
+
+        if(!atlas_find_space(page, width, height, x, y)) {
+            atlas_destroy_page(page);
+            return NULL;
+        }
+
+        page->next = atlas;
+        atlas = page;
+    }
+
+    /* copy the pixels to the page, alpha included */
+    ALLEGRO_STATE state;
+    al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP | ALLEGRO_STATE_BLENDER);
+    al_set_target_bitmap(page->bitmap);
+    al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ZERO);
+    al_draw_bitmap(bitmap, *x, *y, 0);
+    al_restore_state(&state);
+
+    /* done! */
+    return page;
+}
+
+/* creates a new page of the texture atlas */
+atlaspage_t* atlas_create_page()
+{
+    ALLEGRO_BITMAP* bitmap = al_create_bitmap(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE);
+    if(bitmap == NULL) {
+        logfile_message("WARNING: can't create a %dx%d page for the texture atlas", ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE);
+        return NULL;
+    }
+
+    /* clear to transparent */
+    ALLEGRO_STATE state;
+    al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP);
+    al_set_target_bitmap(bitmap);
+    al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+    al_restore_state(&state);
+
+    /* create the page */
+    atlaspage_t* page = mallocx(sizeof *page);
+    page->bitmap = bitmap;
+    page->refs = 0;
+    page->bottom = 0;
+    page->next = NULL;
+    darray_init(page->shelf);
+
+    return page;
+}
+
+/* destroys a page of the texture atlas, returning the next page */
+atlaspage_t* atlas_destroy_page(atlaspage_t* page)
+{
+    atlaspage_t* next = page->next;
+
+    darray_release(page->shelf);
+    al_destroy_bitmap(page->bitmap);
+    free(page);
+
+    return next;
+}
+
+/* finds free space for a width x height image in a page using a shelf packing
+   algorithm. Returns true on success, writing the position to (x, y) */
+bool atlas_find_space(atlaspage_t* page, int width, int height, int* x, int* y)
+{
+    int w = width + ATLAS_PADDING, h = height + ATLAS_PADDING;
+    int best = -1;
+
+    /* pick the lowest shelf that fits the image */
+    for(int i = 0; i < darray_length(page->shelf); i++) {
+        const atlasshelf_t* shelf = &page->shelf[i];
+
+        if(shelf->height >= h && shelf->x + w <= ATLAS_PAGE_SIZE) {
+            if(best < 0 || shelf->height < page->shelf[best].height)
+                best = i;
+        }
+    }
+
+    /* open a new shelf */
+    if(best < 0) {
+        if(page->bottom + h > ATLAS_PAGE_SIZE || w > ATLAS_PAGE_SIZE)
+            return false;
+
+        atlasshelf_t shelf = { .y = page->bottom, .height = h, .x = 0 };
+        page->bottom += h;
+        darray_push(page->shelf, shelf);
+
+        best = darray_length(page->shelf) - 1;
+    }
+
+    /* store the image in the shelf */
+    *x = page->shelf[best].x;
+    *y = page->shelf[best].y;
+    page->shelf[best].x += w;
+
+    return true;
+}
+
+/* makes an image stop sharing its texture with the other images of the atlas */
+void atlas_detach(image_t* img)
+{
+    ALLEGRO_BITMAP* root = img->data;
+    while(al_get_parent_bitmap(root) != NULL)
+        root = al_get_parent_bitmap(root);
+
+    /* is the image stored in the atlas? */
+    const atlaspage_t* page = atlas;
+    while(page != NULL && page->bitmap != root)
+        page = page->next;
+
+    if(page == NULL)
+        return;
+
+    /* copy the pixels to a standalone bitmap. The page, if
+       referenced by this image, is kept until the image is
+       destroyed, so that shared sub-images remain valid */
+    ALLEGRO_BITMAP* bitmap = al_clone_bitmap(img->data);
+    if(bitmap == NULL) {
+        logfile_message("WARNING: can't detach image \"%s\" from the texture atlas", image_filepath(img));
+        return;
+    }
+
+    al_destroy_bitmap(img->data);
+    img->data = bitmap;
+}
+
+/* loads the compressed texture of an image, if there is a suitable one.
+   Returns NULL if the image should be loaded from the original file */
+ALLEGRO_BITMAP* load_compressed_texture(const char* path)
+{
+    char dds_path[1024];
+    ALLEGRO_BITMAP* bitmap;
+    ALLEGRO_STATE state;
+
+    if(!find_compressed_texture(path, dds_path, sizeof(dds_path)))
+        return NULL;
+
+    /* if the video card doesn't support the compressed format, Allegro
+       decompresses the texture; there is no gain then. Don't keep it */
+    al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
+    al_set_new_bitmap_flags(al_get_new_bitmap_flags() & ~ALLEGRO_MEMORY_BITMAP);
+    bitmap = al_load_bitmap(dds_path);
+    al_restore_state(&state);
+
+    if(bitmap == NULL) {
+        logfile_message("WARNING: can't load compressed texture \"%s\"", dds_path);
+        return NULL;
+    }
+    else if(!is_compressed_format(al_get_bitmap_format(bitmap)) || (al_get_bitmap_flags(bitmap) & ALLEGRO_MEMORY_BITMAP)) {
+        logfile_message("Compressed textures are not supported by the video card. Using \"%s\"", path);
+        al_destroy_bitmap(bitmap);
+        return NULL;
+    }
+
+    logfile_message("Using compressed texture \"%s\"", dds_path);
+    return bitmap;
+}
+
+/* finds an up-to-date compressed texture of an image, returning its virtual path in dds_path */
+bool find_compressed_texture(const char* path, char* dds_path, size_t dds_path_size)
+{
+    bool found = false;
+    ALLEGRO_FS_ENTRY* dds_entry;
+
+    /* no compressed textures without a display */
+    if(al_get_current_display() == NULL)
+        return false;
+
+    /* find the compressed texture */
+    str_cpy(dds_path, asset_path(path), dds_path_size);
+    if(strlen(dds_path) + sizeof(COMPRESSED_TEXTURE_EXTENSION) > dds_path_size)
+        return false;
+    strcat(dds_path, COMPRESSED_TEXTURE_EXTENSION);
+
+    if(NULL == (dds_entry = al_create_fs_entry(dds_path)))
+        return false;
+
+    /* a compressed texture older than the original file is stale */
+    if(al_fs_entry_exists(dds_entry)) {
+        ALLEGRO_FS_ENTRY* entry = al_create_fs_entry(asset_path(path));
+
+        if(entry != NULL) {
+            found = !al_fs_entry_exists(entry) || al_get_fs_entry_mtime(dds_entry) >= al_get_fs_entry_mtime(entry);
+            al_destroy_fs_entry(entry);
+        }
+    }
+
+    al_destroy_fs_entry(dds_entry);
+    return found;
+}
+
+/* generates mipmaps for the texture of an image drawn at the given scale, if appropriate */
+void want_mipmaps(const image_t* img, v2d_t scale)
+{
+    /* take the current transform into account */
+    const ALLEGRO_TRANSFORM* transform = al_get_current_transform();
+    float scale_x = fabsf(scale.x) * hypotf(transform->m[0][0], transform->m[0][1]);
+    float scale_y = fabsf(scale.y) * hypotf(transform->m[1][0], transform->m[1][1]);
+    if(scale_x >= MIPMAP_SCALE_THRESHOLD && scale_y >= MIPMAP_SCALE_THRESHOLD)
+        return;
+
+    /* only images loaded from files; drawing targets would need new mipmaps all the time */
+    if(img->path == NULL)
+        return;
+
+    /* the texture is the root bitmap: an atlas page or the image itself */
+    ALLEGRO_BITMAP* root = img->data;
+    while(al_get_parent_bitmap(root) != NULL)
+        root = al_get_parent_bitmap(root);
+
+    int flags = al_get_bitmap_flags(root);
+    if(flags & (ALLEGRO_MIPMAP | ALLEGRO_MEMORY_BITMAP))
+        return;
+
+    /* ALLEGRO_MIPMAP requires a power of two texture (atlas pages are) */
+    int width = al_get_bitmap_width(root), height = al_get_bitmap_height(root);
+    if(!IS_POWER_OF_TWO(width) || !IS_POWER_OF_TWO(height) || is_compressed_format(al_get_bitmap_format(root)))
+        return;
+
+    /* convert the texture. Pending deferred drawing is flushed first, in order */
+    ALLEGRO_STATE state;
+    bool held = al_is_bitmap_drawing_held();
+
+    if(held)
+        al_hold_bitmap_drawing(false);
+
+    logfile_message("Generating mipmaps for a %dx%d texture (\"%s\")", width, height, img->path);
+    al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
+    al_set_new_bitmap_flags(flags | ALLEGRO_MIPMAP);
+    al_convert_bitmap(root); /* sub-bitmaps remain valid */
+    al_restore_state(&state);
+
+    if(held)
+        al_hold_bitmap_drawing(true);
+}
+
+/* checks if a pixel format is a compressed format */
+bool is_compressed_format(int format)
+{
+    switch(format) {
+        case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT1:
+        case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT3:
+        case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT5:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/* feed the signature of the current frame with a drawing operation */
+void track_drawing(const image_t* src, const char* operation, const float* param, int param_count)
+{
+    const ALLEGRO_TRANSFORM* transform = al_get_current_transform();
+    const void* header[] = { src != NULL ? src->data : NULL, operation };
+
+    video_track_drawing(header, sizeof(header));
+    video_track_drawing(param, param_count * sizeof(*param));
+    video_track_drawing(transform->m, sizeof(transform->m));
+}
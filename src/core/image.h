@@ -22,6 +22,7 @@
 #define _IMAGE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "color.h"
 #include "../util/v2d.h"
@@ -44,7 +45,8 @@ enum {
     IC_DEFAULT      = 0,        /* video bitmap */
     IC_BACKBUFFER   = 1 << 0,   /* the image is going to be a drawing target (optimize) */
     IC_DEPTH        = 1 << 1,   /* require a depth buffer */
-    IC_WRAP_MIRROR  = 1 << 2    /* mirror wrapping (shaders) */
+    IC_WRAP_MIRROR  = 1 << 2,   /* mirror wrapping (shaders) */
+    IC_LINEAR       = 1 << 3    /* linear filtering without mipmaps (scaled drawing targets) */
 };
 
 /* image management */
@@ -57,6 +59,7 @@ void image_destroy(image_t* img); /* call this after image_create() */
 /* load from file */
 image_t* image_load(const char* path); /* will be unloaded automatically */
 int image_unload(const image_t* img); /* use if you want to save memory... */
+bool image_reload(image_t* img); /* reloads the pixels of a modified file (hot reload); its size must not change */
 
 /* utilities */
 int image_width(const image_t* img); /* the width of the image */
@@ -67,6 +70,17 @@ void image_enable_linear_filtering(image_t* img); /* enable linear filtering */
 void image_disable_linear_filtering(image_t* img); /* disable linear filtering */
 const char* image_filepath(const image_t* img); /* relative path of the originating file, if defined */
 texturehandle_t image_texture(const image_t* img); /* get texture handle */
+size_t image_texture_size(const image_t* img); /* estimated texture memory, in bytes */
+
+/* texture atlas */
+void image_begin_atlas(); /* pack the images loaded from now on into shared textures */
+void image_end_atlas(); /* stop packing loaded images */
+
+/* prefetching */
+void image_begin_prefetch(); /* decode the images passed to image_prefetch() in background threads */
+void image_end_prefetch(); /* stop prefetching and discard the prefetched images that haven't been loaded */
+void image_prefetch(const char* path); /* schedule an image to be decoded, so that image_load() is faster */
+void image_set_prefetch_budget(size_t bytes); /* limit the memory of the prefetched images that haven't been loaded; 0 means unlimited */
 
 /* pixel manipulation */
 void image_lock(image_t* img, const char* mode);
@@ -74,6 +88,8 @@ void image_unlock(image_t* img);
 bool image_is_locked(const image_t* img);
 color_t image_getpixel(const image_t* img, int x, int y);
 void image_putpixel(int x, int y, color_t color);
+bool image_read_pixels(const image_t* img, uint8_t* rgba_pixels); /* copies width * height * 4 bytes, row by row */
+const uint8_t* image_locked_pixels(const image_t* img, int* pitch); /* RGBA pixels of an image locked with mode "r"; NULL otherwise */
 
 /* drawing target */
 void image_set_drawing_target(image_t* new_target);
@@ -28,6 +28,8 @@
 #include "import.h"
 #include "global.h"
 #include "asset.h"
+#include "../util/util.h"
+#include "../util/darray.h"
 #include "../util/stringutil.h"
 
 /*
@@ -64,6 +66,8 @@ the directory of the executable (which is the default behavior). Simply put,
 #define DRY_RUN                     0 /* don't actually copy any files; for testing purposes only */
 #define WANT_SILLY_JOKE             1
 #define PATH_MAXSIZE                4096
+#define MAX_COPY_WORKERS            8 /* how many threads copy files in parallel */
+#define PROGRESS_INTERVAL           0.5 /* report the progress of the copy every PROGRESS_INTERVAL seconds */
 
 #define ALERT(...)                  message_box(0, __VA_ARGS__)
 #define WARN(...)                   message_box(ALLEGRO_MESSAGEBOX_WARN, __VA_ARGS__)
@@ -266,6 +270,38 @@ static bool make_directory_for_file(ALLEGRO_FS_ENTRY* e);
 static int pathcmp(const char* a, const char* b);
 static ALLEGRO_FILE* open_import_logfile(const char* path_to_directory);
 static ALLEGRO_FILE* close_import_logfile(ALLEGRO_FILE* fp);
+static int copy_files_in_parallel();
+static void* copy_worker(ALLEGRO_THREAD* thread, void* arg);
+static bool is_unchanged(ALLEGRO_FS_ENTRY* dest, ALLEGRO_FS_ENTRY* src);
+static bool hash_file(ALLEGRO_FS_ENTRY* e, uint64_t* hash);
+
+/* files are selected for import while scanning the source folder (which may
+   require user input) and copied later on by a pool of worker threads */
+typedef enum copystatus_t copystatus_t;
+enum copystatus_t
+{
+    COPY_PENDING,
+    COPY_DONE, /* the file has been copied */
+    COPY_UNCHANGED, /* the destination file already has the same contents */
+    COPY_FAILED
+};
+
+typedef struct copyjob_t copyjob_t;
+struct copyjob_t
+{
+    char* src; /* absolute path */
+    char* dest; /* absolute path */
+    char* vpath; /* relative path, for printing */
+    copystatus_t status;
+};
+
+static struct {
+    DARRAY(copyjob_t, job);
+    int next_job; /* index of the next job to be picked by a worker */
+    int finished_jobs;
+    ALLEGRO_MUTEX* mutex;
+    ALLEGRO_COND* job_finished;
+} copyqueue;
 
 /* outputs for the import log */
 static ALLEGRO_FILE* import_logfile = NULL;
@@ -662,9 +698,14 @@ int import_files(ALLEGRO_FS_ENTRY* dest, ALLEGRO_FS_ENTRY* src)
     ALLEGRO_PATH* dest_path = al_create_path_for_directory(dest_dir);
 
     /* call import_file() for each entry of the src folder */
-    void* extra[] = { src_path, dest_path, &error_count };
+    void* extra[] = { src_path, dest_path };
+    darray_init(copyqueue.job);
     my_for_each_fs_entry(src, import_file, extra);
 
+    /* copy the selected files */
+    error_count += copy_files_in_parallel();
+    darray_release(copyqueue.job);
+
     /* clean up */
     al_destroy_path(dest_path);
     al_destroy_path(src_path);
@@ -678,7 +719,6 @@ int import_file(ALLEGRO_FS_ENTRY* e, void* extra)
 {
     const ALLEGRO_PATH* src_path = (ALLEGRO_PATH*)(((void**)extra)[0]);
     const ALLEGRO_PATH* dest_path = (ALLEGRO_PATH*)(((void**)extra)[1]);
-    int* error_count = (int*)(((void**)extra)[2]);
     int result = ALLEGRO_FOR_EACH_FS_ENTRY_OK; /* continue iteration */
 
     /* find e_path, the absolute path of the current entry e */
@@ -744,16 +784,16 @@ int import_file(ALLEGRO_FS_ENTRY* e, void* extra)
 
         }
 
-        /* import the file */
+        /* schedule the file for copying */
         if(import) {
-            ALLEGRO_FS_ENTRY* d = al_create_fs_entry(al_path_cstr(d_path, ALLEGRO_NATIVE_PATH_SEP));
-
-            if(!copy_file(d, e)) {
-                PRINT("!   ERROR: can't copy %s", vpath);
-                ++(*error_count);
-            }
-
-            al_destroy_fs_entry(d);
+            copyjob_t job = {
+                .src = str_dup(al_get_fs_entry_name(e)),
+                .dest = str_dup(al_path_cstr(d_path, ALLEGRO_NATIVE_PATH_SEP)),
+                .vpath = str_dup(vpath),
+                .status = COPY_PENDING
+            };
+
+            darray_push(copyqueue.job, job);
         }
 
     }
@@ -921,6 +961,186 @@ bool copy_file(ALLEGRO_FS_ENTRY* dest, ALLEGRO_FS_ENTRY* src)
 #endif
 }
 
+/* copy the scheduled files using a pool of worker threads, returning the number of errors */
+int copy_files_in_parallel()
+{
+    ALLEGRO_THREAD* thread[MAX_COPY_WORKERS];
+    int thread_count = al_get_cpu_count();
+    int job_count = darray_length(copyqueue.job);
+    int copied = 0, unchanged = 0, failed = 0;
+
+    if(job_count == 0)
+        return 0;
+
+    /* setup the queue */
+    copyqueue.next_job = 0;
+    copyqueue.finished_jobs = 0;
+    copyqueue.mutex = al_create_mutex();
+    copyqueue.job_finished = al_create_cond();
+
+    /* start the workers */
+    if(thread_count > MAX_COPY_WORKERS)
+        thread_count = MAX_COPY_WORKERS;
+    else if(thread_count < 1)
+        thread_count = 1;
+
+    if(thread_count > job_count)
+        thread_count = job_count;
+
+    for(int i = 0; i < thread_count; i++) {
+        if(NULL == (thread[i] = al_create_thread(copy_worker, NULL))) {
+            thread_count = i;
+            break;
+        }
+
+        al_start_thread(thread[i]);
+    }
+
+    PRINT(" ");
+    PRINT("Copying %d files using %d threads...", job_count, thread_count);
+
+    /* no threads? copy the files in this thread */
+    if(thread_count == 0)
+        copy_worker(NULL, NULL);
+
+    /* report progress */
+    al_lock_mutex(copyqueue.mutex);
+    while(copyqueue.finished_jobs < job_count) {
+        ALLEGRO_TIMEOUT timeout;
+        al_init_timeout(&timeout, PROGRESS_INTERVAL);
+        al_wait_cond_until(copyqueue.job_finished, copyqueue.mutex, &timeout);
+
+        int finished_jobs = copyqueue.finished_jobs;
+        al_unlock_mutex(copyqueue.mutex);
+        PRINT("    %d%% (%d of %d)", (100 * finished_jobs) / job_count, finished_jobs, job_count);
+        al_lock_mutex(copyqueue.mutex);
+    }
+    al_unlock_mutex(copyqueue.mutex);
+
+    /* wait for the workers */
+    for(int i = 0; i < thread_count; i++)
+        al_destroy_thread(thread[i]); /* joins the thread */
+
+    al_destroy_cond(copyqueue.job_finished);
+    al_destroy_mutex(copyqueue.mutex);
+
+    /* report the results */
+    PRINT(" ");
+    for(int i = 0; i < job_count; i++) {
+        copyjob_t* job = &copyqueue.job[i];
+
+        switch(job->status) {
+            case COPY_DONE:
+                copied++;
+                break;
+
+            case COPY_UNCHANGED:
+                PRINT("    Unchanged %s", job->vpath);
+                unchanged++;
+                break;
+
+            default:
+                PRINT("!   ERROR: can't copy %s", job->vpath);
+                failed++;
+                break;
+        }
+
+        free(job->vpath);
+        free(job->dest);
+        free(job->src);
+    }
+
+    PRINT(" ");
+    PRINT("%d files copied, %d unchanged.", copied, unchanged);
+
+    /* done! */
+    return failed;
+}
+
+/* a worker thread that copies the scheduled files */
+void* copy_worker(ALLEGRO_THREAD* thread, void* arg)
+{
+    int job_count = darray_length(copyqueue.job);
+
+    for(;;) {
+        /* pick a job */
+        al_lock_mutex(copyqueue.mutex);
+        int j = copyqueue.next_job;
+        if(j < job_count)
+            copyqueue.next_job++;
+        al_unlock_mutex(copyqueue.mutex);
+
+        if(j >= job_count)
+            break;
+
+        /* copy the file, unless the destination already has the same contents */
+        copyjob_t* job = &copyqueue.job[j];
+        ALLEGRO_FS_ENTRY* src = al_create_fs_entry(job->src);
+        ALLEGRO_FS_ENTRY* dest = al_create_fs_entry(job->dest);
+        copystatus_t status;
+
+        if(src == NULL || dest == NULL)
+            status = COPY_FAILED;
+        else if(is_unchanged(dest, src))
+            status = COPY_UNCHANGED;
+        else if(copy_file(dest, src))
+            status = COPY_DONE;
+        else
+            status = COPY_FAILED;
+
+        if(dest != NULL)
+            al_destroy_fs_entry(dest);
+        if(src != NULL)
+            al_destroy_fs_entry(src);
+
+        /* report */
+        al_lock_mutex(copyqueue.mutex);
+        job->status = status;
+        copyqueue.finished_jobs++;
+        al_signal_cond(copyqueue.job_finished);
+        al_unlock_mutex(copyqueue.mutex);
+    }
+
+    return NULL;
+}
+
+/* checks if dest exists and has the same contents of src. Sizes are compared
+   first, so that files that have obviously changed are not read at all */
+bool is_unchanged(ALLEGRO_FS_ENTRY* dest, ALLEGRO_FS_ENTRY* src)
+{
+    uint64_t src_hash, dest_hash;
+
+    if(!al_fs_entry_exists(dest))
+        return false;
+
+    if(al_get_fs_entry_size(dest) != al_get_fs_entry_size(src))
+        return false;
+
+    return hash_file(src, &src_hash) && hash_file(dest, &dest_hash) && src_hash == dest_hash;
+}
+
+/* computes the 64-bit FNV-1a hash of the contents of a file */
+bool hash_file(ALLEGRO_FS_ENTRY* e, uint64_t* hash)
+{
+    ALLEGRO_FILE* fp = al_open_fs_entry(e, "rb");
+    unsigned char buffer[4096];
+    size_t num_bytes;
+
+    if(fp == NULL)
+        return false;
+
+    *hash = UINT64_C(0xcbf29ce484222325);
+    while((num_bytes = al_fread(fp, buffer, sizeof(buffer))) > 0) {
+        for(size_t i = 0; i < num_bytes; i++)
+            *hash = (*hash ^ buffer[i]) * UINT64_C(0x100000001b3);
+    }
+
+    bool success = !al_ferror(fp);
+    al_fclose(fp);
+
+    return success;
+}
+
 /* create a directory (and parent directories, if needed) to store a file */
 bool make_directory_for_file(ALLEGRO_FS_ENTRY* e)
 {
@@ -25,6 +25,7 @@
 #include "logfile.h"
 #include "timer.h"
 #include "inputmap.h"
+#include "inputrecorder.h"
 #include "../entities/mobilegamepad.h"
 #include "../util/numeric.h"
 #include "../util/util.h"
@@ -35,6 +36,7 @@ struct input_t {
     bool enabled; /* is this input object enabled? */
     bool blocked; /* is this input object blocked for user input? */
     bool state[IB_MAX], oldstate[IB_MAX]; /* state of the buttons */
+    float press_delay[IB_MAX]; /* how long ago, in seconds, the buttons were pressed at the last update */
     void (*update)(input_t*); /* update method */
 };
 
@@ -56,8 +58,18 @@ static void inputcomputer_update(input_t* in);
 struct inputuserdefined_t {
     input_t base;
     const inputmap_t *inputmap; /* input mapping */
+
+    /* the input mapping compiled into lookup tables */
+    struct {
+        int key_count; /* number of mapped keys */
+        int key[IB_MAX]; /* scancodes of the mapped keys, without repetitions */
+        uint32_t key_buttons[IB_MAX]; /* key[k] is mapped to this bitmask of buttons */
+        int joy_id; /* 0, 1, 2... or -1 if the joystick is disabled */
+        uint32_t joy_buttons[MAX_JOYSTICK_BUTTONS]; /* joystick button -> bitmask of buttons */
+    } table;
 };
 static void inputuserdefined_update(input_t* in);
+static void inputuserdefined_compile(inputuserdefined_t* me);
 
 /* list of inputs */
 typedef struct input_list_t input_list_t;
@@ -70,6 +82,9 @@ struct input_list_t {
 
 /* keyboard input */
 static bool a5_key[ALLEGRO_KEY_MAX] = { false };
+static bool a5_key_pressed_in_frame[ALLEGRO_KEY_MAX] = { false }; /* pressed since the previous update */
+static bool a5_key_release_pending[ALLEGRO_KEY_MAX] = { false }; /* pressed & released within a frame */
+static double a5_key_press_time[ALLEGRO_KEY_MAX] = { 0.0 }; /* timestamp of the last KEY_DOWN event */
 
 /* mouse input */
 #define LEFT_MOUSE_BUTTON   1 /* primary button, 1 << 0 */
@@ -79,8 +94,34 @@ static struct {
     int x, y, z; /* position of the cursor */
     int dx, dy, dz; /* deltas */
     int b; /* bit vector of active buttons */
+    int pressed_in_frame; /* bit vector of the buttons pressed since the previous update */
+    int release_pending; /* bit vector of the buttons pressed & released within a frame */
+    double press_time[3]; /* timestamps of the last BUTTON_DOWN events of the left, right & middle buttons */
 } a5_mouse = { 0 };
 
+/* timestamped input events. The Allegro event handlers write into the ring
+   and input_update() consumes it. Both run in the main thread, so we need no
+   locks. Presses shorter than a frame are kept for one update, so that they
+   aren't lost, and their timestamps give sub-frame precision */
+typedef struct inputevent_t inputevent_t;
+typedef enum inputeventtype_t inputeventtype_t;
+enum inputeventtype_t { EVENT_KEY_DOWN, EVENT_KEY_UP, EVENT_MOUSE_DOWN, EVENT_MOUSE_UP };
+struct inputevent_t {
+    inputeventtype_t type;
+    int code; /* keycode or mouse button (1, 2, 3...) */
+    double timestamp; /* as reported by Allegro */
+};
+#define EVENT_RING_CAPACITY 256 /* a power of two */
+static struct {
+    inputevent_t event[EVENT_RING_CAPACITY];
+    unsigned head, tail; /* free-running read & write indices */
+} event_ring = { .head = 0, .tail = 0 };
+static double update_timestamp = 0.0; /* when input_update() consumed the events */
+static void push_input_event(inputeventtype_t type, int code, double timestamp);
+static void consume_input_events();
+static void apply_input_event(const inputevent_t* event);
+static float press_delay(double press_time);
+
 /* joystick input */
 #define MAX_JOYS         8 /* maximum number of joysticks */
 #define MIN_BUTTONS      4 /* minimum number of buttons for a joystick to be considered a gamepad */
@@ -130,6 +171,7 @@ static input_list_t* input_list = NULL;
 static void input_register(input_t *in);
 static void input_unregister(input_t *in);
 static void input_clear(input_t *in);
+static void record_or_replay(input_t *in, int user_index);
 static void remap_joystick_buttons(joystick_input_t* joy);
 static void log_joysticks();
 static void log_joystick(ALLEGRO_JOYSTICK* joystick);
@@ -224,10 +266,17 @@ void input_init()
     a5_mouse.b = 0;
     a5_mouse.x = a5_mouse.y = a5_mouse.z = 0;
     a5_mouse.dx = a5_mouse.dy = a5_mouse.dz = 0;
+    a5_mouse.pressed_in_frame = a5_mouse.release_pending = 0;
 
     /* initialize keyboard input */
-    for(int i = 0; i < ALLEGRO_KEY_MAX; i++)
+    for(int i = 0; i < ALLEGRO_KEY_MAX; i++) {
         a5_key[i] = false;
+        a5_key_pressed_in_frame[i] = false;
+        a5_key_release_pending[i] = false;
+    }
+
+    /* initialize the ring of input events */
+    event_ring.head = event_ring.tail = 0;
 
     /* initialize joystick input */
     for(int j = 0; j < MAX_JOYS; j++)
@@ -256,6 +305,9 @@ void input_update()
 {
     int num_joys = min(al_get_num_joysticks(), MAX_JOYS);
 
+    /* consume the keyboard & mouse events received since the previous update */
+    consume_input_events();
+
     /* read joystick input */
     for(int j = 0; j < num_joys; j++) {
         ALLEGRO_JOYSTICK* joystick = al_get_joystick(j);
@@ -375,6 +427,8 @@ void input_update()
     }
 
     /* update the input objects */
+    int user_index = 0;
+    inputrecorder_begin_frame();
     for(input_list_t* it = input_list; it; it = it->next) {
         input_t* in = it->data;
 
@@ -382,13 +436,20 @@ void input_update()
         memcpy(in->oldstate, in->state, sizeof(in->oldstate));
 
         /* clear the current state of the buttons */
-        for(inputbutton_t button = 0; button < IB_MAX; button++)
+        for(inputbutton_t button = 0; button < IB_MAX; button++) {
             in->state[button] = false;
+            in->press_delay[button] = 0.0f;
+        }
 
         /* accept user input */
         if(!in->blocked)
             in->update(in);
+
+        /* record or replay the user input */
+        if(in->update == inputuserdefined_update)
+            record_or_replay(in, user_index++);
     }
+    inputrecorder_end_frame();
 }
 
 
@@ -448,6 +509,18 @@ bool input_button_released(const input_t *in, inputbutton_t button)
 }
 
 
+/*
+ * input_button_press_delay()
+ * If a given button has just been pressed, how long ago, in seconds, it was
+ * pressed at the time of the last update. This is in [0, timer_get_delta()]
+ * and gives sub-frame precision to keyboard & mouse input. Zero otherwise
+ */
+float input_button_press_delay(const input_t *in, inputbutton_t button)
+{
+    return input_button_pressed(in, button) ? in->press_delay[button] : 0.0f;
+}
+
+
 
 
 /* 
@@ -511,6 +584,7 @@ input_t *input_create_user(const char* inputmap_name)
     /* if there isn't such a inputmap_name, the game will exit beautifully */
     inputmap_name = inputmap_name ? inputmap_name : DEFAULT_INPUTMAP_NAME;
     me->inputmap = inputmap_get(inputmap_name);
+    inputuserdefined_compile(me);
 
     input_register(in);
     return in;
@@ -635,6 +709,17 @@ void input_reset(input_t *in)
 }
 
 
+/*
+ * input_discard_transitions()
+ * Buttons that have just been pressed or released are now held
+ * down or up, as if this was a new frame with the same input
+ */
+void input_discard_transitions(input_t *in)
+{
+    memcpy(in->oldstate, in->state, sizeof(in->state));
+}
+
+
 /*
  * input_copy()
  * Copy the state of the buttons of src to dest
@@ -765,6 +850,7 @@ void input_change_mapping(inputuserdefined_t *in, const char* inputmap_name)
     if(str_icmp(inputmap_name, input_get_mapping_name(in)) != 0) {
         input_clear((input_t*)in);
         in->inputmap = inputmap_get(inputmap_name ? inputmap_name : DEFAULT_INPUTMAP_NAME);
+        inputuserdefined_compile(in);
         ((input_t*)in)->update((input_t*)in);
     }
 }
@@ -829,8 +915,31 @@ void input_unregister(input_t *in)
 /* clears all the input buttons */
 void input_clear(input_t *in)
 {
-    for(inputbutton_t button = 0; button < IB_MAX; button++)
+    for(inputbutton_t button = 0; button < IB_MAX; button++) {
         in->state[button] = in->oldstate[button] = false;
+        in->press_delay[button] = 0.0f;
+    }
+}
+
+/* records the buttons of a user input object, or replaces them by recorded ones */
+void record_or_replay(input_t *in, int user_index)
+{
+    uint32_t mask = 0;
+
+    if(!inputrecorder_is_recording() && !inputrecorder_is_replaying())
+        return;
+
+    for(inputbutton_t button = 0; button < IB_MAX; button++)
+        mask |= (uint32_t)in->state[button] << button;
+
+    inputrecorder_process(user_index, &mask);
+
+    if(inputrecorder_is_replaying()) {
+        for(inputbutton_t button = 0; button < IB_MAX; button++) {
+            in->state[button] = (mask & (1u << button)) != 0;
+            in->press_delay[button] = 0.0f; /* we replay whole frames */
+        }
+    }
 }
 
 /* update specific input devices */
@@ -851,6 +960,9 @@ void inputmouse_update(input_t* in)
     in->state[IB_FIRE1] = (a5_mouse.b & LEFT_MOUSE_BUTTON);
     in->state[IB_FIRE2] = (a5_mouse.b & RIGHT_MOUSE_BUTTON);
     in->state[IB_FIRE3] = (a5_mouse.b & MIDDLE_MOUSE_BUTTON);
+    in->press_delay[IB_FIRE1] = (a5_mouse.pressed_in_frame & LEFT_MOUSE_BUTTON) ? press_delay(a5_mouse.press_time[0]) : 0.0f;
+    in->press_delay[IB_FIRE2] = (a5_mouse.pressed_in_frame & RIGHT_MOUSE_BUTTON) ? press_delay(a5_mouse.press_time[1]) : 0.0f;
+    in->press_delay[IB_FIRE3] = (a5_mouse.pressed_in_frame & MIDDLE_MOUSE_BUTTON) ? press_delay(a5_mouse.press_time[2]) : 0.0f;
     in->state[IB_FIRE4] = false;
     in->state[IB_FIRE5] = false;
     in->state[IB_FIRE6] = false;
@@ -866,52 +978,114 @@ void inputcomputer_update(input_t* in)
 void inputuserdefined_update(input_t* in)
 {
     inputuserdefined_t *me = (inputuserdefined_t*)in;
-    const inputmap_t *im = me->inputmap;
+    uint32_t state = 0; /* bitmask of buttons */
 
     /* read keyboard input */
-    if(im->keyboard.enabled) {
-        for(inputbutton_t button = 0; button < IB_MAX; button++)
-            in->state[button] = (im->keyboard.scancode[button] > 0) && a5_key[im->keyboard.scancode[button]];
+    for(int k = 0; k < me->table.key_count; k++) {
+        int scancode = me->table.key[k];
+
+        if(a5_key[scancode]) {
+            uint32_t buttons = me->table.key_buttons[k];
+            state |= buttons;
+
+            if(a5_key_pressed_in_frame[scancode]) {
+                float delay = press_delay(a5_key_press_time[scancode]);
+                for(inputbutton_t button = 0; button < IB_MAX; button++) {
+                    if(buttons & (UINT32_C(1) << button))
+                        in->press_delay[button] = delay;
+                }
+            }
+        }
     }
 
     /* read joystick input */
-    if(im->joystick.enabled && input_is_joystick_enabled()) {
-        int joy_id = im->joystick.number - 1;
-        if(joy_id < MAX_JOYS && wanted_joy[joy_id] != NULL) {
-            v2d_t axis = v2d_new(wanted_joy[joy_id]->axis[AXIS_X], wanted_joy[joy_id]->axis[AXIS_Y]);
-            v2d_t abs_axis = v2d_new(fabsf(axis.x), fabsf(axis.y));
-            float norm_inf = max(abs_axis.x, abs_axis.y);
-
-            if(norm_inf >= ANALOG_SENSITIVITY_THRESHOLD) {
-                v2d_t normalized_axis = v2d_normalize(axis);
-
-                in->state[IB_UP] = in->state[IB_UP] || (normalized_axis.y <= -ANALOG_AXIS_THRESHOLD[AXIS_Y]);
-                in->state[IB_DOWN] = in->state[IB_DOWN] || (normalized_axis.y >= ANALOG_AXIS_THRESHOLD[AXIS_Y]);
-                in->state[IB_LEFT] = in->state[IB_LEFT] || (normalized_axis.x <= -ANALOG_AXIS_THRESHOLD[AXIS_X]);
-                in->state[IB_RIGHT] = in->state[IB_RIGHT] || (normalized_axis.x >= ANALOG_AXIS_THRESHOLD[AXIS_X]);
-
-                /*video_showmessage("%f,%f => %f", normalized_axis.x, normalized_axis.y, RAD2DEG * atan2f(normalized_axis.y, normalized_axis.x));*/
-            }
+    int joy_id = me->table.joy_id;
+    if(joy_id >= 0 && wanted_joy[joy_id] != NULL && input_is_joystick_enabled()) {
+        v2d_t axis = v2d_new(wanted_joy[joy_id]->axis[AXIS_X], wanted_joy[joy_id]->axis[AXIS_Y]);
+        v2d_t abs_axis = v2d_new(fabsf(axis.x), fabsf(axis.y));
+        float norm_inf = max(abs_axis.x, abs_axis.y);
 
-            for(inputbutton_t button = 0; button < IB_MAX; button++) {
-                uint32_t button_mask = im->joystick.button_mask[(int)button];
-                in->state[button] = in->state[button] || ((wanted_joy[joy_id]->button & button_mask) != 0);
-            }
+        if(norm_inf >= ANALOG_SENSITIVITY_THRESHOLD) {
+            v2d_t normalized_axis = v2d_normalize(axis);
+
+            state |= (uint32_t)(normalized_axis.y <= -ANALOG_AXIS_THRESHOLD[AXIS_Y]) << IB_UP;
+            state |= (uint32_t)(normalized_axis.y >= ANALOG_AXIS_THRESHOLD[AXIS_Y]) << IB_DOWN;
+            state |= (uint32_t)(normalized_axis.x <= -ANALOG_AXIS_THRESHOLD[AXIS_X]) << IB_LEFT;
+            state |= (uint32_t)(normalized_axis.x >= ANALOG_AXIS_THRESHOLD[AXIS_X]) << IB_RIGHT;
+
+            /*video_showmessage("%f,%f => %f", normalized_axis.x, normalized_axis.y, RAD2DEG * atan2f(normalized_axis.y, normalized_axis.x));*/
+        }
+
+        /* for each joystick button that is down */
+        uint32_t joy_button = wanted_joy[joy_id]->button;
+        for(int j = 0; joy_button != 0; j++, joy_button >>= 1) {
+            if(joy_button & 1)
+                state |= me->table.joy_buttons[j];
         }
     }
 
     /* read the mobile gamepad as the first joystick (always enabled) */
-    if(im->joystick.enabled && im->joystick.number == 1) {
+    if(joy_id == 0) {
         mobilegamepad_state_t mobile;
         mobilegamepad_get_state(&mobile);
 
-        in->state[IB_UP] = in->state[IB_UP] || ((mobile.dpad & MOBILEGAMEPAD_DPAD_UP) != 0);
-        in->state[IB_DOWN] = in->state[IB_DOWN] || ((mobile.dpad & MOBILEGAMEPAD_DPAD_DOWN) != 0);
-        in->state[IB_LEFT] = in->state[IB_LEFT] || ((mobile.dpad & MOBILEGAMEPAD_DPAD_LEFT) != 0);
-        in->state[IB_RIGHT] = in->state[IB_RIGHT] || ((mobile.dpad & MOBILEGAMEPAD_DPAD_RIGHT) != 0);
+        state |= (uint32_t)((mobile.dpad & MOBILEGAMEPAD_DPAD_UP) != 0) << IB_UP;
+        state |= (uint32_t)((mobile.dpad & MOBILEGAMEPAD_DPAD_DOWN) != 0) << IB_DOWN;
+        state |= (uint32_t)((mobile.dpad & MOBILEGAMEPAD_DPAD_LEFT) != 0) << IB_LEFT;
+        state |= (uint32_t)((mobile.dpad & MOBILEGAMEPAD_DPAD_RIGHT) != 0) << IB_RIGHT;
+
+        state |= (uint32_t)((mobile.buttons & MOBILEGAMEPAD_BUTTON_ACTION) != 0) << IB_FIRE1;
+        state |= (uint32_t)((mobile.buttons & MOBILEGAMEPAD_BUTTON_BACK) != 0) << IB_FIRE4;
+    }
+
+    /* write the state of the buttons */
+    for(inputbutton_t button = 0; button < IB_MAX; button++)
+        in->state[button] = (state >> button) & 1;
+}
+
+/* compile the input mapping of an user-defined input device into lookup
+   tables, so that we don't need to resolve each button on every update */
+void inputuserdefined_compile(inputuserdefined_t* me)
+{
+    const inputmap_t *im = me->inputmap;
+
+    /* keyboard: a key may be mapped to multiple buttons */
+    me->table.key_count = 0;
+    if(im->keyboard.enabled) {
+        for(inputbutton_t button = 0; button < IB_MAX; button++) {
+            int scancode = im->keyboard.scancode[button];
+            int k = 0;
+
+            if(scancode <= 0 || scancode >= ALLEGRO_KEY_MAX)
+                continue;
 
-        in->state[IB_FIRE1] = in->state[IB_FIRE1] || ((mobile.buttons & MOBILEGAMEPAD_BUTTON_ACTION) != 0);
-        in->state[IB_FIRE4] = in->state[IB_FIRE4] || ((mobile.buttons & MOBILEGAMEPAD_BUTTON_BACK) != 0);
+            while(k < me->table.key_count && me->table.key[k] != scancode)
+                k++;
+
+            if(k == me->table.key_count) {
+                me->table.key[k] = scancode;
+                me->table.key_buttons[k] = 0;
+                me->table.key_count++;
+            }
+
+            me->table.key_buttons[k] |= UINT32_C(1) << button;
+        }
+    }
+
+    /* joystick: multiple joystick buttons may be mapped to the same button, and vice-versa */
+    for(int j = 0; j < MAX_JOYSTICK_BUTTONS; j++)
+        me->table.joy_buttons[j] = 0;
+
+    me->table.joy_id = -1;
+    if(im->joystick.enabled && im->joystick.number >= 1 && im->joystick.number <= MAX_JOYS) {
+        me->table.joy_id = im->joystick.number - 1;
+
+        for(inputbutton_t button = 0; button < IB_MAX; button++) {
+            for(int j = 0; j < MAX_JOYSTICK_BUTTONS; j++) {
+                if(im->joystick.button_mask[button] & (UINT32_C(1) << j))
+                    me->table.joy_buttons[j] |= UINT32_C(1) << button;
+            }
+        }
     }
 }
 
@@ -1143,11 +1317,11 @@ void a5_handle_keyboard_event(const ALLEGRO_EVENT* event, void* data)
     switch(event->type) {
 
         case ALLEGRO_EVENT_KEY_DOWN:
-            a5_key[event->keyboard.keycode] = true;
+            push_input_event(EVENT_KEY_DOWN, event->keyboard.keycode, event->any.timestamp);
             break;
 
         case ALLEGRO_EVENT_KEY_UP:
-            a5_key[event->keyboard.keycode] = false;
+            push_input_event(EVENT_KEY_UP, event->keyboard.keycode, event->any.timestamp);
             break;
 
     }
@@ -1170,12 +1344,12 @@ void a5_handle_mouse_event(const ALLEGRO_EVENT* event, void* data)
     switch(event->type) {
 
         case ALLEGRO_EVENT_MOUSE_BUTTON_DOWN:
-            a5_mouse.b |= 1 << (event->mouse.button - 1);
+            push_input_event(EVENT_MOUSE_DOWN, event->mouse.button, event->any.timestamp);
             update_mouse_position();
             break;
 
         case ALLEGRO_EVENT_MOUSE_BUTTON_UP:
-            a5_mouse.b &= ~(1 << (event->mouse.button - 1));
+            push_input_event(EVENT_MOUSE_UP, event->mouse.button, event->any.timestamp);
             update_mouse_position();
             break;
 
@@ -1232,6 +1406,96 @@ void a5_handle_joystick_event(const ALLEGRO_EVENT* event, void* data)
     (void)data;
 }
 
+/* writes an input event into the ring */
+void push_input_event(inputeventtype_t type, int code, double timestamp)
+{
+    /* if the ring is full, apply the pending events right away */
+    if(event_ring.tail - event_ring.head == EVENT_RING_CAPACITY) {
+        while(event_ring.head != event_ring.tail)
+            apply_input_event(&event_ring.event[event_ring.head++ & (EVENT_RING_CAPACITY - 1)]);
+    }
+
+    inputevent_t* e = &event_ring.event[event_ring.tail & (EVENT_RING_CAPACITY - 1)];
+    e->type = type;
+    e->code = code;
+    e->timestamp = timestamp;
+    event_ring.tail++;
+}
+
+/* consumes the input events received since the previous update */
+void consume_input_events()
+{
+    /* keys & buttons pressed and released within the previous frame are released now */
+    for(int k = 0; k < ALLEGRO_KEY_MAX; k++) {
+        if(a5_key_release_pending[k]) {
+            a5_key[k] = false;
+            a5_key_release_pending[k] = false;
+        }
+        a5_key_pressed_in_frame[k] = false;
+    }
+
+    a5_mouse.b &= ~a5_mouse.release_pending;
+    a5_mouse.release_pending = 0;
+    a5_mouse.pressed_in_frame = 0;
+
+    /* consume the events in order */
+    update_timestamp = al_get_time();
+    while(event_ring.head != event_ring.tail)
+        apply_input_event(&event_ring.event[event_ring.head++ & (EVENT_RING_CAPACITY - 1)]);
+}
+
+/* applies an input event to the state of the keyboard or of the mouse */
+void apply_input_event(const inputevent_t* event)
+{
+    int k = event->code;
+
+    switch(event->type) {
+        case EVENT_KEY_DOWN:
+            if(k > 0 && k < ALLEGRO_KEY_MAX) {
+                a5_key[k] = true;
+                a5_key_pressed_in_frame[k] = true;
+                a5_key_release_pending[k] = false;
+                a5_key_press_time[k] = event->timestamp;
+            }
+            break;
+
+        case EVENT_KEY_UP:
+            if(k > 0 && k < ALLEGRO_KEY_MAX) {
+                if(a5_key_pressed_in_frame[k])
+                    a5_key_release_pending[k] = true; /* keep it down for one update */
+                else
+                    a5_key[k] = false;
+            }
+            break;
+
+        case EVENT_MOUSE_DOWN:
+            if(k >= 1 && k <= 16) {
+                a5_mouse.b |= 1 << (k - 1);
+                a5_mouse.pressed_in_frame |= 1 << (k - 1);
+                a5_mouse.release_pending &= ~(1 << (k - 1));
+                if(k <= 3)
+                    a5_mouse.press_time[k - 1] = event->timestamp;
+            }
+            break;
+
+        case EVENT_MOUSE_UP:
+            if(k >= 1 && k <= 16) {
+                if(a5_mouse.pressed_in_frame & (1 << (k - 1)))
+                    a5_mouse.release_pending |= 1 << (k - 1); /* keep it down for one update */
+                else
+                    a5_mouse.b &= ~(1 << (k - 1));
+            }
+            break;
+    }
+}
+
+/* how long ago, in seconds, something was pressed, relative to the last update */
+float press_delay(double press_time)
+{
+    double delay = update_timestamp - press_time;
+    return clip(delay, 0.0, timer_get_delta());
+}
+
 /* emulate mouse input using touch input */
 void a5_handle_touch_event(const ALLEGRO_EVENT* event, void* data)
 {
@@ -77,6 +77,7 @@ void input_destroy(input_t *in);
 bool input_button_down(const input_t *in, inputbutton_t button);
 bool input_button_pressed(const input_t *in, inputbutton_t button);
 bool input_button_released(const input_t *in, inputbutton_t button);
+float input_button_press_delay(const input_t *in, inputbutton_t button); /* sub-frame precision: how long ago, in seconds, a button that has just been pressed was pressed */
 
 void input_simulate_button_down(input_t *in, inputbutton_t button);
 void input_simulate_button_up(input_t *in, inputbutton_t button);
@@ -84,6 +85,7 @@ void input_simulate_button_press(input_t *in, inputbutton_t button);
 
 void input_reset(input_t *in);
 void input_copy(input_t *dest, const input_t *src);
+void input_discard_transitions(input_t *in); /* pressed/released buttons become held down/up */
 
 bool input_is_enabled(const input_t *in);
 void input_enable(input_t *in);
@@ -0,0 +1,282 @@
+/*
+ * Open Surge Engine
+ * inputrecorder.c - deterministic recording & replay of user input
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <allegro5/allegro.h>
+#include <surgescript.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "inputrecorder.h"
+#include "input.h"
+#include "timer.h"
+#include "engine.h"
+#include "logfile.h"
+#include "../util/util.h"
+
+/*
+
+File format (text):
+
+    opensurge-input 1
+    seed <seed>
+    f <elapsed time> <delta time> <n> <mask 1> <mask 2> ... <mask n>
+    f ...
+
+There is one "f" line per framestep. The times are written as hexadecimal
+floating-point numbers, so that they're read back exactly. The i-th mask is
+a bit vector of the buttons held down by the i-th user input object, in the
+order in which the input objects are updated.
+
+A replay is deterministic as long as the game runs the same way given the
+same input, times and seed. The seed is applied to the C library RNG (used
+by the legacy objects) and to the SurgeScript RNG (Math.random).
+
+*/
+
+#define FORMAT_HEADER       "opensurge-input"
+#define FORMAT_VERSION      1
+#define MAX_INPUTS          16 /* user input objects per frame */
+
+/* internal data */
+static ALLEGRO_FILE* record_file = NULL;
+static ALLEGRO_FILE* replay_file = NULL;
+static uint32_t mask[MAX_INPUTS]; /* buttons of the current frame */
+static int mask_count = 0;
+static int64_t frame_count = 0;
+
+static bool open_recording(const char* path, uint64_t seed);
+static bool open_replay(const char* path, uint64_t* seed);
+static bool read_frame();
+static void finish_replay(const char* reason);
+static void apply_seed(uint64_t seed);
+
+
+
+/*
+ * inputrecorder_init()
+ * Initializes the input recorder. Call after the SurgeScript VM has been
+ * created, but before it is launched
+ */
+void inputrecorder_init(const char* record_path, const char* replay_path, int seed)
+{
+    uint64_t the_seed = (seed >= 0) ? (uint64_t)seed : (uint64_t)time(NULL);
+
+    record_file = NULL;
+    replay_file = NULL;
+    mask_count = 0;
+    frame_count = 0;
+
+    /* replay (the recorded seed takes precedence) */
+    if(replay_path != NULL) {
+        if(open_replay(replay_path, &the_seed))
+            logfile_message("Replaying the input recorded at %s (seed %lu)", replay_path, (unsigned long)the_seed);
+        else
+            fatal_error("Can't replay the input recorded at %s", replay_path);
+    }
+
+    /* record */
+    if(record_path != NULL) {
+        if(replay_file != NULL)
+            logfile_message("Can't record and replay the input at the same time. Ignoring %s", record_path);
+        else if(open_recording(record_path, the_seed))
+            logfile_message("Recording the input to %s (seed %lu)", record_path, (unsigned long)the_seed);
+        else
+            logfile_message("Can't record the input to %s", record_path);
+    }
+
+    /* seed the RNGs */
+    if(record_file != NULL || replay_file != NULL || seed >= 0)
+        apply_seed(the_seed);
+}
+
+/*
+ * inputrecorder_release()
+ * Releases the input recorder and closes the files
+ */
+void inputrecorder_release()
+{
+    if(record_file != NULL) {
+        logfile_message("Recorded %.0f frames of input", (double)frame_count);
+        al_fclose(record_file);
+        record_file = NULL;
+    }
+
+    if(replay_file != NULL) {
+        al_fclose(replay_file);
+        replay_file = NULL;
+    }
+}
+
+/*
+ * inputrecorder_is_recording()
+ * Are we recording the user input?
+ */
+bool inputrecorder_is_recording()
+{
+    return record_file != NULL;
+}
+
+/*
+ * inputrecorder_is_replaying()
+ * Are we replaying recorded input?
+ */
+bool inputrecorder_is_replaying()
+{
+    return replay_file != NULL;
+}
+
+/*
+ * inputrecorder_begin_frame()
+ * Begins a framestep. When replaying, this reads the recorded frame and
+ * overrides the times of the framestep. Call after timer_update()
+ */
+void inputrecorder_begin_frame()
+{
+    if(replay_file != NULL) {
+        if(!read_frame())
+            finish_replay("end of the recording");
+    }
+    else
+        mask_count = 0;
+}
+
+/*
+ * inputrecorder_process()
+ * Records the buttons of the input_index-th user input object of the current
+ * framestep, or replaces them by the recorded ones when replaying
+ */
+void inputrecorder_process(int input_index, uint32_t* button_mask)
+{
+    if(replay_file != NULL) {
+        *button_mask = (input_index < mask_count) ? mask[input_index] : 0;
+    }
+    else if(record_file != NULL) {
+        if(input_index < MAX_INPUTS) {
+            mask[input_index] = *button_mask;
+            mask_count = max(mask_count, input_index + 1);
+        }
+    }
+}
+
+/*
+ * inputrecorder_end_frame()
+ * Ends a framestep. When recording, this writes the frame
+ */
+void inputrecorder_end_frame()
+{
+    if(record_file == NULL)
+        return;
+
+    al_fprintf(record_file, "f %a %a %d", timer_get_elapsed(), (double)timer_get_delta(), mask_count);
+    for(int i = 0; i < mask_count; i++)
+        al_fprintf(record_file, " %lx", (unsigned long)mask[i]);
+    al_fputs(record_file, "\n");
+
+    frame_count++;
+}
+
+
+
+/*
+ * private
+ */
+
+/* opens a file for recording and writes the header */
+bool open_recording(const char* path, uint64_t seed)
+{
+    if(NULL == (record_file = al_fopen(path, "wb")))
+        return false;
+
+    al_fprintf(record_file, "%s %d\n", FORMAT_HEADER, FORMAT_VERSION);
+    al_fprintf(record_file, "seed %lu\n", (unsigned long)seed);
+    return true;
+}
+
+/* opens a recording for replay and reads the header */
+bool open_replay(const char* path, uint64_t* seed)
+{
+    char line[256], header[32];
+    unsigned long recorded_seed;
+    int version;
+
+    if(NULL == (replay_file = al_fopen(path, "rb")))
+        return false;
+
+    if(al_fgets(replay_file, line, sizeof(line)) == NULL
+    || sscanf(line, "%31s %d", header, &version) != 2
+    || strcmp(header, FORMAT_HEADER) != 0 || version != FORMAT_VERSION
+    || al_fgets(replay_file, line, sizeof(line)) == NULL
+    || sscanf(line, "seed %lu", &recorded_seed) != 1) {
+        logfile_message("Invalid input recording: %s", path);
+        al_fclose(replay_file);
+        replay_file = NULL;
+        return false;
+    }
+
+    *seed = (uint64_t)recorded_seed;
+    return true;
+}
+
+/* reads the next frame of the replay and overrides the times of the framestep */
+bool read_frame()
+{
+    char line[32 + 12 * MAX_INPUTS];
+    double elapsed_time, delta_time;
+    int offset = 0, n = 0;
+
+    if(al_fgets(replay_file, line, sizeof(line)) == NULL)
+        return false;
+    else if(sscanf(line, "f %la %la %d%n", &elapsed_time, &delta_time, &mask_count, &offset) != 3)
+        return false;
+
+    mask_count = clip(mask_count, 0, MAX_INPUTS);
+    for(int i = 0; i < mask_count; i++) {
+        unsigned long m = 0;
+        if(sscanf(line + offset, " %lx%n", &m, &n) != 1)
+            return false;
+
+        mask[i] = (uint32_t)m;
+        offset += n;
+    }
+
+    timer_override_framestep(elapsed_time, delta_time);
+    frame_count++;
+    return true;
+}
+
+/* stops replaying and quits the engine: a replay drives a whole run */
+void finish_replay(const char* reason)
+{
+    logfile_message("Replayed %.0f frames of input (%s)", (double)frame_count, reason);
+
+    al_fclose(replay_file);
+    replay_file = NULL;
+    mask_count = 0;
+
+    engine_quit();
+}
+
+/* seeds the random number generators */
+void apply_seed(uint64_t seed)
+{
+    srand((unsigned)seed);
+    surgescript_util_srand(seed);
+}
@@ -0,0 +1,40 @@
+/*
+ * Open Surge Engine
+ * inputrecorder.h - deterministic recording & replay of user input
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _INPUTRECORDER_H
+#define _INPUTRECORDER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* records the user input of each framestep to a file or replays it. The paths
+   refer to the virtual filesystem; set them to NULL to disable each feature.
+   Set seed to a negative value to use a random seed (when recording) */
+void inputrecorder_init(const char* record_path, const char* replay_path, int seed);
+void inputrecorder_release();
+bool inputrecorder_is_recording();
+bool inputrecorder_is_replaying();
+
+/* called by the input system at each framestep */
+void inputrecorder_begin_frame();
+void inputrecorder_process(int input_index, uint32_t* button_mask); /* records or replaces the buttons of a user input object */
+void inputrecorder_end_frame();
+
+#endif
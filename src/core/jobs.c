@@ -0,0 +1,208 @@
+/*
+ * Open Surge Engine
+ * jobs.c - job system: a shared pool of worker threads for data-parallel work
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <allegro5/allegro.h>
+#include "jobs.h"
+#include "logfile.h"
+#include "../util/util.h"
+
+/* the pool of worker threads */
+#define MAX_WORKERS 3
+static struct {
+    ALLEGRO_THREAD* thread[MAX_WORKERS];
+    int thread_count;
+    ALLEGRO_MUTEX* mutex;
+    ALLEGRO_COND* job_available; /* broadcast when there is a new job */
+    ALLEGRO_COND* job_done; /* signaled when all workers are done */
+    int job_number; /* incremented for each new job */
+    jobfun_t job_fun; /* the function of the current job */
+    void* job_context; /* the context of the current job */
+    int job_size; /* length of the range of the current job */
+    int job_workers; /* number of threads of the current job, including the main thread */
+    int busy_workers; /* number of workers still running the current job */
+    bool quit;
+} pool = { .thread_count = 0, .mutex = NULL };
+
+static void* worker_run(ALLEGRO_THREAD* thread, void* arg);
+
+
+
+/*
+ * jobs_init()
+ * Creates the worker threads
+ */
+void jobs_init()
+{
+    int cpu_count = al_get_cpu_count();
+    int thread_count = cpu_count > 1 ? cpu_count - 1 : 0;
+
+    if(thread_count > MAX_WORKERS)
+        thread_count = MAX_WORKERS;
+
+    pool.mutex = al_create_mutex();
+    pool.job_available = al_create_cond();
+    pool.job_done = al_create_cond();
+    pool.job_number = 0;
+    pool.job_fun = NULL;
+    pool.job_context = NULL;
+    pool.job_size = 0;
+    pool.job_workers = 0;
+    pool.busy_workers = 0;
+    pool.quit = false;
+
+    pool.thread_count = 0;
+    for(int i = 0; i < thread_count; i++) {
+        ALLEGRO_THREAD* thread = al_create_thread(worker_run, (void*)(intptr_t)i);
+        if(thread == NULL) {
+            logfile_message("Jobs: can't create worker thread %d", i);
+            break;
+        }
+
+        pool.thread[pool.thread_count++] = thread;
+        al_start_thread(thread);
+    }
+
+    logfile_message("Jobs: created %d worker threads", pool.thread_count);
+}
+
+/*
+ * jobs_release()
+ * Joins and destroys the worker threads
+ */
+void jobs_release()
+{
+    if(pool.mutex == NULL)
+        return;
+
+    al_lock_mutex(pool.mutex);
+    pool.quit = true;
+    al_broadcast_cond(pool.job_available);
+    al_unlock_mutex(pool.mutex);
+
+    for(int i = 0; i < pool.thread_count; i++)
+        al_destroy_thread(pool.thread[i]); /* joins the thread */
+    pool.thread_count = 0;
+
+    al_destroy_cond(pool.job_done);
+    al_destroy_cond(pool.job_available);
+    al_destroy_mutex(pool.mutex);
+    pool.mutex = NULL;
+}
+
+/*
+ * jobs_parallel_for()
+ * Calls fun(begin, end, context) on disjoint chunks that cover [0,count).
+ * Each thread gets at least min_count_per_thread elements, so that small
+ * jobs run on the main thread only. Returns when the whole range is done
+ */
+void jobs_parallel_for(int count, int min_count_per_thread, jobfun_t fun, void* context)
+{
+    int workers = 1 + pool.thread_count; /* including the main thread */
+
+    /* small job? */
+    if(min_count_per_thread < 1)
+        min_count_per_thread = 1;
+
+    if(workers * min_count_per_thread > count)
+        workers = count / min_count_per_thread;
+
+    if(workers <= 1) {
+        if(count > 0)
+            fun(0, count, context);
+        return;
+    }
+
+    /* start a new job */
+    al_lock_mutex(pool.mutex);
+    pool.job_fun = fun;
+    pool.job_context = context;
+    pool.job_size = count;
+    pool.job_workers = workers;
+    pool.busy_workers = workers - 1;
+    pool.job_number++;
+    al_broadcast_cond(pool.job_available);
+    al_unlock_mutex(pool.mutex);
+
+    /* the main thread runs the last chunk */
+    fun((workers - 1) * count / workers, count, context);
+
+    /* wait for the workers */
+    al_lock_mutex(pool.mutex);
+    while(pool.busy_workers > 0)
+        al_wait_cond(pool.job_done, pool.mutex);
+    pool.job_fun = NULL;
+    pool.job_context = NULL;
+    al_unlock_mutex(pool.mutex);
+}
+
+/*
+ * jobs_thread_count()
+ * The number of threads that may run a job, including the main thread
+ */
+int jobs_thread_count()
+{
+    return 1 + pool.thread_count;
+}
+
+
+
+/* private */
+
+/* main function of a worker thread */
+void* worker_run(ALLEGRO_THREAD* thread, void* arg)
+{
+    int id = (int)(intptr_t)arg;
+    int job_number = 0;
+
+    al_lock_mutex(pool.mutex);
+    for(;;) {
+
+        /* wait for a job */
+        while(!pool.quit && (pool.job_number == job_number || id >= pool.job_workers - 1)) {
+            job_number = pool.job_number; /* skip jobs that don't need this worker */
+            al_wait_cond(pool.job_available, pool.mutex);
+        }
+
+        if(pool.quit)
+            break;
+
+        /* get a chunk of the job */
+        job_number = pool.job_number;
+        jobfun_t fun = pool.job_fun;
+        void* context = pool.job_context;
+        int begin = id * pool.job_size / pool.job_workers;
+        int end = (id + 1) * pool.job_size / pool.job_workers;
+
+        /* do the work */
+        al_unlock_mutex(pool.mutex);
+        fun(begin, end, context);
+        al_lock_mutex(pool.mutex);
+
+        /* done */
+        if(--pool.busy_workers == 0)
+            al_signal_cond(pool.job_done);
+
+    }
+    al_unlock_mutex(pool.mutex);
+
+    (void)thread;
+    return NULL;
+}
@@ -0,0 +1,44 @@
+/*
+ * Open Surge Engine
+ * jobs.h - job system: a shared pool of worker threads for data-parallel work
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JOBS_H
+#define _JOBS_H
+
+/*
+
+A job splits the range [0,count) into contiguous chunks, one per thread, and
+runs them in parallel. The main thread takes part in the job and the call
+returns only when all chunks are done. Jobs must not touch the SurgeScript VM
+or Allegro's drawing state: they're meant for native, data-parallel stages of
+the frame that read shared data and write to disjoint outputs.
+
+Jobs can't be nested. Call jobs_parallel_for() from the main thread only.
+
+*/
+
+typedef void (*jobfun_t)(int begin, int end, void* context); /* processes [begin,end) */
+
+void jobs_init();
+void jobs_release();
+
+void jobs_parallel_for(int count, int min_count_per_thread, jobfun_t fun, void* context); /* runs fun in parallel over [0,count) */
+int jobs_thread_count(); /* number of threads that may run a job, including the main thread */
+
+#endif
@@ -38,6 +38,8 @@ struct proganim_t {
     proganim_easing_t easing; /* easing function */
     proganim_keyframe_t* keyframe; /* array of keyframes */
     int keyframe_count; /* length of keyframe[] */
+    int segment[101][2]; /* the indices of the keyframes to interpolate at each integer percentage */
+    bool has_segments; /* is segment[][] filled? */
 };
 
 /* keyframe struct */
@@ -77,7 +79,8 @@ static const proganim_t DEFAULT_PROGANIM = {
     .duration = 0.0,
     .easing = easing_linear,
     .keyframe = NULL,
-    .keyframe_count = 0
+    .keyframe_count = 0,
+    .has_segments = false
 };
 
 static const double DURATION_EPSILON = 1e-5;
@@ -86,6 +89,8 @@ static const double DURATION_EPSILON = 1e-5;
 /* helpers */
 static void proganim_add_keyframe(proganim_t* prog_anim, proganim_keyframe_t keyframe);
 static void find_keyframes_suitable_for_interpolation(const proganim_t* prog_anim, double percentage, const proganim_keyframe_t** out_a, const proganim_keyframe_t** out_b);
+static void search_keyframes_suitable_for_interpolation(const proganim_t* prog_anim, int p, int* out_a, int* out_b);
+static void compute_segments(proganim_t* prog_anim);
 static int compare_keyframes(const void* a, const void* b);
 static float normalized_percentage(float percentage, const proganim_keyframe_t* a, const proganim_keyframe_t* b);
 static int parse_percentage(const parsetree_parameter_t* param);
@@ -218,21 +223,41 @@ float proganim_interpolated_opacity(const proganim_t* prog_anim, double seconds,
 void find_keyframes_suitable_for_interpolation(const proganim_t* prog_anim, double percentage, const proganim_keyframe_t** out_a, const proganim_keyframe_t** out_b)
 {
     int p = (int)floor(100.0 * percentage);
+    int a, b;
 
     /* make sure that we have at least 2 keyframes */
     assertx(prog_anim->keyframe_count >= 2);
 
+    /* use the precomputed segments: O(1) */
+    if(prog_anim->has_segments && p >= 0 && p <= 100) {
+        *out_a = &prog_anim->keyframe[prog_anim->segment[p][0]];
+        *out_b = &prog_anim->keyframe[prog_anim->segment[p][1]];
+        return;
+    }
+
+    /* search the keyframes */
+    search_keyframes_suitable_for_interpolation(prog_anim, p, &a, &b);
+    *out_a = &prog_anim->keyframe[a];
+    *out_b = &prog_anim->keyframe[b];
+}
+
+/*
+ * search_keyframes_suitable_for_interpolation()
+ * Search the indices of the keyframes suitable for interpolation at the given integer percentage
+ */
+void search_keyframes_suitable_for_interpolation(const proganim_t* prog_anim, int p, int* out_a, int* out_b)
+{
+    int last = prog_anim->keyframe_count - 1;
+
     /* keyframes are sorted by percentages */
 
     /* out of bounds check */
     if(p < prog_anim->keyframe[0].percentage) {
-        *out_a = &prog_anim->keyframe[0];
-        *out_b = &prog_anim->keyframe[0];
+        *out_a = *out_b = 0;
         return;
     }
-    else if(p > prog_anim->keyframe[prog_anim->keyframe_count - 1].percentage) {
-        *out_a = &prog_anim->keyframe[prog_anim->keyframe_count - 1];
-        *out_b = &prog_anim->keyframe[prog_anim->keyframe_count - 1];
+    else if(p > prog_anim->keyframe[last].percentage) {
+        *out_a = *out_b = last;
         return;
     }
 
@@ -242,15 +267,29 @@ void find_keyframes_suitable_for_interpolation(const proganim_t* prog_anim, doub
         int end_percentage = prog_anim->keyframe[k+1].percentage;
 
         if(p >= start_percentage && p <= end_percentage) {
-            *out_a = &prog_anim->keyframe[k];
-            *out_b = &prog_anim->keyframe[k+1];
+            *out_a = k;
+            *out_b = k+1;
             return;
         }
     }
 
     /* can't find an interval (this shouldn't happen) */
-    *out_a = &prog_anim->keyframe[prog_anim->keyframe_count - 1];
-    *out_b = &prog_anim->keyframe[prog_anim->keyframe_count - 1];
+    *out_a = *out_b = last;
+}
+
+/*
+ * compute_segments()
+ * Precompute the keyframes to interpolate at each integer percentage, so
+ * that evaluating an animation doesn't search its list of keyframes
+ */
+void compute_segments(proganim_t* prog_anim)
+{
+    prog_anim->has_segments = (prog_anim->keyframe_count >= 2);
+    if(!prog_anim->has_segments)
+        return;
+
+    for(int p = 0; p <= 100; p++)
+        search_keyframes_suitable_for_interpolation(prog_anim, p, &prog_anim->segment[p][0], &prog_anim->segment[p][1]);
 }
 
 
@@ -337,6 +376,9 @@ void proganim_validate(proganim_t* prog_anim)
     /* keyframes are already declared in a sorted way */
     (void)compare_keyframes;
 #endif
+
+    /* precompute the segments */
+    compute_segments(prog_anim);
 }
 
 /*
@@ -460,6 +502,7 @@ void proganim_add_keyframe(proganim_t* prog_anim, proganim_keyframe_t keyframe)
     int last = prog_anim->keyframe_count++;
     prog_anim->keyframe = reallocx(prog_anim->keyframe, sizeof(proganim_keyframe_t) * prog_anim->keyframe_count);
     prog_anim->keyframe[last] = keyframe;
+    prog_anim->has_segments = false; /* recomputed on validation */
 }
 
 
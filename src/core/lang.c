@@ -29,16 +29,47 @@
 #include "../util/stringutil.h"
 #include "../util/hashtable.h"
 
-/* fake string type */
-typedef struct { char* data; } stringadapter_t;
-static stringadapter_t* stringadapter_create(const char* data);
-static const char* stringadapter_get_data(const stringadapter_t *s);
-static void stringadapter_set_data(stringadapter_t *s, const char* data);
-static void stringadapter_destroy(stringadapter_t *s);
-
-/* hash table */
-HASHTABLE_GENERATE_CODE(stringadapter_t, stringadapter_destroy);
-static HASHTABLE(stringadapter_t, strings);
+/* compiled language table: an open-addressing index over a blob of strings.
+   Each .lng file is parsed once and kept compiled in memory, so that switching
+   languages and reading metadata don't parse the language files again */
+typedef struct langentry_t langentry_t;
+typedef struct langtable_t langtable_t;
+
+struct langentry_t {
+    uint32_t hash; /* case-insensitive hash of the key */
+    int key; /* offset of the key in the blob; -1 if the slot is empty */
+    int value; /* offset of the value in the blob */
+};
+
+struct langtable_t {
+    char* blob; /* NUL-terminated keys and values */
+    int blob_size;
+    int blob_capacity;
+    langentry_t* entry; /* the index; its capacity is a power of two */
+    int capacity;
+    int count;
+};
+
+static langtable_t* langtable_compile(const char* path);
+static langtable_t* langtable_create();
+static void langtable_destroy(langtable_t* table);
+static const char* langtable_find(const langtable_t* table, const char* key);
+static void langtable_put(langtable_t* table, const char* key, const char* value);
+static int langtable_store(langtable_t* table, const char* str);
+static void langtable_grow(langtable_t* table);
+static uint32_t hash_key(const char* key);
+
+/* compiled tables, indexed by the relative path of the language file */
+HASHTABLE_GENERATE_CODE(langtable_t, langtable_destroy);
+static HASHTABLE(langtable_t, tables);
+
+/* the layers of the current language, from the bottom (default) to the top */
+#define MAX_LAYERS 8
+static const langtable_t* layer[MAX_LAYERS];
+static int layer_count = 0;
+static const langtable_t* get_table(const char* path);
+static void push_layer(const char* path);
+static void load_layers(const char* path);
 
 /* private stuff */
 #define NULL_STRING "null"
@@ -49,9 +80,8 @@ static const char LANGUAGES_FOLDER[] = "languages/";
 static const char EXTENDS_FOLDER[] = "extends/";
 
 static char lang_id[32] = NULL_STRING;
-typedef struct { const char* key; const char* value; } inout_t;
-static int traverse(const parsetree_statement_t *stmt);
-static int traverse_inout(const parsetree_statement_t *stmt, void *inout);
+static char current_path[256] = ""; /* the language file that is currently loaded */
+static int traverse(const parsetree_statement_t *stmt, void *table);
 static int traverse_count(const parsetree_statement_t *stmt, void *counters);
 static bool is_untranslated_entry(const parsetree_statement_t *stmt);
 static char* pathify(const char* path);
@@ -67,7 +97,7 @@ static char* path_to_language_extension(const char* path);
 void lang_init()
 {
     logfile_message("Initializing the language module");
-    strings = hashtable_stringadapter_t_create();
+    tables = hashtable_langtable_t_create();
     lang_loadfile(DEFAULT_LANGUAGE_FILEPATH);
     logfile_message("The language module has been initialized");
 
@@ -82,7 +112,8 @@ void lang_init()
 void lang_release()
 {
     logfile_message("Releasing the language module...");
-    strings = hashtable_stringadapter_t_destroy(strings);
+    layer_count = 0;
+    tables = hashtable_langtable_t_destroy(tables);
 }
 
 
@@ -93,76 +124,14 @@ void lang_release()
 void lang_loadfile(const char* filepath)
 {
     char* path = pathify(filepath);
-    int supver, subver, wipver;
-
-    #define READ_LANGUAGE_FILE(path_to_lng_file) do { \
-        const char* fullpath = asset_path(path_to_lng_file); \
-        parsetree_program_t* prog = nanoparser_construct_tree(fullpath); \
-        nanoparser_traverse_program(prog, traverse); \
-        prog = nanoparser_deconstruct_tree(prog); \
-    } while(0)
-
-
 
     /* log */
     logfile_message("Loading language file \"%s\"...", path);
+    str_cpy(current_path, path, sizeof(current_path));
 
-    /* Check if the path is in the languages/ folder */
-    if(str_incmp(path, LANGUAGES_FOLDER, strlen(LANGUAGES_FOLDER)) != 0)
-        fatal_error("Won't load \"%s\". Language files are expected to be in the %s folder.", path, LANGUAGES_FOLDER);
-
-    /* Check if the path exists */
-    if(!asset_exists(path)) {
-
-        /* Crash if the default language file is missing */
-        if(0 == str_icmp(path, DEFAULT_LANGUAGE_FILEPATH))
-            fatal_error("Missing default language file: \"%s\". Please reinstall the game.", DEFAULT_LANGUAGE_FILEPATH);
-
-        /* If some other language file is missing, we don't crash the application,
-           otherwise the player may get locked due to a corrupted save state */
-        logfile_message("Missing language file: \"%s\"", path);
-        lang_loadfile(DEFAULT_LANGUAGE_FILEPATH);
-        return;
-
-    }
-
-    /* Check if the path points to a language extension */
-    bool is_language_extension = (
-        0 == str_incmp(path, LANGUAGES_FOLDER, strlen(LANGUAGES_FOLDER)) && /* already checked */
-        0 == str_incmp(path + strlen(LANGUAGES_FOLDER), EXTENDS_FOLDER, strlen(EXTENDS_FOLDER))
-    );
-    if(is_language_extension)
-        logfile_message("\"%s\" is a language extension", path);
-
-    /* Compatibility check */
-    lang_compatibility(path, &supver, &subver, &wipver);
-    if(game_version_compare(supver, subver, wipver) < 0) /* backwards compatibility */
-        fatal_error("Language file \"%s\" (version %d.%d.%d) is not compatible with this version of the engine (%s)!", path, supver, subver, wipver, GAME_VERSION_STRING);
-
-    /* Read the default language file to fill in any missing strings */
-    if(str_icmp(path, DEFAULT_LANGUAGE_FILEPATH) != 0)
-        lang_loadfile(DEFAULT_LANGUAGE_FILEPATH);
-
-    /* Read language file to memory */
-    READ_LANGUAGE_FILE(path);
-
-    /* Check if there is a language extension available */
-    if(!is_language_extension) {
-        char* extpath = path_to_language_extension(path);
-
-        /* There is a language extension */
-        if(asset_exists(extpath)) {
-
-            /* Load language extension */
-            logfile_message("Loading language extension at \"%s\"...", extpath);
-            READ_LANGUAGE_FILE(extpath);
-
-        }
-        else
-            logfile_message("No language extension found at \"%s\"", extpath);
-
-        free(extpath);
-    }
+    /* Stack the compiled tables of the language */
+    layer_count = 0;
+    load_layers(path);
 
     /* Update language ID */
     lang_getstring("LANG_ID", lang_id, sizeof(lang_id));
@@ -173,25 +142,47 @@ void lang_loadfile(const char* filepath)
 }
 
 
+/*
+ * lang_reloadfile()
+ * Recompiles a language file that has been modified, given its relative
+ * path, and restacks the current language. Returns false if the file
+ * hasn't been compiled before
+ */
+bool lang_reloadfile(const char* filepath)
+{
+    char* path = pathify(filepath);
+    bool reloaded = false;
+
+    if(hashtable_langtable_t_find(tables, path) != NULL) {
+        /* the layers may point to the old table */
+        layer_count = 0;
+        hashtable_langtable_t_replace(tables, path, langtable_compile(path));
+        lang_loadfile(current_path);
+        reloaded = true;
+    }
+
+    free(path);
+    return reloaded;
+}
+
+
 /*
  * lang_metadata()
  * Reads the contents of the desired key directly from the
- * language file, without loading it in memory. Returns dest.
+ * language file, without loading it as the current language.
+ * Returns dest.
  */
 char* lang_metadata(const char* filepath, const char* desired_key, char* dest, size_t dest_size)
 {
-    const char* fullpath = asset_path(filepath);
-    inout_t param = { .key = desired_key, .value = NULL };
-    parsetree_program_t *prog = nanoparser_construct_tree(fullpath);
-
-    nanoparser_traverse_program_ex(prog, (void*)(&param), traverse_inout);
+    char* path = pathify(filepath);
+    const char* value = langtable_find(get_table(path), desired_key);
 
-    if(param.value == NULL)
+    if(value == NULL)
         str_cpy(dest, NULL_STRING, dest_size);
     else
-        str_cpy(dest, param.value, dest_size);
+        str_cpy(dest, value, dest_size);
 
-    prog = nanoparser_deconstruct_tree(prog);
+    free(path);
     return dest;
 }
 
@@ -202,12 +193,14 @@ char* lang_metadata(const char* filepath, const char* desired_key, char* dest, s
  */
 char* lang_getstring(const char* desired_key, char* dest, size_t dest_size)
 {
-    const stringadapter_t *s = hashtable_stringadapter_t_find(strings, desired_key);
+    /* the topmost layer that has the key wins */
+    for(int i = layer_count - 1; i >= 0; i--) {
+        const char* value = langtable_find(layer[i], desired_key);
+        if(value != NULL)
+            return str_cpy(dest, value, dest_size);
+    }
 
-    if(s != NULL)
-        return str_cpy(dest, stringadapter_get_data(s), dest_size);
-    else
-        return str_cpy(dest, NULL_STRING, dest_size);
+    return str_cpy(dest, NULL_STRING, dest_size);
 }
 
 
@@ -253,42 +246,123 @@ void lang_compatibility(const char* filepath, int* supver, int* subver, int* wip
  */
 bool lang_haskey(const char* desired_key)
 {
-    const stringadapter_t *s = hashtable_stringadapter_t_find(strings, desired_key);
-    return s != NULL;
+    for(int i = layer_count - 1; i >= 0; i--) {
+        if(langtable_find(layer[i], desired_key) != NULL)
+            return true;
+    }
+
+    return false;
 }
 
 
+
+
 /* private stuff */
 
-int traverse(const parsetree_statement_t *stmt)
+/* stacks the layers of a language file: the default language, the file itself and its extension */
+void load_layers(const char* path)
 {
-    const char* id = nanoparser_get_identifier(stmt);
-    const parsetree_parameter_t *param_list = nanoparser_get_parameter_list(stmt);
-    const parsetree_parameter_t *p = nanoparser_get_nth_parameter(param_list, 1);
-    const char* key, *value;
-    stringadapter_t *s;
+    int supver, subver, wipver;
 
-    if(is_untranslated_entry(stmt))
-        return 0;
+    /* Check if the path is in the languages/ folder */
+    if(str_incmp(path, LANGUAGES_FOLDER, strlen(LANGUAGES_FOLDER)) != 0)
+        fatal_error("Won't load \"%s\". Language files are expected to be in the %s folder.", path, LANGUAGES_FOLDER);
 
-    if(nanoparser_get_number_of_parameters(param_list) != 1) 
-        fatal_error("Language file error: invalid syntax at line %d in\n\"%s\"", nanoparser_get_line_number(stmt), nanoparser_get_file(stmt));
+    /* Check if the path exists */
+    if(!asset_exists(path)) {
 
-    nanoparser_expect_string(p, "a string is expected after each key of the language file");
-    key = id;
-    value = nanoparser_get_string(p);
+        /* Crash if the default language file is missing */
+        if(0 == str_icmp(path, DEFAULT_LANGUAGE_FILEPATH))
+            fatal_error("Missing default language file: \"%s\". Please reinstall the game.", DEFAULT_LANGUAGE_FILEPATH);
 
-    if(NULL == (s = hashtable_stringadapter_t_find(strings, key)))
-        hashtable_stringadapter_t_add(strings, key, stringadapter_create(value));
-    else
-        stringadapter_set_data(s, value);
+        /* If some other language file is missing, we don't crash the application,
+           otherwise the player may get locked due to a corrupted save state */
+        logfile_message("Missing language file: \"%s\"", path);
+        layer_count = 0;
+        load_layers(DEFAULT_LANGUAGE_FILEPATH);
+        return;
 
-    return 0;
+    }
+
+    /* Check if the path points to a language extension */
+    bool is_language_extension = (
+        0 == str_incmp(path, LANGUAGES_FOLDER, strlen(LANGUAGES_FOLDER)) && /* already checked */
+        0 == str_incmp(path + strlen(LANGUAGES_FOLDER), EXTENDS_FOLDER, strlen(EXTENDS_FOLDER))
+    );
+    if(is_language_extension)
+        logfile_message("\"%s\" is a language extension", path);
+
+    /* Compatibility check */
+    lang_compatibility(path, &supver, &subver, &wipver);
+    if(game_version_compare(supver, subver, wipver) < 0) /* backwards compatibility */
+        fatal_error("Language file \"%s\" (version %d.%d.%d) is not compatible with this version of the engine (%s)!", path, supver, subver, wipver, GAME_VERSION_STRING);
+
+    /* Read the default language file to fill in any missing strings */
+    if(str_icmp(path, DEFAULT_LANGUAGE_FILEPATH) != 0)
+        load_layers(DEFAULT_LANGUAGE_FILEPATH);
+
+    /* Read language file to memory */
+    push_layer(path);
+
+    /* Check if there is a language extension available */
+    if(!is_language_extension) {
+        char* extpath = path_to_language_extension(path);
+
+        /* There is a language extension */
+        if(asset_exists(extpath)) {
+
+            /* Load language extension */
+            logfile_message("Loading language extension at \"%s\"...", extpath);
+            push_layer(extpath);
+
+        }
+        else
+            logfile_message("No language extension found at \"%s\"", extpath);
+
+        free(extpath);
+    }
 }
 
-int traverse_inout(const parsetree_statement_t *stmt, void *inout)
+/* stacks the compiled table of a language file on top of the current language */
+void push_layer(const char* path)
+{
+    if(layer_count >= MAX_LAYERS)
+        fatal_error("Can't stack language file \"%s\": too many layers", path);
+
+    layer[layer_count++] = get_table(path);
+}
+
+/* gets the compiled table of a language file, compiling it if necessary */
+const langtable_t* get_table(const char* path)
+{
+    langtable_t* table = hashtable_langtable_t_find(tables, path);
+
+    if(table == NULL) {
+        table = langtable_compile(path);
+        hashtable_langtable_t_add(tables, path, table);
+    }
+
+    return table;
+}
+
+
+/* compiles a language file into a new table */
+langtable_t* langtable_compile(const char* path)
+{
+    const char* fullpath = asset_path(path);
+    langtable_t* table = langtable_create();
+    parsetree_program_t* prog = nanoparser_construct_tree(fullpath);
+
+    nanoparser_traverse_program_ex(prog, (void*)table, traverse);
+    prog = nanoparser_deconstruct_tree(prog);
+
+    logfile_message("Compiled language file \"%s\": %d strings, %d bytes", path, table->count, table->blob_size);
+    return table;
+}
+
+/* adds the entries of a language file to a table */
+int traverse(const parsetree_statement_t *stmt, void *table)
 {
-    inout_t *x = (inout_t*)inout;
     const char* id = nanoparser_get_identifier(stmt);
     const parsetree_parameter_t *param_list = nanoparser_get_parameter_list(stmt);
     const parsetree_parameter_t *p = nanoparser_get_nth_parameter(param_list, 1);
@@ -300,10 +374,7 @@ int traverse_inout(const parsetree_statement_t *stmt, void *inout)
         fatal_error("Language file error: invalid syntax at line %d in\n\"%s\"", nanoparser_get_line_number(stmt), nanoparser_get_file(stmt));
 
     nanoparser_expect_string(p, "a string is expected after each key of the language file");
-    if(str_icmp(id, x->key) == 0) {
-        x->value = nanoparser_get_string(p);
-        return 1; /* stop the enumeration */
-    }
+    langtable_put((langtable_t*)table, id, nanoparser_get_string(p));
 
     return 0;
 }
@@ -326,28 +397,126 @@ bool is_untranslated_entry(const parsetree_statement_t *stmt)
     return (0 == str_icmp(id, UNTRANSLATED_STRING));
 }
 
-stringadapter_t* stringadapter_create(const char* data)
+/* creates an empty table */
+langtable_t* langtable_create()
 {
-    stringadapter_t *s = mallocx(sizeof *s);
-    s->data = str_dup(data);
-    return s;
+    langtable_t* table = mallocx(sizeof *table);
+
+    table->blob_size = 0;
+    table->blob_capacity = 1024;
+    table->blob = mallocx(table->blob_capacity * sizeof(*(table->blob)));
+
+    table->count = 0;
+    table->capacity = 64;
+    table->entry = mallocx(table->capacity * sizeof(*(table->entry)));
+    for(int i = 0; i < table->capacity; i++)
+        table->entry[i].key = -1;
+
+    return table;
 }
 
-void stringadapter_destroy(stringadapter_t *s)
+/* destroys a table */
+void langtable_destroy(langtable_t* table)
 {
-    free(s->data);
-    free(s);
+    free(table->entry);
+    free(table->blob);
+    free(table);
 }
 
-const char* stringadapter_get_data(const stringadapter_t *s)
+/* finds the value of a key (case-insensitive), or NULL if there is no such key */
+const char* langtable_find(const langtable_t* table, const char* key)
 {
-    return s->data;
+    uint32_t hash = hash_key(key);
+    uint32_t mask = (uint32_t)(table->capacity - 1);
+
+    /* linear probing; the index is never full */
+    for(uint32_t i = hash & mask; table->entry[i].key >= 0; i = (i + 1) & mask) {
+        const langentry_t* e = &(table->entry[i]);
+        if(e->hash == hash && str_icmp(table->blob + e->key, key) == 0)
+            return table->blob + e->value;
+    }
+
+    return NULL;
 }
 
-void stringadapter_set_data(stringadapter_t *s, const char* data)
+/* adds a key-value pair to a table, replacing the value of an existing key */
+void langtable_put(langtable_t* table, const char* key, const char* value)
 {
-    free(s->data);
-    s->data = str_dup(data);
+    uint32_t hash = hash_key(key);
+    uint32_t mask = (uint32_t)(table->capacity - 1);
+    uint32_t i;
+
+    for(i = hash & mask; table->entry[i].key >= 0; i = (i + 1) & mask) {
+        langentry_t* e = &(table->entry[i]);
+        if(e->hash == hash && str_icmp(table->blob + e->key, key) == 0) {
+            e->value = langtable_store(table, value);
+            return;
+        }
+    }
+
+    /* new entry */
+    table->entry[i].hash = hash;
+    table->entry[i].key = langtable_store(table, key);
+    table->entry[i].value = langtable_store(table, value);
+
+    /* keep the load factor at most 1/2 */
+    if(2 * (++table->count) > table->capacity)
+        langtable_grow(table);
+}
+
+/* copies a string to the blob of a table, returning its offset */
+int langtable_store(langtable_t* table, const char* str)
+{
+    int offset = table->blob_size;
+    int length = strlen(str) + 1;
+
+    if(table->blob_size + length > table->blob_capacity) {
+        while(table->blob_size + length > table->blob_capacity)
+            table->blob_capacity *= 2;
+        table->blob = reallocx(table->blob, table->blob_capacity * sizeof(*(table->blob)));
+    }
+
+    memcpy(table->blob + offset, str, length);
+    table->blob_size += length;
+    return offset;
+}
+
+/* doubles the capacity of the index of a table */
+void langtable_grow(langtable_t* table)
+{
+    langentry_t* old_entry = table->entry;
+    int old_capacity = table->capacity;
+    uint32_t mask;
+
+    table->capacity *= 2;
+    table->entry = mallocx(table->capacity * sizeof(*(table->entry)));
+    for(int i = 0; i < table->capacity; i++)
+        table->entry[i].key = -1;
+
+    mask = (uint32_t)(table->capacity - 1);
+    for(int j = 0; j < old_capacity; j++) {
+        if(old_entry[j].key >= 0) {
+            uint32_t i = old_entry[j].hash & mask;
+            while(table->entry[i].key >= 0)
+                i = (i + 1) & mask;
+            table->entry[i] = old_entry[j];
+        }
+    }
+
+    free(old_entry);
+}
+
+/* case-insensitive FNV-1a hash of a key */
+uint32_t hash_key(const char* key)
+{
+    uint32_t hash = 2166136261u;
+
+    while(*key) {
+        hash ^= (uint32_t)tolower((unsigned char)*(key++));
+        hash *= 16777619u;
+    }
+
+    return hash;
 }
 
 /* replace backslashes by slashes; you'll have to free this string afterwards */
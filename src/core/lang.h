@@ -28,6 +28,7 @@
 void lang_init();
 void lang_release();
 void lang_loadfile(const char* filepath);
+bool lang_reloadfile(const char* filepath); /* recompiles a modified language file (hot reload) */
 char* lang_getstring(const char* desired_key, char* dest, size_t dest_size);
 const char* lang_get(const char* desired_key);
 const char* lang_getid();
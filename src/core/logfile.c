@@ -21,10 +21,12 @@
 #include <allegro5/allegro.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 #include "logfile.h"
 #include "global.h"
 #include "asset.h"
 #include "../util/util.h"
+#include "../util/stringutil.h"
 
 
 
@@ -78,6 +80,40 @@ static void close_console();
 
 static ALLEGRO_MUTEX* mutex = NULL;
 
+/* buffered writer: the lines are appended to a ring buffer of bytes and
+   written to the output streams by a background thread, so that logging
+   never waits for the storage. Producers only hold the mutex to copy a line */
+#define RING_SIZE               262144 /* in bytes; must be a power of two */
+#define MAX_LINE_LENGTH         1024 /* longer lines are truncated */
+#define RECENT_LINES            32 /* recent lines kept for crash reports */
+
+static struct {
+    ALLEGRO_THREAD* thread; /* NULL if we're writing synchronously */
+    ALLEGRO_COND* wakeup; /* signaled when there is something to write */
+    ALLEGRO_COND* drained; /* signaled when the ring buffer has been written */
+    bool quit;
+
+    char ring[RING_SIZE]; /* lines terminated by LINE_BREAK */
+    unsigned head, tail; /* the writer reads at head; the producers write at tail */
+    int dropped; /* number of lines dropped because the ring buffer was full */
+
+    char last[MAX_LINE_LENGTH]; /* the last line, used to rate-limit repeated messages */
+    int repeat_count; /* how many times the last line has been repeated */
+
+    char recent[RECENT_LINES][MAX_LINE_LENGTH]; /* ring buffer of recent lines */
+    int recent_count, recent_next;
+} writer;
+
+static void emit(const char* line);
+static void emit_repeat_count();
+static void start_writer();
+static void stop_writer();
+static void* writer_thread(ALLEGRO_THREAD* thread, void* arg);
+static void write_bytes(const char* bytes, size_t size);
+
+#define LOCK(mutex)     do { if((mutex) != NULL) al_lock_mutex(mutex); } while(0)
+#define UNLOCK(mutex)   do { if((mutex) != NULL) al_unlock_mutex(mutex); } while(0)
+
 
 
 
@@ -97,12 +133,18 @@ void logfile_init(int flags)
 
 #if !defined(__ANDROID__)
     /* open the output streams */
+    stop_writer();
+
     if(flags & LOGFILE_TXT)
         open_logfile();
 
     if(flags & LOGFILE_CONSOLE)
         open_console();
+
+    start_writer();
 #else
+    (void)start_writer;
+    (void)stop_writer;
     (void)open_logfile;
     (void)open_console;
 #endif
@@ -129,47 +171,81 @@ void logfile_init(int flags)
 
 /*
  * logfile_message()
- * Prints a message to the logfile (printf format)
+ * Prints a message to the logfile (printf format).
+ * This doesn't wait for the message to be written
  */
 void logfile_message(const char* fmt, ...)
 {
-#if !defined(__ANDROID__)
-#define LOCK(mutex)     do { if((mutex) != NULL) al_lock_mutex(mutex); } while(0)
-#define UNLOCK(mutex)   do { if((mutex) != NULL) al_unlock_mutex(mutex); } while(0)
+    char line[MAX_LINE_LENGTH];
+    va_list args;
+
+    /* format the message */
+    va_start(args, fmt);
+    vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
 
     LOCK(mutex);
-    {
-        va_list args;
 
-        /* print the message */
-        va_start(args, fmt);
-        CALL(al_vfprintf, fmt, args);
-        va_end(args);
+    /* rate-limit repeated messages */
+    if(strcmp(line, writer.last) == 0) {
+        writer.repeat_count++;
+        UNLOCK(mutex);
+        return;
+    }
 
-        /* break line */
-        CALL(al_fputs, LINE_BREAK);
-        CALL(al_fflush);
+    emit_repeat_count();
+    str_cpy(writer.last, line, sizeof(writer.last));
+
+    /* print the message */
+    emit(line);
 
-        /* "PhysFS does not support the text-mode reading and writing,
-            which means that Windows-style newlines will not be preserved."
-            https://liballeg.org/a5docs/trunk/physfs.html */
+    UNLOCK(mutex);
+}
+
+/*
+ * logfile_flush()
+ * Waits until all pending messages have been written
+ */
+void logfile_flush()
+{
+    LOCK(mutex);
+    emit_repeat_count();
+
+    if(writer.thread != NULL) {
+        al_signal_cond(writer.wakeup);
+        while(writer.head != writer.tail)
+            al_wait_cond(writer.drained, mutex);
     }
+
     UNLOCK(mutex);
+}
 
-#undef UNLOCK
-#undef LOCK
-#else
+/*
+ * logfile_recent()
+ * Writes the most recent lines of the log to a buffer, oldest first.
+ * Useful for crash reports
+ */
+char* logfile_recent(char* buffer, size_t buffer_size)
+{
+    size_t length = 0;
 
-    va_list args;
+    if(buffer_size == 0)
+        return buffer;
 
-    va_start(args, fmt);
-    __android_log_vprint(ANDROID_LOG_INFO, GAME_UNIXNAME, fmt, args);
-    va_end(args);
+    LOCK(mutex);
 
-    /* logging functions from the Android NDK are atomic according to:
-       https://groups.google.com/g/android-ndk/c/lRG-wp1gQV0/m/cnpXcpjOBAAJ */
+    *buffer = '\0';
+    for(int i = 0; i < writer.recent_count; i++) {
+        int j = (writer.recent_next - writer.recent_count + i + RECENT_LINES) % RECENT_LINES;
+        length += snprintf(buffer + length, buffer_size - length, "%s\n", writer.recent[j]);
 
-#endif
+        if(length >= buffer_size - 1)
+            break;
+    }
+
+    UNLOCK(mutex);
+
+    return buffer;
 }
 
 
@@ -182,12 +258,21 @@ void logfile_release(int flags)
 {
     logfile_message("tchau!");
 
+    /* write the pending messages */
+    stop_writer();
+
     if(flags & LOGFILE_TXT)
         close_logfile();
 
     if(flags & LOGFILE_CONSOLE)
         close_console();
 
+    /* keep on writing to the other stream */
+    if(logfile != NULL || console != NULL) {
+        start_writer();
+        return;
+    }
+
     if(mutex != NULL) {
         al_destroy_mutex(mutex);
         mutex = NULL;
@@ -283,3 +368,177 @@ void close_console()
         console = NULL;
     }
 }
+
+/*
+ * emit()
+ * Prints a line. The mutex must be locked
+ */
+void emit(const char* line)
+{
+    /* remember the line */
+    str_cpy(writer.recent[writer.recent_next], line, MAX_LINE_LENGTH);
+    writer.recent_next = (writer.recent_next + 1) % RECENT_LINES;
+    writer.recent_count = min(writer.recent_count + 1, RECENT_LINES);
+
+#if !defined(__ANDROID__)
+
+    size_t length = strlen(line);
+
+    /* write synchronously */
+    if(writer.thread == NULL) {
+        write_bytes(line, length);
+        write_bytes(LINE_BREAK, sizeof(LINE_BREAK) - 1);
+        CALL(al_fflush);
+        return;
+    }
+
+    /* append the line to the ring buffer */
+    size_t size = length + (sizeof(LINE_BREAK) - 1);
+    if(size > RING_SIZE - (writer.tail - writer.head)) {
+        writer.dropped++;
+        return;
+    }
+
+    for(size_t i = 0; i < size; i++) {
+        char c = (i < length) ? line[i] : LINE_BREAK[i - length];
+        writer.ring[(writer.tail + i) & (RING_SIZE - 1)] = c;
+    }
+
+    writer.tail += size;
+    al_signal_cond(writer.wakeup);
+
+#else
+
+    __android_log_write(ANDROID_LOG_INFO, GAME_UNIXNAME, line);
+
+    /* logging functions from the Android NDK are atomic according to:
+       https://groups.google.com/g/android-ndk/c/lRG-wp1gQV0/m/cnpXcpjOBAAJ */
+
+#endif
+}
+
+/*
+ * emit_repeat_count()
+ * Reports how many times the last message has been repeated, if it has been
+ * repeated at all. The mutex must be locked
+ */
+void emit_repeat_count()
+{
+    if(writer.repeat_count > 0) {
+        char line[64];
+        snprintf(line, sizeof(line), "(the last message was repeated %d times)", writer.repeat_count);
+        writer.repeat_count = 0;
+        emit(line);
+    }
+}
+
+/*
+ * start_writer()
+ * Starts the thread that writes the logs to the output streams
+ */
+void start_writer()
+{
+    if(writer.thread != NULL || (logfile == NULL && console == NULL))
+        return;
+
+    writer.quit = false;
+    writer.head = writer.tail = 0;
+    writer.dropped = 0;
+    writer.wakeup = al_create_cond();
+    writer.drained = al_create_cond();
+
+    if(NULL == (writer.thread = al_create_thread(writer_thread, NULL))) {
+        ERROR("Can't create the logfile thread. Writing synchronously...\n");
+        al_destroy_cond(writer.drained);
+        al_destroy_cond(writer.wakeup);
+        return;
+    }
+
+    al_start_thread(writer.thread);
+}
+
+/*
+ * stop_writer()
+ * Writes the pending messages and stops the writer thread
+ */
+void stop_writer()
+{
+    if(writer.thread == NULL)
+        return;
+
+    LOCK(mutex);
+    emit_repeat_count();
+    writer.quit = true;
+    al_signal_cond(writer.wakeup);
+    UNLOCK(mutex);
+
+    al_join_thread(writer.thread, NULL);
+    al_destroy_thread(writer.thread);
+    writer.thread = NULL;
+
+    al_destroy_cond(writer.drained);
+    al_destroy_cond(writer.wakeup);
+}
+
+/*
+ * writer_thread()
+ * Writes the contents of the ring buffer to the output streams.
+ * The ring buffer is drained before quitting
+ */
+void* writer_thread(ALLEGRO_THREAD* thread, void* arg)
+{
+    al_lock_mutex(mutex);
+
+    for(;;) {
+        while(writer.head == writer.tail && writer.dropped == 0 && !writer.quit)
+            al_wait_cond(writer.wakeup, mutex);
+
+        if(writer.head == writer.tail && writer.dropped == 0)
+            break; /* quit */
+
+        /* the producers don't touch [head, tail) */
+        unsigned head = writer.head, tail = writer.tail;
+        int dropped = writer.dropped;
+        writer.dropped = 0;
+        al_unlock_mutex(mutex);
+
+        /* write without holding the mutex */
+        unsigned begin = head & (RING_SIZE - 1), end = tail & (RING_SIZE - 1);
+        if(tail - head > 0 && begin >= end) {
+            write_bytes(writer.ring + begin, RING_SIZE - begin);
+            write_bytes(writer.ring, end);
+        }
+        else
+            write_bytes(writer.ring + begin, end - begin);
+
+        if(dropped > 0) {
+            char line[64];
+            int length = snprintf(line, sizeof(line), "(%d log messages were dropped)" LINE_BREAK, dropped);
+            write_bytes(line, length);
+        }
+
+        CALL(al_fflush);
+
+        /* release the written bytes */
+        al_lock_mutex(mutex);
+        writer.head = tail;
+        al_broadcast_cond(writer.drained);
+    }
+
+    al_unlock_mutex(mutex);
+    return NULL;
+}
+
+/*
+ * write_bytes()
+ * Writes raw bytes to the output streams
+ */
+void write_bytes(const char* bytes, size_t size)
+{
+    if(size > 0)
+        CALL(al_fwrite, bytes, size);
+
+    /* "PhysFS does not support the text-mode reading and writing,
+        which means that Windows-style newlines will not be preserved."
+        https://liballeg.org/a5docs/trunk/physfs.html */
+}
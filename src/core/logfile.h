@@ -21,12 +21,16 @@
 #ifndef _LOGFILE_H
 #define _LOGFILE_H
 
+#include <stddef.h>
+
 /* logfile flags */
 #define LOGFILE_TXT         0x1 /* requires the asset manager to be initialized */
 #define LOGFILE_CONSOLE     0x2 /* will print logs to stdout */
 
 void logfile_init(int flags); /* initializes the logfile module */
 void logfile_message(const char *fmt, ...); /* prints a message to the logfile (printf style) */
+void logfile_flush(); /* waits until all pending messages have been written */
+char* logfile_recent(char* buffer, size_t buffer_size); /* the most recent lines of the log, for crash reports */
 void logfile_release(int flags); /* releases the logfile module */
 
 #endif
@@ -30,6 +30,8 @@
 #include "engine.h"
 #include "global.h"
 #include "../util/darray.h"
+#include "../util/djb2.h"
+#include "../util/internset.h"
 #include "../util/util.h"
 #include "../util/stringutil.h"
 
@@ -87,6 +89,43 @@ static const int ERROR_PREFIX_LENGTH = sizeof(_ERROR_PREFIX) - 1;
 
 
 
+/*
+ * MEMORY ARENA
+ */
+
+/* The nodes and the strings of a parse tree are allocated in a few large
+   blocks owned by its root, so that the whole tree is released at once */
+
+#define ARENA_BLOCK_SIZE 16384 /* default size of a block, in bytes */
+#define ARENA_ALIGNMENT 8 /* use 2^n */
+
+typedef struct nanoarenablock_t nanoarenablock_t;
+struct nanoarenablock_t
+{
+    nanoarenablock_t* next; /* previously allocated block */
+    size_t size; /* capacity of data[], in bytes */
+    size_t used; /* bytes of data[] in use */
+    char data[]; /* aligned to ARENA_ALIGNMENT */
+};
+
+typedef struct nanoarena_t nanoarena_t;
+struct nanoarena_t
+{
+    nanoarenablock_t* block; /* current block; head of a linked list */
+    internset_t* interned; /* the strings of the arena, used while constructing the tree; may be NULL */
+};
+
+static void arena_init(nanoarena_t* arena);
+static void arena_release(nanoarena_t* arena);
+static void arena_finish(nanoarena_t* arena);
+static void* arena_alloc(nanoarena_t* arena, size_t size);
+static const char* arena_intern(nanoarena_t* arena, const char* string);
+static uintptr_t arena_store_string(const char* string, void* arena);
+static const char* arena_lookup_string(uintptr_t key, const void* arena);
+
+
+
+
 /*
  * BASIC TYPES
  */
@@ -104,13 +143,14 @@ typedef struct parsetree_root_t parsetree_root_t;
 struct parsetree_root_t
 {
     parsetree_program_t program; /* base class */
-    char* filepath; /* path to the source file */
+    const char* filepath; /* path to the source file */
+    nanoarena_t arena; /* memory of the parse tree */
 };
 
 /* A statement is an identifier followed by a (possibly empty) list of parameters */
 struct parsetree_statement_t
 {
-    char* identifier; /* an identifier */
+    const char* identifier; /* an identifier */
     parsetree_parameter_t* parameter; /* a list of parameters */
     int line; /* line number in the source file associated with the program */
     const parsetree_program_t* program; /* the program to which this statement belongs */
@@ -123,7 +163,7 @@ struct parsetree_parameter_t
 {
     enum { PARAMETER_STRING, PARAMETER_BLOCK } type;
     union {
-        char* string;
+        const char* string;
         parsetree_program_t* program;
     };
     const parsetree_statement_t* statement; /* the statement to which this parameter belongs */
@@ -139,9 +179,7 @@ static const parsetree_parameter_t NULL_PARAMETER = {
 };
 
 static int traverse_adapter(const parsetree_statement_t* statement, void* user_data);
-static parsetree_program_t* release_program(parsetree_program_t* program);
-static parsetree_statement_t* release_statement(parsetree_statement_t* statement);
-static parsetree_parameter_t* release_parameter(parsetree_parameter_t* parameter);
+static parsetree_root_t* create_root(const char* filepath);
 
 
 
@@ -189,14 +227,13 @@ struct nanotoken_t
  */
 
 #define LEXER_SYMBOL_MAXLENGTH 4095 /* long strings; use 2^n - 1 */
-#define LEXER_BUFFER_SIZE 4096 /* use 2^n */
+#define LEXER_CHUNK_SIZE 65536 /* used when the size of the file is unknown */
 
 typedef struct nanofilestate_t nanofilestate_t;
 struct nanofilestate_t
 {
-    ALLEGRO_FILE* fp;
-    int cursor;
-    char buffer[2 * LEXER_BUFFER_SIZE];
+    const char* cursor; /* the whole file is in memory */
+    const char* end;
     int line;
     int last;
     bool locked;
@@ -212,9 +249,11 @@ struct nanolexer_t
 static nanolexer_t* lexer_create(const char* filepath);
 static nanolexer_t* lexer_destroy(nanolexer_t* lexer);
 
-static bool lexer_read(nanolexer_t* lexer, ALLEGRO_FILE* fp);
-static int lexer_getc(nanofilestate_t* state);
-static int lexer_ungetc(nanofilestate_t* state);
+static bool lexer_read(nanolexer_t* lexer, const char* data, size_t size);
+static char* lexer_load(ALLEGRO_FILE* fp, size_t* size);
+static inline int lexer_getc(nanofilestate_t* state);
+static inline int lexer_ungetc(nanofilestate_t* state);
+static inline void lexer_skipline(nanofilestate_t* state);
 
 
 
@@ -227,8 +266,10 @@ struct nanoparser_t
 {
     const nanolexer_t* lexer;
     int cursor;
+    nanoarena_t* arena; /* memory of the parse tree */
 };
 
+static bool is_legacy_mode();
 static nanoparser_t* parser_create(const nanolexer_t* lexer);
 static nanoparser_t* parser_destroy(nanoparser_t* parser);
 
@@ -245,6 +286,89 @@ static parsetree_parameter_t* parser_parse_parameter(nanoparser_t* parser, const
 
 
 
+/*
+ * BINARY CACHE
+ */
+
+/* Parse trees may be cached in a compact binary format, so that we don't need
+   to lex and parse the same files whenever the engine starts. A cache file has
+   a header followed by a string table and by flat arrays of statements and
+   parameters that refer to each other by index. All data is stored in the
+   native byte order; a foreign cache file fails the magic number test */
+
+#define CACHE_MAGIC 0x3142504E /* "NPB1" */
+#define CACHE_FORMAT_VERSION 1
+#define CACHE_EXTENSION ".bin"
+#define CACHE_NONE (-1) /* null index */
+#define CACHE_PATH_MAXLENGTH 1023
+
+typedef struct nanocacheheader_t nanocacheheader_t;
+struct nanocacheheader_t
+{
+    uint32_t magic; /* CACHE_MAGIC */
+    uint32_t format_version; /* CACHE_FORMAT_VERSION */
+    uint32_t engine_version; /* hash of GAME_VERSION_STRING */
+    uint32_t legacy_mode; /* was the source file read in legacy mode? */
+    int64_t source_size; /* size of the source file, in bytes */
+    int64_t source_mtime; /* modification time of the source file */
+    int32_t string_table_size; /* size of the string table, in bytes */
+    int32_t statement_count; /* length of the array of statements */
+    int32_t parameter_count; /* length of the array of parameters */
+    int32_t root; /* index of the first statement of the root program or CACHE_NONE */
+};
+
+typedef struct nanocachestatement_t nanocachestatement_t;
+struct nanocachestatement_t
+{
+    int32_t identifier; /* offset in the string table */
+    int32_t line; /* line number */
+    int32_t parameter; /* index of the first parameter or CACHE_NONE */
+    int32_t next; /* index of the next statement or CACHE_NONE */
+};
+
+typedef struct nanocacheparameter_t nanocacheparameter_t;
+struct nanocacheparameter_t
+{
+    int32_t type; /* PARAMETER_STRING or PARAMETER_BLOCK */
+    int32_t value; /* string: offset in the string table; block: index of its first statement or CACHE_NONE */
+    int32_t next; /* index of the next parameter or CACHE_NONE */
+};
+
+typedef struct nanocachewriter_t nanocachewriter_t;
+struct nanocachewriter_t
+{
+    DARRAY(char, string_table);
+    DARRAY(nanocachestatement_t, statement);
+    DARRAY(nanocacheparameter_t, parameter);
+    internset_t* interned; /* offsets of the string table, used to store each string only once */
+};
+
+typedef struct nanocachereader_t nanocachereader_t;
+struct nanocachereader_t
+{
+    const nanocacheheader_t* header;
+    const char* string_table;
+    const nanocachestatement_t* statement;
+    const nanocacheparameter_t* parameter;
+    bool* visited; /* statements and parameters already read; detects cycles in corrupt files */
+    nanoarena_t* arena; /* memory of the parse tree */
+};
+
+static char* cache_dir = NULL; /* virtual path of the cache directory; NULL if the cache is disabled */
+
+static bool cache_prepare(const char* filepath, char* cache_path, size_t cache_path_size, nanocacheheader_t* header);
+static parsetree_root_t* cache_read(const char* cache_path, const char* filepath, const nanocacheheader_t* expected_header);
+static bool cache_write(const char* cache_path, const parsetree_root_t* root, const nanocacheheader_t* header);
+static int32_t cache_write_statements(nanocachewriter_t* writer, const parsetree_statement_t* statement);
+static int32_t cache_intern_string(nanocachewriter_t* writer, const char* string);
+static uintptr_t cache_store_string(const char* string, void* writer);
+static const char* cache_lookup_string(uintptr_t key, const void* writer);
+static parsetree_statement_t* cache_read_statements(nanocachereader_t* reader, int32_t index, const parsetree_program_t* program, bool* error);
+static parsetree_parameter_t* cache_read_parameters(nanocachereader_t* reader, int32_t index, const parsetree_statement_t* statement, bool* error);
+static const char* cache_string(const nanocachereader_t* reader, int32_t offset);
+
+
+
 
 /*
  * LOADING & UNLOADING
@@ -257,6 +381,20 @@ static parsetree_parameter_t* parser_parse_parameter(nanoparser_t* parser, const
  */
 parsetree_program_t* nanoparser_construct_tree(const char* filepath)
 {
+    char cache_path[CACHE_PATH_MAXLENGTH + 1];
+    nanocacheheader_t header;
+    bool use_cache = cache_prepare(filepath, cache_path, sizeof(cache_path), &header);
+
+    /* read the parse tree from the cache, if it's up to date */
+    if(use_cache) {
+        parsetree_root_t* cached_root = cache_read(cache_path, filepath, &header);
+        if(cached_root != NULL) {
+            warning("Reading file %s from the cache...", filepath);
+            arena_finish(&(cached_root->arena));
+            return (parsetree_program_t*)cached_root;
+        }
+    }
+
     warning("Reading file %s...", filepath);
 
     nanolexer_t* lexer = lexer_create(filepath);
@@ -266,6 +404,11 @@ parsetree_program_t* nanoparser_construct_tree(const char* filepath)
 
     parser_destroy(parser);
     lexer_destroy(lexer);
+    arena_finish(&(root->arena));
+
+    /* cache the parse tree */
+    if(use_cache && !cache_write(cache_path, root, &header))
+        warning("Can't write the cache file %s", cache_path);
 
     return (parsetree_program_t*)root;
 }
@@ -276,65 +419,39 @@ parsetree_program_t* nanoparser_construct_tree(const char* filepath)
  */
 parsetree_program_t* nanoparser_deconstruct_tree(parsetree_program_t* root)
 {
-    free(((parsetree_root_t*)root)->filepath);
-    return release_program(root);
-}
-
-/*
- * release_program()
- * Release a program
- */
-parsetree_program_t* release_program(parsetree_program_t* program)
-{
-    release_statement(program->statement);
-    free(program);
+    arena_release(&(((parsetree_root_t*)root)->arena));
+    free(root);
 
     return NULL;
 }
 
 /*
- * release_statement()
- * Release a list of statements
+ * nanoparser_set_cache_directory()
+ * Cache the parse trees in the given directory, specified without a trailing
+ * slash. Pass NULL to disable the cache
  */
-parsetree_statement_t* release_statement(parsetree_statement_t* statement)
+void nanoparser_set_cache_directory(const char* dirpath)
 {
-    while(statement != NULL) {
-        parsetree_statement_t* next = statement->next;
-
-        release_parameter(statement->parameter);
-        free(statement->identifier);
-        free(statement);
+    if(cache_dir != NULL)
+        free(cache_dir);
 
-        statement = next;
-    }
-
-    return NULL;
+    cache_dir = (dirpath != NULL) ? str_dup(dirpath) : NULL;
 }
 
 /*
- * release_parameter()
- * Release a list of parameters
+ * create_root()
+ * Create an empty root of a parse tree, with its own memory arena
  */
-parsetree_parameter_t* release_parameter(parsetree_parameter_t* parameter)
+parsetree_root_t* create_root(const char* filepath)
 {
-    while(parameter != NULL) {
-        parsetree_parameter_t* next = parameter->next;
-
-        switch(parameter->type) {
-            case PARAMETER_STRING:
-                free(parameter->string);
-                break;
-
-            case PARAMETER_BLOCK:
-                release_program(parameter->program);
-                break;
-        }
+    parsetree_root_t* root = mallocx(sizeof *root);
 
-        free(parameter);
-        parameter = next;
-    }
+    arena_init(&(root->arena));
+    root->filepath = arena_intern(&(root->arena), filepath);
+    root->program.statement = NULL;
+    root->program.parent = NULL;
 
-    return NULL;
+    return root;
 }
 
 
@@ -530,6 +647,112 @@ const parsetree_statement_t* nanoparser_get_statement(const parsetree_parameter_
 
 
 
+/*
+ * MEMORY ARENA
+ */
+
+/*
+ * arena_init()
+ * Initialize an empty arena
+ */
+void arena_init(nanoarena_t* arena)
+{
+    arena->block = NULL;
+    arena->interned = internset_create(64, arena_store_string, arena_lookup_string, arena);
+}
+
+/*
+ * arena_release()
+ * Release all memory of an arena
+ */
+void arena_release(nanoarena_t* arena)
+{
+    while(arena->block != NULL) {
+        nanoarenablock_t* next = arena->block->next;
+        free(arena->block);
+        arena->block = next;
+    }
+
+    arena_finish(arena);
+}
+
+/*
+ * arena_finish()
+ * Stop interning strings. Call this when the tree has been constructed
+ */
+void arena_finish(nanoarena_t* arena)
+{
+    if(arena->interned != NULL)
+        arena->interned = internset_destroy(arena->interned);
+}
+
+/*
+ * arena_alloc()
+ * Allocate memory from an arena. It will be released with the arena
+ */
+void* arena_alloc(nanoarena_t* arena, size_t size)
+{
+    nanoarenablock_t* block = arena->block;
+
+    /* keep the allocations aligned */
+    size = (size + (ARENA_ALIGNMENT - 1)) & ~((size_t)(ARENA_ALIGNMENT - 1));
+
+    /* allocate a new block if necessary */
+    if(block == NULL || block->used + size > block->size) {
+        size_t block_size = (size > ARENA_BLOCK_SIZE) ? size : ARENA_BLOCK_SIZE;
+        size_t header_size = (sizeof(nanoarenablock_t) + (ARENA_ALIGNMENT - 1)) & ~((size_t)(ARENA_ALIGNMENT - 1));
+
+        block = mallocx(header_size + block_size);
+        block->size = block_size + (header_size - sizeof(nanoarenablock_t));
+        block->used = header_size - sizeof(nanoarenablock_t);
+        block->next = arena->block;
+        arena->block = block;
+    }
+
+    /* bump allocation */
+    void* ptr = block->data + block->used;
+    block->used += size;
+
+    return ptr;
+}
+
+/*
+ * arena_intern()
+ * Copy a string to the arena, unless an equal string is already there
+ */
+const char* arena_intern(nanoarena_t* arena, const char* string)
+{
+    if(arena->interned != NULL)
+        return (const char*)internset_intern(arena->interned, string);
+    else
+        return (const char*)arena_store_string(string, arena);
+}
+
+/*
+ * arena_store_string()
+ * Copy a string to the arena, returning the address of the copy
+ */
+uintptr_t arena_store_string(const char* string, void* arena)
+{
+    size_t size = strlen(string) + 1;
+    char* copy = memcpy(arena_alloc((nanoarena_t*)arena, size), string, size);
+
+    return (uintptr_t)copy;
+}
+
+/*
+ * arena_lookup_string()
+ * The string stored at an address of the arena
+ */
+const char* arena_lookup_string(uintptr_t key, const void* arena)
+{
+    return (const char*)key;
+}
+
+
+
+
+
 /*
  * LEXICAL ANALYSIS
  */
@@ -550,15 +773,25 @@ nanolexer_t* lexer_create(const char* filepath)
         return NULL;
     }
 
+    /* read the whole file */
+    size_t size = 0;
+    char* data = lexer_load(fp, &size);
+    al_fclose(fp);
+
+    if(data == NULL) {
+        crash("Can't read file %s", filepath);
+        return NULL;
+    }
+
     /* initialize the lexer */
     nanolexer_t* lexer = mallocx(sizeof *lexer);
     lexer->filepath = str_dup(filepath);
     darray_init(lexer->token);
 
     /* read the tokens */
-    if(!lexer_read(lexer, fp)) {
+    if(!lexer_read(lexer, data, size)) {
         lexer = lexer_destroy(lexer);
-        al_fclose(fp);
+        free(data);
         crash("Can't read the tokens of %s", filepath);
         return NULL;
     }
@@ -570,7 +803,7 @@ nanolexer_t* lexer_create(const char* filepath)
     #endif
 
     /* done! */
-    al_fclose(fp);
+    free(data);
     return lexer;
 }
 
@@ -590,16 +823,54 @@ nanolexer_t* lexer_destroy(nanolexer_t* lexer)
     return NULL;
 }
 
+/*
+ * lexer_load()
+ * Reads the contents of a file into memory.
+ * Returns NULL on error
+ */
+char* lexer_load(ALLEGRO_FILE* fp, size_t* size)
+{
+    int64_t file_size = al_fsize(fp);
+    char* data = NULL;
+
+    /* we know the size of the file */
+    if(file_size >= 0) {
+        if(file_size > INT32_MAX)
+            return NULL;
+
+        data = mallocx(file_size + 1);
+        if(al_fread(fp, data, file_size) != (size_t)file_size) {
+            free(data);
+            return NULL;
+        }
+
+        *size = file_size;
+        return data;
+    }
+
+    /* we don't know the size of the file */
+    size_t capacity = 0, read_bytes;
+    *size = 0;
+
+    do {
+        if(*size + LEXER_CHUNK_SIZE > capacity) {
+            capacity += LEXER_CHUNK_SIZE;
+            data = reallocx(data, capacity);
+        }
+
+        read_bytes = al_fread(fp, data + *size, LEXER_CHUNK_SIZE);
+        *size += read_bytes;
+    } while(read_bytes == LEXER_CHUNK_SIZE);
+
+    return data;
+}
+
 /*
  * lexer_getc()
  * Get a character from the file
  */
 int lexer_getc(nanofilestate_t* state)
 {
-    int* j = &(state->cursor);
-    size_t read_bytes;
-    char c;
-
     if(state->locked) {
         state->locked = false;
         return state->last;
@@ -608,47 +879,36 @@ int lexer_getc(nanofilestate_t* state)
     if(state->last == '\n')
         ++state->line;
 
-    while(true) {
-
-        if(0 == (c = state->buffer[(*j)++])) { /* end of buffer or file */
-
-            if(*j == LEXER_BUFFER_SIZE) {
-                /* the first buffer has been processed; now read to the second buffer */
-                /*memset(state->buffer + LEXER_BUFFER_SIZE, 0, LEXER_BUFFER_SIZE);*/
-                read_bytes = al_fread(state->fp, state->buffer + LEXER_BUFFER_SIZE, LEXER_BUFFER_SIZE - 1);
-                state->buffer[LEXER_BUFFER_SIZE + read_bytes] = 0;
-            }
-            else if(*j == 2 * LEXER_BUFFER_SIZE) {
-                /* the second buffer has been processed; now read to the first buffer */
-                /*memset(state->buffer, 0, LEXER_BUFFER_SIZE);*/
-                read_bytes = al_fread(state->fp, state->buffer, LEXER_BUFFER_SIZE - 1);
-                state->buffer[read_bytes] = 0;
-                *j = 0;
-            }
-            else {
-                /* end of file */
-                return (state->last = EOF);
-            }
+    while(state->cursor < state->end) {
+        char c = *(state->cursor++);
 
-            /* end of buffer: read next char */
-            /* loop */ ;
+        /* ignore CR; physfs reads files in binary mode only */
+        if(c == '\r')
+            continue;
 
-        }
-        else {
-
-            /* ignore CR; physfs reads files in binary mode only */
-            if(c == '\r')
-                continue;
+        /* a null character ends the file */
+        if(c == '\0')
+            break;
 
-            /* we're not done reading yet */
-            /*putchar(c);*/
-            return (state->last = (int)c); /* not 0 */
+        /* we're not done reading yet */
+        return (state->last = (int)c); /* not 0 */
+    }
 
-        }
+    state->cursor = state->end;
+    return (state->last = EOF);
+}
 
-    }
+/*
+ * lexer_skipline()
+ * Skips the characters up to (but not including) the next line break.
+ * This scans the memory in bulk; memchr() is vectorized by the C library
+ */
+void lexer_skipline(nanofilestate_t* state)
+{
+    nanoassert(!state->locked);
 
-    return EOF;
+    const char* linebreak = memchr(state->cursor, '\n', state->end - state->cursor);
+    state->cursor = (linebreak != NULL) ? linebreak : state->end;
 }
 
 /*
@@ -666,29 +926,22 @@ int lexer_ungetc(nanofilestate_t* state)
  * lexer_read()
  * Reads all tokens from the file
  */
-bool lexer_read(nanolexer_t* lexer, ALLEGRO_FILE* fp)
+bool lexer_read(nanolexer_t* lexer, const char* data, size_t size)
 {
     char symbol_buffer[LEXER_SYMBOL_MAXLENGTH + 1];
     int symbol_length;
     int peek, next;
     nanotoken_t token;
     nanofilestate_t state = {
-        .fp = fp,
-        .cursor = 0,
-        .buffer = { 0 },
+        .cursor = data,
+        .end = data + size,
         .line = 1,
         .last = EOF,
         .locked = false
     };
 
-    /* initialize */
-    /*memset(state.buffer, 0, LEXER_BUFFER_SIZE);*/
-    size_t read_bytes = al_fread(fp, state.buffer, LEXER_BUFFER_SIZE - 1);
-    state.buffer[read_bytes] = state.buffer[LEXER_BUFFER_SIZE - 1] = state.buffer[2 * LEXER_BUFFER_SIZE - 1] = 0;
-
-    /* legacy mode for backwards compatibility with nanoparser v1;
-       nanoparser was rewritten on Open Surge 0.6.1 with a stricter syntax */
-    bool legacy_mode = (engine_compatibility_version_code() < VERSION_CODE(0,6,1));
+    /* legacy mode for backwards compatibility with nanoparser v1 */
+    bool legacy_mode = is_legacy_mode();
 
     #if 0
     /* debug */
@@ -715,12 +968,7 @@ bool lexer_read(nanolexer_t* lexer, ALLEGRO_FILE* fp)
             if(next == '/') {
 
                 /* consume the characters */
-                while(EOF != (peek = lexer_getc(&state))) {
-                    if(peek == '\n') {
-                        lexer_ungetc(&state);
-                        break;
-                    }
-                }
+                lexer_skipline(&state);
 
                 /* skip spaces */
                 continue;
@@ -770,12 +1018,7 @@ bool lexer_read(nanolexer_t* lexer, ALLEGRO_FILE* fp)
                     warning("Obsolete: ignored preprocessor directive at %s:%d", lexer->filepath, state.line);
 
                 /* treat it as a single-line comment */
-                while(EOF != (peek = lexer_getc(&state))) {
-                    if(peek == '\n') {
-                        lexer_ungetc(&state);
-                        break;
-                    }
-                }
+                lexer_skipline(&state);
 
                 /* skip spaces */
                 continue;
@@ -982,6 +1225,17 @@ bool lexer_read(nanolexer_t* lexer, ALLEGRO_FILE* fp)
 }
 
 
+/*
+ * is_legacy_mode()
+ * Legacy mode is for backwards compatibility with nanoparser v1;
+ * nanoparser was rewritten on Open Surge 0.6.1 with a stricter syntax
+ */
+bool is_legacy_mode()
+{
+    return engine_compatibility_version_code() < VERSION_CODE(0,6,1);
+}
+
+
 /*
  * SYNTAX ANALYSIS
  */
@@ -996,6 +1250,7 @@ nanoparser_t* parser_create(const nanolexer_t* lexer)
 
     parser->lexer = lexer;
     parser->cursor = 0;
+    parser->arena = NULL;
 
     return parser;
 }
@@ -1078,14 +1333,13 @@ void parser_unmatch(nanoparser_t* parser, nanotokentype_t token_type)
 parsetree_root_t* parser_parse_root(nanoparser_t* parser)
 {
     /* create root program */
-    parsetree_root_t* root = mallocx(sizeof *root);
-    root->filepath = str_dup(parser->lexer->filepath);
+    parsetree_root_t* root = create_root(parser->lexer->filepath);
+    parser->arena = &(root->arena);
 
 
 
     /* read program */
     parsetree_program_t* program = (parsetree_program_t*)root;
-    program->parent = NULL;
 
     /* skip empty lines */
     while(parser_check(parser, TOKEN_LINEBREAK))
@@ -1113,7 +1367,7 @@ parsetree_root_t* parser_parse_root(nanoparser_t* parser)
 parsetree_program_t* parser_parse_program(nanoparser_t* parser, const parsetree_program_t* parent)
 {
     /* create program */
-    parsetree_program_t* program = mallocx(sizeof *program);
+    parsetree_program_t* program = arena_alloc(parser->arena, sizeof *program);
     program->parent = parent;
 
     /* skip empty lines */
@@ -1141,14 +1395,14 @@ parsetree_statement_t* parser_parse_statement(nanoparser_t* parser, const parset
     parser_expect(parser, TOKEN_IDENTIFIER);
 
     /* read statement(s) */
-    parsetree_statement_t* head = mallocx(sizeof *head);
+    parsetree_statement_t* head = arena_alloc(parser->arena, sizeof *head);
     parsetree_statement_t* statement = head;
     do {
         const nanotoken_t* lookahead = parser_lookahead(parser);
 
         /* read the identifier */
         statement->program = program;
-        statement->identifier = memcpy(mallocx(lookahead->value_size), lookahead->value, lookahead->value_size);
+        statement->identifier = arena_intern(parser->arena, lookahead->value);
         statement->line = lookahead->line;
         statement->next = NULL;
         parser_match(parser, TOKEN_IDENTIFIER);
@@ -1163,7 +1417,7 @@ parsetree_statement_t* parser_parse_statement(nanoparser_t* parser, const parset
 
         /* prepare to read the next statement */
         if(parser_check(parser, TOKEN_IDENTIFIER))
-            statement->next = mallocx(sizeof *(statement->next));
+            statement->next = arena_alloc(parser->arena, sizeof *(statement->next));
 
         /* next node */
         statement = statement->next;
@@ -1190,11 +1444,11 @@ parsetree_parameter_t* parser_parse_parameter(nanoparser_t* parser, const parset
 
     if(parser_check(parser, TOKEN_STRING)) {
         /* read string */
-        parsetree_parameter_t* parameter = mallocx(sizeof *parameter);
+        parsetree_parameter_t* parameter = arena_alloc(parser->arena, sizeof *parameter);
 
         parameter->type = PARAMETER_STRING;
         parameter->statement = statement;
-        parameter->string = memcpy(mallocx(lookahead->value_size), lookahead->value, lookahead->value_size);
+        parameter->string = arena_intern(parser->arena, lookahead->value);
         parser_match(parser, TOKEN_STRING);
         parameter->next = parser_parse_parameter(parser, statement);
 
@@ -1202,11 +1456,11 @@ parsetree_parameter_t* parser_parse_parameter(nanoparser_t* parser, const parset
     }
     else if(parser_check(parser, TOKEN_IDENTIFIER)) {
         /* read identifier */
-        parsetree_parameter_t* parameter = mallocx(sizeof *parameter);
+        parsetree_parameter_t* parameter = arena_alloc(parser->arena, sizeof *parameter);
 
         parameter->type = PARAMETER_STRING;
         parameter->statement = statement;
-        parameter->string = memcpy(mallocx(lookahead->value_size), lookahead->value, lookahead->value_size);
+        parameter->string = arena_intern(parser->arena, lookahead->value);
         parser_match(parser, TOKEN_IDENTIFIER);
         parameter->next = parser_parse_parameter(parser, statement);
 
@@ -1221,7 +1475,7 @@ parsetree_parameter_t* parser_parse_parameter(nanoparser_t* parser, const parset
 
         /* read block */
         if(parser_check(parser, TOKEN_BLOCKSTART)) {
-            parsetree_parameter_t* parameter = mallocx(sizeof *parameter);
+            parsetree_parameter_t* parameter = arena_alloc(parser->arena, sizeof *parameter);
 
             parameter->type = PARAMETER_BLOCK;
             parameter->statement = statement;
@@ -1250,6 +1504,380 @@ parsetree_parameter_t* parser_parse_parameter(nanoparser_t* parser, const parset
 
 
 
+/*
+ * BINARY CACHE
+ */
+
+/*
+ * cache_prepare()
+ * Find the path of the cache file of the given source file and fill in the
+ * header that an up-to-date cache file must have. Returns false if there
+ * is no cache
+ */
+bool cache_prepare(const char* filepath, char* cache_path, size_t cache_path_size, nanocacheheader_t* header)
+{
+    /* is the cache enabled? */
+    if(cache_dir == NULL)
+        return false;
+
+    /* a cache file is valid only for a specific version of the source file */
+    ALLEGRO_FS_ENTRY* entry = al_create_fs_entry(filepath);
+    if(entry == NULL)
+        return false;
+    else if(!al_fs_entry_exists(entry) || !(al_get_fs_entry_mode(entry) & ALLEGRO_FILEMODE_ISFILE)) {
+        al_destroy_fs_entry(entry);
+        return false;
+    }
+
+    memset(header, 0, sizeof(*header));
+    header->magic = CACHE_MAGIC;
+    header->format_version = CACHE_FORMAT_VERSION;
+    header->engine_version = (uint32_t)djb2(GAME_VERSION_STRING);
+    header->legacy_mode = is_legacy_mode();
+    header->source_size = (int64_t)al_get_fs_entry_size(entry);
+    header->source_mtime = (int64_t)al_get_fs_entry_mtime(entry);
+    header->root = CACHE_NONE;
+    al_destroy_fs_entry(entry);
+
+    /* the path of the cache file mirrors the path of the source file */
+    while(*filepath == '/')
+        filepath++;
+
+    int n = snprintf(cache_path, cache_path_size, "%s/%s%s", cache_dir, filepath, CACHE_EXTENSION);
+    return n >= 0 && (size_t)n < cache_path_size;
+}
+
+/*
+ * cache_read()
+ * Read a parse tree from a cache file with a single read. Returns NULL if
+ * the cache file doesn't exist, is outdated or is corrupt
+ */
+parsetree_root_t* cache_read(const char* cache_path, const char* filepath, const nanocacheheader_t* expected_header)
+{
+    parsetree_root_t* root = NULL;
+    bool error = false;
+
+    /* read the whole file */
+    ALLEGRO_FILE* fp = al_fopen(cache_path, "rb");
+    if(fp == NULL)
+        return NULL; /* not cached yet */
+
+    int64_t size = al_fsize(fp);
+    if(size < (int64_t)sizeof(nanocacheheader_t) || size > INT32_MAX) {
+        al_fclose(fp);
+        warning("Ignoring a corrupt cache file: %s", cache_path);
+        return NULL;
+    }
+
+    char* data = mallocx(size);
+    bool success = (al_fread(fp, data, size) == (size_t)size);
+    al_fclose(fp);
+
+    /* validate the header */
+    const nanocacheheader_t* header = (const nanocacheheader_t*)data;
+    if(!success || header->magic != expected_header->magic || header->format_version != expected_header->format_version) {
+        warning("Ignoring a corrupt cache file: %s", cache_path);
+        free(data);
+        return NULL;
+    }
+    else if(
+        header->engine_version != expected_header->engine_version ||
+        header->legacy_mode != expected_header->legacy_mode ||
+        header->source_size != expected_header->source_size ||
+        header->source_mtime != expected_header->source_mtime
+    ) {
+        free(data); /* the cache file is outdated */
+        return NULL;
+    }
+    else if(
+        header->statement_count < 0 || header->parameter_count < 0 || header->string_table_size <= 0 ||
+        size != (int64_t)sizeof(nanocacheheader_t) +
+                (int64_t)header->statement_count * (int64_t)sizeof(nanocachestatement_t) +
+                (int64_t)header->parameter_count * (int64_t)sizeof(nanocacheparameter_t) +
+                (int64_t)header->string_table_size ||
+        data[size-1] != '\0'
+    ) {
+        warning("Ignoring a corrupt cache file: %s", cache_path);
+        free(data);
+        return NULL;
+    }
+
+    /* the arrays are laid out as: statements, parameters, string table */
+    nanocachereader_t reader;
+    reader.header = header;
+    reader.statement = (const nanocachestatement_t*)(data + sizeof(nanocacheheader_t));
+    reader.parameter = (const nanocacheparameter_t*)(reader.statement + header->statement_count);
+    reader.string_table = (const char*)(reader.parameter + header->parameter_count);
+    reader.visited = mallocx((header->statement_count + header->parameter_count + 1) * sizeof(bool));
+    memset(reader.visited, 0, (header->statement_count + header->parameter_count + 1) * sizeof(bool));
+
+    /* construct the parse tree */
+    root = create_root(filepath);
+    reader.arena = &(root->arena);
+    root->program.statement = cache_read_statements(&reader, header->root, (parsetree_program_t*)root, &error);
+
+    if(error) {
+        warning("Ignoring a corrupt cache file: %s", cache_path);
+        root = (parsetree_root_t*)nanoparser_deconstruct_tree((parsetree_program_t*)root);
+    }
+
+    /* done! */
+    free(reader.visited);
+    free(data);
+    return root;
+}
+
+/*
+ * cache_read_statements()
+ * Construct a list of statements from a cache file
+ */
+parsetree_statement_t* cache_read_statements(nanocachereader_t* reader, int32_t index, const parsetree_program_t* program, bool* error)
+{
+    parsetree_statement_t* head = NULL;
+    parsetree_statement_t** tail = &head;
+
+    for(; index != CACHE_NONE && !*error; index = reader->statement[index].next) {
+        const char* identifier;
+
+        /* validate */
+        if(index < 0 || index >= reader->header->statement_count || reader->visited[index] ||
+        NULL == (identifier = cache_string(reader, reader->statement[index].identifier))) {
+            *error = true;
+            break;
+        }
+        reader->visited[index] = true;
+
+        /* construct the statement */
+        parsetree_statement_t* statement = arena_alloc(reader->arena, sizeof *statement);
+        statement->identifier = arena_intern(reader->arena, identifier);
+        statement->line = reader->statement[index].line;
+        statement->program = program;
+        statement->parameter = NULL;
+        statement->next = NULL;
+
+        *tail = statement;
+        tail = &(statement->next);
+
+        /* read the parameters */
+        statement->parameter = cache_read_parameters(reader, reader->statement[index].parameter, statement, error);
+    }
+
+    return head;
+}
+
+/*
+ * cache_read_parameters()
+ * Construct a list of parameters from a cache file
+ */
+parsetree_parameter_t* cache_read_parameters(nanocachereader_t* reader, int32_t index, const parsetree_statement_t* statement, bool* error)
+{
+    parsetree_parameter_t* head = NULL;
+    parsetree_parameter_t** tail = &head;
+    bool* visited = reader->visited + reader->header->statement_count;
+
+    for(; index != CACHE_NONE && !*error; index = reader->parameter[index].next) {
+        const nanocacheparameter_t* p = reader->parameter + index;
+
+        /* validate */
+        if(index < 0 || index >= reader->header->parameter_count || visited[index]) {
+            *error = true;
+            break;
+        }
+        visited[index] = true;
+
+        /* construct the parameter */
+        if(p->type == PARAMETER_STRING) {
+            const char* string = cache_string(reader, p->value);
+            if(string == NULL) {
+                *error = true;
+                break;
+            }
+
+            parsetree_parameter_t* parameter = arena_alloc(reader->arena, sizeof *parameter);
+            parameter->type = PARAMETER_STRING;
+            parameter->string = arena_intern(reader->arena, string);
+            parameter->statement = statement;
+            parameter->next = NULL;
+
+            *tail = parameter;
+            tail = &(parameter->next);
+        }
+        else if(p->type == PARAMETER_BLOCK) {
+            parsetree_program_t* block = arena_alloc(reader->arena, sizeof *block);
+            block->parent = statement->program;
+            block->statement = NULL;
+
+            parsetree_parameter_t* parameter = arena_alloc(reader->arena, sizeof *parameter);
+            parameter->type = PARAMETER_BLOCK;
+            parameter->program = block;
+            parameter->statement = statement;
+            parameter->next = NULL;
+
+            *tail = parameter;
+            tail = &(parameter->next);
+
+            block->statement = cache_read_statements(reader, p->value, block, error);
+        }
+        else {
+            *error = true;
+            break;
+        }
+    }
+
+    return head;
+}
+
+/*
+ * cache_string()
+ * Get a string from the string table of a cache file. Returns NULL if the offset is invalid
+ */
+const char* cache_string(const nanocachereader_t* reader, int32_t offset)
+{
+    if(offset < 0 || offset >= reader->header->string_table_size)
+        return NULL;
+
+    return reader->string_table + offset; /* the string table ends with '\0' */
+}
+
+/*
+ * cache_write()
+ * Write a parse tree to a cache file. Returns true on success
+ */
+bool cache_write(const char* cache_path, const parsetree_root_t* root, const nanocacheheader_t* header)
+{
+    nanocachewriter_t writer;
+    nanocacheheader_t h = *header;
+    char dirpath[CACHE_PATH_MAXLENGTH + 1];
+    bool success = false;
+
+    /* flatten the parse tree */
+    darray_init(writer.string_table);
+    darray_init(writer.statement);
+    darray_init(writer.parameter);
+    writer.interned = internset_create(256, cache_store_string, cache_lookup_string, &writer);
+
+    h.root = cache_write_statements(&writer, root->program.statement);
+    cache_intern_string(&writer, ""); /* the string table must not be empty */
+    h.string_table_size = darray_length(writer.string_table);
+    h.statement_count = darray_length(writer.statement);
+    h.parameter_count = darray_length(writer.parameter);
+
+    /* create the directory of the cache file */
+    str_cpy(dirpath, cache_path, sizeof(dirpath));
+    char* slash = strrchr(dirpath, '/');
+    if(slash != NULL) {
+        *slash = '\0';
+        al_make_directory(dirpath);
+    }
+
+    /* write the cache file */
+    ALLEGRO_FILE* fp = al_fopen(cache_path, "wb");
+    if(fp != NULL) {
+        success = (
+            al_fwrite(fp, &h, sizeof(h)) == sizeof(h) &&
+            al_fwrite(fp, writer.statement, h.statement_count * sizeof(nanocachestatement_t)) == h.statement_count * sizeof(nanocachestatement_t) &&
+            al_fwrite(fp, writer.parameter, h.parameter_count * sizeof(nanocacheparameter_t)) == h.parameter_count * sizeof(nanocacheparameter_t) &&
+            al_fwrite(fp, writer.string_table, h.string_table_size) == (size_t)h.string_table_size
+        );
+        success = al_fclose(fp) && success;
+    }
+
+    /* done! */
+    internset_destroy(writer.interned);
+    darray_release(writer.parameter);
+    darray_release(writer.statement);
+    darray_release(writer.string_table);
+    return success;
+}
+
+/*
+ * cache_write_statements()
+ * Flatten a list of statements, returning the index of the first one
+ */
+int32_t cache_write_statements(nanocachewriter_t* writer, const parsetree_statement_t* statement)
+{
+    int32_t head = CACHE_NONE, prev = CACHE_NONE;
+
+    for(; statement != NULL; statement = statement->next) {
+        nanocachestatement_t s = {
+            .identifier = cache_intern_string(writer, statement->identifier),
+            .line = statement->line,
+            .parameter = CACHE_NONE,
+            .next = CACHE_NONE
+        };
+
+        /* link the statement */
+        int32_t index = darray_push(writer->statement, s) - 1;
+        if(prev != CACHE_NONE)
+            writer->statement[prev].next = index;
+        else
+            head = index;
+        prev = index;
+
+        /* flatten the parameters */
+        int32_t prev_param = CACHE_NONE;
+        for(const parsetree_parameter_t* parameter = statement->parameter; parameter != NULL; parameter = parameter->next) {
+            nanocacheparameter_t p = {
+                .type = parameter->type,
+                .value = CACHE_NONE,
+                .next = CACHE_NONE
+            };
+
+            int32_t param_index = darray_push(writer->parameter, p) - 1;
+            if(prev_param != CACHE_NONE)
+                writer->parameter[prev_param].next = param_index;
+            else
+                writer->statement[index].parameter = param_index;
+            prev_param = param_index;
+
+            /* the arrays may be reallocated, so we access them by index */
+            int32_t value = (parameter->type == PARAMETER_STRING) ?
+                cache_intern_string(writer, parameter->string) :
+                cache_write_statements(writer, parameter->program->statement);
+            writer->parameter[param_index].value = value;
+        }
+    }
+
+    return head;
+}
+
+/*
+ * cache_intern_string()
+ * Add a string to the string table, unless it's already there. Returns its offset
+ */
+int32_t cache_intern_string(nanocachewriter_t* writer, const char* string)
+{
+    return (int32_t)internset_intern(writer->interned, string);
+}
+
+/*
+ * cache_store_string()
+ * Append a string to the string table, returning its offset
+ */
+uintptr_t cache_store_string(const char* string, void* writer)
+{
+    nanocachewriter_t* w = (nanocachewriter_t*)writer;
+    int32_t offset = darray_length(w->string_table);
+
+    for(const char* c = string; ; c++) {
+        darray_push(w->string_table, *c);
+        if(*c == '\0')
+            break;
+    }
+
+    return (uintptr_t)offset;
+}
+
+/*
+ * cache_lookup_string()
+ * The string at an offset of the string table
+ */
+const char* cache_lookup_string(uintptr_t key, const void* writer)
+{
+    return ((const nanocachewriter_t*)writer)->string_table + key;
+}
+
+
 /*
  * ERROR FUNCTIONS
  */
@@ -48,6 +48,9 @@ parsetree_program_t* nanoparser_construct_tree(const char* filepath);
 /* Release a parse tree */
 parsetree_program_t* nanoparser_deconstruct_tree(parsetree_program_t* root);
 
+/* Cache the parse trees in the given directory, specified without a trailing slash. Pass NULL to disable the cache */
+void nanoparser_set_cache_directory(const char* dirpath);
+
 
 
 
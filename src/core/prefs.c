@@ -19,6 +19,7 @@
  */
 
 #include <allegro5/allegro.h>
+#include <allegro5/allegro_physfs.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -27,6 +28,7 @@
 #include <math.h>
 #include "../util/darray.h"
 #include "../util/util.h"
+#include "../util/stringutil.h"
 #include "prefs.h"
 #include "logfile.h"
 #include "global.h"
@@ -47,11 +49,15 @@
 
 /* Where are the prefs stored? */
 #define PREFS_FILE "surge.prefs"
+#define PREFS_TEMP_FILE PREFS_FILE ".tmp" /* written first, then renamed to PREFS_FILE */
+
+/* Write-behind: the changes made within this interval are coalesced into a single write */
+#define PREFS_WRITE_INTERVAL 2.0 /* in seconds */
 
 /* prefs structure */
 typedef enum prefstype_t prefstype_t;
-typedef struct prefslist_t prefslist_t;
 typedef struct prefsentry_t prefsentry_t;
+typedef struct prefswriter_t prefswriter_t;
 
 enum prefstype_t
 {
@@ -64,28 +70,47 @@ enum prefstype_t
 
 struct prefsentry_t
 {
-    char* key;
+    char* key; /* NULL if the slot is empty */
     union prefsvalue_t {
         uint8_t boolean;
         int32_t integer;
         double real;
         char* text;
-    } value;
-    uint32_t hash;
+    } value; /* only strings are stored in the heap */
+    uint32_t hash; /* hash of the key */
     prefstype_t type;
 };
 
-struct prefslist_t
+/* the entries are stored in an open-addressing hash table with linear probing */
+#define PREFS_MIN_CAPACITY 32 /* must be a power of two */
+struct prefs_t
 {
-    prefsentry_t* entry;
-    prefslist_t* next;
+    char* prefsid;
+    prefsentry_t* entry; /* the slots of the table */
+    int capacity; /* number of slots; a power of two */
+    int count; /* number of entries; at most half of the capacity */
+    uint32_t version; /* changes whenever a key is added or removed, invalidating the slots cached by the handles */
+    prefswriter_t* writer; /* writes in the background; may be NULL */
 };
 
-#define PREFS_MAXBUCKETS 31
-struct prefs_t
+/* handle to an entry: caches the hash of the key and its slot in the table */
+struct prefshandle_t
 {
-    char* prefsid;
-    prefslist_t* bucket[PREFS_MAXBUCKETS];
+    prefs_t* prefs;
+    char* key;
+    uint32_t hash;
+    int slot; /* -1 if the key doesn't exist */
+    uint32_t version; /* version of the table when the slot was cached */
+};
+
+/* background writer */
+struct prefswriter_t
+{
+    ALLEGRO_THREAD* thread;
+    ALLEGRO_MUTEX* mutex;
+    ALLEGRO_COND* cond;
+    prefs_t* pending; /* a snapshot of the prefs waiting to be written, or NULL; protected by the mutex */
+    bool quit; /* protected by the mutex */
 };
 
 /* prefs file format */
@@ -112,21 +137,29 @@ struct pfentry_t
 /* private stuff */
 static int load(prefs_t* prefs);
 static int save(const prefs_t* prefs);
+static int replace_file(const char* temp_filename, const char* filename);
+static prefs_t* clone_prefs(const prefs_t* prefs);
+static prefs_t* delete_prefs(prefs_t* prefs);
+static prefswriter_t* create_writer();
+static prefswriter_t* destroy_writer(prefswriter_t* writer);
+static void* write_in_background(ALLEGRO_THREAD* thread, void* arg);
 static uint32_t hash(const char* str);
 static int is_valid_id(const char* key);
 static inline char* clone_str(const char* str);
-static prefsentry_t* new_string_entry(const char* key, const char* value);
-static prefsentry_t* new_int_entry(const char* key, int32_t value);
-static prefsentry_t* new_double_entry(const char* key, double value);
-static prefsentry_t* new_null_entry(const char* key);
-static prefsentry_t* new_bool_entry(const char* key, uint8_t value);
-static prefsentry_t* delete_entry(prefsentry_t* entry);
-static prefslist_t* new_list(prefsentry_t* entry, prefslist_t* next);
-static prefslist_t* delete_list(prefslist_t* list);
-static prefsentry_t* prefs_find_entry(prefs_t* prefs, const char* key);
+static void release_value(prefsentry_t* entry);
+static void allocate_table(prefs_t* prefs, int capacity);
+static void grow_table(prefs_t* prefs);
+static void clear_table(prefs_t* prefs);
+static int find_slot(const prefs_t* prefs, const char* key, uint32_t h);
+static prefsentry_t* prefs_find_entry(const prefs_t* prefs, const char* key);
+static prefsentry_t* prefs_put_entry(prefs_t* prefs, const char* key);
 static int prefs_remove_entry(prefs_t* prefs, const char* key);
-static void prefs_add_entry(prefs_t* prefs, prefsentry_t* entry);
-static int prefs_count_entries(const prefs_t* prefs);
+static prefsentry_t* resolve_handle(prefshandle_t* handle);
+static const char* entry_string(const prefsentry_t* entry);
+static int32_t entry_int(const prefsentry_t* entry);
+static double entry_double(const prefsentry_t* entry);
+static bool entry_bool(const prefsentry_t* entry);
+static char entry_item_type(const prefsentry_t* entry);
 static uint16_t le16_to_cpu(const uint8_t* buf);
 static void cpu_to_le16(uint16_t input, uint8_t* buf);
 static uint32_t le32_to_cpu(const uint8_t* buf);
@@ -139,7 +172,7 @@ static inline int keycmp(const char* a, const char* b);
 static size_t keylen(const char* key, size_t maxlen);
 static int write_header(ALLEGRO_FILE* fp, const prefs_t* prefs);
 static int write_entry(ALLEGRO_FILE* fp, const prefsentry_t* entry);
-static prefsentry_t* read_entry(ALLEGRO_FILE* fp);
+static int read_entry(ALLEGRO_FILE* fp, prefs_t* prefs);
 static int read_header(ALLEGRO_FILE* fp, pfheader_t* header);
 static int validate_header(ALLEGRO_FILE* fp, const prefs_t* prefs, const pfheader_t* header);
 
@@ -155,7 +188,6 @@ static int validate_header(ALLEGRO_FILE* fp, const prefs_t* prefs, const pfheade
 prefs_t* prefs_create(const char* prefsid)
 {
     prefs_t* prefs;
-    int i;
 
     /* Validate */
     prefsid = prefsid && *prefsid ? prefsid : GAME_UNIXNAME;
@@ -165,11 +197,14 @@ prefs_t* prefs_create(const char* prefsid)
     /* Create the instance */
     prefs = mallocx(sizeof *prefs);
     prefs->prefsid = clone_str(prefsid);
-    for(i = 0; i < PREFS_MAXBUCKETS; i++)
-        prefs->bucket[i] = NULL;
+    prefs->version = 0;
+    allocate_table(prefs, PREFS_MIN_CAPACITY);
 
     /* Load from the disk */
     load(prefs);
+
+    /* Start the background writer */
+    prefs->writer = create_writer();
     return prefs;
 }
 
@@ -179,15 +214,14 @@ prefs_t* prefs_create(const char* prefsid)
  */
 prefs_t* prefs_destroy(prefs_t* prefs)
 {
-    /* Save to the disk */
+    /* Stop the background writer, discarding any pending
+       snapshot, and save the latest data to the disk */
+    if(prefs->writer != NULL)
+        prefs->writer = destroy_writer(prefs->writer);
     save(prefs);
 
     /* Delete the instance */
-    for(int i = 0; i < PREFS_MAXBUCKETS; i++)
-        delete_list(prefs->bucket[i]);
-    free(prefs->prefsid);
-    free(prefs);
-    return NULL;
+    return delete_prefs(prefs);
 }
 
 /*
@@ -196,7 +230,7 @@ prefs_t* prefs_destroy(prefs_t* prefs)
  */
 void prefs_set_null(prefs_t* prefs, const char* key)
 {
-    prefs_add_entry(prefs, new_null_entry(key));
+    prefs_put_entry(prefs, key);
 }
 
 /*
@@ -205,8 +239,7 @@ void prefs_set_null(prefs_t* prefs, const char* key)
  */
 const char* prefs_get_string(prefs_t* prefs, const char* key)
 {
-    prefsentry_t* entry = prefs_find_entry(prefs, key);
-    return entry && entry->type == PREFS_STRING ? entry->value.text : "";
+    return entry_string(prefs_find_entry(prefs, key));
 }
 
 /*
@@ -215,7 +248,10 @@ const char* prefs_get_string(prefs_t* prefs, const char* key)
  */
 void prefs_set_string(prefs_t* prefs, const char* key, const char* value)
 {
-    prefs_add_entry(prefs, new_string_entry(key, value));
+    char* text = clone_str(value); /* value may be the current text of the entry */
+    prefsentry_t* entry = prefs_put_entry(prefs, key);
+    entry->value.text = text;
+    entry->type = PREFS_STRING;
 }
 
 /*
@@ -224,8 +260,7 @@ void prefs_set_string(prefs_t* prefs, const char* key, const char* value)
  */
 int prefs_get_int(prefs_t* prefs, const char* key)
 {
-    prefsentry_t* entry = prefs_find_entry(prefs, key);
-    return entry && entry->type == PREFS_INT32 ? entry->value.integer : 0;
+    return entry_int(prefs_find_entry(prefs, key));
 }
 
 /*
@@ -234,7 +269,9 @@ int prefs_get_int(prefs_t* prefs, const char* key)
  */
 void prefs_set_int(prefs_t* prefs, const char* key, int value)
 {
-    prefs_add_entry(prefs, new_int_entry(key, value));
+    prefsentry_t* entry = prefs_put_entry(prefs, key);
+    entry->value.integer = value;
+    entry->type = PREFS_INT32;
 }
 
 /*
@@ -243,8 +280,7 @@ void prefs_set_int(prefs_t* prefs, const char* key, int value)
  */
 double prefs_get_double(prefs_t* prefs, const char* key)
 {
-    prefsentry_t* entry = prefs_find_entry(prefs, key);
-    return entry && entry->type == PREFS_FLOAT64 ? entry->value.real : 0.0;
+    return entry_double(prefs_find_entry(prefs, key));
 }
 
 /*
@@ -253,7 +289,9 @@ double prefs_get_double(prefs_t* prefs, const char* key)
  */
 void prefs_set_double(prefs_t* prefs, const char* key, double value)
 {
-    prefs_add_entry(prefs, new_double_entry(key, value));
+    prefsentry_t* entry = prefs_put_entry(prefs, key);
+    entry->value.real = value;
+    entry->type = PREFS_FLOAT64;
 }
 
 /*
@@ -262,8 +300,7 @@ void prefs_set_double(prefs_t* prefs, const char* key, double value)
  */
 bool prefs_get_bool(prefs_t* prefs, const char* key)
 {
-    prefsentry_t* entry = prefs_find_entry(prefs, key);
-    return entry && entry->type == PREFS_BOOL ? entry->value.boolean != 0 : false;
+    return entry_bool(prefs_find_entry(prefs, key));
 }
 
 /*
@@ -272,7 +309,9 @@ bool prefs_get_bool(prefs_t* prefs, const char* key)
  */
 void prefs_set_bool(prefs_t* prefs, const char* key, bool value)
 {
-    prefs_add_entry(prefs, new_bool_entry(key, value ? 1 : 0));
+    prefsentry_t* entry = prefs_put_entry(prefs, key);
+    entry->value.boolean = value ? 1 : 0;
+    entry->type = PREFS_BOOL;
 }
 
 /*
@@ -282,22 +321,7 @@ void prefs_set_bool(prefs_t* prefs, const char* key, bool value)
  */
 char prefs_item_type(prefs_t* prefs, const char* key)
 {
-    prefsentry_t* entry = prefs_find_entry(prefs, key);
-
-    /* the entry exists */
-    if(entry != NULL) {
-        switch(entry->type) {
-            case PREFS_NULL: return '\0';
-            case PREFS_INT32: return 'i';
-            case PREFS_FLOAT64: return 'f';
-            case PREFS_STRING: return 's';
-            case PREFS_BOOL: return 'b';
-            default: return '?';
-        }
-    }
-
-    /* not found */
-    return '-';
+    return entry_item_type(prefs_find_entry(prefs, key));
 }
 
 /*
@@ -324,8 +348,7 @@ bool prefs_delete_item(prefs_t* prefs, const char* key)
  */
 void prefs_clear(prefs_t* prefs)
 {
-    for(int i = 0; i < PREFS_MAXBUCKETS; i++)
-        prefs->bucket[i] = delete_list(prefs->bucket[i]);
+    clear_table(prefs);
 }
 
 /*
@@ -339,181 +362,349 @@ const char* prefs_id(const prefs_t* prefs)
 
 /*
  * prefs_save()
- * Saves the prefs to the disk
+ * Saves the prefs to the disk. The data is written in the background:
+ * consecutive saves within a short interval are coalesced into a single
+ * write. Pending data is written when the prefs are destroyed
  */
 void prefs_save(const prefs_t* prefs)
 {
-    save(prefs);
-}
-
+    prefswriter_t* writer = prefs->writer;
 
+    /* no background writer? save synchronously */
+    if(writer == NULL) {
+        save(prefs);
+        return;
+    }
 
+    /* replace the pending snapshot, if any */
+    prefs_t* snapshot = clone_prefs(prefs);
 
+    al_lock_mutex(writer->mutex);
+    prefs_t* discarded = writer->pending;
+    writer->pending = snapshot;
+    al_signal_cond(writer->cond);
+    al_unlock_mutex(writer->mutex);
 
-/* internal stuff */
+    if(discarded != NULL)
+        delete_prefs(discarded);
+}
 
-/* prefs entry: utilities */
-prefsentry_t* new_string_entry(const char* key, const char* value)
+/*
+ * prefs_create_handle()
+ * Creates a handle to an entry of the prefs, which may or may not exist.
+ * Reading an entry through its handle doesn't hash the key every time.
+ * Handles must be destroyed before the prefs
+ */
+prefshandle_t* prefs_create_handle(prefs_t* prefs, const char* key)
 {
-    prefsentry_t* entry = mallocx(sizeof *entry);
+    prefshandle_t* handle = mallocx(sizeof *handle);
 
-    entry->key = clone_str(key);
-    entry->value.text = clone_str(value);
-    entry->hash = hash(entry->key);
-    entry->type = PREFS_STRING;
+    handle->prefs = prefs;
+    handle->key = clone_str(key);
+    handle->hash = hash(handle->key);
+    handle->slot = find_slot(prefs, handle->key, handle->hash);
+    handle->version = prefs->version;
 
-    return entry;
+    return handle;
 }
 
-prefsentry_t* new_int_entry(const char* key, int32_t value)
+/*
+ * prefs_destroy_handle()
+ * Destroys a handle
+ */
+prefshandle_t* prefs_destroy_handle(prefshandle_t* handle)
 {
-    prefsentry_t* entry = mallocx(sizeof *entry);
+    free(handle->key);
+    free(handle);
+    return NULL;
+}
 
-    entry->key = clone_str(key);
-    entry->value.integer = value;
-    entry->hash = hash(entry->key);
-    entry->type = PREFS_INT32;
+/*
+ * prefs_handle_get_string()
+ * Gets a string from the prefs using a handle
+ */
+const char* prefs_handle_get_string(prefshandle_t* handle)
+{
+    return entry_string(resolve_handle(handle));
+}
 
-    return entry;
+/*
+ * prefs_handle_get_int()
+ * Gets an integer from the prefs using a handle
+ */
+int prefs_handle_get_int(prefshandle_t* handle)
+{
+    return entry_int(resolve_handle(handle));
 }
 
-prefsentry_t* new_double_entry(const char* key, double value)
+/*
+ * prefs_handle_get_double()
+ * Gets a double from the prefs using a handle
+ */
+double prefs_handle_get_double(prefshandle_t* handle)
 {
-    prefsentry_t* entry = mallocx(sizeof *entry);
+    return entry_double(resolve_handle(handle));
+}
 
-    entry->key = clone_str(key);
-    entry->value.real = value;
-    entry->hash = hash(entry->key);
-    entry->type = PREFS_FLOAT64;
+/*
+ * prefs_handle_get_bool()
+ * Gets a boolean from the prefs using a handle
+ */
+bool prefs_handle_get_bool(prefshandle_t* handle)
+{
+    return entry_bool(resolve_handle(handle));
+}
 
-    return entry;
+/*
+ * prefs_handle_item_type()
+ * Checks the type of an entry using a handle. See prefs_item_type()
+ */
+char prefs_handle_item_type(prefshandle_t* handle)
+{
+    return entry_item_type(resolve_handle(handle));
 }
 
-prefsentry_t* new_null_entry(const char* key)
+
+
+
+
+/* internal stuff */
+
+/* prefs entry: utilities */
+const char* entry_string(const prefsentry_t* entry)
 {
-    prefsentry_t* entry = mallocx(sizeof *entry);
+    return entry && entry->type == PREFS_STRING ? entry->value.text : "";
+}
 
-    entry->key = clone_str(key);
-    entry->value.real = 0.0;
-    entry->hash = hash(entry->key);
-    entry->type = PREFS_NULL;
+int32_t entry_int(const prefsentry_t* entry)
+{
+    return entry && entry->type == PREFS_INT32 ? entry->value.integer : 0;
+}
 
-    return entry;
+double entry_double(const prefsentry_t* entry)
+{
+    return entry && entry->type == PREFS_FLOAT64 ? entry->value.real : 0.0;
 }
 
-prefsentry_t* new_bool_entry(const char* key, uint8_t value)
+bool entry_bool(const prefsentry_t* entry)
 {
-    prefsentry_t* entry = mallocx(sizeof *entry);
+    return entry && entry->type == PREFS_BOOL ? entry->value.boolean != 0 : false;
+}
 
-    entry->key = clone_str(key);
-    entry->value.boolean = value;
-    entry->hash = hash(entry->key);
-    entry->type = PREFS_BOOL;
+char entry_item_type(const prefsentry_t* entry)
+{
+    /* not found */
+    if(entry == NULL)
+        return '-';
 
-    return entry;
+    /* the entry exists */
+    switch(entry->type) {
+        case PREFS_NULL: return '\0';
+        case PREFS_INT32: return 'i';
+        case PREFS_FLOAT64: return 'f';
+        case PREFS_STRING: return 's';
+        case PREFS_BOOL: return 'b';
+        default: return '?';
+    }
 }
 
-prefsentry_t* delete_entry(prefsentry_t* entry)
+void release_value(prefsentry_t* entry)
 {
     if(entry->type == PREFS_STRING)
         free(entry->value.text);
-    free(entry->key);
-    free(entry);
-    return NULL;
+
+    entry->value.real = 0.0;
+    entry->type = PREFS_NULL;
 }
 
-/* prefs list: utilities */
-prefslist_t* new_list(prefsentry_t* entry, prefslist_t* next)
+/* prefs: snapshots */
+prefs_t* clone_prefs(const prefs_t* prefs)
 {
-    prefslist_t* list = mallocx(sizeof *list);
-    list->entry = entry;
-    list->next = next;
-    return list;
+    prefs_t* clone = mallocx(sizeof *clone);
+
+    clone->prefsid = clone_str(prefs->prefsid);
+    clone->capacity = prefs->capacity;
+    clone->count = prefs->count;
+    clone->version = prefs->version;
+    clone->writer = NULL;
+
+    clone->entry = mallocx(clone->capacity * sizeof *(clone->entry));
+    memcpy(clone->entry, prefs->entry, clone->capacity * sizeof *(clone->entry));
+
+    for(int i = 0; i < clone->capacity; i++) {
+        prefsentry_t* entry = &clone->entry[i];
+        if(entry->key != NULL) {
+            entry->key = clone_str(entry->key);
+            if(entry->type == PREFS_STRING)
+                entry->value.text = clone_str(entry->value.text);
+        }
+    }
+
+    return clone;
 }
 
-prefslist_t* delete_list(prefslist_t* list)
+prefs_t* delete_prefs(prefs_t* prefs)
 {
-    while(list != NULL) {
-        prefslist_t* next = list->next;
-        delete_entry(list->entry);
-        free(list);
-        list = next;
-    }
+    clear_table(prefs);
+    free(prefs->entry);
+    free(prefs->prefsid);
+    free(prefs);
     return NULL;
 }
 
-/* prefs: CRUD operations */
-prefsentry_t* prefs_find_entry(prefs_t* prefs, const char* key)
+/* prefs: hash table */
+void allocate_table(prefs_t* prefs, int capacity)
 {
-    /* returns NULL if the key has not been found */
-    uint32_t h = hash(key);
-    prefslist_t* prev = NULL;
-
-    for(prefslist_t* l = prefs->bucket[h % PREFS_MAXBUCKETS]; l != NULL; l = l->next) {
-        /* found the key */
-        if(l->entry->hash == h && 0 == keycmp(l->entry->key, key)) {
-            /* move the entry to the front of the list */
-            if(prev != NULL) {
-                prev->next = l->next;
-                l->next = prefs->bucket[h % PREFS_MAXBUCKETS];
-                prefs->bucket[h % PREFS_MAXBUCKETS] = l;
-            }
-            return l->entry;
+    prefs->entry = mallocx(capacity * sizeof *(prefs->entry));
+    prefs->capacity = capacity;
+    prefs->count = 0;
+
+    for(int i = 0; i < capacity; i++) {
+        prefs->entry[i].key = NULL;
+        prefs->entry[i].type = PREFS_NULL;
+    }
+}
+
+void grow_table(prefs_t* prefs)
+{
+    prefsentry_t* old_entry = prefs->entry;
+    int old_capacity = prefs->capacity;
+    int count = prefs->count;
+
+    /* reinsert the entries using their cached hashes */
+    allocate_table(prefs, 2 * old_capacity);
+    uint32_t mask = prefs->capacity - 1;
+
+    for(int i = 0; i < old_capacity; i++) {
+        if(old_entry[i].key != NULL) {
+            uint32_t j = old_entry[i].hash & mask;
+            while(prefs->entry[j].key != NULL)
+                j = (j + 1) & mask;
+            prefs->entry[j] = old_entry[i];
         }
-        prev = l;
     }
 
-    /* not found */
-    return NULL;
+    prefs->count = count;
+    prefs->version++;
+    free(old_entry);
 }
 
-int prefs_remove_entry(prefs_t* prefs, const char* key)
+void clear_table(prefs_t* prefs)
 {
-    /* returns 0 if there was no such key, non-zero otherwise */
-    uint32_t h = hash(key);
-    prefslist_t* prev = NULL;
-
-    for(prefslist_t* l = prefs->bucket[h % PREFS_MAXBUCKETS]; l != NULL; l = l->next) {
-        /* found the key */
-        if(l->entry->hash == h && 0 == keycmp(l->entry->key, key)) {
-            if(prev == NULL)
-                prefs->bucket[h % PREFS_MAXBUCKETS] = l->next;
-            else
-                prev->next = l->next;
-            l->next = NULL;
-            delete_list(l);
-            return 1;
+    for(int i = 0; i < prefs->capacity; i++) {
+        prefsentry_t* entry = &prefs->entry[i];
+        if(entry->key != NULL) {
+            release_value(entry);
+            free(entry->key);
+            entry->key = NULL;
         }
-        prev = l;
     }
 
-    /* not found */
-    return 0;
+    prefs->count = 0;
+    prefs->version++;
 }
 
-void prefs_add_entry(prefs_t* prefs, prefsentry_t* entry)
+/* returns the slot of the key, or -1 if the key has not been found */
+int find_slot(const prefs_t* prefs, const char* key, uint32_t h)
 {
-    uint32_t h = hash(entry->key);
-    prefslist_t* l = new_list(entry, NULL);
+    uint32_t mask = prefs->capacity - 1;
 
-    /* No duplicate keys are allowed */
-    prefs_remove_entry(prefs, entry->key);
+    for(uint32_t i = h & mask; prefs->entry[i].key != NULL; i = (i + 1) & mask) {
+        if(prefs->entry[i].hash == h && 0 == keycmp(prefs->entry[i].key, key))
+            return (int)i;
+    }
+
+    return -1;
+}
+
+/* prefs: CRUD operations */
+prefsentry_t* prefs_find_entry(const prefs_t* prefs, const char* key)
+{
+    /* returns NULL if the key has not been found */
+    int slot = find_slot(prefs, key, hash(key));
+    return slot >= 0 ? &prefs->entry[slot] : NULL;
+}
+
+prefsentry_t* prefs_put_entry(prefs_t* prefs, const char* key)
+{
+    /* returns a null entry associated with the key, creating it if necessary */
+    uint32_t h = hash(key);
+    int slot = find_slot(prefs, key, h);
+
+    /* the key exists: reuse the slot */
+    if(slot >= 0) {
+        release_value(&prefs->entry[slot]);
+        return &prefs->entry[slot];
+    }
+
+    /* keep the load factor at most 1/2 */
+    if(2 * (prefs->count + 1) > prefs->capacity)
+        grow_table(prefs);
+
+    /* find an empty slot */
+    uint32_t mask = prefs->capacity - 1;
+    uint32_t i = h & mask;
+    while(prefs->entry[i].key != NULL)
+        i = (i + 1) & mask;
 
     /* setup new entry */
-    l->next = prefs->bucket[h % PREFS_MAXBUCKETS];
-    prefs->bucket[h % PREFS_MAXBUCKETS] = l;
+    prefsentry_t* entry = &prefs->entry[i];
+    entry->key = clone_str(key);
+    entry->hash = h;
+    entry->value.real = 0.0;
+    entry->type = PREFS_NULL;
+
+    prefs->count++;
+    prefs->version++;
+    return entry;
+}
+
+int prefs_remove_entry(prefs_t* prefs, const char* key)
+{
+    /* returns 0 if there was no such key, non-zero otherwise */
+    int slot = find_slot(prefs, key, hash(key));
+    if(slot < 0)
+        return 0;
+
+    /* delete the entry */
+    uint32_t mask = prefs->capacity - 1;
+    uint32_t i = slot, j = slot;
+    release_value(&prefs->entry[i]);
+    free(prefs->entry[i].key);
+
+    /* shift back the entries of the cluster, so that no tombstones are needed:
+       an entry may fill the hole at i only if its home slot is not in (i, j] */
+    for(;;) {
+        j = (j + 1) & mask;
+        if(prefs->entry[j].key == NULL)
+            break;
+
+        uint32_t home = prefs->entry[j].hash & mask;
+        bool in_range = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if(!in_range) {
+            prefs->entry[i] = prefs->entry[j];
+            i = j;
+        }
+    }
+
+    prefs->entry[i].key = NULL;
+    prefs->entry[i].type = PREFS_NULL;
+    prefs->count--;
+    prefs->version++;
+    return 1;
 }
 
-int prefs_count_entries(const prefs_t* prefs)
+/* handles: find the slot of the key only if the table has changed */
+prefsentry_t* resolve_handle(prefshandle_t* handle)
 {
-    int count = 0;
+    const prefs_t* prefs = handle->prefs;
 
-    for(int i = 0; i < PREFS_MAXBUCKETS; i++) {
-        for(prefslist_t* l = prefs->bucket[i]; l != NULL; l = l->next)
-            count++;
+    if(handle->version != prefs->version) {
+        handle->slot = find_slot(prefs, handle->key, handle->hash);
+        handle->version = prefs->version;
     }
 
-    return count;
+    return handle->slot >= 0 ? &prefs->entry[handle->slot] : NULL;
 }
 
 /* endianess conversion */
@@ -689,11 +880,11 @@ char* clone_str(const char* str)
 
 /* save & load routines */
 
-/* read an entry from fp
- * returns NULL on corrupt file */
-prefsentry_t* read_entry(ALLEGRO_FILE* fp)
+/* read an entry from fp and add it to the prefs
+ * returns 0 on corrupt file */
+int read_entry(ALLEGRO_FILE* fp, prefs_t* prefs)
 {
-    prefsentry_t* entry = NULL;
+    int success = 0;
     pfentry_t pfentry;
 
     /* read type & data size */
@@ -713,8 +904,10 @@ prefsentry_t* read_entry(ALLEGRO_FILE* fp)
                         const char* key = (const char*)data;
                         const uint8_t* value_buf = (data + keylen(key, pfentry.data_size - 1) + 1);
                         int value_size = pfentry.data_size - (value_buf - data);
-                        if(value_size == 0)
-                            entry = new_null_entry(key);
+                        if(value_size == 0) {
+                            prefs_set_null(prefs, key);
+                            success = 1;
+                        }
                     }
 
                     free(data);
@@ -731,7 +924,8 @@ prefsentry_t* read_entry(ALLEGRO_FILE* fp)
                         int value_size = pfentry.data_size - (value_buf - data);
                         if(value_size == sizeof(int32_t)) {
                             uint32_t value = le32_to_cpu(value_buf);
-                            entry = new_int_entry(key, *((int32_t*)&value));
+                            prefs_set_int(prefs, key, *((int32_t*)&value));
+                            success = 1;
                         }
                     }
 
@@ -749,7 +943,8 @@ prefsentry_t* read_entry(ALLEGRO_FILE* fp)
                         int value_size = pfentry.data_size - (value_buf - data);
                         if(value_size > 0) {
                             double value = double_deserialize(value_buf, value_size);
-                            entry = new_double_entry(key, value);
+                            prefs_set_double(prefs, key, value);
+                            success = 1;
                         }
                     }
 
@@ -767,7 +962,8 @@ prefsentry_t* read_entry(ALLEGRO_FILE* fp)
                         int value_size = pfentry.data_size - (value_buf - data);
                         if(value_size >= 0) {
                             const char* value = (const char*)value_buf;
-                            entry = new_string_entry(key, value);
+                            prefs_set_string(prefs, key, value);
+                            success = 1;
                         }
                     }
 
@@ -785,7 +981,8 @@ prefsentry_t* read_entry(ALLEGRO_FILE* fp)
                         int value_size = pfentry.data_size - (value_buf - data);
                         if(value_size == sizeof(uint8_t)) {
                             uint8_t value = *value_buf;
-                            entry = new_bool_entry(key, value != 0);
+                            prefs_set_bool(prefs, key, value != 0);
+                            success = 1;
                         }
                     }
 
@@ -800,7 +997,8 @@ prefsentry_t* read_entry(ALLEGRO_FILE* fp)
 
                     if(pfentry.data_size == al_fread(fp, data, pfentry.data_size)) {
                         const char* key = (const char*)data;
-                        entry = new_null_entry(key);
+                        prefs_set_null(prefs, key);
+                        success = 1;
                     }
 
                     free(data);
@@ -811,13 +1009,13 @@ prefsentry_t* read_entry(ALLEGRO_FILE* fp)
     }
 
     /* error? */
-    if(al_ferror(fp) != 0 || entry == NULL) {
+    if(al_ferror(fp) != 0 || !success) {
         prefs_log("Prefs reading error (%d) near byte %ld", al_ferror(fp), al_ftell(fp));
         al_fclearerr(fp);
     }
 
     /* done */
-    return entry;
+    return success;
 }
 
 int read_header(ALLEGRO_FILE* fp, pfheader_t* header)
@@ -976,7 +1174,7 @@ int write_header(ALLEGRO_FILE* fp, const prefs_t* prefs)
     memset(header.unused, 0, sizeof(header.unused));
     header.version_code = prefs_version();
     header.prefsid_hash = hash(prefs->prefsid);
-    header.entry_count = prefs_count_entries(prefs);
+    header.entry_count = prefs->count;
 
     /* save header */
     success = success && (sizeof(header.magic) == al_fwrite(fp, header.magic, sizeof(header.magic)));
@@ -1013,13 +1211,8 @@ int load(prefs_t* prefs)
         if(read_header(fp, &header)) {
             if(validate_header(fp, prefs, &header)) {
                 int good = 1;
-                for(int i = 0; i < header.entry_count && good; i++) {
-                    prefsentry_t* entry = read_entry(fp);
-                    if(entry != NULL)
-                        prefs_add_entry(prefs, entry);
-                    else
-                        good = 0;
-                }
+                for(int i = 0; i < header.entry_count && good; i++)
+                    good = read_entry(fp, prefs);
                 success = good;
             }
         }
@@ -1036,26 +1229,34 @@ int load(prefs_t* prefs)
     return success;
 }
 
-/* save prefs to the disk */
+/* save prefs to the disk. We write a temporary file and then replace
+   the prefs file, so that the prefs file is never left incomplete.
+   This may be called from the background writer */
 int save(const prefs_t* prefs)
 {
-    const char* fullpath = asset_path(PREFS_FILE);
-    ALLEGRO_FILE* fp = al_fopen(fullpath, "wb");
+    ALLEGRO_FILE* fp = al_fopen(PREFS_TEMP_FILE, "wb");
     int success = 0;
 
-    prefs_log("Saving prefs to \"%s\"...", fullpath);
+    prefs_log("Saving prefs to \"%s\"...", PREFS_FILE);
 
     /* save file */
     if(fp != NULL) {
         if(write_header(fp, prefs)) {
             int good = 1;
-            for(int i = 0; i < PREFS_MAXBUCKETS && good; i++) {
-                for(prefslist_t* l = prefs->bucket[i]; l != NULL && good; l = l->next)
-                    good = good && write_entry(fp, l->entry);
+            for(int i = 0; i < prefs->capacity && good; i++) {
+                if(prefs->entry[i].key != NULL)
+                    good = write_entry(fp, &prefs->entry[i]);
             }
             success = good;
         }
-        al_fclose(fp);
+        success = al_fclose(fp) && success;
+
+        /* replace the prefs file only if the temporary file is complete */
+        if(success)
+            success = replace_file(PREFS_TEMP_FILE, PREFS_FILE);
+
+        if(!success)
+            al_remove_filename(PREFS_TEMP_FILE);
     }
     else
         prefs_log("Can't open prefs file for writing!");
@@ -1066,4 +1267,120 @@ int save(const prefs_t* prefs)
 
     /* done */
     return success;
-}
\ No newline at end of file
+}
+
+/* atomically replace a file of the write directory by another */
+int replace_file(const char* temp_filename, const char* filename)
+{
+    const char* writedir = asset_writedir();
+    int success = 0;
+
+    if(writedir != NULL) {
+        ALLEGRO_PATH* temp_path = al_create_path_for_directory(writedir);
+        ALLEGRO_PATH* path = al_clone_path(temp_path);
+
+        al_set_path_filename(temp_path, temp_filename);
+        al_set_path_filename(path, filename);
+        success = rename_utf8(
+            al_path_cstr(temp_path, ALLEGRO_NATIVE_PATH_SEP),
+            al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP)
+        );
+
+        al_destroy_path(path);
+        al_destroy_path(temp_path);
+    }
+
+    return success;
+}
+
+/* create the background writer. Returns NULL on error */
+prefswriter_t* create_writer()
+{
+    prefswriter_t* writer = mallocx(sizeof *writer);
+
+    writer->pending = NULL;
+    writer->quit = false;
+    writer->mutex = al_create_mutex();
+    writer->cond = al_create_cond();
+    writer->thread = NULL;
+
+    if(writer->mutex != NULL && writer->cond != NULL)
+        writer->thread = al_create_thread(write_in_background, writer);
+
+    if(writer->thread == NULL) {
+        prefs_log("Can't create the background writer of the prefs");
+        if(writer->cond != NULL)
+            al_destroy_cond(writer->cond);
+        if(writer->mutex != NULL)
+            al_destroy_mutex(writer->mutex);
+        free(writer);
+        return NULL;
+    }
+
+    al_start_thread(writer->thread);
+    return writer;
+}
+
+/* stop the background writer, discarding any pending snapshot */
+prefswriter_t* destroy_writer(prefswriter_t* writer)
+{
+    al_lock_mutex(writer->mutex);
+    prefs_t* discarded = writer->pending;
+    writer->pending = NULL;
+    writer->quit = true;
+    al_signal_cond(writer->cond);
+    al_unlock_mutex(writer->mutex);
+
+    if(discarded != NULL)
+        delete_prefs(discarded);
+
+    /* wait for a write in progress, if any */
+    al_join_thread(writer->thread, NULL);
+    al_destroy_thread(writer->thread);
+    al_destroy_cond(writer->cond);
+    al_destroy_mutex(writer->mutex);
+    free(writer);
+
+    return NULL;
+}
+
+/* the background writer */
+void* write_in_background(ALLEGRO_THREAD* thread, void* arg)
+{
+    prefswriter_t* writer = (prefswriter_t*)arg;
+
+    /* use the physfs file interface in this thread */
+    al_set_physfs_file_interface();
+
+    al_lock_mutex(writer->mutex);
+    for(;;) {
+        ALLEGRO_TIMEOUT timeout;
+
+        /* wait for a save */
+        while(writer->pending == NULL && !writer->quit)
+            al_wait_cond(writer->cond, writer->mutex);
+
+        if(writer->quit)
+            break;
+
+        /* coalesce the saves made within an interval */
+        al_init_timeout(&timeout, PREFS_WRITE_INTERVAL);
+        while(!writer->quit && 0 == al_wait_cond_until(writer->cond, writer->mutex, &timeout));
+
+        if(writer->quit)
+            break;
+
+        /* write the latest snapshot */
+        prefs_t* snapshot = writer->pending;
+        writer->pending = NULL;
+        al_unlock_mutex(writer->mutex);
+
+        save(snapshot);
+        delete_prefs(snapshot);
+
+        al_lock_mutex(writer->mutex);
+    }
+    al_unlock_mutex(writer->mutex);
+
+    return NULL;
+}
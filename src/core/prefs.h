@@ -23,6 +23,7 @@
 
 #include <stdbool.h>
 typedef struct prefs_t prefs_t;
+typedef struct prefshandle_t prefshandle_t;
 
 /* create & destroy */
 prefs_t* prefs_create(const char* prefsid); /* prefsid is a non-empty string composed by lowercase characters and/or digits */
@@ -47,4 +48,13 @@ bool prefs_has_item(prefs_t* prefs, const char* key);
 bool prefs_delete_item(prefs_t* prefs, const char* key);
 void prefs_clear(prefs_t* prefs); /* clears all data */
 
+/* handles: read an entry without hashing its key every time */
+prefshandle_t* prefs_create_handle(prefs_t* prefs, const char* key); /* the entry may or may not exist */
+prefshandle_t* prefs_destroy_handle(prefshandle_t* handle); /* destroy the handles before the prefs */
+const char* prefs_handle_get_string(prefshandle_t* handle);
+int prefs_handle_get_int(prefshandle_t* handle);
+double prefs_handle_get_double(prefshandle_t* handle);
+bool prefs_handle_get_bool(prefshandle_t* handle);
+char prefs_handle_item_type(prefshandle_t* handle);
+
 #endif
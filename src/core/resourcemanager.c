@@ -22,19 +22,84 @@
 #include "image.h"
 #include "audio.h"
 #include "logfile.h"
+#include "timer.h"
 #include "../util/hashtable.h"
+#include "../util/handletable.h"
+#include "../util/util.h"
+
+/*
+
+Each resource gets a handle made of a slot index and a generation counter.
+Dereferencing a handle is an array lookup, without hashing the path, and
+the handle of a released resource (purged, evicted or garbage collected)
+becomes stale and dereferences to NULL instead of dangling.
+
+The tables keyed by path store entries that pair a resource with its handle,
+so that the handle is invalidated when the entry is destroyed.
+
+*/
+
+/* an entry of the tables: a resource and its handle */
+typedef struct resourceentry_t resourceentry_t;
+struct resourceentry_t
+{
+    void* data;
+    handle_t handle;
+};
+
+typedef resourceentry_t imageentry_t;
+typedef resourceentry_t sampleentry_t;
+typedef resourceentry_t musicentry_t;
+
+static resourceentry_t* create_entry(handletable_t* handles, void* data);
+
+/* destructors that keep track of the used memory */
+static void release_image(imageentry_t* entry);
+static void release_sample(sampleentry_t* entry);
+static void release_music(musicentry_t* entry);
 
 /* code generation */
-HASHTABLE_GENERATE_CODE(image_t, image_destroy);
-HASHTABLE_GENERATE_CODE(sound_t, sound_destroy);
-HASHTABLE_GENERATE_CODE(music_t, music_destroy);
+HASHTABLE_GENERATE_CODE(imageentry_t, release_image);
+HASHTABLE_GENERATE_CODE(sampleentry_t, release_sample);
+HASHTABLE_GENERATE_CODE(musicentry_t, release_music);
 
 /* private data */
-static HASHTABLE(image_t, images);
-static HASHTABLE(sound_t, samples);
-static HASHTABLE(music_t, musics);
+static HASHTABLE(imageentry_t, images);
+static HASHTABLE(sampleentry_t, samples);
+static HASHTABLE(musicentry_t, musics);
+static handletable_t* image_handles = NULL;
+static handletable_t* sample_handles = NULL;
+static handletable_t* music_handles = NULL;
 static bool is_valid = false; /* validity flag */
 
+/* enumeration of the resources */
+typedef struct foreachimage_t foreachimage_t;
+struct foreachimage_t
+{
+    void* data;
+    void (*callback)(image_t*,void*);
+};
+
+typedef struct foreachsample_t foreachsample_t;
+struct foreachsample_t
+{
+    void* data;
+    void (*callback)(sound_t*,void*);
+};
+
+static void foreach_image_entry(imageentry_t* entry, void* context);
+static void foreach_sample_entry(sampleentry_t* entry, void* context);
+
+/* memory budget */
+static resourcemanagerstats_t stats = { 0 };
+static bool can_evict = false; /* false if all resources were referenced when we last tried to evict */
+static void enforce_memory_budget();
+static size_t image_memory_usage(const image_t* image);
+
+/* incremental release of unused resources */
+static int gc_table = 0; /* 0: images, 1: samples, 2: musics */
+static int gc_bucket = 0;
+
 
 /* public methods */
 
@@ -42,9 +107,12 @@ static bool is_valid = false; /* validity flag */
 void resourcemanager_init()
 {
     if(!is_valid) {
-        images = hashtable_image_t_create();
-        samples = hashtable_sound_t_create();
-        musics = hashtable_music_t_create();
+        image_handles = handletable_create();
+        sample_handles = handletable_create();
+        music_handles = handletable_create();
+        images = hashtable_imageentry_t_create();
+        samples = hashtable_sampleentry_t_create();
+        musics = hashtable_musicentry_t_create();
         is_valid = true;
     }
 }
@@ -53,21 +121,81 @@ void resourcemanager_release()
 {
     if(is_valid) {
         is_valid = false;
-        images = hashtable_image_t_destroy(images);
-        samples = hashtable_sound_t_destroy(samples);
-        musics = hashtable_music_t_destroy(musics);
+        images = hashtable_imageentry_t_destroy(images);
+        samples = hashtable_sampleentry_t_destroy(samples);
+        musics = hashtable_musicentry_t_destroy(musics);
+        image_handles = handletable_destroy(image_handles);
+        sample_handles = handletable_destroy(sample_handles);
+        music_handles = handletable_destroy(music_handles);
     }
 }
 
 void resourcemanager_release_unused_resources()
 {
     if(is_valid) {
-        hashtable_image_t_release_unreferenced_entries(images);
-        hashtable_sound_t_release_unreferenced_entries(samples);
-        hashtable_music_t_release_unreferenced_entries(musics);
+        hashtable_imageentry_t_release_unreferenced_entries(images);
+        hashtable_sampleentry_t_release_unreferenced_entries(samples);
+        hashtable_musicentry_t_release_unreferenced_entries(musics);
     }
 }
 
+bool resourcemanager_release_unused_resources_incrementally(double time_budget)
+{
+    if(!is_valid)
+        return true;
+
+    /* scan the buckets of the tables until we run out of time.
+       We check the clock after each bucket, so we always make progress */
+    double deadline = timer_get_now() + time_budget;
+    do {
+        int bucket_count = 0;
+        switch(gc_table) {
+            case 0:
+                hashtable_imageentry_t_release_unreferenced_entries_of_bucket(images, gc_bucket);
+                bucket_count = hashtable_imageentry_t_bucket_count(images);
+                break;
+
+            case 1:
+                hashtable_sampleentry_t_release_unreferenced_entries_of_bucket(samples, gc_bucket);
+                bucket_count = hashtable_sampleentry_t_bucket_count(samples);
+                break;
+
+            case 2:
+                hashtable_musicentry_t_release_unreferenced_entries_of_bucket(musics, gc_bucket);
+                bucket_count = hashtable_musicentry_t_bucket_count(musics);
+                break;
+        }
+
+        /* move to the next bucket */
+        if(++gc_bucket >= bucket_count) {
+            gc_bucket = 0;
+            if(++gc_table == 3) {
+                gc_table = 0;
+                return true; /* we've completed a full pass */
+            }
+        }
+    } while(timer_get_now() < deadline);
+
+    /* we'll continue later */
+    return false;
+}
+
+void resourcemanager_set_memory_budget(size_t bytes)
+{
+    stats.budget = bytes;
+    can_evict = true;
+
+    if(bytes > 0)
+        logfile_message("Setting the memory budget of the resource manager to %lu KB", (unsigned long)(bytes / 1024));
+
+    enforce_memory_budget();
+}
+
+resourcemanagerstats_t resourcemanager_stats()
+{
+    return stats;
+}
+
 bool resourcemanager_is_initialized()
 {
     return is_valid;
@@ -78,29 +206,55 @@ bool resourcemanager_is_initialized()
 /* -------- images ------- */
 void resourcemanager_add_image(const char *key, image_t *data)
 {
-    hashtable_image_t_add(images, key, data);
+    if(hashtable_imageentry_t_find(images, key) == NULL) {
+        stats.image_bytes += image_memory_usage(data);
+        stats.image_count++;
+        hashtable_imageentry_t_add(images, key, create_entry(image_handles, data));
+    }
 }
 
 image_t* resourcemanager_find_image(const char *key)
 {
-    return hashtable_image_t_find(images, key);
+    imageentry_t* entry = hashtable_imageentry_t_find(images, key);
+    return entry != NULL ? entry->data : NULL;
+}
+
+imagehandle_t resourcemanager_find_image_handle(const char *key)
+{
+    imageentry_t* entry = hashtable_imageentry_t_find(images, key);
+    return (imagehandle_t){ entry != NULL ? entry->handle : NULL_HANDLE };
+}
+
+image_t* resourcemanager_image_at(imagehandle_t handle)
+{
+    return is_valid ? handletable_get(image_handles, handle.value) : NULL;
 }
 
 int resourcemanager_ref_image(const char *key)
 {
-    return hashtable_image_t_ref(images, key);
+    int refs = hashtable_imageentry_t_ref(images, key);
+
+    /* the referenced image is safe from eviction */
+    enforce_memory_budget();
+
+    return refs;
 }
 
 int resourcemanager_unref_image(const char *key)
 {
-    return is_valid ? hashtable_image_t_unref(images, key) : 0;
+    int refs = is_valid ? hashtable_imageentry_t_unref(images, key) : 0;
+
+    if(refs == 0)
+        can_evict = true;
+
+    return refs;
 }
 
 /* returns TRUE on success (i.e., the image has been successfully purged) */
 bool resourcemanager_purge_image(const char *key)
 {
     if(is_valid && resourcemanager_find_image(key) != NULL) {
-        int refs = hashtable_image_t_refcount(images, key);
+        int refs = hashtable_imageentry_t_refcount(images, key);
 
         /* sanity check */
         if(refs > 0) {
@@ -110,7 +264,7 @@ bool resourcemanager_purge_image(const char *key)
 
         /* purge the image */
         logfile_message("resourcemanager_purge_image('%s')...", key);
-        hashtable_image_t_remove(images, key);
+        hashtable_imageentry_t_remove(images, key);
     }
 
     /* done */
@@ -120,41 +274,202 @@ bool resourcemanager_purge_image(const char *key)
 /* -------- musics --------- */
 void resourcemanager_add_music(const char *key, music_t *data)
 {
-    hashtable_music_t_add(musics, key, data);
+    if(hashtable_musicentry_t_find(musics, key) == NULL) {
+        stats.music_count++;
+        hashtable_musicentry_t_add(musics, key, create_entry(music_handles, data));
+    }
 }
 
 music_t* resourcemanager_find_music(const char *key)
 {
-    return hashtable_music_t_find(musics, key);
+    musicentry_t* entry = hashtable_musicentry_t_find(musics, key);
+    return entry != NULL ? entry->data : NULL;
+}
+
+musichandle_t resourcemanager_find_music_handle(const char *key)
+{
+    musicentry_t* entry = hashtable_musicentry_t_find(musics, key);
+    return (musichandle_t){ entry != NULL ? entry->handle : NULL_HANDLE };
+}
+
+music_t* resourcemanager_music_at(musichandle_t handle)
+{
+    return is_valid ? handletable_get(music_handles, handle.value) : NULL;
 }
 
 int resourcemanager_ref_music(const char *key)
 {
-    return hashtable_music_t_ref(musics, key);
+    return hashtable_musicentry_t_ref(musics, key);
 }
 
 int resourcemanager_unref_music(const char *key)
 {
-    return is_valid ? hashtable_music_t_unref(musics, key) : 0;
+    return is_valid ? hashtable_musicentry_t_unref(musics, key) : 0;
 }
 
 /* ------- samples ------- */
 void resourcemanager_add_sample(const char *key, sound_t *data)
 {
-    hashtable_sound_t_add(samples, key, data);
+    if(hashtable_sampleentry_t_find(samples, key) == NULL) {
+        stats.sample_bytes += sound_memory_usage(data);
+        stats.sample_count++;
+        hashtable_sampleentry_t_add(samples, key, create_entry(sample_handles, data));
+    }
+}
+
+void resourcemanager_count_sample_bytes(size_t bytes)
+{
+    stats.sample_bytes += bytes;
 }
 
 sound_t* resourcemanager_find_sample(const char *key)
 {
-    return hashtable_sound_t_find(samples, key);
+    sampleentry_t* entry = hashtable_sampleentry_t_find(samples, key);
+    return entry != NULL ? entry->data : NULL;
+}
+
+soundhandle_t resourcemanager_find_sample_handle(const char *key)
+{
+    sampleentry_t* entry = hashtable_sampleentry_t_find(samples, key);
+    return (soundhandle_t){ entry != NULL ? entry->handle : NULL_HANDLE };
+}
+
+sound_t* resourcemanager_sample_at(soundhandle_t handle)
+{
+    return is_valid ? handletable_get(sample_handles, handle.value) : NULL;
 }
 
 int resourcemanager_ref_sample(const char *key)
 {
-    return hashtable_sound_t_ref(samples, key);
+    int refs = hashtable_sampleentry_t_ref(samples, key);
+
+    /* the referenced sample is safe from eviction */
+    enforce_memory_budget();
+
+    return refs;
 }
 
 int resourcemanager_unref_sample(const char *key)
 {
-    return is_valid ? hashtable_sound_t_unref(samples, key) : 0;
+    int refs = is_valid ? hashtable_sampleentry_t_unref(samples, key) : 0;
+
+    if(refs == 0)
+        can_evict = true;
+
+    return refs;
+}
+
+void resourcemanager_foreach_sample(void* data, void (*callback)(sound_t*,void*))
+{
+    foreachsample_t context = { .data = data, .callback = callback };
+
+    if(is_valid)
+        hashtable_sampleentry_t_foreach(samples, &context, foreach_sample_entry);
+}
+
+void resourcemanager_foreach_image(void* data, void (*callback)(image_t*,void*))
+{
+    foreachimage_t context = { .data = data, .callback = callback };
+
+    if(is_valid)
+        hashtable_imageentry_t_foreach(images, &context, foreach_image_entry);
+}
+
+
+
+/* -------- private --------- */
+
+/* release unreferenced resources, least recently used first, until we're
+   within the memory budget. Images are evicted first, as they are larger */
+void enforce_memory_budget()
+{
+    if(!is_valid || stats.budget == 0 || !can_evict)
+        return;
+
+    while(stats.image_bytes + stats.sample_bytes > stats.budget) {
+        if(hashtable_imageentry_t_release_least_recently_used_entry(images))
+            stats.evictions++;
+        else if(hashtable_sampleentry_t_release_least_recently_used_entry(samples))
+            stats.evictions++;
+        else {
+            /* everything is referenced; we'll try again after an unref */
+            can_evict = false;
+            logfile_message(
+                "The resource manager is over its memory budget: %lu KB used, %lu KB budget",
+                (unsigned long)((stats.image_bytes + stats.sample_bytes) / 1024),
+                (unsigned long)(stats.budget / 1024)
+            );
+            break;
+        }
+    }
+}
+
+/* estimated texture memory used by an image */
+size_t image_memory_usage(const image_t* image)
+{
+    return image_texture_size(image);
+}
+
+/* creates an entry of a table and a handle to its resource */
+resourceentry_t* create_entry(handletable_t* handles, void* data)
+{
+    resourceentry_t* entry = mallocx(sizeof *entry);
+
+    entry->data = data;
+    entry->handle = handletable_add(handles, data);
+
+    return entry;
+}
+
+/* callbacks of resourcemanager_foreach_image() and of resourcemanager_foreach_sample() */
+void foreach_image_entry(imageentry_t* entry, void* context)
+{
+    foreachimage_t* foreach = (foreachimage_t*)context;
+    foreach->callback(entry->data, foreach->data);
+}
+
+void foreach_sample_entry(sampleentry_t* entry, void* context)
+{
+    foreachsample_t* foreach = (foreachsample_t*)context;
+    foreach->callback(entry->data, foreach->data);
+}
+
+/* destroy an image of the resource manager */
+void release_image(imageentry_t* entry)
+{
+    image_t* image = entry->data;
+    size_t size = image_memory_usage(image);
+
+    stats.image_bytes = stats.image_bytes > size ? stats.image_bytes - size : 0;
+    stats.image_count--;
+
+    handletable_remove(image_handles, entry->handle);
+    image_destroy(image);
+    free(entry);
+}
+
+/* destroy a sample of the resource manager */
+void release_sample(sampleentry_t* entry)
+{
+    sound_t* sample = entry->data;
+    size_t size = sound_memory_usage(sample);
+
+    stats.sample_bytes = stats.sample_bytes > size ? stats.sample_bytes - size : 0;
+    stats.sample_count--;
+
+    handletable_remove(sample_handles, entry->handle);
+    sound_destroy(sample);
+    free(entry);
+}
+
+/* destroy a music of the resource manager */
+void release_music(musicentry_t* entry)
+{
+    music_t* music = entry->data;
+
+    stats.music_count--;
+
+    handletable_remove(music_handles, entry->handle);
+    music_destroy(music);
+    free(entry);
 }
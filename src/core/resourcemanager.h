@@ -22,17 +22,41 @@
 #define _RESOURCEMANAGER_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /* forward declarations */
 struct image_t;
 struct sound_t;
 struct music_t;
 
+/* usage statistics */
+typedef struct resourcemanagerstats_t resourcemanagerstats_t;
+struct resourcemanagerstats_t {
+    size_t image_bytes; /* estimated size of the loaded images (texture memory) */
+    size_t sample_bytes; /* size of the loaded samples */
+    size_t budget; /* memory budget in bytes; 0 means unlimited */
+    int image_count; /* number of loaded images */
+    int sample_count; /* number of loaded samples */
+    int music_count; /* number of loaded musics */
+    int evictions; /* number of resources released because of the budget */
+};
+
+/* typed handles of the resources. A handle is an index and a generation
+   counter: dereferencing it is an array lookup, and the handle of a released
+   resource is stale and dereferences to NULL. A zero value is a null handle */
+typedef struct imagehandle_t { uint32_t value; } imagehandle_t;
+typedef struct soundhandle_t { uint32_t value; } soundhandle_t;
+typedef struct musichandle_t { uint32_t value; } musichandle_t;
+
 /* resource manager: public methods */
 void resourcemanager_init(); /* initializes the resource manager */
 void resourcemanager_release(); /* releases the resource manager */
 void resourcemanager_release_unused_resources(); /* memory optimization: reference counting */
+bool resourcemanager_release_unused_resources_incrementally(double time_budget); /* same as above, but spread over multiple calls; time_budget is in seconds. Returns true when a full pass has been completed */
 bool resourcemanager_is_initialized(); /* is the resource manager initialized? */
+void resourcemanager_set_memory_budget(size_t bytes); /* release unreferenced images & samples, least recently used first, when their memory exceeds the budget. 0 means unlimited */
+resourcemanagerstats_t resourcemanager_stats(); /* usage statistics */
 
 /* data handling */
 void resourcemanager_add_image(const char *key, struct image_t *data); /* adds an image to the dictionary */
@@ -40,15 +64,24 @@ struct image_t* resourcemanager_find_image(const char *key); /* finds an image i
 int resourcemanager_ref_image(const char *key); /* increments and returns the reference counting */
 int resourcemanager_unref_image(const char *key); /* decrements and returns the reference counting */
 bool resourcemanager_purge_image(const char *key); /* use with care */
+imagehandle_t resourcemanager_find_image_handle(const char *key); /* a handle to an image in the dictionary, or a null handle */
+struct image_t* resourcemanager_image_at(imagehandle_t handle); /* dereferences a handle; returns NULL if it is stale */
+void resourcemanager_foreach_image(void* data, void (*callback)(struct image_t*,void*)); /* enumerates the loaded images */
 
 void resourcemanager_add_music(const char *key, struct music_t *data);
 struct music_t* resourcemanager_find_music(const char *key);
 int resourcemanager_ref_music(const char *key);
 int resourcemanager_unref_music(const char *key);
+musichandle_t resourcemanager_find_music_handle(const char *key);
+struct music_t* resourcemanager_music_at(musichandle_t handle);
 
 void resourcemanager_add_sample(const char *key, struct sound_t *data);
 struct sound_t* resourcemanager_find_sample(const char *key);
 int resourcemanager_ref_sample(const char *key);
 int resourcemanager_unref_sample(const char *key);
+soundhandle_t resourcemanager_find_sample_handle(const char *key);
+struct sound_t* resourcemanager_sample_at(soundhandle_t handle);
+void resourcemanager_count_sample_bytes(size_t bytes); /* count the data of a sample that has been decoded after it was added */
+void resourcemanager_foreach_sample(void* data, void (*callback)(struct sound_t*,void*)); /* enumerates the loaded samples */
 
 #endif
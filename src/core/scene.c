@@ -89,6 +89,34 @@ void scenestack_push(scene_t *scn, void *data)
 
 
 
+/*
+ * scenestack_preload()
+ * Starts loading the assets of a scene in the background, so that pushing
+ * it later with the same data doesn't block. Call it, e.g., when starting
+ * a fade-out effect and push the scene when it's no longer preloading
+ */
+void scenestack_preload(scene_t *scn, void *data)
+{
+    if(scn->preload != NULL)
+        scn->preload(data);
+}
+
+
+
+/*
+ * scenestack_is_preloading()
+ * Checks if the assets of a scene are still being loaded in the background
+ */
+bool scenestack_is_preloading(const scene_t *scn, void *data)
+{
+    if(scn->is_preloading != NULL)
+        return scn->is_preloading(data);
+
+    return false;
+}
+
+
+
 /*
  * scenestack_pop()
  * Deletes the top-most scene of the stack.
@@ -151,6 +179,8 @@ scene_t *scene_create(void (*init_func)(void*), void (*update_func)(), void (*re
     s->update = update_func;
     s->render = render_func;
     s->release = release_func;
+    s->preload = NULL;
+    s->is_preloading = NULL;
     return s;
 }
 
@@ -167,6 +197,19 @@ scene_t *scene_destroy(scene_t *scn)
 
 
 
+/*
+ * scene_set_preloader()
+ * Lets a scene load its assets in the background before it's pushed.
+ * preload_func must return immediately
+ */
+void scene_set_preloader(scene_t *scn, void (*preload_func)(void*), bool (*is_preloading_func)(void*))
+{
+    scn->preload = preload_func;
+    scn->is_preloading = is_preloading_func;
+}
+
+
+
 /* private */
 extern void quest_init(void*);
 
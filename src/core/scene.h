@@ -21,16 +21,21 @@
 #ifndef _SCENE_H
 #define _SCENE_H
 
+#include <stdbool.h>
+
 /* Scene struct */
 typedef struct scene_t {
     void (*init)(void*);
     void (*update)();
     void (*render)();
     void (*release)();
+    void (*preload)(void*); /* optional; may be NULL */
+    bool (*is_preloading)(void*); /* optional; may be NULL */
 } scene_t;
 
 scene_t *scene_create(void (*init_func)(void*), void (*update_func)(), void (*render_func)(), void (*release_func)());
 scene_t *scene_destroy(scene_t *scn);
+void scene_set_preloader(scene_t *scn, void (*preload_func)(void*), bool (*is_preloading_func)(void*)); /* preload_func starts loading assets in the background */
 
 
 
@@ -39,6 +44,8 @@ scene_t *scene_destroy(scene_t *scn);
 void scenestack_init();
 void scenestack_release();
 void scenestack_push(scene_t *scn, void *data); /* some generic data will be passed to <scene>_init() */
+void scenestack_preload(scene_t *scn, void *data); /* start loading the assets of a scene that will be pushed with the same data */
+bool scenestack_is_preloading(const scene_t *scn, void *data); /* push the scene when this is false to avoid a hitch */
 void scenestack_pop();
 scene_t *scenestack_top();
 int scenestack_empty();
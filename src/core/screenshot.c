@@ -18,18 +18,65 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_image.h>
+#include <allegro5/allegro_physfs.h>
 #include <stdio.h>
+#include <string.h>
 #include "screenshot.h"
 #include "asset.h"
 #include "logfile.h"
 #include "image.h"
 #include "video.h"
 #include "input.h"
+#include "../util/util.h"
+#include "../util/stringutil.h"
+
+/* Captured frames are read from the backbuffer in the main thread and
+   encoded or written to the disk in a worker thread, so that taking a
+   screenshot or recording a video doesn't stall the game */
+typedef enum captureframetype_t captureframetype_t;
+enum captureframetype_t
+{
+    CAPTURE_SCREENSHOT, /* encode the frame to an image file */
+    CAPTURE_VIDEO_FRAME, /* append the raw frame to a video file */
+    CAPTURE_VIDEO_END /* close the video file */
+};
+
+typedef struct captureframe_t captureframe_t;
+struct captureframe_t
+{
+    captureframetype_t type;
+    uint8_t* pixels; /* RGBA, row by row; NULL if there are no pixels */
+    int width, height;
+    char path[1024]; /* where to write the frame */
+};
+
+#define CAPTURE_QUEUE_CAPACITY 8 /* how many frames may be waiting to be written */
+#define RECORDING_FPS 60 /* one frame is recorded per rendered frame */
+static struct {
+    ALLEGRO_THREAD* thread;
+    ALLEGRO_MUTEX* mutex;
+    ALLEGRO_COND* cond; /* signaled when the queue changes */
+    captureframe_t queue[CAPTURE_QUEUE_CAPACITY]; /* a ring buffer protected by the mutex */
+    int head, count;
+    bool quit;
+} worker = { .thread = NULL };
+
+static void* capture_worker(ALLEGRO_THREAD* thread, void* arg);
+static void start_worker();
+static void stop_worker();
+static bool enqueue_frame(captureframetype_t type, const char* path, bool wait_if_full);
+static void write_frame(const captureframe_t* frame, ALLEGRO_FILE** video_file, char* video_path, size_t video_path_size);
 
 /* private data */
 static const char* screenshot_filename(int screenshot_id);
+static const char* recording_filename(int recording_id);
 static const int MAX_SCREENSHOTS = 1000000;
 static int next_screenshot_id = 0;
+static int next_recording_id = 0;
+static bool is_recording = false;
+static int dropped_frames = 0;
 static input_t *in;
 
 /*
@@ -44,27 +91,58 @@ void screenshot_init()
     /* What's the next screenshot? */
     while(asset_exists(screenshot_filename(next_screenshot_id)) &&
     ++next_screenshot_id < MAX_SCREENSHOTS);
+
+    /* What's the next recording? */
+    while(asset_exists(recording_filename(next_recording_id)) &&
+    ++next_recording_id < MAX_SCREENSHOTS);
+
+    /* Start the worker thread */
+    start_worker();
 }
 
 
 /*
  * screenshot_update()
  * Checks if the user wants to take a snapshot, and if
- * he/she does, we must do it.
+ * he/she does, we must do it. Call after rendering a frame
  */
 void screenshot_update()
 {
-    image_t* snapshot;
-
     /* take the snapshot */
     if(input_button_pressed(in, IB_FIRE1) || input_button_pressed(in, IB_FIRE2)) {
         const char *filename = screenshot_filename(next_screenshot_id++);
         logfile_message("New screenshot: \"%s\"", filename);
-        snapshot = video_take_snapshot();
-        image_save(snapshot, filename);
-        image_destroy(snapshot);
+        enqueue_frame(CAPTURE_SCREENSHOT, filename, true);
         video_showmessage("New screenshot: %s", filename);
     }
+
+    /* start or stop recording */
+    if(input_button_pressed(in, IB_FIRE3)) {
+        if(!is_recording) {
+            const char *filename = recording_filename(next_recording_id++);
+            const image_t* source = video_get_snapshot_source();
+            logfile_message(
+                "Recording %dx%d RGBA frames at %d fps to \"%s\". Encode with: ffmpeg -f rawvideo -pixel_format rgba -video_size %dx%d -framerate %d -i %s video.mp4",
+                image_width(source), image_height(source), RECORDING_FPS, filename,
+                image_width(source), image_height(source), RECORDING_FPS, str_basename(filename)
+            );
+            video_showmessage("Recording: %s", filename);
+            dropped_frames = 0;
+            is_recording = true;
+        }
+        else {
+            logfile_message("Stopped recording. Dropped frames: %d", dropped_frames);
+            video_showmessage("Stopped recording");
+            enqueue_frame(CAPTURE_VIDEO_END, "", true);
+            is_recording = false;
+        }
+    }
+
+    /* record a frame */
+    if(is_recording) {
+        if(!enqueue_frame(CAPTURE_VIDEO_FRAME, recording_filename(next_recording_id - 1), false))
+            dropped_frames++;
+    }
 }
 
 
@@ -74,6 +152,15 @@ void screenshot_update()
  */
 void screenshot_release()
 {
+    /* Stop recording */
+    if(is_recording) {
+        enqueue_frame(CAPTURE_VIDEO_END, "", true);
+        is_recording = false;
+    }
+
+    /* Write the pending frames */
+    stop_worker();
+
     /* We're done with the input object */
     input_destroy(in);
 }
@@ -89,4 +176,235 @@ const char* screenshot_filename(int screenshot_id)
     static char filename[32];
     snprintf(filename, sizeof(filename), "screenshots/s%03d.png", screenshot_id);
     return filename;
-}
\ No newline at end of file
+}
+
+const char* recording_filename(int recording_id)
+{
+    static char filename[32];
+    snprintf(filename, sizeof(filename), "screenshots/r%03d.rgba", recording_id);
+    return filename;
+}
+
+
+
+/* capture pipeline */
+
+/* start the worker thread. If we can't, the frames are written in the main thread */
+void start_worker()
+{
+    worker.head = worker.count = 0;
+    worker.quit = false;
+    worker.mutex = al_create_mutex();
+    worker.cond = al_create_cond();
+    worker.thread = NULL;
+
+    if(worker.mutex != NULL && worker.cond != NULL)
+        worker.thread = al_create_thread(capture_worker, NULL);
+
+    if(worker.thread != NULL)
+        al_start_thread(worker.thread);
+    else
+        logfile_message("Can't create the capture thread. Frames will be written synchronously");
+}
+
+/* stop the worker thread after it writes the pending frames */
+void stop_worker()
+{
+    if(worker.thread != NULL) {
+        al_lock_mutex(worker.mutex);
+        worker.quit = true;
+        al_broadcast_cond(worker.cond);
+        al_unlock_mutex(worker.mutex);
+
+        al_join_thread(worker.thread, NULL);
+        al_destroy_thread(worker.thread);
+        worker.thread = NULL;
+    }
+
+    if(worker.cond != NULL)
+        al_destroy_cond(worker.cond);
+    if(worker.mutex != NULL)
+        al_destroy_mutex(worker.mutex);
+
+    worker.cond = NULL;
+    worker.mutex = NULL;
+}
+
+/* read the last rendered frame and hand it to the worker. Returns false
+   if the frame has been dropped because the worker is lagging behind */
+bool enqueue_frame(captureframetype_t type, const char* path, bool wait_if_full)
+{
+    captureframe_t frame;
+
+    /* setup the frame */
+    frame.type = type;
+    frame.pixels = NULL;
+    frame.width = frame.height = 0;
+    str_cpy(frame.path, *path ? asset_path(path) : "", sizeof(frame.path)); /* asset_path() is not thread-safe */
+
+    /* no worker thread? */
+    if(worker.thread == NULL) {
+        static ALLEGRO_FILE* video_file = NULL;
+        static char video_path[sizeof(frame.path)] = "";
+
+        if(type != CAPTURE_VIDEO_END) {
+            const image_t* source = video_get_snapshot_source();
+            frame.width = image_width(source);
+            frame.height = image_height(source);
+            frame.pixels = mallocx(frame.width * frame.height * 4);
+            if(!image_read_pixels(source, frame.pixels)) {
+                free(frame.pixels);
+                return false;
+            }
+        }
+
+        write_frame(&frame, &video_file, video_path, sizeof(video_path));
+        free(frame.pixels);
+        return true;
+    }
+
+    /* wait for room in the queue, or drop the frame */
+    al_lock_mutex(worker.mutex);
+    while(worker.count == CAPTURE_QUEUE_CAPACITY) {
+        if(!wait_if_full) {
+            al_unlock_mutex(worker.mutex);
+            return false;
+        }
+        al_wait_cond(worker.cond, worker.mutex);
+    }
+    al_unlock_mutex(worker.mutex);
+
+    /* read the pixels in this thread; the GPU can't be accessed by the worker */
+    if(type != CAPTURE_VIDEO_END) {
+        const image_t* source = video_get_snapshot_source();
+        frame.width = image_width(source);
+        frame.height = image_height(source);
+        frame.pixels = mallocx(frame.width * frame.height * 4);
+        if(!image_read_pixels(source, frame.pixels)) {
+            free(frame.pixels);
+            return false;
+        }
+    }
+
+    /* hand the frame to the worker. We are the only producer,
+       so there is still room in the queue */
+    al_lock_mutex(worker.mutex);
+    worker.queue[(worker.head + worker.count) % CAPTURE_QUEUE_CAPACITY] = frame;
+    worker.count++;
+    al_broadcast_cond(worker.cond);
+    al_unlock_mutex(worker.mutex);
+
+    return true;
+}
+
+/* the worker thread */
+void* capture_worker(ALLEGRO_THREAD* thread, void* arg)
+{
+    ALLEGRO_FILE* video_file = NULL;
+    char video_path[sizeof(worker.queue[0].path)] = "";
+
+    /* use the physfs file interface in this thread */
+    al_set_physfs_file_interface();
+
+    al_lock_mutex(worker.mutex);
+    for(;;) {
+        /* wait for a frame */
+        while(worker.count == 0 && !worker.quit)
+            al_wait_cond(worker.cond, worker.mutex);
+
+        /* the queue is drained before quitting */
+        if(worker.count == 0)
+            break;
+
+        captureframe_t frame = worker.queue[worker.head];
+        worker.head = (worker.head + 1) % CAPTURE_QUEUE_CAPACITY;
+        worker.count--;
+        al_broadcast_cond(worker.cond);
+        al_unlock_mutex(worker.mutex);
+
+        /* write the frame */
+        write_frame(&frame, &video_file, video_path, sizeof(video_path));
+        free(frame.pixels);
+
+        al_lock_mutex(worker.mutex);
+    }
+    al_unlock_mutex(worker.mutex);
+
+    /* close the video, if the recording hasn't ended properly */
+    if(video_file != NULL)
+        al_fclose(video_file);
+
+    return NULL;
+}
+
+/* write a captured frame to the disk. *video_file is the open video, if any */
+void write_frame(const captureframe_t* frame, ALLEGRO_FILE** video_file, char* video_path, size_t video_path_size)
+{
+    switch(frame->type) {
+        case CAPTURE_SCREENSHOT: {
+            /* encode the image in memory; no GPU is involved */
+            int flags = al_get_new_bitmap_flags();
+            int format = al_get_new_bitmap_format();
+            al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+            al_set_new_bitmap_format(ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE);
+            ALLEGRO_BITMAP* bmp = al_create_bitmap(frame->width, frame->height);
+            al_set_new_bitmap_format(format);
+            al_set_new_bitmap_flags(flags);
+
+            if(bmp != NULL) {
+                ALLEGRO_LOCKED_REGION* region = al_lock_bitmap(bmp, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_WRITEONLY);
+                if(region != NULL) {
+                    int row_size = frame->width * 4;
+                    for(int y = 0; y < frame->height; y++)
+                        memcpy((uint8_t*)region->data + y * region->pitch, frame->pixels + y * row_size, row_size);
+                    al_unlock_bitmap(bmp);
+
+                    /* logfile_message() is thread-safe */
+                    if(al_save_bitmap(frame->path, bmp))
+                        logfile_message("Saved image to \"%s\"", frame->path);
+                    else
+                        logfile_message("Failed to save image to \"%s\"", frame->path);
+                }
+
+                al_destroy_bitmap(bmp);
+            }
+
+            break;
+        }
+
+        case CAPTURE_VIDEO_FRAME: {
+            /* open the video on its first frame */
+            if(*video_file == NULL || strcmp(video_path, frame->path) != 0) {
+                if(*video_file != NULL)
+                    al_fclose(*video_file);
+
+                str_cpy(video_path, frame->path, video_path_size);
+                if(NULL == (*video_file = al_fopen(frame->path, "wb")))
+                    logfile_message("Can't open \"%s\" for recording", frame->path);
+            }
+
+            /* append the raw frame */
+            if(*video_file != NULL) {
+                size_t size = frame->width * frame->height * 4;
+                if(al_fwrite(*video_file, frame->pixels, size) != size) {
+                    logfile_message("Can't write to \"%s\"", frame->path);
+                    al_fclose(*video_file);
+                    *video_file = NULL;
+                }
+            }
+
+            break;
+        }
+
+        case CAPTURE_VIDEO_END: {
+            if(*video_file != NULL) {
+                al_fclose(*video_file);
+                *video_file = NULL;
+                logfile_message("Saved video to \"%s\"", video_path);
+            }
+
+            *video_path = '\0';
+            break;
+        }
+    }
+}
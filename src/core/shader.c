@@ -22,6 +22,7 @@
 #include "shader.h"
 #include "../util/dictionary.h"
 #include "../util/iterator.h"
+#include "../util/atomdict.h"
 #include "../util/util.h"
 #include "../util/stringutil.h"
 #include "../util/numeric.h"
@@ -34,7 +35,7 @@ struct shader_t
     ALLEGRO_SHADER* shader; /* the first field */
     char* fs;
     char* vs;
-    dictionary_t* uniforms;
+    atomdict_t* uniforms; /* keyed by the atoms of the names of the variables */
     int next_texture_unit;
 };
 
@@ -74,6 +75,7 @@ enum shader_uniformtype_t
 struct shader_uniform_t
 {
     shader_uniformtype_t type;
+    bool is_uploaded; /* true if the GLSL program holds the current value */
     char name[1 + UNIFORM_NAME_MAXLEN];
     union {
         float f;
@@ -87,6 +89,8 @@ struct shader_uniform_t
 static shader_uniform_t* create_uniform(shader_uniformtype_t type, const char* var_name);
 static void destroy_uniform(shader_uniform_t* uniform);
 static bool set_uniform(const shader_uniform_t* uniform);
+static void invalidate_uniforms(atomdict_t* uniforms);
+static inline bool is_sampler(const shader_uniform_t* uniform) { return uniform->type >= TYPE_SAMPLER_0 && uniform->type <= TYPE_SAMPLER_15; }
 static void uniform_dtor(void *uniform, void* ctx) { destroy_uniform((shader_uniform_t*)uniform); (void)ctx; }
 
 /* default vertex shader */
@@ -156,6 +160,7 @@ static const char DEFAULT_SHADER_NAME[] = "default";
 static shader_t* default_shader = NULL;
 static const shader_t* active_shader = NULL;
 static dictionary_t* registry = NULL;
+static bool is_drawing_halted = false; /* true if the shaders can't be recreated */
 
 
 
@@ -168,6 +173,7 @@ void shader_init()
     LOG("Initializing...");
     default_shader = NULL;
     active_shader = NULL;
+    is_drawing_halted = false;
 
     /* initialize the registry of shaders */
     registry = dictionary_create(false, destroy_shader_callback, NULL);
@@ -221,25 +227,25 @@ void shader_discard_all()
     }
 
     iterator_destroy(it);
+
+    /* the shaders can't be recreated until drawing is resumed */
+    is_drawing_halted = true;
 }
 
 /*
  * shader_recreate_all()
- * Recreate all registered shaders after discarding them
+ * Recreate all registered shaders after discarding them. Only the default
+ * shader is recreated immediately; the others are recreated when they are
+ * first activated, so that resuming doesn't recompile shaders that may not
+ * be needed for a while
  */
 void shader_recreate_all()
 {
     LOG("Recreating all shaders...");
 
-    /* recreate all shaders */
-    iterator_t* it = dictionary_values(registry);
-
-    while(iterator_has_next(it)) {
-        shader_t* shader = iterator_next(it);
-        recreate_shader(shader);
-    }
-
-    iterator_destroy(it);
+    is_drawing_halted = false;
+    if(default_shader != NULL && default_shader->shader == NULL)
+        recreate_shader(default_shader);
 }
 
 
@@ -290,9 +296,12 @@ shader_t* shader_create_ex(const char* name, const char* fs_glsl, const char* vs
     /* log */
     LOG("Creating shader \"%s\"...", name);
 
-    /* create GLSL shader */
-    shader->shader = create_glsl_shader(fs_glsl, vs_glsl, error, sizeof error);
-    if(shader->shader == NULL) {
+    /* create GLSL shader. In headless mode, there is no rendering context;
+       the shader is kept as a no-op */
+    shader->shader = NULL;
+    if(al_get_current_display() == NULL)
+        LOG("Headless mode: shader \"%s\" is a no-op", name);
+    else if(NULL == (shader->shader = create_glsl_shader(fs_glsl, vs_glsl, error, sizeof error))) {
         LOG("Can't create shader!");
         FATAL("%s", error);
     }
@@ -302,7 +311,7 @@ shader_t* shader_create_ex(const char* name, const char* fs_glsl, const char* vs
     shader->fs = str_dup(fs_glsl);
 
     /* create the dictionary of uniforms */
-    shader->uniforms = dictionary_create(true, uniform_dtor, NULL);
+    shader->uniforms = atomdict_create(uniform_dtor, NULL);
 
     /* set the next texture unit */
     shader->next_texture_unit = 1; /* unit 0 is used by Allegro */
@@ -327,17 +336,37 @@ bool shader_set_active(const shader_t* shader)
 
        https://liballeg.org/a5docs/trunk/shader.html */
 
+    /* headless mode: no drawing takes place */
+    if(al_get_current_display() == NULL) {
+        active_shader = shader;
+        return true;
+    }
+
+    /* recreate the shader if it has been discarded */
+    if(shader->shader == NULL) {
+        if(is_drawing_halted)
+            return false;
+
+        recreate_shader((shader_t*)shader); /* the GLSL shader is managed internally */
+    }
+
     /* use the shader */
     bool success = al_use_shader(shader->shader);
 
-    /* set uniform variables */
+    /* set uniform variables. The GLSL program keeps the values of its uniforms,
+       so we only upload those that have changed. Samplers are always set,
+       because the bindings of the texture units are shared by all shaders */
     if(success) {
-        iterator_t* it = dictionary_values(shader->uniforms);
-        while(iterator_has_next(it)) {
-            const shader_uniform_t* uniform = iterator_next(it);
-            set_uniform(uniform);
+        atomdictiter_t it;
+        void* element;
+        atomdictiter_init(&it, shader->uniforms);
+        while(atomdictiter_next(&it, NULL, &element)) {
+            shader_uniform_t* uniform = element;
+            if(!uniform->is_uploaded || is_sampler(uniform)) {
+                set_uniform(uniform);
+                uniform->is_uploaded = true; /* don't retry if the uniform isn't used by the program */
+            }
         }
-        iterator_destroy(it);
     }
 
     /* update active shader */
@@ -374,18 +403,22 @@ const shader_t* shader_get_default()
  */
 void shader_set_float(shader_t* shader, const char* var_name, float value)
 {
-    shader_uniform_t* stored_uniform = dictionary_get(shader->uniforms, var_name);
+    atom_t key = atom_intern(var_name);
+    shader_uniform_t* stored_uniform = atomdict_get(shader->uniforms, key);
 
     if(stored_uniform == NULL) {
         /* add new uniform */
         stored_uniform = create_uniform(TYPE_FLOAT, var_name);
         stored_uniform->value.f = value;
-        dictionary_put(shader->uniforms, var_name, stored_uniform);
+        atomdict_put(shader->uniforms, key, stored_uniform);
     }
     else {
         /* update uniform */
         assertx(stored_uniform->type == TYPE_FLOAT, "Can't change uniform type");
-        stored_uniform->value.f = value;
+        if(stored_uniform->value.f != value) {
+            stored_uniform->value.f = value;
+            stored_uniform->is_uploaded = false;
+        }
     }
 }
 
@@ -395,18 +428,22 @@ void shader_set_float(shader_t* shader, const char* var_name, float value)
  */
 void shader_set_int(shader_t* shader, const char* var_name, int value)
 {
-    shader_uniform_t* stored_uniform = dictionary_get(shader->uniforms, var_name);
+    atom_t key = atom_intern(var_name);
+    shader_uniform_t* stored_uniform = atomdict_get(shader->uniforms, key);
 
     if(stored_uniform == NULL) {
         /* add new uniform */
         stored_uniform = create_uniform(TYPE_INT, var_name);
         stored_uniform->value.i = value;
-        dictionary_put(shader->uniforms, var_name, stored_uniform);
+        atomdict_put(shader->uniforms, key, stored_uniform);
     }
     else {
         /* update uniform */
         assertx(stored_uniform->type == TYPE_INT, "Can't change uniform type");
-        stored_uniform->value.i = value;
+        if(stored_uniform->value.i != value) {
+            stored_uniform->value.i = value;
+            stored_uniform->is_uploaded = false;
+        }
     }
 }
 
@@ -416,18 +453,22 @@ void shader_set_int(shader_t* shader, const char* var_name, int value)
  */
 void shader_set_bool(shader_t* shader, const char* var_name, bool value)
 {
-    shader_uniform_t* stored_uniform = dictionary_get(shader->uniforms, var_name);
+    atom_t key = atom_intern(var_name);
+    shader_uniform_t* stored_uniform = atomdict_get(shader->uniforms, key);
 
     if(stored_uniform == NULL) {
         /* add new uniform */
         stored_uniform = create_uniform(TYPE_BOOL, var_name);
         stored_uniform->value.b = value;
-        dictionary_put(shader->uniforms, var_name, stored_uniform);
+        atomdict_put(shader->uniforms, key, stored_uniform);
     }
     else {
         /* update uniform */
         assertx(stored_uniform->type == TYPE_BOOL, "Can't change uniform type");
-        stored_uniform->value.b = value;
+        if(stored_uniform->value.b != value) {
+            stored_uniform->value.b = value;
+            stored_uniform->is_uploaded = false;
+        }
     }
 }
 
@@ -438,18 +479,22 @@ void shader_set_bool(shader_t* shader, const char* var_name, bool value)
 void shader_set_float_vector(shader_t* shader, const char* var_name, int num_components, const float* value)
 {
     assertx(num_components >= 2 && num_components <= 4);
-    shader_uniform_t* stored_uniform = dictionary_get(shader->uniforms, var_name);
+    atom_t key = atom_intern(var_name);
+    shader_uniform_t* stored_uniform = atomdict_get(shader->uniforms, key);
 
     if(stored_uniform == NULL) {
         /* add new uniform */
         stored_uniform = create_uniform(TYPE_FLOAT2 + (num_components-2), var_name);
         memcpy(stored_uniform->value.fvec, value, num_components * sizeof(*value));
-        dictionary_put(shader->uniforms, var_name, stored_uniform);
+        atomdict_put(shader->uniforms, key, stored_uniform);
     }
     else {
         /* update uniform */
         assertx(stored_uniform->type == TYPE_FLOAT2 + (num_components-2), "Can't change uniform type");
-        memcpy(stored_uniform->value.fvec, value, num_components * sizeof(*value));
+        if(memcmp(stored_uniform->value.fvec, value, num_components * sizeof(*value)) != 0) {
+            memcpy(stored_uniform->value.fvec, value, num_components * sizeof(*value));
+            stored_uniform->is_uploaded = false;
+        }
     }
 }
 
@@ -459,7 +504,8 @@ void shader_set_float_vector(shader_t* shader, const char* var_name, int num_com
  */
 void shader_set_sampler(shader_t* shader, const char* var_name, const image_t* image)
 {
-    shader_uniform_t* stored_uniform = dictionary_get(shader->uniforms, var_name);
+    atom_t key = atom_intern(var_name);
+    shader_uniform_t* stored_uniform = atomdict_get(shader->uniforms, key);
 
     /* set the texture unit */
     int unit = (stored_uniform == NULL) ? shader->next_texture_unit++ : (int)stored_uniform->type - TYPE_SAMPLER_0;
@@ -469,7 +515,7 @@ void shader_set_sampler(shader_t* shader, const char* var_name, const image_t* i
         /* add new uniform */
         stored_uniform = create_uniform(TYPE_SAMPLER_0 + unit, var_name);
         stored_uniform->value.tex = image;
-        dictionary_put(shader->uniforms, var_name, stored_uniform);
+        atomdict_put(shader->uniforms, key, stored_uniform);
     }
     else {
         /* update uniform */
@@ -532,7 +578,7 @@ void destroy_shader_callback(void* shader, void* context)
 void destroy_shader(shader_t* shader)
 {
     /* release the dictionary of uniforms */
-    dictionary_destroy(shader->uniforms);
+    atomdict_destroy(shader->uniforms);
 
     /* release the source code */
     free(shader->fs);
@@ -545,12 +591,12 @@ void destroy_shader(shader_t* shader)
     free(shader);
 }
 
-/* discard a shader */
+/* discard a shader. It may have been discarded already, if it
+   hasn't been used since the previous time drawing was resumed */
 void discard_shader(shader_t* shader)
 {
-    assertx(shader->shader != NULL);
-
-    shader->shader = destroy_glsl_shader(shader->shader);
+    if(shader->shader != NULL)
+        shader->shader = destroy_glsl_shader(shader->shader);
 }
 
 /* recreate a shader (after discarding it) */
@@ -564,6 +610,9 @@ void recreate_shader(shader_t* shader)
         LOG("Can't recreate shader!");
         FATAL("%s", error);
     }
+
+    /* the new GLSL program has none of the values of the uniforms */
+    invalidate_uniforms(shader->uniforms);
 }
 
 /* create a uniform sturct */
@@ -593,6 +642,19 @@ void destroy_uniform(shader_uniform_t* uniform)
     free(uniform);
 }
 
+/* mark all uniforms of a shader as not uploaded */
+void invalidate_uniforms(atomdict_t* uniforms)
+{
+    atomdictiter_t it;
+    void* element;
+    atomdictiter_init(&it, uniforms);
+
+    while(atomdictiter_next(&it, NULL, &element)) {
+        shader_uniform_t* uniform = element;
+        uniform->is_uploaded = false;
+    }
+}
+
 /* set value of uniform variable (current shader) */
 bool set_uniform(const shader_uniform_t* uniform)
 {
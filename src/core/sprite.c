@@ -18,6 +18,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdint.h>
 #include <string.h>
 #include "sprite.h"
 #include "animation.h"
@@ -32,8 +33,8 @@
 #include "../util/stringutil.h"
 #include "../util/darray.h"
 #include "../util/hashtable.h"
-#include "../util/dictionary.h"
-#include "../util/iterator.h"
+#include "../util/atom.h"
+#include "../util/atomdict.h"
 #include "../physics/collisionmask.h"
 
 typedef struct animtransition_t animtransition_t;
@@ -54,18 +55,18 @@ struct spriteinfo_t {
 
     int frame_count; /* every frame related to this sprite */
     image_t** frame_data; /* image_t* vector */
+    collisionmask_t** frame_mask; /* shared collision masks of the frames, lazily created */
     const image_t* spritesheet; /* reference to the spritesheet */
 
     int animation_count;
     animation_t** animation_data; /* vector of animation_t* */
 
     DARRAY(animtransition_t*, transition); /* transitions */
-    DARRAY(animtransition_t*, preprocessed_transition); /* transitions without "any" sorted by from_id and then by to_id */
-    int* transition_from; /* transition_from[i] is the first index of preprocessed_transition having from_id == i, if it exists */
-    int transition_from_length; /* length of transition_from[] */
+    uint16_t* transition_table; /* transition_table[from_id * transition_table_size + to_id] is the ID of a transition animation, or 0 if there is none */
+    int transition_table_size; /* 1 + the largest animation ID */
 
-    dictionary_t* prog_anims; /* keyframe-based animations */
-    dictionary_t* user_properties; /* user-defined properties */
+    atomdict_t* prog_anims; /* keyframe-based animations */
+    atomdict_t* user_properties; /* user-defined properties */
 };
 
 /* transitions are animations that play between two other animations */
@@ -108,22 +109,58 @@ static void validate_sprite(spriteinfo_t *spr); /* validates the sprite */
 static spriteinfo_t *spriteinfo_new(); /* creates a new spriteinfo_t instance */
 static spriteinfo_t *spriteinfo_delete(spriteinfo_t *sprite); /* deletes an existing spriteinfo_t instance */
 static animation_t *allocate_sprite_anim(spriteinfo_t *sprite, int anim_id); /* allocate an animation ID in a spriteinfo_t instance */
-static int transition_cmp(const void *t1, const void *t2); /* comparison function for sorting */
 static void validate_transitions(const spriteinfo_t *sprite);
 static void preprocess_transitions(spriteinfo_t *sprite);
 static void load_sprite_images(spriteinfo_t *spr); /* loads the sprite by reading the spritesheet */
 static int scanfile(const char* vpath, void* param); /* file system callback */
+static int prefetch_spritesheets(const parsetree_statement_t *stmt); /* sprite block traversal */
+static int prefetch_spritesheet(const parsetree_statement_t *stmt); /* sprite attributes traversal */
 static int traverse(const parsetree_statement_t *stmt, void *vpath);
+static int traverse_reload(const parsetree_statement_t *stmt, void *count);
 static int traverse_sprite_attributes(const parsetree_statement_t *stmt, void *spriteinfo);
 static int traverse_user_properties(const parsetree_statement_t *stmt, void *dict);
 static void inspect_transitions(const spriteinfo_t* sprite);
 static void destroy_proganim(void* element, void* context);
 static void destroy_userproperty(void* element, void* context);
+static spriteinfo_t* find_sprite(const char* sprite_name);
+static spriteinfo_t* find_sprite_by_handle(sprite_handle_t handle);
+static void forget_handle(const char* sprite_name);
+
+/* parsed .spr files; we parse all of them before creating the sprites,
+   so that the spritesheets can be decoded in parallel */
+typedef struct sprfile_t sprfile_t;
+struct sprfile_t {
+    char* vpath;
+    parsetree_program_t* tree;
+};
+STATIC_DARRAY(sprfile_t, sprfile);
+
+/* sprites replaced by a hot reload are retired instead of destroyed,
+   because actors may still point to their animations. They're destroyed
+   when the sprite system is released */
+STATIC_DARRAY(spriteinfo_t*, retired);
+static bool reloading = false;
+static void destroy_sprite(spriteinfo_t* info) { if(reloading) darray_push(retired, info); else spriteinfo_destroy(info); }
 
 /* hash table that stores the metadata of the sprites */
-HASHTABLE_GENERATE_CODE(spriteinfo_t, spriteinfo_destroy);
+HASHTABLE_GENERATE_CODE(spriteinfo_t, destroy_sprite);
 static HASHTABLE(spriteinfo_t, sprites);
 
+/* declarations of sprites not yet created; used in the lazy loading mode.
+   A declaration refers to a block of a parse tree stored in sprfile */
+typedef struct spritedecl_t spritedecl_t;
+struct spritedecl_t {
+    const parsetree_program_t* program; /* sprite attributes */
+};
+static void spritedecl_destroy(spritedecl_t* decl) { free(decl); }
+HASHTABLE_GENERATE_CODE(spritedecl_t, spritedecl_destroy);
+static HASHTABLE(spritedecl_t, declarations);
+static bool lazy_loading = false;
+
+/* sprite handles are the atoms of the sprite names. resolved[handle] is
+   the sprite of the handle, or NULL if it hasn't been looked up yet */
+STATIC_DARRAY(spriteinfo_t*, resolved);
+
 
 
 
@@ -131,16 +168,53 @@ static HASHTABLE(spriteinfo_t, sprites);
 
 /*
  * sprite_init()
- * Initializes the sprite system
+ * Initializes the sprite system. In the lazy loading mode, the
+ * .spr files are parsed at startup, but each sprite is only
+ * created (and its spritesheet loaded) when it's first used
  */
-void sprite_init()
+void sprite_init(bool lazy)
 {
-    logfile_message("Loading sprites...");
+    lazy_loading = lazy;
     sprites = hashtable_spriteinfo_t_create();
+    declarations = hashtable_spritedecl_t_create();
+    darray_init(resolved);
+    darray_init(retired);
+
+    /* lazy loading: index the sprites, keeping the parse trees */
+    if(lazy_loading) {
+        logfile_message("Indexing sprites...");
+
+        darray_init(sprfile);
+        asset_foreach_file("sprites", ".spr", scanfile, NULL, true);
+        for(int i = 0; i < darray_length(sprfile); i++)
+            nanoparser_traverse_program_ex(sprfile[i].tree, (void*)sprfile[i].vpath, traverse);
+
+        logfile_message("All sprites have been indexed!");
+        return;
+    }
+
+    logfile_message("Loading sprites...");
 
-    /* scan the sprites/ folder */
+    /* scan the sprites/ folder, packing the spritesheets into a
+       texture atlas for better batching when rendering */
+    image_begin_atlas();
+    image_begin_prefetch();
+
+    /* parse the .spr files and prefetch their spritesheets */
+    darray_init(sprfile);
     asset_foreach_file("sprites", ".spr", scanfile, NULL, true);
 
+    /* create the sprites in the order of the files */
+    for(int i = 0; i < darray_length(sprfile); i++) {
+        nanoparser_traverse_program_ex(sprfile[i].tree, (void*)sprfile[i].vpath, traverse);
+        nanoparser_deconstruct_tree(sprfile[i].tree);
+        free(sprfile[i].vpath);
+    }
+    darray_release(sprfile);
+
+    image_end_prefetch();
+    image_end_atlas();
+
     logfile_message("All sprites have been loaded!");
 }
 
@@ -152,7 +226,23 @@ void sprite_init()
 void sprite_release()
 {
     logfile_message("Releasing sprites...");
+    darray_release(resolved);
     sprites = hashtable_spriteinfo_t_destroy(sprites);
+
+    for(int i = 0; i < darray_length(retired); i++)
+        spriteinfo_destroy(retired[i]);
+    darray_release(retired);
+    declarations = hashtable_spritedecl_t_destroy(declarations);
+
+    /* release the parse trees kept by the lazy loading mode */
+    if(lazy_loading) {
+        for(int i = 0; i < darray_length(sprfile); i++) {
+            nanoparser_deconstruct_tree(sprfile[i].tree);
+            free(sprfile[i].vpath);
+        }
+        darray_release(sprfile);
+        lazy_loading = false;
+    }
 }
 
 
@@ -172,7 +262,7 @@ const animation_t *sprite_get_animation(const char *sprite_name, int anim_id)
         return sprite_get_animation(DEFAULT_SPRITE, DEFAULT_ANIM);
 
     /* find the corresponding spriteinfo_t* instance */
-    sprite = hashtable_spriteinfo_t_find(sprites, sprite_name);
+    sprite = find_sprite(sprite_name);
     if(sprite != NULL) {
         if(anim_id >= 0 && anim_id < sprite->animation_count) {
             if(sprite->animation_data[anim_id] != NULL)
@@ -189,13 +279,85 @@ const animation_t *sprite_get_animation(const char *sprite_name, int anim_id)
 }
 
 
+/*
+ * sprite_prefetch()
+ * Schedules the spritesheet of a sprite to be decoded in a background
+ * thread (see image_prefetch()). Sprites are only created on demand in
+ * the lazy loading mode; this does nothing if the sprite already exists
+ */
+void sprite_prefetch(const char* sprite_name)
+{
+    if(!lazy_loading || hashtable_spriteinfo_t_find(sprites, sprite_name) != NULL)
+        return;
+
+    const spritedecl_t* decl = hashtable_spritedecl_t_find(declarations, sprite_name);
+    if(decl != NULL)
+        nanoparser_traverse_program(decl->program, prefetch_spritesheet);
+}
+
+/*
+ * sprite_reload_file()
+ * Redefines the sprites of a .spr file that has been modified, given its
+ * virtual path. Sprite handles will refer to the new definitions, and the
+ * actors will pick them up as they change their animations. Returns the
+ * number of sprites of the file
+ */
+int sprite_reload_file(const char* vpath)
+{
+    logfile_message("Reloading sprites of \"%s\"...", vpath);
+
+    parsetree_program_t* tree = nanoparser_construct_tree(asset_path(vpath));
+    int count = 0;
+
+    reloading = true;
+    nanoparser_traverse_program_ex(tree, (void*)&count, traverse_reload);
+    reloading = false;
+
+    /* in the lazy loading mode, the declarations refer to the parse tree */
+    if(lazy_loading) {
+        sprfile_t file = { .vpath = str_dup(vpath), .tree = tree };
+        darray_push(sprfile, file);
+    }
+    else
+        nanoparser_deconstruct_tree(tree);
+
+    return count;
+}
+
 /*
  * sprite_animation_exists()
  * Checks if an animation exists (for a given sprite)
  */
 bool sprite_animation_exists(const char* sprite_name, int anim_id)
 {
-    const spriteinfo_t *info = hashtable_spriteinfo_t_find(sprites, sprite_name);
+    const spriteinfo_t *info = find_sprite(sprite_name);
+
+    return info != NULL && (
+        anim_id >= 0 && anim_id < info->animation_count &&
+        info->animation_data[anim_id] != NULL
+    );
+}
+
+
+
+/*
+ * sprite_resolve()
+ * Resolves a sprite name into a handle. Set sprite_name
+ * to NULL to get a handle to the default sprite
+ */
+sprite_handle_t sprite_resolve(const char* sprite_name)
+{
+    return atom_intern(sprite_name != NULL ? sprite_name : DEFAULT_SPRITE);
+}
+
+
+/*
+ * sprite_handle_animation_exists()
+ * Checks if an animation exists (for a given sprite handle)
+ */
+bool sprite_handle_animation_exists(sprite_handle_t sprite, int anim_id)
+{
+    const spriteinfo_t *info = find_sprite_by_handle(sprite);
 
     return info != NULL && (
         anim_id >= 0 && anim_id < info->animation_count &&
@@ -204,6 +366,79 @@ bool sprite_animation_exists(const char* sprite_name, int anim_id)
 }
 
 
+/*
+ * sprite_handle_get_animation()
+ * Returns a pointer to an animation corresponding to the
+ * specified sprite handle and animation number
+ */
+const animation_t* sprite_handle_get_animation(sprite_handle_t sprite, int anim_id)
+{
+    const spriteinfo_t *info = find_sprite_by_handle(sprite);
+
+    if(info != NULL && anim_id >= 0 && anim_id < info->animation_count && info->animation_data[anim_id] != NULL)
+        return info->animation_data[anim_id];
+
+    /* fail with the usual error message */
+    return sprite_get_animation(atom_name(sprite) != NULL ? atom_name(sprite) : DEFAULT_SPRITE, anim_id);
+}
+
+
+
+/* finds a sprite by name, creating it on first use in the lazy loading mode */
+spriteinfo_t* find_sprite(const char* sprite_name)
+{
+    spriteinfo_t* sprite = hashtable_spriteinfo_t_find(sprites, sprite_name);
+
+    if(sprite == NULL && lazy_loading) {
+        const spritedecl_t* decl = hashtable_spritedecl_t_find(declarations, sprite_name);
+        if(decl != NULL) {
+            logfile_message("Loading sprite \"%s\"...", sprite_name);
+            sprite = spriteinfo_create(decl->program);
+            hashtable_spriteinfo_t_add(sprites, sprite_name, sprite);
+        }
+    }
+
+    return sprite;
+}
+
+/* finds a sprite by handle, caching the result */
+spriteinfo_t* find_sprite_by_handle(sprite_handle_t handle)
+{
+    if(handle < darray_length(resolved) && resolved[handle] != NULL)
+        return resolved[handle];
+
+    const char* sprite_name = atom_name(handle);
+    if(sprite_name == NULL)
+        return NULL;
+
+    spriteinfo_t* sprite = find_sprite(sprite_name);
+    if(sprite == NULL)
+        return NULL;
+
+    while(darray_length(resolved) <= handle)
+        darray_push(resolved, NULL);
+
+    return (resolved[handle] = sprite);
+}
+
+/* forgets the cached sprite of a handle (call when redefining a sprite) */
+void forget_handle(const char* sprite_name)
+{
+    atom_t handle = atom_find(sprite_name);
+
+    if(handle < darray_length(resolved))
+        resolved[handle] = NULL;
+}
+
+/*
+ * spriteinfo_prefetch()
+ * Schedules the spritesheet of a sprite block to be decoded in a
+ * background thread (see image_prefetch()), before spriteinfo_create()
+ */
+void spriteinfo_prefetch(const parsetree_program_t *tree)
+{
+    nanoparser_traverse_program(tree, prefetch_spritesheet);
+}
 
 /*
  * spriteinfo_create()
@@ -267,53 +502,17 @@ const animation_t* spriteinfo_get_animation(const spriteinfo_t* info, int anim_i
 const animation_t* spriteinfo_find_transition_animation(const spriteinfo_t* info, int from_id, int to_id)
 {
     /* skip everything: there are no transitions in this sprite */
-    if(darray_length(info->transition) == 0)
+    if(info->transition_table == NULL)
         return NULL;
 
-    /* perform a linear search on the set of all transition animations from
-       (from->id). Find a transition to (to->id). This set is typically very
-       small, UNLESS a declaration such as "transition any to x" is present in
-       the .spr file. In the latter case, we perform a binary search because
-       the set is ordered by ascending "to_id".
-
-       Note: a "transition any to x" declaration is, in most cases, unnecessary
-       and can be replaced by the first few frames of anim x, using repeat_from
-       if x repeats. If x must repeat with a different repeat_from index, then
-       a transition from any to x is applicable. How rare is that? Very rare.
-       It's not just a matter of necessity, however. Such a transition can be
-       used for clarity in the script. */
-    assertx(from_id >= 0 && from_id + 1 < info->transition_from_length);
-
-    int start = info->transition_from[from_id];
-    int end = info->transition_from[from_id + 1];
-    int count = end - start; /* zero if there are no transitions from (from_id) */
-
-    if(count < 6) {
-        /* linear search */
-        for(int i = start; i < end; i++) {
-            const animtransition_t* transition = info->preprocessed_transition[i];
-            if(transition->to_id == to_id)
-                return info->animation_data[transition->anim_id];
-        }
-    }
-    else {
-        /* binary search */
-        --end;
-        while(start <= end) {
-            int middle = (start + end) / 2;
-            const animtransition_t* transition = info->preprocessed_transition[middle];
-
-            if(transition->to_id == to_id)
-                return info->animation_data[transition->anim_id];
-            else if(transition->to_id > to_id)
-                end = middle - 1;
-            else
-                start = middle + 1;
-        }
-    }
+    /* the table covers all animations of the sprite, including the
+       transitions from/to "any", which have been expanded at load time */
+    assertx(from_id >= 0 && from_id < info->transition_table_size);
+    if(to_id < 0 || to_id >= info->transition_table_size)
+        return NULL;
 
-    /* not found */
-    return NULL;
+    int anim_id = info->transition_table[from_id * info->transition_table_size + to_id];
+    return anim_id != 0 ? info->animation_data[anim_id] : NULL;
 }
 
 /*
@@ -322,7 +521,11 @@ const animation_t* spriteinfo_find_transition_animation(const spriteinfo_t* info
  */
 const proganim_t* spriteinfo_get_proganim(const spriteinfo_t* info, const char* name)
 {
-    const proganim_t* prog_anim = dictionary_get(info->prog_anims, name);
+    atom_t key = atom_find(name);
+    if(key == ATOM_NONE)
+        return NULL;
+
+    const proganim_t* prog_anim = atomdict_get(info->prog_anims, key);
     return prog_anim; /* possibly NULL */
 }
 
@@ -333,7 +536,22 @@ const proganim_t* spriteinfo_get_proganim(const spriteinfo_t* info, const char*
  */
 const char* const* spriteinfo_user_property(const spriteinfo_t* info, const char* name)
 {
-    const userproperty_t* user_property = dictionary_get(info->user_properties, name);
+    /* no such name has ever been used */
+    atom_t key = atom_find(name);
+    if(key == ATOM_NONE)
+        return NULL;
+
+    return spriteinfo_user_property_atom(info, key);
+}
+
+/*
+ * spriteinfo_user_property_atom()
+ * Get a NULL-terminated array with the element(s) of a user-defined custom property,
+ * or NULL if no property with the given name exists. The name is given as an atom
+ */
+const char* const* spriteinfo_user_property_atom(const spriteinfo_t* info, atom_t name)
+{
+    const userproperty_t* user_property = atomdict_get(info->user_properties, name);
 
     /* no such user-defined custom property? */
     if(user_property == NULL)
@@ -406,14 +624,46 @@ collisionmask_t* spriteinfo_to_collisionmask(const spriteinfo_t* info, int frame
     int x = info->rect_x + (frame_index % w) * info->frame_w;
     int y = info->rect_y + (frame_index / w) * info->frame_h;
 
-    image_lock(spritesheet, "r");
-    collisionmask_t* mask = collisionmask_create(spritesheet, x, y, info->frame_w, info->frame_h, 0);
-    image_unlock(spritesheet);
+    collisionmask_t* mask = collisionmask_load_cached(image_filepath(spritesheet), x, y, info->frame_w, info->frame_h, 0);
+    if(mask == NULL) {
+        image_lock(spritesheet, "r");
+        mask = collisionmask_create(spritesheet, x, y, info->frame_w, info->frame_h, 0);
+        image_unlock(spritesheet);
+        collisionmask_store_cached(mask, image_filepath(spritesheet), x, y, info->frame_w, info->frame_h, 0);
+    }
 #endif
 
     return mask;
 }
 
+/*
+ * spriteinfo_shared_collisionmask()
+ * Gets a collision mask of a frame of the spritesheet, shared by all callers.
+ * It's created only once. Release it with collisionmask_destroy()
+ */
+collisionmask_t* spriteinfo_shared_collisionmask(const spriteinfo_t* info, int frame_index)
+{
+    spriteinfo_t* sprite = (spriteinfo_t*)info; /* a cache */
+
+    if(frame_index < 0 || frame_index >= info->frame_count) {
+        fatal_error("%s: can't get the frame whose index is %d of sprite \"%s\". Valid range is [0,%d].", __func__, frame_index, info->source_file, info->frame_count-1);
+        return NULL;
+    }
+
+    /* lazy allocation */
+    if(sprite->frame_mask == NULL) {
+        sprite->frame_mask = mallocx(sprite->frame_count * sizeof(*(sprite->frame_mask)));
+        for(int i = 0; i < sprite->frame_count; i++)
+            sprite->frame_mask[i] = NULL;
+    }
+
+    /* the sprite keeps a reference to the mask */
+    if(sprite->frame_mask[frame_index] == NULL)
+        sprite->frame_mask[frame_index] = spriteinfo_to_collisionmask(info, frame_index);
+
+    return collisionmask_retain(sprite->frame_mask[frame_index]);
+}
+
 
 
 
@@ -429,13 +679,57 @@ int scanfile(const char *vpath, void *param)
 
     /* read the .spr file */
     parsetree_program_t* p = nanoparser_construct_tree(fullpath);
-    nanoparser_traverse_program_ex(p, (void*)vpath, traverse);
-    nanoparser_deconstruct_tree(p);
+    nanoparser_traverse_program(p, prefetch_spritesheets);
+
+    /* we'll create the sprites later */
+    sprfile_t file = { .vpath = str_dup(vpath), .tree = p };
+    darray_push(sprfile, file);
 
     /* done! */
     return 0;
 }
 
+/*
+ * prefetch_spritesheets()
+ * Prefetch the spritesheets of the sprites of a parsed .spr file
+ */
+int prefetch_spritesheets(const parsetree_statement_t *stmt)
+{
+    const char* identifier = nanoparser_get_identifier(stmt);
+    const parsetree_parameter_t* param_list = nanoparser_get_parameter_list(stmt);
+
+    /* we'll validate the sprite later */
+    if(str_icmp(identifier, "sprite") == 0) {
+        const parsetree_parameter_t* p2 = nanoparser_get_nth_parameter(param_list, 2);
+        const parsetree_program_t* block = nanoparser_get_program(p2);
+
+        if(block != NULL)
+            nanoparser_traverse_program(block, prefetch_spritesheet);
+    }
+
+    return 0;
+}
+
+/*
+ * prefetch_spritesheet()
+ * Prefetch the source_file of a sprite
+ */
+int prefetch_spritesheet(const parsetree_statement_t *stmt)
+{
+    const char* identifier = nanoparser_get_identifier(stmt);
+    const parsetree_parameter_t* param_list = nanoparser_get_parameter_list(stmt);
+
+    if(str_icmp(identifier, "source_file") == 0) {
+        const parsetree_parameter_t* p1 = nanoparser_get_nth_parameter(param_list, 1);
+        const char* source_file = nanoparser_get_string(p1);
+
+        if(asset_exists(source_file))
+            image_prefetch(source_file);
+    }
+
+    return 0;
+}
+
 /*
  * spriteinfo_new()
  * Creates a new empty spriteinfo_t instance
@@ -456,18 +750,18 @@ spriteinfo_t *spriteinfo_new()
 
     sprite->frame_count = 0;
     sprite->frame_data = NULL;
+    sprite->frame_mask = NULL; /* lazy allocation */
     sprite->spritesheet = NULL;
 
     sprite->animation_count = 0;
     sprite->animation_data = NULL;
 
     darray_init(sprite->transition);
-    darray_init(sprite->preprocessed_transition);
-    sprite->transition_from = NULL; /* lazy allocation */
-    sprite->transition_from_length = 0;
+    sprite->transition_table = NULL; /* lazy allocation */
+    sprite->transition_table_size = 0;
 
-    sprite->prog_anims = dictionary_create(true, destroy_proganim, sprite);
-    sprite->user_properties = dictionary_create(true, destroy_userproperty, sprite);
+    sprite->prog_anims = atomdict_create(destroy_proganim, sprite);
+    sprite->user_properties = atomdict_create(destroy_userproperty, sprite);
 
     return sprite;
 }
@@ -481,19 +775,14 @@ spriteinfo_t *spriteinfo_delete(spriteinfo_t *sprite)
     extern animation_t *animation_destroy(animation_t *anim);
 
     /* delete user-defined properties */
-    dictionary_destroy(sprite->user_properties);
+    atomdict_destroy(sprite->user_properties);
 
     /* delete programmatic animations */
-    dictionary_destroy(sprite->prog_anims);
-
-    /* delete transition_from[] */
-    if(sprite->transition_from != NULL)
-        free(sprite->transition_from);
+    atomdict_destroy(sprite->prog_anims);
 
-    /* delete the preprocessed transitions */
-    for(int i = 0; i < darray_length(sprite->preprocessed_transition); i++)
-        transition_delete(sprite->preprocessed_transition[i]);
-    darray_release(sprite->preprocessed_transition);
+    /* delete the transition table */
+    if(sprite->transition_table != NULL)
+        free(sprite->transition_table);
 
     /* delete the transitions */
     for(int i = 0; i < darray_length(sprite->transition); i++)
@@ -510,6 +799,14 @@ spriteinfo_t *spriteinfo_delete(spriteinfo_t *sprite)
         sprite->animation_data = NULL;
     }
 
+    /* release the shared collision masks */
+    if(sprite->frame_mask != NULL) {
+        for(int i = 0; i < sprite->frame_count; i++)
+            collisionmask_destroy(sprite->frame_mask[i]);
+        free(sprite->frame_mask);
+        sprite->frame_mask = NULL;
+    }
+
     /* delete the images */
     if(sprite->frame_data != NULL) {
         for(int i = 0; i < sprite->frame_count; i++)
@@ -607,22 +904,6 @@ animtransition_t *transition_delete(animtransition_t *transition)
     return NULL;
 }
 
-/*
- * transition_cmp()
- * Comparison function (sorting)
- */
-int transition_cmp(const void *t1, const void *t2)
-{
-    const animtransition_t *a = *((const animtransition_t**)t1);
-    const animtransition_t *b = *((const animtransition_t**)t2);
-
-    /* sort by ascending from_id and then by ascending to_id */
-    if(a->from_id != b->from_id)
-        return a->from_id - b->from_id;
-    else
-        return a->to_id - b->to_id;
-}
-
 /*
  * validate_transitions()
  * Validate the transition animations of a sprite
@@ -697,7 +978,19 @@ void preprocess_transitions(spriteinfo_t *sprite)
     /* get the minimum integer greater than the largest animation ID */
     int sup_anim_id = 1 + anim_id[anim_id_length - 1]; /* no more than MAX_ANIMATIONS */
 
-    /* first, let's copy all transitions from x to y (non-any) */
+    /* allocate a dense table of sup_anim_id x sup_anim_id entries. Transition
+       animations are numbered from MAX_ANIMATIONS onwards, so 0 means "none".
+       That's at most 128 KB per sprite, but usually just a few KB */
+    assertx(sprite->transition_table == NULL);
+    assertx(2 * MAX_ANIMATIONS <= UINT16_MAX);
+    sprite->transition_table_size = sup_anim_id;
+    sprite->transition_table = mallocx(sup_anim_id * sup_anim_id * sizeof(*(sprite->transition_table)));
+    memset(sprite->transition_table, 0, sup_anim_id * sup_anim_id * sizeof(*(sprite->transition_table)));
+
+    #define TRANSITION_ENTRY(from, to) sprite->transition_table[(from) * sup_anim_id + (to)]
+
+    /* first, let's fill in all transitions from x to y (non-any). If there
+       are duplicates, the first declared transition takes precedence */
     for(int i = 0; i < darray_length(sprite->transition); i++) {
         const animtransition_t* transition = sprite->transition[i];
 
@@ -709,13 +1002,14 @@ void preprocess_transitions(spriteinfo_t *sprite)
         else if(transition->from_id == TRANSITION_ANY_ANIM || transition->to_id == TRANSITION_ANY_ANIM)
             continue;
 
-        /* copy transition from x to y */
-        animtransition_t* copy = transition_new(transition->anim_id, transition->from_id, transition->to_id);
-        copy->is_valid = true;
-        darray_push(sprite->preprocessed_transition, copy);
+        /* transition from x to y */
+        assertx(transition->from_id < sup_anim_id && transition->to_id < sup_anim_id);
+        if(TRANSITION_ENTRY(transition->from_id, transition->to_id) == 0)
+            TRANSITION_ENTRY(transition->from_id, transition->to_id) = transition->anim_id;
     }
 
-    /* second, preprocess transitions to/from "any" other animation number */
+    /* second, expand the transitions to/from "any" other animation number.
+       These have lower precedence, so they don't replace existing entries */
     for(int i = 0; i < darray_length(sprite->transition); i++) {
         const animtransition_t* transition = sprite->transition[i];
 
@@ -723,25 +1017,19 @@ void preprocess_transitions(spriteinfo_t *sprite)
         if(!transition->is_valid)
             continue;
 
-        /* copy transitions from any */
+        /* transitions from any */
         if(transition->from_id == TRANSITION_ANY_ANIM) {
             for(int j = 0; j < anim_id_length; j++) {
-                if(anim_id[j] != transition->to_id) { /* replace "from any" by all valid animations */
-                    animtransition_t* new_transition = transition_new(transition->anim_id, anim_id[j], transition->to_id);
-                    new_transition->is_valid = true;
-                    darray_push(sprite->preprocessed_transition, new_transition);
-                }
+                if(anim_id[j] != transition->to_id && TRANSITION_ENTRY(anim_id[j], transition->to_id) == 0)
+                    TRANSITION_ENTRY(anim_id[j], transition->to_id) = transition->anim_id;
             }
         }
 
-        /* copy transitions to any */
+        /* transitions to any */
         else if(transition->to_id == TRANSITION_ANY_ANIM) {
             for(int j = 0; j < anim_id_length; j++) {
-                if(anim_id[j] != transition->from_id) { /* replace "to any" by all valid animations */
-                    animtransition_t* new_transition = transition_new(transition->anim_id, transition->from_id, anim_id[j]);
-                    new_transition->is_valid = true;
-                    darray_push(sprite->preprocessed_transition, new_transition);
-                }
+                if(anim_id[j] != transition->from_id && TRANSITION_ENTRY(transition->from_id, anim_id[j]) == 0)
+                    TRANSITION_ENTRY(transition->from_id, anim_id[j]) = transition->anim_id;
             }
         }
 
@@ -749,31 +1037,7 @@ void preprocess_transitions(spriteinfo_t *sprite)
 
     }
 
-    /* sort transitions with a stable sorting algorithm, so
-       that transitions from/to "any" have lower precedence */
-    int n = darray_length(sprite->preprocessed_transition);
-    merge_sort(sprite->preprocessed_transition, n, sizeof(*(sprite->preprocessed_transition)), transition_cmp);
-
-    /* allocate transition_from[] and initialize it with -1s */
-    assertx(sprite->transition_from == NULL);
-    sprite->transition_from_length = 1 + sup_anim_id;
-    sprite->transition_from = mallocx((1 + sup_anim_id) * sizeof(int));
-    for(int i = 0; i <= sup_anim_id; i++)
-        sprite->transition_from[i] = -1;
-
-    /* fill transition_from[] */
-    for(int i = n-1; i >= 0; i--) {
-        const animtransition_t* transition = sprite->preprocessed_transition[i];
-        assertx(transition->from_id >= 0 && transition->from_id < sup_anim_id);
-        sprite->transition_from[transition->from_id] = i;
-    }
-
-    /* get rid of all -1s */
-    sprite->transition_from[sup_anim_id] = n;
-    for(int i = sup_anim_id - 1; i >= 0; i--) {
-        if(sprite->transition_from[i] == -1)
-            sprite->transition_from[i] = sprite->transition_from[i+1]; /* one minus the other (count) is zero */
-    }
+    #undef TRANSITION_ENTRY
 }
 
 
@@ -915,15 +1179,14 @@ void validate_sprite(spriteinfo_t *spr)
 
     /* validate individual keyframe-based animations */
     extern void proganim_validate(proganim_t* prog_anim);
-    iterator_t* it = dictionary_keys(spr->prog_anims);
-    while(iterator_has_next(it)) {
-        const char* name = iterator_next(it);
-        logfile_message("Validating keyframe-based animation \"%s\"...", name);
-
-        proganim_t* prog_anim = dictionary_get(spr->prog_anims, name);
+    atomdictiter_t it;
+    atom_t name;
+    void* prog_anim;
+    atomdictiter_init(&it, spr->prog_anims);
+    while(atomdictiter_next(&it, &name, &prog_anim)) {
+        logfile_message("Validating keyframe-based animation \"%s\"...", atom_name(name));
         proganim_validate(prog_anim);
     }
-    iterator_destroy(it);
 }
 
 
@@ -1007,6 +1270,27 @@ int traverse(const parsetree_statement_t *stmt, void *vpath)
         nanoparser_expect_program(p2, "Must provide sprite attributes");
 
         sprite_name = nanoparser_get_string(p1);
+
+        /* lazy loading: just declare the sprite */
+        if(lazy_loading) {
+            bool must_override = (str_incmp((const char*)vpath, OVERRIDE_PREFIX, OVERRIDE_PREFIX_LENGTH) == 0);
+            spritedecl_t* decl;
+
+            if(hashtable_spritedecl_t_find(declarations, sprite_name) != NULL && !must_override) {
+                nanoparser_warn(stmt, "Can't redefine sprite \"%s\"", sprite_name);
+                return 0;
+            }
+
+            decl = mallocx(sizeof *decl);
+            decl->program = nanoparser_get_program(p2);
+            if(!hashtable_spritedecl_t_replace(declarations, sprite_name, decl))
+                hashtable_spritedecl_t_add(declarations, sprite_name, decl);
+            else
+                nanoparser_warn(stmt, "OVERRIDE: redefining sprite \"%s\"", sprite_name);
+
+            return 0;
+        }
+
         nanoparser_warn(stmt, "Loading sprite \"%s\"", sprite_name);
 
         if(NULL == (sprite = hashtable_spriteinfo_t_find(sprites, sprite_name))) {
@@ -1022,6 +1306,7 @@ int traverse(const parsetree_statement_t *stmt, void *vpath)
                 nanoparser_warn(stmt, "OVERRIDE: redefining sprite \"%s\"", sprite_name);
 
                 spriteinfo_t *new_sprite = spriteinfo_create(nanoparser_get_program(p2));
+                forget_handle(sprite_name);
                 if(hashtable_spriteinfo_t_replace(sprites, sprite_name, new_sprite))
                     return 0; /* the sprite has been successfully redefined */
 
@@ -1038,6 +1323,46 @@ int traverse(const parsetree_statement_t *stmt, void *vpath)
     return 0;
 }
 
+/* redefines the sprites of a modified .spr file */
+int traverse_reload(const parsetree_statement_t *stmt, void *count)
+{
+    const char* identifier = nanoparser_get_identifier(stmt);
+    const parsetree_parameter_t* param_list = nanoparser_get_parameter_list(stmt);
+
+    if(str_icmp(identifier, "sprite") == 0) {
+        const parsetree_parameter_t* p1 = nanoparser_get_nth_parameter(param_list, 1);
+        const parsetree_parameter_t* p2 = nanoparser_get_nth_parameter(param_list, 2);
+
+        nanoparser_expect_string(p1, "Must provide sprite name");
+        nanoparser_expect_program(p2, "Must provide sprite attributes");
+
+        const char* sprite_name = nanoparser_get_string(p1);
+        const parsetree_program_t* program = nanoparser_get_program(p2);
+
+        /* lazy loading: replace the declaration */
+        if(lazy_loading) {
+            spritedecl_t* decl = mallocx(sizeof *decl);
+            decl->program = program;
+            if(!hashtable_spritedecl_t_replace(declarations, sprite_name, decl))
+                hashtable_spritedecl_t_add(declarations, sprite_name, decl);
+        }
+
+        /* replace the sprite if it has been created; the old one is retired */
+        if(!lazy_loading || hashtable_spriteinfo_t_find(sprites, sprite_name) != NULL) {
+            spriteinfo_t* new_sprite = spriteinfo_create(program);
+            forget_handle(sprite_name);
+
+            if(!hashtable_spriteinfo_t_replace(sprites, sprite_name, new_sprite))
+                hashtable_spriteinfo_t_add(sprites, sprite_name, new_sprite);
+        }
+
+        logfile_message("Sprite \"%s\" has been reloaded", sprite_name);
+        (*((int*)count))++;
+    }
+
+    return 0;
+}
+
 
 /*
  * traverse_sprite_attributes()
@@ -1204,7 +1529,7 @@ int traverse_sprite_attributes(const parsetree_statement_t *stmt, void *spritein
         nanoparser_traverse_program_ex(nanoparser_get_program(p2), prog_anim, traverse_keyframes);
 
         /* add the keyframe-based animation to the dictionary */
-        dictionary_put(s->prog_anims, name, prog_anim);
+        atomdict_put(s->prog_anims, atom_intern(name), prog_anim);
     }
     else if(str_icmp(identifier, "custom_properties") == 0) {
         p1 = nanoparser_get_nth_parameter(param_list, 1);
@@ -1238,9 +1563,9 @@ int traverse_user_properties(const parsetree_statement_t *stmt, void *dict)
         nanoparser_crash(stmt, "Unspecified user-defined property \"%s\"", identifier);
 
     /* allocate a user-defined property */
-    dictionary_t* user_properties = (dictionary_t*)dict;
+    atomdict_t* user_properties = (atomdict_t*)dict;
     userproperty_t* user_property = userproperty_new();
-    dictionary_put(user_properties, identifier, user_property);
+    atomdict_put(user_properties, atom_intern(identifier), user_property);
 
     /* read the element(s) of the user-defined property */
     for(int i = 1; i <= number_of_parameters; i++) {
@@ -1269,25 +1594,15 @@ void inspect_transitions(const spriteinfo_t* sprite)
         printf("[%d] from %d to %d == %d\n", i, transition->from_id, transition->to_id, transition->anim_id);
     }
 
-    printf("\n-- PREPROCESSED TRANSITIONS --\n");
-    for(int i = 0; i < darray_length(sprite->preprocessed_transition); i++) {
-        const animtransition_t* transition = sprite->preprocessed_transition[i];
-        printf("[%d] from %d to %d == %d\n", i, transition->from_id, transition->to_id, transition->anim_id);
-    }
-
-    if(sprite->transition_from == NULL)
+    if(sprite->transition_table == NULL)
         return;
 
-    printf("\n-- START / COUNT --\n");
-    for(int i = 0; i < sprite->transition_from_length-1; i++) {
-        int start = sprite->transition_from[i];
-        int end = sprite->transition_from[i+1];
-        int count = end - start;
-
-        printf("from %d:\t\t%d transitions\t\t(indexed from %d to %d)\n", i, count, start, end-1);
-        for(int j = start; j < end; j++) {
-            const animtransition_t* transition = sprite->preprocessed_transition[j];
-            printf("-- from %d to %d play %d\n", transition->from_id, transition->to_id, transition->anim_id);
+    printf("\n-- TRANSITION TABLE --\n");
+    for(int from_id = 0; from_id < sprite->transition_table_size; from_id++) {
+        for(int to_id = 0; to_id < sprite->transition_table_size; to_id++) {
+            int anim_id = sprite->transition_table[from_id * sprite->transition_table_size + to_id];
+            if(anim_id != 0)
+                printf("-- from %d to %d play %d\n", from_id, to_id, anim_id);
         }
     }
 #else
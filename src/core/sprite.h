@@ -23,6 +23,7 @@
 
 #include <stdbool.h>
 #include "../util/rect.h"
+#include "../util/atom.h"
 
 /* forward declarations */
 typedef struct spriteinfo_t spriteinfo_t;
@@ -39,7 +40,7 @@ struct image_t;
  */
 
 /* initializes the sprite system */
-void sprite_init();
+void sprite_init(bool lazy);
 
 /* releases the sprite system */
 void sprite_release();
@@ -50,6 +51,30 @@ bool sprite_animation_exists(const char* sprite_name, int anim_id);
 /* gets the required animation - crashes if not found */
 const struct animation_t* sprite_get_animation(const char* sprite_name, int anim_id);
 
+/* schedules the spritesheet of a sprite that hasn't been created yet to be decoded in the background */
+void sprite_prefetch(const char* sprite_name);
+
+/* redefines the sprites of a .spr file that has been modified (hot reload); returns the number of sprites */
+int sprite_reload_file(const char* vpath);
+
+
+/*
+ * Sprite handles: a sprite name resolved once, so that its animations
+ * can be accessed without string lookups. Handles remain valid while
+ * the program runs, even if the sprite system is reinitialized
+ */
+typedef atom_t sprite_handle_t;
+#define SPRITE_HANDLE_NONE ((sprite_handle_t)ATOM_NONE) /* never returned by sprite_resolve() */
+
+/* resolves a sprite name; the default sprite is used if sprite_name is NULL */
+sprite_handle_t sprite_resolve(const char* sprite_name);
+
+/* checks if an animation exists */
+bool sprite_handle_animation_exists(sprite_handle_t sprite, int anim_id);
+
+/* gets the required animation - crashes if not found */
+const struct animation_t* sprite_handle_get_animation(sprite_handle_t sprite, int anim_id);
+
 
 
 
@@ -60,6 +85,9 @@ const struct animation_t* sprite_get_animation(const char* sprite_name, int anim
 /* creates a spriteinfo_t given a parse tree */
 spriteinfo_t* spriteinfo_create(const struct parsetree_program_t* tree);
 
+/* schedules the spritesheet of a sprite block to be decoded in the background */
+void spriteinfo_prefetch(const struct parsetree_program_t* tree);
+
 /* releases a spriteinfo_t */
 void spriteinfo_destroy(spriteinfo_t* info);
 
@@ -77,6 +105,7 @@ const struct proganim_t* spriteinfo_get_proganim(const spriteinfo_t* info, const
 
 /* gets a NULL-terminated array with the element(s) of a user-defined custom property, or NULL if no property with the given name exists */
 const char* const* spriteinfo_user_property(const spriteinfo_t* info, const char* name);
+const char* const* spriteinfo_user_property_atom(const spriteinfo_t* info, atom_t name); /* faster: no string lookups */
 
 /* the source file (image) of the sprite */
 const char* spriteinfo_source_file(const spriteinfo_t* info);
@@ -93,4 +122,7 @@ int spriteinfo_frame_height(const spriteinfo_t* info);
 /* create a collision mask from a frame of the spritesheet */
 struct collisionmask_t* spriteinfo_to_collisionmask(const spriteinfo_t* info, int frame_index);
 
+/* get a collision mask of a frame of the spritesheet that is shared with other callers; release it with collisionmask_destroy() */
+struct collisionmask_t* spriteinfo_shared_collisionmask(const spriteinfo_t* info, int frame_index);
+
 #endif
\ No newline at end of file
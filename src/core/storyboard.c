@@ -71,6 +71,9 @@ void storyboard_init()
     storyboard[SCENE_MOBILEMENU] = scene_create(mobilemenu_init, mobilemenu_update, mobilemenu_render, mobilemenu_release);
     storyboard[SCENE_MOBILEPOPUP] = scene_create(mobilepopup_init, mobilepopup_update, mobilepopup_render, mobilepopup_release);
     storyboard[SCENE_MODLOADER] = scene_create(modloader_init, modloader_update, modloader_render, modloader_release);
+
+    /* scenes that load their assets in the background */
+    scene_set_preloader(storyboard[SCENE_LEVEL], level_preload, level_is_preloading);
 }
 
 
@@ -30,6 +30,7 @@ static double previous_time = 0.0;
 static double delta_time = 0.0;
 static double smooth_delta_time = 0.0;
 static int64_t frames = 0;
+static double fixed_delta = 0.0; /* simulated clock if positive */
 
 static bool is_paused = false;
 static double pause_duration = 0.0;
@@ -55,6 +56,7 @@ void timer_init()
     delta_time = 0.0;
     smooth_delta_time = 0.0;
     frames = 0;
+    fixed_delta = 0.0;
 
     is_paused = false;
     pause_duration = 0.0;
@@ -88,6 +90,15 @@ void timer_update()
         return;
     }
 
+    /* simulated clock: advance by a fixed step, regardless of the wall clock */
+    if(fixed_delta > 0.0) {
+        current_time = previous_time + fixed_delta;
+        delta_time = smooth_delta_time = fixed_delta;
+        previous_time = current_time;
+        ++frames;
+        return;
+    }
+
     /* read the time at the beginning of this framestep */
     current_time = timer_get_now();
 
@@ -113,6 +124,39 @@ void timer_update()
 }
 
 
+/*
+ * timer_override_framestep()
+ * Replaces the elapsed time and the delta time of the current framestep.
+ * Call after timer_update(). This is used to replay recorded input
+ */
+void timer_override_framestep(double elapsed, double delta)
+{
+    if(is_paused)
+        return;
+
+    current_time = previous_time = elapsed;
+    delta_time = max(delta, 0.0);
+    smooth_delta_time = delta_time;
+}
+
+
+/*
+ * timer_set_fixed_delta()
+ * Makes the time manager advance by a fixed amount of seconds at each
+ * framestep, regardless of the wall clock. This is used to run simulations
+ * (e.g., in headless mode). Pass zero to use the wall clock again
+ */
+void timer_set_fixed_delta(double delta)
+{
+    fixed_delta = max(delta, 0.0);
+
+    if(fixed_delta > 0.0)
+        logfile_message("The time manager is running on a simulated clock (%.0f microseconds per framestep)", fixed_delta * 1000000.0);
+    else
+        previous_time = current_time = timer_get_now();
+}
+
+
 /*
  * timer_get_delta()
  * Returns the time interval, in seconds, between the last two cycles of the main loop
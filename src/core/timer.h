@@ -34,6 +34,8 @@ float timer_get_smooth_delta();
 double timer_get_elapsed();
 double timer_get_now();
 int64_t timer_get_frames();
+void timer_override_framestep(double elapsed, double delta); /* used to replay recorded input */
+void timer_set_fixed_delta(double delta); /* simulated clock; pass zero to disable */
 
 /* pause & resume */
 void timer_pause();
@@ -0,0 +1,246 @@
+/*
+ * Open Surge Engine
+ * trace.c - startup tracer
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <allegro5/allegro.h>
+#include "trace.h"
+#include "logfile.h"
+#include "../util/darray.h"
+#include "../util/util.h"
+
+/* a phase of the startup */
+typedef struct tracephase_t tracephase_t;
+struct tracephase_t
+{
+    const char* name; /* a string literal */
+    double start_time; /* in seconds, since trace_init() */
+    double end_time; /* negative if the phase hasn't ended */
+    int parent; /* index of the parent phase or NO_PHASE */
+    int depth; /* nesting level */
+    int track; /* phases of the same track are nested; each root phase starts a new track */
+};
+
+/* internal data */
+#define NO_PHASE (-1)
+static const char TRACE_FILE[] = "startup_trace.json"; /* Chrome trace format; open it at chrome://tracing */
+STATIC_DARRAY(tracephase_t, phase);
+static int current_phase = NO_PHASE; /* innermost phase of the main thread */
+static int track_count = 0;
+static bool enabled = false;
+static double start_time = 0.0;
+static ALLEGRO_MUTEX* mutex = NULL;
+
+static int begin_phase(const char* phase_name, int parent);
+static void end_phase(int phase_id);
+static void write_summary();
+static bool write_trace_file(const char* filepath);
+
+
+
+/*
+ * trace_init()
+ * Initializes the startup tracer. Allegro must be initialized
+ */
+void trace_init(bool is_enabled)
+{
+    trace_release();
+
+    if(!(enabled = is_enabled))
+        return;
+
+    mutex = al_create_mutex();
+    darray_init(phase);
+    current_phase = NO_PHASE;
+    track_count = 0;
+    start_time = al_get_time();
+}
+
+/*
+ * trace_release()
+ * Releases the startup tracer, discarding any data that hasn't been reported
+ */
+void trace_release()
+{
+    if(mutex == NULL)
+        return;
+
+    darray_release(phase);
+    al_destroy_mutex(mutex);
+    mutex = NULL;
+    enabled = false;
+}
+
+/*
+ * trace_finish()
+ * Ends all phases and reports the trace to the logfile and to a file
+ * in the write directory. Tracing stops afterwards
+ */
+void trace_finish()
+{
+    if(!enabled)
+        return;
+
+    al_lock_mutex(mutex);
+
+    /* end the phases that are still running */
+    double now = al_get_time() - start_time;
+    for(int i = 0; i < darray_length(phase); i++) {
+        if(phase[i].end_time < 0.0)
+            phase[i].end_time = now;
+    }
+
+    /* report */
+    write_summary();
+    if(write_trace_file(TRACE_FILE))
+        logfile_message("The startup trace has been written to %s", TRACE_FILE);
+    else
+        logfile_message("Can't write the startup trace to %s", TRACE_FILE);
+
+    enabled = false;
+    al_unlock_mutex(mutex);
+}
+
+/*
+ * trace_begin()
+ * Begins a phase of the main thread, nested in the innermost running one
+ */
+void trace_begin(const char* phase_name)
+{
+    if(!enabled)
+        return;
+
+    al_lock_mutex(mutex);
+    current_phase = begin_phase(phase_name, current_phase);
+    al_unlock_mutex(mutex);
+}
+
+/*
+ * trace_end()
+ * Ends the innermost running phase of the main thread
+ */
+void trace_end()
+{
+    if(!enabled)
+        return;
+
+    al_lock_mutex(mutex);
+    if(current_phase != NO_PHASE) {
+        end_phase(current_phase);
+        current_phase = phase[current_phase].parent;
+    }
+    al_unlock_mutex(mutex);
+}
+
+/*
+ * trace_begin_async()
+ * Begins a phase in a thread other than the main one. The phase gets its
+ * own track. Returns an ID to be passed to trace_end_async()
+ */
+int trace_begin_async(const char* phase_name)
+{
+    int phase_id;
+
+    if(!enabled)
+        return NO_PHASE;
+
+    al_lock_mutex(mutex);
+    phase_id = begin_phase(phase_name, NO_PHASE);
+    al_unlock_mutex(mutex);
+
+    return phase_id;
+}
+
+/*
+ * trace_end_async()
+ * Ends a phase started with trace_begin_async()
+ */
+void trace_end_async(int phase_id)
+{
+    if(!enabled || phase_id == NO_PHASE)
+        return;
+
+    al_lock_mutex(mutex);
+    end_phase(phase_id);
+    al_unlock_mutex(mutex);
+}
+
+
+
+/*
+ * private
+ */
+
+/* begins a new phase. Call with the mutex locked */
+int begin_phase(const char* phase_name, int parent)
+{
+    tracephase_t p = {
+        .name = phase_name,
+        .start_time = al_get_time() - start_time,
+        .end_time = -1.0,
+        .parent = parent,
+        .depth = (parent != NO_PHASE) ? phase[parent].depth + 1 : 0,
+        .track = (parent != NO_PHASE) ? phase[parent].track : track_count++
+    };
+
+    return darray_push(phase, p) - 1;
+}
+
+/* ends a phase. Call with the mutex locked */
+void end_phase(int phase_id)
+{
+    if(phase_id >= 0 && phase_id < darray_length(phase))
+        phase[phase_id].end_time = al_get_time() - start_time;
+}
+
+/* writes a summary of the trace to the logfile, in the order the phases began */
+void write_summary()
+{
+    logfile_message("Startup trace:");
+
+    for(int i = 0; i < darray_length(phase); i++) {
+        const tracephase_t* p = &phase[i];
+        logfile_message("%*s%s: %.2f ms (at %.2f ms)",
+            2 * (p->depth + 1), "", p->name,
+            1000.0 * (p->end_time - p->start_time),
+            1000.0 * p->start_time
+        );
+    }
+}
+
+/* writes the trace in the Chrome trace format to a file of the virtual filesystem */
+bool write_trace_file(const char* filepath)
+{
+    ALLEGRO_FILE* fp = al_fopen(filepath, "wb");
+    if(fp == NULL)
+        return false;
+
+    al_fputs(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for(int i = 0; i < darray_length(phase); i++) {
+        const tracephase_t* p = &phase[i];
+        al_fprintf(fp, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.0f,\"dur\":%.0f}%s\n",
+            p->name, p->track + 1,
+            1000000.0 * p->start_time,
+            1000000.0 * (p->end_time - p->start_time),
+            (i + 1 < darray_length(phase)) ? "," : ""
+        );
+    }
+    al_fputs(fp, "]}\n");
+
+    return al_fclose(fp);
+}
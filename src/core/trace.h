@@ -0,0 +1,39 @@
+/*
+ * Open Surge Engine
+ * trace.h - startup tracer
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdbool.h>
+
+/* startup tracer */
+void trace_init(bool enabled);
+void trace_release();
+void trace_finish(); /* write the report and stop tracing */
+
+/* nested phases of the main thread; names must be string literals */
+void trace_begin(const char* phase_name);
+void trace_end();
+
+/* phases of other threads */
+int trace_begin_async(const char* phase_name);
+void trace_end_async(int phase_id);
+
+#endif
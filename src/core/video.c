@@ -38,6 +38,8 @@
 #include "video.h"
 #include "image.h"
 #include "shader.h"
+#include "gputimer.h"
+#include "frameprofiler.h"
 #include "engine.h"
 #include "timer.h"
 #include "logfile.h"
@@ -49,6 +51,7 @@
 #include "../util/util.h"
 #include "../util/stringutil.h"
 #include "../entities/mobilegamepad.h"
+#include "../entities/renderqueue.h"
 
 
 
@@ -56,6 +59,7 @@
 #define DEFAULT_WINDOW_TITLE (GAME_TITLE " " GAME_VERSION_STRING)
 static char window_title[256] = DEFAULT_WINDOW_TITLE;
 static ALLEGRO_DISPLAY* display = NULL; /* game window */
+static bool is_headless = false; /* if true, there is no display and nothing is presented */
 static bool create_display(int width, int height);
 static void destroy_display();
 static void reconfigure_display();
@@ -70,11 +74,16 @@ static void a5_handle_video_event(const ALLEGRO_EVENT* event, void* data);
 #define DEFAULT_SCREEN_HEIGHT 240
 static int game_screen_width = DEFAULT_SCREEN_WIDTH; /* the width of the backbuffer during regular gameplay (i.e., not in the level editor) */
 static int game_screen_height = DEFAULT_SCREEN_HEIGHT; /* the height of the backbuffer during regular gameplay */
-static image_t* backbuffer[2] = { NULL, NULL };
+#define NUMBER_OF_BACKBUFFERS (USE_ROUNDROBIN_BACKBUFFER ? 2 : 1)
+static image_t* backbuffer[2] = { NULL, NULL }; /* views of the top-left corner of the storage */
+static image_t* backbuffer_storage[2] = { NULL, NULL }; /* grows, but never shrinks */
 static int backbuffer_index = 0; /* round-robin backbuffer: 0 = primary; 1 = secondary */
 static bool create_backbuffer();
 static void destroy_backbuffer();
 static void reconfigure_backbuffer();
+static void release_backbuffer_views();
+static bool create_backbuffer_storage(int screen_width, int screen_height);
+static void destroy_backbuffer_storage();
 static void compute_screen_size(videomode_t mode, int* screen_width, int* screen_height);
 
 
@@ -104,8 +113,45 @@ static double fps_last_update = 0.0;
 static void init_fps();
 static void update_fps();
 static void render_fps();
+static void render_profiler();
 static int sort_fps_samples(const void* a, const void* b);
 
+/* Adaptive quality: under load, the costly effects are disabled first, and then every
+   other frame is skipped. Quality is restored one level at a time after the game has
+   run at full speed for a while; if that fails quickly, we wait longer the next time */
+typedef enum adaptivelevel_t {
+    ADAPTIVE_FULL_QUALITY,
+    ADAPTIVE_REDUCED_EFFECTS,
+    ADAPTIVE_SKIP_FRAMES
+} adaptivelevel_t;
+#define ADAPTIVE_LOWER_FPS      (TARGET_FPS * 0.9) /* lower the quality below this framerate */
+#define ADAPTIVE_RESTORE_FPS    (TARGET_FPS - 2) /* full speed */
+#define ADAPTIVE_RESTORE_DELAY  5.0 /* in seconds; minimum time at full speed before restoring quality */
+#define ADAPTIVE_MAX_DELAY      120.0 /* in seconds */
+static struct {
+    bool is_enabled;
+    adaptivelevel_t level;
+    double full_speed_since; /* when the game started running at full speed, or < 0 */
+    double restored_at; /* when the quality was last restored */
+    double restore_delay; /* time at full speed that is required to restore quality */
+    bool skip_next_frame;
+} adaptive = {
+    .is_enabled = false,
+    .level = ADAPTIVE_FULL_QUALITY,
+    .full_speed_since = -1.0,
+    .restored_at = -1.0,
+    .restore_delay = ADAPTIVE_RESTORE_DELAY,
+    .skip_next_frame = false,
+};
+static void update_adaptive_quality(double fps_sample);
+static bool is_power_saving = false; /* present every other frame on constrained devices */
+static bool is_idle = false; /* the engine is throttling the update rate of a static scene */
+static const char* ADAPTIVELEVEL_NAME[] = {
+    [ADAPTIVE_FULL_QUALITY] = "full quality",
+    [ADAPTIVE_REDUCED_EFFECTS] = "reduced effects",
+    [ADAPTIVE_SKIP_FRAMES] = "frame skipping"
+};
+
 
 /* Video settings */
 static struct {
@@ -128,6 +174,9 @@ static struct {
     /* should we display the FPS counter? */
     bool is_fps_visible;
 
+    /* should we render opaque entries front-to-back with the depth buffer? */
+    bool is_early_z_enabled;
+
 } settings = {
     .resolution = VIDEORESOLUTION_1X,
     .mode = VIDEOMODE_DEFAULT,
@@ -135,6 +184,7 @@ static struct {
     .is_fullscreen = false,
     .is_immersive = false,
     .is_fps_visible = false,
+    .is_early_z_enabled = false,
 };
 
 
@@ -165,6 +215,91 @@ static void release_console();
 static void print_to_console(const char* message);
 static void render_console();
 
+/* Text layer: the texts of the console and of the debug overlays are
+   enqueued as commands every frame, but they're rendered to a cached
+   bitmap only when the commands change. The bitmap is drawn in one go */
+#define TEXTLAYER_MAX_COMMANDS    96
+typedef struct textcommand_t textcommand_t;
+struct textcommand_t {
+    ALLEGRO_TRANSFORM transform;
+    float x, y;
+    int flags;
+    char text[CONSOLE_MESSAGE_MAXSIZE];
+};
+static struct {
+    textcommand_t command[TEXTLAYER_MAX_COMMANDS]; /* commands of the current frame */
+    textcommand_t cached[TEXTLAYER_MAX_COMMANDS]; /* commands rendered to the bitmap */
+    int count; /* number of commands of the current frame */
+    int cached_count; /* number of commands rendered to the bitmap */
+    ALLEGRO_BITMAP* bitmap; /* may be NULL */
+} textlayer = {
+    .count = 0,
+    .cached_count = 0,
+    .bitmap = NULL
+};
+static void enqueue_text(float x, float y, int flags, const char* fmt, ...);
+static void flush_text_layer();
+static void release_text_layer();
+
+
+/* Dirty tracking */
+#define DIRTY_SIGNATURE_SEED      0xcbf29ce484222325ULL /* FNV-1a */
+static struct {
+
+    /* is dirty tracking enabled for the current frame? */
+    bool enabled;
+
+    /* signature of the current frame */
+    uint64_t signature;
+
+    /* signature of the last presented frame */
+    uint64_t previous_signature;
+    bool has_previous_signature;
+
+    /* was the presentation of the last rendered frame skipped? */
+    bool skipped_presentation;
+
+} dirty = {
+    .enabled = false,
+    .signature = DIRTY_SIGNATURE_SEED,
+    .previous_signature = 0,
+    .has_previous_signature = false,
+    .skipped_presentation = false
+};
+static bool is_frame_unchanged();
+static void invalidate_frame();
+
+
+/* Post-processing. The intermediate targets are shared by all passes of the
+   same downscale factor: there is a ping-pong pair for each factor, created
+   on demand. Like the backbuffer, each target is a view of the top-left
+   corner of a storage that is kept until the storage of the backbuffer is
+   destroyed. The storage is proportional to that of the backbuffer, so that
+   the texture coordinates of the targets match those of the scene */
+#define POSTFX_MAX_PASSES         8
+#define POSTFX_MAX_DOWNSCALE      8
+static struct {
+
+    /* ordered list of passes */
+    struct {
+        shader_t* shader;
+        int downscale; /* 1 = full resolution */
+    } pass[POSTFX_MAX_PASSES];
+    int pass_count;
+
+    /* intermediate targets */
+    image_t* target[1 + POSTFX_MAX_DOWNSCALE][2];
+    image_t* target_storage[1 + POSTFX_MAX_DOWNSCALE][2];
+
+} postfx = {
+    .pass_count = 0
+};
+static const image_t* render_postfx(const image_t* scene);
+static void present_postfx(const image_t* image);
+static image_t* postfx_target(int downscale, const image_t* input);
+static void release_postfx_views();
+static void destroy_postfx_targets();
+
 
 /* Loading screen */
 static const char LOADING_FONT[] = "Loading";
@@ -192,11 +327,8 @@ static const char* VIDEOQUALITY_NAME[] = {
     [VIDEOQUALITY_HIGH] = "high"
 };
 
-#define DRAW_TEXT(x, y, flags, fmt, ...) do { \
-    al_draw_textf(console.font, al_map_rgb(0, 0, 0), (x) + 1.0f, (y) + 1.0f, (flags) | ALLEGRO_ALIGN_INTEGER, (fmt), __VA_ARGS__); \
-    al_draw_textf(console.font, al_map_rgb(0, 0, 0), (x) + 0.0f, (y) + 1.0f, (flags) | ALLEGRO_ALIGN_INTEGER, (fmt), __VA_ARGS__); \
-    al_draw_textf(console.font, al_map_rgb(255, 255, 255), (x), (y), (flags) | ALLEGRO_ALIGN_INTEGER, (fmt), __VA_ARGS__); \
-} while(0)
+#define DRAW_TEXT(x, y, flags, fmt, ...) \
+    enqueue_text((x), (y), (flags) | ALLEGRO_ALIGN_INTEGER, (fmt), __VA_ARGS__)
 
 #define FONT_SCALE() (( \
     al_get_display_width(display) >= 2 * game_screen_width && \
@@ -255,8 +387,10 @@ void video_init()
     /* initialize the FPS counter */
     init_fps();
 
-    /* create the display */
-    if(!create_display(game_screen_width, game_screen_height))
+    /* create the display. In headless mode, the images are memory bitmaps */
+    if(is_headless)
+        LOG("Running in headless mode: there is no display");
+    else if(!create_display(game_screen_width, game_screen_height))
         FATAL("Failed to create a %dx%d display", game_screen_width, game_screen_height);
 
     /* create the backbuffer */
@@ -264,7 +398,10 @@ void video_init()
         FATAL("Failed to create the backbuffer");
 
     /* import OpenGL symbols */
-    import_opengl_symbols();
+    if(!is_headless) {
+        import_opengl_symbols();
+        gputimer_init();
+    }
 
     /* initialize the shader system */
     shader_init();
@@ -286,14 +423,21 @@ void video_release()
     /* release the console */
     release_console();
 
+    /* clear the post-processing chain */
+    video_clear_postprocessing();
+
     /* release the shader system */
     shader_release();
 
     /* destroy the backbuffer */
     destroy_backbuffer();
 
+    /* release the GPU timer */
+    gputimer_release();
+
     /* destroy the display */
-    destroy_display();
+    if(display != NULL)
+        destroy_display();
 }
 
 /*
@@ -306,6 +450,29 @@ void video_render(void (*render_overlay)())
     ALLEGRO_TRANSFORM display_transform;
     ALLEGRO_TRANSFORM identity_transform;
 
+    /* there is nothing to present in headless mode */
+    if(is_headless) {
+        update_fps();
+        return;
+    }
+
+    /* nothing has changed? skip the presentation */
+    dirty.skipped_presentation = is_frame_unchanged();
+    if(dirty.skipped_presentation) {
+        update_fps();
+        gputimer_end_frame();
+
+        /* clear our backbuffer for the next frame */
+        if(_glClear != NULL)
+            _glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        else {
+            al_clear_to_color(al_map_rgba_f(0.0f, 0.0f, 0.0f, 0.0f));
+            al_clear_depth_buffer(1);
+        }
+
+        return;
+    }
+
     /* compute an appropriate transform */
     al_identity_transform(&identity_transform);
     compute_display_transform(&display_transform);
@@ -319,9 +486,19 @@ void video_render(void (*render_overlay)())
     else
         al_clear_depth_buffer(1);
 
+    /* apply the post-processing chain, except for its last pass */
+    gputimer_mark(GPUPHASE_POSTPROCESSING);
+    const image_t* frame = render_postfx(backbuffer[backbuffer_index]);
+
     /* copy our backbuffer to the display backbuffer */
+    gputimer_mark(GPUPHASE_PRESENT);
     al_set_target_bitmap(al_get_backbuffer(display));
     al_use_transform(&display_transform);
+    if(postfx.pass_count > 0) {
+        /* the last pass renders directly to the display */
+        present_postfx(frame);
+    }
+    else {
 #if USE_ROUNDROBIN_BACKBUFFER
 #if 1
         /* render the current frame */
@@ -333,6 +510,7 @@ void video_render(void (*render_overlay)())
 #else
         al_draw_bitmap(IMAGE2BITMAP(backbuffer[backbuffer_index]), 0.0f, 0.0f, 0);
 #endif
+    }
     al_use_transform(&identity_transform);
 
     /* render stuff in window space */
@@ -345,6 +523,7 @@ void video_render(void (*render_overlay)())
 
     /* compute the framerate */
     update_fps();
+    gputimer_end_frame();
 
     /* OpenGL: clear values */
     if(_glClearColor != NULL)
@@ -485,7 +664,8 @@ void video_set_immersive(bool immersive)
     if(engine_is_init() && !engine_must_quit() && !engine_must_restart(NULL)) {
 
         /* change the display flag */
-        al_set_display_flag(display, ALLEGRO_FRAMELESS, immersive);
+        if(display != NULL)
+            al_set_display_flag(display, ALLEGRO_FRAMELESS, immersive);
 
         /* restore the default shader */
         if(changed_mode) {
@@ -557,9 +737,10 @@ void video_set_quality(videoquality_t quality)
     LOG("Setting the video quality to %s", VIDEOQUALITY_NAME[quality]);
     settings.quality = quality;
 
-    /* TODO */
-    if(quality > VIDEOQUALITY_MEDIUM)
-        video_showmessage("%s video quality: coming soon!", VIDEOQUALITY_NAME[quality]);
+    /* high-res backbuffers are bound by overdraw:
+       enable a front-to-back opaque pass with early depth testing */
+    settings.is_early_z_enabled = (quality >= VIDEOQUALITY_HIGH);
+    LOG("%s early depth testing", settings.is_early_z_enabled ? "Enabling" : "Disabling");
 }
 
 /*
@@ -571,6 +752,18 @@ videoquality_t video_get_quality()
     return settings.quality;
 }
 
+/*
+ * video_is_early_z_enabled()
+ * Should we render the opaque entries front-to-back using the depth
+ * buffer, so that occluded pixels are discarded early? This is set
+ * according to the video quality. The level applies changes at its
+ * next frame.
+ */
+bool video_is_early_z_enabled()
+{
+    return settings.is_early_z_enabled;
+}
+
 /*
  * video_set_fps_visible()
  * Shows/hides the FPS counter
@@ -599,6 +792,110 @@ int video_fps()
     return fps;
 }
 
+/*
+ * video_set_adaptive_quality()
+ * Lower the quality of the rendering when the game can't keep up with the
+ * target framerate, and restore it when there is headroom again
+ */
+void video_set_adaptive_quality(bool enabled)
+{
+    LOG("%s adaptive quality", enabled ? "Enabling" : "Disabling");
+
+    adaptive.is_enabled = enabled;
+    adaptive.level = ADAPTIVE_FULL_QUALITY;
+    adaptive.full_speed_since = -1.0;
+    adaptive.restored_at = -1.0;
+    adaptive.restore_delay = ADAPTIVE_RESTORE_DELAY;
+    adaptive.skip_next_frame = false;
+}
+
+/*
+ * video_set_power_saving()
+ * Render every other frame to keep the device cooler. The game logic
+ * still runs at the target framerate
+ */
+void video_set_power_saving(bool enabled)
+{
+    if(enabled != is_power_saving)
+        LOG("%s power saving", enabled ? "Enabling" : "Disabling");
+
+    is_power_saving = enabled;
+    adaptive.skip_next_frame = false;
+}
+
+/*
+ * video_is_power_saving()
+ * Are we rendering every other frame to save power?
+ */
+bool video_is_power_saving()
+{
+    return is_power_saving;
+}
+
+/*
+ * video_set_idle()
+ * The engine informs us that it's throttling the update rate of a static
+ * scene. The measurement of the framerate is kept as it was meanwhile, so
+ * that the adaptive quality doesn't take the throttling for load
+ */
+void video_set_idle(bool idle)
+{
+    is_idle = idle;
+}
+
+/*
+ * video_enable_headless_mode()
+ * Run without a display. Simulations may run in servers with no graphics.
+ * Call before video_init()
+ */
+void video_enable_headless_mode(bool enabled)
+{
+    is_headless = enabled;
+}
+
+/*
+ * video_is_headless()
+ * Are we running without a display?
+ */
+bool video_is_headless()
+{
+    return is_headless;
+}
+
+/*
+ * video_is_adaptive_quality_enabled()
+ * Is the adaptive quality enabled?
+ */
+bool video_is_adaptive_quality_enabled()
+{
+    return adaptive.is_enabled;
+}
+
+/*
+ * video_are_costly_effects_enabled()
+ * Should costly effects, such as the shader of the water, be rendered?
+ * They are disabled by the adaptive quality under load
+ */
+bool video_are_costly_effects_enabled()
+{
+    return adaptive.level < ADAPTIVE_REDUCED_EFFECTS;
+}
+
+/*
+ * video_should_skip_frame()
+ * Should the engine skip the rendering of the current frame? The adaptive
+ * quality skips every other frame under heavy load, and so does the power
+ * saving mode. Call once per frame
+ */
+bool video_should_skip_frame()
+{
+    if(adaptive.level < ADAPTIVE_SKIP_FRAMES && !is_power_saving)
+        return false;
+
+    adaptive.skip_next_frame = !adaptive.skip_next_frame;
+    return !adaptive.skip_next_frame;
+}
+
 /*
  * video_get_screen_size()
  * Returns the size of the backbuffer
@@ -613,6 +910,19 @@ v2d_t video_get_screen_size()
     return v2d_new(screen_width, screen_height);
 }
 
+/*
+ * video_get_max_screen_size()
+ * Returns the size of the storage of the backbuffer. The screen may be
+ * resized up to this size without reallocating the backbuffer
+ */
+v2d_t video_get_max_screen_size()
+{
+    if(backbuffer_storage[0] == NULL)
+        return video_get_screen_size();
+
+    return v2d_new(image_width(backbuffer_storage[0]), image_height(backbuffer_storage[0]));
+}
+
 /*
  * video_get_window_size()
  * Returns the window size
@@ -660,6 +970,57 @@ void video_clearmessages()
         print_to_console("");
 }
 
+/*
+ * video_enable_dirty_tracking()
+ * Enables dirty tracking for the current frame. If the frame turns out to be
+ * identical to the previous presented frame, its presentation will be
+ * skipped. Call this before rendering anything in a mostly static scene (a
+ * menu) that draws exclusively via images and fonts.
+ */
+void video_enable_dirty_tracking()
+{
+    dirty.enabled = true;
+    dirty.signature = DIRTY_SIGNATURE_SEED;
+}
+
+/*
+ * video_skipped_presentation()
+ * Was the presentation of the last rendered frame skipped because the
+ * frame was identical to the previous one?
+ */
+bool video_skipped_presentation()
+{
+    return dirty.skipped_presentation;
+}
+
+/*
+ * video_is_tracking_drawing()
+ * Is dirty tracking enabled for the current frame?
+ */
+bool video_is_tracking_drawing()
+{
+    return dirty.enabled;
+}
+
+/*
+ * video_track_drawing()
+ * Feeds the signature of the current frame with the data of a drawing
+ * operation. Use this when dirty tracking is enabled.
+ */
+void video_track_drawing(const void* data, size_t size)
+{
+    const uint8_t* byte = (const uint8_t*)data;
+    uint64_t hash = dirty.signature;
+
+    /* FNV-1a */
+    for(size_t i = 0; i < size; i++) {
+        hash ^= byte[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    dirty.signature = hash;
+}
+
 /*
  * video_display_loading_screen()
  * Displays a loading screen
@@ -676,6 +1037,9 @@ void video_display_loading_screen()
  */
 void video_display_loading_screen_ex(double progress)
 {
+    if(is_headless)
+        return;
+
     const image_t *img = image_load(LOADING_IMAGE);
     v2d_t camera = v2d_multiply(video_get_screen_size(), 0.5f);
 
@@ -743,14 +1107,67 @@ v2d_t video_convert_window_to_screen(v2d_t window_coordinates)
  * Destroy the returned image after usage
  */
 image_t* video_take_snapshot()
+{
+    return image_clone(video_get_snapshot_source());
+}
+
+/*
+ * video_get_snapshot_source()
+ * The backbuffer of the last rendered frame. Read its pixels
+ * instead of cloning it if you don't need a copy on the GPU
+ */
+const image_t* video_get_snapshot_source()
 {
 #if USE_ROUNDROBIN_BACKBUFFER
     int index = 1 - backbuffer_index;
 #else
     int index = backbuffer_index;
 #endif
-    const image_t* snapshot = backbuffer[index];
-    return image_clone(snapshot);
+    return backbuffer[index];
+}
+
+/*
+ * video_add_postprocessing_pass()
+ * Appends a full-screen shader to the post-processing chain. The pass is
+ * rendered at 1/downscale of the resolution of the screen; the last pass is
+ * always rendered to the window. Besides tex, the shader may sample the
+ * original frame using a sampler named scene. Returns true on success
+ */
+bool video_add_postprocessing_pass(shader_t* shader, int downscale)
+{
+    if(postfx.pass_count >= POSTFX_MAX_PASSES) {
+        LOG("Can't add more than %d post-processing passes", POSTFX_MAX_PASSES);
+        return false;
+    }
+
+    downscale = clip(downscale, 1, POSTFX_MAX_DOWNSCALE);
+    postfx.pass[postfx.pass_count].shader = shader;
+    postfx.pass[postfx.pass_count].downscale = downscale;
+    postfx.pass_count++;
+
+    invalidate_frame();
+    return true;
+}
+
+/*
+ * video_clear_postprocessing()
+ * Removes all passes of the post-processing chain
+ */
+void video_clear_postprocessing()
+{
+    if(postfx.pass_count > 0)
+        invalidate_frame();
+
+    postfx.pass_count = 0;
+}
+
+/*
+ * video_postprocessing_pass_count()
+ * The number of passes of the post-processing chain
+ */
+int video_postprocessing_pass_count()
+{
+    return postfx.pass_count;
 }
 
 /*
@@ -881,6 +1298,11 @@ void destroy_display()
 /* Reconfigure the display according to the current settings */
 void reconfigure_display()
 {
+    invalidate_frame();
+
+    if(display == NULL)
+        return;
+
 #if !defined(__ANDROID__)
     int multiplier = (int)(settings.resolution - VIDEORESOLUTION_1X) + 1;
     int new_display_width = game_screen_width * multiplier;
@@ -922,10 +1344,10 @@ void reconfigure_display()
 void compute_display_transform(ALLEGRO_TRANSFORM* transform)
 {
     v2d_t scale, offset;
-    float display_width = (float)al_get_display_width(display);
-    float display_height = (float)al_get_display_height(display);
     float backbuffer_width = (float)image_width(backbuffer[0]);
     float backbuffer_height = (float)image_height(backbuffer[0]);
+    float display_width = (display != NULL) ? (float)al_get_display_width(display) : backbuffer_width;
+    float display_height = (display != NULL) ? (float)al_get_display_height(display) : backbuffer_height;
 
     /* ensure non-zero scale for an invertible transform. is this necessary? */
     display_width = max(1, display_width);
@@ -985,6 +1407,7 @@ void a5_handle_video_event(const ALLEGRO_EVENT* event, void* data)
             break;
 
         case ALLEGRO_EVENT_DISPLAY_SWITCH_IN:
+            invalidate_frame();
             break;
 
         case ALLEGRO_EVENT_DISPLAY_SWITCH_OUT:
@@ -995,6 +1418,7 @@ void a5_handle_video_event(const ALLEGRO_EVENT* event, void* data)
             al_acknowledge_drawing_halt(event->display.source);
             destroy_backbuffer(); /* the backbuffer has the ALLEGRO_NO_PRESERVE_TEXTURE flag enabled */
             shader_discard_all();
+            gputimer_release();
             was_immersive = video_is_immersive();
             break;
 
@@ -1008,6 +1432,8 @@ void a5_handle_video_event(const ALLEGRO_EVENT* event, void* data)
             if(!use_default_shader())
                 LOG("Can't set the default shader");
 
+            gputimer_init();
+
             video_set_immersive(was_immersive);
             break;
     }
@@ -1026,6 +1452,9 @@ void a5_handle_video_event(const ALLEGRO_EVENT* event, void* data)
 /* Create the backbuffer (the image texture to which the game will be rendered to) */
 bool create_backbuffer()
 {
+    /* the contents of the display must be recreated */
+    invalidate_frame();
+
     int screen_width = game_screen_width;
     int screen_height = game_screen_height;
 
@@ -1038,19 +1467,17 @@ bool create_backbuffer()
     /* compute the size of the backbuffer */
     compute_screen_size(settings.mode, &screen_width, &screen_height);
 
-    /* create the images */
-    bool want_depth_buffer = true;
-
-    if(NULL == (backbuffer[0] = image_create_backbuffer(screen_width, screen_height, want_depth_buffer))) {
-        return false;
-    }
-#if USE_ROUNDROBIN_BACKBUFFER
-    else if(NULL == (backbuffer[1] = image_create_backbuffer(screen_width, screen_height, want_depth_buffer))) {
-        image_destroy(backbuffer[0]);
-        backbuffer[0] = NULL;
+    /* make sure that the storage is large enough */
+    if(!create_backbuffer_storage(screen_width, screen_height))
         return false;
+
+    /* create the images. These are views of the top-left corner of the storage */
+    for(int b = 0; b < NUMBER_OF_BACKBUFFERS; b++) {
+        if(NULL == (backbuffer[b] = image_create_shared(backbuffer_storage[b], 0, 0, screen_width, screen_height))) {
+            release_backbuffer_views();
+            return false;
+        }
     }
-#endif
 
     /* set the target bitmap */
     backbuffer_index = 0;
@@ -1070,15 +1497,9 @@ void destroy_backbuffer()
         return;
     }
 
-    /* restore the default framebuffer */
-    al_set_target_bitmap(al_get_backbuffer(display));
-
     /* destroy the images */
-    for(int b = sizeof(backbuffer) / sizeof(backbuffer[0]) - 1; b >= 0; b--) {
-        if(backbuffer[b] != NULL)
-            image_destroy(backbuffer[b]);
-        backbuffer[b] = NULL;
-    }
+    release_backbuffer_views();
+    destroy_backbuffer_storage();
 }
 
 /* Reconfigure the backbuffer according to the current settings */
@@ -1090,9 +1511,9 @@ void reconfigure_backbuffer()
         return;
     }
 
-    /* destroy the old */
+    /* release the old views. The storage is kept if it's large enough */
     LOG("Will reconfigure the backbuffer...");
-    destroy_backbuffer();
+    release_backbuffer_views();
 
     /* create the new */
     if(!create_backbuffer())
@@ -1103,11 +1524,82 @@ void reconfigure_backbuffer()
         LOG("Can't set the default shader");
 }
 
+/* Release the views of the backbuffer, keeping its storage */
+void release_backbuffer_views()
+{
+    /* restore the default framebuffer */
+    al_set_target_bitmap(display != NULL ? al_get_backbuffer(display) : NULL);
+
+    /* destroy the views */
+    for(int b = NUMBER_OF_BACKBUFFERS - 1; b >= 0; b--) {
+        if(backbuffer[b] != NULL)
+            image_destroy(backbuffer[b]);
+        backbuffer[b] = NULL;
+    }
+
+    /* the views of the post-processing targets have the size of the backbuffer */
+    release_postfx_views();
+}
+
+/* Make sure that the storage of the backbuffer can hold a screen of the given
+   size. The storage is only reallocated if it's too small; when it is, we
+   allocate it at the largest size we expect to need, so that resizing the
+   window or switching the video mode doesn't reallocate GPU memory */
+bool create_backbuffer_storage(int screen_width, int screen_height)
+{
+    int width = screen_width, height = screen_height;
+    bool want_depth_buffer = true;
+
+    /* is the current storage large enough? */
+    if(backbuffer_storage[0] != NULL) {
+        if(screen_width <= image_width(backbuffer_storage[0]) && screen_height <= image_height(backbuffer_storage[0]))
+            return true;
+
+        width = max(width, image_width(backbuffer_storage[0]));
+        height = max(height, image_height(backbuffer_storage[0]));
+        destroy_backbuffer_storage();
+    }
+
+    /* in the modes other than the default, the screen may be as large as the desktop */
+    if(settings.mode != VIDEOMODE_DEFAULT && display != NULL) {
+        ALLEGRO_MONITOR_INFO info;
+        if(al_get_monitor_info(0, &info)) {
+            width = max(width, info.x2 - info.x1);
+            height = max(height, info.y2 - info.y1);
+        }
+    }
+
+    /* create the storage */
+    LOG("Creating a %dx%d backbuffer storage", width, height);
+    for(int b = 0; b < NUMBER_OF_BACKBUFFERS; b++) {
+        if(NULL == (backbuffer_storage[b] = image_create_backbuffer(width, height, want_depth_buffer))) {
+            destroy_backbuffer_storage();
+            return false;
+        }
+    }
+
+    /* done! */
+    return true;
+}
+
+/* Destroy the storage of the backbuffer. Its views must be released first */
+void destroy_backbuffer_storage()
+{
+    /* the post-processing targets are allocated in proportion to the storage */
+    destroy_postfx_targets();
+
+    for(int b = NUMBER_OF_BACKBUFFERS - 1; b >= 0; b--) {
+        if(backbuffer_storage[b] != NULL)
+            image_destroy(backbuffer_storage[b]);
+        backbuffer_storage[b] = NULL;
+    }
+}
+
 /* Compute the size of the screen / backbuffer according to the video mode */
 void compute_screen_size(videomode_t mode, int* screen_width, int* screen_height)
 {
-    int window_width = al_get_display_width(display);
-    int window_height = al_get_display_height(display);
+    int window_width = (display != NULL) ? al_get_display_width(display) : game_screen_width;
+    int window_height = (display != NULL) ? al_get_display_height(display) : game_screen_height;
 
     switch(mode) {
         case VIDEOMODE_DEFAULT:
@@ -1174,6 +1666,130 @@ bool use_default_shader()
 
 
 
+/*
+ *
+ * POST-PROCESSING
+ *
+ */
+
+/* Render all passes of the post-processing chain except the last one,
+   returning the input of the last pass */
+const image_t* render_postfx(const image_t* scene)
+{
+    const image_t* input = scene;
+
+    if(postfx.pass_count <= 1)
+        return input;
+
+    /* overwrite the intermediate targets: there is no need to clear them */
+    int op, src, dst;
+    al_get_blender(&op, &src, &dst);
+    al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ZERO);
+
+    for(int i = 0; i < postfx.pass_count - 1; i++) {
+        shader_t* shader = postfx.pass[i].shader;
+        image_t* output = postfx_target(postfx.pass[i].downscale, input);
+
+        if(output == NULL)
+            break;
+
+        al_set_target_bitmap(IMAGE2BITMAP(output));
+        shader_set_sampler(shader, "scene", scene);
+        if(!shader_set_active(shader))
+            continue;
+
+        al_draw_scaled_bitmap(IMAGE2BITMAP(input),
+            0.0f, 0.0f, image_width(input), image_height(input),
+            0.0f, 0.0f, image_width(output), image_height(output),
+        0);
+
+        shader_set_active(shader_get_default());
+        input = output;
+    }
+
+    al_set_blender(op, src, dst);
+    return input;
+}
+
+/* Render the last pass of the post-processing chain to the display,
+   which must be the current target */
+void present_postfx(const image_t* image)
+{
+    shader_t* shader = postfx.pass[postfx.pass_count - 1].shader;
+    const image_t* scene = backbuffer[backbuffer_index];
+
+    shader_set_sampler(shader, "scene", scene);
+    bool active = shader_set_active(shader);
+
+    al_draw_scaled_bitmap(IMAGE2BITMAP(image),
+        0.0f, 0.0f, image_width(image), image_height(image),
+        0.0f, 0.0f, image_width(scene), image_height(scene),
+    0);
+
+    if(active)
+        shader_set_active(shader_get_default());
+}
+
+/* Get an intermediate target of the given downscale factor that is different
+   from the input of the pass, creating it if necessary */
+image_t* postfx_target(int downscale, const image_t* input)
+{
+    int index = (postfx.target[downscale][0] == input) ? 1 : 0;
+
+    if(postfx.target[downscale][index] == NULL) {
+        const image_t* screen = backbuffer[backbuffer_index];
+        int width = max(1, image_width(screen) / downscale);
+        int height = max(1, image_height(screen) / downscale);
+
+        /* create the storage */
+        if(postfx.target_storage[downscale][index] == NULL) {
+            const image_t* storage = backbuffer_storage[backbuffer_index];
+            int storage_width = max(1, image_width(storage) / downscale);
+            int storage_height = max(1, image_height(storage) / downscale);
+            int flags = IC_BACKBUFFER | (downscale > 1 ? IC_LINEAR : 0);
+
+            LOG("Creating a %dx%d post-processing target", storage_width, storage_height);
+            if(NULL == (postfx.target_storage[downscale][index] = image_create_ex(storage_width, storage_height, flags))) {
+                LOG("Can't create a %dx%d post-processing target", storage_width, storage_height);
+                return NULL;
+            }
+        }
+
+        /* create the view */
+        postfx.target[downscale][index] = image_create_shared(postfx.target_storage[downscale][index], 0, 0, width, height);
+    }
+
+    return postfx.target[downscale][index];
+}
+
+/* Release the views of the intermediate targets, keeping their storage */
+void release_postfx_views()
+{
+    for(int d = 0; d <= POSTFX_MAX_DOWNSCALE; d++) {
+        for(int i = 0; i < 2; i++) {
+            if(postfx.target[d][i] != NULL)
+                image_destroy(postfx.target[d][i]);
+            postfx.target[d][i] = NULL;
+        }
+    }
+}
+
+/* Destroy the intermediate targets of the post-processing chain */
+void destroy_postfx_targets()
+{
+    release_postfx_views();
+
+    for(int d = 0; d <= POSTFX_MAX_DOWNSCALE; d++) {
+        for(int i = 0; i < 2; i++) {
+            if(postfx.target_storage[d][i] != NULL)
+                image_destroy(postfx.target_storage[d][i]);
+            postfx.target_storage[d][i] = NULL;
+        }
+    }
+}
+
+
+
 /*
  *
  * BUILT-IN CONSOLE
@@ -1203,6 +1819,9 @@ void release_console()
 {
     LOG("Releasing the console...");
 
+    /* release the cached texts */
+    release_text_layer();
+
     /* release the font of the console */
     al_destroy_font(console.font);
 }
@@ -1256,6 +1875,106 @@ void render_console()
 }
 
 
+/* Enqueue a text to be rendered in the text layer, using the current transform */
+void enqueue_text(float x, float y, int flags, const char* fmt, ...)
+{
+    va_list args;
+
+    if(textlayer.count >= TEXTLAYER_MAX_COMMANDS)
+        return;
+
+    /* zero the command, so that commands can be compared with memcmp() */
+    textcommand_t* command = &textlayer.command[textlayer.count++];
+    memset(command, 0, sizeof(*command));
+
+    al_copy_transform(&command->transform, al_get_current_transform());
+    command->x = x;
+    command->y = y;
+    command->flags = flags;
+
+    va_start(args, fmt);
+    vsnprintf(command->text, sizeof(command->text), fmt, args);
+    va_end(args);
+}
+
+/* Render the text layer to the display. Texts are laid out again only if they have changed */
+void flush_text_layer()
+{
+    int width = al_get_display_width(display);
+    int height = al_get_display_height(display);
+    bool is_valid = (
+        textlayer.bitmap != NULL &&
+        al_get_bitmap_width(textlayer.bitmap) == width &&
+        al_get_bitmap_height(textlayer.bitmap) == height &&
+        !(al_get_bitmap_flags(textlayer.bitmap) & ALLEGRO_MEMORY_BITMAP) /* the display may have been recreated */
+    );
+
+    /* nothing to render */
+    if(textlayer.count == 0) {
+        textlayer.cached_count = 0;
+        return;
+    }
+
+    /* is the cached bitmap up-to-date? */
+    if(
+        !is_valid ||
+        textlayer.count != textlayer.cached_count ||
+        0 != memcmp(textlayer.command, textlayer.cached, textlayer.count * sizeof(*textlayer.command))
+    ) {
+        ALLEGRO_STATE state;
+        al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP | ALLEGRO_STATE_TRANSFORM | ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
+
+        /* create the bitmap */
+        if(!is_valid) {
+            if(textlayer.bitmap != NULL)
+                al_destroy_bitmap(textlayer.bitmap);
+
+            al_set_new_bitmap_flags(ALLEGRO_VIDEO_BITMAP);
+            if(NULL == (textlayer.bitmap = al_create_bitmap(width, height))) {
+                LOG("Can't create the text layer");
+                al_restore_state(&state);
+                return;
+            }
+        }
+
+        /* lay out the texts with a shadow */
+        al_set_target_bitmap(textlayer.bitmap);
+        al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+        al_hold_bitmap_drawing(true);
+        for(int i = 0; i < textlayer.count; i++) {
+            const textcommand_t* command = &textlayer.command[i];
+
+            al_use_transform(&command->transform);
+            al_draw_text(console.font, al_map_rgb(0, 0, 0), command->x + 1.0f, command->y + 1.0f, command->flags, command->text);
+            al_draw_text(console.font, al_map_rgb(0, 0, 0), command->x + 0.0f, command->y + 1.0f, command->flags, command->text);
+            al_draw_text(console.font, al_map_rgb(255, 255, 255), command->x, command->y, command->flags, command->text);
+        }
+        al_hold_bitmap_drawing(false);
+
+        /* remember the commands */
+        memcpy(textlayer.cached, textlayer.command, textlayer.count * sizeof(*textlayer.command));
+        textlayer.cached_count = textlayer.count;
+
+        al_restore_state(&state);
+    }
+
+    /* render the cached texts in one go */
+    al_draw_bitmap(textlayer.bitmap, 0.0f, 0.0f, 0);
+}
+
+/* Release the text layer */
+void release_text_layer()
+{
+    if(textlayer.bitmap != NULL) {
+        al_destroy_bitmap(textlayer.bitmap);
+        textlayer.bitmap = NULL;
+    }
+
+    textlayer.count = 0;
+    textlayer.cached_count = 0;
+}
+
+
 /*
  *
  * FRAMERATE
@@ -1277,6 +1996,47 @@ void init_fps()
         fps_sample[i] = 0.0;
 }
 
+/* Lower or restore the quality according to the median of the samples of the framerate */
+void update_adaptive_quality(double fps_sample)
+{
+    double now = timer_get_now();
+    adaptivelevel_t level = adaptive.level;
+
+    /* the median is 0 until enough samples have been collected */
+    if(fps_sample <= 0.0)
+        return;
+
+    if(fps_sample < ADAPTIVE_LOWER_FPS) {
+        /* can't keep up: lower the quality */
+        adaptive.full_speed_since = -1.0;
+        if(level < ADAPTIVE_SKIP_FRAMES) {
+            /* we have restored the quality too early */
+            if(adaptive.restored_at >= 0.0 && now - adaptive.restored_at < adaptive.restore_delay)
+                adaptive.restore_delay = min(2.0 * adaptive.restore_delay, ADAPTIVE_MAX_DELAY);
+
+            adaptive.level = level + 1;
+        }
+    }
+    else if(fps_sample >= ADAPTIVE_RESTORE_FPS && level > ADAPTIVE_FULL_QUALITY) {
+        /* there is headroom: restore the quality after a while */
+        if(adaptive.full_speed_since < 0.0)
+            adaptive.full_speed_since = now;
+        else if(now - adaptive.full_speed_since >= adaptive.restore_delay) {
+            adaptive.full_speed_since = -1.0;
+            adaptive.restored_at = now;
+            adaptive.level = level - 1;
+        }
+    }
+    else
+        adaptive.full_speed_since = -1.0;
+
+    /* log the change */
+    if(adaptive.level != level) {
+        LOG("Adaptive quality: %s at %.1f fps", ADAPTIVELEVEL_NAME[adaptive.level], fps_sample);
+        adaptive.skip_next_frame = false;
+    }
+}
+
 /* sorting function for the framerate samples */
 int sort_fps_samples(const void* a, const void* b)
 {
@@ -1292,6 +2052,13 @@ void update_fps()
     double delta_time = timer_get_delta();
     double elapsed_time = timer_get_elapsed();
 
+    /* the update rate is throttled on purpose; keep the last measurement */
+    if(is_idle) {
+        fps_last_update = elapsed_time;
+        fps_frames = 0;
+        return;
+    }
+
     /* method 1: count the number of frames */
     ++fps_frames;
     if(elapsed_time >= fps_last_update + 1.0 / FPS_UPDATE_FREQUENCY) {
@@ -1312,6 +2079,10 @@ void update_fps()
     /* collect a sample of the framerate */
     fps_sample[index_of_next_fps_sample++] = 1.0 / delta_time;
 
+    /* adjust the quality when a new median is available */
+    if(adaptive.is_enabled && index_of_next_fps_sample == 1)
+        update_adaptive_quality(fps_median);
+
     /* Compare the two methods of determining the framerate. If their results
        are very similar, take the median of the samples. If they are not, the
        dataset has outliers. Let's take the counted method in this case. */
@@ -1355,6 +2126,72 @@ void render_fps()
 }
 
 
+/* render the profiling data of the render queue */
+void render_profiler()
+{
+    int font_scale = FONT_SCALE();
+    int font_height = al_get_font_line_height(console.font);
+    int ypos = 0;
+
+    const renderqueue_profile_t* profile;
+    int type_count = renderqueue_profile(&profile);
+
+    ALLEGRO_STATE state;
+    al_store_state(&state, ALLEGRO_STATE_TRANSFORM);
+
+    ALLEGRO_TRANSFORM transform;
+    al_identity_transform(&transform);
+    al_scale_transform(&transform, font_scale, font_scale);
+    al_use_transform(&transform);
+
+    DRAW_TEXT(0.0f, ypos, ALLEGRO_ALIGN_LEFT, "%-14s %6s %6s %6s %6s %8s", "type", "count", "batch", "texsw", "draws", "cpu us");
+    ypos += font_height;
+
+    /* list the types that have been rendered and the total */
+    for(int i = 0; i <= type_count; i++) {
+        if(profile[i].entries == 0.0f && i < type_count)
+            continue;
+
+        DRAW_TEXT(0.0f, ypos, ALLEGRO_ALIGN_LEFT, "%-14s %6.1f %6.1f %6.1f %6.1f %8.1f",
+            profile[i].name,
+            profile[i].entries,
+            profile[i].batches,
+            profile[i].texture_switches,
+            profile[i].draw_calls,
+            profile[i].microseconds
+        );
+        ypos += font_height;
+    }
+
+    /* GPU time of the render phases */
+    ypos += font_height;
+    if(!gputimer_is_available()) {
+        DRAW_TEXT(0.0f, ypos, ALLEGRO_ALIGN_LEFT, "%s", "GPU timing is not available");
+        al_restore_state(&state);
+        return;
+    }
+
+    DRAW_TEXT(0.0f, ypos, ALLEGRO_ALIGN_LEFT, "%-16s %8s", "phase", "gpu ms");
+    ypos += font_height;
+
+    for(gpuphase_t phase = 0; phase <= GPUPHASE_COUNT; phase++) {
+        DRAW_TEXT(0.0f, ypos, ALLEGRO_ALIGN_LEFT, "%-16s %8.2f", gputimer_phase_name(phase), gputimer_milliseconds(phase));
+        ypos += font_height;
+    }
+
+    /* compare the CPU time with the GPU time of a frame */
+    if(frameprofiler_is_enabled()) {
+        double cpu_ms = 1000.0 * (frameprofiler_mean(FRAMEPHASE_UPDATE) + frameprofiler_mean(FRAMEPHASE_RENDER));
+        DRAW_TEXT(0.0f, ypos, ALLEGRO_ALIGN_LEFT, "%-16s %8.2f", "cpu (upd+rnd)", cpu_ms);
+        ypos += font_height;
+
+        /* the cost of these texts, which is part of the presentation */
+        double overlay_ms = 1000.0 * frameprofiler_mean(FRAMEPHASE_OVERLAY);
+        DRAW_TEXT(0.0f, ypos, ALLEGRO_ALIGN_LEFT, "%-16s %8.2f", "cpu (overlay)", overlay_ms);
+    }
+
+    al_restore_state(&state);
+}
 
 /*
  *
@@ -1365,14 +2202,68 @@ void render_fps()
 /* render texts with Allegro's built-in font */
 void render_texts()
 {
-    al_hold_bitmap_drawing(true);
+    frameprofiler_begin(FRAMEPHASE_OVERLAY);
+
+    /* lay out the texts */
+    textlayer.count = 0;
 
     if(settings.is_fps_visible)
         render_fps();
 
+    if(renderqueue_is_profiler_enabled())
+        render_profiler();
+
     render_console();
 
-    al_hold_bitmap_drawing(false);
+    /* render them */
+    flush_text_layer();
+
+    frameprofiler_end(FRAMEPHASE_OVERLAY);
+}
+
+/* checks if the current frame is identical to the last presented frame.
+   This also finishes the signature of the current frame */
+bool is_frame_unchanged()
+{
+    bool was_enabled = dirty.enabled;
+    dirty.enabled = false;
+
+    /* no tracking */
+    if(!was_enabled) {
+        dirty.has_previous_signature = false;
+        return false;
+    }
+
+    /* the overlay and the texts are rendered in window space */
+    if(mobilegamepad_is_visible()) {
+        dirty.has_previous_signature = false;
+        return false;
+    }
+
+    if(settings.is_fps_visible) {
+        int tenths_of_fps = (int)(10.0 * fps);
+        video_track_drawing(&tenths_of_fps, sizeof(tenths_of_fps));
+    }
+
+    double elapsed = timer_get_elapsed();
+    for(int i = 0; i < CONSOLE_MAX_ENTRIES; i++) {
+        bool is_visible = (elapsed < console.entry[i].expire_time);
+        video_track_drawing(&is_visible, sizeof(is_visible));
+    }
+    video_track_drawing(&console.head, sizeof(console.head));
+
+    /* compare the signatures */
+    bool unchanged = dirty.has_previous_signature && (dirty.signature == dirty.previous_signature);
+    dirty.previous_signature = dirty.signature;
+    dirty.has_previous_signature = true;
+
+    return unchanged;
+}
+
+/* forces the presentation of the next frame */
+void invalidate_frame()
+{
+    dirty.has_previous_signature = false;
 }
 
 /* import OpenGL symbols */
@@ -22,10 +22,12 @@
 #define _VIDEO_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "../util/v2d.h"
 #include "color.h"
 
 struct image_t;
+struct shader_t;
 
 /* video manager */
 void video_init();
@@ -37,6 +39,7 @@ void video_render(void (*render_overlay)());
 #define VIDEO_SCREEN_H ((int)(video_get_screen_size().y))
 struct image_t *video_get_backbuffer();
 v2d_t video_get_screen_size(); /* usually 426x240 pixels */
+v2d_t video_get_max_screen_size(); /* the backbuffer is a view of a storage of this size */
 
 /* resolution: controls the size of the window */
 typedef enum videoresolution_t {
@@ -72,6 +75,22 @@ typedef enum videoquality_t {
 
 void video_set_quality(videoquality_t quality);
 videoquality_t video_get_quality();
+bool video_is_early_z_enabled(); /* front-to-back opaque pass with the depth buffer */
+
+/* headless mode: no display; call before video_init() */
+void video_enable_headless_mode(bool enabled);
+bool video_is_headless();
+
+/* adaptive quality: lower the quality under load to keep the game at full speed */
+void video_set_adaptive_quality(bool enabled);
+bool video_is_adaptive_quality_enabled();
+bool video_are_costly_effects_enabled(); /* effects such as the shader of the water */
+bool video_should_skip_frame(); /* call once per frame */
+
+/* power: render less often on constrained devices and while the engine is idle */
+void video_set_power_saving(bool enabled); /* render every other frame */
+bool video_is_power_saving();
+void video_set_idle(bool idle); /* the engine is throttling the update rate */
 
 /* fullscreen mode */
 void video_set_fullscreen(bool fullscreen);
@@ -90,12 +109,25 @@ int video_fps(); /* the FPS rate */
 void video_showmessage(const char *fmt, ...);
 void video_clearmessages();
 
+/* dirty tracking: skip the presentation of unchanged frames */
+void video_enable_dirty_tracking(); /* call before rendering a static scene */
+bool video_is_tracking_drawing();
+bool video_skipped_presentation(); /* was the presentation of the last rendered frame skipped? */
+void video_track_drawing(const void* data, size_t size);
+
+/* post-processing: an ordered chain of full-screen shaders applied to the backbuffer.
+   Each pass reads the output of the previous pass (tex) and the original frame (scene) */
+bool video_add_postprocessing_pass(struct shader_t* shader, int downscale); /* downscale: 1 = full resolution, 2 = half resolution... */
+void video_clear_postprocessing();
+int video_postprocessing_pass_count();
+
 /* misc */
 void video_display_loading_screen();
 void video_display_loading_screen_ex(double progress);
 const char* video_get_window_title();
 v2d_t video_convert_window_to_screen(v2d_t window_coordinates);
 struct image_t* video_take_snapshot();
+const struct image_t* video_get_snapshot_source(); /* the backbuffer of the last rendered frame; don't modify */
 bool video_use_default_shader();
 
 #endif
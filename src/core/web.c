@@ -36,7 +36,14 @@
 #include <allegro5/allegro_android.h>
 #endif
 
+#include <allegro5/allegro.h>
+
+#if defined(WANT_HTTP)
+#include <curl/curl.h>
+#endif
+
 #include "web.h"
+#include "global.h"
 #include "video.h"
 #include "logfile.h"
 #include "../util/util.h"
@@ -54,6 +61,68 @@ static char *encode_uri_ex(const char *uri, const char encode_table[256]);
 static void open_web_page(const char* safe_url);
 #endif
 
+/* HTTP requests */
+typedef struct httprequest_t httprequest_t;
+struct httprequest_t {
+    /* request */
+    char* url;
+    char* body; /* NULL for GET requests */
+    char* content_type;
+    httpcallback_t callback; /* may be NULL */
+    void* context;
+
+    /* response */
+    int status;
+    char* response;
+    size_t response_size;
+
+    httprequest_t* next;
+};
+
+typedef struct httpqueue_t httpqueue_t;
+struct httpqueue_t {
+    httprequest_t* head;
+    httprequest_t* tail;
+};
+
+static httpqueue_t pending_requests = { NULL, NULL }; /* shared with the worker */
+static httpqueue_t completed_requests = { NULL, NULL }; /* shared with the worker */
+static ALLEGRO_THREAD* worker = NULL;
+static ALLEGRO_MUTEX* mutex = NULL;
+static ALLEGRO_COND* cond = NULL;
+static bool wants_to_quit = false;
+
+static const int HTTP_TIMEOUT = 15; /* in seconds */
+static const size_t HTTP_MAX_RESPONSE_SIZE = 1024 * 1024; /* in bytes */
+
+static bool enqueue_request(const char* url, const char* body, const char* content_type, httpcallback_t callback, void* context);
+static void* worker_thread(ALLEGRO_THREAD* thread, void* arg);
+static void perform_request(httprequest_t* request);
+static void complete_request(httprequest_t* request);
+static void cancel_requests(httpqueue_t* queue);
+static httprequest_t* destroy_request(httprequest_t* request);
+static inline void queue_push(httpqueue_t* queue, httprequest_t* request);
+static inline httprequest_t* queue_pop(httpqueue_t* queue);
+static inline bool is_http_url(const char* url);
+
+/* telemetry: events are sent in batches, as JSON arrays */
+typedef struct telemetrybatch_t telemetrybatch_t;
+struct telemetrybatch_t {
+    char* url;
+    char* buffer; /* "[event1,event2,...": the closing bracket is added when sending */
+    size_t length; /* length of the buffer */
+    size_t capacity; /* capacity of the buffer */
+    int count; /* number of events in the batch */
+    double start_time; /* time of the first event of the batch, in seconds */
+    telemetrybatch_t* next;
+};
+
+static telemetrybatch_t* telemetry = NULL;
+static const int TELEMETRY_MAX_EVENTS = 32; /* send a batch when it has this many events... */
+static const double TELEMETRY_MAX_DELAY = 10.0; /* ...or when its first event is this old (in seconds) */
+static void send_telemetry(telemetrybatch_t* batch);
+static void append_telemetry(telemetrybatch_t* batch, const char* str, size_t length);
+
 
 
 /* public functions */
@@ -187,6 +256,193 @@ char* encode_uri_component(const char* uri, char* dest, size_t dest_size)
 
 
 
+/*
+ * web_init()
+ * Initializes the HTTP client
+ */
+void web_init()
+{
+#if defined(WANT_HTTP)
+    if(curl_global_init(CURL_GLOBAL_DEFAULT) != 0)
+        fatal_error("Can't initialize libcurl");
+
+    logfile_message("Using %s", curl_version());
+#endif
+
+    wants_to_quit = false;
+    mutex = al_create_mutex();
+    cond = al_create_cond();
+    worker = al_create_thread(worker_thread, NULL);
+    al_start_thread(worker);
+}
+
+/*
+ * web_release()
+ * Releases the HTTP client. Pending requests are canceled
+ * and unsent telemetry is discarded
+ */
+void web_release()
+{
+    if(worker == NULL)
+        return;
+
+    /* stop the worker. We wait for the request in progress, if any */
+    al_lock_mutex(mutex);
+    wants_to_quit = true;
+    al_broadcast_cond(cond);
+    al_unlock_mutex(mutex);
+
+    al_join_thread(worker, NULL);
+    al_destroy_thread(worker);
+    worker = NULL;
+
+    /* cancel the requests */
+    cancel_requests(&pending_requests);
+    cancel_requests(&completed_requests);
+
+    /* discard the telemetry */
+    while(telemetry != NULL) {
+        telemetrybatch_t* next = telemetry->next;
+        free(telemetry->buffer);
+        free(telemetry->url);
+        free(telemetry);
+        telemetry = next;
+    }
+
+    al_destroy_cond(cond);
+    al_destroy_mutex(mutex);
+    cond = NULL;
+    mutex = NULL;
+
+#if defined(WANT_HTTP)
+    curl_global_cleanup();
+#endif
+}
+
+/*
+ * web_update()
+ * Calls the callbacks of the completed requests and sends the telemetry.
+ * Call this on the main thread
+ */
+void web_update()
+{
+    httprequest_t* request;
+
+    if(worker == NULL)
+        return;
+
+    /* grab the completed requests */
+    al_lock_mutex(mutex);
+    request = completed_requests.head;
+    completed_requests.head = completed_requests.tail = NULL;
+    al_unlock_mutex(mutex);
+
+    /* call the callbacks */
+    while(request != NULL) {
+        httprequest_t* next = request->next;
+        complete_request(request);
+        destroy_request(request);
+        request = next;
+    }
+
+    /* send the telemetry */
+    if(telemetry != NULL) {
+        double now = al_get_time();
+        for(telemetrybatch_t* batch = telemetry; batch != NULL; batch = batch->next) {
+            if(batch->count > 0 && now - batch->start_time >= TELEMETRY_MAX_DELAY)
+                send_telemetry(batch);
+        }
+    }
+}
+
+/*
+ * web_is_http_available()
+ * Can we make HTTP requests in this build?
+ */
+bool web_is_http_available()
+{
+#if defined(WANT_HTTP)
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*
+ * http_get()
+ * Makes an asynchronous GET request. The optional callback will be called
+ * on the main thread when the request is complete. Returns false if the
+ * request can't be made (e.g., invalid URL), in which case the callback
+ * is not called
+ */
+bool http_get(const char* url, httpcallback_t callback, void* context)
+{
+    return enqueue_request(url, NULL, NULL, callback, context);
+}
+
+/*
+ * http_post()
+ * Makes an asynchronous POST request. The optional callback will be called
+ * on the main thread when the request is complete. Returns false if the
+ * request can't be made (e.g., invalid URL), in which case the callback
+ * is not called
+ */
+bool http_post(const char* url, const char* body, const char* content_type, httpcallback_t callback, void* context)
+{
+    return enqueue_request(url, body != NULL ? body : "", content_type, callback, context);
+}
+
+/*
+ * http_send_telemetry()
+ * Sends a telemetry event, given as a JSON value, to a URL. Events sent to
+ * the same URL are batched and POSTed together as a JSON array
+ */
+void http_send_telemetry(const char* url, const char* event)
+{
+    telemetrybatch_t* batch;
+
+    if(!is_http_url(url)) {
+        logfile_message("Can't send telemetry to \"%s\": invalid URL", url);
+        return;
+    }
+
+    /* find the batch of the URL */
+    for(batch = telemetry; batch != NULL; batch = batch->next) {
+        if(strcmp(batch->url, url) == 0)
+            break;
+    }
+
+    if(batch == NULL) {
+        batch = mallocx(sizeof *batch);
+        batch->url = str_dup(url);
+        batch->capacity = 256;
+        batch->buffer = mallocx(batch->capacity);
+        batch->length = 0;
+        batch->count = 0;
+        batch->start_time = 0.0;
+        batch->next = telemetry;
+        telemetry = batch;
+    }
+
+    /* add the event to the batch */
+    if(batch->count++ == 0) {
+        batch->start_time = al_get_time();
+        append_telemetry(batch, "[", 1);
+    }
+    else
+        append_telemetry(batch, ",", 1);
+
+    append_telemetry(batch, event, strlen(event));
+
+    /* is the batch full? */
+    if(batch->count >= TELEMETRY_MAX_EVENTS)
+        send_telemetry(batch);
+}
+
+
+
+
+
 /* private methods */
 
 /* converts to hex */
@@ -260,3 +516,251 @@ void open_web_page(const char* safe_url)
 }
 
 #endif
+
+/* enqueues a HTTP request to be performed by the worker */
+bool enqueue_request(const char* url, const char* body, const char* content_type, httpcallback_t callback, void* context)
+{
+    if(!is_http_url(url)) {
+        logfile_message("Can't request \"%s\": invalid URL", url);
+        return false;
+    }
+
+    if(worker == NULL) {
+        logfile_message("Can't request \"%s\": the HTTP client is not initialized", url);
+        return false;
+    }
+
+    httprequest_t* request = mallocx(sizeof *request);
+    request->url = encode_uri(url);
+    request->body = body != NULL ? str_dup(body) : NULL;
+    request->content_type = content_type != NULL ? str_dup(content_type) : NULL;
+    request->callback = callback;
+    request->context = context;
+    request->status = 0;
+    request->response = NULL;
+    request->response_size = 0;
+    request->next = NULL;
+
+    al_lock_mutex(mutex);
+    queue_push(&pending_requests, request);
+    al_signal_cond(cond);
+    al_unlock_mutex(mutex);
+
+    return true;
+}
+
+/* the worker thread performs the requests one at a time */
+void* worker_thread(ALLEGRO_THREAD* thread, void* arg)
+{
+    for(;;) {
+        httprequest_t* request;
+
+        /* wait for a request */
+        al_lock_mutex(mutex);
+        while(pending_requests.head == NULL && !wants_to_quit)
+            al_wait_cond(cond, mutex);
+
+        if(wants_to_quit) {
+            al_unlock_mutex(mutex);
+            break;
+        }
+
+        request = queue_pop(&pending_requests);
+        al_unlock_mutex(mutex);
+
+        /* perform the request without holding the lock */
+        perform_request(request);
+
+        /* we're done */
+        al_lock_mutex(mutex);
+        queue_push(&completed_requests, request);
+        al_unlock_mutex(mutex);
+    }
+
+    return NULL;
+}
+
+#if defined(WANT_HTTP)
+
+/* accumulates the response body */
+static size_t write_response(char* data, size_t size, size_t nmemb, void* userdata)
+{
+    httprequest_t* request = (httprequest_t*)userdata;
+    size_t length = size * nmemb;
+
+    if(request->response_size + length > HTTP_MAX_RESPONSE_SIZE)
+        return 0; /* abort the transfer */
+
+    request->response = reallocx(request->response, request->response_size + length + 1);
+    memcpy(request->response + request->response_size, data, length);
+    request->response_size += length;
+    request->response[request->response_size] = '\0';
+
+    return length;
+}
+
+/* performs a request on the worker thread */
+void perform_request(httprequest_t* request)
+{
+    char error[CURL_ERROR_SIZE] = "";
+    struct curl_slist* headers = NULL;
+    CURL* curl = curl_easy_init();
+    CURLcode result;
+
+    if(curl == NULL) {
+        request->response = str_dup("Can't initialize the HTTP request");
+        request->response_size = strlen(request->response);
+        return;
+    }
+
+    curl_easy_setopt(curl, CURLOPT_URL, request->url);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L); /* we're not on the main thread */
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)HTTP_TIMEOUT);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 5L);
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_response);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, request);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, GAME_TITLE " " GAME_VERSION_STRING);
+
+    if(request->body != NULL) {
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request->body);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)strlen(request->body));
+
+        if(request->content_type != NULL) {
+            char header[256];
+            snprintf(header, sizeof(header), "Content-Type: %s", request->content_type);
+            headers = curl_slist_append(headers, header);
+            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        }
+    }
+
+    result = curl_easy_perform(curl);
+    if(result == CURLE_OK) {
+        long status = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+        request->status = (int)status;
+    }
+    else {
+        free(request->response);
+        request->response = str_dup(*error ? error : curl_easy_strerror(result));
+        request->response_size = strlen(request->response);
+        request->status = 0;
+    }
+
+    curl_slist_free_all(headers);
+    curl_easy_cleanup(curl);
+}
+
+#else
+
+/* performs a request on the worker thread */
+void perform_request(httprequest_t* request)
+{
+    request->response = str_dup("HTTP requests are not supported in this build");
+    request->response_size = strlen(request->response);
+    request->status = 0;
+}
+
+#endif
+
+/* calls the callback of a completed request, on the main thread */
+void complete_request(httprequest_t* request)
+{
+    httpresponse_t response = {
+        .status = request->status,
+        .body = request->response != NULL ? request->response : "",
+        .body_size = request->response_size
+    };
+
+    if(request->status == 0)
+        logfile_message("HTTP request to \"%s\" failed: %s", request->url, response.body);
+
+    if(request->callback != NULL)
+        request->callback(&response, request->context);
+}
+
+/* cancels all requests of a queue, letting the callbacks release their contexts */
+void cancel_requests(httpqueue_t* queue)
+{
+    httprequest_t* request;
+    httpresponse_t canceled = { .status = HTTP_CANCELED, .body = "", .body_size = 0 };
+
+    while((request = queue_pop(queue)) != NULL) {
+        if(request->callback != NULL)
+            request->callback(&canceled, request->context);
+
+        destroy_request(request);
+    }
+}
+
+/* destroys a request */
+httprequest_t* destroy_request(httprequest_t* request)
+{
+    free(request->response);
+    free(request->content_type);
+    free(request->body);
+    free(request->url);
+    free(request);
+    return NULL;
+}
+
+/* adds a request to the end of a queue */
+void queue_push(httpqueue_t* queue, httprequest_t* request)
+{
+    request->next = NULL;
+
+    if(queue->tail != NULL)
+        queue->tail->next = request;
+    else
+        queue->head = request;
+
+    queue->tail = request;
+}
+
+/* removes a request from the beginning of a queue. Returns NULL if the queue is empty */
+httprequest_t* queue_pop(httpqueue_t* queue)
+{
+    httprequest_t* request = queue->head;
+
+    if(request != NULL) {
+        queue->head = request->next;
+        if(queue->head == NULL)
+            queue->tail = NULL;
+
+        request->next = NULL;
+    }
+
+    return request;
+}
+
+/* we only accept http:// and https:// URLs */
+bool is_http_url(const char* url)
+{
+    return strncmp(url, "http://", 7) == 0 || strncmp(url, "https://", 8) == 0;
+}
+
+/* sends a batch of telemetry events and clears it */
+void send_telemetry(telemetrybatch_t* batch)
+{
+    append_telemetry(batch, "]", 1);
+    http_post(batch->url, batch->buffer, "application/json", NULL, NULL);
+
+    batch->length = 0;
+    batch->count = 0;
+}
+
+/* appends a string to the buffer of a batch of telemetry events */
+void append_telemetry(telemetrybatch_t* batch, const char* str, size_t length)
+{
+    if(batch->length + length + 1 > batch->capacity) {
+        while(batch->length + length + 1 > batch->capacity)
+            batch->capacity *= 2;
+
+        batch->buffer = reallocx(batch->buffer, batch->capacity);
+    }
+
+    memcpy(batch->buffer + batch->length, str, length);
+    batch->length += length;
+    batch->buffer[batch->length] = '\0';
+}
@@ -22,8 +22,29 @@
 #define _WEB_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 bool launch_url(const char *url); /* launch URL; returns true on success */
 char* encode_uri_component(const char* uri, char* dest, size_t dest_size); /* returns dest */
 
+/* asynchronous HTTP client: requests are performed on a worker thread and
+   their callbacks are called on the main thread, in web_update() */
+typedef struct httpresponse_t httpresponse_t;
+struct httpresponse_t {
+    int status; /* HTTP status code; 0 on failure; HTTP_CANCELED if the request has been canceled */
+    const char* body; /* response body (NUL-terminated); an error message on failure */
+    size_t body_size; /* size of the body in bytes */
+};
+
+typedef void (*httpcallback_t)(const httpresponse_t* response, void* context);
+#define HTTP_CANCELED (-1) /* callbacks must release their context, but not do anything else */
+
+void web_init();
+void web_release(); /* pending requests are canceled; unsent telemetry is discarded */
+void web_update(); /* call the callbacks of the completed requests and send the telemetry */
+bool web_is_http_available(); /* can we make HTTP requests in this build? */
+bool http_get(const char* url, httpcallback_t callback, void* context); /* returns false if the request can't be made */
+bool http_post(const char* url, const char* body, const char* content_type, httpcallback_t callback, void* context);
+void http_send_telemetry(const char* url, const char* event); /* event is a JSON value; events are batched per URL */
+
 #endif
@@ -25,6 +25,7 @@
 #include "../util/numeric.h"
 #include "../util/util.h"
 #include "../util/transform.h"
+#include "../util/darray.h"
 #include "../core/global.h"
 #include "../core/input.h"
 #include "../core/logfile.h"
@@ -35,6 +36,9 @@
 
 /* private stuff */
 static void update_animation(actor_t *act);
+static void add_to_batch(actor_t *act);
+static void remove_from_batch(actor_t *act);
+STATIC_DARRAY(actor_t*, batch); /* actors whose animations will be advanced at the end of the frame */
 static bool can_be_clipped_out(const actor_t* act, v2d_t topleft);
 static void actor_transform(ALLEGRO_TRANSFORM* transform, const actor_t* act, v2d_t topleft);
 
@@ -57,6 +61,7 @@ actor_t* actor_create()
     act->animation_timer = 0.0;
     act->animation_speed_factor = 1.0f;
     act->synchronized_animation = false;
+    act->batch_index = -1;
 
     act->hot_spot = v2d_new(0, 0);
     act->mirror = IF_NONE;
@@ -75,6 +80,8 @@ actor_t* actor_create()
  */
 void actor_destroy(actor_t *act)
 {
+    remove_from_batch(act);
+
     if(act->input != NULL)
         input_destroy(act->input);
 
@@ -82,6 +89,46 @@ void actor_destroy(actor_t *act)
 }
 
 
+/*
+ * actor_init_animation_batch()
+ * Initializes the batch of animations
+ */
+void actor_init_animation_batch()
+{
+    darray_init(batch);
+}
+
+
+/*
+ * actor_release_animation_batch()
+ * Releases the batch of animations
+ */
+void actor_release_animation_batch()
+{
+    for(int i = 0; i < darray_length(batch); i++)
+        batch[i]->batch_index = -1;
+
+    darray_release(batch);
+}
+
+
+/*
+ * actor_advance_animations()
+ * Advances, in a single loop, the animations of all actors rendered in this
+ * frame. Call once per frame, after rendering. An actor rendered multiple
+ * times in a frame is advanced only once
+ */
+void actor_advance_animations()
+{
+    for(int i = 0; i < darray_length(batch); i++) {
+        batch[i]->batch_index = -1;
+        update_animation(batch[i]);
+    }
+
+    darray_clear(batch);
+}
+
+
 /*
  * actor_render()
  * Default rendering function
@@ -126,7 +173,7 @@ void actor_render(actor_t *act, v2d_t camera_position)
         }
 
         /* update animation timer (next frame) */
-        update_animation(act);
+        add_to_batch(act);
     }
 }
 
@@ -365,6 +412,32 @@ void update_animation(actor_t *act)
         act->animation_timer += timer_get_delta() * act->animation_speed_factor;
 }
 
+/* schedules the advancement of the animation of an actor */
+void add_to_batch(actor_t *act)
+{
+    if(act->batch_index >= 0)
+        return;
+
+    act->batch_index = darray_length(batch);
+    darray_push(batch, act);
+}
+
+/* cancels the advancement of the animation of an actor */
+void remove_from_batch(actor_t *act)
+{
+    int index = act->batch_index;
+    if(index < 0)
+        return;
+
+    /* swap with the last element */
+    int last = darray_length(batch) - 1;
+    batch[index] = batch[last];
+    batch[index]->batch_index = index;
+    darray_truncate(batch, last);
+
+    act->batch_index = -1;
+}
+
 /* Checks if the actor can be clipped out (rendering) */
 bool can_be_clipped_out(const actor_t* act, v2d_t topleft)
 {
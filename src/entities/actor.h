@@ -48,6 +48,7 @@ typedef struct actor_t {
     double animation_timer; /* given in seconds */
     float animation_speed_factor; /* default value: 1.0 */
     bool synchronized_animation; /* synchronized animation? */
+    int batch_index; /* index in the batch of animations to be advanced; -1 if none */
 
     /* transformations */
     bool visible; /* is this actor visible? */
@@ -64,6 +65,11 @@ typedef struct actor_t {
 actor_t* actor_create();
 void actor_destroy(actor_t *act);
 
+/* batched animation */
+void actor_init_animation_batch();
+void actor_release_animation_batch();
+void actor_advance_animations(); /* advances the animations of the actors rendered in this frame */
+
 /* rendering */
 const image_t* actor_image(const actor_t *act);
 void actor_render(actor_t *act, v2d_t camera_position);
@@ -24,6 +24,7 @@
 #include "background.h"
 #include "actor.h"
 #include "../core/sprite.h"
+#include "../core/image.h"
 #include "../core/video.h"
 #include "../core/asset.h"
 #include "../core/logfile.h"
@@ -55,6 +56,8 @@ struct bgtheme_t {
     int foreground_count; /* number of foreground layers */
     char* filepath; /* filepath of the background */
     double animation_time; /* animation time, in seconds */
+    parsetree_program_t* tree; /* parse tree of the .bg file, kept while there are layers to be loaded */
+    int pending_count; /* number of layers that haven't been loaded yet */
 #if WANT_FAST_DRAW
     int draw_count; /* number of draws */
 #endif
@@ -62,8 +65,10 @@ struct bgtheme_t {
 
 /* bglayer struct: a background (or foreground) layer */
 struct bglayer_t {
-    spriteinfo_t *data; /* this is not stored in the main hash */
-    const animation_t* animation; /* animation 0 of the sprite of the layer */
+    spriteinfo_t *data; /* this is not stored in the main hash; NULL until the layer is loaded */
+    const animation_t* animation; /* animation 0 of the sprite of the layer; NULL until the layer is loaded */
+    const parsetree_program_t* sprite_block; /* sprite declaration of a layer that hasn't been loaded yet */
+    v2d_t declared_frame_size; /* frame size declared in the sprite block, used until the layer is loaded */
 
     v2d_t initial_position; /* initial position */
     v2d_t scroll_speed; /* scroll speed */
@@ -72,9 +77,11 @@ struct bglayer_t {
 
     bgbehavior_t *behavior; /* behavior */
     int group_index; /* for deferred drawing */
+    image_t* cache; /* pre-rendered tiles of a static layer (may be NULL) */
 };
 static bglayer_t *bglayer_new(); /* constructor */
 static bglayer_t *bglayer_delete(bglayer_t *layer); /* destructor */
+static void bglayer_load(bgtheme_t *bgtheme, bglayer_t *layer); /* creates the sprite of the layer */
 
 
 
@@ -135,15 +142,30 @@ static void group_layers(bgtheme_t *bgtheme);
 /* rendering */
 typedef void (*renderstrategy_t)(const image_t*,v2d_t,void*);
 static void render_layers(bglayer_t* const *layers, int layer_count, v2d_t camera_position, double animation_time, void* data, renderstrategy_t render_image);
+static void load_nearby_layers(bgtheme_t *bgtheme, int first, int layer_count, v2d_t camera_position);
+static v2d_t layer_position(const bglayer_t* layer, v2d_t topleft, v2d_t frame_size);
+static v2d_t layer_frame_size(const bglayer_t* layer);
 static void render_without_cache(const image_t* image, v2d_t position, void* data);
 static void render_with_cache(const image_t* image, v2d_t position, void* data);
 
+/* layer cache */
+static bool want_layer_cache();
+static bool is_cacheable_layer(const bglayer_t* layer);
+static void layer_grid(const bglayer_t* layer, v2d_t screen_size, int* rows, int* cols);
+static void update_layer_cache(bglayer_t* layer);
+static void release_layer_cache(bglayer_t* layer);
+
 /* .bg files */
 static int traverse(const parsetree_statement_t *stmt, void *bgtheme);
 static int traverse_layer_attributes(const parsetree_statement_t *stmt, void *bglayer);
+static int traverse_declared_frame_size(const parsetree_statement_t *stmt, void *rect);
+static int traverse_prefetch(const parsetree_statement_t *stmt);
 static void validate_layer(const bglayer_t* layer);
 static void validate_theme(const bgtheme_t* theme);
 
+/* prefetching */
+static char* prefetched_filepath = NULL; /* the theme whose images are being decoded in advance, if any */
+
 
 
 
@@ -170,20 +192,24 @@ bgtheme_t* background_load(const char *filepath)
     bgtheme->background_count = 0;
     bgtheme->foreground_count = 0;
     bgtheme->animation_time = 0.0;
+    bgtheme->tree = NULL;
+    bgtheme->pending_count = 0;
 #if WANT_FAST_DRAW
     bgtheme->draw_count = 1;
 #endif
 
-    /* read the .bg file */
+    /* read the .bg file. The sprites of the layers are created
+       when the layers first come close to the screen, so we keep
+       the parse tree until then */
     tree = nanoparser_construct_tree(fullpath);
     nanoparser_traverse_program_ex(tree, (void*)bgtheme, traverse);
-    tree = nanoparser_deconstruct_tree(tree);
+    bgtheme->tree = tree;
+    bgtheme->pending_count = bgtheme->layer_count;
     validate_theme(bgtheme);
 
     /* prepare for rendering */
     sort_layers(bgtheme);
     split_layers(bgtheme);
-    group_layers(bgtheme);
 
     /* done! */
     return bgtheme;
@@ -204,6 +230,13 @@ bgtheme_t* background_unload(bgtheme_t *bgtheme)
         free(bgtheme->layer);
     }
 
+    if(bgtheme->tree != NULL)
+        bgtheme->tree = nanoparser_deconstruct_tree(bgtheme->tree);
+
+    /* the prefetched images of this theme have been used */
+    if(prefetched_filepath != NULL && str_icmp(prefetched_filepath, bgtheme->filepath) == 0)
+        background_cancel_prefetch();
+
     free(bgtheme->filepath);
     free(bgtheme);
     return NULL;
@@ -221,6 +254,18 @@ void background_update(bgtheme_t *bgtheme)
         bgbehavior_update(layer->behavior);
     }
 
+    /* update the cache of the background layers */
+    if(want_layer_cache()) {
+        for(int i = 0; i < bgtheme->background_count; i++) {
+            if(bgtheme->layer[i]->animation != NULL)
+                update_layer_cache(bgtheme->layer[i]);
+        }
+    }
+    else {
+        for(int i = 0; i < bgtheme->background_count; i++)
+            release_layer_cache(bgtheme->layer[i]);
+    }
+
     /* update animation time */
     bgtheme->animation_time += timer_get_delta();
 }
@@ -235,6 +280,10 @@ void background_render_bg(bgtheme_t *bgtheme, v2d_t camera_position)
     int layer_count = bgtheme->background_count;
     double animation_time = bgtheme->animation_time;
 
+    /* load the layers that come close to the screen */
+    if(bgtheme->pending_count > 0)
+        load_nearby_layers(bgtheme, 0, layer_count, camera_position);
+
 #if WANT_FAST_DRAW
     FAST_DRAW_CACHE* cache = fd_create_cache(bgtheme->draw_count, true, false);
     int draw_count = 0;
@@ -276,6 +325,10 @@ void background_render_fg(bgtheme_t *bgtheme, v2d_t camera_position)
     int layer_count = bgtheme->foreground_count;
     double animation_time = bgtheme->animation_time;
 
+    /* load the layers that come close to the screen */
+    if(bgtheme->pending_count > 0)
+        load_nearby_layers(bgtheme, bgtheme->background_count, layer_count, camera_position);
+
     /* foregrounds typically have few layers */
     image_hold_drawing(true);
     render_layers(layers, layer_count, camera_position, animation_time, NULL, render_without_cache);
@@ -309,6 +362,61 @@ int background_number_of_fg_layers(const bgtheme_t* bgtheme)
     return bgtheme->foreground_count;
 }
 
+/*
+ * background_prefetch()
+ * Decodes the images of a background theme in background threads, so
+ * that changing to that theme later on doesn't stall the game. Only one
+ * theme is prefetched at a time
+ */
+void background_prefetch(const char *filepath)
+{
+    /* already prefetching this theme? */
+    if(prefetched_filepath != NULL && str_icmp(prefetched_filepath, filepath) == 0)
+        return;
+    else if(!asset_exists(filepath))
+        return;
+
+    /* start over */
+    background_cancel_prefetch();
+    logfile_message("Prefetching background \"%s\"...", filepath);
+    prefetched_filepath = str_dup(filepath);
+    image_begin_prefetch();
+    background_prefetch_images(filepath);
+}
+
+/*
+ * background_prefetch_images()
+ * Schedules the spritesheets of the layers of a background theme to be
+ * decoded in background threads. Call it between image_begin_prefetch()
+ * and image_end_prefetch()
+ */
+void background_prefetch_images(const char *filepath)
+{
+    parsetree_program_t *tree;
+
+    if(!asset_exists(filepath))
+        return;
+
+    tree = nanoparser_construct_tree(asset_path(filepath));
+    nanoparser_traverse_program(tree, traverse_prefetch);
+    tree = nanoparser_deconstruct_tree(tree);
+}
+
+/*
+ * background_cancel_prefetch()
+ * Stops prefetching a background theme, discarding
+ * the prefetched images that haven't been used
+ */
+void background_cancel_prefetch()
+{
+    if(prefetched_filepath == NULL)
+        return;
+
+    image_end_prefetch();
+    free(prefetched_filepath);
+    prefetched_filepath = NULL;
+}
+
 
 
 /* private methods */
@@ -322,6 +430,8 @@ bglayer_t *bglayer_new()
 
     layer->data = NULL;
     layer->animation = NULL;
+    layer->sprite_block = NULL;
+    layer->declared_frame_size = v2d_new(1.0f, 1.0f);
     layer->initial_position = v2d_new(0.0f, 0.0f);
     layer->scroll_speed = v2d_new(0.0f, 0.0f);
     layer->repeat_x = false;
@@ -329,6 +439,7 @@ bglayer_t *bglayer_new()
     layer->zindex = 0.0f;
     layer->behavior = bgbehavior_default_new(layer);
     layer->group_index = 0;
+    layer->cache = NULL;
 
     return layer;
 }
@@ -340,11 +451,27 @@ bglayer_t *bglayer_delete(bglayer_t *layer)
         spriteinfo_destroy(layer->data);
 
     layer->behavior = bgbehavior_delete(layer->behavior);
+    release_layer_cache(layer);
 
     free(layer);
     return NULL;
 }
 
+/* create the sprite of a layer that hasn't been loaded yet */
+void bglayer_load(bgtheme_t *bgtheme, bglayer_t *layer)
+{
+    layer->data = spriteinfo_create(layer->sprite_block);
+    layer->animation = spriteinfo_get_animation(layer->data, 0);
+    layer->sprite_block = NULL;
+    validate_layer(layer);
+
+    /* all layers have been loaded */
+    if(--(bgtheme->pending_count) == 0) {
+        bgtheme->tree = nanoparser_deconstruct_tree(bgtheme->tree);
+        group_layers(bgtheme);
+    }
+}
+
 
 
 
@@ -485,25 +612,24 @@ void render_layers(bglayer_t* const *layers, int layer_count, v2d_t camera_posit
     for(int i = 0; i < layer_count; i++) {
         const bglayer_t* layer = layers[i];
         const animation_t* animation = layer->animation;
-        float frame_width = animation_frame_width(animation);
-        float frame_height = animation_frame_height(animation);
+
+        /* the layer hasn't been loaded yet */
+        if(animation == NULL)
+            continue;
 
         /* compute the position the layer in screen space */
-        v2d_t scroll = v2d_compmult(layer->scroll_speed, topleft);
-        v2d_t offset = v2d_add(layer->behavior->offset, scroll);
-        v2d_t position = v2d_add(layer->initial_position, offset);
-        position.x = floorf(0.5 + position.x); /* round to nearest integer */
-        position.y = floorf(0.5 + position.y);
+        float frame_width = animation_frame_width(animation);
+        float frame_height = animation_frame_height(animation);
+        v2d_t position = layer_position(layer, topleft, v2d_new(frame_width, frame_height));
 
         /* tiled rendering? */
-        int rows = 1, cols = 1;
-        if(layer->repeat_x) {
-            position.x = fmodf(position.x, frame_width) - frame_width;
-            cols = 3 + (int)(screen_size.x / frame_width);
-        }
-        if(layer->repeat_y) {
-            position.y = fmodf(position.y, frame_height) - frame_height;
-            rows = 3 + (int)(screen_size.y / frame_height);
+        int rows, cols;
+        layer_grid(layer, screen_size, &rows, &cols);
+
+        /* render the pre-rendered tiles in one go */
+        if(layer->cache != NULL) {
+            render_image(layer->cache, position, data);
+            continue;
         }
 
         /* render */
@@ -520,6 +646,57 @@ void render_layers(bglayer_t* const *layers, int layer_count, v2d_t camera_posit
     }
 }
 
+/* load the layers that are on the screen or close to it */
+void load_nearby_layers(bgtheme_t *bgtheme, int first, int layer_count, v2d_t camera_position)
+{
+    v2d_t screen_size = video_get_screen_size();
+    v2d_t topleft = v2d_subtract(camera_position, v2d_multiply(screen_size, 0.5f));
+    rect_t nearby_rect = rect_new(-screen_size.x, -screen_size.y, 3 * screen_size.x, 3 * screen_size.y); /* a margin of one screen */
+
+    for(int i = first; i < first + layer_count; i++) {
+        bglayer_t* layer = bgtheme->layer[i];
+        if(layer->animation != NULL)
+            continue;
+
+        /* the declared frame size is an estimate of the actual one */
+        int rows, cols;
+        v2d_t frame_size = layer_frame_size(layer);
+        v2d_t position = layer_position(layer, topleft, frame_size);
+        layer_grid(layer, screen_size, &rows, &cols);
+
+        rect_t layer_rect = rect_new(position.x, position.y, cols * frame_size.x, rows * frame_size.y);
+        if(rect_overlaps(layer_rect, nearby_rect))
+            bglayer_load(bgtheme, layer);
+    }
+}
+
+/* the position of the top-left corner of a layer in screen space */
+v2d_t layer_position(const bglayer_t* layer, v2d_t topleft, v2d_t frame_size)
+{
+    v2d_t scroll = v2d_compmult(layer->scroll_speed, topleft);
+    v2d_t offset = v2d_add(layer->behavior->offset, scroll);
+    v2d_t position = v2d_add(layer->initial_position, offset);
+    position.x = floorf(0.5 + position.x); /* round to nearest integer */
+    position.y = floorf(0.5 + position.y);
+
+    /* tiled rendering? */
+    if(layer->repeat_x)
+        position.x = fmodf(position.x, frame_size.x) - frame_size.x;
+    if(layer->repeat_y)
+        position.y = fmodf(position.y, frame_size.y) - frame_size.y;
+
+    return position;
+}
+
+/* the frame size of a layer, which is estimated if the layer hasn't been loaded yet */
+v2d_t layer_frame_size(const bglayer_t* layer)
+{
+    if(layer->animation == NULL)
+        return layer->declared_frame_size;
+
+    return v2d_new(animation_frame_width(layer->animation), animation_frame_height(layer->animation));
+}
+
 /* render an image */
 void render_without_cache(const image_t* image, v2d_t position, void* data)
 {
@@ -535,12 +712,116 @@ void render_with_cache(const image_t* image, v2d_t position, void* data)
 
     fd_draw_bitmap(cache, IMAGE2BITMAP(image), position.x, position.y);
     ++(*draw_count);
+
+    /* FastDraw bypasses the image module */
+    if(video_is_tracking_drawing()) {
+        video_track_drawing(&image, sizeof(image));
+        video_track_drawing(&position, sizeof(position));
+    }
 #endif
 }
 
 
 
 
+/* layer cache */
+
+/*
+ * Tiled layers may be rendered with lots of small quads. If a layer isn't
+ * animated, we pre-render its tiles into a texture that covers the screen
+ * plus a margin of one tile in each repeating direction. Since tiling is
+ * periodic, the cache never needs to be re-rendered when the camera moves:
+ * we just shift it, as we did with the individual tiles. We rebuild it if
+ * the size of the screen changes.
+ *
+ * This trades batching (each cached layer has its own texture) for less
+ * vertex processing and is meant for low-end devices.
+ */
+
+/* should we cache the layers? */
+bool want_layer_cache()
+{
+    return video_get_quality() == VIDEOQUALITY_LOW;
+}
+
+/* checks if a layer can be cached */
+bool is_cacheable_layer(const bglayer_t* layer)
+{
+    const int max_size = 2048; /* a safe texture size */
+    v2d_t screen_size = video_get_screen_size();
+    int rows, cols;
+
+    /* not a tiled layer */
+    if(!layer->repeat_x && !layer->repeat_y)
+        return false;
+
+    /* animated layer */
+    if(animation_frame_count(layer->animation) > 1)
+        return false;
+
+    /* the cache would be too large */
+    layer_grid(layer, screen_size, &rows, &cols);
+    return cols * animation_frame_width(layer->animation) <= max_size &&
+           rows * animation_frame_height(layer->animation) <= max_size;
+}
+
+/* the number of rows and columns of tiles needed to cover the screen */
+void layer_grid(const bglayer_t* layer, v2d_t screen_size, int* rows, int* cols)
+{
+    v2d_t frame_size = layer_frame_size(layer);
+
+    *cols = layer->repeat_x ? 3 + (int)(screen_size.x / frame_size.x) : 1;
+    *rows = layer->repeat_y ? 3 + (int)(screen_size.y / frame_size.y) : 1;
+}
+
+/* create or update the cache of a layer, if applicable */
+void update_layer_cache(bglayer_t* layer)
+{
+    v2d_t screen_size = video_get_screen_size();
+    int frame_width = animation_frame_width(layer->animation);
+    int frame_height = animation_frame_height(layer->animation);
+    int rows, cols;
+
+    /* is the cache up-to-date? */
+    layer_grid(layer, screen_size, &rows, &cols);
+    if(layer->cache != NULL) {
+        if(image_width(layer->cache) == cols * frame_width && image_height(layer->cache) == rows * frame_height)
+            return;
+
+        release_layer_cache(layer);
+    }
+
+    /* can we cache this layer? */
+    if(!is_cacheable_layer(layer))
+        return;
+
+    /* pre-render the tiles */
+    const image_t* image = animation_image(layer->animation, 0);
+    image_t* target = image_drawing_target();
+
+    layer->cache = image_create(cols * frame_width, rows * frame_height);
+    image_set_drawing_target(layer->cache);
+    image_clear(color_rgba(0, 0, 0, 0));
+    image_hold_drawing(true);
+    for(int y = 0; y < rows; y++) {
+        for(int x = 0; x < cols; x++)
+            image_draw(image, x * frame_width, y * frame_height, IF_NONE);
+    }
+    image_hold_drawing(false);
+    image_set_drawing_target(target);
+}
+
+/* release the cache of a layer */
+void release_layer_cache(bglayer_t* layer)
+{
+    if(layer->cache != NULL) {
+        image_destroy(layer->cache);
+        layer->cache = NULL;
+    }
+}
+
+
+
 
 /* preprocessing */
 
@@ -758,10 +1039,11 @@ int traverse_layer_attributes(const parsetree_statement_t *stmt, void *bglayer)
         p1 = nanoparser_get_nth_parameter(param_list, 1);
         nanoparser_expect_program(p1, "Can't read background attributes: sprite block expected");
 
-        if(layer->data != NULL)
-            spriteinfo_destroy(layer->data);
-        layer->data = spriteinfo_create(nanoparser_get_program(p1));
-        layer->animation = spriteinfo_get_animation(layer->data, 0);
+        /* the sprite is created when the layer is loaded */
+        rect_t declared = rect_new(0, 0, 1, 1); /* frame size (w, h) and source_rect size (x, y) */
+        layer->sprite_block = nanoparser_get_program(p1);
+        nanoparser_traverse_program_ex(layer->sprite_block, &declared, traverse_declared_frame_size);
+        layer->declared_frame_size = v2d_new(min(declared.width, declared.x), min(declared.height, declared.y));
     }
     else
         fatal_error("Can't read background attributes. Unknown identifier: '%s'", identifier);
@@ -769,10 +1051,52 @@ int traverse_layer_attributes(const parsetree_statement_t *stmt, void *bglayer)
     return 0;
 }
 
+/* read the frame size declared in the sprite block of a layer, as in sprite.c */
+int traverse_declared_frame_size(const parsetree_statement_t *stmt, void *rect)
+{
+    const char *identifier = nanoparser_get_identifier(stmt);
+    const parsetree_parameter_t *param_list = nanoparser_get_parameter_list(stmt);
+    rect_t *declared = (rect_t*)rect;
+
+    if(str_icmp(identifier, "frame_size") == 0) {
+        const parsetree_parameter_t *p1 = nanoparser_get_nth_parameter(param_list, 1);
+        const parsetree_parameter_t *p2 = nanoparser_get_nth_parameter(param_list, 2);
+
+        declared->width = max(1, atoi(nanoparser_get_string(p1)));
+        declared->height = max(1, atoi(nanoparser_get_string(p2)));
+    }
+    else if(str_icmp(identifier, "source_rect") == 0) {
+        const parsetree_parameter_t *p3 = nanoparser_get_nth_parameter(param_list, 3);
+        const parsetree_parameter_t *p4 = nanoparser_get_nth_parameter(param_list, 4);
+
+        declared->x = max(1, atoi(nanoparser_get_string(p3)));
+        declared->y = max(1, atoi(nanoparser_get_string(p4)));
+    }
+
+    return 0;
+}
+
+/* schedule the spritesheets of a .bg file to be decoded in background threads */
+int traverse_prefetch(const parsetree_statement_t *stmt)
+{
+    const char *identifier = nanoparser_get_identifier(stmt);
+    const parsetree_parameter_t *param_list = nanoparser_get_parameter_list(stmt);
+    const parsetree_program_t *block = nanoparser_get_program(nanoparser_get_nth_parameter(param_list, 1));
+
+    if(block == NULL)
+        return 0;
+    else if(str_icmp(identifier, "background") == 0)
+        nanoparser_traverse_program(block, traverse_prefetch); /* layer attributes */
+    else if(str_icmp(identifier, "sprite") == 0)
+        spriteinfo_prefetch(block);
+
+    return 0;
+}
+
 /* validate a layer */
 void validate_layer(const bglayer_t *layer)
 {
-    if(layer->data == NULL || layer->animation == NULL)
+    if(layer->sprite_block == NULL && (layer->data == NULL || layer->animation == NULL))
         fatal_error("Can't read background layer: no sprite data given");
 }
 
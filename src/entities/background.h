@@ -36,4 +36,8 @@ const char* background_filepath(const bgtheme_t *bgtheme); /* get the filepath o
 int background_number_of_bg_layers(const bgtheme_t* bgtheme); /* number of background layers */
 int background_number_of_fg_layers(const bgtheme_t* bgtheme); /* number of foreground layers */
 
+void background_prefetch(const char *filepath); /* decodes the images of a theme in advance, so that loading it later is faster */
+void background_cancel_prefetch(); /* discards the images that have been prefetched and haven't been used */
+void background_prefetch_images(const char *filepath); /* schedules the images of a theme to be decoded; see image_begin_prefetch() */
+
 #endif
\ No newline at end of file
@@ -20,6 +20,7 @@
 
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
 #include "brick.h"
 #include "player.h"
 #include "actor.h"
@@ -39,10 +40,12 @@
 #include "../util/numeric.h"
 #include "../util/util.h"
 #include "../util/stringutil.h"
+#include "../util/snapshot.h"
 #include "../physics/collisionmask.h"
 #include "../physics/obstacle.h"
 #include "../physics/physicsactor.h"
 #include "../scenes/level.h"
+#include "../scripting/scripting.h"
 
 /* constants */
 #define BRKDATA_MAX             16384 /* up to BRKDATA_MAX bricks per theme are supported */
@@ -52,6 +55,7 @@
 /* types */
 typedef enum brickstate_t brickstate_t;
 typedef struct brickdata_t brickdata_t;
+typedef struct brickpath_t brickpath_t;
 typedef struct maskdetails_t maskdetails_t;
 
 /* brick state */
@@ -67,6 +71,10 @@ struct brickdata_t {
     spriteinfo_t *data; /* this is not stored in the main hash */
     const image_t *image; /* pointer to a brick image in the animation */
     int image_width, image_height; /* cached image size */
+    bool is_animated; /* does the image change over time? */
+    bool is_opaque; /* are all pixels of the image opaque? */
+    const image_t* frame; /* current frame, shared by all instances */
+    double frame_time; /* elapsed time when the current frame was computed */
     char* maskfile; /* collision mask file (may be NULL) */
     collisionmask_t *mask; /* collision mask (may be NULL) */
     image_t* maskimg; /* mask image for rendering (may be NULL) */
@@ -74,6 +82,17 @@ struct brickdata_t {
     bricktype_t type;
     brickbehavior_t behavior;
     float behavior_arg[BRICKBEHAVIOR_MAXARGS];
+    brickpath_t* path; /* movement path (may be NULL) */
+};
+
+/* movement path of a moving brick, precomputed from its behavior arguments
+   and shared by all bricks of the same kind. The position of a brick along
+   its path is periodic, so we sample one cycle of each axis and look up
+   the offset of the brick relative to its spawn point by time */
+#define BRICKPATH_SAMPLES 1024 /* samples per cycle; must be a power of two */
+struct brickpath_t {
+    float frequency[2]; /* cycles per second of each axis */
+    float offset[2][BRICKPATH_SAMPLES + 1]; /* offset of each axis along a cycle; the last sample repeats the first */
 };
 
 /* brick instances */
@@ -104,8 +123,15 @@ static void validate_brickdata(const brickdata_t *obj);
 static int traverse(const parsetree_statement_t *stmt);
 static int traverse_brick_attributes(const parsetree_statement_t *stmt, void *brickdata);
 static int traverse_collisionmask(const parsetree_statement_t *stmt, void *maskdetails);
+static int prefetch_brick(const parsetree_statement_t *stmt);
+static int prefetch_brick_attributes(const parsetree_statement_t *stmt);
 static collisionmask_t *read_collisionmask(const parsetree_program_t *block);
 static void create_collisionmasks();
+static void create_opacity_flags();
+static bool is_opaque_region(const image_t* image, int x, int y, int width, int height);
+static brickpath_t* create_path(const brickdata_t* obj);
+static void create_paths();
+static inline float sample_path(const brickpath_t* path, int axis, float t);
 static obstacle_t* create_obstacle(const brick_t* brick);
 static obstacle_t* destroy_obstacle(obstacle_t* obstacle);
 static inline int get_obstacle_flags(const brick_t* brick);
@@ -113,7 +139,8 @@ static inline obstaclelayer_t get_obstacle_layer(const brick_t* brick);
 static inline int get_image_flags(const brick_t* brick);
 static bool is_player_standing_on_platform(const player_t *player, const brick_t *brk);
 static bool can_be_clipped_out(const brick_t* brick, v2d_t topleft);
-static surgescript_object_t* create_particle(const brick_t* brick, int source_x, int source_y, int width, int height, v2d_t position, v2d_t velocity);
+static void create_particle(const brick_t* brick, int source_x, int source_y, int width, int height, v2d_t position, v2d_t velocity);
+static surgescript_object_t* find_particle_emitter(float zindex, v2d_t position);
 static int brickdata_count = 0; /* size of brickdata[] */
 static brickdata_t* brickdata[BRKDATA_MAX]; /* brick data */
 
@@ -152,9 +179,16 @@ void brickset_load(const char* filename)
     for(i=0; i<BRKDATA_MAX; i++) 
         brickdata[i] = NULL;
 
+    /* pack the images of the bricks into a texture atlas,
+       decoding them in parallel */
+    image_begin_atlas();
+    image_begin_prefetch();
     tree = nanoparser_construct_tree(fullpath);
+    nanoparser_traverse_program(tree, prefetch_brick);
     nanoparser_traverse_program(tree, traverse);
     tree = nanoparser_deconstruct_tree(tree);
+    image_end_prefetch();
+    image_end_atlas();
 
     if(brickdata_count == 0)
         fatal_error("FATAL ERROR: no bricks have been defined in \"%s\"", filename);
@@ -162,11 +196,37 @@ void brickset_load(const char* filename)
     logfile_message("Creating collision masks...");
     create_collisionmasks();
 
+    logfile_message("Creating movement paths...");
+    create_paths();
+
+    logfile_message("Checking the opacity of the bricks...");
+    create_opacity_flags();
+
     logfile_message("The brickset has been loaded.");
 }
 
 
 
+/*
+ * brickset_prefetch()
+ * Schedules the images of a brickset to be decoded in background threads,
+ * so that loading it later is faster. Call it between image_begin_prefetch()
+ * and image_end_prefetch()
+ */
+void brickset_prefetch(const char *filename)
+{
+    parsetree_program_t *tree;
+
+    if(!asset_exists(filename))
+        return;
+
+    tree = nanoparser_construct_tree(asset_path(filename));
+    nanoparser_traverse_program(tree, prefetch_brick);
+    tree = nanoparser_deconstruct_tree(tree);
+}
+
+
+
 /*
  * brickset_unload()
  * Unloads the current brickset
@@ -367,18 +427,13 @@ void brick_update(brick_t *brk, player_t** team, int team_size)
         case BRB_CIRCULAR: {
             int dx, dy, old_x, old_y;
 
-            /* get the parameters */
-            float t = (brk->value[0] = level_time()); /* elapsed time */
-            float rx = max(brk->brick_ref->behavior_arg[0], 0.0f); /* x-dist */
-            float ry = max(brk->brick_ref->behavior_arg[1], 0.0f); /* y-dist */
-            float sx = TWO_PI * brk->brick_ref->behavior_arg[2]; /* x-speed */
-            float sy = TWO_PI * brk->brick_ref->behavior_arg[3]; /* y-speed */
-            float ph = DEG2RAD * brk->brick_ref->behavior_arg[4]; /* initial phase */
+            /* get the elapsed time */
+            float t = (brk->value[0] = level_time());
 
             /* compute the position */
             old_x = brk->x; old_y = brk->y;
-            brk->x = brk->sx + ROUND(rx * cosf(sx * t + ph));
-            brk->y = brk->sy + ROUND(ry * sinf(sy * t + ph));
+            brk->x = brk->sx + ROUND(sample_path(brk->brick_ref->path, 0, t));
+            brk->y = brk->sy + ROUND(sample_path(brk->brick_ref->path, 1, t));
             dx = brk->x - old_x; dy = brk->y - old_y;
 
             /* passable bricks do not affect the player */
@@ -412,21 +467,13 @@ void brick_update(brick_t *brk, player_t** team, int team_size)
         case BRB_PENDULAR: {
             int dx, dy, old_x, old_y;
 
-            /* get the parameters */
-            float t = (brk->value[0] = level_time()); /* elapsed time */
-            float r = max(brk->brick_ref->behavior_arg[0], 0.0f); /* radius */
-            float f = TWO_PI * brk->brick_ref->behavior_arg[1]; /* cycles per second */
-            float ph = DEG2RAD * brk->brick_ref->behavior_arg[2]; /* initial phase */
-            float off = DEG2RAD * (90.0f + brk->brick_ref->behavior_arg[3]); /* angular offset */
-            float a = DEG2RAD * (fmodf(180.0f + brk->brick_ref->behavior_arg[4], 360.0f)); /* angular amplitude */
-
-            /* compute the angle */
-            float ang = (a / 2.0f) * cosf(f * t + ph) + off;
+            /* get the elapsed time */
+            float t = (brk->value[0] = level_time());
 
             /* compute the position */
             old_x = brk->x; old_y = brk->y;
-            brk->x = brk->sx + ROUND(r * cosf(ang));
-            brk->y = brk->sy + ROUND(r * sinf(ang));
+            brk->x = brk->sx + ROUND(sample_path(brk->brick_ref->path, 0, t));
+            brk->y = brk->sy + ROUND(sample_path(brk->brick_ref->path, 1, t));
             dx = brk->x - old_x; dy = brk->y - old_y;
 
             /* passable bricks do not affect the player */
@@ -845,6 +892,71 @@ bool brick_has_movement_path(const brick_t* brk)
         return false;
 }
 
+/*
+ * brick_is_animated()
+ * Checks if the image of a brick changes over time
+ */
+bool brick_is_animated(const brick_t* brk)
+{
+    return brk->brick_ref != NULL && brk->brick_ref->is_animated;
+}
+
+/*
+ * brick_is_opaque()
+ * Checks if a brick hides whatever is behind it, i.e., if its image is
+ * rendered and all of its pixels are opaque
+ */
+bool brick_is_opaque(const brick_t* brk)
+{
+    return brk->brick_ref != NULL && brk->brick_ref->is_opaque;
+}
+
+/*
+ * brick_is_stateful()
+ * Checks if a brick has state that changes as the level is played
+ * (e.g., it breaks or falls), as opposed to being a function of time
+ */
+bool brick_is_stateful(const brick_t* brk)
+{
+    switch(brick_behavior(brk)) {
+        case BRB_BREAKABLE:
+        case BRB_FALL:
+        case BRB_SMASHABLE:
+        case BRB_FLOAT:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/*
+ * brick_save_state()
+ * Writes the mutable state of a brick to a snapshot
+ */
+void brick_save_state(const brick_t* brk, snapshot_t* snapshot)
+{
+    snapshot_put(snapshot, brk->x);
+    snapshot_put(snapshot, brk->y);
+    snapshot_put(snapshot, brk->state);
+    snapshot_put(snapshot, brk->value);
+}
+
+/*
+ * brick_load_state()
+ * Reads the mutable state of a brick from a snapshot
+ */
+void brick_load_state(brick_t* brk, snapshot_t* snapshot)
+{
+    snapshot_get(snapshot, brk->x);
+    snapshot_get(snapshot, brk->y);
+    snapshot_get(snapshot, brk->state);
+    snapshot_get(snapshot, brk->value);
+
+    if(brk->obstacle != NULL)
+        obstacle_set_position(brk->obstacle, point2d_new(brk->x, brk->y));
+}
+
 /*
  * brick_has_mask()
  * Checks if a brick has a collision mask
@@ -1045,18 +1157,28 @@ float brick_zindex_preview(int id)
 
 /* === private stuff === */
 
-/* Animates a brick */
+/* Animates a brick. All instances of a brick share the same frame,
+   which is computed at most once per frame of the game */
 void animate_brick(brick_t *brk)
 {
-    const spriteinfo_t *sprite = brk->brick_ref->data;
+    brickdata_t* data;
+    double now;
 
-    /* fake brick? */
-    if(sprite == NULL)
+    /* static brick? its image never changes */
+    if(!brk->brick_ref->is_animated)
         return;
 
+    /* update the shared frame */
+    data = brickdata[brk->brick_ref->id];
+    now = timer_get_elapsed();
+    if(data->frame_time != now) {
+        const animation_t* anim = spriteinfo_get_animation(data->data, 0);
+        data->frame = animation_image_at_time(anim, now);
+        data->frame_time = now;
+    }
+
     /* animate */
-    const animation_t* anim = spriteinfo_get_animation(sprite, 0);
-    brk->image = animation_image_at_time(anim, timer_get_elapsed());
+    brk->image = data->frame;
 }
 
 /* Checks if the player is standing on top of a platform */
@@ -1086,53 +1208,44 @@ bool can_be_clipped_out(const brick_t* brick, v2d_t topleft)
 }
 
 /* create a brick particle */
-surgescript_object_t* create_particle(const brick_t* brick, int source_x, int source_y, int width, int height, v2d_t position, v2d_t velocity)
-{
-    /* create the particle */
-    surgescript_object_t* particle = level_create_object("BrickParticle", position);
-
-    /* create auxiliary variables */
-    surgescript_var_t* id = surgescript_var_create();
-    surgescript_var_t* x = surgescript_var_create();
-    surgescript_var_t* y = surgescript_var_create();
-    surgescript_var_t* w = surgescript_var_create();
-    surgescript_var_t* h = surgescript_var_create();
-
-    /* call particle.setBrick(brick_id, source_x, source_y, width, height) */
-    const surgescript_var_t* args1[] = {
-        surgescript_var_set_number(id, brick_id(brick)),
-        surgescript_var_set_number(x, source_x),
-        surgescript_var_set_number(y, source_y),
-        surgescript_var_set_number(w, width),
-        surgescript_var_set_number(h, height)
-    };
-    surgescript_object_call_function(particle, "setBrick", args1, 5, NULL);
-
-    /* call particle.setVelocity(xvel, yvel) */
-    const surgescript_var_t* args2[] = {
-        surgescript_var_set_number(x, velocity.x),
-        surgescript_var_set_number(y, velocity.y)
-    };
-    surgescript_object_call_function(particle, "setVelocity", args2, 2, NULL);
-
-    /* call particle.set_zindex(zindex) */
-    /*
-    // the zindex of the brick is already set by setBrick()
-    const surgescript_var_t* args3[] = {
-        surgescript_var_set_number(x, 1.0)
-    };
-    surgescript_object_call_function(particle, "set_zindex", args3, 1, NULL);
-    */
-
-    /* release auxiliary variables */
-    surgescript_var_destroy(h);
-    surgescript_var_destroy(w);
-    surgescript_var_destroy(y);
-    surgescript_var_destroy(x);
-    surgescript_var_destroy(id);
-
-    /* return the particle */
-    return particle;
+void create_particle(const brick_t* brick, int source_x, int source_y, int width, int height, v2d_t position, v2d_t velocity)
+{
+    int id = brick_id(brick);
+    surgescript_object_t* emitter = find_particle_emitter(brick_zindex_preview(id), position);
+
+    if(emitter != NULL)
+        scripting_brickparticles_emit(emitter, brick_image_preview(id), source_x, source_y, width, height, position, velocity);
+}
+
+/* find the particle emitter of the given zindex, spawning it if necessary */
+surgescript_object_t* find_particle_emitter(float zindex, v2d_t position)
+{
+    const char* EMITTER = "BrickParticles";
+    surgescript_object_t* emitter = level_child_object(EMITTER);
+
+    /* the emitters are children of Level. Search the emitter of this zindex */
+    zindex = max(0.0f, zindex);
+    if(emitter != NULL) {
+        surgescript_objectmanager_t* manager = surgescript_object_manager(emitter);
+        surgescript_object_t* level = surgescript_objectmanager_get(manager, surgescript_object_parent(emitter));
+
+        for(int i = surgescript_object_child_count(level) - 1; i >= 0; i--) {
+            surgescript_objecthandle_t child_handle = surgescript_object_nth_child(level, i);
+            surgescript_object_t* child = surgescript_objectmanager_get(manager, child_handle);
+
+            if(
+                strcmp(surgescript_object_name(child), EMITTER) == 0 &&
+                scripting_brickparticles_zindex(child) == zindex
+            )
+                return child;
+        }
+    }
+
+    /* not found; spawn a new emitter */
+    if(NULL != (emitter = level_create_object(EMITTER, position)))
+        scripting_brickparticles_set_zindex(emitter, zindex);
+
+    return emitter;
 }
 
 
@@ -1147,6 +1260,10 @@ brickdata_t* brickdata_new(int brick_id)
     obj->image = NULL;
     obj->image_width = 0;
     obj->image_height = 0;
+    obj->is_animated = false;
+    obj->is_opaque = false;
+    obj->frame = NULL;
+    obj->frame_time = -1.0;
     obj->mask = NULL;
     obj->maskfile = NULL;
     obj->maskimg = NULL;
@@ -1154,6 +1271,8 @@ brickdata_t* brickdata_new(int brick_id)
     obj->behavior = BRB_DEFAULT;
     obj->zindex = 0.5f;
 
+    obj->path = NULL;
+
     for(int i = 0; i < BRICKBEHAVIOR_MAXARGS; i++)
         obj->behavior_arg[i] = 0.0f;
 
@@ -1172,6 +1291,8 @@ brickdata_t* brickdata_delete(brickdata_t *obj)
             image_destroy(obj->maskimg);
         if(obj->maskfile != NULL)
             free(obj->maskfile);
+        if(obj->path != NULL)
+            free(obj->path);
         free(obj);
     }
 
@@ -1192,6 +1313,138 @@ void validate_brickdata(const brickdata_t *obj)
         fatal_error("Can't load bricks: all bricks must have a sprite!");
 }
 
+/* precomputes the movement paths of the bricks */
+void create_paths()
+{
+    for(int i = 0; i < brickdata_count; i++) {
+        if(brickdata[i] != NULL)
+            brickdata[i]->path = create_path(brickdata[i]);
+    }
+}
+
+/* finds out which kinds of bricks are fully opaque. Animated bricks and
+   markers are never considered opaque. We lock each image only once */
+void create_opacity_flags()
+{
+    image_t* image = NULL;
+    const char* prev_file = "";
+
+    for(int i = 0; i < brickdata_count; i++) {
+        if(brickdata[i] == NULL || brickdata[i]->is_animated || brickdata[i]->behavior == BRB_MARKER)
+            continue;
+
+        const spriteinfo_t* sprite = brickdata[i]->data;
+        const char* file = spriteinfo_source_file(sprite);
+        rect_t source_rect = spriteinfo_source_rect(sprite);
+
+        if(image == NULL || 0 != str_icmp(prev_file, file)) {
+            if(image != NULL) {
+                image_unlock(image);
+                image_unload(image);
+            }
+            image = image_load(file);
+            image_lock(image, "r");
+            prev_file = file;
+        }
+
+        brickdata[i]->is_opaque = is_opaque_region(
+            image,
+            source_rect.x,
+            source_rect.y,
+            spriteinfo_frame_width(sprite),
+            spriteinfo_frame_height(sprite)
+        );
+    }
+
+    if(image != NULL) {
+        image_unlock(image);
+        image_unload(image);
+    }
+}
+
+/* checks if all pixels of a region of a locked image are opaque */
+bool is_opaque_region(const image_t* image, int x, int y, int width, int height)
+{
+    int pitch;
+    const uint8_t* pixels = image_locked_pixels(image, &pitch);
+
+    /* we can't tell */
+    if(pixels == NULL || x < 0 || y < 0 || x + width > image_width(image) || y + height > image_height(image))
+        return false;
+
+    /* the pixels are given in RGBA format. Magenta is the transparent color */
+    for(int j = 0; j < height; j++) {
+        const uint8_t* p = pixels + (y + j) * pitch + x * 4;
+        for(int i = 0; i < width; i++, p += 4) {
+            if(p[3] != 255 || (p[0] == 255 && p[1] == 0 && p[2] == 255))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/* precomputes the movement path of a kind of brick. Returns NULL if it doesn't move */
+brickpath_t* create_path(const brickdata_t* obj)
+{
+    brickpath_t* path;
+
+    switch(obj->behavior) {
+        case BRB_CIRCULAR: {
+            float rx = max(obj->behavior_arg[0], 0.0f); /* x-dist */
+            float ry = max(obj->behavior_arg[1], 0.0f); /* y-dist */
+            float ph = DEG2RAD * obj->behavior_arg[4]; /* initial phase */
+
+            path = mallocx(sizeof *path);
+            path->frequency[0] = obj->behavior_arg[2]; /* x-speed */
+            path->frequency[1] = obj->behavior_arg[3]; /* y-speed */
+
+            for(int k = 0; k <= BRICKPATH_SAMPLES; k++) {
+                float theta = TWO_PI * (float)(k % BRICKPATH_SAMPLES) / (float)BRICKPATH_SAMPLES + ph;
+                path->offset[0][k] = rx * cosf(theta);
+                path->offset[1][k] = ry * sinf(theta);
+            }
+
+            return path;
+        }
+
+        case BRB_PENDULAR: {
+            float r = max(obj->behavior_arg[0], 0.0f); /* radius */
+            float ph = DEG2RAD * obj->behavior_arg[2]; /* initial phase */
+            float off = DEG2RAD * (90.0f + obj->behavior_arg[3]); /* angular offset */
+            float a = DEG2RAD * (fmodf(180.0f + obj->behavior_arg[4], 360.0f)); /* angular amplitude */
+
+            path = mallocx(sizeof *path);
+            path->frequency[0] = path->frequency[1] = obj->behavior_arg[1]; /* cycles per second */
+
+            for(int k = 0; k <= BRICKPATH_SAMPLES; k++) {
+                float theta = TWO_PI * (float)(k % BRICKPATH_SAMPLES) / (float)BRICKPATH_SAMPLES + ph;
+                float ang = (a / 2.0f) * cosf(theta) + off;
+                path->offset[0][k] = r * cosf(ang);
+                path->offset[1][k] = r * sinf(ang);
+            }
+
+            return path;
+        }
+
+        default:
+            return NULL;
+    }
+}
+
+/* the offset of a brick along an axis of its movement path at time t,
+   linearly interpolated between the samples */
+float sample_path(const brickpath_t* path, int axis, float t)
+{
+    double cycles = (double)path->frequency[axis] * (double)t;
+    double u = (cycles - floor(cycles)) * BRICKPATH_SAMPLES; /* 0 <= u <= BRICKPATH_SAMPLES */
+    int k = (int)u & (BRICKPATH_SAMPLES - 1);
+    float w = (float)(u - floor(u));
+    const float* offset = path->offset[axis];
+
+    return offset[k] + (offset[k+1] - offset[k]) * w;
+}
+
 /* creates an obstacle (for the physics engine) corresponding to the brick */
 obstacle_t* create_obstacle(const brick_t* brick)
 {
@@ -1274,6 +1527,10 @@ int traverse(const parsetree_statement_t *stmt)
         /* cache preview image size */
         brickdata[brick_id]->image_width = image_width(brickdata[brick_id]->image);
         brickdata[brick_id]->image_height = image_height(brickdata[brick_id]->image);
+
+        /* classify the brick: static bricks are never animated */
+        brickdata[brick_id]->is_animated = (animation_frame_count(anim) > 1);
+        brickdata[brick_id]->frame = brickdata[brick_id]->image;
     }
     else
         fatal_error("Can't load bricks: unknown identifier '%s'", identifier);
@@ -1281,6 +1538,45 @@ int traverse(const parsetree_statement_t *stmt)
     return 0;
 }
 
+/* schedules the images of a brick of a .brk file to be decoded in the background */
+int prefetch_brick(const parsetree_statement_t *stmt)
+{
+    const char *identifier = nanoparser_get_identifier(stmt);
+    const parsetree_parameter_t *param_list = nanoparser_get_parameter_list(stmt);
+
+    /* we'll validate the brick later */
+    if(str_icmp(identifier, "brick") == 0) {
+        const parsetree_parameter_t *p2 = nanoparser_get_nth_parameter(param_list, 2);
+        const parsetree_program_t *block = nanoparser_get_program(p2);
+
+        if(block != NULL)
+            nanoparser_traverse_program(block, prefetch_brick_attributes);
+    }
+
+    return 0;
+}
+
+/* schedules the images of a brick { ... } block to be decoded in the background */
+int prefetch_brick_attributes(const parsetree_statement_t *stmt)
+{
+    const char *identifier = nanoparser_get_identifier(stmt);
+    const parsetree_parameter_t *param_list = nanoparser_get_parameter_list(stmt);
+    const parsetree_parameter_t *p1 = nanoparser_get_nth_parameter(param_list, 1);
+
+    if(str_icmp(identifier, "sprite") == 0) {
+        const parsetree_program_t *block = nanoparser_get_program(p1);
+        if(block != NULL)
+            spriteinfo_prefetch(block);
+    }
+    else if(str_icmp(identifier, "mask") == 0) {
+        const char *maskfile = nanoparser_get_string(p1);
+        if(asset_exists(maskfile))
+            image_prefetch(maskfile);
+    }
+
+    return 0;
+}
+
 /* traverses a brick { ... } block */
 int traverse_brick_attributes(const parsetree_statement_t *stmt, void *brickdata)
 {
@@ -1449,6 +1745,11 @@ void create_collisionmasks()
             int frame_height = spriteinfo_frame_height(sprite);
             int flags = (brickdata[i]->type == BRK_CLOUD) ? CMF_CLOUDIFY : 0;
 
+            /* read the mask from the cache, if possible, so that we don't lock the image */
+            brickdata[i]->mask = collisionmask_load_cached(maskfile, source_rect.x, source_rect.y, frame_width, frame_height, flags);
+            if(brickdata[i]->mask != NULL)
+                continue;
+
             if(mask == NULL || 0 != str_icmp(prev_maskfile, maskfile)) {
                 if(mask != NULL) {
                     image_unlock(mask);
@@ -1467,6 +1768,7 @@ void create_collisionmasks()
                 frame_height,
                 flags
             );
+            collisionmask_store_cached(brickdata[i]->mask, maskfile, source_rect.x, source_rect.y, frame_width, frame_height, flags);
         }
     }
 
@@ -66,6 +66,7 @@ struct obstacle_t;
 struct brickdata_t;
 struct brick_t;
 struct image_t;
+struct snapshot_t;
 
 /* typedefs */
 typedef struct brick_t brick_t;
@@ -84,6 +85,7 @@ struct brick_list_t {
 /* brickset: theme interface */
 void brickset_load(const char *filename); /* loads a brickset */
 void brickset_unload(); /* unloads the current brickset */
+void brickset_prefetch(const char *filename); /* schedules the images of a brickset to be decoded; see image_begin_prefetch() */
 int brickset_size(); /* number of bricks */
 int brickset_loaded(); /* is a brickset loaded? */
 
@@ -112,6 +114,11 @@ void brick_kill(brick_t* brk); /* kills a brick */
 int brick_is_alive(const brick_t* brk); /* checks if a brick is alive */
 bool brick_has_movement_path(const brick_t* brk); /* checks if a brick has a movement path */
 bool brick_has_mask(const brick_t* brk); /* checks if a brick has a collision mask */
+bool brick_is_animated(const brick_t* brk); /* checks if the image of a brick changes over time */
+bool brick_is_opaque(const brick_t* brk); /* checks if a brick hides whatever is behind it (all pixels of its image are opaque) */
+bool brick_is_stateful(const brick_t* brk); /* checks if a brick breaks, falls, etc. as the level is played */
+void brick_save_state(const brick_t* brk, struct snapshot_t* snapshot); /* writes the mutable state of a brick to a snapshot */
+void brick_load_state(brick_t* brk, struct snapshot_t* snapshot); /* reads the mutable state of a brick from a snapshot */
 
 /* brick utilities */
 int brick_exists(int id); /* does a brick with the given id exist in the brickset? */
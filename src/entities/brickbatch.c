@@ -0,0 +1,329 @@
+/*
+ * Open Surge Engine
+ * brickbatch.c - batched rendering of static bricks
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_primitives.h>
+#include "brickbatch.h"
+#include "brick.h"
+#include "../core/image.h"
+#include "../core/video.h"
+#include "../core/logfile.h"
+#include "../util/util.h"
+#include "../util/darray.h"
+#include "../util/iterator.h"
+
+/* a group of bricks sharing the same z-index, type, layer and texture */
+struct brickgroup_t
+{
+    ALLEGRO_VERTEX_BUFFER* vertex_buffer; /* 6 vertices per brick */
+    ALLEGRO_BITMAP* texture; /* root bitmap */
+    const brick_t* representative; /* the first brick of the group */
+    int brick_count;
+    int ypos; /* the smallest ypos of the group */
+};
+
+/* brick batch */
+struct brickbatch_t
+{
+    DARRAY(brickgroup_t, group);
+    DARRAY(const brick_t*, brick); /* auxiliary storage */
+    DARRAY(ALLEGRO_VERTEX, vertex); /* auxiliary storage */
+    bool is_valid; /* false if the batch couldn't be built */
+};
+
+static int brick_cmp(const void* a, const void* b);
+static bool same_group(const brick_t* a, const brick_t* b);
+static inline ALLEGRO_BITMAP* root_bitmap(ALLEGRO_BITMAP* bitmap);
+static void push_brick_vertices(brickbatch_t* batch, const brick_t* brick);
+static void clear_groups(brickbatch_t* batch);
+
+
+
+/*
+ * brickbatch_create()
+ * Creates a new brick batch
+ */
+brickbatch_t* brickbatch_create()
+{
+    brickbatch_t* batch = mallocx(sizeof *batch);
+
+    darray_init(batch->group);
+    darray_init(batch->brick);
+    darray_init(batch->vertex);
+    batch->is_valid = false;
+
+    return batch;
+}
+
+/*
+ * brickbatch_destroy()
+ * Destroys a brick batch
+ */
+brickbatch_t* brickbatch_destroy(brickbatch_t* batch)
+{
+    clear_groups(batch);
+
+    darray_release(batch->vertex);
+    darray_release(batch->brick);
+    darray_release(batch->group);
+    free(batch);
+
+    return NULL;
+}
+
+/*
+ * brickbatch_rebuild()
+ * Rebuilds the batch with the eligible bricks given by the iterator.
+ * Returns true on success. If this fails, no bricks will be batched.
+ */
+bool brickbatch_rebuild(brickbatch_t* batch, iterator_t* brick_iterator)
+{
+    /* clear the batch */
+    clear_groups(batch);
+    darray_clear(batch->brick);
+    batch->is_valid = true;
+
+    /* collect the eligible bricks */
+    while(iterator_has_next(brick_iterator)) {
+        const brick_t* brick = iterator_next(brick_iterator);
+        if(brickbatch_is_eligible(brick))
+            darray_push(batch->brick, brick);
+    }
+
+    /* sort the bricks by group and then by ypos (stable sorting) */
+    merge_sort(batch->brick, darray_length(batch->brick), sizeof(*(batch->brick)), brick_cmp);
+
+    /* create the groups */
+    for(int i = 0, j = 0; i < darray_length(batch->brick); i = j) {
+        brickgroup_t group = {
+            .vertex_buffer = NULL,
+            .texture = root_bitmap(IMAGE2BITMAP(brick_image(batch->brick[i]))),
+            .representative = batch->brick[i],
+            .brick_count = 0,
+            .ypos = (int)brick_position(batch->brick[i]).y
+        };
+
+        /* fill the vertices */
+        darray_clear(batch->vertex);
+        for(j = i; j < darray_length(batch->brick) && same_group(batch->brick[i], batch->brick[j]); j++)
+            push_brick_vertices(batch, batch->brick[j]);
+
+        /* upload the vertices to the GPU */
+        group.brick_count = j - i;
+        group.vertex_buffer = al_create_vertex_buffer(NULL, batch->vertex, darray_length(batch->vertex), ALLEGRO_PRIM_BUFFER_STATIC);
+        if(group.vertex_buffer == NULL) {
+            logfile_message("Brick batch - can't create a vertex buffer with %d bricks", group.brick_count);
+            clear_groups(batch);
+            batch->is_valid = false;
+            return false;
+        }
+
+        darray_push(batch->group, group);
+    }
+
+    /* done! */
+    return true;
+}
+
+/*
+ * brickbatch_contains()
+ * Checks if a brick is rendered by the batch
+ */
+bool brickbatch_contains(const brickbatch_t* batch, const brick_t* brick)
+{
+    /* brickbatch_rebuild() is given all bricks inside a region */
+    return batch->is_valid && brickbatch_is_eligible(brick);
+}
+
+/*
+ * brickbatch_is_eligible()
+ * Checks if a brick can be batched. Eligible bricks are alive,
+ * static and not animated: they don't change over time.
+ */
+bool brickbatch_is_eligible(const brick_t* brick)
+{
+    return brick_is_alive(brick) &&
+           brick_behavior(brick) == BRB_DEFAULT &&
+           !brick_has_movement_path(brick) &&
+           !brick_is_animated(brick);
+}
+
+/*
+ * brickbatch_group_count()
+ * The number of groups of the batch
+ */
+int brickbatch_group_count(const brickbatch_t* batch)
+{
+    return darray_length(batch->group);
+}
+
+/*
+ * brickbatch_group_at()
+ * The index-th group of the batch
+ */
+const brickgroup_t* brickbatch_group_at(const brickbatch_t* batch, int index)
+{
+    return &(batch->group[index]);
+}
+
+/*
+ * brickgroup_representative()
+ * A brick of the group. All bricks of the group share the same
+ * z-index, type, layer and texture.
+ */
+const brick_t* brickgroup_representative(const brickgroup_t* group)
+{
+    return group->representative;
+}
+
+/*
+ * brickgroup_brick_count()
+ * The number of bricks of the group
+ */
+int brickgroup_brick_count(const brickgroup_t* group)
+{
+    return group->brick_count;
+}
+
+/*
+ * brickgroup_ypos()
+ * The smallest ypos of the bricks of the group
+ */
+int brickgroup_ypos(const brickgroup_t* group)
+{
+    return group->ypos;
+}
+
+/*
+ * brickgroup_render()
+ * Renders a group of bricks with a single draw call
+ */
+void brickgroup_render(const brickgroup_t* group, v2d_t camera_position)
+{
+    v2d_t topleft = v2d_subtract(camera_position, v2d_multiply(video_get_screen_size(), 0.5f));
+    ALLEGRO_TRANSFORM prev_transform, transform;
+
+    /* the vertices are stored in world space */
+    al_copy_transform(&prev_transform, al_get_current_transform());
+    al_identity_transform(&transform);
+    al_translate_transform(&transform, -(int)topleft.x, -(int)topleft.y);
+    al_compose_transform(&transform, &prev_transform);
+
+    /* render */
+    al_use_transform(&transform);
+    al_draw_vertex_buffer(group->vertex_buffer, group->texture, 0, 6 * group->brick_count, ALLEGRO_PRIM_TRIANGLE_LIST);
+    al_use_transform(&prev_transform);
+}
+
+
+
+
+/*
+ * private stuff
+ */
+
+/* compares two bricks: sort by group and then by ypos */
+int brick_cmp(const void* a, const void* b)
+{
+    const brick_t* x = *((const brick_t**)a);
+    const brick_t* y = *((const brick_t**)b);
+
+    float zx = brick_zindex(x), zy = brick_zindex(y);
+    if(zx != zy)
+        return (zx > zy) - (zx < zy);
+
+    if(brick_type(x) != brick_type(y))
+        return (int)brick_type(x) - (int)brick_type(y);
+
+    if(brick_layer(x) != brick_layer(y))
+        return (int)brick_layer(x) - (int)brick_layer(y);
+
+    uintptr_t tx = (uintptr_t)root_bitmap(IMAGE2BITMAP(brick_image(x)));
+    uintptr_t ty = (uintptr_t)root_bitmap(IMAGE2BITMAP(brick_image(y)));
+    if(tx != ty)
+        return (tx > ty) - (tx < ty);
+
+    return (int)brick_position(x).y - (int)brick_position(y).y;
+}
+
+/* checks if two bricks belong to the same group */
+bool same_group(const brick_t* a, const brick_t* b)
+{
+    return brick_zindex(a) == brick_zindex(b) &&
+           brick_type(a) == brick_type(b) &&
+           brick_layer(a) == brick_layer(b) &&
+           root_bitmap(IMAGE2BITMAP(brick_image(a))) == root_bitmap(IMAGE2BITMAP(brick_image(b)));
+}
+
+/* the root of a (sub-)bitmap */
+ALLEGRO_BITMAP* root_bitmap(ALLEGRO_BITMAP* bitmap)
+{
+    ALLEGRO_BITMAP* parent = al_get_parent_bitmap(bitmap);
+    return parent != NULL ? parent : bitmap;
+}
+
+/* adds the vertices of a brick (two triangles) to the auxiliary storage */
+void push_brick_vertices(brickbatch_t* batch, const brick_t* brick)
+{
+    ALLEGRO_BITMAP* bitmap = IMAGE2BITMAP(brick_image(brick));
+    ALLEGRO_COLOR white = al_map_rgb_f(1.0f, 1.0f, 1.0f);
+    v2d_t position = brick_position(brick);
+    float w = al_get_bitmap_width(bitmap);
+    float h = al_get_bitmap_height(bitmap);
+
+    /* world space */
+    float x0 = (int)position.x, y0 = (int)position.y;
+    float x1 = x0 + w, y1 = y0 + h;
+
+    /* texture space (in pixels) */
+    float u0 = al_get_bitmap_x(bitmap), v0 = al_get_bitmap_y(bitmap);
+    float u1 = u0 + w, v1 = v0 + h;
+
+    /* flip */
+    brickflip_t flip = brick_flip(brick);
+    if(flip & BRF_HFLIP) {
+        float tmp = u0;
+        u0 = u1;
+        u1 = tmp;
+    }
+    if(flip & BRF_VFLIP) {
+        float tmp = v0;
+        v0 = v1;
+        v1 = tmp;
+    }
+
+    /* two triangles */
+    darray_push(batch->vertex, ((ALLEGRO_VERTEX){ .x = x0, .y = y0, .z = 0, .u = u0, .v = v0, .color = white }));
+    darray_push(batch->vertex, ((ALLEGRO_VERTEX){ .x = x1, .y = y1, .z = 0, .u = u1, .v = v1, .color = white }));
+    darray_push(batch->vertex, ((ALLEGRO_VERTEX){ .x = x0, .y = y1, .z = 0, .u = u0, .v = v1, .color = white }));
+    darray_push(batch->vertex, ((ALLEGRO_VERTEX){ .x = x0, .y = y0, .z = 0, .u = u0, .v = v0, .color = white }));
+    darray_push(batch->vertex, ((ALLEGRO_VERTEX){ .x = x1, .y = y0, .z = 0, .u = u1, .v = v0, .color = white }));
+    darray_push(batch->vertex, ((ALLEGRO_VERTEX){ .x = x1, .y = y1, .z = 0, .u = u1, .v = v1, .color = white }));
+}
+
+/* releases the groups of the batch */
+void clear_groups(brickbatch_t* batch)
+{
+    for(int i = 0; i < darray_length(batch->group); i++)
+        al_destroy_vertex_buffer(batch->group[i].vertex_buffer);
+
+    darray_clear(batch->group);
+}
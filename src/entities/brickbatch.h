@@ -0,0 +1,52 @@
+/*
+ * Open Surge Engine
+ * brickbatch.h - batched rendering of static bricks
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BRICKBATCH_H
+#define _BRICKBATCH_H
+
+#include <stdbool.h>
+#include "../util/v2d.h"
+
+/* forward declarations */
+typedef struct brickbatch_t brickbatch_t;
+typedef struct brickgroup_t brickgroup_t;
+struct brick_t;
+struct iterator_t;
+
+/* A brick batch stores the static bricks of a region in vertex buffers.
+   Bricks sharing the same z-index, type, layer and texture are stored in
+   the same group and are rendered with a single draw call. */
+
+/* public API */
+brickbatch_t* brickbatch_create();
+brickbatch_t* brickbatch_destroy(brickbatch_t* batch);
+bool brickbatch_rebuild(brickbatch_t* batch, struct iterator_t* brick_iterator); /* rebuild the batch with the eligible bricks of the iterator */
+bool brickbatch_contains(const brickbatch_t* batch, const struct brick_t* brick); /* is the brick rendered by the batch? */
+bool brickbatch_is_eligible(const struct brick_t* brick); /* can the brick be batched? */
+
+/* groups */
+int brickbatch_group_count(const brickbatch_t* batch);
+const brickgroup_t* brickbatch_group_at(const brickbatch_t* batch, int index);
+const struct brick_t* brickgroup_representative(const brickgroup_t* group); /* a brick of the group */
+int brickgroup_brick_count(const brickgroup_t* group);
+int brickgroup_ypos(const brickgroup_t* group);
+void brickgroup_render(const brickgroup_t* group, v2d_t camera_position);
+
+#endif
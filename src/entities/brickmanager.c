@@ -22,14 +22,13 @@
 #include <stdbool.h>
 #include "brickmanager.h"
 #include "brick.h"
+#include "brickbatch.h"
 #include "../util/util.h"
 #include "../util/darray.h"
 #include "../util/iterator.h"
+#include "../util/profiler.h"
 #include "../scripting/scripting.h"
 
-#define FASTHASH_INLINE
-#include "../util/fasthash.h"
-
 typedef struct brickrect_t brickrect_t;
 typedef struct heightsampler_t heightsampler_t;
 typedef struct brickbucket_t brickbucket_t;
@@ -54,6 +53,14 @@ struct heightsampler_t
     /* smooth_height_at[j] = smooth_height_at[j-1] if j >= 1 and height_at[j] == 0 (no sampling data)
                              height_at[j]          otherwise */
     DARRAY(int, smooth_height_at);
+
+    /* a segment tree for range-max queries over smooth_height_at[]:
+       tree[tree_capacity + j] = smooth_height_at[j] and tree[k] = max(tree[2k], tree[2k+1]).
+       It's updated lazily, when queried */
+    int* tree;
+    int tree_capacity; /* a power of two; 0 if the tree must be rebuilt */
+    int dirty_left; /* smooth_height_at[dirty_left..dirty_right] has changed since the last query */
+    int dirty_right; /* (the interval is empty if dirty_left > dirty_right) */
 };
 
 /* A bucket of bricks */
@@ -62,6 +69,12 @@ struct brickbucket_t
     /* a vector of bricks */
     DARRAY(brick_t*, brick);
 
+    /* attributes of the bricks that are read by the queries, stored in vectors
+       parallel to the above. The spawn point and the behavior of a brick don't
+       change, so we can scan these without touching the bricks themselves */
+    DARRAY(v2d_t, spawnpoint);
+    DARRAY(brickbehavior_t, behavior);
+
     /* a destructor of individual bricks */
     brick_t* (*brick_dtor)(brick_t*);
 };
@@ -69,11 +82,14 @@ struct brickbucket_t
 /* Brick Manager */
 struct brickmanager_t
 {
-    /* The Brick Manager is implemented with a spatial hash table mapped to a
-       linear map table */
+    /* The Brick Manager is implemented with a dense grid of buckets of static
+       bricks. The grid grows as bricks are added, and its cells are indexed
+       directly, i.e., cell[y * grid_width + x] */
 
-    /* a hash table of brick buckets that are allocated lazily */
-    fasthash_t* hashtable;
+    /* a dense grid of brick buckets that are allocated lazily (NULL if empty) */
+    brickbucket_t** cell;
+    int grid_width; /* in cells */
+    int grid_height; /* in cells */
 
     /* a special bucket that is included in all queries regardless of the ROI */
     brickbucket_t* awake_bucket;
@@ -93,6 +109,37 @@ struct brickmanager_t
 
     /* height sampler */
     heightsampler_t* sampler;
+
+    /* a batch of the static bricks inside the cells of the ROI */
+    brickbatch_t* batch;
+    brickrect_t batch_cells; /* cells of the spatial hash covered by the batch */
+    bool is_batch_dirty; /* rebuild the batch? */
+
+    /* the static bricks inside the cells of the ROI change when this changes */
+    unsigned static_version;
+    brickrect_t static_cells; /* cells of the spatial hash of the current version */
+
+    /* the bricks inside the ROI are cached in arrays that are reused across
+       frames, so that retrieving them allocates no memory */
+    DARRAY(brick_t*, active_span);
+    DARRAY(brick_t*, moving_span);
+    DARRAY(brick_t*, static_span);
+    bool is_active_span_dirty;
+    bool is_moving_span_dirty;
+    unsigned static_span_version; /* static_version when static_span was built */
+    bool has_static_span;
+
+    /* nodes of the legacy brick lists, also reused */
+    DARRAY(brick_list_t, active_list_node);
+    DARRAY(brick_list_t, all_list_node);
+
+    /* the result of the last spatial query */
+    DARRAY(brick_t*, query_span);
+
+    /* the largest width or height of a brick that has been added; a brick
+       belongs to the cell of its center, so this bounds the cells that
+       need to be scanned in order to find the bricks at a position */
+    int max_brick_size;
 };
 
 /* Iterator state */
@@ -112,17 +159,22 @@ struct brickiteratorstate_t
 };
 
 /* Utilities */
-#define GRID_SIZE 256 /* width and height of a cell of the spatial hash; this impacts the number of fasthash queries per frame (quadratically), as well as the number of returned bricks */
+#define GRID_SIZE 256 /* width and height of a cell of the grid; this impacts the number of visited cells per frame (quadratically), as well as the number of returned bricks */
+#define GRID_MAX_CELLS 2048 /* maximum width and height of the grid, in cells; farther bricks are stored in the cells of the border */
 #define SAMPLER_WIDTH 128 /* width of the fixed-size intervals of the height sampler */
 #define SAMPLER_MAX_INDEX 16384 /* >= MAX_LEVEL_WIDTH / SAMPLER_WIDTH */
 
-static inline uint64_t position_to_hash(int x, int y);
-static inline uint64_t brick2hash(const brick_t* brick);
+static inline int position_to_cell(int coordinate);
+static void brick2cell(const brick_t* brick, int* cell_x, int* cell_y);
+static inline brickbucket_t* grid_cell(const brickmanager_t* manager, int cell_x, int cell_y);
+static brickbucket_t* grid_create_cell(brickmanager_t* manager, int cell_x, int cell_y);
+static void grid_release(brickmanager_t* manager);
 
 static brickbucket_t* bucket_ctor(brick_t* (*brick_dtor)(brick_t*));
 static brickbucket_t* bucket_dtor(brickbucket_t* bucket);
-static void bucket_dtor_adapter(void* bucket);
 static inline void bucket_add(brickbucket_t* bucket, brick_t* brick);
+static inline void bucket_add_from(brickbucket_t* bucket, const brickbucket_t* source_bucket, int index);
+static int bucket_remove_spawned_in(brickbucket_t* bucket, rect_t area);
 static int bucket_wash(brickbucket_t* bucket);
 static void bucket_clear(brickbucket_t* bucket);
 static inline bool bucket_is_empty(const brickbucket_t* bucket);
@@ -139,6 +191,7 @@ static int sampler_query(heightsampler_t* sampler, int left, int right);
 static void sampler_add(heightsampler_t* sampler, v2d_t topleft_position, v2d_t size);
 static void sampler_add_brick(heightsampler_t* sampler, const brick_t* brick);
 static void sampler_add_bricklike_object(heightsampler_t* sampler, const surgescript_object_t* bricklike_object);
+static void sampler_update_tree(heightsampler_t* sampler);
 
 static void update_world_size(brickmanager_t* manager, v2d_t topleft_position, v2d_t size);
 static void update_world_size_with_brick(brickmanager_t* manager, const brick_t* brick);
@@ -150,11 +203,14 @@ static void acknowledge_bricklike_object(brickmanager_t* manager, const surgescr
 static bool is_brick_inside_roi(const brick_t* brick, const brickrect_t* roi);
 static void filter_bricks_inside_roi(brickbucket_t* out_bucket, const brickbucket_t* in_bucket, const brickrect_t* roi);
 static void filter_non_default_bricks(brickbucket_t* out_bucket, const brickbucket_t* in_bucket);
+static void filter_default_bricks(brickbucket_t* out_bucket, const brickbucket_t* in_bucket);
 
 static brick_t* brick_fake_destroy(brick_t* brick);
 
-static brick_list_t* add_to_list(brick_list_t* list, brick_t* brick);
-static brick_list_t* release_list(brick_list_t* list);
+static brickrect_t roi_cells(const brickrect_t* roi);
+
+static void invalidate_spans(brickmanager_t* manager);
+static brick_list_t* build_list(brick_list_t* node, int count, brick_t* const* brick);
 
 
 
@@ -173,12 +229,35 @@ brickmanager_t* brickmanager_create()
 {
     brickmanager_t* manager = mallocx(sizeof *manager);
 
-    manager->hashtable = fasthash_create(bucket_dtor_adapter, 12);
+    manager->cell = NULL;
+    manager->grid_width = 0;
+    manager->grid_height = 0;
     manager->awake_bucket = bucket_ctor(brick_destroy);
     darray_init(manager->bucket_ref);
     darray_push(manager->bucket_ref, manager->awake_bucket);
     manager->sampler = sampler_ctor();
 
+    manager->batch = brickbatch_create();
+    manager->batch_cells = (brickrect_t){ 0, 0, -1, -1 };
+    manager->is_batch_dirty = true;
+
+    manager->static_version = 0;
+    manager->static_cells = (brickrect_t){ 0, 0, -1, -1 };
+
+    darray_init(manager->active_span);
+    darray_init(manager->moving_span);
+    darray_init(manager->static_span);
+    manager->is_active_span_dirty = true;
+    manager->is_moving_span_dirty = true;
+    manager->static_span_version = 0;
+    manager->has_static_span = false;
+
+    darray_init(manager->active_list_node);
+    darray_init(manager->all_list_node);
+
+    darray_init(manager->query_span);
+    manager->max_brick_size = 0;
+
     manager->roi = (brickrect_t){ 0, 0, 0, 0 };
     manager->brick_count = 0;
     manager->world_width = 1;
@@ -193,10 +272,18 @@ brickmanager_t* brickmanager_create()
  */
 brickmanager_t* brickmanager_destroy(brickmanager_t* manager)
 {
+    darray_release(manager->query_span);
+    darray_release(manager->all_list_node);
+    darray_release(manager->active_list_node);
+    darray_release(manager->static_span);
+    darray_release(manager->moving_span);
+    darray_release(manager->active_span);
+
+    brickbatch_destroy(manager->batch);
     sampler_dtor(manager->sampler);
     darray_release(manager->bucket_ref); /* a vector of references only */
     bucket_dtor(manager->awake_bucket);
-    fasthash_destroy(manager->hashtable);
+    grid_release(manager);
 
     free(manager);
     return NULL;
@@ -215,15 +302,13 @@ void brickmanager_add_brick(brickmanager_t* manager, struct brick_t* brick)
     if(!is_moving_brick) {
 
         /* find the appropriate bucket for the brick */
-        uint64_t key = brick2hash(brick);
-        bucket = fasthash_get(manager->hashtable, key);
+        int cell_x, cell_y;
+        brick2cell(brick, &cell_x, &cell_y);
+        bucket = grid_cell(manager, cell_x, cell_y);
 
         /* lazily allocate a new bucket if one doesn't exist */
-        if(bucket == NULL) {
-            bucket = bucket_ctor(brick_destroy);
-            fasthash_put(manager->hashtable, key, bucket);
-            darray_push(manager->bucket_ref, bucket);
-        }
+        if(bucket == NULL)
+            bucket = grid_create_cell(manager, cell_x, cell_y);
 
     }
     else {
@@ -239,11 +324,20 @@ void brickmanager_add_brick(brickmanager_t* manager, struct brick_t* brick)
     /* increment the brick count */
     manager->brick_count++;
 
+    /* keep track of the size of the largest brick */
+    v2d_t size = brick_size(brick);
+    manager->max_brick_size = max(manager->max_brick_size, (int)max(size.x, size.y));
+
     /* update the size of the world */
     update_world_size_with_brick(manager, brick);
 
     /* update the height sampler */
     sampler_add_brick(manager->sampler, brick);
+
+    /* the batch is no longer up-to-date */
+    manager->is_batch_dirty = true;
+    manager->static_version++;
+    invalidate_spans(manager);
 }
 
 /*
@@ -264,6 +358,11 @@ void brickmanager_remove_all_bricks(brickmanager_t* manager)
     manager->world_width = 1;
     manager->world_height = 1;
 
+    /* the batch is no longer up-to-date */
+    manager->is_batch_dirty = true;
+    manager->static_version++;
+    invalidate_spans(manager);
+
     /* acknowledge brick-like objects */
     /*acknowledge_bricklike_objects(manager);*/
 }
@@ -274,20 +373,15 @@ void brickmanager_remove_all_bricks(brickmanager_t* manager)
  */
 void brickmanager_update(brickmanager_t* manager)
 {
+    PROFILER_BEGIN("brickmanager_update");
+
     /* remove dead bricks inside (any bucket that intersects with) the ROI */
     int cnt = 0; /* we'll count the number of removed bricks */
-    int left = manager->roi.left;
-    int top = manager->roi.top;
-    int right = manager->roi.right;
-    int bottom = manager->roi.bottom;
+    brickrect_t cells = roi_cells(&(manager->roi));
 
-    right += GRID_SIZE - 1;
-    bottom += GRID_SIZE - 1;
-
-    for(int y = top; y <= bottom; y += GRID_SIZE) {
-        for(int x = left; x <= right; x += GRID_SIZE) {
-            uint64_t key = position_to_hash(x, y);
-            brickbucket_t* bucket = fasthash_get(manager->hashtable, key);
+    for(int y = cells.top; y <= cells.bottom; y++) {
+        for(int x = cells.left; x <= cells.right; x++) {
+            brickbucket_t* bucket = grid_cell(manager, x, y);
 
             /* wash the bucket if it exists */
             if(bucket != NULL)
@@ -301,6 +395,15 @@ void brickmanager_update(brickmanager_t* manager)
     /* update the brick count */
     manager->brick_count -= cnt;
 
+    /* the batch may reference removed bricks */
+    if(cnt > 0) {
+        manager->is_batch_dirty = true;
+        manager->static_version++;
+    }
+
+    /* the moving bricks may have entered or left the ROI */
+    invalidate_spans(manager);
+
     /* we don't update the sampler nor the world size with the bricks: why bother?
        it doesn't matter much, since dead bricks are very few with special behavior
        we may also remove bricks using the level editor, but we can just recalculate instead */
@@ -308,6 +411,40 @@ void brickmanager_update(brickmanager_t* manager)
 
     /* we do update the sampler and the world size when it comes to brick-like objects */
     acknowledge_bricklike_objects(manager);
+
+    PROFILER_END();
+}
+
+/*
+ * brickmanager_remove_bricks_in_area()
+ * Removes the bricks whose spawn point is inside the given area,
+ * in world space. Returns the number of removed bricks
+ */
+int brickmanager_remove_bricks_in_area(brickmanager_t* manager, rect_t area)
+{
+    int cnt = 0;
+
+    /* dead bricks outside the ROI are not washed by brickmanager_update(),
+       so we remove them right away. We scan all buckets, since a bucket is
+       selected by the center of a brick and large bricks may belong
+       to a bucket that is far from their spawn point */
+    for(int i = 0; i < darray_length(manager->bucket_ref); i++)
+        cnt += bucket_remove_spawned_in((brickbucket_t*)manager->bucket_ref[i], area);
+
+    cnt += bucket_remove_spawned_in(manager->awake_bucket, area);
+
+    /* update the brick count */
+    manager->brick_count -= cnt;
+
+    /* the batch may reference removed bricks */
+    if(cnt > 0) {
+        manager->is_batch_dirty = true;
+        manager->static_version++;
+        invalidate_spans(manager);
+    }
+
+    /* as in brickmanager_update(), we keep the sampler and the world size */
+    return cnt;
 }
 
 /*
@@ -382,6 +519,16 @@ void brickmanager_recalculate_world_size(brickmanager_t* manager)
     acknowledge_bricklike_objects(manager);
 }
 
+/*
+ * brickmanager_extend_world_size()
+ * Make the world at least as large as the given size, in pixels. Useful
+ * when the manager doesn't store all bricks of the world at once
+ */
+void brickmanager_extend_world_size(brickmanager_t* manager, int min_world_width, int min_world_height)
+{
+    update_world_size(manager, v2d_new(0, 0), v2d_new(min_world_width, min_world_height));
+}
+
 /*
  * brickmanager_set_roi()
  * Sets the current Region Of Interest (ROI) in world space.
@@ -431,10 +578,30 @@ void brickmanager_set_roi(brickmanager_t* manager, rect_t roi)
         height = world_height - y;
 
     /* update the ROI */
-    manager->roi.left = x;
-    manager->roi.top = y;
-    manager->roi.right = x + width - 1;
-    manager->roi.bottom = y + height - 1;
+    if(
+        manager->roi.left != x ||
+        manager->roi.top != y ||
+        manager->roi.right != x + width - 1 ||
+        manager->roi.bottom != y + height - 1
+    ) {
+        manager->roi.left = x;
+        manager->roi.top = y;
+        manager->roi.right = x + width - 1;
+        manager->roi.bottom = y + height - 1;
+        invalidate_spans(manager);
+    }
+
+    /* the set of active static bricks changes only when the cells change */
+    brickrect_t cells = roi_cells(&(manager->roi));
+    if(
+        cells.left != manager->static_cells.left ||
+        cells.top != manager->static_cells.top ||
+        cells.right != manager->static_cells.right ||
+        cells.bottom != manager->static_cells.bottom
+    ) {
+        manager->static_cells = cells;
+        manager->static_version++;
+    }
 }
 
 /*
@@ -452,18 +619,10 @@ iterator_t* brickmanager_retrieve_active_bricks(const brickmanager_t* manager)
     const brickrect_t* roi = &(manager->roi);
 
     /* for each bucket inside the ROI */
-    int left = roi->left;
-    int top = roi->top;
-    int right = roi->right;
-    int bottom = roi->bottom;
-
-    right += GRID_SIZE - 1;
-    bottom += GRID_SIZE - 1;
-
-    for(int y = top; y <= bottom; y += GRID_SIZE) {
-        for(int x = left; x <= right; x += GRID_SIZE) {
-            uint64_t key = position_to_hash(x, y);
-            const brickbucket_t* bucket = fasthash_get(manager->hashtable, key);
+    brickrect_t cells = roi_cells(roi);
+    for(int y = cells.top; y <= cells.bottom; y++) {
+        for(int x = cells.left; x <= cells.right; x++) {
+            const brickbucket_t* bucket = grid_cell(manager, x, y);
 
             /* add the bucket if it exists and if it's not empty */
             if(bucket != NULL && !bucket_is_empty(bucket))
@@ -486,6 +645,37 @@ iterator_t* brickmanager_retrieve_active_bricks(const brickmanager_t* manager)
     );
 }
 
+/*
+ * brickmanager_retrieve_active_brick_batch()
+ * Retrieve a batch of the static bricks inside the current Region Of Interest (ROI).
+ * The batch is rebuilt only when the cells of the ROI change or when bricks are
+ * added or removed. It includes all bricks returned by
+ * brickmanager_retrieve_active_bricks() that are eligible for batching.
+ */
+const brickbatch_t* brickmanager_retrieve_active_brick_batch(brickmanager_t* manager)
+{
+    brickrect_t cells = roi_cells(&(manager->roi));
+
+    /* rebuild the batch if necessary */
+    if(
+        manager->is_batch_dirty ||
+        cells.left != manager->batch_cells.left ||
+        cells.top != manager->batch_cells.top ||
+        cells.right != manager->batch_cells.right ||
+        cells.bottom != manager->batch_cells.bottom
+    ) {
+        iterator_t* it = brickmanager_retrieve_active_bricks(manager);
+        brickbatch_rebuild(manager->batch, it);
+        iterator_destroy(it);
+
+        manager->batch_cells = cells;
+        manager->is_batch_dirty = false;
+    }
+
+    /* done! */
+    return manager->batch;
+}
+
 /*
  * brickmanager_retrieve_active_moving_bricks()
  * Efficiently retrieve moving bricks inside the current Region Of Interest (ROI)
@@ -501,18 +691,10 @@ iterator_t* brickmanager_retrieve_active_moving_bricks(const brickmanager_t* man
     const brickrect_t* roi = &(manager->roi);
 
     /* for each bucket inside the ROI */
-    int left = roi->left;
-    int top = roi->top;
-    int right = roi->right;
-    int bottom = roi->bottom;
-
-    right += GRID_SIZE - 1;
-    bottom += GRID_SIZE - 1;
-
-    for(int y = top; y <= bottom; y += GRID_SIZE) {
-        for(int x = left; x <= right; x += GRID_SIZE) {
-            uint64_t key = position_to_hash(x, y);
-            const brickbucket_t* bucket = fasthash_get(manager->hashtable, key);
+    brickrect_t cells = roi_cells(roi);
+    for(int y = cells.top; y <= cells.bottom; y++) {
+        for(int x = cells.left; x <= cells.right; x++) {
+            const brickbucket_t* bucket = grid_cell(manager, x, y);
 
             /* we must consider bricks with non-default behavior as "moving" */
             /* we add the bucket if it exists and if it's not empty */
@@ -538,6 +720,59 @@ iterator_t* brickmanager_retrieve_active_moving_bricks(const brickmanager_t* man
     );
 }
 
+/*
+ * brickmanager_retrieve_active_static_bricks()
+ * Efficiently retrieve the static bricks inside the cells of the current Region
+ * Of Interest (ROI). These are the bricks returned by brickmanager_retrieve_active_bricks()
+ * that are not returned by brickmanager_retrieve_active_moving_bricks()
+ */
+iterator_t* brickmanager_retrieve_active_static_bricks(const brickmanager_t* manager)
+{
+    /* create a new iterator state */
+    brickiteratorstate_t state = { .b = 0, .i = 0 };
+    state.own_bucket = bucket_ctor(brick_fake_destroy); /* a bucket of references only */
+    darray_init(state.bucket);
+
+    /* get the ROI */
+    const brickrect_t* roi = &(manager->roi);
+
+    /* for each bucket inside the ROI */
+    brickrect_t cells = roi_cells(roi);
+    for(int y = cells.top; y <= cells.bottom; y++) {
+        for(int x = cells.left; x <= cells.right; x++) {
+            const brickbucket_t* bucket = grid_cell(manager, x, y);
+
+            /* the awake bucket stores no static bricks */
+            if(bucket != NULL && !bucket_is_empty(bucket))
+                filter_default_bricks(state.own_bucket, bucket);
+        }
+    }
+
+    /* add own_bucket if it's not empty */
+    if(!bucket_is_empty(state.own_bucket))
+        darray_push(state.bucket, state.own_bucket);
+
+    /* return a new iterator */
+    return iterator_create(
+        &state,
+        brickiteratorstate_copy_ctor,
+        brickiteratorstate_dtor,
+        brickiteratorstate_next,
+        brickiteratorstate_has_next
+    );
+}
+
+/*
+ * brickmanager_active_static_bricks_version()
+ * A number that changes whenever brickmanager_retrieve_active_static_bricks()
+ * may return a different set of bricks, i.e., when the cells of the ROI change
+ * or when bricks are added or removed
+ */
+unsigned brickmanager_active_static_bricks_version(const brickmanager_t* manager)
+{
+    return manager->static_version;
+}
+
 /*
  * brickmanager_retrieve_all_bricks()
  * Retrieves all bricks
@@ -565,49 +800,233 @@ iterator_t* brickmanager_retrieve_all_bricks(const brickmanager_t* manager)
     );
 }
 
+/*
+ * brickmanager_active_bricks()
+ * The bricks inside the current Region Of Interest (ROI), as returned by
+ * brickmanager_retrieve_active_bricks(). The returned array is owned by the
+ * manager and is valid until the ROI changes or until bricks are added,
+ * removed or updated. It's computed at most once per frame and per ROI
+ */
+brick_t* const* brickmanager_active_bricks(brickmanager_t* manager, int* count)
+{
+    if(manager->is_active_span_dirty) {
+        brickrect_t cells = roi_cells(&(manager->roi));
+        darray_clear(manager->active_span);
+
+        /* the static bricks of the cells of the ROI */
+        for(int y = cells.top; y <= cells.bottom; y++) {
+            for(int x = cells.left; x <= cells.right; x++) {
+                const brickbucket_t* bucket = grid_cell(manager, x, y);
+
+                if(bucket != NULL) {
+                    for(int i = 0; i < darray_length(bucket->brick); i++)
+                        darray_push(manager->active_span, bucket->brick[i]);
+                }
+            }
+        }
+
+        /* the awake bricks inside the ROI */
+        const brickbucket_t* awake_bucket = manager->awake_bucket;
+        for(int i = 0; i < darray_length(awake_bucket->brick); i++) {
+            if(is_brick_inside_roi(awake_bucket->brick[i], &(manager->roi)))
+                darray_push(manager->active_span, awake_bucket->brick[i]);
+        }
+
+        manager->is_active_span_dirty = false;
+    }
+
+    *count = darray_length(manager->active_span);
+    return manager->active_span;
+}
+
+/*
+ * brickmanager_bricks_in_area()
+ * The bricks whose bounding box intersects the given area, found using the
+ * spatial index instead of scanning all bricks. The returned array is owned
+ * by the manager and is valid until the next call to this function
+ */
+brick_t* const* brickmanager_bricks_in_area(brickmanager_t* manager, rect_t area, int* count)
+{
+    brickrect_t rect = {
+        .top = area.y,
+        .left = area.x,
+        .bottom = area.y + max(area.height, 1) - 1,
+        .right = area.x + max(area.width, 1) - 1
+    };
+
+    /* a brick that intersects the area has its center
+       within half of its size from the area */
+    int margin = 1 + manager->max_brick_size / 2;
+    brickrect_t cells = {
+        .top = position_to_cell(rect.top - margin),
+        .left = position_to_cell(rect.left - margin),
+        .bottom = position_to_cell(rect.bottom + margin),
+        .right = position_to_cell(rect.right + margin)
+    };
+
+    darray_clear(manager->query_span);
+
+    /* the static bricks */
+    for(int y = cells.top; y <= cells.bottom; y++) {
+        for(int x = cells.left; x <= cells.right; x++) {
+            const brickbucket_t* bucket = grid_cell(manager, x, y);
+
+            if(bucket != NULL) {
+                for(int i = 0; i < darray_length(bucket->brick); i++) {
+                    if(is_brick_inside_roi(bucket->brick[i], &rect))
+                        darray_push(manager->query_span, bucket->brick[i]);
+                }
+            }
+        }
+    }
+
+    /* the awake bricks */
+    const brickbucket_t* awake_bucket = manager->awake_bucket;
+    for(int i = 0; i < darray_length(awake_bucket->brick); i++) {
+        if(is_brick_inside_roi(awake_bucket->brick[i], &rect))
+            darray_push(manager->query_span, awake_bucket->brick[i]);
+    }
+
+    *count = darray_length(manager->query_span);
+    return manager->query_span;
+}
+
+/*
+ * brickmanager_active_moving_bricks()
+ * The moving bricks inside the current Region Of Interest (ROI), as returned
+ * by brickmanager_retrieve_active_moving_bricks(). The returned array is owned
+ * by the manager and is valid until the ROI changes or until bricks are
+ * added, removed or updated
+ */
+brick_t* const* brickmanager_active_moving_bricks(brickmanager_t* manager, int* count)
+{
+    if(manager->is_moving_span_dirty) {
+        brickrect_t cells = roi_cells(&(manager->roi));
+        darray_clear(manager->moving_span);
+
+        /* we must consider bricks with non-default behavior as "moving" */
+        for(int y = cells.top; y <= cells.bottom; y++) {
+            for(int x = cells.left; x <= cells.right; x++) {
+                const brickbucket_t* bucket = grid_cell(manager, x, y);
+
+                if(bucket != NULL) {
+                    for(int i = 0; i < darray_length(bucket->brick); i++) {
+                        if(bucket->behavior[i] != BRB_DEFAULT)
+                            darray_push(manager->moving_span, bucket->brick[i]);
+                    }
+                }
+            }
+        }
+
+        /* the awake bricks inside the ROI */
+        const brickbucket_t* awake_bucket = manager->awake_bucket;
+        for(int i = 0; i < darray_length(awake_bucket->brick); i++) {
+            if(is_brick_inside_roi(awake_bucket->brick[i], &(manager->roi)))
+                darray_push(manager->moving_span, awake_bucket->brick[i]);
+        }
+
+        manager->is_moving_span_dirty = false;
+    }
+
+    *count = darray_length(manager->moving_span);
+    return manager->moving_span;
+}
+
+/*
+ * brickmanager_active_static_bricks()
+ * The static bricks inside the cells of the current Region Of Interest (ROI),
+ * as returned by brickmanager_retrieve_active_static_bricks(). The returned
+ * array is owned by the manager and is rebuilt only when
+ * brickmanager_active_static_bricks_version() changes
+ */
+brick_t* const* brickmanager_active_static_bricks(brickmanager_t* manager, int* count)
+{
+    if(!manager->has_static_span || manager->static_span_version != manager->static_version) {
+        brickrect_t cells = roi_cells(&(manager->roi));
+        darray_clear(manager->static_span);
+
+        /* the awake bucket stores no static bricks */
+        for(int y = cells.top; y <= cells.bottom; y++) {
+            for(int x = cells.left; x <= cells.right; x++) {
+                const brickbucket_t* bucket = grid_cell(manager, x, y);
+
+                if(bucket != NULL) {
+                    for(int i = 0; i < darray_length(bucket->brick); i++) {
+                        if(bucket->behavior[i] == BRB_DEFAULT)
+                            darray_push(manager->static_span, bucket->brick[i]);
+                    }
+                }
+            }
+        }
+
+        manager->static_span_version = manager->static_version;
+        manager->has_static_span = true;
+    }
+
+    *count = darray_length(manager->static_span);
+    return manager->static_span;
+}
+
 /*
  * brickmanager_retrieve_all_bricks_as_list()
- * Retrieves all bricks as a brick list
+ * Retrieves all bricks as a brick list. The list is owned by the manager
+ * and is valid until this function is called again
  */
-brick_list_t* brickmanager_retrieve_all_bricks_as_list(const brickmanager_t* manager)
+brick_list_t* brickmanager_retrieve_all_bricks_as_list(brickmanager_t* manager)
 {
-    iterator_t* it = brickmanager_retrieve_all_bricks(manager);
-    brick_list_t* list = NULL;
+    int count = 0;
 
-    while(iterator_has_next(it)) {
-        brick_t* brick = iterator_next(it);
-        list = add_to_list(list, brick);
+    /* reserve the nodes of the list */
+    for(int b = 0; b < darray_length(manager->bucket_ref); b++)
+        count += darray_length(manager->bucket_ref[b]->brick);
+
+    brick_list_t empty_node = { .data = NULL, .next = NULL };
+    darray_clear(manager->all_list_node);
+    for(int i = 0; i < count; i++)
+        darray_push(manager->all_list_node, empty_node);
+
+    /* fill the nodes */
+    int k = count;
+    for(int b = 0; b < darray_length(manager->bucket_ref); b++) {
+        const brickbucket_t* bucket = manager->bucket_ref[b];
+
+        for(int i = 0; i < darray_length(bucket->brick); i++) {
+            brick_list_t* node = &(manager->all_list_node[--k]);
+            node->data = bucket->brick[i];
+            node->next = (k + 1 < count) ? node + 1 : NULL;
+        }
     }
 
-    iterator_destroy(it);
-    return list;
+    return count > 0 ? manager->all_list_node : NULL;
 }
 
 /*
  * brickmanager_retrieve_active_bricks_as_list()
- * Retrieves bricks inside the ROI as a brick list
+ * Retrieves bricks inside the ROI as a brick list. The list is owned by
+ * the manager and is valid until this function is called again
  */
-brick_list_t* brickmanager_retrieve_active_bricks_as_list(const brickmanager_t* manager)
+brick_list_t* brickmanager_retrieve_active_bricks_as_list(brickmanager_t* manager)
 {
-    iterator_t* it = brickmanager_retrieve_active_bricks(manager);
-    brick_list_t* list = NULL;
+    int count;
+    brick_t* const* brick = brickmanager_active_bricks(manager, &count);
 
-    while(iterator_has_next(it)) {
-        brick_t* brick = iterator_next(it);
-        list = add_to_list(list, brick);
-    }
+    brick_list_t empty_node = { .data = NULL, .next = NULL };
+    darray_clear(manager->active_list_node);
+    for(int i = 0; i < count; i++)
+        darray_push(manager->active_list_node, empty_node);
 
-    iterator_destroy(it);
-    return list;
+    return build_list(manager->active_list_node, count, brick);
 }
 
 /*
  * brickmanager_release_list()
- * Releases a brick list
+ * Releases a brick list. The nodes are owned by the manager, so this just
+ * returns NULL; it's kept for backwards compatibility
  */
 brick_list_t* brickmanager_release_list(brick_list_t* list)
 {
-    return release_list(list);
+    (void)list;
+    return NULL;
 }
 
 
@@ -619,23 +1038,22 @@ brick_list_t* brickmanager_release_list(brick_list_t* list)
  */
 
 
-/* hashing utilities */
+/* grid utilities */
 
-uint64_t position_to_hash(int x, int y)
+int position_to_cell(int coordinate)
 {
-    if(x < 0)
-        x = 0;
+    if(coordinate < 0)
+        return 0;
 
-    if(y < 0)
-        y = 0;
+    coordinate /= GRID_SIZE;
 
-    x /= GRID_SIZE;
-    y /= GRID_SIZE;
+    if(coordinate >= GRID_MAX_CELLS)
+        return GRID_MAX_CELLS - 1;
 
-    return (((uint64_t)x) << 32) | ((uint64_t)y);
+    return coordinate;
 }
 
-uint64_t brick2hash(const brick_t* brick)
+void brick2cell(const brick_t* brick, int* cell_x, int* cell_y)
 {
     /* the spawn point does not change !!!
        the position may change and we do not keep track of position changes */
@@ -645,7 +1063,56 @@ uint64_t brick2hash(const brick_t* brick)
     int center_x = topleft.x + size.x * 0.5f;
     int center_y = topleft.y + size.y * 0.5f;
 
-    return position_to_hash(center_x, center_y);
+    *cell_x = position_to_cell(center_x);
+    *cell_y = position_to_cell(center_y);
+}
+
+brickbucket_t* grid_cell(const brickmanager_t* manager, int cell_x, int cell_y)
+{
+    /* cells outside the grid are empty */
+    if(cell_x >= manager->grid_width || cell_y >= manager->grid_height)
+        return NULL;
+
+    return manager->cell[cell_y * manager->grid_width + cell_x];
+}
+
+brickbucket_t* grid_create_cell(brickmanager_t* manager, int cell_x, int cell_y)
+{
+    /* grow the grid if necessary */
+    if(cell_x >= manager->grid_width || cell_y >= manager->grid_height) {
+        int new_width = max(manager->grid_width, cell_x + 1);
+        int new_height = max(manager->grid_height, cell_y + 1);
+        brickbucket_t** new_cell = mallocx(new_width * new_height * sizeof(*new_cell));
+
+        for(int y = 0; y < new_height; y++) {
+            for(int x = 0; x < new_width; x++)
+                new_cell[y * new_width + x] = grid_cell(manager, x, y);
+        }
+
+        free(manager->cell);
+        manager->cell = new_cell;
+        manager->grid_width = new_width;
+        manager->grid_height = new_height;
+    }
+
+    /* create a new bucket */
+    brickbucket_t* bucket = bucket_ctor(brick_destroy);
+    manager->cell[cell_y * manager->grid_width + cell_x] = bucket;
+    darray_push(manager->bucket_ref, bucket);
+
+    return bucket;
+}
+
+void grid_release(brickmanager_t* manager)
+{
+    for(int i = manager->grid_width * manager->grid_height - 1; i >= 0; i--) {
+        if(manager->cell[i] != NULL)
+            bucket_dtor(manager->cell[i]);
+    }
+
+    free(manager->cell);
+    manager->cell = NULL;
+    manager->grid_width = manager->grid_height = 0;
 }
 
 
@@ -658,6 +1125,8 @@ brickbucket_t* bucket_ctor(brick_t* (*brick_dtor)(brick_t*))
     brickbucket_t* bucket = mallocx(sizeof *bucket);
 
     darray_init(bucket->brick);
+    darray_init(bucket->spawnpoint);
+    darray_init(bucket->behavior);
     bucket->brick_dtor = brick_dtor;
 
     return bucket;
@@ -670,6 +1139,8 @@ brickbucket_t* bucket_dtor(brickbucket_t* bucket)
         bucket->brick_dtor(bucket->brick[i]);
 
     /* release the bucket */
+    darray_release(bucket->behavior);
+    darray_release(bucket->spawnpoint);
     darray_release(bucket->brick);
     free(bucket);
 
@@ -677,14 +1148,30 @@ brickbucket_t* bucket_dtor(brickbucket_t* bucket)
     return NULL;
 }
 
-void bucket_dtor_adapter(void* bucket)
+void bucket_add(brickbucket_t* bucket, brick_t* brick)
 {
-    bucket_dtor((brickbucket_t*)bucket);
+    darray_push(bucket->brick, brick);
+    darray_push(bucket->spawnpoint, brick_spawnpoint(brick));
+    darray_push(bucket->behavior, brick_behavior(brick));
 }
 
-void bucket_add(brickbucket_t* bucket, brick_t* brick)
+void bucket_add_from(brickbucket_t* bucket, const brickbucket_t* source_bucket, int index)
 {
-    darray_push(bucket->brick, brick);
+    darray_push(bucket->brick, source_bucket->brick[index]);
+    darray_push(bucket->spawnpoint, source_bucket->spawnpoint[index]);
+    darray_push(bucket->behavior, source_bucket->behavior[index]);
+}
+
+int bucket_remove_spawned_in(brickbucket_t* bucket, rect_t area)
+{
+    /* kill the bricks spawned in the area */
+    for(int i = 0; i < darray_length(bucket->brick); i++) {
+        if(rect_contains(area, bucket->spawnpoint[i]))
+            brick_kill(bucket->brick[i]);
+    }
+
+    /* remove them */
+    return bucket_wash(bucket);
 }
 
 int bucket_wash(brickbucket_t* bucket)
@@ -696,6 +1183,8 @@ int bucket_wash(brickbucket_t* bucket)
         if(!brick_is_alive(bucket->brick[i])) {
             bucket->brick_dtor(bucket->brick[i]);
             darray_remove(bucket->brick, i);
+            darray_remove(bucket->spawnpoint, i);
+            darray_remove(bucket->behavior, i);
             count++;
         }
     }
@@ -710,6 +1199,8 @@ void bucket_clear(brickbucket_t* bucket)
         bucket->brick_dtor(bucket->brick[i]);
 
     darray_clear(bucket->brick);
+    darray_clear(bucket->spawnpoint);
+    darray_clear(bucket->behavior);
 }
 
 bool bucket_is_empty(const brickbucket_t* bucket)
@@ -827,11 +1318,17 @@ heightsampler_t* sampler_ctor()
     darray_push(sampler->height_at, 0);
     darray_push(sampler->smooth_height_at, 0);
 
+    sampler->tree = NULL;
+    sampler->tree_capacity = 0;
+    sampler->dirty_left = 1;
+    sampler->dirty_right = 0;
+
     return sampler;
 }
 
 heightsampler_t* sampler_dtor(heightsampler_t* sampler)
 {
+    free(sampler->tree);
     darray_release(sampler->smooth_height_at);
     darray_release(sampler->height_at);
     free(sampler);
@@ -846,6 +1343,9 @@ void sampler_clear(heightsampler_t* sampler)
 
     darray_push(sampler->height_at, 0);
     darray_push(sampler->smooth_height_at, 0);
+
+    /* rebuild the tree on the next query */
+    sampler->tree_capacity = 0;
 }
 
 int sampler_query(heightsampler_t* sampler, int left, int right)
@@ -874,9 +1374,17 @@ int sampler_query(heightsampler_t* sampler, int left, int right)
     /* query the height at the given interval
        method: clamp to edge */
     int max_height = 0;
-    for(int i = l; i <= r; i++) {
-        if(sampler->smooth_height_at[i] > max_height)
-            max_height = sampler->smooth_height_at[i];
+    sampler_update_tree(sampler);
+    for(l += sampler->tree_capacity, r += sampler->tree_capacity + 1; l < r; l >>= 1, r >>= 1) {
+        if(l & 1) {
+            int height = sampler->tree[l++];
+            max_height = max(max_height, height);
+        }
+
+        if(r & 1) {
+            int height = sampler->tree[--r];
+            max_height = max(max_height, height);
+        }
     }
 
     /* done */
@@ -914,12 +1422,65 @@ void sampler_add(heightsampler_t* sampler, v2d_t topleft_position, v2d_t size)
         sampler->smooth_height_at[index] = sampler->height_at[index];
 
     /* fill smooth_height_at[] */
-    for(int j = index+1; j < darray_length(sampler->smooth_height_at); j++) {
+    int j;
+    for(j = index+1; j < darray_length(sampler->smooth_height_at); j++) {
         if(sampler->height_at[j] == 0)
             sampler->smooth_height_at[j] = sampler->smooth_height_at[j-1]; /* j >= 1 always */
         else
             break;
     }
+
+    /* smooth_height_at[index..j-1] may have changed */
+    if(sampler->dirty_left > sampler->dirty_right) {
+        sampler->dirty_left = index;
+        sampler->dirty_right = j-1;
+    }
+    else {
+        sampler->dirty_left = min(sampler->dirty_left, index);
+        sampler->dirty_right = max(sampler->dirty_right, j-1);
+    }
+}
+
+void sampler_update_tree(heightsampler_t* sampler)
+{
+    int length = darray_length(sampler->smooth_height_at);
+
+    /* rebuild the tree if it's too small */
+    if(length > sampler->tree_capacity) {
+        int capacity = 1;
+        while(capacity < length)
+            capacity *= 2;
+
+        free(sampler->tree);
+        sampler->tree = mallocx(2 * capacity * sizeof(*(sampler->tree)));
+        sampler->tree_capacity = capacity;
+
+        for(int j = 0; j < capacity; j++)
+            sampler->tree[capacity + j] = (j < length) ? sampler->smooth_height_at[j] : 0;
+        for(int k = capacity - 1; k >= 1; k--)
+            sampler->tree[k] = max(sampler->tree[2*k], sampler->tree[2*k+1]);
+
+        sampler->dirty_left = 1;
+        sampler->dirty_right = 0;
+        return;
+    }
+
+    /* update the changed interval and its ancestors */
+    if(sampler->dirty_left <= sampler->dirty_right) {
+        int left = sampler->tree_capacity + sampler->dirty_left;
+        int right = sampler->tree_capacity + sampler->dirty_right;
+
+        for(int k = left; k <= right; k++)
+            sampler->tree[k] = sampler->smooth_height_at[k - sampler->tree_capacity];
+
+        for(left >>= 1, right >>= 1; left >= 1; left >>= 1, right >>= 1) {
+            for(int k = left; k <= right; k++)
+                sampler->tree[k] = max(sampler->tree[2*k], sampler->tree[2*k+1]);
+        }
+
+        sampler->dirty_left = 1;
+        sampler->dirty_right = 0;
+    }
 }
 
 void sampler_add_brick(heightsampler_t* sampler, const brick_t* brick)
@@ -987,9 +1548,10 @@ void acknowledge_bricklike_objects(brickmanager_t* manager)
     surgescript_objectmanager_t* object_manager = surgescript_object_manager(level);
 
     /* acknowledge each brick-like object */
-    iterator_t* bricklike_iterator = entitymanager_bricklike_iterator(entity_manager);
-    while(iterator_has_next(bricklike_iterator)) {
-        surgescript_objecthandle_t* bricklike_handle = iterator_next(bricklike_iterator);
+    arrayiter_t bricklike_iterator;
+    entitymanager_bricklike_arrayiter(entity_manager, &bricklike_iterator);
+    while(arrayiter_has_next(&bricklike_iterator)) {
+        const surgescript_objecthandle_t* bricklike_handle = arrayiter_next(&bricklike_iterator);
 
         if(surgescript_objectmanager_exists(object_manager, *bricklike_handle)) {
             surgescript_object_t* bricklike_object = surgescript_objectmanager_get(object_manager, *bricklike_handle);
@@ -998,7 +1560,6 @@ void acknowledge_bricklike_objects(brickmanager_t* manager)
                 acknowledge_bricklike_object(manager, bricklike_object);
         }
     }
-    iterator_destroy(bricklike_iterator);
 }
 
 /* Acknowledge a brick-like object, so that we take it into account when
@@ -1040,17 +1601,23 @@ void filter_bricks_inside_roi(brickbucket_t* out_bucket, const brickbucket_t* in
         brick_t* brick = in_bucket->brick[i];
 
         if(is_brick_inside_roi(brick, roi))
-            bucket_add(out_bucket, brick); /* add a reference to the output bucket */
+            bucket_add_from(out_bucket, in_bucket, i); /* add a reference to the output bucket */
     }
 }
 
 void filter_non_default_bricks(brickbucket_t* out_bucket, const brickbucket_t* in_bucket)
 {
     for(int i = 0; i < darray_length(in_bucket->brick); i++) {
-        brick_t* brick = in_bucket->brick[i];
+        if(in_bucket->behavior[i] != BRB_DEFAULT)
+            bucket_add_from(out_bucket, in_bucket, i); /* add a reference to the output bucket */
+    }
+}
 
-        if(brick_behavior(brick) != BRB_DEFAULT)
-            bucket_add(out_bucket, brick); /* add a reference to the output bucket */
+void filter_default_bricks(brickbucket_t* out_bucket, const brickbucket_t* in_bucket)
+{
+    for(int i = 0; i < darray_length(in_bucket->brick); i++) {
+        if(in_bucket->behavior[i] == BRB_DEFAULT)
+            bucket_add_from(out_bucket, in_bucket, i); /* add a reference to the output bucket */
     }
 }
 
@@ -1066,29 +1633,45 @@ brick_t* brick_fake_destroy(brick_t* brick)
     return NULL;
 }
 
+/* the cells of the grid that are scanned when querying the given ROI */
+brickrect_t roi_cells(const brickrect_t* roi)
+{
+    /* we scan the cells at positions left + k * GRID_SIZE, k = 0, 1, 2...
+       up to right + GRID_SIZE - 1, and similarly for the rows */
+    int right = roi->left + GRID_SIZE * ((roi->right + GRID_SIZE - 1 - roi->left) / GRID_SIZE);
+    int bottom = roi->top + GRID_SIZE * ((roi->bottom + GRID_SIZE - 1 - roi->top) / GRID_SIZE);
+
+    return (brickrect_t){
+        .left = position_to_cell(roi->left),
+        .top = position_to_cell(roi->top),
+        .right = position_to_cell(right),
+        .bottom = position_to_cell(bottom)
+    };
+}
 
 
-/* legacy brick list routines for backwards compatibility */
 
-brick_list_t* add_to_list(brick_list_t* list, brick_t* brick)
+/* spans */
+
+void invalidate_spans(brickmanager_t* manager)
 {
-    /* add quickly to the linked list */
-    /* note that we're adding in reverse order */
-    brick_list_t* node = mallocx(sizeof *node);
-    node->data = brick;
-    node->next = list;
-    return node;
+    /* the static span is tracked by static_version */
+    manager->is_active_span_dirty = true;
+    manager->is_moving_span_dirty = true;
 }
 
-brick_list_t* release_list(brick_list_t* list)
+
+
+/* legacy brick list routines for backwards compatibility */
+
+brick_list_t* build_list(brick_list_t* node, int count, brick_t* const* brick)
 {
-    /* release linked list */
-    while(list != NULL) {
-        brick_list_t* next = list->next;
-        free(list);
-        list = next;
+    /* link the preallocated nodes. As in previous versions, the
+       bricks appear in the list in reverse order */
+    for(int i = 0; i < count; i++) {
+        node[i].data = brick[count - 1 - i];
+        node[i].next = (i + 1 < count) ? &node[i + 1] : NULL;
     }
 
-    /* done */
-    return NULL;
+    return count > 0 ? node : NULL;
 }
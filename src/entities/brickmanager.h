@@ -29,6 +29,7 @@ struct brickmanager_t;
 struct brick_list_t;
 struct brick_t;
 struct iterator_t;
+struct brickbatch_t;
 
 /* public API */
 brickmanager_t* brickmanager_create();
@@ -38,22 +39,33 @@ void brickmanager_update(brickmanager_t* manager);
 /* storage */
 void brickmanager_add_brick(brickmanager_t* manager, struct brick_t* brick);
 void brickmanager_remove_all_bricks(brickmanager_t* manager);
+int brickmanager_remove_bricks_in_area(brickmanager_t* manager, rect_t area); /* remove the bricks whose spawn point is inside the area */
 int brickmanager_number_of_bricks(const brickmanager_t* manager);
 
 /* retrieval */
 void brickmanager_set_roi(brickmanager_t* manager, rect_t roi); /* set region of interest (ROI) */
 struct iterator_t* brickmanager_retrieve_active_bricks(const brickmanager_t* manager); /* efficient retrieval based on a ROI */
+const struct brickbatch_t* brickmanager_retrieve_active_brick_batch(brickmanager_t* manager); /* batch of static bricks within the ROI */
 struct iterator_t* brickmanager_retrieve_active_moving_bricks(const brickmanager_t* manager); /* retrieve moving bricks within the ROI */
+struct iterator_t* brickmanager_retrieve_active_static_bricks(const brickmanager_t* manager); /* retrieve static bricks within the ROI */
+unsigned brickmanager_active_static_bricks_version(const brickmanager_t* manager); /* changes when the active static bricks change */
 struct iterator_t* brickmanager_retrieve_all_bricks(const brickmanager_t* manager);
 
+/* retrieval without allocations: the arrays are owned by the manager and are cached per frame */
+struct brick_t* const* brickmanager_active_bricks(brickmanager_t* manager, int* count); /* bricks within the ROI */
+struct brick_t* const* brickmanager_active_moving_bricks(brickmanager_t* manager, int* count); /* moving bricks within the ROI */
+struct brick_t* const* brickmanager_active_static_bricks(brickmanager_t* manager, int* count); /* static bricks within the ROI */
+struct brick_t* const* brickmanager_bricks_in_area(brickmanager_t* manager, rect_t area, int* count); /* bricks that intersect the area, regardless of the ROI */
+
 /* world size */
 void brickmanager_world_size(const brickmanager_t* manager, int* world_width, int* world_height);
 int brickmanager_world_height_at_interval(const brickmanager_t* manager, int left_xpos, int right_xpos); /* coordinates are inclusive */
 void brickmanager_recalculate_world_size(brickmanager_t* manager);
+void brickmanager_extend_world_size(brickmanager_t* manager, int min_world_width, int min_world_height);
 
 /* legacy brick list for backwards compatibility */
-struct brick_list_t* brickmanager_retrieve_all_bricks_as_list(const brickmanager_t* manager);
-struct brick_list_t* brickmanager_retrieve_active_bricks_as_list(const brickmanager_t* manager);
+struct brick_list_t* brickmanager_retrieve_all_bricks_as_list(brickmanager_t* manager); /* the list is owned by the manager */
+struct brick_list_t* brickmanager_retrieve_active_bricks_as_list(brickmanager_t* manager); /* the list is owned by the manager */
 struct brick_list_t* brickmanager_release_list(struct brick_list_t* list);
 
 #endif
\ No newline at end of file
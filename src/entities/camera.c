@@ -20,6 +20,7 @@
 
 #include <math.h>
 #include "camera.h"
+#include "actor.h"
 #include "../util/util.h"
 #include "../core/video.h"
 #include "../core/timer.h"
@@ -41,6 +42,26 @@ struct camera_t {
 
     /* locking the camera */
     bool is_locked; /* is the camera locked or can it move freely? */
+
+    /* velocity of the camera in px/s, measured on each update */
+    v2d_t velocity;
+
+    /* native controller: follows the camera focus of the level */
+    struct {
+        bool enabled; /* is the controller following the camera focus? */
+        bool overridden; /* has the position been set elsewhere since the last update? */
+        cameracontroller_params_t params; /* configuration */
+        v2d_t focus_position; /* position of the focus in the last update */
+        v2d_t focus_velocity; /* smoothed velocity of the focus, in px/s */
+        v2d_t look_ahead; /* current look-ahead offset */
+        bool has_focus; /* are focus_position & focus_velocity valid? */
+    } controller;
+
+    /* split-screen */
+    struct {
+        int count; /* number of views, including the camera itself */
+        v2d_t position[CAMERA_MAX_VIEWS]; /* position[0] is unused: view 0 is the camera */
+    } views;
 };
 
 static camera_t camera;
@@ -51,6 +72,18 @@ static inline void enable_boundaries();
 static inline void disable_boundaries();
 static inline v2d_t clip_to_boundaries(v2d_t position);
 static v2d_t clip_position(v2d_t position, float x1, float y1, float x2, float y2);
+static void run_controller(float dt);
+static inline float smoothing_factor(float time_constant, float dt);
+static inline float follow_axis(float position, float target, float dead_zone);
+
+/* default configuration of the native controller */
+static const cameracontroller_params_t DEFAULT_CONTROLLER_PARAMS = {
+    .dead_zone = { .x = 16.0f, .y = 64.0f }, /* in pixels */
+    .smoothing = 0.05f, /* in seconds */
+    .look_ahead_time = 0.25f, /* in seconds */
+    .max_look_ahead = { .x = 64.0f, .y = 0.0f }, /* in pixels */
+    .look_ahead_smoothing = 0.5f /* in seconds */
+};
 
 
 
@@ -67,6 +100,17 @@ void camera_init()
     camera.position = v2d_new(camera.boundaries.x1, camera.boundaries.y1);
     camera.target = camera.position;
     camera.speed = 0.0f;
+    camera.velocity = v2d_new(0.0f, 0.0f);
+
+    camera.controller.enabled = false;
+    camera.controller.overridden = false;
+    camera.controller.params = DEFAULT_CONTROLLER_PARAMS;
+    camera.controller.has_focus = false;
+    camera.controller.look_ahead = v2d_new(0.0f, 0.0f);
+
+    camera.views.count = 1;
+    for(int i = 0; i < CAMERA_MAX_VIEWS; i++)
+        camera.views.position[i] = camera.position;
 }
 
 /*
@@ -77,6 +121,7 @@ void camera_update()
 {
     const float threshold = 10.0f;
     float dt = timer_get_delta();
+    v2d_t previous_position = camera.position;
     v2d_t ds;
 
     /* updating the boundaries */
@@ -88,15 +133,28 @@ void camera_update()
         enable_boundaries();
 
     /* updating the camera position */
-    ds = v2d_subtract(camera.target, camera.position);
-    if(v2d_magnitude(ds) > threshold) {
-        ds = v2d_normalize(ds);
-        camera.position.x += ds.x * camera.speed * dt;
-        camera.position.y += ds.y * camera.speed * dt;
+    if(camera.controller.enabled && !level_editmode() && !level_is_in_debug_mode()) {
+        /* a position set by scripts takes precedence over the controller */
+        if(!camera.controller.overridden)
+            run_controller(dt);
+    }
+    else {
+        ds = v2d_subtract(camera.target, camera.position);
+        if(v2d_magnitude(ds) > threshold) {
+            ds = v2d_normalize(ds);
+            camera.position.x += ds.x * camera.speed * dt;
+            camera.position.y += ds.y * camera.speed * dt;
+        }
     }
 
+    camera.controller.overridden = false;
+
     /* clipping... */
     camera.position = clip_to_boundaries(camera.position);
+
+    /* measuring the velocity */
+    if(dt > 0.0f)
+        camera.velocity = v2d_multiply(v2d_subtract(camera.position, previous_position), 1.0f / dt);
 }
 
 /*
@@ -185,6 +243,131 @@ v2d_t camera_get_position()
 void camera_set_position(v2d_t position)
 {
     camera.position = camera.target = clip_to_boundaries(position);
+    camera.controller.overridden = true;
+}
+
+/*
+ * camera_get_velocity()
+ * The velocity of the camera in px/s, as measured in the last update
+ */
+v2d_t camera_get_velocity()
+{
+    return camera.velocity;
+}
+
+/*
+ * camera_enable_controller()
+ * Enables or disables the native controller, which makes the camera
+ * follow the camera focus of the level without any per-frame scripting
+ */
+void camera_enable_controller(bool enabled)
+{
+    if(enabled && !camera.controller.enabled) {
+        camera.controller.has_focus = false;
+        camera.controller.look_ahead = v2d_new(0.0f, 0.0f);
+    }
+
+    camera.controller.enabled = enabled;
+}
+
+/*
+ * camera_is_controller_enabled()
+ * Is the native controller enabled?
+ */
+bool camera_is_controller_enabled()
+{
+    return camera.controller.enabled;
+}
+
+/*
+ * camera_controller_params()
+ * The configuration of the native controller
+ */
+const cameracontroller_params_t* camera_controller_params()
+{
+    return &camera.controller.params;
+}
+
+/*
+ * camera_set_controller_params()
+ * Configures the native controller. Negative values are clipped to zero
+ */
+void camera_set_controller_params(const cameracontroller_params_t* params)
+{
+    cameracontroller_params_t* p = &camera.controller.params;
+
+    p->dead_zone.x = max(0.0f, params->dead_zone.x);
+    p->dead_zone.y = max(0.0f, params->dead_zone.y);
+    p->smoothing = max(0.0f, params->smoothing);
+    p->look_ahead_time = max(0.0f, params->look_ahead_time);
+    p->max_look_ahead.x = max(0.0f, params->max_look_ahead.x);
+    p->max_look_ahead.y = max(0.0f, params->max_look_ahead.y);
+    p->look_ahead_smoothing = max(0.0f, params->look_ahead_smoothing);
+}
+
+/*
+ * camera_view_count()
+ * The number of views of the level (split-screen)
+ */
+int camera_view_count()
+{
+    return camera.views.count;
+}
+
+/*
+ * camera_set_view_count()
+ * Splits the screen among the given number of views
+ */
+void camera_set_view_count(int count)
+{
+    camera.views.count = clip(count, 1, CAMERA_MAX_VIEWS);
+}
+
+/*
+ * camera_view_position()
+ * The position of a view, mapped to the center of its viewport
+ */
+v2d_t camera_view_position(int view_index)
+{
+    if(view_index <= 0 || view_index >= camera.views.count)
+        return camera_get_position();
+
+    v2d_t position = camera.views.position[view_index];
+    return v2d_new(floorf(position.x), floorf(position.y));
+}
+
+/*
+ * camera_set_view_position()
+ * Sets the position of a view. Setting the position of view 0
+ * is the same as setting the position of the camera
+ */
+void camera_set_view_position(int view_index, v2d_t position)
+{
+    if(view_index == 0)
+        camera_set_position(position);
+    else if(view_index > 0 && view_index < CAMERA_MAX_VIEWS)
+        camera.views.position[view_index] = clip_to_boundaries(position);
+}
+
+/*
+ * camera_view_viewport()
+ * The region of the screen of a view, in pixels
+ */
+rect_t camera_view_viewport(int view_index)
+{
+    int w = VIDEO_SCREEN_W, h = VIDEO_SCREEN_H;
+    int i = clip(view_index, 0, camera.views.count - 1);
+
+    switch(camera.views.count) {
+        case 1:
+            return rect_new(0, 0, w, h);
+
+        case 2:
+            return rect_new(0, i * (h / 2), w, h / 2);
+
+        default:
+            return rect_new((i % 2) * (w / 2), (i / 2) * (h / 2), w / 2, h / 2);
+    }
 }
 
 /*
@@ -225,6 +408,75 @@ bool camera_clip_test(v2d_t position)
 }
 
 /* private methods */
+
+/* makes the camera follow the camera focus of the level */
+void run_controller(float dt)
+{
+    const cameracontroller_params_t* params = &camera.controller.params;
+    const actor_t* focus = level_get_camera_focus();
+    v2d_t position;
+
+    if(focus == NULL || dt <= 0.0f)
+        return;
+
+    /* track the velocity of the focus */
+    position = focus->position;
+    if(camera.controller.has_focus) {
+        v2d_t velocity = v2d_multiply(v2d_subtract(position, camera.controller.focus_position), 1.0f / dt);
+        float k = smoothing_factor(params->look_ahead_smoothing, dt);
+
+        camera.controller.focus_velocity = v2d_lerp(camera.controller.focus_velocity, velocity, k);
+    }
+    else
+        camera.controller.focus_velocity = v2d_new(0.0f, 0.0f);
+
+    camera.controller.focus_position = position;
+
+    /* the focus is too far away (e.g., it has been teleported) */
+    if(!camera.controller.has_focus || v2d_magnitude(v2d_subtract(position, camera.position)) > 2 * VIDEO_SCREEN_W) {
+        camera.controller.has_focus = true;
+        camera.controller.look_ahead = v2d_new(0.0f, 0.0f);
+        camera.position = position;
+        return;
+    }
+
+    /* look ahead in the direction of movement */
+    v2d_t look_ahead = v2d_multiply(camera.controller.focus_velocity, params->look_ahead_time);
+    look_ahead.x = clip(look_ahead.x, -params->max_look_ahead.x, params->max_look_ahead.x);
+    look_ahead.y = clip(look_ahead.y, -params->max_look_ahead.y, params->max_look_ahead.y);
+    camera.controller.look_ahead = look_ahead;
+    position = v2d_add(position, look_ahead);
+
+    /* move within the dead zone and smooth things out */
+    float k = smoothing_factor(params->smoothing, dt);
+    camera.position.x += k * (follow_axis(camera.position.x, position.x, params->dead_zone.x) - camera.position.x);
+    camera.position.y += k * (follow_axis(camera.position.y, position.y, params->dead_zone.y) - camera.position.y);
+    camera.target = camera.position;
+}
+
+/* frame-rate independent exponential smoothing: the fraction of the way
+   to be covered in dt seconds, given a time constant (zero means no smoothing) */
+float smoothing_factor(float time_constant, float dt)
+{
+    if(time_constant <= 0.0f)
+        return 1.0f;
+
+    return 1.0f - expf(-dt / time_constant);
+}
+
+/* the position along an axis that brings the target inside the dead zone */
+float follow_axis(float position, float target, float dead_zone)
+{
+    float half = dead_zone * 0.5f;
+
+    if(target > position + half)
+        return target - half;
+    else if(target < position - half)
+        return target + half;
+    else
+        return position;
+}
+
 void define_boundaries(float x1, float y1, float x2, float y2)
 {
     camera.boundaries.x1 = x1;
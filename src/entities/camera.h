@@ -23,6 +23,7 @@
 
 #include <stdbool.h>
 #include "../util/v2d.h"
+#include "../util/rect.h"
 
 /* initializes the camera */
 void camera_init();
@@ -57,4 +58,35 @@ v2d_t camera_clip(v2d_t position);
 /* is the position inside the visible playfield? */
 bool camera_clip_test(v2d_t position);
 
+/* the velocity of the camera in px/s */
+v2d_t camera_get_velocity();
+
+/* native controller: follows the camera focus of the level with a dead zone,
+   smoothing and look-ahead. Positions set with camera_set_position() take
+   precedence over the controller in the frame they're set */
+typedef struct cameracontroller_params_t cameracontroller_params_t;
+struct cameracontroller_params_t {
+    v2d_t dead_zone; /* size of the box, centered on the camera, in which the focus can move freely (px) */
+    float smoothing; /* time constant of the movement of the camera (seconds); zero means no smoothing */
+    float look_ahead_time; /* look ahead this many seconds in the direction of movement of the focus */
+    v2d_t max_look_ahead; /* maximum look-ahead offset (px) */
+    float look_ahead_smoothing; /* time constant used to smooth the velocity of the focus (seconds) */
+};
+
+void camera_enable_controller(bool enabled);
+bool camera_is_controller_enabled();
+const cameracontroller_params_t* camera_controller_params();
+void camera_set_controller_params(const cameracontroller_params_t* params);
+
+/* split-screen: the level may be seen through multiple views. View 0 is the
+   camera itself; the positions of the other views are set explicitly. The
+   screen is split evenly among the views: two views are stacked vertically,
+   three or four views are laid out in quadrants */
+#define CAMERA_MAX_VIEWS 4
+int camera_view_count(); /* 1 by default */
+void camera_set_view_count(int count); /* 1 <= count <= CAMERA_MAX_VIEWS */
+v2d_t camera_view_position(int view_index); /* position of a view, mapped to the center of its viewport */
+void camera_set_view_position(int view_index, v2d_t position);
+rect_t camera_view_viewport(int view_index); /* region of the screen of a view, in pixels */
+
 #endif
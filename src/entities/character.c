@@ -22,6 +22,7 @@
 #include "../core/nanoparser.h"
 #include "../core/asset.h"
 #include "../core/audio.h"
+#include "../core/sprite.h"
 #include "../util/util.h"
 #include "../util/stringutil.h"
 #include "../util/hashtable.h"
@@ -33,6 +34,7 @@ static void character_delete(character_t* c); /* deletes c */
 static int dirfill(const char *vpath, void *param); /* file system callback */
 static void register_character(character_t *c); /* adds c to the hash table */
 static void validate_character(character_t *c); /* validates c */
+static void prepare_animation_cache(character_t *c); /* allocates the cache of resolved animations */
 
 static int traverse(const parsetree_statement_t *stmt, void* character_count);
 static int traverse_character(const parsetree_statement_t *stmt, void *character);
@@ -106,6 +108,26 @@ bool charactersystem_exists(const char* character_name)
     return c != NULL;
 }
 
+/*
+ * character_animation()
+ * Gets an animation of the sprite of a character. The lookup is cached in
+ * the character, so that all players of the same character share it.
+ * Crashes if the animation doesn't exist
+ */
+const struct animation_t* character_animation(const character_t* character, int anim_id)
+{
+    /* the cache is allocated beforehand; only its entries are written here */
+    if(anim_id >= 0 && anim_id < character->resolved_animation_count) {
+        if(character->resolved_animation[anim_id] == NULL)
+            character->resolved_animation[anim_id] = sprite_get_animation(character->animation.sprite_name, anim_id);
+
+        return character->resolved_animation[anim_id];
+    }
+
+    /* not an animation of the character */
+    return sprite_get_animation(character->animation.sprite_name, anim_id);
+}
+
 
 
 
@@ -163,6 +185,9 @@ character_t *character_new(const char *name)
     c->ability.charge = true;
     c->ability.brake = true;
 
+    c->resolved_animation = NULL;
+    c->resolved_animation_count = 0;
+
     return c;
 }
 
@@ -171,6 +196,7 @@ void character_delete(character_t* c)
     for(int i = 0; i < darray_length(c->companion_name); i++)
         free(c->companion_name[i]);
     darray_release(c->companion_name);
+    free(c->resolved_animation);
     free(c->animation.sprite_name);
     free(c->name);
     free(c);
@@ -188,9 +214,41 @@ int dirfill(const char *vpath, void *param)
 void register_character(character_t *c)
 {
     logfile_message("Registering character '%s'...", c->name);
+    prepare_animation_cache(c);
     hashtable_character_t_add(characters, c->name, c);
 }
 
+void prepare_animation_cache(character_t *c)
+{
+    /* we don't resolve the animations now, because the sprites may be
+       loaded lazily. We just make room for all of them */
+    int n = 0;
+    n = max(n, c->animation.stopped);
+    n = max(n, c->animation.walking);
+    n = max(n, c->animation.running);
+    n = max(n, c->animation.jumping);
+    n = max(n, c->animation.springing);
+    n = max(n, c->animation.rolling);
+    n = max(n, c->animation.pushing);
+    n = max(n, c->animation.gettinghit);
+    n = max(n, c->animation.dead);
+    n = max(n, c->animation.braking);
+    n = max(n, c->animation.ledge);
+    n = max(n, c->animation.drowned);
+    n = max(n, c->animation.breathing);
+    n = max(n, c->animation.waiting);
+    n = max(n, c->animation.ducking);
+    n = max(n, c->animation.lookingup);
+    n = max(n, c->animation.winning);
+    n = max(n, c->animation.ceiling);
+    n = max(n, c->animation.charging);
+
+    c->resolved_animation_count = n + 1;
+    c->resolved_animation = mallocx(c->resolved_animation_count * sizeof *(c->resolved_animation));
+    for(int i = 0; i < c->resolved_animation_count; i++)
+        c->resolved_animation[i] = NULL;
+}
+
 void validate_character(character_t *c)
 {
     if(str_icmp(c->name, "") == 0)
@@ -26,6 +26,7 @@
 
 /* forward declarations */
 struct sound_t;
+struct animation_t;
 
 /* character metadata */
 typedef struct character_t character_t;
@@ -85,6 +86,11 @@ struct character_t {
     } ability;
 
     DARRAY(char*, companion_name);
+
+    /* animations resolved on first use, shared by all players
+       of this character; indexed by animation number */
+    const struct animation_t** resolved_animation;
+    int resolved_animation_count;
 };
 
 /* initializes the character system */
@@ -99,4 +105,7 @@ const character_t* charactersystem_get(const char* character_name);
 /* checks if a character exists */
 bool charactersystem_exists(const char* character_name);
 
+/* gets an animation of the sprite of a character, caching the lookup */
+const struct animation_t* character_animation(const character_t* character, int anim_id);
+
 #endif
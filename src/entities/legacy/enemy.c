@@ -41,6 +41,7 @@
 #include "../../util/stringutil.h"
 #include "../../util/hashtable.h"
 #include "../../physics/collisionmask.h"
+#include "../../physics/physicsactor.h"
 #include "../../scenes/level.h"
 
 /* private stuff */
@@ -66,6 +67,29 @@ typedef struct { const char* category[MAX_CATEGORIES]; int length; } object_cate
 static int object_name_table_cmp(const void *a, const void *b);
 static int object_category_table_cmp(const void *a, const void *b);
 
+/* player proximity: the collision boxes of the team are united in a single box,
+   which is recomputed only when the state of a player that affects it changes */
+#define PROXIMITY_TEAM_MAX              16
+typedef struct proximitykey_t proximitykey_t;
+struct proximitykey_t {
+    const player_t* player;
+    v2d_t position;
+    physicsactorstate_t state;
+    movmode_t movmode;
+    int angle;
+    bool midair;
+    int frozen;
+};
+static struct {
+    proximitykey_t key[PROXIMITY_TEAM_MAX];
+    int team_size;
+    int64_t frame; /* recomputed at least once per frame */
+    float box[4]; /* x1, y1, x2, y2 */
+} proximity = { .team_size = -1, .frame = -1 };
+static inline proximitykey_t proximity_key(const player_t *player);
+static bool is_proximity_up_to_date(player_t **team, int team_size);
+static void update_proximity(player_t **team, int team_size);
+
 static enemy_t* create_from_script(const char *object_name);
 static int fill_object_names(const parsetree_statement_t *stmt, void *object_name_data);
 static int fill_object_categories(const parsetree_statement_t *stmt, void *object_category_data);
@@ -84,6 +108,20 @@ typedef parsetree_program_t objectcode_t;
 HASHTABLE_GENERATE_CODE(objectcode_t, NULL);
 static HASHTABLE(objectcode_t, lookup_table);
 
+HASHTABLE_GENERATE_CODE(objectprogram_t, objectcompiler_destroy_program);
+static HASHTABLE(objectprogram_t, program_table); /* the compiled objects, shared by their instances */
+static objectprogram_t* object_program(const char *object_name);
+
+static int is_profiling_enabled = FALSE;
+static void release_profile(objectprofile_t *profile);
+HASHTABLE_GENERATE_CODE(objectprofile_t, release_profile);
+static HASHTABLE(objectprofile_t, profile_table); /* profiling counters of each object */
+static objectprofile_t* object_profile(const char *object_name);
+typedef struct objectprofilelist_t { DARRAY(objectprofile_t*, profile); } objectprofilelist_t;
+static void collect_profile(objectprofile_t *profile, void *profile_list);
+static int profile_cmp(const void *a, const void *b);
+static void log_profiles();
+
 
 /* ------ public class methods ---------- */
 
@@ -120,6 +158,8 @@ void objects_init()
     lookup_table = hashtable_objectcode_t_create();
     for(i = 0; i < darray_length(objects); i++)
         nanoparser_traverse_program_ex(objects[i], (void*)lookup_table, fill_lookup_table);
+    program_table = hashtable_objectprogram_t_create();
+    profile_table = hashtable_objectprofile_t_create();
 
     /* done! */
     logfile_message("All legacy scripts have been loaded!");
@@ -133,6 +173,11 @@ void objects_release()
 {
     logfile_message("Releasing legacy scripts...");
 
+    if(is_profiling_enabled)
+        log_profiles();
+
+    profile_table = hashtable_objectprofile_t_destroy(profile_table);
+    program_table = hashtable_objectprogram_t_destroy(program_table);
     lookup_table = hashtable_objectcode_t_destroy(lookup_table);
     name_table.length = category_table.length = 0;
 
@@ -168,6 +213,20 @@ const char** objects_get_list_of_categories(int *n)
 
 
 
+/*
+ * objects_enable_profiling()
+ * Counts the state transitions, the commands, the nanocalc
+ * evaluations and the update time of the objects of each kind.
+ * A report is written to the log file when this module is released
+ */
+void objects_enable_profiling(int enable)
+{
+    is_profiling_enabled = enable;
+}
+
+
+
+
 /* ------ public instance methods ------- */
 
 
@@ -203,10 +262,6 @@ enemy_t *enemy_destroy(enemy_t *enemy)
     /* destroy my virtual machine */
     objectvm_destroy(enemy->vm);
 
-    /* destroy my categories */
-    if(enemy->category != NULL)
-        free(enemy->category);
-
     /* destroy my collision mask (if any) */
     if(enemy->mask != NULL)
         collisionmask_destroy(enemy->mask);
@@ -227,10 +282,9 @@ enemy_t *enemy_destroy(enemy_t *enemy)
  */
 void enemy_update(enemy_t *enemy, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, enemy_list_t *object_list)
 {
-    objectmachine_t *machine = *(objectvm_get_reference_to_current_state(enemy->vm));
     if(enemy->state == ES_DEAD) return;
     nanocalcext_set_target_object((object_t*)enemy, brick_list, item_list, object_list);
-    machine->update(machine, team, team_size, brick_list, item_list, object_list);
+    objectvm_update(enemy->vm, team, team_size, brick_list, item_list, object_list);
 }
 
 
@@ -338,6 +392,34 @@ void enemy_observe_active_player(enemy_t *enemy)
     enemy->observed_player = NULL;
 }
 
+/*
+ * enemy_may_collide_with_team()
+ * A broadphase for the collisions between the object and the players;
+ * returns FALSE only if player_collision() is FALSE for all of them
+ */
+int enemy_may_collide_with_team(const enemy_t *enemy, player_t **team, int team_size)
+{
+    const actor_t *act = enemy->actor;
+    const image_t *img = actor_image(act);
+    v2d_t topleft = v2d_subtract(act->position, act->hot_spot);
+    float box[4];
+
+    if(team_size <= 0)
+        return FALSE;
+    else if(team_size > PROXIMITY_TEAM_MAX)
+        return TRUE;
+
+    if(!is_proximity_up_to_date(team, team_size))
+        update_proximity(team, team_size);
+
+    box[0] = topleft.x;
+    box[1] = topleft.y;
+    box[2] = topleft.x + image_width(img);
+    box[3] = topleft.y + image_height(img);
+
+    return bounding_box(proximity.box, box);
+}
+
 /*
  * enemy_belongs_to_category()
  * checks if a given object belongs to a category
@@ -372,8 +454,8 @@ int enemy_exists(const char* object_name)
 
 enemy_t* create_from_script(const char *object_name)
 {
+    objectprogram_t* program = object_program(object_name);
     enemy_t* e = mallocx(sizeof *e);
-    objectcode_t *object_code;
 
     /* setup the object */
     e->name = str_dup(object_name);
@@ -391,7 +473,7 @@ enemy_t* create_from_script(const char *object_name)
     e->hide_unless_in_editor_mode = FALSE;
     e->detach_from_camera = FALSE;
     e->mask = NULL;
-    e->vm = objectvm_create(e);
+    e->vm = objectvm_create(e, objectcompiler_program_layout(program));
     e->created_from_editor = TRUE;
     e->parent = NULL;
     e->children = object_children_new();
@@ -399,17 +481,165 @@ enemy_t* create_from_script(const char *object_name)
     e->attached_to_player = FALSE;
     e->attached_to_player_offset = v2d_new(0,0);
 
-    /* Let's compile the object */
-    object_code = hashtable_objectcode_t_find(lookup_table, object_name);
-    if(object_code != NULL)
-        objectcompiler_compile(e, object_code);
-    else
-        fatal_error("Can't spawn \"%s\": the object does not exist!", object_name);
+    /* build the object from its compiled script */
+    objectcompiler_instantiate(program, e);
+
+    /* profiling */
+    if(is_profiling_enabled) {
+        objectprofile_t *profile = object_profile(object_name);
+        objectvm_set_profile(e->vm, profile);
+        profile->instances++;
+    }
 
     /* success! */
     return e;
 }
 
+/* the state of a player that may change its collision box within a frame */
+proximitykey_t proximity_key(const player_t *player)
+{
+    proximitykey_t key;
+
+    key.player = player;
+    key.position = player_position(player);
+    key.state = physicsactor_get_state(player->pa);
+    key.movmode = physicsactor_get_movmode(player->pa);
+    key.angle = physicsactor_get_angle(player->pa);
+    key.midair = physicsactor_is_midair(player->pa);
+    key.frozen = player_is_frozen(player);
+
+    return key;
+}
+
+/* is the united box of the team up to date? Objects may move the players */
+bool is_proximity_up_to_date(player_t **team, int team_size)
+{
+    if(team_size != proximity.team_size || timer_get_frames() != proximity.frame)
+        return false;
+
+    for(int i = 0; i < team_size; i++) {
+        proximitykey_t key = proximity_key(team[i]);
+        const proximitykey_t *cached = &(proximity.key[i]);
+
+        if(
+            key.player != cached->player ||
+            key.position.x != cached->position.x || key.position.y != cached->position.y ||
+            key.state != cached->state || key.movmode != cached->movmode ||
+            key.angle != cached->angle || key.midair != cached->midair ||
+            key.frozen != cached->frozen
+        )
+            return false;
+    }
+
+    return true;
+}
+
+/* recomputes the united box of the team */
+void update_proximity(player_t **team, int team_size)
+{
+    proximity.team_size = team_size;
+    proximity.frame = timer_get_frames();
+    proximity.box[0] = proximity.box[1] = INFINITY;
+    proximity.box[2] = proximity.box[3] = -INFINITY;
+
+    for(int i = 0; i < team_size; i++) {
+        float box[4];
+
+        proximity.key[i] = proximity_key(team[i]);
+        player_collision_box(team[i], box);
+
+        proximity.box[0] = min(proximity.box[0], box[0]);
+        proximity.box[1] = min(proximity.box[1], box[1]);
+        proximity.box[2] = max(proximity.box[2], box[2]);
+        proximity.box[3] = max(proximity.box[3], box[3]);
+    }
+}
+
+/* the compiled script of the given object, compiled when it's first spawned */
+objectprogram_t* object_program(const char *object_name)
+{
+    objectprogram_t* program = hashtable_objectprogram_t_find(program_table, object_name);
+
+    if(program == NULL) {
+        objectcode_t* object_code = hashtable_objectcode_t_find(lookup_table, object_name);
+        if(object_code == NULL)
+            fatal_error("Can't spawn \"%s\": the object does not exist!", object_name);
+
+        program = objectcompiler_compile_program(object_name, object_code);
+        hashtable_objectprogram_t_add(program_table, object_name, program);
+    }
+
+    return program;
+}
+
+/* the profiling counters of the given object */
+objectprofile_t* object_profile(const char *object_name)
+{
+    objectprofile_t* profile = hashtable_objectprofile_t_find(profile_table, object_name);
+
+    if(profile == NULL) {
+        profile = mallocx(sizeof *profile);
+        profile->name = str_dup(object_name);
+        profile->instances = 0;
+        profile->updates = 0;
+        profile->transitions = 0;
+        profile->commands = 0;
+        profile->evaluations = 0;
+        profile->time = 0.0;
+        hashtable_objectprofile_t_add(profile_table, object_name, profile);
+    }
+
+    return profile;
+}
+
+/* releases the profiling counters of an object */
+void release_profile(objectprofile_t *profile)
+{
+    free(profile->name);
+    free(profile);
+}
+
+/* adds a profile to a list */
+void collect_profile(objectprofile_t *profile, void *profile_list)
+{
+    objectprofilelist_t *list = (objectprofilelist_t*)profile_list;
+    darray_push(list->profile, profile);
+}
+
+/* sorts the profiles by time, decreasingly */
+int profile_cmp(const void *a, const void *b)
+{
+    const objectprofile_t *p = *((const objectprofile_t**)a);
+    const objectprofile_t *q = *((const objectprofile_t**)b);
+
+    if(p->time != q->time)
+        return p->time < q->time ? 1 : -1;
+    else
+        return str_icmp(p->name, q->name);
+}
+
+/* writes the profiling counters to the log file, the most expensive objects first */
+void log_profiles()
+{
+    objectprofilelist_t list;
+
+    darray_init(list.profile);
+    hashtable_objectprofile_t_foreach(profile_table, &list, collect_profile);
+    qsort(list.profile, darray_length(list.profile), sizeof(list.profile[0]), profile_cmp);
+
+    logfile_message("Profile of the legacy objects (%d kinds):", (int)darray_length(list.profile));
+    for(int i = 0; i < darray_length(list.profile); i++) {
+        const objectprofile_t *p = list.profile[i];
+        logfile_message(
+            "  \"%s\": %.3f ms, %d instances, %.0f updates, %.0f state transitions, %.0f commands, %.0f evaluations",
+            p->name, 1000.0 * p->time, p->instances, (double)p->updates,
+            (double)p->transitions, (double)p->commands, (double)p->evaluations
+        );
+    }
+
+    darray_release(list.profile);
+}
+
 int is_hidden_object(const char *name)
 {
     return name[0] == '.';
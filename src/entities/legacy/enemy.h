@@ -97,6 +97,9 @@ const char** objects_get_list_of_names(int *n);
 /* returns an array v[0..n-1] of available object categories */
 const char** objects_get_list_of_categories(int *n);
 
+/* counts the work of the objects of each kind and writes a report to the log file when this module is released */
+void objects_enable_profiling(int enable);
+
 
 
 /* ------ public instance methods: generic routines ------- */
@@ -146,6 +149,9 @@ void enemy_observe_current_player(enemy_t *enemy);
 /* observes the active player */
 void enemy_observe_active_player(enemy_t *enemy);
 
+/* broadphase: may the object be colliding with any player of the team? */
+int enemy_may_collide_with_team(const enemy_t *enemy, struct player_t **team, int team_size);
+
 /* checks if a given object belongs to a category */
 int enemy_belongs_to_category(enemy_t *enemy, const char *category);
 
@@ -26,6 +26,8 @@
 #include "enemy.h"
 #include "spatialhash.h"
 #include "../../util/util.h"
+#include "../../util/arena.h"
+#include "../../core/engine.h"
 
 /* defining the spatial hashes */
 SPATIALHASH_GENERATE_CODE(brick_t)
@@ -50,6 +52,8 @@ static int brick_count;
 static int item_count;
 static int object_count;
 
+static bool is_world_size_known;
+
 static void add_to_dead_bricks_list(brick_t *brick);
 static void add_to_dead_items_list(item_t *item);
 static void add_to_dead_objects_list(enemy_t *object);
@@ -92,6 +96,8 @@ void entitymanager_init()
     item_count = 0;
     object_count = 0;
 
+    is_world_size_known = false;
+
     bricks = spatialhash_brick_t_create(brick_destroy, get_brick_xpos, get_brick_ypos, get_brick_width, get_brick_height);
     items = spatialhash_item_t_create(item_destroy, get_item_xpos, get_item_ypos, get_item_width, get_item_height);
     objects = spatialhash_enemy_t_create(enemy_destroy, get_object_xpos, get_object_ypos, get_object_width, get_object_height);
@@ -132,6 +138,27 @@ void entitymanager_store_object(enemy_t *object)
     object_count++;
 }
 
+void entitymanager_set_world_size(int world_width, int world_height)
+{
+    /* the world size is unknown if there are no bricks */
+    if(world_width >= LARGE_INT || world_height >= LARGE_INT)
+        return;
+
+    /* the grids are estimates until we know the actual size of the world.
+       From then on, we only rebuild them (rarely) if the world grows */
+    if(!is_world_size_known) {
+        spatialhash_brick_t_refit(bricks, world_width, world_height);
+        spatialhash_item_t_refit(items, world_width, world_height);
+        spatialhash_enemy_t_refit(objects, world_width, world_height);
+        is_world_size_known = true;
+    }
+    else {
+        spatialhash_brick_t_fit(bricks, world_width, world_height);
+        spatialhash_item_t_fit(items, world_width, world_height);
+        spatialhash_enemy_t_fit(objects, world_width, world_height);
+    }
+}
+
 void entitymanager_set_active_region(rect_t roi)
 {
     active_rectangle_xpos = roi.x;
@@ -220,40 +247,22 @@ enemy_list_t* entitymanager_retrieve_all_objects()
 
 brick_list_t* entitymanager_release_retrieved_brick_list(brick_list_t *list)
 {
-    brick_list_t *next;
-
-    while(list != NULL) {
-        next = list->next;
-        free(list);
-        list = next;
-    }
-
+    /* the nodes live in the scratch memory of the frame */
+    (void)list;
     return NULL;
 }
 
 item_list_t* entitymanager_release_retrieved_item_list(item_list_t *list)
 {
-    item_list_t *next;
-
-    while(list != NULL) {
-        next = list->next;
-        free(list);
-        list = next;
-    }
-
+    /* the nodes live in the scratch memory of the frame */
+    (void)list;
     return NULL;
 }
 
 enemy_list_t* entitymanager_release_retrieved_object_list(enemy_list_t *list)
 {
-    enemy_list_t *next;
-
-    while(list != NULL) {
-        next = list->next;
-        free(list);
-        list = next;
-    }
-
+    /* the nodes live in the scratch memory of the frame */
+    (void)list;
     return NULL;
 }
 
@@ -381,7 +390,7 @@ int retrieve_nonpersistent_bricks(brick_t *brick, void *ref_to_brick_list)
 
     if(brick_is_alive(brick)) {
         if(!IS_MOVING_BRICK(brick)) { /* faster than if(!spatialhash_brick_t_is_persistent(bricks, brick)) { */
-            brick_list_t *p = mallocx(sizeof *p);
+            brick_list_t *p = arena_alloc(engine_frame_arena(), sizeof *p);
             p->data = brick;
             p->next = *list;
             *list = p;
@@ -398,7 +407,7 @@ int retrieve_bricks(brick_t *brick, void *ref_to_brick_list)
     brick_list_t **list = (brick_list_t**)ref_to_brick_list;
 
     if(brick_is_alive(brick)) {
-        brick_list_t *p = mallocx(sizeof *p);
+        brick_list_t *p = arena_alloc(engine_frame_arena(), sizeof *p);
         p->data = brick;
         p->next = *list;
         *list = p;
@@ -414,7 +423,7 @@ int retrieve_items(item_t *item, void *ref_to_item_list)
     item_list_t **list = (item_list_t**)ref_to_item_list;
 
     if(item->state != IS_DEAD) {
-        item_list_t *p = mallocx(sizeof *p);
+        item_list_t *p = arena_alloc(engine_frame_arena(), sizeof *p);
         p->data = item;
         p->next = *list;
         *list = p;
@@ -430,7 +439,7 @@ int retrieve_objects(enemy_t *object, void *ref_to_object_list)
     enemy_list_t **list = (enemy_list_t**)ref_to_object_list;
 
     if(object->state != ES_DEAD) {
-        enemy_list_t *p = mallocx(sizeof *p);
+        enemy_list_t *p = arena_alloc(engine_frame_arena(), sizeof *p);
         p->data = object;
         p->next = *list;
         *list = p;
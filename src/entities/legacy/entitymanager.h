@@ -41,6 +41,9 @@ void entitymanager_store_brick(struct brick_t *brick);
 void entitymanager_store_item(struct item_t *item);
 void entitymanager_store_object(struct enemy_t *object);
 
+/* the spatial partitioning adapts to the size of the world, in pixels */
+void entitymanager_set_world_size(int world_width, int world_height);
+
 /* retrieving active entities efficiently */
 void entitymanager_set_active_region(rect_t roi);
 struct brick_list_t* entitymanager_retrieve_active_bricks();
@@ -53,7 +56,8 @@ struct brick_list_t* entitymanager_retrieve_all_bricks();
 struct item_list_t* entitymanager_retrieve_all_items();
 struct enemy_list_t* entitymanager_retrieve_all_objects();
 
-/* after you retrieve a list of entities, you must release that list */
+/* after you retrieve a list of entities, you must release that list. The lists are
+   stored in the scratch memory of the frame, so don't keep them across frames */
 struct brick_list_t* entitymanager_release_retrieved_brick_list(struct brick_list_t *list);
 struct item_list_t* entitymanager_release_retrieved_item_list(struct item_list_t *list);
 struct enemy_list_t* entitymanager_release_retrieved_object_list(struct enemy_list_t *list);
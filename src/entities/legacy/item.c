@@ -552,6 +552,7 @@ item_t *item_create(int type)
     if(item != NULL) {
         item->type = type;
         item->state = IS_IDLE;
+        item->update_type = IU_INTERACTIVE;
         item->init(item);
         item->mask = item->obstacle ? collisionmask_create_box(
             image_width(actor_image(item->actor)),
@@ -599,7 +600,9 @@ void item_render(item_t *item, v2d_t camera_position)
  */
 void item_update(item_t *item, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, enemy_list_t *enemy_list)
 {
-    item->update(item, team, team_size, brick_list, item_list, enemy_list);
+    /* items that are static or that only animate are asleep */
+    if(item->update_type == IU_INTERACTIVE)
+        item->update(item, team, team_size, brick_list, item_list, enemy_list);
 }
 
 
@@ -1586,8 +1589,10 @@ void checkpointorb_update(item_t* item, player_t** team, int team_size, brick_li
         }
     }
     else {
-        if(actor_animation_finished(act))
+        if(actor_animation_finished(act)) {
             actor_change_animation(act, sprite_get_animation("SD_CHECKPOINT", 2));
+            item->update_type = IU_ANIMATED; /* nothing else to do */
+        }
     }
 }
 
@@ -1751,6 +1756,7 @@ void crushedbox_init(item_t *item)
     item->obstacle = FALSE;
     item->bring_to_back = TRUE;
     item->preserve = TRUE;
+    item->update_type = IU_ANIMATED;
     item->actor = actor_create();
 
     actor_change_animation(item->actor, sprite_get_animation("SD_ITEMBOX", 10));
@@ -2263,6 +2269,7 @@ void endsign_update(item_t* item, player_t** team, int team_size, brick_list_t*
                 anim_id = 5;
 
             actor_change_animation(act, sprite_get_animation("SD_ENDSIGN", anim_id));
+            item->update_type = IU_ANIMATED; /* nothing else to do */
         }
     }
 }
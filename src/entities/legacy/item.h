@@ -121,6 +121,7 @@ struct enemy_list_t;
 typedef struct item_t item_t;
 typedef struct item_list_t item_list_t;
 typedef enum itemstate_t itemstate_t;
+typedef enum itemupdatetype_t itemupdatetype_t;
 
 /* item state */
 enum itemstate_t {
@@ -128,6 +129,13 @@ enum itemstate_t {
     IS_DEAD           /* dead items are automatically removed from the item list */
 };
 
+/* does the item need to be updated every frame? */
+enum itemupdatetype_t {
+    IU_INTERACTIVE,   /* interacts with the world: updated every frame (default) */
+    IU_ANIMATED,      /* only animates: the animation is advanced with time when rendering; not updated */
+    IU_STATIC         /* does nothing: not updated */
+};
+
 /* <<abstract>> item class */
 struct item_t {
     /* abstract methods */
@@ -139,6 +147,7 @@ struct item_t {
     /* properties of this item */
     struct actor_t* actor; /* actor */
     itemstate_t state; /* item state */
+    itemupdatetype_t update_type; /* an item may change it at any time, e.g., to go to sleep */
     int type; /* item type */
     int obstacle; /* is this item an obstacle? (i.e., is it not passable?) */
     int preserve; /* should we delete this item when it's outside the screen? */
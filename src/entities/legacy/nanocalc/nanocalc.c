@@ -113,116 +113,124 @@ char *nanocalc_interpolate_string(const char *str, symboltable_t *symbol_table)
 
 /* ============ SYMBOL TABLE ============== */
 
-/* data structure: variables are stored in a linked list */
-/* we estimate that each symbol table in an object will hold a small number of variables */
-typedef struct association_t association_t;
-struct association_t {
-    char *key;
-    float value;
-    association_t *next;
+/* data structure: variables are stored in a flat array of values, addressed by slot.
+   The names of the slots belong to a layout, which may be shared by many symbol tables
+   (e.g., by all instances of a legacy object). Compiled expressions address the slots
+   by index, so slots are never removed from a layout; clearing a table just marks its
+   variables as undefined */
+struct symbollayout_t {
+    char **key; /* name of each slot */
+    int length;
+    int capacity;
+    int refs; /* reference counter */
 };
 
 struct symboltable_t {
-    association_t *data;
+    symbollayout_t *layout;
+    float *value; /* value of each slot */
+    unsigned char *defined; /* is the variable of each slot defined? */
+    int capacity; /* slots beyond the capacity are undefined */
 };
 
 static symboltable_t* global_st = NULL; /* fixed, global symbol table */
 #define IS_GLOBAL_VARIABLE(varname) (*((varname)+1) == '_') /* vars starting with '_' are global */
+static int symboltable_find_slot(const symboltable_t *st, const char *key);
+static int symboltable_get_slot(symboltable_t *st, const char *key);
+static inline float symboltable_load(const symboltable_t *st, int slot);
+static inline void symboltable_store(symboltable_t *st, int slot, float value);
+static void symboltable_reserve(symboltable_t *st, int slot);
+
+/* creates a new layout */
+symbollayout_t *symbollayout_new()
+{
+    symbollayout_t *layout = malloc_x(sizeof *layout);
+    layout->key = NULL;
+    layout->length = 0;
+    layout->capacity = 0;
+    layout->refs = 1;
+    return layout;
+}
+
+/* releases a reference to a layout */
+void symbollayout_destroy(symbollayout_t *layout)
+{
+    int i;
+
+    if(--layout->refs > 0)
+        return;
+
+    for(i=0; i<layout->length; i++)
+        free(layout->key[i]);
+
+    free(layout->key);
+    free(layout);
+}
 
 /* creates a new symbol table */
 symboltable_t *symboltable_new()
+{
+    symbollayout_t *layout = symbollayout_new();
+    symboltable_t *st = symboltable_new_with_layout(layout);
+    symbollayout_destroy(layout); /* the table holds a reference */
+    return st;
+}
+
+/* creates a new symbol table with a shared layout */
+symboltable_t *symboltable_new_with_layout(symbollayout_t *layout)
 {
     symboltable_t *st = malloc_x(sizeof *st);
-    st->data = NULL;
+    st->layout = layout;
+    st->value = NULL;
+    st->defined = NULL;
+    st->capacity = 0;
+    layout->refs++;
     return st;
 }
 
 /* destroys an existing symbol table */
 void symboltable_destroy(symboltable_t *st)
 {
-    symboltable_clear(st);
+    symbollayout_destroy(st->layout);
+    free(st->defined);
+    free(st->value);
     free(st);
 }
 
 /* clears an existing symbol table */
 void symboltable_clear(symboltable_t *st)
 {
-    association_t *node, *next;
+    int i;
 
-    for(node=st->data; node!=NULL; node=next) {
-        next = node->next;
-        free(node->key);
-        free(node);
+    for(i=0; i<st->capacity; i++) {
+        st->value[i] = 0.0f;
+        st->defined[i] = 0;
     }
-
-    st->data = NULL;
 }
 
 /* adds or updates an association */
 void symboltable_set(symboltable_t *st, const char *key, float value)
 {
-    association_t *node, *prev = NULL;
-
     /* global variable? */
     if(IS_GLOBAL_VARIABLE(key))
         st = symboltable_get_global_table();
     if(!st) return;
 
-    /* searching... */
-    for(node=st->data; node!=NULL; node=node->next) {
-        if(strcmp(node->key, key) == 0) {
-            node->value = value;
-            return;
-        }
-        prev = node;
-    }
-
-    node = malloc_x(sizeof *node);
-    node->key = str_dup(key);
-    node->value = value;
-    node->next = NULL;
-
-    if(prev != NULL)
-        prev->next = node;
-    else
-        st->data = node;
+    symboltable_store(st, symboltable_get_slot(st, key), value);
 }
 
 /* gets the value of an association */
 float symboltable_get(symboltable_t *st, const char *key)
 {
-    association_t *node;
+    int index;
 
     /* global variable? */
     if(IS_GLOBAL_VARIABLE(key))
         st = symboltable_get_global_table();
     if(!st) return 0.0f;
 
-    /* searching... */
-    if(!IS_GLOBAL_VARIABLE(key)) {
-        /* linear search */
-        for(node=st->data; node; node=node->next) {
-            if(strcmp(node->key, key) == 0)
-                return node->value;
-        }
-    }
-    else {
-        /* linear search + MoveToFront heuristic for linked lists */
-        association_t *prev = NULL;
-        for(node=st->data; node; node=node->next) {
-            if(strcmp(node->key, key) == 0) {
-                float value = node->value;
-                if(prev != NULL) {
-                    prev->next = node->next;
-                    node->next = st->data;
-                    st->data = node;
-                }
-                return value;
-            }
-            else
-                prev = node;
-        }
-    }
+    /* undefined variables are zero */
+    if((index = symboltable_find_slot(st, key)) >= 0)
+        return symboltable_load(st, index);
 
     /* element not found */
     return 0.0f;
@@ -231,7 +239,7 @@ float symboltable_get(symboltable_t *st, const char *key)
 /* does the given variable exist? */
 int symboltable_is_defined(symboltable_t *st, const char *key)
 {
-    association_t *node;
+    int index;
 
     /* global variable? */
     if(IS_GLOBAL_VARIABLE(key))
@@ -239,14 +247,91 @@ int symboltable_is_defined(symboltable_t *st, const char *key)
     if(!st) return 0;
 
     /* searching... */
-    for(node=st->data; node!=NULL; node=node->next) {
-        if(strcmp(node->key, key) == 0)
-            return 1;
-    }
+    if((index = symboltable_find_slot(st, key)) >= 0)
+        return index < st->capacity && st->defined[index];
 
     return 0; /* element not found */
 }
 
+/* finds the slot of a variable in the layout of the given table, returning -1 if there is no such slot */
+int symboltable_find_slot(const symboltable_t *st, const char *key)
+{
+    const symbollayout_t *layout = st->layout;
+    int i;
+
+    for(i=0; i<layout->length; i++) {
+        if(strcmp(layout->key[i], key) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+/* finds the slot of a variable in the layout of the given table, creating a slot if there is none */
+int symboltable_get_slot(symboltable_t *st, const char *key)
+{
+    symbollayout_t *layout = st->layout;
+    int index = symboltable_find_slot(st, key);
+
+    if(index < 0) {
+        if(layout->length >= layout->capacity) {
+            char **k;
+            layout->capacity = (layout->capacity > 0) ? 2 * layout->capacity : 4;
+            k = realloc(layout->key, layout->capacity * sizeof(*k));
+            if(k == NULL)
+                error(__FILE__ ": Out of memory");
+            layout->key = k;
+        }
+
+        index = layout->length++;
+        layout->key[index] = str_dup(key);
+    }
+
+    return index;
+}
+
+/* reads the value of a slot */
+float symboltable_load(const symboltable_t *st, int slot)
+{
+    return slot < st->capacity ? st->value[slot] : 0.0f;
+}
+
+/* writes the value of a slot, defining its variable */
+void symboltable_store(symboltable_t *st, int slot, float value)
+{
+    if(slot >= st->capacity)
+        symboltable_reserve(st, slot);
+
+    st->value[slot] = value;
+    st->defined[slot] = 1;
+}
+
+/* makes room for the given slot. The layout may
+   have grown since the values were allocated */
+void symboltable_reserve(symboltable_t *st, int slot)
+{
+    int capacity = st->layout->capacity, i;
+    float *value;
+    unsigned char *defined;
+
+    if(capacity <= slot)
+        capacity = slot + 1;
+
+    value = realloc(st->value, capacity * sizeof(*value));
+    defined = realloc(st->defined, capacity * sizeof(*defined));
+    if(value == NULL || defined == NULL)
+        error(__FILE__ ": Out of memory");
+
+    for(i=st->capacity; i<capacity; i++) {
+        value[i] = 0.0f;
+        defined[i] = 0;
+    }
+
+    st->value = value;
+    st->defined = defined;
+    st->capacity = capacity;
+}
+
 /* returns a fixed, global symbol table */
 symboltable_t *symboltable_get_global_table()
 {
@@ -263,6 +348,7 @@ symboltable_t *symboltable_get_global_table()
 typedef struct bif_t bif_t;
 struct bif_t {
     int arity;
+    int pure; /* no side effects and the result depends only on the arguments */
     union {
         float (*arity0)();
         float (*arity1)(float);
@@ -314,11 +400,22 @@ static bif_t* bif_find(const char *name)
     return bif;
 }*/
 
+static void bif_declare_pure(const char *name)
+{
+    bif_t *fun = bif_find(name);
+
+    if(fun != NULL)
+        fun->pure = 1;
+    else
+        error("Can't find built-in function '%s'", name);
+}
+
 static void bif_register_arity0(const char *name, float (*fun)())
 {
     if(bif_length < BIF_CAPACITY) {
         if(!bif_find(name)) {
             bif[bif_length].name = str_dup(name);
+            bif[bif_length].fun.pure = 0;
             bif[bif_length].fun.arity = 0;
             bif[bif_length].fun.call.arity0 = fun;
             bif_length++;
@@ -335,6 +432,7 @@ static void bif_register_arity1(const char *name, float (*fun)(float))
     if(bif_length < BIF_CAPACITY) {
         if(!bif_find(name)) {
             bif[bif_length].name = str_dup(name);
+            bif[bif_length].fun.pure = 0;
             bif[bif_length].fun.arity = 1;
             bif[bif_length].fun.call.arity1 = fun;
             bif_length++;
@@ -351,6 +449,7 @@ static void bif_register_arity2(const char *name, float (*fun)(float,float))
     if(bif_length < BIF_CAPACITY) {
         if(!bif_find(name)) {
             bif[bif_length].name = str_dup(name);
+            bif[bif_length].fun.pure = 0;
             bif[bif_length].fun.arity = 2;
             bif[bif_length].fun.call.arity2 = fun;
             bif_length++;
@@ -367,6 +466,7 @@ static void bif_register_arity3(const char *name, float (*fun)(float,float,float
     if(bif_length < BIF_CAPACITY) {
         if(!bif_find(name)) {
             bif[bif_length].name = str_dup(name);
+            bif[bif_length].fun.pure = 0;
             bif[bif_length].fun.arity = 3;
             bif[bif_length].fun.call.arity3 = fun;
             bif_length++;
@@ -383,6 +483,7 @@ static void bif_register_arity4(const char *name, float (*fun)(float,float,float
     if(bif_length < BIF_CAPACITY) {
         if(!bif_find(name)) {
             bif[bif_length].name = str_dup(name);
+            bif[bif_length].fun.pure = 0;
             bif[bif_length].fun.arity = 4;
             bif[bif_length].fun.call.arity4 = fun;
             bif_length++;
@@ -709,6 +810,7 @@ static exprtree_t* exprtree_function_arity0_new(float (*fun)())
 {
     exprtree_function_t *node = malloc_x(sizeof *node);
     node->fun.arity = 0;
+    node->fun.pure = 0;
     node->fun.call.arity0 = fun;
     node->param[0] = NULL;
     node->param[1] = NULL;
@@ -723,6 +825,7 @@ static exprtree_t* exprtree_function_arity1_new(float (*fun)(float), exprtree_t
 {
     exprtree_function_t *node = malloc_x(sizeof *node);
     node->fun.arity = 1;
+    node->fun.pure = 0;
     node->fun.call.arity1 = fun;
     node->param[0] = param0;
     node->param[1] = NULL;
@@ -737,6 +840,7 @@ static exprtree_t* exprtree_function_arity2_new(float (*fun)(float,float), exprt
 {
     exprtree_function_t *node = malloc_x(sizeof *node);
     node->fun.arity = 2;
+    node->fun.pure = 0;
     node->fun.call.arity2 = fun;
     node->param[0] = param0;
     node->param[1] = param1;
@@ -751,6 +855,7 @@ static exprtree_t* exprtree_function_arity3_new(float (*fun)(float,float,float),
 {
     exprtree_function_t *node = malloc_x(sizeof *node);
     node->fun.arity = 3;
+    node->fun.pure = 0;
     node->fun.call.arity3 = fun;
     node->param[0] = param0;
     node->param[1] = param1;
@@ -765,6 +870,7 @@ static exprtree_t* exprtree_function_arity4_new(float (*fun)(float,float,float,f
 {
     exprtree_function_t *node = malloc_x(sizeof *node);
     node->fun.arity = 4;
+    node->fun.pure = 0;
     node->fun.call.arity4 = fun;
     node->param[0] = param0;
     node->param[1] = param1;
@@ -1284,6 +1390,7 @@ exprtree_t* parser_read_factor()
             me = exprtree_function_arity0_new(fun->call.arity0);
         }
 
+        ((exprtree_function_t*)me)->fun.pure = fun->pure;
         parser_expect(TOK_RPAREN);
         free(op);
         break;
@@ -1324,11 +1431,597 @@ static exprtree_t* parse(const char *expression_string, symboltable_t *symbol_ta
 
 
 
+/* =============== OPTIMIZER ============================ */
+
+static int is_constant(const exprtree_t *tree)
+{
+    return tree->eval == exprtree_number_eval;
+}
+
+/* replaces a tree whose value is known at parse time by a number */
+static exprtree_t* fold(exprtree_t *tree)
+{
+    float value = tree->eval(tree);
+    tree->del(tree);
+    return exprtree_number_new(value);
+}
+
+/* folds constant subtrees and calls of pure BIFs with constant arguments */
+static exprtree_t* optimize(exprtree_t *tree)
+{
+    if(tree->eval == exprtree_unaryop_eval) {
+        exprtree_unaryop_t *node = (exprtree_unaryop_t*)tree;
+
+        node->expression = optimize(node->expression);
+        if(is_constant(node->expression))
+            return fold(tree);
+    }
+    else if(tree->eval == exprtree_binaryop_eval) {
+        exprtree_binaryop_t *node = (exprtree_binaryop_t*)tree;
+        const char *op = node->operator;
+
+        node->left_expr = optimize(node->left_expr);
+        node->right_expr = optimize(node->right_expr);
+
+        if(is_constant(node->left_expr)) {
+            float value = ((exprtree_number_t*)(node->left_expr))->value;
+
+            if(is_constant(node->right_expr))
+                return fold(tree);
+            else if(strcmp(op, "and") == 0 && fabs(value) <= 1e-5)
+                return fold(tree); /* the right side is never evaluated */
+            else if(strcmp(op, "or") == 0 && fabs(value) > 1e-5)
+                return fold(tree);
+            else if(strcmp(op, ",") == 0) {
+                /* a constant has no side effects */
+                exprtree_t *right = node->right_expr;
+                node->right_expr = exprtree_number_new(0.0f);
+                tree->del(tree);
+                return right;
+            }
+        }
+    }
+    else if(tree->eval == exprtree_assignmentop_eval) {
+        exprtree_assignmentop_t *node = (exprtree_assignmentop_t*)tree;
+        node->right_expr = optimize(node->right_expr);
+    }
+    else if(tree->eval == exprtree_function_eval) {
+        exprtree_function_t *node = (exprtree_function_t*)tree;
+        int i, constant_arguments = 1;
+
+        for(i=0; i<node->fun.arity; i++) {
+            node->param[i] = optimize(node->param[i]);
+            constant_arguments = constant_arguments && is_constant(node->param[i]);
+        }
+
+        /* this inlines the pure BIFs of arity 0 */
+        if(node->fun.pure && constant_arguments)
+            return fold(tree);
+    }
+
+    return tree;
+}
+
+
+
+
+/* =============== BYTECODE COMPILER ============================ */
+/* expression trees are lowered to a flat program of a stack machine,
+   with variables resolved to the slots of their symbol tables */
+
+/* opcodes */
+typedef enum {
+    OP_PUSH,                /* push a constant */
+    OP_LOAD,                /* push a variable of the symbol table of the expression */
+    OP_LOADG,               /* push a global variable */
+    OP_STORE,               /* store the top of the stack in a variable of the symbol table of the expression */
+    OP_STOREG,              /* store the top of the stack in a global variable */
+    OP_POP,                 /* discard the top of the stack */
+    OP_NEG, OP_NOT, OP_TRUTH, /* unary operations; OP_TRUTH converts a value to 0 or 1 */
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_POW,
+    OP_EQ, OP_NE, OP_GT, OP_LT, OP_GE, OP_LE,
+    OP_RDIV,                /* division with reversed operands */
+    OP_SPOW,                /* sign-preserving power */
+    OP_JMP,                 /* jump */
+    OP_JFALSE, OP_JTRUE,    /* pop a value and jump if it's false (true) */
+    OP_CALL0, OP_CALL1, OP_CALL2, OP_CALL3, OP_CALL4 /* call a built-in function */
+} opcode_t;
+
+/* instruction */
+typedef struct instruction_t instruction_t;
+struct instruction_t {
+    opcode_t op;
+    union {
+        float value; /* OP_PUSH */
+        int slot; /* OP_LOAD, OP_STORE and their globals */
+        int target; /* jumps */
+        bif_t fun; /* OP_CALLn */
+    } arg;
+};
+
+/* operators */
+static const struct {
+    const char *name;
+    opcode_t op;
+} binary_operator[] = {
+    { "+", OP_ADD }, { "-", OP_SUB }, { "*", OP_MUL }, { "/", OP_DIV }, { "mod", OP_MOD }, { "^", OP_POW },
+    { "==", OP_EQ }, { "<>", OP_NE }, { ">", OP_GT }, { "<", OP_LT }, { ">=", OP_GE }, { "<=", OP_LE }
+};
+
+/* a local variable of a program */
+typedef struct localvariable_t localvariable_t;
+struct localvariable_t {
+    int slot;
+    char *name;
+};
+
+/* compiled program. Expressions of the same text share their program
+   when the slots of their local variables match */
+typedef struct program_t program_t;
+struct program_t {
+    char *source; /* text of the expression */
+    instruction_t *code;
+    int length; /* number of instructions */
+    localvariable_t *local; /* local variables, in the order of their first use */
+    int local_count;
+    int batchable; /* may it run across many symbol tables at once? See run_batch() */
+    int writes_locals; /* does it store values in local variables? */
+    int refs; /* reference counter */
+    program_t *next; /* next program in the same bucket of the cache */
+};
+
+#define PROGRAM_BUCKETS 1024 /* a power of two */
+static program_t* program_cache[PROGRAM_BUCKETS];
+static program_t* program_find(const char *source, symboltable_t *symbol_table);
+static void program_store(program_t *program);
+static void program_release(program_t *program);
+
+/* compiler state */
+#define VM_STACKSIZE 64 /* expressions that need a deeper stack are evaluated by walking their trees */
+typedef struct compiler_t compiler_t;
+struct compiler_t {
+    instruction_t *code;
+    int length;
+    int capacity;
+    int depth; /* current depth of the stack */
+    int max_depth; /* maximum depth of the stack */
+    symboltable_t *symbol_table; /* symbol table of the expression */
+    localvariable_t *local; /* local variables */
+    int local_count;
+};
+
+static int compiler_emit(compiler_t *c, opcode_t op, int stack_effect)
+{
+    if(c->length >= c->capacity) {
+        instruction_t *code;
+        c->capacity = (c->capacity > 0) ? 2 * c->capacity : 8;
+        code = realloc(c->code, c->capacity * sizeof(*code));
+        if(code == NULL)
+            error(__FILE__ ": Out of memory");
+        c->code = code;
+    }
+
+    c->depth += stack_effect;
+    if(c->depth > c->max_depth)
+        c->max_depth = c->depth;
+
+    c->code[c->length].op = op;
+    c->code[c->length].arg.target = 0;
+    return c->length++;
+}
+
+static void compiler_emit_push(compiler_t *c, float value)
+{
+    int i = compiler_emit(c, OP_PUSH, +1);
+    c->code[i].arg.value = value;
+}
+
+static void compiler_emit_variable(compiler_t *c, const exprtree_variable_t *var, int store)
+{
+    const char *name = var->variable_name;
+    opcode_t op = store ? OP_STORE : OP_LOAD;
+    symboltable_t *table = var->symbol_table;
+    int i;
+
+    if(IS_GLOBAL_VARIABLE(name)) {
+        op = store ? OP_STOREG : OP_LOADG;
+        table = symboltable_get_global_table();
+    }
+    else if(table != c->symbol_table)
+        error("Can't compile expression: variable '%s' belongs to another symbol table", name);
+
+    i = compiler_emit(c, op, store ? 0 : +1);
+    c->code[i].arg.slot = symboltable_get_slot(table, name);
+
+    /* record the local variables */
+    if(op == OP_LOAD || op == OP_STORE) {
+        int j;
+
+        for(j=0; j<c->local_count; j++) {
+            if(c->local[j].slot == c->code[i].arg.slot)
+                return;
+        }
+
+        c->local = realloc(c->local, (c->local_count + 1) * sizeof(*(c->local)));
+        if(c->local == NULL)
+            error(__FILE__ ": Out of memory");
+        c->local[c->local_count].slot = c->code[i].arg.slot;
+        c->local[c->local_count].name = str_dup(name);
+        c->local_count++;
+    }
+}
+
+static void compiler_emit_call(compiler_t *c, const bif_t *fun)
+{
+    int i = compiler_emit(c, (opcode_t)(OP_CALL0 + fun->arity), 1 - fun->arity);
+    c->code[i].arg.fun = *fun;
+}
+
+static void compiler_patch(compiler_t *c, int jump)
+{
+    c->code[jump].arg.target = c->length;
+}
+
+static void compile_tree(compiler_t *c, const exprtree_t *tree)
+{
+    if(tree->eval == exprtree_number_eval) {
+        compiler_emit_push(c, ((const exprtree_number_t*)tree)->value);
+    }
+    else if(tree->eval == exprtree_variable_eval) {
+        compiler_emit_variable(c, (const exprtree_variable_t*)tree, 0);
+    }
+    else if(tree->eval == exprtree_unaryop_eval) {
+        const exprtree_unaryop_t *node = (const exprtree_unaryop_t*)tree;
+
+        compile_tree(c, node->expression);
+        if(strcmp(node->operator, "-") == 0)
+            compiler_emit(c, OP_NEG, 0);
+        else if(strcmp(node->operator, "not") == 0)
+            compiler_emit(c, OP_NOT, 0);
+        else
+            error("Can't compile expression: invalid unary operator '%s'", node->operator);
+    }
+    else if(tree->eval == exprtree_binaryop_eval) {
+        const exprtree_binaryop_t *node = (const exprtree_binaryop_t*)tree;
+        const char *op = node->operator;
+        int is_and = (strcmp(op, "and") == 0);
+        size_t i;
+
+        if(is_and || strcmp(op, "or") == 0) {
+            /* short-circuit boolean operations */
+            int shortcut, end;
+
+            compile_tree(c, node->left_expr);
+            shortcut = compiler_emit(c, is_and ? OP_JFALSE : OP_JTRUE, -1);
+            compile_tree(c, node->right_expr);
+            compiler_emit(c, OP_TRUTH, 0);
+            end = compiler_emit(c, OP_JMP, -1);
+            compiler_patch(c, shortcut);
+            compiler_emit_push(c, is_and ? 0.0f : 1.0f);
+            compiler_patch(c, end);
+        }
+        else if(strcmp(op, ",") == 0) {
+            compile_tree(c, node->left_expr);
+            compiler_emit(c, OP_POP, -1);
+            compile_tree(c, node->right_expr);
+        }
+        else {
+            for(i=0; i<sizeof(binary_operator)/sizeof(binary_operator[0]); i++) {
+                if(strcmp(op, binary_operator[i].name) == 0)
+                    break;
+            }
+
+            if(i == sizeof(binary_operator)/sizeof(binary_operator[0]))
+                error("Can't compile expression: invalid binary operator '%s'", op);
+
+            compile_tree(c, node->left_expr);
+            compile_tree(c, node->right_expr);
+            compiler_emit(c, binary_operator[i].op, -1);
+        }
+    }
+    else if(tree->eval == exprtree_assignmentop_eval) {
+        const exprtree_assignmentop_t *node = (const exprtree_assignmentop_t*)tree;
+        const char *op = node->operator;
+
+        /* keep the order of evaluation of the tree */
+        if(strcmp(op, "=") == 0) {
+            compile_tree(c, node->right_expr);
+        }
+        else if(strcmp(op, "/=") == 0) {
+            compile_tree(c, node->right_expr);
+            compiler_emit_variable(c, node->left_expr, 0);
+            compiler_emit(c, OP_RDIV, -1);
+        }
+        else {
+            opcode_t opcode = OP_ADD;
+
+            if(strcmp(op, "+=") == 0)
+                opcode = OP_ADD;
+            else if(strcmp(op, "-=") == 0)
+                opcode = OP_SUB;
+            else if(strcmp(op, "*=") == 0)
+                opcode = OP_MUL;
+            else if(strcmp(op, "^=") == 0)
+                opcode = OP_SPOW;
+            else
+                error("Can't compile expression: invalid assignment operator '%s'", op);
+
+            compiler_emit_variable(c, node->left_expr, 0);
+            compile_tree(c, node->right_expr);
+            compiler_emit(c, opcode, -1);
+        }
+
+        compiler_emit_variable(c, node->left_expr, 1);
+    }
+    else if(tree->eval == exprtree_function_eval) {
+        const exprtree_function_t *node = (const exprtree_function_t*)tree;
+        int i;
+
+        for(i=0; i<node->fun.arity; i++)
+            compile_tree(c, node->param[i]);
+
+        compiler_emit_call(c, &(node->fun));
+    }
+    else
+        error("Can't compile expression: unknown node");
+}
+
+/* compiles an expression tree. Returns NULL if the tree needs a stack deeper than VM_STACKSIZE */
+static program_t* compile(const exprtree_t *tree, symboltable_t *symbol_table, const char *source)
+{
+    compiler_t c = { NULL, 0, 0, 0, 0, symbol_table, NULL, 0 };
+    program_t *program;
+    int i;
+
+    compile_tree(&c, tree);
+    if(c.max_depth > VM_STACKSIZE) {
+        while(c.local_count > 0)
+            free(c.local[--c.local_count].name);
+        free(c.local);
+        free(c.code);
+        return NULL;
+    }
+
+    program = malloc_x(sizeof *program);
+    program->source = str_dup(source);
+    program->code = realloc(c.code, c.length * sizeof(*(c.code)));
+    program->length = c.length;
+    program->local = c.local;
+    program->local_count = c.local_count;
+    program->batchable = 1;
+    program->writes_locals = 0;
+    program->refs = 1;
+    program->next = NULL;
+
+    /* programs are batched only if the order of evaluation of their lanes doesn't matter */
+    for(i=0; i<program->length; i++) {
+        switch(program->code[i].op) {
+        case OP_JMP: case OP_JFALSE: case OP_JTRUE: case OP_STOREG:
+            program->batchable = 0;
+            break;
+        case OP_CALL0: case OP_CALL1: case OP_CALL2: case OP_CALL3: case OP_CALL4:
+            if(!program->code[i].arg.fun.pure)
+                program->batchable = 0;
+            break;
+        case OP_STORE:
+            program->writes_locals = 1;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return program;
+}
+
+/* the bucket of the cache of programs of the given source */
+static program_t** program_bucket(const char *source)
+{
+    unsigned hash = 2166136261u; /* FNV-1a */
+
+    while(*source)
+        hash = (hash ^ (unsigned char)(*(source++))) * 16777619u;
+
+    return &program_cache[hash & (PROGRAM_BUCKETS - 1)];
+}
+
+/* finds a compiled program of the given source whose local variables
+   are at the same slots of the given symbol table, or NULL */
+program_t* program_find(const char *source, symboltable_t *symbol_table)
+{
+    program_t *program;
+    int i;
+
+    for(program = *program_bucket(source); program != NULL; program = program->next) {
+        if(strcmp(program->source, source) != 0)
+            continue;
+
+        /* this creates the slots in the same order as the compiler */
+        for(i=0; i<program->local_count; i++) {
+            if(symboltable_get_slot(symbol_table, program->local[i].name) != program->local[i].slot)
+                break;
+        }
+
+        if(i == program->local_count) {
+            program->refs++;
+            return program;
+        }
+    }
+
+    return NULL;
+}
+
+/* adds a program to the cache */
+void program_store(program_t *program)
+{
+    program_t **bucket = program_bucket(program->source);
+
+    program->next = *bucket;
+    *bucket = program;
+}
+
+/* releases a reference to a program */
+void program_release(program_t *program)
+{
+    program_t **p;
+    int i;
+
+    if(--program->refs > 0)
+        return;
+
+    for(p = program_bucket(program->source); *p != NULL; p = &((*p)->next)) {
+        if(*p == program) {
+            *p = program->next;
+            break;
+        }
+    }
+
+    for(i=0; i<program->local_count; i++)
+        free(program->local[i].name);
+
+    free(program->local);
+    free(program->code);
+    free(program->source);
+    free(program);
+}
+
+/* runs a compiled program */
+static float run(const instruction_t *code, int length, symboltable_t *symbol_table)
+{
+    float stack[VM_STACKSIZE];
+    int sp = 0, pc;
+    float x, y;
+
+    #define TRUE_(v) (fabs(v) > 1e-5)
+
+    for(pc=0; pc<length; pc++) {
+        const instruction_t *in = &code[pc];
+        switch(in->op) {
+        case OP_PUSH:   stack[sp++] = in->arg.value; break;
+        case OP_LOAD:   stack[sp++] = symboltable_load(symbol_table, in->arg.slot); break;
+        case OP_LOADG:  stack[sp++] = symboltable_load(global_st, in->arg.slot); break;
+        case OP_STORE:  symboltable_store(symbol_table, in->arg.slot, stack[sp-1]); break;
+        case OP_STOREG: symboltable_store(global_st, in->arg.slot, stack[sp-1]); break;
+        case OP_POP:    sp--; break;
+        case OP_NEG:    stack[sp-1] = -stack[sp-1]; break;
+        case OP_NOT:    stack[sp-1] = TRUE_(stack[sp-1]) ? 0.0f : 1.0f; break;
+        case OP_TRUTH:  stack[sp-1] = TRUE_(stack[sp-1]) ? 1.0f : 0.0f; break;
+        case OP_JMP:    pc = in->arg.target - 1; break;
+        case OP_JFALSE: if(!TRUE_(stack[--sp])) pc = in->arg.target - 1; break;
+        case OP_JTRUE:  if(TRUE_(stack[--sp])) pc = in->arg.target - 1; break;
+        case OP_CALL0:  stack[sp++] = in->arg.fun.call.arity0(); break;
+        case OP_CALL1:  stack[sp-1] = in->arg.fun.call.arity1(stack[sp-1]); break;
+        case OP_CALL2:  sp -= 1; stack[sp-1] = in->arg.fun.call.arity2(stack[sp-1], stack[sp]); break;
+        case OP_CALL3:  sp -= 2; stack[sp-1] = in->arg.fun.call.arity3(stack[sp-1], stack[sp], stack[sp+1]); break;
+        case OP_CALL4:  sp -= 3; stack[sp-1] = in->arg.fun.call.arity4(stack[sp-1], stack[sp], stack[sp+1], stack[sp+2]); break;
+
+        default:
+            /* binary operations */
+            y = stack[--sp];
+            x = stack[sp-1];
+            switch(in->op) {
+            case OP_ADD:  x = x + y; break;
+            case OP_SUB:  x = x - y; break;
+            case OP_MUL:  x = x * y; break;
+            case OP_DIV:  x = TRUE_(y) ? x / y : 1.0f; break;
+            case OP_RDIV: x = TRUE_(x) ? y / x : 1.0f; break;
+            case OP_MOD:  x = TRUE_(y) ? fmod(x, y) : 0.0f; break;
+            case OP_POW:  x = pow(x, y); break;
+            case OP_SPOW: x = x >= 0.0f ? pow(x, y) : -pow(-x, y); break;
+            case OP_EQ:   x = !TRUE_(x-y) ? 1.0f : 0.0f; break;
+            case OP_NE:   x = TRUE_(x-y) ? 1.0f : 0.0f; break;
+            case OP_GT:   x = x > y ? 1.0f : 0.0f; break;
+            case OP_LT:   x = x < y ? 1.0f : 0.0f; break;
+            case OP_GE:   x = x >= y ? 1.0f : 0.0f; break;
+            case OP_LE:   x = x <= y ? 1.0f : 0.0f; break;
+            default:      error("Can't evaluate expression: invalid opcode %d", (int)in->op); break;
+            }
+            stack[sp-1] = x;
+            break;
+        }
+    }
+
+    #undef TRUE_
+
+    return sp > 0 ? stack[sp-1] : 0.0f;
+}
+
+/* runs a compiled program across many symbol tables at once, storing the value of each
+   lane in result[]. The stack is laid out as a structure of arrays, with one lane per
+   symbol table, and each instruction is applied to all lanes in a loop the compiler
+   can vectorize. The program must be batchable: without jumps, there is no divergence,
+   and without global stores or impure calls, the lanes can't observe one another.
+   Lanes that store local variables must have distinct symbol tables */
+#define VM_LANES 32
+static void run_batch(const instruction_t *code, int length, symboltable_t **symbol_table, int lanes, float *result)
+{
+    float stack[VM_STACKSIZE][VM_LANES];
+    int sp = 0, pc, l;
+    float *x, *y, value;
+
+    #define TRUE_(v) (fabs(v) > 1e-5)
+    #define FOR_EACH_LANE for(l=0; l<lanes; l++)
+
+    for(pc=0; pc<length; pc++) {
+        const instruction_t *in = &code[pc];
+        switch(in->op) {
+        case OP_PUSH:   value = in->arg.value; x = stack[sp++]; FOR_EACH_LANE x[l] = value; break;
+        case OP_LOAD:   x = stack[sp++]; FOR_EACH_LANE x[l] = symboltable_load(symbol_table[l], in->arg.slot); break;
+        case OP_LOADG:  value = symboltable_load(global_st, in->arg.slot); x = stack[sp++]; FOR_EACH_LANE x[l] = value; break;
+        case OP_STORE:  x = stack[sp-1]; FOR_EACH_LANE symboltable_store(symbol_table[l], in->arg.slot, x[l]); break;
+        case OP_POP:    sp--; break;
+        case OP_NEG:    x = stack[sp-1]; FOR_EACH_LANE x[l] = -x[l]; break;
+        case OP_NOT:    x = stack[sp-1]; FOR_EACH_LANE x[l] = TRUE_(x[l]) ? 0.0f : 1.0f; break;
+        case OP_TRUTH:  x = stack[sp-1]; FOR_EACH_LANE x[l] = TRUE_(x[l]) ? 1.0f : 0.0f; break;
+        case OP_CALL0:  x = stack[sp++]; FOR_EACH_LANE x[l] = in->arg.fun.call.arity0(); break;
+        case OP_CALL1:  x = stack[sp-1]; FOR_EACH_LANE x[l] = in->arg.fun.call.arity1(x[l]); break;
+        case OP_CALL2:  sp -= 1; x = stack[sp-1]; FOR_EACH_LANE x[l] = in->arg.fun.call.arity2(x[l], stack[sp][l]); break;
+        case OP_CALL3:  sp -= 2; x = stack[sp-1]; FOR_EACH_LANE x[l] = in->arg.fun.call.arity3(x[l], stack[sp][l], stack[sp+1][l]); break;
+        case OP_CALL4:  sp -= 3; x = stack[sp-1]; FOR_EACH_LANE x[l] = in->arg.fun.call.arity4(x[l], stack[sp][l], stack[sp+1][l], stack[sp+2][l]); break;
+
+        default:
+            /* binary operations */
+            y = stack[--sp];
+            x = stack[sp-1];
+            switch(in->op) {
+            case OP_ADD:  FOR_EACH_LANE x[l] = x[l] + y[l]; break;
+            case OP_SUB:  FOR_EACH_LANE x[l] = x[l] - y[l]; break;
+            case OP_MUL:  FOR_EACH_LANE x[l] = x[l] * y[l]; break;
+            case OP_DIV:  FOR_EACH_LANE x[l] = TRUE_(y[l]) ? x[l] / y[l] : 1.0f; break;
+            case OP_RDIV: FOR_EACH_LANE x[l] = TRUE_(x[l]) ? y[l] / x[l] : 1.0f; break;
+            case OP_MOD:  FOR_EACH_LANE x[l] = TRUE_(y[l]) ? fmod(x[l], y[l]) : 0.0f; break;
+            case OP_POW:  FOR_EACH_LANE x[l] = pow(x[l], y[l]); break;
+            case OP_SPOW: FOR_EACH_LANE x[l] = x[l] >= 0.0f ? pow(x[l], y[l]) : -pow(-x[l], y[l]); break;
+            case OP_EQ:   FOR_EACH_LANE x[l] = !TRUE_(x[l]-y[l]) ? 1.0f : 0.0f; break;
+            case OP_NE:   FOR_EACH_LANE x[l] = TRUE_(x[l]-y[l]) ? 1.0f : 0.0f; break;
+            case OP_GT:   FOR_EACH_LANE x[l] = x[l] > y[l] ? 1.0f : 0.0f; break;
+            case OP_LT:   FOR_EACH_LANE x[l] = x[l] < y[l] ? 1.0f : 0.0f; break;
+            case OP_GE:   FOR_EACH_LANE x[l] = x[l] >= y[l] ? 1.0f : 0.0f; break;
+            case OP_LE:   FOR_EACH_LANE x[l] = x[l] <= y[l] ? 1.0f : 0.0f; break;
+            default:      error("Can't evaluate expression: invalid opcode %d", (int)in->op); break;
+            }
+            break;
+        }
+    }
+
+    #undef FOR_EACH_LANE
+    #undef TRUE_
+
+    for(l=0; l<lanes; l++)
+        result[l] = sp > 0 ? stack[sp-1][l] : 0.0f;
+}
+
+
+
 /* =============== EXPRESSION EVALUATOR FACADE ============================ */
 
+static unsigned long evaluation_count = 0; /* number of evaluations so far */
+
 /* expression data structure */
 struct expression_t {
-    exprtree_t *root;
+    exprtree_t *root; /* parse tree; NULL if the expression has been compiled */
+    program_t *program; /* compiled program, possibly shared */
+    symboltable_t *symbol_table;
 };
 
 /* creates a new expression */
@@ -1336,23 +2029,92 @@ expression_t *expression_new(const char *expression_string, symboltable_t *symbo
 {
     expression_t *expr = malloc_x(sizeof *expr);
     symboltable_t *st = (symbol_table == NULL) ? symboltable_get_global_table() : symbol_table;
-    expr->root = parse(expression_string, st);
+
+    expr->symbol_table = st;
+    expr->root = NULL;
+
+    /* share the program of an identical expression */
+    if(NULL != (expr->program = program_find(expression_string, st)))
+        return expr;
+
+    /* parse, optimize & compile */
+    expr->root = optimize(parse(expression_string, st));
+    expr->program = compile(expr->root, st, expression_string);
+
+    /* we don't need the tree anymore */
+    if(expr->program != NULL) {
+        program_store(expr->program);
+        expr->root->del(expr->root);
+        expr->root = NULL;
+    }
+
     return expr;
 }
 
+/* the number of expressions evaluated so far. It wraps around on overflow */
+unsigned long expression_evaluation_count()
+{
+    return evaluation_count;
+}
+
 /* destroys an existing expression object */
 void expression_destroy(expression_t *expr)
 {
-    expr->root->del(expr->root);
+    if(expr->root != NULL)
+        expr->root->del(expr->root);
+
+    if(expr->program != NULL)
+        program_release(expr->program);
+
     free(expr);
 }
 
 /* evaluates an expression */
 float expression_evaluate(expression_t *expr)
 {
+    evaluation_count++;
+
+    if(expr->program != NULL)
+        return run(expr->program->code, expr->program->length, expr->symbol_table);
+
     return expr->root->eval(expr->root);
 }
 
+/* evaluates many expressions, in order */
+void expression_evaluate_batch(expression_t **expr, int count, float *result)
+{
+    symboltable_t *table[VM_LANES];
+    const program_t *program;
+    int i = 0, lanes, j;
+
+    while(i < count) {
+        /* expressions that can't be batched are evaluated one by one */
+        program = expr[i]->program;
+        if(program == NULL || !program->batchable) {
+            result[i] = expression_evaluate(expr[i]);
+            i++;
+            continue;
+        }
+
+        /* gather the consecutive expressions that share the program */
+        for(lanes = 0; lanes < VM_LANES && i + lanes < count; lanes++) {
+            if(expr[i + lanes]->program != program)
+                break;
+
+            table[lanes] = expr[i + lanes]->symbol_table;
+            if(program->writes_locals) {
+                for(j=0; j<lanes && table[j] != table[lanes]; j++);
+                if(j < lanes)
+                    break;
+            }
+        }
+
+        run_batch(program->code, program->length, table, lanes, result + i);
+        evaluation_count += lanes;
+        i += lanes;
+    }
+}
+
 
 
 
@@ -1362,6 +2124,7 @@ float expression_evaluate(expression_t *expr)
 void nanocalc_init()
 {
     global_st = symboltable_new();
+    memset(program_cache, 0, sizeof(program_cache));
     bif_init();
 }
 
@@ -1398,6 +2161,12 @@ void nanocalc_register_bif_arity4(const char *name, float (*fun)(float,float,flo
     bif_register_arity4(name, fun);
 }
 
+/* declares that a registered BIF is pure */
+void nanocalc_declare_pure_bif(const char *name)
+{
+    bif_declare_pure(name);
+}
+
 /* you may optionally define your own error function (it will be called
    when an error arises). It must receive an error string */
 void nanocalc_set_error_function(void (*fun)(const char*))
@@ -108,6 +108,10 @@ void nanocalc_register_bif_arity2(const char *name, float (*fun)(float,float));
 void nanocalc_register_bif_arity3(const char *name, float (*fun)(float,float,float));
 void nanocalc_register_bif_arity4(const char *name, float (*fun)(float,float,float,float));
 
+/* declares that a registered BIF is pure, i.e., it has no side effects and its
+   result depends only on its arguments. Calls with constant arguments are folded */
+void nanocalc_declare_pure_bif(const char *name);
+
 /* you may optionally define your own error function (it will be called
    when an error arises). It must receive an error string */
 void nanocalc_set_error_function(void (*fun)(const char*));
@@ -122,9 +126,16 @@ void nanocalc_error(const char *fmt, ...);
 /* symbol table: used to store variables */
 typedef struct symboltable_t symboltable_t;
 
+/* symbol layout: the names of the variables, which may be shared by many symbol tables */
+typedef struct symbollayout_t symbollayout_t;
+
 /* creates a new symbol table */
 symboltable_t *symboltable_new();
 
+/* creates a new symbol table that shares the given layout. The variables of
+   the table are stored in a flat array, indexed by the slots of the layout */
+symboltable_t *symboltable_new_with_layout(symbollayout_t *layout);
+
 /* destroys an existing symbol table */
 void symboltable_destroy(symboltable_t *st);
 
@@ -143,6 +154,12 @@ void symboltable_clear(symboltable_t *st);
 /* returns a fixed, global symbol table */
 symboltable_t *symboltable_get_global_table();
 
+/* creates a new symbol layout */
+symbollayout_t *symbollayout_new();
+
+/* releases a symbol layout. Symbol tables keep their layouts alive */
+void symbollayout_destroy(symbollayout_t *layout);
+
 
 
 /* ============== EXPRESSION FACTORY ================= */
@@ -160,6 +177,14 @@ void expression_destroy(expression_t *expr);
 /* evaluates an expression */
 float expression_evaluate(expression_t *expr);
 
+/* evaluates expr[0], expr[1], ..., expr[count-1], in this order, storing their values in
+   result[]. Identical expressions of symbol tables that share a layout, such as those of
+   many instances of the same legacy object, are evaluated together with vector math */
+void expression_evaluate_batch(expression_t **expr, int count, float *result);
+
+/* the number of expressions evaluated so far, for profiling. It wraps around on overflow */
+unsigned long expression_evaluation_count();
+
 
 
 /* ============== UTILITIES ================= */
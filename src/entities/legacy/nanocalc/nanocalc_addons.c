@@ -345,6 +345,20 @@ void nanocalc_addons_init()
     nanocalc_register_bif_arity0("leet", f_leet);
     nanocalc_register_bif_arity0("pi", f_pi);
     nanocalc_register_bif_arity0("infinity", f_infinity);
+
+    /* the math BIFs, except random(), are pure */
+    {
+        static const char *PURE_BIFS[] = {
+            "cond", "clamp", "lerp", "max", "min", "atan2", "sign", "abs",
+            "floor", "ceil", "round", "sqrt", "exp", "log", "log10",
+            "cos", "sin", "tan", "asin", "acos", "atan", "cosh", "sinh", "tanh",
+            "deg2rad", "rad2deg", "leet", "pi", "infinity"
+        };
+        int i;
+
+        for(i=0; i<(int)(sizeof(PURE_BIFS)/sizeof(PURE_BIFS[0])); i++)
+            nanocalc_declare_pure_bif(PURE_BIFS[i]);
+    }
 }
 
 /* call this when you're done, but before nanocalc_release() */
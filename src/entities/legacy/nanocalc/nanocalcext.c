@@ -180,6 +180,9 @@ void nanocalcext_register_bifs()
     nanocalc_register_bif_arity2("brick_layer", f_brick_layer);
     nanocalc_register_bif_arity2("obstacle_exists", f_obstacle_exists);
 
+    /* constants */
+    nanocalc_declare_pure_bif("initial_lives");
+
     target = NULL;
 }
 
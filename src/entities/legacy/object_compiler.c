@@ -29,6 +29,7 @@
 #include "../../core/global.h"
 #include "../../util/util.h"
 #include "../../util/stringutil.h"
+#include "../../util/darray.h"
 
 /* expression evaluator (nanocalc) helper */
 /* given a string, makes an expression_t object */
@@ -43,14 +44,50 @@
 /* private stuff ;) */
 #define DEFAULT_STATE                   "main"
 #define STACKMAX                        1024
-static void compile_command(objectmachine_t** machine_ref, const char *command, int n, const char *param[], const parsetree_statement_t *stmt);
-static int traverse_object(const parsetree_statement_t *stmt, void *object);
-static int traverse_object_state(const parsetree_statement_t *stmt, void *machine);
-static int push_object_state(const parsetree_statement_t *stmt, void *machine);
+typedef void (*objectaction_t)(objectmachine_t**,int,const char**,const parsetree_statement_t*);
+static objectaction_t find_action(const char *command, const parsetree_statement_t *stmt);
+static int traverse_object(const parsetree_statement_t *stmt, void *program);
+static int traverse_object_state(const parsetree_statement_t *stmt, void *program);
+static int push_object_state(const parsetree_statement_t *stmt, void *program);
 static void compile_error(const parsetree_statement_t *stmt, const char *format, ...);
-static struct { const parsetree_statement_t *stmt; void *machine; } stack[STACKMAX];
+static struct { const parsetree_statement_t *stmt; void *program; } stack[STACKMAX];
 static int stacksize;
 
+/* a compiled object is shared by all of its instances */
+/* each instance builds its own decorators, as they hold per-instance state */
+typedef struct objectstate_t objectstate_t;
+typedef struct objectcommand_t objectcommand_t;
+
+struct objectstate_t {
+    const char *name; /* name of the state */
+    int first_command; /* index of its first command */
+    int command_count; /* number of commands, in order of construction */
+};
+
+struct objectcommand_t {
+    objectaction_t action; /* adds a decorator to a machine */
+    int first_param; /* index of its first parameter */
+    int param_count; /* number of parameters */
+    const parsetree_statement_t *stmt; /* location in the script */
+};
+
+struct objectprogram_t {
+    char *name; /* name of the object */
+    symbollayout_t *layout; /* variables of the instances */
+    DARRAY(objectstate_t, state);
+    DARRAY(objectcommand_t, command);
+    DARRAY(const char*, param); /* parameters of all commands */
+
+    /* properties of the instances */
+    const char *annotation;
+    const char **category;
+    int category_count;
+    int preserve;
+    int always_active;
+    int hide_unless_in_editor_mode;
+    int detach_from_camera;
+};
+
 /* -------------------------------------- */
 
 /*
@@ -234,7 +271,7 @@ static void m_launch_url(objectmachine_t** m, int n, const char **p, const parse
 /* command table */
 typedef struct {
     const char *command;
-    void (*action)(objectmachine_t**,int,const char**,const parsetree_statement_t*);
+    objectaction_t action;
 } entry_t;
 
 static entry_t command_table[] = {
@@ -420,12 +457,93 @@ static entry_t command_table[] = {
 /* public methods */
 
 /*
- * objectcompiler_compile()
- * Compiles the given script
+ * objectcompiler_compile_program()
+ * Compiles the script of an object into a program shared by all its instances
+ */
+objectprogram_t* objectcompiler_compile_program(const char *object_name, const parsetree_program_t *script)
+{
+    objectprogram_t *program = mallocx(sizeof *program);
+
+    program->name = str_dup(object_name);
+    program->layout = symbollayout_new();
+    darray_init(program->state);
+    darray_init(program->command);
+    darray_init(program->param);
+
+    program->annotation = "";
+    program->category = NULL;
+    program->category_count = 0;
+    program->preserve = TRUE;
+    program->always_active = FALSE;
+    program->hide_unless_in_editor_mode = FALSE;
+    program->detach_from_camera = FALSE;
+
+    nanoparser_traverse_program_ex(script, (void*)program, traverse_object);
+    return program;
+}
+
+/*
+ * objectcompiler_destroy_program()
+ * Destroys a compiled program
+ */
+void objectcompiler_destroy_program(objectprogram_t *program)
+{
+    if(program->category != NULL)
+        free(program->category);
+
+    darray_release(program->param);
+    darray_release(program->command);
+    darray_release(program->state);
+    symbollayout_destroy(program->layout);
+    free(program->name);
+    free(program);
+}
+
+/*
+ * objectcompiler_program_layout()
+ * The layout of the variables of the instances of a program
  */
-void objectcompiler_compile(object_t *obj, const parsetree_program_t *script)
+symbollayout_t* objectcompiler_program_layout(const objectprogram_t *program)
 {
-    nanoparser_traverse_program_ex(script, (void*)obj, traverse_object);
+    return program->layout;
+}
+
+/*
+ * objectcompiler_instantiate()
+ * Sets up an object according to a compiled program. The virtual
+ * machine of the object must use the layout of the program.
+ */
+void objectcompiler_instantiate(const objectprogram_t *program, object_t *obj)
+{
+    int i, j;
+
+    /* properties */
+    obj->annotation = program->annotation;
+    obj->category = program->category; /* shared */
+    obj->category_count = program->category_count;
+    obj->preserve = program->preserve;
+    obj->always_active = program->always_active;
+    obj->hide_unless_in_editor_mode = program->hide_unless_in_editor_mode;
+    obj->detach_from_camera = program->detach_from_camera;
+
+    /* build the machine of each state */
+    for(i = 0; i < darray_length(program->state); i++) {
+        const objectstate_t *state = &(program->state[i]);
+        objectmachine_t **machine_ref;
+
+        objectvm_create_state(obj->vm, state->name);
+        objectvm_set_current_state(obj->vm, state->name);
+        machine_ref = objectvm_get_reference_to_current_state(obj->vm);
+
+        for(j = 0; j < state->command_count; j++) {
+            const objectcommand_t *cmd = &(program->command[state->first_command + j]);
+            cmd->action(machine_ref, cmd->param_count, program->param + cmd->first_param, cmd->stmt);
+        }
+
+        (*machine_ref)->init(*machine_ref);
+    }
+
+    objectvm_flatten_states(obj->vm);
     objectvm_reset_history(obj->vm);
     objectvm_set_current_state(obj->vm, DEFAULT_STATE);
 }
@@ -436,17 +554,16 @@ void objectcompiler_compile(object_t *obj, const parsetree_program_t *script)
 /* -------------------------------------- */
 
 /* private methods */
-int traverse_object(const parsetree_statement_t* stmt, void *object)
+int traverse_object(const parsetree_statement_t* stmt, void *program)
 {
-    object_t *e = (object_t*)object;
+    objectprogram_t *e = (objectprogram_t*)program;
     const char *id = nanoparser_get_identifier(stmt);
     const parsetree_parameter_t *param_list = nanoparser_get_parameter_list(stmt);
-    objectmachine_t **machine_ref;
 
     if(str_icmp(id, "state") == 0) {
         const parsetree_parameter_t *p1, *p2;
-        const char *state_name;
         const parsetree_program_t *state_code;
+        objectstate_t state;
 
         p1 = nanoparser_get_nth_parameter(param_list, 1);
         p2 = nanoparser_get_nth_parameter(param_list, 2);
@@ -454,19 +571,17 @@ int traverse_object(const parsetree_statement_t* stmt, void *object)
         nanoparser_expect_string(p1, "Object script error: state name is expected");
         nanoparser_expect_program(p2, "Object script error: state code is expected");
 
-        state_name = nanoparser_get_string(p1);
+        state.name = nanoparser_get_string(p1);
+        state.first_command = darray_length(e->command);
         state_code = nanoparser_get_program(p2);
 
-        objectvm_create_state(e->vm, state_name);
-        objectvm_set_current_state(e->vm, state_name);
-        machine_ref = objectvm_get_reference_to_current_state(e->vm);
-
         stacksize = 0;
-        nanoparser_traverse_program_ex(state_code, (void*)machine_ref, push_object_state);
+        nanoparser_traverse_program_ex(state_code, (void*)e, push_object_state);
         while(stacksize-- > 0) /* traverse in reverse order - note the order of the decorators */
-            traverse_object_state(stack[stacksize].stmt, stack[stacksize].machine);
+            traverse_object_state(stack[stacksize].stmt, stack[stacksize].program);
 
-        (*machine_ref)->init(*machine_ref);
+        state.command_count = darray_length(e->command) - state.first_command;
+        darray_push(e->state, state);
     }
     else if(str_icmp(id, "requires") == 0) {
         if(nanoparser_get_number_of_parameters(param_list) == 1) {
@@ -547,38 +662,41 @@ int traverse_object(const parsetree_statement_t* stmt, void *object)
     return 0;
 }
 
-int traverse_object_state(const parsetree_statement_t* stmt, void *machine)
+int traverse_object_state(const parsetree_statement_t* stmt, void *program)
 {
-    objectmachine_t **ref = (objectmachine_t**)machine; /* reference to the current object machine */
+    objectprogram_t *e = (objectprogram_t*)program;
     const char *id = nanoparser_get_identifier(stmt); /* command string */
     const parsetree_parameter_t *param_list = nanoparser_get_parameter_list(stmt);
-    const char **p_k;
-    int i, n;
+    objectcommand_t cmd;
+    int i;
 
-    /* creates the parameter list: p_k[0..n-1] */
-    n = nanoparser_get_number_of_parameters(param_list);
-    p_k = mallocx(n * (sizeof *p_k));
-    for(i=0; i<n; i++) {
+    /* finds the action that adds the corresponding decorator to a machine */
+    cmd.action = find_action(id, stmt);
+    cmd.stmt = stmt;
+
+    /* stores the parameter list: param[first_param .. first_param+param_count-1] */
+    cmd.param_count = nanoparser_get_number_of_parameters(param_list);
+    cmd.first_param = darray_length(e->param);
+    for(i=0; i<cmd.param_count; i++) {
         const parsetree_parameter_t *p = nanoparser_get_nth_parameter(param_list, 1+i);
+        const char *param;
+
         nanoparser_expect_string(p, "Object script error: command parameters must be strings");
-        p_k[i] = nanoparser_get_string(p);
+        param = nanoparser_get_string(p);
+        darray_push(e->param, param);
     }
 
-    /* adds the corresponding decorator to the machine */
-    compile_command(ref, id, n, p_k, stmt);
-
-    /* releases the parameter list */
-    free(p_k);
+    darray_push(e->command, cmd);
 
     /* done! :-) */
     return 0;
 }
 
-int push_object_state(const parsetree_statement_t* stmt, void *machine)
+int push_object_state(const parsetree_statement_t* stmt, void *program)
 {
     if(stacksize < STACKMAX) {
         stack[stacksize].stmt = stmt;
-        stack[stacksize].machine = machine;
+        stack[stacksize].program = program;
         stacksize++;
     }
     else
@@ -587,22 +705,21 @@ int push_object_state(const parsetree_statement_t* stmt, void *machine)
     return 0;
 }
 
-void compile_command(objectmachine_t** machine_ref, const char *command, int n, const char *param[], const parsetree_statement_t *stmt)
+objectaction_t find_action(const char *command, const parsetree_statement_t *stmt)
 {
     int i = 0;
     entry_t e = command_table[i++];
 
     /* finds the corresponding command in the table */
     while(e.command != NULL && e.action != NULL) {
-        if(str_icmp(e.command, command) == 0) {
-            (e.action)(machine_ref, n, (const char**)param, stmt);
-            return;
-        }
+        if(str_icmp(e.command, command) == 0)
+            return e.action;
 
         e = command_table[i++];
     }
 
     COMPILE_ERROR("Object script error - unknown command: '%s'", command);
+    return NULL;
 }
 
 
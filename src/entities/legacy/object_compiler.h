@@ -24,6 +24,12 @@
 #include "object_vm.h"
 #include "../../core/nanoparser.h"
 
-void objectcompiler_compile(object_t *obj, const parsetree_program_t *script);
+/* a compiled object script, shared by all instances of an object */
+typedef struct objectprogram_t objectprogram_t;
+
+objectprogram_t* objectcompiler_compile_program(const char *object_name, const parsetree_program_t *script);
+void objectcompiler_destroy_program(objectprogram_t *program);
+symbollayout_t* objectcompiler_program_layout(const objectprogram_t *program);
+void objectcompiler_instantiate(const objectprogram_t *program, object_t *obj);
 
 #endif
@@ -54,6 +54,7 @@ typedef struct objectdecorator_t objectdecorator_t;
 struct objectdecorator_t {
     objectmachine_t base; /* objectdecorator_t implements the objectmachine_t interface */
     objectmachine_t *decorated_machine; /* what are we decorating? */
+    int (*command)(objectmachine_t*, player_t**, int, brick_list_t*, item_list_t*, object_list_t*); /* runs the command of this decorator; returns TRUE if the decorated machine should be updated as well */
 };
 
 /* given an object machine, get its object instance */
@@ -64,6 +65,113 @@ object_t* objectdecorator_get_object_instance(objectmachine_t *obj)
     return decorated_machine->get_object_instance(decorated_machine);
 }
 
+/* number of commands executed so far */
+static int64_t command_count = 0;
+
+/* the number of commands executed so far, for profiling */
+int64_t objectdecorator_command_count()
+{
+    return command_count;
+}
+
+/* runs the command of the decorator, then (maybe) updates the decorated machine */
+static void objectdecorator_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+{
+    objectdecorator_t *me = (objectdecorator_t*)obj;
+    objectmachine_t *decorated_machine = me->decorated_machine;
+
+    command_count++;
+    if(me->command(obj, team, team_size, brick_list, item_list, object_list))
+        decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+}
+
+
+
+/* ----- FLATTENED MACHINES ----- */
+
+/* a flattened machine stores the commands of a chain of decorators in an
+   array, so that its update runs in a loop instead of a chain of calls */
+typedef struct objectflatcommand_t objectflatcommand_t;
+struct objectflatcommand_t {
+    int (*command)(objectmachine_t*, player_t**, int, brick_list_t*, item_list_t*, object_list_t*);
+    objectmachine_t *decorator;
+};
+
+struct objectflatmachine_t {
+    objectmachine_t *machine; /* the flattened machine */
+    objectmachine_t *innermost_machine; /* the machine below all decorators */
+    objectflatcommand_t *command; /* commands in order of execution */
+    int command_count;
+};
+
+/*
+ * objectflatmachine_create()
+ * Flattens a machine built with decorators. This should be called after the
+ * machine has been fully built; the decorators are not modified
+ */
+objectflatmachine_t* objectflatmachine_create(objectmachine_t *machine)
+{
+    objectflatmachine_t *flat = mallocx(sizeof *flat);
+    objectmachine_t *m;
+    int n = 0;
+
+    for(m = machine; m->update == objectdecorator_update; m = ((objectdecorator_t*)m)->decorated_machine)
+        n++;
+
+    flat->machine = machine;
+    flat->innermost_machine = m;
+    flat->command_count = n;
+    flat->command = mallocx(max(1, n) * sizeof(*(flat->command)));
+
+    n = 0;
+    for(m = machine; m->update == objectdecorator_update; m = ((objectdecorator_t*)m)->decorated_machine) {
+        flat->command[n].command = ((objectdecorator_t*)m)->command;
+        flat->command[n].decorator = m;
+        n++;
+    }
+
+    return flat;
+}
+
+/*
+ * objectflatmachine_destroy()
+ * Destroys a flattened machine. The decorators are not released
+ */
+objectflatmachine_t* objectflatmachine_destroy(objectflatmachine_t *flat)
+{
+    free(flat->command);
+    free(flat);
+    return NULL;
+}
+
+/*
+ * objectflatmachine_machine()
+ * The machine that has been flattened
+ */
+objectmachine_t* objectflatmachine_machine(const objectflatmachine_t *flat)
+{
+    return flat->machine;
+}
+
+/*
+ * objectflatmachine_update()
+ * Updates a flattened machine. This is equivalent to calling
+ * machine->update(), but without traversing the chain of decorators
+ */
+void objectflatmachine_update(const objectflatmachine_t *flat, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+{
+    const objectflatcommand_t *cmd = flat->command;
+    const objectflatcommand_t *end = cmd + flat->command_count;
+
+    for(; cmd != end; cmd++) {
+        command_count++;
+        if(!cmd->command(cmd->decorator, team, team_size, brick_list, item_list, object_list))
+            return;
+    }
+
+    flat->innermost_machine->update(flat->innermost_machine, team, team_size, brick_list, item_list, object_list);
+}
+
 
 
 /* ----- COMMANDS ----- */
@@ -78,7 +186,7 @@ struct objectdecorator_addcollectibles_t {
 /* private methods */
 static void addcollectibles_init(objectmachine_t *obj);
 static void addcollectibles_release(objectmachine_t *obj);
-static void addcollectibles_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int addcollectibles_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void addcollectibles_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -94,7 +202,8 @@ objectmachine_t* objectdecorator_addcollectibles_new(objectmachine_t *decorated_
 
     obj->init = addcollectibles_init;
     obj->release = addcollectibles_release;
-    obj->update = addcollectibles_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = addcollectibles_update;
     obj->render = addcollectibles_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -129,15 +238,13 @@ void addcollectibles_release(objectmachine_t *obj)
     free(obj);
 }
 
-void addcollectibles_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int addcollectibles_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_addcollectibles_t *me = (objectdecorator_addcollectibles_t*)obj;
 
     player_set_collectibles( player_get_collectibles() + (int)expression_evaluate(me->collectibles) );
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void addcollectibles_render(objectmachine_t *obj, v2d_t camera_position)
@@ -160,7 +267,7 @@ struct objectdecorator_addlives_t {
 /* private methods */
 static void addlives_init(objectmachine_t *obj);
 static void addlives_release(objectmachine_t *obj);
-static void addlives_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int addlives_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void addlives_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -176,7 +283,8 @@ objectmachine_t* objectdecorator_addlives_new(objectmachine_t *decorated_machine
 
     obj->init = addlives_init;
     obj->release = addlives_release;
-    obj->update = addlives_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = addlives_update;
     obj->render = addlives_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -211,15 +319,13 @@ void addlives_release(objectmachine_t *obj)
     free(obj);
 }
 
-void addlives_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int addlives_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_addlives_t *me = (objectdecorator_addlives_t*)obj;
 
     player_set_lives( player_get_lives() + (int)expression_evaluate(me->lives) );
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void addlives_render(objectmachine_t *obj, v2d_t camera_position)
@@ -242,7 +348,7 @@ struct objectdecorator_addtoscore_t {
 /* private methods */
 static void addtoscore_init(objectmachine_t *obj);
 static void addtoscore_release(objectmachine_t *obj);
-static void addtoscore_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int addtoscore_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void addtoscore_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -257,7 +363,8 @@ objectmachine_t* objectdecorator_addtoscore_new(objectmachine_t *decorated_machi
 
     obj->init = addtoscore_init;
     obj->release = addtoscore_release;
-    obj->update = addtoscore_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = addtoscore_update;
     obj->render = addtoscore_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -292,15 +399,13 @@ void addtoscore_release(objectmachine_t *obj)
     free(obj);
 }
 
-void addtoscore_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int addtoscore_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_addtoscore_t *me = (objectdecorator_addtoscore_t*)obj;
 
     level_add_to_score( (int)expression_evaluate(me->score) );
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void addtoscore_render(objectmachine_t *obj, v2d_t camera_position)
@@ -322,7 +427,7 @@ struct objectdecorator_asktoleave_t {
 /* private methods */
 static void asktoleave_init(objectmachine_t *obj);
 static void asktoleave_release(objectmachine_t *obj);
-static void asktoleave_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int asktoleave_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void asktoleave_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -338,7 +443,8 @@ objectmachine_t* objectdecorator_asktoleave_new(objectmachine_t *decorated_machi
 
     obj->init = asktoleave_init;
     obj->release = asktoleave_release;
-    obj->update = asktoleave_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = asktoleave_update;
     obj->render = asktoleave_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -371,14 +477,11 @@ void asktoleave_release(objectmachine_t *obj)
     free(obj);
 }
 
-void asktoleave_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int asktoleave_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
-
     level_ask_to_leave();
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void asktoleave_render(objectmachine_t *obj, v2d_t camera_position)
@@ -402,7 +505,7 @@ struct objectdecorator_attachtoplayer_t {
 /* private methods */
 static void attachtoplayer_init(objectmachine_t *obj);
 static void attachtoplayer_release(objectmachine_t *obj);
-static void attachtoplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int attachtoplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void attachtoplayer_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -420,7 +523,8 @@ objectmachine_t* objectdecorator_attachtoplayer_new(objectmachine_t *decorated_m
 
     obj->init = attachtoplayer_init;
     obj->release = attachtoplayer_release;
-    obj->update = attachtoplayer_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = attachtoplayer_update;
     obj->render = attachtoplayer_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -458,10 +562,8 @@ void attachtoplayer_release(objectmachine_t *obj)
     free(obj);
 }
 
-void attachtoplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int attachtoplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_attachtoplayer_t *me = (objectdecorator_attachtoplayer_t*)obj;
     object_t *object = obj->get_object_instance(obj);
     player_t *player = enemy_get_observed_player(object);
@@ -472,7 +574,7 @@ void attachtoplayer_update(objectmachine_t *obj, player_t **team, int team_size,
     object->attached_to_player_offset = v2d_rotate(offset, -player->actor->angle);
     object->actor->position = v2d_add(player->actor->position, object->attached_to_player_offset);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void attachtoplayer_render(objectmachine_t *obj, v2d_t camera_position)
@@ -560,7 +662,7 @@ static void stopsamplestrategy_release(audiostrategy_t *s);
 /* private methods */
 static void audiocommand_init(objectmachine_t *obj);
 static void audiocommand_release(objectmachine_t *obj);
-static void audiocommand_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int audiocommand_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void audiocommand_render(objectmachine_t *obj, v2d_t camera_position);
 
 static objectmachine_t* audiocommand_make_decorator(objectmachine_t *decorated_machine, audiostrategy_t *strategy);
@@ -621,15 +723,13 @@ void audiocommand_release(objectmachine_t *obj)
     free(obj);
 }
 
-void audiocommand_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int audiocommand_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_audio_t *me = (objectdecorator_audio_t*)obj;
 
     me->strategy->update(me->strategy);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void audiocommand_render(objectmachine_t *obj, v2d_t camera_position)
@@ -656,7 +756,8 @@ objectmachine_t* audiocommand_make_decorator(objectmachine_t *decorated_machine,
 
     obj->init = audiocommand_init;
     obj->release = audiocommand_release;
-    obj->update = audiocommand_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = audiocommand_update;
     obj->render = audiocommand_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -843,7 +944,7 @@ struct objectdecorator_bounceplayer_t {
 /* private methods */
 static void bounceplayer_init(objectmachine_t *obj);
 static void bounceplayer_release(objectmachine_t *obj);
-static void bounceplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int bounceplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void bounceplayer_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -859,7 +960,8 @@ objectmachine_t* objectdecorator_bounceplayer_new(objectmachine_t *decorated_mac
 
     obj->init = bounceplayer_init;
     obj->release = bounceplayer_release;
-    obj->update = bounceplayer_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = bounceplayer_update;
     obj->render = bounceplayer_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -892,16 +994,14 @@ void bounceplayer_release(objectmachine_t *obj)
     free(obj);
 }
 
-void bounceplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int bounceplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     object_t *object = obj->get_object_instance(obj);
     player_t *player = enemy_get_observed_player(obj->get_object_instance(obj));
 
     player_bounce_ex(player, object->actor, FALSE);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void bounceplayer_render(objectmachine_t *obj, v2d_t camera_position)
@@ -925,7 +1025,7 @@ struct objectdecorator_bullettrajectory_t {
 /* private methods */
 static void bullettrajectory_init(objectmachine_t *obj);
 static void bullettrajectory_release(objectmachine_t *obj);
-static void bullettrajectory_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int bullettrajectory_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void bullettrajectory_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -943,7 +1043,8 @@ objectmachine_t* objectdecorator_bullettrajectory_new(objectmachine_t *decorated
 
     obj->init = bullettrajectory_init;
     obj->release = bullettrajectory_release;
-    obj->update = bullettrajectory_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = bullettrajectory_update;
     obj->render = bullettrajectory_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -981,10 +1082,8 @@ void bullettrajectory_release(objectmachine_t *obj)
     free(obj);
 }
 
-void bullettrajectory_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int bullettrajectory_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_bullettrajectory_t *me = (objectdecorator_bullettrajectory_t*)obj;
     object_t *object = obj->get_object_instance(obj);
     float dt = timer_get_delta();
@@ -994,7 +1093,7 @@ void bullettrajectory_update(objectmachine_t *obj, player_t **team, int team_siz
     ds = v2d_multiply(speed, dt);
     object->actor->position = v2d_add(object->actor->position, ds);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void bullettrajectory_render(objectmachine_t *obj, v2d_t camera_position)
@@ -1018,7 +1117,7 @@ struct objectdecorator_camerafocus_t {
 /* private methods */
 static void camerafocus_init(objectmachine_t *obj);
 static void camerafocus_release(objectmachine_t *obj);
-static void camerafocus_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int camerafocus_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void camerafocus_render(objectmachine_t *obj, v2d_t camera_position);
 
 static objectmachine_t* camerafocus_make_decorator(objectmachine_t *decorated_machine, void (*strategy)(objectmachine_t*));
@@ -1050,7 +1149,8 @@ objectmachine_t* camerafocus_make_decorator(objectmachine_t *decorated_machine,
 
     obj->init = camerafocus_init;
     obj->release = camerafocus_release;
-    obj->update = camerafocus_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = camerafocus_update;
     obj->render = camerafocus_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -1084,15 +1184,13 @@ void camerafocus_release(objectmachine_t *obj)
     free(obj);
 }
 
-void camerafocus_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int camerafocus_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_camerafocus_t *me = (objectdecorator_camerafocus_t*)obj;
 
     me->strategy(obj);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void camerafocus_render(objectmachine_t *obj, v2d_t camera_position)
@@ -1129,7 +1227,7 @@ struct objectdecorator_changeclosestobjectstate_t {
 /* private methods */
 static void changeclosestobjectstate_init(objectmachine_t *obj);
 static void changeclosestobjectstate_release(objectmachine_t *obj);
-static void changeclosestobjectstate_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int changeclosestobjectstate_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void changeclosestobjectstate_render(objectmachine_t *obj, v2d_t camera_position);
 
 static object_t *find_closest_object(object_t *me, object_list_t *list, const char* desired_name, float *distance);
@@ -1145,7 +1243,8 @@ objectmachine_t* objectdecorator_changeclosestobjectstate_new(objectmachine_t *d
 
     obj->init = changeclosestobjectstate_init;
     obj->release = changeclosestobjectstate_release;
-    obj->update = changeclosestobjectstate_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = changeclosestobjectstate_update;
     obj->render = changeclosestobjectstate_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -1181,11 +1280,9 @@ void changeclosestobjectstate_release(objectmachine_t *obj)
     free(obj);
 }
 
-void changeclosestobjectstate_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int changeclosestobjectstate_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
     objectdecorator_changeclosestobjectstate_t *me = (objectdecorator_changeclosestobjectstate_t*)obj;
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     object_t *object = obj->get_object_instance(obj);
     object_t *target = find_closest_object(object, object_list, me->object_name, NULL);
 
@@ -1195,7 +1292,7 @@ void changeclosestobjectstate_update(objectmachine_t *obj, player_t **team, int
         nanocalcext_set_target_object(object, brick_list, item_list, object_list); /* restore nanocalc's target object */
     }
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void changeclosestobjectstate_render(objectmachine_t *obj, v2d_t camera_position)
@@ -1252,7 +1349,7 @@ static void changeparentstate_strategy(objectdecorator_children_t *me, player_t
 /* private methods */
 static void childrencommand_init(objectmachine_t *obj);
 static void childrencommand_release(objectmachine_t *obj);
-static void childrencommand_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int childrencommand_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void childrencommand_render(objectmachine_t *obj, v2d_t camera_position);
 
 static objectmachine_t *childrencommand_make_decorator(objectmachine_t *decorated_machine, childrenstrategy_t strategy, expression_t *offset_x, expression_t *offset_y, const char *object_name, const char *child_name, const char *new_state_name);
@@ -1285,7 +1382,8 @@ objectmachine_t *childrencommand_make_decorator(objectmachine_t *decorated_machi
 
     obj->init = childrencommand_init;
     obj->release = childrencommand_release;
-    obj->update = childrencommand_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = childrencommand_update;
     obj->render = childrencommand_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -1337,15 +1435,13 @@ void childrencommand_release(objectmachine_t *obj)
     free(obj);
 }
 
-void childrencommand_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int childrencommand_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
     objectdecorator_children_t *me = (objectdecorator_children_t*)obj;
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
 
     me->strategy(me, team, team_size, brick_list, item_list, object_list);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void childrencommand_render(objectmachine_t *obj, v2d_t camera_position)
@@ -1415,7 +1511,7 @@ struct objectdecorator_clearlevel_t {
 /* private methods */
 static void clearlevel_init(objectmachine_t *obj);
 static void clearlevel_release(objectmachine_t *obj);
-static void clearlevel_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int clearlevel_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void clearlevel_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -1431,7 +1527,8 @@ objectmachine_t* objectdecorator_clearlevel_new(objectmachine_t *decorated_machi
 
     obj->init = clearlevel_init;
     obj->release = clearlevel_release;
-    obj->update = clearlevel_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = clearlevel_update;
     obj->render = clearlevel_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -1464,15 +1561,13 @@ void clearlevel_release(objectmachine_t *obj)
     free(obj);
 }
 
-void clearlevel_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int clearlevel_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     object_t *object = obj->get_object_instance(obj);
 
     level_clear(object->actor);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void clearlevel_render(objectmachine_t *obj, v2d_t camera_position)
@@ -1496,7 +1591,7 @@ struct objectdecorator_createitem_t {
 /* private methods */
 static void createitem_init(objectmachine_t *obj);
 static void createitem_release(objectmachine_t *obj);
-static void createitem_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int createitem_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void createitem_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -1510,7 +1605,8 @@ objectmachine_t* objectdecorator_createitem_new(objectmachine_t *decorated_machi
 
     obj->init = createitem_init;
     obj->release = createitem_release;
-    obj->update = createitem_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = createitem_update;
     obj->render = createitem_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -1546,11 +1642,9 @@ void createitem_release(objectmachine_t *obj)
     free(obj);
 }
 
-void createitem_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int createitem_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
     objectdecorator_createitem_t *me = (objectdecorator_createitem_t*)obj;
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     object_t *object = obj->get_object_instance(obj);
     int item_id;
     v2d_t offset;
@@ -1561,7 +1655,7 @@ void createitem_update(objectmachine_t *obj, player_t **team, int team_size, bri
 
     level_create_legacy_item(item_id, v2d_add(object->actor->position, offset));
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void createitem_render(objectmachine_t *obj, v2d_t camera_position)
@@ -1583,7 +1677,7 @@ struct objectdecorator_destroy_t {
 /* private methods */
 static void destroy_init(objectmachine_t *obj);
 static void destroy_release(objectmachine_t *obj);
-static void destroy_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int destroy_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void destroy_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -1601,7 +1695,8 @@ objectmachine_t* objectdecorator_destroy_new(objectmachine_t *decorated_machine)
 
     obj->init = destroy_init;
     obj->release = destroy_release;
-    obj->update = destroy_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = destroy_update;
     obj->render = destroy_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -1635,16 +1730,13 @@ void destroy_release(objectmachine_t *obj)
     free(obj);
 }
 
-void destroy_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int destroy_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    /*objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;*/
-
     object_t *object = obj->get_object_instance(obj);
     object->state = ES_DEAD;
 
     /* suspend the execution */
-    /*decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);*/
+    return FALSE;
 }
 
 void destroy_render(objectmachine_t *obj, v2d_t camera_position)
@@ -1670,7 +1762,7 @@ struct objectdecorator_dialogbox_t {
 /* private methods */
 static void dialogbox_init(objectmachine_t *obj);
 static void dialogbox_release(objectmachine_t *obj);
-static void dialogbox_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int dialogbox_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void dialogbox_render(objectmachine_t *obj, v2d_t camera_position);
 
 static objectmachine_t* dialogbox_make_decorator(objectmachine_t *decorated_machine, const char *title, const char *message, void (*strategy)());
@@ -1702,7 +1794,8 @@ objectmachine_t* dialogbox_make_decorator(objectmachine_t *decorated_machine, co
 
     obj->init = dialogbox_init;
     obj->release = dialogbox_release;
-    obj->update = dialogbox_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = dialogbox_update;
     obj->render = dialogbox_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -1736,15 +1829,13 @@ void dialogbox_release(objectmachine_t *obj)
     free(obj);
 }
 
-void dialogbox_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int dialogbox_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_dialogbox_t *me = (objectdecorator_dialogbox_t*)obj;
 
     me->strategy(me);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void dialogbox_render(objectmachine_t *obj, v2d_t camera_position)
@@ -1780,7 +1871,7 @@ struct objectdecorator_ellipticaltrajectory_t {
 /* private methods */
 static void ellipticaltrajectory_init(objectmachine_t *obj);
 static void ellipticaltrajectory_release(objectmachine_t *obj);
-static void ellipticaltrajectory_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int ellipticaltrajectory_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void ellipticaltrajectory_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -1796,7 +1887,8 @@ objectmachine_t* objectdecorator_ellipticaltrajectory_new(objectmachine_t *decor
 
     obj->init = ellipticaltrajectory_init;
     obj->release = ellipticaltrajectory_release;
-    obj->update = ellipticaltrajectory_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = ellipticaltrajectory_update;
     obj->render = ellipticaltrajectory_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -1842,10 +1934,8 @@ void ellipticaltrajectory_release(objectmachine_t *obj)
     free(obj);
 }
 
-void ellipticaltrajectory_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int ellipticaltrajectory_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_ellipticaltrajectory_t *me = (objectdecorator_ellipticaltrajectory_t*)obj;
     object_t *object = obj->get_object_instance(obj);
     actor_t *act = object->actor;
@@ -1916,7 +2006,7 @@ void ellipticaltrajectory_update(objectmachine_t *obj, player_t **team, int team
     }
 
     /* decorator pattern */
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void ellipticaltrajectory_render(objectmachine_t *obj, v2d_t camera_position)
@@ -1939,7 +2029,7 @@ struct objectdecorator_enemy_t {
 /* private methods */
 static void enemydecorator_init(objectmachine_t *obj);
 static void enemydecorator_release(objectmachine_t *obj);
-static void enemydecorator_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int enemydecorator_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void enemydecorator_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -1955,7 +2045,8 @@ objectmachine_t* objectdecorator_enemy_new(objectmachine_t *decorated_machine, e
 
     obj->init = enemydecorator_init;
     obj->release = enemydecorator_release;
-    obj->update = enemydecorator_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = enemydecorator_update;
     obj->render = enemydecorator_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -1991,16 +2082,18 @@ void enemydecorator_release(objectmachine_t *obj)
     free(obj);
 }
 
-void enemydecorator_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int enemydecorator_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
     objectdecorator_enemy_t *me = (objectdecorator_enemy_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     object_t *object = obj->get_object_instance(obj);
     int i, score;
 
     score = (int)expression_evaluate(me->score);
 
+    /* broadphase */
+    if(!enemy_may_collide_with_team(object, team, team_size))
+        return TRUE;
+
     /* player x object collision */
     for(i=0; i<team_size; i++) {
         player_t *player = team[i];
@@ -2021,7 +2114,7 @@ void enemydecorator_update(objectmachine_t *obj, player_t **team, int team_size,
         }
     }
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void enemydecorator_render(objectmachine_t *obj, v2d_t camera_position)
@@ -2092,7 +2185,7 @@ static void objectdecorator_executefor_destructor(objectdecorator_executebase_t
 /* private methods */
 static void executecommand_init(objectmachine_t *obj);
 static void executecommand_release(objectmachine_t *obj);
-static void executecommand_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int executecommand_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void executecommand_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -2107,7 +2200,8 @@ objectmachine_t* objectdecorator_execute_new(objectmachine_t *decorated_machine,
 
     obj->init = executecommand_init;
     obj->release = executecommand_release;
-    obj->update = executecommand_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = executecommand_update;
     obj->render = executecommand_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -2129,7 +2223,8 @@ objectmachine_t* objectdecorator_executeif_new(objectmachine_t *decorated_machin
 
     obj->init = executecommand_init;
     obj->release = executecommand_release;
-    obj->update = executecommand_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = executecommand_update;
     obj->render = executecommand_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -2152,7 +2247,8 @@ objectmachine_t* objectdecorator_executeunless_new(objectmachine_t *decorated_ma
 
     obj->init = executecommand_init;
     obj->release = executecommand_release;
-    obj->update = executecommand_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = executecommand_update;
     obj->render = executecommand_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -2175,7 +2271,8 @@ objectmachine_t* objectdecorator_executewhile_new(objectmachine_t *decorated_mac
 
     obj->init = executecommand_init;
     obj->release = executecommand_release;
-    obj->update = executecommand_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = executecommand_update;
     obj->render = executecommand_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -2198,7 +2295,8 @@ objectmachine_t* objectdecorator_executefor_new(objectmachine_t *decorated_machi
 
     obj->init = executecommand_init;
     obj->release = executecommand_release;
-    obj->update = executecommand_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = executecommand_update;
     obj->render = executecommand_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -2239,16 +2337,14 @@ void executecommand_release(objectmachine_t *obj)
     free(obj);
 }
 
-void executecommand_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int executecommand_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
     objectdecorator_executebase_t *me = (objectdecorator_executebase_t*)obj;
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     object_t *object = obj->get_object_instance(obj);
 
     me->update(me, object, team, team_size, brick_list, item_list, object_list);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void executecommand_render(objectmachine_t *obj, v2d_t camera_position)
@@ -2382,7 +2478,7 @@ struct objectdecorator_gravity_t {
 /* private methods */
 static void gravity_init(objectmachine_t *obj);
 static void gravity_release(objectmachine_t *obj);
-static void gravity_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int gravity_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void gravity_render(objectmachine_t *obj, v2d_t camera_position);
 
 static int hit_test(const brick_t* brk, int x, int y);
@@ -2400,7 +2496,8 @@ objectmachine_t* objectdecorator_gravity_new(objectmachine_t *decorated_machine)
 
     obj->init = gravity_init;
     obj->release = gravity_release;
-    obj->update = gravity_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = gravity_update;
     obj->render = gravity_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -2433,10 +2530,8 @@ void gravity_release(objectmachine_t *obj)
     free(obj);
 }
 
-void gravity_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int gravity_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     object_t *object = obj->get_object_instance(obj);
     actor_t *act = object->actor;
     float dt = timer_get_delta(), g = level_gravity();
@@ -2527,7 +2622,7 @@ void gravity_update(objectmachine_t *obj, player_t **team, int team_size, brick_
 
     /* --------------------------- */
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void gravity_render(objectmachine_t *obj, v2d_t camera_position)
@@ -2595,7 +2690,7 @@ static int acid_strategy(player_t *p);
 /* private methods */
 static void hitplayer_init(objectmachine_t *obj);
 static void hitplayer_release(objectmachine_t *obj);
-static void hitplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int hitplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void hitplayer_render(objectmachine_t *obj, v2d_t camera_position);
 static objectmachine_t *hitplayer_make_decorator(objectmachine_t *decorated_machine, int (*strategy)(player_t*));
 
@@ -2635,7 +2730,8 @@ objectmachine_t *hitplayer_make_decorator(objectmachine_t *decorated_machine, in
 
     obj->init = hitplayer_init;
     obj->release = hitplayer_release;
-    obj->update = hitplayer_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = hitplayer_update;
     obj->render = hitplayer_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -2665,10 +2761,8 @@ void hitplayer_release(objectmachine_t *obj)
     free(obj);
 }
 
-void hitplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int hitplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_hitplayer_t *me = (objectdecorator_hitplayer_t*)obj;
     object_t *object = obj->get_object_instance(obj);
     player_t *player = enemy_get_observed_player(obj->get_object_instance(obj));
@@ -2676,7 +2770,7 @@ void hitplayer_update(objectmachine_t *obj, player_t **team, int team_size, bric
     if(!player_is_invincible(player) && me->should_hit_the_player(player))
         player_hit_ex(player, object->actor);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void hitplayer_render(objectmachine_t *obj, v2d_t camera_position)
@@ -2720,7 +2814,7 @@ struct objectdecorator_jump_t {
 /* private methods */
 static void jump_init(objectmachine_t *obj);
 static void jump_release(objectmachine_t *obj);
-static void jump_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int jump_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void jump_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -2736,7 +2830,8 @@ objectmachine_t* objectdecorator_jump_new(objectmachine_t *decorated_machine, ex
 
     obj->init = jump_init;
     obj->release = jump_release;
-    obj->update = jump_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = jump_update;
     obj->render = jump_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -2771,10 +2866,8 @@ void jump_release(objectmachine_t *obj)
     free(obj);
 }
 
-void jump_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int jump_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_jump_t *me = (objectdecorator_jump_t*)obj;
     object_t *object = obj->get_object_instance(obj);
     actor_t *act = object->actor;
@@ -2792,7 +2885,7 @@ void jump_update(objectmachine_t *obj, player_t **team, int team_size, brick_lis
     /*act->jump_strength = jump_strength;
     input_simulate_button_down(act->input, IB_FIRE1);*/
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void jump_render(objectmachine_t *obj, v2d_t camera_position)
@@ -2814,7 +2907,7 @@ struct objectdecorator_killplayer_t {
 /* private methods */
 static void killplayer_init(objectmachine_t *obj);
 static void killplayer_release(objectmachine_t *obj);
-static void killplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int killplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void killplayer_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -2832,7 +2925,8 @@ objectmachine_t* objectdecorator_killplayer_new(objectmachine_t *decorated_machi
 
     obj->init = killplayer_init;
     obj->release = killplayer_release;
-    obj->update = killplayer_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = killplayer_update;
     obj->render = killplayer_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -2866,15 +2960,13 @@ void killplayer_release(objectmachine_t *obj)
     free(obj);
 }
 
-void killplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int killplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     player_t *player = enemy_get_observed_player(obj->get_object_instance(obj));
 
     player_kill(player);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void killplayer_render(objectmachine_t *obj, v2d_t camera_position)
@@ -2897,7 +2989,7 @@ struct objectdecorator_launchurl_t {
 /* private methods */
 static void launchurl_init(objectmachine_t *obj);
 static void launchurl_release(objectmachine_t *obj);
-static void launchurl_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int launchurl_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void launchurl_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -2915,7 +3007,8 @@ objectmachine_t* objectdecorator_launchurl_new(objectmachine_t *decorated_machin
 
     obj->init = launchurl_init;
     obj->release = launchurl_release;
-    obj->update = launchurl_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = launchurl_update;
     obj->render = launchurl_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -2950,16 +3043,14 @@ void launchurl_release(objectmachine_t *obj)
     free(obj);
 }
 
-void launchurl_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int launchurl_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_launchurl_t *me = (objectdecorator_launchurl_t*)obj;
 
     if(!launch_url(me->url))
         video_showmessage("Can't open URL.");
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void launchurl_render(objectmachine_t *obj, v2d_t camera_position)
@@ -2982,7 +3073,7 @@ struct objectdecorator_loadlevel_t {
 /* private methods */
 static void loadlevel_init(objectmachine_t *obj);
 static void loadlevel_release(objectmachine_t *obj);
-static void loadlevel_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int loadlevel_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void loadlevel_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -3000,7 +3091,8 @@ objectmachine_t* objectdecorator_loadlevel_new(objectmachine_t *decorated_machin
 
     obj->init = loadlevel_init;
     obj->release = loadlevel_release;
-    obj->update = loadlevel_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = loadlevel_update;
     obj->render = loadlevel_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -3036,15 +3128,13 @@ void loadlevel_release(objectmachine_t *obj)
     free(obj);
 }
 
-void loadlevel_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int loadlevel_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    /*objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;*/
     objectdecorator_loadlevel_t *me = (objectdecorator_loadlevel_t*)obj;
 
     level_change(me->level_path);
 
-    /*decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);*/
+    return FALSE;
 }
 
 void loadlevel_render(objectmachine_t *obj, v2d_t camera_position)
@@ -3070,7 +3160,7 @@ struct objectdecorator_lockcamera_t {
 /* private methods */
 static void lockcamera_init(objectmachine_t *obj);
 static void lockcamera_release(objectmachine_t *obj);
-static void lockcamera_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int lockcamera_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void lockcamera_render(objectmachine_t *obj, v2d_t camera_position);
 
 static void get_rectangle_coordinates(objectdecorator_lockcamera_t *me, int *x1, int *y1, int *x2, int *y2);
@@ -3088,7 +3178,8 @@ objectmachine_t* objectdecorator_lockcamera_new(objectmachine_t *decorated_machi
 
     obj->init = lockcamera_init;
     obj->release = lockcamera_release;
-    obj->update = lockcamera_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = lockcamera_update;
     obj->render = lockcamera_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -3138,10 +3229,8 @@ void lockcamera_release(objectmachine_t *obj)
     free(obj);
 }
 
-void lockcamera_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int lockcamera_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     object_t *object = obj->get_object_instance(obj);
     player_t *player = enemy_get_observed_player(object);
     objectdecorator_lockcamera_t *me = (objectdecorator_lockcamera_t*)obj;
@@ -3215,7 +3304,7 @@ void lockcamera_update(objectmachine_t *obj, player_t **team, int team_size, bri
         player_set_ypos(player, clip(ta->position.y, ry, ry + rh));
     }
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void lockcamera_render(objectmachine_t *obj, v2d_t camera_position)
@@ -3286,7 +3375,7 @@ struct objectdecorator_look_t {
 static objectmachine_t* objectdecorator_look_new(objectmachine_t *decorated_machine, void (*look_strategy)(objectdecorator_look_t*));
 static void look_init(objectmachine_t *obj);
 static void look_release(objectmachine_t *obj);
-static void look_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int look_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void look_render(objectmachine_t *obj, v2d_t camera_position);
 
 /* private strategies */
@@ -3334,7 +3423,8 @@ objectmachine_t* objectdecorator_look_new(objectmachine_t *decorated_machine, vo
 
     obj->init = look_init;
     obj->release = look_release;
-    obj->update = look_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = look_update;
     obj->render = look_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -3365,15 +3455,13 @@ void look_release(objectmachine_t *obj)
     free(obj);
 }
 
-void look_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int look_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_look_t *me = (objectdecorator_look_t*)obj;
 
     me->look_strategy(me);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void look_render(objectmachine_t *obj, v2d_t camera_position)
@@ -3440,7 +3528,7 @@ struct objectdecorator_mosquitomovement_t {
 /* private methods */
 static void mosquitomovement_init(objectmachine_t *obj);
 static void mosquitomovement_release(objectmachine_t *obj);
-static void mosquitomovement_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int mosquitomovement_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void mosquitomovement_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -3458,7 +3546,8 @@ objectmachine_t* objectdecorator_mosquitomovement_new(objectmachine_t *decorated
 
     obj->init = mosquitomovement_init;
     obj->release = mosquitomovement_release;
-    obj->update = mosquitomovement_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = mosquitomovement_update;
     obj->render = mosquitomovement_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -3494,10 +3583,8 @@ void mosquitomovement_release(objectmachine_t *obj)
     free(obj);
 }
 
-void mosquitomovement_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int mosquitomovement_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_mosquitomovement_t *me = (objectdecorator_mosquitomovement_t*)obj;
     object_t *object = obj->get_object_instance(obj);
     player_t *player = enemy_get_observed_player(object);
@@ -3511,7 +3598,7 @@ void mosquitomovement_update(objectmachine_t *obj, player_t **team, int team_siz
         object->actor->position = v2d_add(object->actor->position, ds);
     }
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void mosquitomovement_render(objectmachine_t *obj, v2d_t camera_position)
@@ -3534,7 +3621,7 @@ struct objectdecorator_moveplayer_t {
 /* private methods */
 static void moveplayer_init(objectmachine_t *obj);
 static void moveplayer_release(objectmachine_t *obj);
-static void moveplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int moveplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void moveplayer_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -3552,7 +3639,8 @@ objectmachine_t* objectdecorator_moveplayer_new(objectmachine_t *decorated_machi
 
     obj->init = moveplayer_init;
     obj->release = moveplayer_release;
-    obj->update = moveplayer_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = moveplayer_update;
     obj->render = moveplayer_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -3590,10 +3678,8 @@ void moveplayer_release(objectmachine_t *obj)
     free(obj);
 }
 
-void moveplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int moveplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_moveplayer_t *me = (objectdecorator_moveplayer_t*)obj;
     float dt = timer_get_delta();
     v2d_t speed = v2d_new(expression_evaluate(me->speed_x), expression_evaluate(me->speed_y));
@@ -3604,7 +3690,7 @@ void moveplayer_update(objectmachine_t *obj, player_t **team, int team_size, bri
     v2d_t new_pos = v2d_add(prev_pos, ds);
     player_set_position(player, new_pos);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void moveplayer_render(objectmachine_t *obj, v2d_t camera_position)
@@ -3626,7 +3712,7 @@ struct objectdecorator_nextlevel_t {
 /* private methods */
 static void nextlevel_init(objectmachine_t *obj);
 static void nextlevel_release(objectmachine_t *obj);
-static void nextlevel_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int nextlevel_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void nextlevel_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -3642,7 +3728,8 @@ objectmachine_t* objectdecorator_nextlevel_new(objectmachine_t *decorated_machin
 
     obj->init = nextlevel_init;
     obj->release = nextlevel_release;
-    obj->update = nextlevel_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = nextlevel_update;
     obj->render = nextlevel_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -3675,14 +3762,11 @@ void nextlevel_release(objectmachine_t *obj)
     free(obj);
 }
 
-void nextlevel_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int nextlevel_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
-
     level_jump_to_next_stage();
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void nextlevel_render(objectmachine_t *obj, v2d_t camera_position)
@@ -3714,7 +3798,7 @@ struct observeplayerstrategy_t {
 /* private methods */
 static void observeplayer_init(objectmachine_t *obj);
 static void observeplayer_release(objectmachine_t *obj);
-static void observeplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int observeplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void observeplayer_render(objectmachine_t *obj, v2d_t camera_position);
 
 static objectmachine_t* observeplayer_make_decorator(objectmachine_t *decorated_machine, observeplayerstrategy_t *strategy);
@@ -3764,7 +3848,8 @@ objectmachine_t* observeplayer_make_decorator(objectmachine_t *decorated_machine
 
     obj->init = observeplayer_init;
     obj->release = observeplayer_release;
-    obj->update = observeplayer_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = observeplayer_update;
     obj->render = observeplayer_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -3807,15 +3892,13 @@ void observeplayer_release(objectmachine_t *obj)
     free(obj);
 }
 
-void observeplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int observeplayer_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_observeplayer_t *me = (objectdecorator_observeplayer_t*)obj;
 
     me->strategy->run(me->strategy, team, team_size);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void observeplayer_render(objectmachine_t *obj, v2d_t camera_position)
@@ -4142,7 +4225,7 @@ static int onmusicplay_should_trigger_event(eventstrategy_t *event, object_t *ob
 static objectmachine_t *onevent_make_decorator(objectmachine_t *decorated_machine, const char *new_state_name, eventstrategy_t *strategy);
 static void onevent_init(objectmachine_t *obj);
 static void onevent_release(objectmachine_t *obj);
-static void onevent_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int onevent_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void onevent_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -4423,7 +4506,8 @@ objectmachine_t *onevent_make_decorator(objectmachine_t *decorated_machine, cons
 
     obj->init = onevent_init;
     obj->release = onevent_release;
-    obj->update = onevent_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = onevent_update;
     obj->render = onevent_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -4458,17 +4542,17 @@ void onevent_release(objectmachine_t *obj)
     free(obj);
 }
 
-void onevent_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int onevent_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_onevent_t *me = (objectdecorator_onevent_t*)obj;
     object_t *object = obj->get_object_instance(obj);
 
-    if(me->strategy->should_trigger_event(me->strategy, object, team, team_size, brick_list, item_list, object_list))
+    if(me->strategy->should_trigger_event(me->strategy, object, team, team_size, brick_list, item_list, object_list)) {
         objectvm_set_current_state(object->vm, me->new_state_name);
-    else
-        decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+        return FALSE;
+    }
+
+    return TRUE;
 }
 
 void onevent_render(objectmachine_t *obj, v2d_t camera_position)
@@ -5258,7 +5342,7 @@ struct objectdecorator_pause_t {
 /* private methods */
 static void pause_init(objectmachine_t *obj);
 static void pause_release(objectmachine_t *obj);
-static void pause_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int pause_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void pause_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -5274,7 +5358,8 @@ objectmachine_t* objectdecorator_pause_new(objectmachine_t *decorated_machine)
 
     obj->init = pause_init;
     obj->release = pause_release;
-    obj->update = pause_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = pause_update;
     obj->render = pause_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -5307,14 +5392,11 @@ void pause_release(objectmachine_t *obj)
     free(obj);
 }
 
-void pause_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int pause_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
-
     level_pause();
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void pause_render(objectmachine_t *obj, v2d_t camera_position)
@@ -5337,7 +5419,7 @@ struct objectdecorator_playeraction_t {
 /* private methods */
 static void playeraction_init(objectmachine_t *obj);
 static void playeraction_release(objectmachine_t *obj);
-static void playeraction_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int playeraction_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void playeraction_render(objectmachine_t *obj, v2d_t camera_position);
 
 static objectmachine_t *playeraction_make_decorator(objectmachine_t *decorated_machine, void (*update_strategy)(player_t*));
@@ -5429,7 +5511,8 @@ objectmachine_t* playeraction_make_decorator(objectmachine_t *decorated_machine,
 
     obj->init = playeraction_init;
     obj->release = playeraction_release;
-    obj->update = playeraction_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = playeraction_update;
     obj->render = playeraction_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -5460,16 +5543,14 @@ void playeraction_release(objectmachine_t *obj)
     free(obj);
 }
 
-void playeraction_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int playeraction_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_playeraction_t *me = (objectdecorator_playeraction_t*)obj;
     player_t *player = enemy_get_observed_player(obj->get_object_instance(obj));
 
     me->update(player);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void playeraction_render(objectmachine_t *obj, v2d_t camera_position)
@@ -5549,7 +5630,7 @@ struct objectdecorator_playermovement_t {
 /* private methods */
 static void playermovement_init(objectmachine_t *obj);
 static void playermovement_release(objectmachine_t *obj);
-static void playermovement_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int playermovement_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void playermovement_render(objectmachine_t *obj, v2d_t camera_position);
 
 static objectmachine_t *playermovement_make_decorator(objectmachine_t *decorated_machine, int enable);
@@ -5584,7 +5665,8 @@ objectmachine_t* playermovement_make_decorator(objectmachine_t *decorated_machin
 
     obj->init = playermovement_init;
     obj->release = playermovement_release;
-    obj->update = playermovement_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = playermovement_update;
     obj->render = playermovement_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -5615,16 +5697,14 @@ void playermovement_release(objectmachine_t *obj)
     free(obj);
 }
 
-void playermovement_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int playermovement_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_playermovement_t *me = (objectdecorator_playermovement_t*)obj;
     player_t *player = enemy_get_observed_player(obj->get_object_instance(obj));
 
     player_set_frozen(player, !me->enable);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void playermovement_render(objectmachine_t *obj, v2d_t camera_position)
@@ -5658,7 +5738,7 @@ struct objectdecorator_popquest_t {
 /* private methods */
 static void questcommand_init(objectmachine_t *obj);
 static void questcommand_release(objectmachine_t *obj);
-static void questcommand_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int questcommand_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void questcommand_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -5696,7 +5776,8 @@ objectmachine_t* setup_decorator(objectdecorator_quest_t *me, objectmachine_t *d
 
     obj->init = questcommand_init;
     obj->release = questcommand_release;
-    obj->update = questcommand_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = questcommand_update;
     obj->render = questcommand_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -5727,15 +5808,13 @@ void questcommand_release(objectmachine_t *obj)
     free(obj);
 }
 
-void questcommand_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int questcommand_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
     objectdecorator_quest_t *me = (objectdecorator_quest_t*)obj;
-    /*objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;*/
 
     me->update(me);
 
-    /*decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);*/
+    return FALSE;
 }
 
 void questcommand_render(objectmachine_t *obj, v2d_t camera_position)
@@ -5772,7 +5851,7 @@ struct objectdecorator_resetglobals_t {
 /* private methods */
 static void resetglobals_init(objectmachine_t *obj);
 static void resetglobals_release(objectmachine_t *obj);
-static void resetglobals_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int resetglobals_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void resetglobals_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -5788,7 +5867,8 @@ objectmachine_t* objectdecorator_resetglobals_new(objectmachine_t *decorated_mac
 
     obj->init = resetglobals_init;
     obj->release = resetglobals_release;
-    obj->update = resetglobals_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = resetglobals_update;
     obj->render = resetglobals_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -5821,18 +5901,15 @@ void resetglobals_release(objectmachine_t *obj)
     free(obj);
 }
 
-void resetglobals_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int resetglobals_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
-
     /* reset globals */
     symboltable_clear(symboltable_get_global_table());
 
     /* reset arrays */
     nanocalc_addons_resetarrays();
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void resetglobals_render(objectmachine_t *obj, v2d_t camera_position)
@@ -5854,7 +5931,7 @@ struct objectdecorator_restartlevel_t {
 /* private methods */
 static void restartlevel_init(objectmachine_t *obj);
 static void restartlevel_release(objectmachine_t *obj);
-static void restartlevel_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int restartlevel_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void restartlevel_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -5872,7 +5949,8 @@ objectmachine_t* objectdecorator_restartlevel_new(objectmachine_t *decorated_mac
 
     obj->init = restartlevel_init;
     obj->release = restartlevel_release;
-    obj->update = restartlevel_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = restartlevel_update;
     obj->render = restartlevel_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -5906,14 +5984,11 @@ void restartlevel_release(objectmachine_t *obj)
     free(obj);
 }
 
-void restartlevel_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int restartlevel_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    /*objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;*/
-
     level_restart();
 
-    /*decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);*/
+    return FALSE;
 }
 
 void restartlevel_render(objectmachine_t *obj, v2d_t camera_position)
@@ -5935,7 +6010,7 @@ struct objectdecorator_returntopreviousstate_t {
 /* private methods */
 static void returntopreviousstate_init(objectmachine_t *obj);
 static void returntopreviousstate_release(objectmachine_t *obj);
-static void returntopreviousstate_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int returntopreviousstate_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void returntopreviousstate_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -5951,7 +6026,8 @@ objectmachine_t* objectdecorator_returntopreviousstate_new(objectmachine_t *deco
 
     obj->init = returntopreviousstate_init;
     obj->release = returntopreviousstate_release;
-    obj->update = returntopreviousstate_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = returntopreviousstate_update;
     obj->render = returntopreviousstate_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -5984,15 +6060,12 @@ void returntopreviousstate_release(objectmachine_t *obj)
     free(obj);
 }
 
-void returntopreviousstate_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int returntopreviousstate_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    /*objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;*/
-
     object_t *object = obj->get_object_instance(obj);
     objectvm_return_to_previous_state(object->vm);
 
-    /*decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);*/
+    return FALSE;
 }
 
 void returntopreviousstate_render(objectmachine_t *obj, v2d_t camera_position)
@@ -6014,7 +6087,7 @@ struct objectdecorator_savelevel_t {
 /* private methods */
 static void savelevel_init(objectmachine_t *obj);
 static void savelevel_release(objectmachine_t *obj);
-static void savelevel_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int savelevel_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void savelevel_render(objectmachine_t *obj, v2d_t camera_position);
 static void fix_objects(object_t *obj, void *any_data); /* will fix obj and its children (ie, set ptr->created_from_editor to TRUE) */
 static void unfix_objects(object_t *obj, void *any_data); /* will undo whatever fix_objects() did */
@@ -6034,7 +6107,8 @@ objectmachine_t* objectdecorator_savelevel_new(objectmachine_t *decorated_machin
 
     obj->init = savelevel_init;
     obj->release = savelevel_release;
-    obj->update = savelevel_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = savelevel_update;
     obj->render = savelevel_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -6068,17 +6142,15 @@ void savelevel_release(objectmachine_t *obj)
     free(obj);
 }
 
-void savelevel_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int savelevel_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     object_t *o = obj->get_object_instance(obj);
 
     fix_objects(o, NULL);
     level_persist();
     unfix_objects(o, NULL);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void savelevel_render(objectmachine_t *obj, v2d_t camera_position)
@@ -6115,7 +6187,7 @@ struct objectdecorator_setabsoluteposition_t {
 /* private methods */
 static void setabsoluteposition_init(objectmachine_t *obj);
 static void setabsoluteposition_release(objectmachine_t *obj);
-static void setabsoluteposition_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int setabsoluteposition_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void setabsoluteposition_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -6133,7 +6205,8 @@ objectmachine_t* objectdecorator_setabsoluteposition_new(objectmachine_t *decora
 
     obj->init = setabsoluteposition_init;
     obj->release = setabsoluteposition_release;
-    obj->update = setabsoluteposition_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = setabsoluteposition_update;
     obj->render = setabsoluteposition_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -6171,17 +6244,15 @@ void setabsoluteposition_release(objectmachine_t *obj)
     free(obj);
 }
 
-void setabsoluteposition_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int setabsoluteposition_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_setabsoluteposition_t *me = (objectdecorator_setabsoluteposition_t*)obj;
     object_t *object = obj->get_object_instance(obj);
     v2d_t pos = v2d_new(expression_evaluate(me->pos_x), expression_evaluate(me->pos_y));
 
     object->actor->position = pos;
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void setabsoluteposition_render(objectmachine_t *obj, v2d_t camera_position)
@@ -6204,7 +6275,7 @@ struct objectdecorator_setalpha_t {
 /* private methods */
 static void setalpha_init(objectmachine_t *obj);
 static void setalpha_release(objectmachine_t *obj);
-static void setalpha_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int setalpha_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void setalpha_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -6222,7 +6293,8 @@ objectmachine_t* objectdecorator_setalpha_new(objectmachine_t *decorated_machine
 
     obj->init = setalpha_init;
     obj->release = setalpha_release;
-    obj->update = setalpha_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = setalpha_update;
     obj->render = setalpha_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -6258,17 +6330,15 @@ void setalpha_release(objectmachine_t *obj)
     free(obj);
 }
 
-void setalpha_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int setalpha_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_setalpha_t *me = (objectdecorator_setalpha_t*)obj;
     object_t *object = obj->get_object_instance(obj);
     float alpha = clip01(expression_evaluate(me->alpha));
 
     object->actor->alpha = alpha;
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void setalpha_render(objectmachine_t *obj, v2d_t camera_position)
@@ -6291,7 +6361,7 @@ struct objectdecorator_setangle_t {
 /* private methods */
 static void setangle_init(objectmachine_t *obj);
 static void setangle_release(objectmachine_t *obj);
-static void setangle_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int setangle_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void setangle_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -6309,7 +6379,8 @@ objectmachine_t* objectdecorator_setangle_new(objectmachine_t *decorated_machine
 
     obj->init = setangle_init;
     obj->release = setangle_release;
-    obj->update = setangle_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = setangle_update;
     obj->render = setangle_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -6345,17 +6416,15 @@ void setangle_release(objectmachine_t *obj)
     free(obj);
 }
 
-void setangle_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int setangle_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_setangle_t *me = (objectdecorator_setangle_t*)obj;
     object_t *object = obj->get_object_instance(obj);
 
     float angle = expression_evaluate(me->angle);
     object->actor->angle = angle * PI / 180.0f;
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void setangle_render(objectmachine_t *obj, v2d_t camera_position)
@@ -6425,7 +6494,7 @@ struct objectdecorator_setanimation_t {
 /* private methods */
 static void setanimation_init(objectmachine_t *obj);
 static void setanimation_release(objectmachine_t *obj);
-static void setanimation_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int setanimation_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void setanimation_render(objectmachine_t *obj, v2d_t camera_position);
 
 static objectmachine_t* setanimation_make_decorator(objectdecorator_setanimationstrategy_t *strategy, objectmachine_t *decorated_machine);
@@ -6480,15 +6549,13 @@ void setanimation_release(objectmachine_t *obj)
     free(obj);
 }
 
-void setanimation_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int setanimation_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_setanimation_t *me = (objectdecorator_setanimation_t*)obj;
 
     me->strategy->update(obj);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void setanimation_render(objectmachine_t *obj, v2d_t camera_position)
@@ -6645,7 +6712,8 @@ objectmachine_t* setanimation_make_decorator(objectdecorator_setanimationstrateg
 
     obj->init = setanimation_init;
     obj->release = setanimation_release;
-    obj->update = setanimation_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = setanimation_update;
     obj->render = setanimation_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -6666,7 +6734,7 @@ struct objectdecorator_setobstacle_t {
 /* private methods */
 static void setobstacle_init(objectmachine_t *obj);
 static void setobstacle_release(objectmachine_t *obj);
-static void setobstacle_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int setobstacle_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void setobstacle_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -6684,7 +6752,8 @@ objectmachine_t* objectdecorator_setobstacle_new(objectmachine_t *decorated_mach
 
     obj->init = setobstacle_init;
     obj->release = setobstacle_release;
-    obj->update = setobstacle_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = setobstacle_update;
     obj->render = setobstacle_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -6721,10 +6790,8 @@ void setobstacle_release(objectmachine_t *obj)
     free(obj);
 }
 
-void setobstacle_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int setobstacle_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_setobstacle_t *me = (objectdecorator_setobstacle_t*)obj;
     object_t *object = obj->get_object_instance(obj);
     /*float angle = expression_evaluate(me->angle);*/ /* deprecated */
@@ -6744,7 +6811,7 @@ void setobstacle_update(objectmachine_t *obj, player_t **team, int team_size, br
     object->obstacle = me->is_obstacle;
 
     /* done */
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void setobstacle_render(objectmachine_t *obj, v2d_t camera_position)
@@ -6768,7 +6835,7 @@ struct objectdecorator_setplayeranimation_t {
 /* private methods */
 static void setplayeranimation_init(objectmachine_t *obj);
 static void setplayeranimation_release(objectmachine_t *obj);
-static void setplayeranimation_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int setplayeranimation_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void setplayeranimation_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -6786,7 +6853,8 @@ objectmachine_t* objectdecorator_setplayeranimation_new(objectmachine_t *decorat
 
     obj->init = setplayeranimation_init;
     obj->release = setplayeranimation_release;
-    obj->update = setplayeranimation_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = setplayeranimation_update;
     obj->render = setplayeranimation_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -6824,17 +6892,15 @@ void setplayeranimation_release(objectmachine_t *obj)
     free(obj);
 }
 
-void setplayeranimation_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int setplayeranimation_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_setplayeranimation_t *me = (objectdecorator_setplayeranimation_t*)obj;
     player_t *player = enemy_get_observed_player(obj->get_object_instance(obj));
     int animation_id = (int)expression_evaluate(me->animation_id);
 
     player_override_animation(player, sprite_get_animation(me->sprite_name, animation_id));
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void setplayeranimation_render(objectmachine_t *obj, v2d_t camera_position)
@@ -6857,7 +6923,7 @@ struct objectdecorator_setplayerinputmap_t {
 /* private methods */
 static void setplayerinputmap_init(objectmachine_t *obj);
 static void setplayerinputmap_release(objectmachine_t *obj);
-static void setplayerinputmap_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int setplayerinputmap_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void setplayerinputmap_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -6873,7 +6939,8 @@ objectmachine_t* objectdecorator_setplayerinputmap_new(objectmachine_t *decorate
 
     obj->init = setplayerinputmap_init;
     obj->release = setplayerinputmap_release;
-    obj->update = setplayerinputmap_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = setplayerinputmap_update;
     obj->render = setplayerinputmap_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -6908,10 +6975,8 @@ void setplayerinputmap_release(objectmachine_t *obj)
     free(obj);
 }
 
-void setplayerinputmap_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int setplayerinputmap_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_setplayerinputmap_t *me = (objectdecorator_setplayerinputmap_t*)obj;
     object_t *object = obj->get_object_instance(obj);
     player_t *player = enemy_get_observed_player(object);
@@ -6920,7 +6985,7 @@ void setplayerinputmap_update(objectmachine_t *obj, player_t **team, int team_si
     /* I'm sure 'in' is an inputuserdefined_t* */
     input_change_mapping((inputuserdefined_t*)in, me->inputmap_name);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void setplayerinputmap_render(objectmachine_t *obj, v2d_t camera_position)
@@ -6943,7 +7008,7 @@ struct objectdecorator_setplayerposition_t {
 /* private methods */
 static void setplayerposition_init(objectmachine_t *obj);
 static void setplayerposition_release(objectmachine_t *obj);
-static void setplayerposition_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int setplayerposition_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void setplayerposition_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -6961,7 +7026,8 @@ objectmachine_t* objectdecorator_setplayerposition_new(objectmachine_t *decorate
 
     obj->init = setplayerposition_init;
     obj->release = setplayerposition_release;
-    obj->update = setplayerposition_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = setplayerposition_update;
     obj->render = setplayerposition_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -6999,10 +7065,8 @@ void setplayerposition_release(objectmachine_t *obj)
     free(obj);
 }
 
-void setplayerposition_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int setplayerposition_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_setplayerposition_t *me = (objectdecorator_setplayerposition_t*)obj;
     object_t *object = obj->get_object_instance(obj);
     player_t *player = enemy_get_observed_player(object);
@@ -7011,7 +7075,7 @@ void setplayerposition_update(objectmachine_t *obj, player_t **team, int team_si
     v2d_t new_pos = v2d_add(object->actor->position, offset);
     player_set_position(player, new_pos);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void setplayerposition_render(objectmachine_t *obj, v2d_t camera_position)
@@ -7035,7 +7099,7 @@ struct objectdecorator_setplayerspeed_t {
 /* private methods */
 static void setplayerspeed_init(objectmachine_t *obj);
 static void setplayerspeed_release(objectmachine_t *obj);
-static void setplayerspeed_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int setplayerspeed_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void setplayerspeed_render(objectmachine_t *obj, v2d_t camera_position);
 
 static objectmachine_t* setplayerspeed_make_decorator(objectmachine_t *decorated_machine, expression_t *speed, void (*strategy)(player_t*,expression_t*));
@@ -7071,7 +7135,8 @@ objectmachine_t* setplayerspeed_make_decorator(objectmachine_t *decorated_machin
 
     obj->init = setplayerspeed_init;
     obj->release = setplayerspeed_release;
-    obj->update = setplayerspeed_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = setplayerspeed_update;
     obj->render = setplayerspeed_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -7104,16 +7169,14 @@ void setplayerspeed_release(objectmachine_t *obj)
     free(obj);
 }
 
-void setplayerspeed_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int setplayerspeed_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_setplayerspeed_t *me = (objectdecorator_setplayerspeed_t*)obj;
     player_t *player = enemy_get_observed_player(obj->get_object_instance(obj));
 
     me->strategy(player, me->speed);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void setplayerspeed_render(objectmachine_t *obj, v2d_t camera_position)
@@ -7149,7 +7212,7 @@ struct objectdecorator_setscale_t {
 /* private methods */
 static void setscale_init(objectmachine_t *obj);
 static void setscale_release(objectmachine_t *obj);
-static void setscale_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int setscale_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void setscale_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -7167,7 +7230,8 @@ objectmachine_t* objectdecorator_setscale_new(objectmachine_t *decorated_machine
 
     obj->init = setscale_init;
     obj->release = setscale_release;
-    obj->update = setscale_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = setscale_update;
     obj->render = setscale_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -7205,10 +7269,8 @@ void setscale_release(objectmachine_t *obj)
     free(obj);
 }
 
-void setscale_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int setscale_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_setscale_t *me = (objectdecorator_setscale_t*)obj;
     object_t *object = obj->get_object_instance(obj);
 
@@ -7216,7 +7278,7 @@ void setscale_update(objectmachine_t *obj, player_t **team, int team_size, brick
     float scale_y = max(0.0f, expression_evaluate(me->scale_y));
     object->actor->scale = v2d_new(scale_x, scale_y);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void setscale_render(objectmachine_t *obj, v2d_t camera_position)
@@ -7239,7 +7301,7 @@ struct objectdecorator_setzindex_t {
 /* private methods */
 static void setzindex_init(objectmachine_t *obj);
 static void setzindex_release(objectmachine_t *obj);
-static void setzindex_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int setzindex_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void setzindex_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -7255,7 +7317,8 @@ objectmachine_t* objectdecorator_setzindex_new(objectmachine_t *decorated_machin
 
     obj->init = setzindex_init;
     obj->release = setzindex_release;
-    obj->update = setzindex_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = setzindex_update;
     obj->render = setzindex_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -7290,10 +7353,8 @@ void setzindex_release(objectmachine_t *obj)
     free(obj);
 }
 
-void setzindex_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int setzindex_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_setzindex_t *me = (objectdecorator_setzindex_t*)obj;
     object_t *object = obj->get_object_instance(obj);
     float zindex = expression_evaluate(me->zindex); /* no clip() */
@@ -7302,7 +7363,7 @@ void setzindex_update(objectmachine_t *obj, player_t **team, int team_size, bric
     object->zindex = zindex;
 
     /* decorator pattern */
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void setzindex_render(objectmachine_t *obj, v2d_t camera_position)
@@ -7325,7 +7386,7 @@ struct objectdecorator_showhide_t {
 /* private methods */
 static void showhide_init(objectmachine_t *obj);
 static void showhide_release(objectmachine_t *obj);
-static void showhide_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int showhide_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void showhide_render(objectmachine_t *obj, v2d_t camera_position);
 
 static objectmachine_t* showhide_make_decorator(objectmachine_t *decorated_machine, int show);
@@ -7354,7 +7415,8 @@ static objectmachine_t* showhide_make_decorator(objectmachine_t *decorated_machi
 
     obj->init = showhide_init;
     obj->release = showhide_release;
-    obj->update = showhide_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = showhide_update;
     obj->render = showhide_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -7389,16 +7451,15 @@ void showhide_release(objectmachine_t *obj)
     free(obj);
 }
 
-void showhide_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int showhide_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
     object_t *object = obj->get_object_instance(obj);
     objectdecorator_t *dec = (objectdecorator_t*)obj;
     objectdecorator_showhide_t *me = (objectdecorator_showhide_t*)dec;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
 
     object->actor->visible = me->show;
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void showhide_render(objectmachine_t *obj, v2d_t camera_position)
@@ -7422,7 +7483,7 @@ struct objectdecorator_simulatebutton_t {
 /* private methods */
 static void simulatebutton_init(objectmachine_t *obj);
 static void simulatebutton_release(objectmachine_t *obj);
-static void simulatebutton_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int simulatebutton_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void simulatebutton_render(objectmachine_t *obj, v2d_t camera_position);
 
 static objectmachine_t* simulatebutton_make_decorator(objectmachine_t *decorated_machine, const char *button_name, void (*callback)(input_t*,inputbutton_t));
@@ -7450,7 +7511,8 @@ objectmachine_t* simulatebutton_make_decorator(objectmachine_t *decorated_machin
 
     obj->init = simulatebutton_init;
     obj->release = simulatebutton_release;
-    obj->update = simulatebutton_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = simulatebutton_update;
     obj->render = simulatebutton_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -7512,10 +7574,8 @@ void simulatebutton_release(objectmachine_t *obj)
     free(obj);
 }
 
-void simulatebutton_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int simulatebutton_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_simulatebutton_t *me = (objectdecorator_simulatebutton_t*)obj;
     object_t *object = obj->get_object_instance(obj);
     player_t *player = enemy_get_observed_player(object);
@@ -7523,7 +7583,7 @@ void simulatebutton_update(objectmachine_t *obj, player_t **team, int team_size,
     input_enable(player->actor->input); /* so that non-active players will respond to this command */
     me->callback(player->actor->input, me->button);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void simulatebutton_render(objectmachine_t *obj, v2d_t camera_position)
@@ -7547,7 +7607,7 @@ struct objectdecorator_switchcharacter_t {
 /* private methods */
 static void switchcharacter_init(objectmachine_t *obj);
 static void switchcharacter_release(objectmachine_t *obj);
-static void switchcharacter_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int switchcharacter_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void switchcharacter_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -7563,7 +7623,8 @@ objectmachine_t* objectdecorator_switchcharacter_new(objectmachine_t *decorated_
 
     obj->init = switchcharacter_init;
     obj->release = switchcharacter_release;
-    obj->update = switchcharacter_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = switchcharacter_update;
     obj->render = switchcharacter_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -7601,10 +7662,8 @@ void switchcharacter_release(objectmachine_t *obj)
     free(obj);
 }
 
-void switchcharacter_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int switchcharacter_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_switchcharacter_t *me = (objectdecorator_switchcharacter_t*)obj;
     object_t *object = obj->get_object_instance(obj);
     player_t *player = level_player(); /* active player */
@@ -7637,7 +7696,7 @@ void switchcharacter_update(objectmachine_t *obj, player_t **team, int team_size
     else
         fatal_error("Can't switch character: player '%s' does not exist!", me->name);
 
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void switchcharacter_render(objectmachine_t *obj, v2d_t camera_position)
@@ -7668,7 +7727,7 @@ struct objectdecorator_textout_t {
 /* private methods */
 static void textout_init(objectmachine_t *obj);
 static void textout_release(objectmachine_t *obj);
-static void textout_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int textout_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void textout_render(objectmachine_t *obj, v2d_t camera_position);
 
 objectmachine_t* textout_make_decorator(objectmachine_t *decorated_machine, textoutstyle_t style, const char *font_name, expression_t *xpos, expression_t *ypos, const char *text, expression_t *max_width, expression_t *index_of_first_char, expression_t *length);
@@ -7725,10 +7784,8 @@ void textout_release(objectmachine_t *obj)
     free(obj);
 }
 
-void textout_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int textout_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_textout_t *me = (objectdecorator_textout_t*)obj;
     object_t *object = obj->get_object_instance(obj);
     symboltable_t *st = objectvm_get_symbol_table(object->vm);
@@ -7767,7 +7824,7 @@ void textout_update(objectmachine_t *obj, player_t **team, int team_size, brick_
     font_set_position(me->fnt, v2d_add(object->actor->position, pos));
 
     /* done! */
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void textout_render(objectmachine_t *obj, v2d_t camera_position)
@@ -7792,7 +7849,8 @@ objectmachine_t* textout_make_decorator(objectmachine_t *decorated_machine, text
 
     obj->init = textout_init;
     obj->release = textout_release;
-    obj->update = textout_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = textout_update;
     obj->render = textout_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -7837,7 +7895,7 @@ struct objectdecorator_variables_t {
 /* private methods */
 static void varcommand_init(objectmachine_t *obj);
 static void varcommand_release(objectmachine_t *obj);
-static void varcommand_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int varcommand_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void varcommand_render(objectmachine_t *obj, v2d_t camera_position);
 
 /* private strategies */
@@ -7859,7 +7917,8 @@ objectmachine_t* objectdecorator_let_new(objectmachine_t *decorated_machine, exp
 
     obj->init = varcommand_init;
     obj->release = varcommand_release;
-    obj->update = varcommand_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = varcommand_update;
     obj->render = varcommand_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -7879,7 +7938,8 @@ objectmachine_t* objectdecorator_if_new(objectmachine_t *decorated_machine, expr
 
     obj->init = varcommand_init;
     obj->release = varcommand_release;
-    obj->update = varcommand_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = varcommand_update;
     obj->render = varcommand_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -7899,7 +7959,8 @@ objectmachine_t* objectdecorator_unless_new(objectmachine_t *decorated_machine,
 
     obj->init = varcommand_init;
     obj->release = varcommand_release;
-    obj->update = varcommand_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = varcommand_update;
     obj->render = varcommand_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -7938,18 +7999,18 @@ void varcommand_release(objectmachine_t *obj)
     free(obj);
 }
 
-void varcommand_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int varcommand_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_variables_t *me = (objectdecorator_variables_t*)obj;
     object_t *object = obj->get_object_instance(obj);
     float result = expression_evaluate(me->expr);
 
-    if(me->must_change_state(result))
+    if(me->must_change_state(result)) {
         objectvm_set_current_state(object->vm, me->new_state_name);
-    else
-        decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+        return FALSE;
+    }
+
+    return TRUE;
 }
 
 void varcommand_render(objectmachine_t *obj, v2d_t camera_position)
@@ -7973,7 +8034,7 @@ struct objectdecorator_walk_t {
 /* private methods */
 static void walk_init(objectmachine_t *obj);
 static void walk_release(objectmachine_t *obj);
-static void walk_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+static int walk_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
 static void walk_render(objectmachine_t *obj, v2d_t camera_position);
 
 
@@ -7989,7 +8050,8 @@ objectmachine_t* objectdecorator_walk_new(objectmachine_t *decorated_machine, ex
 
     obj->init = walk_init;
     obj->release = walk_release;
-    obj->update = walk_update;
+    obj->update = objectdecorator_update; /* inherits from superclass */
+    dec->command = walk_update;
     obj->render = walk_render;
     obj->get_object_instance = objectdecorator_get_object_instance; /* inherits from superclass */
     dec->decorated_machine = decorated_machine;
@@ -8025,10 +8087,8 @@ void walk_release(objectmachine_t *obj)
     free(obj);
 }
 
-void walk_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+int walk_update(objectmachine_t *obj, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
 {
-    objectdecorator_t *dec = (objectdecorator_t*)obj;
-    objectmachine_t *decorated_machine = dec->decorated_machine;
     objectdecorator_walk_t *me = (objectdecorator_walk_t*)obj;
     object_t *object = obj->get_object_instance(obj);
     actor_t *act = object->actor;
@@ -8067,7 +8127,7 @@ void walk_update(objectmachine_t *obj, player_t **team, int team_size, brick_lis
     }
 
     /* decorator pattern */
-    decorated_machine->update(decorated_machine, team, team_size, brick_list, item_list, object_list);
+    return TRUE;
 }
 
 void walk_render(objectmachine_t *obj, v2d_t camera_position)
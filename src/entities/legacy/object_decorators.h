@@ -21,9 +21,20 @@
 #ifndef _OBJECT_DECORATORS_H
 #define _OBJECT_DECORATORS_H
 
+#include <stdint.h>
 #include "object_machine.h"
 #include "nanocalc/nanocalc.h"
 
+/* flattened machines: the commands of a chain of decorators, stored in an array */
+typedef struct objectflatmachine_t objectflatmachine_t;
+objectflatmachine_t* objectflatmachine_create(objectmachine_t *machine);
+objectflatmachine_t* objectflatmachine_destroy(objectflatmachine_t *flat);
+objectmachine_t* objectflatmachine_machine(const objectflatmachine_t *flat);
+void objectflatmachine_update(const objectflatmachine_t *flat, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+
+/* the number of commands executed so far, for profiling */
+int64_t objectdecorator_command_count();
+
 /* commands */
 objectmachine_t* objectdecorator_addcollectibles_new(objectmachine_t *decorated_machine, expression_t *collectibles);
 objectmachine_t* objectdecorator_addlives_new(objectmachine_t *decorated_machine, expression_t *lives);
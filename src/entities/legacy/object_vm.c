@@ -19,8 +19,10 @@
  */
 
 #include "object_vm.h"
+#include "object_decorators.h"
 #include "../../util/util.h"
 #include "../../util/stringutil.h"
+#include "../../core/timer.h"
 
 /* private stuff */
 typedef struct objectmachine_list_t objectmachine_list_t;
@@ -32,14 +34,19 @@ struct objectvm_t
     enemy_t* owner; /* who owns this VM? */
     objectmachine_list_t* state_list; /* list of states */
     objectmachine_t** reference_to_current_state; /* reference to the current state */
+    objectmachine_list_t* current_state; /* the node of the current state */
     symboltable_t* symbol_table; /* object's private symbol table (stores its variables) */
     objectmachine_stack_t* history; /* stores previous states */
+    objectprofile_t* profile; /* profiling counters, or NULL */
 };
 
+static void update_current_state(objectvm_t *vm, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list);
+
 /* linked list of object machines */
 struct objectmachine_list_t {
     char *name;
     objectmachine_t *data;
+    objectflatmachine_t *flat; /* flattened data, if available */
     objectmachine_list_t *next;
 };
 
@@ -65,14 +72,16 @@ static void objectmachine_stack_clear(objectmachine_stack_t* stack);
 
 /* public methods */
 
-objectvm_t* objectvm_create(enemy_t* owner)
+objectvm_t* objectvm_create(enemy_t* owner, symbollayout_t* layout)
 {
     objectvm_t *vm = mallocx(sizeof *vm);
     vm->owner = owner;
     vm->state_list = NULL;
     vm->reference_to_current_state = NULL;
+    vm->current_state = NULL;
     vm->history = objectmachine_stack_new();
-    vm->symbol_table = symboltable_new();
+    vm->symbol_table = symboltable_new_with_layout(layout);
+    vm->profile = NULL;
     return vm;
 }
 
@@ -125,7 +134,10 @@ void objectvm_set_current_state(objectvm_t* vm, const char *name)
     if(m != NULL) {
         if(vm->reference_to_current_state != &(m->data)) {
             vm->reference_to_current_state = &(m->data);
+            vm->current_state = m;
             objectmachine_stack_push(vm->history, m);
+            if(vm->profile != NULL)
+                vm->profile->transitions++;
         }
     }
     else
@@ -141,12 +153,57 @@ void objectvm_return_to_previous_state(objectvm_t *vm)
 
     if(m != NULL) {
         vm->reference_to_current_state = &(m->data);
+        vm->current_state = m;
         objectmachine_stack_push(vm->history, m);
+        if(vm->profile != NULL)
+            vm->profile->transitions++;
     }
     else
         fatal_error("Object script error: can't return to previous state in object \"%s\".", vm->owner->name);
 }
 
+void objectvm_update(objectvm_t *vm, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+{
+    objectprofile_t *profile = vm->profile;
+    double start_time;
+    unsigned long start_evaluations;
+    int64_t start_commands;
+
+    /* fast path */
+    if(profile == NULL) {
+        update_current_state(vm, team, team_size, brick_list, item_list, object_list);
+        return;
+    }
+
+    /* count the work of the update */
+    start_time = timer_get_now();
+    start_evaluations = expression_evaluation_count();
+    start_commands = objectdecorator_command_count();
+
+    update_current_state(vm, team, team_size, brick_list, item_list, object_list);
+
+    profile->updates++;
+    profile->commands += objectdecorator_command_count() - start_commands;
+    profile->evaluations += (int64_t)(expression_evaluation_count() - start_evaluations);
+    profile->time += timer_get_now() - start_time;
+}
+
+void objectvm_set_profile(objectvm_t *vm, objectprofile_t *profile)
+{
+    vm->profile = profile;
+}
+
+void objectvm_flatten_states(objectvm_t *vm)
+{
+    objectmachine_list_t *m;
+
+    for(m = vm->state_list; m != NULL; m = m->next) {
+        if(m->flat != NULL)
+            m->flat = objectflatmachine_destroy(m->flat);
+        m->flat = objectflatmachine_create(m->data);
+    }
+}
+
 void objectvm_reset_history(objectvm_t *vm)
 {
     objectmachine_stack_clear(vm->history);
@@ -164,6 +221,19 @@ objectmachine_t* objectvm_get_state_by_name(objectvm_t* vm, const char *name)
         return m->data;
 }
 
+/* objectvm_t: private methods */
+
+void update_current_state(objectvm_t *vm, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list)
+{
+    objectmachine_list_t *m = vm->current_state;
+
+    /* use the flattened machine if it's up to date */
+    if(m->flat != NULL && objectflatmachine_machine(m->flat) == m->data)
+        objectflatmachine_update(m->flat, team, team_size, brick_list, item_list, object_list);
+    else
+        m->data->update(m->data, team, team_size, brick_list, item_list, object_list);
+}
+
 /* objectmachine_list_t: private methods */
 
 objectmachine_list_t* objectmachine_list_new(objectmachine_list_t* list, const char *name, enemy_t *owner)
@@ -171,6 +241,7 @@ objectmachine_list_t* objectmachine_list_new(objectmachine_list_t* list, const c
     objectmachine_list_t *l = mallocx(sizeof *l);
     l->name = str_dup(name);
     l->data = objectbasicmachine_new(owner);
+    l->flat = NULL;
     l->next = list;
     return l;
 }
@@ -181,6 +252,8 @@ objectmachine_list_t* objectmachine_list_delete(objectmachine_list_t* list)
         objectmachine_t *machine = list->data;
         objectmachine_list_delete(list->next);
         free(list->name);
+        if(list->flat != NULL)
+            objectflatmachine_destroy(list->flat);
         machine->release(machine);
         free(list);
     }
@@ -31,9 +31,21 @@
 
 typedef struct objectvm_t objectvm_t;
 
+/* profiling counters of an object, shared by all of its instances */
+typedef struct objectprofile_t objectprofile_t;
+struct objectprofile_t {
+    char *name; /* name of the object */
+    int instances; /* number of instances created */
+    int64_t updates; /* number of updates of the instances */
+    int64_t transitions; /* number of changes of state */
+    int64_t commands; /* number of commands (decorators) executed */
+    int64_t evaluations; /* number of nanocalc expressions evaluated */
+    double time; /* time spent updating the instances, in seconds */
+};
+
 /* public methods */
 
-objectvm_t* objectvm_create(enemy_t* owner); /* creates a new virtual machine */
+objectvm_t* objectvm_create(enemy_t* owner, symbollayout_t* layout); /* creates a new virtual machine; its variables follow the given layout, shared by the instances of an object */
 objectvm_t* objectvm_destroy(objectvm_t* vm); /* destroys an existing VM */
 objectmachine_t** objectvm_get_reference_to_current_state(objectvm_t* vm); /* returns a reference to the current state */
 symboltable_t* objectvm_get_symbol_table(objectvm_t *vm); /* returns my symbol table (variables support; nanocalc stuff...) */
@@ -41,7 +53,10 @@ void objectvm_create_state(objectvm_t* vm, const char *name); /* you have to cre
 const char* objectvm_get_current_state(objectvm_t* vm); /* gets the current state */
 void objectvm_set_current_state(objectvm_t* vm, const char *name); /* sets the current state */
 void objectvm_return_to_previous_state(objectvm_t *vm); /* returns to the previous state */
+void objectvm_update(objectvm_t *vm, player_t **team, int team_size, brick_list_t *brick_list, item_list_t *item_list, object_list_t *object_list); /* updates the current state */
+void objectvm_flatten_states(objectvm_t *vm); /* flattens the machines of all states, so that they update faster. Call it after the states have been built */
 void objectvm_reset_history(objectvm_t *vm); /* resets the history of states (can't return to previous state anymore) */
 objectmachine_t* objectvm_get_state_by_name(objectvm_t* vm, const char *name); /* retrieves a specific state by name */
+void objectvm_set_profile(objectvm_t *vm, objectprofile_t *profile); /* counts the work of the VM in the given profile; pass NULL to stop counting */
 
 #endif
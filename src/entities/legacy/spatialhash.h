@@ -22,24 +22,34 @@
 #define _SPATIALHASH_H
 
 #include <stdbool.h>
+#include <string.h>
 #include "../../core/global.h"
 #include "../../core/logfile.h"
 #include "../../util/util.h"
 
 /* utilities */
-#define SPATIALHASH_GRID_WIDTH      64
-#define SPATIALHASH_GRID_HEIGHT     32
-#define DEFAULT_WORLD_WIDTH         50048 /* max. estimates; multiples of the grid size */
-#define DEFAULT_WORLD_HEIGHT        15008
+#define SPATIALHASH_CELL_SIZE           512 /* preferred size of a cell, in pixels */
+#define SPATIALHASH_MAX_GRID_WIDTH      1024 /* the cells grow beyond the preferred size in larger worlds */
+#define SPATIALHASH_MAX_GRID_HEIGHT     256
+#define DEFAULT_WORLD_WIDTH             50048 /* estimates used until the actual size of the world is known */
+#define DEFAULT_WORLD_HEIGHT            15008
 
 /* spatialhash_<typename> class: pretty much like C++ templates */
+/* the world is partitioned into a grid of cells; each cell stores its elements contiguously */
 #define SPATIALHASH_GENERATE_CODE(T) \
 typedef struct spatialhash_##T spatialhash_##T; \
-typedef struct spatialhash_list_##T spatialhash_list_##T; \
+typedef struct spatialhash_cell_##T spatialhash_cell_##T; \
+struct spatialhash_cell_##T { \
+    T **data; /* the elements of the cell, from the oldest to the newest */ \
+    int length; \
+    int capacity; \
+}; \
 struct spatialhash_##T { \
-    spatialhash_list_##T *bucket[SPATIALHASH_GRID_HEIGHT][SPATIALHASH_GRID_WIDTH]; /* regular elements */ \
-    spatialhash_list_##T *persistent_elements; /* persistent elements */  \
-    int cell_width, cell_height; /* a cell is an element of a SPATIALHASH_GRID_WIDTH x SPATIALHASH_GRID_HEIGHT grid, also known as the bucket */ \
+    spatialhash_cell_##T *cell; /* regular elements: cell[row * grid_width + col] */ \
+    spatialhash_cell_##T persistent_elements; /* persistent elements */  \
+    int grid_width, grid_height; /* number of columns and rows of the grid */ \
+    int cell_width, cell_height; /* size of a cell, in pixels */ \
+    int world_width, world_height; /* size of the world covered by the grid, in pixels */ \
     int largest_element_width, largest_element_height; \
     int (*xpos)(const T*); \
     int (*ypos)(const T*); \
@@ -47,17 +57,56 @@ struct spatialhash_##T { \
     int (*height)(const T*); \
     T* (*destroy_element)(T*); \
 }; \
-struct spatialhash_list_##T { \
-    T *data; \
-    spatialhash_list_##T *next; \
-}; \
+/* appends an element to a cell */ \
+static void spatialhash_##T##_cell_push(spatialhash_cell_##T *c, T *element) \
+{ \
+    if(c->length == c->capacity) { \
+        c->capacity = max(4, 2 * c->capacity); \
+        c->data = reallocx(c->data, c->capacity * sizeof(*(c->data))); \
+    } \
+    c->data[c->length++] = element; \
+} \
+/* removes the i-th element of a cell, preserving the order of the others */ \
+static void spatialhash_##T##_cell_erase(spatialhash_cell_##T *c, int i) \
+{ \
+    memmove(c->data + i, c->data + i + 1, (c->length - i - 1) * sizeof(*(c->data))); \
+    c->length--; \
+} \
+/* finds an element in a cell. Returns its index or -1 if it's not there */ \
+static int spatialhash_##T##_cell_find(const spatialhash_cell_##T *c, const T *element) \
+{ \
+    for(int i = c->length - 1; i >= 0; i--) { \
+        if(c->data[i] == element) \
+            return i; \
+    } \
+    return -1; \
+} \
+/* the cell that should store the given element */ \
+static spatialhash_cell_##T* spatialhash_##T##_cell_of(spatialhash_##T *sh, const T *element) \
+{ \
+    int col = clip(sh->xpos(element) / sh->cell_width, 0, sh->grid_width-1); \
+    int row = clip(sh->ypos(element) / sh->cell_height, 0, sh->grid_height-1); \
+    return &(sh->cell[row * sh->grid_width + col]); \
+} \
+/* allocates an empty grid covering a world of the given size */ \
+static void spatialhash_##T##_create_grid(spatialhash_##T *sh, int world_width, int world_height) \
+{ \
+    world_width = max(1, world_width); \
+    world_height = max(1, world_height); \
+    sh->grid_width = clip((world_width + SPATIALHASH_CELL_SIZE - 1) / SPATIALHASH_CELL_SIZE, 1, SPATIALHASH_MAX_GRID_WIDTH); \
+    sh->grid_height = clip((world_height + SPATIALHASH_CELL_SIZE - 1) / SPATIALHASH_CELL_SIZE, 1, SPATIALHASH_MAX_GRID_HEIGHT); \
+    sh->cell_width = max(1, (world_width + sh->grid_width - 1) / sh->grid_width); \
+    sh->cell_height = max(1, (world_height + sh->grid_height - 1) / sh->grid_height); \
+    sh->world_width = sh->grid_width * sh->cell_width; \
+    sh->world_height = sh->grid_height * sh->cell_height; \
+    sh->cell = mallocx(sh->grid_width * sh->grid_height * sizeof(*(sh->cell))); \
+    memset(sh->cell, 0, sh->grid_width * sh->grid_height * sizeof(*(sh->cell))); \
+} \
 spatialhash_##T* spatialhash_##T##_create_ex(T* (*destroy_element_strategy)(T*), int (*get_element_xpos)(const T*), int (*get_element_ypos)(const T*), int (*get_element_width)(const T*), int (*get_element_height)(const T*), int estimated_world_width, int estimated_world_height) /* destroy_element_strategy may be NULL */ \
 { \
-    int i, j; \
     spatialhash_##T *sh = mallocx(sizeof *sh); \
     logfile_message("spatialhash_" #T "_create_ex(%d, %d)", estimated_world_width, estimated_world_height); \
-    sh->cell_width = max(1, estimated_world_width / SPATIALHASH_GRID_WIDTH); \
-    sh->cell_height = max(1, estimated_world_height / SPATIALHASH_GRID_HEIGHT); \
+    spatialhash_##T##_create_grid(sh, estimated_world_width, estimated_world_height); \
     sh->largest_element_width = 0; \
     sh->largest_element_height = 0; \
     sh->xpos = get_element_xpos; \
@@ -65,11 +114,9 @@ spatialhash_##T* spatialhash_##T##_create_ex(T* (*destroy_element_strategy)(T*),
     sh->width = get_element_width; \
     sh->height = get_element_height; \
     sh->destroy_element = destroy_element_strategy; \
-    for(i=0; i<SPATIALHASH_GRID_HEIGHT; i++) { \
-        for(j=0; j<SPATIALHASH_GRID_WIDTH; j++) \
-            sh->bucket[i][j] = NULL; \
-    } \
-    sh->persistent_elements = NULL; \
+    sh->persistent_elements.data = NULL; \
+    sh->persistent_elements.length = 0; \
+    sh->persistent_elements.capacity = 0; \
     return sh; \
 } \
 /* creates a new spatial hash */ \
@@ -81,28 +128,23 @@ spatialhash_##T* spatialhash_##T##_create(T* (*destroy_element_strategy)(T*), in
 spatialhash_##T* spatialhash_##T##_destroy(spatialhash_##T *sh) \
 { \
     int i, j; \
-    spatialhash_list_##T *p, *q; \
     logfile_message("spatialhash_" #T "_destroy()"); \
-    for(i=0; i<SPATIALHASH_GRID_HEIGHT; i++) { \
-        for(j=0; j<SPATIALHASH_GRID_WIDTH; j++) { \
-            p = sh->bucket[i][j]; \
-            while(p != NULL) { \
-                q = p->next; \
-                if(sh->destroy_element != NULL) \
-                    p->data = sh->destroy_element(p->data); \
-                free(p); \
-                p = q; \
-            } \
+    for(i = 0; i < sh->grid_width * sh->grid_height; i++) { \
+        spatialhash_cell_##T *c = &(sh->cell[i]); \
+        for(j = c->length - 1; j >= 0; j--) { \
+            if(sh->destroy_element != NULL) \
+                c->data[j] = sh->destroy_element(c->data[j]); \
         } \
+        if(c->data != NULL) \
+            free(c->data); \
     } \
-    p = sh->persistent_elements; \
-    while(p != NULL) { \
-        q = p->next; \
+    for(j = sh->persistent_elements.length - 1; j >= 0; j--) { \
         if(sh->destroy_element != NULL) \
-            p->data = sh->destroy_element(p->data); \
-        free(p); \
-        p = q; \
+            sh->persistent_elements.data[j] = sh->destroy_element(sh->persistent_elements.data[j]); \
     } \
+    if(sh->persistent_elements.data != NULL) \
+        free(sh->persistent_elements.data); \
+    free(sh->cell); \
     free(sh); \
     logfile_message("spatialhash_" #T "_destroy() - success!"); \
     return NULL; \
@@ -110,129 +152,91 @@ spatialhash_##T* spatialhash_##T##_destroy(spatialhash_##T *sh) \
 /* adds an element to the spatial hash */ \
 void spatialhash_##T##_add(spatialhash_##T *sh, T *element) \
 { \
-    int row, col; \
-    spatialhash_list_##T *p; \
-    \
-    col = sh->xpos(element) / sh->cell_width; \
-    row = sh->ypos(element) / sh->cell_height; \
-    col = clip(col, 0, SPATIALHASH_GRID_WIDTH-1); \
-    row = clip(row, 0, SPATIALHASH_GRID_HEIGHT-1); \
+    spatialhash_cell_##T *c = spatialhash_##T##_cell_of(sh, element); \
     \
-    for(p = sh->bucket[row][col]; p != NULL; p = p->next) { \
-        if(p->data == element) { \
-            logfile_message("spatialhash_" #T "_add(): element '%p' already exists! It won't be added.", element); \
-            return; \
-        } \
+    if(spatialhash_##T##_cell_find(c, element) >= 0) { \
+        logfile_message("spatialhash_" #T "_add(): element '%p' already exists! It won't be added.", element); \
+        return; \
     } \
     \
-    /*logfile_message("spatialhash_" #T "_add(): adding '%p'...", element);*/ \
-    \
-    p = mallocx(sizeof *p); \
-    p->data = element; \
-    p->next = sh->bucket[row][col]; \
-    sh->bucket[row][col] = p; \
-    \
+    spatialhash_##T##_cell_push(c, element); \
     sh->largest_element_width = max(sh->largest_element_width, sh->width(element)); \
     sh->largest_element_height = max(sh->largest_element_height, sh->height(element)); \
 } \
 /* adds a persistent element to the spatial hash */ \
 void spatialhash_##T##_add_persistent(spatialhash_##T *sh, T *element) \
 { \
-    spatialhash_list_##T *p; \
-    \
-    for(p = sh->persistent_elements; p != NULL; p = p->next) { \
-        if(p->data == element) { \
-            logfile_message("spatialhash_" #T "_add_persistent(): element '%p' already exists! It won't be added.", element); \
-            return; \
-        } \
+    if(spatialhash_##T##_cell_find(&(sh->persistent_elements), element) >= 0) { \
+        logfile_message("spatialhash_" #T "_add_persistent(): element '%p' already exists! It won't be added.", element); \
+        return; \
     } \
     \
-    /*logfile_message("spatialhash_" #T "_add_persistent(): adding '%p'...", element);*/ \
-    \
-    p = mallocx(sizeof *p); \
-    p->data = element; \
-    p->next = sh->persistent_elements; \
-    sh->persistent_elements = p; \
+    spatialhash_##T##_cell_push(&(sh->persistent_elements), element); \
 } \
 /* checks if an element of the spatial hash is persistent */ \
 bool spatialhash_##T##_is_persistent(spatialhash_##T *sh, T *element) \
 { \
-    spatialhash_list_##T *p; \
-    \
-    for(p = sh->persistent_elements; p != NULL; p = p->next) { \
-        if(p->data == element) \
-            return true; \
-    } \
-    \
-    return false; \
+    return spatialhash_##T##_cell_find(&(sh->persistent_elements), element) >= 0; \
 } \
 /* removes an element from the spatial hash */ \
 void spatialhash_##T##_remove(spatialhash_##T *sh, T *element) \
 { \
-    int row, col; \
-    spatialhash_list_##T *p, *prev; \
-    \
-    col = sh->xpos(element) / sh->cell_width; \
-    row = sh->ypos(element) / sh->cell_height; \
-    col = clip(col, 0, SPATIALHASH_GRID_WIDTH-1); \
-    row = clip(row, 0, SPATIALHASH_GRID_HEIGHT-1); \
+    spatialhash_cell_##T *c = spatialhash_##T##_cell_of(sh, element); \
+    int i, j; \
     \
     /* is it a regular element? */ \
-    for(prev = NULL, p = sh->bucket[row][col]; p != NULL; prev = p, p = p->next) { \
-        if(p->data == element) { \
-            if(prev != NULL) \
-                prev->next = p->next; \
-            else \
-                sh->bucket[row][col] = p->next; \
+    if((j = spatialhash_##T##_cell_find(c, element)) < 0) { \
+        /* is it a persistent element? */ \
+        c = &(sh->persistent_elements); \
+        if((j = spatialhash_##T##_cell_find(c, element)) < 0) { \
+            /* FIXME looking in the entire table to see if we find the element (this is BAD) */ \
+            for(i = 0; i < sh->grid_width * sh->grid_height && j < 0; i++) { \
+                c = &(sh->cell[i]); \
+                j = spatialhash_##T##_cell_find(c, element); \
+            } \
             \
-            if(sh->destroy_element != NULL) \
-                p->data = sh->destroy_element(p->data); \
+            /* aargh! it's 3:00 AM and we found nothing! */ \
+            if(j < 0) { \
+                logfile_message("spatialhash_" #T "_remove(): element '%p' was not found.", element); \
+                return; \
+            } \
             \
-            free(p); \
-            return; \
+            logfile_message("spatialhash_" #T "_remove(): trouble on removing '%p'... I had to look for it in the entire table", element); \
         } \
     } \
     \
-    /* is it a persistent element? */ \
-    for(prev = NULL, p = sh->persistent_elements; p != NULL; prev = p, p = p->next) { \
-        if(p->data == element) { \
-            if(prev != NULL) \
-                prev->next = p->next; \
-            else \
-                sh->persistent_elements = p->next; \
-            \
-            if(sh->destroy_element != NULL) \
-                p->data = sh->destroy_element(p->data); \
-            \
-            free(p); \
-            return; \
-        } \
-    } \
+    spatialhash_##T##_cell_erase(c, j); \
+    if(sh->destroy_element != NULL) \
+        element = sh->destroy_element(element); \
+} \
+/* makes sure that the grid covers a world of the given size. The grid */ \
+/* is rebuilt if the world is larger than the area it covers */ \
+void spatialhash_##T##_fit(spatialhash_##T *sh, int world_width, int world_height) \
+{ \
+    spatialhash_cell_##T *old_cell = sh->cell; \
+    int i, j, old_cell_count = sh->grid_width * sh->grid_height; \
     \
-    /* FIXME looking in the entire table to see if we find the element (this is BAD) */ \
-    for(row = 0; row < SPATIALHASH_GRID_HEIGHT; row++) { \
-        for(col = 0; col < SPATIALHASH_GRID_WIDTH; col++) { \
-            for(prev = NULL, p = sh->bucket[row][col]; p != NULL; prev = p, p = p->next) { \
-                if(p->data == element) { \
-                    logfile_message("spatialhash_" #T "_remove(): trouble on removing '%p'... I had to look for it in the entire table", element); \
-                    \
-                    if(prev != NULL) \
-                        prev->next = p->next; \
-                    else \
-                        sh->bucket[row][col] = p->next; \
-                    \
-                    if(sh->destroy_element != NULL) \
-                        p->data = sh->destroy_element(p->data); \
-                    \
-                    free(p); \
-                    return; \
-                } \
-            } \
-        } \
+    if(world_width <= sh->world_width && world_height <= sh->world_height) \
+        return; \
+    \
+    logfile_message("spatialhash_" #T "_fit(%d, %d)", world_width, world_height); \
+    spatialhash_##T##_create_grid(sh, world_width, world_height); \
+    \
+    for(i = 0; i < old_cell_count; i++) { \
+        for(j = 0; j < old_cell[i].length; j++) \
+            spatialhash_##T##_cell_push(spatialhash_##T##_cell_of(sh, old_cell[i].data[j]), old_cell[i].data[j]); \
+        if(old_cell[i].data != NULL) \
+            free(old_cell[i].data); \
     } \
     \
-    /* aargh! it's 3:00 AM and we found nothing! */ \
-    logfile_message("spatialhash_" #T "_remove(): element '%p' was not found.", element); \
+    free(old_cell); \
+} \
+/* rebuilds the grid so that it covers exactly a world of the given size */ \
+/* (the grid may shrink). Call it after you have found the actual size of the world */ \
+void spatialhash_##T##_refit(spatialhash_##T *sh, int world_width, int world_height) \
+{ \
+    sh->world_width = sh->world_height = 0; /* force a rebuild */ \
+    spatialhash_##T##_fit(sh, world_width, world_height); \
 } \
 /* for each element X in the given rectangle, calls callback_function(X,some_user_data), */ \
 /* where some_user_data, a void pointer, may be anything you need. */ \
@@ -244,8 +248,7 @@ void spatialhash_##T##_foreach(spatialhash_##T *sh, int rectangle_xpos, int rect
 { \
     int r_x1, r_y1, r_x2, r_y2, e_x1, e_y1, e_x2, e_y2; \
     int row, col, first_row, first_col, last_row, last_col; \
-    int stop_iteration = FALSE; \
-    spatialhash_list_##T *p, *prev; \
+    int i, stop_iteration = FALSE; \
     \
     r_x1 = rectangle_xpos - sh->largest_element_width; \
     r_y1 = rectangle_ypos - sh->largest_element_height; \
@@ -257,66 +260,52 @@ void spatialhash_##T##_foreach(spatialhash_##T *sh, int rectangle_xpos, int rect
     last_col = r_x2 / sh->cell_width; \
     last_row = r_y2 / sh->cell_height; \
     \
-    first_col = clip(first_col, 0, SPATIALHASH_GRID_WIDTH-1); \
-    first_row = clip(first_row, 0, SPATIALHASH_GRID_HEIGHT-1); \
-    last_col = clip(last_col, 0, SPATIALHASH_GRID_WIDTH-1); \
-    last_row = clip(last_row, 0, SPATIALHASH_GRID_HEIGHT-1); \
+    first_col = clip(first_col, 0, sh->grid_width-1); \
+    first_row = clip(first_row, 0, sh->grid_height-1); \
+    last_col = clip(last_col, 0, sh->grid_width-1); \
+    last_row = clip(last_row, 0, sh->grid_height-1); \
     \
-    /* scanning persistent elements */ \
-    for(p = sh->persistent_elements; p != NULL && !stop_iteration; p = p->next) { \
-        if(0 != callback_function(p->data, some_user_data)) \
+    /* scanning persistent elements (newest first) */ \
+    for(i = sh->persistent_elements.length - 1; i >= 0 && !stop_iteration; i--) { \
+        if(0 != callback_function(sh->persistent_elements.data[i], some_user_data)) \
             stop_iteration = TRUE; \
     } \
     \
-    /* scanning regular elements */ \
+    /* scanning regular elements (newest first) */ \
     stop_iteration = !((rectangle_width > 0) && (rectangle_height > 0)); \
-    for(row=first_row; row<=last_row; row++) { \
-        for(col=first_col; col<=last_col; col++) { \
-            prev = NULL; \
-            p = sh->bucket[row][col]; \
+    for(row=first_row; row<=last_row && !stop_iteration; row++) { \
+        for(col=first_col; col<=last_col && !stop_iteration; col++) { \
+            spatialhash_cell_##T *c = &(sh->cell[row * sh->grid_width + col]); \
             \
-            while(p != NULL && !stop_iteration) { \
+            for(i = c->length - 1; i >= 0 && !stop_iteration; i--) { \
+                T *e = c->data[i]; \
                 int cx, cy; \
-                e_x1 = sh->xpos(p->data); \
-                e_y1 = sh->ypos(p->data); \
-                e_x2 = e_x1 + sh->width(p->data); \
-                e_y2 = e_y1 + sh->height(p->data); \
+                e_x1 = sh->xpos(e); \
+                e_y1 = sh->ypos(e); \
+                e_x2 = e_x1 + sh->width(e); \
+                e_y2 = e_y1 + sh->height(e); \
                 sh->largest_element_width = max(sh->largest_element_width, e_x2 - e_x1); \
                 sh->largest_element_height = max(sh->largest_element_height, e_y2 - e_y1); \
                 \
                 cx = e_x1 / sh->cell_width; \
                 cy = e_y1 / sh->cell_height; \
-                cx = clip(cx, 0, SPATIALHASH_GRID_WIDTH-1); \
-                cy = clip(cy, 0, SPATIALHASH_GRID_HEIGHT-1); \
+                cx = clip(cx, 0, sh->grid_width-1); \
+                cy = clip(cy, 0, sh->grid_height-1); \
                 \
                 if(cx >= first_col && cx <= last_col && cy >= first_row && cy <= last_row) { \
-                    /* is p->data inside the given rectangle? (bounding box check) */ \
+                    /* is e inside the given rectangle? (bounding box check) */ \
                     if((e_x1 <= r_x2 && e_x2 >= r_x1) && (e_y1 <= r_y2 && e_y2 >= r_y1)) { \
-                        if((!stop_iteration) && (0 != callback_function(p->data, some_user_data))) \
+                        if(0 != callback_function(e, some_user_data)) \
                             stop_iteration = TRUE; \
                     } \
                 } \
                 \
                 if(!(cx == col && cy == row)) { \
-                    /* do we need to move p->data to some other bucket? */ \
-                    T *e = p->data; \
-                    if(prev != NULL) { \
-                        prev->next = p->next; \
-                        free(p); \
-                        p = prev; \
-                        spatialhash_##T##_add(sh, e); \
-                    } \
-                    else { \
-                        sh->bucket[row][col] = p->next; \
-                        free(p); \
-                        p = sh->bucket[row][col]; \
-                        spatialhash_##T##_add(sh, e); \
-                        continue; \
-                    } \
+                    /* do we need to move e to some other cell? */ \
+                    /* the elements after i, which have been scanned already, are shifted */ \
+                    spatialhash_##T##_cell_erase(c, i); \
+                    spatialhash_##T##_cell_push(&(sh->cell[cy * sh->grid_width + cx]), e); \
                 } \
-                \
-                prev = p; \
-                p = p->next; \
             } \
         } \
     } \
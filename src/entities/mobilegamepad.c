@@ -28,6 +28,7 @@
 #include "../core/video.h"
 #include "../core/timer.h"
 #include "../util/v2d.h"
+#include "../util/rect.h"
 #include "../util/numeric.h"
 #include "../util/util.h"
 
@@ -214,6 +215,34 @@ static actor_t* actor[] = {
 /* indicates the pressing of the back button or the performing of a back gesture on a smartphone */
 static bool back_pressed = false;
 
+/* rendering cache: the controls are pre-rendered into a texture that is
+   redrawn only when their appearance changes. The overlay is then drawn
+   with one quad per group of controls, all from the same texture */
+enum {
+    DPAD_GROUP, /* dpad and stick */
+    BUTTON_GROUP, /* action button */
+
+    NUM_GROUPS
+};
+
+static const int GROUP_OF_CONTROL[] = {
+    [DPAD] = DPAD_GROUP,
+    [DPAD_STICK] = DPAD_GROUP,
+    [ACTION_BUTTON] = BUTTON_GROUP
+};
+
+static struct {
+    image_t* image; /* the groups of controls side by side; NULL if not created */
+    image_t* group_image[NUM_GROUPS]; /* shared images of the above */
+    rect_t group_rect[NUM_GROUPS]; /* the area of each group in window space */
+    bool valid; /* can we render the controls using the cache? */
+
+    /* what has been rendered */
+    v2d_t window_size;
+    const image_t* control_image[NUM_CONTROLS];
+    v2d_t stick_offset;
+} cache = { .image = NULL, .valid = false };
+
 /* misc */
 static void trigger(int control, v2d_t offset);
 static void animate_actors();
@@ -222,6 +251,10 @@ static void render_actors();
 static void handle_fade_effect();
 static void enable_linear_filtering();
 static v2d_t dpad_stick_offset(float scale);
+static void update_cache(float scale, v2d_t stick_offset);
+static void render_cache();
+static void release_cache();
+static rect_t control_rect(int control, float margin);
 static void a5_handle_back_event(const ALLEGRO_EVENT* event, void* data);
 
 
@@ -306,6 +339,9 @@ void mobilegamepad_init(int _flags)
  */
 void mobilegamepad_release()
 {
+    /* release the rendering cache */
+    release_cache();
+
     /* destroy the actors */
     for(int i = NUM_CONTROLS - 1; i >= 0; i--) {
         if(actor[i] != NULL) {
@@ -414,7 +450,10 @@ void mobilegamepad_render()
     handle_fade_effect();
 
     /* render mobile gamepad */
-    render_actors();
+    if(cache.valid)
+        render_cache();
+    else
+        render_actors();
 
     /* render the mouse cursor */
     if(flags & MOBILEGAMEPAD_WANT_MOUSE_INPUT) {
@@ -581,6 +620,9 @@ void update_actors()
     v2d_t stick_offset = dpad_stick_offset(scale);
     actor[DPAD_STICK]->position.x += stick_offset.x;
     actor[DPAD_STICK]->position.y += stick_offset.y;
+
+    /* pre-render the controls */
+    update_cache(scale, stick_offset);
 }
 
 void render_actors()
@@ -612,6 +654,156 @@ void enable_linear_filtering()
     }
 }
 
+/* redraws the rendering cache if the appearance of the controls has changed */
+void update_cache(float scale, v2d_t stick_offset)
+{
+    v2d_t window_size = video_get_window_size();
+    bool must_redraw = false;
+
+    /* animated controls are rendered directly */
+    cache.valid = false;
+    for(int i = 0; i < NUM_CONTROLS; i++) {
+        if(animation_frame_count(actor[i]->animation) > 1 || animation_has_keyframes(actor[i]->animation))
+            return;
+    }
+
+    /* lay out the groups side by side when the size of the window changes.
+       The stick moves within its group */
+    if(cache.image == NULL || !nearly_equal(window_size.x, cache.window_size.x) || !nearly_equal(window_size.y, cache.window_size.y)) {
+        float max_stick_length = v2d_magnitude(actor_action_offset(actor[DPAD_STICK])) * scale;
+        int x = 0, height = 1;
+
+        release_cache();
+
+        for(int g = 0; g < NUM_GROUPS; g++) {
+            rect_t rect = rect_new(0, 0, 0, 0);
+
+            for(int i = 0; i < NUM_CONTROLS; i++) {
+                if(GROUP_OF_CONTROL[i] == g) {
+                    rect_t r = control_rect(i, i == DPAD_STICK ? max_stick_length : 0.0f);
+
+                    if(rect.width == 0) {
+                        rect = r;
+                    }
+                    else {
+                        int right = max(rect.x + rect.width, r.x + r.width), bottom = max(rect.y + rect.height, r.y + r.height);
+                        rect.x = min(rect.x, r.x); rect.y = min(rect.y, r.y);
+                        rect.width = right - rect.x; rect.height = bottom - rect.y;
+                    }
+                }
+            }
+
+            cache.group_rect[g] = rect;
+            x += rect.width + 1; /* padding */
+            height = max(height, rect.height);
+        }
+
+        if(NULL == (cache.image = image_create(max(1, x), height))) {
+            LOG("Can't create a rendering cache");
+            return;
+        }
+
+        x = 0;
+        for(int g = 0; g < NUM_GROUPS; g++) {
+            rect_t rect = cache.group_rect[g];
+            cache.group_image[g] = image_create_shared(cache.image, x, 0, max(1, rect.width), max(1, rect.height));
+            x += rect.width + 1;
+        }
+
+        cache.window_size = window_size;
+        must_redraw = true;
+    }
+
+    /* has anything changed? */
+    for(int i = 0; i < NUM_CONTROLS; i++)
+        must_redraw = must_redraw || (cache.control_image[i] != actor_image(actor[i]));
+    must_redraw = must_redraw || !nearly_equal(stick_offset.x, cache.stick_offset.x) || !nearly_equal(stick_offset.y, cache.stick_offset.y);
+
+    /* redraw the controls */
+    if(must_redraw) {
+        image_t* previous_target = image_drawing_target();
+        v2d_t half_screen = v2d_multiply(video_get_screen_size(), 0.5f);
+
+        image_set_drawing_target(cache.image);
+        image_clear(color_rgba(0, 0, 0, 0));
+
+        for(int g = 0; g < NUM_GROUPS; g++) {
+            image_set_drawing_target(cache.group_image[g]);
+
+            for(int i = 0; i < NUM_CONTROLS; i++) {
+                if(GROUP_OF_CONTROL[i] == g) {
+                    /* the top-left corner of the group is the origin */
+                    v2d_t camera = v2d_add(v2d_new(cache.group_rect[g].x, cache.group_rect[g].y), half_screen);
+                    float actor_alpha = actor[i]->alpha;
+
+                    actor[i]->alpha = 1.0f;
+                    actor_render(actor[i], camera);
+                    actor[i]->alpha = actor_alpha;
+
+                    cache.control_image[i] = actor_image(actor[i]);
+                }
+            }
+        }
+
+        image_set_drawing_target(previous_target);
+        cache.stick_offset = stick_offset;
+    }
+
+    cache.valid = true;
+}
+
+/* renders the controls using the rendering cache */
+void render_cache()
+{
+    float opacity = actor[DPAD]->alpha;
+
+    if(opacity <= 0.0f)
+        return;
+
+    image_hold_drawing(true);
+    for(int g = 0; g < NUM_GROUPS; g++)
+        image_draw_trans(cache.group_image[g], cache.group_rect[g].x, cache.group_rect[g].y, opacity, IF_NONE);
+    image_hold_drawing(false);
+}
+
+/* releases the rendering cache */
+void release_cache()
+{
+    if(cache.image != NULL) {
+        for(int g = NUM_GROUPS - 1; g >= 0; g--)
+            image_destroy(cache.group_image[g]);
+
+        image_destroy(cache.image);
+        cache.image = NULL;
+    }
+
+    for(int i = 0; i < NUM_CONTROLS; i++)
+        cache.control_image[i] = NULL;
+
+    cache.valid = false;
+}
+
+/* the area covered by a control in window space, extended by a margin */
+rect_t control_rect(int control, float margin)
+{
+    const actor_t* act = actor[control];
+    const image_t* image = actor_image(act);
+    v2d_t hot_spot = v2d_compmult(act->hot_spot, act->scale);
+    v2d_t size = v2d_compmult(v2d_new(image_width(image), image_height(image)), act->scale);
+
+    /* the position of the stick changes; take its resting position */
+    v2d_t position = act->position;
+    if(control == DPAD_STICK)
+        position = actor[DPAD]->position;
+
+    int left = (int)floorf(position.x - hot_spot.x - margin);
+    int top = (int)floorf(position.y - hot_spot.y - margin);
+    int right = (int)ceilf(position.x - hot_spot.x + size.x + margin);
+    int bottom = (int)ceilf(position.y - hot_spot.y + size.y + margin);
+
+    return rect_new(left, top, right - left, bottom - top);
+}
+
 /* handle a keyboard ALLEGRO_KEY_BACK event */
 void a5_handle_back_event(const ALLEGRO_EVENT* event, void* data)
 {
@@ -45,6 +45,7 @@
 #include "../util/numeric.h"
 #include "../util/util.h"
 #include "../util/stringutil.h"
+#include "../util/snapshot.h"
 #include "../physics/physicsactor.h"
 #include "../physics/obstaclemap.h"
 #include "../physics/obstacle.h"
@@ -63,18 +64,32 @@ static const float PLAYER_UNDERWATER_TIME = 30.0f;    /* how long can the player
 static const float PLAYER_TURBOCHARGE_TIME = 20.0f;   /* turbocharge time, in seconds */
 static const float PLAYER_INVINCIBILITY_TIME = 20.0f; /* invincibility time, in seconds */
 static const float PLAYER_DEAD_RESTART_TIME = 2.5f;   /* time to restart the level when the player is killed */
+#define PLAYER_MAX_BATCH 16                           /* max number of players per physics job */
 
 /* private data */
 static int collectibles = 0;                /* shared collectibles */
 static int lives = PLAYER_INITIAL_LIVES;    /* shared lives */
 static int score = 0;                       /* shared score */
 
+/* sprites of the shields, indexed by playershield_t; resolved on first use */
+static const char* SHIELD_SPRITE_NAME[] = {
+    [SH_SHIELD] = "Shield",
+    [SH_FIRESHIELD] = "Fire shield",
+    [SH_THUNDERSHIELD] = "Thunder shield",
+    [SH_WATERSHIELD] = "Water shield",
+    [SH_ACIDSHIELD] = "Acid shield",
+    [SH_WINDSHIELD] = "Wind shield"
+};
+static sprite_handle_t shield_sprite[sizeof(SHIELD_SPRITE_NAME) / sizeof(SHIELD_SPRITE_NAME[0])] = { SPRITE_HANDLE_NONE };
+
 /* misc */
 static void update_shield(player_t *player);
 static void update_animation(player_t *player);
 static void update_animation_speed(player_t *player);
 static void update_underwater_status(player_t* player);
-static void physics_adapter(player_t *player, const obstaclemap_t* obstaclemap);
+static void update(player_t *player);
+static void prepare_physics(player_t *player);
+static void read_physics(player_t *player);
 static float smooth_angle(const physicsactor_t* pa, float current_angle);
 static bool require_angle_to_be_zero(physicsactorstate_t state, movmode_t movmode);
 static inline float delta_angle(float alpha, float beta);
@@ -130,7 +145,7 @@ player_t *player_create(int id, const char *character_name)
     /* actor */
     p->actor = actor_create();
     p->actor->input = input_create_user(NULL);
-    actor_change_animation(p->actor, sprite_get_animation(c->animation.sprite_name, c->animation.stopped));
+    actor_change_animation(p->actor, character_animation(c, c->animation.stopped));
 
     /* shield */
     p->shield = actor_create();
@@ -140,9 +155,10 @@ player_t *player_create(int id, const char *character_name)
     p->invincible = FALSE;
     p->invincibility_timer = 0.0f;
     p->star = mallocx(PLAYER_MAX_STARS * sizeof(actor_t*));
+    sprite_handle_t star_sprite = sprite_resolve("Invincibility");
     for(i = 0; i < PLAYER_MAX_STARS; i++) {
         p->star[i] = actor_create();
-        actor_change_animation(p->star[i], sprite_get_animation("Invincibility", 0));
+        actor_change_animation(p->star[i], sprite_handle_get_animation(star_sprite, 0));
     }
 
     /* turbo */
@@ -204,171 +220,38 @@ player_t* player_destroy(player_t *player)
  */
 void player_update(player_t *player, const obstaclemap_t* obstaclemap)
 {
-    actor_t *act = player->actor;
-    physicsactor_t *pa = player->pa;
-    float padding = 16.0f, eps = 1e-5;
-    float dt = timer_get_delta();
-
-    /* if the player movement is enabled... */
-    if(!player->disable_movement) {
-
-        /* run physics simulation */
-        physics_adapter(player, obstaclemap);
-
-        /* read new position */
-        v2d_t position = player_position(player);
-
-        /* enter / leave water */
-        update_underwater_status(player);
-
-        /* underwater logic */
-        if(player_is_underwater(player)) {
-            /* disable turbo */
-            player_set_turbocharged(player, FALSE);
-
-            /* disable some shields */
-            if(player->shield_type == SH_FIRESHIELD || player->shield_type == SH_THUNDERSHIELD) {
-                if(!player_is_invincible(player))
-                    player_hit(player, 0.0f);
-                else
-                    player->shield_type = SH_NONE;
-            }
-
-            /* timer countdown */
-            if(player->shield_type != SH_WATERSHIELD && !player_is_winning(player) && (
-                player_is_forcibly_underwater(player) || /* forcibly underwater via scripting OR... */
-                is_head_underwater(player)               /* the head of the player is underwater */
-            ))
-                player->underwater_timer += dt;
-            else
-                player->underwater_timer = 0.0f;
-
-            /* drowning */
-            if(player_seconds_remaining_to_drown(player) <= 0.0f)
-                player_drown(player);
-        }
-
-        /* the player is blinking */
-        if(player->blinking) {
-            player->blink_timer += dt;
-
-            if(player->blink_timer >= player->blink_visibility_timer + 0.06f) {
-                player->blink_visibility_timer = player->blink_timer;
-                act->visible = !act->visible;
-            }
-
-            if(player->blink_timer >= PLAYER_MAX_BLINK)
-                player_set_blinking(player, FALSE);
-        }
-
-        /* invincibility stars */
-        if(player->invincible) {
-            /* update timer & finish */
-            player->invincibility_timer += dt;
-            if(player->invincibility_timer >= PLAYER_INVINCIBILITY_TIME)
-                player_set_invincible(player, FALSE);
-        }
-
-        /* turbo speed */
-        if(player->turbocharged) {
-            /* update timer & finish */
-            player->turbocharged_timer += dt;
-            if(player->turbocharged_timer >= PLAYER_TURBOCHARGE_TIME)
-                player_set_turbocharged(player, FALSE);
-        }
-
-        /* pitfalls */
-        if(position.y >= level_height_at(position.x)) {
-            if(!player_is_dying(player))
-                logfile_message("Player \"%s\" fell into a pit!", player_name(player));
-            player_kill(player);
-        }
-
-        /* winning pose */
-        if(level_has_been_cleared())
-            physicsactor_enable_winning_pose(pa);
-        else if(player_is_winning(player))
-            physicsactor_disable_winning_pose(pa); /* level_undo_clear() was called */
-
-        /* rolling misc */
-        if(!player_is_midair(player))
-            player->thrown_while_rolling = FALSE;
-        else if(player_ysp(player) < 0.0f && player_is_rolling(player))
-            player->thrown_while_rolling = TRUE;
-
-        /* misc */
-        player->on_movable_platform = FALSE;
-
-        /* the focused player can't get off the boundaries of the camera
-           (when boundaries are enabled) */
-        if(player_has_focus(player)) {
-            v2d_t cam_topleft = camera_clip(v2d_new(0, 0));
-            v2d_t cam_bottomright = camera_clip(level_size());
-
-            /* lock horizontally */
-            if(position.x > cam_bottomright.x - padding + eps) {
-                player_set_speed(player, player_speed(player) * 0.5f);
-                player_set_xpos(player, cam_bottomright.x - padding);
-                position = player_position(player); /* update position */
-            }
-            else if(position.x < cam_topleft.x + padding - eps) {
-                player_set_speed(player, player_speed(player) * 0.5f);
-                player_set_xpos(player, cam_topleft.x + padding);
-                position = player_position(player);
-            }
-
-            /* lock on top; won't prevent pits */
-            if(!player_is_dying(player)) {
-                if(position.y < cam_topleft.y + padding - eps) {
-                    player_set_ysp(player, player_ysp(player) * 0.5f);
-                    player_set_ypos(player, cam_topleft.y + padding);
-                    position = player_position(player);
-                }
-            }
-        }
-
-        /* am I hurt? Gotta have the focus */
-        if(player_is_getting_hit(player) || player_is_dying(player))
-            player_focus(player);
-
-    }
-#if 0
-    else {
-        /* if the player is frozen...? */
-    }
-#endif
+    player_update_batch(&player, 1, obstaclemap);
+}
 
-    /* can't leave the world */
-    v2d_t position = player_position(player);
+/*
+ * player_update_batch()
+ * Updates multiple players. Their physics simulations run in parallel
+ */
+void player_update_batch(player_t **player, int count, const obstaclemap_t* obstaclemap)
+{
+    physicsactor_t* pa[PLAYER_MAX_BATCH];
+    int n = 0;
 
-    if(position.x < padding - eps) {
-        player_set_speed(player, player_speed(player) * 0.5f);
-        player_set_xpos(player, padding);
-        position = player_position(player); /* update position */
-    }
-    else if(position.x > level_size().x - padding + eps) {
-        player_set_speed(player, player_speed(player) * 0.5f);
-        player_set_xpos(player, level_size().x - padding);
-        position = player_position(player);
+    /* large batch? */
+    if(count > PLAYER_MAX_BATCH) {
+        player_update_batch(player, PLAYER_MAX_BATCH, obstaclemap);
+        player_update_batch(player + PLAYER_MAX_BATCH, count - PLAYER_MAX_BATCH, obstaclemap);
+        return;
     }
 
-    if(position.y < padding - eps) {
-        player_set_ysp(player, player_ysp(player) * 0.5f);
-        player_set_ypos(player, padding);
-        position = player_position(player);
+    /* run the physics simulations */
+    for(int i = 0; i < count; i++) {
+        if(!player[i]->disable_movement) {
+            prepare_physics(player[i]);
+            pa[n++] = player[i]->pa;
+        }
     }
 
-    /* invincibility stars */
-    if(player->invincible)
-        animate_invincibility_stars(player);
-
-    /* shield */
-    if(player->shield_type != SH_NONE)
-        update_shield(player);
+    physicsactor_update_all(pa, n, obstaclemap);
 
-    /* restart the level if dead */
-    if(player_is_dying(player))
-        run_dying_logic(player);
+    /* the rest of the update runs sequentially */
+    for(int i = 0; i < count; i++)
+        update(player[i]);
 }
 
 
@@ -418,6 +301,14 @@ void player_render(player_t *player, v2d_t camera_position)
     /* hotspot "gambiarra" */
     hotspot_magic(player);
 
+    /* interpolate between the last two steps of the physics simulation.
+       The shield and the stars follow the player */
+    if(!player->disable_movement) {
+        v2d_t position = physicsactor_get_position(player->pa);
+        v2d_t interpolated_position = physicsactor_get_interpolated_position(player->pa);
+        camera_position = v2d_add(camera_position, v2d_subtract(position, interpolated_position));
+    }
+
     /* render the player */
     actor_render(act, camera_position);
 
@@ -737,19 +628,11 @@ void player_lock_horizontally_for(player_t *player, float seconds)
  */
 int player_collision(const player_t *player, const actor_t *actor)
 {
-    int player_box_width, player_box_height;
-    v2d_t player_box_center, actor_box_topleft;
+    v2d_t actor_box_topleft;
     float player_box[4], actor_box[4];
     const image_t *img = actor_image(actor);
 
-    physicsactor_bounding_box(player->pa, &player_box_width, &player_box_height, &player_box_center);
-    if(player_is_frozen(player))
-        player_box_center = player_position(player);
-
-    player_box[0] = player_box_center.x - player_box_width / 2;
-    player_box[1] = player_box_center.y - player_box_height / 2;
-    player_box[2] = player_box_center.x + player_box_width / 2;
-    player_box[3] = player_box_center.y + player_box_height / 2;
+    player_collision_box(player, player_box);
 
     actor_box_topleft = v2d_subtract(actor->position, actor->hot_spot);
     actor_box[0] = actor_box_topleft.x;
@@ -768,17 +651,8 @@ int player_collision(const player_t *player, const actor_t *actor)
 int player_overlaps(const player_t *player, int x, int y, int width, int height)
 {
     float player_box[4], other_box[4];
-    int player_box_width, player_box_height;
-    v2d_t player_box_center;
 
-    physicsactor_bounding_box(player->pa, &player_box_width, &player_box_height, &player_box_center);
-    if(player_is_frozen(player))
-        player_box_center = player_position(player);
-
-    player_box[0] = player_box_center.x - player_box_width / 2;
-    player_box[1] = player_box_center.y - player_box_height / 2;
-    player_box[2] = player_box_center.x + player_box_width / 2;
-    player_box[3] = player_box_center.y + player_box_height / 2;
+    player_collision_box(player, player_box);
 
     other_box[0] = x;
     other_box[1] = y;
@@ -788,6 +662,26 @@ int player_overlaps(const player_t *player, int x, int y, int width, int height)
     return bounding_box(player_box, other_box);
 }
 
+/*
+ * player_collision_box()
+ * The box used by player_collision() and player_overlaps(),
+ * in world coordinates: box = (x1, y1, x2, y2)
+ */
+void player_collision_box(const player_t *player, float box[4])
+{
+    int player_box_width, player_box_height;
+    v2d_t player_box_center;
+
+    physicsactor_bounding_box(player->pa, &player_box_width, &player_box_height, &player_box_center);
+    if(player_is_frozen(player))
+        player_box_center = player_position(player);
+
+    box[0] = player_box_center.x - player_box_width / 2;
+    box[1] = player_box_center.y - player_box_height / 2;
+    box[2] = player_box_center.x + player_box_width / 2;
+    box[3] = player_box_center.y + player_box_height / 2;
+}
+
 /*
  * player_bounding_box()
  * Returns a bounding box of the player
@@ -1362,6 +1256,25 @@ void player_set_secondary(player_t* player, int secondary)
     player->secondary = secondary;
 }
 
+/*
+ * player_has_lightweight_physics()
+ * Is the physics simulation of the player running in lightweight mode?
+ */
+int player_has_lightweight_physics(const player_t* player)
+{
+    return physicsactor_is_lightweight(player->pa);
+}
+
+/*
+ * player_set_lightweight_physics()
+ * Run a cheaper, less accurate physics simulation at a reduced rate. This is
+ * meant for players that can't be seen, such as companions that are off screen
+ */
+void player_set_lightweight_physics(player_t* player, int lightweight)
+{
+    physicsactor_set_lightweight(player->pa, lightweight);
+}
+
 /*
  * player_is_focusable()
  * Is the player focusable? That is, can this player receive
@@ -1508,6 +1421,44 @@ v2d_t player_position(const player_t* player)
     return physicsactor_get_position(player->pa);
 }
 
+/* the dynamic state of a player, in the order it's serialized. The
+   physics, the actor and the character are stored elsewhere */
+#define PLAYER_STATE_FIELDS(X) \
+    X(disable_movement) X(disable_roll) X(on_movable_platform) X(disable_animation_control) \
+    X(invulnerable) X(immortal) X(aggressive) X(inoffensive) X(secondary) X(focusable) \
+    X(mirror) X(got_glasses) X(shield_type) \
+    X(invincible) X(invincibility_timer) X(turbocharged) X(turbocharged_timer) X(layer) \
+    X(underwater) X(forcibly_underwater) X(forcibly_out_of_water) X(underwater_timer) X(breath_time) \
+    X(blinking) X(blink_timer) X(blink_visibility_timer) X(dead_timer) \
+    X(thrown_while_rolling) X(visible)
+
+/*
+ * player_save_state()
+ * Write the dynamic state of the player, including its physics, to a snapshot
+ */
+void player_save_state(const player_t* player, snapshot_t* snapshot)
+{
+    #define SAVE_FIELD(field) snapshot_put(snapshot, player->field);
+    PLAYER_STATE_FIELDS(SAVE_FIELD)
+    #undef SAVE_FIELD
+
+    physicsactor_save_state(player->pa, snapshot);
+}
+
+/*
+ * player_load_state()
+ * Read the dynamic state of the player from a snapshot
+ */
+void player_load_state(player_t* player, snapshot_t* snapshot)
+{
+    #define LOAD_FIELD(field) snapshot_get(snapshot, player->field);
+    PLAYER_STATE_FIELDS(LOAD_FIELD)
+    #undef LOAD_FIELD
+
+    physicsactor_load_state(player->pa, snapshot);
+    player->actor->position = physicsactor_get_position(player->pa);
+}
+
 /*
  * player_set_position()
  * The position of the player in world space
@@ -1713,33 +1664,12 @@ void update_shield(player_t *player)
     sh->position = v2d_add(position, v2d_rotate(offset, -angle));
     sh->scale = scale;
 
-    switch(player->shield_type) {
-        case SH_SHIELD:
-            actor_change_animation(sh, sprite_get_animation("Shield", 0));
-            break;
-
-        case SH_FIRESHIELD:
-            actor_change_animation(sh, sprite_get_animation("Fire shield", 0));
-            break;
-
-        case SH_THUNDERSHIELD:
-            actor_change_animation(sh, sprite_get_animation("Thunder shield", 0));
-            break;
-
-        case SH_WATERSHIELD:
-            actor_change_animation(sh, sprite_get_animation("Water shield", 0));
-            break;
-
-        case SH_ACIDSHIELD:
-            actor_change_animation(sh, sprite_get_animation("Acid shield", 0));
-            break;
-
-        case SH_WINDSHIELD:
-            actor_change_animation(sh, sprite_get_animation("Wind shield", 0));
-            break;
+    /* change the animation */
+    if(player->shield_type != SH_NONE) {
+        if(shield_sprite[player->shield_type] == SPRITE_HANDLE_NONE)
+            shield_sprite[player->shield_type] = sprite_resolve(SHIELD_SPRITE_NAME[player->shield_type]);
 
-        case SH_NONE:
-            break;
+        actor_change_animation(sh, sprite_handle_get_animation(shield_sprite[player->shield_type], 0));
     }
 }
 
@@ -1748,7 +1678,7 @@ void update_animation(player_t *player)
 {
     #define CHANGE_ANIM(id) do { \
         const character_t* character = player->character; \
-        const animation_t* anim = sprite_get_animation(character->animation.sprite_name, character->animation.id); \
+        const animation_t* anim = character_animation(character, character->animation.id); \
         actor_change_animation(player->actor, anim); \
     } while(0)
 
@@ -1834,8 +1764,8 @@ void update_underwater_status(player_t* player)
             player_leave_water(player);
     }
 
-    /* adopt the regular logic: check the waterlevel */
-    else if(player_position(player).y >= level_waterlevel()) {
+    /* adopt the regular logic: check the waterlevel and the water regions */
+    else if(level_is_underwater(player_position(player))) {
         if(!player_is_underwater(player))
             player_enter_water(player);
     }
@@ -1845,8 +1775,178 @@ void update_underwater_status(player_t* player)
     }
 }
 
-/* the interface between player_t and physicsactor_t */
-void physics_adapter(player_t *player, const obstaclemap_t* obstaclemap)
+/* updates the player after the physics simulation */
+void update(player_t *player)
+{
+    actor_t *act = player->actor;
+    physicsactor_t *pa = player->pa;
+    float padding = 16.0f, eps = 1e-5;
+    float dt = timer_get_delta();
+
+    /* if the player movement is enabled... */
+    if(!player->disable_movement) {
+
+        /* read the results of the physics simulation */
+        read_physics(player);
+
+        /* read new position */
+        v2d_t position = player_position(player);
+
+        /* enter / leave water */
+        update_underwater_status(player);
+
+        /* underwater logic */
+        if(player_is_underwater(player)) {
+            /* disable turbo */
+            player_set_turbocharged(player, FALSE);
+
+            /* disable some shields */
+            if(player->shield_type == SH_FIRESHIELD || player->shield_type == SH_THUNDERSHIELD) {
+                if(!player_is_invincible(player))
+                    player_hit(player, 0.0f);
+                else
+                    player->shield_type = SH_NONE;
+            }
+
+            /* timer countdown */
+            if(player->shield_type != SH_WATERSHIELD && !player_is_winning(player) && (
+                player_is_forcibly_underwater(player) || /* forcibly underwater via scripting OR... */
+                is_head_underwater(player)               /* the head of the player is underwater */
+            ))
+                player->underwater_timer += dt;
+            else
+                player->underwater_timer = 0.0f;
+
+            /* drowning */
+            if(player_seconds_remaining_to_drown(player) <= 0.0f)
+                player_drown(player);
+        }
+
+        /* the player is blinking */
+        if(player->blinking) {
+            player->blink_timer += dt;
+
+            if(player->blink_timer >= player->blink_visibility_timer + 0.06f) {
+                player->blink_visibility_timer = player->blink_timer;
+                act->visible = !act->visible;
+            }
+
+            if(player->blink_timer >= PLAYER_MAX_BLINK)
+                player_set_blinking(player, FALSE);
+        }
+
+        /* invincibility stars */
+        if(player->invincible) {
+            /* update timer & finish */
+            player->invincibility_timer += dt;
+            if(player->invincibility_timer >= PLAYER_INVINCIBILITY_TIME)
+                player_set_invincible(player, FALSE);
+        }
+
+        /* turbo speed */
+        if(player->turbocharged) {
+            /* update timer & finish */
+            player->turbocharged_timer += dt;
+            if(player->turbocharged_timer >= PLAYER_TURBOCHARGE_TIME)
+                player_set_turbocharged(player, FALSE);
+        }
+
+        /* pitfalls */
+        if(position.y >= level_height_at(position.x)) {
+            if(!player_is_dying(player))
+                logfile_message("Player \"%s\" fell into a pit!", player_name(player));
+            player_kill(player);
+        }
+
+        /* winning pose */
+        if(level_has_been_cleared())
+            physicsactor_enable_winning_pose(pa);
+        else if(player_is_winning(player))
+            physicsactor_disable_winning_pose(pa); /* level_undo_clear() was called */
+
+        /* rolling misc */
+        if(!player_is_midair(player))
+            player->thrown_while_rolling = FALSE;
+        else if(player_ysp(player) < 0.0f && player_is_rolling(player))
+            player->thrown_while_rolling = TRUE;
+
+        /* misc */
+        player->on_movable_platform = FALSE;
+
+        /* the focused player can't get off the boundaries of the camera
+           (when boundaries are enabled) */
+        if(player_has_focus(player)) {
+            v2d_t cam_topleft = camera_clip(v2d_new(0, 0));
+            v2d_t cam_bottomright = camera_clip(level_size());
+
+            /* lock horizontally */
+            if(position.x > cam_bottomright.x - padding + eps) {
+                player_set_speed(player, player_speed(player) * 0.5f);
+                player_set_xpos(player, cam_bottomright.x - padding);
+                position = player_position(player); /* update position */
+            }
+            else if(position.x < cam_topleft.x + padding - eps) {
+                player_set_speed(player, player_speed(player) * 0.5f);
+                player_set_xpos(player, cam_topleft.x + padding);
+                position = player_position(player);
+            }
+
+            /* lock on top; won't prevent pits */
+            if(!player_is_dying(player)) {
+                if(position.y < cam_topleft.y + padding - eps) {
+                    player_set_ysp(player, player_ysp(player) * 0.5f);
+                    player_set_ypos(player, cam_topleft.y + padding);
+                    position = player_position(player);
+                }
+            }
+        }
+
+        /* am I hurt? Gotta have the focus */
+        if(player_is_getting_hit(player) || player_is_dying(player))
+            player_focus(player);
+
+    }
+#if 0
+    else {
+        /* if the player is frozen...? */
+    }
+#endif
+
+    /* can't leave the world */
+    v2d_t position = player_position(player);
+
+    if(position.x < padding - eps) {
+        player_set_speed(player, player_speed(player) * 0.5f);
+        player_set_xpos(player, padding);
+        position = player_position(player); /* update position */
+    }
+    else if(position.x > level_size().x - padding + eps) {
+        player_set_speed(player, player_speed(player) * 0.5f);
+        player_set_xpos(player, level_size().x - padding);
+        position = player_position(player);
+    }
+
+    if(position.y < padding - eps) {
+        player_set_ysp(player, player_ysp(player) * 0.5f);
+        player_set_ypos(player, padding);
+        position = player_position(player);
+    }
+
+    /* invincibility stars */
+    if(player->invincible)
+        animate_invincibility_stars(player);
+
+    /* shield */
+    if(player->shield_type != SH_NONE)
+        update_shield(player);
+
+    /* restart the level if dead */
+    if(player_is_dying(player))
+        run_dying_logic(player);
+}
+
+/* the interface between player_t and physicsactor_t: call before the physics update */
+void prepare_physics(player_t *player)
 {
     physicsactor_t *pa = player->pa;
     actor_t *act = player->actor;
@@ -1861,9 +1961,13 @@ void physics_adapter(player_t *player, const obstaclemap_t* obstaclemap)
         physicsactor_set_layer(pa, OL_YELLOW);
     else
         physicsactor_set_layer(pa, OL_DEFAULT);
+}
 
-    /* physics update */
-    physicsactor_update(pa, obstaclemap);
+/* the interface between player_t and physicsactor_t: call after the physics update */
+void read_physics(player_t *player)
+{
+    physicsactor_t *pa = player->pa;
+    actor_t *act = player->actor;
 
     /* update position */
     act->position = physicsactor_get_position(pa);
@@ -2107,7 +2211,7 @@ int is_head_underwater(const player_t* player)
 
     top = player_box_center.y - player_box_height / 2.0f;
     bottom = player_box_center.y + player_box_height / 2.0f;
-    return (int)lerp(bottom, top, head_factor) >= level_waterlevel();
+    return level_is_underwater(v2d_new(player_box_center.x, (int)lerp(bottom, top, head_factor)));
 }
 
 /* turbocharged physics */
@@ -48,6 +48,7 @@ struct physicsactor_t;
 struct obstaclemap_t;
 struct character_t;
 struct surgescript_object_t;
+struct snapshot_t;
 
 /* constants */
 extern const int PLAYER_INITIAL_LIVES;       /* initial lives */
@@ -108,6 +109,7 @@ player_t* player_create(int id, const char *character_name);
 player_t* player_destroy(player_t *player);
 void player_early_update(player_t *player);
 void player_update(player_t *player, const struct obstaclemap_t* obstaclemap);
+void player_update_batch(player_t **player, int count, const struct obstaclemap_t* obstaclemap); /* physics in parallel */
 void player_render(player_t *player, v2d_t camera_position);
 
 void player_hit(player_t *player, float direction);
@@ -124,6 +126,7 @@ void player_disable_roll(player_t *player);
 void player_lock_horizontally_for(player_t *player, float seconds);
 int player_collision(const player_t *player, const struct actor_t *actor);
 int player_overlaps(const player_t *player, int x, int y, int width, int height);
+void player_collision_box(const player_t *player, float box[4]);
 rect_t player_bounding_box(const player_t* player);
 int player_senses_layer(const player_t* player, bricklayer_t layer);
 int player_transform_into(player_t *player, struct surgescript_object_t *player_object, const char *character_name);
@@ -173,6 +176,8 @@ int player_is_immortal(const player_t* player);
 void player_set_immortal(player_t* player, int immortal);
 int player_is_secondary(const player_t* player);
 void player_set_secondary(player_t* player, int secondary);
+int player_has_lightweight_physics(const player_t* player);
+void player_set_lightweight_physics(player_t* player, int lightweight); /* cheaper physics for players that are off screen */
 int player_is_focusable(const player_t* player);
 void player_set_focusable(player_t* player, int focusable);
 
@@ -185,6 +190,9 @@ void player_set_xsp(player_t* player, float value);
 float player_ysp(const player_t* player);
 void player_set_ysp(player_t* player, float value);
 
+void player_save_state(const player_t* player, struct snapshot_t* snapshot); /* write the dynamic state of the player, including its physics, to a snapshot */
+void player_load_state(player_t* player, struct snapshot_t* snapshot); /* read the dynamic state of the player from a snapshot */
+
 v2d_t player_position(const player_t* player);
 void player_set_position(player_t* player, v2d_t position);
 void player_set_xpos(player_t* player, float xpos);
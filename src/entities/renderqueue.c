@@ -21,10 +21,12 @@
 #include <allegro5/allegro.h>
 #include <surgescript.h>
 #include <string.h>
+#include <stdint.h>
 #include <math.h>
 #include "renderqueue.h"
 #include "player.h"
 #include "brick.h"
+#include "brickbatch.h"
 #include "actor.h"
 #include "background.h"
 #include "waterfx.h"
@@ -34,8 +36,13 @@
 #include "../core/video.h"
 #include "../core/image.h"
 #include "../core/shader.h"
+#include "../core/gputimer.h"
+#include "../core/jobs.h"
+#include "../core/engine.h"
 #include "../util/util.h"
 #include "../util/stringutil.h"
+#include "../util/profiler.h"
+#include "../util/arena.h"
 #include "../scenes/level.h"
 #include "../scripting/scripting.h"
 
@@ -49,6 +56,7 @@ enum {
     TYPE_BRICK_MASK,
     TYPE_BRICK_DEBUG,
     TYPE_BRICK_PATH,
+    TYPE_BRICK_BATCH,
 
     TYPE_SSOBJECT,
     TYPE_SSOBJECT_GIZMO,
@@ -67,6 +75,7 @@ typedef union renderable_t renderable_t;
 union renderable_t {
     player_t* player;
     brick_t* brick;
+    const brickgroup_t* brickgroup;
     item_t* item;
     object_t* object; /* legacy object */
     surgescript_object_t* ssobject;
@@ -84,6 +93,9 @@ struct renderable_vtable_t {
     const char* (*path)(renderable_t, char*, size_t);
     int (*type)(renderable_t);
     bool (*is_translucent)(renderable_t);
+    bool (*bounds)(renderable_t,rect_t*); /* bounding box in world space, used to cull the views; NULL or false if unbounded */
+    bool is_reentrant; /* can the sorting keys be computed in a worker thread? */
+    bool is_occludable; /* can the entry be hidden by the opaque bricks in front of it? */
 };
 
 /* an entry of the render queue */
@@ -102,6 +114,8 @@ struct renderqueue_entry_t {
         int ypos;
         texturehandle_t texture;
         bool is_translucent;
+        bool is_bounded; /* computed only if there are multiple views */
+        rect_t bounds;
     } cached;
 
 #if defined(__GNUC__)
@@ -110,6 +124,18 @@ struct renderqueue_entry_t {
 };
 #endif
 
+/* an entry of the render queue as it was sorted in the previous frame (retained mode) */
+typedef struct renderqueue_retained_t renderqueue_retained_t;
+struct renderqueue_retained_t {
+    renderable_t renderable;
+    const renderable_vtable_t* vtable;
+
+    /* sorting keys; see cmp_fun() */
+    float zindex;
+    int type;
+    int ypos;
+};
+
 /* vtables */
 static float zindex_player(renderable_t r);
 static float zindex_item(renderable_t r);
@@ -118,6 +144,7 @@ static float zindex_brick(renderable_t r);
 static float zindex_brick_mask(renderable_t r);
 static float zindex_brick_debug(renderable_t r);
 static float zindex_brick_path(renderable_t r);
+static float zindex_brick_batch(renderable_t r);
 static float zindex_ssobject(renderable_t r);
 static float zindex_ssobject_gizmo(renderable_t r);
 static float zindex_ssobject_debug(renderable_t r);
@@ -132,6 +159,7 @@ static void render_brick(renderable_t r, v2d_t camera_position);
 static void render_brick_mask(renderable_t r, v2d_t camera_position);
 static void render_brick_debug(renderable_t r, v2d_t camera_position);
 static void render_brick_path(renderable_t r, v2d_t camera_position);
+static void render_brick_batch(renderable_t r, v2d_t camera_position);
 static void render_ssobject(renderable_t r, v2d_t camera_position);
 static void render_ssobject_gizmo(renderable_t r, v2d_t camera_position);
 static void render_ssobject_debug(renderable_t r, v2d_t camera_position);
@@ -146,6 +174,7 @@ static int ypos_brick(renderable_t r);
 static int ypos_brick_mask(renderable_t r);
 static int ypos_brick_debug(renderable_t r);
 static int ypos_brick_path(renderable_t r);
+static int ypos_brick_batch(renderable_t r);
 static int ypos_ssobject(renderable_t r);
 static int ypos_ssobject_gizmo(renderable_t r);
 static int ypos_ssobject_debug(renderable_t r);
@@ -160,6 +189,7 @@ static texturehandle_t texture_brick(renderable_t r);
 static texturehandle_t texture_brick_mask(renderable_t r);
 static texturehandle_t texture_brick_debug(renderable_t r);
 static texturehandle_t texture_brick_path(renderable_t r);
+static texturehandle_t texture_brick_batch(renderable_t r);
 static texturehandle_t texture_ssobject(renderable_t r);
 static texturehandle_t texture_ssobject_gizmo(renderable_t r);
 static texturehandle_t texture_ssobject_debug(renderable_t r);
@@ -174,6 +204,7 @@ static const char* path_brick(renderable_t r, char* dest, size_t dest_size);
 static const char* path_brick_mask(renderable_t r, char* dest, size_t dest_size);
 static const char* path_brick_debug(renderable_t r, char* dest, size_t dest_size);
 static const char* path_brick_path(renderable_t r, char* dest, size_t dest_size);
+static const char* path_brick_batch(renderable_t r, char* dest, size_t dest_size);
 static const char* path_ssobject(renderable_t r, char* dest, size_t dest_size);
 static const char* path_ssobject_gizmo(renderable_t r, char* dest, size_t dest_size);
 static const char* path_ssobject_debug(renderable_t r, char* dest, size_t dest_size);
@@ -188,6 +219,7 @@ static int type_brick(renderable_t r);
 static int type_brick_mask(renderable_t r);
 static int type_brick_debug(renderable_t r);
 static int type_brick_path(renderable_t r);
+static int type_brick_batch(renderable_t r);
 static int type_ssobject(renderable_t r);
 static int type_ssobject_gizmo(renderable_t r);
 static int type_ssobject_debug(renderable_t r);
@@ -202,6 +234,7 @@ static bool is_translucent_brick(renderable_t r);
 static bool is_translucent_brick_mask(renderable_t r);
 static bool is_translucent_brick_debug(renderable_t r);
 static bool is_translucent_brick_path(renderable_t r);
+static bool is_translucent_brick_batch(renderable_t r);
 static bool is_translucent_ssobject(renderable_t r);
 static bool is_translucent_ssobject_gizmo(renderable_t r);
 static bool is_translucent_ssobject_debug(renderable_t r);
@@ -209,6 +242,12 @@ static bool is_translucent_background(renderable_t r);
 static bool is_translucent_foreground(renderable_t r);
 static bool is_translucent_water(renderable_t r);
 
+static bool bounds_brick(renderable_t r, rect_t* bounds);
+static bool bounds_brick_mask(renderable_t r, rect_t* bounds);
+static bool bounds_brick_debug(renderable_t r, rect_t* bounds);
+static bool bounds_ssobject(renderable_t r, rect_t* bounds);
+static bool bounds_ssobject_debug(renderable_t r, rect_t* bounds);
+
 static const renderable_vtable_t VTABLE[] = {
     [TYPE_BRICK] = {
         .zindex = zindex_brick,
@@ -217,7 +256,10 @@ static const renderable_vtable_t VTABLE[] = {
         .texture = texture_brick,
         .path = path_brick,
         .type = type_brick,
-        .is_translucent = is_translucent_brick
+        .is_translucent = is_translucent_brick,
+        .bounds = bounds_brick,
+        .is_reentrant = true,
+        .is_occludable = true
     },
 
     [TYPE_BRICK_MASK] = {
@@ -227,7 +269,9 @@ static const renderable_vtable_t VTABLE[] = {
         .texture = texture_brick_mask,
         .path = path_brick_mask,
         .type = type_brick_mask,
-        .is_translucent = is_translucent_brick_mask
+        .is_translucent = is_translucent_brick_mask,
+        .bounds = bounds_brick_mask,
+        .is_reentrant = true
     },
 
     [TYPE_BRICK_DEBUG] = {
@@ -237,7 +281,9 @@ static const renderable_vtable_t VTABLE[] = {
         .texture = texture_brick_debug,
         .path = path_brick_debug,
         .type = type_brick_debug,
-        .is_translucent = is_translucent_brick_debug
+        .is_translucent = is_translucent_brick_debug,
+        .bounds = bounds_brick_debug,
+        .is_reentrant = true
     },
 
     [TYPE_BRICK_PATH] = {
@@ -247,7 +293,19 @@ static const renderable_vtable_t VTABLE[] = {
         .texture = texture_brick_path,
         .path = path_brick_path,
         .type = type_brick_path,
-        .is_translucent = is_translucent_brick_path
+        .is_translucent = is_translucent_brick_path,
+        .is_reentrant = true
+    },
+
+    [TYPE_BRICK_BATCH] = {
+        .zindex = zindex_brick_batch,
+        .render = render_brick_batch,
+        .ypos = ypos_brick_batch,
+        .texture = texture_brick_batch,
+        .path = path_brick_batch,
+        .type = type_brick_batch,
+        .is_translucent = is_translucent_brick_batch,
+        .is_reentrant = true
     },
 
     [TYPE_ITEM] = {
@@ -287,7 +345,9 @@ static const renderable_vtable_t VTABLE[] = {
         .texture = texture_ssobject,
         .path = path_ssobject,
         .type = type_ssobject,
-        .is_translucent = is_translucent_ssobject
+        .is_translucent = is_translucent_ssobject,
+        .bounds = bounds_ssobject,
+        .is_occludable = true
     },
 
     [TYPE_SSOBJECT_DEBUG] = {
@@ -297,7 +357,8 @@ static const renderable_vtable_t VTABLE[] = {
         .texture = texture_ssobject_debug,
         .path = path_ssobject_debug,
         .type = type_ssobject_debug,
-        .is_translucent = is_translucent_ssobject_debug
+        .is_translucent = is_translucent_ssobject_debug,
+        .bounds = bounds_ssobject_debug
     },
 
     [TYPE_SSOBJECT_GIZMO] = {
@@ -317,7 +378,8 @@ static const renderable_vtable_t VTABLE[] = {
         .texture = texture_background,
         .path = path_background,
         .type = type_background,
-        .is_translucent = is_translucent_background
+        .is_translucent = is_translucent_background,
+        .is_reentrant = true
     },
 
     [TYPE_FOREGROUND] = {
@@ -327,7 +389,8 @@ static const renderable_vtable_t VTABLE[] = {
         .texture = texture_foreground,
         .path = path_foreground,
         .type = type_foreground,
-        .is_translucent = is_translucent_foreground
+        .is_translucent = is_translucent_foreground,
+        .is_reentrant = true
     },
 
     [TYPE_WATER] = {
@@ -337,7 +400,8 @@ static const renderable_vtable_t VTABLE[] = {
         .texture = texture_water,
         .path = path_water,
         .type = type_water,
-        .is_translucent = is_translucent_water
+        .is_translucent = is_translucent_water,
+        .is_reentrant = true
     }
 };
 
@@ -377,6 +441,50 @@ static const char fs_glsl_with_alpha_testing[] = ""
 #define REPORT_END()              (void)0
 static bool want_report = false;
 
+/* render queue profiler */
+#define TYPE_COUNT                ((int)(sizeof(VTABLE) / sizeof(VTABLE[0])))
+#define PROFILER_FRAMES           60 /* collect data over this number of frames */
+static bool want_profiler = false;
+static int profiler_frames = 0;
+static double profiler_sort_time = 0.0;
+static renderqueue_profile_t profiler_sum[TYPE_COUNT + 1]; /* the last entry is the total */
+static renderqueue_profile_t profiler_avg[TYPE_COUNT + 1];
+static const char* TYPE_NAME[] = {
+    [TYPE_PLAYER] = "player",
+    [TYPE_BRICK] = "brick",
+    [TYPE_BRICK_MASK] = "brick mask",
+    [TYPE_BRICK_DEBUG] = "brick debug",
+    [TYPE_BRICK_PATH] = "brick path",
+    [TYPE_BRICK_BATCH] = "brick batch",
+    [TYPE_SSOBJECT] = "ssobject",
+    [TYPE_SSOBJECT_GIZMO] = "ssobject gizmo",
+    [TYPE_SSOBJECT_DEBUG] = "ssobject debug",
+    [TYPE_BACKGROUND] = "background",
+    [TYPE_FOREGROUND] = "foreground",
+    [TYPE_WATER] = "water",
+    [TYPE_ITEM] = "item",
+    [TYPE_OBJECT] = "object"
+};
+static const gpuphase_t GPU_PHASE[] = {
+    [TYPE_PLAYER] = GPUPHASE_ENTITIES,
+    [TYPE_BRICK] = GPUPHASE_BRICKS,
+    [TYPE_BRICK_MASK] = GPUPHASE_BRICKS,
+    [TYPE_BRICK_DEBUG] = GPUPHASE_BRICKS,
+    [TYPE_BRICK_PATH] = GPUPHASE_BRICKS,
+    [TYPE_BRICK_BATCH] = GPUPHASE_BRICKS,
+    [TYPE_SSOBJECT] = GPUPHASE_ENTITIES,
+    [TYPE_SSOBJECT_GIZMO] = GPUPHASE_ENTITIES,
+    [TYPE_SSOBJECT_DEBUG] = GPUPHASE_ENTITIES,
+    [TYPE_BACKGROUND] = GPUPHASE_BACKGROUND,
+    [TYPE_FOREGROUND] = GPUPHASE_BACKGROUND,
+    [TYPE_WATER] = GPUPHASE_WATER,
+    [TYPE_ITEM] = GPUPHASE_ENTITIES,
+    [TYPE_OBJECT] = GPUPHASE_ENTITIES
+};
+static void profile_entry(const renderqueue_entry_t* entry, double elapsed_time, bool is_batch, bool is_texture_switch, bool is_draw_call);
+static void profile_frame(double sort_time);
+static void reset_profiler();
+
 /* utilities */
 #define ZINDEX_OFFSET(n)          (0.000001f * (float)(n)) /* ZINDEX_OFFSET(1) is the mininum zindex offset */
 #define ZINDEX_LARGE              99999.0f /* will be displayed in front of others */
@@ -385,19 +493,64 @@ static bool want_report = false;
 static const texturehandle_t NO_TEXTURE = ~0u;
 static int cmp_fun(const void* i, const void* j);
 static int cmp_zbuf_fun(const void* i, const void* j);
+static int cmp_earlyz_fun(const void* i, const void* j);
 static inline float brick_zindex_offset(const brick_t *brick);
 static void enqueue(const renderqueue_entry_t* entry);
 static const char* random_path(char prefix);
+static void allocate_buffers(int capacity);
+static void release_buffers();
+static int sort_entries();
+static void retain_entries();
+static int find_retained(const renderqueue_entry_t* entry);
+static inline uint32_t hash_renderable(renderable_t renderable, const renderable_vtable_t* vtable);
+static inline void record_entry(renderqueue_entry_t* e);
+static void record_entries();
+static void record_range(int begin, int end, void* context);
+static int cull_occluded_entries();
+static bool is_occluded(const renderqueue_entry_t* entry, const float* coverage, int left, int top, int columns, int rows);
 
 /* internal data */
 static bool use_depth_buffer = false;
+static bool use_early_z = false; /* render the opaque entries front-to-back */
 static shader_t* internal_shader = NULL;
 static renderqueue_entry_t* buffer = NULL; /* storage */
-static int* sorted_indices = NULL; /* a permutation of 0, 1, ... n-1, where n = buffer_size */
 static renderqueue_entry_t** sorted_buffer = NULL; /* sorted indirection to buffer[] */
 static int buffer_size = 0;
 static int buffer_capacity = 0;
-static v2d_t camera;
+
+/* views */
+typedef struct renderqueue_view_t renderqueue_view_t;
+struct renderqueue_view_t {
+    v2d_t camera; /* the position of the camera, mapped to the center of the viewport */
+    rect_t viewport; /* in screen space */
+    rect_t area; /* the region of the world seen through the viewport */
+};
+static renderqueue_view_t view[RENDERQUEUE_MAX_VIEWS];
+static int view_count = 1;
+static const int SSOBJECT_CULLING_MARGIN = 256; /* in pixels */
+static v2d_t begin_view(int view_index);
+static void end_view(int view_index);
+static inline bool is_visible(const renderqueue_entry_t* entry, int view_index);
+
+/* retained mode */
+static renderqueue_retained_t* retained = NULL; /* the sorted entries of the previous frame */
+static int retained_size = 0;
+static int* retained_index = NULL; /* maps a renderable to 1 + its position in retained[]; 0 means empty */
+static int retained_index_mask = 0; /* the capacity of retained_index[] minus 1; the capacity is a power of 2 */
+static renderqueue_entry_t** clean_buffer = NULL; /* entries whose sorting keys haven't changed since the previous frame */
+static renderqueue_entry_t** dirty_buffer = NULL; /* entries that need to be sorted */
+static renderqueue_entry_t** scratch_buffer = NULL; /* scratch memory of the merge sort */
+static renderqueue_stats_t stats; /* high-water marks */
+
+/* parallel recording */
+#define MIN_ENTRIES_PER_WORKER    512 /* don't bother with threads for small queues */
+
+/* occlusion culling */
+#define OCCLUSION_CELL_SIZE       16 /* in pixels; the size of the bricks is usually a multiple of it */
+#define MAX_OCCLUSION_CELLS       8192 /* no occlusion culling if the views are too large */
+static const brick_t** occluder = NULL; /* opaque bricks of the current frame */
+static int occluder_count = 0;
+static int occluder_capacity = 0;
 
 
 
@@ -453,6 +606,38 @@ https://liballeg.org/a5docs/trunk/graphics.html#deferred-drawing
 #define USE_DEFERRED_DRAWING 1
 
 
+
+/*
+
+OPTIMIZATION: RETAINED ORDER
+----------------------------
+
+Most entries of the render queue are enqueued again and again, frame after
+frame, with the same sorting keys (z-index, type and ypos). Think of the bricks
+of a level: they rarely change. Fully sorting the render queue every frame is,
+therefore, mostly redundant work.
+
+We keep the sorted entries of the previous frame in retained[], as well as an
+index that maps a renderable (and its vtable) to its position in retained[].
+When sorting a new frame, each entry is classified as follows:
+
+clean: the entry was in the previous frame and its sorting keys are the same
+dirty: the entry is new or its sorting keys have changed
+
+Since the sorting keys of the clean entries haven't changed, the clean entries
+are still sorted relative to each other if we take them in the order of the
+previous frame. We collect them in that order in O(n), we sort the dirty
+entries only and then we merge both sequences in O(n). On a typical frame,
+there are only a few dirty entries.
+
+The sorting keys are computed every frame (see enqueue()), so the result is
+correct even if a renderable is destroyed and a new one is created at the same
+address: it would either be clean with the right keys or dirty.
+
+*/
+#define USE_RETAINED_ORDER 1
+
+
 /* ----- public interface -----*/
 
 
@@ -461,25 +646,52 @@ https://liballeg.org/a5docs/trunk/graphics.html#deferred-drawing
  * renderqueue_init()
  * Initializes the render queue
  */
-void renderqueue_init(bool want_depth_buffer)
+void renderqueue_init(bool want_depth_buffer, bool want_early_z)
 {
-    LOG("initializing %s depth buffer...", want_depth_buffer ? "with" : "without");
+    LOG("initializing...");
 
-    /* do we want the depth buffer? */
-    use_depth_buffer = want_depth_buffer;
+    /* depth buffer & early-Z */
+    renderqueue_set_depth_mode(want_depth_buffer, want_early_z);
 
     /* no reporting */
     want_report = false;
 
-    /* initialize the camera */
-    camera = v2d_new(0, 0);
+    /* no profiling */
+    want_profiler = false;
+    reset_profiler();
+    gputimer_set_enabled(false);
 
-    /* allocate buffers */
+    /* initialize the views */
+    renderqueue_begin(v2d_new(0, 0));
+
+    /* allocate buffers. They grow as needed and are
+       only released in renderqueue_release(), so that
+       steady-state frames do no heap allocations */
     buffer_size = 0;
-    buffer_capacity = INITIAL_BUFFER_CAPACITY;
-    buffer = mallocx(buffer_capacity * sizeof(*buffer));
-    sorted_buffer = mallocx(buffer_capacity * sizeof(*sorted_buffer));
-    sorted_indices = mallocx(buffer_capacity * sizeof(*sorted_indices));
+    retained_size = 0;
+    memset(&stats, 0, sizeof(stats));
+    allocate_buffers(INITIAL_BUFFER_CAPACITY);
+
+    /* done! */
+    LOG("initialized!");
+}
+
+/*
+ * renderqueue_set_depth_mode()
+ * Enables or disables the depth buffer and the front-to-back opaque pass
+ * (early-Z). Call it between frames; it takes effect at the next frame
+ */
+void renderqueue_set_depth_mode(bool want_depth_buffer, bool want_early_z)
+{
+    LOG("%s depth buffer", want_depth_buffer || want_early_z ? "with" : "without");
+
+    /* do we want the depth buffer? */
+    use_depth_buffer = want_depth_buffer || want_early_z;
+
+    /* do we want a front-to-back opaque pass? */
+    use_early_z = want_early_z;
+    if(use_early_z)
+        LOG("will render opaque entries front-to-back");
 
     /* setup the internal shader of the renderqueue */
     if(use_depth_buffer) {
@@ -494,9 +706,6 @@ void renderqueue_init(bool want_depth_buffer)
         LOG("will not perform alpha testing");
         internal_shader = NULL; /* we'll use the default shader */
     }
-
-    /* done! */
-    LOG("initialized!");
 }
 
 /*
@@ -509,23 +718,25 @@ void renderqueue_release()
 
     video_use_default_shader();
 
-    free(sorted_indices);
-    sorted_indices = NULL;
-
-    free(sorted_buffer);
-    sorted_buffer = NULL;
-
-    free(buffer);
-    buffer = NULL;
+    LOG("peak usage: %d of %d entries (%d sorted), %d reallocations, %d KiB",
+        stats.high_water_mark, stats.capacity, stats.max_sorted_entries,
+        stats.reallocations, (int)(stats.bytes / 1024));
+    release_buffers();
 
-    buffer_capacity = 0;
-    buffer_size = 0;
+    free(occluder);
+    occluder = NULL;
+    occluder_count = 0;
+    occluder_capacity = 0;
 
     if(want_report) {
         want_report = false;
         REPORT_CLEAR();
     }
 
+    want_profiler = false;
+    reset_profiler();
+    gputimer_set_enabled(false);
+
     LOG("released!");
 }
 
@@ -538,8 +749,34 @@ void renderqueue_release()
  */
 void renderqueue_begin(v2d_t camera_position)
 {
-    camera = camera_position;
+    v2d_t screen_size = video_get_screen_size();
+    rect_t viewport = rect_new(0, 0, (int)screen_size.x, (int)screen_size.y);
+
+    renderqueue_begin_views(&camera_position, &viewport, 1);
+}
+
+/*
+ * renderqueue_begin_views()
+ * Starts a new rendering process with multiple views (e.g., split-screen).
+ * The entities are sorted once and rendered once per view
+ */
+void renderqueue_begin_views(const v2d_t* camera_position, const rect_t* viewport, int count)
+{
+    view_count = clip(count, 1, RENDERQUEUE_MAX_VIEWS);
+
+    for(int i = 0; i < view_count; i++) {
+        view[i].camera = camera_position[i];
+        view[i].viewport = viewport[i];
+        view[i].area = rect_new(
+            (int)camera_position[i].x - viewport[i].width / 2,
+            (int)camera_position[i].y - viewport[i].height / 2,
+            viewport[i].width,
+            viewport[i].height
+        );
+    }
+
     buffer_size = 0;
+    occluder_count = 0;
 }
 
 /*
@@ -549,19 +786,47 @@ void renderqueue_begin(v2d_t camera_position)
 void renderqueue_end()
 {
     int batch_count = 0;
+    int dirty_count = 0;
 
     /* skip if the buffer is empty */
-    if(buffer_size == 0)
+    if(buffer_size == 0) {
+        retained_size = 0;
         return;
+    }
+
+    PROFILER_BEGIN("renderqueue_end");
+
+    /* compute the remaining sorting keys, possibly in parallel */
+    double sort_start = want_profiler ? al_get_time() : 0.0;
+    record_entries();
+
+    /* skip the entries that are hidden behind opaque bricks */
+    int occluded_count = cull_occluded_entries();
+    if(buffer_size == 0) {
+        retained_size = 0;
+        occluder_count = 0;
+        PROFILER_END();
+        return;
+    }
 
     /* quickly sort the buffer (stable sorting) */
-    merge_sort(sorted_buffer, buffer_size, sizeof(*sorted_buffer), cmp_fun);
+    dirty_count = sort_entries();
+
+    /* update the high-water marks */
+    if(buffer_size > stats.high_water_mark)
+        stats.high_water_mark = buffer_size;
+    if(dirty_count > stats.max_sorted_entries)
+        stats.max_sorted_entries = dirty_count;
 
     /* start reporting */
     REPORT_BEGIN();
     REPORT("Batching stats");
     REPORT("--------------");
     REPORT("Depth test: % 3s", use_depth_buffer ? "yes" : "no");
+    REPORT("Early-Z   : % 3s", use_early_z ? "yes" : "no");
+    REPORT("Re-sorted : %3d", dirty_count);
+    REPORT("Occluded  : %3d", occluded_count);
+    REPORT("Capacity  : %3d", stats.capacity);
 
     /* clear the screen */
     al_clear_to_color(al_map_rgb_f(0.0f, 0.0f, 0.0f));
@@ -595,9 +860,9 @@ void renderqueue_end()
         for(int i = 0; i < buffer_size; i++)
             sorted_buffer[i]->zorder = i;
 
-        /* sort by source image for batching
-           no need of stable sorting here */
-        qsort(sorted_buffer, buffer_size, sizeof(*sorted_buffer), cmp_zbuf_fun);
+        /* sort by source image for batching, or front-to-back
+           for early depth testing. No need of stable sorting here */
+        qsort(sorted_buffer, buffer_size, sizeof(*sorted_buffer), use_early_z ? cmp_earlyz_fun : cmp_zbuf_fun);
 
         /* after sorting, partition the buffer into opaque and translucent objects */
         for(int i = buffer_size - 1; i >= 0; i--) {
@@ -624,58 +889,93 @@ void renderqueue_end()
 
     }
 
-    /* render the entries */
-    bool held = false;
-    for(int j = 0; j < buffer_size; j++) {
+    /* profile the sorting */
+    double sort_time = want_profiler ? al_get_time() - sort_start : 0.0;
 
-        int curr = sorted_buffer[j]->group_index;
-        int prev = sorted_buffer[(j + (buffer_size - 1)) % buffer_size]->group_index;
+    /* render the entries once per view. The sorting keys, the groups and
+       the bounding boxes are computed once and shared by all views */
+    for(int v = 0; v < view_count; v++) {
+        texturehandle_t bound_texture = NO_TEXTURE;
+        v2d_t camera = begin_view(v);
 
-        /* enable deferred drawing */
-        if(curr > prev) {
-            held = true;
-            image_hold_drawing(true);
-        }
+        /* depth writes were disabled for the translucent entries of the previous view */
+        if(use_depth_buffer)
+            al_set_render_state(ALLEGRO_WRITE_MASK, ALLEGRO_MASK_DEPTH | ALLEGRO_MASK_RGBA);
+
+        /* render the entries */
+        bool held = false;
+        for(int j = 0; j < buffer_size; j++) {
 
-        /* reporting */
-        if(curr >= prev) {
-            ++batch_count;
-            if(want_report) {
-                char c = (curr == prev) ? '+' : ' '; /* curr == prev only if group_index == 1 */
-                sorted_buffer[j]->vtable->path(sorted_buffer[j]->renderable, entry_path, sizeof(entry_path));
-                REPORT("Batch size:%c%3d %s", c, sorted_buffer[j]->group_index, entry_path);
+            int curr = sorted_buffer[j]->group_index;
+            int prev = sorted_buffer[(j + (buffer_size - 1)) % buffer_size]->group_index;
+
+            /* GPU timing. Deferred groups are drawn at once, so we mark between groups */
+            if(want_profiler && !held)
+                gputimer_mark(GPU_PHASE[sorted_buffer[j]->vtable - VTABLE]);
+
+            /* enable deferred drawing */
+            if(curr > prev) {
+                held = true;
+                image_hold_drawing(true);
             }
-        }
 
-        /* set the z-coordinate */
-        if(use_depth_buffer) {
-            /* we've rendered all opaque objects. Now we're going to render
-               the translucent ones. Let's disable depth writes and render
-               back-to-front. */
-            if(j == translucent_start)
-                al_set_render_state(ALLEGRO_WRITE_MASK, ALLEGRO_MASK_RGBA);
+            /* reporting */
+            if(curr >= prev && v == 0) {
+                ++batch_count;
+                if(want_report) {
+                    char c = (curr == prev) ? '+' : ' '; /* curr == prev only if group_index == 1 */
+                    sorted_buffer[j]->vtable->path(sorted_buffer[j]->renderable, entry_path, sizeof(entry_path));
+                    REPORT("Batch size:%c%3d %s", c, sorted_buffer[j]->group_index, entry_path);
+                }
+            }
 
-            /* set z to a value in [0,1] according to the z-order of the entry */
-            float z = 1.0f - (float)sorted_buffer[j]->zorder / (float)(buffer_size - 1);
+            /* set the z-coordinate */
+            if(use_depth_buffer) {
+                /* we've rendered all opaque objects. Now we're going to render
+                   the translucent ones. Let's disable depth writes and render
+                   back-to-front. */
+                if(j == translucent_start)
+                    al_set_render_state(ALLEGRO_WRITE_MASK, ALLEGRO_MASK_RGBA);
 
-            /* map z from [0,1] to [-1,1], the range of the default
-               orthographic projection set by Allegro */
-            z = 2.0f * z - 1.0f;
+                /* set z to a value in [0,1] according to the z-order of the entry */
+                float z = 1.0f - (float)sorted_buffer[j]->zorder / (float)(buffer_size - 1);
 
-            /* change the transform */
-            ztransform.m[3][2] = z;
-            al_use_transform(&ztransform);
-        }
+                /* map z from [0,1] to [-1,1], the range of the default
+                   orthographic projection set by Allegro */
+                z = 2.0f * z - 1.0f;
 
-        /* render the j-th entry */
-        sorted_buffer[j]->vtable->render(sorted_buffer[j]->renderable, camera);
+                /* change the transform */
+                ztransform.m[3][2] = z;
+                al_use_transform(&ztransform);
+            }
+
+            /* render the j-th entry, unless it's outside of the view. We keep
+               track of the deferred groups even if we skip the rendering */
+            bool is_rendered = is_visible(sorted_buffer[j], v);
+            double start_time = want_profiler ? al_get_time() : 0.0;
+            if(is_rendered)
+                sorted_buffer[j]->vtable->render(sorted_buffer[j]->renderable, camera);
+
+            /* disable deferred drawing */
+            if(held && sorted_buffer[j]->group_index == 1) {
+                image_hold_drawing(false);
+                held = false;
+            }
+
+            /* profiling */
+            if(want_profiler && is_rendered) {
+                texturehandle_t texture = sorted_buffer[j]->cached.texture;
+                bool is_batch = (curr > prev); /* a deferred group of at least 2 entries */
+                bool is_texture_switch = (texture != NO_TEXTURE && texture != bound_texture);
+                bool is_draw_call = (sorted_buffer[j]->group_index == 1); /* deferred groups are flushed at once */
+
+                bound_texture = texture; /* NO_TEXTURE: we don't know what has been bound */
+                profile_entry(sorted_buffer[j], al_get_time() - start_time, is_batch, is_texture_switch, is_draw_call);
+            }
 
-        /* disable deferred drawing */
-        if(held && sorted_buffer[j]->group_index == 1) {
-            image_hold_drawing(false);
-            held = false;
         }
 
+        end_view(v);
     }
 
     if(use_depth_buffer) {
@@ -692,9 +992,26 @@ void renderqueue_end()
 #else
 
     /* render the entries without deferred drawing */
-    for(int j = 0; j < buffer_size; j++) {
-        sorted_buffer[j]->vtable->render(sorted_buffer[j]->renderable, camera);
-        ++batch_count; /* will be equal to buffer_size */
+    double sort_time = want_profiler ? al_get_time() - sort_start : 0.0;
+    for(int v = 0; v < view_count; v++) {
+        v2d_t camera = begin_view(v);
+
+        for(int j = 0; j < buffer_size; j++) {
+            if(!is_visible(sorted_buffer[j], v))
+                continue;
+
+            if(want_profiler)
+                gputimer_mark(GPU_PHASE[sorted_buffer[j]->vtable - VTABLE]);
+
+            double start_time = want_profiler ? al_get_time() : 0.0;
+            sorted_buffer[j]->vtable->render(sorted_buffer[j]->renderable, camera);
+            batch_count += (v == 0) ? 1 : 0; /* will be equal to buffer_size in a single view */
+
+            if(want_profiler)
+                profile_entry(sorted_buffer[j], al_get_time() - start_time, false, sorted_buffer[j]->cached.texture != NO_TEXTURE, true);
+        }
+
+        end_view(v);
     }
 
     REPORT("No batching!");
@@ -708,12 +1025,21 @@ void renderqueue_end()
     REPORT("Batches   : %3d %.2f", batch_count, 100.0f * savings);
     REPORT_END();
 
+    /* end of profiling */
+    if(want_profiler) {
+        gputimer_mark(GPUPHASE_OTHER);
+        profile_frame(sort_time);
+    }
+
     /* go back to the default shader */
     if(internal_shader != NULL)
         shader_set_active(shader_get_default());
 
     /* clean up */
     buffer_size = 0;
+    occluder_count = 0;
+
+    PROFILER_END();
 }
 
 
@@ -813,6 +1139,21 @@ void renderqueue_enqueue_brick_path(brick_t *brick)
     enqueue(&entry);
 }
 
+/*
+ * renderqueue_enqueue_brick_group()
+ * Enqueues a group of a brick batch
+ */
+void renderqueue_enqueue_brick_group(const brickgroup_t* group)
+{
+    renderqueue_entry_t entry = {
+        .renderable.brickgroup = group,
+        .vtable = &VTABLE[TYPE_BRICK_BATCH]
+    };
+
+    /* enqueue */
+    enqueue(&entry);
+}
+
 
 
 /*
@@ -983,11 +1324,30 @@ void renderqueue_enqueue_water()
     };
 
     /* clip out */
-    int y = level_waterlevel() - ((int)camera.y - VIDEO_SCREEN_H / 2);
-    if(y >= VIDEO_SCREEN_H)
-        return;
+    for(int i = 0; i < view_count; i++) {
+        if(waterfx_is_visible(view[i].camera)) {
+            enqueue(&entry);
+            return;
+        }
+    }
+}
 
-    enqueue(&entry);
+/*
+ * renderqueue_add_occluder()
+ * Adds an opaque brick to the occlusion culling of the current frame.
+ * Bricks and SurgeScript objects that are entirely hidden behind opaque
+ * bricks of a greater z-index are not rendered. The occluder is not
+ * rendered by this call; enqueue it as usual
+ */
+void renderqueue_add_occluder(const brick_t* brick)
+{
+    /* grow the buffer if necessary */
+    if(occluder_count == occluder_capacity) {
+        occluder_capacity = max(64, 2 * occluder_capacity);
+        occluder = reallocx(occluder, occluder_capacity * sizeof(*occluder));
+    }
+
+    occluder[occluder_count++] = brick;
 }
 
 
@@ -1016,6 +1376,154 @@ bool renderqueue_toggle_stats_report()
     return true;
 }
 
+/*
+ * renderqueue_toggle_profiler()
+ * Enable/disable the profiler for development purposes
+ */
+bool renderqueue_toggle_profiler()
+{
+    /* error: uninitialized render queue */
+    if(buffer == NULL) {
+        LOG("Can't toggle the profiler");
+        return false;
+    }
+
+    /* toggle */
+    want_profiler = !want_profiler;
+    LOG("Profiler is %s", want_profiler ? "enabled" : "disabled");
+
+    /* clear data */
+    reset_profiler();
+    gputimer_set_enabled(want_profiler);
+
+    /* success */
+    return true;
+}
+
+/*
+ * renderqueue_is_profiler_enabled()
+ * Is the profiler enabled?
+ */
+bool renderqueue_is_profiler_enabled()
+{
+    return want_profiler;
+}
+
+/*
+ * renderqueue_profile()
+ * Gets the profiling data of the render queue, averaged over the last frames.
+ * Renderables of each type are grouped together. This function returns the
+ * number of types; type_count + 1 entries are written to *profile. The last
+ * one is the sum of all types plus the time spent sorting.
+ */
+int renderqueue_profile(const renderqueue_profile_t** profile)
+{
+    *profile = profiler_avg;
+    return TYPE_COUNT;
+}
+
+/*
+ * renderqueue_stats()
+ * Memory usage of the render queue since it was initialized. If the number of
+ * reallocations doesn't change from a frame to the next, then no heap memory
+ * was allocated by the render queue in that frame
+ */
+const renderqueue_stats_t* renderqueue_stats()
+{
+    return &stats;
+}
+
+
+
+#if defined(WANT_BENCHMARKS)
+
+/* synthetic entries for the microbenchmarks */
+struct renderqueue_benchmark_t {
+    int count;
+    renderqueue_entry_t* entry;
+    renderqueue_entry_t** unsorted; /* the order of submission */
+    renderqueue_entry_t** sorted;
+    renderqueue_entry_t** scratch;
+};
+
+/*
+ * renderqueue_benchmark_create()
+ * Creates synthetic entries with sorting keys distributed like those of a
+ * level: mostly bricks and objects at the default z-index, a few players,
+ * and backgrounds & foregrounds at the extremes
+ */
+renderqueue_benchmark_t* renderqueue_benchmark_create(int entry_count)
+{
+    renderqueue_benchmark_t* benchmark = mallocx(sizeof *benchmark);
+    int n = max(entry_count, 1);
+
+    benchmark->count = n;
+    benchmark->entry = mallocx(n * sizeof(*(benchmark->entry)));
+    benchmark->unsorted = mallocx(n * sizeof(*(benchmark->unsorted)));
+    benchmark->sorted = mallocx(n * sizeof(*(benchmark->sorted)));
+    benchmark->scratch = mallocx(n * sizeof(*(benchmark->scratch)));
+
+    for(int i = 0; i < n; i++) {
+        renderqueue_entry_t* entry = &(benchmark->entry[i]);
+        int r = random(100);
+
+        memset(entry, 0, sizeof(*entry));
+        entry->cached.ypos = random(4096);
+
+        if(r < 60) {
+            entry->cached.type = TYPE_BRICK;
+            entry->cached.zindex = 0.5f - ZINDEX_OFFSET(random(3) * 10); /* background, default & foreground bricks */
+        }
+        else if(r < 95) {
+            entry->cached.type = TYPE_SSOBJECT;
+            entry->cached.zindex = (random(4) == 0) ? 0.5f + 0.01f * random(50) : 0.5f;
+        }
+        else if(r < 96) {
+            entry->cached.type = TYPE_PLAYER;
+            entry->cached.zindex = 0.5f;
+        }
+        else if(r < 98) {
+            entry->cached.type = TYPE_BACKGROUND;
+            entry->cached.zindex = 0.0f;
+        }
+        else {
+            entry->cached.type = TYPE_FOREGROUND;
+            entry->cached.zindex = 1.0f;
+        }
+
+        benchmark->unsorted[i] = entry;
+    }
+
+    return benchmark;
+}
+
+/*
+ * renderqueue_benchmark_destroy()
+ * Destroys the synthetic entries
+ */
+renderqueue_benchmark_t* renderqueue_benchmark_destroy(renderqueue_benchmark_t* benchmark)
+{
+    free(benchmark->scratch);
+    free(benchmark->sorted);
+    free(benchmark->unsorted);
+    free(benchmark->entry);
+    free(benchmark);
+
+    return NULL;
+}
+
+/*
+ * renderqueue_benchmark_sort()
+ * Sorts the synthetic entries, in the order of submission, with cmp_fun()
+ */
+void renderqueue_benchmark_sort(renderqueue_benchmark_t* benchmark)
+{
+    memcpy(benchmark->sorted, benchmark->unsorted, benchmark->count * sizeof(*(benchmark->sorted)));
+    merge_sort_with_buffer(benchmark->sorted, benchmark->count, sizeof(*(benchmark->sorted)), cmp_fun, benchmark->scratch);
+}
+
+#endif
+
 
 
 /* ----- private utilities ----- */
@@ -1024,30 +1532,399 @@ bool renderqueue_toggle_stats_report()
 void enqueue(const renderqueue_entry_t* entry)
 {
     /* grow the buffer if necessary */
-    if(buffer_size == buffer_capacity) {
-        buffer_capacity *= 2;
-        buffer = reallocx(buffer, buffer_capacity * sizeof(*buffer));
-        sorted_buffer = reallocx(sorted_buffer, buffer_capacity * sizeof(*sorted_buffer));
-        sorted_indices = reallocx(sorted_indices, buffer_capacity * sizeof(*sorted_indices));
-
-        /* sorted_buffer[] is invalidated because we have realloc'd buffer[] */
-        for(int i = 0; i < buffer_size; i++)
-            sorted_buffer[i] = &buffer[sorted_indices[i]];
-    }
+    if(buffer_size == buffer_capacity)
+        allocate_buffers(2 * buffer_capacity);
 
-    /* add the entry to the buffer */
+    /* add the entry to the buffer
+       sorted_buffer[] will be filled when sorting */
     renderqueue_entry_t* e = &buffer[buffer_size];
     memcpy(e, entry, sizeof(*entry));
-    sorted_buffer[buffer_size] = e;
-    sorted_indices[buffer_size] = buffer_size;
     buffer_size++;
 
-    /* cache the values of the new entry for purposes of comparison to other entries */
+    /* cache the values of the new entry for purposes of comparison to other
+       entries. Reentrant entries are recorded later, possibly in parallel */
+    if(!e->vtable->is_reentrant)
+        record_entry(e);
+}
+
+/* caches the sorting keys of an entry */
+void record_entry(renderqueue_entry_t* e)
+{
     e->cached.zindex = e->vtable->zindex(e->renderable);
     e->cached.type = e->vtable->type(e->renderable);
     e->cached.ypos = e->vtable->ypos(e->renderable);
     e->cached.texture = e->vtable->texture(e->renderable);
     e->cached.is_translucent = e->vtable->is_translucent(e->renderable);
+
+    /* the bounding boxes are only needed to cull multiple views */
+    e->cached.is_bounded = (view_count > 1) && (e->vtable->bounds != NULL) && e->vtable->bounds(e->renderable, &e->cached.bounds);
+}
+
+/* sets up the rendering of a view: the target is clipped to the viewport.
+   Returns the position of the camera that maps the view to its viewport */
+v2d_t begin_view(int view_index)
+{
+    const renderqueue_view_t* v = &view[view_index];
+    v2d_t screen_center = v2d_multiply(video_get_screen_size(), 0.5f);
+    v2d_t viewport_center = v2d_new(v->viewport.x + v->viewport.width / 2, v->viewport.y + v->viewport.height / 2);
+
+    if(view_count > 1)
+        al_set_clipping_rectangle(v->viewport.x, v->viewport.y, v->viewport.width, v->viewport.height);
+
+    return v2d_subtract(v->camera, v2d_subtract(viewport_center, screen_center));
+}
+
+/* finishes the rendering of a view */
+void end_view(int view_index)
+{
+    if(view_count > 1)
+        al_reset_clipping_rectangle();
+
+    (void)view_index;
+}
+
+/* checks if an entry may be seen through a view */
+bool is_visible(const renderqueue_entry_t* entry, int view_index)
+{
+    if(!entry->cached.is_bounded)
+        return true;
+
+    return rect_overlaps(entry->cached.bounds, view[view_index].area);
+}
+
+/* caches the sorting keys of the reentrant entries of buffer[begin .. end-1] */
+void record_range(int begin, int end, void* context)
+{
+    for(int i = begin; i < end; i++) {
+        if(buffer[i].vtable->is_reentrant)
+            record_entry(&buffer[i]);
+    }
+
+    (void)context;
+}
+
+/* caches the sorting keys of all reentrant entries. Non-reentrant entries
+   (SurgeScript objects, players...) have been recorded by enqueue(). The
+   render callbacks issue Allegro calls and run SurgeScript code, so they
+   are submitted by the main thread only */
+void record_entries()
+{
+    jobs_parallel_for(buffer_size, MIN_ENTRIES_PER_WORKER, record_range, NULL);
+}
+
+/*
+
+OPTIMIZATION: OCCLUSION CULLING
+
+The opaque bricks of the frame are rasterized into a coarse coverage grid
+that spans the views. Each cell stores the greatest z-index of the bricks
+that cover it entirely, so a cell is never marked as covered if a brick
+only covers part of it. An occludable entry whose bounding box lies on
+cells whose coverage is greater than its own z-index can't be seen, and
+is removed from the queue before sorting. The parts of a bounding box
+that lie outside of the views can't be seen either.
+
+This is conservative: entries of equal z-index, entries without bounds
+(e.g., detached entities) and entries that lie entirely outside of the
+views are kept.
+
+*/
+
+/* removes the hidden entries from buffer[]. Returns the number of removed entries */
+int cull_occluded_entries()
+{
+    if(occluder_count == 0)
+        return 0;
+
+    /* the region seen through the views, aligned to the grid */
+    int left = view[0].area.x, top = view[0].area.y;
+    int right = left + view[0].area.width, bottom = top + view[0].area.height;
+    for(int v = 1; v < view_count; v++) {
+        left = min(left, view[v].area.x);
+        top = min(top, view[v].area.y);
+        right = max(right, view[v].area.x + view[v].area.width);
+        bottom = max(bottom, view[v].area.y + view[v].area.height);
+    }
+
+    left = (int)floorf((float)left / OCCLUSION_CELL_SIZE) * OCCLUSION_CELL_SIZE;
+    top = (int)floorf((float)top / OCCLUSION_CELL_SIZE) * OCCLUSION_CELL_SIZE;
+    int columns = (right - left + OCCLUSION_CELL_SIZE - 1) / OCCLUSION_CELL_SIZE;
+    int rows = (bottom - top + OCCLUSION_CELL_SIZE - 1) / OCCLUSION_CELL_SIZE;
+    if(columns <= 0 || rows <= 0 || columns * rows > MAX_OCCLUSION_CELLS)
+        return 0;
+
+    /* rasterize the occluders. We only mark the cells that lie entirely inside a brick */
+    float* coverage = arena_alloc(engine_frame_arena(), columns * rows * sizeof(float));
+    for(int k = 0; k < columns * rows; k++)
+        coverage[k] = -INFINITY;
+
+    for(int i = 0; i < occluder_count; i++) {
+        const brick_t* brick = occluder[i];
+        v2d_t position = brick_position(brick);
+        v2d_t size = brick_size(brick);
+        float zindex = brick_zindex(brick) + brick_zindex_offset(brick);
+
+        int x = (int)position.x - left, y = (int)position.y - top;
+        int first_column = max(0, (x + OCCLUSION_CELL_SIZE - 1) / OCCLUSION_CELL_SIZE);
+        int first_row = max(0, (y + OCCLUSION_CELL_SIZE - 1) / OCCLUSION_CELL_SIZE);
+        int end_column = min(columns, (int)floorf((float)(x + (int)size.x) / OCCLUSION_CELL_SIZE));
+        int end_row = min(rows, (int)floorf((float)(y + (int)size.y) / OCCLUSION_CELL_SIZE));
+
+        for(int r = first_row; r < end_row; r++) {
+            for(int c = first_column; c < end_column; c++) {
+                if(zindex > coverage[r * columns + c])
+                    coverage[r * columns + c] = zindex;
+            }
+        }
+    }
+
+    /* remove the hidden entries, preserving the order of the others */
+    int n = 0;
+    for(int i = 0; i < buffer_size; i++) {
+        if(!is_occluded(&buffer[i], coverage, left, top, columns, rows)) {
+            if(n != i)
+                buffer[n] = buffer[i];
+            n++;
+        }
+    }
+
+    int occluded_count = buffer_size - n;
+    buffer_size = n;
+    return occluded_count;
+}
+
+/* checks if an entry is hidden by the coverage grid */
+bool is_occluded(const renderqueue_entry_t* entry, const float* coverage, int left, int top, int columns, int rows)
+{
+    rect_t bounds;
+
+    if(!entry->vtable->is_occludable)
+        return false;
+
+    if(entry->cached.is_bounded)
+        bounds = entry->cached.bounds;
+    else if(entry->vtable->bounds == NULL || !entry->vtable->bounds(entry->renderable, &bounds))
+        return false;
+
+    /* the cells overlapped by the bounding box, clipped to the grid */
+    int x = bounds.x - left, y = bounds.y - top;
+    int first_column = max(0, (int)floorf((float)x / OCCLUSION_CELL_SIZE));
+    int first_row = max(0, (int)floorf((float)y / OCCLUSION_CELL_SIZE));
+    int end_column = min(columns, (int)floorf((float)(x + bounds.width - 1) / OCCLUSION_CELL_SIZE) + 1);
+    int end_row = min(rows, (int)floorf((float)(y + bounds.height - 1) / OCCLUSION_CELL_SIZE) + 1);
+
+    /* the entry is outside of the views */
+    if(first_column >= end_column || first_row >= end_row)
+        return false;
+
+    /* the entry is hidden only if all of its cells are covered by something in front of it */
+    float zindex = entry->cached.zindex;
+    for(int r = first_row; r < end_row; r++) {
+        for(int c = first_column; c < end_column; c++) {
+            if(!(coverage[r * columns + c] > zindex))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/* (re)allocates the internal buffers, preserving buffer[] and retained[] */
+void allocate_buffers(int capacity)
+{
+    buffer_capacity = capacity;
+    buffer = reallocx(buffer, buffer_capacity * sizeof(*buffer));
+    sorted_buffer = reallocx(sorted_buffer, buffer_capacity * sizeof(*sorted_buffer));
+    clean_buffer = reallocx(clean_buffer, buffer_capacity * sizeof(*clean_buffer));
+    dirty_buffer = reallocx(dirty_buffer, buffer_capacity * sizeof(*dirty_buffer));
+    scratch_buffer = reallocx(scratch_buffer, buffer_capacity * sizeof(*scratch_buffer));
+    retained = reallocx(retained, buffer_capacity * sizeof(*retained));
+
+    /* the load factor of the index is at most 1/2, since
+       retained_size <= buffer_capacity, a power of 2 */
+    retained_index_mask = 2 * buffer_capacity - 1;
+    free(retained_index);
+    retained_index = mallocx((retained_index_mask + 1) * sizeof(*retained_index));
+
+    /* rebuild the index */
+    retain_entries();
+
+    /* update the stats */
+    if(stats.capacity > 0) {
+        stats.reallocations++;
+        LOG("growing to %d entries", buffer_capacity);
+    }
+
+    stats.capacity = buffer_capacity;
+    stats.bytes = buffer_capacity * (
+        sizeof(*buffer) + sizeof(*sorted_buffer) +
+        sizeof(*clean_buffer) + sizeof(*dirty_buffer) +
+        sizeof(*scratch_buffer) + sizeof(*retained) +
+        2 * sizeof(*retained_index)
+    );
+}
+
+/* releases the internal buffers */
+void release_buffers()
+{
+    free(retained_index);
+    retained_index = NULL;
+    retained_index_mask = 0;
+
+    free(retained);
+    retained = NULL;
+    retained_size = 0;
+
+    free(scratch_buffer);
+    scratch_buffer = NULL;
+
+    free(dirty_buffer);
+    dirty_buffer = NULL;
+
+    free(clean_buffer);
+    clean_buffer = NULL;
+
+    free(sorted_buffer);
+    sorted_buffer = NULL;
+
+    free(buffer);
+    buffer = NULL;
+
+    buffer_capacity = 0;
+    buffer_size = 0;
+}
+
+/* fills sorted_buffer[] with the entries of buffer[], sorted with cmp_fun().
+   Returns the number of entries that had to be sorted */
+int sort_entries()
+{
+#if USE_RETAINED_ORDER
+
+    int clean_count = 0, dirty_count = 0;
+    int n = 0, a = 0, b = 0;
+
+    /* classify the entries. clean_buffer[k] will store the
+       clean entry at position k of the previous frame, if any */
+    for(int k = 0; k < retained_size; k++)
+        clean_buffer[k] = NULL;
+
+    for(int i = 0; i < buffer_size; i++) {
+        renderqueue_entry_t* e = &buffer[i];
+        int k = find_retained(e);
+
+        if(
+            k >= 0 && clean_buffer[k] == NULL && /* retained & not enqueued twice */
+            retained[k].zindex == e->cached.zindex &&
+            retained[k].type == e->cached.type &&
+            retained[k].ypos == e->cached.ypos
+        )
+            clean_buffer[k] = e;
+        else
+            dirty_buffer[dirty_count++] = e;
+    }
+
+    /* the clean entries are already sorted relative to each other */
+    for(int k = 0; k < retained_size; k++) {
+        if(clean_buffer[k] != NULL)
+            clean_buffer[clean_count++] = clean_buffer[k];
+    }
+
+    /* sort the dirty entries only (stable sorting) */
+    merge_sort_with_buffer(dirty_buffer, dirty_count, sizeof(*dirty_buffer), cmp_fun, scratch_buffer);
+
+    /* merge the clean and the dirty entries */
+    while(a < clean_count && b < dirty_count) {
+        if(cmp_fun(&dirty_buffer[b], &clean_buffer[a]) < 0)
+            sorted_buffer[n++] = dirty_buffer[b++];
+        else
+            sorted_buffer[n++] = clean_buffer[a++];
+    }
+
+    while(a < clean_count)
+        sorted_buffer[n++] = clean_buffer[a++];
+
+    while(b < dirty_count)
+        sorted_buffer[n++] = dirty_buffer[b++];
+
+    /* remember the sorted order for the next frame */
+    retained_size = buffer_size;
+    for(int j = 0; j < buffer_size; j++) {
+        const renderqueue_entry_t* e = sorted_buffer[j];
+        renderqueue_retained_t* r = &retained[j];
+
+        r->renderable = e->renderable;
+        r->vtable = e->vtable;
+        r->zindex = e->cached.zindex;
+        r->type = e->cached.type;
+        r->ypos = e->cached.ypos;
+    }
+
+    retain_entries();
+
+    /* done */
+    return dirty_count;
+
+#else
+
+    /* sort everything, every frame */
+    for(int i = 0; i < buffer_size; i++)
+        sorted_buffer[i] = &buffer[i];
+
+    merge_sort_with_buffer(sorted_buffer, buffer_size, sizeof(*sorted_buffer), cmp_fun, scratch_buffer);
+    (void)retain_entries;
+    (void)find_retained;
+
+    return buffer_size;
+
+#endif
+}
+
+/* rebuilds the index of the retained entries */
+void retain_entries()
+{
+    memset(retained_index, 0, (retained_index_mask + 1) * sizeof(*retained_index));
+
+    for(int j = 0; j < retained_size; j++) {
+        uint32_t k = hash_renderable(retained[j].renderable, retained[j].vtable) & retained_index_mask;
+
+        /* linear probing */
+        while(retained_index[k] != 0)
+            k = (k + 1) & retained_index_mask;
+
+        retained_index[k] = 1 + j;
+    }
+}
+
+/* finds the position of an entry in retained[], or -1 if it's not there */
+int find_retained(const renderqueue_entry_t* entry)
+{
+    uint32_t k = hash_renderable(entry->renderable, entry->vtable) & retained_index_mask;
+
+    while(retained_index[k] != 0) {
+        int j = retained_index[k] - 1;
+
+        if(retained[j].renderable.dummy == entry->renderable.dummy && retained[j].vtable == entry->vtable)
+            return j;
+
+        k = (k + 1) & retained_index_mask;
+    }
+
+    return -1;
+}
+
+/* hashes a renderable and its vtable */
+uint32_t hash_renderable(renderable_t renderable, const renderable_vtable_t* vtable)
+{
+    uint64_t x = (uint64_t)(uintptr_t)renderable.dummy ^ ((uint64_t)(vtable - VTABLE) << 56);
+
+    /* a finalizer of MurmurHash3 */
+    x ^= x >> 33;
+    x *= UINT64_C(0xff51afd7ed558ccd);
+    x ^= x >> 33;
+    x *= UINT64_C(0xc4ceb9fe1a85ec53);
+    x ^= x >> 33;
+
+    return (uint32_t)x;
 }
 
 /* compares two entries of the render queue */
@@ -1120,6 +1997,93 @@ int cmp_zbuf_fun(const void* i, const void* j)
         return dz; /* back-to-front */
 }
 
+/* sort the render queue for a front-to-back opaque pass and a back-to-front translucent pass */
+int cmp_earlyz_fun(const void* i, const void* j)
+{
+    const renderqueue_entry_t* a = *((const renderqueue_entry_t**)i);
+    const renderqueue_entry_t* b = *((const renderqueue_entry_t**)j);
+
+    /* put opaque objects first */
+    int la = (int)a->cached.is_translucent;
+    int lb = (int)b->cached.is_translucent;
+    if(la != lb)
+        return la - lb;
+
+    /* render the opaque objects front-to-back over the whole queue, so
+       that the depth test discards the occluded pixels as early as
+       possible. Entries that share a texture may still be batched if
+       they're adjacent. Render the translucent objects back-to-front. */
+    if(!la)
+        return b->zorder - a->zorder; /* front-to-back */
+    else
+        return a->zorder - b->zorder; /* back-to-front */
+}
+
+/* accumulate profiling data of an entry */
+void profile_entry(const renderqueue_entry_t* entry, double elapsed_time, bool is_batch, bool is_texture_switch, bool is_draw_call)
+{
+    renderqueue_profile_t* p = &profiler_sum[entry->vtable - VTABLE];
+
+    p->entries += 1.0f;
+    p->batches += is_batch ? 1.0f : 0.0f;
+    p->texture_switches += is_texture_switch ? 1.0f : 0.0f;
+    p->draw_calls += is_draw_call ? 1.0f : 0.0f;
+    p->microseconds += 1000000.0f * (float)elapsed_time;
+}
+
+/* finish profiling a frame; compute the averages every PROFILER_FRAMES frames */
+void profile_frame(double sort_time)
+{
+    profiler_sort_time += sort_time;
+
+    if(++profiler_frames < PROFILER_FRAMES)
+        return;
+
+    /* compute the totals */
+    renderqueue_profile_t* total = &profiler_sum[TYPE_COUNT];
+    *total = (renderqueue_profile_t){ .name = "total" };
+    for(int t = 0; t < TYPE_COUNT; t++) {
+        total->entries += profiler_sum[t].entries;
+        total->batches += profiler_sum[t].batches;
+        total->texture_switches += profiler_sum[t].texture_switches;
+        total->draw_calls += profiler_sum[t].draw_calls;
+        total->microseconds += profiler_sum[t].microseconds;
+    }
+    total->microseconds += 1000000.0f * (float)profiler_sort_time;
+
+    /* compute the averages */
+    for(int t = 0; t <= TYPE_COUNT; t++) {
+        profiler_avg[t] = (renderqueue_profile_t){
+            .name = profiler_sum[t].name,
+            .entries = profiler_sum[t].entries / PROFILER_FRAMES,
+            .batches = profiler_sum[t].batches / PROFILER_FRAMES,
+            .texture_switches = profiler_sum[t].texture_switches / PROFILER_FRAMES,
+            .draw_calls = profiler_sum[t].draw_calls / PROFILER_FRAMES,
+            .microseconds = profiler_sum[t].microseconds / PROFILER_FRAMES
+        };
+    }
+
+    /* start a new round */
+    for(int t = 0; t <= TYPE_COUNT; t++)
+        profiler_sum[t] = (renderqueue_profile_t){ .name = profiler_avg[t].name };
+    profiler_sort_time = 0.0;
+    profiler_frames = 0;
+}
+
+/* clear the profiling data */
+void reset_profiler()
+{
+    for(int t = 0; t < TYPE_COUNT; t++) {
+        profiler_sum[t] = (renderqueue_profile_t){ .name = TYPE_NAME[t] };
+        profiler_avg[t] = (renderqueue_profile_t){ .name = TYPE_NAME[t] };
+    }
+
+    profiler_sum[TYPE_COUNT] = (renderqueue_profile_t){ .name = "total" };
+    profiler_avg[TYPE_COUNT] = (renderqueue_profile_t){ .name = "total" };
+    profiler_sort_time = 0.0;
+    profiler_frames = 0;
+}
+
 /* compute a tiny zindex offset for a brick depending on its type, layer and behavior */
 float brick_zindex_offset(const brick_t *brick)
 {
@@ -1183,6 +2147,7 @@ int type_brick(renderable_t r) { return TYPE_BRICK; }
 int type_brick_mask(renderable_t r) { return TYPE_BRICK_MASK; }
 int type_brick_debug(renderable_t r) { return TYPE_BRICK_DEBUG; }
 int type_brick_path(renderable_t r) { return TYPE_BRICK_PATH; }
+int type_brick_batch(renderable_t r) { return TYPE_BRICK; } /* sort like individual bricks */
 int type_ssobject(renderable_t r) { return TYPE_SSOBJECT; }
 int type_ssobject_debug(renderable_t r) { return TYPE_SSOBJECT_DEBUG; }
 int type_ssobject_gizmo(renderable_t r) { return TYPE_SSOBJECT_GIZMO; }
@@ -1197,6 +2162,7 @@ float zindex_brick(renderable_t r) { return brick_zindex(r.brick) + brick_zindex
 float zindex_brick_mask(renderable_t r) { return ZINDEX_LARGE + brick_zindex_offset(r.brick); }
 float zindex_brick_debug(renderable_t r) { return zindex_brick(r); }
 float zindex_brick_path(renderable_t r) { return zindex_brick_mask(r) + 1.0f; }
+float zindex_brick_batch(renderable_t r) { return zindex_brick((renderable_t){ .brick = (brick_t*)brickgroup_representative(r.brickgroup) }); }
 float zindex_ssobject(renderable_t r) { return scripting_util_object_zindex(r.ssobject); }
 float zindex_ssobject_debug(renderable_t r) { return zindex_ssobject(r); } /* TODO: check children */
 float zindex_ssobject_gizmo(renderable_t r) { return ZINDEX_LARGE + zindex_ssobject(r); }
@@ -1211,6 +2177,7 @@ int ypos_brick(renderable_t r) { return brick_position(r.brick).y; }
 int ypos_brick_mask(renderable_t r) { return ypos_brick(r); }
 int ypos_brick_debug(renderable_t r) { return ypos_brick(r); }
 int ypos_brick_path(renderable_t r) { return ypos_brick(r); }
+int ypos_brick_batch(renderable_t r) { return brickgroup_ypos(r.brickgroup); }
 int ypos_ssobject(renderable_t r) { return 0; } /* TODO (not needed?) */
 int ypos_ssobject_debug(renderable_t r) { return ypos_ssobject(r); }
 int ypos_ssobject_gizmo(renderable_t r) { return ypos_ssobject(r); }
@@ -1225,6 +2192,7 @@ bool is_translucent_brick(renderable_t r) { return false; }
 bool is_translucent_brick_mask(renderable_t r) { return false; }
 bool is_translucent_brick_debug(renderable_t r) { return false; }
 bool is_translucent_brick_path(renderable_t r) { return false; }
+bool is_translucent_brick_batch(renderable_t r) { return false; }
 bool is_translucent_background(renderable_t r) { return false; }
 bool is_translucent_foreground(renderable_t r) { return false; }
 
@@ -1246,6 +2214,38 @@ bool is_translucent_ssobject(renderable_t r)
     return false;
 }
 
+bool bounds_brick(renderable_t r, rect_t* bounds)
+{
+    v2d_t position = brick_position(r.brick);
+    v2d_t size = brick_size(r.brick);
+
+    *bounds = rect_new((int)position.x, (int)position.y, (int)size.x, (int)size.y);
+    return true;
+}
+
+bool bounds_brick_mask(renderable_t r, rect_t* bounds) { return bounds_brick(r, bounds); }
+bool bounds_brick_debug(renderable_t r, rect_t* bounds) { return bounds_brick(r, bounds); }
+bool bounds_ssobject_debug(renderable_t r, rect_t* bounds) { return bounds_ssobject(r, bounds); }
+
+bool bounds_ssobject(renderable_t r, rect_t* bounds)
+{
+    /* detached entities are rendered in screen space */
+    if(scripting_util_is_effectively_detached_entity(r.ssobject))
+        return false;
+
+    /* the size of a SurgeScript renderable is unknown. We cull around
+       its position, just like the level culls the entities near the camera */
+    v2d_t position = scripting_util_world_position(r.ssobject);
+    *bounds = rect_new(
+        (int)position.x - SSOBJECT_CULLING_MARGIN,
+        (int)position.y - SSOBJECT_CULLING_MARGIN,
+        2 * SSOBJECT_CULLING_MARGIN,
+        2 * SSOBJECT_CULLING_MARGIN
+    );
+
+    return true;
+}
+
 const char* path_player(renderable_t r, char* dest, size_t dest_size) { return str_cpy(dest, image_filepath(actor_image(r.player->actor)), dest_size); }
 const char* path_item(renderable_t r, char* dest, size_t dest_size) { return str_cpy(dest, "<legacy-item>", dest_size); }
 const char* path_object(renderable_t r, char* dest, size_t dest_size) { return str_cpy(dest, "<legacy-object>", dest_size); }
@@ -1253,6 +2253,7 @@ const char* path_brick(renderable_t r, char* dest, size_t dest_size) { return st
 const char* path_brick_mask(renderable_t r, char* dest, size_t dest_size) { return str_cpy(dest, random_path('M'), dest_size); }
 const char* path_brick_debug(renderable_t r, char* dest, size_t dest_size) { return path_brick(r, dest, dest_size); }
 const char* path_brick_path(renderable_t r, char* dest, size_t dest_size) { return str_cpy(dest, random_path('P'), dest_size); }
+const char* path_brick_batch(renderable_t r, char* dest, size_t dest_size) { return str_cpy(dest, image_filepath(brick_image(brickgroup_representative(r.brickgroup))), dest_size); }
 const char* path_background(renderable_t r, char* dest, size_t dest_size) { return str_cpy(dest, "<background>", dest_size); }
 const char* path_foreground(renderable_t r, char* dest, size_t dest_size) { return str_cpy(dest, "<foreground>", dest_size); }
 const char* path_water(renderable_t r, char* dest, size_t dest_size) { return str_cpy(dest, "<water>", dest_size); }
@@ -1293,6 +2294,7 @@ texturehandle_t texture_item(renderable_t r) { return NO_TEXTURE; /* legacy TODO
 texturehandle_t texture_object(renderable_t r) { return NO_TEXTURE; /* legacy TODO: remove */ }
 texturehandle_t texture_brick_mask(renderable_t r) { return NO_TEXTURE; }
 texturehandle_t texture_brick_path(renderable_t r) { return NO_TEXTURE; }
+texturehandle_t texture_brick_batch(renderable_t r) { return NO_TEXTURE; } /* not a held bitmap drawing */
 texturehandle_t texture_ssobject_gizmo(renderable_t r) { return NO_TEXTURE; }
 texturehandle_t texture_background(renderable_t r) { return NO_TEXTURE; }
 texturehandle_t texture_foreground(renderable_t r) { return NO_TEXTURE; }
@@ -1377,6 +2379,11 @@ void render_brick_path(renderable_t r, v2d_t camera_position)
     brick_render_path(r.brick, camera_position);
 }
 
+void render_brick_batch(renderable_t r, v2d_t camera_position)
+{
+    brickgroup_render(r.brickgroup, camera_position);
+}
+
 void render_ssobject(renderable_t r, v2d_t camera_position)
 {
     surgescript_var_t* cam_x = surgescript_var_set_number(surgescript_var_create(), camera_position.x);
@@ -22,10 +22,13 @@
 #define _RENDERQUEUE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "../util/v2d.h"
+#include "../util/rect.h"
 
 /* forward declarations */
 struct brick_t;
+struct brickgroup_t;
 struct item_t;
 struct enemy_t;
 struct player_t;
@@ -33,18 +36,27 @@ struct bgtheme_t;
 struct surgescript_object_t;
 
 /* initialization & deinitialization */
-void renderqueue_init(bool want_depth_buffer);
+void renderqueue_init(bool want_depth_buffer, bool want_early_z);
 void renderqueue_release();
+void renderqueue_set_depth_mode(bool want_depth_buffer, bool want_early_z); /* may be called between frames */
 
 /* rendering */
 void renderqueue_begin(v2d_t camera_position);
 void renderqueue_end();
 
+/* multiple views (e.g., split-screen): the entities are enqueued and sorted
+   once, and then rendered once per view, culled and clipped to its viewport.
+   The viewports are given in screen space; the positions of the cameras of
+   the views are mapped to the center of the viewports */
+#define RENDERQUEUE_MAX_VIEWS 4
+void renderqueue_begin_views(const v2d_t* camera_position, const rect_t* viewport, int count);
+
 /* enqueues entities */
 void renderqueue_enqueue_brick(struct brick_t* brick);
 void renderqueue_enqueue_brick_mask(struct brick_t* brick);
 void renderqueue_enqueue_brick_debug(struct brick_t* brick);
 void renderqueue_enqueue_brick_path(struct brick_t* brick);
+void renderqueue_enqueue_brick_group(const struct brickgroup_t* group);
 void renderqueue_enqueue_item(struct item_t* item);
 void renderqueue_enqueue_object(struct enemy_t* object);
 void renderqueue_enqueue_player(struct player_t* player);
@@ -55,7 +67,47 @@ void renderqueue_enqueue_background(struct bgtheme_t* background);
 void renderqueue_enqueue_foreground(struct bgtheme_t* foreground);
 void renderqueue_enqueue_water();
 
+/* occlusion culling: entries hidden behind opaque bricks aren't rendered */
+void renderqueue_add_occluder(const struct brick_t* brick);
+
+/* profiling */
+typedef struct renderqueue_profile_t renderqueue_profile_t;
+struct renderqueue_profile_t {
+    const char* name; /* type of renderable */
+
+    /* averages per frame */
+    float entries; /* number of entries in the queue */
+    float batches; /* number of deferred groups (2+ entries rendered at once) */
+    float texture_switches; /* changes of the source texture */
+    float draw_calls; /* estimated number of draw calls */
+    float microseconds; /* CPU time */
+};
+
+bool renderqueue_toggle_profiler();
+bool renderqueue_is_profiler_enabled();
+int renderqueue_profile(const renderqueue_profile_t** profile); /* returns the number of types */
+
+/* memory */
+typedef struct renderqueue_stats_t renderqueue_stats_t;
+struct renderqueue_stats_t {
+    int capacity; /* number of entries that fit in the preallocated buffers */
+    int high_water_mark; /* maximum number of entries of a frame */
+    int max_sorted_entries; /* maximum number of entries that had to be sorted in a frame */
+    int reallocations; /* number of times the buffers have grown */
+    size_t bytes; /* size of the buffers */
+};
+
+const renderqueue_stats_t* renderqueue_stats(); /* since renderqueue_init() */
+
 /* misc */
 bool renderqueue_toggle_stats_report();
 
+/* microbenchmarks: sort synthetic entries with the comparator of the render queue */
+#if defined(WANT_BENCHMARKS)
+typedef struct renderqueue_benchmark_t renderqueue_benchmark_t;
+renderqueue_benchmark_t* renderqueue_benchmark_create(int entry_count);
+renderqueue_benchmark_t* renderqueue_benchmark_destroy(renderqueue_benchmark_t* benchmark);
+void renderqueue_benchmark_sort(renderqueue_benchmark_t* benchmark);
+#endif
+
 #endif
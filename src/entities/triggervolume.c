@@ -0,0 +1,371 @@
+/*
+ * Open Surge Engine
+ * triggervolume.c - trigger volumes with enter/exit events
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <limits.h>
+#include "triggervolume.h"
+#include "player.h"
+#include "../util/util.h"
+#include "../util/darray.h"
+#include "../util/rect.h"
+
+/* a trigger volume */
+typedef struct triggervolume_t triggervolume_t;
+struct triggervolume_t {
+    int id;
+    int x, y, width, height; /* in world space */
+    triggercallback_t callback;
+    void* context;
+    uint32_t inside; /* bit p is set if player p was inside the volume in the last update */
+    uint32_t next_inside; /* the same, computed in the current update */
+    uint32_t visit; /* stamp of the current update */
+};
+
+/* a pending enter/exit event */
+typedef struct triggerevent_t triggerevent_t;
+struct triggerevent_t {
+    int volume_id;
+    player_t* player;
+    bool entered;
+    triggercallback_t callback;
+    void* context;
+};
+
+#define MAX_PLAYERS 32 /* one bit per player */
+
+STATIC_DARRAY(triggervolume_t, volume);
+STATIC_DARRAY(int, occupied); /* indices of the volumes that have players inside */
+STATIC_DARRAY(int, touched); /* indices of the volumes tested in the current update */
+STATIC_DARRAY(triggerevent_t, event);
+static int next_volume_id = 1;
+static bool occupied_is_dirty = false; /* indices have changed */
+static uint32_t current_visit = 0;
+
+/* uniform grid; see waterfx.c */
+static struct {
+    bool is_dirty; /* the grid must be rebuilt */
+    int x, y; /* top-left corner, in world space */
+    int cols, rows;
+    int cell_shift; /* the size of a cell is 1 << cell_shift pixels */
+    int* cell_start; /* the volumes of cell k are cell_volume[cell_start[k] .. cell_start[k+1]-1] */
+    int* cell_volume; /* indices of volumes */
+    int cell_volume_capacity;
+} grid;
+
+#define MIN_CELL_SHIFT 8 /* cells of 256x256 pixels */
+#define MAX_CELLS 65536 /* cells are made larger if needed */
+static void rebuild_grid();
+static void release_grid();
+static inline int find_volume(int id);
+static inline void touch(int index);
+static inline bool overlaps(const triggervolume_t* v, rect_t box);
+
+
+
+/*
+ * triggervolume_init()
+ * Initializes the trigger volumes
+ */
+void triggervolume_init()
+{
+    darray_init(volume);
+    darray_init(occupied);
+    darray_init(touched);
+    darray_init(event);
+
+    memset(&grid, 0, sizeof(grid));
+    occupied_is_dirty = false;
+    current_visit = 0;
+}
+
+/*
+ * triggervolume_release()
+ * Releases the trigger volumes
+ */
+void triggervolume_release()
+{
+    release_grid();
+
+    darray_release(event);
+    darray_release(touched);
+    darray_release(occupied);
+    darray_release(volume);
+}
+
+/*
+ * triggervolume_update()
+ * Tests the players against the trigger volumes and invokes
+ * the callbacks of the volumes whose state has changed
+ */
+void triggervolume_update(player_t** players, int player_count)
+{
+    if(darray_length(volume) == 0)
+        return;
+
+    if(grid.is_dirty)
+        rebuild_grid();
+
+    if(occupied_is_dirty) {
+        darray_clear(occupied);
+        for(int i = 0; i < darray_length(volume); i++) {
+            if(volume[i].inside != 0)
+                darray_push(occupied, i);
+        }
+        occupied_is_dirty = false;
+    }
+
+    /* volumes that had players inside must be tested, so that we detect exits */
+    current_visit++;
+    darray_clear(touched);
+    for(int j = 0; j < darray_length(occupied); j++)
+        touch(occupied[j]);
+
+    /* test each player against the volumes of the cells it overlaps */
+    player_count = min(player_count, MAX_PLAYERS);
+    for(int p = 0; p < player_count; p++) {
+        rect_t box = player_bounding_box(players[p]);
+        int col1 = max(0, (box.x - grid.x) >> grid.cell_shift);
+        int row1 = max(0, (box.y - grid.y) >> grid.cell_shift);
+        int col2 = min(grid.cols - 1, (box.x + max(0, box.width - 1) - grid.x) >> grid.cell_shift);
+        int row2 = min(grid.rows - 1, (box.y + max(0, box.height - 1) - grid.y) >> grid.cell_shift);
+
+        for(int row = row1; row <= row2; row++) {
+            for(int col = col1; col <= col2; col++) {
+                int cell = row * grid.cols + col;
+                for(int j = grid.cell_start[cell]; j < grid.cell_start[cell + 1]; j++) {
+                    int i = grid.cell_volume[j];
+                    if(overlaps(&volume[i], box)) {
+                        touch(i);
+                        volume[i].next_inside |= UINT32_C(1) << p;
+                    }
+                }
+            }
+        }
+    }
+
+    /* collect the changes of state */
+    darray_clear(occupied);
+    darray_clear(event);
+    for(int j = 0; j < darray_length(touched); j++) {
+        triggervolume_t* v = &volume[touched[j]];
+        uint32_t changed = v->inside ^ v->next_inside;
+
+        for(int p = 0; changed != 0; p++, changed >>= 1) {
+            if((changed & 1) && p < player_count) {
+                triggerevent_t e = {
+                    .volume_id = v->id,
+                    .player = players[p],
+                    .entered = (v->next_inside & (UINT32_C(1) << p)) != 0,
+                    .callback = v->callback,
+                    .context = v->context
+                };
+                darray_push(event, e);
+            }
+        }
+
+        v->inside = v->next_inside;
+        if(v->inside != 0)
+            darray_push(occupied, touched[j]);
+    }
+
+    /* invoke the callbacks. A callback may add or remove volumes,
+       so we skip the events of the volumes that no longer exist */
+    for(int k = 0; k < darray_length(event); k++) {
+        triggerevent_t e = event[k];
+        if(e.callback != NULL && find_volume(e.volume_id) >= 0)
+            e.callback(e.volume_id, e.player, e.entered, e.context);
+    }
+}
+
+/*
+ * triggervolume_add()
+ * Adds a trigger volume, given in world space. The callback will be
+ * invoked whenever a player enters or exits the volume. Returns the
+ * ID of the volume
+ */
+int triggervolume_add(int x, int y, int width, int height, triggercallback_t callback, void* context)
+{
+    triggervolume_t v = {
+        .id = next_volume_id++,
+        .x = x, .y = y,
+        .width = max(0, width), .height = max(0, height),
+        .callback = callback,
+        .context = context,
+        .inside = 0,
+        .next_inside = 0,
+        .visit = 0
+    };
+
+    darray_push(volume, v);
+    grid.is_dirty = true;
+
+    return v.id;
+}
+
+/*
+ * triggervolume_remove()
+ * Removes a trigger volume. No exit events are generated.
+ * Returns false if there is no such volume
+ */
+bool triggervolume_remove(int volume_id)
+{
+    int index = find_volume(volume_id);
+
+    if(index < 0)
+        return false;
+
+    darray_remove(volume, index);
+    grid.is_dirty = true;
+    occupied_is_dirty = true;
+
+    return true;
+}
+
+/*
+ * triggervolume_clear()
+ * Removes all trigger volumes
+ */
+void triggervolume_clear()
+{
+    darray_clear(volume);
+    darray_clear(occupied);
+    grid.is_dirty = true;
+    occupied_is_dirty = false;
+}
+
+/*
+ * triggervolume_count()
+ * The number of trigger volumes
+ */
+int triggervolume_count()
+{
+    return darray_length(volume);
+}
+
+
+
+/* private */
+
+/* rebuilds the uniform grid that indexes the volumes */
+void rebuild_grid()
+{
+    int n = darray_length(volume);
+    int x1 = INT_MAX, y1 = INT_MAX, x2 = INT_MIN, y2 = INT_MIN;
+
+    grid.is_dirty = false;
+    grid.cols = grid.rows = 0;
+    if(n == 0)
+        return;
+
+    /* bounding box */
+    for(int i = 0; i < n; i++) {
+        x1 = min(x1, volume[i].x);
+        y1 = min(y1, volume[i].y);
+        x2 = max(x2, volume[i].x + volume[i].width);
+        y2 = max(y2, volume[i].y + volume[i].height);
+    }
+
+    /* size of the cells */
+    grid.x = x1;
+    grid.y = y1;
+    grid.cell_shift = MIN_CELL_SHIFT;
+    do {
+        grid.cols = ((x2 - x1) >> grid.cell_shift) + 1;
+        grid.rows = ((y2 - y1) >> grid.cell_shift) + 1;
+    } while((int64_t)grid.cols * grid.rows > MAX_CELLS && ++grid.cell_shift < 30);
+
+    /* count the volumes of each cell */
+    int cell_count = grid.cols * grid.rows;
+    int total = 0;
+
+    grid.cell_start = reallocx(grid.cell_start, (cell_count + 1) * sizeof(*grid.cell_start));
+    memset(grid.cell_start, 0, (cell_count + 1) * sizeof(*grid.cell_start));
+
+    #define FOREACH_CELL(v, cell) \
+        for(int row = ((v)->y - grid.y) >> grid.cell_shift, last_row = ((v)->y + max(0, (v)->height - 1) - grid.y) >> grid.cell_shift; row <= last_row; row++) \
+            for(int col = ((v)->x - grid.x) >> grid.cell_shift, last_col = ((v)->x + max(0, (v)->width - 1) - grid.x) >> grid.cell_shift, cell = row * grid.cols + col; col <= last_col; col++, cell++)
+
+    for(int i = 0; i < n; i++) {
+        FOREACH_CELL(&volume[i], cell) {
+            grid.cell_start[cell + 1]++;
+            total++;
+        }
+    }
+
+    /* prefix sums */
+    for(int k = 0; k < cell_count; k++)
+        grid.cell_start[k + 1] += grid.cell_start[k];
+
+    /* fill the cells */
+    if(total > grid.cell_volume_capacity) {
+        grid.cell_volume_capacity = total;
+        grid.cell_volume = reallocx(grid.cell_volume, total * sizeof(*grid.cell_volume));
+    }
+
+    int* fill = mallocx(cell_count * sizeof(*fill));
+    memcpy(fill, grid.cell_start, cell_count * sizeof(*fill));
+
+    for(int i = 0; i < n; i++) {
+        FOREACH_CELL(&volume[i], cell)
+            grid.cell_volume[fill[cell]++] = i;
+    }
+
+    #undef FOREACH_CELL
+
+    free(fill);
+}
+
+/* releases the uniform grid */
+void release_grid()
+{
+    free(grid.cell_volume);
+    free(grid.cell_start);
+    memset(&grid, 0, sizeof(grid));
+}
+
+/* the index of the volume with the given ID, or -1 if there is no such volume */
+int find_volume(int id)
+{
+    for(int i = darray_length(volume) - 1; i >= 0; i--) {
+        if(volume[i].id == id)
+            return i;
+    }
+
+    return -1;
+}
+
+/* marks a volume as tested in the current update */
+void touch(int index)
+{
+    triggervolume_t* v = &volume[index];
+
+    if(v->visit != current_visit) {
+        v->visit = current_visit;
+        v->next_inside = 0;
+        darray_push(touched, index);
+    }
+}
+
+/* checks if a volume overlaps a rectangle in world space */
+bool overlaps(const triggervolume_t* v, rect_t box)
+{
+    return box.x < v->x + v->width && box.x + box.width > v->x &&
+           box.y < v->y + v->height && box.y + box.height > v->y;
+}
@@ -0,0 +1,47 @@
+/*
+ * Open Surge Engine
+ * triggervolume.h - trigger volumes with enter/exit events
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TRIGGERVOLUME_H
+#define _TRIGGERVOLUME_H
+
+#include <stdbool.h>
+
+/*
+
+A trigger volume is a rectangle in world space that notifies a callback
+whenever a player enters or exits it. Volumes are indexed by a uniform grid
+and tested once per player per frame; callbacks are only invoked when the
+state changes. It's fine to add or remove volumes inside a callback.
+
+*/
+
+struct player_t;
+typedef void (*triggercallback_t)(int volume_id, struct player_t* player, bool entered, void* context);
+
+void triggervolume_init();
+void triggervolume_release();
+void triggervolume_update(struct player_t** players, int player_count);
+
+int triggervolume_add(int x, int y, int width, int height, triggercallback_t callback, void* context); /* returns the ID of the volume */
+bool triggervolume_remove(int volume_id);
+void triggervolume_clear();
+int triggervolume_count();
+
+#endif
@@ -19,6 +19,8 @@
  */
 
 #include <math.h>
+#include <string.h>
+#include <limits.h>
 #include "waterfx.h"
 #include "../core/image.h"
 #include "../core/video.h"
@@ -29,6 +31,7 @@
 #include "../entities/player.h"
 #include "../scenes/level.h"
 #include "../util/util.h"
+#include "../util/darray.h"
 
 /* shader */
 static const char watershader_glsl[] = ""
@@ -46,7 +49,6 @@ static const char watershader_glsl[] = ""
     "   pixel[1] = textureOffset(tex, texcoord, ivec2(0,0));\n"
     "   pixel[2] = textureOffset(tex, texcoord, ivec2(1,0));\n"
 
-#if defined(__ANDROID__)
     /*
      * Due to a rule set in the Android version of Allegro 5.2.8, more precisely
      * at src/opengl/ogl_bitmap.c (_al_ogl_create_bitmap), the actual size of
@@ -55,12 +57,15 @@ static const char watershader_glsl[] = ""
      * the u,v wrapping behavior doesn't work as expected. This creates artifacts
      * at the right edge of the screen, when we read pixels that are out of bounds.
      *
+     * On all platforms, the input texture is allocated at the maximum size of
+     * the screen (see video_get_max_screen_size()), so it may be wider than the
+     * screen itself. The same artifacts would appear.
+     *
      * This little hack fixes the undesirable behavior by assuming that the input
      * texture has been previously cleared to RGBA (0,0,0,0) and that we have set
      * its GL_TEXTURE_WRAP_[UV] parameter to GL_MIRRORED_REPEAT.
      */
     "   pixel[2] += float(all(equal(pixel[2], vec4(0.0)))) * pixel[0];\n" /* pixel[2] becomes pixel[0] if it's zero */
-#endif
 
     "   highp float screen_height = float(textureSize(tex, 0).y);\n"
     "   highp float screen_y = screen_height - texcoord.y * screen_height;\n"
@@ -105,15 +110,47 @@ static void handle_video_event(const ALLEGRO_EVENT* event, void* context);
 /* internals */
 #define DEFAULT_WATERLEVEL      LARGE_INT
 #define DEFAULT_WATERCOLOR()    color_rgba(0, 64, 255, 128)
+#define MAX_VISIBLE_WATER       64 /* maximum number of regions of water rendered at once */
 static int waterlevel = DEFAULT_WATERLEVEL;
 static color_t watercolor;
 static float internal_timer;
 static shader_t* watershader;
-static void render_simple_effect(int y, color_t color);
-static void render_default_effect(int y, float camera_y, float offset, float timer, float speed, color_t color);
+static void render_simple_effect(int x, int y, int width, int height, color_t color);
+static void render_default_effect(int x, int y, int width, int height, float camera_y, float offset, float timer, float speed, color_t color);
+static int visible_water(v2d_t camera_position, int* rect, int max_rects);
 static float* color_to_vec4(color_t color, float* vec4);
 static color_t premultiply_alpha(color_t color);
 
+/* water regions: rectangles whose top is the level of the water. They are
+   indexed by a uniform grid, so that a point query is a lookup of a cell */
+typedef struct waterregion_t waterregion_t;
+struct waterregion_t {
+    int id;
+    int x, y, width, height; /* in world space */
+    uint32_t visit; /* used to report each region only once in the queries of rectangles */
+};
+
+STATIC_DARRAY(waterregion_t, region);
+static int next_region_id = 1;
+
+static struct {
+    bool is_dirty; /* the grid must be rebuilt */
+    int x, y; /* top-left corner, in world space */
+    int cols, rows;
+    int cell_shift; /* the size of a cell is 1 << cell_shift pixels */
+    uint32_t visit; /* a stamp for the queries of rectangles */
+    int* cell_start; /* the regions of cell k are cell_region[cell_start[k] .. cell_start[k+1]-1] */
+    int* cell_region; /* indices of regions */
+    int cell_region_capacity;
+} grid;
+
+#define MIN_CELL_SHIFT 9 /* cells of 512x512 pixels */
+#define MAX_CELLS 65536 /* cells are made larger if needed */
+static void rebuild_grid();
+static void release_grid();
+static inline int find_region(int id);
+static inline bool region_contains(const waterregion_t* r, float x, float y);
+
 /* log */
 #define LOG(...)                logfile_message("Waterfx: " __VA_ARGS__)
 
@@ -130,6 +167,12 @@ void waterfx_init()
     waterlevel = DEFAULT_WATERLEVEL;
     watercolor = DEFAULT_WATERCOLOR();
 
+    /* no water regions */
+    darray_init(region);
+    next_region_id = 1;
+    memset(&grid, 0, sizeof(grid));
+    grid.is_dirty = true;
+
     /* create the shader */
     watershader = shader_create("waterfx", watershader_glsl);
 
@@ -155,6 +198,10 @@ void waterfx_release()
 
     /* destroy backbuffers */
     destroy_backbuffers();
+
+    /* release the water regions */
+    release_grid();
+    darray_release(region);
 }
 
 /*
@@ -173,20 +220,18 @@ void waterfx_update()
  */
 void waterfx_render_fg(v2d_t camera_position)
 {
-    /* convert the waterlevel from world space to screen space */
+    int rect[4 * MAX_VISIBLE_WATER];
+    int n = visible_water(camera_position, rect, MAX_VISIBLE_WATER);
     v2d_t half_screen = v2d_multiply(video_get_screen_size(), 0.5f);
-    v2d_t topleft = v2d_subtract(camera_position, half_screen);
-    int y = waterlevel - topleft.y;
+    float camera_y = camera_position.y - half_screen.y;
 
     /* clip out */
-    if(y >= VIDEO_SCREEN_H)
+    if(n == 0)
         return;
 
-    /* adjust y */
-    y = max(0, y);
-
     /* if the active player is too fast,
        maybe a simple effect will look better? */
+    bool simple_effect = !(video_get_quality() > VIDEOQUALITY_LOW && video_are_costly_effects_enabled());
     const player_t* player = level_player();
     if(player != NULL && !player_is_dying(player) && !player_is_frozen(player)) {
         static bool disabled_effect = false;
@@ -194,16 +239,19 @@ void waterfx_render_fg(v2d_t camera_position)
 
         if(disabled_effect || abs_ysp >= 270.0f) {
             disabled_effect = (abs_ysp > 180.0f);
-            render_simple_effect(y, watercolor);
-            return;
+            simple_effect = true;
         }
     }
 
     /* render */
-    if(video_get_quality() > VIDEOQUALITY_LOW)
-        render_default_effect(y, topleft.y, 0.0f, internal_timer, 32.0f, watercolor);
-    else
-        render_simple_effect(y, watercolor);
+    for(int i = 0; i < n; i++) {
+        const int* r = &rect[4 * i];
+
+        if(simple_effect)
+            render_simple_effect(r[0], r[1], r[2], r[3], watercolor);
+        else
+            render_default_effect(r[0], r[1], r[2], r[3], camera_y, 0.0f, internal_timer, 32.0f, watercolor);
+    }
 }
 
 /*
@@ -212,24 +260,118 @@ void waterfx_render_fg(v2d_t camera_position)
  */
 void waterfx_render_bg(v2d_t camera_position)
 {
-    /* convert the waterlevel from world space to screen space */
-    v2d_t half_screen = v2d_multiply(video_get_screen_size(), 0.5f);
-    v2d_t topleft = v2d_subtract(camera_position, half_screen);
-    int y = waterlevel - topleft.y;
-
-    /* clip out */
-    if(y >= VIDEO_SCREEN_H)
-        return;
-
-    /* adjust y */
-    y = max(0, y);
+    int rect[4 * MAX_VISIBLE_WATER];
+    int n;
 
     /* render */
-    if(video_get_quality() > VIDEOQUALITY_LOW) {
+    if(video_get_quality() > VIDEOQUALITY_LOW && video_are_costly_effects_enabled()) {
         float camera_y = 0.0f; /* no camera */
         color_t transparent = color_rgba(0, 0, 0, 0);
-        render_default_effect(y, camera_y, 16.0f, internal_timer, 64.0f, transparent);
+
+        n = visible_water(camera_position, rect, MAX_VISIBLE_WATER);
+        for(int i = 0; i < n; i++) {
+            const int* r = &rect[4 * i];
+            render_default_effect(r[0], r[1], r[2], r[3], camera_y, 16.0f, internal_timer, 64.0f, transparent);
+        }
+    }
+}
+
+/*
+ * waterfx_is_visible()
+ * Is there any water on the screen?
+ */
+bool waterfx_is_visible(v2d_t camera_position)
+{
+    int rect[4];
+    return visible_water(camera_position, rect, 1) > 0;
+}
+
+/*
+ * waterfx_is_underwater()
+ * Checks if a position in world space is below the global waterlevel
+ * or inside a water region
+ */
+bool waterfx_is_underwater(v2d_t position)
+{
+    if(position.y >= waterlevel)
+        return true;
+
+    if(darray_length(region) == 0)
+        return false;
+
+    if(grid.is_dirty)
+        rebuild_grid();
+
+    /* find the cell */
+    int col = ((int)floorf(position.x) - grid.x) >> grid.cell_shift;
+    int row = ((int)floorf(position.y) - grid.y) >> grid.cell_shift;
+    if(col < 0 || col >= grid.cols || row < 0 || row >= grid.rows)
+        return false;
+
+    /* check the regions of the cell */
+    int cell = row * grid.cols + col;
+    for(int j = grid.cell_start[cell]; j < grid.cell_start[cell + 1]; j++) {
+        if(region_contains(&region[grid.cell_region[j]], position.x, position.y))
+            return true;
     }
+
+    return false;
+}
+
+/*
+ * waterfx_add_region()
+ * Adds a rectangular region of water, given in world space. The level
+ * of the water in the region is its top. Returns the ID of the region
+ */
+int waterfx_add_region(int x, int y, int width, int height)
+{
+    waterregion_t r = {
+        .id = next_region_id++,
+        .x = x, .y = y,
+        .width = max(0, width), .height = max(0, height),
+        .visit = 0
+    };
+
+    darray_push(region, r);
+    grid.is_dirty = true;
+
+    return r.id;
+}
+
+/*
+ * waterfx_remove_region()
+ * Removes a region of water. Returns false if there is no such region
+ */
+bool waterfx_remove_region(int region_id)
+{
+    int index = find_region(region_id);
+
+    if(index < 0)
+        return false;
+
+    darray_remove(region, index);
+    grid.is_dirty = true;
+
+    return true;
+}
+
+/*
+ * waterfx_clear_regions()
+ * Removes all regions of water
+ */
+void waterfx_clear_regions()
+{
+    darray_clear(region);
+    grid.is_dirty = true;
+}
+
+/*
+ * waterfx_region_count()
+ * The number of regions of water
+ */
+int waterfx_region_count()
+{
+    return darray_length(region);
 }
 
 /*
@@ -294,11 +436,15 @@ color_t waterfx_default_color()
  *
  */
 
-/* create the backbuffers used for post-processing */
+/* create the backbuffers used for post-processing. They're allocated at the
+   maximum size of the screen, so that they needn't be recreated when the
+   screen is resized. We only use their top-left corner */
 bool create_backbuffers()
 {
+    v2d_t size = video_get_max_screen_size();
+
     for(int i = 0; i < NUMBER_OF_BACKBUFFERS; i++) {
-        backbuffer[i] = image_create_ex(VIDEO_SCREEN_W, VIDEO_SCREEN_H, IC_BACKBUFFER | IC_WRAP_MIRROR);
+        backbuffer[i] = image_create_ex(size.x, size.y, IC_BACKBUFFER | IC_WRAP_MIRROR);
         if(backbuffer[i] == NULL)
             return false;
     }
@@ -333,31 +479,46 @@ void handle_video_event(const ALLEGRO_EVENT* event, void* context)
 }
 
 /* render a simple water effect
-   y >= 0 is given in screen space */
-void render_simple_effect(int y, color_t color)
+   the rectangle is given in screen space */
+void render_simple_effect(int x, int y, int width, int height, color_t color)
 {
-    v2d_t screen_size = video_get_screen_size();
-    image_rectfill(0, y, screen_size.x, screen_size.y, premultiply_alpha(watercolor));
+    image_rectfill(x, y, x + width, y + height, premultiply_alpha(color));
 }
 
-/* render the default water effect */
-void render_default_effect(int y, float camera_y, float offset, float timer, float speed, color_t color)
+/* render the default water effect
+   the rectangle is given in screen space */
+void render_default_effect(int x, int y, int width, int height, float camera_y, float offset, float timer, float speed, color_t color)
 {
     /* this should never happen; backbuffers may be recreated */
     if(backbuffer[backbuffer_index] == NULL) {
-        /*render_simple_effect(y, color);*/
+        /*render_simple_effect(x, y, width, height, color);*/
         return;
     }
 
-    /* copy the backbuffer */
+    /* the storage of the video backbuffer has grown? */
+    v2d_t screen_size = video_get_screen_size();
+    if(image_width(backbuffer[backbuffer_index]) < screen_size.x || image_height(backbuffer[backbuffer_index]) < screen_size.y) {
+        destroy_backbuffers();
+        if(!create_backbuffers()) {
+            LOG("Can't recreate the backbuffers!");
+            return;
+        }
+    }
+
+    /* copy the underwater region of the backbuffer */
     /* possibly expensive on mobile platforms because we trigger a pipeline
        flush when unbinding a partially rendered FBO, but we mitigate the cost
-       with low-res graphics. */
+       with low-res graphics. We can't sample the backbuffer while rendering to
+       it (that's a feedback loop), but the shader only reads neighbors in the
+       same row, so we copy just the rectangle of the water, plus a pixel on
+       each side. The clear is kept: see the note about the wrapping behavior */
+    int copy_x = max(0, x - 1);
+    int copy_width = min((int)screen_size.x, x + width + 1) - copy_x;
     image_t* target = image_drawing_target();
     image_set_drawing_target(backbuffer[backbuffer_index]);
     {
         image_clear(color_rgba(0, 0, 0, 0));
-        image_draw(video_get_backbuffer(), 0, 0, IF_NONE);
+        image_blit(video_get_backbuffer(), copy_x, y, copy_x, y, copy_width, height);
     }
     image_set_drawing_target(target);
 
@@ -374,8 +535,7 @@ void render_default_effect(int y, float camera_y, float offset, float timer, flo
     const shader_t* prev = shader_get_active();
     shader_set_active(watershader);
     {
-        v2d_t screen_size = video_get_screen_size();
-        image_blit(backbuffer[backbuffer_index], 0, y, 0, y, screen_size.x, screen_size.y);
+        image_blit(backbuffer[backbuffer_index], x, y, x, y, width, height);
     }
     shader_set_active(prev);
 
@@ -383,6 +543,168 @@ void render_default_effect(int y, float camera_y, float offset, float timer, flo
     backbuffer_index = (1 + backbuffer_index) % NUMBER_OF_BACKBUFFERS;
 }
 
+/* finds the visible water: the part below the global waterlevel and the
+   visible regions, as rectangles (x, y, width, height) in screen space.
+   Returns the number of rectangles, at most max_rects */
+int visible_water(v2d_t camera_position, int* rect, int max_rects)
+{
+    v2d_t screen_size = video_get_screen_size();
+    v2d_t topleft = v2d_subtract(camera_position, v2d_multiply(screen_size, 0.5f));
+    int left = (int)topleft.x, top = (int)topleft.y;
+    int right = left + (int)screen_size.x, bottom = top + (int)screen_size.y;
+    int n = 0;
+
+    /* the global waterlevel */
+    if(waterlevel < bottom && n < max_rects) {
+        int y = max(0, waterlevel - top);
+
+        rect[4 * n + 0] = 0;
+        rect[4 * n + 1] = y;
+        rect[4 * n + 2] = (int)screen_size.x;
+        rect[4 * n + 3] = (int)screen_size.y - y;
+        n++;
+    }
+
+    /* the regions */
+    if(darray_length(region) == 0)
+        return n;
+
+    if(grid.is_dirty)
+        rebuild_grid();
+
+    int col1 = max(0, (left - grid.x) >> grid.cell_shift);
+    int row1 = max(0, (top - grid.y) >> grid.cell_shift);
+    int col2 = min(grid.cols - 1, (right - 1 - grid.x) >> grid.cell_shift);
+    int row2 = min(grid.rows - 1, (bottom - 1 - grid.y) >> grid.cell_shift);
+    uint32_t visit = ++grid.visit;
+
+    for(int row = row1; row <= row2; row++) {
+        for(int col = col1; col <= col2; col++) {
+            int cell = row * grid.cols + col;
+
+            for(int j = grid.cell_start[cell]; j < grid.cell_start[cell + 1]; j++) {
+                waterregion_t* r = &region[grid.cell_region[j]];
+
+                /* report each region once */
+                if(r->visit == visit)
+                    continue;
+                r->visit = visit;
+
+                /* clip the region to the screen */
+                int x1 = max(r->x, left), y1 = max(r->y, top);
+                int x2 = min(r->x + r->width, right), y2 = min(r->y + r->height, bottom);
+                if(x1 >= x2 || y1 >= y2)
+                    continue;
+
+                if(n == max_rects)
+                    return n;
+
+                rect[4 * n + 0] = x1 - left;
+                rect[4 * n + 1] = y1 - top;
+                rect[4 * n + 2] = x2 - x1;
+                rect[4 * n + 3] = y2 - y1;
+                n++;
+            }
+        }
+    }
+
+    return n;
+}
+
+/* rebuilds the uniform grid that indexes the regions of water */
+void rebuild_grid()
+{
+    int n = darray_length(region);
+    int x1 = INT_MAX, y1 = INT_MAX, x2 = INT_MIN, y2 = INT_MIN;
+
+    grid.is_dirty = false;
+    grid.cols = grid.rows = 0;
+    if(n == 0)
+        return;
+
+    /* bounding box */
+    for(int i = 0; i < n; i++) {
+        x1 = min(x1, region[i].x);
+        y1 = min(y1, region[i].y);
+        x2 = max(x2, region[i].x + region[i].width);
+        y2 = max(y2, region[i].y + region[i].height);
+    }
+
+    /* size of the cells */
+    grid.x = x1;
+    grid.y = y1;
+    grid.cell_shift = MIN_CELL_SHIFT;
+    do {
+        grid.cols = ((x2 - x1) >> grid.cell_shift) + 1;
+        grid.rows = ((y2 - y1) >> grid.cell_shift) + 1;
+    } while((int64_t)grid.cols * grid.rows > MAX_CELLS && ++grid.cell_shift < 30);
+
+    /* count the regions of each cell */
+    int cell_count = grid.cols * grid.rows;
+    int total = 0;
+
+    grid.cell_start = reallocx(grid.cell_start, (cell_count + 1) * sizeof(*grid.cell_start));
+    memset(grid.cell_start, 0, (cell_count + 1) * sizeof(*grid.cell_start));
+
+    #define FOREACH_CELL(r, cell) \
+        for(int row = ((r)->y - grid.y) >> grid.cell_shift, last_row = ((r)->y + max(0, (r)->height - 1) - grid.y) >> grid.cell_shift; row <= last_row; row++) \
+            for(int col = ((r)->x - grid.x) >> grid.cell_shift, last_col = ((r)->x + max(0, (r)->width - 1) - grid.x) >> grid.cell_shift, cell = row * grid.cols + col; col <= last_col; col++, cell++)
+
+    for(int i = 0; i < n; i++) {
+        FOREACH_CELL(&region[i], cell) {
+            grid.cell_start[cell + 1]++;
+            total++;
+        }
+    }
+
+    /* prefix sums */
+    for(int k = 0; k < cell_count; k++)
+        grid.cell_start[k + 1] += grid.cell_start[k];
+
+    /* fill the cells */
+    if(total > grid.cell_region_capacity) {
+        grid.cell_region_capacity = total;
+        grid.cell_region = reallocx(grid.cell_region, total * sizeof(*grid.cell_region));
+    }
+
+    int* fill = mallocx(cell_count * sizeof(*fill));
+    memcpy(fill, grid.cell_start, cell_count * sizeof(*fill));
+
+    for(int i = 0; i < n; i++) {
+        FOREACH_CELL(&region[i], cell)
+            grid.cell_region[fill[cell]++] = i;
+    }
+
+    #undef FOREACH_CELL
+
+    free(fill);
+}
+
+/* releases the uniform grid */
+void release_grid()
+{
+    free(grid.cell_region);
+    free(grid.cell_start);
+    memset(&grid, 0, sizeof(grid));
+}
+
+/* the index of the region with the given ID, or -1 if there is no such region */
+int find_region(int id)
+{
+    for(int i = darray_length(region) - 1; i >= 0; i--) {
+        if(region[i].id == id)
+            return i;
+    }
+
+    return -1;
+}
+
+/* checks if a point in world space is inside a region */
+bool region_contains(const waterregion_t* r, float x, float y)
+{
+    return x >= r->x && x < r->x + r->width && y >= r->y && y < r->y + r->height;
+}
+
 /* convert a RGBA color to a vec4 in [0,1]^4 */
 float* color_to_vec4(color_t color, float* vec4)
 {
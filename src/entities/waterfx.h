@@ -21,6 +21,7 @@
 #ifndef _WATERFX_H
 #define _WATERFX_H
 
+#include <stdbool.h>
 #include "../core/color.h"
 #include "../util/v2d.h"
 
@@ -38,4 +39,14 @@ void waterfx_set_color(color_t color);
 color_t waterfx_color();
 color_t waterfx_default_color();
 
+/* water regions: rectangles in world space whose top is the level of the water.
+   They're combined with the global waterlevel */
+int waterfx_add_region(int x, int y, int width, int height); /* returns the ID of the region */
+bool waterfx_remove_region(int region_id);
+void waterfx_clear_regions();
+int waterfx_region_count();
+
+bool waterfx_is_underwater(v2d_t position); /* is the position (world space) below the waterlevel or inside a region? */
+bool waterfx_is_visible(v2d_t camera_position); /* is there any water on the screen? */
+
 #endif
\ No newline at end of file
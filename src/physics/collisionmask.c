@@ -19,11 +19,19 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <allegro5/allegro.h>
 #include "collisionmask.h"
+#include "../core/global.h"
 #include "../core/video.h"
 #include "../core/image.h"
+#include "../core/asset.h"
 #include "../core/logfile.h"
 #include "../util/util.h"
+#include "../util/darray.h"
+#include "../util/djb2.h"
+#include "../util/stringutil.h"
+#include "../util/simd.h"
 
 
 
@@ -31,16 +39,24 @@
 struct collisionmask_t {
 
     /* mask data */
-    uint8_t* mask; /* this must be the first entry; it's a binary image: solid pixel is 1 and non-solid pixel is 0 */
+    uint64_t* bits; /* this must be the first entry; it's a binary image packed in rows of 64-bit words: solid pixel is 1 and non-solid pixel is 0 */
     int width;
     int height;
-    int pitch;
+    int pitch; /* number of words per row */
 
-    /* integral mask for constant-time collision detection */
+    /* integral mask for constant-time collision detection; lazily created,
+       except for large masks, which never have one */
     uint32_t* integral_mask;
 
-    /* ground maps for each ground direction */
-    uint16_t* gmap[4];
+    /* ground maps for GD_DOWN and GD_UP, lazily created; we scan the rows
+       for GD_LEFT and GD_RIGHT */
+    uint16_t* gmap[2];
+
+    /* the caches requested during concurrent reads (PENDING_* flags) */
+    int pending_caches;
+
+    /* number of references to the mask: it's destroyed when it drops to zero */
+    int refcount;
 
 };
 
@@ -52,11 +68,60 @@ static void cloudify_mask(collisionmask_t* mask);
 static uint16_t* create_groundmap(const collisionmask_t* mask, grounddir_t ground_direction);
 static inline uint16_t* clone_groundmap(uint16_t* gmap, int width, int height, grounddir_t ground_direction);
 static inline uint16_t* destroy_groundmap(uint16_t* gmap);
+static inline const uint16_t* get_groundmap(const collisionmask_t* mask, int index, grounddir_t ground_direction);
 
 /* integral masks */
+#define INTEGRAL_MASK_MAX_AREA (128 * 128) /* larger masks use word-level row scans instead */
 static uint32_t* create_integral_mask(const collisionmask_t* mask);
 static uint32_t* clone_integral_mask(uint32_t* integral_mask, int width, int height);
 static inline uint32_t* destroy_integral_mask(uint32_t* integral_mask);
+static inline const uint32_t* get_integral_mask(const collisionmask_t* mask);
+
+/* stats */
+static collisionmask_stats_t stats = { 0, 0, 0 };
+
+/* word-level row scans */
+static bool row_scan_test(const collisionmask_t* mask, int left, int top, int right, int bottom);
+static int scan_right(const collisionmask_t* mask, int x, int y, uint64_t flip);
+static int scan_left(const collisionmask_t* mask, int x, int y, uint64_t flip);
+static inline int lowest_set_bit(uint64_t word);
+static inline int highest_set_bit(uint64_t word);
+static int scan_down(const collisionmask_t* mask, int x, int y);
+static int scan_up(const collisionmask_t* mask, int x, int y);
+
+/* fast creation from the pixels of a locked image */
+static void pack_solid_pixels(const uint8_t* rgba, int count, uint64_t* words);
+
+/* disk cache */
+#define CACHE_MAGIC 0x31424D43 /* "CMB1" */
+#define CACHE_FORMAT_VERSION 1
+#define CACHE_EXTENSION ".bin"
+#define CACHE_PATH_MAXLENGTH 1023
+typedef struct maskcacheheader_t maskcacheheader_t;
+struct maskcacheheader_t
+{
+    uint32_t magic; /* CACHE_MAGIC */
+    uint32_t format_version; /* CACHE_FORMAT_VERSION */
+    uint32_t engine_version; /* hash of GAME_VERSION_STRING */
+    int32_t x, y, width, height, flags; /* the arguments of collisionmask_create() */
+    int64_t source_size; /* size of the image file, in bytes */
+    int64_t source_mtime; /* modification time of the image file */
+    int32_t mask_width; /* the dimensions of the mask; the data that follows */
+    int32_t mask_height; /* the header is the mask and its two ground maps */
+};
+static char* cache_dir = NULL; /* virtual path of the cache directory; NULL if the cache is disabled */
+static bool cache_prepare(const char* image_path, int x, int y, int width, int height, int flags, char* cache_path, size_t cache_path_size, maskcacheheader_t* header);
+
+/* concurrent reads */
+static bool concurrent_reads = false; /* no caches are built while this is true */
+static ALLEGRO_MUTEX* pending_mutex = NULL;
+STATIC_DARRAY(collisionmask_t*, pending_masks); /* masks that need caches */
+static void request_caches(const collisionmask_t* mask, int caches);
+#define PENDING_INTEGRAL_MASK   0x1
+#define PENDING_GROUNDMAP_DOWN  0x2
+#define PENDING_GROUNDMAP_UP    0x4
+#define SOLID_PIXELS    UINT64_C(0) /* flip value for scans */
+#define PASSABLE_PIXELS (~UINT64_C(0))
 
 /*
 
@@ -203,7 +268,7 @@ collisionmask_t *collisionmask_create(const image_t *image, int x, int y, int wi
     /* basic params */
     mask->width = clip(width, 1, image_width(image));
     mask->height = clip(height, 1, image_height(image));
-    mask->pitch = MASK_ALIGN(mask->width);
+    mask->pitch = (mask->width + 63) / 64;
 
     /* really?? */
     if(mask->width > MASK_MAXSIZE || mask->height > MASK_MAXSIZE) {
@@ -219,14 +284,24 @@ collisionmask_t *collisionmask_create(const image_t *image, int x, int y, int wi
     }
 
     /* create the collision mask */
-    size_t mask_size = (mask->pitch * mask->height) * sizeof(*(mask->mask));
-    mask->mask = mallocx(mask_size);
-    memset(mask->mask, 0, mask_size);
-
-    for(int j = 0, jp = 0; j < mask->height; j++, jp += mask->pitch) {
-        for(int i = 0; i < mask->width; i++) {
-            if(!color_is_transparent(image_getpixel(image, x + i, y + j)))
-                mask->mask[jp + i] = 1;
+    size_t mask_size = (mask->pitch * mask->height) * sizeof(*(mask->bits));
+    mask->bits = mallocx(mask_size);
+    memset(mask->bits, 0, mask_size);
+
+    int pixels_pitch;
+    const uint8_t* pixels = image_locked_pixels(image, &pixels_pitch);
+    if(pixels != NULL && x >= 0 && y >= 0 && x + mask->width <= image_width(image) && y + mask->height <= image_height(image)) {
+        /* scan the rows of the locked pixels */
+        for(int j = 0, jp = 0; j < mask->height; j++, jp += mask->pitch)
+            pack_solid_pixels(pixels + (y + j) * pixels_pitch + x * 4, mask->width, mask->bits + jp);
+    }
+    else {
+        /* read one pixel at a time */
+        for(int j = 0, jp = 0; j < mask->height; j++, jp += mask->pitch) {
+            for(int i = 0; i < mask->width; i++) {
+                if(!color_is_transparent(image_getpixel(image, x + i, y + j)))
+                    mask->bits[jp + (i >> 6)] |= UINT64_C(1) << (i & 63);
+            }
         }
     }
 
@@ -234,14 +309,13 @@ collisionmask_t *collisionmask_create(const image_t *image, int x, int y, int wi
     if(flags & CMF_CLOUDIFY)
         cloudify_mask(mask);
 
-    /* create the integral mask */
-    mask->integral_mask = create_integral_mask(mask);
-
-    /* create the ground maps */
-    mask->gmap[0] = create_groundmap(mask, GD_DOWN);
-    mask->gmap[1] = create_groundmap(mask, GD_LEFT);
-    mask->gmap[2] = create_groundmap(mask, GD_UP);
-    mask->gmap[3] = create_groundmap(mask, GD_RIGHT);
+    /* the integral mask and the ground maps are created on demand */
+    mask->integral_mask = NULL;
+    mask->gmap[0] = NULL;
+    mask->gmap[1] = NULL;
+    mask->pending_caches = 0;
+    mask->refcount = 1;
+    stats.masks++;
 
     /* done! */
     return mask;
@@ -259,21 +333,25 @@ collisionmask_t *collisionmask_create_box(int width, int height)
     /* basic params */
     mask->width = clip(width, 1, MASK_MAXSIZE);
     mask->height = clip(height, 1, MASK_MAXSIZE);
-    mask->pitch = MASK_ALIGN(mask->width);
+    mask->pitch = (mask->width + 63) / 64;
 
     /* create the collision mask */
-    size_t mask_size = (mask->pitch * mask->height) * sizeof(*(mask->mask));
-    mask->mask = mallocx(mask_size);
-    memset(mask->mask, 1, mask_size);
+    size_t mask_size = (mask->pitch * mask->height) * sizeof(*(mask->bits));
+    mask->bits = mallocx(mask_size);
+    memset(mask->bits, 0, mask_size);
 
-    /* create the integral mask */
-    mask->integral_mask = create_integral_mask(mask);
+    for(int j = 0, jp = 0; j < mask->height; j++, jp += mask->pitch) {
+        for(int i = 0; i < mask->width; i++)
+            mask->bits[jp + (i >> 6)] |= UINT64_C(1) << (i & 63);
+    }
 
-    /* create the ground maps */
-    mask->gmap[0] = create_groundmap(mask, GD_DOWN);
-    mask->gmap[1] = create_groundmap(mask, GD_LEFT);
-    mask->gmap[2] = create_groundmap(mask, GD_UP);
-    mask->gmap[3] = create_groundmap(mask, GD_RIGHT);
+    /* the integral mask and the ground maps are created on demand */
+    mask->integral_mask = NULL;
+    mask->gmap[0] = NULL;
+    mask->gmap[1] = NULL;
+    mask->pending_caches = 0;
+    mask->refcount = 1;
+    stats.masks++;
 
     /* done! */
     return mask;
@@ -290,26 +368,40 @@ collisionmask_t* collisionmask_clone(const collisionmask_t* mask)
     memcpy(clone, mask, sizeof(*clone));
 
     /* clone the mask data */
-    size_t mask_size = (mask->pitch * mask->height) * sizeof(*(mask->mask));
-    clone->mask = mallocx(mask_size);
-    memcpy(clone->mask, mask->mask, mask_size);
+    size_t mask_size = (mask->pitch * mask->height) * sizeof(*(mask->bits));
+    clone->bits = mallocx(mask_size);
+    memcpy(clone->bits, mask->bits, mask_size);
 
     /* clone the integral mask */
     clone->integral_mask = clone_integral_mask(mask->integral_mask, mask->width, mask->height);
 
     /* clone the ground maps */
     clone->gmap[0] = clone_groundmap(mask->gmap[0], mask->width, mask->height, GD_DOWN);
-    clone->gmap[1] = clone_groundmap(mask->gmap[1], mask->width, mask->height, GD_LEFT);
-    clone->gmap[2] = clone_groundmap(mask->gmap[2], mask->width, mask->height, GD_UP);
-    clone->gmap[3] = clone_groundmap(mask->gmap[3], mask->width, mask->height, GD_RIGHT);
+    clone->gmap[1] = clone_groundmap(mask->gmap[1], mask->width, mask->height, GD_UP);
+    clone->pending_caches = 0;
+    clone->refcount = 1;
+    stats.masks++;
 
     /* done! */
     return clone;
 }
 
+/*
+ * collisionmask_retain()
+ * Shares an existing collision mask instead of cloning it. Each
+ * call must be matched by a call to collisionmask_destroy()
+ */
+collisionmask_t* collisionmask_retain(const collisionmask_t* mask)
+{
+    collisionmask_t* shared = (collisionmask_t*)mask; /* the bits of a mask never change */
+    shared->refcount++;
+    return shared;
+}
+
 /*
  * collisionmask_destroy()
- * Destroys an existing collision mask
+ * Releases a reference to an existing collision mask,
+ * destroying it if there are no other references
  */
 collisionmask_t *collisionmask_destroy(collisionmask_t *mask)
 {
@@ -317,9 +409,11 @@ collisionmask_t *collisionmask_destroy(collisionmask_t *mask)
     if(!mask)
         return NULL;
 
+    /* the mask is still shared */
+    if(--mask->refcount > 0)
+        return NULL;
+
     /* release the ground maps */
-    destroy_groundmap(mask->gmap[3]);
-    destroy_groundmap(mask->gmap[2]);
     destroy_groundmap(mask->gmap[1]);
     destroy_groundmap(mask->gmap[0]);
 
@@ -327,7 +421,7 @@ collisionmask_t *collisionmask_destroy(collisionmask_t *mask)
     destroy_integral_mask(mask->integral_mask);
 
     /* release the mask data & struct */
-    free(mask->mask);
+    free(mask->bits);
     free(mask);
 
     /* done */
@@ -354,7 +448,7 @@ int collisionmask_height(const collisionmask_t* mask)
 
 /*
  * collisionmask_pitch()
- * Pitch value
+ * Pitch value: the number of 64-bit words per row
  */
 int collisionmask_pitch(const collisionmask_t* mask)
 {
@@ -401,9 +495,19 @@ bool collisionmask_area_test(const collisionmask_t* mask, int left, int top, int
     if(bottom > b)
         bottom = b;
 
+    /* large masks have no integral mask */
+    if(mask->width * mask->height > INTEGRAL_MASK_MAX_AREA)
+        return row_scan_test(mask, left, top, right, bottom);
+
+    /* we can't build the integral mask during concurrent reads */
+    if(concurrent_reads && mask->integral_mask == NULL) {
+        request_caches(mask, PENDING_INTEGRAL_MASK);
+        return row_scan_test(mask, left, top, right, bottom);
+    }
+
     /* super fast area test */
     int p = MASK_ALIGN(mask->width + 1); /* pitch of the integral mask */
-    const uint32_t* s = mask->integral_mask;
+    const uint32_t* s = get_integral_mask(mask);
     return s[(bottom+1)*p + (right+1)] - s[(bottom+1)*p + left] > s[top*p + (right+1)] - s[top*p + left];
 
     /* there is no overflow nor unsigned integer wraparound. Both sides of the
@@ -453,28 +557,254 @@ int collisionmask_locate_ground(const collisionmask_t* mask, int x, int y, groun
             y = mask->height - 1;
     }
 
+    /* we can't build the ground maps during concurrent reads */
+    if(concurrent_reads && mask->gmap[ground_direction == GD_UP] == NULL) {
+        if(ground_direction == GD_DOWN) {
+            request_caches(mask, PENDING_GROUNDMAP_DOWN);
+            return scan_down(mask, x, y);
+        }
+        else if(ground_direction == GD_UP) {
+            request_caches(mask, PENDING_GROUNDMAP_UP);
+            return scan_up(mask, x, y);
+        }
+    }
+
     /* this is very fast */
     switch(ground_direction) {
         case GD_DOWN:
             p = MASK_ALIGN(mask->width);
-            return mask->gmap[0][p * y + x];
-
-        case GD_LEFT:
-            p = MASK_ALIGN(mask->height);
-            return mask->gmap[1][p * x + y];
+            return get_groundmap(mask, 0, GD_DOWN)[p * y + x];
 
         case GD_UP:
             p = MASK_ALIGN(mask->width);
-            return mask->gmap[2][p * y + x];
+            return get_groundmap(mask, 1, GD_UP)[p * y + x];
 
+        /* the ground is "to the left": we get the right end of the solid run
+           that contains (x,y) or the closest solid pixel to the left */
+        case GD_LEFT:
+            if(collisionmask_at(mask, x, y, mask->pitch))
+                return scan_right(mask, x, y, PASSABLE_PIXELS) - 1;
+            else
+                return max(0, scan_left(mask, x, y, SOLID_PIXELS));
+
+        /* the ground is "to the right": we get the left end of the solid run
+           that contains (x,y) or the closest solid pixel to the right */
         case GD_RIGHT:
-            p = MASK_ALIGN(mask->height);
-            return mask->gmap[3][p * x + y];
+            if(collisionmask_at(mask, x, y, mask->pitch))
+                return scan_left(mask, x, y, PASSABLE_PIXELS) + 1;
+            else
+                return min(mask->width - 1, scan_right(mask, x, y, SOLID_PIXELS));
     }
 
     return 0;
 }
 
+/*
+ * collisionmask_begin_concurrent_reads()
+ * Multiple threads will read the collision masks until the matching call to
+ * collisionmask_end_concurrent_reads(). Caches aren't built in the meantime;
+ * masks may not be created nor destroyed
+ */
+void collisionmask_begin_concurrent_reads()
+{
+    if(concurrent_reads)
+        return;
+
+    pending_mutex = al_create_mutex();
+    darray_init(pending_masks);
+    concurrent_reads = true;
+}
+
+/*
+ * collisionmask_end_concurrent_reads()
+ * Ends the concurrent reads and builds the caches that were requested
+ * in the meantime. Call it from the main thread when the others are done
+ */
+void collisionmask_end_concurrent_reads()
+{
+    if(!concurrent_reads)
+        return;
+
+    concurrent_reads = false;
+    al_destroy_mutex(pending_mutex);
+    pending_mutex = NULL;
+
+    for(int i = 0; i < darray_length(pending_masks); i++) {
+        collisionmask_t* mask = pending_masks[i];
+
+        /* build only the caches that were requested */
+        if(mask->pending_caches & PENDING_INTEGRAL_MASK)
+            get_integral_mask(mask);
+        if(mask->pending_caches & PENDING_GROUNDMAP_DOWN)
+            get_groundmap(mask, 0, GD_DOWN);
+        if(mask->pending_caches & PENDING_GROUNDMAP_UP)
+            get_groundmap(mask, 1, GD_UP);
+
+        mask->pending_caches = 0;
+    }
+
+    darray_release(pending_masks);
+}
+
+/*
+ * collisionmask_set_cache_directory()
+ * Cache the masks created from image files, as well as their ground maps, in
+ * the given directory, specified without a trailing slash. Pass NULL to
+ * disable the cache
+ */
+void collisionmask_set_cache_directory(const char* dirpath)
+{
+    if(cache_dir != NULL)
+        free(cache_dir);
+
+    cache_dir = (dirpath != NULL) ? str_dup(dirpath) : NULL;
+}
+
+/*
+ * collisionmask_load_cached()
+ * Loads the mask that collisionmask_create() would create with the given
+ * arguments from the image file at image_path, without touching the image.
+ * Returns NULL if the mask isn't cached or if the cache is outdated
+ */
+collisionmask_t* collisionmask_load_cached(const char* image_path, int x, int y, int width, int height, int flags)
+{
+    char cache_path[CACHE_PATH_MAXLENGTH + 1];
+    maskcacheheader_t expected, header;
+
+    if(!cache_prepare(image_path, x, y, width, height, flags, cache_path, sizeof(cache_path), &expected))
+        return NULL;
+
+    ALLEGRO_FILE* fp = al_fopen(cache_path, "rb");
+    if(fp == NULL)
+        return NULL; /* not cached yet */
+
+    /* validate the header */
+    if(al_fread(fp, &header, sizeof(header)) != sizeof(header) ||
+    header.magic != expected.magic || header.format_version != expected.format_version ||
+    header.mask_width < 1 || header.mask_width > MASK_MAXSIZE ||
+    header.mask_height < 1 || header.mask_height > MASK_MAXSIZE) {
+        logfile_message("Ignoring a corrupt cache file: %s", cache_path);
+        al_fclose(fp);
+        return NULL;
+    }
+    else if(
+        header.engine_version != expected.engine_version ||
+        header.source_size != expected.source_size || header.source_mtime != expected.source_mtime ||
+        header.x != expected.x || header.y != expected.y ||
+        header.width != expected.width || header.height != expected.height ||
+        header.flags != expected.flags
+    ) {
+        al_fclose(fp); /* the cache file is outdated */
+        return NULL;
+    }
+
+    /* read the mask and its ground maps */
+    collisionmask_t* mask = mallocx(sizeof *mask);
+    mask->width = header.mask_width;
+    mask->height = header.mask_height;
+    mask->pitch = (mask->width + 63) / 64;
+
+    size_t mask_size = (mask->pitch * mask->height) * sizeof(*(mask->bits));
+    size_t gmap_size = (MASK_ALIGN(mask->width) * mask->height) * sizeof(*(mask->gmap[0]));
+    mask->bits = mallocx(mask_size);
+    mask->gmap[0] = mallocx(gmap_size);
+    mask->gmap[1] = mallocx(gmap_size);
+
+    bool success = (
+        al_fread(fp, mask->bits, mask_size) == mask_size &&
+        al_fread(fp, mask->gmap[0], gmap_size) == gmap_size &&
+        al_fread(fp, mask->gmap[1], gmap_size) == gmap_size &&
+        al_fgetc(fp) == EOF
+    );
+    al_fclose(fp);
+
+    if(!success) {
+        logfile_message("Ignoring a corrupt cache file: %s", cache_path);
+        free(mask->gmap[1]);
+        free(mask->gmap[0]);
+        free(mask->bits);
+        free(mask);
+        return NULL;
+    }
+
+    /* the integral mask is created on demand */
+    mask->integral_mask = NULL;
+    mask->pending_caches = 0;
+    mask->refcount = 1;
+    stats.masks++;
+
+    /* done! */
+    return mask;
+}
+
+/*
+ * collisionmask_store_cached()
+ * Stores a mask created by collisionmask_create() with the given arguments
+ * from the image file at image_path, so that collisionmask_load_cached()
+ * can read it later. Returns false if the mask hasn't been stored
+ */
+bool collisionmask_store_cached(const collisionmask_t* mask, const char* image_path, int x, int y, int width, int height, int flags)
+{
+    char cache_path[CACHE_PATH_MAXLENGTH + 1];
+    char dirpath[CACHE_PATH_MAXLENGTH + 1];
+    maskcacheheader_t header;
+    bool success = false;
+
+    if(!cache_prepare(image_path, x, y, width, height, flags, cache_path, sizeof(cache_path), &header))
+        return false;
+
+    header.mask_width = mask->width;
+    header.mask_height = mask->height;
+
+    /* the ground maps are stored as well. Don't keep them in the mask if
+       they haven't been requested, as we may be reading concurrently */
+    uint16_t* gmap_down = mask->gmap[0] != NULL ? mask->gmap[0] : create_groundmap(mask, GD_DOWN);
+    uint16_t* gmap_up = mask->gmap[1] != NULL ? mask->gmap[1] : create_groundmap(mask, GD_UP);
+    size_t mask_size = (mask->pitch * mask->height) * sizeof(*(mask->bits));
+    size_t gmap_size = (MASK_ALIGN(mask->width) * mask->height) * sizeof(*gmap_down);
+
+    /* create the directory of the cache file */
+    str_cpy(dirpath, cache_path, sizeof(dirpath));
+    char* slash = strrchr(dirpath, '/');
+    if(slash != NULL) {
+        *slash = '\0';
+        al_make_directory(dirpath);
+    }
+
+    /* write the cache file */
+    ALLEGRO_FILE* fp = al_fopen(cache_path, "wb");
+    if(fp != NULL) {
+        success = (
+            al_fwrite(fp, &header, sizeof(header)) == sizeof(header) &&
+            al_fwrite(fp, mask->bits, mask_size) == mask_size &&
+            al_fwrite(fp, gmap_down, gmap_size) == gmap_size &&
+            al_fwrite(fp, gmap_up, gmap_size) == gmap_size
+        );
+        success = al_fclose(fp) && success;
+    }
+
+    if(!success)
+        logfile_message("Can't write the cache file %s", cache_path);
+
+    /* done! */
+    if(gmap_up != mask->gmap[1])
+        destroy_groundmap(gmap_up);
+    if(gmap_down != mask->gmap[0])
+        destroy_groundmap(gmap_down);
+
+    return success;
+}
+
+/*
+ * collisionmask_stats()
+ * The number of collision masks created so far, as well as the number of
+ * ground maps and integral masks that had to be built on demand
+ */
+const collisionmask_stats_t* collisionmask_stats()
+{
+    return &stats;
+}
+
 /*
  * collisionmask_to_image()
  * Creates a binary image with colored solid pixels and transparent passable pixels
@@ -517,10 +847,12 @@ void cloudify_mask(collisionmask_t* mask)
 {
     for(int i = 0; i < mask->width; i++) {
         int l = CLOUD_HEIGHT;
+        uint64_t bit = UINT64_C(1) << (i & 63);
         for(int j = 0, jp = 0; j < mask->height; j++, jp += mask->pitch) {
-            if(mask->mask[jp + i]) {
+            uint64_t* word = &(mask->bits[jp + (i >> 6)]);
+            if(*word & bit) {
                 if(--l < 0)
-                    mask->mask[jp + i] = 0;
+                    *word &= ~bit;
             }
             else
                 l = CLOUD_HEIGHT;
@@ -578,30 +910,6 @@ uint16_t* create_groundmap(const collisionmask_t* mask, grounddir_t ground_direc
             }
             break;
 
-        /* the ground is "to the left" */
-        case GD_LEFT:
-            p = MASK_ALIGN(mask->height);
-            gmap = mallocx((p *  w) * sizeof(*gmap));
-            for(y = 0; y < h; y++) {
-                if(collisionmask_at(mask, w-1, y, pitch))
-                    gmap[p * (w-1) + y] = w-1;
-                for(x = w-2; x >= 0; x--) {
-                    if(collisionmask_at(mask, x, y, pitch)) {
-                        if(collisionmask_at(mask, x+1, y, pitch))
-                            gmap[p * x + y] = gmap[p * (x+1) + y];
-                        else
-                            gmap[p * x + y] = x;
-                    }
-                }
-                if(!collisionmask_at(mask, 0, y, pitch))
-                    gmap[y] = 0;
-                for(x = 1; x < w; x++) {
-                    if(!collisionmask_at(mask, x, y, pitch))
-                        gmap[p * x + y] = gmap[p * (x-1) + y];
-                }
-            }
-            break;
-
         /* the ground is upwards */
         case GD_UP:
             p = MASK_ALIGN(mask->width);
@@ -626,28 +934,8 @@ uint16_t* create_groundmap(const collisionmask_t* mask, grounddir_t ground_direc
             }
             break;
 
-        /* the ground is "to the right" */
-        case GD_RIGHT:
-            p = MASK_ALIGN(mask->height);
-            gmap = mallocx((p * w) * sizeof(*gmap));
-            for(y = 0; y < h; y++) {
-                if(collisionmask_at(mask, 0, y, pitch))
-                    gmap[y] = 0;
-                for(x = 1; x < w; x++) {
-                    if(collisionmask_at(mask, x, y, pitch)) {
-                        if(collisionmask_at(mask, x-1, y, pitch))
-                            gmap[p * x + y] = gmap[p * (x-1) + y];
-                        else
-                            gmap[p * x + y] = x;
-                    }
-                }
-                if(!collisionmask_at(mask, w-1, y, pitch))
-                    gmap[p * (w-1) + y] = w-1;
-                for(x = w-2; x >=0; x--) {
-                    if(!collisionmask_at(mask, x, y, pitch))
-                        gmap[p * x + y] = gmap[p * (x+1) + y];
-                }
-            }
+        /* we scan the rows of the mask instead */
+        default:
             break;
     }
 
@@ -655,6 +943,17 @@ uint16_t* create_groundmap(const collisionmask_t* mask, grounddir_t ground_direc
     return gmap;
 }
 
+/* Gets a ground map of the mask, creating it if it doesn't exist yet */
+const uint16_t* get_groundmap(const collisionmask_t* mask, int index, grounddir_t ground_direction)
+{
+    if(mask->gmap[index] == NULL) {
+        ((collisionmask_t*)mask)->gmap[index] = create_groundmap(mask, ground_direction); /* a cache */
+        stats.groundmaps++;
+    }
+
+    return mask->gmap[index];
+}
+
 /* Destroys an existing ground map */
 uint16_t* destroy_groundmap(uint16_t* gmap)
 {
@@ -663,13 +962,16 @@ uint16_t* destroy_groundmap(uint16_t* gmap)
     return NULL;
 }
 
-/* Clones an existing ground map */
+/* Clones an existing ground map, if it has been created */
 uint16_t* clone_groundmap(uint16_t* gmap, int width, int height, grounddir_t ground_direction)
 {
     uint16_t* clone = NULL;
     size_t size = 0;
     int pitch = 0;
 
+    if(gmap == NULL)
+        return NULL;
+
     switch(ground_direction)
     {
         case GD_DOWN:
@@ -678,11 +980,8 @@ uint16_t* clone_groundmap(uint16_t* gmap, int width, int height, grounddir_t gro
             size = (pitch * height) * sizeof(*clone);
             break;
 
-        case GD_LEFT:
-        case GD_RIGHT:
-            pitch = MASK_ALIGN(height);
-            size = (pitch *  width) * sizeof(*clone);
-            break;
+        default:
+            return NULL;
     }
 
     clone = mallocx(size);
@@ -706,6 +1005,7 @@ uint32_t* create_integral_mask(const collisionmask_t* mask)
 
     int p = MASK_ALIGN(width + 1); /* pitch of the integral mask */
     uint32_t* integral_mask = NULL;
+
     size_t integral_mask_size = (p * (height + 1)) * sizeof(*integral_mask);
     integral_mask = mallocx(integral_mask_size);
 
@@ -731,9 +1031,23 @@ uint32_t* create_integral_mask(const collisionmask_t* mask)
     return integral_mask;
 }
 
-/* Clones an integral mask */
+/* Gets the integral mask, creating it if it doesn't exist yet */
+const uint32_t* get_integral_mask(const collisionmask_t* mask)
+{
+    if(mask->integral_mask == NULL) {
+        ((collisionmask_t*)mask)->integral_mask = create_integral_mask(mask); /* a cache */
+        stats.integral_masks++;
+    }
+
+    return mask->integral_mask;
+}
+
+/* Clones an integral mask, if it has been created */
 uint32_t* clone_integral_mask(uint32_t* integral_mask, int width, int height)
 {
+    if(integral_mask == NULL)
+        return NULL;
+
     int pitch = MASK_ALIGN(width + 1);
     size_t clone_size = (pitch * (height + 1)) * sizeof(*integral_mask);
     uint32_t* clone = mallocx(clone_size);
@@ -750,4 +1064,247 @@ uint32_t* destroy_integral_mask(uint32_t* integral_mask)
         free(integral_mask);
 
     return NULL;
-}
\ No newline at end of file
+}
+
+
+
+/*
+ * Word-level row scans
+ */
+
+/* checks if any pixel of [left,right] x [top,bottom] is solid, scanning the rows
+   of the mask one 64-bit word at a time. The rectangle must be within the mask */
+bool row_scan_test(const collisionmask_t* mask, int left, int top, int right, int bottom)
+{
+    int first_word = left >> 6, last_word = right >> 6;
+    uint64_t first_bits = ~UINT64_C(0) << (left & 63);
+    uint64_t last_bits = ~UINT64_C(0) >> (63 - (right & 63));
+    const uint64_t* row = mask->bits + top * mask->pitch;
+
+    /* the rectangle fits in a single word per row (e.g., a vertical sensor) */
+    if(first_word == last_word) {
+        uint64_t bits = first_bits & last_bits;
+        for(int y = top; y <= bottom; y++, row += mask->pitch) {
+            if(row[first_word] & bits)
+                return true;
+        }
+        return false;
+    }
+
+    /* the rectangle spans multiple words per row */
+    for(int y = top; y <= bottom; y++, row += mask->pitch) {
+        if(row[first_word] & first_bits)
+            return true;
+        for(int w = first_word + 1; w < last_word; w++) {
+            if(row[w])
+                return true;
+        }
+        if(row[last_word] & last_bits)
+            return true;
+    }
+
+    return false;
+}
+
+/* finds the smallest x' >= x such that pixel (x',y) is solid (flip = SOLID_PIXELS)
+   or passable (flip = PASSABLE_PIXELS). Returns the width of the mask if there is none */
+int scan_right(const collisionmask_t* mask, int x, int y, uint64_t flip)
+{
+    const uint64_t* row = mask->bits + y * mask->pitch;
+    int i = x >> 6;
+    uint64_t word = (row[i] ^ flip) & (~UINT64_C(0) << (x & 63));
+
+    for(;;) {
+        if(word != 0)
+            return min(mask->width, (i << 6) + lowest_set_bit(word)); /* the padding is passable */
+        else if(++i >= mask->pitch)
+            return mask->width;
+
+        word = row[i] ^ flip;
+    }
+}
+
+/* finds the largest x' <= x such that pixel (x',y) is solid (flip = SOLID_PIXELS)
+   or passable (flip = PASSABLE_PIXELS). Returns -1 if there is none */
+int scan_left(const collisionmask_t* mask, int x, int y, uint64_t flip)
+{
+    const uint64_t* row = mask->bits + y * mask->pitch;
+    int i = x >> 6;
+    uint64_t word = (row[i] ^ flip) & (~UINT64_C(0) >> (63 - (x & 63)));
+
+    for(;;) {
+        if(word != 0)
+            return (i << 6) + highest_set_bit(word);
+        else if(--i < 0)
+            return -1;
+
+        word = row[i] ^ flip;
+    }
+}
+
+/* the ground map value of (x,y) for GD_DOWN, computed without the ground map:
+   the top of the solid run that contains (x,y) or the top of the next solid
+   run below it. Returns the bottom of the mask if there is none */
+int scan_down(const collisionmask_t* mask, int x, int y)
+{
+    int pitch = mask->pitch;
+
+    if(collisionmask_at(mask, x, y, pitch)) {
+        while(y > 0 && collisionmask_at(mask, x, y-1, pitch))
+            y--;
+        return y;
+    }
+
+    while(++y < mask->height) {
+        if(collisionmask_at(mask, x, y, pitch))
+            return y;
+    }
+
+    return mask->height - 1;
+}
+
+/* the ground map value of (x,y) for GD_UP, computed without the ground map */
+int scan_up(const collisionmask_t* mask, int x, int y)
+{
+    int pitch = mask->pitch;
+
+    if(collisionmask_at(mask, x, y, pitch)) {
+        while(y < mask->height - 1 && collisionmask_at(mask, x, y+1, pitch))
+            y++;
+        return y;
+    }
+
+    while(--y >= 0) {
+        if(collisionmask_at(mask, x, y, pitch))
+            return y;
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Concurrent reads
+ */
+
+
+/* sets the bits of the solid pixels of a row of RGBA pixels: a pixel is
+   solid unless it's fully transparent or bright pink (the mask color) */
+void pack_solid_pixels(const uint8_t* rgba, int count, uint64_t* words)
+{
+    for(int i = 0; i < count; i += 64) {
+        const uint8_t* p = rgba + i * 4;
+        int n = min(64, count - i), k = 0;
+        uint64_t word = 0;
+
+#if (defined(HAVE_SSE2) || defined(HAVE_NEON)) && (!defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+        /* test 4 pixels at a time. The bytes R, G, B, A of a pixel read as
+           a little-endian 32-bit integer give A << 24 | B << 16 | G << 8 | R */
+        for(; k + 4 <= n; k += 4, p += 16) {
+#if defined(HAVE_SSE2)
+            __m128i pixel = _mm_loadu_si128((const __m128i*)p);
+            __m128i invisible = _mm_cmpeq_epi32(_mm_srli_epi32(pixel, 24), _mm_setzero_si128());
+            __m128i pink = _mm_cmpeq_epi32(_mm_and_si128(pixel, _mm_set1_epi32(0x00FFFFFF)), _mm_set1_epi32(0x00FF00FF));
+            int transparent = _mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(invisible, pink)));
+            word |= (uint64_t)(~transparent & 0xF) << k;
+#else
+            static const uint32_t lane_bit[4] = { 1, 2, 4, 8 };
+            uint32x4_t pixel = vreinterpretq_u32_u8(vld1q_u8(p));
+            uint32x4_t invisible = vceqq_u32(vshrq_n_u32(pixel, 24), vdupq_n_u32(0));
+            uint32x4_t pink = vceqq_u32(vandq_u32(pixel, vdupq_n_u32(0x00FFFFFF)), vdupq_n_u32(0x00FF00FF));
+            uint32x4_t solid = vandq_u32(vmvnq_u32(vorrq_u32(invisible, pink)), vld1q_u32(lane_bit));
+            uint32x2_t sum = vpadd_u32(vget_low_u32(solid), vget_high_u32(solid));
+            word |= (uint64_t)vget_lane_u32(vpadd_u32(sum, sum), 0) << k;
+#endif
+        }
+#endif
+
+        /* the remaining pixels */
+        for(; k < n; k++, p += 4) {
+            bool transparent = (p[3] == 0) || (p[0] == 255 && p[1] == 0 && p[2] == 255);
+            word |= (uint64_t)(!transparent) << k;
+        }
+
+        words[i >> 6] = word;
+    }
+}
+
+/* checks if the cache is enabled and computes the header and the path of the
+   cache file of a mask. A cache file is valid only for a specific version of
+   the image file */
+bool cache_prepare(const char* image_path, int x, int y, int width, int height, int flags, char* cache_path, size_t cache_path_size, maskcacheheader_t* header)
+{
+    /* is the cache enabled? */
+    if(cache_dir == NULL || image_path == NULL)
+        return false;
+
+    /* stat the image file */
+    ALLEGRO_FS_ENTRY* entry = al_create_fs_entry(asset_path(image_path));
+    if(entry == NULL)
+        return false;
+    else if(!al_fs_entry_exists(entry) || !(al_get_fs_entry_mode(entry) & ALLEGRO_FILEMODE_ISFILE)) {
+        al_destroy_fs_entry(entry);
+        return false;
+    }
+
+    memset(header, 0, sizeof(*header));
+    header->magic = CACHE_MAGIC;
+    header->format_version = CACHE_FORMAT_VERSION;
+    header->engine_version = (uint32_t)djb2(GAME_VERSION_STRING);
+    header->x = x;
+    header->y = y;
+    header->width = width;
+    header->height = height;
+    header->flags = flags;
+    header->source_size = (int64_t)al_get_fs_entry_size(entry);
+    header->source_mtime = (int64_t)al_get_fs_entry_mtime(entry);
+    al_destroy_fs_entry(entry);
+
+    /* the path of the cache file mirrors the path of the image file */
+    while(*image_path == '/')
+        image_path++;
+
+    int n = snprintf(cache_path, cache_path_size, "%s/%s.%d_%d_%d_%d_%d%s", cache_dir, image_path, x, y, width, height, flags, CACHE_EXTENSION);
+    return n >= 0 && (size_t)n < cache_path_size;
+}
+
+/* the requested caches of the mask (PENDING_* flags) will be built after the concurrent reads */
+void request_caches(const collisionmask_t* mask, int caches)
+{
+    al_lock_mutex(pending_mutex);
+    if(mask->pending_caches == 0)
+        darray_push(pending_masks, (collisionmask_t*)mask);
+    ((collisionmask_t*)mask)->pending_caches |= caches;
+    al_unlock_mutex(pending_mutex);
+}
+
+/* the index of the lowest set bit of a non-zero word */
+int lowest_set_bit(uint64_t word)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(word);
+#else
+    int n = 0;
+    while(!(word & 1)) {
+        word >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+/* the index of the highest set bit of a non-zero word */
+int highest_set_bit(uint64_t word)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(word);
+#else
+    int n = 63;
+    while(!(word & (UINT64_C(1) << 63))) {
+        word <<= 1;
+        n--;
+    }
+    return n;
+#endif
+}
@@ -37,16 +37,17 @@ enum {
 /* create and destroy a collision mask */
 collisionmask_t* collisionmask_create(const struct image_t* image, int x, int y, int width, int height, int flags);
 collisionmask_t* collisionmask_create_box(int width, int height);
-collisionmask_t* collisionmask_destroy(collisionmask_t *mask);
+collisionmask_t* collisionmask_destroy(collisionmask_t *mask); /* releases a reference */
 collisionmask_t* collisionmask_clone(const collisionmask_t* mask);
+collisionmask_t* collisionmask_retain(const collisionmask_t* mask); /* shares the mask; call collisionmask_destroy() afterwards */
 
 /* retrieve dimensions */
 int collisionmask_width(const collisionmask_t* mask);
 int collisionmask_height(const collisionmask_t* mask);
-int collisionmask_pitch(const collisionmask_t* mask);
+int collisionmask_pitch(const collisionmask_t* mask); /* in 64-bit words */
 
 /* collision checking */
-#define collisionmask_at(mask, x, y, pitch) (*(*((const uint8_t**)(mask)) + (y) * (pitch) + (x))) /* fast pixel test with no boundary checking and no (mask == NULL) checking!! */
+#define collisionmask_at(mask, x, y, pitch) ((int)((*(*((const uint64_t**)(mask)) + (y) * (pitch) + ((x) >> 6)) >> ((x) & 63)) & 1)) /* fast pixel test with no boundary checking and no (mask == NULL) checking!! */
 bool collisionmask_pixel_test(const collisionmask_t* mask, int x, int y); /* slower pixel test with boundary checking */
 bool collisionmask_area_test(const collisionmask_t* mask, int left, int top, int right, int bottom); /* fast area test */
 
@@ -55,7 +56,26 @@ typedef enum grounddir_t { GD_DOWN, GD_RIGHT, GD_UP, GD_LEFT } grounddir_t; /* a
 #define FLIPPED_GROUNDDIR(dir) (grounddir_t)(((dir) + 2) & 3) /* flip a grounddir_t */
 int collisionmask_locate_ground(const collisionmask_t* mask, int x, int y, grounddir_t ground_direction);
 
+/* concurrent reads (no caches are built in the meantime) */
+void collisionmask_begin_concurrent_reads();
+void collisionmask_end_concurrent_reads();
+
+/* disk cache of the masks created from image files */
+void collisionmask_set_cache_directory(const char* dirpath); /* NULL disables the cache */
+collisionmask_t* collisionmask_load_cached(const char* image_path, int x, int y, int width, int height, int flags); /* NULL if not cached */
+bool collisionmask_store_cached(const collisionmask_t* mask, const char* image_path, int x, int y, int width, int height, int flags);
+
 /* misc */
 struct image_t* collisionmask_to_image(const collisionmask_t* mask, color_t color);
 
+/* stats */
+typedef struct collisionmask_stats_t collisionmask_stats_t;
+struct collisionmask_stats_t {
+    int masks; /* number of collision masks created */
+    int groundmaps; /* number of ground maps built on demand */
+    int integral_masks; /* number of integral masks built on demand */
+};
+
+const collisionmask_stats_t* collisionmask_stats();
+
 #endif
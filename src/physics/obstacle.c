@@ -22,6 +22,8 @@
 #include "obstacle.h"
 #include "collisionmask.h"
 #include "../util/util.h"
+#include "../util/arena.h"
+#include "../util/pool.h"
 
 /* obstacle struct */
 struct obstacle_t
@@ -33,6 +35,7 @@ struct obstacle_t
 
     obstaclelayer_t layer;
     uint8_t flags;
+    bool is_in_arena; /* is the memory owned by an arena? */
 
     const collisionmask_t* mask;
 
@@ -49,6 +52,13 @@ struct obstacle_t
 } while(0)
 
 
+/* obstacles are allocated from a pool. It's created on demand and
+   destroyed when there are no obstacles left (e.g., when leaving a level) */
+static pool_t* pool = NULL;
+#define OBSTACLES_PER_SLAB 256
+
+static obstacle_t* init_obstacle(obstacle_t* o, const collisionmask_t* mask, point2d_t position, obstaclelayer_t layer, int flags, void (*dtor)(void*), void *dtor_userdata);
+
 
 /* public methods */
 obstacle_t* obstacle_create(const collisionmask_t* mask, point2d_t position, obstaclelayer_t layer, int flags)
@@ -58,8 +68,28 @@ obstacle_t* obstacle_create(const collisionmask_t* mask, point2d_t position, obs
 
 obstacle_t* obstacle_create_ex(const collisionmask_t* mask, point2d_t position, obstaclelayer_t layer, int flags, void (*dtor)(void*), void *dtor_userdata)
 {
-    obstacle_t *o = mallocx(sizeof *o);
+    if(pool == NULL)
+        pool = pool_create(sizeof(obstacle_t), OBSTACLES_PER_SLAB);
+
+    obstacle_t *o = pool_alloc(pool);
+
+    o->is_in_arena = false;
+    return init_obstacle(o, mask, position, layer, flags, dtor, dtor_userdata);
+}
+
+/* the memory of the obstacle is released when the arena is reset, but
+   you should still call obstacle_destroy() before that to run the dtor */
+obstacle_t* obstacle_create_in_arena(arena_t* arena, const collisionmask_t* mask, point2d_t position, obstaclelayer_t layer, int flags, void (*dtor)(void*), void *dtor_userdata)
+{
+    obstacle_t *o = arena_alloc(arena, sizeof *o);
+
+    o->is_in_arena = true;
+    return init_obstacle(o, mask, position, layer, flags, dtor, dtor_userdata);
+}
 
+/* initializes the fields of an obstacle */
+obstacle_t* init_obstacle(obstacle_t* o, const collisionmask_t* mask, point2d_t position, obstaclelayer_t layer, int flags, void (*dtor)(void*), void *dtor_userdata)
+{
     o->position = position;
 
     o->layer = layer;
@@ -83,7 +113,12 @@ obstacle_t* obstacle_destroy(obstacle_t *obstacle)
     if(obstacle->dtor != NULL)
         obstacle->dtor(obstacle->dtor_userdata);
 
-    free(obstacle);
+    if(!obstacle->is_in_arena) {
+        pool_free(pool, obstacle);
+        if(pool_count(pool) == 0)
+            pool = pool_destroy(pool);
+    }
+
     return NULL;
 }
 
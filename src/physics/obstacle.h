@@ -31,6 +31,7 @@
  */
 struct obstacle_t;
 typedef struct obstacle_t obstacle_t;
+struct arena_t;
 
 /* obstacle flags */
 enum {
@@ -52,6 +53,7 @@ enum obstaclelayer_t {
 /* create and destroy */
 obstacle_t* obstacle_create(const collisionmask_t *mask, point2d_t position, obstaclelayer_t layer, int flags);
 obstacle_t* obstacle_create_ex(const collisionmask_t* mask, point2d_t position, obstaclelayer_t layer, int flags, void (*dtor)(void*), void *dtor_userdata);
+obstacle_t* obstacle_create_in_arena(struct arena_t* arena, const collisionmask_t* mask, point2d_t position, obstaclelayer_t layer, int flags, void (*dtor)(void*), void *dtor_userdata); /* short-lived obstacle; its memory is owned by the arena */
 obstacle_t* obstacle_destroy(obstacle_t *obstacle);
 
 /* public methods */
@@ -18,12 +18,14 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
 #include "obstaclemap.h"
 #include "obstacle.h"
 #include "physicsactor.h"
 #include "../core/video.h"
 #include "../util/darray.h"
 #include "../util/util.h"
+#include "../util/profiler.h"
 
 /*
 
@@ -34,23 +36,46 @@ access. Any particular obstacle may be placed in one or more buckets, depending
 on its size. Buckets have fixed length. They are used to partition space. When
 detecting collisions, we just inspect the obstacles of the relevant buckets.
 
+Optionally, space is partitioned along the y-axis as well, in a 2D uniform grid
+of square buckets. Each row of the grid is a sequence of buckets distributed
+throughout the x-axis, as above. This helps tall, vertical levels, in which the
+buckets of the x-axis-only scheme become long columns of obstacles.
+
+An obstacle map has two tiers: a static tier and a dynamic tier. Each tier has
+its own partition. The static tier stores obstacles that don't move, such as
+the static bricks near the camera. It's built once and kept across frames until
+it's explicitly cleared. The dynamic tier stores moving obstacles and is meant
+to be rebuilt on every frame. Queries merge the results of both tiers.
+
+Each tier is further partitioned by obstacle layer (default, green, yellow).
+The obstacles of each layer are stored contiguously, so that a query with a
+layer filter walks only the relevant partitions: the default layer and the
+layer of the filter. No per-obstacle layer checks are needed.
+
 */
-struct obstaclemap_t
+typedef struct obstaclemaptier_t obstaclemaptier_t;
+struct obstaclemaptier_t
 {
     /* obstacles */
     DARRAY(const obstacle_t*, obstacle);
 
-    /* possibly repeating obstacles sorted by increasing bucket index */
+    /* possibly repeating obstacles sorted by increasing layer and bucket index */
     DARRAY(const obstacle_t*, sorted_obstacle);
 
     /* cumulative sum of helper.bucket_count[] */
     DARRAY(int, bucket_start);
 
-    /* number of buckets */
+    /* number of buckets per layer: number_of_columns * number_of_rows */
     int number_of_buckets;
+    int number_of_columns;
+    int number_of_rows; /* 1 if we partition the x-axis only */
 
-    /* min limit of the obstacle map in the x-axis */
+    /* min limits of the obstacle map */
     int min_x;
+    int min_y;
+
+    /* partition the y-axis as well? */
+    bool use_2d_grid;
 
     /* the obstacle map will be locked once we partition space */
     bool is_locked;
@@ -61,15 +86,28 @@ struct obstaclemap_t
         /* possibly repeating indices of obstacle[] in their incoming order */
         DARRAY(int, obstacle_index);
 
-        /* bucket_index[i] is a bucket index of obstacle[obstacle_index[i]] */
+        /* bucket_index[i] is a bucket index of obstacle[obstacle_index[i]],
+           offset by the layer of the obstacle times the number of buckets */
         DARRAY(int, bucket_index);
 
-        /* bucket_count[i] is the number of obstacles in the i-th bucket */
+        /* bucket_count[i] is the number of obstacles in the i-th bucket (of all layers) */
         DARRAY(int, bucket_count);
 
     } helper;
 };
 
+struct obstaclemap_t
+{
+    /* obstacles that don't move; kept until cleared */
+    obstaclemaptier_t static_tier;
+
+    /* obstacles that may move; rebuilt on every frame */
+    obstaclemaptier_t dynamic_tier;
+
+    /* partitioning scheme of the next build */
+    bool want_2d_grid;
+};
+
 /*
 
 The length of a bucket, in pixels
@@ -115,14 +153,36 @@ sparsity.
 
 */
 static const int MAX_ROI_WIDTH = 16384; /* far beyond what's needed */
-static const int MAX_BUCKETS = MAX_ROI_WIDTH / BUCKET_LENGTH;
+static const int MAX_BUCKETS = MAX_ROI_WIDTH / BUCKET_LENGTH; /* per row */
+static const int MAX_ROI_HEIGHT = 16384;
+static const int MAX_ROWS = MAX_ROI_HEIGHT / BUCKET_LENGTH;
+
+/* the number of obstacle layers, i.e., of partitions of each tier */
+#define NUMBER_OF_LAYERS 3 /* OL_DEFAULT, OL_GREEN, OL_YELLOW */
 
 /* private stuff */
 static const int WORLD_LIMIT = LARGE_INT;
 static const obstacle_t* pick_best_obstacle(const obstacle_t *a, const obstacle_t *b, int x1, int y1, int x2, int y2, movmode_t mm);
-static inline bool ignore_obstacle(const obstacle_t *obstacle, obstaclelayer_t layer_filter);
-static bool find_partition_limits(const obstaclemap_t* obstaclemap, int x1, int x2, int* begin, int* end);
+static inline int relevant_layers(obstaclelayer_t layer_filter, obstaclelayer_t layer[]);
+static bool find_partition_limits(const obstaclemaptier_t* tier, int x1, int x2, int row, obstaclelayer_t layer, int* begin, int* end);
+static bool find_row_limits(const obstaclemaptier_t* tier, int y1, int y2, int* first_row, int* last_row);
 static const obstacle_t* pick_tallest_ground(const obstacle_t* a, const obstacle_t* b, int x1, int y1, int x2, int y2, grounddir_t ground_direction, int* out_gnd);
+static const obstacle_t* merge_grounds(const obstacle_t* a, int gnd_a, const obstacle_t* b, int gnd_b, grounddir_t ground_direction, int* out_gnd);
+
+static void tier_init(obstaclemaptier_t* tier);
+static void tier_release(obstaclemaptier_t* tier);
+static void tier_add(obstaclemaptier_t* tier, const obstacle_t* obstacle);
+static void tier_clear(obstaclemaptier_t* tier);
+static void tier_build(obstaclemaptier_t* tier);
+static const obstacle_t* tier_get_best_obstacle_at(const obstaclemaptier_t* tier, int x1, int y1, int x2, int y2, movmode_t mm, obstaclelayer_t layer_filter);
+static void tier_get_best_obstacles_at(const obstaclemaptier_t* tier, obstaclemap_query_t* query, int query_count, movmode_t mm, obstaclelayer_t layer_filter);
+static inline bool is_valid_query(const obstaclemap_query_t* query);
+static bool tier_obstacle_exists(const obstaclemaptier_t* tier, int x, int y, obstaclelayer_t layer_filter);
+static bool tier_solid_exists(const obstaclemaptier_t* tier, int x, int y, obstaclelayer_t layer_filter);
+static void tier_solids_exist(const obstaclemaptier_t* tier, obstaclemap_point_t* point, int point_count, obstaclelayer_t layer_filter);
+static void tier_solid_grid(const obstaclemaptier_t* tier, int x, int y, int columns, int rows, int cell_size, obstaclelayer_t layer_filter, bool* grid);
+static const obstacle_t* tier_find_ground(const obstaclemaptier_t* tier, int x1, int y1, int x2, int y2, obstaclelayer_t layer_filter, grounddir_t ground_direction, int* out_ground_position);
+static const obstacle_t* tier_cast_ray(const obstaclemaptier_t* tier, int x1, int y1, int x2, int y2, obstaclelayer_t layer_filter, int steps, int* inout_step);
 
 
 
@@ -141,17 +201,9 @@ obstaclemap_t* obstaclemap_create()
 {
     obstaclemap_t *obstaclemap = mallocx(sizeof *obstaclemap);
 
-    darray_init(obstaclemap->obstacle);
-    darray_init(obstaclemap->sorted_obstacle);
-    darray_init_ex(obstaclemap->bucket_start, MAX_BUCKETS + 1);
-
-    obstaclemap->number_of_buckets = 0;
-    obstaclemap->min_x = WORLD_LIMIT;
-    obstaclemap->is_locked = false;
-
-    darray_init(obstaclemap->helper.obstacle_index);
-    darray_init(obstaclemap->helper.bucket_index);
-    darray_init_ex(obstaclemap->helper.bucket_count, MAX_BUCKETS);
+    tier_init(&obstaclemap->static_tier);
+    tier_init(&obstaclemap->dynamic_tier);
+    obstaclemap->want_2d_grid = false;
 
     return obstaclemap;
 }
@@ -162,13 +214,8 @@ obstaclemap_t* obstaclemap_create()
  */
 obstaclemap_t* obstaclemap_destroy(obstaclemap_t *obstaclemap)
 {
-    darray_release(obstaclemap->helper.bucket_count);
-    darray_release(obstaclemap->helper.bucket_index);
-    darray_release(obstaclemap->helper.obstacle_index);
-
-    darray_release(obstaclemap->bucket_start);
-    darray_release(obstaclemap->sorted_obstacle);
-    darray_release(obstaclemap->obstacle);
+    tier_release(&obstaclemap->dynamic_tier);
+    tier_release(&obstaclemap->static_tier);
 
     free(obstaclemap);
     return NULL;
@@ -176,23 +223,20 @@ obstaclemap_t* obstaclemap_destroy(obstaclemap_t *obstaclemap)
 
 /*
  * obstaclemap_add()
- * Adds an obstacle to the obstacle map
+ * Adds an obstacle to the dynamic tier of the obstacle map
  */
 void obstaclemap_add(obstaclemap_t *obstaclemap, const obstacle_t *obstacle)
 {
-    /* can't add if locked */
-    if(obstaclemap->is_locked) {
-        fatal_error("Obstacle map is locked");
-        return;
-    }
-
-    /* store the obstacle */
-    darray_push(obstaclemap->obstacle, obstacle);
+    tier_add(&obstaclemap->dynamic_tier, obstacle);
+}
 
-    /* update limit */
-    int min_x = obstacle_get_position(obstacle).x;
-    if(min_x < obstaclemap->min_x)
-        obstaclemap->min_x = min_x;
+/*
+ * obstaclemap_add_static()
+ * Adds an obstacle that doesn't move to the static tier of the obstacle map
+ */
+void obstaclemap_add_static(obstaclemap_t *obstaclemap, const obstacle_t *obstacle)
+{
+    tier_add(&obstaclemap->static_tier, obstacle);
 }
 
 /*
@@ -201,235 +245,747 @@ void obstaclemap_add(obstaclemap_t *obstaclemap, const obstacle_t *obstacle)
  */
 void obstaclemap_clear(obstaclemap_t* obstaclemap)
 {
-    darray_clear(obstaclemap->obstacle);
-    darray_clear(obstaclemap->sorted_obstacle);
-    darray_clear(obstaclemap->bucket_start);
+    tier_clear(&obstaclemap->static_tier);
+    tier_clear(&obstaclemap->dynamic_tier);
+}
 
-    obstaclemap->number_of_buckets = 0;
-    obstaclemap->min_x = WORLD_LIMIT;
-    obstaclemap->is_locked = false; /* unlock */
+/*
+ * obstaclemap_clear_dynamic()
+ * Removes the obstacles of the dynamic tier, keeping the static tier
+ */
+void obstaclemap_clear_dynamic(obstaclemap_t* obstaclemap)
+{
+    tier_clear(&obstaclemap->dynamic_tier);
+}
 
-    darray_clear(obstaclemap->helper.obstacle_index);
-    darray_clear(obstaclemap->helper.bucket_index);
-    darray_clear(obstaclemap->helper.bucket_count);
+/*
+ * obstaclemap_use_2d_grid()
+ * Partition space along both axes instead of the x-axis only. This
+ * takes effect the next time each tier of the map is built
+ */
+void obstaclemap_use_2d_grid(obstaclemap_t* obstaclemap, bool use_2d_grid)
+{
+    obstaclemap->want_2d_grid = use_2d_grid;
+}
+
+/*
+ * obstaclemap_count()
+ * The number of obstacles in the map, static or not
+ */
+int obstaclemap_count(const obstaclemap_t* obstaclemap)
+{
+    return darray_length(obstaclemap->static_tier.obstacle) + darray_length(obstaclemap->dynamic_tier.obstacle);
 }
 
 /*
  * obstaclemap_build()
- * Builds the internal data structure. Call after adding all obstacles
+ * Builds the internal data structure. Call after adding all obstacles.
+ * The static tier is built only if it has been cleared
  */
 void obstaclemap_build(obstaclemap_t* obstaclemap)
+{
+    PROFILER_BEGIN("obstaclemap_build");
+
+    if(!obstaclemap->static_tier.is_locked) {
+        obstaclemap->static_tier.use_2d_grid = obstaclemap->want_2d_grid;
+        tier_build(&obstaclemap->static_tier);
+    }
+
+    obstaclemap->dynamic_tier.use_2d_grid = obstaclemap->want_2d_grid;
+    tier_build(&obstaclemap->dynamic_tier);
+
+    PROFILER_END();
+}
+
+/*
+ * obstaclemap_get_best_obstacle_at()
+ * Gets the "best" obstacle that hits a sensor, given a movmode_t and a layer
+ * This routine assumes that the obstacle map is already built
+ * It returns NULL if no hitting obstacle is found
+ */
+const obstacle_t* obstaclemap_get_best_obstacle_at(const obstaclemap_t *obstaclemap, int x1, int y1, int x2, int y2, movmode_t mm, obstaclelayer_t layer_filter)
+{
+    /* validate the input */
+    if(x1 > x2 || y1 > y2)
+        return NULL;
+
+    /* pick the best obstacle among the best of each tier */
+    const obstacle_t* a = tier_get_best_obstacle_at(&obstaclemap->static_tier, x1, y1, x2, y2, mm, layer_filter);
+    const obstacle_t* b = tier_get_best_obstacle_at(&obstaclemap->dynamic_tier, x1, y1, x2, y2, mm, layer_filter);
+
+    return pick_best_obstacle(a, b, x1, y1, x2, y2, mm);
+}
+
+/*
+ * obstaclemap_get_best_obstacles_at()
+ * Similar to obstaclemap_get_best_obstacle_at(), but for multiple sensors at once.
+ * Useful when the sensors are close to each other, e.g., the sensors of the same
+ * actor: we find the relevant buckets and scan their obstacles a single time for
+ * all sensors. The output is written to query[i].best for all i
+ */
+void obstaclemap_get_best_obstacles_at(const obstaclemap_t *obstaclemap, obstaclemap_query_t* query, int query_count, movmode_t mm, obstaclelayer_t layer_filter)
+{
+    for(int i = 0; i < query_count; i++)
+        query[i].best = NULL;
+
+    tier_get_best_obstacles_at(&obstaclemap->static_tier, query, query_count, mm, layer_filter);
+    tier_get_best_obstacles_at(&obstaclemap->dynamic_tier, query, query_count, mm, layer_filter);
+}
+
+/*
+ * obstaclemap_obstacle_exists()
+ * Checks if an obstacle exists at (x,y)
+ */
+bool obstaclemap_obstacle_exists(const obstaclemap_t* obstaclemap, int x, int y, obstaclelayer_t layer_filter)
+{
+    return tier_obstacle_exists(&obstaclemap->static_tier, x, y, layer_filter) ||
+           tier_obstacle_exists(&obstaclemap->dynamic_tier, x, y, layer_filter);
+}
+
+/*
+ * obstaclemap_solid_exists()
+ * Checks if a solid obstacle exists at (x,y)
+ */
+bool obstaclemap_solid_exists(const obstaclemap_t* obstaclemap, int x, int y, obstaclelayer_t layer_filter)
+{
+    return tier_solid_exists(&obstaclemap->static_tier, x, y, layer_filter) ||
+           tier_solid_exists(&obstaclemap->dynamic_tier, x, y, layer_filter);
+}
+
+/*
+ * obstaclemap_solids_exist()
+ * Batched version of obstaclemap_solid_exists(). Useful when the points are
+ * close to each other, e.g., the probes of an AI sensing the terrain: we find
+ * the relevant buckets and scan their obstacles a single time for all points.
+ * The output is written to point[i].is_solid for all i
+ */
+void obstaclemap_solids_exist(const obstaclemap_t* obstaclemap, obstaclemap_point_t* point, int point_count, obstaclelayer_t layer_filter)
+{
+    for(int i = 0; i < point_count; i++)
+        point[i].is_solid = false;
+
+    tier_solids_exist(&obstaclemap->static_tier, point, point_count, layer_filter);
+    tier_solids_exist(&obstaclemap->dynamic_tier, point, point_count, layer_filter);
+}
+
+/*
+ * obstaclemap_solid_grid()
+ * Computes an occupancy bitmap of a region. The region is divided into
+ * columns x rows square cells of the given size, starting at (x,y). Cell
+ * (i,j) is stored at grid[j * columns + i] and is set to true if a solid
+ * obstacle overlaps it
+ */
+void obstaclemap_solid_grid(const obstaclemap_t* obstaclemap, int x, int y, int columns, int rows, int cell_size, obstaclelayer_t layer_filter, bool* grid)
+{
+    for(int i = columns * rows - 1; i >= 0; i--)
+        grid[i] = false;
+
+    /* validate the input */
+    if(columns <= 0 || rows <= 0 || cell_size <= 0)
+        return;
+
+    tier_solid_grid(&obstaclemap->static_tier, x, y, columns, rows, cell_size, layer_filter, grid);
+    tier_solid_grid(&obstaclemap->dynamic_tier, x, y, columns, rows, cell_size, layer_filter, grid);
+}
+
+/*
+ * obstaclemap_find_ground()
+ * Find the tallest ground based on the specified parameters
+ * We expect x1 <= x2 and y1 <= y2
+ * Returns NULL if there is no ground
+ */
+const obstacle_t* obstaclemap_find_ground(const obstaclemap_t *obstaclemap, int x1, int y1, int x2, int y2, obstaclelayer_t layer_filter, grounddir_t ground_direction, int* out_ground_position)
+{
+    int gnd_a = 0, gnd_b = 0;
+
+    /* validate the input */
+    if(x1 > x2 || y1 > y2)
+        return NULL;
+
+    /* pick the tallest ground among the grounds of each tier */
+    const obstacle_t* a = tier_find_ground(&obstaclemap->static_tier, x1, y1, x2, y2, layer_filter, ground_direction, &gnd_a);
+    const obstacle_t* b = tier_find_ground(&obstaclemap->dynamic_tier, x1, y1, x2, y2, layer_filter, ground_direction, &gnd_b);
+
+    return merge_grounds(a, gnd_a, b, gnd_b, ground_direction, out_ground_position);
+}
+
+
+/*
+ * obstaclemap_cast_ray()
+ * Swept query: finds the first solid obstacle along the segment from (x1,y1) to
+ * (x2,y2). The segment is walked one pixel at a time in steps = max(|x2-x1|,|y2-y1|)
+ * steps. If an obstacle is found, *out_step is set to the first step, in [1,steps],
+ * that hits it. Clouds and obstacles that contain (x1,y1) are ignored, so that the
+ * query is meant to detect walls that would be crossed by a fast movement. Both
+ * out_step and out_steps may be NULL. Returns NULL if there is no such obstacle
+ */
+const obstacle_t* obstaclemap_cast_ray(const obstaclemap_t *obstaclemap, int x1, int y1, int x2, int y2, obstaclelayer_t layer_filter, int* out_step, int* out_steps)
+{
+    int steps = max(abs(x2 - x1), abs(y2 - y1));
+    int step = steps + 1; /* no hit */
+
+    /* the closest hit among the tiers */
+    const obstacle_t* a = tier_cast_ray(&obstaclemap->static_tier, x1, y1, x2, y2, layer_filter, steps, &step);
+    const obstacle_t* b = tier_cast_ray(&obstaclemap->dynamic_tier, x1, y1, x2, y2, layer_filter, steps, &step);
+    const obstacle_t* hit = (b != NULL) ? b : a; /* b, if found, is closer than a */
+
+    if(out_step != NULL)
+        *out_step = (hit != NULL) ? step : 0;
+    if(out_steps != NULL)
+        *out_steps = steps;
+
+    return hit;
+}
+
+
+
+/* private methods */
+
+/* initializes a tier */
+void tier_init(obstaclemaptier_t* tier)
+{
+    darray_init(tier->obstacle);
+    darray_init(tier->sorted_obstacle);
+    darray_init_ex(tier->bucket_start, NUMBER_OF_LAYERS * MAX_BUCKETS + 1);
+
+    tier->number_of_buckets = 0;
+    tier->number_of_columns = 0;
+    tier->number_of_rows = 0;
+    tier->min_x = WORLD_LIMIT;
+    tier->min_y = WORLD_LIMIT;
+    tier->use_2d_grid = false;
+    tier->is_locked = false;
+
+    darray_init(tier->helper.obstacle_index);
+    darray_init(tier->helper.bucket_index);
+    darray_init_ex(tier->helper.bucket_count, NUMBER_OF_LAYERS * MAX_BUCKETS);
+}
+
+/* releases a tier */
+void tier_release(obstaclemaptier_t* tier)
+{
+    darray_release(tier->helper.bucket_count);
+    darray_release(tier->helper.bucket_index);
+    darray_release(tier->helper.obstacle_index);
+
+    darray_release(tier->bucket_start);
+    darray_release(tier->sorted_obstacle);
+    darray_release(tier->obstacle);
+}
+
+/* adds an obstacle to a tier */
+void tier_add(obstaclemaptier_t* tier, const obstacle_t* obstacle)
+{
+    /* can't add if locked */
+    if(tier->is_locked) {
+        fatal_error("Obstacle map is locked");
+        return;
+    }
+
+    /* store the obstacle */
+    darray_push(tier->obstacle, obstacle);
+
+    /* update limits */
+    point2d_t position = obstacle_get_position(obstacle);
+    if(position.x < tier->min_x)
+        tier->min_x = position.x;
+    if(position.y < tier->min_y)
+        tier->min_y = position.y;
+}
+
+/* removes all obstacles from a tier */
+void tier_clear(obstaclemaptier_t* tier)
+{
+    darray_clear(tier->obstacle);
+    darray_clear(tier->sorted_obstacle);
+    darray_clear(tier->bucket_start);
+
+    tier->number_of_buckets = 0;
+    tier->number_of_columns = 0;
+    tier->number_of_rows = 0;
+    tier->min_x = WORLD_LIMIT;
+    tier->min_y = WORLD_LIMIT;
+    tier->is_locked = false; /* unlock */
+
+    darray_clear(tier->helper.obstacle_index);
+    darray_clear(tier->helper.bucket_index);
+    darray_clear(tier->helper.bucket_count);
+}
+
+/* builds the partition of a tier */
+void tier_build(obstaclemaptier_t* tier)
 {
     /*
 
     We sort obstacles by increasing bucket index and in linear time using
-    Counting Sort. This routine must be fast, as it runs on every frame.
+    Counting Sort. This routine must be fast, as it runs on every frame for
+    the dynamic tier.
 
     */
-    int number_of_buckets = 0;
-    int min_x = obstaclemap->min_x;
+    int number_of_columns = 0, number_of_rows = 0;
+    int min_x = tier->min_x, min_y = tier->min_y;
 
     /* quickly clear the arrays, just to be sure */
-    darray_clear(obstaclemap->sorted_obstacle);
-    darray_clear(obstaclemap->bucket_start);
-    darray_clear(obstaclemap->helper.obstacle_index);
-    darray_clear(obstaclemap->helper.bucket_index);
-    darray_clear(obstaclemap->helper.bucket_count);
-
-    /* for each obstacle j, normalize its x-position and find all relevant buckets */
-    for(int j = 0; j < darray_length(obstaclemap->obstacle); j++) {
-        const obstacle_t* obstacle = obstaclemap->obstacle[j];
-        int x = obstacle_get_position(obstacle).x;
-        int width = obstacle_get_width(obstacle);
-
-        int normalized_x1 = x - min_x; /* never negative because min_x <= x */
-        int normalized_x2 = (x + width - 1) - min_x; /* width >= 1 */
-
-        int first_bucket = normalized_x1 / BUCKET_LENGTH;
-        int last_bucket = normalized_x2 / BUCKET_LENGTH;
+    darray_clear(tier->sorted_obstacle);
+    darray_clear(tier->bucket_start);
+    darray_clear(tier->helper.obstacle_index);
+    darray_clear(tier->helper.bucket_index);
+    darray_clear(tier->helper.bucket_count);
+
+    /* find the number of columns and rows of the grid
+       the number of rows is 1 if we partition the x-axis only */
+    for(int j = 0; j < darray_length(tier->obstacle); j++) {
+        const obstacle_t* obstacle = tier->obstacle[j];
+        point2d_t position = obstacle_get_position(obstacle);
 
         /* checks and balances, just to be safe
            we should never need this for a typical Region of Interest */
-        if(last_bucket > MAX_BUCKETS - 1)
-            last_bucket = MAX_BUCKETS - 1;
+        int last_column = ((position.x + obstacle_get_width(obstacle) - 1) - min_x) / BUCKET_LENGTH;
+        if(last_column > MAX_BUCKETS - 1)
+            last_column = MAX_BUCKETS - 1;
 
-        /* update the number of buckets
-           we expect this to be a small integer
+        int last_row = tier->use_2d_grid ? ((position.y + obstacle_get_height(obstacle) - 1) - min_y) / BUCKET_LENGTH : 0;
+        if(last_row > MAX_ROWS - 1)
+            last_row = MAX_ROWS - 1;
+
+        /* we expect these to be small integers
            the initial bucket of the obstacle map is zero */
-        if(last_bucket + 1 > number_of_buckets)
-            number_of_buckets = last_bucket + 1;
+        if(last_column + 1 > number_of_columns)
+            number_of_columns = last_column + 1;
+        if(last_row + 1 > number_of_rows)
+            number_of_rows = last_row + 1;
+    }
+
+    int number_of_buckets = number_of_columns * number_of_rows;
+
+    /* for each obstacle j, normalize its position and find all relevant buckets */
+    for(int j = 0; j < darray_length(tier->obstacle); j++) {
+        const obstacle_t* obstacle = tier->obstacle[j];
+        point2d_t position = obstacle_get_position(obstacle);
+        int width = obstacle_get_width(obstacle);
+        int height = obstacle_get_height(obstacle);
 
-        /* associate obstacle j with buckets in { b | first_bucket <= b <= last_bucket } */
-        for(int b = first_bucket; b <= last_bucket; b++) {
-            darray_push(obstaclemap->helper.obstacle_index, j);
-            darray_push(obstaclemap->helper.bucket_index, b);
+        /* the buckets of each layer are stored contiguously */
+        int layer_offset = (int)obstacle_get_layer(obstacle) * number_of_buckets;
+
+        int normalized_x1 = position.x - min_x; /* never negative because min_x <= x */
+        int normalized_x2 = (position.x + width - 1) - min_x; /* width >= 1 */
+
+        int first_column = normalized_x1 / BUCKET_LENGTH;
+        int last_column = min(normalized_x2 / BUCKET_LENGTH, number_of_columns - 1);
+
+        int first_row = 0, last_row = 0;
+        if(tier->use_2d_grid) {
+            int normalized_y1 = position.y - min_y; /* never negative because min_y <= y */
+            int normalized_y2 = (position.y + height - 1) - min_y; /* height >= 1 */
+
+            first_row = normalized_y1 / BUCKET_LENGTH;
+            last_row = min(normalized_y2 / BUCKET_LENGTH, number_of_rows - 1);
+        }
+
+        /* associate obstacle j with the buckets of the rectangle of the grid
+           [first_column, last_column] x [first_row, last_row], row by row */
+        for(int r = first_row; r <= last_row; r++) {
+            for(int c = first_column; c <= last_column; c++) {
+                darray_push(tier->helper.obstacle_index, j);
+                darray_push(tier->helper.bucket_index, layer_offset + r * number_of_columns + c);
+            }
         }
     }
 
     /* initialize bucket_count[] with zeros */
-    for(int b = 0; b < number_of_buckets; b++)
-        darray_push(obstaclemap->helper.bucket_count, 0);
+    for(int b = 0; b < NUMBER_OF_LAYERS * number_of_buckets; b++)
+        darray_push(tier->helper.bucket_count, 0);
 
     /* initialize sorted_obstacle[] */
-    for(int i = 0; i < darray_length(obstaclemap->helper.obstacle_index); i++)
-        darray_push(obstaclemap->sorted_obstacle, NULL);
+    for(int i = 0; i < darray_length(tier->helper.obstacle_index); i++)
+        darray_push(tier->sorted_obstacle, NULL);
 
     /* count the number of obstacles in each bucket */
-    for(int i = 0; i < darray_length(obstaclemap->helper.bucket_index); i++) {
-        int b = obstaclemap->helper.bucket_index[i];
-        obstaclemap->helper.bucket_count[b]++;
+    for(int i = 0; i < darray_length(tier->helper.bucket_index); i++) {
+        int b = tier->helper.bucket_index[i];
+        tier->helper.bucket_count[b]++;
     }
 
     /* compute the cumulative sum of bucket_count[] in-place
        we no longer need the original values */
-    for(int b = 1; b < number_of_buckets; b++)
-        obstaclemap->helper.bucket_count[b] += obstaclemap->helper.bucket_count[b-1];
+    for(int b = 1; b < NUMBER_OF_LAYERS * number_of_buckets; b++)
+        tier->helper.bucket_count[b] += tier->helper.bucket_count[b-1];
 
     /* copy that cumulative sum to bucket_start[] for later use
        we make sure that the first entry is zero for convenience */
-    darray_push(obstaclemap->bucket_start, 0);
-    for(int b = 0; b < number_of_buckets; b++)
-        darray_push(obstaclemap->bucket_start, obstaclemap->helper.bucket_count[b]);
+    darray_push(tier->bucket_start, 0);
+    for(int b = 0; b < NUMBER_OF_LAYERS * number_of_buckets; b++)
+        darray_push(tier->bucket_start, tier->helper.bucket_count[b]);
 
     /* fill sorted_obstacle[] with Counting Sort */
-    for(int i = darray_length(obstaclemap->helper.obstacle_index) - 1; i >= 0; i--) {
-        int j = obstaclemap->helper.obstacle_index[i];
-        int b = obstaclemap->helper.bucket_index[i];
-        int k = --obstaclemap->helper.bucket_count[b];
-        obstaclemap->sorted_obstacle[k] = obstaclemap->obstacle[j];
+    for(int i = darray_length(tier->helper.obstacle_index) - 1; i >= 0; i--) {
+        int j = tier->helper.obstacle_index[i];
+        int b = tier->helper.bucket_index[i];
+        int k = --tier->helper.bucket_count[b];
+        tier->sorted_obstacle[k] = tier->obstacle[j];
     }
 
     /* update the number of buckets in the structure
        and lock the obstacle map */
-    obstaclemap->number_of_buckets = number_of_buckets;
-    obstaclemap->is_locked = true;
+    tier->number_of_buckets = number_of_buckets;
+    tier->number_of_columns = number_of_columns;
+    tier->number_of_rows = number_of_rows;
+    tier->is_locked = true;
 }
 
-/*
- * obstaclemap_get_best_obstacle_at()
- * Gets the "best" obstacle that hits a sensor, given a movmode_t and a layer
- * This routine assumes that the obstacle map is already built
- * It returns NULL if no hitting obstacle is found
- */
-const obstacle_t* obstaclemap_get_best_obstacle_at(const obstaclemap_t *obstaclemap, int x1, int y1, int x2, int y2, movmode_t mm, obstaclelayer_t layer_filter)
+/* the best obstacle of a tier that hits a sensor. We expect x1 <= x2 and y1 <= y2 */
+const obstacle_t* tier_get_best_obstacle_at(const obstaclemaptier_t* tier, int x1, int y1, int x2, int y2, movmode_t mm, obstaclelayer_t layer_filter)
 {
     /*
     ************************************************************
     *** This routine is highly demanded and must be fast !!! ***
     ************************************************************
     */
-    int begin, end;
+    int begin, end, first_row, last_row;
     const obstacle_t *best = NULL;
+    obstaclelayer_t layer[NUMBER_OF_LAYERS];
+    int layer_count = relevant_layers(layer_filter, layer);
 
-    /* validate the input */
-    if(x1 > x2 || y1 > y2)
-        return NULL;
-
-    /* find the limits of the partition */
-    if(!find_partition_limits(obstaclemap, x1, x2, &begin, &end))
+    /* find the relevant rows */
+    if(!find_row_limits(tier, y1, y2, &first_row, &last_row))
         return NULL; /* invalid partition */
 
-    /* find the best obstacle */
-    for(int j = begin; j < end; j++) { /* so simple and efficient!!! ;) */
-        const obstacle_t *obstacle = obstaclemap->sorted_obstacle[j];
+    for(int row = first_row; row <= last_row; row++) {
+        for(int l = 0; l < layer_count; l++) {
+
+            /* find the limits of the partition */
+            if(!find_partition_limits(tier, x1, x2, row, layer[l], &begin, &end))
+                return NULL; /* invalid partition */
+
+            /* find the best obstacle */
+            for(int j = begin; j < end; j++) { /* so simple and efficient!!! ;) */
+                const obstacle_t *obstacle = tier->sorted_obstacle[j];
 
-        if(!ignore_obstacle(obstacle, layer_filter) && obstacle_got_collision(obstacle, x1, y1, x2, y2))
-            best = pick_best_obstacle(obstacle, best, x1, y1, x2, y2, mm);
+                if(obstacle_got_collision(obstacle, x1, y1, x2, y2))
+                    best = pick_best_obstacle(obstacle, best, x1, y1, x2, y2, mm);
+            }
+
+        }
     }
 
     /* done! */
     return best;
 }
 
-/*
- * obstaclemap_obstacle_exists()
- * Checks if an obstacle exists at (x,y)
- */
-bool obstaclemap_obstacle_exists(const obstaclemap_t* obstaclemap, int x, int y, obstaclelayer_t layer_filter)
+/* picks the best obstacles of a tier for multiple sensors.
+   query[i].best is updated for each i; it may be initially set */
+void tier_get_best_obstacles_at(const obstaclemaptier_t* tier, obstaclemap_query_t* query, int query_count, movmode_t mm, obstaclelayer_t layer_filter)
+{
+    int x1 = WORLD_LIMIT, y1 = WORLD_LIMIT;
+    int x2 = -WORLD_LIMIT, y2 = -WORLD_LIMIT;
+    int begin, end, first_row, last_row;
+    obstaclelayer_t layer[NUMBER_OF_LAYERS];
+    int layer_count = relevant_layers(layer_filter, layer);
+
+    /* find the bounding box of the sensors */
+    for(int i = 0; i < query_count; i++) {
+        if(is_valid_query(&query[i])) {
+            x1 = min(x1, query[i].x1);
+            y1 = min(y1, query[i].y1);
+            x2 = max(x2, query[i].x2);
+            y2 = max(y2, query[i].y2);
+        }
+    }
+
+    /* find the relevant rows */
+    if(x1 > x2 || !find_row_limits(tier, y1, y2, &first_row, &last_row))
+        return; /* no valid queries or invalid partition */
+
+    for(int row = first_row; row <= last_row; row++) {
+        for(int l = 0; l < layer_count; l++) {
+
+            /* find the limits of the partition */
+            if(!find_partition_limits(tier, x1, x2, row, layer[l], &begin, &end))
+                return; /* invalid partition */
+
+            /* scan the obstacles once for all sensors */
+            for(int j = begin; j < end; j++) {
+                const obstacle_t *obstacle = tier->sorted_obstacle[j];
+
+                for(int i = 0; i < query_count; i++) {
+                    obstaclemap_query_t* q = &query[i];
+
+                    if(is_valid_query(q) && obstacle_got_collision(obstacle, q->x1, q->y1, q->x2, q->y2))
+                        q->best = pick_best_obstacle(obstacle, q->best, q->x1, q->y1, q->x2, q->y2, mm);
+                }
+            }
+
+        }
+    }
+}
+
+/* checks if an obstacle of a tier exists at (x,y) */
+bool tier_obstacle_exists(const obstaclemaptier_t* tier, int x, int y, obstaclelayer_t layer_filter)
 {
-    int begin, end;
+    int begin, end, row;
+    obstaclelayer_t layer[NUMBER_OF_LAYERS];
+    int layer_count = relevant_layers(layer_filter, layer);
 
-    /* find the limits of the partition */
-    if(!find_partition_limits(obstaclemap, x, x, &begin, &end))
+    /* find the relevant row */
+    if(!find_row_limits(tier, y, y, &row, &row))
         return false; /* invalid partition */
 
-    /* search for an obstacle */
-    for(int j = begin; j < end; j++) {
-        const obstacle_t *obstacle = obstaclemap->sorted_obstacle[j];
+    for(int l = 0; l < layer_count; l++) {
+
+        /* find the limits of the partition */
+        if(!find_partition_limits(tier, x, x, row, layer[l], &begin, &end))
+            return false; /* invalid partition */
+
+        /* search for an obstacle */
+        for(int j = begin; j < end; j++) {
+            const obstacle_t *obstacle = tier->sorted_obstacle[j];
+
+            if(obstacle_got_collision(obstacle, x, y, x, y))
+                return true;
+        }
 
-        if(!ignore_obstacle(obstacle, layer_filter) && obstacle_got_collision(obstacle, x, y, x, y))
-            return true;
     }
 
     /* not found */
     return false;
 }
 
-/*
- * obstaclemap_solid_exists()
- * Checks if a solid obstacle exists at (x,y)
- */
-bool obstaclemap_solid_exists(const obstaclemap_t* obstaclemap, int x, int y, obstaclelayer_t layer_filter)
+/* checks if a solid obstacle of a tier exists at (x,y) */
+bool tier_solid_exists(const obstaclemaptier_t* tier, int x, int y, obstaclelayer_t layer_filter)
 {
-    int begin, end;
+    int begin, end, row;
+    obstaclelayer_t layer[NUMBER_OF_LAYERS];
+    int layer_count = relevant_layers(layer_filter, layer);
 
-    /* find the limits of the partition */
-    if(!find_partition_limits(obstaclemap, x, x, &begin, &end))
+    /* find the relevant row */
+    if(!find_row_limits(tier, y, y, &row, &row))
         return false; /* invalid partition */
 
-    /* search for a solid obstacle */
-    for(int j = begin; j < end; j++) {
-        const obstacle_t *obstacle = obstaclemap->sorted_obstacle[j];
+    for(int l = 0; l < layer_count; l++) {
+
+        /* find the limits of the partition */
+        if(!find_partition_limits(tier, x, x, row, layer[l], &begin, &end))
+            return false; /* invalid partition */
+
+        /* search for a solid obstacle */
+        for(int j = begin; j < end; j++) {
+            const obstacle_t *obstacle = tier->sorted_obstacle[j];
+
+            if(obstacle_got_collision(obstacle, x, y, x, y) && obstacle_is_solid(obstacle))
+                return true;
+        }
 
-        if(!ignore_obstacle(obstacle, layer_filter) && obstacle_got_collision(obstacle, x, y, x, y) && obstacle_is_solid(obstacle))
-            return true;
     }
 
     /* not found */
     return false;
 }
 
-/*
- * obstaclemap_find_ground()
- * Find the tallest ground based on the specified parameters
- * We expect x1 <= x2 and y1 <= y2
- * Returns NULL if there is no ground
- */
-const obstacle_t* obstaclemap_find_ground(const obstaclemap_t *obstaclemap, int x1, int y1, int x2, int y2, obstaclelayer_t layer_filter, grounddir_t ground_direction, int* out_ground_position)
+/* checks if solid obstacles of a tier exist at multiple points.
+   point[i].is_solid is updated for each i; it may be initially set */
+void tier_solids_exist(const obstaclemaptier_t* tier, obstaclemap_point_t* point, int point_count, obstaclelayer_t layer_filter)
+{
+    int x1 = WORLD_LIMIT, y1 = WORLD_LIMIT;
+    int x2 = -WORLD_LIMIT, y2 = -WORLD_LIMIT;
+    int begin, end, first_row, last_row;
+    obstaclelayer_t layer[NUMBER_OF_LAYERS];
+    int layer_count = relevant_layers(layer_filter, layer);
+
+    /* find the bounding box of the points that are still unresolved */
+    for(int i = 0; i < point_count; i++) {
+        if(!point[i].is_solid) {
+            x1 = min(x1, point[i].x);
+            y1 = min(y1, point[i].y);
+            x2 = max(x2, point[i].x);
+            y2 = max(y2, point[i].y);
+        }
+    }
+
+    /* find the relevant rows */
+    if(x1 > x2 || !find_row_limits(tier, y1, y2, &first_row, &last_row))
+        return; /* nothing to do or invalid partition */
+
+    for(int row = first_row; row <= last_row; row++) {
+        for(int l = 0; l < layer_count; l++) {
+
+            /* find the limits of the partition */
+            if(!find_partition_limits(tier, x1, x2, row, layer[l], &begin, &end))
+                return; /* invalid partition */
+
+            /* scan the obstacles once for all points */
+            for(int j = begin; j < end; j++) {
+                const obstacle_t *obstacle = tier->sorted_obstacle[j];
+
+                if(!obstacle_is_solid(obstacle))
+                    continue;
+
+                for(int i = 0; i < point_count; i++) {
+                    obstaclemap_point_t* p = &point[i];
+
+                    if(!p->is_solid && obstacle_got_collision(obstacle, p->x, p->y, p->x, p->y))
+                        p->is_solid = true;
+                }
+            }
+
+        }
+    }
+}
+
+/* computes the occupancy bitmap of a region of a tier. The cells of grid[]
+   that are already set are kept */
+void tier_solid_grid(const obstaclemaptier_t* tier, int x, int y, int columns, int rows, int cell_size, obstaclelayer_t layer_filter, bool* grid)
 {
-    int begin, end;
+    int begin, end, first_row, last_row;
+    obstaclelayer_t layer[NUMBER_OF_LAYERS];
+    int layer_count = relevant_layers(layer_filter, layer);
+
+    /* the region */
+    int x2 = x + columns * cell_size - 1;
+    int y2 = y + rows * cell_size - 1;
+
+    /* find the relevant rows */
+    if(!find_row_limits(tier, y, y2, &first_row, &last_row))
+        return; /* invalid partition */
+
+    for(int row = first_row; row <= last_row; row++) {
+        for(int l = 0; l < layer_count; l++) {
+
+            /* find the limits of the partition */
+            if(!find_partition_limits(tier, x, x2, row, layer[l], &begin, &end))
+                return; /* invalid partition */
+
+            /* test each obstacle against the cells overlapped by its bounding box only */
+            for(int j = begin; j < end; j++) {
+                const obstacle_t *obstacle = tier->sorted_obstacle[j];
+
+                if(!obstacle_is_solid(obstacle))
+                    continue;
+
+                point2d_t position = obstacle_get_position(obstacle);
+                int left = position.x, right = position.x + obstacle_get_width(obstacle) - 1;
+                int top = position.y, bottom = position.y + obstacle_get_height(obstacle) - 1;
+
+                if(right < x || left > x2 || bottom < y || top > y2)
+                    continue;
+
+                int first_column = (max(left, x) - x) / cell_size;
+                int last_column = (min(right, x2) - x) / cell_size;
+                int first_cell_row = (max(top, y) - y) / cell_size;
+                int last_cell_row = (min(bottom, y2) - y) / cell_size;
+
+                for(int r = first_cell_row; r <= last_cell_row; r++) {
+                    for(int c = first_column; c <= last_column; c++) {
+                        bool* cell = &grid[r * columns + c];
+                        int cell_x = x + c * cell_size, cell_y = y + r * cell_size;
+
+                        if(!*cell && obstacle_got_collision(obstacle, cell_x, cell_y, cell_x + cell_size - 1, cell_y + cell_size - 1))
+                            *cell = true;
+                    }
+                }
+            }
+
+        }
+    }
+}
+
+/* the tallest ground of a tier. We expect x1 <= x2 and y1 <= y2 */
+const obstacle_t* tier_find_ground(const obstaclemaptier_t* tier, int x1, int y1, int x2, int y2, obstaclelayer_t layer_filter, grounddir_t ground_direction, int* out_ground_position)
+{
+    int begin, end, first_row, last_row;
     const obstacle_t *tallest_ground = NULL;
+    obstaclelayer_t layer[NUMBER_OF_LAYERS];
+    int layer_count = relevant_layers(layer_filter, layer);
 
-    /* validate the input */
-    if(x1 > x2 || y1 > y2)
+    /* find the relevant rows */
+    if(!find_row_limits(tier, y1, y2, &first_row, &last_row))
         return NULL;
 
-    /* find the limits of the partition */
-    if(!find_partition_limits(obstaclemap, x1, x2, &begin, &end))
-        return NULL;
+    for(int row = first_row; row <= last_row; row++) {
+        for(int l = 0; l < layer_count; l++) {
+
+            /* find the limits of the partition */
+            if(!find_partition_limits(tier, x1, x2, row, layer[l], &begin, &end))
+                return NULL;
+
+            /* find the tallest ground */
+            for(int j = begin; j < end; j++) {
+                const obstacle_t *obstacle = tier->sorted_obstacle[j];
 
-    /* find the tallest ground */
-    for(int j = begin; j < end; j++) {
-        const obstacle_t *obstacle = obstaclemap->sorted_obstacle[j];
+                if(obstacle_got_collision(obstacle, x1, y1, x2, y2))
+                    tallest_ground = pick_tallest_ground(obstacle, tallest_ground, x1, y1, x2, y2, ground_direction, out_ground_position);
+            }
 
-        if(!ignore_obstacle(obstacle, layer_filter) && obstacle_got_collision(obstacle, x1, y1, x2, y2))
-            tallest_ground = pick_tallest_ground(obstacle, tallest_ground, x1, y1, x2, y2, ground_direction, out_ground_position);
+        }
     }
 
     /* done! */
     return tallest_ground;
 }
 
+/* the first solid obstacle of a tier along a segment. Only the obstacles that
+   are hit before *inout_step are considered; *inout_step is updated on a hit */
+const obstacle_t* tier_cast_ray(const obstaclemaptier_t* tier, int x1, int y1, int x2, int y2, obstaclelayer_t layer_filter, int steps, int* inout_step)
+{
+    int begin, end, first_row, last_row;
+    int left = min(x1, x2), right = max(x1, x2);
+    int top = min(y1, y2), bottom = max(y1, y2);
+    const obstacle_t* closest = NULL;
+    obstaclelayer_t layer[NUMBER_OF_LAYERS];
+    int layer_count = relevant_layers(layer_filter, layer);
+
+    /* nothing to do */
+    if(steps == 0)
+        return NULL;
 
+    /* find the relevant rows */
+    if(!find_row_limits(tier, top, bottom, &first_row, &last_row))
+        return NULL;
 
-/* private methods */
+    for(int row = first_row; row <= last_row; row++) {
+        for(int l = 0; l < layer_count; l++) {
+
+            /* find the limits of the partition that contains the segment */
+            if(!find_partition_limits(tier, left, right, row, layer[l], &begin, &end))
+                return NULL;
+
+            /* march along the segment for each candidate obstacle */
+            for(int j = begin; j < end; j++) {
+                const obstacle_t *obstacle = tier->sorted_obstacle[j];
+
+                if(!obstacle_is_solid(obstacle))
+                    continue;
+                else if(!obstacle_got_collision(obstacle, left, top, right, bottom))
+                    continue;
+                else if(obstacle_got_collision(obstacle, x1, y1, x1, y1))
+                    continue; /* we're already inside this one */
+
+                for(int k = 1; k < *inout_step; k++) {
+                    int x = x1 + (x2 - x1) * k / steps;
+                    int y = y1 + (y2 - y1) * k / steps;
 
-/* given an interval I = [x1,x2], find maximal indices begin and end of sorted_obstacle[] such that
-   sorted_obstacle[j] intersects with I for all j | begin <= j < end. Returns true on success. */
-bool find_partition_limits(const obstaclemap_t* obstaclemap, int x1, int x2, int* begin, int* end)
+                    if(obstacle_got_collision(obstacle, x, y, x, y)) {
+                        *inout_step = k;
+                        closest = obstacle;
+                        break;
+                    }
+                }
+            }
+
+        }
+    }
+
+    /* done! */
+    return closest;
+}
+
+/* given an interval I = [x1,x2], a row of the grid and a layer, find maximal indices begin and
+   end of sorted_obstacle[] such that sorted_obstacle[j] intersects with I and belongs to the
+   layer for all j | begin <= j < end. Returns true on success. */
+bool find_partition_limits(const obstaclemaptier_t* tier, int x1, int x2, int row, obstaclelayer_t layer, int* begin, int* end)
 {
-    int min_x = obstaclemap->min_x;
-    int number_of_buckets = obstaclemap->number_of_buckets;
+    int min_x = tier->min_x;
+    int number_of_columns = tier->number_of_columns;
 
     /* find the bucket range */
     int normalized_x1 = x1 - min_x;
@@ -441,24 +997,26 @@ bool find_partition_limits(const obstaclemap_t* obstaclemap, int x1, int x2, int
     /* clip */
     if(first_bucket < 0)
         first_bucket = 0;
-    if(last_bucket >= number_of_buckets)
-        last_bucket = number_of_buckets - 1;
+    if(last_bucket >= number_of_columns)
+        last_bucket = number_of_columns - 1;
 
     /* validate */
     if(first_bucket > last_bucket)
-        return false; /* invalid [x1,x2] interval or number_of_buckets == 0 */
+        return false; /* invalid [x1,x2] interval or number_of_columns == 0 */
 
     /*
 
-    Now that we have 0 <= first_bucket <= last_bucket < number_of_buckets,
-    we find the relevant indices of sorted_obstacle[].
+    Now that we have 0 <= first_bucket <= last_bucket < number_of_columns,
+    we find the relevant indices of sorted_obstacle[]. The buckets of a row
+    of a layer are contiguous.
 
-    Reminder: bucket_start[] has (number_of_buckets + 1) elements
-              the first element is always zero!
+    Reminder: bucket_start[] has (NUMBER_OF_LAYERS * number_of_buckets + 1)
+              elements; the first element is always zero!
 
     */
-    *begin = obstaclemap->bucket_start[first_bucket];
-    *end = obstaclemap->bucket_start[last_bucket + 1];
+    int offset = (int)layer * tier->number_of_buckets + row * tier->number_of_columns;
+    *begin = tier->bucket_start[offset + first_bucket];
+    *end = tier->bucket_start[offset + last_bucket + 1];
 
 #if WANT_PERFORMANCE_REPORT
     /*
@@ -473,11 +1031,11 @@ bool find_partition_limits(const obstaclemap_t* obstaclemap, int x1, int x2, int
 
     /* number of iterations with partitioning vs brute force */
     int partition = (*end) - (*begin);
-    int brute_force = darray_length(obstaclemap->obstacle); /* test all obstacles */
+    int brute_force = darray_length(tier->obstacle); /* test all obstacles */
 
     /* compute stats */
     float fraction = brute_force > 0 ? (float)partition / (float)brute_force : 0.0f;
-    float bucket_ratio = brute_force > 0 ? (float)number_of_buckets / (float)brute_force : 0.0f;
+    float bucket_ratio = brute_force > 0 ? (float)tier->number_of_buckets / (float)brute_force : 0.0f;
     static const float alpha = 0.99f;
     static float smooth_fraction = 1.0f;
     smooth_fraction = smooth_fraction * alpha + (1.0f - alpha) * fraction;
@@ -489,11 +1047,12 @@ bool find_partition_limits(const obstaclemap_t* obstaclemap, int x1, int x2, int
 
     /* report on screen */
     video_showmessage(
-        "part=%d vs brute=%d | speedup=%.1fx | buckets=%d %.0f%%",
+        "part=%d vs brute=%d | speedup=%.1fx | buckets=%dx%d %.0f%%",
         partition,
         brute_force,
         speedup,
-        number_of_buckets,
+        tier->number_of_columns,
+        tier->number_of_rows,
         100.0f * bucket_ratio
     );
 #endif
@@ -502,6 +1061,32 @@ bool find_partition_limits(const obstaclemap_t* obstaclemap, int x1, int x2, int
     return true;
 }
 
+/* given an interval I = [y1,y2], find the range of rows of the grid that intersect I.
+   Returns true on success. */
+bool find_row_limits(const obstaclemaptier_t* tier, int y1, int y2, int* first_row, int* last_row)
+{
+    int number_of_rows = tier->number_of_rows;
+
+    /* a single row */
+    if(!tier->use_2d_grid) {
+        *first_row = *last_row = 0;
+        return number_of_rows > 0;
+    }
+
+    /* find the row range */
+    *first_row = (y1 - tier->min_y) / BUCKET_LENGTH;
+    *last_row = (y2 - tier->min_y) / BUCKET_LENGTH;
+
+    /* clip */
+    if(*first_row < 0)
+        *first_row = 0;
+    if(*last_row >= number_of_rows)
+        *last_row = number_of_rows - 1;
+
+    /* validate */
+    return *first_row <= *last_row; /* false if invalid [y1,y2] or number_of_rows == 0 */
+}
+
 /* considering that the sensor collides with both a and b, which one should we pick? */
 /* we know that x1 <= x2 and y1 <= y2; these values already come rotated according to the movmode */
 const obstacle_t* pick_best_obstacle(const obstacle_t *a, const obstacle_t *b, int x1, int y1, int x2, int y2, movmode_t mm)
@@ -628,9 +1213,50 @@ const obstacle_t* pick_tallest_ground(const obstacle_t* a, const obstacle_t* b,
     return *out_gnd == ha ? a : b;
 }
 
-/* whether or not the given obstacle should be ignored, given a layer filter */
-bool ignore_obstacle(const obstacle_t *obstacle, obstaclelayer_t layer_filter)
+/* pick the tallest ground between a and b, given their ground positions. a and b may be NULL */
+const obstacle_t* merge_grounds(const obstacle_t* a, int gnd_a, const obstacle_t* b, int gnd_b, grounddir_t ground_direction, int* out_gnd)
 {
-    obstaclelayer_t obstacle_layer = obstacle_get_layer(obstacle);
-    return layer_filter != OL_DEFAULT && obstacle_layer != OL_DEFAULT && obstacle_layer != layer_filter;
+    /* check for NULLs */
+    if(b == NULL) {
+        if(a != NULL)
+            *out_gnd = gnd_a;
+        return a;
+    }
+
+    if(a == NULL) {
+        *out_gnd = gnd_b;
+        return b;
+    }
+
+    /* which obstacle is the tallest? */
+    switch(ground_direction) {
+        case GD_DOWN:   *out_gnd = min(gnd_a, gnd_b); break;
+        case GD_UP:     *out_gnd = max(gnd_a, gnd_b); break;
+        case GD_RIGHT:  *out_gnd = min(gnd_a, gnd_b); break;
+        case GD_LEFT:   *out_gnd = max(gnd_a, gnd_b); break;
+    }
+    return *out_gnd == gnd_a ? a : b;
+}
+
+/* a query is valid if x1 <= x2 and y1 <= y2 */
+bool is_valid_query(const obstaclemap_query_t* query)
+{
+    return query->x1 <= query->x2 && query->y1 <= query->y2;
+}
+
+/* the layers whose obstacles should be inspected, given a layer filter. Obstacles
+   of the default layer are always inspected; the default filter inspects all layers.
+   The layers are written to layer[] and their number is returned */
+int relevant_layers(obstaclelayer_t layer_filter, obstaclelayer_t layer[])
+{
+    if(layer_filter == OL_DEFAULT) {
+        layer[0] = OL_DEFAULT;
+        layer[1] = OL_GREEN;
+        layer[2] = OL_YELLOW;
+        return 3;
+    }
+
+    layer[0] = OL_DEFAULT;
+    layer[1] = layer_filter;
+    return 2;
 }
\ No newline at end of file
@@ -31,6 +31,8 @@ typedef struct obstaclemap_t obstaclemap_t;
 
 /* forward declarations */
 struct obstacle_t;
+struct obstaclemap_query_t;
+struct obstaclemap_point_t;
 enum obstaclelayer_t;
 enum movmode_t;
 enum grounddir_t;
@@ -41,13 +43,35 @@ obstaclemap_t* obstaclemap_destroy(obstaclemap_t *obstaclemap);
 
 /* building & clearing */
 void obstaclemap_add(obstaclemap_t *obstaclemap, const struct obstacle_t *obstacle); /* adds an obstacle to the map (you have to release it) */
+void obstaclemap_add_static(obstaclemap_t *obstaclemap, const struct obstacle_t *obstacle); /* adds an obstacle that doesn't move to the map; it's kept until obstaclemap_clear() */
 void obstaclemap_build(obstaclemap_t* obstaclemap); /* builds the internal data structure after adding all obstacles */
 void obstaclemap_clear(obstaclemap_t* obstaclemap); /* removes all obstacles from the obstacle map */
+void obstaclemap_clear_dynamic(obstaclemap_t* obstaclemap); /* removes all obstacles except the static ones */
+void obstaclemap_use_2d_grid(obstaclemap_t* obstaclemap, bool use_2d_grid); /* partition space along both axes (takes effect on the next build) */
+int obstaclemap_count(const obstaclemap_t* obstaclemap); /* number of obstacles in the map */
 
 /* collision detection */
 bool obstaclemap_obstacle_exists(const obstaclemap_t* obstaclemap, int x, int y, enum obstaclelayer_t layer_filter); /* checks if an obstacle exists at (x,y) */
 bool obstaclemap_solid_exists(const obstaclemap_t* obstaclemap, int x, int y, enum obstaclelayer_t layer_filter); /* checks if a solid obstacle exists at (x,y) */
+void obstaclemap_solids_exist(const obstaclemap_t* obstaclemap, struct obstaclemap_point_t* point, int point_count, enum obstaclelayer_t layer_filter); /* batched version of obstaclemap_solid_exists() */
+void obstaclemap_solid_grid(const obstaclemap_t* obstaclemap, int x, int y, int columns, int rows, int cell_size, enum obstaclelayer_t layer_filter, bool* grid); /* occupancy bitmap of a region; grid[] has columns * rows cells */
 const struct obstacle_t* obstaclemap_get_best_obstacle_at(const obstaclemap_t *obstaclemap, int x1, int y1, int x2, int y2, enum movmode_t mm, enum obstaclelayer_t layer_filter); /* x2 > x1 && y2 > y1; NULL may be returned */
+void obstaclemap_get_best_obstacles_at(const obstaclemap_t *obstaclemap, struct obstaclemap_query_t* query, int query_count, enum movmode_t mm, enum obstaclelayer_t layer_filter); /* batched version of obstaclemap_get_best_obstacle_at() */
 const struct obstacle_t* obstaclemap_find_ground(const obstaclemap_t *obstaclemap, int x1, int y1, int x2, int y2, enum obstaclelayer_t layer_filter, enum grounddir_t ground_direction, int* out_ground_position); /* x2 > x1 && y2 > y1; returns NULL if there is no ground */
+const struct obstacle_t* obstaclemap_cast_ray(const obstaclemap_t *obstaclemap, int x1, int y1, int x2, int y2, enum obstaclelayer_t layer_filter, int* out_step, int* out_steps); /* swept query: the first solid obstacle along the segment from (x1,y1) to (x2,y2); NULL if there is none */
+
+/* a query of obstaclemap_get_best_obstacles_at() */
+typedef struct obstaclemap_query_t obstaclemap_query_t;
+struct obstaclemap_query_t {
+    int x1, y1, x2, y2; /* input: a sensor in world space; the query is skipped unless x2 >= x1 && y2 >= y1 */
+    const struct obstacle_t* best; /* output: the best obstacle or NULL */
+};
+
+/* a point of obstaclemap_solids_exist() */
+typedef struct obstaclemap_point_t obstaclemap_point_t;
+struct obstaclemap_point_t {
+    int x, y; /* input: a point in world space */
+    bool is_solid; /* output: is there a solid obstacle at (x,y)? */
+};
 
 #endif
@@ -23,6 +23,7 @@
 #include "sensor.h"
 #include "obstaclemap.h"
 #include "obstacle.h"
+#include "collisionmask.h"
 #include "../core/image.h"
 #include "../core/color.h"
 #include "../core/video.h"
@@ -30,8 +31,13 @@
 #include "../core/timer.h"
 #include "../core/engine.h"
 #include "../core/global.h"
+#include "../core/jobs.h"
+#include "../core/logfile.h"
 #include "../util/numeric.h"
 #include "../util/util.h"
+#include "../util/darray.h"
+#include "../util/profiler.h"
+#include "../util/snapshot.h"
 
 typedef struct physicsactorobserverlist_t physicsactorobserverlist_t;
 
@@ -130,6 +136,17 @@ struct physicsactor_t
     double reference_time; /* used in fixed_update */
     double fixed_time;
     bool delayed_jump;
+
+    double prev_xpos; /* position at the previous step of the simulation */
+    double prev_ypos;
+    double interpolation; /* in [0,1]: how far the engine is between the previous and the current step */
+
+    bool lightweight; /* run a cheaper, less accurate simulation at a reduced rate */
+    int lightweight_counter; /* framesteps since the last step of the lightweight simulation */
+    double lightweight_time; /* time accumulated since the last step of the lightweight simulation */
+
+    bool defer_events; /* queue the events instead of notifying the observers right away */
+    DARRAY(physicsactorevent_t, deferred_event); /* events raised in a worker thread. It grows as needed */
 };
 
 
@@ -144,6 +161,15 @@ struct physicsactorobserverlist_t
 static physicsactorobserverlist_t* create_observer(void (*callback)(physicsactor_t*,physicsactorevent_t,void*), void* context, physicsactorobserverlist_t* next);
 static physicsactorobserverlist_t* destroy_observers(physicsactorobserverlist_t* list);
 static void notify_observers(physicsactor_t* pa, physicsactorevent_t event);
+static void notify_deferred_events(physicsactor_t* pa);
+
+/* parallel updates */
+typedef struct updatejob_t updatejob_t;
+struct updatejob_t {
+    physicsactor_t** actors;
+    const obstaclemap_t* obstaclemap;
+};
+static void update_range(int begin, int end, void* context);
 
 
 /* helpers */
@@ -154,6 +180,7 @@ static void render_ball(v2d_t sensor_position, int radius, color_t color, v2d_t
 static char pick_the_best_floor(const physicsactor_t *pa, const obstacle_t *a, const obstacle_t *b, const sensor_t *a_sensor, const sensor_t *b_sensor);
 static char pick_the_best_ceiling(const physicsactor_t *pa, const obstacle_t *c, const obstacle_t *d, const sensor_t *c_sensor, const sensor_t *d_sensor);
 static const obstacle_t* find_ground_with_extended_sensor(const physicsactor_t* pa, const obstaclemap_t* obstaclemap, const sensor_t* sensor, int extended_sensor_length, int* out_ground_position);
+static double sweep_walls(const physicsactor_t* pa, const obstaclemap_t* obstaclemap, double dx, double dy);
 static bool is_smashed(const physicsactor_t* pa, const obstaclemap_t* obstaclemap);
 static bool got_moving_obstacle_at_sensor(const physicsactor_t* pa, const obstaclemap_t* obstaclemap, const sensor_t* s);
 static bool is_on_moving_platform(const physicsactor_t* pa, const obstaclemap_t* obstaclemap);
@@ -177,8 +204,14 @@ static const grounddir_t _MM_TO_GD[4] = {
 #define CLOUD_HEIGHT            16
 #define TARGET_FPS              60.0 /* target framerate of the simulation */
 #define HARD_CAPSPEED           (24.0 * TARGET_FPS)
+#define MAX_STEPS_PER_FRAME     4 /* fixed rate: run at most this many steps per framestep, so we don't spiral down when the engine is slow */
+#define LIGHTWEIGHT_INTERVAL    2 /* lightweight mode: run one (larger) step of the simulation every this many framesteps */
+
+static double simulation_rate = 0.0; /* fixed rate of the simulation in Hz; zero means lockstep with the engine */
 
 static void fixed_update(physicsactor_t *pa, const obstaclemap_t *obstaclemap, double dt);
+static void fixed_rate_update(physicsactor_t *pa, const obstaclemap_t *obstaclemap);
+static void lightweight_update(physicsactor_t *pa, const obstaclemap_t *obstaclemap);
 static void update_movmode(physicsactor_t* pa);
 static void update_sensors(physicsactor_t* pa, const obstaclemap_t* obstaclemap, obstacle_t const** const at_A, obstacle_t const** const at_B, obstacle_t const** const at_C, obstacle_t const** const at_D, obstacle_t const** const at_M, obstacle_t const** const at_N);
 
@@ -384,6 +417,14 @@ physicsactor_t* physicsactor_create(v2d_t position)
     pa->reference_time = 0.0;
     pa->fixed_time = 0.0;
     pa->delayed_jump = false;
+    pa->prev_xpos = pa->xpos;
+    pa->prev_ypos = pa->ypos;
+    pa->interpolation = 1.0;
+    pa->lightweight = false;
+    pa->lightweight_counter = 0;
+    pa->lightweight_time = 0.0;
+    pa->defer_events = false;
+    darray_init(pa->deferred_event);
 
     /* initialize the physics model */
     physicsactor_reset_model_parameters(pa);
@@ -461,10 +502,54 @@ physicsactor_t* physicsactor_destroy(physicsactor_t *pa)
 
     destroy_observers(pa->observers);
     input_destroy(pa->input);
+    darray_release(pa->deferred_event);
     free(pa);
     return NULL;
 }
 
+/* the dynamic state of a physics actor, in the order it's serialized.
+   Sensors, observers and the input device are not part of it */
+#define PHYSICSACTOR_STATE_FIELDS(X) \
+    X(state) X(xpos) X(ypos) X(dx) X(dy) X(xsp) X(ysp) X(gsp) \
+    X(movmode) X(angle) X(prev_angle) \
+    X(facing_right) X(midair) X(was_midair) X(touching_ceiling) \
+    X(acc) X(dec) X(frc) X(capspeed) X(topspeed) X(topyspeed) X(air) X(airdrag) \
+    X(jmp) X(jmprel) X(diejmp) X(hitjmp) X(grv) X(slp) X(chrg) \
+    X(rollfrc) X(rolldec) X(rolluphillslp) X(rolldownhillslp) \
+    X(rollthreshold) X(unrollthreshold) X(movethreshold) X(falloffthreshold) \
+    X(brakingthreshold) X(airdragthreshold) X(airdragxthreshold) X(chrgthreshold) X(waittime) \
+    X(charge_intensity) X(airdrag_coefficient) \
+    X(hlock_timer) X(jump_lock_timer) X(wait_timer) X(midair_timer) X(breathe_timer) \
+    X(winning_pose) X(want_to_detach_from_ground) X(unstable_angle_counter) X(layer) \
+    X(reference_time) X(fixed_time) X(delayed_jump) \
+    X(prev_xpos) X(prev_ypos) X(interpolation) \
+    X(lightweight_counter) X(lightweight_time)
+
+/*
+ * physicsactor_save_state()
+ * Write the dynamic state of the physics actor to a snapshot
+ */
+void physicsactor_save_state(const physicsactor_t *pa, snapshot_t *snapshot)
+{
+    #define SAVE_FIELD(field) snapshot_put(snapshot, pa->field);
+    PHYSICSACTOR_STATE_FIELDS(SAVE_FIELD)
+    #undef SAVE_FIELD
+}
+
+/*
+ * physicsactor_load_state()
+ * Read the dynamic state of the physics actor from a snapshot
+ */
+void physicsactor_load_state(physicsactor_t *pa, snapshot_t *snapshot)
+{
+    #define LOAD_FIELD(field) snapshot_get(snapshot, pa->field);
+    PHYSICSACTOR_STATE_FIELDS(LOAD_FIELD)
+    #undef LOAD_FIELD
+
+    /* events raised before the snapshot was taken are gone */
+    darray_clear(pa->deferred_event);
+}
+
 void physicsactor_reset_model_parameters(physicsactor_t* pa)
 {
     const double fpsmul = 60.0;
@@ -517,6 +602,18 @@ void physicsactor_update(physicsactor_t *pa, const obstaclemap_t *obstaclemap)
 {
     /* we run the simulation with a fixed timestep for better accuracy and consistency */
     const double FIXED_TIMESTEP = 1.0 / TARGET_FPS;
+
+    /* the actor is not being watched closely */
+    if(pa->lightweight) {
+        lightweight_update(pa, obstaclemap);
+        return;
+    }
+
+    /* decouple the simulation from the framerate of the engine */
+    if(simulation_rate > 0.0) {
+        fixed_rate_update(pa, obstaclemap);
+        return;
+    }
 #if 1
     /* advance the reference time */
     double dt = timer_get_delta();
@@ -586,6 +683,59 @@ void physicsactor_update(physicsactor_t *pa, const obstaclemap_t *obstaclemap)
 #endif
 }
 
+void physicsactor_set_simulation_rate(double rate)
+{
+    simulation_rate = max(0.0, rate);
+}
+
+double physicsactor_simulation_rate()
+{
+    return simulation_rate;
+}
+
+void physicsactor_set_lightweight(physicsactor_t *pa, bool lightweight)
+{
+    if(pa->lightweight == lightweight)
+        return;
+
+    pa->lightweight = lightweight;
+    pa->lightweight_counter = 0;
+    pa->lightweight_time = 0.0;
+}
+
+bool physicsactor_is_lightweight(const physicsactor_t *pa)
+{
+    return pa->lightweight;
+}
+
+void physicsactor_update_all(physicsactor_t** pa, int count, const obstaclemap_t *obstaclemap)
+{
+    /* nothing to parallelize? */
+    if(count <= 1 || jobs_thread_count() <= 1) {
+        for(int i = 0; i < count; i++)
+            physicsactor_update(pa[i], obstaclemap);
+        return;
+    }
+
+    /* the observers may touch the rest of the engine, so we notify them
+       in the main thread after the simulation. No new caches of the
+       collision masks are built while the workers are reading them */
+    for(int i = 0; i < count; i++)
+        pa[i]->defer_events = true;
+    collisionmask_begin_concurrent_reads();
+
+    /* update the physics actors in parallel */
+    updatejob_t job = { .actors = pa, .obstaclemap = obstaclemap };
+    jobs_parallel_for(count, 1, update_range, &job);
+
+    /* notify the observers in order */
+    collisionmask_end_concurrent_reads();
+    for(int i = 0; i < count; i++) {
+        pa[i]->defer_events = false;
+        notify_deferred_events(pa[i]);
+    }
+}
+
 void physicsactor_render_sensors(const physicsactor_t *pa, v2d_t camera_position)
 {
     v2d_t position = physicsactor_get_position(pa);
@@ -633,11 +783,26 @@ v2d_t physicsactor_get_position(const physicsactor_t *pa)
 
 void physicsactor_set_position(physicsactor_t *pa, v2d_t position)
 {
+    /* keep the previous step relative to the new position,
+       so that carried actors are still interpolated */
+    pa->prev_xpos += position.x - pa->xpos;
+    pa->prev_ypos += position.y - pa->ypos;
+
     /* converts from float to double */
     pa->xpos = position.x;
     pa->ypos = position.y;
 }
 
+v2d_t physicsactor_get_interpolated_position(const physicsactor_t *pa)
+{
+    double t = pa->interpolation;
+
+    return v2d_new(
+        pa->prev_xpos + (pa->xpos - pa->prev_xpos) * t,
+        pa->prev_ypos + (pa->ypos - pa->prev_ypos) * t
+    );
+}
+
 void physicsactor_lock_horizontally_for(physicsactor_t *pa, double seconds)
 {
     seconds = max(seconds, 0.0);
@@ -1055,12 +1220,94 @@ bool physicsactor_is_standing_on_platform(const physicsactor_t *pa, const obstac
  * ---------------------------------------
  */
 
+/* runs the simulation at a fixed rate, independent of the framerate of the engine.
+   The leftover time is used to interpolate the rendered position */
+void fixed_rate_update(physicsactor_t *pa, const obstaclemap_t *obstaclemap)
+{
+    const double FIXED_TIMESTEP = 1.0 / simulation_rate;
+    int steps = 0;
+
+    /* advance the reference time */
+    pa->reference_time += timer_get_delta();
+
+    /* a button may be first pressed in a framestep with no steps of the simulation */
+    if(pa->fixed_time + FIXED_TIMESTEP > pa->reference_time) {
+        pa->delayed_jump = pa->delayed_jump || input_button_pressed(pa->input, IB_FIRE1);
+    }
+    else if(pa->delayed_jump) {
+        input_simulate_button_press(pa->input, IB_FIRE1);
+        pa->delayed_jump = false;
+    }
+
+    /* run the simulation */
+    while(pa->fixed_time + FIXED_TIMESTEP <= pa->reference_time) {
+        pa->prev_xpos = pa->xpos;
+        pa->prev_ypos = pa->ypos;
+
+        fixed_update(pa, obstaclemap, FIXED_TIMESTEP);
+        pa->fixed_time += FIXED_TIMESTEP;
+
+        /* the buttons are first pressed only once per framestep */
+        input_discard_transitions(pa->input);
+
+        /* drop the backlog if the engine is too slow */
+        if(++steps >= MAX_STEPS_PER_FRAME) {
+            if(pa->fixed_time + FIXED_TIMESTEP <= pa->reference_time)
+                pa->fixed_time = pa->reference_time;
+            break;
+        }
+    }
+
+    /* interpolation factor */
+    double t = (pa->reference_time - pa->fixed_time) / FIXED_TIMESTEP;
+    pa->interpolation = clip01(t);
+}
+
+/* runs the simulation at a reduced rate, taking a larger step every
+   LIGHTWEIGHT_INTERVAL framesteps. This is cheaper but less accurate,
+   so it's meant for actors that the user can't see (e.g., off-screen
+   companions). The clocks of the regular modes are kept in sync, so
+   that we can switch back to them seamlessly */
+void lightweight_update(physicsactor_t *pa, const obstaclemap_t *obstaclemap)
+{
+    const double MAX_TIMESTEP = (double)LIGHTWEIGHT_INTERVAL / TARGET_FPS;
+    double dt = timer_get_delta();
+
+    /* advance the clocks */
+    pa->reference_time += dt;
+    pa->fixed_time = pa->reference_time;
+    pa->lightweight_time += dt;
+
+    /* a button may be first pressed in a framestep with no steps of the simulation */
+    if(++pa->lightweight_counter < LIGHTWEIGHT_INTERVAL) {
+        pa->delayed_jump = pa->delayed_jump || input_button_pressed(pa->input, IB_FIRE1);
+        return;
+    }
+    else if(pa->delayed_jump) {
+        input_simulate_button_press(pa->input, IB_FIRE1);
+        pa->delayed_jump = false;
+    }
+
+    /* run a single step of the simulation, bounded so that the sensors
+       don't skip over thin obstacles at high speeds */
+    dt = min(pa->lightweight_time, MAX_TIMESTEP);
+    pa->lightweight_counter = 0;
+    pa->lightweight_time = 0.0;
+
+    pa->prev_xpos = pa->xpos;
+    pa->prev_ypos = pa->ypos;
+    fixed_update(pa, obstaclemap, dt);
+    pa->interpolation = 1.0;
+}
+
 /* physics simulation */
 void fixed_update(physicsactor_t *pa, const obstaclemap_t *obstaclemap, double dt)
 {
     const obstacle_t *at_A = NULL, *at_B = NULL, *at_C = NULL, *at_D = NULL, *at_M = NULL, *at_N = NULL;
     double prev_xpos, prev_ypos;
 
+    PROFILER_BEGIN("physicsactor fixed_update");
+
     /*
      *
      * initialization
@@ -1114,6 +1361,7 @@ void fixed_update(physicsactor_t *pa, const obstaclemap_t *obstaclemap, double d
         pa->ysp = min(pa->ysp + pa->grv * dt, pa->topyspeed);
         pa->ypos += pa->ysp * dt;
         pa->facing_right = true;
+        PROFILER_END();
         return;
     }
 
@@ -1577,9 +1825,10 @@ void fixed_update(physicsactor_t *pa, const obstaclemap_t *obstaclemap, double d
      *
      */
 
-    /* update the position */
-    pa->xpos += pa->xsp * dt;
-    pa->ypos += pa->ysp * dt;
+    /* update the position. At high speeds, stop at the first wall along the way */
+    double t = sweep_walls(pa, obstaclemap, pa->xsp * dt, pa->ysp * dt);
+    pa->xpos += pa->xsp * dt * t;
+    pa->ypos += pa->ysp * dt * t;
     update_sensors(pa, obstaclemap, &at_A, &at_B, &at_C, &at_D, &at_M, &at_N);
 
     /*
@@ -1591,6 +1840,7 @@ void fixed_update(physicsactor_t *pa, const obstaclemap_t *obstaclemap, double d
     if(is_smashed(pa, obstaclemap)) {
         notify_observers(pa, PAE_SMASH);
         physicsactor_kill(pa);
+        PROFILER_END();
         return;
     }
 
@@ -1733,6 +1983,8 @@ void fixed_update(physicsactor_t *pa, const obstaclemap_t *obstaclemap, double d
         pa->midair_timer += dt;
     else
         pa->midair_timer = 0.0;
+
+    PROFILER_END();
 }
 
 /* call update_sensors() whenever you update pa->position or pa->angle */
@@ -1783,14 +2035,18 @@ void update_sensors(physicsactor_t* pa, const obstaclemap_t* obstaclemap, obstac
 #endif
     }
 
-    /* read sensors */
+    /* read sensors (all at once) */
     v2d_t position = physicsactor_get_position(pa);
-    *at_A = sensor_check(a, position, pa->movmode, pa->layer, obstaclemap);
-    *at_B = sensor_check(b, position, pa->movmode, pa->layer, obstaclemap);
-    *at_C = sensor_check(c, position, pa->movmode, pa->layer, obstaclemap);
-    *at_D = sensor_check(d, position, pa->movmode, pa->layer, obstaclemap);
-    *at_M = sensor_check(m, position, pa->movmode, pa->layer, obstaclemap);
-    *at_N = sensor_check(n, position, pa->movmode, pa->layer, obstaclemap);
+    const sensor_t* sensor[6] = { a, b, c, d, m, n };
+    const obstacle_t* at[6];
+
+    sensor_check_all(sensor, 6, position, pa->movmode, pa->layer, obstaclemap, at);
+    *at_A = at[0];
+    *at_B = at[1];
+    *at_C = at[2];
+    *at_D = at[3];
+    *at_M = at[4];
+    *at_N = at[5];
 
     /* C, D, M, N: ignore clouds */
     *at_C = (*at_C != NULL && obstacle_is_solid(*at_C)) ? *at_C : NULL;
@@ -2649,6 +2905,34 @@ const obstacle_t* find_ground_with_extended_sensor(const physicsactor_t* pa, con
     return obstaclemap_find_ground(obstaclemap, x1, y1, x2, y2, pa->layer, MM_TO_GD(pa->movmode), out_ground_position);
 }
 
+/* continuous collision detection for fast movement: the fraction, in [0,1], of the
+   movement (dx,dy) that can be performed before the wall sensor hits a wall. The
+   wall sensors are checked at the end position only, which isn't enough when the
+   actor moves by more than their length in a single step: it could go through thin
+   walls. If the movement is cut short, the wall sensor will overlap the wall and
+   the wall will be handled as usual */
+double sweep_walls(const physicsactor_t* pa, const obstaclemap_t* obstaclemap, double dx, double dy)
+{
+    const sensor_t* sensor = (dx > 0.0) ? sensor_N(pa) : sensor_M(pa);
+    int reach = abs(sensor_local_tail(sensor).x);
+    int step = 0, steps = 0;
+
+    /* the discrete test is enough */
+    if(pa->movmode != MM_FLOOR || fabs(dx) <= reach)
+        return 1.0;
+
+    /* sweep the tail of the wall sensor */
+    v2d_t from = v2d_new(floor(pa->xpos), floor(pa->ypos));
+    v2d_t to = v2d_new(floor(pa->xpos + dx), floor(pa->ypos + dy));
+    point2d_t a = sensor_tail(sensor, from, pa->movmode);
+    point2d_t b = sensor_tail(sensor, to, pa->movmode);
+
+    if(obstaclemap_cast_ray(obstaclemap, a.x, a.y, b.x, b.y, pa->layer, &step, &steps) == NULL)
+        return 1.0;
+
+    return (double)step / (double)steps;
+}
+
 /* checks if there is a moving obstacle colliding with the sensor */
 bool got_moving_obstacle_at_sensor(const physicsactor_t* pa, const obstaclemap_t* obstaclemap, const sensor_t* s)
 {
@@ -2874,12 +3158,28 @@ void notify_observers(physicsactor_t* pa, physicsactorevent_t event)
 {
     physicsactorobserverlist_t* observer = pa->observers;
 
+    /* we're in a worker thread */
+    if(pa->defer_events) {
+        darray_push(pa->deferred_event, event);
+        return;
+    }
+
     while(observer != NULL) {
         observer->callback(pa, event, observer->context);
         observer = observer->next;
     }
 }
 
+/* notify observers of the events raised during a parallel update */
+void notify_deferred_events(physicsactor_t* pa)
+{
+    /* we are back on the main thread: defer_events is false */
+    for(int i = 0; i < darray_length(pa->deferred_event); i++)
+        notify_observers(pa, pa->deferred_event[i]);
+
+    darray_clear(pa->deferred_event);
+}
+
 /* create an observer */
 physicsactorobserverlist_t* create_observer(void (*callback)(physicsactor_t*,physicsactorevent_t,void*), void* context, physicsactorobserverlist_t* next)
 {
@@ -2902,4 +3202,22 @@ physicsactorobserverlist_t* destroy_observers(physicsactorobserverlist_t* list)
     }
 
     return NULL;
-}
\ No newline at end of file
+}
+
+
+
+/*
+ *
+ * Parallel updates
+ *
+ */
+
+/* updates actors[begin .. end-1] of an updatejob_t. Physics actors are independent
+   from one another: they only read the (shared) obstacle map and modify their own state */
+void update_range(int begin, int end, void* context)
+{
+    const updatejob_t* job = (const updatejob_t*)context;
+
+    for(int i = begin; i < end; i++)
+        physicsactor_update(job->actors[i], job->obstaclemap);
+}
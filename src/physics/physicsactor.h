@@ -94,6 +94,7 @@ enum physicsactorevent_t
 struct obstaclemap_t;
 struct obstacle_t;
 struct input_t;
+struct snapshot_t;
 enum obstaclelayer_t;
 
 /* API */
@@ -101,8 +102,18 @@ physicsactor_t* physicsactor_create(v2d_t position);
 physicsactor_t* physicsactor_destroy(physicsactor_t *pa);
 
 void physicsactor_update(physicsactor_t *pa, const struct obstaclemap_t *obstaclemap);
+void physicsactor_update_all(physicsactor_t** pa, int count, const struct obstaclemap_t *obstaclemap); /* update independent physics actors, possibly in parallel */
 void physicsactor_render_sensors(const physicsactor_t *pa, v2d_t camera_position);
 
+void physicsactor_set_simulation_rate(double rate); /* fixed rate in Hz, independent of the framerate of the engine; zero (default) means lockstep with the engine */
+double physicsactor_simulation_rate();
+void physicsactor_set_lightweight(physicsactor_t *pa, bool lightweight); /* run a cheaper, less accurate simulation at a reduced rate (e.g., for actors that are off screen) */
+bool physicsactor_is_lightweight(const physicsactor_t *pa);
+
+void physicsactor_save_state(const physicsactor_t *pa, struct snapshot_t *snapshot); /* write the dynamic state (e.g., position, speed, timers, model parameters) to a snapshot */
+void physicsactor_load_state(physicsactor_t *pa, struct snapshot_t *snapshot); /* read the dynamic state from a snapshot */
+
+
 void physicsactor_capture_input(physicsactor_t *pa, const struct input_t *in); /* call before physicsactor_update() */
 void physicsactor_reset_model_parameters(physicsactor_t* pa);
 void physicsactor_subscribe(physicsactor_t* pa, void (*callback)(physicsactor_t*,physicsactorevent_t,void*), void* context);
@@ -114,6 +125,7 @@ physicsactorstate_t physicsactor_get_state(const physicsactor_t *pa);
 int physicsactor_get_angle(const physicsactor_t *pa); /* get the angle in degrees */
 v2d_t physicsactor_get_position(const physicsactor_t *pa); /* the position of the physics actor is the center of its sprite */
 void physicsactor_set_position(physicsactor_t *pa, v2d_t position);
+v2d_t physicsactor_get_interpolated_position(const physicsactor_t *pa); /* use it for rendering: the position between the last two steps of the simulation */
 void physicsactor_lock_horizontally_for(physicsactor_t *pa, double seconds); /* set the horizontal control lock timer */
 double physicsactor_hlock_timer(const physicsactor_t *pa); /* get the horizontal control lock timer (in seconds) */
 bool physicsactor_resurrect(physicsactor_t *pa);
@@ -44,6 +44,7 @@ struct sensor_t
 /* private stuff ;-) */
 static sensorstate_t* select_state(const sensor_t *sensor, movmode_t mm);
 static color_t make_translucent_color(color_t color, float alpha);
+#define MAX_BATCHED_SENSORS 8 /* max number of sensors per batch of sensor_check_all() */
 
 
 /*
@@ -209,6 +210,47 @@ const obstacle_t* sensor_check(const sensor_t *sensor, v2d_t actor_position, mov
     return sensorstate_check(s, actor_position, obstaclemap, x1, y1, x2, y2, layer_filter);
 }
 
+/*
+ * sensor_check_all()
+ * Similar to sensor_check(), but for multiple sensors at once. The obstacle map
+ * is scanned a single time for sensors that are close to each other, such as
+ * those of a single actor. out_obstacle[i] is set to the obstacle that collides
+ * with sensor[i], or to NULL if there is no such obstacle
+ */
+void sensor_check_all(const sensor_t** sensor, int sensor_count, v2d_t actor_position, movmode_t mm, obstaclelayer_t layer_filter, const obstaclemap_t *obstaclemap, const obstacle_t** out_obstacle)
+{
+    obstaclemap_query_t query[MAX_BATCHED_SENSORS];
+
+    for(int base = 0; base < sensor_count; base += MAX_BATCHED_SENSORS) {
+        int count = min(sensor_count - base, MAX_BATCHED_SENSORS);
+
+        /* set up the queries in world space */
+        for(int i = 0; i < count; i++) {
+            const sensor_t* s = sensor[base + i];
+            int x1, y1, x2, y2;
+
+            if(s->enabled) {
+                sensor_worldpos(s, actor_position, mm, &x1, &y1, &x2, &y2);
+                query[i].x1 = min(x1, x2);
+                query[i].y1 = min(y1, y2);
+                query[i].x2 = max(x1, x2);
+                query[i].y2 = max(y1, y2);
+            }
+            else {
+                /* skip disabled sensors */
+                query[i].x1 = query[i].y1 = 0;
+                query[i].x2 = query[i].y2 = -1;
+            }
+        }
+
+        /* scan the obstacle map */
+        obstaclemap_get_best_obstacles_at(obstaclemap, query, count, mm, layer_filter);
+
+        for(int i = 0; i < count; i++)
+            out_obstacle[base + i] = query[i].best;
+    }
+}
+
 /*
  * sensor_render()
  * Render the sensor
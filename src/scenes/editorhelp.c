@@ -53,6 +53,7 @@ static const char text[] =
 "F1                                   $EDITOR_HELP_CMD_HELP\n"
 "G                                    $EDITOR_HELP_CMD_GRID\n"
 "M                                    $EDITOR_HELP_CMD_MASKS\n"
+"O                                    $EDITOR_HELP_CMD_OVERVIEW\n"
 "\n"
 "$EDITOR_HELP_ITEMS\n"
 "\n"
@@ -245,6 +245,9 @@ void langselect_render()
     int i;
     v2d_t cam = v2d_new(VIDEO_SCREEN_W/2, VIDEO_SCREEN_H/2);
 
+    /* skip the presentation if nothing changes */
+    video_enable_dirty_tracking();
+
     background_render_bg(bgtheme, cam);
     background_render_fg(bgtheme, cam);
 
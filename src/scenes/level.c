@@ -32,11 +32,13 @@
 #include "pause.h"
 #include "quest.h"
 #include "util/levparser.h"
+#include "util/levsaver.h"
 #include "util/editorgrp.h"
 #include "util/editorcmd.h"
 #include "../core/engine.h"
 #include "../core/scene.h"
 #include "../core/storyboard.h"
+#include "../core/quest.h"
 #include "../core/global.h"
 #include "../core/input.h"
 #include "../core/fadefx.h"
@@ -44,25 +46,34 @@
 #include "../core/audio.h"
 #include "../core/timer.h"
 #include "../core/sprite.h"
+#include "../core/image.h"
 #include "../core/asset.h"
 #include "../core/logfile.h"
 #include "../core/lang.h"
 #include "../core/nanoparser.h"
 #include "../core/font.h"
 #include "../core/prefs.h"
+#include "../core/resourcemanager.h"
+#include "../core/trace.h"
 #include "../util/darray.h"
 #include "../util/numeric.h"
 #include "../util/rect.h"
 #include "../util/util.h"
 #include "../util/stringutil.h"
 #include "../util/iterator.h"
+#include "../util/profiler.h"
+#include "../util/arena.h"
+#include "../util/atom.h"
+#include "../util/snapshot.h"
 #include "../entities/mobilegamepad.h"
 #include "../entities/actor.h"
 #include "../entities/brick.h"
 #include "../entities/brickmanager.h"
+#include "../entities/brickbatch.h"
 #include "../entities/player.h"
 #include "../entities/camera.h"
 #include "../entities/waterfx.h"
+#include "../entities/triggervolume.h"
 #include "../entities/background.h"
 #include "../entities/renderqueue.h"
 #include "../entities/sfx.h"
@@ -70,6 +81,8 @@
 #include "../entities/legacy/item.h"
 #include "../entities/legacy/enemy.h"
 #include "../physics/obstacle.h"
+#include "../physics/collisionmask.h"
+#include "../physics/physicsactor.h"
 #include "../physics/obstaclemap.h"
 #include "../scripting/scripting.h"
 #include "../scenes/editorpal.h"
@@ -94,9 +107,11 @@ typedef struct {
 /* internal data */
 static int dialogregion_size; /* size of the vector */
 static dialogregion_t dialogregion[DIALOGREGION_MAX];
+static int dialogregions_armed; /* TRUE if the regions have been added as trigger volumes */
 
 /* internal methods */
 static void update_dialogregions();
+static void on_dialogregion(int volume_id, player_t* p, bool entered, void* context);
 
 
 
@@ -164,13 +179,35 @@ static void clear_level_state(levelstate_t* state);
 
 /* region of interest */
 static rect_t create_roi(v2d_t camera, int margin);
+static rect_t include_views_in_roi(rect_t roi, int margin);
 static const int ROI_MARGIN_UPDATE_ENTITY = 256;
 static const int ROI_MARGIN_UPDATE_BRICK = ROI_MARGIN_UPDATE_ENTITY + 64; /* bricks should use a larger margin than entities */
 static const int ROI_MARGIN_UPDATE_PLAYER = ROI_MARGIN_UPDATE_ENTITY;
+static const int ROI_MARGIN_FULL_PHYSICS = 64; /* companions outside of this ROI run lightweight physics */
 static const int ROI_MARGIN_RENDER_ENTITY = ROI_MARGIN_UPDATE_ENTITY; /* use the same ROI of the update cycle to skip updating the entity tree; we don't want to unnecessarily bubble things up and down in the entity tree, as it takes time */
 static const int ROI_MARGIN_RENDER_BRICK = 128;
 static const int ROI_MARGIN_EDITOR = 128;
 
+/* region of interest with hysteresis: the ROI is kept as long as it contains
+   the camera ROI with the enter margin and is contained in the camera ROI with
+   the exit margin, so that a shaking camera doesn't cause activation churn.
+   When recomputed, the ROI is expanded in the direction of camera movement */
+typedef struct roistate_t roistate_t;
+struct roistate_t {
+    rect_t roi;
+    bool is_valid;
+};
+static roistate_t entity_roi_state, brick_roi_state;
+static v2d_t roi_camera_position, roi_camera_velocity;
+static bool is_roi_camera_tracked;
+static void reset_roi_hysteresis();
+static void track_roi_camera(v2d_t camera, float dt);
+static rect_t create_roi_with_hysteresis(roistate_t* state, v2d_t camera, int margin);
+static const int ROI_HYSTERESIS = 64; /* the exit margin is the enter margin plus twice this, plus the lookahead */
+static const float ROI_LOOKAHEAD_TIME = 0.25f; /* in seconds: predictive expansion in the direction of camera velocity */
+static const int ROI_MAX_LOOKAHEAD = 256; /* in pixels */
+static bool wants_lightweight_physics(const player_t* player, v2d_t camera);
+
 /* internal data */
 static float level_timer;
 static music_t *music;
@@ -192,6 +229,14 @@ static bool was_immersive;
 /* scripting controlled variables */
 static int level_cleared; /* display the level cleared animation */
 static int jump_to_next_stage; /* jumps to the next stage in the quest */
+
+/* prefetching the next level of the quest: its file is read in the
+   background when the level is cleared; then we decode its images in
+   background threads, so that loading it is faster. The prefetched
+   images are kept across scenes, until the next level is loaded */
+#define NEXTLEVEL_PREFETCH_BUDGET (64 * 1024 * 1024) /* in bytes */
+static enum { NEXTLEVEL_NONE, NEXTLEVEL_READING, NEXTLEVEL_PREFETCHING } next_level_state = NEXTLEVEL_NONE;
+static char next_level_file[PATH_MAXLEN] = "";
 static int wants_to_leave; /* wants to abort the level */
 static int wants_to_pause; /* wants to pause the level */
 
@@ -200,18 +245,26 @@ static int dlgbox_active;
 static uint32_t dlgbox_starttime;
 static actor_t *dlgbox;
 static font_t *dlgbox_title, *dlgbox_message;
+static font_t *profiler_font;
 
 /* level management */
 static void level_load(const char *filepath);
 static void level_unload();
 static int level_save(const char *filepath);
+static bool level_save_in_background(const char *filepath);
+static bool write_level_snapshot(const char* fullpath);
 static bool level_interpret_header_line(const char *filepath, int fileline, levparser_command_t command, const char *command_name, int param_count, const char** param, void *data);
 static bool level_interpret_body_line(const char *filepath, int fileline, levparser_command_t command, const char *command_name, int param_count, const char** param, void *data);
-static bool level_save_ssobject(surgescript_object_t* object, void* param);
+static bool level_prefetch_line(const char *filepath, int fileline, levparser_command_t command, const char *command_name, int param_count, const char** param, void *data);
+static void level_save_entity(surgescript_object_t* entity, uint64_t entity_id, v2d_t spawn_point, void* param);
 
 /* internal methods */
 static int inside_screen(int x, int y, int w, int h, int margin);
 static void update_level_size();
+static void preload_next_level();
+static void prefetch_next_level();
+static void end_next_level_prefetch();
+static bool prefetch_header_line(const char *filepath, int fileline, levparser_command_t command, const char *command_name, int param_count, const char** param, void *data);
 static void restart(int preserve_level_state);
 static void update_music();
 static void render_bricks();
@@ -219,15 +272,23 @@ static void render_bricks_debug();
 static void render_players();
 static void spawn_players();
 static void render_level(const item_list_t *major_items, const enemy_list_t *major_enemies); /* render bricks, items, enemies, players, etc. */
+static videoquality_t renderqueue_quality; /* the video quality the render queue has been configured for */
+static void configure_renderqueue(); /* set up the depth modes of the render queue according to the video quality */
 static void render_hud(); /* gui / hud related */
 static void render_dlgbox(); /* dialog boxes */
+static void render_profiler(); /* entity statistics of the profiler overlay */
+static void profile_sample(sound_t* sample, void* data); /* audio statistics of the profiler overlay */
+typedef struct audioprofile_t { const sound_t* largest[3]; size_t saved_bytes; } audioprofile_t;
 static void update_dlgbox(); /* dialog boxes */
 static void reconfigure_players_input_devices();
 
 /* obstacle map */
 static obstaclemap_t* obstaclemap = NULL; /* obstacle map near the camera */
 static bool is_obstaclemap_dirty = false;
+static bool has_static_obstacles = false; /* is the static tier of the obstacle map up-to-date? */
+static unsigned static_obstacles_version = 0; /* version of the active static bricks in the static tier */
 STATIC_DARRAY(obstacle_t*, mock_obstacles); /* dynamically generated obstacles */
+static arena_t* mock_obstacle_arena = NULL; /* memory of the mock obstacles; reset whenever the dynamic tier is cleared */
 static void create_obstaclemap();
 static void destroy_obstaclemap();
 static void clear_obstaclemap();
@@ -259,11 +320,60 @@ static void entity_info_set_id(const surgescript_object_t* object, uint64_t enti
 static bool entity_info_is_persistent(const surgescript_object_t* object);
 static void entity_info_set_persistent(const surgescript_object_t* object, bool is_persistent);
 
+/* level streaming: the bricks of a level are loaded by region as the camera moves */
+static bool is_streaming_enabled = false; /* stream the levels? */
+static levregions_t* streamed_regions = NULL; /* regions of the current level; NULL if it's not being streamed */
+static bool* is_region_loaded = NULL; /* indexed by region */
+STATIC_DARRAY(int, loaded_region); /* indices of the loaded regions */
+static int streamed_world_width = 0, streamed_world_height = 0; /* size of the level, including the regions that aren't loaded */
+static const int STREAMING_MARGIN = 512; /* load the regions this close to the ROI and unload those farther than twice this */
+
+static void start_streaming(const char* filepath);
+static void stop_streaming();
+static void release_streaming();
+static void update_streaming(rect_t roi);
+static void load_region(int region_index);
+static rect_t region_rect(int region_index);
+static bool interpret_region_line(const char *filepath, int fileline, levparser_command_t command, const char *command_name, int param_count, const char** param, void *data);
+static bool measure_region_line(const char *filepath, int fileline, levparser_command_t command, const char *command_name, int param_count, const char** param, void *data);
+static void create_brick_from_line(const char *command_name, int param_count, const char** param);
+
 /* debug mode */
 #define debug_mode_want_to_activate() (!mobilegamepad_is_available() && editorcmd_is_triggered(editor_cmd, "enter-debug-mode"))
 
 /* events */
 static void handle_switchout_event(const ALLEGRO_EVENT* event, void* data);
+static void handle_suspend_event(const ALLEGRO_EVENT* event, void* data);
+
+/* snapshots: a ring buffer with the recent states of the level, so that it
+   can be rewound, and a suspend file that is written when the app goes to
+   the background and that is applied the next time the level is loaded */
+#define SNAPSHOT_RING_SIZE 300 /* 5 seconds at 60 fps */
+#define SNAPSHOT_MAGIC 0x50414E53 /* "SNAP" */
+#define SUSPEND_FILE "level.suspend"
+typedef struct snapshotfield_t snapshotfield_t;
+struct snapshotfield_t {
+    uint64_t entity_id; /* the entity must have an ID */
+    atom_t name; /* name of a property of the entity */
+};
+enum { SNAPSHOTVALUE_NONE, SNAPSHOTVALUE_NULL, SNAPSHOTVALUE_NUMBER, SNAPSHOTVALUE_BOOL, SNAPSHOTVALUE_STRING };
+static snapshot_t* snapshot_ring[SNAPSHOT_RING_SIZE];
+static int snapshot_head = 0; /* where the next snapshot will be captured */
+static int snapshot_count = 0; /* number of snapshots in the ring */
+static double snapshot_time = 0.0; /* time spent capturing the latest snapshot, in seconds */
+STATIC_DARRAY(snapshotfield_t, snapshot_field); /* registered properties of entities */
+STATIC_DARRAY(brick_t*, snapshot_brick); /* scratch space of read_snapshot() */
+static void init_snapshots();
+static void release_snapshots();
+static void discard_snapshots();
+static void write_snapshot(snapshot_t* snapshot);
+static bool read_snapshot(snapshot_t* snapshot);
+static void write_snapshot_field(snapshot_t* snapshot, const snapshotfield_t* field);
+static bool read_snapshot_field(snapshot_t* snapshot);
+static size_t snapshot_memory();
+static bool suspend_level();
+static bool resume_level();
+static surgescript_object_t* find_entity(uint64_t entity_id);
 
 
 
@@ -283,6 +393,8 @@ static bool editor_want_to_activate();
 static void editor_update_background();
 static void editor_waterline_render(int ycoord, color_t color);
 static void editor_save();
+static void editor_update_saving();
+static void editor_autosave();
 static void editor_scroll();
 static bool editor_is_eraser_enabled();
 
@@ -309,6 +421,11 @@ static font_t *editor_cursor_font;
 static font_t *editor_properties_font; /* top bar */
 static font_t *editor_help_font; /* top bar */
 static videomode_t editor_previous_videomode = VIDEOMODE_DEFAULT;
+static bool editor_is_saving; /* is editor_save() writing the level in the background? */
+static bool editor_is_erasing; /* is the eraser being used? */
+static bool editor_has_unsaved_changes; /* have there been changes since the last (auto)save? */
+static float editor_autosave_timer;
+#define EDITOR_AUTOSAVE_INTERVAL 60.0f /* in seconds */
 static const char* editor_entity_class(enum editor_entity_type objtype);
 static const char* editor_entity_info(enum editor_entity_type objtype, int objid);
 static void editor_draw_object(enum editor_entity_type obj_type, int obj_id, v2d_t position);
@@ -355,6 +472,9 @@ static int editor_ssobj_index(const char* entity_name); /* an index k such that
 static const char* editor_ssobj_name(int entity_index); /* the inverse of editor_ssobj_index() */
 static void editor_remove_entity(uint64_t entity_id);
 static void editor_pick_entity(surgescript_object_t* object, surgescript_object_t** best_candidate);
+static surgescript_object_t* editor_entity_at_cursor();
+static struct { v2d_t position; unsigned changes; bool has_target; surgescript_objecthandle_t target; } editor_entity_at_cursor_cache; /* the SurgeScript VM is paused in the editor */
+static unsigned editor_changes; /* incremented whenever an action is committed */
 
 /* editor: bricks */
 static int* editor_brick; /* an array of all valid brick numbers */
@@ -400,6 +520,35 @@ static void editor_status_update();
 static void editor_status_render();
 static void editor_status_display(const char* message, int argc, const char** argv);
 
+/* editor: overview. The level is shown zoomed out using low-resolution tiles
+   that are rendered progressively and cached. Nothing is activated in the
+   overview: clicking on it brings back the full-detail view at the cursor */
+#define EDITOR_OVERVIEW_SCALE 8 /* zoom-out factor */
+#define EDITOR_OVERVIEW_TILE_SIZE 128 /* width and height of a tile, in pixels */
+#define EDITOR_OVERVIEW_MAX_TILES 256 /* maximum number of cached tiles */
+#define EDITOR_OVERVIEW_TILES_PER_FRAME 2 /* maximum number of tiles rendered per frame */
+typedef struct editor_overview_tile_t {
+    int col, row; /* the tile covers a square of TILE_SIZE * SCALE pixels of the level */
+    unsigned changes; /* value of editor_changes when the tile was rendered */
+    unsigned last_used; /* frame number */
+    image_t* image; /* NULL if the slot is free */
+} editor_overview_tile_t;
+static bool editor_overview_enabled;
+static v2d_t editor_overview_camera; /* in world coordinates */
+static unsigned editor_overview_frame;
+static editor_overview_tile_t editor_overview_tile[EDITOR_OVERVIEW_MAX_TILES];
+STATIC_DARRAY(brick_t*, editor_overview_bricks); /* bricks of the tile being rendered */
+static void editor_overview_init();
+static void editor_overview_release();
+static void editor_overview_update();
+static void editor_overview_render();
+static void editor_overview_clear();
+static bool editor_overview_is_enabled();
+static editor_overview_tile_t* editor_overview_find_tile(int col, int row);
+static editor_overview_tile_t* editor_overview_new_tile(int col, int row);
+static void editor_overview_render_tile(editor_overview_tile_t* tile);
+static int editor_overview_zindex_cmp(const void* a, const void* b);
+
 /* implementing UNDO and REDO */
 
 /* in order to implement UNDO and REDO,
@@ -433,27 +582,35 @@ static editor_action_t editor_action_entity_new(int is_new_object, enum editor_e
 static editor_action_t editor_action_spawnpoint_new(int is_changing, v2d_t obj_position, v2d_t obj_old_position);
 static editor_action_t editor_action_waterlevel_new(int is_changing, int new_waterlevel, int old_waterlevel);
 
-/* linked list */
-typedef struct editor_action_list_t {
-    editor_action_t action; /* node data */
-    int in_group; /* is this element part of a group? */
-    uint32_t group_key; /* internal use (used only if in_group is true) */
-    struct editor_action_list_t *prev, *next; /* linked list: pointers */
-} editor_action_list_t;
+/* command log: a ring buffer of actions. The actions of a group (e.g., a
+   group of objects or a stroke of the eraser) are undone in a single step.
+   Memory is bounded: when the log is full, the oldest steps are forgotten */
+#define EDITOR_ACTION_LOG_INITIALSIZE 256 /* a power of two */
+#define EDITOR_ACTION_LOG_MAXSIZE 65536 /* maximum number of actions; a power of two */
+typedef struct editor_action_record_t {
+    editor_action_t action;
+    uint32_t group; /* consecutive actions of the same group make up a single step */
+} editor_action_record_t;
 
 /* data */
-editor_action_list_t *editor_action_buffer;
-editor_action_list_t *editor_action_buffer_head; /* sentinel */
-editor_action_list_t *editor_action_buffer_cursor;
-    
+static editor_action_record_t* editor_action_log; /* ring buffer */
+static int editor_action_log_capacity; /* a power of two */
+static int editor_action_log_first; /* index of the oldest action */
+static int editor_action_log_count; /* number of actions in the log */
+static int editor_action_log_cursor; /* number of applied actions; the ones after these can be redone */
+static uint32_t editor_action_group; /* group of the last registered action */
+static int editor_action_group_depth; /* greater than zero when registering a group */
+
 /* methods */
 static void editor_action_init();
 static void editor_action_release();
 static void editor_action_undo();
 static void editor_action_redo();
+static void editor_action_begin_group();
+static void editor_action_end_group();
 static editor_action_t editor_action_commit(editor_action_t action);
 static void editor_action_register(editor_action_t action); /* internal */
-static editor_action_list_t* editor_action_delete_list(editor_action_list_t *list); /* internal */
+static editor_action_record_t* editor_action_log_at(int i); /* internal */
 
 
 
@@ -476,6 +633,9 @@ void level_load(const char *filepath)
 {
     logfile_message("Loading level \"%s\"...", filepath);
 
+    /* the level may be being saved */
+    levsaver_wait();
+
     /* initialize fields with default values */
     str_cpy(file, filepath, sizeof(file)); /* we want the relative filepath */
     str_cpy(name, "Untitled", sizeof(name));
@@ -493,6 +653,7 @@ void level_load(const char *filepath)
     requires[2] = GAME_VERSION_WIP;
     readonly = FALSE;
     dialogregion_size = 0;
+    dialogregions_armed = FALSE;
 
     /* clear pointers */
     backgroundtheme = NULL;
@@ -506,10 +667,17 @@ void level_load(const char *filepath)
     /* initialize the water effect */
     waterfx_init();
 
+    /* initialize the trigger volumes */
+    triggervolume_init();
+
     /* scripting: preparing a new Level... */
     surgescript_object_t* level_manager = scripting_util_surgeengine_component(surgescript_vm(), "LevelManager");
     surgescript_object_call_function(level_manager, "onLevelLoad", NULL, 0, NULL);
 
+    /* keep the level in memory, so that we read the disk only once
+       and so that restarting the level doesn't read it again */
+    levparser_preload(filepath);
+
     /* read the header of the level file */
     if(!levparser_parse(filepath, NULL, level_interpret_header_line))
         fatal_error("Can\'t open level file \"%s\".", filepath);
@@ -518,6 +686,11 @@ void level_load(const char *filepath)
     music_stop(); /* stop any music that's playing */
     music = *musicfile ? music_load(musicfile) : NULL;
 
+    /* decode the spritesheets of the entities of the level in parallel
+       while we load the brickset (which decodes its own images in parallel) */
+    image_begin_prefetch();
+    levparser_parse(filepath, NULL, level_prefetch_line);
+
     /* load the brickset */
     brickset_load(theme);
 
@@ -531,9 +704,18 @@ void level_load(const char *filepath)
     camera_set_position(player_position(player));
     surgescript_object_call_function(scripting_util_surgeengine_component(surgescript_vm(), "Player"), "__spawnPlayers", NULL, 0, NULL);
 
+    /* stream the bricks of the level, if enabled */
+    if(is_streaming_enabled)
+        start_streaming(filepath);
+
     /* read the body of the level file;
        load bricks & entities */
     levparser_parse(filepath, NULL, level_interpret_body_line);
+    image_end_prefetch();
+
+    /* the images of the level may have been prefetched while
+       the previous level of the quest was running */
+    end_next_level_prefetch();
 
     /* recompute the level size */
     update_level_size();
@@ -571,6 +753,8 @@ void level_unload()
     /* misc */
     camera_unlock();
     waterfx_release();
+    triggervolume_release();
+    discard_snapshots();
 
     /* music */
     logfile_message("Stopping the music...");
@@ -582,6 +766,7 @@ void level_unload()
     /* remove all bricks */
     logfile_message("Removing all bricks...");
     brickmanager_remove_all_bricks(brick_manager);
+    release_streaming();
 
     /* unload the brickset */
     logfile_message("Unloading the brickset...");
@@ -590,6 +775,7 @@ void level_unload()
     /* unload the background */
     logfile_message("Unloading the background...");
     backgroundtheme = background_unload(backgroundtheme);
+    background_cancel_prefetch();
 
     /* success! */
     logfile_message("The level has been unloaded.");
@@ -603,8 +789,29 @@ void level_unload()
  */
 int level_save(const char *filepath)
 {
-    const char* fullpath = asset_path(filepath);
-    ALLEGRO_FILE *fp;
+    if(!level_save_in_background(filepath))
+        return FALSE;
+
+    /* wait for completion */
+    if(!levsaver_wait()) {
+        video_showmessage("Could not save \"%s\".", filepath);
+        return FALSE;
+    }
+
+    /* done! */
+    logfile_message("level_save() ok");
+    return TRUE;
+}
+
+/*
+ * level_save_in_background()
+ * Takes a snapshot of the current level and writes it to a file in a
+ * background thread. The file is replaced atomically when the snapshot
+ * has been completely written. Returns TRUE if the save has started
+ */
+bool level_save_in_background(const char *filepath)
+{
+    char fullpath[PATH_MAXLEN];
 
     /* skip if the readonly flag is set
        should this be moved to the scripting layer instead? */
@@ -619,16 +826,30 @@ int level_save(const char *filepath)
         return FALSE;
     }
 
-    /* open file for writing */
+    /* levels are written to the write directory */
+    const char* virtual_path = asset_path(filepath);
+    const char* writedir = asset_writedir();
+    size_t len = strlen(writedir);
+    bool has_separator = (len > 0 && (writedir[len-1] == '/' || writedir[len-1] == '\\'));
+    while(*virtual_path == '/')
+        virtual_path++;
+    snprintf(fullpath, sizeof(fullpath), "%s%s%s", writedir, has_separator ? "" : "/", virtual_path);
+
+    /* start saving */
     logfile_message("level_save(\"%s\")", fullpath);
-    if(NULL == (fp = al_fopen(fullpath, "w"))) {
-        logfile_message("Warning: could not open \"%s\" for writing.", fullpath);
-        video_showmessage("Could not open \"%s\" for writing.", fullpath);
-        return FALSE;
-    }
+    return write_level_snapshot(fullpath);
+}
+
+/* serialize the current level and write it to a file in the background */
+bool write_level_snapshot(const char* fullpath)
+{
+    ALLEGRO_USTR* out = al_ustr_new("");
+
+    /* we save all bricks */
+    stop_streaming();
 
     /* level header */
-    al_fprintf(fp,
+    al_ustr_appendf(out,
     "// ------------------------------------------------------------\n"
     "// %s %s level\n"
     "// This file was generated automatically.\n"
@@ -637,18 +858,18 @@ int level_save(const char *filepath)
     GAME_TITLE, GAME_VERSION_STRING, GAME_WEBSITE);
 
     /* header */
-    al_fprintf(fp,
+    al_ustr_appendf(out,
     "// header\n"
     "name \"%s\"\n",
     str_addslashes(name, NULL, 0));
 
     /* author */
-    al_fprintf(fp, "author \"%s\"\n", str_addslashes(author, NULL, 0));
+    al_ustr_appendf(out, "author \"%s\"\n", str_addslashes(author, NULL, 0));
     if(strcmp(license, "") != 0)
-        al_fprintf(fp, "license \"%s\"\n", str_addslashes(license, NULL, 0));
+        al_ustr_appendf(out, "license \"%s\"\n", str_addslashes(license, NULL, 0));
 
     /* level attributes */
-    al_fprintf(fp,
+    al_ustr_appendf(out,
     "version \"%s\"\n"
     "requires \"%d.%d.%d\"\n"
     "act %d\n"
@@ -662,49 +883,49 @@ int level_save(const char *filepath)
 
     /* music? */
     if(strcmp(musicfile, "") != 0)
-        al_fprintf(fp, "music \"%s\"\n", musicfile);
+        al_ustr_appendf(out, "music \"%s\"\n", musicfile);
 
     /* grouptheme? */
     if(strcmp(grouptheme, "") != 0)
-        al_fprintf(fp, "grouptheme \"%s\"\n", grouptheme);
+        al_ustr_appendf(out, "grouptheme \"%s\"\n", grouptheme);
 
     /* setup objects? */
     iterator_t* setup_iterator = scripting_level_setupobjects_iterator(level_ssobject());
     if(iterator_has_next(setup_iterator)) {
-        al_fprintf(fp, "setup");
+        al_ustr_appendf(out, "setup");
         while(iterator_has_next(setup_iterator)) {
             const char** object_name = iterator_next(setup_iterator);
-            al_fprintf(fp, " \"%s\"", str_addslashes(*object_name, NULL, 0));
+            al_ustr_appendf(out, " \"%s\"", str_addslashes(*object_name, NULL, 0));
         }
-        al_fprintf(fp, "\n");
+        al_ustr_appendf(out, "\n");
     }
     iterator_destroy(setup_iterator);
 
     /* players */
-    al_fprintf(fp, "players");
+    al_ustr_appendf(out, "players");
     for(int i = 0; i < team_size; i++)
-        al_fprintf(fp, " \"%s\"", str_addslashes(player_name(team[i]), NULL, 0));
-    al_fprintf(fp, "\n");
+        al_ustr_appendf(out, " \"%s\"", str_addslashes(player_name(team[i]), NULL, 0));
+    al_ustr_appendf(out, "\n");
 
     /* read only? */
     if(readonly)
-        al_fprintf(fp, "readonly\n");
+        al_ustr_appendf(out, "readonly\n");
 
     /* water */
     if(level_waterlevel() != DEFAULT_WATERLEVEL())
-        al_fprintf(fp, "waterlevel %d\n", level_waterlevel());
+        al_ustr_appendf(out, "waterlevel %d\n", level_waterlevel());
     if(!color_equals(level_watercolor(), DEFAULT_WATERCOLOR())) {
         uint8_t r, g, b, a;
         color_unmap(level_watercolor(), &r, &g, &b, &a);
-        al_fprintf(fp, "watercolor %d %d %d %d\n", r, g, b, a);
+        al_ustr_appendf(out, "watercolor %d %d %d %d\n", r, g, b, a);
     }
 
     /* dialog regions */
     if(dialogregion_size > 0) {
-        al_fprintf(fp, "\n// dialogs\n");
+        al_ustr_appendf(out, "\n// dialogs\n");
         for(int i = 0; i < dialogregion_size; i++) {
             char title[256], message[1024];
-            al_fprintf(fp,
+            al_ustr_appendf(out,
                 "dialogbox %d %d %d %d \"%s\" \"%s\"\n",
                 dialogregion[i].rect_x,
                 dialogregion[i].rect_y,
@@ -717,7 +938,7 @@ int level_save(const char *filepath)
     }
 
     /* brick list */
-    al_fprintf(fp, "\n// bricks\n");
+    al_ustr_appendf(out, "\n// bricks\n");
     iterator_t* brick_iterator = brickmanager_retrieve_all_bricks(brick_manager);
     while(iterator_has_next(brick_iterator)) {
         const brick_t* brick = iterator_next(brick_iterator);
@@ -725,7 +946,7 @@ int level_save(const char *filepath)
         bricklayer_t layer = brick_layer(brick);
         brickflip_t flip = brick_flip(brick);
 
-        al_fprintf(fp,
+        al_ustr_appendf(out,
             "brick %d %d %d%s%s%s%s\n",
 
             brick_id(brick),
@@ -741,16 +962,16 @@ int level_save(const char *filepath)
     iterator_destroy(brick_iterator);
 
     /* SurgeScript entity list */
-    al_fprintf(fp, "\n// entities\n");
-    surgescript_object_traverse_tree_ex(level_ssobject(), fp, level_save_ssobject);
+    al_ustr_appendf(out, "\n// entities\n");
+    entitymanager_foreach_persistent_entity(entitymanager_ssobject(), out, level_save_entity);
 
     /* item list */
     item_list_t* item_list = entitymanager_retrieve_all_items();
     if(item_list) {
-        al_fprintf(fp, "\n// legacy items\n");
+        al_ustr_appendf(out, "\n// legacy items\n");
         for(item_list_t* iti = item_list; iti != NULL; iti = iti->next) {
             if(iti->data->state != IS_DEAD)
-                al_fprintf(fp, "item %d %d %d\n", iti->data->type, (int)iti->data->actor->spawn_point.x, (int)iti->data->actor->spawn_point.y);
+                al_ustr_appendf(out, "item %d %d %d\n", iti->data->type, (int)iti->data->actor->spawn_point.x, (int)iti->data->actor->spawn_point.y);
         }
     }
     item_list = entitymanager_release_retrieved_item_list(item_list);
@@ -758,21 +979,24 @@ int level_save(const char *filepath)
     /* legacy object list */
     enemy_list_t* object_list = entitymanager_retrieve_all_objects();
     if(object_list) {
-        al_fprintf(fp, "\n// legacy objects\n");
+        al_ustr_appendf(out, "\n// legacy objects\n");
         for(enemy_list_t* ite = object_list; ite != NULL; ite = ite->next) {
             if(ite->data->created_from_editor && ite->data->state != ES_DEAD)
-                al_fprintf(fp, "object \"%s\" %d %d\n", str_addslashes(ite->data->name, NULL, 0), (int)ite->data->actor->spawn_point.x, (int)ite->data->actor->spawn_point.y);
+                al_ustr_appendf(out, "object \"%s\" %d %d\n", str_addslashes(ite->data->name, NULL, 0), (int)ite->data->actor->spawn_point.x, (int)ite->data->actor->spawn_point.y);
         }
     }
     object_list = entitymanager_release_retrieved_object_list(object_list);
 
     /* end of file */
-    al_fprintf(fp, "\n// EOF");
-    al_fclose(fp);
+    al_ustr_appendf(out, "\n// EOF");
 
-    /* done! */
-    logfile_message("level_save() ok");
-    return TRUE;
+    /* the saver takes ownership of a copy of the contents */
+    size_t size = al_ustr_size(out);
+    char* contents = mallocx(size + 1);
+    memcpy(contents, al_cstr(out), size + 1);
+    al_ustr_free(out);
+
+    return levsaver_save(fullpath, contents, size);
 }
 
 /*
@@ -1017,6 +1241,28 @@ bool level_interpret_header_line(const char* filepath, int fileline, levparser_c
     return true;
 }
 
+/*
+ * level_prefetch_line()
+ * Schedules the spritesheets of the entities of the .lev file to be decoded
+ * in the background. We assume that an entity uses the sprite of the same name
+ */
+bool level_prefetch_line(const char* filepath, int fileline, levparser_command_t command, const char* command_name, int param_count, const char** param, void* data)
+{
+    switch(command) {
+    case LEVCOMMAND_ENTITY:
+    case LEVCOMMAND_LEGACYOBJECT:
+        if(param_count >= 1 && !is_setup_object(param[0]))
+            sprite_prefetch(param[0]);
+        break;
+
+    default:
+        break;
+    }
+
+    /* continue reading */
+    return true;
+}
+
 /*
  * level_interpret_body_line()
  * Interprets a line of the body of the .lev file
@@ -1025,31 +1271,9 @@ bool level_interpret_body_line(const char* filepath, int fileline, levparser_com
 {
     switch(command) {
     case LEVCOMMAND_BRICK: {
-        if(param_count >= 3 && param_count <= 5) {
-            if(*theme != '\0') {
-                bricklayer_t layer = BRL_DEFAULT;
-                brickflip_t flip = BRF_NOFLIP;
-                int id = atoi(param[0]);
-                int x = atoi(param[1]);
-                int y = atoi(param[2]);
-
-                for(int j = 3; j < param_count; j++) {
-                    if(layer == BRL_DEFAULT && brick_util_layercode(param[j]) != BRL_DEFAULT)
-                        layer = brick_util_layercode(param[j]);
-                    else if(flip == BRF_NOFLIP && brick_util_flipcode(param[j]) != BRF_NOFLIP)
-                        flip = brick_util_flipcode(param[j]);
-                }
-
-                if(brick_exists(id))
-                    level_create_brick(id, v2d_new(x,y), layer, flip);
-                else
-                    logfile_message("Level loader - invalid brick: %d", id);
-            }
-            else
-                logfile_message("Level loader - warning: cannot create a new brick if the theme is not defined");
-        }
-        else
-            logfile_message("Level loader - command '%s' expects three, four or five parameters: id, xpos, ypos [, layer_name [, flip_flags]]", command_name);
+        /* streamed bricks are loaded by region */
+        if(streamed_regions == NULL)
+            create_brick_from_line(command_name, param_count, param);
 
         break;
     }
@@ -1136,33 +1360,76 @@ bool level_interpret_body_line(const char* filepath, int fileline, levparser_com
 }
 
 /*
- * level_save_ssobject()
- * Writes an object declaration to a level file
+ * create_brick_from_line()
+ * Creates a brick declared in the .lev file
  */
-bool level_save_ssobject(surgescript_object_t* object, void* param)
+void create_brick_from_line(const char* command_name, int param_count, const char** param)
 {
-    ALLEGRO_FILE* fp = (ALLEGRO_FILE*)param;
-
-    if(surgescript_object_is_killed(object))
-        return false;
+    if(param_count >= 3 && param_count <= 5) {
+        if(*theme != '\0') {
+            bricklayer_t layer = BRL_DEFAULT;
+            brickflip_t flip = BRF_NOFLIP;
+            int id = atoi(param[0]);
+            int x = atoi(param[1]);
+            int y = atoi(param[2]);
 
-    if(surgescript_object_has_tag(object, "entity")) {
-        if(entity_info_is_persistent(object)) {
-            const char* object_name = surgescript_object_name(object);
-            v2d_t spawn_point = entity_info_spawnpoint(object);
-            uint64_t entity_id = entity_info_id(object);
+            for(int j = 3; j < param_count; j++) {
+                if(layer == BRL_DEFAULT && brick_util_layercode(param[j]) != BRL_DEFAULT)
+                    layer = brick_util_layercode(param[j]);
+                else if(flip == BRF_NOFLIP && brick_util_flipcode(param[j]) != BRF_NOFLIP)
+                    flip = brick_util_flipcode(param[j]);
+            }
 
-            al_fprintf(fp, "entity \"%s\" %d %d \"%s\"\n", str_addslashes(object_name, NULL, 0), (int)spawn_point.x, (int)spawn_point.y, x64_to_str(entity_id, NULL, 0));
+            if(brick_exists(id))
+                level_create_brick(id, v2d_new(x,y), layer, flip);
+            else
+                logfile_message("Level loader - invalid brick: %d", id);
         }
+        else
+            logfile_message("Level loader - warning: cannot create a new brick if the theme is not defined");
     }
+    else
+        logfile_message("Level loader - command '%s' expects three, four or five parameters: id, xpos, ypos [, layer_name [, flip_flags]]", command_name);
+}
 
-    return true;
+/*
+ * level_save_entity()
+ * Writes the declaration of a persistent entity to a level file
+ */
+void level_save_entity(surgescript_object_t* entity, uint64_t entity_id, v2d_t spawn_point, void* param)
+{
+    ALLEGRO_USTR* out = (ALLEGRO_USTR*)param;
+    const char* object_name = surgescript_object_name(entity);
+    char hex_id[17];
+
+    al_ustr_appendf(out, "entity \"%s\" %d %d \"%s\"\n", str_addslashes(object_name, NULL, 0), (int)spawn_point.x, (int)spawn_point.y, x64_to_str(entity_id, hex_id, sizeof(hex_id)));
 }
 
 
 
 /* scene functions */
 
+/*
+ * level_preload()
+ * Starts reading the level file in the background, before the scene is
+ * initialized (e.g., during a fade-out effect of the previous scene)
+ */
+void level_preload(void *path_to_lev_file)
+{
+    const char *filepath = (const char*)path_to_lev_file;
+    levparser_preload(filepath);
+}
+
+/*
+ * level_is_preloading()
+ * Checks if the level file is still being read in the background
+ */
+bool level_is_preloading(void *path_to_lev_file)
+{
+    const char *filepath = (const char*)path_to_lev_file;
+    return levparser_is_preloading(filepath);
+}
+
 /*
  * level_init()
  * Initializes the scene
@@ -1172,6 +1439,7 @@ void level_init(void *path_to_lev_file)
     const char *filepath = (const char*)path_to_lev_file;
 
     logfile_message("level_init()");
+    trace_begin("level_init");
     video_display_loading_screen();
 
     /* initialize variables */
@@ -1182,6 +1450,7 @@ void level_init(void *path_to_lev_file)
 
     level_timer = 0.0f;
     quit_level = FALSE;
+    reset_roi_hysteresis();
     must_load_another_level = FALSE;
     must_restart_this_level = FALSE;
     must_push_a_quest = FALSE;
@@ -1211,9 +1480,12 @@ void level_init(void *path_to_lev_file)
     dlgbox_title = font_create("dialogbox");
     dlgbox_message = font_create("dialogbox");
 
+    /* profiler overlay */
+    profiler_font = font_create("EditorUI");
+
     /* render queue */
-    bool want_depth_buffer = (video_get_quality() < VIDEOQUALITY_MEDIUM);
-    renderqueue_init(want_depth_buffer);
+    renderqueue_init(false, false);
+    configure_renderqueue();
 
     /* helpers */
     clear_level_state(&saved_state);
@@ -1223,19 +1495,31 @@ void level_init(void *path_to_lev_file)
     entitymanager_init();
     create_obstaclemap();
 
+    /* snapshots */
+    init_snapshots();
+
     /* load level file */
     level_load(filepath);
 
+    /* resume a suspended level */
+    if(resume_level())
+        logfile_message("Resumed a suspended level");
+
     /* editor */
     editor_init();
 
     /* event listeners */
     engine_add_event_listener(ALLEGRO_EVENT_DISPLAY_SWITCH_OUT, NULL, handle_switchout_event);
+    engine_add_event_listener(ALLEGRO_EVENT_DISPLAY_HALT_DRAWING, NULL, handle_suspend_event);
 
     /* immersive mode */
     was_immersive = video_is_immersive();
     video_set_immersive(true); /* enable immersive mode during gameplay */
 
+    /* the first level has been loaded: report the startup trace */
+    trace_end();
+    trace_finish();
+
     /* done! */
     logfile_message("level_init() ok");
 }
@@ -1260,6 +1544,8 @@ void level_release()
     /* event listeners */
     if(!engine_remove_event_listener(ALLEGRO_EVENT_DISPLAY_SWITCH_OUT, NULL, handle_switchout_event))
         logfile_message("Can't remove event listener: switch out");
+    if(!engine_remove_event_listener(ALLEGRO_EVENT_DISPLAY_HALT_DRAWING, NULL, handle_suspend_event))
+        logfile_message("Can't remove event listener: halt drawing");
 
     /* release the editor */
     editor_release();
@@ -1267,11 +1553,17 @@ void level_release()
     /* unload the level and its scripts */
     level_unload();
 
+    /* snapshots */
+    release_snapshots();
+
     /* dialog box */
     font_destroy(dlgbox_title);
     font_destroy(dlgbox_message);
     actor_destroy(dlgbox);
 
+    /* profiler overlay */
+    font_destroy(profiler_font);
+
     /* release the brick manager and all bricks */
     logfile_message("Releasing the brick manager...");
     brick_manager = brickmanager_destroy(brick_manager);
@@ -1290,9 +1582,17 @@ void level_release()
 
     clear_level_state(&saved_state);
 
+    /* we won't load the next level of the quest */
+    if(!level_cleared)
+        end_next_level_prefetch();
+
     /* render queue */
     renderqueue_release();
 
+    /* report the usage of collision masks (cumulative) */
+    const collisionmask_stats_t* mask_stats = collisionmask_stats();
+    logfile_message("Collision masks: %d created; %d ground maps and %d integral masks built on demand", mask_stats->masks, mask_stats->groundmaps, mask_stats->integral_masks);
+
     /* deinitialize the fields */
     strcpy(file, "");
     strcpy(name, ""); /* scripting: Level.name may be accessed on Application.onExit */
@@ -1335,6 +1635,10 @@ void level_update()
     entitymanager_remove_dead_items();
     entitymanager_remove_dead_objects();
 
+    /* prefetch the next level of the quest once its file has been read */
+    if(next_level_state == NEXTLEVEL_READING && !levparser_is_preloading(next_level_file))
+        prefetch_next_level();
+
     /* next stage in the quest... */
     if(jump_to_next_stage) {
         jump_to_next_stage = FALSE;
@@ -1468,7 +1772,7 @@ void level_update()
     waterfx_update();
 
     /* legacy camera code (runs before scripts) */
-    if(!level_is_in_debug_mode()) {
+    if(!level_is_in_debug_mode() && !camera_is_controller_enabled()) {
         if(level_cleared)
             camera_move_to(v2d_add(camera_focus->position, v2d_new(0, -90)), 0.17);
         else if(!got_dying_player)
@@ -1476,9 +1780,13 @@ void level_update()
     }
 
     /* getting the major entities */
-    rect_t brick_roi = create_roi(cam, ROI_MARGIN_UPDATE_BRICK);
-    rect_t entity_roi = create_roi(cam, ROI_MARGIN_UPDATE_ENTITY);
+    track_roi_camera(cam, dt);
+    rect_t brick_roi = create_roi_with_hysteresis(&brick_roi_state, cam, ROI_MARGIN_UPDATE_BRICK);
+    rect_t entity_roi = create_roi_with_hysteresis(&entity_roi_state, cam, ROI_MARGIN_UPDATE_ENTITY);
+    brick_roi = include_views_in_roi(brick_roi, ROI_MARGIN_UPDATE_BRICK);
+    entity_roi = include_views_in_roi(entity_roi, ROI_MARGIN_UPDATE_ENTITY);
 
+    update_streaming(brick_roi);
     brickmanager_set_roi(brick_manager, brick_roi);
     set_entitymanager_roi(entity_roi);
     entitymanager_set_active_region(entity_roi); /* legacy */
@@ -1532,14 +1840,13 @@ void level_update()
     }
 
     /* update bricks */
-    iterator_t* brick_iterator = brickmanager_retrieve_active_moving_bricks(brick_manager);
-    while(iterator_has_next(brick_iterator)) {
+    int moving_brick_count;
+    brick_t* const* moving_brick = brickmanager_active_moving_bricks(brick_manager, &moving_brick_count);
+    for(i = 0; i < moving_brick_count; i++) {
         /* no need to update static bricks.
            We won't even retrieve them! */
-        brick_t* brick = iterator_next(brick_iterator);
-        brick_update(brick, team, team_size);
+        brick_update(moving_brick[i], team, team_size);
     }
-    iterator_destroy(brick_iterator);
 
     /* early update: players */
     if(brickmanager_number_of_bricks(brick_manager) > 0) {
@@ -1561,6 +1868,9 @@ void level_update()
 
     /* update players */
     if(brickmanager_number_of_bricks(brick_manager) > 0) {
+        player_t* active_player[TEAM_MAX];
+        int active_players = 0;
+
         for(i = 0; i < team_size; i++) {
             v2d_t cam = camera_get_position();
             v2d_t pos = player_position(team[i]);
@@ -1570,9 +1880,15 @@ void level_update()
             /* updating... */
             if(rect_overlaps(roi, box) || player_is_dying(team[i]) || pos.y < 0) {
                 if(!got_dying_player || player_is_dying(team[i]) || player_is_getting_hit(team[i]))
-                    player_update(team[i], obstaclemap);
+                    active_player[active_players++] = team[i];
             }
+
+            /* companions that can't be seen run cheaper physics */
+            player_set_lightweight_physics(team[i], wants_lightweight_physics(team[i], cam));
         }
+
+        /* the physics of the players are independent of one another */
+        player_update_batch(active_player, active_players, obstaclemap);
     }
 
     /* some objects are attached to the player... */
@@ -1596,11 +1912,18 @@ void level_update()
     /* update camera */
     camera_update();
 
+    /* positional audio */
+    if(player != NULL)
+        audio_set_listener(player_position(player), camera_get_position());
+
     /* scripting: late update */
     late_update_ssobjects();
 
-    /* update dialog box */
+    /* trigger volumes */
     update_dialogregions();
+    triggervolume_update(team, team_size);
+
+    /* update dialog box */
     update_dlgbox();
 
     /* level timer */
@@ -1628,6 +1951,10 @@ void level_render()
     if(level_timer < 0.05f)
         return;
 
+    /* the video quality may have been changed in the settings */
+    if(video_get_quality() != renderqueue_quality)
+        configure_renderqueue();
+
     /* quit... */
     if(quit_level) {
         image_blit(quit_level_img, 0, 0, 0, 0, image_width(quit_level_img), image_height(quit_level_img));
@@ -1646,8 +1973,8 @@ void level_render()
        entitymanager_set_active_region() was called (i.e., via scripting).
        Let's make sure that we keep our active region updated. */
     v2d_t cam = camera_get_position(); /* we're not in editor mode */
-    rect_t brick_roi = create_roi(cam, ROI_MARGIN_RENDER_BRICK);
-    rect_t entity_roi = create_roi(cam, ROI_MARGIN_RENDER_ENTITY);
+    rect_t brick_roi = include_views_in_roi(create_roi(cam, ROI_MARGIN_RENDER_BRICK), ROI_MARGIN_RENDER_BRICK);
+    rect_t entity_roi = include_views_in_roi(create_roi_with_hysteresis(&entity_roi_state, cam, ROI_MARGIN_RENDER_ENTITY), ROI_MARGIN_RENDER_ENTITY);
 
     brickmanager_set_roi(brick_manager, brick_roi); /* this call is cheap */
     set_entitymanager_roi(entity_roi); /* this call may be expensive if the ROI has changed */
@@ -1895,18 +2222,7 @@ surgescript_object_t* level_create_object(const char* object_name, v2d_t positio
  */
 surgescript_object_t* level_get_entity_by_id(const char* entity_id)
 {
-    surgescript_object_t* level = level_ssobject();
-    surgescript_objectmanager_t* manager = surgescript_object_manager(level);
-
-    uint64_t id = str_to_x64(entity_id);
-    surgescript_object_t* entity_manager = entitymanager_ssobject();
-    surgescript_objecthandle_t handle = entitymanager_find_entity_by_id(entity_manager, id);
-
-    if(!surgescript_objectmanager_exists(manager, handle)) /* the object may have been deleted */
-        return NULL; /* not found */
-
-    /* success! */
-    return surgescript_objectmanager_get(manager, handle);
+    return find_entity(str_to_x64(entity_id));
 }
 
 
@@ -1964,6 +2280,34 @@ const obstaclemap_t* level_obstaclemap()
     return obstaclemap;
 }
 
+/*
+ * level_stats()
+ * Counts the entities of the level in the current frame. This is used
+ * for benchmarking
+ */
+levelstats_t level_stats()
+{
+    levelstats_t stats = { 0 };
+    const surgescript_objectmanager_t* manager = surgescript_object_manager(level_ssobject());
+
+    brickmanager_active_bricks(brick_manager, &stats.active_bricks);
+    stats.bricks = brickmanager_number_of_bricks(brick_manager);
+    stats.obstacles = obstaclemap_count(obstaclemap);
+    stats.ssobjects = surgescript_objectmanager_count(manager);
+
+    item_list_t* item_list = entitymanager_retrieve_active_items();
+    for(const item_list_t* it = item_list; it != NULL; it = it->next)
+        stats.active_legacy_items++;
+    entitymanager_release_retrieved_item_list(item_list);
+
+    enemy_list_t* object_list = entitymanager_retrieve_active_objects();
+    for(const enemy_list_t* it = object_list; it != NULL; it = it->next)
+        stats.active_legacy_objects++;
+    entitymanager_release_retrieved_object_list(object_list);
+
+    return stats;
+}
+
 /*
  * level_set_obstaclemap_dirty()
  * Require another update of the obstacle map after updating the scripts
@@ -2106,6 +2450,9 @@ void level_clear(actor_t *end_sign)
     /* hide dialog box, if any */
     level_hide_dialogbox();
 
+    /* preload the next level of the quest while the level cleared animation plays */
+    preload_next_level();
+
     /* success! */
     level_cleared = TRUE;
 }
@@ -2236,6 +2583,15 @@ void level_set_waterlevel(int ycoord)
     waterfx_set_ypos(ycoord);
 }
 
+/*
+ * level_is_underwater()
+ * Checks if a position is below the waterlevel or inside a water region
+ */
+bool level_is_underwater(v2d_t position)
+{
+    return waterfx_is_underwater(position);
+}
+
 /*
  * level_watercolor()
  * Returns the color of the water
@@ -2295,9 +2651,12 @@ void level_change_background(const char* filepath)
 {
     if(str_icmp(filepath, background_filepath(backgroundtheme)) != 0) {
         /* string bgtheme (original path) is untouched */
+        /* load the new theme before unloading the old one,
+           so that the images they have in common are shared */
+        bgtheme_t* old_theme = backgroundtheme;
         logfile_message("Changing level background to \"%s\"...", filepath);
-        background_unload(backgroundtheme);
         backgroundtheme = background_load(filepath);
+        background_unload(old_theme);
     }
 }
 
@@ -2339,6 +2698,78 @@ void level_save_state()
     save_level_state(&saved_state);
 }
 
+/*
+ * level_capture_snapshot()
+ * Captures the state of the level (players, bricks near the camera,
+ * registered properties of entities, etc.) into a ring buffer with
+ * its recent states. Call level_rewind() to go back in time
+ */
+void level_capture_snapshot()
+{
+    double start_time = timer_get_now();
+
+    /* snapshots are reused, so that we don't touch the heap in the long run */
+    if(snapshot_ring[snapshot_head] == NULL)
+        snapshot_ring[snapshot_head] = snapshot_create();
+
+    write_snapshot(snapshot_ring[snapshot_head]);
+    snapshot_head = (snapshot_head + 1) % SNAPSHOT_RING_SIZE;
+    snapshot_count = min(snapshot_count + 1, SNAPSHOT_RING_SIZE);
+
+    snapshot_time = timer_get_now() - start_time;
+}
+
+/*
+ * level_rewind()
+ * Restores the state of the level to the snapshot captured the given
+ * number of steps ago (1 is the latest snapshot). The newer snapshots
+ * are discarded. Returns the number of steps that were actually rewound
+ */
+int level_rewind(int steps)
+{
+    steps = clip(steps, 0, snapshot_count);
+    if(steps == 0)
+        return 0;
+
+    /* the restored snapshot becomes the latest one */
+    int index = (snapshot_head - steps + SNAPSHOT_RING_SIZE) % SNAPSHOT_RING_SIZE;
+    snapshot_head = (index + 1) % SNAPSHOT_RING_SIZE;
+    snapshot_count -= steps - 1;
+
+    if(!read_snapshot(snapshot_ring[index])) {
+        logfile_message("Can't rewind the level: invalid snapshot");
+        discard_snapshots();
+        return 0;
+    }
+
+    return steps;
+}
+
+/*
+ * level_register_snapshot_field()
+ * Includes a property of an entity (e.g., "hp") in the snapshots of the
+ * level. The property must be a number, a boolean, a string or null. The
+ * entity must have an ID. Returns true on success
+ */
+bool level_register_snapshot_field(const surgescript_object_t* entity, const char* field_name)
+{
+    if(!entity_info_exists(entity))
+        return false;
+
+    snapshotfield_t field = {
+        .entity_id = entity_info_id(entity),
+        .name = atom_intern(field_name)
+    };
+
+    for(int i = 0; i < darray_length(snapshot_field); i++) {
+        if(snapshot_field[i].entity_id == field.entity_id && snapshot_field[i].name == field.name)
+            return true;
+    }
+
+    darray_push(snapshot_field, field);
+    return true;
+}
+
 
 
 /*
@@ -2408,11 +2839,31 @@ bool level_is_in_debug_mode()
  */
 
 
+/* sets up the depth modes of the render queue according to the video quality */
+void configure_renderqueue()
+{
+    bool want_depth_buffer = (video_get_quality() < VIDEOQUALITY_MEDIUM);
+    bool want_early_z = video_is_early_z_enabled();
+
+    renderqueue_set_depth_mode(want_depth_buffer, want_early_z);
+    renderqueue_quality = video_get_quality();
+}
+
 /* renders the entities of the level: bricks, enemies, items, players, etc. */
 void render_level(const item_list_t *major_items, const enemy_list_t *major_enemies)
 {
+    /* split-screen: the entities are sorted once and rendered once per view */
+    int view_count = editor_is_enabled() ? 1 : min(camera_view_count(), RENDERQUEUE_MAX_VIEWS);
+    v2d_t view_position[RENDERQUEUE_MAX_VIEWS];
+    rect_t viewport[RENDERQUEUE_MAX_VIEWS];
+
+    for(int i = 0; i < view_count; i++) {
+        view_position[i] = camera_view_position(i);
+        viewport[i] = camera_view_viewport(i);
+    }
+
     /* starting up the render queue... */
-    renderqueue_begin( camera_get_position() );
+    renderqueue_begin_views(view_position, viewport, view_count);
 
         /* render background */
         renderqueue_enqueue_background(backgroundtheme);
@@ -2465,10 +2916,105 @@ int inside_screen(int x, int y, int w, int h, int margin)
 }
 
 
+/* reads the next level of the current quest, if any, in the background */
+void preload_next_level()
+{
+    const quest_t* quest = quest_current();
+    int next_level = quest_next_level(); /* has been incremented already */
+
+    if(quest != NULL && next_level < quest_entry_count(quest)) {
+        if(quest_entry_is_level(quest, next_level)) {
+            const char* filepath = quest_entry_path(quest, next_level);
+
+            /* already prefetching? */
+            if(next_level_state != NEXTLEVEL_NONE && str_icmp(next_level_file, filepath) == 0)
+                return;
+
+            end_next_level_prefetch();
+            levparser_preload(filepath);
+            str_cpy(next_level_file, filepath, sizeof(next_level_file));
+            next_level_state = NEXTLEVEL_READING;
+        }
+    }
+}
+
+/* decodes the images of the next level of the quest in background threads:
+   the spritesheets of its brickset, of its background and of its entities.
+   We don't prefetch the music, since it's streamed */
+void prefetch_next_level()
+{
+    char header[2][PATH_MAXLEN] = { "", "" }; /* brickset, background */
+
+    logfile_message("Prefetching the next level \"%s\"...", next_level_file);
+    next_level_state = NEXTLEVEL_PREFETCHING;
+    image_set_prefetch_budget(NEXTLEVEL_PREFETCH_BUDGET);
+    image_begin_prefetch();
+
+    if(!levparser_parse(next_level_file, header, prefetch_header_line))
+        return;
+
+    if(*header[0] != '\0')
+        brickset_prefetch(header[0]);
+    if(*header[1] != '\0')
+        background_prefetch_images(header[1]);
+
+    levparser_parse(next_level_file, NULL, level_prefetch_line);
+}
+
+/* stops prefetching the next level of the quest, discarding the unused images */
+void end_next_level_prefetch()
+{
+    if(next_level_state == NEXTLEVEL_PREFETCHING) {
+        image_end_prefetch();
+        image_set_prefetch_budget(0);
+    }
+
+    next_level_state = NEXTLEVEL_NONE;
+    *next_level_file = '\0';
+}
+
+/* reads the brickset & the background of the next level of the quest */
+bool prefetch_header_line(const char* filepath, int fileline, levparser_command_t command, const char* command_name, int param_count, const char** param, void* data)
+{
+    char (*header)[PATH_MAXLEN] = (char (*)[PATH_MAXLEN])data;
+
+    switch(command) {
+    case LEVCOMMAND_THEME:
+        if(param_count == 1)
+            str_cpy(header[0], param[0], PATH_MAXLEN);
+        break;
+
+    case LEVCOMMAND_BGTHEME:
+        if(param_count == 1)
+            str_cpy(header[1], param[0], PATH_MAXLEN);
+        break;
+
+    case LEVCOMMAND_BRICK:
+    case LEVCOMMAND_ENTITY:
+        return false; /* stop the enumeration after reading the header */
+
+    default:
+        break;
+    }
+
+    /* continue reading */
+    return true;
+}
+
 /* recalculates the size of the current level */
 void update_level_size()
 {
+    int world_width, world_height;
+
     brickmanager_recalculate_world_size(brick_manager);
+
+    /* include the regions that aren't loaded */
+    if(streamed_regions != NULL)
+        brickmanager_extend_world_size(brick_manager, streamed_world_width, streamed_world_height);
+
+    /* adapt the spatial partitioning of the legacy entities */
+    brickmanager_world_size(brick_manager, &world_width, &world_height);
+    entitymanager_set_world_size(world_width, world_height);
 }
 
 
@@ -2513,25 +3059,37 @@ void update_music()
 /* renders the bricks */
 void render_bricks()
 {
-    iterator_t* it = brickmanager_retrieve_active_bricks(brick_manager);
-    while(iterator_has_next(it)) {
-        brick_t* brick = iterator_next(it);
+    /* static bricks are rendered in batches */
+    const brickbatch_t* batch = brickmanager_retrieve_active_brick_batch(brick_manager);
+    for(int i = 0; i < brickbatch_group_count(batch); i++)
+        renderqueue_enqueue_brick_group(brickbatch_group_at(batch, i));
+
+    /* render the other bricks individually */
+    int count;
+    brick_t* const* bricks = brickmanager_active_bricks(brick_manager, &count);
+    for(int i = 0; i < count; i++) {
+        brick_t* brick = bricks[i];
 
-        renderqueue_enqueue_brick(brick);
+        if(!brickbatch_contains(batch, brick))
+            renderqueue_enqueue_brick(brick);
+
+        /* opaque bricks hide what's behind them */
+        if(brick_is_opaque(brick))
+            renderqueue_add_occluder(brick);
 
         if(must_render_brick_masks)
             renderqueue_enqueue_brick_mask(brick);
     }
-    iterator_destroy(it);
 }
 
 
 /* renders the bricks (level editor) */
 void render_bricks_debug()
 {
-    iterator_t* it = brickmanager_retrieve_active_bricks(brick_manager);
-    while(iterator_has_next(it)) {
-        brick_t* brick = iterator_next(it);
+    int count;
+    brick_t* const* bricks = brickmanager_active_bricks(brick_manager, &count);
+    for(int i = 0; i < count; i++) {
+        brick_t* brick = bricks[i];
 
         renderqueue_enqueue_brick_debug(brick);
         renderqueue_enqueue_brick_path(brick);
@@ -2539,7 +3097,6 @@ void render_bricks_debug()
         if(must_render_brick_masks)
             renderqueue_enqueue_brick_mask(brick);
     }
-    iterator_destroy(it);
 }
 
 
@@ -2601,6 +3158,87 @@ void render_hud()
 
     /* dialog box */
     render_dlgbox(fixedcam);
+
+    /* profiler overlay */
+    if(renderqueue_is_profiler_enabled())
+        render_profiler(fixedcam);
+}
+
+/* renders the entity & resource statistics of the profiler overlay */
+void render_profiler(v2d_t camera_position)
+{
+    surgescript_vm_t* vm = surgescript_vm();
+    int length = 0, requests = 0;
+    int update_period = 1, deferred_updates = 0;
+    int64_t total_deferred_updates = 0;
+    double update_time = 0.0;
+    const int padding = 8;
+
+    if(!surgescript_vm_is_active(vm))
+        return;
+
+    resourcemanagerstats_t stats = resourcemanager_stats();
+    entitymanager_late_update_stats(entitymanager_ssobject(), &length, &requests);
+    entitymanager_scheduler_stats(entitymanager_ssobject(), &update_period, &deferred_updates, &total_deferred_updates, &update_time);
+
+    /* find the largest samples */
+    audioprofile_t audio = { { NULL, NULL, NULL }, 0 };
+    resourcemanager_foreach_sample(&audio, profile_sample);
+
+    char largest[3][64] = { "", "", "" };
+    for(int i = 0; i < 3 && audio.largest[i] != NULL; i++) {
+        snprintf(largest[i], sizeof(largest[i]), "\n  %.48s (%lu KB)",
+            sound_path(audio.largest[i]),
+            (unsigned long)(sound_memory_usage(audio.largest[i]) / 1024)
+        );
+    }
+
+    size_t update_arena_peak = 0, render_arena_peak = 0;
+    engine_frame_arena_stats(&update_arena_peak, &render_arena_peak);
+
+    font_set_text(profiler_font,
+        "late update queue: %d (%d requests)\n"
+        "entity updates: %.2f ms, period %d, %d deferred (%lld total)\n"
+        "frame arenas: update %lu KB, render %lu KB (peak)\n"
+        "resources: %d images (%lu KB), %d samples (%lu KB), %d evictions\n"
+        "audio: %lu KB saved by compaction%s%s%s\n"
+        "snapshots: %d (%.2f ms, %lu KB)",
+        length, requests,
+        update_time * 1000.0, update_period, deferred_updates, (long long)total_deferred_updates,
+        (unsigned long)(update_arena_peak / 1024), (unsigned long)(render_arena_peak / 1024),
+        stats.image_count, (unsigned long)(stats.image_bytes / 1024),
+        stats.sample_count, (unsigned long)(stats.sample_bytes / 1024),
+        stats.evictions,
+        (unsigned long)(audio.saved_bytes / 1024),
+        largest[0], largest[1], largest[2],
+        snapshot_count, snapshot_time * 1000.0, (unsigned long)(snapshot_memory() / 1024)
+    );
+
+    int h = (int)(font_get_textsize(profiler_font).y);
+    font_set_position(profiler_font, v2d_new(padding, VIDEO_SCREEN_H - h - padding));
+    font_render(profiler_font, camera_position);
+}
+
+/* audio statistics of the profiler overlay */
+void profile_sample(sound_t* sample, void* data)
+{
+    audioprofile_t* audio = (audioprofile_t*)data;
+    size_t bytes = sound_memory_usage(sample);
+    const sound_t* s = sample;
+
+    audio->saved_bytes += sound_original_memory_usage(sample) - bytes;
+
+    /* keep the 3 largest samples, sorted */
+    for(int i = 0; i < 3; i++) {
+        if(audio->largest[i] == NULL || bytes > sound_memory_usage(audio->largest[i])) {
+            const sound_t* tmp = audio->largest[i];
+            audio->largest[i] = s;
+            s = tmp;
+            if(s == NULL)
+                break;
+            bytes = sound_memory_usage(s);
+        }
+    }
 }
 
 
@@ -2656,31 +3294,28 @@ void update_dlgbox()
  * this function shows the corresponding dialog box */
 void update_dialogregions()
 {
-    int i;
-    float a[4], b[4];
-
-    if(level_timer < 2.0)
+    /* the dialog regions are triggered only after a little while */
+    if(dialogregions_armed || level_timer < 2.0)
         return;
 
-    a[0] = player->actor->position.x;
-    a[1] = player->actor->position.y;
-    a[2] = a[0] + image_width(actor_image(player->actor));
-    a[3] = a[1] + image_height(actor_image(player->actor));
+    for(int i = 0; i < dialogregion_size; i++) {
+        dialogregion_t* d = &dialogregion[i];
+        if(!d->disabled)
+            triggervolume_add(d->rect_x, d->rect_y, d->rect_w, d->rect_h, on_dialogregion, d);
+    }
 
-    for(i=0; i<dialogregion_size; i++) {
-        if(dialogregion[i].disabled)
-            continue;
+    dialogregions_armed = TRUE;
+}
 
-        b[0] = dialogregion[i].rect_x;
-        b[1] = dialogregion[i].rect_y;
-        b[2] = b[0]+dialogregion[i].rect_w;
-        b[3] = b[1]+dialogregion[i].rect_h;
+/* a player has entered or exited a dialog region */
+void on_dialogregion(int volume_id, player_t* p, bool entered, void* context)
+{
+    dialogregion_t* d = (dialogregion_t*)context;
 
-        if(bounding_box(a, b)) {
-            dialogregion[i].disabled = TRUE;
-            level_call_dialogbox(dialogregion[i].title, dialogregion[i].message);
-            break;
-        }
+    if(entered && p == player && !d->disabled) {
+        d->disabled = TRUE;
+        triggervolume_remove(volume_id);
+        level_call_dialogbox(d->title, d->message);
     }
 }
 
@@ -2797,6 +3432,104 @@ rect_t create_roi(v2d_t camera, int margin)
     );
 }
 
+/* split-screen: extends a region of interest, so that it also covers
+   the other views of the level. The entities are updated only once */
+rect_t include_views_in_roi(rect_t roi, int margin)
+{
+    int view_count = level_editmode() ? 1 : camera_view_count();
+
+    for(int i = 1; i < view_count; i++) {
+        rect_t view_roi = create_roi(camera_view_position(i), margin);
+        int left = min(roi.x, view_roi.x);
+        int top = min(roi.y, view_roi.y);
+        int right = max(roi.x + roi.width, view_roi.x + view_roi.width);
+        int bottom = max(roi.y + roi.height, view_roi.y + view_roi.height);
+
+        roi = rect_new(left, top, right - left, bottom - top);
+    }
+
+    return roi;
+}
+
+/* create a region of interest with hysteresis and predictive expansion.
+   Entities within the given margin of the screen are always in the ROI */
+rect_t create_roi_with_hysteresis(roistate_t* state, v2d_t camera, int margin)
+{
+    rect_t enter_roi = create_roi(camera, margin);
+    rect_t exit_roi = create_roi(camera, margin + 2 * ROI_HYSTERESIS + ROI_MAX_LOOKAHEAD);
+    rect_t roi = state->roi;
+
+    /* keep the current ROI if enter_roi <= roi <= exit_roi */
+    if(state->is_valid &&
+        roi.x <= enter_roi.x && roi.y <= enter_roi.y &&
+        roi.x + roi.width >= enter_roi.x + enter_roi.width &&
+        roi.y + roi.height >= enter_roi.y + enter_roi.height &&
+        roi.x >= exit_roi.x && roi.y >= exit_roi.y &&
+        roi.x + roi.width <= exit_roi.x + exit_roi.width &&
+        roi.y + roi.height <= exit_roi.y + exit_roi.height
+    )
+        return roi;
+
+    /* recompute the ROI */
+    roi = create_roi(camera, margin + ROI_HYSTERESIS);
+
+    /* expand it in the direction of the camera velocity */
+    int lx = (int)(roi_camera_velocity.x * ROI_LOOKAHEAD_TIME);
+    int ly = (int)(roi_camera_velocity.y * ROI_LOOKAHEAD_TIME);
+    lx = clip(lx, -ROI_MAX_LOOKAHEAD, ROI_MAX_LOOKAHEAD);
+    ly = clip(ly, -ROI_MAX_LOOKAHEAD, ROI_MAX_LOOKAHEAD);
+
+    if(lx < 0)
+        roi.x += lx;
+    roi.width += abs(lx);
+
+    if(ly < 0)
+        roi.y += ly;
+    roi.height += abs(ly);
+
+    /* done */
+    state->roi = roi;
+    state->is_valid = true;
+    return roi;
+}
+
+/* estimate the velocity of the camera, used to expand the ROI */
+void track_roi_camera(v2d_t camera, float dt)
+{
+    if(camera_is_controller_enabled()) /* the native controller knows the velocity of the camera */
+        roi_camera_velocity = camera_get_velocity();
+    else if(is_roi_camera_tracked && dt > 0.0f)
+        roi_camera_velocity = v2d_multiply(v2d_subtract(camera, roi_camera_position), 1.0f / dt);
+    else
+        roi_camera_velocity = v2d_new(0, 0);
+
+    roi_camera_position = camera;
+    is_roi_camera_tracked = true;
+}
+
+/* forget the current ROIs, e.g., after the camera has been controlled elsewhere */
+void reset_roi_hysteresis()
+{
+    entity_roi_state.is_valid = false;
+    brick_roi_state.is_valid = false;
+    is_roi_camera_tracked = false;
+    roi_camera_velocity = v2d_new(0, 0);
+}
+
+/* companions that can't be seen don't need a full physics simulation.
+   They switch back to it as soon as they get close to the screen */
+bool wants_lightweight_physics(const player_t* player, v2d_t camera)
+{
+    if(!player_is_secondary(player) || player == level_player())
+        return false;
+
+    if(player_is_dying(player) || player_is_getting_hit(player))
+        return false;
+
+    rect_t roi = create_roi(camera, ROI_MARGIN_FULL_PHYSICS);
+    return !rect_overlaps(roi, player_bounding_box(player));
+}
+
 
 /* obstacle map */
 
@@ -2804,8 +3537,10 @@ rect_t create_roi(v2d_t camera, int margin)
 void create_obstaclemap()
 {
     is_obstaclemap_dirty = false;
+    has_static_obstacles = false;
     obstaclemap = obstaclemap_create();
     darray_init(mock_obstacles);
+    mock_obstacle_arena = arena_create(0);
 }
 
 /* destroy the obstacle map */
@@ -2814,21 +3549,24 @@ void destroy_obstaclemap()
     for(int i = 0; i < darray_length(mock_obstacles); i++)
         obstacle_destroy(mock_obstacles[i]);
     darray_release(mock_obstacles);
+    mock_obstacle_arena = arena_destroy(mock_obstacle_arena);
 
     obstaclemap_destroy(obstaclemap);
     obstaclemap = NULL;
 
     is_obstaclemap_dirty = false;
+    has_static_obstacles = false;
 }
 
-/* clear the obstacle map */
+/* clear the dynamic tier of the obstacle map */
 void clear_obstaclemap()
 {
-    obstaclemap_clear(obstaclemap);
+    obstaclemap_clear_dynamic(obstaclemap);
 
     for(int i = 0; i < darray_length(mock_obstacles); i++)
         obstacle_destroy(mock_obstacles[i]);
     darray_clear(mock_obstacles);
+    arena_reset(mock_obstacle_arena);
 }
 
 /* update the obstacle map */
@@ -2836,24 +3574,50 @@ void update_obstaclemap(const item_list_t* item_list, const object_list_t* objec
 {
     const surgescript_objectmanager_t* manager = surgescript_object_manager(level_ssobject());
 
-    /* clear the obstacle map */
+    PROFILER_BEGIN("update_obstaclemap");
+
+    /* clear the dynamic tier of the obstacle map */
     clear_obstaclemap();
 
-    /* add bricks */
-    iterator_t* brick_iterator = brickmanager_retrieve_active_bricks(brick_manager);
-    while(iterator_has_next(brick_iterator)) {
-        const brick_t* brick = iterator_next(brick_iterator);
-        const obstacle_t* obstacle = brick_obstacle(brick);
+    /* add static bricks only if they have changed */
+    unsigned version = brickmanager_active_static_bricks_version(brick_manager);
+    if(!has_static_obstacles || version != static_obstacles_version) {
+        int world_width, world_height;
+
+        /* partition space along the y-axis as well in vertical levels */
+        brickmanager_world_size(brick_manager, &world_width, &world_height);
+        obstaclemap_use_2d_grid(obstaclemap, world_height > world_width);
+
+        obstaclemap_clear(obstaclemap);
+
+        int static_brick_count;
+        brick_t* const* static_brick = brickmanager_active_static_bricks(brick_manager, &static_brick_count);
+        for(int i = 0; i < static_brick_count; i++) {
+            const obstacle_t* obstacle = brick_obstacle(static_brick[i]);
+
+            if(obstacle != NULL)
+                obstaclemap_add_static(obstaclemap, obstacle);
+        }
+
+        static_obstacles_version = version;
+        has_static_obstacles = true;
+    }
+
+    /* add moving bricks */
+    int moving_brick_count;
+    brick_t* const* moving_brick = brickmanager_active_moving_bricks(brick_manager, &moving_brick_count);
+    for(int i = 0; i < moving_brick_count; i++) {
+        const obstacle_t* obstacle = brick_obstacle(moving_brick[i]);
 
         if(obstacle != NULL)
             obstaclemap_add(obstaclemap, obstacle);
     }
-    iterator_destroy(brick_iterator);
 
     /* add brick-like objects */
-    iterator_t* bricklike_iterator = entitymanager_bricklike_iterator(entitymanager_ssobject());
-    while(iterator_has_next(bricklike_iterator)) {
-        surgescript_objecthandle_t* bricklike_handle = iterator_next(bricklike_iterator);
+    arrayiter_t bricklike_iterator;
+    entitymanager_bricklike_arrayiter(entitymanager_ssobject(), &bricklike_iterator);
+    while(arrayiter_has_next(&bricklike_iterator)) {
+        const surgescript_objecthandle_t* bricklike_handle = arrayiter_next(&bricklike_iterator);
 
         if(surgescript_objectmanager_exists(manager, *bricklike_handle)) {
             surgescript_object_t* bricklike_object = surgescript_objectmanager_get(manager, *bricklike_handle);
@@ -2866,7 +3630,6 @@ void update_obstaclemap(const item_list_t* item_list, const object_list_t* objec
             }
         }
     }
-    iterator_destroy(bricklike_iterator);
 
     /* add legacy items */
     for(; item_list; item_list = item_list->next) {
@@ -2894,6 +3657,8 @@ void update_obstaclemap(const item_list_t* item_list, const object_list_t* objec
 
     /* build the obstacle map */
     obstaclemap_build(obstaclemap);
+
+    PROFILER_END();
 }
 
 /* converts a legacy item to an obstacle */
@@ -2901,7 +3666,7 @@ obstacle_t* item2obstacle(const item_t* item)
 {
     const collisionmask_t* mask = item->mask;
     v2d_t position = v2d_subtract(item->actor->position, item->actor->hot_spot);
-    return obstacle_create(mask, point2d_new(position.x, position.y), OL_DEFAULT, OF_NONSTATIC);
+    return obstacle_create_in_arena(mock_obstacle_arena, mask, point2d_new(position.x, position.y), OL_DEFAULT, OF_NONSTATIC, NULL, NULL);
 }
 
 /* converts a legacy object to an obstacle */
@@ -2909,7 +3674,7 @@ obstacle_t* object2obstacle(const object_t* object)
 {
     const collisionmask_t* mask = object->mask;
     v2d_t position = v2d_subtract(object->actor->position, object->actor->hot_spot);
-    return obstacle_create(mask, point2d_new(position.x, position.y), OL_DEFAULT, OF_NONSTATIC);
+    return obstacle_create_in_arena(mock_obstacle_arena, mask, point2d_new(position.x, position.y), OL_DEFAULT, OF_NONSTATIC, NULL, NULL);
 }
 
 /* converts a brick-like SurgeScript object to an obstacle */
@@ -2923,12 +3688,13 @@ obstacle_t* bricklike2obstacle(const surgescript_object_t* object)
     if(scripting_brick_type(object) == BRK_CLOUD)
         flags |= OF_CLOUD;
 
-    collisionmask_t* clone = create_collisionmask_of_bricklike_object(object);
-    return obstacle_create_ex(
-        clone,
+    collisionmask_t* mask = create_collisionmask_of_bricklike_object(object);
+    return obstacle_create_in_arena(
+        mock_obstacle_arena,
+        mask,
         point2d_new(position.x, position.y),
         layer, flags,
-        destroy_collisionmask_of_bricklike_object, clone
+        destroy_collisionmask_of_bricklike_object, mask
     );
 }
 
@@ -2938,14 +3704,14 @@ collisionmask_t* create_collisionmask_of_bricklike_object(const surgescript_obje
     /* the following pointer is guaranteed to be valid during the lifetime of the obstacle_t,
        regardless of what happens with the brick-like object (i.e., it may get destroyed) */
     const collisionmask_t* mask = scripting_brick_mask(object); /* assumed to be valid */
-    return collisionmask_clone(mask); /* not very efficient, though */
+    return collisionmask_retain(mask); /* the mask is shared: no need to clone it */
 }
 
 /* destroys a collision mask created for a brick-like SurgeScript object */
 void destroy_collisionmask_of_bricklike_object(void* mask)
 {
-    collisionmask_t* clone = (collisionmask_t*)mask;
-    collisionmask_destroy(clone);
+    collisionmask_t* shared = (collisionmask_t*)mask;
+    collisionmask_destroy(shared); /* releases a reference */
 }
 
 
@@ -2976,7 +3742,15 @@ void update_ssobjects()
     surgescript_vm_t* vm = surgescript_vm();
 
     if(surgescript_vm_is_active(vm)) {
+        double start_time = timer_get_now();
+
+        PROFILER_BEGIN("surgescript_vm_update");
         surgescript_vm_update(vm);
+        PROFILER_END();
+
+        /* reactivate the entities whose update has been deferred
+           and schedule the updates of the next frame */
+        entitymanager_end_update(entitymanager_ssobject(), timer_get_now() - start_time);
     }
 }
 
@@ -3093,6 +3867,159 @@ void notify_ssobjects(const char* fun_name)
 
 
 
+/*
+ * Level streaming
+ */
+
+/*
+ * level_enable_streaming()
+ * Load the bricks of the levels by region, as the camera moves,
+ * rather than all at once. Takes effect when a level is loaded
+ */
+void level_enable_streaming(bool enable)
+{
+    is_streaming_enabled = enable;
+}
+
+/* start streaming the bricks of a level, before its body is read */
+void start_streaming(const char* filepath)
+{
+    /* the regions are read from the compiled level */
+    release_streaming();
+    if(NULL == (streamed_regions = levparser_load_regions(filepath))) {
+        logfile_message("Can't stream level \"%s\": it hasn't been compiled", filepath);
+        return;
+    }
+
+    int region_count = levparser_region_count(streamed_regions);
+    logfile_message("Streaming %d regions of level \"%s\"", region_count, filepath);
+
+    is_region_loaded = mallocx(sizeof(bool) * (region_count + 1));
+    for(int i = 0; i < region_count; i++)
+        is_region_loaded[i] = false;
+    darray_init(loaded_region);
+
+    /* measure the level without creating its bricks */
+    streamed_world_width = streamed_world_height = 0;
+    for(int i = 0; i < region_count; i++)
+        levparser_parse_region(streamed_regions, i, NULL, measure_region_line);
+
+    /* load the regions near the camera */
+    update_streaming(create_roi(camera_get_position(), ROI_MARGIN_UPDATE_BRICK));
+}
+
+/* load all regions and stop streaming the current level */
+void stop_streaming()
+{
+    if(streamed_regions == NULL)
+        return;
+
+    logfile_message("Loading all regions of the level...");
+    for(int i = levparser_region_count(streamed_regions) - 1; i >= 0; i--) {
+        if(!is_region_loaded[i])
+            load_region(i);
+    }
+
+    release_streaming();
+    update_level_size();
+}
+
+/* stop streaming the current level without loading the regions */
+void release_streaming()
+{
+    if(streamed_regions == NULL)
+        return;
+
+    darray_release(loaded_region);
+    free(is_region_loaded);
+    is_region_loaded = NULL;
+    streamed_regions = levparser_unload_regions(streamed_regions);
+}
+
+/* load the regions near the ROI and unload the ones that are far from it */
+void update_streaming(rect_t roi)
+{
+    if(streamed_regions == NULL)
+        return;
+
+    int region_size = levparser_region_size(streamed_regions);
+    rect_t load_area = rect_new(roi.x - STREAMING_MARGIN, roi.y - STREAMING_MARGIN, roi.width + 2 * STREAMING_MARGIN, roi.height + 2 * STREAMING_MARGIN);
+    rect_t keep_area = rect_new(roi.x - 2 * STREAMING_MARGIN, roi.y - 2 * STREAMING_MARGIN, roi.width + 4 * STREAMING_MARGIN, roi.height + 4 * STREAMING_MARGIN);
+
+    /* load the regions near the ROI */
+    int left = (int)floorf((float)load_area.x / region_size);
+    int top = (int)floorf((float)load_area.y / region_size);
+    int right = (int)floorf((float)(load_area.x + load_area.width - 1) / region_size);
+    int bottom = (int)floorf((float)(load_area.y + load_area.height - 1) / region_size);
+
+    for(int region_y = top; region_y <= bottom; region_y++) {
+        for(int region_x = left; region_x <= right; region_x++) {
+            int region_index = levparser_find_region(streamed_regions, region_x, region_y);
+            if(region_index >= 0 && !is_region_loaded[region_index])
+                load_region(region_index);
+        }
+    }
+
+    /* unload the regions far from the ROI. The bricks are
+       restored to their initial state when they're loaded again */
+    for(int i = darray_length(loaded_region) - 1; i >= 0; i--) {
+        rect_t rect = region_rect(loaded_region[i]);
+        if(!rect_overlaps(rect, keep_area)) {
+            brickmanager_remove_bricks_in_area(brick_manager, rect);
+            is_region_loaded[loaded_region[i]] = false;
+            darray_remove(loaded_region, i);
+        }
+    }
+}
+
+/* load the bricks of a region */
+void load_region(int region_index)
+{
+    levparser_parse_region(streamed_regions, region_index, NULL, interpret_region_line);
+    is_region_loaded[region_index] = true;
+    darray_push(loaded_region, region_index);
+}
+
+/* the area of a region, in world space */
+rect_t region_rect(int region_index)
+{
+    int region_size = levparser_region_size(streamed_regions);
+    int region_x, region_y;
+
+    levparser_region_position(streamed_regions, region_index, &region_x, &region_y);
+    return rect_new(region_x * region_size, region_y * region_size, region_size, region_size);
+}
+
+/* create the bricks of a region; the entities have been spawned with the body of the level */
+bool interpret_region_line(const char* filepath, int fileline, levparser_command_t command, const char* command_name, int param_count, const char** param, void* data)
+{
+    if(command == LEVCOMMAND_BRICK)
+        create_brick_from_line(command_name, param_count, param);
+
+    return true;
+}
+
+/* compute the size of the level */
+bool measure_region_line(const char* filepath, int fileline, levparser_command_t command, const char* command_name, int param_count, const char** param, void* data)
+{
+    if(command == LEVCOMMAND_BRICK && param_count >= 3) {
+        const image_t* image = brick_image_preview(atoi(param[0]));
+
+        if(image != NULL) {
+            int right = atoi(param[1]) + image_width(image);
+            int bottom = atoi(param[2]) + image_height(image);
+
+            streamed_world_width = max(streamed_world_width, right);
+            streamed_world_height = max(streamed_world_height, bottom);
+        }
+    }
+
+    return true;
+}
+
+
+
+
 /*
  * Additional info of SurgeScript entities
  */
@@ -3170,6 +4097,449 @@ void handle_switchout_event(const ALLEGRO_EVENT* event, void* data)
     (void)data;
 }
 
+/* handles an ALLEGRO_EVENT_DISPLAY_HALT_DRAWING event: the app is going to
+   the background (e.g., on Android) and its process may be killed */
+void handle_suspend_event(const ALLEGRO_EVENT* event, void* data)
+{
+    if(!level_editmode() && suspend_level())
+        logfile_message("The level has been suspended");
+
+    (void)event;
+    (void)data;
+}
+
+
+
+/*
+ * Snapshots
+ */
+
+/* initializes the snapshots */
+void init_snapshots()
+{
+    for(int i = 0; i < SNAPSHOT_RING_SIZE; i++)
+        snapshot_ring[i] = NULL;
+
+    snapshot_head = 0;
+    snapshot_count = 0;
+    snapshot_time = 0.0;
+
+    darray_init(snapshot_field);
+    darray_init(snapshot_brick);
+}
+
+/* releases the snapshots */
+void release_snapshots()
+{
+    darray_release(snapshot_brick);
+    darray_release(snapshot_field);
+
+    for(int i = 0; i < SNAPSHOT_RING_SIZE; i++) {
+        if(snapshot_ring[i] != NULL)
+            snapshot_ring[i] = snapshot_destroy(snapshot_ring[i]);
+    }
+
+    snapshot_head = 0;
+    snapshot_count = 0;
+}
+
+/* discards the captured snapshots and the registered properties,
+   keeping the memory of the ring buffer */
+void discard_snapshots()
+{
+    darray_clear(snapshot_field);
+
+    snapshot_head = 0;
+    snapshot_count = 0;
+}
+
+/* writes the state of the level to a snapshot */
+void write_snapshot(snapshot_t* snapshot)
+{
+    uint32_t magic = SNAPSHOT_MAGIC;
+    v2d_t camera = camera_get_position();
+    int player_index = 0, brick_count = 0, stateful_brick_count = 0;
+    int field_count = darray_length(snapshot_field);
+
+    snapshot_clear(snapshot);
+
+    /* header */
+    snapshot_put(snapshot, magic);
+    snapshot_write_string(snapshot, file);
+    snapshot_put(snapshot, level_timer);
+    snapshot_put(snapshot, camera);
+
+    /* Level.time */
+    surgescript_var_t* script_time = surgescript_var_create();
+    surgescript_object_call_function(level_ssobject(), "get_time", NULL, 0, script_time);
+    double elapsed_time = surgescript_var_get_number(script_time);
+    snapshot_put(snapshot, elapsed_time);
+    surgescript_var_destroy(script_time);
+
+    /* players */
+    for(int i = 0; i < team_size; i++) {
+        if(team[i] == player)
+            player_index = i;
+    }
+
+    snapshot_put(snapshot, team_size);
+    snapshot_put(snapshot, player_index);
+    for(int i = 0; i < team_size; i++)
+        player_save_state(team[i], snapshot);
+
+    /* bricks near the camera that break, fall, etc. The other
+       bricks are either static or a function of the level time */
+    brick_t* const* brick = brickmanager_active_bricks(brick_manager, &brick_count);
+    for(int i = 0; i < brick_count; i++)
+        stateful_brick_count += brick_is_stateful(brick[i]) ? 1 : 0;
+
+    snapshot_put(snapshot, stateful_brick_count);
+    for(int i = 0; i < brick_count; i++) {
+        if(brick_is_stateful(brick[i])) {
+            int id = brick_id(brick[i]);
+            v2d_t spawn_point = brick_spawnpoint(brick[i]);
+            bricklayer_t layer = brick_layer(brick[i]);
+            brickflip_t flip = brick_flip(brick[i]);
+
+            snapshot_put(snapshot, id);
+            snapshot_put(snapshot, spawn_point);
+            snapshot_put(snapshot, layer);
+            snapshot_put(snapshot, flip);
+            brick_save_state(brick[i], snapshot);
+        }
+    }
+
+    /* registered properties of entities */
+    snapshot_put(snapshot, field_count);
+    for(int i = 0; i < field_count; i++)
+        write_snapshot_field(snapshot, &snapshot_field[i]);
+}
+
+/* restores the state of the level from a snapshot. Returns false if the
+   snapshot is invalid or if it doesn't belong to the current level */
+bool read_snapshot(snapshot_t* snapshot)
+{
+    char level_path[PATH_MAXLEN];
+    uint32_t magic = 0;
+    float timer = 0.0f;
+    double elapsed_time = 0.0;
+    v2d_t camera = v2d_new(0, 0);
+    int saved_team_size = 0, player_index = 0, brick_count = 0, field_count = 0;
+
+    /* validate the header before changing anything */
+    snapshot_seek_start(snapshot);
+    if(!snapshot_get(snapshot, magic) || magic != SNAPSHOT_MAGIC)
+        return false;
+    else if(!snapshot_read_string(snapshot, level_path, sizeof(level_path)) || strcmp(level_path, file) != 0)
+        return false;
+    else if(!snapshot_get(snapshot, timer) || !snapshot_get(snapshot, camera) || !snapshot_get(snapshot, elapsed_time))
+        return false;
+    else if(!snapshot_get(snapshot, saved_team_size) || saved_team_size != team_size)
+        return false;
+    else if(!snapshot_get(snapshot, player_index) || player_index < 0 || player_index >= team_size)
+        return false;
+
+    /* level time & camera */
+    level_timer = timer;
+    camera_set_position(camera);
+
+    surgescript_var_t* script_time = surgescript_var_set_number(surgescript_var_create(), elapsed_time);
+    const surgescript_var_t* param[] = { script_time };
+    surgescript_object_call_function(level_ssobject(), "set_time", param, 1, NULL);
+    surgescript_var_destroy(script_time);
+
+    /* players */
+    for(int i = 0; i < team_size; i++)
+        player_load_state(team[i], snapshot);
+
+    if(team[player_index] != player)
+        level_change_player(team[player_index]);
+
+    /* bricks: match the bricks near the camera of the snapshot,
+       and recreate the ones that have been removed since then */
+    int count = 0;
+    rect_t area = create_roi(camera, ROI_MARGIN_UPDATE_BRICK);
+    brick_t* const* brick = brickmanager_bricks_in_area(brick_manager, area, &count);
+
+    darray_clear(snapshot_brick);
+    for(int i = 0; i < count; i++) {
+        if(brick_is_stateful(brick[i]))
+            darray_push(snapshot_brick, brick[i]);
+    }
+
+    if(!snapshot_get(snapshot, brick_count))
+        return false;
+
+    for(int i = 0; i < brick_count; i++) {
+        int id = 0;
+        v2d_t spawn_point = v2d_new(0, 0);
+        bricklayer_t layer = BRL_DEFAULT;
+        brickflip_t flip = BRF_NOFLIP;
+        brick_t* match = NULL;
+
+        snapshot_get(snapshot, id);
+        snapshot_get(snapshot, spawn_point);
+        snapshot_get(snapshot, layer);
+        if(!snapshot_get(snapshot, flip) || !brick_exists(id))
+            return false;
+
+        for(int j = 0; j < darray_length(snapshot_brick); j++) {
+            const brick_t* candidate = snapshot_brick[j];
+            v2d_t candidate_spawn_point = brick_spawnpoint(candidate);
+
+            if(
+                brick_id(candidate) == id &&
+                candidate_spawn_point.x == spawn_point.x &&
+                candidate_spawn_point.y == spawn_point.y &&
+                brick_layer(candidate) == layer &&
+                brick_flip(candidate) == flip
+            ) {
+                match = snapshot_brick[j];
+                darray_remove(snapshot_brick, j); /* match each brick once */
+                break;
+            }
+        }
+
+        if(match == NULL)
+            match = level_create_brick(id, spawn_point, layer, flip);
+
+        brick_load_state(match, snapshot);
+    }
+
+    level_set_obstaclemap_dirty();
+
+    /* registered properties of entities */
+    if(!snapshot_get(snapshot, field_count))
+        return false;
+
+    for(int i = 0; i < field_count; i++) {
+        if(!read_snapshot_field(snapshot))
+            return false;
+    }
+
+    /* done! */
+    return snapshot_at_end(snapshot);
+}
+
+/* writes a registered property of an entity, as well as its position */
+void write_snapshot_field(snapshot_t* snapshot, const snapshotfield_t* field)
+{
+    surgescript_object_t* entity = find_entity(field->entity_id);
+    const char* name = atom_name(field->name);
+    bool exists = (entity != NULL);
+    uint8_t type = SNAPSHOTVALUE_NONE;
+    char fun_name[128];
+
+    snapshot_put(snapshot, field->entity_id);
+    snapshot_write_string(snapshot, name);
+    snapshot_put(snapshot, exists);
+
+    if(!exists) {
+        snapshot_put(snapshot, type);
+        return;
+    }
+
+    v2d_t position = scripting_util_world_position(entity);
+    snapshot_put(snapshot, position);
+
+    /* read the property using its getter */
+    snprintf(fun_name, sizeof(fun_name), "get_%s", name);
+    if(!surgescript_object_has_function(entity, fun_name)) {
+        snapshot_put(snapshot, type);
+        return;
+    }
+
+    surgescript_var_t* value = surgescript_var_create();
+    surgescript_object_call_function(entity, fun_name, NULL, 0, value);
+
+    if(surgescript_var_is_null(value)) {
+        type = SNAPSHOTVALUE_NULL;
+        snapshot_put(snapshot, type);
+    }
+    else if(surgescript_var_is_number(value)) {
+        double number = surgescript_var_get_number(value);
+        type = SNAPSHOTVALUE_NUMBER;
+        snapshot_put(snapshot, type);
+        snapshot_put(snapshot, number);
+    }
+    else if(surgescript_var_is_bool(value)) {
+        bool boolean = surgescript_var_get_bool(value);
+        type = SNAPSHOTVALUE_BOOL;
+        snapshot_put(snapshot, type);
+        snapshot_put(snapshot, boolean);
+    }
+    else if(surgescript_var_is_string(value)) {
+        char* str = surgescript_var_get_string(value, surgescript_object_manager(entity));
+        type = SNAPSHOTVALUE_STRING;
+        snapshot_put(snapshot, type);
+        snapshot_write_string(snapshot, str);
+        ssfree(str);
+    }
+    else {
+        /* objects and the like are not stored */
+        snapshot_put(snapshot, type);
+    }
+
+    surgescript_var_destroy(value);
+}
+
+/* reads a registered property of an entity and restores it
+   if the entity still exists. Returns false on error */
+bool read_snapshot_field(snapshot_t* snapshot)
+{
+    uint64_t entity_id = 0;
+    char name[128], str[1024];
+    bool existed = false;
+    uint8_t type = SNAPSHOTVALUE_NONE;
+    v2d_t position = v2d_new(0, 0);
+    char fun_name[sizeof(name) + 4];
+
+    snapshot_get(snapshot, entity_id);
+    snapshot_read_string(snapshot, name, sizeof(name));
+    snapshot_get(snapshot, existed);
+    if(existed)
+        snapshot_get(snapshot, position);
+    if(!snapshot_get(snapshot, type))
+        return false;
+
+    /* read the value */
+    surgescript_var_t* value = surgescript_var_create();
+    switch(type) {
+        case SNAPSHOTVALUE_NONE:
+            break;
+
+        case SNAPSHOTVALUE_NULL:
+            surgescript_var_set_null(value);
+            break;
+
+        case SNAPSHOTVALUE_NUMBER: {
+            double number = 0.0;
+            snapshot_get(snapshot, number);
+            surgescript_var_set_number(value, number);
+            break;
+        }
+
+        case SNAPSHOTVALUE_BOOL: {
+            bool boolean = false;
+            snapshot_get(snapshot, boolean);
+            surgescript_var_set_bool(value, boolean);
+            break;
+        }
+
+        case SNAPSHOTVALUE_STRING:
+            snapshot_read_string(snapshot, str, sizeof(str));
+            surgescript_var_set_string(value, str);
+            break;
+
+        default:
+            surgescript_var_destroy(value);
+            return false;
+    }
+
+    /* restore the entity, if it still exists */
+    surgescript_object_t* entity = existed ? find_entity(entity_id) : NULL;
+    if(entity != NULL) {
+        scripting_util_set_world_position(entity, position);
+
+        snprintf(fun_name, sizeof(fun_name), "set_%s", name);
+        if(type != SNAPSHOTVALUE_NONE && surgescript_object_has_function(entity, fun_name)) {
+            const surgescript_var_t* param[] = { value };
+            surgescript_object_call_function(entity, fun_name, param, 1, NULL);
+        }
+    }
+
+    surgescript_var_destroy(value);
+    return true;
+}
+
+/* the memory used by the ring buffer, in bytes */
+size_t snapshot_memory()
+{
+    size_t bytes = 0;
+
+    for(int i = 0; i < SNAPSHOT_RING_SIZE; i++) {
+        if(snapshot_ring[i] != NULL)
+            bytes += snapshot_capacity(snapshot_ring[i]);
+    }
+
+    return bytes;
+}
+
+/* writes the state of the level to the suspend file */
+bool suspend_level()
+{
+    char fullpath[1024];
+    ALLEGRO_FILE* fp;
+    bool success = false;
+
+    if('\0' == *asset_cache_path(SUSPEND_FILE, fullpath, sizeof(fullpath)))
+        return false;
+    else if(NULL == (fp = al_fopen(fullpath, "wb"))) {
+        logfile_message("Can't write the suspend file to \"%s\"", fullpath);
+        return false;
+    }
+
+    snapshot_t* snapshot = snapshot_create();
+    write_snapshot(snapshot);
+    success = (al_fwrite(fp, snapshot_data(snapshot), snapshot_size(snapshot)) == snapshot_size(snapshot));
+    snapshot_destroy(snapshot);
+
+    al_fclose(fp);
+    return success;
+}
+
+/* restores the state of the level from the suspend file, if it belongs to
+   the current level. The file is removed after it is applied */
+bool resume_level()
+{
+    char fullpath[1024];
+    ALLEGRO_FILE* fp;
+    bool success = false;
+
+    if('\0' == *asset_cache_path(SUSPEND_FILE, fullpath, sizeof(fullpath)))
+        return false;
+    else if(NULL == (fp = al_fopen(fullpath, "rb")))
+        return false;
+
+    int64_t size = al_fsize(fp);
+    if(size > 0) {
+        void* data = mallocx(size);
+
+        if(al_fread(fp, data, size) == (size_t)size) {
+            snapshot_t* snapshot = snapshot_create();
+            snapshot_copy(snapshot, data, size);
+            success = read_snapshot(snapshot);
+            snapshot_destroy(snapshot);
+        }
+
+        free(data);
+    }
+
+    al_fclose(fp);
+
+    /* a suspend file of another level is kept */
+    if(success)
+        al_remove_filename(fullpath);
+
+    return success;
+}
+
+/* finds an entity by its ID. Returns NULL if there is no such entity */
+surgescript_object_t* find_entity(uint64_t entity_id)
+{
+    surgescript_object_t* level = level_ssobject();
+    surgescript_objectmanager_t* manager = surgescript_object_manager(level);
+
+    surgescript_object_t* entity_manager = entitymanager_ssobject();
+    surgescript_objecthandle_t handle = entitymanager_find_entity_by_id(entity_manager, entity_id);
+
+    if(!surgescript_objectmanager_exists(manager, handle)) /* the object may have been deleted */
+        return NULL; /* not found */
+
+    /* success! */
+    return surgescript_objectmanager_get(manager, handle);
+}
+
 
 
 
@@ -3241,6 +4611,9 @@ void editor_init()
     /* status bar */
     editor_status_init();
 
+    /* overview */
+    editor_overview_init();
+
     /* bricks */
     editor_brick_init();
     editor_cursor_entity_type = EDT_BRICK;
@@ -3274,6 +4647,9 @@ void editor_release()
     /* bricks */
     editor_brick_release();
 
+    /* overview */
+    editor_overview_release();
+
     /* status bar */
     editor_status_release();
 
@@ -3313,6 +4689,10 @@ void editor_update()
     /* mouse cursor */
     editor_cursor = editorcmd_mousepos(editor_cmd);
 
+    /* the level is saved in the background */
+    editor_update_saving();
+    editor_autosave();
+
     /* disable the level editor */
     if(editorcmd_is_triggered(editor_cmd, "quit") || editorcmd_is_triggered(editor_cmd, "quit-alt")) {
         editor_disable();
@@ -3398,10 +4778,16 @@ void editor_update()
             editor_cursor_entity_id = selected_item;
     }
 
+    /* overview */
+    editor_overview_update();
+    if(editor_overview_is_enabled())
+        return;
+
     /* ----------------------------------------- */
 
     /* set the region of interest */
     v2d_t cam = editor_camera;
+    reset_roi_hysteresis(); /* the editor sets the ROI on its own */
     rect_t brick_roi = create_roi(cam, ROI_MARGIN_EDITOR);
     rect_t entity_roi = brick_roi;
 
@@ -3506,6 +4892,15 @@ void editor_update()
         editor_action_register(eda);
     }
 
+    /* a stroke of the eraser is undone in a single step */
+    if(editor_is_eraser_enabled() != editor_is_erasing) {
+        editor_is_erasing = !editor_is_erasing;
+        if(editor_is_erasing)
+            editor_action_begin_group();
+        else
+            editor_action_end_group();
+    }
+
     /* pick or delete item */
     pick_object = editorcmd_is_triggered(editor_cmd, "pick-item");
     delete_object = editorcmd_is_triggered(editor_cmd, "delete-item") || editor_is_eraser_enabled();
@@ -3516,9 +4911,14 @@ void editor_update()
                 const brick_t* candidate = NULL;
                 bool candidate_got_collision = false;
 
-                iterator_t* it = brickmanager_retrieve_active_bricks(brick_manager);
-                while(iterator_has_next(it)) {
-                    const brick_t* brick = iterator_next(it);
+                /* query the spatial index of the bricks */
+                int count;
+                v2d_t cursor_position = v2d_add(editor_cursor, topleft);
+                rect_t cursor_area = rect_new((int)floorf(cursor_position.x) - 1, (int)floorf(cursor_position.y) - 1, 3, 3);
+                brick_t* const* bricks_at_cursor = brickmanager_bricks_in_area(brick_manager, cursor_area, &count);
+
+                for(int i = 0; i < count; i++) {
+                    const brick_t* brick = bricks_at_cursor[i];
                     v2d_t brk_topleft = brick_position(brick);
                     v2d_t brk_bottomright = v2d_add(brk_topleft, brick_size(brick));
                     float a[4] = { brk_topleft.x, brk_topleft.y, brk_bottomright.x, brk_bottomright.y };
@@ -3542,7 +4942,6 @@ void editor_update()
                         }
                     }
                 }
-                iterator_destroy(it);
 
                 if(candidate != NULL) {
                     if(pick_object) {
@@ -3629,21 +5028,7 @@ void editor_update()
 
             /* SurgeScript entity */
             case EDT_SSOBJ: {
-                surgescript_object_t* ssobject = NULL;
-                surgescript_object_t* entity_manager = entitymanager_ssobject();
-                surgescript_objectmanager_t* manager = surgescript_object_manager(entity_manager);
-
-                iterator_t* it = entitymanager_activeentities_iterator(entity_manager);
-                while(iterator_has_next(it)) {
-                    surgescript_var_t** var = iterator_next(it);
-                    surgescript_objecthandle_t entity_handle = surgescript_var_get_objecthandle(*var);
-
-                    if(surgescript_objectmanager_exists(manager, entity_handle)) {
-                        surgescript_object_t* entity = surgescript_objectmanager_get(manager, entity_handle);
-                        editor_pick_entity(entity, &ssobject);
-                    }
-                }
-                iterator_destroy(it);
+                surgescript_object_t* ssobject = editor_entity_at_cursor();
 
                 if(ssobject != NULL) {
                     int index = editor_ssobj_index(surgescript_object_name(ssobject));
@@ -3724,6 +5109,14 @@ void editor_render()
     v2d_t topleft = v2d_subtract(editor_camera, v2d_new(VIDEO_SCREEN_W/2, VIDEO_SCREEN_H/2));
     item_list_t* major_items = entitymanager_retrieve_active_items();
     enemy_list_t* major_enemies = entitymanager_retrieve_active_objects();
+
+    /* overview */
+    if(editor_overview_is_enabled()) {
+        major_items = entitymanager_release_retrieved_item_list(major_items);
+        major_enemies = entitymanager_release_retrieved_object_list(major_enemies);
+        editor_overview_render();
+        return;
+    }
     
     /* render the level */
     render_level(major_items, major_enemies);
@@ -3784,6 +5177,9 @@ void editor_enable()
     /* pause the SurgeScript VM */
     scripting_pause_vm();
 
+    /* the editor works with all bricks */
+    stop_streaming();
+
     /* changing the video mode */
     editor_previous_videomode = video_get_mode();
     video_set_mode(VIDEOMODE_FILL);
@@ -3791,6 +5187,11 @@ void editor_enable()
     /* activating the editor */
     editor_action_init();
     editor_enabled = true;
+    editor_is_saving = false;
+    editor_is_erasing = false;
+    editor_changes++; /* invalidate caches */
+    editor_has_unsaved_changes = false;
+    editor_autosave_timer = 0.0f;
     editor_camera.x = (int)camera_get_position().x;
     editor_camera.y = (int)camera_get_position().y;
     editor_cursor = v2d_new(VIDEO_SCREEN_W/2, VIDEO_SCREEN_H/2);
@@ -3810,6 +5211,7 @@ void editor_disable()
 
     /* disabling the level editor */
     editor_action_release();
+    editor_overview_clear();
     editor_enabled = false;
 
     /* changing the video mode */
@@ -3870,11 +5272,32 @@ void editor_waterline_render(int ycoord, color_t color)
 
 /*
  * editor_save()
- * Saves the level
+ * Saves the level in the background
  */
 void editor_save()
 {
-    if(level_save(file)) {
+    if(level_save_in_background(file)) {
+        editor_is_saving = true;
+        editor_has_unsaved_changes = false;
+        editor_update_saving(); /* display a message if we're done */
+    }
+    else {
+        sound_play(SFX_DENY);
+        editor_status_display("$EDITOR_MESSAGE_SAVEERROR", 0, NULL);
+    }
+}
+
+/*
+ * editor_update_saving()
+ * Displays a message when editor_save() is done
+ */
+void editor_update_saving()
+{
+    if(!editor_is_saving || levsaver_is_saving())
+        return;
+
+    editor_is_saving = false;
+    if(levsaver_wait()) {
         sound_play(SFX_SAVE);
         editor_status_display("$EDITOR_MESSAGE_SAVED", 1, (const char*[]){ file });
     }
@@ -3884,6 +5307,33 @@ void editor_save()
     }
 }
 
+/*
+ * editor_autosave()
+ * Periodically saves a copy of the level to the cache,
+ * so that unsaved work can be recovered after a crash
+ */
+void editor_autosave()
+{
+    char relative_path[PATH_MAXLEN];
+    char fullpath[PATH_MAXLEN];
+
+    /* is it time to autosave? */
+    if((editor_autosave_timer += timer_get_delta()) < EDITOR_AUTOSAVE_INTERVAL)
+        return;
+    else if(!editor_has_unsaved_changes || editor_is_saving || levsaver_is_saving())
+        return;
+
+    /* the autosave is stored in the cache and never replaces the level file */
+    editor_autosave_timer = 0.0f;
+    snprintf(relative_path, sizeof(relative_path), "autosave/%s", file);
+    if('\0' == *asset_cache_path(relative_path, fullpath, sizeof(fullpath)))
+        return;
+
+    logfile_message("Autosaving the level to \"%s\"", fullpath);
+    if(write_level_snapshot(fullpath))
+        editor_has_unsaved_changes = false;
+}
+
 
 /*
  * editor_scroll()
@@ -4655,22 +6105,8 @@ void editor_tooltip_update()
 {
     font_set_visible(editor_tooltip_font, false);
     if(editor_cursor_entity_type == EDT_SSOBJ) {
-        surgescript_object_t* target = NULL;
-        surgescript_object_t* entity_manager = entitymanager_ssobject();
-        surgescript_objectmanager_t* manager = surgescript_object_manager(entity_manager);
-
         /* locate a target (onmouseover) */
-        iterator_t* it = entitymanager_activeentities_iterator(entity_manager);
-        while(iterator_has_next(it)) {
-            surgescript_var_t** var = iterator_next(it);
-            surgescript_objecthandle_t entity_handle = surgescript_var_get_objecthandle(*var);
-
-            if(surgescript_objectmanager_exists(manager, entity_handle)) {
-                surgescript_object_t* entity = surgescript_objectmanager_get(manager, entity_handle);
-                editor_pick_entity(entity, &target);
-            }
-        }
-        iterator_destroy(it);
+        surgescript_object_t* target = editor_entity_at_cursor();
 
         /* found a target */
         if(target != NULL && !surgescript_object_is_killed(target)) {
@@ -4857,6 +6293,237 @@ void editor_status_display(const char* message, int argc, const char** argv)
 
 
 
+/* level editor: overview */
+
+/* initializes the overview */
+void editor_overview_init()
+{
+    editor_overview_enabled = false;
+    editor_overview_camera = v2d_new(0, 0);
+    editor_overview_frame = 0;
+
+    for(int i = 0; i < EDITOR_OVERVIEW_MAX_TILES; i++)
+        editor_overview_tile[i].image = NULL;
+
+    darray_init(editor_overview_bricks);
+}
+
+/* releases the overview */
+void editor_overview_release()
+{
+    editor_overview_clear();
+    darray_release(editor_overview_bricks);
+}
+
+/* is the overview enabled? */
+bool editor_overview_is_enabled()
+{
+    return editor_overview_enabled;
+}
+
+/* discards the cached tiles and leaves the overview */
+void editor_overview_clear()
+{
+    for(int i = 0; i < EDITOR_OVERVIEW_MAX_TILES; i++) {
+        if(editor_overview_tile[i].image != NULL) {
+            image_destroy(editor_overview_tile[i].image);
+            editor_overview_tile[i].image = NULL;
+        }
+    }
+
+    editor_overview_enabled = false;
+}
+
+/* updates the overview */
+void editor_overview_update()
+{
+    const float scale = EDITOR_OVERVIEW_SCALE;
+
+    /* toggle the overview */
+    if(editorcmd_is_triggered(editor_cmd, "toggle-overview")) {
+        editor_overview_enabled = !editor_overview_enabled;
+        editor_overview_camera = editor_camera;
+
+        if(editor_overview_enabled) {
+            const char* scale_str = str_from_int(EDITOR_OVERVIEW_SCALE, NULL, 0);
+            editor_status_display("$EDITOR_MESSAGE_OVERVIEWON", 1, (const char*[]){ scale_str });
+        }
+        else
+            editor_status_display("$EDITOR_MESSAGE_OVERVIEWOFF", 0, NULL);
+    }
+
+    if(!editor_overview_enabled)
+        return;
+
+    /* go to the full-detail view at the cursor */
+    if(editorcmd_is_triggered(editor_cmd, "put-item")) {
+        v2d_t topleft = v2d_subtract(editor_overview_camera, v2d_new(VIDEO_SCREEN_W * scale / 2, VIDEO_SCREEN_H * scale / 2));
+        editor_camera = v2d_add(topleft, v2d_multiply(editor_cursor, scale));
+        editor_overview_enabled = false;
+        editor_scroll(); /* clip the camera */
+        editor_status_display("$EDITOR_MESSAGE_OVERVIEWOFF", 0, NULL);
+        return;
+    }
+
+    /* scroll the overview */
+    v2d_t direction = v2d_new(0, 0);
+    if(editorcmd_is_triggered(editor_cmd, "UP") || editorcmd_is_triggered(editor_cmd, "up"))
+        direction.y -= 1.0f;
+    if(editorcmd_is_triggered(editor_cmd, "RIGHT") || editorcmd_is_triggered(editor_cmd, "right"))
+        direction.x += 1.0f;
+    if(editorcmd_is_triggered(editor_cmd, "DOWN") || editorcmd_is_triggered(editor_cmd, "down"))
+        direction.y += 1.0f;
+    if(editorcmd_is_triggered(editor_cmd, "LEFT") || editorcmd_is_triggered(editor_cmd, "left"))
+        direction.x -= 1.0f;
+
+    editor_overview_camera = v2d_add(editor_overview_camera, v2d_multiply(direction, 750.0f * scale * timer_get_delta()));
+    editor_overview_camera.x = (int)max(editor_overview_camera.x, VIDEO_SCREEN_W * scale / 2);
+    editor_overview_camera.y = (int)max(editor_overview_camera.y, VIDEO_SCREEN_H * scale / 2);
+
+    /* status bar */
+    editor_status_update();
+}
+
+/* renders the overview */
+void editor_overview_render()
+{
+    const int scale = EDITOR_OVERVIEW_SCALE;
+    const int world_tile_size = EDITOR_OVERVIEW_TILE_SIZE * EDITOR_OVERVIEW_SCALE;
+    v2d_t topleft = v2d_subtract(editor_overview_camera, v2d_new(VIDEO_SCREEN_W * scale / 2, VIDEO_SCREEN_H * scale / 2));
+    int first_col = max(0, (int)topleft.x / world_tile_size), first_row = max(0, (int)topleft.y / world_tile_size);
+    int last_col = ((int)topleft.x + VIDEO_SCREEN_W * scale) / world_tile_size;
+    int last_row = ((int)topleft.y + VIDEO_SCREEN_H * scale) / world_tile_size;
+    int budget = EDITOR_OVERVIEW_TILES_PER_FRAME;
+
+    editor_overview_frame++;
+    image_clear(EDITOR_UI_COLOR());
+
+    /* render the visible tiles, rendering the missing or outdated ones progressively */
+    for(int row = first_row; row <= last_row; row++) {
+        for(int col = first_col; col <= last_col; col++) {
+            editor_overview_tile_t* tile = editor_overview_find_tile(col, row);
+
+            if(tile == NULL && budget > 0) {
+                if(NULL != (tile = editor_overview_new_tile(col, row))) {
+                    editor_overview_render_tile(tile);
+                    budget--;
+                }
+            }
+            else if(tile != NULL && tile->changes != editor_changes && budget > 0) {
+                editor_overview_render_tile(tile);
+                budget--;
+            }
+
+            if(tile != NULL) {
+                int x = col * EDITOR_OVERVIEW_TILE_SIZE - (int)topleft.x / scale;
+                int y = row * EDITOR_OVERVIEW_TILE_SIZE - (int)topleft.y / scale;
+
+                tile->last_used = editor_overview_frame;
+                image_draw(tile->image, x, y, IF_NONE);
+            }
+        }
+    }
+
+    /* the full-detail view at the cursor */
+    int w = VIDEO_SCREEN_W / scale, h = VIDEO_SCREEN_H / scale;
+    int x = (int)editor_cursor.x - w / 2, y = (int)editor_cursor.y - h / 2;
+    image_rect(x, y, x + w, y + h, color_rgb(255, 255, 255));
+
+    /* status bar */
+    editor_status_render();
+}
+
+/* finds a cached tile */
+editor_overview_tile_t* editor_overview_find_tile(int col, int row)
+{
+    for(int i = 0; i < EDITOR_OVERVIEW_MAX_TILES; i++) {
+        editor_overview_tile_t* tile = &editor_overview_tile[i];
+        if(tile->image != NULL && tile->col == col && tile->row == row)
+            return tile;
+    }
+
+    return NULL;
+}
+
+/* creates a tile, reusing the least recently used one if the cache is full.
+   Returns NULL if all tiles are in use in this frame */
+editor_overview_tile_t* editor_overview_new_tile(int col, int row)
+{
+    editor_overview_tile_t* tile = NULL;
+
+    for(int i = 0; i < EDITOR_OVERVIEW_MAX_TILES; i++) {
+        editor_overview_tile_t* candidate = &editor_overview_tile[i];
+
+        if(candidate->image == NULL) {
+            tile = candidate;
+            break;
+        }
+        else if(candidate->last_used != editor_overview_frame && (tile == NULL || candidate->last_used < tile->last_used))
+            tile = candidate;
+    }
+
+    if(tile == NULL)
+        return NULL;
+
+    if(tile->image == NULL)
+        tile->image = image_create(EDITOR_OVERVIEW_TILE_SIZE, EDITOR_OVERVIEW_TILE_SIZE);
+
+    if(tile->image == NULL)
+        return NULL;
+
+    tile->col = col;
+    tile->row = row;
+    tile->changes = editor_changes - 1; /* not rendered */
+    tile->last_used = editor_overview_frame;
+
+    return tile;
+}
+
+/* renders the bricks of a tile at a reduced scale */
+void editor_overview_render_tile(editor_overview_tile_t* tile)
+{
+    const float scale = EDITOR_OVERVIEW_SCALE;
+    const int world_tile_size = EDITOR_OVERVIEW_TILE_SIZE * EDITOR_OVERVIEW_SCALE;
+    rect_t area = rect_new(tile->col * world_tile_size, tile->row * world_tile_size, world_tile_size, world_tile_size);
+    image_t* previous_target = image_drawing_target();
+    int count;
+
+    /* find the bricks of the tile and sort them by zindex */
+    brick_t* const* bricks = brickmanager_bricks_in_area(brick_manager, area, &count);
+    darray_clear(editor_overview_bricks);
+    for(int i = 0; i < count; i++)
+        darray_push(editor_overview_bricks, bricks[i]);
+    qsort(editor_overview_bricks, darray_length(editor_overview_bricks), sizeof(brick_t*), editor_overview_zindex_cmp);
+
+    /* render the bricks */
+    image_set_drawing_target(tile->image);
+    image_clear(color_rgba(0, 0, 0, 0));
+
+    for(int i = 0; i < darray_length(editor_overview_bricks); i++) {
+        const brick_t* brick = editor_overview_bricks[i];
+        v2d_t position = v2d_subtract(brick_position(brick), v2d_new(area.x, area.y));
+
+        image_draw_scaled(brick_image(brick),
+            (int)(position.x / scale), (int)(position.y / scale),
+            v2d_new(1.0f / scale, 1.0f / scale),
+            brick_image_flags(brick_flip(brick))
+        );
+    }
+
+    image_set_drawing_target(previous_target);
+    tile->changes = editor_changes;
+}
+
+/* compare bricks by zindex */
+int editor_overview_zindex_cmp(const void* a, const void* b)
+{
+    float za = brick_zindex(*((const brick_t**)a));
+    float zb = brick_zindex(*((const brick_t**)b));
+
+    return (za > zb) - (za < zb);
+}
+
+
 /* level editor actions */
 
 /* action: constructor (entity) */
@@ -4874,9 +6541,12 @@ editor_action_t editor_action_entity_new(int is_new_object, enum editor_entity_t
 
     /* are we removing a brick? Store its layer & flip flags */
     if(!is_new_object && obj_type == EDT_BRICK) {
-        iterator_t* it = brickmanager_retrieve_all_bricks(brick_manager);
-        while(iterator_has_next(it)) {
-            brick_t* brick = iterator_next(it);
+        int count;
+        rect_t area = rect_new((int)o.obj_position.x, (int)o.obj_position.y, 1, 1);
+        brick_t* const* bricks = brickmanager_bricks_in_area(brick_manager, area, &count);
+
+        for(int i = 0; i < count; i++) {
+            brick_t* brick = bricks[i];
 
             if(brick_id(brick) == o.obj_id) {
                 v2d_t delta = v2d_subtract(brick_position(brick), o.obj_position);
@@ -4889,7 +6559,6 @@ editor_action_t editor_action_entity_new(int is_new_object, enum editor_entity_t
                 }
             }
         }
-        iterator_destroy(it);
     }
 
     return o;
@@ -4928,65 +6597,95 @@ editor_action_t editor_action_waterlevel_new(int is_changing, int new_waterlevel
 /* initializes the editor_action module */
 void editor_action_init()
 {
-    /* linked list */
-    editor_action_buffer_head = mallocx(sizeof *editor_action_buffer_head);
-    editor_action_buffer_head->in_group = FALSE;
-    editor_action_buffer_head->prev = NULL;
-    editor_action_buffer_head->next = NULL;
-    editor_action_buffer = editor_action_buffer_head;
-    editor_action_buffer_cursor = editor_action_buffer_head;
+    /* command log */
+    editor_action_log_capacity = EDITOR_ACTION_LOG_INITIALSIZE;
+    editor_action_log = mallocx(editor_action_log_capacity * sizeof(*editor_action_log));
+    editor_action_log_first = 0;
+    editor_action_log_count = 0;
+    editor_action_log_cursor = 0;
+
+    /* groups */
+    editor_action_group = 0;
+    editor_action_group_depth = 0;
 }
 
 /* releases the editor_action module */
 void editor_action_release()
 {
-    /* linked list */
-    editor_action_buffer_head = editor_action_delete_list(editor_action_buffer_head);
-    editor_action_buffer = NULL;
-    editor_action_buffer_cursor = NULL;
+    /* command log */
+    free(editor_action_log);
+    editor_action_log = NULL;
+    editor_action_log_capacity = 0;
+    editor_action_log_first = 0;
+    editor_action_log_count = 0;
+    editor_action_log_cursor = 0;
+}
+
+/* the actions registered between a call to this function and
+   editor_action_end_group() will be undone in a single step */
+void editor_action_begin_group()
+{
+    if(editor_action_group_depth++ == 0)
+        editor_action_group++;
+}
+
+/* ends a group of actions */
+void editor_action_end_group()
+{
+    if(editor_action_group_depth > 0)
+        editor_action_group_depth--;
 }
 
 /* registers a new editor_action */
 void editor_action_register(editor_action_t action)
 {
-    /* ugly, but these fancy group stuff
-     * shouldn't be availiable on the interface */
-    static int registering_group = FALSE;
-    static uint32_t group_key;
-
     if(action.obj_type != EDT_GROUP) {
-        editor_action_list_t *c, *it, *node;
-
-        /* creating new node */
-        node = mallocx(sizeof *node);
-        node->action = action;
-        node->in_group = registering_group;
-        if(node->in_group)
-            node->group_key = group_key;
-
-        /* cursor */
-        c = editor_action_buffer_cursor;
-        if(c != NULL)
-            c->next = editor_action_delete_list(c->next);
-
-        /* inserting the node into the linked list */
-        it = editor_action_buffer;
-        while(it->next != NULL)
-            it = it->next;
-        it->next = node;
-        node->prev = it;
-        node->next = NULL;
-
-        /* updating the cursor */
-        editor_action_buffer_cursor = node;
+        /* discard the actions that could be redone */
+        editor_action_log_count = editor_action_log_cursor;
+
+        /* the log is full */
+        if(editor_action_log_count == editor_action_log_capacity) {
+            if(editor_action_log_capacity < EDITOR_ACTION_LOG_MAXSIZE) {
+                /* grow the ring buffer, making it contiguous */
+                int capacity = editor_action_log_capacity * 2;
+                editor_action_record_t* log = mallocx(capacity * sizeof(*log));
+
+                for(int i = 0; i < editor_action_log_count; i++)
+                    log[i] = *editor_action_log_at(i);
+
+                free(editor_action_log);
+                editor_action_log = log;
+                editor_action_log_capacity = capacity;
+                editor_action_log_first = 0;
+            }
+            else {
+                /* forget the oldest step */
+                uint32_t group = editor_action_log_at(0)->group;
+
+                do {
+                    editor_action_log_first = (editor_action_log_first + 1) & (editor_action_log_capacity - 1);
+                    editor_action_log_count--;
+                } while(editor_action_log_count > 0 && editor_action_log_at(0)->group == group);
+
+                editor_action_log_cursor = editor_action_log_count;
+            }
+        }
+
+        /* an action that is not part of a group is a step of its own */
+        if(editor_action_group_depth == 0)
+            editor_action_group++;
+
+        /* append the action */
+        editor_action_record_t* record = editor_action_log_at(editor_action_log_count++);
+        record->action = action;
+        record->group = editor_action_group;
+        editor_action_log_cursor = editor_action_log_count;
     }
     else {
-        static uint32_t auto_increment = 0xbeef; /* dummy value */
         editorgrp_entity_list_t *list, *it;
 
         /* registering a group of objects */
-        registering_group = TRUE;
-        group_key = auto_increment++;
+        editor_action_begin_group();
         list = editorgrp_get_group(action.obj_id);
         for(it=list; it; it=it->next) {
             editor_action_t a;
@@ -4995,51 +6694,40 @@ void editor_action_register(editor_action_t action)
             a = editor_action_entity_new(TRUE, my_type, e.id, v2d_add(e.position, action.obj_position));
             editor_action_register(a);
         }
-        registering_group = FALSE;
+        editor_action_end_group();
     }
 }
 
-/* deletes an editor_action list */
-editor_action_list_t* editor_action_delete_list(editor_action_list_t *list)
+/* the i-th oldest action of the log */
+editor_action_record_t* editor_action_log_at(int i)
 {
-    editor_action_list_t *p, *next;
-
-    p = list;
-    while(p != NULL) {
-        next = p->next;
-        free(p);
-        p = next;
-    }
-
-    return NULL;
+    return &editor_action_log[(editor_action_log_first + i) & (editor_action_log_capacity - 1)];
 }
 
 /* undo */
 void editor_action_undo()
 {
-    editor_action_list_t *p;
     editor_action_t a;
 
-    if(editor_action_buffer_cursor != editor_action_buffer_head) {
-        /* moving the cursor */
-        p = editor_action_buffer_cursor;
-        editor_action_buffer_cursor = editor_action_buffer_cursor->prev;
-
-        /* UNDOing a group? */
-        if(p->in_group && p->prev && p->prev->in_group && p->group_key == p->prev->group_key)
-            editor_action_undo();
-
-        /* undo */
-        a = p->action;
-        a.type = /* reverse of a.type ??? */
-        (a.type == EDA_NEWOBJECT) ? EDA_DELETEOBJECT :
-        (a.type == EDA_DELETEOBJECT) ? EDA_NEWOBJECT :
-        (a.type == EDA_CHANGESPAWN) ? EDA_RESTORESPAWN :
-        (a.type == EDA_RESTORESPAWN) ? EDA_CHANGESPAWN :
-        (a.type == EDA_CHANGEWATER) ? EDA_RESTOREWATER :
-        (a.type == EDA_RESTOREWATER) ? EDA_CHANGEWATER :
-        a.type;
-        editor_action_commit(a);
+    if(editor_action_log_cursor > 0) {
+        uint32_t group = editor_action_log_at(editor_action_log_cursor - 1)->group;
+
+        /* undo a step, which may be a group of actions */
+        while(editor_action_log_cursor > 0 && editor_action_log_at(editor_action_log_cursor - 1)->group == group) {
+            /* moving the cursor */
+            a = editor_action_log_at(--editor_action_log_cursor)->action;
+
+            /* undo */
+            a.type = /* reverse of a.type ??? */
+            (a.type == EDA_NEWOBJECT) ? EDA_DELETEOBJECT :
+            (a.type == EDA_DELETEOBJECT) ? EDA_NEWOBJECT :
+            (a.type == EDA_CHANGESPAWN) ? EDA_RESTORESPAWN :
+            (a.type == EDA_RESTORESPAWN) ? EDA_CHANGESPAWN :
+            (a.type == EDA_CHANGEWATER) ? EDA_RESTOREWATER :
+            (a.type == EDA_RESTOREWATER) ? EDA_CHANGEWATER :
+            a.type;
+            editor_action_commit(a);
+        }
     }
     else
         editor_status_display("$EDITOR_MESSAGE_UNDOERROR", 0, NULL);
@@ -5049,21 +6737,19 @@ void editor_action_undo()
 /* redo */
 void editor_action_redo()
 {
-    editor_action_list_t *p;
     editor_action_t a;
 
-    if(editor_action_buffer_cursor->next != NULL) {
-        /* moving the cursor */
-        editor_action_buffer_cursor = editor_action_buffer_cursor->next;
-        p = editor_action_buffer_cursor;
+    if(editor_action_log_cursor < editor_action_log_count) {
+        uint32_t group = editor_action_log_at(editor_action_log_cursor)->group;
 
-        /* REDOing a group? */
-        if(p->in_group && p->next && p->next->in_group && p->group_key == p->next->group_key)
-            editor_action_redo();
-        
-        /* redo */
-        a = p->action;
-        editor_action_commit(a);
+        /* redo a step, which may be a group of actions */
+        while(editor_action_log_cursor < editor_action_log_count && editor_action_log_at(editor_action_log_cursor)->group == group) {
+            /* moving the cursor */
+            a = editor_action_log_at(editor_action_log_cursor++)->action;
+
+            /* redo */
+            editor_action_commit(a);
+        }
     }
     else
         editor_status_display("$EDITOR_MESSAGE_REDOERROR", 0, NULL);
@@ -5072,6 +6758,12 @@ void editor_action_redo()
 /* commit action */
 editor_action_t editor_action_commit(editor_action_t action)
 {
+    /* entities may have been created or removed */
+    editor_changes++;
+
+    /* the level will be autosaved */
+    editor_has_unsaved_changes = true;
+
     if(action.type == EDA_NEWOBJECT) {
         /* new object */
         switch(action.obj_type) {
@@ -5153,9 +6845,12 @@ editor_action_t editor_action_commit(editor_action_t action)
         switch(action.obj_type) {
             case EDT_BRICK: {
                 /* delete brick */
-                iterator_t* it = brickmanager_retrieve_all_bricks(brick_manager);
-                while(iterator_has_next(it)) {
-                    brick_t* brick = iterator_next(it);
+                int count;
+                rect_t area = rect_new((int)action.obj_position.x, (int)action.obj_position.y, 1, 1);
+                brick_t* const* bricks = brickmanager_bricks_in_area(brick_manager, area, &count);
+
+                for(int i = 0; i < count; i++) {
+                    brick_t* brick = bricks[i];
 
                     if(brick_id(brick) == action.obj_id) {
                         v2d_t delta = v2d_subtract(brick_position(brick), action.obj_position);
@@ -5165,7 +6860,6 @@ editor_action_t editor_action_commit(editor_action_t action)
                             brick_kill(brick);
                     }
                 }
-                iterator_destroy(it);
                 break;
             }
 
@@ -5273,3 +6967,48 @@ void editor_pick_entity(surgescript_object_t* object, surgescript_object_t** bes
         }
     }
 }
+
+/* finds the best SurgeScript entity under the cursor. Entities don't move
+   while the editor is enabled, so the result is cached until the cursor
+   moves or until an action is committed */
+surgescript_object_t* editor_entity_at_cursor()
+{
+    v2d_t topleft = v2d_subtract(editor_camera, v2d_new(VIDEO_SCREEN_W/2, VIDEO_SCREEN_H/2));
+    v2d_t position = v2d_add(editor_cursor, topleft);
+    surgescript_object_t* entity_manager = entitymanager_ssobject();
+    surgescript_objectmanager_t* manager = surgescript_object_manager(entity_manager);
+    surgescript_object_t* target = NULL;
+
+    /* use the cached result */
+    if(
+        editor_entity_at_cursor_cache.changes == editor_changes &&
+        nearly_zero(v2d_magnitude(v2d_subtract(editor_entity_at_cursor_cache.position, position)))
+    ) {
+        if(!editor_entity_at_cursor_cache.has_target)
+            return NULL;
+        else if(surgescript_objectmanager_exists(manager, editor_entity_at_cursor_cache.target))
+            return surgescript_objectmanager_get(manager, editor_entity_at_cursor_cache.target);
+    }
+
+    /* scan the active entities */
+    iterator_t* it = entitymanager_activeentities_iterator(entity_manager);
+    while(iterator_has_next(it)) {
+        surgescript_var_t** var = iterator_next(it);
+        surgescript_objecthandle_t entity_handle = surgescript_var_get_objecthandle(*var);
+
+        if(surgescript_objectmanager_exists(manager, entity_handle)) {
+            surgescript_object_t* entity = surgescript_objectmanager_get(manager, entity_handle);
+            editor_pick_entity(entity, &target);
+        }
+    }
+    iterator_destroy(it);
+
+    /* cache the result */
+    editor_entity_at_cursor_cache.position = position;
+    editor_entity_at_cursor_cache.changes = editor_changes;
+    editor_entity_at_cursor_cache.has_target = (target != NULL);
+    if(target != NULL)
+        editor_entity_at_cursor_cache.target = surgescript_object_handle(target);
+
+    return target;
+}
@@ -32,6 +32,8 @@ void level_init(void *path_to_lev_file); /* pass a string containing the path to
 void level_update();
 void level_render();
 void level_release();
+void level_preload(void *path_to_lev_file); /* reads the .lev file in the background */
+bool level_is_preloading(void *path_to_lev_file);
 
 
 
@@ -98,6 +100,7 @@ void level_restart();
 void level_abort();
 void level_push_quest(const char* path_to_qst_file);
 void level_quit_with_gameover();
+void level_enable_streaming(bool enable); /* load the bricks of the levels by region */
 
 /* level state */
 void level_save_state();
@@ -105,12 +108,18 @@ void level_set_spawnpoint(v2d_t newpos);
 v2d_t level_spawnpoint();
 int level_waterlevel();
 void level_set_waterlevel(int ycoord);
+bool level_is_underwater(v2d_t position); /* below the waterlevel or inside a water region? */
 color_t level_watercolor();
 void level_set_watercolor(color_t color);
 void level_set_act(int new_act_number);
 void level_change_background(const char* filepath);
 const struct bgtheme_t* level_background();
 
+/* snapshots */
+void level_capture_snapshot(); /* captures the state of the level into a ring buffer of recent states */
+int level_rewind(int steps); /* restores a recent state (1 is the latest snapshot); returns the number of steps rewound */
+bool level_register_snapshot_field(const surgescript_object_t* entity, const char* field_name); /* includes a property of an entity in the snapshots */
+
 /* misc */
 v2d_t level_size();
 int level_height_at(int xpos);
@@ -120,6 +129,18 @@ void level_add_to_score(int score);
 void level_call_dialogbox(const char *title, const char *message);
 void level_hide_dialogbox();
 
+/* statistics */
+typedef struct levelstats_t levelstats_t;
+struct levelstats_t {
+    int bricks; /* number of bricks of the level */
+    int active_bricks; /* number of bricks near the camera */
+    int obstacles; /* number of obstacles in the obstacle map */
+    int active_legacy_items; /* number of legacy items near the camera */
+    int active_legacy_objects; /* number of legacy objects near the camera */
+    int ssobjects; /* number of SurgeScript objects */
+};
+levelstats_t level_stats(); /* a snapshot of the current frame */
+
 /* editor & development */
 int level_editmode(); /* active editor? */
 int level_is_displaying_gizmos(); /* are we displaying gizmos for visual debugging? */
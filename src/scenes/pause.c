@@ -557,6 +557,9 @@ void pause_render()
 {
     v2d_t camera = v2d_multiply(video_get_screen_size(), 0.5f);
 
+    /* the level is frozen: skip the presentation if nothing changes */
+    video_enable_dirty_tracking();
+
     /* legacy mode? */
     if(legacy_mode) {
         legacy_render();
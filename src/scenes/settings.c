@@ -471,6 +471,9 @@ void settings_update()
  */
 void settings_render()
 {
+    /* skip the presentation if nothing changes */
+    video_enable_dirty_tracking();
+
     background_render_bg(background, camera);
 
     render_entries(camera);
@@ -964,12 +967,6 @@ void change_quality(settings_entry_t* e)
 
     int i = e->index_of_current_value;
     video_set_quality(new_quality[i]);
-
-    /* coming soon */
-    if(new_quality[i] == VIDEOQUALITY_HIGH) {
-        sound_play(SFX_DENY);
-        alert("%s", lang_get("OPTIONS_COMINGSOON"));
-    }
 }
 
 void init_quality(settings_entry_t* e)
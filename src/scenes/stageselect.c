@@ -22,6 +22,8 @@
 #include <math.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <allegro5/allegro.h>
 #include "stageselect.h"
 #include "util/levparser.h"
 #include "settings.h"
@@ -43,6 +45,7 @@
 #include "../util/numeric.h"
 #include "../util/util.h"
 #include "../util/stringutil.h"
+#include "../util/hashtable.h"
 #include "../entities/actor.h"
 #include "../entities/background.h"
 #include "../entities/player.h"
@@ -65,6 +68,31 @@ static stagedata_t* stagedata_load(const char *filename, bool is_quest);
 static void stagedata_unload(stagedata_t *s);
 static bool interpret_level_line(const char *filepath, int fileline, levparser_command_t command, const char *command_name, int param_count, const char** param, void* data);
 
+/* cached metadata of a level file. Parsing the header of every level
+   whenever the screen opens is slow when there are many levels installed,
+   so we keep the metadata in a cache file keyed by modification time & size */
+typedef struct stagecache_t stagecache_t;
+struct stagecache_t {
+    char* filepath; /* relative path */
+    int64_t mtime; /* last modification time of the level file */
+    int64_t size; /* size of the level file, in bytes */
+    char name[256]; /* stage name */
+    int act; /* zone number */
+    bool is_used; /* was this entry looked up in the current listing? */
+};
+
+static stagecache_t* stagecache_create(const char* filepath);
+static void stagecache_destroy(stagecache_t* entry);
+HASHTABLE_GENERATE_CODE(stagecache_t, stagecache_destroy);
+static HASHTABLE(stagecache_t, stage_cache);
+static bool stage_cache_changed = false; /* should we rewrite the cache file? */
+static int stage_cache_loaded = 0; /* number of entries read from the cache file */
+static int stage_cache_hits = 0; /* number of entries used in the current listing */
+static void load_stage_cache();
+static void save_stage_cache();
+static void write_cache_entry(stagecache_t* entry, void* fp);
+static bool stat_level(const char* vpath, int64_t* mtime, int64_t* size);
+
 
 
 /* private data */
@@ -72,6 +100,8 @@ static bool interpret_level_line(const char *filepath, int fileline, levparser_c
 #define STAGE_MAXPERPAGE         (VIDEO_SCREEN_H / 30)
 #define STAGE_MAX                2048 /* can't have more than STAGE_MAX levels installed */
 #define STAGE_PREFSENTRY         ".lastselectedlevel"
+#define STAGE_CACHEFILE          "stageselect.cache" /* relative to the cache directory */
+#define STAGE_CACHEVERSION       "opensurge-stageselect-cache 1" /* first line of the cache file */
 static font_t *title; /* title */
 static font_t *msg; /* message */
 static font_t *page; /* page number */
@@ -244,6 +274,10 @@ void stageselect_update()
                     save_selection(option);
                     sound_play(SFX_CONFIRM);
                     state = STAGESTATE_PLAY;
+
+                    /* read the level while fading out */
+                    if(!selected_stage->is_quest)
+                        scenestack_preload(storyboard_get_scene(SCENE_LEVEL), selected_stage->filepath);
                 }
             }
             break;
@@ -261,7 +295,9 @@ void stageselect_update()
 
         /* fade-out effect (play a level) */
         case STAGESTATE_PLAY: {
-            if(fadefx_is_over()) {
+            bool is_preloading = !selected_stage->is_quest && scenestack_is_preloading(storyboard_get_scene(SCENE_LEVEL), selected_stage->filepath);
+
+            if(fadefx_is_over() && !is_preloading) {
                 /* scripting: reset global variables & arrays */
                 symboltable_clear(symboltable_get_global_table());
                 nanocalc_addons_resetarrays();
@@ -317,6 +353,9 @@ void stageselect_render()
 {
     v2d_t cam = v2d_new(VIDEO_SCREEN_W/2, VIDEO_SCREEN_H/2);
 
+    /* skip the presentation if nothing changes */
+    video_enable_dirty_tracking();
+
     background_render_bg(bgtheme, cam);
     background_render_fg(bgtheme, cam);
 
@@ -350,7 +389,9 @@ void load_stage_list()
 
     /* loading data */
     stage_count = 0;
+    load_stage_cache();
     asset_foreach_file("levels", ".lev", dirfill, "L", enable_debug);
+    save_stage_cache();
     if(enable_debug) {
         asset_foreach_file("quests", ".qst", dirfill, "Q", true);
         qsort(stage_data, stage_count, sizeof(stagedata_t*), debug_sort_cmp);
@@ -447,12 +488,40 @@ stagedata_t* stagedata_load(const char *filename, bool is_quest)
         snprintf(s->name, sizeof(s->name), "%s", s->filepath + (skip_prefix ? PREFIX_LENGTH : 0));
     }
     else if(!is_quest) {
+        int64_t mtime = 0, size = 0;
+        bool can_cache = stat_level(s->filepath, &mtime, &size);
+        stagecache_t* entry = can_cache ? hashtable_stagecache_t_find(stage_cache, s->filepath) : NULL;
+
+        /* use the cached header if the file hasn't been modified */
+        if(entry != NULL && entry->mtime == mtime && entry->size == size) {
+            str_cpy(s->name, entry->name, sizeof(s->name));
+            s->act = entry->act;
+            entry->is_used = true;
+            stage_cache_hits++;
+            return s;
+        }
+
         /* read the .lev file */
         if(!levparser_parse(s->filepath, s, interpret_level_line)) {
             logfile_message("Level select: can't parse level file \"%s\"", s->filepath);
             stagedata_unload(s);
             return NULL;
         }
+
+        /* update the cache */
+        if(can_cache) {
+            if(entry == NULL) {
+                entry = stagecache_create(s->filepath);
+                hashtable_stagecache_t_add(stage_cache, entry->filepath, entry);
+            }
+
+            str_cpy(entry->name, s->name, sizeof(entry->name));
+            entry->act = s->act;
+            entry->mtime = mtime;
+            entry->size = size;
+            entry->is_used = true;
+            stage_cache_changed = true;
+        }
     }
 
     /* done! */
@@ -494,6 +563,146 @@ bool interpret_level_line(const char *filepath, int fileline, levparser_command_
     return true;
 }
 
+/* stagecache_t constructor */
+stagecache_t* stagecache_create(const char* filepath)
+{
+    stagecache_t* entry = mallocx(sizeof *entry);
+
+    entry->filepath = str_dup(filepath);
+    entry->mtime = 0;
+    entry->size = 0;
+    entry->name[0] = '\0';
+    entry->act = 0;
+    entry->is_used = false;
+
+    return entry;
+}
+
+/* stagecache_t destructor */
+void stagecache_destroy(stagecache_t* entry)
+{
+    free(entry->filepath);
+    free(entry);
+}
+
+/* loads the cached metadata of the levels */
+void load_stage_cache()
+{
+    char fullpath[1024], line[1024];
+    ALLEGRO_FILE* fp;
+
+    stage_cache = hashtable_stagecache_t_create();
+    stage_cache_changed = false;
+    stage_cache_loaded = 0;
+    stage_cache_hits = 0;
+
+    /* the cache is only used in the regular (non-debug) listing */
+    if(enable_debug)
+        return;
+
+    /* open the cache file */
+    if('\0' == *asset_cache_path(STAGE_CACHEFILE, fullpath, sizeof(fullpath)))
+        return;
+    else if(NULL == (fp = al_fopen(fullpath, "rb")))
+        return;
+
+    /* check the version */
+    if(al_fgets(fp, line, sizeof(line)) == NULL || strncmp(line, STAGE_CACHEVERSION, strlen(STAGE_CACHEVERSION)) != 0) {
+        logfile_message("Level select: discarding an outdated cache");
+        al_fclose(fp);
+        stage_cache_changed = true;
+        return;
+    }
+
+    /* read the entries: mtime <TAB> size <TAB> act <TAB> filepath <TAB> name */
+    while(al_fgets(fp, line, sizeof(line)) != NULL) {
+        char* field[5] = { line };
+        int n = 1;
+
+        line[strcspn(line, "\r\n")] = '\0';
+        for(char* p = line; n < 5 && NULL != (p = strchr(p, '\t')); n++) {
+            *(p++) = '\0';
+            field[n] = p;
+        }
+
+        if(n < 5 || *field[3] == '\0' || hashtable_stagecache_t_find(stage_cache, field[3]) != NULL)
+            continue;
+
+        stagecache_t* entry = stagecache_create(field[3]);
+        entry->mtime = (int64_t)strtoll(field[0], NULL, 10);
+        entry->size = (int64_t)strtoll(field[1], NULL, 10);
+        entry->act = atoi(field[2]);
+        str_cpy(entry->name, field[4], sizeof(entry->name));
+        hashtable_stagecache_t_add(stage_cache, entry->filepath, entry);
+        stage_cache_loaded++;
+    }
+
+    al_fclose(fp);
+}
+
+/* saves the cached metadata of the levels, dropping the entries of the levels that are gone */
+void save_stage_cache()
+{
+    char fullpath[1024];
+    ALLEGRO_FILE* fp;
+
+    /* nothing to save? */
+    if(enable_debug || (!stage_cache_changed && stage_cache_hits == stage_cache_loaded))
+        goto done;
+
+    /* write the cache file */
+    if('\0' == *asset_cache_path(STAGE_CACHEFILE, fullpath, sizeof(fullpath)))
+        goto done;
+    else if(NULL == (fp = al_fopen(fullpath, "wb"))) {
+        logfile_message("Level select: can't write the cache to \"%s\"", fullpath);
+        goto done;
+    }
+
+    al_fprintf(fp, "%s\n", STAGE_CACHEVERSION);
+    hashtable_stagecache_t_foreach(stage_cache, fp, write_cache_entry);
+    al_fclose(fp);
+
+done:
+    stage_cache = hashtable_stagecache_t_destroy(stage_cache);
+}
+
+/* writes an entry to the cache file */
+void write_cache_entry(stagecache_t* entry, void* fp)
+{
+    /* skip the levels that are gone & the fields that can't be stored */
+    if(!entry->is_used)
+        return;
+    else if(strpbrk(entry->filepath, "\t\r\n") != NULL || strpbrk(entry->name, "\t\r\n") != NULL)
+        return;
+
+    al_fprintf((ALLEGRO_FILE*)fp, "%lld\t%lld\t%d\t%s\t%s\n",
+        (long long)entry->mtime,
+        (long long)entry->size,
+        entry->act,
+        entry->filepath,
+        entry->name
+    );
+}
+
+/* the modification time & the size of a level file */
+bool stat_level(const char* vpath, int64_t* mtime, int64_t* size)
+{
+    ALLEGRO_FS_ENTRY* entry = al_create_fs_entry(asset_path(vpath));
+    bool success = false;
+
+    if(entry == NULL)
+        return false;
+
+    if(al_fs_entry_exists(entry) && (al_get_fs_entry_mode(entry) & ALLEGRO_FILEMODE_ISFILE)) {
+        *mtime = (int64_t)al_get_fs_entry_mtime(entry);
+        *size = (int64_t)al_get_fs_entry_size(entry);
+        success = true;
+    }
+
+    al_destroy_fs_entry(entry);
+    return success;
+}
+
 /* load a level that was previously selected by the user */
 int load_selection()
 {
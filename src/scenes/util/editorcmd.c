@@ -74,7 +74,8 @@ static const command_t command[] = {
     { "flip-previous", "Shift+F" },
     { "layer-next", "L" },
     { "layer-previous", "Shift+L" },
-    { "toggle-masks", "M" }
+    { "toggle-masks", "M" },
+    { "toggle-overview", "O" }
 };
 static const int command_count = sizeof(command) / sizeof(command_t);
 static bool hotkey_is_triggered(const editorcmd_t* cmd, const char* hotkey);
@@ -82,7 +83,7 @@ static bool hotkey_is_triggered(const editorcmd_t* cmd, const char* hotkey);
 /* editorcmd_t struct */
 struct editorcmd_t
 {
-    input_t* keyboard[2];
+    input_t* keyboard[3];
     input_t* mouse;
 };
 
@@ -99,6 +100,7 @@ editorcmd_t* editorcmd_create()
     editorcmd_t* cmd = mallocx(sizeof *cmd);
     cmd->keyboard[0] = input_create_user("editorcmd1");
     cmd->keyboard[1] = input_create_user("editorcmd2");
+    cmd->keyboard[2] = input_create_user("editorcmd3");
     cmd->mouse = input_create_mouse();
     return cmd;
 }
@@ -110,6 +112,7 @@ editorcmd_t* editorcmd_create()
 editorcmd_t* editorcmd_destroy(editorcmd_t* cmd)
 {
     input_destroy(cmd->mouse);
+    input_destroy(cmd->keyboard[2]);
     input_destroy(cmd->keyboard[1]);
     input_destroy(cmd->keyboard[0]);
     free(cmd);
@@ -206,6 +209,7 @@ bool hotkey_is_triggered(const editorcmd_t* cmd, const char* hotkey)
         case 'F': return input_button_pressed(cmd->keyboard[1], IB_FIRE6);
         case 'Z': return input_button_pressed(cmd->keyboard[1], IB_FIRE7);
         case 'Y': return input_button_pressed(cmd->keyboard[1], IB_FIRE8);
+        case 'O': return input_button_pressed(cmd->keyboard[2], IB_FIRE1);
     }
 
     /* nope */
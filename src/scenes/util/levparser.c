@@ -19,20 +19,159 @@
  */
 
 #include <allegro5/allegro.h>
+#include <allegro5/allegro_physfs.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include "levparser.h"
 #include "../../core/asset.h"
+#include "../../core/logfile.h"
 #include "../../util/util.h"
 #include "../../util/stringutil.h"
 #include "../../util/djb2.h"
+#include "../../util/darray.h"
+#include "../../util/internset.h"
+
+/* Levels are compiled to a binary format, so that we don't need to tokenize
+   their (possibly huge) text files whenever they are loaded. A compiled level
+   has a header followed by flat arrays of commands, spatial chunks and
+   parameters, and by a string table in which each string is stored once.
+   Commands are kept in the order they appear in the .lev file, because the
+   order of creation of bricks and entities matters. Additionally, the bricks
+   and the entities are indexed by the region of the level they belong to, so
+   that a section of the level can be located without scanning all of it.
+   All data is stored in the native byte order; a foreign compiled level fails
+   the magic number test */
+#define COMPILED_MAGIC 0x3142564C /* "LVB1" */
+#define COMPILED_FORMAT_VERSION 1
+#define COMPILED_EXTENSION ".bin"
+#define COMPILED_PATH_MAXLENGTH 1023
+#define COMPILED_NONE (-1) /* null index */
+#define REGION_SIZE 1024 /* width and height of a spatial chunk, in pixels */
+
+typedef struct levheader_t levheader_t;
+struct levheader_t
+{
+    uint32_t magic; /* COMPILED_MAGIC */
+    uint32_t format_version; /* COMPILED_FORMAT_VERSION */
+    int64_t source_size; /* size of the .lev file, in bytes */
+    int64_t source_mtime; /* modification time of the .lev file */
+    int32_t region_size; /* REGION_SIZE */
+    int32_t command_count; /* length of the array of commands */
+    int32_t chunk_count; /* length of the array of chunks */
+    int32_t parameter_count; /* length of the array of parameters */
+    int32_t string_table_size; /* size of the string table, in bytes */
+    int32_t reserved; /* padding */
+};
+
+typedef struct levcompiledcommand_t levcompiledcommand_t;
+struct levcompiledcommand_t
+{
+    int32_t name; /* offset in the string table */
+    int32_t line; /* line number in the .lev file */
+    int32_t first_param; /* index of the first parameter */
+    int32_t param_count; /* number of parameters */
+    int32_t chunk; /* index of the spatial chunk or COMPILED_NONE */
+};
+
+typedef struct levcompiledchunk_t levcompiledchunk_t;
+struct levcompiledchunk_t
+{
+    int32_t region_x; /* horizontal position of the region, in units of region_size */
+    int32_t region_y; /* vertical position of the region, in units of region_size */
+    int32_t first_command; /* index in the array of chunk commands */
+    int32_t command_count; /* number of commands of this chunk */
+};
+
+typedef struct levcompiled_t levcompiled_t;
+struct levcompiled_t
+{
+    char* buffer; /* contents of the file */
+    const levheader_t* header;
+    const levcompiledcommand_t* command;
+    const levcompiledchunk_t* chunk; /* sorted by region */
+    const int32_t* chunk_command; /* indices of the commands of the chunks */
+    const int32_t* parameter; /* offsets in the string table */
+    const char* string_table;
+};
+
+struct levregions_t
+{
+    levcompiled_t compiled;
+    char filepath[COMPILED_PATH_MAXLENGTH + 1];
+};
+
+typedef struct levcompiler_t levcompiler_t;
+struct levcompiler_t
+{
+    DARRAY(levcompiledcommand_t, command);
+    DARRAY(int32_t, parameter); /* offsets in the string table */
+    DARRAY(char, string_table);
+    internset_t* interned; /* offsets of the string table */
+};
+
+typedef struct levregionentry_t levregionentry_t;
+struct levregionentry_t
+{
+    int32_t region_x;
+    int32_t region_y;
+    int32_t command;
+};
+
+/* Snapshots are in-memory copies of levels. They are read in a background
+   thread, so that the next level can be preloaded while the current one is
+   still running, and they make reloading a level (e.g., restarting it) a
+   replay from memory that doesn't touch the disk */
+#define SNAPSHOT_MAX 2 /* the current level and the next one */
+
+typedef struct levsnapshot_t levsnapshot_t;
+struct levsnapshot_t
+{
+    char filepath[COMPILED_PATH_MAXLENGTH + 1]; /* full path of the .lev file; empty if unused */
+    char compiled_path[COMPILED_PATH_MAXLENGTH + 1]; /* empty if compiled levels are disabled */
+    levheader_t header; /* identifies the version of the .lev file */
+    char* source; /* contents of the .lev file; NULL if it couldn't be read */
+    int64_t source_size; /* size of the contents, in bytes */
+    levcompiled_t compiled; /* the compiled level; its buffer is NULL if it's not available */
+    ALLEGRO_THREAD* thread; /* the loader thread; NULL if the snapshot is ready */
+    bool done; /* set by the loader thread; protected by snapshot_mutex */
+    uint32_t last_use; /* for eviction */
+};
+
+static char* compiled_dir = NULL; /* virtual path of the directory of compiled levels; NULL if disabled */
+static levsnapshot_t snapshot[SNAPSHOT_MAX]; /* zero-initialized */
+static uint32_t snapshot_clock = 0;
+static ALLEGRO_MUTEX* snapshot_mutex = NULL;
 
 /* helpers */
 #define LINE_MAXLEN 1024
 #define MAX_PARAMS 16
-static bool parse_line(const char* filepath, int fileline, char* line, void* data, levparser_callback_t callback);
+static bool parse_line(const char* filepath, int fileline, char* line, void* data, levparser_callback_t callback, levcompiler_t* compiler);
 static inline levparser_command_t find_command(const char* command_name);
+static bool source_header(const char* filepath, levheader_t* header);
+static bool compiled_prepare(const char* filepath, char* compiled_path, size_t compiled_path_size, levheader_t* header);
+static bool compiled_load(const char* compiled_path, const levheader_t* expected_header, levcompiled_t* compiled);
+static void compiled_unload(levcompiled_t* compiled);
+static bool compiled_replay(const levcompiled_t* compiled, int command_index, const char* filepath, void* data, levparser_callback_t callback);
+static bool compiled_write(const char* compiled_path, levcompiler_t* compiler, const levheader_t* header);
+static void compiler_init(levcompiler_t* compiler);
+static void compiler_release(levcompiler_t* compiler);
+static void compiler_add(levcompiler_t* compiler, int fileline, const char* command_name, int param_count, char** param);
+static int32_t compiler_intern(levcompiler_t* compiler, const char* string);
+static uintptr_t compiler_store_string(const char* string, void* compiler);
+static const char* compiler_lookup_string(uintptr_t key, const void* compiler);
+static int compare_region_entries(const void* a, const void* b);
+static inline int compare_regions(int32_t region_x1, int32_t region_y1, int32_t region_x2, int32_t region_y2);
+static inline int32_t region_of(int coordinate);
+static levsnapshot_t* snapshot_find(const char* filepath);
+static levsnapshot_t* snapshot_acquire(const char* filepath);
+static bool snapshot_is_current(const levsnapshot_t* s, const levheader_t* header);
+static void snapshot_load(levsnapshot_t* s);
+static char* read_source(const char* filepath, size_t* size);
+static void* snapshot_thread(ALLEGRO_THREAD* thread, void* arg);
+static void snapshot_wait(levsnapshot_t* s);
+static void snapshot_release(levsnapshot_t* s);
 
 /* identifiers */
 #define NAME        DJB2_CONST('n','a','m','e')
@@ -71,31 +210,320 @@ static inline levparser_command_t find_command(const char* command_name);
  */
 bool levparser_parse(const char* path_to_lev_file, void* data, levparser_callback_t callback)
 {
-    const char* fullpath = asset_path(path_to_lev_file);
+    char fullpath[COMPILED_PATH_MAXLENGTH + 1];
+    char compiled_path[COMPILED_PATH_MAXLENGTH + 1];
     char line[LINE_MAXLEN];
+    levheader_t header;
+    levcompiler_t compiler;
+    levcompiled_t compiled;
+    bool completed = true;
     int ln = 0;
 
-    /* open the level file */
-    ALLEGRO_FILE* fp = al_fopen(fullpath, "r");
-    if(!fp)
+    /* the callback may call asset_path() */
+    str_cpy(fullpath, asset_path(path_to_lev_file), sizeof(fullpath));
+
+    /* use the snapshot of the level, if there is an up-to-date one */
+    levsnapshot_t* s = snapshot_acquire(fullpath);
+    if(s != NULL && s->compiled.buffer != NULL) {
+        for(int i = 0; i < s->compiled.header->command_count; i++) {
+            if(!compiled_replay(&(s->compiled), i, fullpath, data, callback))
+                break;
+        }
+
+        return true;
+    }
+
+    /* replay the compiled level, if it's up to date */
+    bool use_compiled = compiled_prepare(fullpath, compiled_path, sizeof(compiled_path), &header);
+    if(use_compiled) {
+        if(compiled_load(compiled_path, &header, &compiled)) {
+            for(int i = 0; i < compiled.header->command_count; i++) {
+                if(!compiled_replay(&compiled, i, fullpath, data, callback))
+                    break;
+            }
+
+            /* keep the compiled level in the snapshot */
+            if(s != NULL)
+                s->compiled = compiled;
+            else
+                compiled_unload(&compiled);
+
+            return true;
+        }
+    }
+
+    /* read the whole level file, unless it's already in memory */
+    char* source = NULL;
+    const char* text = NULL;
+    size_t text_size = 0;
+
+    if(s != NULL && s->source != NULL) {
+        text = s->source;
+        text_size = s->source_size;
+    }
+    else if(NULL != (source = read_source(fullpath, &text_size)))
+        text = source;
+    else
         return false; /* error */
 
     /* read and parse */
-    while(al_fgets(fp, line, sizeof(line))) {
+    if(use_compiled)
+        compiler_init(&compiler);
+
+    for(const char *p = text, *end = text + text_size; p < end; ) {
+
+        /* find the end of the line; memchr() is vectorized by the C library */
+        const char* linebreak = memchr(p, '\n', end - p);
+        const char* next = (linebreak != NULL) ? linebreak + 1 : end;
+
+        /* lines that are too long are split, as al_fgets() would do */
+        size_t length = min((size_t)(next - p), sizeof(line) - 1);
+        memcpy(line, p, length);
+        line[length] = '\0';
+        p += length;
 
         /* line has a '\n' at the end, which we keep */
-        if(!parse_line(fullpath, ++ln, line, data, callback))
+        if(!parse_line(fullpath, ++ln, line, data, callback, use_compiled ? &compiler : NULL)) {
+            completed = false;
             break;
+        }
 
     }
 
-    /* close the level file */
-    al_fclose(fp);
+    /* release the level file */
+    free(source);
+
+    /* compile the level, unless we've read only a part of it */
+    if(use_compiled) {
+        if(completed && !compiled_write(compiled_path, &compiler, &header))
+            logfile_message("Can't write the compiled level %s", compiled_path);
+
+        compiler_release(&compiler);
+    }
 
     /* success! */
     return true;
 }
 
+/*
+ * levparser_load_regions()
+ * Loads the spatial index of the bricks and of the entities of a .lev file,
+ * so that each region of the level can be read separately. This requires an
+ * up-to-date compiled level, which levparser_parse() creates when it reads
+ * the whole file. Returns NULL if there is no such compiled level
+ */
+levregions_t* levparser_load_regions(const char* path_to_lev_file)
+{
+    char compiled_path[COMPILED_PATH_MAXLENGTH + 1];
+    levregions_t* regions = mallocx(sizeof *regions);
+    levheader_t header;
+
+    str_cpy(regions->filepath, asset_path(path_to_lev_file), sizeof(regions->filepath));
+
+    if(!compiled_prepare(regions->filepath, compiled_path, sizeof(compiled_path), &header) ||
+    !compiled_load(compiled_path, &header, &(regions->compiled))) {
+        free(regions);
+        return NULL;
+    }
+
+    return regions;
+}
+
+/*
+ * levparser_unload_regions()
+ * Releases the spatial index of a level
+ */
+levregions_t* levparser_unload_regions(levregions_t* regions)
+{
+    compiled_unload(&(regions->compiled));
+    free(regions);
+    return NULL;
+}
+
+/*
+ * levparser_region_size()
+ * The width and the height of the regions, in pixels
+ */
+int levparser_region_size(const levregions_t* regions)
+{
+    return regions->compiled.header->region_size;
+}
+
+/*
+ * levparser_region_count()
+ * The number of non-empty regions of the level
+ */
+int levparser_region_count(const levregions_t* regions)
+{
+    return regions->compiled.header->chunk_count;
+}
+
+/*
+ * levparser_find_region()
+ * Finds the index of the region at the given position, in units of the
+ * region size. Returns -1 if the region is empty
+ */
+int levparser_find_region(const levregions_t* regions, int region_x, int region_y)
+{
+    const levcompiledchunk_t* chunk = regions->compiled.chunk;
+    int lo = 0, hi = regions->compiled.header->chunk_count - 1;
+
+    /* binary search */
+    while(lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        int cmp = compare_regions(chunk[mid].region_x, chunk[mid].region_y, region_x, region_y);
+
+        if(cmp < 0)
+            lo = mid + 1;
+        else if(cmp > 0)
+            hi = mid - 1;
+        else
+            return mid;
+    }
+
+    return -1;
+}
+
+/*
+ * levparser_region_position()
+ * The position of the region of the given index, in units of the region size
+ */
+void levparser_region_position(const levregions_t* regions, int region_index, int* region_x, int* region_y)
+{
+    const levcompiledchunk_t* chunk = regions->compiled.chunk + region_index;
+
+    *region_x = chunk->region_x;
+    *region_y = chunk->region_y;
+}
+
+/*
+ * levparser_parse_region()
+ * Invokes a callback for each brick and for each entity of the region of
+ * the given index, in the order of the .lev file. If the callback returns
+ * false, the reading will stop
+ */
+void levparser_parse_region(const levregions_t* regions, int region_index, void* data, levparser_callback_t callback)
+{
+    const levcompiled_t* compiled = &(regions->compiled);
+    const levcompiledchunk_t* chunk = compiled->chunk + region_index;
+
+    for(int i = 0; i < chunk->command_count; i++) {
+        int command_index = compiled->chunk_command[chunk->first_command + i];
+        if(!compiled_replay(compiled, command_index, regions->filepath, data, callback))
+            break;
+    }
+}
+
+/*
+ * levparser_set_compiled_directory()
+ * Store compiled levels in the given directory, specified without a trailing
+ * slash. Pass NULL to disable compiled levels
+ */
+void levparser_set_compiled_directory(const char* dirpath)
+{
+    if(compiled_dir != NULL)
+        free(compiled_dir);
+
+    compiled_dir = (dirpath != NULL) ? str_dup(dirpath) : NULL;
+}
+
+/*
+ * levparser_preload()
+ * Starts reading a .lev file into memory in a background thread, so that
+ * subsequent calls to levparser_parse() on that file will not touch the disk.
+ * A few levels are kept in memory; the least recently used ones are evicted.
+ * Returns false if the file doesn't exist
+ */
+bool levparser_preload(const char* path_to_lev_file)
+{
+    char fullpath[COMPILED_PATH_MAXLENGTH + 1];
+    levheader_t header;
+    levsnapshot_t* s;
+
+    str_cpy(fullpath, asset_path(path_to_lev_file), sizeof(fullpath));
+    if(!source_header(fullpath, &header))
+        return false;
+
+    /* is the level already in memory? */
+    if(NULL != (s = snapshot_find(fullpath))) {
+        if(snapshot_is_current(s, &header)) {
+            s->last_use = ++snapshot_clock;
+            return true;
+        }
+
+        snapshot_release(s);
+    }
+    else {
+        /* evict the least recently used snapshot */
+        s = &snapshot[0];
+        for(int i = 1; i < SNAPSHOT_MAX && s->filepath[0] != '\0'; i++) {
+            if(snapshot[i].filepath[0] == '\0' || snapshot[i].last_use < s->last_use)
+                s = &snapshot[i];
+        }
+
+        snapshot_release(s);
+    }
+
+    /* setup the snapshot in this thread: asset_path() and
+       the file system interface are not shared with other threads */
+    str_cpy(s->filepath, fullpath, sizeof(s->filepath));
+    if(!compiled_prepare(fullpath, s->compiled_path, sizeof(s->compiled_path), &header))
+        s->compiled_path[0] = '\0';
+    s->header = header;
+    s->source = NULL;
+    s->source_size = 0;
+    s->compiled.buffer = NULL;
+    s->done = false;
+    s->last_use = ++snapshot_clock;
+
+    /* read the level in the background */
+    if(snapshot_mutex == NULL)
+        snapshot_mutex = al_create_mutex();
+
+    if(snapshot_mutex != NULL && NULL != (s->thread = al_create_thread(snapshot_thread, s)))
+        al_start_thread(s->thread);
+    else {
+        snapshot_load(s);
+        s->done = true;
+    }
+
+    return true;
+}
+
+/*
+ * levparser_is_preloading()
+ * Checks if a .lev file is still being read in the background. This
+ * doesn't block, unlike levparser_parse(), which waits for the reading
+ */
+bool levparser_is_preloading(const char* path_to_lev_file)
+{
+    const levsnapshot_t* s = snapshot_find(asset_path(path_to_lev_file));
+    bool done = true;
+
+    if(s != NULL && s->thread != NULL) {
+        al_lock_mutex(snapshot_mutex);
+        done = s->done;
+        al_unlock_mutex(snapshot_mutex);
+    }
+
+    return !done;
+}
+
+/*
+ * levparser_release_preloaded()
+ * Releases the levels kept in memory
+ */
+void levparser_release_preloaded()
+{
+    for(int i = 0; i < SNAPSHOT_MAX; i++)
+        snapshot_release(&snapshot[i]);
+
+    if(snapshot_mutex != NULL) {
+        al_destroy_mutex(snapshot_mutex);
+        snapshot_mutex = NULL;
+    }
+}
+
 
 
 
@@ -106,7 +534,7 @@ bool levparser_parse(const char* path_to_lev_file, void* data, levparser_callbac
  */
 
 /* parse a line from the .lev file */
-bool parse_line(const char* filepath, int fileline, char* line, void* data, levparser_callback_t callback)
+bool parse_line(const char* filepath, int fileline, char* line, void* data, levparser_callback_t callback, levcompiler_t* compiler)
 {
     char *p, *identifier, *param[MAX_PARAMS];
 
@@ -155,6 +583,10 @@ bool parse_line(const char* filepath, int fileline, char* line, void* data, levp
         for(; *p && isspace((int)*p); p++);
     }
 
+    /* compile the line */
+    if(compiler != NULL)
+        compiler_add(compiler, fileline, identifier, param_count, param);
+
     /* interpret the line */
     return callback(filepath, fileline, find_command(identifier), identifier, param_count, (const char**)param, data);
 }
@@ -234,4 +666,482 @@ levparser_command_t find_command(const char* command_name)
         default:
             return LEVCOMMAND_UNKNOWN;
     }
-}
\ No newline at end of file
+}
+/* fill in the header that an up-to-date compiled level of a .lev file must have. Returns false if there is no such file */
+bool source_header(const char* filepath, levheader_t* header)
+{
+    /* a compiled level is valid only for a specific version of the .lev file */
+    ALLEGRO_FS_ENTRY* entry = al_create_fs_entry(filepath);
+    if(entry == NULL)
+        return false;
+    else if(!al_fs_entry_exists(entry) || !(al_get_fs_entry_mode(entry) & ALLEGRO_FILEMODE_ISFILE)) {
+        al_destroy_fs_entry(entry);
+        return false;
+    }
+
+    memset(header, 0, sizeof(*header));
+    header->magic = COMPILED_MAGIC;
+    header->format_version = COMPILED_FORMAT_VERSION;
+    header->source_size = (int64_t)al_get_fs_entry_size(entry);
+    header->source_mtime = (int64_t)al_get_fs_entry_mtime(entry);
+    header->region_size = REGION_SIZE;
+    al_destroy_fs_entry(entry);
+
+    return true;
+}
+
+/* find the path of the compiled level and fill in the header that an up-to-date compiled level must have */
+bool compiled_prepare(const char* filepath, char* compiled_path, size_t compiled_path_size, levheader_t* header)
+{
+    /* are compiled levels enabled? */
+    if(compiled_dir == NULL)
+        return false;
+
+    if(!source_header(filepath, header))
+        return false;
+
+    /* the path of the compiled level mirrors the path of the .lev file */
+    while(*filepath == '/')
+        filepath++;
+
+    int n = snprintf(compiled_path, compiled_path_size, "%s/%s%s", compiled_dir, filepath, COMPILED_EXTENSION);
+    return n >= 0 && (size_t)n < compiled_path_size;
+}
+
+/* read a compiled level with a single read. Returns false if it doesn't exist, is outdated or is corrupt */
+bool compiled_load(const char* compiled_path, const levheader_t* expected_header, levcompiled_t* compiled)
+{
+    bool success = true;
+
+    /* read the whole file */
+    ALLEGRO_FILE* fp = al_fopen(compiled_path, "rb");
+    if(fp == NULL)
+        return false; /* not compiled yet */
+
+    int64_t size = al_fsize(fp);
+    if(size < (int64_t)sizeof(levheader_t) || size > INT32_MAX) {
+        al_fclose(fp);
+        logfile_message("Ignoring a corrupt compiled level: %s", compiled_path);
+        return false;
+    }
+
+    char* buffer = mallocx(size);
+    success = (al_fread(fp, buffer, size) == (size_t)size);
+    al_fclose(fp);
+
+    /* validate the header */
+    const levheader_t* header = (const levheader_t*)buffer;
+    if(!success || header->magic != expected_header->magic || header->format_version != expected_header->format_version) {
+        logfile_message("Ignoring a corrupt compiled level: %s", compiled_path);
+        free(buffer);
+        return false;
+    }
+    else if(
+        header->source_size != expected_header->source_size ||
+        header->source_mtime != expected_header->source_mtime ||
+        header->region_size != expected_header->region_size
+    ) {
+        free(buffer); /* the compiled level is outdated */
+        return false;
+    }
+    else if(
+        header->command_count < 0 || header->chunk_count < 0 || header->parameter_count < 0 || header->string_table_size <= 0 ||
+        size != (int64_t)sizeof(levheader_t) +
+                (int64_t)header->command_count * (int64_t)sizeof(levcompiledcommand_t) +
+                (int64_t)header->chunk_count * (int64_t)sizeof(levcompiledchunk_t) +
+                (int64_t)header->command_count * (int64_t)sizeof(int32_t) + /* commands of the chunks */
+                (int64_t)header->parameter_count * (int64_t)sizeof(int32_t) +
+                (int64_t)header->string_table_size ||
+        buffer[size-1] != '\0'
+    ) {
+        logfile_message("Ignoring a corrupt compiled level: %s", compiled_path);
+        free(buffer);
+        return false;
+    }
+
+    /* the arrays are laid out as: commands, chunks, commands of the chunks, parameters, string table */
+    compiled->buffer = buffer;
+    compiled->header = header;
+    compiled->command = (const levcompiledcommand_t*)(buffer + sizeof(levheader_t));
+    compiled->chunk = (const levcompiledchunk_t*)(compiled->command + header->command_count);
+    compiled->chunk_command = (const int32_t*)(compiled->chunk + header->chunk_count);
+    compiled->parameter = compiled->chunk_command + header->command_count;
+    compiled->string_table = (const char*)(compiled->parameter + header->parameter_count);
+
+    /* validate the commands before invoking any callback, because we
+       can't fall back to the .lev file after we have started */
+    for(int i = 0; i < header->command_count && success; i++) {
+        const levcompiledcommand_t* c = compiled->command + i;
+
+        success = (
+            c->name >= 0 && c->name < header->string_table_size &&
+            c->param_count >= 0 && c->param_count <= MAX_PARAMS &&
+            c->first_param >= 0 && c->first_param <= header->parameter_count - c->param_count &&
+            c->chunk >= COMPILED_NONE && c->chunk < header->chunk_count
+        );
+
+        for(int j = 0; j < c->param_count && success; j++) {
+            int32_t offset = compiled->parameter[c->first_param + j];
+            success = (offset >= 0 && offset < header->string_table_size);
+        }
+    }
+
+    /* validate the chunks, which must be sorted by region */
+    for(int i = 0; i < header->chunk_count && success; i++) {
+        const levcompiledchunk_t* k = compiled->chunk + i;
+
+        success = (
+            k->command_count >= 0 &&
+            k->first_command >= 0 &&
+            k->first_command <= header->command_count - k->command_count &&
+            (i == 0 || compare_regions(k[-1].region_x, k[-1].region_y, k->region_x, k->region_y) < 0)
+        );
+    }
+
+    for(int i = 0; i < header->command_count && success; i++)
+        success = (compiled->chunk_command[i] >= 0 && compiled->chunk_command[i] < header->command_count);
+
+    if(!success) {
+        logfile_message("Ignoring a corrupt compiled level: %s", compiled_path);
+        compiled_unload(compiled);
+        return false;
+    }
+
+    /* done! */
+    return true;
+}
+
+/* release a compiled level */
+void compiled_unload(levcompiled_t* compiled)
+{
+    free(compiled->buffer);
+    compiled->buffer = NULL;
+}
+
+/* invoke the callback for a command of a compiled level and return its result.
+   The strings are read directly from the string table, which ends with '\0' */
+bool compiled_replay(const levcompiled_t* compiled, int command_index, const char* filepath, void* data, levparser_callback_t callback)
+{
+    const levcompiledcommand_t* c = compiled->command + command_index;
+    const char* command_name = compiled->string_table + c->name;
+    const char* param[MAX_PARAMS];
+
+    for(int j = 0; j < c->param_count; j++)
+        param[j] = compiled->string_table + compiled->parameter[c->first_param + j];
+
+    return callback(filepath, c->line, find_command(command_name), command_name, c->param_count, param, data);
+}
+
+/* write a compiled level. Returns true on success */
+bool compiled_write(const char* compiled_path, levcompiler_t* compiler, const levheader_t* header)
+{
+    levheader_t h = *header;
+    char dirpath[COMPILED_PATH_MAXLENGTH + 1];
+    DARRAY(levregionentry_t, entry);
+    DARRAY(levcompiledchunk_t, chunk);
+    DARRAY(int32_t, chunk_command);
+    bool success = false;
+
+    /* index the bricks and the entities by region */
+    darray_init(entry);
+    for(int i = 0; i < darray_length(compiler->command); i++) {
+        const levcompiledcommand_t* c = &(compiler->command[i]);
+        const char* command_name = compiler->string_table + c->name;
+        const int32_t* param = compiler->parameter + c->first_param;
+
+        switch(find_command(command_name)) {
+            case LEVCOMMAND_BRICK:
+            case LEVCOMMAND_ENTITY:
+            case LEVCOMMAND_LEGACYOBJECT:
+            case LEVCOMMAND_LEGACYITEM:
+                /* <name> <x> <y> ... */
+                if(c->param_count >= 3) {
+                    levregionentry_t e = {
+                        .region_x = region_of(atoi(compiler->string_table + param[1])),
+                        .region_y = region_of(atoi(compiler->string_table + param[2])),
+                        .command = i
+                    };
+                    darray_push(entry, e);
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    qsort(entry, darray_length(entry), sizeof(levregionentry_t), compare_region_entries);
+
+    /* group the bricks and the entities in spatial chunks */
+    darray_init(chunk);
+    darray_init(chunk_command);
+    for(int i = 0; i < darray_length(entry); i++) {
+        int n = darray_length(chunk);
+
+        if(n == 0 || chunk[n-1].region_x != entry[i].region_x || chunk[n-1].region_y != entry[i].region_y) {
+            levcompiledchunk_t new_chunk = {
+                .region_x = entry[i].region_x,
+                .region_y = entry[i].region_y,
+                .first_command = i,
+                .command_count = 0
+            };
+            n = darray_push(chunk, new_chunk);
+        }
+
+        chunk[n-1].command_count++;
+        compiler->command[entry[i].command].chunk = n-1;
+        darray_push(chunk_command, entry[i].command);
+    }
+
+    /* the commands that are not in any chunk go last */
+    for(int i = 0; i < darray_length(compiler->command); i++) {
+        if(compiler->command[i].chunk == COMPILED_NONE)
+            darray_push(chunk_command, i);
+    }
+
+    compiler_intern(compiler, ""); /* the string table must not be empty */
+    h.command_count = darray_length(compiler->command);
+    h.chunk_count = darray_length(chunk);
+    h.parameter_count = darray_length(compiler->parameter);
+    h.string_table_size = darray_length(compiler->string_table);
+
+    /* create the directory of the compiled level */
+    str_cpy(dirpath, compiled_path, sizeof(dirpath));
+    char* slash = strrchr(dirpath, '/');
+    if(slash != NULL) {
+        *slash = '\0';
+        al_make_directory(dirpath);
+    }
+
+    /* write the compiled level */
+    ALLEGRO_FILE* fp = al_fopen(compiled_path, "wb");
+    if(fp != NULL) {
+        success = (
+            al_fwrite(fp, &h, sizeof(h)) == sizeof(h) &&
+            al_fwrite(fp, compiler->command, h.command_count * sizeof(levcompiledcommand_t)) == h.command_count * sizeof(levcompiledcommand_t) &&
+            al_fwrite(fp, chunk, h.chunk_count * sizeof(levcompiledchunk_t)) == h.chunk_count * sizeof(levcompiledchunk_t) &&
+            al_fwrite(fp, chunk_command, h.command_count * sizeof(int32_t)) == h.command_count * sizeof(int32_t) &&
+            al_fwrite(fp, compiler->parameter, h.parameter_count * sizeof(int32_t)) == h.parameter_count * sizeof(int32_t) &&
+            al_fwrite(fp, compiler->string_table, h.string_table_size) == (size_t)h.string_table_size
+        );
+        success = al_fclose(fp) && success;
+    }
+
+    /* done! */
+    darray_release(chunk_command);
+    darray_release(chunk);
+    darray_release(entry);
+    return success;
+}
+
+/* initialize a level compiler */
+void compiler_init(levcompiler_t* compiler)
+{
+    darray_init(compiler->command);
+    darray_init(compiler->parameter);
+    darray_init(compiler->string_table);
+
+    compiler->interned = internset_create(256, compiler_store_string, compiler_lookup_string, compiler);
+}
+
+/* release a level compiler */
+void compiler_release(levcompiler_t* compiler)
+{
+    compiler->interned = internset_destroy(compiler->interned);
+    darray_release(compiler->string_table);
+    darray_release(compiler->parameter);
+    darray_release(compiler->command);
+}
+
+/* add a line of the .lev file to the compiled level */
+void compiler_add(levcompiler_t* compiler, int fileline, const char* command_name, int param_count, char** param)
+{
+    levcompiledcommand_t command = {
+        .name = compiler_intern(compiler, command_name),
+        .line = fileline,
+        .first_param = darray_length(compiler->parameter),
+        .param_count = param_count,
+        .chunk = COMPILED_NONE
+    };
+
+    for(int i = 0; i < param_count; i++) {
+        int32_t offset = compiler_intern(compiler, param[i]);
+        darray_push(compiler->parameter, offset);
+    }
+
+    darray_push(compiler->command, command);
+}
+
+/* add a string to the string table, unless it's already there. Returns its offset */
+int32_t compiler_intern(levcompiler_t* compiler, const char* string)
+{
+    return (int32_t)internset_intern(compiler->interned, string);
+}
+
+/* append a string to the string table. Returns its offset */
+uintptr_t compiler_store_string(const char* string, void* compiler)
+{
+    levcompiler_t* c = (levcompiler_t*)compiler;
+    int32_t offset = darray_length(c->string_table);
+
+    for(const char* p = string; ; p++) {
+        darray_push(c->string_table, *p);
+        if(*p == '\0')
+            break;
+    }
+
+    return (uintptr_t)offset;
+}
+
+/* the string at an offset of the string table */
+const char* compiler_lookup_string(uintptr_t key, const void* compiler)
+{
+    return ((const levcompiler_t*)compiler)->string_table + key;
+}
+
+/* sort the index of regions by region, keeping the order of the .lev file within each region */
+int compare_region_entries(const void* a, const void* b)
+{
+    const levregionentry_t* p = (const levregionentry_t*)a;
+    const levregionentry_t* q = (const levregionentry_t*)b;
+    int cmp = compare_regions(p->region_x, p->region_y, q->region_x, q->region_y);
+
+    return (cmp != 0) ? cmp : (p->command > q->command) - (p->command < q->command);
+}
+
+/* the order of the regions: top to bottom, left to right */
+int compare_regions(int32_t region_x1, int32_t region_y1, int32_t region_x2, int32_t region_y2)
+{
+    if(region_y1 != region_y2)
+        return (region_y1 > region_y2) - (region_y1 < region_y2);
+    else
+        return (region_x1 > region_x2) - (region_x1 < region_x2);
+}
+
+/* the region of a coordinate, in pixels */
+int32_t region_of(int coordinate)
+{
+    /* round towards negative infinity */
+    return (coordinate >= 0) ? coordinate / REGION_SIZE : -((-coordinate + REGION_SIZE - 1) / REGION_SIZE);
+}
+
+/* find the snapshot of a .lev file, or NULL if there is none */
+levsnapshot_t* snapshot_find(const char* filepath)
+{
+    for(int i = 0; i < SNAPSHOT_MAX; i++) {
+        if(snapshot[i].filepath[0] != '\0' && strcmp(snapshot[i].filepath, filepath) == 0)
+            return &snapshot[i];
+    }
+
+    return NULL;
+}
+
+/* wait for the snapshot of a .lev file and return it, provided that it's up to date */
+levsnapshot_t* snapshot_acquire(const char* filepath)
+{
+    levsnapshot_t* s = snapshot_find(filepath);
+    levheader_t header;
+
+    if(s == NULL)
+        return NULL;
+
+    snapshot_wait(s);
+
+    /* has the .lev file been modified since it was read? */
+    if(!source_header(filepath, &header) || !snapshot_is_current(s, &header)) {
+        snapshot_release(s);
+        return NULL;
+    }
+
+    s->last_use = ++snapshot_clock;
+    return s;
+}
+
+/* checks if a snapshot matches the current version of its .lev file */
+bool snapshot_is_current(const levsnapshot_t* s, const levheader_t* header)
+{
+    return s->header.source_size == header->source_size && s->header.source_mtime == header->source_mtime;
+}
+
+/* read the .lev file and its compiled level into memory */
+void snapshot_load(levsnapshot_t* s)
+{
+    /* read the compiled level, if it's up to date */
+    if(s->compiled_path[0] != '\0') {
+        if(!compiled_load(s->compiled_path, &(s->header), &(s->compiled)))
+            s->compiled.buffer = NULL;
+    }
+
+    /* read the .lev file, so that we can compile it without reading the disk */
+    size_t size = 0;
+    s->source = read_source(s->filepath, &size);
+    s->source_size = (s->source != NULL) ? size : 0;
+}
+
+/* reads the contents of a .lev file into memory. Returns NULL on error */
+char* read_source(const char* filepath, size_t* size)
+{
+    ALLEGRO_FILE* fp = al_fopen(filepath, "rb");
+    if(fp == NULL)
+        return NULL;
+
+    int64_t file_size = al_fsize(fp);
+    char* source = NULL;
+
+    if(file_size >= 0 && file_size <= INT32_MAX) {
+        source = mallocx(file_size + 1);
+
+        if(al_fread(fp, source, file_size) != (size_t)file_size) {
+            free(source);
+            source = NULL;
+        }
+        else
+            *size = file_size;
+    }
+
+    al_fclose(fp);
+    return source;
+}
+
+/* the loader thread of a snapshot */
+void* snapshot_thread(ALLEGRO_THREAD* thread, void* arg)
+{
+    /* use the physfs file interface in this thread */
+    al_set_physfs_file_interface();
+
+    levsnapshot_t* s = (levsnapshot_t*)arg;
+    snapshot_load(s);
+
+    al_lock_mutex(snapshot_mutex);
+    s->done = true;
+    al_unlock_mutex(snapshot_mutex);
+
+    return NULL;
+}
+
+/* wait for the loader thread of a snapshot */
+void snapshot_wait(levsnapshot_t* s)
+{
+    if(s->thread != NULL) {
+        al_join_thread(s->thread, NULL);
+        al_destroy_thread(s->thread);
+        s->thread = NULL;
+    }
+}
+
+/* release a snapshot */
+void snapshot_release(levsnapshot_t* s)
+{
+    snapshot_wait(s);
+
+    if(s->source != NULL) {
+        free(s->source);
+        s->source = NULL;
+        s->source_size = 0;
+    }
+
+    if(s->compiled.buffer != NULL)
+        compiled_unload(&(s->compiled));
+
+    s->filepath[0] = '\0';
+}
@@ -24,9 +24,25 @@
 #include <stdbool.h>
 
 typedef enum levparser_command_t levparser_command_t;
+typedef struct levregions_t levregions_t;
 typedef bool (*levparser_callback_t)(const char *filepath, int fileline, levparser_command_t command, const char *command_name, int param_count, const char **param, void* data);
 
 bool levparser_parse(const char* path_to_lev_file, void* data, levparser_callback_t callback);
+void levparser_set_compiled_directory(const char* dirpath); /* NULL disables compiled levels */
+
+/* levels in memory */
+bool levparser_preload(const char* path_to_lev_file); /* reads the file in a background thread */
+bool levparser_is_preloading(const char* path_to_lev_file); /* non-blocking */
+void levparser_release_preloaded();
+
+/* regions of a level */
+levregions_t* levparser_load_regions(const char* path_to_lev_file); /* returns NULL if the level hasn't been compiled */
+levregions_t* levparser_unload_regions(levregions_t* regions);
+int levparser_region_size(const levregions_t* regions); /* in pixels */
+int levparser_region_count(const levregions_t* regions); /* number of non-empty regions */
+int levparser_find_region(const levregions_t* regions, int region_x, int region_y); /* -1 if the region is empty */
+void levparser_region_position(const levregions_t* regions, int region_index, int* region_x, int* region_y);
+void levparser_parse_region(const levregions_t* regions, int region_index, void* data, levparser_callback_t callback);
 
 enum levparser_command_t
 {
@@ -0,0 +1,186 @@
+/*
+ * Open Surge Engine
+ * levsaver.c - background writer of level files (.lev)
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <allegro5/allegro.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "levsaver.h"
+#include "../../core/logfile.h"
+#include "../../util/util.h"
+#include "../../util/stringutil.h"
+
+/* the path of the temporary file is the target path followed by this suffix */
+#define TEMP_SUFFIX ".tmp"
+#define PATH_MAXLENGTH 1023
+
+/* a save in progress */
+typedef struct levsave_t levsave_t;
+struct levsave_t
+{
+    char fullpath[PATH_MAXLENGTH + 1]; /* absolute path of the target file */
+    char* contents; /* contents of the file */
+    size_t size; /* size of the contents, in bytes */
+    bool success; /* set by the writer thread */
+    bool done; /* set by the writer thread; protected by the mutex */
+};
+
+static ALLEGRO_THREAD* thread = NULL; /* the writer thread; NULL if there is no save in progress */
+static ALLEGRO_MUTEX* mutex = NULL;
+static levsave_t save;
+static bool last_save_succeeded = true;
+
+static void* write_level(ALLEGRO_THREAD* self, void* arg);
+
+
+
+/*
+ * levsaver_save()
+ * Writes a level file in a background thread. The contents are a snapshot
+ * of the level, so the caller may modify the level while it's being saved.
+ * This function takes ownership of the contents. If there is a save in
+ * progress, we wait for it first. Returns false if the save can't be started
+ */
+bool levsaver_save(const char* fullpath, char* contents, size_t size)
+{
+    /* one save at a time */
+    levsaver_wait();
+
+    /* setup the save */
+    if(strlen(fullpath) + sizeof(TEMP_SUFFIX) > sizeof(save.fullpath)) {
+        logfile_message("Can't save level: path too long: %s", fullpath);
+        free(contents);
+        return false;
+    }
+
+    str_cpy(save.fullpath, fullpath, sizeof(save.fullpath));
+    save.contents = contents;
+    save.size = size;
+    save.success = false;
+    save.done = false;
+
+    /* write the file in the background */
+    if(mutex == NULL)
+        mutex = al_create_mutex();
+
+    if(mutex == NULL || NULL == (thread = al_create_thread(write_level, &save))) {
+        write_level(NULL, &save);
+        last_save_succeeded = save.success;
+        return last_save_succeeded;
+    }
+
+    al_start_thread(thread);
+    return true;
+}
+
+/*
+ * levsaver_is_saving()
+ * Checks if there is a save in progress
+ */
+bool levsaver_is_saving()
+{
+    bool done = true;
+
+    if(thread != NULL) {
+        al_lock_mutex(mutex);
+        done = save.done;
+        al_unlock_mutex(mutex);
+    }
+
+    return !done;
+}
+
+/*
+ * levsaver_wait()
+ * Waits for the save in progress, if any. Returns true if the last save succeeded
+ */
+bool levsaver_wait()
+{
+    if(thread != NULL) {
+        al_join_thread(thread, NULL);
+        al_destroy_thread(thread);
+        thread = NULL;
+
+        last_save_succeeded = save.success;
+    }
+
+    return last_save_succeeded;
+}
+
+/*
+ * levsaver_release()
+ * Waits for the save in progress and releases the saver
+ */
+void levsaver_release()
+{
+    levsaver_wait();
+
+    if(mutex != NULL) {
+        al_destroy_mutex(mutex);
+        mutex = NULL;
+    }
+}
+
+
+
+/* private */
+
+/* write the level to a temporary file and replace the target file */
+void* write_level(ALLEGRO_THREAD* self, void* arg)
+{
+    levsave_t* s = (levsave_t*)arg;
+    char temppath[PATH_MAXLENGTH + 1];
+    bool success = false;
+
+    /* write the temporary file */
+    snprintf(temppath, sizeof(temppath), "%s%s", s->fullpath, TEMP_SUFFIX);
+    FILE* fp = fopen_utf8(temppath, "wb");
+    if(fp != NULL) {
+        success = (fwrite(s->contents, 1, s->size, fp) == s->size);
+        success = (fflush(fp) == 0) && success;
+        success = (fclose(fp) == 0) && success;
+
+        /* replace the target file only if the temporary file is complete */
+        if(success)
+            success = rename_utf8(temppath, s->fullpath);
+
+        if(!success)
+            remove(temppath);
+    }
+
+    /* logfile_message() is thread-safe */
+    if(!success)
+        logfile_message("Can't save level \"%s\"", s->fullpath);
+
+    /* release the contents */
+    free(s->contents);
+    s->contents = NULL;
+    s->success = success;
+
+    if(self != NULL) {
+        al_lock_mutex(mutex);
+        s->done = true;
+        al_unlock_mutex(mutex);
+    }
+    else
+        s->done = true;
+
+    return NULL;
+}
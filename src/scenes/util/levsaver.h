@@ -0,0 +1,34 @@
+/*
+ * Open Surge Engine
+ * levsaver.h - background writer of level files (.lev)
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LEVSAVER_H
+#define _LEVSAVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* levels are written to a temporary file in a background thread,
+   which then replaces the target file atomically */
+bool levsaver_save(const char* fullpath, char* contents, size_t size); /* takes ownership of contents, which must be allocated with malloc */
+bool levsaver_is_saving(); /* is there a save in progress? */
+bool levsaver_wait(); /* waits for the save in progress; returns true if the last save succeeded */
+void levsaver_release();
+
+#endif
@@ -24,6 +24,7 @@
 #include "scripting.h"
 #include "../core/video.h"
 #include "../core/image.h"
+#include "../core/sprite.h"
 #include "../util/v2d.h"
 #include "../util/numeric.h"
 #include "../util/util.h"
@@ -165,8 +166,12 @@ surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescri
     surgescript_var_set_null(surgescript_heap_at(heap, OFFSET_ADDR)); /* lazy evaluation */
 
     /* initial configuration */
+    static sprite_handle_t null_sprite = SPRITE_HANDLE_NONE;
+    if(null_sprite == SPRITE_HANDLE_NONE)
+        null_sprite = sprite_resolve(NULL);
+
     surgescript_object_set_userdata(object, actor);
-    actor_change_animation(actor, sprite_get_animation(NULL, 0));
+    actor_change_animation(actor, sprite_handle_get_animation(null_sprite, 0));
     actor->spawn_point = scripting_util_world_position(object);
 
     /* sanity check */
@@ -472,6 +477,7 @@ surgescript_var_t* fun_setoffset(surgescript_object_t* object, const surgescript
     surgescript_object_t* v2 = surgescript_objectmanager_get(manager, v2h);
     scripting_vector2_read(v2, &x, &y);
     surgescript_transform_setposition2d(transform, x, y);
+    scripting_transform_changed();
 
     return NULL;
 }
@@ -19,6 +19,7 @@
  */
 
 #include <surgescript.h>
+#include "scripting.h"
 
 #if defined(__ANDROID__)
 #define ALLEGRO_UNSTABLE
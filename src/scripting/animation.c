@@ -64,6 +64,7 @@ static const surgescript_heapptr_t ACTIONSPOT_ADDR = 4;
 static const surgescript_heapptr_t ACTIONOFFSET_ADDR = 5;
 static const surgescript_heapptr_t ANIMTRANSFORM_ADDR = 6;
 static const surgescript_heapptr_t ANIMTRANSFORMTEMPVECTOR_ADDR = 7;
+static const surgescript_heapptr_t SPRITEHANDLE_ADDR = 8; /* the sprite name resolved into a sprite_handle_t */
 static const char* ONCHANGE = "onAnimationChange"; /* fun onAnimationChange(animation) will be called on the parent object */
 static void notify_change(const surgescript_object_t* object);
 static actor_t* get_animation_actor(const surgescript_object_t* object);
@@ -158,6 +159,7 @@ surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescri
     ssassert(ACTIONOFFSET_ADDR == surgescript_heap_malloc(heap));
     ssassert(ANIMTRANSFORM_ADDR == surgescript_heap_malloc(heap));
     ssassert(ANIMTRANSFORMTEMPVECTOR_ADDR == surgescript_heap_malloc(heap));
+    ssassert(SPRITEHANDLE_ADDR == surgescript_heap_malloc(heap));
     surgescript_var_set_number(surgescript_heap_at(heap, ANIMID_ADDR), 0);
     surgescript_var_set_string(surgescript_heap_at(heap, SPRITENAME_ADDR), "");
     surgescript_var_set_null(surgescript_heap_at(heap, HOTSPOT_ADDR)); /* lazy evaluation */
@@ -166,6 +168,7 @@ surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescri
     surgescript_var_set_null(surgescript_heap_at(heap, ACTIONOFFSET_ADDR)); /* lazy evaluation */
     surgescript_var_set_null(surgescript_heap_at(heap, ANIMTRANSFORM_ADDR)); /* lazy evaluation */
     surgescript_var_set_null(surgescript_heap_at(heap, ANIMTRANSFORMTEMPVECTOR_ADDR)); /* lazy evaluation */
+    surgescript_var_set_number(surgescript_heap_at(heap, SPRITEHANDLE_ADDR), SPRITE_HANDLE_NONE);
     surgescript_object_set_userdata(object, (void*)animation);
 
     /* sanity check */
@@ -201,11 +204,13 @@ surgescript_var_t* fun_init(surgescript_object_t* object, const surgescript_var_
 
     /* set sprite name */
     char* sprite_name = surgescript_var_get_string(param[0], manager);
+    sprite_handle_t sprite = sprite_resolve(sprite_name);
     surgescript_var_set_string(surgescript_heap_at(heap, SPRITENAME_ADDR), sprite_name);
+    surgescript_var_set_number(surgescript_heap_at(heap, SPRITEHANDLE_ADDR), sprite);
 
     /* update animation pointer */
-    if(sprite_animation_exists(sprite_name, anim_id)) {
-        const animation_t* animation = sprite_get_animation(sprite_name, anim_id);
+    if(sprite_handle_animation_exists(sprite, anim_id)) {
+        const animation_t* animation = sprite_handle_get_animation(sprite, anim_id);
         surgescript_object_set_userdata(object, (void*)animation);
     }
     else {
@@ -233,9 +238,9 @@ surgescript_var_t* fun_setid(surgescript_object_t* object, const surgescript_var
     }
 
     /* update data */
-    const char* sprite_name = surgescript_var_fast_get_string(surgescript_heap_at(heap, SPRITENAME_ADDR));
-    if(sprite_animation_exists(sprite_name, anim_id)) {
-        const animation_t* animation = sprite_get_animation(sprite_name, anim_id);
+    sprite_handle_t sprite = (sprite_handle_t)surgescript_var_get_number(surgescript_heap_at(heap, SPRITEHANDLE_ADDR));
+    if(sprite_handle_animation_exists(sprite, anim_id)) {
+        const animation_t* animation = sprite_handle_get_animation(sprite, anim_id);
         surgescript_var_set_number(anim_ref, anim_id);
         surgescript_object_set_userdata(object, (void*)animation);
     }
@@ -615,7 +620,12 @@ void notify_change(const surgescript_object_t* object)
 /* returns a pre-defined NULL animation */
 const animation_t* null_animation()
 {
-    return sprite_get_animation(NULL, 0);
+    static sprite_handle_t null_sprite = SPRITE_HANDLE_NONE;
+
+    if(null_sprite == SPRITE_HANDLE_NONE)
+        null_sprite = sprite_resolve(NULL);
+
+    return sprite_handle_get_animation(null_sprite, 0);
 }
 
 /* convert a string to a SurgeScript variable. The type of the variable depends on its contents */
@@ -19,6 +19,7 @@
  */
 
 #include <surgescript.h>
+#include "scripting.h"
 #include "../core/engine.h"
 #include "../util/util.h"
 #include "../util/stringutil.h"
@@ -0,0 +1,298 @@
+/*
+ * Open Surge Engine
+ * audiosource.c - scripting system: positional audio source
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <surgescript.h>
+#include "scripting.h"
+#include "../core/audio.h"
+#include "../core/video.h"
+#include "../util/util.h"
+
+/* private */
+static surgescript_var_t* fun_main(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_init(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_destructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_getmindist(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_setmindist(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_getmaxdist(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_setmaxdist(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_gethorizontal(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_sethorizontal(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_getlineheight(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_setlineheight(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_getvolume(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_setvolume(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_getenabled(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_setenabled(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static inline audiosource_t* get_source(const surgescript_object_t* object);
+static void update_distances(surgescript_object_t* object);
+static void update_line(surgescript_object_t* object);
+static const surgescript_heapptr_t MINDIST_ADDR = 0;
+static const surgescript_heapptr_t MAXDIST_ADDR = 1;
+static const surgescript_heapptr_t HORIZONTAL_ADDR = 2;
+static const surgescript_heapptr_t LINEHEIGHT_ADDR = 3;
+static const surgescript_heapptr_t VOLUME_ADDR = 4;
+static const surgescript_heapptr_t ENABLED_ADDR = 5;
+static const double DEFAULT_MINDIST = 256.0;
+static const double DEFAULT_MAXDIST = 512.0;
+static const double DEFAULT_VOLUME = 1.0;
+
+/*
+ * scripting_register_audiosource()
+ * Register the AudioSource object
+ */
+void scripting_register_audiosource(surgescript_vm_t* vm)
+{
+    surgescript_vm_bind(vm, "AudioSource", "state:main", fun_main, 0);
+    surgescript_vm_bind(vm, "AudioSource", "__init", fun_init, 1);
+    surgescript_vm_bind(vm, "AudioSource", "constructor", fun_constructor, 0);
+    surgescript_vm_bind(vm, "AudioSource", "destructor", fun_destructor, 0);
+    surgescript_vm_bind(vm, "AudioSource", "get_mindist", fun_getmindist, 0);
+    surgescript_vm_bind(vm, "AudioSource", "set_mindist", fun_setmindist, 1);
+    surgescript_vm_bind(vm, "AudioSource", "get_maxdist", fun_getmaxdist, 0);
+    surgescript_vm_bind(vm, "AudioSource", "set_maxdist", fun_setmaxdist, 1);
+    surgescript_vm_bind(vm, "AudioSource", "get_horizontal", fun_gethorizontal, 0);
+    surgescript_vm_bind(vm, "AudioSource", "set_horizontal", fun_sethorizontal, 1);
+    surgescript_vm_bind(vm, "AudioSource", "get_lineHeight", fun_getlineheight, 0);
+    surgescript_vm_bind(vm, "AudioSource", "set_lineHeight", fun_setlineheight, 1);
+    surgescript_vm_bind(vm, "AudioSource", "get_volume", fun_getvolume, 0);
+    surgescript_vm_bind(vm, "AudioSource", "set_volume", fun_setvolume, 1);
+    surgescript_vm_bind(vm, "AudioSource", "get_enabled", fun_getenabled, 0);
+    surgescript_vm_bind(vm, "AudioSource", "set_enabled", fun_setenabled, 1);
+}
+
+/* main state: follow the world position of the object */
+surgescript_var_t* fun_main(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    audiosource_t* source = get_source(object);
+
+    if(source != NULL)
+        audiosource_set_position(source, scripting_util_world_position(object));
+
+    return NULL;
+}
+
+/* constructor */
+surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+
+    ssassert(MINDIST_ADDR == surgescript_heap_malloc(heap));
+    ssassert(MAXDIST_ADDR == surgescript_heap_malloc(heap));
+    ssassert(HORIZONTAL_ADDR == surgescript_heap_malloc(heap));
+    ssassert(LINEHEIGHT_ADDR == surgescript_heap_malloc(heap));
+    ssassert(VOLUME_ADDR == surgescript_heap_malloc(heap));
+    ssassert(ENABLED_ADDR == surgescript_heap_malloc(heap));
+
+    surgescript_var_set_number(surgescript_heap_at(heap, MINDIST_ADDR), DEFAULT_MINDIST);
+    surgescript_var_set_number(surgescript_heap_at(heap, MAXDIST_ADDR), DEFAULT_MAXDIST);
+    surgescript_var_set_bool(surgescript_heap_at(heap, HORIZONTAL_ADDR), false);
+    surgescript_var_set_number(surgescript_heap_at(heap, LINEHEIGHT_ADDR), VIDEO_SCREEN_H);
+    surgescript_var_set_number(surgescript_heap_at(heap, VOLUME_ADDR), DEFAULT_VOLUME);
+    surgescript_var_set_bool(surgescript_heap_at(heap, ENABLED_ADDR), true);
+
+    surgescript_object_set_userdata(object, NULL);
+    return NULL;
+}
+
+/* __init: pass the relative path to a sound file */
+surgescript_var_t* fun_init(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    char* path = surgescript_var_get_string(param[0], manager);
+    sound_t* sound = sound_load(path);
+
+    if(sound != NULL && get_source(object) == NULL) {
+        audiosource_t* source = audiosource_create(sound);
+        surgescript_object_set_userdata(object, source);
+
+        audiosource_set_position(source, scripting_util_world_position(object));
+        audiosource_set_volume(source, surgescript_var_get_number(surgescript_heap_at(heap, VOLUME_ADDR)));
+        audiosource_set_enabled(source, surgescript_var_get_bool(surgescript_heap_at(heap, ENABLED_ADDR)));
+        update_distances(object);
+        update_line(object);
+    }
+
+    ssfree(path);
+    return surgescript_var_set_objecthandle(surgescript_var_create(), surgescript_object_handle(object));
+}
+
+/* destructor */
+surgescript_var_t* fun_destructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    audiosource_t* source = get_source(object);
+
+    if(source != NULL) {
+        audiosource_destroy(source);
+        surgescript_object_set_userdata(object, NULL);
+    }
+
+    return NULL;
+}
+
+/* within a distance of mindist pixels, the sound will stay the loudest */
+surgescript_var_t* fun_getmindist(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    return surgescript_var_clone(surgescript_heap_at(heap, MINDIST_ADDR));
+}
+
+surgescript_var_t* fun_setmindist(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    double mindist = surgescript_var_get_number(param[0]);
+
+    surgescript_var_set_number(surgescript_heap_at(heap, MINDIST_ADDR), max(mindist, 0.0));
+    update_distances(object);
+
+    return NULL;
+}
+
+/* outside the region of maxdist pixels, the sound will be silent */
+surgescript_var_t* fun_getmaxdist(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    return surgescript_var_clone(surgescript_heap_at(heap, MAXDIST_ADDR));
+}
+
+surgescript_var_t* fun_setmaxdist(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    double maxdist = surgescript_var_get_number(param[0]);
+
+    surgescript_var_set_number(surgescript_heap_at(heap, MAXDIST_ADDR), max(maxdist, 0.0));
+    update_distances(object);
+
+    return NULL;
+}
+
+/* measure the distance to a horizontal line instead of a point? */
+surgescript_var_t* fun_gethorizontal(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    return surgescript_var_clone(surgescript_heap_at(heap, HORIZONTAL_ADDR));
+}
+
+surgescript_var_t* fun_sethorizontal(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    bool horizontal = surgescript_var_get_bool(param[0]);
+
+    surgescript_var_set_bool(surgescript_heap_at(heap, HORIZONTAL_ADDR), horizontal);
+    update_line(object);
+
+    return NULL;
+}
+
+/* the height of the horizontal line, in pixels */
+surgescript_var_t* fun_getlineheight(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    return surgescript_var_clone(surgescript_heap_at(heap, LINEHEIGHT_ADDR));
+}
+
+surgescript_var_t* fun_setlineheight(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    double line_height = surgescript_var_get_number(param[0]);
+
+    surgescript_var_set_number(surgescript_heap_at(heap, LINEHEIGHT_ADDR), max(line_height, 0.0));
+    update_line(object);
+
+    return NULL;
+}
+
+/* base volume, a value in the [0, 1] range */
+surgescript_var_t* fun_getvolume(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    return surgescript_var_clone(surgescript_heap_at(heap, VOLUME_ADDR));
+}
+
+surgescript_var_t* fun_setvolume(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    double volume = surgescript_var_get_number(param[0]);
+    audiosource_t* source = get_source(object);
+
+    volume = clip01(volume);
+    surgescript_var_set_number(surgescript_heap_at(heap, VOLUME_ADDR), volume);
+    if(source != NULL)
+        audiosource_set_volume(source, volume);
+
+    return NULL;
+}
+
+/* is the audio source enabled? */
+surgescript_var_t* fun_getenabled(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    return surgescript_var_clone(surgescript_heap_at(heap, ENABLED_ADDR));
+}
+
+surgescript_var_t* fun_setenabled(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    bool enabled = surgescript_var_get_bool(param[0]);
+    audiosource_t* source = get_source(object);
+
+    surgescript_var_set_bool(surgescript_heap_at(heap, ENABLED_ADDR), enabled);
+    if(source != NULL)
+        audiosource_set_enabled(source, enabled);
+
+    return NULL;
+}
+
+
+
+/* --- utilities --- */
+
+/* gets the audiosource_t* pointer: may be NULL */
+audiosource_t* get_source(const surgescript_object_t* object)
+{
+    return (audiosource_t*)surgescript_object_userdata(object);
+}
+
+/* sends the falloff distances to the audio source */
+void update_distances(surgescript_object_t* object)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    audiosource_t* source = get_source(object);
+
+    if(source != NULL) {
+        double mindist = surgescript_var_get_number(surgescript_heap_at(heap, MINDIST_ADDR));
+        double maxdist = surgescript_var_get_number(surgescript_heap_at(heap, MAXDIST_ADDR));
+        audiosource_set_distances(source, mindist, maxdist);
+    }
+}
+
+/* sends the horizontal line to the audio source */
+void update_line(surgescript_object_t* object)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    audiosource_t* source = get_source(object);
+
+    if(source != NULL) {
+        bool horizontal = surgescript_var_get_bool(surgescript_heap_at(heap, HORIZONTAL_ADDR));
+        double line_height = surgescript_var_get_number(surgescript_heap_at(heap, LINEHEIGHT_ADDR));
+        audiosource_set_horizontal(source, horizontal, line_height);
+    }
+}
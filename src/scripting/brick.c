@@ -294,9 +294,9 @@ surgescript_var_t* fun_destructor(surgescript_object_t* object, const surgescrip
     bricklike_data_t* data = get_data(object);
 
     /* this block of code would crash the application, as it would
-       invalidate pointers from a valid obstacle map. However, we
-       clone the collision mask of this brick-like object and use
-       the clone in the obstacle map instead. */
+       invalidate pointers from a valid obstacle map. However, the
+       collision mask is shared: the obstacle map holds references
+       to the mask of this brick-like object. */
     if(data->mask != NULL) {
         collisionmask_destroy(data->mask);
         if(data->maskimg != NULL)
@@ -323,9 +323,9 @@ surgescript_var_t* fun_init(surgescript_object_t* object, const surgescript_var_
             image_destroy(data->maskimg);
     }
 
-    data->mask = spriteinfo_to_collisionmask(
+    data->mask = spriteinfo_shared_collisionmask(
         animation_sprite(animation),
-        animation_frame_index(animation, 0) /* get the first frame of the animation */
+        animation_frame_index(animation, 0) /* get the first frame of the animation; bricks with the same sprite share the mask */
     );
     data->maskimg = NULL; /* create lazily */
     data->hot_spot = animation_hot_spot(animation);
@@ -479,6 +479,7 @@ surgescript_var_t* fun_setoffset(surgescript_object_t* object, const surgescript
     surgescript_object_t* v2 = surgescript_objectmanager_get(manager, v2h);
     scripting_vector2_read(v2, &x, &y);
     surgescript_transform_setposition2d(transform, x, y);
+    scripting_transform_changed();
 
     return NULL;
 }
@@ -1,6 +1,6 @@
 /*
  * Open Surge Engine
- * brickparticle.c - scripting system: brick particle
+ * brickparticle.c - scripting system: brick particles
  * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
  * http://opensurge2d.org
  *
@@ -19,6 +19,7 @@
  */
 
 #include <surgescript.h>
+#include <string.h>
 #include "scripting.h"
 #include "../core/timer.h"
 #include "../core/image.h"
@@ -29,18 +30,40 @@
 #include "../entities/camera.h"
 #include "../scenes/level.h"
 
-/* brick particle data */
-typedef struct particledata_t particledata_t;
-struct particledata_t
+/*
+
+BrickParticles is a particle emitter. A single object owns all the brick
+particles of a zindex and keeps them in a structure of arrays. The particles
+are updated in tight loops that the compiler can vectorize, and they are drawn
+in a single entry of the render queue. Bricks break in bursts of many particles
+that are soon disposed of: we don't want a SurgeScript object for each of them.
+
+*/
+
+/* particle emitter data */
+typedef struct brickparticles_t brickparticles_t;
+struct brickparticles_t
 {
-    const image_t* image; /* possibly NULL */
-    int src_x, src_y, width, height;
-    double zindex;
-    v2d_t velocity;
+    int count; /* number of particles */
+    int capacity; /* allocated length of the arrays below */
+    float zindex;
+
+    /* structure of arrays */
+    float* x; /* position in world space */
+    float* y;
+    float* xvel; /* velocity */
+    float* yvel;
+    const image_t** image;
+    short* src_x; /* subregion of the image */
+    short* src_y;
+    short* width;
+    short* height;
 };
 
 /* constants */
 static const double DEFAULT_ZINDEX = 0.5;
+#define INITIAL_CAPACITY 64
+#define MAX_PARTICLES 4096
 
 /* SurgeScript functions */
 static surgescript_var_t* fun_main(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
@@ -52,11 +75,11 @@ static surgescript_var_t* fun_gettexturehandle(surgescript_object_t* object, con
 static surgescript_var_t* fun_getistranslucent(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_getzindex(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_setzindex(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
-static surgescript_var_t* fun_setbrick(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
-static surgescript_var_t* fun_setvelocity(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
-static inline particledata_t* get_particledata(const surgescript_object_t* object);
-static particledata_t* create_particledata();
-static particledata_t* destroy_particledata(particledata_t* pd);
+static surgescript_var_t* fun_getcount(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static inline brickparticles_t* get_data(const surgescript_object_t* object);
+static void grow(brickparticles_t* data);
+static void move_particles(brickparticles_t* data, float gravity, float dt);
+static void remove_particle(brickparticles_t* data, int index);
 
 
 
@@ -70,26 +93,87 @@ void scripting_register_brickparticle(surgescript_vm_t* vm)
 {
     /* tags */
     surgescript_tagsystem_t* tag_system = surgescript_vm_tagsystem(vm);
-    surgescript_tagsystem_add_tag(tag_system, "BrickParticle", "renderable");
-    surgescript_tagsystem_add_tag(tag_system, "BrickParticle", "entity");
-    surgescript_tagsystem_add_tag(tag_system, "BrickParticle", "private");
-    surgescript_tagsystem_add_tag(tag_system, "BrickParticle", "disposable");
+    surgescript_tagsystem_add_tag(tag_system, "BrickParticles", "renderable");
+    surgescript_tagsystem_add_tag(tag_system, "BrickParticles", "entity");
+    surgescript_tagsystem_add_tag(tag_system, "BrickParticles", "private");
+    surgescript_tagsystem_add_tag(tag_system, "BrickParticles", "awake");
 
     /* methods */
-    surgescript_vm_bind(vm, "BrickParticle", "state:main", fun_main, 0);
-    surgescript_vm_bind(vm, "BrickParticle", "constructor", fun_constructor, 0);
-    surgescript_vm_bind(vm, "BrickParticle", "destructor", fun_destructor, 0);
+    surgescript_vm_bind(vm, "BrickParticles", "state:main", fun_main, 0);
+    surgescript_vm_bind(vm, "BrickParticles", "constructor", fun_constructor, 0);
+    surgescript_vm_bind(vm, "BrickParticles", "destructor", fun_destructor, 0);
+
+    surgescript_vm_bind(vm, "BrickParticles", "get_count", fun_getcount, 0);
+
+    surgescript_vm_bind(vm, "BrickParticles", "set_zindex", fun_setzindex, 1);
+    surgescript_vm_bind(vm, "BrickParticles", "get_zindex", fun_getzindex, 0);
 
-    surgescript_vm_bind(vm, "BrickParticle", "setBrick", fun_setbrick, 5);
-    surgescript_vm_bind(vm, "BrickParticle", "setVelocity", fun_setvelocity, 2);
+    surgescript_vm_bind(vm, "BrickParticles", "get___filepathOfRenderable", fun_getfilepathofrenderable, 0);
+    surgescript_vm_bind(vm, "BrickParticles", "get___textureHandle", fun_gettexturehandle, 0);
+    surgescript_vm_bind(vm, "BrickParticles", "get___isTranslucent", fun_getistranslucent, 0);
+    surgescript_vm_bind(vm, "BrickParticles", "onRender", fun_onrender, 2);
+}
 
-    surgescript_vm_bind(vm, "BrickParticle", "set_zindex", fun_setzindex, 1);
-    surgescript_vm_bind(vm, "BrickParticle", "get_zindex", fun_getzindex, 0);
+/*
+ * scripting_release_brickparticle()
+ * Release this component. Call after destroying the VM
+ */
+void scripting_release_brickparticle()
+{
+    /* nothing to do: the particles are owned by the emitters */
+    ;
+}
 
-    surgescript_vm_bind(vm, "BrickParticle", "get___filepathOfRenderable", fun_getfilepathofrenderable, 0);
-    surgescript_vm_bind(vm, "BrickParticle", "get___textureHandle", fun_gettexturehandle, 0);
-    surgescript_vm_bind(vm, "BrickParticle", "get___isTranslucent", fun_getistranslucent, 0);
-    surgescript_vm_bind(vm, "BrickParticle", "onRender", fun_onrender, 2);
+/*
+ * scripting_brickparticles_emit()
+ * Emits a particle displaying a subregion of an image. The particle
+ * is discarded if the emitter is full
+ */
+void scripting_brickparticles_emit(surgescript_object_t* emitter, const image_t* image, int src_x, int src_y, int width, int height, v2d_t position, v2d_t velocity)
+{
+    brickparticles_t* data = get_data(emitter);
+    int image_w = image_width(image);
+    int image_h = image_height(image);
+
+    /* make room for a new particle */
+    if(data->count == data->capacity) {
+        if(data->capacity >= MAX_PARTICLES)
+            return;
+
+        grow(data);
+    }
+
+    /* add the particle */
+    int i = data->count++;
+    data->x[i] = position.x;
+    data->y[i] = position.y;
+    data->xvel[i] = velocity.x;
+    data->yvel[i] = velocity.y;
+    data->image[i] = image;
+    data->width[i] = clip(width, 0, image_w);
+    data->height[i] = clip(height, 0, image_h);
+    data->src_x[i] = clip(src_x, 0, image_w - data->width[i]);
+    data->src_y[i] = clip(src_y, 0, image_h - data->height[i]);
+}
+
+/*
+ * scripting_brickparticles_zindex()
+ * The zindex of the particles of an emitter
+ */
+float scripting_brickparticles_zindex(const surgescript_object_t* emitter)
+{
+    const brickparticles_t* data = get_data(emitter);
+    return data->zindex;
+}
+
+/*
+ * scripting_brickparticles_set_zindex()
+ * Changes the zindex of the particles of an emitter
+ */
+void scripting_brickparticles_set_zindex(surgescript_object_t* emitter, float zindex)
+{
+    brickparticles_t* data = get_data(emitter);
+    data->zindex = max(0.0f, zindex);
 }
 
 
@@ -104,20 +188,29 @@ SurgeScript functions
 /* main state */
 surgescript_var_t* fun_main(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
-    surgescript_transform_t* transform = surgescript_object_transform(object);
-    particledata_t* pd = get_particledata(object);
-    float dt = timer_get_delta();
+    brickparticles_t* data = get_data(object);
+    int top, left, bottom, right;
 
-    /* update velocity */
-    float grv = level_gravity();
-    pd->velocity.y += grv * dt;
+    /* nothing to do? */
+    if(data->count == 0)
+        return NULL;
 
-    /* update position */
-    float dx = pd->velocity.x * dt;
-    float dy = pd->velocity.y * dt;
-    surgescript_transform_translate2d(transform, dx, dy);
+    /* move the particles */
+    move_particles(data, level_gravity(), timer_get_delta());
 
-    /* this disposable entity will be removed automatically by the Entity Manager */
+    /* remove the particles that have left the region of interest */
+    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
+    surgescript_object_t* level = surgescript_objectmanager_get(manager, surgescript_object_parent(object));
+    surgescript_object_t* entity_manager = scripting_level_entitymanager(level);
+    entitymanager_get_roi(entity_manager, &top, &left, &bottom, &right);
+
+    for(int i = data->count - 1; i >= 0; i--) {
+        if(
+            data->x[i] + data->width[i] < left || data->x[i] > right ||
+            data->y[i] + data->height[i] < top || data->y[i] > bottom
+        )
+            remove_particle(data, i);
+    }
 
     /* done */
     return NULL;
@@ -128,33 +221,41 @@ surgescript_var_t* fun_onrender(surgescript_object_t* object, const surgescript_
 {
     double camera_x = surgescript_var_get_number(param[0]);
     double camera_y = surgescript_var_get_number(param[1]);
-    v2d_t camera = v2d_new(camera_x, camera_y);
-    v2d_t position = v2d_new(0.0f, 0.0f);
+    const brickparticles_t* data = get_data(object);
 
     /* nothing to do? */
-    const particledata_t* pd = get_particledata(object);
-    if(pd->image == NULL)
-        return NULL; /* image not yet set */
-
-    /* get position in world space */
-    const surgescript_transform_t* transform = surgescript_object_transform(object);
-    surgescript_transform_getposition2d(transform, &position.x, &position.y);
-
-    /* convert position to screen space */
-    v2d_t center_of_screen = v2d_multiply(video_get_screen_size(), 0.5f);
-    v2d_t topleft_of_screen = v2d_subtract(camera, center_of_screen);
-    position = v2d_subtract(position, topleft_of_screen);
-
-    /* render */
-    image_blit(
-        pd->image,
-        pd->src_x,
-        pd->src_y,
-        (int)position.x,
-        (int)position.y,
-        pd->width,
-        pd->height
-    );
+    if(data->count == 0)
+        return NULL;
+
+    /* find the top-left corner of the screen in world space */
+    v2d_t screen_size = video_get_screen_size();
+    int offset_x = (int)(camera_x - 0.5 * screen_size.x);
+    int offset_y = (int)(camera_y - 0.5 * screen_size.y);
+    int screen_w = (int)screen_size.x;
+    int screen_h = (int)screen_size.y;
+
+    /* render all particles in a single batch */
+    image_hold_drawing(true);
+
+    for(int i = 0; i < data->count; i++) {
+        int x = (int)data->x[i] - offset_x;
+        int y = (int)data->y[i] - offset_y;
+
+        if(x + data->width[i] <= 0 || x >= screen_w || y + data->height[i] <= 0 || y >= screen_h)
+            continue;
+
+        image_blit(
+            data->image[i],
+            data->src_x[i],
+            data->src_y[i],
+            x,
+            y,
+            data->width[i],
+            data->height[i]
+        );
+    }
+
+    image_hold_drawing(false);
 
     /* done */
     return NULL;
@@ -165,7 +266,7 @@ surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescri
 {
     surgescript_objectmanager_t* manager = surgescript_object_manager(object);
 
-    /* BrickParticle must be a child of Level */
+    /* BrickParticles must be a child of Level */
     surgescript_objecthandle_t parent_handle = surgescript_object_parent(object);
     const surgescript_object_t* parent = surgescript_objectmanager_get(manager, parent_handle);
     if(strcmp(surgescript_object_name(parent), "Level") != 0) {
@@ -173,9 +274,17 @@ surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescri
         return NULL;
     }
 
-    /* create particle data */
-    particledata_t* pd = create_particledata();
-    surgescript_object_set_userdata(object, pd);
+    /* create the emitter data */
+    brickparticles_t* data = mallocx(sizeof *data);
+    data->count = 0;
+    data->capacity = 0;
+    data->zindex = DEFAULT_ZINDEX;
+    data->x = data->y = NULL;
+    data->xvel = data->yvel = NULL;
+    data->image = NULL;
+    data->src_x = data->src_y = NULL;
+    data->width = data->height = NULL;
+    surgescript_object_set_userdata(object, data);
 
     /* done */
     return NULL;
@@ -184,100 +293,73 @@ surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescri
 /* destructor */
 surgescript_var_t* fun_destructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
-    /* destroy particle data */
-    particledata_t* pd = get_particledata(object);
-    destroy_particledata(pd);
+    brickparticles_t* data = get_data(object);
+
+    /* destroy the emitter data */
+    free(data->height);
+    free(data->width);
+    free(data->src_y);
+    free(data->src_x);
+    free(data->image);
+    free(data->yvel);
+    free(data->xvel);
+    free(data->y);
+    free(data->x);
+    free(data);
 
     /* done */
     return NULL;
 }
 
-/* set brick */
-surgescript_var_t* fun_setbrick(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+/* the number of live particles */
+surgescript_var_t* fun_getcount(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
-    int brick_id = surgescript_var_get_number(param[0]);
-    int src_x = surgescript_var_get_number(param[1]);
-    int src_y = surgescript_var_get_number(param[2]);
-    int width = surgescript_var_get_number(param[3]);
-    int height = surgescript_var_get_number(param[4]);
-
-    if(brick_exists(brick_id)) {
-        const image_t* brick_image = brick_image_preview(brick_id);
-        int brick_width = image_width(brick_image);
-        int brick_height = image_height(brick_image);
-        float zindex = brick_zindex_preview(brick_id);
-
-        particledata_t* pd = get_particledata(object);
-        pd->image = brick_image;
-        pd->width = clip(width, 0, brick_width);
-        pd->height = clip(height, 0, brick_height);
-        pd->src_x = clip(src_x, 0, brick_width - pd->width);
-        pd->src_y = clip(src_y, 0, brick_height - pd->height);
-        pd->zindex = max(0.0f, zindex);
-    }
-
-    return NULL;
-}
-
-/* set velocity */
-surgescript_var_t* fun_setvelocity(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
-{
-    double xvel = surgescript_var_get_number(param[0]);
-    double yvel = surgescript_var_get_number(param[1]);
-
-    particledata_t* pd = get_particledata(object);
-    pd->velocity = v2d_new(xvel, yvel);
-
-    return NULL;
+    const brickparticles_t* data = get_data(object);
+    return surgescript_var_set_number(surgescript_var_create(), data->count);
 }
 
 /* set zindex */
 surgescript_var_t* fun_setzindex(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
     double zindex = surgescript_var_get_number(param[0]);
-
-    particledata_t* pd = get_particledata(object);
-    pd->zindex = zindex;
-
+    scripting_brickparticles_set_zindex(object, zindex);
     return NULL;
 }
 
 /* get zindex */
 surgescript_var_t* fun_getzindex(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
-    const particledata_t* pd = get_particledata(object);
-    return surgescript_var_set_number(surgescript_var_create(), pd->zindex);
+    const brickparticles_t* data = get_data(object);
+    return surgescript_var_set_number(surgescript_var_create(), data->zindex);
 }
 
 /* the filepath of this renderable (used by the render queue) */
 surgescript_var_t* fun_getfilepathofrenderable(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
-    const particledata_t* pd = get_particledata(object);
-    const image_t* image = pd->image;
+    const brickparticles_t* data = get_data(object);
 
-    /* image already set? */
-    if(image != NULL) {
-        const char* filepath = image_filepath(image);
+    /* are there any particles? */
+    if(data->count > 0) {
+        const char* filepath = image_filepath(data->image[0]);
         return surgescript_var_set_string(surgescript_var_create(), filepath);
     }
 
-    /* image not yet set */
-    return surgescript_var_set_string(surgescript_var_create(), "<brick-particle>");
+    /* no particles */
+    return surgescript_var_set_string(surgescript_var_create(), "<brick-particles>");
 }
 
 /* the texture handle of this renderable (used by the render queue) */
 surgescript_var_t* fun_gettexturehandle(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
-    const particledata_t* pd = get_particledata(object);
-    const image_t* image = pd->image;
+    const brickparticles_t* data = get_data(object);
 
-    /* image already set? */
-    if(image != NULL) {
-        texturehandle_t tex = image_texture(image);
+    /* are there any particles? */
+    if(data->count > 0) {
+        texturehandle_t tex = image_texture(data->image[0]);
         return surgescript_var_set_rawbits(surgescript_var_create(), tex);
     }
 
-    /* image not yet set */
+    /* no particles */
     return surgescript_var_set_null(surgescript_var_create());
 }
 
@@ -296,29 +378,63 @@ misc
 
 */
 
-/* get particle data */
-particledata_t* get_particledata(const surgescript_object_t* object)
+/* get emitter data */
+brickparticles_t* get_data(const surgescript_object_t* object)
 {
-    return (particledata_t*)surgescript_object_userdata(object);
+    return (brickparticles_t*)surgescript_object_userdata(object);
 }
 
-/* create particle data */
-particledata_t* create_particledata()
+/* double the capacity of the emitter */
+void grow(brickparticles_t* data)
 {
-    particledata_t* pd = mallocx(sizeof *pd);
-
-    pd->image = NULL;
-    pd->src_x = pd->src_y = 0;
-    pd->width = pd->height = 0;
-    pd->zindex = DEFAULT_ZINDEX;
-    pd->velocity = v2d_new(0.0f, 0.0f);
+    int capacity = data->capacity > 0 ? min(2 * data->capacity, MAX_PARTICLES) : INITIAL_CAPACITY;
+
+    data->x = reallocx(data->x, capacity * sizeof(*(data->x)));
+    data->y = reallocx(data->y, capacity * sizeof(*(data->y)));
+    data->xvel = reallocx(data->xvel, capacity * sizeof(*(data->xvel)));
+    data->yvel = reallocx(data->yvel, capacity * sizeof(*(data->yvel)));
+    data->image = reallocx(data->image, capacity * sizeof(*(data->image)));
+    data->src_x = reallocx(data->src_x, capacity * sizeof(*(data->src_x)));
+    data->src_y = reallocx(data->src_y, capacity * sizeof(*(data->src_y)));
+    data->width = reallocx(data->width, capacity * sizeof(*(data->width)));
+    data->height = reallocx(data->height, capacity * sizeof(*(data->height)));
+
+    data->capacity = capacity;
+}
 
-    return pd;
+/* move the particles under gravity
+   These loops have no dependencies between iterations and operate on
+   contiguous arrays of floats, so the compiler turns them into SIMD code */
+void move_particles(brickparticles_t* data, float gravity, float dt)
+{
+    float* x = data->x;
+    float* y = data->y;
+    const float* xvel = data->xvel;
+    float* yvel = data->yvel;
+    const float dv = gravity * dt;
+    const int n = data->count;
+
+    for(int i = 0; i < n; i++)
+        yvel[i] += dv;
+
+    for(int i = 0; i < n; i++) {
+        x[i] += xvel[i] * dt;
+        y[i] += yvel[i] * dt;
+    }
 }
 
-/* destroy particle data */
-particledata_t* destroy_particledata(particledata_t* pd)
+/* remove a particle in O(1); the order of the particles is not preserved */
+void remove_particle(brickparticles_t* data, int index)
 {
-    free(pd);
-    return NULL;
-}
\ No newline at end of file
+    int last = --data->count;
+
+    data->x[index] = data->x[last];
+    data->y[index] = data->y[last];
+    data->xvel[index] = data->xvel[last];
+    data->yvel[index] = data->yvel[last];
+    data->image[index] = data->image[last];
+    data->src_x[index] = data->src_x[last];
+    data->src_y[index] = data->src_y[last];
+    data->width[index] = data->width[last];
+    data->height[index] = data->height[last];
+}
@@ -35,6 +35,20 @@ static surgescript_var_t* fun_lock(surgescript_object_t* object, const surgescri
 static surgescript_var_t* fun_unlock(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_screentoworld(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_worldtoscreen(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_getfollow(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_setfollow(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_getdeadzone(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_setdeadzone(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_getsmoothing(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_setsmoothing(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_getlookaheadtime(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_setlookaheadtime(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_getmaxlookahead(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_setmaxlookahead(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_getviewcount(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_setviewcount(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_setviewposition(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* new_vector2(surgescript_object_t* object, v2d_t v);
 static const surgescript_heapptr_t POSITION_ADDR = 0;
 
 /*
@@ -54,6 +68,19 @@ void scripting_register_camera(surgescript_vm_t* vm)
     surgescript_vm_bind(vm, "Camera", "unlock", fun_unlock, 0);
     surgescript_vm_bind(vm, "Camera", "screenToWorld", fun_screentoworld, 1);
     surgescript_vm_bind(vm, "Camera", "worldToScreen", fun_worldtoscreen, 1);
+    surgescript_vm_bind(vm, "Camera", "get_follow", fun_getfollow, 0);
+    surgescript_vm_bind(vm, "Camera", "set_follow", fun_setfollow, 1);
+    surgescript_vm_bind(vm, "Camera", "get_deadZone", fun_getdeadzone, 0);
+    surgescript_vm_bind(vm, "Camera", "set_deadZone", fun_setdeadzone, 1);
+    surgescript_vm_bind(vm, "Camera", "get_smoothing", fun_getsmoothing, 0);
+    surgescript_vm_bind(vm, "Camera", "set_smoothing", fun_setsmoothing, 1);
+    surgescript_vm_bind(vm, "Camera", "get_lookAheadTime", fun_getlookaheadtime, 0);
+    surgescript_vm_bind(vm, "Camera", "set_lookAheadTime", fun_setlookaheadtime, 1);
+    surgescript_vm_bind(vm, "Camera", "get_maxLookAhead", fun_getmaxlookahead, 0);
+    surgescript_vm_bind(vm, "Camera", "set_maxLookAhead", fun_setmaxlookahead, 1);
+    surgescript_vm_bind(vm, "Camera", "get_viewCount", fun_getviewcount, 0);
+    surgescript_vm_bind(vm, "Camera", "set_viewCount", fun_setviewcount, 1);
+    surgescript_vm_bind(vm, "Camera", "setViewPosition", fun_setviewposition, 2);
 }
 
 /* constructor */
@@ -179,4 +206,127 @@ surgescript_var_t* fun_worldtoscreen(surgescript_object_t* object, const surgesc
     );
 
     return surgescript_var_set_objecthandle(surgescript_var_create(), new_handle);
-}
\ No newline at end of file
+}
+
+/* is the native controller following the camera focus? */
+surgescript_var_t* fun_getfollow(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    return surgescript_var_set_bool(surgescript_var_create(), camera_is_controller_enabled());
+}
+
+/* enable or disable the native controller, which follows the camera focus (usually, the player) without per-frame scripting */
+surgescript_var_t* fun_setfollow(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    camera_enable_controller(surgescript_var_get_bool(param[0]));
+    return NULL;
+}
+
+/* the size of the dead zone of the native controller, in pixels */
+surgescript_var_t* fun_getdeadzone(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    return new_vector2(object, camera_controller_params()->dead_zone);
+}
+
+/* set the size of the dead zone of the native controller: a box centered on the camera in which the focus can move freely */
+surgescript_var_t* fun_setdeadzone(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
+    surgescript_objecthandle_t handle = surgescript_var_get_objecthandle(param[0]);
+    cameracontroller_params_t params = *camera_controller_params();
+
+    params.dead_zone = scripting_vector2_to_v2d(surgescript_objectmanager_get(manager, handle));
+    camera_set_controller_params(&params);
+
+    return NULL;
+}
+
+/* the smoothing time of the native controller, in seconds */
+surgescript_var_t* fun_getsmoothing(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    return surgescript_var_set_number(surgescript_var_create(), camera_controller_params()->smoothing);
+}
+
+/* set the smoothing time of the native controller, in seconds. Zero means no smoothing */
+surgescript_var_t* fun_setsmoothing(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    cameracontroller_params_t params = *camera_controller_params();
+
+    params.smoothing = surgescript_var_get_number(param[0]);
+    camera_set_controller_params(&params);
+
+    return NULL;
+}
+
+/* how far ahead, in seconds, the native controller looks in the direction of movement of the focus */
+surgescript_var_t* fun_getlookaheadtime(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    return surgescript_var_set_number(surgescript_var_create(), camera_controller_params()->look_ahead_time);
+}
+
+/* set the look-ahead time of the native controller, in seconds. Zero disables the look-ahead */
+surgescript_var_t* fun_setlookaheadtime(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    cameracontroller_params_t params = *camera_controller_params();
+
+    params.look_ahead_time = surgescript_var_get_number(param[0]);
+    camera_set_controller_params(&params);
+
+    return NULL;
+}
+
+/* the maximum look-ahead offset of the native controller, in pixels */
+surgescript_var_t* fun_getmaxlookahead(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    return new_vector2(object, camera_controller_params()->max_look_ahead);
+}
+
+/* set the maximum look-ahead offset of the native controller, in pixels */
+surgescript_var_t* fun_setmaxlookahead(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
+    surgescript_objecthandle_t handle = surgescript_var_get_objecthandle(param[0]);
+    cameracontroller_params_t params = *camera_controller_params();
+
+    params.max_look_ahead = scripting_vector2_to_v2d(surgescript_objectmanager_get(manager, handle));
+    camera_set_controller_params(&params);
+
+    return NULL;
+}
+
+/* split-screen: the number of views of the level */
+surgescript_var_t* fun_getviewcount(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    return surgescript_var_set_number(surgescript_var_create(), camera_view_count());
+}
+
+/* split-screen: splits the screen among 1 to 4 views. View 0 is the camera itself */
+surgescript_var_t* fun_setviewcount(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    int count = surgescript_var_get_number(param[0]);
+    camera_set_view_count(count);
+    return NULL;
+}
+
+/* split-screen: sets the position of the view of the given index, in world coordinates */
+surgescript_var_t* fun_setviewposition(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
+    int view_index = surgescript_var_get_number(param[0]);
+    surgescript_objecthandle_t handle = surgescript_var_get_objecthandle(param[1]);
+    surgescript_object_t* v2 = surgescript_objectmanager_get(manager, handle);
+
+    camera_set_view_position(view_index, scripting_vector2_to_v2d(v2));
+
+    return NULL;
+}
+
+/* spawns a temporary Vector2 with the given coordinates */
+surgescript_var_t* new_vector2(surgescript_object_t* object, v2d_t v)
+{
+    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
+    surgescript_objecthandle_t handle = surgescript_objectmanager_spawn_temp(manager, "Vector2");
+
+    scripting_vector2_update(surgescript_objectmanager_get(manager, handle), v.x, v.y);
+
+    return surgescript_var_set_objecthandle(surgescript_var_create(), handle);
+}
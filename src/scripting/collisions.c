@@ -20,11 +20,15 @@
 
 #include <surgescript.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include "scripting.h"
 #include "../core/image.h"
 #include "../core/video.h"
 #include "../util/darray.h"
+#include "../util/util.h"
 #include "../util/v2d.h"
+#include "../util/profiler.h"
+#include "../util/pool.h"
 
 /* private */
 typedef enum { COLLIDER_TYPE_BOX, COLLIDER_TYPE_BALL } collidertype_t;
@@ -40,6 +44,8 @@ struct collider_t
     v2d_t worldpos;
     v2d_t anchor;
     uint8_t flags;
+    int layer; /* collision layer, 0 <= layer < COLLIDER_MAX_LAYERS */
+    uint32_t mask; /* the i-th bit is set if the collider interacts with layer i */
 };
 
 typedef struct boxcollider_t boxcollider_t;
@@ -57,16 +63,53 @@ struct ballcollider_t
     double radius; /* in pixels */
 };
 
+typedef struct packedcollider_t packedcollider_t;
+struct packedcollider_t
+{
+    collidertype_t type;
+    double x, y; /* center in world space */
+    double half_width, half_height; /* boxes only */
+    double radius; /* balls only */
+    uint32_t layer_bit; /* 1 << layer */
+    uint32_t mask;
+};
+
+typedef struct sweepentry_t sweepentry_t;
+struct sweepentry_t
+{
+    double left, right; /* bounding box of the collider on the x-axis */
+    int index; /* index of the collider in colliders[] */
+};
+
+typedef struct colliderpair_t colliderpair_t;
+struct colliderpair_t
+{
+    int i, j; /* indices of the colliders, i > j */
+};
+
 typedef struct collisionmanager_t collisionmanager_t;
 struct collisionmanager_t
 {
     DARRAY(surgescript_objecthandle_t, colliders);
+    DARRAY(packedcollider_t, packed); /* packed[i] is the geometry of colliders[i] in this frame */
+
+    /* broadphase: sweep and prune */
+    DARRAY(sweepentry_t, sweep); /* sorted by the left side of the bounding boxes */
+    DARRAY(sweepentry_t, sweep_tmp); /* scratch memory of the sort */
+    DARRAY(colliderpair_t, pairs); /* pairs of colliders whose bounding boxes overlap */
+
+    /* stats of the last frame */
+    int pair_tests; /* how many bounding box tests were performed */
+    int narrowphase_tests; /* how many pairs were tested with collidesWith() */
 };
 
 #define COLLIDER_FLAG_ISVISIBLE             0x1
 #define COLLIDER_FLAG_NOTIFYONCOLLISION     0x2
 #define COLLIDER_FLAG_NOTIFYONOVERLAP       0x4
 #define COLLIDER_FLAG_ISDISABLED            0x8
+#define COLLIDER_MAX_LAYERS                 32
+#define COLLIDER_DEFAULT_LAYER              0
+#define COLLIDER_DEFAULT_MASK               UINT32_MAX /* interact with all layers */
 #define COLLIDER_COLOR(flags)               (color_premul_rgba(255, 255, 0, (flags) & COLLIDER_FLAG_ISDISABLED ? 63 : 127))
 static const surgescript_heapptr_t CENTER_ADDR = 0;
 static const surgescript_heapptr_t ANCHOR_ADDR = 1;
@@ -74,7 +117,24 @@ static const surgescript_heapptr_t ANCHOR_ADDR = 1;
 static inline collider_t* safe_get_collider(surgescript_object_t* object);
 static inline bool is_collider(const surgescript_object_t* object);
 static inline bool quick_bounding_box_test(const collider_t* a, const collider_t* b);
+
+/* colliders of all types are allocated from a pool. It's created on demand
+   and destroyed when there are no colliders left (e.g., when leaving a level) */
+static pool_t* collider_pool = NULL;
+#define COLLIDERS_PER_SLAB 128
+static collider_t* alloc_collider();
+static void free_collider(collider_t* collider);
 static inline void quickly_get_bounding_box(const collider_t* collider, double* left, double* top, double* right, double* bottom);
+static void sweep_and_prune(surgescript_objectmanager_t* manager, collisionmanager_t* colmgr);
+static int sweepentry_cmp(const void* a, const void* b);
+static int colliderpair_cmp(const void* a, const void* b);
+static inline packedcollider_t pack_collider(const collider_t* collider);
+static inline bool can_interact(const packedcollider_t* a, const packedcollider_t* b);
+static inline bool packed_collision_test(const packedcollider_t* a, const packedcollider_t* b);
+static inline bool box_box_test(const packedcollider_t* box, const packedcollider_t* other_box);
+static inline bool box_ball_test(const packedcollider_t* box, const packedcollider_t* ball);
+static inline bool ball_ball_test(const packedcollider_t* ball, const packedcollider_t* other_ball);
+#define WANT_PERFORMANCE_REPORT 0 /* for testing only */
 
 static surgescript_var_t* fun_main(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_destructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
@@ -87,6 +147,10 @@ static surgescript_var_t* fun_getcenter(surgescript_object_t* object, const surg
 static surgescript_var_t* fun_getanchor(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_setanchor(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_notify(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_getlayer(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_setlayer(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_setlayercollision(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_collideswithlayer(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 
 static surgescript_var_t* fun_collisionbox_constructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_collisionbox_init(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
@@ -149,6 +213,10 @@ void scripting_register_collisions(surgescript_vm_t* vm)
     surgescript_vm_bind(vm, "CollisionBox", "get_anchor", fun_getanchor, 0);
     surgescript_vm_bind(vm, "CollisionBox", "set_anchor", fun_setanchor, 1);
     surgescript_vm_bind(vm, "CollisionBox", "__notify", fun_notify, 1);
+    surgescript_vm_bind(vm, "CollisionBox", "get_layer", fun_getlayer, 0);
+    surgescript_vm_bind(vm, "CollisionBox", "set_layer", fun_setlayer, 1);
+    surgescript_vm_bind(vm, "CollisionBox", "setLayerCollision", fun_setlayercollision, 2);
+    surgescript_vm_bind(vm, "CollisionBox", "collidesWithLayer", fun_collideswithlayer, 1);
     surgescript_vm_bind(vm, "CollisionBox", "__init", fun_collisionbox_init, 3);
     surgescript_vm_bind(vm, "CollisionBox", "constructor", fun_collisionbox_constructor, 0);
     surgescript_vm_bind(vm, "CollisionBox", "collidesWith", fun_collisionbox_collideswith, 1);
@@ -177,6 +245,10 @@ void scripting_register_collisions(surgescript_vm_t* vm)
     surgescript_vm_bind(vm, "CollisionBall", "get_anchor", fun_getanchor, 0);
     surgescript_vm_bind(vm, "CollisionBall", "set_anchor", fun_setanchor, 1);
     surgescript_vm_bind(vm, "CollisionBall", "__notify", fun_notify, 1);
+    surgescript_vm_bind(vm, "CollisionBall", "get_layer", fun_getlayer, 0);
+    surgescript_vm_bind(vm, "CollisionBall", "set_layer", fun_setlayer, 1);
+    surgescript_vm_bind(vm, "CollisionBall", "setLayerCollision", fun_setlayercollision, 2);
+    surgescript_vm_bind(vm, "CollisionBall", "collidesWithLayer", fun_collideswithlayer, 1);
     surgescript_vm_bind(vm, "CollisionBall", "__init", fun_collisionball_init, 2);
     surgescript_vm_bind(vm, "CollisionBall", "constructor", fun_collisionball_constructor, 0);
     surgescript_vm_bind(vm, "CollisionBall", "collidesWith", fun_collisionball_collideswith, 1);
@@ -216,6 +288,26 @@ collider_t* safe_get_collider(surgescript_object_t* object)
     return unsafe_get_collider(object);
 }
 
+/* Allocate a collider of any type from the pool */
+collider_t* alloc_collider()
+{
+    const size_t size = sizeof(boxcollider_t) > sizeof(ballcollider_t) ? sizeof(boxcollider_t) : sizeof(ballcollider_t);
+
+    if(collider_pool == NULL)
+        collider_pool = pool_create(size, COLLIDERS_PER_SLAB);
+
+    return pool_alloc(collider_pool);
+}
+
+/* Give a collider back to the pool */
+void free_collider(collider_t* collider)
+{
+    pool_free(collider_pool, collider);
+
+    if(pool_count(collider_pool) == 0)
+        collider_pool = pool_destroy(collider_pool);
+}
+
 /* Get the bounding box of a collider in world space coordinates */
 void quickly_get_bounding_box(const collider_t* collider, double* left, double* top, double* right, double* bottom)
 {
@@ -268,6 +360,163 @@ bool quick_bounding_box_test(const collider_t* a, const collider_t* b)
 }
 
 
+/* Broadphase: finds the pairs of colliders whose bounding boxes overlap.
+   We sort the colliders by the left side of their bounding boxes and sweep
+   along the x-axis, testing only the colliders whose x-intervals intersect */
+void sweep_and_prune(surgescript_objectmanager_t* manager, collisionmanager_t* colmgr)
+{
+    int n = darray_length(colmgr->colliders);
+    double top, bottom;
+
+    darray_clear(colmgr->sweep);
+    darray_clear(colmgr->pairs);
+    darray_clear(colmgr->packed);
+    colmgr->pair_tests = 0;
+
+    /* compute the x-intervals and pack the geometry of the colliders */
+    for(int i = 0; i < n; i++) {
+        surgescript_object_t* object = surgescript_objectmanager_get(manager, colmgr->colliders[i]);
+        const collider_t* collider = unsafe_get_collider(object);
+        sweepentry_t entry = { .index = i };
+
+        darray_push(colmgr->packed, pack_collider(collider));
+        quickly_get_bounding_box(collider, &entry.left, &top, &entry.right, &bottom);
+        darray_push(colmgr->sweep, entry);
+        darray_push(colmgr->sweep_tmp, entry); /* reserve space */
+    }
+
+    /* sort by the left side */
+    merge_sort_with_buffer(colmgr->sweep, n, sizeof(sweepentry_t), sweepentry_cmp, colmgr->sweep_tmp);
+    darray_clear(colmgr->sweep_tmp);
+
+    /* sweep: the x-intervals of a and b intersect only if b.left <= a.right,
+       given that a.left <= b.left */
+    for(int a = 0; a < n; a++) {
+        const sweepentry_t* sa = &colmgr->sweep[a];
+
+        for(int b = a + 1; b < n && colmgr->sweep[b].left <= sa->right; b++) {
+            const sweepentry_t* sb = &colmgr->sweep[b];
+            int i = max(sa->index, sb->index), j = min(sa->index, sb->index);
+
+            /* skip the pairs whose layers don't interact */
+            if(!can_interact(&colmgr->packed[i], &colmgr->packed[j]))
+                continue;
+
+            surgescript_object_t* collider = surgescript_objectmanager_get(manager, colmgr->colliders[i]);
+            surgescript_object_t* other_collider = surgescript_objectmanager_get(manager, colmgr->colliders[j]);
+
+            /* the exact bounding box test of the brute force algorithm */
+            colmgr->pair_tests++;
+            if(quick_bounding_box_test(unsafe_get_collider(collider), unsafe_get_collider(other_collider))) {
+                colliderpair_t pair = { .i = i, .j = j };
+                darray_push(colmgr->pairs, pair);
+            }
+        }
+    }
+
+    /* keep the order of the brute force algorithm */
+    qsort(colmgr->pairs, darray_length(colmgr->pairs), sizeof(colliderpair_t), colliderpair_cmp);
+    colmgr->narrowphase_tests = darray_length(colmgr->pairs);
+}
+
+/* Read the geometry of a collider */
+packedcollider_t pack_collider(const collider_t* collider)
+{
+    packedcollider_t packed = {
+        .type = collider->type,
+        .x = collider->worldpos.x,
+        .y = collider->worldpos.y,
+        .half_width = 0.0,
+        .half_height = 0.0,
+        .radius = 0.0,
+        .layer_bit = UINT32_C(1) << collider->layer,
+        .mask = collider->mask
+    };
+
+    if(collider->type == COLLIDER_TYPE_BOX) {
+        packed.half_width = ((const boxcollider_t*)collider)->width / 2.0;
+        packed.half_height = ((const boxcollider_t*)collider)->height / 2.0;
+    }
+    else if(collider->type == COLLIDER_TYPE_BALL)
+        packed.radius = ((const ballcollider_t*)collider)->radius;
+
+    return packed;
+}
+
+/* Checks if the layers of two colliders interact with each other */
+bool can_interact(const packedcollider_t* a, const packedcollider_t* b)
+{
+    return (a->mask & b->layer_bit) && (b->mask & a->layer_bit);
+}
+
+/* Narrowphase: checks if two colliders collide. The test is symmetric */
+bool packed_collision_test(const packedcollider_t* a, const packedcollider_t* b)
+{
+    switch((a->type << 1) | b->type) {
+        case (COLLIDER_TYPE_BOX << 1) | COLLIDER_TYPE_BOX:
+            return box_box_test(a, b);
+
+        case (COLLIDER_TYPE_BOX << 1) | COLLIDER_TYPE_BALL:
+            return box_ball_test(a, b);
+
+        case (COLLIDER_TYPE_BALL << 1) | COLLIDER_TYPE_BOX:
+            return box_ball_test(b, a);
+
+        case (COLLIDER_TYPE_BALL << 1) | COLLIDER_TYPE_BALL:
+            return ball_ball_test(a, b);
+    }
+
+    return false;
+}
+
+/* box-box collision test */
+bool box_box_test(const packedcollider_t* box, const packedcollider_t* other_box)
+{
+    return box->x - box->half_width < other_box->x + other_box->half_width &&
+           box->x + box->half_width > other_box->x - other_box->half_width &&
+           box->y - box->half_height < other_box->y + other_box->half_height &&
+           box->y + box->half_height > other_box->y - other_box->half_height;
+}
+
+/* box-ball collision test */
+bool box_ball_test(const packedcollider_t* box, const packedcollider_t* ball)
+{
+    double dx = ball->x - clip(ball->x, box->x - box->half_width, box->x + box->half_width);
+    double dy = ball->y - clip(ball->y, box->y - box->half_height, box->y + box->half_height);
+    return dx * dx + dy * dy < ball->radius * ball->radius;
+}
+
+/* ball-ball collision test */
+bool ball_ball_test(const packedcollider_t* ball, const packedcollider_t* other_ball)
+{
+    double dx = ball->x - other_ball->x;
+    double dy = ball->y - other_ball->y;
+    double rr = ball->radius + other_ball->radius;
+    return dx * dx + dy * dy < rr * rr;
+}
+
+/* compare the left side of the bounding boxes */
+int sweepentry_cmp(const void* a, const void* b)
+{
+    double la = ((const sweepentry_t*)a)->left;
+    double lb = ((const sweepentry_t*)b)->left;
+
+    return (la > lb) - (la < lb);
+}
+
+/* order the pairs by i, then by j */
+int colliderpair_cmp(const void* a, const void* b)
+{
+    const colliderpair_t* pa = (const colliderpair_t*)a;
+    const colliderpair_t* pb = (const colliderpair_t*)b;
+
+    if(pa->i != pb->i)
+        return pa->i - pb->i;
+    else
+        return pa->j - pb->j;
+}
+
+
 
 /* ----------------------- CollisionManager --------------------------------- */
 
@@ -277,40 +526,55 @@ surgescript_var_t* fun_manager_main(surgescript_object_t* object, const surgescr
     surgescript_objectmanager_t* manager = surgescript_object_manager(object);
     collisionmanager_t* colmgr = surgescript_object_userdata(object);
     surgescript_var_t* tmp = surgescript_var_create();
-    surgescript_var_t* ret = surgescript_var_create();
     const surgescript_var_t* p[] = { tmp };
 
-    /*
-     * TODO: make this faster?
-     * simple, quadratic algorithm
-     */
-    for(int i = 1; i < darray_length(colmgr->colliders); i++) {
-        surgescript_object_t* collider = surgescript_objectmanager_get(manager, colmgr->colliders[i]);
-        for(int j = 0; j < i; j++) {
-            surgescript_object_t* other_collider = surgescript_objectmanager_get(manager, colmgr->colliders[j]);
+    PROFILER_BEGIN("collisions");
 
-            /* quickly discard a collision test */
-            if(!quick_bounding_box_test(
-                unsafe_get_collider(collider),
-                unsafe_get_collider(other_collider)
-            ))
-                continue;
+    /* find the pairs of colliders whose bounding boxes overlap */
+    sweep_and_prune(manager, colmgr);
+
+    /* test the pairs in the same order of the brute force algorithm:
+       for each i, for each j < i. We don't call collidesWith() here */
+    for(int k = 0; k < darray_length(colmgr->pairs); k++) {
+        int i = colmgr->pairs[k].i, j = colmgr->pairs[k].j;
 
-            /* perform a collision test */
+        /* the callbacks of the previous pairs may have destroyed the colliders */
+        if(!surgescript_objectmanager_exists(manager, colmgr->colliders[i]) || !surgescript_objectmanager_exists(manager, colmgr->colliders[j]))
+            continue;
+
+        surgescript_object_t* collider = surgescript_objectmanager_get(manager, colmgr->colliders[i]);
+        surgescript_object_t* other_collider = surgescript_objectmanager_get(manager, colmgr->colliders[j]);
+        if(!is_collider(collider) || !is_collider(other_collider))
+            continue;
+
+        /* ... or moved them. Test their current bounding boxes, as the brute
+           force algorithm did, and read their current geometry */
+        const collider_t* a = unsafe_get_collider(collider);
+        const collider_t* b = unsafe_get_collider(other_collider);
+        if(!quick_bounding_box_test(a, b))
+            continue;
+
+        packedcollider_t packed_a = pack_collider(a), packed_b = pack_collider(b);
+
+        /* perform a collision test */
+        if(can_interact(&packed_a, &packed_b) && packed_collision_test(&packed_a, &packed_b)) {
+            /* notify the colliders */
             surgescript_var_set_objecthandle(tmp, colmgr->colliders[j]);
-            surgescript_object_call_function(collider, "collidesWith", p, 1, ret);
-            if(surgescript_var_get_bool(ret)) {
-                /* notify the colliders */
-                surgescript_object_call_function(collider, "__notify", p, 1, NULL);
-                surgescript_var_set_objecthandle(tmp, colmgr->colliders[i]);
-                surgescript_object_call_function(other_collider, "__notify", p, 1, NULL);
-            }
+            surgescript_object_call_function(collider, "__notify", p, 1, NULL);
+            surgescript_var_set_objecthandle(tmp, colmgr->colliders[i]);
+            surgescript_object_call_function(other_collider, "__notify", p, 1, NULL);
         }
     }
 
+#if WANT_PERFORMANCE_REPORT
+    int n = darray_length(colmgr->colliders);
+    video_showmessage("Colliders: %d. Pair tests: %d (brute force: %d). Narrowphase: %d", n, colmgr->pair_tests, n * (n - 1) / 2, colmgr->narrowphase_tests);
+#endif
+
     darray_clear(colmgr->colliders);
-    surgescript_var_destroy(ret);
     surgescript_var_destroy(tmp);
+
+    PROFILER_END();
     return NULL;
 }
 
@@ -319,6 +583,12 @@ surgescript_var_t* fun_manager_constructor(surgescript_object_t* object, const s
 {
     collisionmanager_t* colmgr = mallocx(sizeof *colmgr);
     darray_init(colmgr->colliders);
+    darray_init(colmgr->packed);
+    darray_init(colmgr->sweep);
+    darray_init(colmgr->sweep_tmp);
+    darray_init(colmgr->pairs);
+    colmgr->pair_tests = 0;
+    colmgr->narrowphase_tests = 0;
     surgescript_object_set_userdata(object, colmgr);
     return NULL;
 }
@@ -327,6 +597,10 @@ surgescript_var_t* fun_manager_constructor(surgescript_object_t* object, const s
 surgescript_var_t* fun_manager_destructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
     collisionmanager_t* colmgr = surgescript_object_userdata(object);
+    darray_release(colmgr->pairs);
+    darray_release(colmgr->sweep_tmp);
+    darray_release(colmgr->sweep);
+    darray_release(colmgr->packed);
     darray_release(colmgr->colliders);
     free(colmgr);
     return NULL;
@@ -364,7 +638,7 @@ surgescript_var_t* fun_destructor(surgescript_object_t* object, const surgescrip
     collider_t* collider = unsafe_get_collider(object);
     darray_release(collider->curr_collisions);
     darray_release(collider->prev_collisions);
-    free(collider);
+    free_collider(collider);
     return NULL;
 }
 
@@ -506,6 +780,56 @@ surgescript_var_t* fun_notify(surgescript_object_t* object, const surgescript_va
     return NULL;
 }
 
+/* get the collision layer: an integer between 0 and 31 (inclusive) */
+surgescript_var_t* fun_getlayer(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    collider_t* collider = unsafe_get_collider(object);
+    return surgescript_var_set_number(surgescript_var_create(), collider->layer);
+}
+
+/* set the collision layer */
+surgescript_var_t* fun_setlayer(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    collider_t* collider = unsafe_get_collider(object);
+    int layer = (int)surgescript_var_get_number(param[0]);
+
+    if(layer >= 0 && layer < COLLIDER_MAX_LAYERS)
+        collider->layer = layer;
+    else
+        scripting_warning(object, "Invalid collision layer: %d", layer);
+
+    return NULL;
+}
+
+/* setLayerCollision(layer, enabled): enable or disable collisions with a layer. Returns this collider */
+surgescript_var_t* fun_setlayercollision(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    collider_t* collider = unsafe_get_collider(object);
+    int layer = (int)surgescript_var_get_number(param[0]);
+    bool enabled = surgescript_var_get_bool(param[1]);
+
+    if(layer >= 0 && layer < COLLIDER_MAX_LAYERS) {
+        if(enabled)
+            collider->mask |= UINT32_C(1) << layer;
+        else
+            collider->mask &= ~(UINT32_C(1) << layer);
+    }
+    else
+        scripting_warning(object, "Invalid collision layer: %d", layer);
+
+    return surgescript_var_set_objecthandle(surgescript_var_create(), surgescript_object_handle(object));
+}
+
+/* collidesWithLayer(layer): checks if collisions with a layer are enabled */
+surgescript_var_t* fun_collideswithlayer(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    collider_t* collider = unsafe_get_collider(object);
+    int layer = (int)surgescript_var_get_number(param[0]);
+    bool enabled = layer >= 0 && layer < COLLIDER_MAX_LAYERS && (collider->mask & (UINT32_C(1) << layer));
+
+    return surgescript_var_set_bool(surgescript_var_create(), enabled);
+}
+
 /* get center: Vector2 (world coordinates) */
 surgescript_var_t* fun_getcenter(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
@@ -589,7 +913,7 @@ surgescript_var_t* fun_setanchor(surgescript_object_t* object, const surgescript
 /* box constructor */
 surgescript_var_t* fun_collisionbox_constructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
-    collider_t* collider = mallocx(sizeof(boxcollider_t));
+    collider_t* collider = alloc_collider();
     surgescript_heap_t* heap = surgescript_object_heap(object);
     surgescript_objectmanager_t* manager = surgescript_object_manager(object);
     surgescript_objecthandle_t root = surgescript_objectmanager_root(manager);
@@ -603,6 +927,8 @@ surgescript_var_t* fun_collisionbox_constructor(surgescript_object_t* object, co
     collider->worldpos = v2d_new(0.0f, 0.0f); /* the center of the collider in world coordinates */
     collider->anchor = v2d_new(0.5f, 0.5f); /* default anchor: at the center of the collider */
     collider->flags = 0;
+    collider->layer = COLLIDER_DEFAULT_LAYER;
+    collider->mask = COLLIDER_DEFAULT_MASK;
     darray_init(collider->prev_collisions);
     darray_init(collider->curr_collisions);
     ((boxcollider_t*)collider)->width = 0.0;
@@ -677,6 +1003,7 @@ surgescript_var_t* fun_collisionbox_setanchor(surgescript_object_t* object, cons
     double x = surgescript_var_get_number(param[0]);
     double y = surgescript_var_get_number(param[1]);
     surgescript_transform_setposition2d(transform, (0.5 - x) * width, (0.5 - y) * height);
+    scripting_transform_changed();
     ((collider_t*)collider)->worldpos = scripting_util_world_position(object); /* update worldpos */
     ((collider_t*)collider)->anchor = v2d_new(x, y);
 
@@ -707,38 +1034,11 @@ surgescript_var_t* fun_collisionbox_collideswith(surgescript_object_t* object, c
 {
     surgescript_objectmanager_t* manager = surgescript_object_manager(object);
     surgescript_objecthandle_t other_collider = surgescript_var_get_objecthandle(param[0]);
-    boxcollider_t* collider = (boxcollider_t*)unsafe_get_collider(object);
-    double my_left = ((collider_t*)collider)->worldpos.x - collider->width / 2.0;
-    double my_right = ((collider_t*)collider)->worldpos.x + collider->width / 2.0;
-    double my_top = ((collider_t*)collider)->worldpos.y - collider->height / 2.0;
-    double my_bottom = ((collider_t*)collider)->worldpos.y + collider->height / 2.0;
     collider_t* other = safe_get_collider(surgescript_objectmanager_get(manager, other_collider));
+    packedcollider_t a = pack_collider(unsafe_get_collider(object));
+    packedcollider_t b = pack_collider(other);
 
-    switch(other->type) {
-        case COLLIDER_TYPE_BOX: {
-            double other_left = other->worldpos.x - ((boxcollider_t*)other)->width / 2.0;
-            double other_right = other->worldpos.x + ((boxcollider_t*)other)->width / 2.0;
-            double other_top = other->worldpos.y - ((boxcollider_t*)other)->height / 2.0;
-            double other_bottom = other->worldpos.y + ((boxcollider_t*)other)->height / 2.0;
-            return surgescript_var_set_bool(surgescript_var_create(),
-                my_left < other_right && my_right > other_left &&
-                my_top < other_bottom && my_bottom > other_top
-            );
-        }
-
-        case COLLIDER_TYPE_BALL: {
-            double cx = other->worldpos.x;
-            double cy = other->worldpos.y;
-            double r = ((ballcollider_t*)other)->radius;
-            double dx = cx - clip(cx, my_left, my_right);
-            double dy = cy - clip(cy, my_top, my_bottom);
-            return surgescript_var_set_bool(surgescript_var_create(),
-                dx * dx + dy * dy < r * r
-            );
-        }
-    }
-
-    return surgescript_var_set_bool(surgescript_var_create(), false);
+    return surgescript_var_set_bool(surgescript_var_create(), packed_collision_test(&a, &b));
 }
 
 /* set dimensions */
@@ -857,7 +1157,7 @@ surgescript_var_t* fun_collisionbox_zindex(surgescript_object_t* object, const s
 /* ball constructor */
 surgescript_var_t* fun_collisionball_constructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
-    collider_t* collider = mallocx(sizeof(ballcollider_t));
+    collider_t* collider = alloc_collider();
     surgescript_heap_t* heap = surgescript_object_heap(object);
     surgescript_objectmanager_t* manager = surgescript_object_manager(object);
     surgescript_objecthandle_t root = surgescript_objectmanager_root(manager);
@@ -871,6 +1171,8 @@ surgescript_var_t* fun_collisionball_constructor(surgescript_object_t* object, c
     collider->worldpos = v2d_new(0.0f, 0.0f); /* the center of the collider in world coordinates */
     collider->anchor = v2d_new(0.5f, 0.5f); /* default anchor: at the center of the collider */
     collider->flags = 0;
+    collider->layer = COLLIDER_DEFAULT_LAYER;
+    collider->mask = COLLIDER_DEFAULT_MASK;
     darray_init(collider->prev_collisions);
     darray_init(collider->curr_collisions);
     ((ballcollider_t*)collider)->radius = 0.0;
@@ -933,37 +1235,11 @@ surgescript_var_t* fun_collisionball_collideswith(surgescript_object_t* object,
 {
     surgescript_objectmanager_t* manager = surgescript_object_manager(object);
     surgescript_objecthandle_t other_collider = surgescript_var_get_objecthandle(param[0]);
-    ballcollider_t* collider = (ballcollider_t*)unsafe_get_collider(object);
-    v2d_t my_center = ((collider_t*)collider)->worldpos;
-    double my_radius = collider->radius;
     collider_t* other = safe_get_collider(surgescript_objectmanager_get(manager, other_collider));
+    packedcollider_t a = pack_collider(unsafe_get_collider(object));
+    packedcollider_t b = pack_collider(other);
 
-    switch(other->type) {
-        case COLLIDER_TYPE_BOX: {
-            double other_left = other->worldpos.x - ((boxcollider_t*)other)->width / 2.0;
-            double other_right = other->worldpos.x + ((boxcollider_t*)other)->width / 2.0;
-            double other_top = other->worldpos.y - ((boxcollider_t*)other)->height / 2.0;
-            double other_bottom = other->worldpos.y + ((boxcollider_t*)other)->height / 2.0;
-            double dx = my_center.x - clip(my_center.x, other_left, other_right);
-            double dy = my_center.y - clip(my_center.y, other_top, other_bottom);
-            return surgescript_var_set_bool(surgescript_var_create(),
-                dx * dx + dy * dy < my_radius * my_radius
-            );
-        }
-
-        case COLLIDER_TYPE_BALL: {
-            v2d_t other_center = other->worldpos;
-            double other_radius = ((ballcollider_t*)other)->radius;
-            double dx = my_center.x - other_center.x;
-            double dy = my_center.y - other_center.y;
-            double rr = my_radius + other_radius;
-            return surgescript_var_set_bool(surgescript_var_create(),
-                dx * dx + dy * dy < rr * rr
-            );
-        }
-    }
-
-    return surgescript_var_set_bool(surgescript_var_create(), false);
+    return surgescript_var_set_bool(surgescript_var_create(), packed_collision_test(&a, &b));
 }
 
 /* contains(): checks if world-position pos = (x, y) is inside the collider */
@@ -998,6 +1274,7 @@ surgescript_var_t* fun_collisionball_setanchor(surgescript_object_t* object, con
     double x = surgescript_var_get_number(param[0]);
     double y = surgescript_var_get_number(param[1]);
     surgescript_transform_setposition2d(transform, (0.5 - x) * size, (0.5 - y) * size);
+    scripting_transform_changed();
     ((collider_t*)collider)->worldpos = scripting_util_world_position(object); /* update worldpos */
     ((collider_t*)collider)->anchor = v2d_new(x, y);
 
@@ -19,6 +19,7 @@
  */
 
 #include <surgescript.h>
+#include "scripting.h"
 #include "../core/video.h"
 
 /* private */
@@ -26,6 +27,7 @@ static surgescript_var_t* fun_main(surgescript_object_t* object, const surgescri
 static surgescript_var_t* fun_print(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_write(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_readline(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_dumpcallprofile(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 
 /*
  * scripting_register_console()
@@ -37,6 +39,7 @@ void scripting_register_console(surgescript_vm_t* vm)
     surgescript_vm_bind(vm, "Console", "print", fun_print, 1);
     surgescript_vm_bind(vm, "Console", "write", fun_write, 1);
     surgescript_vm_bind(vm, "Console", "readline", fun_readline, 0);
+    surgescript_vm_bind(vm, "Console", "__dumpCallProfile", fun_dumpcallprofile, 0);
 }
 
 /* Console routines */
@@ -68,4 +71,11 @@ surgescript_var_t* fun_write(surgescript_object_t* object, const surgescript_var
 surgescript_var_t* fun_readline(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
     return NULL;
-}
\ No newline at end of file
+}
+
+/* writes the profile of the native calls to the log file (requires --ss-profile-calls) */
+surgescript_var_t* fun_dumpcallprofile(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    scripting_dump_call_profile();
+    return NULL;
+}
@@ -23,12 +23,17 @@
 #include "scripting.h"
 #include "../util/numeric.h"
 #include "../util/util.h"
+#include "../util/djb2.h"
+#include "../util/stringutil.h"
+#include "../util/fasthash.h"
+#include "../util/arena.h"
 #include "../core/video.h"
 #include "../core/image.h"
 #include "../core/sprite.h"
 #include "../core/animation.h"
 #include "../core/engine.h"
 #include "../core/global.h"
+#include "../core/jobs.h"
 #include "../entities/renderqueue.h"
 
 static surgescript_var_t* fun_main(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
@@ -55,6 +60,29 @@ static surgescript_var_t* fun_debug_isindebugmode(surgescript_object_t* object,
 static surgescript_var_t* fun_debug_enterdebugmode(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_debug_exitdebugmode(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_debug_getdebugmode(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+
+/* a notification broadcast to many entities: we resolve the target function
+   once per object class, not once per object */
+typedef struct entitynotification_t entitynotification_t;
+typedef struct notifiedclass_t notifiedclass_t;
+
+struct entitynotification_t
+{
+    char* fun_name; /* the function to be called */
+    fasthash_t* classes; /* object name -> notifiedclass_t */
+};
+
+struct notifiedclass_t
+{
+    char* name; /* object name */
+    bool is_entity; /* is the class tagged "entity"? */
+    bool has_function; /* does the class implement fun_name? */
+    notifiedclass_t* next; /* next class with the same hash */
+};
+
+static const notifiedclass_t* find_notified_class(entitynotification_t* notification, const surgescript_object_t* object);
+static void notifiedclass_dtor(void* ptr);
+
 static surgescript_heapptr_t LEVELOBJECTCONTAINER_ADDR = 0;
 static surgescript_heapptr_t DEBUGMODE_ADDR = 1; /* DebugEntityContainer only */
 static const char DEBUGMODE_OBJECT_NAME[] = "Debug Mode";
@@ -68,12 +96,24 @@ static bool render_subtree_faster(surgescript_object_t* object, void* data);
 static bool render_subtree(surgescript_object_t* object, void* data);
 static bool add_to_late_update_queue(surgescript_object_t* entity_or_component, void* data);
 static bool notify_entity(surgescript_object_t* entity_or_component, void* data);
+static bool broadcast_to_entity(surgescript_object_t* entity_or_component, void* data);
 static inline v2d_t entity_position(surgescript_object_t* entity);
 static inline bool is_entity_inside_roi(surgescript_object_t* entity_manager, surgescript_object_t* entity);
 static inline bool is_entity_inside_screen(surgescript_object_t* entity_manager, surgescript_object_t* entity);
+static inline bool is_low_priority_entity(surgescript_object_t* entity_manager, surgescript_object_t* entity);
 static bool is_entity_position_inside_screen(surgescript_object_t* entity_manager, surgescript_object_t* entity, v2d_t entity_position);
 static bool is_sprite_inside_screen(v2d_t camera_position, const char* sprite_name, v2d_t sprite_position, float sprite_rotation, v2d_t sprite_scale);
 
+/* parallel ROI tests */
+#define MIN_ROI_TESTS_PER_WORKER 256 /* don't bother with threads for small containers */
+typedef struct roitest_t roitest_t;
+struct roitest_t {
+    surgescript_object_t* entity_manager;
+    surgescript_object_t** entity; /* the entities of the container */
+    bool* inside; /* inside[i] is true if entity[i] is inside the region of interest */
+};
+static void test_roi_range(int begin, int end, void* context);
+
 
 /*
  * scripting_register_entitycontainer()
@@ -163,7 +203,7 @@ surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescri
 
     /* validate */
     const char* parent_name = surgescript_object_name(parent);
-    if(!(0 == strcmp(parent_name, "EntityTreeLeaf") || 0 == strcmp(parent_name, "EntityManager")))
+    if(!(0 == strcmp(parent_name, "EntityTree") || 0 == strcmp(parent_name, "EntityManager")))
         scripting_error(object, "%s must not be a child of %s", surgescript_object_name(object), parent_name);
 
     /* allocate a LevelContainerObject */
@@ -189,11 +229,34 @@ surgescript_var_t* fun_main(surgescript_object_t* object, const surgescript_var_
     surgescript_object_t* entity_manager = get_entity_manager(object);
     surgescript_var_t* arg = surgescript_var_create();
     void* data[] = { entity_manager, arg };
+    int count = 0;
 
-    /* for each entity */
+    /* gather the entities */
     iterator_t* it = levelobjectcontainer_iterator(object);
     while(iterator_has_next(it)) {
-        surgescript_object_t* entity = iterator_next(it);
+        iterator_next(it);
+        count++;
+    }
+    iterator_destroy(it);
+
+    roitest_t roitest = {
+        .entity_manager = entity_manager,
+        .entity = arena_alloc(engine_frame_arena(), count * sizeof(surgescript_object_t*)),
+        .inside = arena_alloc(engine_frame_arena(), count * sizeof(bool))
+    };
+
+    it = levelobjectcontainer_iterator(object);
+    for(int i = 0; i < count && iterator_has_next(it); i++)
+        roitest.entity[i] = iterator_next(it);
+    iterator_destroy(it);
+
+    /* test the entities against the region of interest. These tests only
+       read the transforms, so we run them in parallel before touching the VM */
+    jobs_parallel_for(count, MIN_ROI_TESTS_PER_WORKER, test_roi_range, &roitest);
+
+    /* for each entity */
+    for(int i = 0; i < count; i++) {
+        surgescript_object_t* entity = roitest.entity[i];
         surgescript_objecthandle_t entity_handle = surgescript_object_handle(entity);
 
         /* skip deleted entities */
@@ -203,14 +266,23 @@ surgescript_var_t* fun_main(surgescript_object_t* object, const surgescript_var_
         }
 
         /* is the entity inside the region of interest? */
-        if(is_entity_inside_roi(entity_manager, entity)) {
-
-            /* the entity is active */
-            surgescript_object_set_active(entity, true);
+        if(roitest.inside[i]) {
 
             /* the entity is not sleeping */
             entitymanager_set_entity_sleeping(entity_manager, entity_handle, false);
 
+            /* if we're over the time budget, the update of a
+               low-priority entity may be deferred to a later frame */
+            if(
+                entitymanager_is_throttling_updates(entity_manager) &&
+                is_low_priority_entity(entity_manager, entity) &&
+                entitymanager_defer_entity_update(entity_manager, entity)
+            )
+                continue;
+
+            /* the entity is active */
+            surgescript_object_set_active(entity, true);
+
             /* does this entity or its descendants implement lateUpdate() ? */
             surgescript_object_traverse_tree_ex(entity, data, add_to_late_update_queue);
 
@@ -231,6 +303,7 @@ surgescript_var_t* fun_main(surgescript_object_t* object, const surgescript_var_
                     /* move it back to its spawn point */
                     surgescript_transform_t* transform = surgescript_object_transform(entity);
                     surgescript_transform_setposition2d(transform, spawn_point.x, spawn_point.y);
+                    scripting_transform_changed();
 
                     /* notify the entity and its descendants */
                     surgescript_object_traverse_tree_ex(entity, "onReset", notify_entity);
@@ -254,7 +327,6 @@ surgescript_var_t* fun_main(surgescript_object_t* object, const surgescript_var_
 
         }
     }
-    iterator_destroy(it);
 
     /* done */
     surgescript_var_destroy(arg);
@@ -460,14 +532,12 @@ surgescript_var_t* fun_removeentity(surgescript_object_t* object, const surgescr
     return NULL;
 }
 
-/* call sector.bubbleUp(entity) for each entity stored in this container, where sector = parent */
+/* bubble up each entity stored in this container, where the EntityTree = parent */
 surgescript_var_t* fun_bubbleupentities(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
     surgescript_objectmanager_t* manager = surgescript_object_manager(object);
-    surgescript_objecthandle_t sector_handle = surgescript_object_parent(object);
-    surgescript_object_t* sector = surgescript_objectmanager_get(manager, sector_handle);
-    surgescript_var_t* arg = surgescript_var_create();
-    const surgescript_var_t* args[] = { arg };
+    surgescript_objecthandle_t entity_tree_handle = surgescript_object_parent(object);
+    surgescript_object_t* entity_tree = surgescript_objectmanager_get(manager, entity_tree_handle);
 
     /* for each entity */
     iterator_t* it = levelobjectcontainer_iterator(object);
@@ -479,14 +549,12 @@ surgescript_var_t* fun_bubbleupentities(surgescript_object_t* object, const surg
         if(surgescript_object_is_killed(entity))
             continue;
 
-        /* call sector.bubbleUp(entity) */
-        surgescript_var_set_objecthandle(arg, entity_handle);
-        surgescript_object_call_function(sector, "bubbleUp", args, 1, NULL);
+        /* move the entity to its proper leaf sector */
+        entitytree_bubble_up(entity_tree, object, entity_handle);
     }
     iterator_destroy(it);
 
     /* done */
-    surgescript_var_destroy(arg);
     return NULL;
 }
 
@@ -534,18 +602,13 @@ surgescript_var_t* fun_selectactiveentities(surgescript_object_t* object, const
 surgescript_var_t* fun_notifyentities(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
     const char* fun_name = surgescript_var_fast_get_string(param[0]);
+    entitynotification_t* notification = entitynotification_create(fun_name);
 
-    /* for each entity */
-    iterator_t* it = levelobjectcontainer_iterator(object);
-    while(iterator_has_next(it)) {
-        surgescript_object_t* entity = iterator_next(it);
-
-        /* notify the entity and its descendants */
-        surgescript_object_traverse_tree_ex(entity, (void*)fun_name, notify_entity);
-    }
-    iterator_destroy(it);
+    /* notify the entities */
+    entitycontainer_notify_entities(object, notification);
 
     /* done */
+    entitynotification_destroy(notification);
     return NULL;
 }
 
@@ -804,6 +867,47 @@ surgescript_var_t* fun_debug_getdebugmode(surgescript_object_t* object, const su
 
 
 
+/*
+ * C API
+ */
+
+/* create a notification: the given function will be called on the entities */
+entitynotification_t* entitynotification_create(const char* fun_name)
+{
+    entitynotification_t* notification = mallocx(sizeof *notification);
+
+    notification->fun_name = str_dup(fun_name);
+    notification->classes = fasthash_create(notifiedclass_dtor, 6);
+
+    return notification;
+}
+
+/* destroy a notification */
+entitynotification_t* entitynotification_destroy(entitynotification_t* notification)
+{
+    fasthash_destroy(notification->classes);
+    free(notification->fun_name);
+    free(notification);
+
+    return NULL;
+}
+
+/* notify the entities stored in a container, as well as their descendants */
+void entitycontainer_notify_entities(surgescript_object_t* entity_container, entitynotification_t* notification)
+{
+    /* for each entity */
+    iterator_t* it = levelobjectcontainer_iterator(entity_container);
+    while(iterator_has_next(it)) {
+        surgescript_object_t* entity = iterator_next(it);
+
+        /* notify the entity and its descendants */
+        surgescript_object_traverse_tree_ex(entity, notification, broadcast_to_entity);
+    }
+    iterator_destroy(it);
+}
+
+
+
 /*
  * helpers
  */
@@ -907,6 +1011,66 @@ bool add_to_late_update_queue(surgescript_object_t* entity_or_component, void* d
     return true;
 }
 
+bool broadcast_to_entity(surgescript_object_t* entity_or_component, void* data)
+{
+    entitynotification_t* notification = (entitynotification_t*)data;
+    const notifiedclass_t* class_info = find_notified_class(notification, entity_or_component);
+
+    /* skip if not entity */
+    if(!class_info->is_entity)
+        return false; /* save processing time; entities that are descendants of non-entities will be skipped */
+
+    /* notify the entity if there is such a function */
+    if(class_info->has_function)
+        surgescript_object_call_function(entity_or_component, notification->fun_name, NULL, 0, NULL);
+
+    /* continue iteration */
+    return true;
+}
+
+const notifiedclass_t* find_notified_class(entitynotification_t* notification, const surgescript_object_t* object)
+{
+    const char* object_name = surgescript_object_name(object);
+    uint64_t key = djb2(object_name);
+    notifiedclass_t* head = fasthash_get(notification->classes, key);
+
+    /* have we seen this class already? */
+    for(notifiedclass_t* class_info = head; class_info != NULL; class_info = class_info->next) {
+        if(0 == strcmp(class_info->name, object_name))
+            return class_info;
+    }
+
+    /* resolve the target function for this class */
+    notifiedclass_t* class_info = mallocx(sizeof *class_info);
+    class_info->name = str_dup(object_name);
+    class_info->is_entity = surgescript_object_has_tag(object, "entity");
+    class_info->has_function = surgescript_object_has_function(object, notification->fun_name);
+    class_info->next = NULL;
+
+    if(head != NULL) {
+        class_info->next = head->next;
+        head->next = class_info;
+    }
+    else
+        fasthash_put(notification->classes, key, class_info);
+
+    return class_info;
+}
+
+void notifiedclass_dtor(void* ptr)
+{
+    notifiedclass_t* class_info = (notifiedclass_t*)ptr;
+
+    while(class_info != NULL) {
+        notifiedclass_t* next = class_info->next;
+
+        free(class_info->name);
+        free(class_info);
+
+        class_info = next;
+    }
+}
+
 bool notify_entity(surgescript_object_t* entity_or_component, void* data)
 {
     const char* fun_name = (const char*)data;
@@ -941,11 +1105,28 @@ bool is_entity_inside_roi(surgescript_object_t* entity_manager, surgescript_obje
     return entitymanager_is_inside_roi(entity_manager, entity_position(entity));
 }
 
+/* tests entity[begin .. end-1] of a roitest_t against the region of interest */
+void test_roi_range(int begin, int end, void* context)
+{
+    roitest_t* roitest = (roitest_t*)context;
+
+    for(int i = begin; i < end; i++)
+        roitest->inside[i] = is_entity_inside_roi(roitest->entity_manager, roitest->entity[i]);
+}
+
 bool is_entity_inside_screen(surgescript_object_t* entity_manager, surgescript_object_t* entity)
 {
     return is_entity_position_inside_screen(entity_manager, entity, entity_position(entity));
 }
 
+/* the update of a low-priority entity may be deferred if we're over the time
+   budget. Entities tagged "lowpriority" and entities that are outside the
+   screen (i.e., not so close to the player) have low priority */
+bool is_low_priority_entity(surgescript_object_t* entity_manager, surgescript_object_t* entity)
+{
+    return surgescript_object_has_tag(entity, "lowpriority") || !is_entity_inside_screen(entity_manager, entity);
+}
+
 bool is_entity_position_inside_screen(surgescript_object_t* entity_manager, surgescript_object_t* entity, v2d_t entity_position)
 {
     /* guess the position of the camera */
@@ -1022,24 +1203,13 @@ bool is_sprite_inside_screen(v2d_t camera_position, const char* sprite_name, v2d
         };
         v2d_rotate_all(rotated_sprite_corner, 4, radians);
 
-        v2d_t min01 = v2d_new(
-            min(rotated_sprite_corner[0].x, rotated_sprite_corner[1].x),
-            min(rotated_sprite_corner[0].y, rotated_sprite_corner[1].y)
-        ), min23 = v2d_new(
-            min(rotated_sprite_corner[2].x, rotated_sprite_corner[3].x),
-            min(rotated_sprite_corner[2].y, rotated_sprite_corner[3].y)
-        ), max01 = v2d_new(
-            min(rotated_sprite_corner[0].x, rotated_sprite_corner[1].x),
-            min(rotated_sprite_corner[0].y, rotated_sprite_corner[1].y)
-        ), max23 = v2d_new(
-            max(rotated_sprite_corner[2].x, rotated_sprite_corner[3].x),
-            max(rotated_sprite_corner[2].y, rotated_sprite_corner[3].y)
-        );
-
-        sprite_top = min(min01.y, min23.y);
-        sprite_left = min(min01.x, min23.x);
-        sprite_bottom = max(max01.y, max23.y);
-        sprite_right = max(max01.x, max23.x);
+        v2d_t bounds_min, bounds_max;
+        v2d_bounds(rotated_sprite_corner, 4, &bounds_min, &bounds_max);
+
+        sprite_top = bounds_min.y;
+        sprite_left = bounds_min.x;
+        sprite_bottom = bounds_max.y;
+        sprite_right = bounds_max.x;
 
     }
 
@@ -41,6 +41,7 @@
 #include "../util/fasthash.h"
 
 #include <surgescript.h>
+#include <stdlib.h>
 #include <string.h>
 #include "scripting.h"
 #include "../core/logfile.h"
@@ -50,6 +51,7 @@
 #include "../util/util.h"
 #include "../util/stringutil.h"
 #include "../util/iterator.h"
+#include "../util/djb2.h"
 #include "../scenes/level.h"
 
 typedef struct entityinfo_t entityinfo_t;
@@ -57,8 +59,25 @@ struct entityinfo_t {
     surgescript_objecthandle_t handle; /* hash key: SurgeScript object */
     uint64_t id; /* uniquely identifies the entity in the Level */
     v2d_t spawn_point; /* spawn point */
-    bool is_persistent; /* usually placed via level editor; will be saved in the .lev file */
+    int persistent_slot; /* index in the packed array of persistent entities, or -1 if the entity isn't persistent */
     bool is_sleeping; /* sleeping / inactive? */
+    uint32_t serial; /* distinguishes entities that reuse the same handle */
+    uint32_t late_update_generation; /* was the entity added to the late update queue in this generation? */
+    entityinfo_t* next_free; /* next free entry of the pool */
+};
+
+typedef struct entityref_t entityref_t;
+struct entityref_t {
+    surgescript_objecthandle_t handle;
+    uint32_t serial; /* the serial number of the entity info at spawn time */
+};
+
+typedef struct entityname_t entityname_t;
+struct entityname_t {
+    char* name; /* hash key: object name */
+    DARRAY(entityref_t, entity); /* in spawn order; may contain stale entries */
+    int live_count; /* number of live entities at the last compaction */
+    entityname_t* next; /* next entry with the same hash */
 };
 
 typedef struct entitydb_t entitydb_t;
@@ -71,11 +90,45 @@ struct entitydb_t {
 
     /* entity info */
     fasthash_t* info;
-    fasthash_t* id_to_handle;
+    fasthash_t* id_to_info;
     entityinfo_t* cached_query;
 
-    /* late update queue */
-    DARRAY(surgescript_objecthandle_t, late_update_queue);
+    /* entity info is stored in blocks that are never moved nor released
+       until the EntityManager is destroyed; free entries are reused */
+    DARRAY(entityinfo_t*, info_block);
+    entityinfo_t* free_info;
+    uint32_t next_serial;
+
+    /* entities spawned with spawnEntity(), indexed by name */
+    fasthash_t* name_index;
+
+    /* persistent entities (usually placed via level editor; they will be saved
+       in the .lev file), packed so that they can be scanned linearly */
+    DARRAY(entityinfo_t*, persistent);
+
+    /* late update queue (double-buffered) */
+    DARRAY(surgescript_objecthandle_t, late_update_queue); /* filled during the update cycle */
+    DARRAY(surgescript_objecthandle_t, late_update_batch); /* processed in lateUpdate() */
+    uint32_t late_update_generation; /* incremented on each frame; never zero */
+    int late_update_requests; /* number of additions to the queue, duplicates included */
+    struct {
+        int length; /* number of entities processed in the last lateUpdate() */
+        int requests; /* number of additions to the queue in the last frame */
+    } late_update_stats;
+
+    /* update scheduler: when the update of the entities exceeds its time
+       budget, low-priority entities are updated at a reduced frequency */
+    struct {
+        int period; /* low-priority entities are updated once every period frames */
+        int frames_under_budget; /* consecutive frames with some slack */
+        uint32_t frame; /* frame counter */
+        DARRAY(surgescript_objecthandle_t, deferred); /* entities deferred in the current frame */
+        struct {
+            int deferred; /* number of updates deferred in the last frame */
+            int64_t total_deferred; /* number of updates deferred since the creation of the EntityManager */
+            double update_time; /* time spent updating the entities in the last frame, in seconds */
+        } stats;
+    } scheduler;
 
     /* brick-like objects */
     DARRAY(surgescript_objecthandle_t, bricklike_objects);
@@ -86,11 +139,18 @@ struct entitydb_t {
 };
 
 static entityinfo_t NULL_ENTRY = { .handle = 0, .id = 0 };
-static entityinfo_t* entityinfo_ctor(entityinfo_t info) { return (entityinfo_t*)memcpy(mallocx(sizeof(info)), &info, sizeof(info)); }
-static void entityinfo_dtor(void* entry) { free(entry); }
-
-static surgescript_objecthandle_t* handle_ctor(surgescript_objecthandle_t handle) { return (surgescript_objecthandle_t*)memcpy(mallocx(sizeof(handle)), &handle, sizeof(handle)); }
-static void handle_dtor(void* handle) { free(handle); }
+static entityinfo_t* entityinfo_alloc(entitydb_t* db, entityinfo_t info);
+static void entityinfo_reserve(entitydb_t* db, int count);
+static void entityinfo_free(entitydb_t* db, entityinfo_t* info);
+static void entityinfo_set_persistent(entitydb_t* db, entityinfo_t* info, bool is_persistent);
+static int compare_serials(const void* a, const void* b);
+#define INFO_BLOCK_SIZE 1024 /* number of entries of each block of entity info */
+#define UPDATE_TIME_BUDGET 0.008 /* time budget of the update of the entities, in seconds */
+#define MAX_UPDATE_PERIOD 8 /* low-priority entities are updated at least once every MAX_UPDATE_PERIOD frames */
+#define FRAMES_TO_SPEED_UP 30 /* increase the frequency of the updates after this many frames under the budget */
+
+static entityname_t* entityname_ctor(const char* name);
+static void entityname_dtor(void* entry);
 
 /* C API; make sure you call these with an actual EntityManager object (it won't be checked) */
 bool entitymanager_has_entity_info(surgescript_object_t* entity_manager, surgescript_objecthandle_t entity_handle);
@@ -101,10 +161,16 @@ void entitymanager_set_entity_id(surgescript_object_t* entity_manager, surgescri
 v2d_t entitymanager_get_entity_spawn_point(surgescript_object_t* entity_manager, surgescript_objecthandle_t entity_handle);
 bool entitymanager_is_entity_persistent(surgescript_object_t* entity_manager, surgescript_objecthandle_t entity_handle);
 void entitymanager_set_entity_persistent(surgescript_object_t* entity_manager, surgescript_objecthandle_t entity_handle, bool is_persistent);
+void entitymanager_foreach_persistent_entity(surgescript_object_t* entity_manager, void* data, void (*callback)(surgescript_object_t*,uint64_t,v2d_t,void*));
 bool entitymanager_is_entity_sleeping(surgescript_object_t* entity_manager, surgescript_objecthandle_t entity_handle);
 void entitymanager_set_entity_sleeping(surgescript_object_t* entity_manager, surgescript_objecthandle_t entity_handle, bool is_sleeping);
 bool entitymanager_is_inside_roi(surgescript_object_t* entity_manager, v2d_t position);
 void entitymanager_get_roi(surgescript_object_t* entity_manager, int* top, int* left, int* bottom, int* right);
+void entitymanager_late_update_stats(surgescript_object_t* entity_manager, int* length, int* requests);
+bool entitymanager_is_throttling_updates(surgescript_object_t* entity_manager);
+bool entitymanager_defer_entity_update(surgescript_object_t* entity_manager, surgescript_object_t* entity);
+void entitymanager_end_update(surgescript_object_t* entity_manager, double update_time);
+void entitymanager_scheduler_stats(surgescript_object_t* entity_manager, int* period, int* deferred, int64_t* total_deferred, double* update_time);
 arrayiterator_t* entitymanager_bricklike_iterator(surgescript_object_t* entity_manager);
 ssarrayiterator_t* entitymanager_activeentities_iterator(surgescript_object_t* entity_manager);
 
@@ -117,6 +183,7 @@ static surgescript_var_t* fun_destructor(surgescript_object_t* object, const sur
 static surgescript_var_t* fun_destroy(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_spawn(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_spawnentity(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_spawnentities(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_entity(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_entityid(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_findentity(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
@@ -148,12 +215,21 @@ static const surgescript_heapptr_t NOTGARBAGECONTAINER_ADDR = 5;
 static inline entityinfo_t* quick_lookup(surgescript_object_t* entity_manager, surgescript_objecthandle_t entity_handle);
 static void foreach_unawake_container_inside_roi(surgescript_object_t* entity_manager, const char* fun_name, const surgescript_var_t** param, int num_params);
 static void foreach_unawake_container(surgescript_object_t* entity_manager, const char* fun_name, const surgescript_var_t** param, int num_params);
-static void foreach_unawake_container_callback(surgescript_objecthandle_t container_handle, void* data);
 static void pause_containers(surgescript_object_t* entity_manager, bool pause);
 static bool is_in_debug_mode(surgescript_object_t* entity_manager);
 static void refresh_entity_tree(surgescript_object_t* entity_manager);
 static bool inspect_subtree(const surgescript_object_t* root, bool is_root_entity, const surgescript_objectmanager_t* manager, surgescript_tagsystem_t* tag_system, int depth);
 static void prevent_garbage_collection(surgescript_object_t* entity_manager, surgescript_objecthandle_t entity_handle);
+static int compare_handles(const void* a, const void* b);
+static entityname_t* find_entity_name(entitydb_t* db, const char* entity_name, bool create);
+static void index_entity_name(surgescript_object_t* entity_manager, const char* entity_name, const entityinfo_t* info);
+static void prune_entity_name(surgescript_object_t* entity_manager, entityname_t* entry);
+static inline bool is_entity_alive(surgescript_object_t* entity_manager, entityref_t ref);
+static bool validate_entity_name(surgescript_object_t* entity_manager, const char* entity_name);
+static surgescript_objecthandle_t create_entity(surgescript_object_t* entity_manager, const char* entity_name, v2d_t spawn_point);
+static void store_entity(surgescript_object_t* entity_container, surgescript_objecthandle_t entity_handle);
+static int array_length(surgescript_object_t* array);
+static void array_get(surgescript_object_t* array, int index, surgescript_var_t* out);
 
 
 
@@ -176,6 +252,7 @@ void scripting_register_entitymanager(surgescript_vm_t* vm)
 
     surgescript_vm_bind(vm, "EntityManager", "spawn", fun_spawn, 1);
     surgescript_vm_bind(vm, "EntityManager", "spawnEntity", fun_spawnentity, 2);
+    surgescript_vm_bind(vm, "EntityManager", "spawnEntities", fun_spawnentities, 2);
     surgescript_vm_bind(vm, "EntityManager", "entity", fun_entity, 1);
     surgescript_vm_bind(vm, "EntityManager", "entityId", fun_entityid, 1);
     surgescript_vm_bind(vm, "EntityManager", "findEntity", fun_findentity, 1);
@@ -204,10 +281,19 @@ surgescript_var_t* fun_main(surgescript_object_t* object, const surgescript_var_
 
     /* clear the late update queue */
     darray_clear(db->late_update_queue);
+    db->late_update_requests = 0;
+
+    /* start a new generation */
+    if(++db->late_update_generation == 0)
+        db->late_update_generation = 1;
 
     /* clear the brick-like object list */
     darray_clear(db->bricklike_objects);
 
+    /* start a new frame of the update scheduler */
+    darray_clear(db->scheduler.deferred);
+    db->scheduler.frame++;
+
     /* FIXME: maybe we should update the awake & detached entities AFTER unawake ones?
        e.g., camera scripts. */
 
@@ -232,14 +318,34 @@ surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescri
     entitydb_t* db = mallocx(sizeof *db);
 
     int lg2_cap = 15;
-    db->info = fasthash_create(entityinfo_dtor, lg2_cap);
-    db->id_to_handle = fasthash_create(handle_dtor, lg2_cap);
+    db->info = fasthash_create(NULL, lg2_cap); /* entries are owned by the pool */
+    db->id_to_info = fasthash_create(NULL, lg2_cap);
     db->cached_query = &NULL_ENTRY;
 
+    darray_init(db->info_block);
+    db->free_info = NULL;
+    db->next_serial = 0;
+
+    db->name_index = fasthash_create(entityname_dtor, 10);
+    darray_init(db->persistent);
+
     darray_init(db->late_update_queue);
+    darray_init(db->late_update_batch);
+    db->late_update_generation = 1;
+    db->late_update_requests = 0;
+    db->late_update_stats.length = 0;
+    db->late_update_stats.requests = 0;
     darray_init(db->bricklike_objects);
     db->dirty_partition = false;
 
+    db->scheduler.period = 1;
+    db->scheduler.frames_under_budget = 0;
+    db->scheduler.frame = 0;
+    darray_init(db->scheduler.deferred);
+    db->scheduler.stats.deferred = 0;
+    db->scheduler.stats.total_deferred = 0;
+    db->scheduler.stats.update_time = 0.0;
+
     db->roi.left = 0;
     db->roi.top = 0;
     db->roi.right = 0;
@@ -293,12 +399,20 @@ surgescript_var_t* fun_destructor(surgescript_object_t* object, const surgescrip
     /* release the database */
     entitydb_t* db = get_db(object);
 
+    darray_release(db->scheduler.deferred);
     darray_release(db->bricklike_objects);
+    darray_release(db->late_update_batch);
     darray_release(db->late_update_queue);
 
-    fasthash_destroy(db->id_to_handle);
+    darray_release(db->persistent);
+    fasthash_destroy(db->name_index);
+    fasthash_destroy(db->id_to_info);
     fasthash_destroy(db->info);
 
+    for(int i = 0; i < darray_length(db->info_block); i++)
+        free(db->info_block[i]);
+    darray_release(db->info_block);
+
     free(db);
 
     /* done! */
@@ -348,70 +462,22 @@ surgescript_var_t* fun_spawnentity(surgescript_object_t* object, const surgescri
 {
     surgescript_heap_t* heap = surgescript_object_heap(object);
     surgescript_objectmanager_t* manager = surgescript_object_manager(object);
+    surgescript_tagsystem_t* tag_system = surgescript_objectmanager_tagsystem(manager);
     const char* entity_name = surgescript_var_fast_get_string(param[0]);
     surgescript_objecthandle_t position_handle = surgescript_var_get_objecthandle(param[1]);
 
-    /* validate: does the object exist? */
-    if(!surgescript_objectmanager_class_exists(manager, entity_name)) {
-        scripting_error(object, "Can't spawn entity: object \"%s\" doesn't exist!", entity_name);
-        return NULL;
-    }
-
-    /* validate: accept only entities */
-    surgescript_tagsystem_t* tag_system = surgescript_objectmanager_tagsystem(manager);
-    if(!surgescript_tagsystem_has_tag(tag_system, entity_name, "entity")) {
-        scripting_error(object, "Can't spawn entity: object \"%s\" isn't tagged \"entity\"!", entity_name);
+    /* validate the entity name */
+    if(!validate_entity_name(object, entity_name))
         return NULL;
-    }
-
-    /* sanity check */
-    if(
-        surgescript_tagsystem_has_tag(tag_system, entity_name, "detached") &&
-        !surgescript_tagsystem_has_tag(tag_system, entity_name, "private")
-    ) {
-        video_showmessage("Entity \"%s\" is tagged \"detached\", but not \"private\"", entity_name);
-        surgescript_tagsystem_add_tag(tag_system, entity_name, "private");
-    }
-
-    /* get the Level object */
-    surgescript_objecthandle_t level_handle = surgescript_object_parent(object);
-    surgescript_object_t* level = surgescript_objectmanager_get(manager, level_handle);
-
-    /* spawn the entity */
-    surgescript_objecthandle_t entity_parent = level_handle;
-    surgescript_objecthandle_t entity_handle = surgescript_objectmanager_spawn(manager, entity_parent, entity_name, NULL);
-    surgescript_object_t* entity = surgescript_objectmanager_get(manager, entity_handle);
 
     /* read the spawn point */
     double spawn_x = 0.0, spawn_y = 0.0;
     surgescript_object_t* position = surgescript_objectmanager_get(manager, position_handle);
     scripting_vector2_read(position, &spawn_x, &spawn_y);
-    v2d_t spawn_point = v2d_new(spawn_x, spawn_y);
-
-    /* position the entity */
-    surgescript_transform_t* transform = surgescript_object_transform(entity);
-    surgescript_transform_setposition2d(transform, spawn_x, spawn_y); /* already in world space */
-
-    /* generate entity info */
-    entityinfo_t* info = entityinfo_ctor((entityinfo_t) {
-        .handle = entity_handle,
-        .id = generate_entity_id(),
-        .spawn_point = spawn_point,
-        .is_sleeping = !(
-            surgescript_object_has_tag(entity, "awake") ||
-            surgescript_object_has_tag(entity, "detached")
-        ),
-        .is_persistent = !(
-            surgescript_object_has_tag(entity, "private") ||
-            /*surgescript_object_has_tag(entity, "detached") ||*/ /* if it's detached, it's private - see above */
-            scripting_level_issetupobjectname(level, entity_name)
-        )
-    });
 
-    /* store entity info */
-    entitydb_t* db = get_db(object);
-    fasthash_put(db->info, info->handle, info);
-    fasthash_put(db->id_to_handle, info->id, handle_ctor(info->handle));
+    /* spawn the entity */
+    surgescript_objecthandle_t entity_handle = create_entity(object, entity_name, v2d_new(spawn_x, spawn_y));
+    surgescript_object_t* entity = surgescript_objectmanager_get(manager, entity_handle);
 
     /* decide the entity container: is the new entity awake or not? */
     bool is_awake = (
@@ -431,40 +497,21 @@ surgescript_var_t* fun_spawnentity(surgescript_object_t* object, const surgescri
         surgescript_var_t* entity_tree_var = surgescript_heap_at(heap, ENTITYTREE_ADDR);
         surgescript_objecthandle_t entity_tree_handle = surgescript_var_get_objecthandle(entity_tree_var);
         surgescript_object_t* entity_tree = surgescript_objectmanager_get(manager, entity_tree_handle);
-        surgescript_var_t* entity_var = surgescript_var_create();
-        const surgescript_var_t* args[] = { entity_var };
 
-        /* call entityTree.bubbleDown(entity) */
-        surgescript_var_set_objecthandle(entity_var, entity_handle);
-        surgescript_object_call_function(entity_tree, "bubbleDown", args, 1, NULL);
-
-        surgescript_var_destroy(entity_var);
+        /* bubble down the entity */
+        entitytree_bubble_down(entity_tree, entity_handle);
 
         /* new subsectors may have been allocated;
            mark the space partition as dirty */
-        db->dirty_partition = true;
+        get_db(object)->dirty_partition = true;
     }
     else {
         /* store the entity in the awake container */
-        surgescript_var_t* arg = surgescript_var_create();
-        const surgescript_var_t* args[] = { arg };
-
-        /* call entityContainer.storeEntity(entity) */
-        surgescript_var_set_objecthandle(arg, entity_handle);
-        surgescript_object_call_function(entity_container, "storeEntity", args, 1, NULL);
-
-        surgescript_var_destroy(arg);
+        store_entity(entity_container, entity_handle);
     }
 #else
     /* store the entity in the selected entity container */
-    surgescript_var_t* arg = surgescript_var_create();
-    const surgescript_var_t* args[] = { arg };
-
-    /* call entityContainer.storeEntity(entity) */
-    surgescript_var_set_objecthandle(arg, entity_handle);
-    surgescript_object_call_function(entity_container, "storeEntity", args, 1, NULL);
-
-    surgescript_var_destroy(arg);
+    store_entity(entity_container, entity_handle);
 #endif
 
     /* prevent garbage collection */
@@ -477,6 +524,139 @@ surgescript_var_t* fun_spawnentity(surgescript_object_t* object, const surgescri
     return surgescript_var_set_objecthandle(surgescript_var_create(), entity_handle);
 }
 
+/* spawn many entities at once, given an array of names and an array of positions
+   in world space. Returns an array with the spawned entities. The entities that
+   are not awake will only be activated in the next frame */
+surgescript_var_t* fun_spawnentities(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
+    surgescript_tagsystem_t* tag_system = surgescript_objectmanager_tagsystem(manager);
+    surgescript_objecthandle_t names_handle = surgescript_var_get_objecthandle(param[0]);
+    surgescript_objecthandle_t positions_handle = surgescript_var_get_objecthandle(param[1]);
+    entitydb_t* db = get_db(object);
+
+    /* spawn the output array */
+    surgescript_objecthandle_t array_handle = surgescript_objectmanager_spawn_array(manager);
+    surgescript_object_t* array = surgescript_objectmanager_get(manager, array_handle);
+    surgescript_var_t* ret = surgescript_var_set_objecthandle(surgescript_var_create(), array_handle);
+
+    /* validate the input */
+    if(!surgescript_objectmanager_exists(manager, names_handle) || !surgescript_objectmanager_exists(manager, positions_handle)) {
+        scripting_error(object, "Can't spawn entities: expected two arrays");
+        return ret;
+    }
+
+    surgescript_object_t* names = surgescript_objectmanager_get(manager, names_handle);
+    surgescript_object_t* positions = surgescript_objectmanager_get(manager, positions_handle);
+    if(strcmp(surgescript_object_name(names), "Array") != 0 || strcmp(surgescript_object_name(positions), "Array") != 0) {
+        scripting_error(object, "Can't spawn entities: expected two arrays");
+        return ret;
+    }
+
+    int count = min(array_length(names), array_length(positions));
+    if(count == 0)
+        return ret;
+
+    /* allocate all entity info at once */
+    entityinfo_reserve(db, count);
+
+    /* spawn the entities. The unawake ones will be stored in bulk */
+    DARRAY(surgescript_objecthandle_t, spawned);
+    DARRAY(surgescript_objecthandle_t, unawake);
+    darray_init_ex(spawned, count);
+    darray_init_ex(unawake, count);
+
+    surgescript_var_t* element = surgescript_var_create();
+    const surgescript_var_t* args[] = { element };
+    surgescript_object_t* awake_container = surgescript_objectmanager_get(manager,
+        surgescript_var_get_objecthandle(surgescript_heap_at(heap, AWAKEENTITYCONTAINER_ADDR))
+    );
+
+    for(int i = 0; i < count; i++) {
+        /* read the position */
+        double spawn_x = 0.0, spawn_y = 0.0;
+        array_get(positions, i, element);
+        surgescript_objecthandle_t position_handle = surgescript_var_get_objecthandle(element);
+        if(surgescript_objectmanager_exists(manager, position_handle)) {
+            surgescript_object_t* position = surgescript_objectmanager_get(manager, position_handle);
+            scripting_vector2_read(position, &spawn_x, &spawn_y);
+        }
+
+        /* read and validate the name */
+        array_get(names, i, element);
+        char* entity_name = surgescript_var_get_string(element, manager);
+        if(!validate_entity_name(object, entity_name)) {
+            ssfree(entity_name);
+            continue;
+        }
+
+        /* spawn the entity */
+        surgescript_objecthandle_t entity_handle = create_entity(object, entity_name, v2d_new(spawn_x, spawn_y));
+        darray_push(spawned, entity_handle);
+
+        /* store it in the awake container, or defer its storage */
+        if(
+            surgescript_tagsystem_has_tag(tag_system, entity_name, "awake") ||
+            surgescript_tagsystem_has_tag(tag_system, entity_name, "detached")
+        )
+            store_entity(awake_container, entity_handle);
+        else
+            darray_push(unawake, entity_handle);
+
+        ssfree(entity_name);
+    }
+
+    /* store the unawake entities */
+#if WANT_SPACE_PARTITIONING
+    if(darray_length(unawake) > 0) {
+        surgescript_var_t* entity_tree_var = surgescript_heap_at(heap, ENTITYTREE_ADDR);
+        surgescript_objecthandle_t entity_tree_handle = surgescript_var_get_objecthandle(entity_tree_var);
+        surgescript_object_t* entity_tree = surgescript_objectmanager_get(manager, entity_tree_handle);
+
+        /* bubble down all entities in a single pass */
+        entitytree_bubble_down_batch(entity_tree, unawake, darray_length(unawake));
+
+        /* new subsectors may have been allocated;
+           mark the space partition as dirty */
+        db->dirty_partition = true;
+    }
+#else
+    surgescript_object_t* unawake_container = surgescript_objectmanager_get(manager,
+        surgescript_var_get_objecthandle(surgescript_heap_at(heap, UNAWAKEENTITYCONTAINER_ADDR))
+    );
+
+    for(int i = 0; i < darray_length(unawake); i++)
+        store_entity(unawake_container, unawake[i]);
+#endif
+
+    /* defer the activation of the unawake entities to the next frame,
+       when their containers will wake up the ones inside the ROI. This
+       way we don't update a large batch of entities in a single frame */
+    for(int i = 0; i < darray_length(unawake); i++) {
+        surgescript_object_t* entity = surgescript_objectmanager_get(manager, unawake[i]);
+        surgescript_object_set_active(entity, false);
+    }
+
+    /* prevent garbage collection, apply backwards-compatibility
+       fix and fill the output array */
+    for(int i = 0; i < darray_length(spawned); i++) {
+        surgescript_object_t* entity = surgescript_objectmanager_get(manager, spawned[i]);
+
+        prevent_garbage_collection(object, spawned[i]);
+        inspect_subtree(entity, true, manager, tag_system, 0);
+
+        surgescript_var_set_objecthandle(element, spawned[i]);
+        surgescript_object_call_function(array, "push", args, 1, NULL);
+    }
+
+    /* done */
+    surgescript_var_destroy(element);
+    darray_release(unawake);
+    darray_release(spawned);
+    return ret;
+}
+
 /* get the entity with the given id */
 surgescript_var_t* fun_entity(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
@@ -521,18 +701,17 @@ surgescript_var_t* fun_findentity(surgescript_object_t* object, const surgescrip
     surgescript_var_t* ret = surgescript_var_create();
 
     if(surgescript_tagsystem_has_tag(tag_system, object_name, "entity")) {
-        /*
-         * TODO: develop a faster data structure?
-         * We just call Level.child() here
-         */
-
-        /* get the Level object */
-        surgescript_objecthandle_t level_handle = surgescript_object_parent(object);
-        surgescript_object_t* level = surgescript_objectmanager_get(manager, level_handle);
-
-        /* find the entity */
-        surgescript_object_call_function(level, "child", param, 1, ret);
-        return ret; /* will be null if no entity is found */
+        /* find the first live entity in the name index */
+        entityname_t* entry = find_entity_name(get_db(object), object_name, false);
+
+        if(entry != NULL) {
+            for(int i = 0; i < darray_length(entry->entity); i++) {
+                if(is_entity_alive(object, entry->entity[i]))
+                    return surgescript_var_set_objecthandle(ret, entry->entity[i].handle);
+            }
+        }
+
+        return surgescript_var_set_null(ret); /* no entity is found */
     }
     else {
         /* the object doesn't exist or is not an entity */
@@ -551,18 +730,27 @@ surgescript_var_t* fun_findentities(surgescript_object_t* object, const surgescr
     surgescript_var_t* ret = surgescript_var_create();
 
     if(surgescript_tagsystem_has_tag(tag_system, object_name, "entity")) {
-        /*
-         * TODO: develop a faster data structure?
-         * We just call Level.children() here
-         */
-
-        /* get the Level object */
-        surgescript_objecthandle_t level_handle = surgescript_object_parent(object);
-        surgescript_object_t* level = surgescript_objectmanager_get(manager, level_handle);
-
-        /* find the entities */
-        surgescript_object_call_function(level, "children", param, 1, ret);
-        return ret; /* will be null if no entities are found */
+        /* find the entities in the name index */
+        surgescript_objecthandle_t array_handle = surgescript_objectmanager_spawn_array(manager);
+        surgescript_object_t* array = surgescript_objectmanager_get(manager, array_handle);
+        entityname_t* entry = find_entity_name(get_db(object), object_name, false);
+
+        if(entry != NULL) {
+            surgescript_var_t* arg = surgescript_var_create();
+            const surgescript_var_t* args[] = { arg };
+
+            /* only the live entities are kept */
+            prune_entity_name(object, entry);
+
+            for(int i = 0; i < darray_length(entry->entity); i++) {
+                surgescript_var_set_objecthandle(arg, entry->entity[i].handle);
+                surgescript_object_call_function(array, "push", args, 1, NULL);
+            }
+
+            surgescript_var_destroy(arg);
+        }
+
+        return surgescript_var_set_objecthandle(ret, array_handle);
     }
     else {
         /* the object doesn't exist or is not an entity */
@@ -650,6 +838,18 @@ surgescript_var_t* fun_addtolateupdatequeue(surgescript_object_t* object, const
     entitydb_t* db = get_db(object);
     surgescript_objecthandle_t handle = surgescript_var_get_objecthandle(param[0]);
 
+    db->late_update_requests++;
+
+    /* has the entity been queued in this frame already? */
+    entityinfo_t* info = quick_lookup(object, handle);
+    if(info != NULL) {
+        if(info->late_update_generation == db->late_update_generation)
+            return NULL;
+
+        info->late_update_generation = db->late_update_generation;
+    }
+
+    /* entities without info are deduplicated in lateUpdate() */
     darray_push(db->late_update_queue, handle);
 
     return NULL;
@@ -679,11 +879,26 @@ surgescript_var_t* fun_addbricklikeobject(surgescript_object_t* object, const su
 surgescript_var_t* fun_lateupdate(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
     const surgescript_objectmanager_t* manager = surgescript_object_manager(object);
-    const entitydb_t* db = get_db(object);
+    entitydb_t* db = get_db(object);
+    int length = 0;
+
+    /* swap the buffers: entities added to the queue
+       from now on will be processed in the next frame */
+    darray_clear(db->late_update_batch);
+    for(int i = 0; i < darray_length(db->late_update_queue); i++)
+        darray_push(db->late_update_batch, db->late_update_queue[i]);
+    darray_clear(db->late_update_queue);
+
+    /* process the entities in handle order */
+    qsort(db->late_update_batch, darray_length(db->late_update_batch), sizeof(*(db->late_update_batch)), compare_handles);
 
     /* for each entity in the late update queue, call entity.lateUpdate() */
-    for(int i = 0; i < darray_length(db->late_update_queue); i++) {
-        surgescript_objecthandle_t entity_handle = db->late_update_queue[i];
+    for(int i = 0; i < darray_length(db->late_update_batch); i++) {
+        surgescript_objecthandle_t entity_handle = db->late_update_batch[i];
+        if(i > 0 && entity_handle == db->late_update_batch[i-1]) /* skip duplicates */
+            continue;
+
+        length++;
         if(surgescript_objectmanager_exists(manager, entity_handle)) { /* validity check */
             surgescript_object_t* entity = surgescript_objectmanager_get(manager, entity_handle);
             if(!surgescript_object_is_killed(entity)) {
@@ -692,6 +907,10 @@ surgescript_var_t* fun_lateupdate(surgescript_object_t* object, const surgescrip
         }
     }
 
+    /* update the statistics */
+    db->late_update_stats.length = length;
+    db->late_update_stats.requests = db->late_update_requests;
+
     /* done! */
     return NULL;
 }
@@ -701,31 +920,47 @@ surgescript_var_t* fun_notifyentities(surgescript_object_t* object, const surges
 {
     const surgescript_heap_t* heap = surgescript_object_heap(object);
     const surgescript_objectmanager_t* manager = surgescript_object_manager(object);
+    const char* fun_name = surgescript_var_fast_get_string(param[0]);
+
+    /* the target function is resolved once per object class
+       and shared by all containers */
+    struct entitynotification_t* notification = entitynotification_create(fun_name);
 
     /* notify entities of the debug container */
     surgescript_var_t* debug_container_var = surgescript_heap_at(heap, DEBUGENTITYCONTAINER_ADDR);
     surgescript_objecthandle_t debug_container_handle = surgescript_var_get_objecthandle(debug_container_var);
     surgescript_object_t* debug_container = surgescript_objectmanager_get(manager, debug_container_handle);
-    surgescript_object_call_function(debug_container, "notifyEntities", param, num_params, NULL);
+    entitycontainer_notify_entities(debug_container, notification);
 
     /* notify entities of the awake container */
     surgescript_var_t* awake_container_var = surgescript_heap_at(heap, AWAKEENTITYCONTAINER_ADDR);
     surgescript_objecthandle_t awake_container_handle = surgescript_var_get_objecthandle(awake_container_var);
     surgescript_object_t* awake_container = surgescript_objectmanager_get(manager, awake_container_handle);
-    surgescript_object_call_function(awake_container, "notifyEntities", param, num_params, NULL);
+    entitycontainer_notify_entities(awake_container, notification);
 
 #if WANT_SPACE_PARTITIONING
-    /* notify entities of all unawake containers */
-    foreach_unawake_container(object, "notifyEntities", param, num_params);
+    /* notify entities of all unawake containers, i.e., the children of the EntityTree */
+    surgescript_var_t* entity_tree_var = surgescript_heap_at(heap, ENTITYTREE_ADDR);
+    surgescript_objecthandle_t entity_tree_handle = surgescript_var_get_objecthandle(entity_tree_var);
+    surgescript_object_t* entity_tree = surgescript_objectmanager_get(manager, entity_tree_handle);
+
+    int n = surgescript_object_child_count(entity_tree);
+    for(int i = 0; i < n; i++) {
+        surgescript_objecthandle_t container_handle = surgescript_object_nth_child(entity_tree, i);
+        surgescript_object_t* container = surgescript_objectmanager_get(manager, container_handle);
+
+        entitycontainer_notify_entities(container, notification);
+    }
 #else
     /* notify entities of the unawake container */
     surgescript_var_t* unawake_container_var = surgescript_heap_at(heap, UNAWAKEENTITYCONTAINER_ADDR);
     surgescript_objecthandle_t unawake_container_handle = surgescript_var_get_objecthandle(unawake_container_var);
     surgescript_object_t* unawake_container = surgescript_objectmanager_get(manager, unawake_container_handle);
-    surgescript_object_call_function(unawake_container, "notifyEntities", param, num_params, NULL);
+    entitycontainer_notify_entities(unawake_container, notification);
 #endif
 
     /* done! */
+    entitynotification_destroy(notification);
     return NULL;
 }
 
@@ -888,10 +1123,17 @@ void entitymanager_remove_entity_info(surgescript_object_t* entity_manager, surg
 
     if(info != NULL) {
         entitydb_t* db = get_db(entity_manager);
-        uint64_t entity_id = info->id;
 
-        fasthash_delete(db->id_to_handle, entity_id);
+        /* another entity may have been given the same ID */
+        if(fasthash_get(db->id_to_info, info->id) == info)
+            fasthash_delete(db->id_to_info, info->id);
         fasthash_delete(db->info, entity_handle);
+
+        /* invalidate the cache and return the entry to the pool */
+        if(db->cached_query == info)
+            db->cached_query = &NULL_ENTRY;
+        entityinfo_set_persistent(db, info, false);
+        entityinfo_free(db, info);
     }
 }
 
@@ -910,9 +1152,10 @@ void entitymanager_set_entity_id(surgescript_object_t* entity_manager, surgescri
     if(info != NULL) {
         entitydb_t* db = get_db(entity_manager);
 
-        /* update the id_to_handle hashtable */
-        fasthash_delete(db->id_to_handle, info->id);
-        fasthash_put(db->id_to_handle, entity_id, handle_ctor(info->handle));
+        /* update the id_to_info hashtable */
+        if(fasthash_get(db->id_to_info, info->id) == info)
+            fasthash_delete(db->id_to_info, info->id);
+        fasthash_put(db->id_to_info, entity_id, info);
 
         /* set the new id */
         info->id = entity_id;
@@ -930,7 +1173,7 @@ v2d_t entitymanager_get_entity_spawn_point(surgescript_object_t* entity_manager,
 bool entitymanager_is_entity_persistent(surgescript_object_t* entity_manager, surgescript_objecthandle_t entity_handle)
 {
     entityinfo_t* info = quick_lookup(entity_manager, entity_handle);
-    return info != NULL ? info->is_persistent : false; /* return false if the entity info is missing */
+    return info != NULL ? info->persistent_slot >= 0 : false; /* return false if the entity info is missing */
 }
 
 /* change the persistent flag of an entity */
@@ -938,7 +1181,32 @@ void entitymanager_set_entity_persistent(surgescript_object_t* entity_manager, s
 {
     entityinfo_t* info = quick_lookup(entity_manager, entity_handle);
     if(info != NULL)
-        info->is_persistent = is_persistent;
+        entityinfo_set_persistent(get_db(entity_manager), info, is_persistent);
+}
+
+/* call a function for each persistent entity, in spawn order. This is a
+   linear scan of the packed array of persistent entities */
+void entitymanager_foreach_persistent_entity(surgescript_object_t* entity_manager, void* data, void (*callback)(surgescript_object_t*,uint64_t,v2d_t,void*))
+{
+    entitydb_t* db = get_db(entity_manager);
+    const surgescript_objectmanager_t* manager = surgescript_object_manager(entity_manager);
+
+    /* sort the persistent entities in spawn order. The array is kept
+       packed by swapping elements on removal, so it's sorted lazily */
+    qsort(db->persistent, darray_length(db->persistent), sizeof(*(db->persistent)), compare_serials);
+    for(int i = 0; i < darray_length(db->persistent); i++)
+        db->persistent[i]->persistent_slot = i;
+
+    /* for each persistent entity */
+    for(int i = 0; i < darray_length(db->persistent); i++) {
+        const entityinfo_t* info = db->persistent[i];
+
+        if(surgescript_objectmanager_exists(manager, info->handle)) { /* validity check */
+            surgescript_object_t* entity = surgescript_objectmanager_get(manager, info->handle);
+            if(!surgescript_object_is_killed(entity))
+                callback(entity, info->id, info->spawn_point, data);
+        }
+    }
 }
 
 /* is the entity sleeping? */
@@ -960,21 +1228,21 @@ void entitymanager_set_entity_sleeping(surgescript_object_t* entity_manager, sur
 surgescript_objecthandle_t entitymanager_find_entity_by_id(surgescript_object_t* entity_manager, uint64_t entity_id)
 {
     entitydb_t* db = get_db(entity_manager);
-    surgescript_objecthandle_t* handle_ptr = (surgescript_objecthandle_t*)fasthash_get(db->id_to_handle, entity_id);
+    const entityinfo_t* info = fasthash_get(db->id_to_info, entity_id);
     surgescript_objectmanager_t* manager = surgescript_object_manager(entity_manager);
 
-    if(handle_ptr == NULL) {
+    if(info == NULL) {
         /* ID not found */
         return surgescript_objectmanager_null(manager);
     }
-    else if(!surgescript_objectmanager_exists(manager, *handle_ptr)) {
+    else if(!surgescript_objectmanager_exists(manager, info->handle)) {
         /* the entity no longer exists */
-        entitymanager_remove_entity_info(entity_manager, *handle_ptr);
+        entitymanager_remove_entity_info(entity_manager, info->handle);
         return surgescript_objectmanager_null(manager);
     }
     else {
         /* success! */
-        return *handle_ptr;
+        return info->handle;
     }
 }
 
@@ -998,6 +1266,98 @@ void entitymanager_get_roi(surgescript_object_t* entity_manager, int* top, int*
     *right = db->roi.right;
 }
 
+/* get the length of the late update queue of the last frame, as well as the
+   number of requests to add entities to it (duplicates included) */
+void entitymanager_late_update_stats(surgescript_object_t* entity_manager, int* length, int* requests)
+{
+    const entitydb_t* db = get_db(entity_manager);
+
+    *length = db->late_update_stats.length;
+    *requests = db->late_update_stats.requests;
+}
+
+/* are the updates of low-priority entities being throttled? This happens
+   when the update of the entities exceeds its time budget */
+bool entitymanager_is_throttling_updates(surgescript_object_t* entity_manager)
+{
+    const entitydb_t* db = get_db(entity_manager);
+    return db->scheduler.period > 1;
+}
+
+/* defer the update of a low-priority entity to a later frame, unless it's
+   its turn to be updated. Low-priority entities are updated on a round-robin
+   basis, so that the deferred updates are spread evenly across the frames.
+   Returns true if the update has been deferred, i.e., the entity has been
+   inactivated until the end of the update cycle */
+bool entitymanager_defer_entity_update(surgescript_object_t* entity_manager, surgescript_object_t* entity)
+{
+    entitydb_t* db = get_db(entity_manager);
+    surgescript_objecthandle_t entity_handle = surgescript_object_handle(entity);
+
+    /* is it the turn of this entity? */
+    if((entity_handle + db->scheduler.frame) % db->scheduler.period == 0)
+        return false;
+
+    /* defer the update */
+    surgescript_object_set_active(entity, false);
+    darray_push(db->scheduler.deferred, entity_handle);
+    return true;
+}
+
+/* to be called after the update cycle of the SurgeScript VM. Reactivates the
+   entities whose update has been deferred, so that they are still rendered,
+   and adjusts the frequency of the updates of the low-priority entities */
+void entitymanager_end_update(surgescript_object_t* entity_manager, double update_time)
+{
+    entitydb_t* db = get_db(entity_manager);
+    const surgescript_objectmanager_t* manager = surgescript_object_manager(entity_manager);
+
+    /* reactivate the deferred entities */
+    for(int i = 0; i < darray_length(db->scheduler.deferred); i++) {
+        surgescript_objecthandle_t entity_handle = db->scheduler.deferred[i];
+
+        if(surgescript_objectmanager_exists(manager, entity_handle)) { /* validity check */
+            surgescript_object_t* entity = surgescript_objectmanager_get(manager, entity_handle);
+            if(!surgescript_object_is_killed(entity))
+                surgescript_object_set_active(entity, true);
+        }
+    }
+
+    /* update the statistics */
+    db->scheduler.stats.deferred = darray_length(db->scheduler.deferred);
+    db->scheduler.stats.total_deferred += darray_length(db->scheduler.deferred);
+    db->scheduler.stats.update_time = update_time;
+    darray_clear(db->scheduler.deferred);
+
+    /* update less frequently if we're over budget; update more frequently
+       if there has been some slack for a while (hysteresis prevents oscillations) */
+    if(update_time > UPDATE_TIME_BUDGET) {
+        db->scheduler.period = min(db->scheduler.period * 2, MAX_UPDATE_PERIOD);
+        db->scheduler.frames_under_budget = 0;
+    }
+    else if(update_time < UPDATE_TIME_BUDGET / 2.0 && db->scheduler.period > 1) {
+        if(++db->scheduler.frames_under_budget >= FRAMES_TO_SPEED_UP) {
+            db->scheduler.period /= 2;
+            db->scheduler.frames_under_budget = 0;
+        }
+    }
+    else
+        db->scheduler.frames_under_budget = 0;
+}
+
+/* statistics of the update scheduler: the current update period of the
+   low-priority entities, the number of deferred updates in the last frame
+   and since the beginning, and the time spent updating the entities */
+void entitymanager_scheduler_stats(surgescript_object_t* entity_manager, int* period, int* deferred, int64_t* total_deferred, double* update_time)
+{
+    const entitydb_t* db = get_db(entity_manager);
+
+    *period = db->scheduler.period;
+    *deferred = db->scheduler.stats.deferred;
+    *total_deferred = db->scheduler.stats.total_deferred;
+    *update_time = db->scheduler.stats.update_time;
+}
+
 /* create an iterator for iterating over the collection of (handles of) brick-like objects */
 iterator_t* entitymanager_bricklike_iterator(surgescript_object_t* entity_manager)
 {
@@ -1010,6 +1370,15 @@ iterator_t* entitymanager_bricklike_iterator(surgescript_object_t* entity_manage
     );
 }
 
+/* initialize a value-type iterator for iterating over the collection of (handles of)
+   brick-like objects without allocating anything on the heap */
+void entitymanager_bricklike_arrayiter(surgescript_object_t* entity_manager, arrayiter_t* it)
+{
+    entitydb_t* db = get_db(entity_manager);
+
+    darray_arrayiter(it, db->bricklike_objects);
+}
+
 /* create an iterator for iterating over the collection of (handles of) active entities
    (i.e., awake, inside the ROI...) */
 iterator_t* entitymanager_activeentities_iterator(surgescript_object_t* entity_manager)
@@ -1056,6 +1425,196 @@ entityinfo_t* quick_lookup(surgescript_object_t* entity_manager, surgescript_obj
     return db->cached_query;
 }
 
+/* find the entry of the name index of the given entity name, optionally creating it */
+entityname_t* find_entity_name(entitydb_t* db, const char* entity_name, bool create)
+{
+    uint64_t key = djb2(entity_name);
+    entityname_t* head = fasthash_get(db->name_index, key);
+
+    /* resolve hash collisions */
+    for(entityname_t* entry = head; entry != NULL; entry = entry->next) {
+        if(0 == strcmp(entry->name, entity_name))
+            return entry;
+    }
+
+    /* not found */
+    if(!create)
+        return NULL;
+
+    /* create a new entry */
+    entityname_t* entry = entityname_ctor(entity_name);
+    if(head != NULL) {
+        entry->next = head->next;
+        head->next = entry;
+    }
+    else
+        fasthash_put(db->name_index, key, entry);
+
+    return entry;
+}
+
+/* add a new entity to the name index */
+void index_entity_name(surgescript_object_t* entity_manager, const char* entity_name, const entityinfo_t* info)
+{
+    entityname_t* entry = find_entity_name(get_db(entity_manager), entity_name, true);
+    entityref_t ref = { .handle = info->handle, .serial = info->serial };
+
+    /* remove the stale entries once in a while,
+       so that the memory is proportional to the number of live entities */
+    if(darray_length(entry->entity) >= 2 * entry->live_count + 16)
+        prune_entity_name(entity_manager, entry);
+
+    darray_push(entry->entity, ref);
+}
+
+/* remove the stale entries of the name index, keeping the spawn order */
+void prune_entity_name(surgescript_object_t* entity_manager, entityname_t* entry)
+{
+    int n = darray_length(entry->entity), m = 0;
+    entityref_t stale;
+
+    for(int i = 0; i < n; i++) {
+        if(is_entity_alive(entity_manager, entry->entity[i]))
+            entry->entity[m++] = entry->entity[i];
+    }
+
+    while(darray_length(entry->entity) > m)
+        darray_pop(entry->entity, stale);
+
+    entry->live_count = m;
+}
+
+/* checks if an entry of the name index refers to a live entity.
+   The entity info is removed when an entity is destroyed, and it
+   changes its serial number when a new entity reuses the handle */
+bool is_entity_alive(surgescript_object_t* entity_manager, entityref_t ref)
+{
+    const surgescript_objectmanager_t* manager = surgescript_object_manager(entity_manager);
+    const entityinfo_t* info = quick_lookup(entity_manager, ref.handle);
+
+    return info != NULL && info->serial == ref.serial && surgescript_objectmanager_exists(manager, ref.handle);
+}
+
+/* entity name: constructor */
+entityname_t* entityname_ctor(const char* name)
+{
+    entityname_t* entry = mallocx(sizeof *entry);
+
+    entry->name = str_dup(name);
+    darray_init(entry->entity);
+    entry->live_count = 0;
+    entry->next = NULL;
+
+    return entry;
+}
+
+/* entity name: destructor (releases the entries with the same hash as well) */
+void entityname_dtor(void* ptr)
+{
+    entityname_t* entry = (entityname_t*)ptr;
+
+    while(entry != NULL) {
+        entityname_t* next = entry->next;
+
+        darray_release(entry->entity);
+        free(entry->name);
+        free(entry);
+
+        entry = next;
+    }
+}
+
+/* compare two object handles */
+int compare_handles(const void* a, const void* b)
+{
+    surgescript_objecthandle_t x = *((const surgescript_objecthandle_t*)a);
+    surgescript_objecthandle_t y = *((const surgescript_objecthandle_t*)b);
+
+    return (x > y) - (x < y);
+}
+
+/* allocate an entry of entity info from the pool */
+entityinfo_t* entityinfo_alloc(entitydb_t* db, entityinfo_t info)
+{
+    /* no free entries? allocate a new block */
+    if(db->free_info == NULL)
+        entityinfo_reserve(db, 1);
+
+    /* take the first free entry */
+    entityinfo_t* entry = db->free_info;
+    db->free_info = entry->next_free;
+
+    *entry = info;
+    entry->next_free = NULL;
+
+    return entry;
+}
+
+/* make sure that the pool has at least count free entries. The missing
+   entries are allocated in a single block */
+void entityinfo_reserve(entitydb_t* db, int count)
+{
+    int free_count = 0;
+
+    /* count the free entries */
+    for(const entityinfo_t* entry = db->free_info; entry != NULL && free_count < count; entry = entry->next_free)
+        free_count++;
+
+    if(free_count >= count)
+        return;
+
+    /* allocate a new block */
+    int block_size = max(count - free_count, INFO_BLOCK_SIZE);
+    entityinfo_t* block = mallocx(block_size * sizeof(*block));
+
+    for(int i = 0; i < block_size - 1; i++)
+        block[i].next_free = &block[i+1];
+    block[block_size - 1].next_free = db->free_info;
+
+    darray_push(db->info_block, block);
+    db->free_info = block;
+}
+
+/* return an entry of entity info to the pool */
+void entityinfo_free(entitydb_t* db, entityinfo_t* info)
+{
+    info->handle = 0;
+    info->next_free = db->free_info;
+    db->free_info = info;
+}
+
+/* add an entry of entity info to, or remove it from, the packed array of persistent entities */
+void entityinfo_set_persistent(entitydb_t* db, entityinfo_t* info, bool is_persistent)
+{
+    if(is_persistent) {
+        if(info->persistent_slot < 0) {
+            info->persistent_slot = darray_length(db->persistent);
+            darray_push(db->persistent, info);
+        }
+    }
+    else if(info->persistent_slot >= 0) {
+        /* keep the array packed: move the last element to the vacant slot */
+        entityinfo_t* last = NULL;
+        darray_pop(db->persistent, last);
+
+        if(last != info) {
+            db->persistent[info->persistent_slot] = last;
+            last->persistent_slot = info->persistent_slot;
+        }
+
+        info->persistent_slot = -1;
+    }
+}
+
+/* compare the serial numbers of entries of entity info */
+int compare_serials(const void* a, const void* b)
+{
+    uint32_t x = (*((const entityinfo_t**)a))->serial;
+    uint32_t y = (*((const entityinfo_t**)b))->serial;
+
+    return (x > y) - (x < y);
+}
+
 /* calls a function on each unawake container inside the region of interest */
 void foreach_unawake_container_inside_roi(surgescript_object_t* entity_manager, const char* fun_name, const surgescript_var_t** param, int num_params)
 {
@@ -1091,27 +1650,16 @@ void foreach_unawake_container(surgescript_object_t* entity_manager, const char*
     surgescript_objecthandle_t entity_tree_handle = surgescript_var_get_objecthandle(entity_tree_var);
     surgescript_object_t* entity_tree = surgescript_objectmanager_get(manager, entity_tree_handle);
 
-    /* for each unawake container in the EntityTree */
-    void* pack[] = { manager, (char*)fun_name, param, &num_params };
-    surgescript_object_find_descendants(entity_tree, "EntityContainer", pack, foreach_unawake_container_callback);
-    /* ^ slow!!! */
-}
-
-/* callback for foreach_unawake_container() */
-void foreach_unawake_container_callback(surgescript_objecthandle_t container_handle, void* data)
-{
-    void** pack = (void**)data;
-
-    surgescript_objectmanager_t* manager = pack[0];
-    char* fun_name = pack[1];
-    const surgescript_var_t** param = pack[2];
-    int* num_params = pack[3];
-
-    /* get the unawake container */
-    surgescript_object_t* container = surgescript_objectmanager_get(manager, container_handle);
+    /* for each unawake container in the EntityTree
+       (the containers are the children of the tree) */
+    int n = surgescript_object_child_count(entity_tree);
+    for(int i = 0; i < n; i++) {
+        surgescript_objecthandle_t container_handle = surgescript_object_nth_child(entity_tree, i);
+        surgescript_object_t* container = surgescript_objectmanager_get(manager, container_handle);
 
-    /* call function */
-    surgescript_object_call_function(container, fun_name, param, *num_params, NULL);
+        /* call function */
+        surgescript_object_call_function(container, fun_name, param, num_params, NULL);
+    }
 }
 
 /* pause containers */
@@ -1188,42 +1736,16 @@ void refresh_entity_tree(surgescript_object_t* entity_manager)
 
     /* update the size of the world */
     v2d_t world_size = level_size();
-    surgescript_var_t* world_width_var = surgescript_var_set_number(surgescript_var_create(), world_size.x);
-    surgescript_var_t* world_height_var = surgescript_var_set_number(surgescript_var_create(), world_size.y);
-    surgescript_var_t* world_size_has_changed = surgescript_var_create();
-
-    const surgescript_var_t* world_size_args[] = { world_width_var, world_height_var };
-    surgescript_object_call_function(entity_tree, "updateWorldSize", world_size_args, 2, world_size_has_changed);
-
-    if(surgescript_var_get_bool(world_size_has_changed)) {
+    if(entitytree_update_world_size(entity_tree, world_size.x, world_size.y)) {
         /* if the world size has changed, then we must
            relocate all entities of all containers */
         logfile_message("EntityManager: world size has changed. Relocating all entities...");
         foreach_unawake_container(entity_manager, "bubbleUpEntities", NULL, 0);
     }
 
-    surgescript_var_destroy(world_size_has_changed);
-    surgescript_var_destroy(world_height_var);
-    surgescript_var_destroy(world_width_var);
-
-    /* clear the unawake entity container array */
-    surgescript_object_call_function(unawake_container_array, "clear", NULL, 0, NULL);
-
-    /* update the ROI of the entity tree, as well as the unawake container array */
-    surgescript_var_t* output_array_var = surgescript_var_clone(unawake_container_array_var);
-    surgescript_var_t* top_var = surgescript_var_set_number(surgescript_var_create(), db->roi.top);
-    surgescript_var_t* left_var = surgescript_var_set_number(surgescript_var_create(), db->roi.left);
-    surgescript_var_t* bottom_var = surgescript_var_set_number(surgescript_var_create(), db->roi.bottom);
-    surgescript_var_t* right_var = surgescript_var_set_number(surgescript_var_create(), db->roi.right);
-
-    const surgescript_var_t* args[] = { output_array_var, top_var, left_var, bottom_var, right_var };
-    surgescript_object_call_function(entity_tree, "updateROI", args, 5, NULL);
-
-    surgescript_var_destroy(right_var);
-    surgescript_var_destroy(bottom_var);
-    surgescript_var_destroy(left_var);
-    surgescript_var_destroy(top_var);
-    surgescript_var_destroy(output_array_var);
+    /* update the ROI of the entity tree, as well as the unawake container array.
+       The array is refilled only if the set of awake leaf sectors has changed */
+    entitytree_update_roi(entity_tree, unawake_container_array, db->roi.top, db->roi.left, db->roi.bottom, db->roi.right);
 
     /* the space partition is clean again, i.e.,
        the unawake entity container array has the correct entries */
@@ -1232,7 +1754,6 @@ void refresh_entity_tree(surgescript_object_t* entity_manager)
 
     /* no space partitioning */
     (void)foreach_unawake_container;
-    (void)foreach_unawake_container_callback;
     (void)foreach_unawake_container_inside_roi;
 
 #endif
@@ -1329,4 +1850,120 @@ void prevent_garbage_collection(surgescript_object_t* entity_manager, surgescrip
     surgescript_var_t* param = surgescript_var_set_objecthandle(surgescript_var_create(), entity_handle);
     surgescript_object_call_function(container, "addObject", (const surgescript_var_t*[]){ param }, 1, NULL);
     surgescript_var_destroy(param);
-}
\ No newline at end of file
+}
+/* checks if an entity with the given name can be spawned */
+bool validate_entity_name(surgescript_object_t* entity_manager, const char* entity_name)
+{
+    surgescript_objectmanager_t* manager = surgescript_object_manager(entity_manager);
+    surgescript_tagsystem_t* tag_system = surgescript_objectmanager_tagsystem(manager);
+
+    /* validate: does the object exist? */
+    if(!surgescript_objectmanager_class_exists(manager, entity_name)) {
+        scripting_error(entity_manager, "Can't spawn entity: object \"%s\" doesn't exist!", entity_name);
+        return false;
+    }
+
+    /* validate: accept only entities */
+    if(!surgescript_tagsystem_has_tag(tag_system, entity_name, "entity")) {
+        scripting_error(entity_manager, "Can't spawn entity: object \"%s\" isn't tagged \"entity\"!", entity_name);
+        return false;
+    }
+
+    /* sanity check */
+    if(
+        surgescript_tagsystem_has_tag(tag_system, entity_name, "detached") &&
+        !surgescript_tagsystem_has_tag(tag_system, entity_name, "private")
+    ) {
+        video_showmessage("Entity \"%s\" is tagged \"detached\", but not \"private\"", entity_name);
+        surgescript_tagsystem_add_tag(tag_system, entity_name, "private");
+    }
+
+    /* valid entity */
+    return true;
+}
+
+/* spawns an entity as a child of Level and generates its entity info.
+   The new entity is not yet stored in any entity container */
+surgescript_objecthandle_t create_entity(surgescript_object_t* entity_manager, const char* entity_name, v2d_t spawn_point)
+{
+    surgescript_objectmanager_t* manager = surgescript_object_manager(entity_manager);
+
+    /* get the Level object */
+    surgescript_objecthandle_t level_handle = surgescript_object_parent(entity_manager);
+    surgescript_object_t* level = surgescript_objectmanager_get(manager, level_handle);
+
+    /* spawn the entity */
+    surgescript_objecthandle_t entity_parent = level_handle;
+    surgescript_objecthandle_t entity_handle = surgescript_objectmanager_spawn(manager, entity_parent, entity_name, NULL);
+    surgescript_object_t* entity = surgescript_objectmanager_get(manager, entity_handle);
+
+    /* position the entity */
+    surgescript_transform_t* transform = surgescript_object_transform(entity);
+    surgescript_transform_setposition2d(transform, spawn_point.x, spawn_point.y); /* already in world space */
+    scripting_transform_changed();
+
+    /* generate entity info */
+    entitydb_t* db = get_db(entity_manager);
+    entityinfo_t* info = entityinfo_alloc(db, (entityinfo_t) {
+        .handle = entity_handle,
+        .id = generate_entity_id(),
+        .serial = db->next_serial++,
+        .spawn_point = spawn_point,
+        .is_sleeping = !(
+            surgescript_object_has_tag(entity, "awake") ||
+            surgescript_object_has_tag(entity, "detached")
+        ),
+        .persistent_slot = -1
+    });
+
+    /* is the entity persistent? */
+    bool is_persistent = !(
+        surgescript_object_has_tag(entity, "private") ||
+        /*surgescript_object_has_tag(entity, "detached") ||*/ /* if it's detached, it's private - see above */
+        scripting_level_issetupobjectname(level, entity_name)
+    );
+    entityinfo_set_persistent(db, info, is_persistent);
+
+    /* store entity info */
+    fasthash_put(db->info, info->handle, info);
+    fasthash_put(db->id_to_info, info->id, info);
+    index_entity_name(entity_manager, entity_name, info);
+
+    /* done */
+    return entity_handle;
+}
+
+/* stores an entity in an entity container */
+void store_entity(surgescript_object_t* entity_container, surgescript_objecthandle_t entity_handle)
+{
+    surgescript_var_t* arg = surgescript_var_create();
+    const surgescript_var_t* args[] = { arg };
+
+    /* call entityContainer.storeEntity(entity) */
+    surgescript_var_set_objecthandle(arg, entity_handle);
+    surgescript_object_call_function(entity_container, "storeEntity", args, 1, NULL);
+
+    surgescript_var_destroy(arg);
+}
+
+/* the length of a SurgeScript Array */
+int array_length(surgescript_object_t* array)
+{
+    surgescript_var_t* ret = surgescript_var_create();
+    surgescript_object_call_function(array, "get_length", NULL, 0, ret);
+
+    int length = surgescript_var_get_number(ret);
+    surgescript_var_destroy(ret);
+
+    return max(0, length);
+}
+
+/* read the element of a SurgeScript Array at the given index */
+void array_get(surgescript_object_t* array, int index, surgescript_var_t* out)
+{
+    surgescript_var_t* arg = surgescript_var_set_number(surgescript_var_create(), index);
+    const surgescript_var_t* args[] = { arg };
+
+    surgescript_object_call_function(array, "get", args, 1, out);
+    surgescript_var_destroy(arg);
+}
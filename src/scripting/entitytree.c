@@ -418,6 +418,37 @@
  * All we have to do now is call update(R), where R is our region of interest.
  * The intersecting leaf sectors are returned for convenience.
  * 
+ * 
+ * 
+ * 
+ * Flattening the tree
+ * -------------------
+ * 
+ * Walking the tree sector by sector is a sensible approach when sectors are
+ * objects of a scene graph, but we can do better. Since the height H of the
+ * Entity Tree is constant, all leaf sectors have the same depth and, taken
+ * together, they form a grid of 2^H columns and 2^H rows. Moreover, the way
+ * a sector is divided horizontally does not depend on how it's divided
+ * vertically, and vice-versa. This means that the left borders of the leaf
+ * sectors can be computed once for each column, and the top borders can be
+ * computed once for each row.
+ * 
+ * In this implementation, the non-leaf sectors are implicit. We store only
+ * the leaf sectors, in a contiguous array indexed by (row, column). Finding
+ * the leaf sector of a position takes two binary searches. bubbleUp reduces
+ * to comparing the leaf sector of the position of the entity with the sector
+ * in which the entity is stored. findIntersectingLeafSectors reduces to a
+ * range of rows and columns. The results are the same as the ones of the
+ * recursive procedures, but we don't visit any non-leaf sectors.
+ * 
+ * Each allocated leaf sector stores an EntityContainer, which is a direct
+ * child of the EntityTree object. The leaf sectors that intersect with the
+ * ROI are awake. Other leaf sectors are put to sleep. The set of awake leaf
+ * sectors changes only when the ROI crosses the border of a leaf sector or
+ * when a leaf sector is allocated inside the ROI. We keep track of these
+ * events and do the work only when they happen: the leaf sectors that leave
+ * the ROI are put to sleep and those that enter the ROI are awakened.
+ * 
  */
 
 #include <surgescript.h>
@@ -428,7 +459,7 @@
 #include "../util/util.h"
 
 /* the height of the quaternary tree - must be greater than zero
-   the number of nodes in the tree grows exponentially (we allocate lazily) */
+   the number of leaf sectors grows exponentially (we allocate lazily) */
 #define TREE_HEIGHT 5 /* log2(W / w); W = 32768 (max_level_width), w = 1024 (~roi_width) */
 
 /* we use sensible constants, as tiny worlds would otherwise promote too much bubbling and memory allocations */
@@ -444,130 +475,76 @@
 #define DEFAULT_WORLD_WIDTH 32768 /* 2:1 ratio */
 #define DEFAULT_WORLD_HEIGHT 16384 /* water at y ~ 10,000 */
 
+/* the leaf sectors form a GRID_SIZE x GRID_SIZE grid */
+#define GRID_SIZE (1 << (TREE_HEIGHT))
 
 
-/* types & utilities */
-typedef struct sector_t sector_t;
-typedef struct sectoraddr_t sectoraddr_t;
-typedef struct sectorrect_t sectorrect_t;
-typedef struct sectorvtable_t sectorvtable_t;
-typedef enum sectorquadrant_t sectorquadrant_t;
-typedef surgescript_var_t* (*sectorfun_t)(surgescript_object_t*,const surgescript_var_t**,int);
-
-/* sector quadrant */
-enum sectorquadrant_t
-{
-    TOPLEFT = 0,
-    TOPRIGHT = 1,
-    BOTTOMLEFT = 2,
-    BOTTOMRIGHT = 3
-};
-
-/* sector rectangle */
-struct sectorrect_t
-{
-    /* coordinates are inclusive */
-    int top;
-    int left;
-    int bottom;
-    int right;
-};
 
-/* sector address */
-struct sectoraddr_t
-{
-    uint32_t path;
-    int depth;
-};
+/* types & utilities */
+typedef struct sectorgrid_t sectorgrid_t;
+typedef struct sectorrange_t sectorrange_t;
 
-/* sector vtable */
-struct sectorvtable_t
+/* a range of leaf sectors (inclusive) */
+struct sectorrange_t
 {
-    /* we use this vtable to bypass the SurgeScript
-       call stack and gain extra speed */
-    sectorfun_t bubble_up;
-    sectorfun_t bubble_down;
-    sectorfun_t update_roi;
-    sectorfun_t update_world_size;
+    int first_row;
+    int last_row;
+    int first_column;
+    int last_column;
 };
 
-/* sector struct */
-struct sector_t
+/* the leaf sectors of the tree */
+struct sectorgrid_t
 {
-    int index;
-    sectoraddr_t addr;
-
-    const sectorvtable_t* vt;
-    int flags;
-
-    int cached_world_width;
-    int cached_world_height;
-    sectorrect_t cached_rect; /* depends on the size of the world */
-
-    /* children info (no need of node allocation) */
-    struct {
-        int index;
-        sectoraddr_t addr;
-        sectorrect_t cached_rect;
-    } child[4];
+    /* the size of the world */
+    int world_width;
+    int world_height;
+
+    /* column[j] is the left border of the j-th column of leaf sectors;
+       row[i] is the top border of the i-th row of leaf sectors.
+       column[GRID_SIZE] = world_width and row[GRID_SIZE] = world_height */
+    int column[GRID_SIZE + 1];
+    int row[GRID_SIZE + 1];
+
+    /* the EntityContainer of each leaf sector, indexed by row * GRID_SIZE + column;
+       zero (null) if the leaf sector is not allocated */
+    surgescript_objecthandle_t container[GRID_SIZE * GRID_SIZE];
+
+    /* leaf sectors that intersect with the ROI */
+    sectorrange_t awake;
+    bool awake_changed; /* a container has been spawned in the awake range */
 };
 
-/* sector flags */
-#define SECTOR_HAS_SUBSECTOR(quadrant)  (1 << (quadrant)) /* quadrant = 0, 1, 2, 3 */
-#define SECTOR_IS_LEAF                  (1 << 4)
+static const sectorrange_t EMPTY_RANGE = { .first_row = 0, .last_row = -1, .first_column = 0, .last_column = -1 };
 
 /* sector helpers */
-static sector_t* sector_ctor(int index, int world_width, int world_height);
-static sector_t* sector_dtor(sector_t* sector);
-static bool sector_update_rect(sector_t* sector, int world_width, int world_height);
-static sectoraddr_t find_sector_address(int index);
-static sectorrect_t find_sector_rect(sectoraddr_t addr, int world_width, int world_height);
-static inline bool disjoint_rects(sectorrect_t a, sectorrect_t b);
-static inline bool point_belongs_to_rect(sectorrect_t r, int x, int y);
-static inline bool is_leaf_sector(int index);
+static sectorgrid_t* grid_ctor(int world_width, int world_height);
+static sectorgrid_t* grid_dtor(sectorgrid_t* grid);
+static bool grid_update_borders(sectorgrid_t* grid, int world_width, int world_height);
+static void partition(int* border, int first, int last, int begin, int end);
+static inline int find_cell(const int* border, int coordinate);
+static inline bool range_contains(sectorrange_t range, int row, int column);
+static inline bool range_changed(sectorrange_t a, sectorrange_t b);
+static int find_leaf_sector(const sectorgrid_t* grid, surgescript_object_t* entity);
+static surgescript_objecthandle_t spawn_container(surgescript_object_t* entity_tree, int leaf);
+static v2d_t get_clipped_position(surgescript_object_t* entity, float world_width, float world_height);
+
 
 
+/* C API; make sure you call these with an actual EntityTree object (it won't be checked) */
+void entitytree_bubble_down(surgescript_object_t* entity_tree, surgescript_objecthandle_t entity_handle);
+void entitytree_bubble_down_batch(surgescript_object_t* entity_tree, const surgescript_objecthandle_t* entity_handle, int count);
+void entitytree_bubble_up(surgescript_object_t* entity_tree, surgescript_object_t* entity_container, surgescript_objecthandle_t entity_handle);
+bool entitytree_update_world_size(surgescript_object_t* entity_tree, int world_width, int world_height);
+bool entitytree_update_roi(surgescript_object_t* entity_tree, surgescript_object_t* output_array, int top, int left, int bottom, int right);
 
-/* SurgeScript functions & utilities */
+/* SurgeScript functions */
 static surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_destructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_main(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_spawn(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_destroy(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
-static surgescript_var_t* fun_bubbleup(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
-static surgescript_var_t* fun_bubbledown(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
-static surgescript_var_t* fun_updateroi(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
-static surgescript_var_t* fun_updateworldsize(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
-static surgescript_var_t* fun_leaf_constructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
-static surgescript_var_t* fun_leaf_bubbleup(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
-static surgescript_var_t* fun_leaf_bubbledown(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
-static surgescript_var_t* fun_leaf_updateroi(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
-static surgescript_var_t* fun_leaf_updateworldsize(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
-static const surgescript_heapptr_t ENTITYCONTAINER_ADDR = 0; /* leaf nodes only */
-static const surgescript_heapptr_t CHILD_ADDR[] = { /* non-leaf nodes only */
-    [TOPLEFT] = 0,
-    [TOPRIGHT] = 1,
-    [BOTTOMLEFT] = 2,
-    [BOTTOMRIGHT] = 3
-};
-#define unsafe_get_sector(tree_node) ((sector_t*)surgescript_object_userdata(tree_node))
-static inline sector_t* safe_get_sector(surgescript_object_t* tree_node);
-static surgescript_objecthandle_t spawn_child(surgescript_object_t* object, sectorquadrant_t quadrant);
-static v2d_t get_clipped_position(surgescript_object_t* entity, float world_width, float world_height);
-
-static const sectorvtable_t LEAF_VTABLE = {
-    .bubble_up = fun_leaf_bubbleup,
-    .bubble_down = fun_leaf_bubbledown,
-    .update_roi = fun_leaf_updateroi,
-    .update_world_size = fun_leaf_updateworldsize
-};
-
-static const sectorvtable_t NONLEAF_VTABLE = {
-    .bubble_up = fun_bubbleup,
-    .bubble_down = fun_bubbledown,
-    .update_roi = fun_updateroi,
-    .update_world_size = fun_updateworldsize
-};
+#define get_grid(entity_tree) ((sectorgrid_t*)surgescript_object_userdata(entity_tree))
 
 
 
@@ -579,69 +556,20 @@ static const sectorvtable_t NONLEAF_VTABLE = {
  */
 void scripting_register_entitytree(surgescript_vm_t* vm)
 {
-    /* EntityTree */
+    /* the tree is maintained via the C API */
     surgescript_vm_bind(vm, "EntityTree", "state:main", fun_main, 0);
     surgescript_vm_bind(vm, "EntityTree", "constructor", fun_constructor, 0);
     surgescript_vm_bind(vm, "EntityTree", "destructor", fun_destructor, 0);
     surgescript_vm_bind(vm, "EntityTree", "spawn", fun_spawn, 1);
     surgescript_vm_bind(vm, "EntityTree", "destroy", fun_destroy, 0);
-    surgescript_vm_bind(vm, "EntityTree", "bubbleUp", fun_bubbleup, 1);
-    surgescript_vm_bind(vm, "EntityTree", "bubbleDown", fun_bubbledown, 1);
-    surgescript_vm_bind(vm, "EntityTree", "updateROI", fun_updateroi, 5);
-    surgescript_vm_bind(vm, "EntityTree", "updateWorldSize", fun_updateworldsize, 2);
-
-    /* EntityTreeLeaf "inherits" from EntityTree */
-    surgescript_vm_bind(vm, "EntityTreeLeaf", "state:main", fun_main, 0);
-    surgescript_vm_bind(vm, "EntityTreeLeaf", "constructor", fun_leaf_constructor, 0);
-    surgescript_vm_bind(vm, "EntityTreeLeaf", "destructor", fun_destructor, 0);
-    surgescript_vm_bind(vm, "EntityTreeLeaf", "spawn", fun_spawn, 1);
-    surgescript_vm_bind(vm, "EntityTreeLeaf", "destroy", fun_destroy, 0);
-    surgescript_vm_bind(vm, "EntityTreeLeaf", "bubbleUp", fun_leaf_bubbleup, 1);
-    surgescript_vm_bind(vm, "EntityTreeLeaf", "bubbleDown", fun_leaf_bubbledown, 1);
-    surgescript_vm_bind(vm, "EntityTreeLeaf", "updateROI", fun_leaf_updateroi, 5);
-    surgescript_vm_bind(vm, "EntityTreeLeaf", "updateWorldSize", fun_leaf_updateworldsize, 2);
 }
 
-/* constructor of a non-leaf node */
+/* constructor */
 surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
-    surgescript_heap_t* heap = surgescript_object_heap(object);
-    const sector_t* sector = unsafe_get_sector(object);
-
-    /* allocate root data */
-    if(sector == NULL) {
-        sector_t* root_sector = sector_ctor(0, DEFAULT_WORLD_WIDTH, DEFAULT_WORLD_HEIGHT);
-        surgescript_object_set_userdata(object, root_sector);
-    }
-
-    /* children will be allocated lazily */
-    for(int j = 0; j < 4; j++) {
-        ssassert(CHILD_ADDR[j] == surgescript_heap_malloc(heap));
-        surgescript_var_set_null(surgescript_heap_at(heap, CHILD_ADDR[j]));
-    }
-
-    /* done */
-    return NULL;
-}
-
-/* constructor of a leaf node */
-surgescript_var_t* fun_leaf_constructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
-{
-    surgescript_heap_t* heap = surgescript_object_heap(object);
-    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
-    const sector_t* sector = unsafe_get_sector(object);
-
-    /* the sector is assumed to be allocated already
-       (when spawning this node) */
-    ssassert(sector != NULL); /* this object must not be spawned via SurgeScript! */
-
-    /* spawn an EntityContainer */
-    surgescript_objecthandle_t handle = surgescript_object_handle(object);
-    surgescript_objecthandle_t container = surgescript_objectmanager_spawn(manager, handle, "EntityContainer", NULL);
-
-    /* store the EntityContainer */
-    ssassert(ENTITYCONTAINER_ADDR == surgescript_heap_malloc(heap));
-    surgescript_var_set_objecthandle(surgescript_heap_at(heap, ENTITYCONTAINER_ADDR), container);
+    /* allocate the leaf sectors; their containers will be spawned lazily */
+    sectorgrid_t* grid = grid_ctor(DEFAULT_WORLD_WIDTH, DEFAULT_WORLD_HEIGHT);
+    surgescript_object_set_userdata(object, grid);
 
     /* done */
     return NULL;
@@ -650,10 +578,11 @@ surgescript_var_t* fun_leaf_constructor(surgescript_object_t* object, const surg
 /* destructor */
 surgescript_var_t* fun_destructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
-    sector_t* sector = unsafe_get_sector(object);
+    sectorgrid_t* grid = get_grid(object);
 
-    /* deallocate sector data */
-    sector_dtor(sector);
+    /* deallocate the leaf sectors; the containers
+       are children of this object */
+    grid_dtor(grid);
 
     /* done */
     return NULL;
@@ -680,280 +609,189 @@ surgescript_var_t* fun_destroy(surgescript_object_t* object, const surgescript_v
     return NULL;
 }
 
-/* leaf-variant of update world size */
-surgescript_var_t* fun_leaf_updateworldsize(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
-{
-    double world_width = surgescript_var_get_number(param[0]);
-    double world_height = surgescript_var_get_number(param[1]);
-    sector_t* sector = unsafe_get_sector(object);
 
-    /* update world size */
-    if(!sector_update_rect(sector, world_width, world_height))
-        return surgescript_var_set_bool(surgescript_var_create(), false);
 
-    /* done */
-    return surgescript_var_set_bool(surgescript_var_create(), true);
-}
-
-/* non-leaf-variant of update world size */
-surgescript_var_t* fun_updateworldsize(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
-{
-    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
-    surgescript_heap_t* heap = surgescript_object_heap(object);
-    double world_width = surgescript_var_get_number(param[0]);
-    double world_height = surgescript_var_get_number(param[1]);
-    sector_t* sector = unsafe_get_sector(object);
-
-    /* update world size */
-    if(!sector_update_rect(sector, world_width, world_height))
-        return surgescript_var_set_bool(surgescript_var_create(), false); /* no change; return quickly */
-
-    /* recurse on each allocated subsector */
-    for(int j = 0; j < 4; j++) {
-        surgescript_var_t* child_var = surgescript_heap_at(heap, CHILD_ADDR[j]);
-        if(!surgescript_var_is_null(child_var)) {
-            surgescript_objecthandle_t child_handle = surgescript_var_get_objecthandle(child_var);
-            surgescript_object_t* child = surgescript_objectmanager_get(manager, child_handle);
-            sector_t* child_sector = safe_get_sector(child);
-
-            child_sector->vt->update_world_size(child, param, num_params);
-        }
-    }
-
-    /* done */
-    return surgescript_var_set_bool(surgescript_var_create(), true);
-}
+/*
+ * C API
+ */
 
-/* leaf-variant of bubble up */
-surgescript_var_t* fun_leaf_bubbleup(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+/* store a new entity in the leaf sector it belongs to (bubbleDown from the root) */
+void entitytree_bubble_down(surgescript_object_t* entity_tree, surgescript_objecthandle_t entity_handle)
 {
-    /* get the entity */
-    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
-    surgescript_objecthandle_t entity_handle = surgescript_var_get_objecthandle(param[0]);
+    surgescript_objectmanager_t* manager = surgescript_object_manager(entity_tree);
     surgescript_object_t* entity = surgescript_objectmanager_get(manager, entity_handle);
-    sector_t* sector = unsafe_get_sector(object);
+    sectorgrid_t* grid = get_grid(entity_tree);
 
-    /* get the size of the world */
-    int world_width = sector->cached_world_width;
-    int world_height = sector->cached_world_height;
+    /* find the leaf sector and lazily allocate its container */
+    int leaf = find_leaf_sector(grid, entity);
+    if(grid->container[leaf] == 0)
+        grid->container[leaf] = spawn_container(entity_tree, leaf);
 
-    /* does the entity belong to this sector? */
-    v2d_t entity_position = get_clipped_position(entity, world_width, world_height);
-    if(!point_belongs_to_rect(sector->cached_rect, entity_position.x, entity_position.y)) {
+    /* store the entity in the container of the leaf sector */
+    surgescript_object_t* container = surgescript_objectmanager_get(manager, grid->container[leaf]);
+    surgescript_var_t* arg = surgescript_var_create();
+    const surgescript_var_t* args[] = { arg };
 
-        /* get the entity container of this leaf sector */
-        surgescript_heap_t* heap = surgescript_object_heap(object);
-        surgescript_var_t* container_var = surgescript_heap_at(heap, ENTITYCONTAINER_ADDR);
-        surgescript_objecthandle_t container_handle = surgescript_var_get_objecthandle(container_var);
-        surgescript_object_t* container = surgescript_objectmanager_get(manager, container_handle);
+    surgescript_var_set_objecthandle(arg, entity_handle);
+    surgescript_object_call_function(container, "storeEntity", args, 1, NULL);
 
-        /* remove this entity from its present container */
-        surgescript_var_t* arg = surgescript_var_create();
-        const surgescript_var_t* args[] = { arg };
-        surgescript_var_set_objecthandle(arg, entity_handle);
-        surgescript_object_call_function(container, "removeEntity", args, 1, NULL);
-        surgescript_var_destroy(arg);
+    surgescript_var_destroy(arg);
+}
 
-        /* call parent.bubbleUp(entity) */
-        surgescript_objecthandle_t parent_handle = surgescript_object_parent(object);
-        surgescript_object_t* parent = surgescript_objectmanager_get(manager, parent_handle);
-        sector_t* parent_sector = safe_get_sector(parent);
+/* store many new entities in the leaf sectors they belong to. The entities are
+   grouped by leaf sector (counting sort), so that each container is looked up
+   and lazily allocated only once */
+void entitytree_bubble_down_batch(surgescript_object_t* entity_tree, const surgescript_objecthandle_t* entity_handle, int count)
+{
+    surgescript_objectmanager_t* manager = surgescript_object_manager(entity_tree);
+    sectorgrid_t* grid = get_grid(entity_tree);
+    int first[GRID_SIZE * GRID_SIZE + 1] = { 0 };
 
-        return parent_sector->vt->bubble_up(parent, param, num_params);
+    if(count <= 0)
+        return;
 
-    }
+    /* find the leaf sector of each entity */
+    int* leaf = mallocx(count * sizeof(*leaf));
+    surgescript_objecthandle_t* sorted = mallocx(count * sizeof(*sorted));
 
-    /* done */
-    return NULL;
-}
+    for(int i = 0; i < count; i++) {
+        surgescript_object_t* entity = surgescript_objectmanager_get(manager, entity_handle[i]);
+        leaf[i] = find_leaf_sector(grid, entity);
+        first[leaf[i] + 1]++;
+    }
 
-/* non-leaf-variant of bubble up */
-surgescript_var_t* fun_bubbleup(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
-{
-    /* get the entity */
-    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
-    surgescript_objecthandle_t entity_handle = surgescript_var_get_objecthandle(param[0]);
-    surgescript_object_t* entity = surgescript_objectmanager_get(manager, entity_handle);
-    sector_t* sector = unsafe_get_sector(object);
+    /* group the entities by leaf sector */
+    for(int k = 1; k <= GRID_SIZE * GRID_SIZE; k++)
+        first[k] += first[k-1];
 
-    /* get the size of the world */
-    int world_width = sector->cached_world_width;
-    int world_height = sector->cached_world_height;
+    for(int i = 0; i < count; i++)
+        sorted[first[leaf[i]]++] = entity_handle[i];
 
-    /* does the entity belong to this sector? */
-    v2d_t entity_position = get_clipped_position(entity, world_width, world_height);
-    if(!point_belongs_to_rect(sector->cached_rect, entity_position.x, entity_position.y)) {
+    /* store the entities in the containers of the leaf sectors.
+       first[k] is now the beginning of the group of sector k+1 */
+    surgescript_var_t* arg = surgescript_var_create();
+    const surgescript_var_t* args[] = { arg };
 
-        /* call parent.bubbleUp(entity) */
-        surgescript_objecthandle_t parent_handle = surgescript_object_parent(object);
-        surgescript_object_t* parent = surgescript_objectmanager_get(manager, parent_handle);
-        sector_t* parent_sector = safe_get_sector(parent);
+    for(int k = 0, begin = 0; k < GRID_SIZE * GRID_SIZE; begin = first[k++]) {
+        if(begin == first[k])
+            continue;
 
-        return parent_sector->vt->bubble_up(parent, param, num_params);
+        if(grid->container[k] == 0)
+            grid->container[k] = spawn_container(entity_tree, k);
 
+        surgescript_object_t* container = surgescript_objectmanager_get(manager, grid->container[k]);
+        for(int i = begin; i < first[k]; i++) {
+            surgescript_var_set_objecthandle(arg, sorted[i]);
+            surgescript_object_call_function(container, "storeEntity", args, 1, NULL);
+        }
     }
-    else {
 
-        /* call this.bubbleDown(entity) */
-        return sector->vt->bubble_down(object, param, num_params);
+    surgescript_var_destroy(arg);
 
-    }
+    /* done */
+    free(sorted);
+    free(leaf);
 }
 
-/* leaf-variant of bubble down */
-surgescript_var_t* fun_leaf_bubbledown(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+/* move an entity stored in the given container to the leaf sector it belongs to, if it has changed */
+void entitytree_bubble_up(surgescript_object_t* entity_tree, surgescript_object_t* entity_container, surgescript_objecthandle_t entity_handle)
 {
-    /* get the entity */
-    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
-    surgescript_objecthandle_t entity_handle = surgescript_var_get_objecthandle(param[0]);
-
-    /* get the entity container of this leaf sector */
-    surgescript_heap_t* heap = surgescript_object_heap(object);
-    surgescript_var_t* container_var = surgescript_heap_at(heap, ENTITYCONTAINER_ADDR);
-    surgescript_objecthandle_t container_handle = surgescript_var_get_objecthandle(container_var);
-    surgescript_object_t* container = surgescript_objectmanager_get(manager, container_handle);
+    surgescript_objectmanager_t* manager = surgescript_object_manager(entity_tree);
+    surgescript_object_t* entity = surgescript_objectmanager_get(manager, entity_handle);
+    sectorgrid_t* grid = get_grid(entity_tree);
+
+    /* does the entity belong to the sector of its present container? */
+    int leaf = find_leaf_sector(grid, entity);
+    if(grid->container[leaf] == surgescript_object_handle(entity_container))
+        return;
 
-    /* store the entity in the container of this sector */
+    /* remove this entity from its present container */
     surgescript_var_t* arg = surgescript_var_create();
     const surgescript_var_t* args[] = { arg };
+
     surgescript_var_set_objecthandle(arg, entity_handle);
-    surgescript_object_call_function(container, "storeEntity", args, 1, NULL);
+    surgescript_object_call_function(entity_container, "removeEntity", args, 1, NULL);
+
     surgescript_var_destroy(arg);
 
-    /* done */
-    return NULL;
+    /* store it in the proper leaf sector */
+    entitytree_bubble_down(entity_tree, entity_handle);
 }
 
-/* non-leaf-variant of bubble down */
-surgescript_var_t* fun_bubbledown(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+/* update the size of the world. Returns true if the leaf sectors have changed */
+bool entitytree_update_world_size(surgescript_object_t* entity_tree, int world_width, int world_height)
 {
-    /* get the entity */
-    surgescript_heap_t* heap = surgescript_object_heap(object);
-    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
-    surgescript_objecthandle_t entity_handle = surgescript_var_get_objecthandle(param[0]);
-    surgescript_object_t* entity = surgescript_objectmanager_get(manager, entity_handle);
-    sector_t* sector = unsafe_get_sector(object);
+    sectorgrid_t* grid = get_grid(entity_tree);
+    return grid_update_borders(grid, world_width, world_height);
+}
 
-    /* get the size of the world */
-    int world_width = sector->cached_world_width;
-    int world_height = sector->cached_world_height;
+/* find the leaf sectors that intersect with the ROI, put the other ones to sleep
+   and fill the output array with the containers of the intersecting sectors.
+   The work is done only if the set of awake sectors has changed, in which case
+   we return true. Otherwise, the output array is left untouched */
+bool entitytree_update_roi(surgescript_object_t* entity_tree, surgescript_object_t* output_array, int top, int left, int bottom, int right)
+{
+    surgescript_objectmanager_t* manager = surgescript_object_manager(entity_tree);
+    sectorgrid_t* grid = get_grid(entity_tree);
+    sectorrange_t previous = grid->awake;
+    sectorrange_t range = EMPTY_RANGE;
+
+    /* find the leaf sectors that intersect with the ROI */
+    if(!(right < 0 || left >= grid->world_width || bottom < 0 || top >= grid->world_height)) {
+        range.first_column = find_cell(grid->column, max(left, 0));
+        range.last_column = find_cell(grid->column, min(right, grid->world_width - 1));
+        range.first_row = find_cell(grid->row, max(top, 0));
+        range.last_row = find_cell(grid->row, min(bottom, grid->world_height - 1));
+    }
 
-    /* get the position of the entity */
-    v2d_t entity_position = get_clipped_position(entity, world_width, world_height);
+    /* awaken the tree */
+    surgescript_object_set_active(entity_tree, true);
 
-    /* for each subsector */
-    for(int j = 0; j < 4; j++) {
+    /* has the ROI crossed the border of a leaf sector? */
+    if(!grid->awake_changed && !range_changed(previous, range))
+        return false;
 
-        /* does the entity belong to the j-th subsector? */
-        if(point_belongs_to_rect(sector->child[j].cached_rect, entity_position.x, entity_position.y)) {
+    /* put to sleep the leaf sectors that no longer intersect with the ROI */
+    for(int i = previous.first_row; i <= previous.last_row; i++) {
+        for(int j = previous.first_column; j <= previous.last_column; j++) {
+            surgescript_objecthandle_t container_handle = grid->container[i * GRID_SIZE + j];
 
-            /* lazily allocate the subsector */
-            surgescript_var_t* child_var = surgescript_heap_at(heap, CHILD_ADDR[j]);
-            if(surgescript_var_is_null(child_var)) {
-                surgescript_objecthandle_t child_handle = spawn_child(object, j);
-                surgescript_var_set_objecthandle(child_var, child_handle);
-                sector->flags |= SECTOR_HAS_SUBSECTOR(j);
+            if(container_handle != 0 && !range_contains(range, i, j)) {
+                surgescript_object_t* container = surgescript_objectmanager_get(manager, container_handle);
+                surgescript_object_set_active(container, false);
             }
-
-            /* call subsector.bubbleDown(entity) */
-            surgescript_objecthandle_t child_handle = surgescript_var_get_objecthandle(child_var);
-            surgescript_object_t* child = surgescript_objectmanager_get(manager, child_handle);
-            sector_t* child_sector = unsafe_get_sector(child);
-
-            return child_sector->vt->bubble_down(child, param, num_params);
-
         }
-
     }
 
-    /* this shouldn't happen */
-    ssfatal(
-        "Can't bubbleDown \"%s\" at (%f,%f) in [0-%lf)x[0-%lf)",
-        surgescript_object_name(entity),
-        entity_position.x, entity_position.y,
-        world_width, world_height
-    );
-    return NULL;
-}
-
-/* non-leaf-variant of updateROI: find intersecting leaf sectors and put nodes to sleep */
-surgescript_var_t* fun_updateroi(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
-{
-    surgescript_heap_t* heap = surgescript_object_heap(object);
-    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
-    /*surgescript_objecthandle_t array_handle = surgescript_var_get_objecthandle(param[0]);*/ /* ignored */
-    double top = surgescript_var_get_number(param[1]);
-    double left = surgescript_var_get_number(param[2]);
-    double bottom = surgescript_var_get_number(param[3]);
-    double right = surgescript_var_get_number(param[4]);
-    sector_t* sector = unsafe_get_sector(object);
-
-    sectorrect_t roi = {
-        .top = top,
-        .left = left,
-        .bottom = bottom,
-        .right = right
-    };
-
-    /* awaken this sector */
-    surgescript_object_set_active(object, true);
-
-    /* for each subsector */
-    for(int j = 0; j < 4; j++) {
-
-        /* is the subsector allocated? */
-        if(!(sector->flags & SECTOR_HAS_SUBSECTOR(j)))
-            continue; /* not allocated; skip */
-
-        /* get the allocated subsector */
-        const surgescript_var_t* child_var = surgescript_heap_at(heap, CHILD_ADDR[j]);
-        surgescript_objecthandle_t child_handle = surgescript_var_get_objecthandle(child_var); /* not null, because the subsector is allocated */
-        ssassert(surgescript_objectmanager_exists(manager, child_handle));
-        surgescript_object_t* child = surgescript_objectmanager_get(manager, child_handle);
-
-        /* does the subsector intersect with the ROI? */
-        if(disjoint_rects(sector->child[j].cached_rect, roi)) {
-            /* no, it doesn't */
-            surgescript_object_set_active(child, false); /* put it to sleep */
-            continue; /* skip */
-        }
-
-        /* recursion */
-        sector_t* child_sector = unsafe_get_sector(child);
-        child_sector->vt->update_roi(child, param, num_params);
-
-    }
-
-    /* done */
-    return NULL;
-}
-
-/* leaf-variant of updateROI */
-surgescript_var_t* fun_leaf_updateroi(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
-{
-    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
-    surgescript_objecthandle_t array_handle = surgescript_var_get_objecthandle(param[0]);
-    surgescript_object_t* array = surgescript_objectmanager_get(manager, array_handle);
+    /* awaken the leaf sectors that intersect with the ROI
+       and add their containers to the output array */
+    surgescript_var_t* arg = surgescript_var_create();
+    const surgescript_var_t* args[] = { arg };
 
-    /* awaken this sector */
-    surgescript_object_set_active(object, true);
+    surgescript_object_call_function(output_array, "clear", NULL, 0, NULL);
 
-    /* get the entity container of this leaf sector */
-    surgescript_heap_t* heap = surgescript_object_heap(object);
-    surgescript_var_t* container_var = surgescript_heap_at(heap, ENTITYCONTAINER_ADDR);
-    surgescript_objecthandle_t container_handle = surgescript_var_get_objecthandle(container_var);
+    for(int i = range.first_row; i <= range.last_row; i++) {
+        for(int j = range.first_column; j <= range.last_column; j++) {
+            surgescript_objecthandle_t container_handle = grid->container[i * GRID_SIZE + j];
 
-    /* add the entity container of this leaf sector to the output array */
-    surgescript_var_t* arg = surgescript_var_create();
-    const surgescript_var_t* args[] = { arg };
+            if(container_handle != 0) {
+                if(!range_contains(previous, i, j)) {
+                    surgescript_object_t* container = surgescript_objectmanager_get(manager, container_handle);
+                    surgescript_object_set_active(container, true);
+                }
 
-    surgescript_var_set_objecthandle(arg, container_handle);
-    surgescript_object_call_function(array, "push", args, 1, NULL);
+                surgescript_var_set_objecthandle(arg, container_handle);
+                surgescript_object_call_function(output_array, "push", args, 1, NULL);
+            }
+        }
+    }
 
     surgescript_var_destroy(arg);
 
     /* done */
-    return NULL;
+    grid->awake = range;
+    grid->awake_changed = false;
+    return true;
 }
 
 
@@ -962,207 +800,130 @@ surgescript_var_t* fun_leaf_updateroi(surgescript_object_t* object, const surges
  * private
  */
 
-sectoraddr_t find_sector_address(int index)
+sectorgrid_t* grid_ctor(int world_width, int world_height)
 {
-    sectoraddr_t addr = { .path = 0, .depth = 0 };
+    sectorgrid_t* grid = mallocx(sizeof *grid);
 
-    while(index > 0) {
-        addr.path = 4 * addr.path + ((index - 1) % 4);
-        addr.depth++;
+    grid->world_width = 0;
+    grid->world_height = 0;
+    grid->awake = EMPTY_RANGE;
+    grid->awake_changed = false;
 
-        index = (index - 1) / 4;
-    }
+    for(int k = 0; k < GRID_SIZE * GRID_SIZE; k++)
+        grid->container[k] = 0;
 
-    return addr;
+    grid_update_borders(grid, world_width, world_height);
+    return grid;
 }
 
-sectorrect_t find_sector_rect(sectoraddr_t addr, int world_width, int world_height)
+sectorgrid_t* grid_dtor(sectorgrid_t* grid)
 {
+    free(grid);
+    return NULL;
+}
+
+bool grid_update_borders(sectorgrid_t* grid, int world_width, int world_height)
+{
+    /* is the world too small? */
     if(world_width < MIN_WORLD_WIDTH)
         world_width = MIN_WORLD_WIDTH;
     if(world_height < MIN_WORLD_HEIGHT)
         world_height = MIN_WORLD_HEIGHT;
 
-    sectorrect_t rect = {
-        .left = 0,
-        .top = 0,
-        .right = world_width - 1,
-        .bottom = world_height - 1
-    };
-
-    while(addr.depth != 0) {
-        uint32_t direction = addr.path % 4;
-        int w = rect.right - rect.left + 1;
-        int h = rect.bottom - rect.top + 1;
-
-        switch(direction) {
-            case TOPLEFT:
-                rect.right = rect.left + (w+1)/2 - 1;
-                rect.bottom = rect.top + (h+1)/2 - 1;
-                break;
-
-            case TOPRIGHT:
-                rect.left = rect.right - w/2 + 1;
-                rect.bottom = rect.top + (h+1)/2 - 1;
-                break;
-
-            case BOTTOMLEFT:
-                rect.right = rect.left + (w+1)/2 - 1;
-                rect.top = rect.bottom - h/2 + 1;
-                break;
-
-            case BOTTOMRIGHT:
-                rect.left = rect.right - w/2 + 1;
-                rect.top = rect.bottom - h/2 + 1;
-                break;
-        }
+    /* no need to update */
+    if(world_width == grid->world_width && world_height == grid->world_height)
+        return false;
 
-        addr.path /= 4;
-        addr.depth--;
-    }
+    /* divide the world */
+    grid->world_width = world_width;
+    grid->world_height = world_height;
 
-    return rect;
-}
+    grid->column[0] = 0;
+    grid->column[GRID_SIZE] = world_width;
+    partition(grid->column, 0, GRID_SIZE, 0, world_width);
 
-bool disjoint_rects(sectorrect_t a, sectorrect_t b)
-{
-    return b.right < a.left || b.left > a.right || b.bottom < a.top || b.top > a.bottom;
-}
+    grid->row[0] = 0;
+    grid->row[GRID_SIZE] = world_height;
+    partition(grid->row, 0, GRID_SIZE, 0, world_height);
 
-bool point_belongs_to_rect(sectorrect_t r, int x, int y)
-{
-    return r.left <= x && x <= r.right && r.top <= y && y <= r.bottom;
+    /* done */
+    return true;
 }
 
-bool is_leaf_sector(int index)
+/* given cells [first, last) spanning coordinates [begin, end),
+   compute the borders of the cells as if we were subdividing the sectors */
+void partition(int* border, int first, int last, int begin, int end)
 {
-    /*
-
-    Each level d >= 0 of the Entity Tree has 4^d sectors indexed from first_d to
-    last_d, inclusive. Clearly, level 0 has only one node, the root, and hence
-    first_0 = last_d = 0. Since indices are always incremented by one, it follows
-    that first_d = last_(d-1) + 1 for d > 0. Since level d has 4^d sectors, we have
-    last_d - first_d + 1 = 4^d, or alternatively, last_d = last_(d-1) + 4^d for d > 0.
-    We use these equations to establish the following recurrence formula:
-
-    l_d = { l_(d-1) + 4^d      if d > 0
-          { 0                  if d = 0
-
-    We solve analytically and find l_d = (4/3) * (4^d - 1) for d >= 0.
+    if(last - first <= 1)
+        return;
 
-    If the Entity Tree has height H, then a sector is a leaf if its index is
-    between first_H and last_H, inclusive. It's then easy to see that a sector
-    is a leaf if:
+    /* the topleft and the bottomleft subsectors have width ceil(w/2);
+       the analogous holds for the heights */
+    int middle = (first + last) / 2;
+    border[middle] = begin + (end - begin + 1) / 2;
 
-    index > last_(H-1) = (4/3) * (4^(H-1) - 1)
-
-    No invalid indices are provided as input (i.e., we assume index <= last_H).
-
-    */
-    const int last = 4 * (((1 << (2 * (TREE_HEIGHT - 1))) - 1) / 3);
-
-    return index > last;
+    partition(border, first, middle, begin, border[middle]);
+    partition(border, middle, last, border[middle], end);
 }
 
-sector_t* sector_ctor(int index, int world_width, int world_height)
+/* find the index of the cell (row or column) that contains the given coordinate,
+   assumed to be within the bounds of the world */
+int find_cell(const int* border, int coordinate)
 {
-    sector_t* sector = mallocx(sizeof *sector);
-    bool is_leaf = is_leaf_sector(index);
-
-    sector->index = index;
-    sector->addr = find_sector_address(index);
-
-    sector->vt = is_leaf ? &LEAF_VTABLE : &NONLEAF_VTABLE;
-    sector->flags = is_leaf ? SECTOR_IS_LEAF : 0;
+    int lo = 0, hi = GRID_SIZE;
 
-    sector->cached_world_width = 0;
-    sector->cached_world_height = 0;
-    sector->cached_rect = (sectorrect_t){ 0, 0, 0, 0 };
+    /* binary search: border[lo] <= coordinate < border[hi] */
+    while(hi - lo > 1) {
+        int mid = (lo + hi) / 2;
 
-    if(!is_leaf) {
-        for(int j = 0; j < 4; j++) {
-            int child_index = 1 + 4 * index + j;
-            sector->child[j].index = child_index;
-            sector->child[j].addr = find_sector_address(child_index);
-            sector->child[j].cached_rect = (sectorrect_t){ 0, 0, 0, 0 };
-        }
-    }
-    else {
-        /* fill with valid values */
-        for(int j = 0; j < 4; j++) {
-            sector->child[j].index = sector->index;
-            sector->child[j].addr = sector->addr;
-            sector->child[j].cached_rect = sector->cached_rect;
-        }
+        if(coordinate < border[mid])
+            hi = mid;
+        else
+            lo = mid;
     }
 
-    sector_update_rect(sector, world_width, world_height);
-    return sector;
+    return lo;
 }
 
-sector_t* sector_dtor(sector_t* sector)
+bool range_contains(sectorrange_t range, int row, int column)
 {
-    free(sector);
-    return NULL;
+    return range.first_row <= row && row <= range.last_row && range.first_column <= column && column <= range.last_column;
 }
 
-bool sector_update_rect(sector_t* sector, int world_width, int world_height)
+bool range_changed(sectorrange_t a, sectorrange_t b)
 {
-    /* is the world too small? */
-    if(world_width < MIN_WORLD_WIDTH)
-        world_width = MIN_WORLD_WIDTH;
-    if(world_height < MIN_WORLD_HEIGHT)
-        world_height = MIN_WORLD_HEIGHT;
-
-    /* update only if needed */
-    if(world_width != sector->cached_world_width || world_height != sector->cached_world_height) {
-        sector->cached_world_width = world_width;
-        sector->cached_world_height = world_height;
-        sector->cached_rect = find_sector_rect(sector->addr, world_width, world_height);
-
-        if(!(sector->flags & SECTOR_IS_LEAF)) {
-            for(int j = 0; j < 4; j++)
-                sector->child[j].cached_rect = find_sector_rect(sector->child[j].addr, world_width, world_height);
-        }
-        else {
-            for(int j = 0; j < 4; j++)
-                sector->child[j].cached_rect = sector->cached_rect;
-        }
-
-        return true;
-    }
-
-    /* no need to update */
-    return false;
+    return a.first_row != b.first_row || a.last_row != b.last_row || a.first_column != b.first_column || a.last_column != b.last_column;
 }
 
-sector_t* safe_get_sector(surgescript_object_t* tree_node)
+/* find the index of the leaf sector an entity belongs to */
+int find_leaf_sector(const sectorgrid_t* grid, surgescript_object_t* entity)
 {
-    const char* object_name = surgescript_object_name(tree_node);
-
-    if(0 == strcmp(object_name, "EntityTree") || 0 == strcmp(object_name, "EntityTreeLeaf"))
-        return unsafe_get_sector(tree_node);
+    v2d_t position = get_clipped_position(entity, grid->world_width, grid->world_height);
+    int row = find_cell(grid->row, (int)position.y);
+    int column = find_cell(grid->column, (int)position.x);
 
-    /* this shouldn't happen */
-    scripting_error(tree_node, "Can't get EntityTree sector of %s", object_name);
-    return NULL;
+    return row * GRID_SIZE + column;
 }
 
-surgescript_objecthandle_t spawn_child(surgescript_object_t* parent, sectorquadrant_t quadrant)
+/* spawn the EntityContainer of a leaf sector */
+surgescript_objecthandle_t spawn_container(surgescript_object_t* entity_tree, int leaf)
 {
-    const sector_t* parent_sector = unsafe_get_sector(parent);
-    int world_width = parent_sector->cached_world_width;
-    int world_height = parent_sector->cached_world_height;
+    surgescript_objectmanager_t* manager = surgescript_object_manager(entity_tree);
+    surgescript_objecthandle_t tree_handle = surgescript_object_handle(entity_tree);
+    surgescript_objecthandle_t container_handle = surgescript_objectmanager_spawn(manager, tree_handle, "EntityContainer", NULL);
+
+    sectorgrid_t* grid = get_grid(entity_tree);
 
-    int child_index = 1 + 4 * parent_sector->index + quadrant; /* quadrant = 0, 1, 2, 3 */
-    sector_t* child_sector = sector_ctor(child_index, world_width, world_height);
-    const char* child_name = (child_sector->flags & SECTOR_IS_LEAF) ? "EntityTreeLeaf" : "EntityTree";
+    /* a new leaf sector is awake only if it intersects with the ROI */
+    surgescript_object_t* container = surgescript_objectmanager_get(manager, container_handle);
+    bool is_awake = range_contains(grid->awake, leaf / GRID_SIZE, leaf % GRID_SIZE);
+    surgescript_object_set_active(container, is_awake);
 
-    surgescript_objectmanager_t* manager = surgescript_object_manager(parent);
-    surgescript_objecthandle_t parent_handle = surgescript_object_handle(parent);
-    surgescript_objecthandle_t child_handle = surgescript_objectmanager_spawn(manager, parent_handle, child_name, child_sector);
+    /* the container must be added to the output array of update_roi */
+    if(is_awake)
+        grid->awake_changed = true;
 
-    return child_handle;
+    return container_handle;
 }
 
 v2d_t get_clipped_position(surgescript_object_t* entity, float world_width, float world_height)
@@ -1182,4 +943,4 @@ v2d_t get_clipped_position(surgescript_object_t* entity, float world_width, floa
     }
 
     return v2d_new(x, y);
-}
\ No newline at end of file
+}
@@ -19,6 +19,7 @@
  */
 
 #include <surgescript.h>
+#include "scripting.h"
 #include "../core/config.h"
 
 /* private */
@@ -20,6 +20,7 @@
 
 #include <surgescript.h>
 #include <stdint.h>
+#include "scripting.h"
 #include "../util/djb2.h"
 #include "../core/video.h"
 #include "../core/input.h"
@@ -32,6 +32,8 @@
 #include "../scenes/quest.h"
 #include "../entities/player.h"
 #include "../entities/background.h"
+#include "../entities/waterfx.h"
+#include "../entities/triggervolume.h"
 
 /* private */
 static surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
@@ -39,9 +41,17 @@ static surgescript_var_t* fun_destructor(surgescript_object_t* object, const sur
 static surgescript_var_t* fun_main(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_spawn(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_spawnentity(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_spawnentities(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_destroy(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_getwaterlevel(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_setwaterlevel(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_addwaterregion(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_removewaterregion(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_clearwaterregions(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_isunderwater(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_addtrigger(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_removetrigger(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static void notify_trigger_listener(int volume_id, player_t* player, bool entered, void* context);
 static surgescript_var_t* fun_getspawnpoint(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_setspawnpoint(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_getcleared(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
@@ -55,6 +65,7 @@ static surgescript_var_t* fun_getfile(surgescript_object_t* object, const surges
 static surgescript_var_t* fun_getbgtheme(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_getbackground(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_setbackground(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_prefetchbackground(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_getmusic(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_getgravity(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_gettime(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
@@ -88,6 +99,9 @@ static surgescript_var_t* fun_getplayermanager(surgescript_object_t* object, con
 static surgescript_var_t* fun_registersetupobjectname(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_spawnsetupobjects(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_spawnassetupobject(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_capturesnapshot(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_rewind(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_registersnapshotfield(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static const surgescript_heapptr_t MUSIC_ADDR = 0; /* Level.music */
 static const surgescript_heapptr_t SPAWNPOINT_ADDR = 1; /* Level.spawnpoint */
 static const surgescript_heapptr_t SETUPFUNCTOR_ADDR = 2; /* object "LevelSetupFunctor" */
@@ -138,6 +152,7 @@ void scripting_register_level(surgescript_vm_t* vm)
     surgescript_vm_bind(vm, "Level", "destructor", fun_destructor, 0);
     surgescript_vm_bind(vm, "Level", "spawn", fun_spawn, 1);
     surgescript_vm_bind(vm, "Level", "spawnEntity", fun_spawnentity, 2);
+    surgescript_vm_bind(vm, "Level", "spawnEntities", fun_spawnentities, 2);
     surgescript_vm_bind(vm, "Level", "destroy", fun_destroy, 0);
     surgescript_vm_bind(vm, "Level", "get_name", fun_getname, 0);
     surgescript_vm_bind(vm, "Level", "get_act", fun_getact, 0);
@@ -154,10 +169,17 @@ void scripting_register_level(surgescript_vm_t* vm)
     surgescript_vm_bind(vm, "Level", "get_bgtheme", fun_getbgtheme, 0);
     surgescript_vm_bind(vm, "Level", "set_waterlevel", fun_setwaterlevel, 1);
     surgescript_vm_bind(vm, "Level", "get_waterlevel", fun_getwaterlevel, 0);
+    surgescript_vm_bind(vm, "Level", "addWaterRegion", fun_addwaterregion, 4);
+    surgescript_vm_bind(vm, "Level", "removeWaterRegion", fun_removewaterregion, 1);
+    surgescript_vm_bind(vm, "Level", "clearWaterRegions", fun_clearwaterregions, 0);
+    surgescript_vm_bind(vm, "Level", "isUnderwater", fun_isunderwater, 1);
+    surgescript_vm_bind(vm, "Level", "addTrigger", fun_addtrigger, 5);
+    surgescript_vm_bind(vm, "Level", "removeTrigger", fun_removetrigger, 1);
     surgescript_vm_bind(vm, "Level", "set_spawnpoint", fun_setspawnpoint, 1);
     surgescript_vm_bind(vm, "Level", "get_spawnpoint", fun_getspawnpoint, 0);
     surgescript_vm_bind(vm, "Level", "set_background", fun_setbackground, 1);
     surgescript_vm_bind(vm, "Level", "get_background", fun_getbackground, 0);
+    surgescript_vm_bind(vm, "Level", "prefetchBackground", fun_prefetchbackground, 1);
     surgescript_vm_bind(vm, "Level", "set_next", fun_setnext, 1);
     surgescript_vm_bind(vm, "Level", "get_next", fun_getnext, 0);
     surgescript_vm_bind(vm, "Level", "set_onUnload", fun_setonunload, 1);
@@ -177,6 +199,9 @@ void scripting_register_level(surgescript_vm_t* vm)
     surgescript_vm_bind(vm, "Level", "findEntities", fun_findentities, 1);
     surgescript_vm_bind(vm, "Level", "activeEntities", fun_activeentities, 0);
     surgescript_vm_bind(vm, "Level", "setup", fun_setup, 1);
+    surgescript_vm_bind(vm, "Level", "captureSnapshot", fun_capturesnapshot, 0);
+    surgescript_vm_bind(vm, "Level", "rewind", fun_rewind, 1);
+    surgescript_vm_bind(vm, "Level", "registerSnapshotField", fun_registersnapshotfield, 2);
     surgescript_vm_bind(vm, "Level", "get_debugMode", fun_get_debugmode, 0);
     surgescript_vm_bind(vm, "Level", "set_debugMode", fun_set_debugmode, 1);
     surgescript_vm_bind(vm, "Level", "__onLoad", fun_onload, 0);
@@ -476,6 +501,19 @@ surgescript_var_t* fun_spawnentity(surgescript_object_t* object, const surgescri
     return new_entity_var;
 }
 
+/* spawn many entities at once, given an array of names and an array of positions in world coordinates */
+surgescript_var_t* fun_spawnentities(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_var_t* new_entities_var = surgescript_var_create();
+
+    /* delegate to entityManager.spawnEntities() */
+    surgescript_object_t* entity_manager = get_entity_manager(object);
+    surgescript_object_call_function(entity_manager, "spawnEntities", param, 2, new_entities_var);
+
+    /* done! */
+    return new_entities_var;
+}
+
 /* can't destroy this object */
 surgescript_var_t* fun_destroy(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
@@ -503,6 +541,95 @@ surgescript_var_t* fun_setwaterlevel(surgescript_object_t* object, const surgesc
     return NULL;
 }
 
+/* add a rectangular region of water: give its top-left corner (its top is
+   the level of the water), its width and its height, in pixels. Returns an ID */
+surgescript_var_t* fun_addwaterregion(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    int x = (int)surgescript_var_get_number(param[0]);
+    int y = (int)surgescript_var_get_number(param[1]);
+    int width = (int)surgescript_var_get_number(param[2]);
+    int height = (int)surgescript_var_get_number(param[3]);
+    int region_id = waterfx_add_region(x, y, width, height);
+
+    return surgescript_var_set_number(surgescript_var_create(), region_id);
+}
+
+/* remove a region of water, given its ID. Returns true on success */
+surgescript_var_t* fun_removewaterregion(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    int region_id = (int)surgescript_var_get_number(param[0]);
+    bool success = waterfx_remove_region(region_id);
+
+    return surgescript_var_set_bool(surgescript_var_create(), success);
+}
+
+/* remove all regions of water */
+surgescript_var_t* fun_clearwaterregions(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    waterfx_clear_regions();
+    return NULL;
+}
+
+/* is the given position (a Vector2 in world space) below the waterlevel or inside a region of water? */
+surgescript_var_t* fun_isunderwater(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
+    surgescript_objecthandle_t handle = surgescript_var_get_objecthandle(param[0]);
+    v2d_t position = scripting_vector2_to_v2d(surgescript_objectmanager_get(manager, handle));
+
+    return surgescript_var_set_bool(surgescript_var_create(), level_is_underwater(position));
+}
+
+/* add a trigger volume (a rectangle in world space), returning its ID. Whenever a
+   player enters or exits it, the listener's onTriggerEnter(playerName, triggerId) or
+   onTriggerExit(playerName, triggerId) will be called, if the listener still exists */
+surgescript_var_t* fun_addtrigger(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    int x = (int)surgescript_var_get_number(param[0]);
+    int y = (int)surgescript_var_get_number(param[1]);
+    int width = (int)surgescript_var_get_number(param[2]);
+    int height = (int)surgescript_var_get_number(param[3]);
+    surgescript_objecthandle_t listener = surgescript_var_get_objecthandle(param[4]);
+    int volume_id = triggervolume_add(x, y, width, height, notify_trigger_listener, (void*)(uintptr_t)listener);
+
+    return surgescript_var_set_number(surgescript_var_create(), volume_id);
+}
+
+/* remove a trigger volume, given its ID. Returns true on success */
+surgescript_var_t* fun_removetrigger(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    int volume_id = (int)surgescript_var_get_number(param[0]);
+    bool success = triggervolume_remove(volume_id);
+
+    return surgescript_var_set_bool(surgescript_var_create(), success);
+}
+
+/* calls onTriggerEnter() or onTriggerExit() on the listener of a trigger volume */
+void notify_trigger_listener(int volume_id, player_t* player, bool entered, void* context)
+{
+    surgescript_objecthandle_t handle = (surgescript_objecthandle_t)(uintptr_t)context;
+    surgescript_vm_t* vm = surgescript_vm();
+    surgescript_objectmanager_t* manager = surgescript_vm_objectmanager(vm);
+    const char* fun_name = entered ? "onTriggerEnter" : "onTriggerExit";
+
+    if(!surgescript_objectmanager_exists(manager, handle)) {
+        triggervolume_remove(volume_id); /* the listener is gone */
+        return;
+    }
+
+    surgescript_object_t* listener = surgescript_objectmanager_get(manager, handle);
+    if(surgescript_object_has_function(listener, fun_name)) {
+        surgescript_var_t* name = surgescript_var_set_string(surgescript_var_create(), player_name(player));
+        surgescript_var_t* trigger_id = surgescript_var_set_number(surgescript_var_create(), volume_id);
+        const surgescript_var_t* args[] = { name, trigger_id };
+
+        surgescript_object_call_function(listener, fun_name, args, 2, NULL);
+
+        surgescript_var_destroy(trigger_id);
+        surgescript_var_destroy(name);
+    }
+}
+
 /* get the spawn point, a Vector2 */
 surgescript_var_t* fun_getspawnpoint(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
@@ -546,6 +673,17 @@ surgescript_var_t* fun_setbackground(surgescript_object_t* object, const surgesc
     return NULL;
 }
 
+/* decode the images of a background in advance, so that changing to it later doesn't stall the game */
+surgescript_var_t* fun_prefetchbackground(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    const char* path = surgescript_var_fast_get_string(param[0]);
+
+    if(str_icmp(path, background_filepath(level_background())) != 0)
+        background_prefetch(path);
+
+    return NULL;
+}
+
 /* get the original background of the level */
 surgescript_var_t* fun_getbgtheme(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
@@ -801,6 +939,37 @@ surgescript_var_t* fun_findentities(surgescript_object_t* object, const surgescr
     return ret;
 }
 
+/* captures the state of the level into a ring buffer of recent states */
+surgescript_var_t* fun_capturesnapshot(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    level_capture_snapshot();
+    return NULL;
+}
+
+/* rewinds the level to a recent state (1 is the latest snapshot). Returns the number of steps rewound */
+surgescript_var_t* fun_rewind(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    int steps = surgescript_var_get_number(param[0]);
+    return surgescript_var_set_number(surgescript_var_create(), level_rewind(steps));
+}
+
+/* includes a property of an entity (e.g., "hp") in the snapshots of the level. The entity must have an ID */
+surgescript_var_t* fun_registersnapshotfield(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
+    surgescript_objecthandle_t handle = surgescript_var_get_objecthandle(param[0]);
+    bool success = false;
+
+    if(surgescript_objectmanager_exists(manager, handle)) {
+        surgescript_object_t* entity = surgescript_objectmanager_get(manager, handle);
+        char* field_name = surgescript_var_get_string(param[1], manager);
+        success = level_register_snapshot_field(entity, field_name);
+        ssfree(field_name);
+    }
+
+    return surgescript_var_set_bool(surgescript_var_create(), success);
+}
+
 /* get active entities: those that are inside the region of interest, as well as the awake (and detached) ones */
 surgescript_var_t* fun_activeentities(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
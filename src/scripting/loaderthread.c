@@ -25,6 +25,7 @@
 #include <stdbool.h>
 #include "scripting.h"
 #include "../core/logfile.h"
+#include "../core/trace.h"
 #include "../util/util.h"
 #include "../util/stringutil.h"
 
@@ -125,7 +126,9 @@ void* load_surgescript(ALLEGRO_THREAD* thread, void* arg)
     /* save the calling environment */
     if(!setjmp(((ssthreadcontext_t*)arg)->env)) {
         /* load scripts */
+        int phase = trace_begin_async("scripting_init");
         scripting_init(ctx->argc, (const char**)(ctx->argv));
+        trace_end_async(phase);
     }
     else {
         /* we'll exit the thread with a non-blank ctx->error_message */
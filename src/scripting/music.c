@@ -20,6 +20,7 @@
 
 #include <surgescript.h>
 #include <string.h>
+#include "scripting.h"
 #include "../util/util.h"
 #include "../core/audio.h"
 
@@ -29,6 +30,7 @@ static surgescript_var_t* fun_init(surgescript_object_t* object, const surgescri
 static surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_destructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_play(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_crossfade(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_stop(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_pause(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_setvolume(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
@@ -50,6 +52,7 @@ void scripting_register_music(surgescript_vm_t* vm)
     surgescript_vm_bind(vm, "Music", "constructor", fun_constructor, 0);
     surgescript_vm_bind(vm, "Music", "destructor", fun_destructor, 0);
     surgescript_vm_bind(vm, "Music", "play", fun_play, 0);
+    surgescript_vm_bind(vm, "Music", "crossfade", fun_crossfade, 1);
     surgescript_vm_bind(vm, "Music", "stop", fun_stop, 0);
     surgescript_vm_bind(vm, "Music", "pause", fun_pause, 0);
     surgescript_vm_bind(vm, "Music", "set_volume", fun_setvolume, 1);
@@ -145,6 +148,24 @@ surgescript_var_t* fun_play(surgescript_object_t* object, const surgescript_var_
     return NULL;
 }
 
+/* plays the music (once), crossfading it with the current music during the given number of seconds */
+surgescript_var_t* fun_crossfade(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    music_t* music = get_music(object);
+    double volume = get_volume(object);
+    double seconds = surgescript_var_get_number(param[0]);
+
+    if(music != NULL) {
+        if(music_current() == music && music_is_paused())
+            music_resume(music);
+        else
+            music_crossfade(music, false, seconds);
+        music_set_volume(volume);
+    }
+
+    return NULL;
+}
+
 /* stops the music */
 surgescript_var_t* fun_stop(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
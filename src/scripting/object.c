@@ -20,6 +20,7 @@
 
 #include <string.h>
 #include <surgescript.h>
+#include "scripting.h"
 #include "../core/video.h"
 #include "../core/logfile.h"
 
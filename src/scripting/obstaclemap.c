@@ -18,18 +18,31 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
 #include <surgescript.h>
+#include "scripting.h"
 #include "../core/video.h"
+#include "../core/engine.h"
 #include "../physics/obstacle.h"
 #include "../physics/obstaclemap.h"
+#include "../physics/collisionmask.h"
 #include "../scenes/level.h"
+#include "../util/arena.h"
+#include "../util/util.h"
 
 /* private */
 #define STORE_EMPTY_OBSTACLEMAP 0
 static surgescript_var_t* fun_main(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_destructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_probe(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_scancolumn(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_occupancy(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 const obstaclemap_t* scripting_obstaclemap_ptr(const surgescript_object_t* object);
+static obstaclelayer_t read_layer(const surgescript_object_t* object, const surgescript_var_t* layer);
+static surgescript_var_t* spawn_array_of_bools(surgescript_object_t* object, const bool* value, int count);
+static const int MAX_PROBES = 1024; /* per call */
+static const int MAX_OCCUPANCY_CELLS = 4096; /* per call */
 
 /*
  * scripting_register_obstaclemap()
@@ -40,6 +53,9 @@ void scripting_register_obstaclemap(surgescript_vm_t* vm)
     surgescript_vm_bind(vm, "ObstacleMap", "state:main", fun_main, 0);
     surgescript_vm_bind(vm, "ObstacleMap", "constructor", fun_constructor, 0);
     surgescript_vm_bind(vm, "ObstacleMap", "destructor", fun_destructor, 0);
+    surgescript_vm_bind(vm, "ObstacleMap", "probe", fun_probe, 2);
+    surgescript_vm_bind(vm, "ObstacleMap", "scanColumn", fun_scancolumn, 4);
+    surgescript_vm_bind(vm, "ObstacleMap", "occupancy", fun_occupancy, 6);
 }
 
 
@@ -98,4 +114,152 @@ surgescript_var_t* fun_destructor(surgescript_object_t* object, const surgescrip
     surgescript_object_set_userdata(object, NULL);
     return NULL;
 #endif
-}
\ No newline at end of file
+}
+
+/* checks which of the given points, an Array of Vector2 objects in world space,
+   have solid obstacles in a layer ("default", "green" or "yellow"). Returns
+   an Array of booleans of the same length */
+surgescript_var_t* fun_probe(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
+    surgescript_objecthandle_t points_handle = surgescript_var_get_objecthandle(param[0]);
+    obstaclelayer_t layer = read_layer(object, param[1]);
+    const obstaclemap_t* obstaclemap = scripting_obstaclemap_ptr(object);
+
+    /* validate the input */
+    if(!surgescript_objectmanager_exists(manager, points_handle))
+        return spawn_array_of_bools(object, NULL, 0);
+
+    surgescript_object_t* points = surgescript_objectmanager_get(manager, points_handle);
+    if(strcmp(surgescript_object_name(points), "Array") != 0)
+        return spawn_array_of_bools(object, NULL, 0);
+
+    /* read the points */
+    surgescript_var_t* length = surgescript_var_create();
+    surgescript_object_call_function(points, "get_length", NULL, 0, length);
+    int count = clip((int)surgescript_var_get_number(length), 0, MAX_PROBES);
+    surgescript_var_destroy(length);
+
+    obstaclemap_point_t* point = arena_alloc(engine_frame_arena(), (1 + count) * sizeof(*point));
+    surgescript_var_t* index = surgescript_var_create();
+    surgescript_var_t* element = surgescript_var_create();
+    const surgescript_var_t* args[] = { index };
+
+    for(int i = 0; i < count; i++) {
+        double x = 0.0, y = 0.0;
+
+        surgescript_var_set_number(index, i);
+        surgescript_object_call_function(points, "get", args, 1, element);
+
+        surgescript_objecthandle_t handle = surgescript_var_get_objecthandle(element);
+        if(surgescript_objectmanager_exists(manager, handle))
+            scripting_vector2_read(surgescript_objectmanager_get(manager, handle), &x, &y);
+
+        point[i].x = (int)x;
+        point[i].y = (int)y;
+    }
+
+    surgescript_var_destroy(element);
+    surgescript_var_destroy(index);
+
+    /* query all points at once */
+    bool* is_solid = arena_alloc(engine_frame_arena(), (1 + count) * sizeof(*is_solid));
+    if(obstaclemap != NULL)
+        obstaclemap_solids_exist(obstaclemap, point, count, layer);
+
+    for(int i = 0; i < count; i++)
+        is_solid[i] = (obstaclemap != NULL) && point[i].is_solid;
+
+    return spawn_array_of_bools(object, is_solid, count);
+}
+
+/* scans the column x from y1 towards y2 and returns the y coordinate of the
+   first solid pixel, or null if there is none */
+surgescript_var_t* fun_scancolumn(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    int x = (int)surgescript_var_get_number(param[0]);
+    int y1 = (int)surgescript_var_get_number(param[1]);
+    int y2 = (int)surgescript_var_get_number(param[2]);
+    obstaclelayer_t layer = read_layer(object, param[3]);
+    const obstaclemap_t* obstaclemap = scripting_obstaclemap_ptr(object);
+    int ground_position = 0;
+
+    if(obstaclemap == NULL)
+        return surgescript_var_set_null(surgescript_var_create());
+
+    /* the first solid pixel of the column is the tallest ground,
+       with gravity pointing from y1 towards y2 */
+    grounddir_t ground_direction = (y2 >= y1) ? GD_DOWN : GD_UP;
+    if(obstaclemap_find_ground(obstaclemap, x, min(y1, y2), x, max(y1, y2), layer, ground_direction, &ground_position) == NULL)
+        return surgescript_var_set_null(surgescript_var_create());
+
+    /* the ground may begin before y1 */
+    ground_position = (y2 >= y1) ? max(ground_position, y1) : min(ground_position, y1);
+    return surgescript_var_set_number(surgescript_var_create(), ground_position);
+}
+
+/* computes an occupancy bitmap of the region of the world starting at (x,y),
+   divided into columns x rows square cells of the given size. Returns an
+   Array of booleans in row-major order: a cell is true if a solid obstacle
+   overlaps it */
+surgescript_var_t* fun_occupancy(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    int x = (int)surgescript_var_get_number(param[0]);
+    int y = (int)surgescript_var_get_number(param[1]);
+    int columns = max(0, (int)surgescript_var_get_number(param[2]));
+    int rows = max(0, (int)surgescript_var_get_number(param[3]));
+    int cell_size = max(1, (int)surgescript_var_get_number(param[4]));
+    obstaclelayer_t layer = read_layer(object, param[5]);
+    const obstaclemap_t* obstaclemap = scripting_obstaclemap_ptr(object);
+
+    /* validate the input */
+    if(columns == 0 || rows == 0)
+        return spawn_array_of_bools(object, NULL, 0);
+    else if(columns * rows > MAX_OCCUPANCY_CELLS || columns > MAX_OCCUPANCY_CELLS || rows > MAX_OCCUPANCY_CELLS) {
+        scripting_warning(object, "ObstacleMap.occupancy(): can't query more than %d cells at once", MAX_OCCUPANCY_CELLS);
+        return spawn_array_of_bools(object, NULL, 0);
+    }
+
+    /* query the region */
+    bool* grid = arena_alloc(engine_frame_arena(), columns * rows * sizeof(*grid));
+    if(obstaclemap != NULL)
+        obstaclemap_solid_grid(obstaclemap, x, y, columns, rows, cell_size, layer, grid);
+    else
+        memset(grid, 0, columns * rows * sizeof(*grid));
+
+    return spawn_array_of_bools(object, grid, columns * rows);
+}
+
+/* read the name of an obstacle layer */
+obstaclelayer_t read_layer(const surgescript_object_t* object, const surgescript_var_t* layer)
+{
+    char* layer_name = surgescript_var_get_string(layer, surgescript_object_manager(object));
+    obstaclelayer_t obstacle_layer = OL_DEFAULT;
+
+    if(strcmp(layer_name, "green") == 0)
+        obstacle_layer = OL_GREEN;
+    else if(strcmp(layer_name, "yellow") == 0)
+        obstacle_layer = OL_YELLOW;
+
+    ssfree(layer_name);
+    return obstacle_layer;
+}
+
+/* spawn a SurgeScript Array with the given booleans */
+surgescript_var_t* spawn_array_of_bools(surgescript_object_t* object, const bool* value, int count)
+{
+    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
+    surgescript_objecthandle_t array_handle = surgescript_objectmanager_spawn_array(manager);
+    surgescript_object_t* array = surgescript_objectmanager_get(manager, array_handle);
+
+    surgescript_var_t* element = surgescript_var_create();
+    const surgescript_var_t* args[] = { element };
+
+    for(int i = 0; i < count; i++) {
+        surgescript_var_set_bool(element, value[i]);
+        surgescript_object_call_function(array, "push", args, 1, NULL);
+    }
+
+    /* reuse the temporary variable to return the array */
+    return surgescript_var_set_objecthandle(element, array_handle);
+}
@@ -20,6 +20,7 @@
 
 #include <surgescript.h>
 #include <allegro5/allegro.h>
+#include "scripting.h"
 
 /* private */
 static surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
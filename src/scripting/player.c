@@ -23,6 +23,7 @@
 #include <math.h>
 #include "scripting.h"
 #include "../core/logfile.h"
+#include "../core/timer.h"
 #include "../util/numeric.h"
 #include "../util/darray.h"
 #include "../util/util.h"
@@ -82,6 +83,7 @@ static surgescript_var_t* fun_getbreathing(surgescript_object_t* object, const s
 static surgescript_var_t* fun_getcrouchingdown(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_getlookingup(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_getwinning(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_getsnapshot(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 
 /* read-write properties */
 static surgescript_var_t* fun_getshield(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
@@ -179,7 +181,8 @@ static const surgescript_heapptr_t ANIMATION_ADDR = 3;
 static const surgescript_heapptr_t INPUT_ADDR = 4;
 static const surgescript_heapptr_t MOVEBYDX_ADDR = 5;
 static const surgescript_heapptr_t MOVEBYDY_ADDR = 6;
-static const surgescript_heapptr_t COMPANION_BASE_ADDR = 7; /* must be the last address of Player */
+static const surgescript_heapptr_t SNAPSHOT_ADDR = 7;
+static const surgescript_heapptr_t COMPANION_BASE_ADDR = 8; /* must be the last address of Player */
 
 static inline player_t* get_player(const surgescript_object_t* object);
 static inline surgescript_object_t* get_collider(surgescript_object_t* object);
@@ -196,6 +199,68 @@ static void init_animation(surgescript_object_t* animation, const char* sprite_n
 static bool is_removed_companion(const surgescript_objectmanager_t* manager, surgescript_objecthandle_t handle);
 #define FIXANG(rad) ((rad) >= 0.0 ? (rad) * RAD2DEG : 360.0 + (rad) * RAD2DEG)
 
+/*
+ * PlayerSnapshot: a read-only view of the state of a Player, refreshed
+ * at most once per frame when player.snapshot is read. Reading a field
+ * of the snapshot is a cheap heap access, not a query to the player_t.
+ * X(property, getter of Player)
+ */
+#define PLAYERSNAPSHOT_FIELDS(X) \
+    X(name, fun_getname) \
+    X(direction, fun_getdirection) \
+    X(angle, fun_getangle) \
+    X(slope, fun_getslope) \
+    X(speed, fun_getspeed) \
+    X(gsp, fun_getgsp) \
+    X(xsp, fun_getxsp) \
+    X(ysp, fun_getysp) \
+    X(attacking, fun_getattacking) \
+    X(midair, fun_getmidair) \
+    X(blinking, fun_getblinking) \
+    X(dying, fun_getdying) \
+    X(stopped, fun_getstopped) \
+    X(walking, fun_getwalking) \
+    X(running, fun_getrunning) \
+    X(waiting, fun_getwaiting) \
+    X(jumping, fun_getjumping) \
+    X(springing, fun_getspringing) \
+    X(rolling, fun_getrolling) \
+    X(charging, fun_getcharging) \
+    X(pushing, fun_getpushing) \
+    X(hit, fun_gethit) \
+    X(braking, fun_getbraking) \
+    X(balancing, fun_getbalancing) \
+    X(drowning, fun_getdrowning) \
+    X(breathing, fun_getbreathing) \
+    X(crouchingDown, fun_getcrouchingdown) \
+    X(lookingUp, fun_getlookingup) \
+    X(winning, fun_getwinning) \
+    X(underwater, fun_getunderwater) \
+    X(secondsToDrown, fun_getsecondstodrown) \
+    X(shield, fun_getshield) \
+    X(invincible, fun_getinvincible) \
+    X(turbo, fun_getturbo) \
+    X(frozen, fun_getfrozen) \
+    X(collectibles, fun_getcollectibles) \
+    X(lives, fun_getlives) \
+    X(score, fun_getscore)
+
+#define SNAPSHOT_FIELD_ADDR(property, getter) SNAPSHOT_##property##_ADDR,
+enum {
+    SNAPSHOT_FRAME_ADDR = 0, /* frame of the last refresh */
+    PLAYERSNAPSHOT_FIELDS(SNAPSHOT_FIELD_ADDR)
+    SNAPSHOT_FIELD_COUNT
+};
+#undef SNAPSHOT_FIELD_ADDR
+
+#define DECLARE_SNAPSHOT_GETTER(property, getter) \
+    static surgescript_var_t* fun_snapshot_get_##property(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+PLAYERSNAPSHOT_FIELDS(DECLARE_SNAPSHOT_GETTER)
+#undef DECLARE_SNAPSHOT_GETTER
+
+static surgescript_var_t* fun_snapshot_constructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static void refresh_snapshot(surgescript_object_t* object, surgescript_object_t* snapshot);
+
 
 /*
  * scripting_register_player()
@@ -245,6 +310,7 @@ void scripting_register_player(surgescript_vm_t* vm)
     surgescript_vm_bind(vm, "Player", "get_crouchingDown", fun_getcrouchingdown, 0);
     surgescript_vm_bind(vm, "Player", "get_lookingUp", fun_getlookingup, 0);
     surgescript_vm_bind(vm, "Player", "get_winning", fun_getwinning, 0);
+    surgescript_vm_bind(vm, "Player", "get_snapshot", fun_getsnapshot, 0);
 
     /* read-write properties */
     surgescript_vm_bind(vm, "Player", "get_shield", fun_getshield, 0);
@@ -338,6 +404,13 @@ void scripting_register_player(surgescript_vm_t* vm)
     surgescript_vm_bind(vm, "Player", "destroy", fun_destroy, 0);
     surgescript_vm_bind(vm, "Player", "lateUpdate", fun_lateupdate, 0);
     surgescript_vm_bind(vm, "Player", "__init", fun_init, 1);
+
+    /* PlayerSnapshot */
+    #define BIND_SNAPSHOT_GETTER(property, getter) \
+        surgescript_vm_bind(vm, "PlayerSnapshot", "get_" #property, fun_snapshot_get_##property, 0);
+    PLAYERSNAPSHOT_FIELDS(BIND_SNAPSHOT_GETTER)
+    #undef BIND_SNAPSHOT_GETTER
+    surgescript_vm_bind(vm, "PlayerSnapshot", "constructor", fun_snapshot_constructor, 0);
     surgescript_vm_bind(vm, "Player", "__releaseChildren", fun_unload, 0);
     surgescript_vm_bind(vm, "Player", "__spawnCompanions", fun_spawncompanions, 0);
     surgescript_vm_bind(vm, "Player", "__destroyCompanions", fun_destroycompanions, 0);
@@ -373,6 +446,7 @@ surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescri
     surgescript_objecthandle_t me = surgescript_object_handle(object);
     surgescript_objecthandle_t transform = surgescript_objectmanager_spawn(manager, me, "Transform", NULL);
     surgescript_objecthandle_t animation = surgescript_objectmanager_spawn(manager, me, "Animation", NULL);
+    surgescript_objecthandle_t snapshot = surgescript_objectmanager_spawn(manager, me, "PlayerSnapshot", NULL);
     surgescript_objecthandle_t parent_handle = surgescript_object_parent(object);
     surgescript_object_t* parent = surgescript_objectmanager_get(manager, parent_handle);
     surgescript_var_t* tmp[5] = {
@@ -390,6 +464,7 @@ surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescri
     ssassert(INPUT_ADDR == surgescript_heap_malloc(heap));
     ssassert(MOVEBYDX_ADDR == surgescript_heap_malloc(heap));
     ssassert(MOVEBYDY_ADDR == surgescript_heap_malloc(heap));
+    ssassert(SNAPSHOT_ADDR == surgescript_heap_malloc(heap));
 
     surgescript_var_set_null(surgescript_heap_at(heap, ID_ADDR));
     surgescript_var_set_objecthandle(surgescript_heap_at(heap, TRANSFORM_ADDR), transform);
@@ -397,6 +472,7 @@ surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescri
     surgescript_var_set_null(surgescript_heap_at(heap, INPUT_ADDR));
     surgescript_var_set_number(surgescript_heap_at(heap, MOVEBYDX_ADDR), 0.0);
     surgescript_var_set_number(surgescript_heap_at(heap, MOVEBYDY_ADDR), 0.0);
+    surgescript_var_set_objecthandle(surgescript_heap_at(heap, SNAPSHOT_ADDR), snapshot);
     surgescript_object_set_userdata(object, NULL);
 
     /* spawn the collider */
@@ -818,6 +894,18 @@ surgescript_var_t* fun_getinput(surgescript_object_t* object, const surgescript_
     return surgescript_var_clone(surgescript_heap_at(heap, INPUT_ADDR));
 }
 
+/* a read-only view of the state of the player, refreshed at most once per frame */
+surgescript_var_t* fun_getsnapshot(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    surgescript_var_t* snapshot_var = surgescript_heap_at(heap, SNAPSHOT_ADDR);
+    surgescript_object_t* snapshot = surgescript_objectmanager_get(manager, surgescript_var_get_objecthandle(snapshot_var));
+
+    refresh_snapshot(object, snapshot);
+    return surgescript_var_clone(snapshot_var);
+}
+
 /* direction is +1 if the player is facing right; -1 if facing left */
 surgescript_var_t* fun_getdirection(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
@@ -1846,6 +1934,7 @@ void update_transform(surgescript_object_t* object, v2d_t position, float angle,
     surgescript_transform_setposition2d(transform, position.x, position.y); /* assuming local position == world position */
     surgescript_transform_setrotation2d(transform, angle); /* in degrees */
     surgescript_transform_setscale2d(transform, scale.x, scale.y);
+    scripting_transform_changed();
 }
 
 /* read the player transform */
@@ -2005,4 +2094,58 @@ bool is_removed_companion(const surgescript_objectmanager_t* manager, surgescrip
     }
 
     return false;
-}
\ No newline at end of file
+}
+
+
+
+/* PlayerSnapshot */
+
+/* constructor */
+surgescript_var_t* fun_snapshot_constructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+
+    for(int i = 0; i < SNAPSHOT_FIELD_COUNT; i++) {
+        ssassert(i == surgescript_heap_malloc(heap));
+        surgescript_var_set_null(surgescript_heap_at(heap, i));
+    }
+
+    surgescript_var_set_number(surgescript_heap_at(heap, SNAPSHOT_FRAME_ADDR), -1);
+    return NULL;
+}
+
+/* getters */
+#define DEFINE_SNAPSHOT_GETTER(property, getter) \
+    surgescript_var_t* fun_snapshot_get_##property(surgescript_object_t* object, const surgescript_var_t** param, int num_params) \
+    { \
+        surgescript_heap_t* heap = surgescript_object_heap(object); \
+        return surgescript_var_clone(surgescript_heap_at(heap, SNAPSHOT_##property##_ADDR)); \
+    }
+PLAYERSNAPSHOT_FIELDS(DEFINE_SNAPSHOT_GETTER)
+#undef DEFINE_SNAPSHOT_GETTER
+
+/* read the state of the player into its snapshot, unless it's been read in this frame */
+void refresh_snapshot(surgescript_object_t* object, surgescript_object_t* snapshot)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(snapshot);
+    surgescript_var_t* frame = surgescript_heap_at(heap, SNAPSHOT_FRAME_ADDR);
+    double current_frame = (double)timer_get_frames();
+
+    if(surgescript_var_get_number(frame) == current_frame)
+        return;
+
+    surgescript_var_set_number(frame, current_frame);
+
+    #define READ_SNAPSHOT_FIELD(property, getter) \
+    do { \
+        surgescript_var_t* value = getter(object, NULL, 0); \
+        if(value != NULL) { \
+            surgescript_var_copy(surgescript_heap_at(heap, SNAPSHOT_##property##_ADDR), value); \
+            surgescript_var_destroy(value); \
+        } \
+        else \
+            surgescript_var_set_null(surgescript_heap_at(heap, SNAPSHOT_##property##_ADDR)); \
+    } while(0);
+    PLAYERSNAPSHOT_FIELDS(READ_SNAPSHOT_FIELD)
+    #undef READ_SNAPSHOT_FIELD
+}
@@ -20,6 +20,7 @@
 
 #include <surgescript.h>
 #include <string.h>
+#include "scripting.h"
 #include "../util/util.h"
 #include "../core/video.h"
 
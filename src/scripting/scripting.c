@@ -19,13 +19,20 @@
  */
 
 #include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_physfs.h>
 #include "scripting.h"
 #include "../core/global.h"
 #include "../core/asset.h"
 #include "../core/video.h"
+#include "../core/logfile.h"
+#include "../core/timer.h"
 #include "../util/v2d.h"
 #include "../util/util.h"
 #include "../util/stringutil.h"
+#include "../util/darray.h"
 #include "../scenes/level.h"
 
 /* private area */
@@ -35,12 +42,60 @@ static int vm_argc = 0;
 static bool test_mode = false;
 static int pause_counter = 0;
 static void compile_scripts(surgescript_vm_t* vm);
-static int compile_script(const char* filepath, void* param);
-static char* read_file(const char* filepath);
+static int list_script(const char* filepath, void* param);
+static char* read_file(const char* filepath, int* error);
 static bool found_test_script(const surgescript_vm_t* vm);
 static void check_if_compatible();
 static void parse_surgescript_options(surgescript_vm_t* vm, int argc, char** argv);
 
+/* reading scripts in parallel
+   The compiler isn't thread-safe, but reading the files is. Reader threads
+   read ahead while the calling thread compiles the scripts in order */
+#define MAX_SCRIPT_READERS 7
+typedef struct scriptfile_t scriptfile_t;
+struct scriptfile_t {
+    char* fullpath;
+    char* source; /* NULL if not yet read or on error */
+    int error; /* errno if the file can't be read */
+    bool is_ready;
+};
+STATIC_DARRAY(scriptfile_t, script_file); /* must not be modified while the readers are running */
+static struct {
+    ALLEGRO_THREAD* thread[MAX_SCRIPT_READERS];
+    int thread_count;
+    ALLEGRO_MUTEX* mutex;
+    ALLEGRO_COND* script_ready; /* broadcast when a script has been read */
+    size_t next_script; /* index of the next script to be read */
+    bool quit;
+} readers = { .thread_count = 0 };
+static void start_script_readers();
+static void stop_script_readers();
+static void* script_reader(ALLEGRO_THREAD* thread, void* arg);
+static void read_script(size_t index);
+static const scriptfile_t* wait_for_script(size_t index);
+
+/* native call profiler
+   If enabled with --ss-profile-calls, the native functions are bound through
+   trampolines that count their calls and measure their (inclusive) time */
+#define MAX_PROFILED_FUNCTIONS 1000 /* number of trampolines */
+typedef struct profiledfunction_t profiledfunction_t;
+struct profiledfunction_t {
+    char* object_name;
+    char* fun_name;
+    surgescript_program_cfunction_t fun;
+    uint64_t calls;
+    double time; /* in seconds */
+};
+static struct {
+    bool enabled;
+    profiledfunction_t function[MAX_PROFILED_FUNCTIONS];
+    int function_count;
+} call_profiler = { .enabled = false, .function_count = 0 };
+static void reset_call_profiler();
+static int profiledfunction_cmp(const void* a, const void* b);
+static inline surgescript_var_t* profiled_call(int index, surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static const surgescript_program_cfunction_t trampoline[MAX_PROFILED_FUNCTIONS];
+
 /* SurgeEngine */
 static void setup_surgeengine(surgescript_vm_t* vm);
 extern void scripting_register_application(surgescript_vm_t* vm);
@@ -48,8 +103,10 @@ extern void scripting_register_surgeengine(surgescript_vm_t* vm);
 extern void scripting_register_actor(surgescript_vm_t* vm);
 extern void scripting_register_androidplatform(surgescript_vm_t* vm);
 extern void scripting_register_animation(surgescript_vm_t* vm);
+extern void scripting_register_audiosource(surgescript_vm_t* vm);
 extern void scripting_register_brick(surgescript_vm_t* vm);
 extern void scripting_register_brickparticle(surgescript_vm_t* vm);
+extern void scripting_release_brickparticle();
 extern void scripting_register_camera(surgescript_vm_t* vm);
 extern void scripting_register_collisions(surgescript_vm_t* vm);
 extern void scripting_register_console(surgescript_vm_t* vm);
@@ -79,6 +136,7 @@ extern void scripting_register_text(surgescript_vm_t* vm);
 extern void scripting_register_time(surgescript_vm_t* vm);
 extern void scripting_register_transform(surgescript_vm_t* vm);
 extern void scripting_register_vector2(surgescript_vm_t* vm);
+extern void scripting_release_vector2();
 extern void scripting_register_video(surgescript_vm_t* vm);
 extern void scripting_register_web(surgescript_vm_t* vm);
 
@@ -127,8 +185,15 @@ void scripting_release()
         free(vm_argv[vm_argc]);
     free(vm_argv);
 
+    /* release the call profiler */
+    reset_call_profiler();
+
     /* destroy VM */
     vm = surgescript_vm_destroy(vm);
+
+    /* release pools of SurgeEngine builtins */
+    scripting_release_brickparticle();
+    scripting_release_vector2();
 }
 
 /*
@@ -180,6 +245,7 @@ void scripting_reload()
     parse_surgescript_options(vm, vm_argc, vm_argv);
 
     /* register SurgeEngine builtins */
+    reset_call_profiler();
     setup_surgeengine(vm);
 
     /* compile scripts */
@@ -240,26 +306,28 @@ surgescript_objecthandle_t scripting_util_require_component(const surgescript_ob
 v2d_t scripting_util_world_position(const surgescript_object_t* object)
 {
     v2d_t position;
-    surgescript_transform_util_worldposition2d(object, &position.x, &position.y);
+    scripting_transform_world_position(object, &position.x, &position.y);
     return position;
 }
 
 /* compute the world angle of an object */
 float scripting_util_world_angle(const surgescript_object_t* object)
 {
-    return surgescript_transform_util_worldangle2d(object);
+    return scripting_transform_world_angle(object);
 }
 
 /* set the world position of an object (teleport) */
 void scripting_util_set_world_position(surgescript_object_t* object, v2d_t position)
 {
     surgescript_transform_util_setworldposition2d(object, position.x, position.y);
+    scripting_transform_changed();
 }
 
 /* set the world angle of an object (in degrees) */
 void scripting_util_set_world_angle(surgescript_object_t* object, float angle)
 {
     surgescript_transform_util_setworldangle2d(object, angle);
+    scripting_transform_changed();
 }
 
 /* checks if the object is inside the visible part of the screen */
@@ -419,6 +487,7 @@ void setup_surgeengine(surgescript_vm_t* vm)
     scripting_register_actor(vm);
     scripting_register_androidplatform(vm);
     scripting_register_animation(vm);
+    scripting_register_audiosource(vm);
     scripting_register_brick(vm);
     scripting_register_brickparticle(vm);
     scripting_register_camera(vm);
@@ -454,11 +523,40 @@ void setup_surgeengine(surgescript_vm_t* vm)
     scripting_register_web(vm);
 }
 
-/* compiles all .ss scripts from the scripts/ folder */
+/* compiles all .ss scripts from the scripts/ folder.
+
+   There is no cache of compiled scripts: SurgeScript has no API to read
+   the bytecode of a compiled program back, nor to restore the tags and the
+   plugins that the parser registers, so every script is compiled from its
+   source. We only read the sources in parallel while compiling in order. */
 void compile_scripts(surgescript_vm_t* vm)
 {
-    /* compile scripts */
-    asset_foreach_file("scripts", ".ss", compile_script, NULL, true);
+    /* list the scripts */
+    darray_init(script_file);
+    asset_foreach_file("scripts", ".ss", list_script, NULL, true);
+
+    /* read the scripts in parallel and compile them in order */
+    start_script_readers();
+    for(size_t i = 0; i < darray_length(script_file); i++) {
+        const scriptfile_t* file = wait_for_script(i);
+
+        if(file->source == NULL) {
+            stop_script_readers();
+            surgescript_util_fatal("Can't read file \"%s\". errno = %d", file->fullpath, file->error);
+            return;
+        }
+
+        surgescript_vm_compile_virtual_file(vm, file->source, file->fullpath);
+
+        free(script_file[i].source);
+        script_file[i].source = NULL;
+    }
+    stop_script_readers();
+
+    /* release the list */
+    for(size_t i = 0; i < darray_length(script_file); i++)
+        free(script_file[i].fullpath);
+    darray_release(script_file);
 
     /* if no test script is present... */
     if(found_test_script(vm)) {
@@ -471,22 +569,121 @@ void compile_scripts(surgescript_vm_t* vm)
     }
 }
 
-/* compile a .ss script from the scripts/ folder */
-int compile_script(const char* filepath, void* param)
+/* add a .ss script from the scripts/ folder to the list of scripts to be compiled */
+int list_script(const char* filepath, void* param)
+{
+    scriptfile_t file = {
+        .fullpath = str_dup(asset_path(filepath)),
+        .source = NULL,
+        .error = 0,
+        .is_ready = false
+    };
+
+    darray_push(script_file, file);
+    return 0;
+}
+
+/* start the threads that read the listed scripts */
+void start_script_readers()
 {
-    const char* fullpath = asset_path(filepath);
+    int cpu_count = al_get_cpu_count();
+    int thread_count = cpu_count > 1 ? cpu_count - 1 : 0;
+
+    if(thread_count > MAX_SCRIPT_READERS)
+        thread_count = MAX_SCRIPT_READERS;
+    if(thread_count > (int)darray_length(script_file))
+        thread_count = darray_length(script_file);
+
+    readers.mutex = al_create_mutex();
+    readers.script_ready = al_create_cond();
+    readers.next_script = 0;
+    readers.quit = false;
+
+    readers.thread_count = 0;
+    for(int i = 0; i < thread_count; i++) {
+        ALLEGRO_THREAD* thread = al_create_thread(script_reader, NULL);
+        if(thread == NULL) {
+            surgescript_util_log("Can't create script reader thread %d", i);
+            break;
+        }
+
+        readers.thread[readers.thread_count++] = thread;
+        al_start_thread(thread);
+    }
+}
 
-    /* read script */
-    char* script = read_file(fullpath);
-    if(script == NULL)
-        return -1;
+/* stop the reader threads, whether or not they have read all scripts */
+void stop_script_readers()
+{
+    al_lock_mutex(readers.mutex);
+    readers.quit = true;
+    al_unlock_mutex(readers.mutex);
 
-    /* compile script */
-    bool success = surgescript_vm_compile_virtual_file(vm, script, fullpath);
+    for(int i = 0; i < readers.thread_count; i++)
+        al_destroy_thread(readers.thread[i]); /* joins the thread */
+    readers.thread_count = 0;
 
-    /* done! */
-    free(script);
-    return success ? 0 : -1;
+    al_destroy_cond(readers.script_ready);
+    al_destroy_mutex(readers.mutex);
+}
+
+/* a reader thread */
+void* script_reader(ALLEGRO_THREAD* thread, void* arg)
+{
+    /* use the physfs file interface in this thread */
+    al_set_physfs_file_interface();
+
+    for(;;) {
+        size_t index;
+
+        /* pick the next script */
+        al_lock_mutex(readers.mutex);
+        if(readers.quit || readers.next_script >= darray_length(script_file)) {
+            al_unlock_mutex(readers.mutex);
+            break;
+        }
+        index = readers.next_script++;
+        al_unlock_mutex(readers.mutex);
+
+        /* read it */
+        read_script(index);
+    }
+
+    return NULL;
+}
+
+/* read the index-th script of the list. Call after picking it */
+void read_script(size_t index)
+{
+    int error = 0;
+    char* source = read_file(script_file[index].fullpath, &error);
+
+    al_lock_mutex(readers.mutex);
+    script_file[index].source = source;
+    script_file[index].error = error;
+    script_file[index].is_ready = true;
+    al_broadcast_cond(readers.script_ready);
+    al_unlock_mutex(readers.mutex);
+}
+
+/* wait until the index-th script of the list has been read.
+   If no reader has picked it yet, read it in the calling thread */
+const scriptfile_t* wait_for_script(size_t index)
+{
+    al_lock_mutex(readers.mutex);
+
+    if(readers.next_script == index) {
+        readers.next_script++;
+        al_unlock_mutex(readers.mutex);
+        read_script(index);
+        al_lock_mutex(readers.mutex);
+    }
+
+    while(!script_file[index].is_ready)
+        al_wait_cond(readers.script_ready, readers.mutex);
+
+    al_unlock_mutex(readers.mutex);
+    return &script_file[index];
 }
 
 /* do we have a test script? (that is, did the user write his/her own "Application" object?) */
@@ -496,8 +693,9 @@ bool found_test_script(const surgescript_vm_t* vm)
     return surgescript_programpool_exists(pool, "Application", "state:main");
 }
 
-/* reads a file using Allegro's File I/O interface */
-char* read_file(const char* filepath)
+/* reads a file using Allegro's File I/O interface. Returns NULL on error.
+   This may be called from multiple threads */
+char* read_file(const char* filepath, int* error)
 {
     const size_t BUFSIZE = 4096;
     size_t read_chars = 0, data_size = 0;
@@ -506,18 +704,30 @@ char* read_file(const char* filepath)
     /* open the file in binary mode, so that offsets don't get messed up */
     ALLEGRO_FILE* fp = al_fopen(filepath, "rb");
     if(!fp) {
-        surgescript_util_fatal("Can't read file \"%s\". errno = %d", filepath, al_get_errno());
+        *error = al_get_errno();
         return NULL;
     }
 
     /* read file to data[] */
     surgescript_util_log("Reading script %s...", filepath);
-    do {
-        data_size += BUFSIZE;
+    int64_t file_size = al_fsize(fp);
+    if(file_size >= 0) {
+        /* the size of the file is known: allocate once.
+           We ask for one extra byte to detect if the file has grown meanwhile */
+        data_size = (size_t)file_size + 1;
+        data = mallocx(data_size + 1);
+        read_chars = al_fread(fp, data, data_size);
+        data[read_chars] = '\0';
+    }
+
+    /* the size of the file is unknown (or it has grown): grow the buffer
+       geometrically, not linearly, so that large scripts are read quickly */
+    while(read_chars == data_size) {
+        data_size = max(data_size * 2, BUFSIZE);
         data = reallocx(data, data_size + 1);
-        read_chars += al_fread(fp, data + read_chars, BUFSIZE);
+        read_chars += al_fread(fp, data + read_chars, data_size - read_chars);
         data[read_chars] = '\0';
-    } while(read_chars == data_size);
+    }
     al_fclose(fp);
 
     /* success! */
@@ -538,5 +748,155 @@ void parse_surgescript_options(surgescript_vm_t* vm, int argc, char** argv)
             surgescript_parser_t* parser = surgescript_vm_parser(vm);
             surgescript_parser_set_flags(parser, SSPARSER_SKIP_DUPLICATES);
         }
+        else if(strcmp(argv[i], "--ss-profile-calls") == 0) {
+            call_profiler.enabled = true;
+        }
+    }
+}
+
+
+
+/*
+ * native call profiler
+ */
+
+/*
+ * scripting_bind()
+ * Binds a native function to an object. All the builtins of SurgeEngine are
+ * bound with this function (see scripting.h), so that their calls can be
+ * profiled
+ */
+void scripting_bind(surgescript_vm_t* vm, const char* object_name, const char* fun_name, surgescript_program_cfunction_t fun, int num_params)
+{
+    /* the profiler is disabled: bind the function directly */
+    if(!call_profiler.enabled || call_profiler.function_count >= MAX_PROFILED_FUNCTIONS) {
+        if(call_profiler.enabled)
+            logfile_message("Can't profile %s.%s(): increase MAX_PROFILED_FUNCTIONS", object_name, fun_name);
+
+        (surgescript_vm_bind)(vm, object_name, fun_name, fun, num_params);
+        return;
+    }
+
+    /* bind the function through a trampoline */
+    int index = call_profiler.function_count++;
+    profiledfunction_t* f = &call_profiler.function[index];
+
+    f->object_name = str_dup(object_name);
+    f->fun_name = str_dup(fun_name);
+    f->fun = fun;
+    f->calls = 0;
+    f->time = 0.0;
+
+    (surgescript_vm_bind)(vm, object_name, fun_name, trampoline[index], num_params);
+}
+
+/*
+ * scripting_dump_call_profile()
+ * Writes the number of calls and the time spent in each native function,
+ * since the previous dump, to the log file. Requires --ss-profile-calls
+ */
+void scripting_dump_call_profile()
+{
+    const int TOP = 50;
+    int n = call_profiler.function_count;
+    uint64_t total_calls = 0;
+    double total_time = 0.0;
+
+    if(!call_profiler.enabled) {
+        video_showmessage("Launch the engine with -- --ss-profile-calls to profile the calls");
+        return;
+    }
+
+    /* sort the functions by time. We sort a copy, because
+       the index of a function is the index of its trampoline */
+    profiledfunction_t* sorted = mallocx(n * sizeof(*sorted));
+    memcpy(sorted, call_profiler.function, n * sizeof(*sorted));
+    qsort(sorted, n, sizeof(*sorted), profiledfunction_cmp);
+
+    for(int i = 0; i < n; i++) {
+        total_calls += sorted[i].calls;
+        total_time += sorted[i].time;
+    }
+
+    /* write the report */
+    logfile_message("Native call profile: %" PRIu64 " calls, %.3f ms (inclusive times)", total_calls, total_time * 1000.0);
+    for(int i = 0; i < n && i < TOP && sorted[i].calls > 0; i++) {
+        logfile_message("%3d. %s.%s: %" PRIu64 " calls, %.3f ms, %.3f us/call",
+            i + 1, sorted[i].object_name, sorted[i].fun_name, sorted[i].calls,
+            sorted[i].time * 1000.0, sorted[i].time * 1000000.0 / (double)sorted[i].calls
+        );
+    }
+
+    if(n > 0 && sorted[0].calls > 0)
+        video_showmessage("Native calls: %" PRIu64 ". Top: %s.%s. See the log file", total_calls, sorted[0].object_name, sorted[0].fun_name);
+
+    free(sorted);
+
+    /* start a new measurement */
+    for(int i = 0; i < n; i++) {
+        call_profiler.function[i].calls = 0;
+        call_profiler.function[i].time = 0.0;
+    }
+}
+
+/* forget the profiled functions. Called before binding the builtins */
+void reset_call_profiler()
+{
+    for(int i = 0; i < call_profiler.function_count; i++) {
+        free(call_profiler.function[i].fun_name);
+        free(call_profiler.function[i].object_name);
+    }
+
+    call_profiler.function_count = 0;
+}
+
+/* sort by time, in descending order */
+int profiledfunction_cmp(const void* a, const void* b)
+{
+    double ta = ((const profiledfunction_t*)a)->time;
+    double tb = ((const profiledfunction_t*)b)->time;
+
+    return (ta < tb) - (ta > tb);
+}
+
+/* call a profiled function */
+surgescript_var_t* profiled_call(int index, surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    profiledfunction_t* f = &call_profiler.function[index];
+    double start = timer_get_now();
+    surgescript_var_t* ret = f->fun(object, param, num_params);
+
+    f->time += timer_get_now() - start;
+    f->calls++;
+
+    return ret;
+}
+
+/* the trampolines: trampoline[i] calls the i-th profiled function.
+   The functions are named trampoline_1000, trampoline_1001, ... */
+#define TRAMPOLINE(n) \
+    static surgescript_var_t* trampoline_##n(surgescript_object_t* object, const surgescript_var_t** param, int num_params) \
+    { \
+        return profiled_call(n - 1000, object, param, num_params); \
     }
-}
\ No newline at end of file
+#define TRAMPOLINE_3(a, b, c) TRAMPOLINE(1##a##b##c)
+#define TRAMPOLINE_2(a, b) \
+    TRAMPOLINE_3(a, b, 0) TRAMPOLINE_3(a, b, 1) TRAMPOLINE_3(a, b, 2) TRAMPOLINE_3(a, b, 3) TRAMPOLINE_3(a, b, 4) \
+    TRAMPOLINE_3(a, b, 5) TRAMPOLINE_3(a, b, 6) TRAMPOLINE_3(a, b, 7) TRAMPOLINE_3(a, b, 8) TRAMPOLINE_3(a, b, 9)
+#define TRAMPOLINE_1(a) \
+    TRAMPOLINE_2(a, 0) TRAMPOLINE_2(a, 1) TRAMPOLINE_2(a, 2) TRAMPOLINE_2(a, 3) TRAMPOLINE_2(a, 4) \
+    TRAMPOLINE_2(a, 5) TRAMPOLINE_2(a, 6) TRAMPOLINE_2(a, 7) TRAMPOLINE_2(a, 8) TRAMPOLINE_2(a, 9)
+TRAMPOLINE_1(0) TRAMPOLINE_1(1) TRAMPOLINE_1(2) TRAMPOLINE_1(3) TRAMPOLINE_1(4)
+TRAMPOLINE_1(5) TRAMPOLINE_1(6) TRAMPOLINE_1(7) TRAMPOLINE_1(8) TRAMPOLINE_1(9)
+
+#define TRAMPOLINE_NAME_3(a, b, c) trampoline_1##a##b##c,
+#define TRAMPOLINE_NAME_2(a, b) \
+    TRAMPOLINE_NAME_3(a, b, 0) TRAMPOLINE_NAME_3(a, b, 1) TRAMPOLINE_NAME_3(a, b, 2) TRAMPOLINE_NAME_3(a, b, 3) TRAMPOLINE_NAME_3(a, b, 4) \
+    TRAMPOLINE_NAME_3(a, b, 5) TRAMPOLINE_NAME_3(a, b, 6) TRAMPOLINE_NAME_3(a, b, 7) TRAMPOLINE_NAME_3(a, b, 8) TRAMPOLINE_NAME_3(a, b, 9)
+#define TRAMPOLINE_NAME_1(a) \
+    TRAMPOLINE_NAME_2(a, 0) TRAMPOLINE_NAME_2(a, 1) TRAMPOLINE_NAME_2(a, 2) TRAMPOLINE_NAME_2(a, 3) TRAMPOLINE_NAME_2(a, 4) \
+    TRAMPOLINE_NAME_2(a, 5) TRAMPOLINE_NAME_2(a, 6) TRAMPOLINE_NAME_2(a, 7) TRAMPOLINE_NAME_2(a, 8) TRAMPOLINE_NAME_2(a, 9)
+static const surgescript_program_cfunction_t trampoline[MAX_PROFILED_FUNCTIONS] = {
+    TRAMPOLINE_NAME_1(0) TRAMPOLINE_NAME_1(1) TRAMPOLINE_NAME_1(2) TRAMPOLINE_NAME_1(3) TRAMPOLINE_NAME_1(4)
+    TRAMPOLINE_NAME_1(5) TRAMPOLINE_NAME_1(6) TRAMPOLINE_NAME_1(7) TRAMPOLINE_NAME_1(8) TRAMPOLINE_NAME_1(9)
+};
\ No newline at end of file
@@ -38,6 +38,12 @@ void scripting_resume_vm();
 
 bool scripting_testmode();
 
+/* native functions
+   The builtins are bound with scripting_bind(), so that their calls can be profiled */
+void scripting_bind(surgescript_vm_t* vm, const char* object_name, const char* fun_name, surgescript_program_cfunction_t fun, int num_params);
+void scripting_dump_call_profile(); /* requires --ss-profile-calls */
+#define surgescript_vm_bind(vm, object_name, fun_name, fun, num_params) scripting_bind((vm), (object_name), (fun_name), (fun), (num_params))
+
 /* scripting utilities */
 surgescript_objecthandle_t scripting_util_require_component(const surgescript_object_t* object, const char* component_name);
 v2d_t scripting_util_world_position(const surgescript_object_t* object);
@@ -58,6 +64,7 @@ void scripting_warning(const surgescript_object_t* object, const char* fmt, ...)
 /* obtain data from objects */
 struct actor_t;
 struct animation_t;
+struct image_t;
 struct collisionmask_t;
 struct music_t;
 struct player_t;
@@ -67,6 +74,10 @@ extern void scripting_vector2_update(surgescript_object_t* object, double x, dou
 extern void scripting_vector2_read(const surgescript_object_t* object, double* x, double* y);
 extern v2d_t scripting_vector2_to_v2d(const surgescript_object_t* object);
 
+extern void scripting_transform_world_position(const surgescript_object_t* object, float* x, float* y);
+extern float scripting_transform_world_angle(const surgescript_object_t* object);
+extern void scripting_transform_changed();
+
 extern struct actor_t* scripting_actor_ptr(const surgescript_object_t* object);
 extern struct player_t* scripting_player_ptr(const surgescript_object_t* object);
 extern struct music_t* scripting_music_ptr(const surgescript_object_t* object);
@@ -83,6 +94,10 @@ extern struct collisionmask_t* scripting_brick_mask(const surgescript_object_t*
 extern v2d_t scripting_brick_size(const surgescript_object_t* object);
 extern v2d_t scripting_brick_position(const surgescript_object_t* object);
 
+extern void scripting_brickparticles_emit(surgescript_object_t* emitter, const struct image_t* image, int src_x, int src_y, int width, int height, v2d_t position, v2d_t velocity);
+extern float scripting_brickparticles_zindex(const surgescript_object_t* emitter);
+extern void scripting_brickparticles_set_zindex(surgescript_object_t* emitter, float zindex);
+
 extern const struct obstaclemap_t* scripting_obstaclemap_ptr(const surgescript_object_t* object);
 
 extern iterator_t* scripting_levelobjectcontainer_iterator(surgescript_object_t* container);
@@ -100,11 +115,28 @@ extern void entitymanager_set_entity_id(surgescript_object_t* entity_manager, su
 extern v2d_t entitymanager_get_entity_spawn_point(surgescript_object_t* entity_manager, surgescript_objecthandle_t entity_handle);
 extern bool entitymanager_is_entity_persistent(surgescript_object_t* entity_manager, surgescript_objecthandle_t entity_handle);
 extern void entitymanager_set_entity_persistent(surgescript_object_t* entity_manager, surgescript_objecthandle_t entity_handle, bool is_persistent);
+extern void entitymanager_foreach_persistent_entity(surgescript_object_t* entity_manager, void* data, void (*callback)(surgescript_object_t*,uint64_t,v2d_t,void*));
 extern bool entitymanager_is_entity_sleeping(surgescript_object_t* entity_manager, surgescript_objecthandle_t entity_handle);
 extern void entitymanager_set_entity_sleeping(surgescript_object_t* entity_manager, surgescript_objecthandle_t entity_handle, bool is_sleeping);
 extern bool entitymanager_is_inside_roi(surgescript_object_t* entity_manager, v2d_t position);
 extern void entitymanager_get_roi(surgescript_object_t* entity_manager, int* top, int* left, int* bottom, int* right);
+extern void entitymanager_late_update_stats(surgescript_object_t* entity_manager, int* length, int* requests);
+extern bool entitymanager_is_throttling_updates(surgescript_object_t* entity_manager);
+extern bool entitymanager_defer_entity_update(surgescript_object_t* entity_manager, surgescript_object_t* entity);
+extern void entitymanager_end_update(surgescript_object_t* entity_manager, double update_time);
+extern void entitymanager_scheduler_stats(surgescript_object_t* entity_manager, int* period, int* deferred, int64_t* total_deferred, double* update_time);
 extern iterator_t* entitymanager_bricklike_iterator(surgescript_object_t* entity_manager);
+extern void entitymanager_bricklike_arrayiter(surgescript_object_t* entity_manager, arrayiter_t* it);
 extern iterator_t* entitymanager_activeentities_iterator(surgescript_object_t* entity_manager);
 
+extern void entitytree_bubble_down(surgescript_object_t* entity_tree, surgescript_objecthandle_t entity_handle);
+extern void entitytree_bubble_down_batch(surgescript_object_t* entity_tree, const surgescript_objecthandle_t* entity_handle, int count);
+extern void entitytree_bubble_up(surgescript_object_t* entity_tree, surgescript_object_t* entity_container, surgescript_objecthandle_t entity_handle);
+extern bool entitytree_update_world_size(surgescript_object_t* entity_tree, int world_width, int world_height);
+extern bool entitytree_update_roi(surgescript_object_t* entity_tree, surgescript_object_t* output_array, int top, int left, int bottom, int right);
+
+extern struct entitynotification_t* entitynotification_create(const char* fun_name);
+extern struct entitynotification_t* entitynotification_destroy(struct entitynotification_t* notification);
+extern void entitycontainer_notify_entities(surgescript_object_t* entity_container, struct entitynotification_t* notification);
+
 #endif
\ No newline at end of file
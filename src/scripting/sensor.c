@@ -46,14 +46,20 @@ static surgescript_var_t* fun_setenabled(surgescript_object_t* object, const sur
 static surgescript_var_t* fun_getenabled(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_getstatus(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_ontransformchange(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_updategroup(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static inline const obstaclemap_t* get_obstaclemap(const surgescript_object_t* object);
 static inline sensor_t* get_sensor(const surgescript_object_t* object);
 static inline void update(surgescript_object_t* object);
+static void update_batch(surgescript_object_t* object, bool consecutive_only);
+static void set_status(surgescript_object_t* object, const obstacle_t* obstacle);
+static bool can_be_batched_with(const surgescript_object_t* sensor_object, const surgescript_object_t* leader, v2d_t leader_position);
 static const surgescript_heapptr_t OBSTACLEMAP_ADDR = 0;
 static const surgescript_heapptr_t VISIBLE_ADDR = 1;
 static const surgescript_heapptr_t STATUS_ADDR = 2;
 static const surgescript_heapptr_t ENABLED_ADDR = 3;
 static const surgescript_heapptr_t LAYER_ADDR = 4;
+static const surgescript_heapptr_t BATCHED_ADDR = 5; /* updated by a preceding sibling in this frame? */
+#define MAX_SENSORS_PER_BATCH 16
 #define SENSOR_COLOR() (color_hex("ffff00"))
 
 /*
@@ -81,6 +87,7 @@ void scripting_register_sensor(surgescript_vm_t* vm)
     surgescript_vm_bind(vm, "Sensor", "set_enabled", fun_setenabled, 1);
     surgescript_vm_bind(vm, "Sensor", "get_enabled", fun_getenabled, 0);
     surgescript_vm_bind(vm, "Sensor", "onTransformChange", fun_ontransformchange, 0);
+    surgescript_vm_bind(vm, "Sensor", "__updateGroup", fun_updategroup, 0);
     surgescript_vm_bind(vm, "Sensor", "onRender", fun_onrender, 2);
     surgescript_vm_bind(vm, "Sensor", "onRenderGizmos", fun_onrendergizmos, 2);
 }
@@ -102,6 +109,7 @@ surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescri
     ssassert(STATUS_ADDR == surgescript_heap_malloc(heap));
     ssassert(ENABLED_ADDR == surgescript_heap_malloc(heap));
     ssassert(LAYER_ADDR == surgescript_heap_malloc(heap));
+    ssassert(BATCHED_ADDR == surgescript_heap_malloc(heap));
 
     /* initial configuration */
     surgescript_var_set_null(surgescript_heap_at(heap, OBSTACLEMAP_ADDR));
@@ -109,6 +117,7 @@ surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescri
     surgescript_var_set_number(surgescript_heap_at(heap, STATUS_ADDR), 0);
     surgescript_var_set_bool(surgescript_heap_at(heap, ENABLED_ADDR), true);
     surgescript_var_set_rawbits(surgescript_heap_at(heap, LAYER_ADDR), OL_DEFAULT);
+    surgescript_var_set_bool(surgescript_heap_at(heap, BATCHED_ADDR), false);
 
     /* will create the sensor later */
     surgescript_object_set_userdata(object, NULL);
@@ -138,7 +147,19 @@ surgescript_var_t* fun_destructor(surgescript_object_t* object, const surgescrip
 /* main state; will check for collisions automatically once per frame */
 surgescript_var_t* fun_main(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
-    update(object);
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    surgescript_var_t* batched = surgescript_heap_at(heap, BATCHED_ADDR);
+
+    /* a preceding sibling has already updated this sensor in this frame */
+    if(surgescript_var_get_bool(batched)) {
+        surgescript_var_set_bool(batched, false);
+        return NULL;
+    }
+
+    /* siblings are updated one after the other. Since sensors have no
+       children, nothing runs between consecutive sibling sensors, so
+       we can update them all at once */
+    update_batch(object, true);
     return NULL;
 }
 
@@ -189,6 +210,15 @@ surgescript_var_t* fun_ontransformchange(surgescript_object_t* object, const sur
     return NULL;
 }
 
+/* update the collision status of this sensor and of its sibling sensors AT
+   THIS MOMENT IN TIME, in a single batch. This is equivalent to, but faster
+   than, calling onTransformChange() on each of the sensors of the parent */
+surgescript_var_t* fun_updategroup(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    update_batch(object, false);
+    return NULL;
+}
+
 /* render */
 surgescript_var_t* fun_onrender(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
@@ -362,18 +392,120 @@ void update(surgescript_object_t* object)
         const obstaclemap_t* obstaclemap = get_obstaclemap(object);
         const obstacle_t* obstacle = sensor_check(sensor, scripting_util_world_position(object), MM_FLOOR, layer, obstaclemap);
 
-        if(obstacle != NULL) {
-            if(obstacle_is_solid(obstacle)) {
-                if(*(surgescript_var_fast_get_string(status)) != 's')
-                    surgescript_var_set_string(status, "solid");
-            }
-            else {
-                if(*(surgescript_var_fast_get_string(status)) != 'c')
-                    surgescript_var_set_string(status, "cloud");
+        set_status(object, obstacle);
+    }
+    else
+        surgescript_var_set_null(status);
+}
+
+/* update a sensor together with its sibling sensors that share its world
+   position, obstacle map and layer, so that the obstacle map is scanned a
+   single time. If consecutive_only is true, only the siblings that follow
+   the sensor, without interruption, are updated; they're marked as batched */
+void update_batch(surgescript_object_t* object, bool consecutive_only)
+{
+    surgescript_objectmanager_t* manager = surgescript_object_manager(object);
+    surgescript_object_t* parent = surgescript_objectmanager_get(manager, surgescript_object_parent(object));
+    surgescript_objecthandle_t me = surgescript_object_handle(object);
+    surgescript_object_t* member[MAX_SENSORS_PER_BATCH];
+    const sensor_t* sensor[MAX_SENSORS_PER_BATCH];
+    const obstacle_t* obstacle[MAX_SENSORS_PER_BATCH];
+    int count = 0;
+
+    /* a disabled sensor has nothing to check */
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    if(!surgescript_var_get_bool(surgescript_heap_at(heap, ENABLED_ADDR)) || get_sensor(object) == NULL) {
+        update(object);
+        if(!consecutive_only) {
+            /* the siblings are updated individually */
+            int child_count = surgescript_object_child_count(parent);
+            for(int i = 0; i < child_count; i++) {
+                surgescript_object_t* child = surgescript_objectmanager_get(manager, surgescript_object_nth_child(parent, i));
+                if(child != object && strcmp(surgescript_object_name(child), "Sensor") == 0)
+                    update(child);
             }
         }
+        return;
+    }
+
+    /* gather the members of the batch */
+    v2d_t position = scripting_util_world_position(object);
+    int child_count = surgescript_object_child_count(parent);
+    int my_index = -1;
+    for(int i = 0; i < child_count; i++) {
+        surgescript_objecthandle_t child_handle = surgescript_object_nth_child(parent, i);
+        surgescript_object_t* child = surgescript_objectmanager_get(manager, child_handle);
+
+        if(child_handle == me) {
+            my_index = i;
+            member[count++] = child;
+            continue;
+        }
+        else if(consecutive_only && my_index < 0)
+            continue;
+
+        if(strcmp(surgescript_object_name(child), "Sensor") != 0) {
+            if(consecutive_only)
+                break; /* the run of consecutive sensors is over */
+            continue;
+        }
+
+        if(count < MAX_SENSORS_PER_BATCH && can_be_batched_with(child, object, position))
+            member[count++] = child;
+        else if(consecutive_only)
+            break;
         else
-            surgescript_var_set_null(status);
+            update(child);
+    }
+
+    /* scan the obstacle map */
+    obstaclelayer_t layer = (obstaclelayer_t)surgescript_var_get_rawbits(surgescript_heap_at(heap, LAYER_ADDR));
+    for(int i = 0; i < count; i++)
+        sensor[i] = get_sensor(member[i]);
+    sensor_check_all(sensor, count, position, MM_FLOOR, layer, get_obstaclemap(object), obstacle);
+
+    /* set the status of the members */
+    for(int i = 0; i < count; i++) {
+        set_status(member[i], obstacle[i]);
+        if(consecutive_only && member[i] != object)
+            surgescript_var_set_bool(surgescript_heap_at(surgescript_object_heap(member[i]), BATCHED_ADDR), true);
+    }
+}
+
+/* can a sensor be checked in the same batch as the leader? */
+bool can_be_batched_with(const surgescript_object_t* sensor_object, const surgescript_object_t* leader, v2d_t leader_position)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(sensor_object);
+    surgescript_heap_t* leader_heap = surgescript_object_heap(leader);
+
+    if(get_sensor(sensor_object) == NULL || !surgescript_object_is_active(sensor_object))
+        return false;
+    else if(!surgescript_var_get_bool(surgescript_heap_at(heap, ENABLED_ADDR)))
+        return false;
+    else if(surgescript_var_get_rawbits(surgescript_heap_at(heap, LAYER_ADDR)) != surgescript_var_get_rawbits(surgescript_heap_at(leader_heap, LAYER_ADDR)))
+        return false;
+    else if(surgescript_var_get_objecthandle(surgescript_heap_at(heap, OBSTACLEMAP_ADDR)) != surgescript_var_get_objecthandle(surgescript_heap_at(leader_heap, OBSTACLEMAP_ADDR)))
+        return false;
+
+    v2d_t position = scripting_util_world_position(sensor_object);
+    return position.x == leader_position.x && position.y == leader_position.y;
+}
+
+/* set the status of a sensor according to the obstacle it senses, if any */
+void set_status(surgescript_object_t* object, const obstacle_t* obstacle)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    surgescript_var_t* status = surgescript_heap_at(heap, STATUS_ADDR);
+
+    if(obstacle != NULL) {
+        if(obstacle_is_solid(obstacle)) {
+            if(*(surgescript_var_fast_get_string(status)) != 's')
+                surgescript_var_set_string(status, "solid");
+        }
+        else {
+            if(*(surgescript_var_fast_get_string(status)) != 'c')
+                surgescript_var_set_string(status, "cloud");
+        }
     }
     else
         surgescript_var_set_null(status);
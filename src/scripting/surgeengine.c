@@ -19,6 +19,7 @@
  */
 
 #include <surgescript.h>
+#include "scripting.h"
 #include "../core/global.h"
 #include "../entities/mobilegamepad.h"
 
@@ -70,6 +71,7 @@ object 'SurgeEngine' \n\
     public readonly Input = spawn('InputFactory'); \n\
     public readonly Camera = spawn('Camera'); \n\
     public readonly Collisions = spawn('Collision'); \n\
+    public readonly ObstacleMap = spawn('ObstacleMap'); \n\
     public readonly Events = spawn('Events'); \n\
     public readonly UI = spawn('UI'); \n\
     public readonly Platform = spawn('Platform'); \n\
@@ -276,6 +278,7 @@ object 'Audio' \n\
 { \n\
     public readonly Music = spawn('MusicFactory'); \n\
     public readonly Sound = spawn('SoundFactory'); \n\
+    public readonly AudioSource = spawn('AudioSourceFactory'); \n\
 \n\
     fun destroy() { } \n\
 } \n\
@@ -309,6 +312,18 @@ object 'SoundFactory' \n\
     fun destroy() { } \n\
 } \n\
 \n\
+object 'AudioSourceFactory' \n\
+{ \n\
+    fun call(pathToSound) \n\
+    { \n\
+        source = caller.spawn('AudioSource'); \n\
+        source.__init(pathToSound); \n\
+        return source; \n\
+    } \n\
+\n\
+    fun destroy() { } \n\
+} \n\
+\n\
 object 'Events' \n\
 { \n\
     public readonly Event = spawn('EventFactory'); \n\
@@ -54,6 +54,8 @@ static surgescript_var_t* fun_setzindex(surgescript_object_t* object, const surg
 static surgescript_var_t* fun_getoffset(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_setoffset(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_getsize(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_getcached(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_setcached(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static const surgescript_heapptr_t FONT_ADDR = 0;
 static const surgescript_heapptr_t TEXT_ADDR = 1;
 static const surgescript_heapptr_t ALIGN_ADDR = 2;
@@ -63,12 +65,14 @@ static const surgescript_heapptr_t DETACHED_ADDR = 5;
 static const surgescript_heapptr_t OFFSET_ADDR = 6;
 static const surgescript_heapptr_t MAXWIDTH_ADDR = 7;
 static const surgescript_heapptr_t SIZE_ADDR = 8;
+static const surgescript_heapptr_t CACHED_ADDR = 9;
 static const char* DEFAULT_TEXT = "";
 static const char* DEFAULT_FONT = "default";
 static const char* DEFAULT_ALIGN = "left";
 static const double DEFAULT_ZINDEX = 0.5;
 static const double DEFAULT_MAXWIDTH = INFINITY; /* no wordwrap */
 static const bool DEFAULT_VISIBILITY = true;
+static const bool DEFAULT_CACHED = false;
 static inline font_t* get_font(const surgescript_object_t* object);
 static inline fontalign_t str2align(const char* align);
 static inline const char* align2str(fontalign_t align);
@@ -104,6 +108,8 @@ void scripting_register_text(surgescript_vm_t* vm)
     surgescript_vm_bind(vm, "Text", "get_offset", fun_getoffset, 0);
     surgescript_vm_bind(vm, "Text", "set_offset", fun_setoffset, 1);
     surgescript_vm_bind(vm, "Text", "get_size", fun_getsize, 0);
+    surgescript_vm_bind(vm, "Text", "set_cached", fun_setcached, 1);
+    surgescript_vm_bind(vm, "Text", "get_cached", fun_getcached, 0);
     surgescript_vm_bind(vm, "Text", "onRender", fun_onrender, 2);
     surgescript_vm_bind(vm, "Text", "get___filepathOfRenderable", fun_getfilepathofrenderable, 0);
     surgescript_vm_bind(vm, "Text", "get___textureHandle", fun_gettexturehandle, 0);
@@ -153,6 +159,7 @@ surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescri
     ssassert(OFFSET_ADDR == surgescript_heap_malloc(heap));
     ssassert(MAXWIDTH_ADDR == surgescript_heap_malloc(heap));
     ssassert(SIZE_ADDR == surgescript_heap_malloc(heap));
+    ssassert(CACHED_ADDR == surgescript_heap_malloc(heap));
     surgescript_var_set_null(surgescript_heap_at(heap, FONT_ADDR));
     surgescript_var_set_string(surgescript_heap_at(heap, TEXT_ADDR), DEFAULT_TEXT);
     surgescript_var_set_string(surgescript_heap_at(heap, ALIGN_ADDR), DEFAULT_ALIGN);
@@ -162,6 +169,7 @@ surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescri
     surgescript_var_set_bool(surgescript_heap_at(heap, DETACHED_ADDR), is_detached);
     surgescript_var_set_number(surgescript_heap_at(heap, MAXWIDTH_ADDR), DEFAULT_MAXWIDTH);
     surgescript_var_set_null(surgescript_heap_at(heap, SIZE_ADDR)); /* lazy allocation */
+    surgescript_var_set_bool(surgescript_heap_at(heap, CACHED_ADDR), DEFAULT_CACHED);
 
     /* sanity check */
     if(!surgescript_object_has_tag(parent, "entity")) {
@@ -197,6 +205,7 @@ surgescript_var_t* fun_init(surgescript_object_t* object, const surgescript_var_
     font_set_align(font, str2align(surgescript_var_fast_get_string(surgescript_heap_at(heap, ALIGN_ADDR))));
     font_set_visible(font, surgescript_var_get_bool(surgescript_heap_at(heap, VISIBLE_ADDR)));
     font_set_width(font, isfinite(max_width) ? max_width : 0);
+    font_set_cached(font, surgescript_var_get_bool(surgescript_heap_at(heap, CACHED_ADDR)));
 
     /* userdata */
     surgescript_var_set_string(surgescript_heap_at(heap, FONT_ADDR), font_name);
@@ -248,7 +257,7 @@ surgescript_var_t* fun_gettexturehandle(surgescript_object_t* object, const surg
 
     /* is the font valid? */
     if(font != NULL) {
-        const image_t* image = font_get_image(font);
+        const image_t* image = font_is_cached(font) ? font_get_cached_image(font) : font_get_image(font);
 
         /* is this a bitmap font? */
         if(image != NULL) {
@@ -264,9 +273,10 @@ surgescript_var_t* fun_gettexturehandle(surgescript_object_t* object, const surg
 surgescript_var_t* fun_getistranslucent(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
     /* we'll consider this renderable to be translucent if it's not a bitmap font,
-       e.g., a TrueType font (there is likely some antialiasing taking place...) */
+       e.g., a TrueType font (there is likely some antialiasing taking place...)
+       The texture of a cached text is translucent as well */
     const font_t* font = get_font(object);
-    bool is_translucent = (font != NULL) && (font_get_image(font) == NULL);
+    bool is_translucent = (font != NULL) && (font_get_image(font) == NULL || font_is_cached(font));
 
     return surgescript_var_set_bool(surgescript_var_create(), is_translucent);
 }
@@ -393,6 +403,27 @@ surgescript_var_t* fun_getvisible(surgescript_object_t* object, const surgescrip
     return surgescript_var_clone(surgescript_heap_at(heap, VISIBLE_ADDR));
 }
 
+/* set cached: render the text into a texture when it changes? Good for static texts */
+surgescript_var_t* fun_setcached(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    bool is_cached = surgescript_var_get_bool(param[0]);
+    font_t* font = get_font(object);
+
+    if(font != NULL)
+        font_set_cached(font, is_cached);
+
+    surgescript_var_set_bool(surgescript_heap_at(heap, CACHED_ADDR), is_cached);
+    return NULL;
+}
+
+/* get cached */
+surgescript_var_t* fun_getcached(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    surgescript_heap_t* heap = surgescript_object_heap(object);
+    return surgescript_var_clone(surgescript_heap_at(heap, CACHED_ADDR));
+}
+
 /* get offset */
 surgescript_var_t* fun_getoffset(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
@@ -432,6 +463,7 @@ surgescript_var_t* fun_setoffset(surgescript_object_t* object, const surgescript
     surgescript_object_t* v2 = surgescript_objectmanager_get(manager, v2h);
     scripting_vector2_read(v2, &x, &y);
     surgescript_transform_setposition2d(transform, x, y);
+    scripting_transform_changed();
 
     return NULL;
 }
@@ -19,12 +19,15 @@
  */
 
 #include <surgescript.h>
+#include "scripting.h"
 #include "../core/timer.h"
+#include "../core/frameprofiler.h"
 
 /* private */
 static surgescript_var_t* fun_getdelta(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_gettime(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_getnow(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_frametime(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 
 /*
  * scripting_register_time()
@@ -35,6 +38,7 @@ void scripting_register_time(surgescript_vm_t* vm)
     surgescript_vm_bind(vm, "Time", "get_delta", fun_getdelta, 0);
     surgescript_vm_bind(vm, "Time", "get_time", fun_gettime, 0);
     surgescript_vm_bind(vm, "Time", "get_now", fun_getnow, 0);
+    surgescript_vm_bind(vm, "Time", "frameTime", fun_frametime, 2);
 }
 
 /* Time routines */
@@ -58,4 +62,22 @@ surgescript_var_t* fun_getnow(surgescript_object_t* object, const surgescript_va
 {
     /* get the engine time, rather than the SurgeScript time, for synchronized results */
     return surgescript_var_set_number(surgescript_var_create(), timer_get_now());
-}
\ No newline at end of file
+}
+
+/* frameTime(phase, percentile): the given percentile, in [0,100], of the duration (in seconds)
+   of a phase of the recent frames: "frame", "update", "render", "present" or "gc".
+   Returns zero unless the engine has been launched with --profile-frames */
+surgescript_var_t* fun_frametime(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    const surgescript_objectmanager_t* manager = surgescript_object_manager(object);
+    char* phase_name = surgescript_var_get_string(param[0], manager);
+    double percentile = surgescript_var_get_number(param[1]);
+    double duration = 0.0;
+    framephase_t phase;
+
+    if(frameprofiler_find_phase(phase_name, &phase))
+        duration = frameprofiler_percentile(phase, percentile);
+
+    ssfree(phase_name);
+    return surgescript_var_set_number(surgescript_var_create(), duration);
+}
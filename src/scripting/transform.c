@@ -62,6 +62,23 @@ static const surgescript_heapptr_t LOSSYSCALE_ADDR = 3;
 static const surgescript_heapptr_t RIGHT_ADDR = 4;
 static const surgescript_heapptr_t UP_ADDR = 5;
 
+/* cache of world transforms: repeated queries are O(1), instead of
+   O(depth) in the hierarchy. An entry is valid if no transform has
+   changed since it was computed (i.e., the epoch matches) and if the
+   local transform and the parent of the object are the same */
+#define WORLDCACHE_SIZE 4096 /* a power of two */
+typedef struct worldcache_t worldcache_t;
+struct worldcache_t {
+    unsigned epoch; /* 0 means invalid */
+    surgescript_objecthandle_t handle;
+    surgescript_objecthandle_t parent;
+    float local_x, local_y, local_angle, local_scale_x, local_scale_y;
+    float world_x, world_y, world_angle;
+};
+static worldcache_t worldcache[WORLDCACHE_SIZE];
+static unsigned world_epoch = 1; /* incremented whenever a transform changes */
+static const worldcache_t* cached_world_transform(const surgescript_object_t* object);
+
 
 
 /*
@@ -235,7 +252,7 @@ surgescript_var_t* fun_getposition(surgescript_object_t* object, const surgescri
     surgescript_object_t* v2 = get_v2(object, WORLDPOSITION_ADDR);
     float world_x = 0.0f, world_y = 0.0f;
 
-    surgescript_transform_util_worldposition2d(target(object), &world_x, &world_y);
+    scripting_transform_world_position(target(object), &world_x, &world_y);
     scripting_vector2_update(v2, world_x, world_y);
 
     return surgescript_var_set_objecthandle(surgescript_var_create(), surgescript_object_handle(v2));
@@ -258,7 +275,7 @@ surgescript_var_t* fun_setposition(surgescript_object_t* object, const surgescri
 /* get world angle (in degrees) */
 surgescript_var_t* fun_getangle(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
-    double world_angle = surgescript_transform_util_worldangle2d(target(object)); /* in degrees */
+    double world_angle = scripting_transform_world_angle(target(object)); /* in degrees */
     return surgescript_var_set_number(surgescript_var_create(), world_angle);
 }
 
@@ -389,6 +406,80 @@ surgescript_var_t* fun_getup(surgescript_object_t* object, const surgescript_var
 
 /* misc */
 
+/*
+ * scripting_transform_world_position()
+ * The position of an object in world space, computed once
+ * and reused until a transform changes
+ */
+void scripting_transform_world_position(const surgescript_object_t* object, float* x, float* y)
+{
+    const worldcache_t* entry = cached_world_transform(object);
+    *x = entry->world_x;
+    *y = entry->world_y;
+}
+
+/*
+ * scripting_transform_world_angle()
+ * The angle of an object in world space, in degrees
+ */
+float scripting_transform_world_angle(const surgescript_object_t* object)
+{
+    const worldcache_t* entry = cached_world_transform(object);
+    return entry->world_angle;
+}
+
+/*
+ * scripting_transform_changed()
+ * Invalidates the cached world transforms. This must be called whenever
+ * the transform of an object is modified, because the world transforms
+ * of its descendants depend on it
+ */
+void scripting_transform_changed()
+{
+    /* on wrap-around, discard the entries of previous epochs */
+    if(++world_epoch == 0) {
+        memset(worldcache, 0, sizeof(worldcache));
+        world_epoch = 1;
+    }
+}
+
+/* the cached world transform of an object, recomputed if it's invalid */
+const worldcache_t* cached_world_transform(const surgescript_object_t* object)
+{
+    const surgescript_transform_t* transform = surgescript_object_transform((surgescript_object_t*)object);
+    surgescript_objecthandle_t handle = surgescript_object_handle(object);
+    surgescript_objecthandle_t parent = surgescript_object_parent(object);
+    worldcache_t* entry = &worldcache[handle & (WORLDCACHE_SIZE - 1)];
+    float x, y, angle, scale_x, scale_y;
+
+    /* read the local transform */
+    surgescript_transform_getposition2d(transform, &x, &y);
+    surgescript_transform_getscale2d(transform, &scale_x, &scale_y);
+    angle = surgescript_transform_getrotation2d(transform);
+
+    /* cache hit */
+    if(
+        entry->epoch == world_epoch && entry->handle == handle && entry->parent == parent &&
+        entry->local_x == x && entry->local_y == y && entry->local_angle == angle &&
+        entry->local_scale_x == scale_x && entry->local_scale_y == scale_y
+    )
+        return entry;
+
+    /* cache miss: go through the parent chain */
+    entry->epoch = world_epoch;
+    entry->handle = handle;
+    entry->parent = parent;
+    entry->local_x = x;
+    entry->local_y = y;
+    entry->local_angle = angle;
+    entry->local_scale_x = scale_x;
+    entry->local_scale_y = scale_y;
+    surgescript_transform_util_worldposition2d(object, &entry->world_x, &entry->world_y);
+    entry->world_angle = surgescript_transform_util_worldangle2d(object);
+
+    return entry;
+}
+
 /* will return the target object of the given transform object */
 surgescript_object_t* target(const surgescript_object_t* object)
 {
@@ -431,6 +522,8 @@ surgescript_object_t* get_v2(surgescript_object_t* object, surgescript_heapptr_t
 /* notify the target object of a transform change */
 void notify_change(surgescript_object_t* object)
 {
+    scripting_transform_changed();
+
     surgescript_object_t* notifiable_target = (surgescript_object_t*)surgescript_object_userdata(object);
     if(notifiable_target != NULL && notifiable_target == target(object)) { /* safety check */
         surgescript_var_t* transform_handle = surgescript_var_set_objecthandle(surgescript_var_create(), surgescript_object_handle(object));
@@ -36,7 +36,7 @@ struct ssarrayiterator_state_t
     size_t c_array_length;
 
     /* delegation */
-    iterator_t* c_array_iterator;
+    arrayiter_t c_array_iterator;
 };
 
 static iterator_state_t* surgescript_arrayiterator_ctor(void* ctor_data);
@@ -127,7 +127,8 @@ iterator_state_t* surgescript_arrayiterator_ctor(void* ctor_data)
         get_surgescript_array_element(state->array, i, state->c_array[i]); /* read the data eagerly, now */
     }
 
-    state->c_array_iterator = iterator_create_from_array(
+    arrayiter_init(
+        &state->c_array_iterator,
         state->c_array,
         state->c_array_length,
         sizeof(*(state->c_array))
@@ -149,9 +150,6 @@ void surgescript_arrayiterator_dtor(iterator_state_t* s)
 {
     ssarrayiterator_state_t* state = (ssarrayiterator_state_t*)s;
 
-    /* release the iterator of the C array */
-    iterator_destroy(state->c_array_iterator);
-
     /* release the C array */
     for(int i = state->c_array_length - 1; i >= 0; i--)
         surgescript_var_destroy(state->c_array[i]);
@@ -169,14 +167,14 @@ void surgescript_arrayiterator_dtor(iterator_state_t* s)
 void* surgescript_arrayiterator_next(iterator_state_t* s)
 {
     ssarrayiterator_state_t* state = (ssarrayiterator_state_t*)s;
-    return iterator_next(state->c_array_iterator);
+    return arrayiter_next(&state->c_array_iterator);
 }
 
 /* iteration not over? */
 bool surgescript_arrayiterator_has_next(iterator_state_t* s)
 {
     ssarrayiterator_state_t* state = (ssarrayiterator_state_t*)s;
-    return iterator_has_next(state->c_array_iterator);
+    return arrayiter_has_next(&state->c_array_iterator);
 }
 
 /* return the length of the array */
@@ -25,6 +25,7 @@
 #include <errno.h>
 #include <float.h>
 #include <math.h>
+#include "scripting.h"
 #include "../util/v2d.h"
 #include "../util/numeric.h"
 #include "../util/util.h"
@@ -34,8 +35,17 @@ typedef struct surgescript_vector2_t surgescript_vector2_t;
 struct surgescript_vector2_t {
     double x, y;
     bool initialized;
+    surgescript_vector2_t* next_free; /* in the pool */
 };
 
+/* pool of vector data
+   Vector math in the scripts spawns many short-lived Vector2 objects, which
+   are soon collected. We recycle their data instead of going back and forth
+   to the allocator. */
+static surgescript_vector2_t* pool = NULL;
+static int pool_size = 0;
+static const int MAX_POOL_SIZE = 8192;
+
 /*
 *** Note: Vector2 must be immutable ***
 */
@@ -66,7 +76,9 @@ static surgescript_var_t* fun_tostring(surgescript_object_t* object, const surge
 static inline surgescript_vector2_t* get_vector(const surgescript_object_t* object);
 static inline const surgescript_vector2_t* safe_get_vector(const surgescript_object_t* object);
 static inline surgescript_objecthandle_t spawn_vector(surgescript_objectmanager_t* manager, double x, double y);
-static const surgescript_vector2_t ZERO = { 0.0, 0.0, true };
+static surgescript_vector2_t* create_vector_data();
+static surgescript_vector2_t* destroy_vector_data(surgescript_vector2_t* v);
+static const surgescript_vector2_t ZERO = { 0.0, 0.0, true, NULL };
 static const double EPS = DBL_EPSILON;
 static double y_axis = -1.0;
 
@@ -104,6 +116,21 @@ void scripting_register_vector2(surgescript_vm_t* vm)
     surgescript_vm_bind(vm, "Vector2", "projectedOn", fun_projectedon, 1);
 }
 
+/*
+ * scripting_release_vector2()
+ * Release the pool of vector data. Call after destroying the VM
+ */
+void scripting_release_vector2()
+{
+    while(pool != NULL) {
+        surgescript_vector2_t* next = pool->next_free;
+        ssfree(pool);
+        pool = next;
+    }
+
+    pool_size = 0;
+}
+
 /*
  * scripting_vector2_update()
  * Updates the contents of a SurgeScript Vector2 object (useful for engine functions / performance)
@@ -157,9 +184,7 @@ surgescript_var_t* fun_main(surgescript_object_t* object, const surgescript_var_
 /* constructor */
 surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
-    surgescript_vector2_t* v = ssmalloc(sizeof *v);
-    v->x = v->y = 0.0;
-    v->initialized = false;
+    surgescript_vector2_t* v = create_vector_data();
     surgescript_object_set_userdata(object, v);
     return NULL;
 }
@@ -168,7 +193,7 @@ surgescript_var_t* fun_constructor(surgescript_object_t* object, const surgescri
 surgescript_var_t* fun_destructor(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
 {
     surgescript_vector2_t* v = get_vector(object);
-    ssfree(v);
+    destroy_vector_data(v);
     return NULL;
 }
 
@@ -414,4 +439,39 @@ surgescript_objecthandle_t spawn_vector(surgescript_objectmanager_t* manager, do
     v->x = x;
     v->y = y;
     return handle;
-}
\ No newline at end of file
+}
+
+/* create vector data */
+surgescript_vector2_t* create_vector_data()
+{
+    surgescript_vector2_t* v = pool;
+
+    /* reuse vector data from the pool, if possible */
+    if(v != NULL) {
+        pool = v->next_free;
+        pool_size--;
+    }
+    else
+        v = ssmalloc(sizeof *v);
+
+    v->x = v->y = 0.0;
+    v->initialized = false;
+    v->next_free = NULL;
+
+    return v;
+}
+
+/* destroy vector data */
+surgescript_vector2_t* destroy_vector_data(surgescript_vector2_t* v)
+{
+    /* give the vector data back to the pool */
+    if(pool_size < MAX_POOL_SIZE) {
+        v->next_free = pool;
+        pool = v;
+        pool_size++;
+        return NULL;
+    }
+
+    ssfree(v);
+    return NULL;
+}
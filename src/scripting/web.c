@@ -30,6 +30,19 @@ static surgescript_var_t* fun_destroy(surgescript_object_t* object, const surges
 static surgescript_var_t* fun_spawn(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_launchurl(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
 static surgescript_var_t* fun_encodeuricomponent(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_get(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_post(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_sendtelemetry(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static surgescript_var_t* fun_gethttpavailable(surgescript_object_t* object, const surgescript_var_t** param, int num_params);
+static bool is_http_url(surgescript_object_t* object, const char* url);
+static void* create_listener(surgescript_object_t* object, const surgescript_var_t* listener);
+static void notify_listener(const httpresponse_t* response, void* context);
+
+/* the listener of a HTTP request */
+typedef struct weblistener_t weblistener_t;
+struct weblistener_t {
+    surgescript_objecthandle_t handle; /* object with an onResponse(status, body) function */
+};
 
 /*
  * scripting_register_web()
@@ -42,6 +55,10 @@ void scripting_register_web(surgescript_vm_t* vm)
     surgescript_vm_bind(vm, "Web", "spawn", fun_spawn, 1);
     surgescript_vm_bind(vm, "Web", "launchURL", fun_launchurl, 1);
     surgescript_vm_bind(vm, "Web", "encodeURIComponent", fun_encodeuricomponent, 1);
+    surgescript_vm_bind(vm, "Web", "get", fun_get, 2);
+    surgescript_vm_bind(vm, "Web", "post", fun_post, 3);
+    surgescript_vm_bind(vm, "Web", "sendTelemetry", fun_sendtelemetry, 2);
+    surgescript_vm_bind(vm, "Web", "get_httpAvailable", fun_gethttpavailable, 0);
 }
 
 /* main state */
@@ -99,4 +116,119 @@ surgescript_var_t* fun_encodeuricomponent(surgescript_object_t* object, const su
     free(buf);
     ssfree(uri_component);
     return ret;
-}
\ No newline at end of file
+}
+
+/* make an asynchronous GET request: give a URL and an optional listener,
+   an object whose onResponse(status, body) function will be called when
+   the request is complete. status is 0 on failure */
+surgescript_var_t* fun_get(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    const surgescript_objectmanager_t* manager = surgescript_object_manager(object);
+    char* url = surgescript_var_get_string(param[0], manager);
+
+    if(is_http_url(object, url)) {
+        void* listener = create_listener(object, param[1]);
+        if(!http_get(url, listener != NULL ? notify_listener : NULL, listener))
+            free(listener);
+    }
+
+    ssfree(url);
+    return NULL;
+}
+
+/* make an asynchronous POST request: give a URL, the data to be sent (JSON)
+   and an optional listener, as in get() */
+surgescript_var_t* fun_post(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    const surgescript_objectmanager_t* manager = surgescript_object_manager(object);
+    char* url = surgescript_var_get_string(param[0], manager);
+
+    if(is_http_url(object, url)) {
+        char* data = surgescript_var_get_string(param[1], manager);
+        void* listener = create_listener(object, param[2]);
+
+        if(!http_post(url, data, "application/json", listener != NULL ? notify_listener : NULL, listener))
+            free(listener);
+
+        ssfree(data);
+    }
+
+    ssfree(url);
+    return NULL;
+}
+
+/* send a telemetry event (a string in JSON format) to a URL. Events sent to
+   the same URL are batched and posted together as a JSON array */
+surgescript_var_t* fun_sendtelemetry(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    const surgescript_objectmanager_t* manager = surgescript_object_manager(object);
+    char* url = surgescript_var_get_string(param[0], manager);
+
+    if(is_http_url(object, url)) {
+        char* event = surgescript_var_get_string(param[1], manager);
+        http_send_telemetry(url, event);
+        ssfree(event);
+    }
+
+    ssfree(url);
+    return NULL;
+}
+
+/* can HTTP requests be made in this build? */
+surgescript_var_t* fun_gethttpavailable(surgescript_object_t* object, const surgescript_var_t** param, int num_params)
+{
+    return surgescript_var_set_bool(surgescript_var_create(), web_is_http_available());
+}
+
+/* checks if a URL is suitable for a HTTP request, warning the user if it's not */
+bool is_http_url(surgescript_object_t* object, const char* url)
+{
+    if(strncmp(url, "http://", 7) == 0 || strncmp(url, "https://", 8) == 0)
+        return true;
+
+    if(strstr(url, "://") != NULL)
+        scripting_warning(object, "Can't request URL. Unsupported protocol for %s", url);
+    else
+        scripting_warning(object, "Can't request URL. Please specify a protocol (e.g., https://) to request %s", url);
+
+    return false;
+}
+
+/* creates the listener of a HTTP request. Returns NULL if there is no listener */
+void* create_listener(surgescript_object_t* object, const surgescript_var_t* listener)
+{
+    if(!surgescript_var_is_objecthandle(listener))
+        return NULL;
+
+    weblistener_t* l = mallocx(sizeof *l);
+    l->handle = surgescript_var_get_objecthandle(listener);
+    return l;
+}
+
+/* calls onResponse(status, body) on the listener of a HTTP request, if it still exists */
+void notify_listener(const httpresponse_t* response, void* context)
+{
+    weblistener_t* listener = (weblistener_t*)context;
+    surgescript_vm_t* vm = surgescript_vm();
+
+    if(response->status != HTTP_CANCELED && surgescript_vm_is_active(vm)) {
+        surgescript_objectmanager_t* manager = surgescript_vm_objectmanager(vm);
+
+        if(surgescript_objectmanager_exists(manager, listener->handle)) {
+            surgescript_object_t* object = surgescript_objectmanager_get(manager, listener->handle);
+
+            if(surgescript_object_has_function(object, "onResponse")) {
+                surgescript_var_t* status = surgescript_var_set_number(surgescript_var_create(), response->status);
+                surgescript_var_t* body = surgescript_var_set_string(surgescript_var_create(), response->body);
+                const surgescript_var_t* args[] = { status, body };
+
+                surgescript_object_call_function(object, "onResponse", args, 2, NULL);
+
+                surgescript_var_destroy(body);
+                surgescript_var_destroy(status);
+            }
+        }
+    }
+
+    free(listener);
+}
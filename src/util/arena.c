@@ -0,0 +1,183 @@
+/*
+ * Open Surge Engine
+ * arena.c - bump allocator for short-lived allocations
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include "arena.h"
+#include "util.h"
+
+/* a contiguous block of memory */
+typedef struct arenachunk_t arenachunk_t;
+struct arenachunk_t
+{
+    arenachunk_t* next; /* previously filled chunk */
+    size_t capacity; /* size of data[], in bytes */
+    size_t offset; /* bytes of data[] in use */
+    uint8_t* data; /* aligned storage */
+};
+
+/* arena */
+struct arena_t
+{
+    arenachunk_t* chunk; /* current chunk; older ones follow */
+    size_t used; /* bytes allocated since the last reset */
+    size_t high_water_mark; /* max(used) */
+};
+
+/* alignment of the allocations, in bytes; suitable for any scalar type and for SIMD vectors */
+#define ARENA_ALIGNMENT 16
+#define ALIGN_UP(n) (((n) + (ARENA_ALIGNMENT - 1)) & ~((size_t)(ARENA_ALIGNMENT - 1)))
+
+#define MIN_CHUNK_CAPACITY 1024 /* in bytes */
+
+static arenachunk_t* create_chunk(size_t capacity, arenachunk_t* next);
+static void destroy_chunks(arenachunk_t* chunk);
+
+
+
+/*
+ * arena_create()
+ * Creates a new arena
+ */
+arena_t* arena_create(size_t initial_capacity)
+{
+    arena_t* arena = mallocx(sizeof *arena);
+
+    arena->chunk = create_chunk(max(initial_capacity, MIN_CHUNK_CAPACITY), NULL);
+    arena->used = 0;
+    arena->high_water_mark = 0;
+
+    return arena;
+}
+
+/*
+ * arena_destroy()
+ * Destroys an arena and all of its allocations
+ */
+arena_t* arena_destroy(arena_t* arena)
+{
+    destroy_chunks(arena->chunk);
+    free(arena);
+
+    return NULL;
+}
+
+/*
+ * arena_alloc()
+ * Allocates memory from the arena. The returned pointer is valid until the
+ * arena is reset or destroyed. This never returns NULL
+ */
+void* arena_alloc(arena_t* arena, size_t bytes)
+{
+    arenachunk_t* chunk = arena->chunk;
+    size_t size = ALIGN_UP(max(bytes, 1));
+
+    /* the current chunk is full: grow. We don't move the existing allocations */
+    if(chunk->offset + size > chunk->capacity) {
+        size_t capacity = max(2 * chunk->capacity, size);
+        chunk = arena->chunk = create_chunk(capacity, chunk);
+    }
+
+    /* bump the pointer */
+    void* ptr = chunk->data + chunk->offset;
+    chunk->offset += size;
+
+    /* update the statistics */
+    arena->used += size;
+    if(arena->used > arena->high_water_mark)
+        arena->high_water_mark = arena->used;
+
+    return ptr;
+}
+
+/*
+ * arena_reset()
+ * Releases all allocations at once
+ */
+void arena_reset(arena_t* arena)
+{
+    arenachunk_t* chunk = arena->chunk;
+
+    /* the arena has grown since the last reset. Replace all chunks
+       by a single one that fits everything, so that we won't need
+       to grow again if the next usage pattern is similar */
+    if(chunk->next != NULL) {
+        size_t capacity = 0;
+        for(arenachunk_t* c = chunk; c != NULL; c = c->next)
+            capacity += c->capacity;
+
+        destroy_chunks(chunk);
+        chunk = arena->chunk = create_chunk(capacity, NULL);
+    }
+
+    chunk->offset = 0;
+    arena->used = 0;
+}
+
+/*
+ * arena_used()
+ * The number of bytes allocated since the last reset
+ */
+size_t arena_used(const arena_t* arena)
+{
+    return arena->used;
+}
+
+/*
+ * arena_high_water_mark()
+ * The largest number of bytes allocated between two resets
+ */
+size_t arena_high_water_mark(const arena_t* arena)
+{
+    return arena->high_water_mark;
+}
+
+
+
+/* private */
+
+/* creates a new chunk with the given capacity */
+arenachunk_t* create_chunk(size_t capacity, arenachunk_t* next)
+{
+    /* place the data right after the header of the chunk */
+    size_t header_size = ALIGN_UP(sizeof(arenachunk_t));
+    uint8_t* block = mallocx(header_size + capacity + ARENA_ALIGNMENT);
+    arenachunk_t* chunk = (arenachunk_t*)block;
+
+    /* mallocx() may not give us the alignment we want */
+    uintptr_t data = (uintptr_t)(block + header_size);
+    data = (data + (ARENA_ALIGNMENT - 1)) & ~((uintptr_t)(ARENA_ALIGNMENT - 1));
+
+    chunk->next = next;
+    chunk->capacity = capacity;
+    chunk->offset = 0;
+    chunk->data = (uint8_t*)data;
+
+    return chunk;
+}
+
+/* destroys a list of chunks */
+void destroy_chunks(arenachunk_t* chunk)
+{
+    while(chunk != NULL) {
+        arenachunk_t* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
@@ -0,0 +1,58 @@
+/*
+ * Open Surge Engine
+ * arena.h - bump allocator for short-lived allocations
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+/*
+
+An arena hands out memory by bumping a pointer. Individual allocations are
+never freed; instead, the whole arena is reset at once. All pointers given
+by an arena remain valid until it is reset or destroyed.
+
+Usage example:
+
+arena_t* arena = arena_create(4096);
+
+for(;;) {
+    arena_reset(arena);
+    int* tmp = arena_alloc(arena, n * sizeof(int));
+    ...
+}
+
+arena_destroy(arena);
+
+*/
+
+#include <stddef.h>
+
+/* opaque type */
+typedef struct arena_t arena_t;
+
+arena_t* arena_create(size_t initial_capacity); /* creates a new arena */
+arena_t* arena_destroy(arena_t* arena); /* destroys an arena and all of its allocations */
+
+void* arena_alloc(arena_t* arena, size_t bytes); /* allocates suitably aligned memory; never returns NULL */
+void arena_reset(arena_t* arena); /* releases all allocations at once */
+
+size_t arena_used(const arena_t* arena); /* bytes allocated since the last reset */
+size_t arena_high_water_mark(const arena_t* arena); /* largest number of bytes allocated between two resets */
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ * Open Surge Engine
+ * atom.c - interned strings
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "atom.h"
+#include "darray.h"
+#include "djb2.h"
+#include "stringutil.h"
+#include "util.h"
+
+/* a slot of the hash table of the interned strings */
+typedef struct atomslot_t atomslot_t;
+struct atomslot_t
+{
+    uint32_t hash; /* hash of the string */
+    atom_t atom; /* ATOM_NONE if the slot is empty */
+};
+
+/* interned strings */
+STATIC_DARRAY(char*, name); /* name[atom] is the string of the atom; name[ATOM_NONE] is NULL */
+static atomslot_t* slot = NULL; /* open addressing with linear probing */
+static uint32_t slot_mask = 0; /* capacity - 1, where capacity is a power of two */
+#define INITIAL_CAPACITY 1024 /* must be a power of two */
+
+static void init_table();
+static void grow_table();
+static inline uint32_t hash_of(const char* str);
+
+
+
+/*
+ * atom_intern()
+ * Interns a string, returning its atom
+ */
+atom_t atom_intern(const char* str)
+{
+    atom_t atom = atom_find(str);
+    if(atom != ATOM_NONE)
+        return atom;
+
+    /* keep the load factor at most 1/2 */
+    if(2 * darray_length(name) >= slot_mask + 1)
+        grow_table();
+
+    /* add the string */
+    uint32_t hash = hash_of(str);
+    atom = darray_length(name);
+    darray_push(name, str_dup(str));
+
+    uint32_t k = hash & slot_mask;
+    while(slot[k].atom != ATOM_NONE)
+        k = (k + 1) & slot_mask;
+
+    slot[k].hash = hash;
+    slot[k].atom = atom;
+
+    return atom;
+}
+
+/*
+ * atom_find()
+ * The atom of a string, or ATOM_NONE if the string hasn't been interned
+ */
+atom_t atom_find(const char* str)
+{
+    if(slot == NULL)
+        init_table();
+
+    uint32_t hash = hash_of(str);
+    for(uint32_t k = hash & slot_mask; slot[k].atom != ATOM_NONE; k = (k + 1) & slot_mask) {
+        if(slot[k].hash == hash && strcmp(name[slot[k].atom], str) == 0)
+            return slot[k].atom;
+    }
+
+    return ATOM_NONE;
+}
+
+/*
+ * atom_name()
+ * The string of an atom, or NULL if the atom is invalid
+ */
+const char* atom_name(atom_t atom)
+{
+    if(slot == NULL || atom >= darray_length(name))
+        return NULL;
+
+    return name[atom];
+}
+
+/*
+ * atom_release()
+ * Releases all atoms. Previously interned atoms become invalid
+ */
+void atom_release()
+{
+    if(slot == NULL)
+        return;
+
+    for(int i = darray_length(name) - 1; i > 0; i--)
+        free(name[i]);
+    darray_release(name);
+
+    free(slot);
+    slot = NULL;
+    slot_mask = 0;
+}
+
+
+
+/* private */
+
+/* initializes the hash table */
+void init_table()
+{
+    darray_init(name);
+    darray_push(name, NULL); /* ATOM_NONE */
+
+    slot = mallocx(INITIAL_CAPACITY * sizeof(*slot));
+    slot_mask = INITIAL_CAPACITY - 1;
+    memset(slot, 0, INITIAL_CAPACITY * sizeof(*slot));
+}
+
+/* doubles the capacity of the hash table */
+void grow_table()
+{
+    uint32_t old_capacity = slot_mask + 1;
+    atomslot_t* old_slot = slot;
+
+    slot_mask = 2 * old_capacity - 1;
+    slot = mallocx((slot_mask + 1) * sizeof(*slot));
+    memset(slot, 0, (slot_mask + 1) * sizeof(*slot));
+
+    for(uint32_t i = 0; i < old_capacity; i++) {
+        if(old_slot[i].atom != ATOM_NONE) {
+            uint32_t k = old_slot[i].hash & slot_mask;
+            while(slot[k].atom != ATOM_NONE)
+                k = (k + 1) & slot_mask;
+
+            slot[k] = old_slot[i];
+        }
+    }
+
+    free(old_slot);
+}
+
+/* hash function */
+uint32_t hash_of(const char* str)
+{
+    uint64_t h = djb2(str);
+    return (uint32_t)(h ^ (h >> 32));
+}
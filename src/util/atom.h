@@ -0,0 +1,44 @@
+/*
+ * Open Surge Engine
+ * atom.h - interned strings
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ATOM_H
+#define _ATOM_H
+
+#include <stdint.h>
+
+/*
+
+An atom is a small integer that stands for an interned string. Equal strings
+(case-sensitive) are interned to the same atom, so names can be resolved once
+and then compared as integers. Atoms are stable until atom_release() is called.
+
+Interning is not thread-safe: use it on the main thread only.
+
+*/
+
+typedef uint32_t atom_t;
+#define ATOM_NONE ((atom_t)0) /* no atom is ever interned as ATOM_NONE */
+
+atom_t atom_intern(const char* str); /* interns a string, returning its atom */
+atom_t atom_find(const char* str); /* the atom of a string, or ATOM_NONE if it hasn't been interned */
+const char* atom_name(atom_t atom); /* the string of an atom, or NULL if the atom is invalid */
+void atom_release(); /* releases all atoms */
+
+#endif
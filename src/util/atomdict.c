@@ -0,0 +1,250 @@
+/*
+ * Open Surge Engine
+ * atomdict.c - a dictionary keyed by atoms
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "atomdict.h"
+#include "util.h"
+
+/*
+
+This is an open addressing hash table with robin hood hashing: on insertion,
+an entry that is farther from its home slot takes the place of an entry that
+is closer to its own. This keeps the probe sequences short and even, and lets
+lookups stop early: a miss is detected as soon as we find an entry that is
+closer to its home slot than the key we're looking for would be.
+
+*/
+
+/* dictionary entry */
+typedef struct atomdictentry_t atomdictentry_t;
+struct atomdictentry_t
+{
+    atom_t key;
+    uint32_t distance; /* 1 + distance to the home slot; 0 if the entry is empty */
+    void* value;
+};
+
+/* dictionary */
+struct atomdict_t
+{
+    void (*dtor)(void*,void*);
+    void *dtor_context;
+
+    int count; /* number of entries */
+    uint32_t mask; /* capacity - 1, where capacity is a power of two */
+    atomdictentry_t* entry;
+};
+
+#define INITIAL_CAPACITY 8 /* must be a power of two */
+#define MAX_LOAD_FACTOR(capacity) (((capacity) * 7) / 8) /* robin hood hashing works well under high load */
+
+static inline uint32_t home_slot(const atomdict_t* dict, atom_t key);
+static void insert(atomdict_t* dict, atom_t key, void* value);
+static void grow(atomdict_t* dict);
+static void null_dtor(void* element, void* dtor_context);
+
+
+
+/*
+ * atomdict_create()
+ * Creates a dictionary with an optional element destructor
+ */
+atomdict_t* atomdict_create(void (*element_dtor)(void*,void*), void* dtor_context)
+{
+    atomdict_t* dict = mallocx(sizeof *dict);
+
+    dict->dtor = element_dtor != NULL ? element_dtor : null_dtor;
+    dict->dtor_context = dtor_context;
+
+    dict->count = 0;
+    dict->mask = INITIAL_CAPACITY - 1;
+    dict->entry = mallocx(INITIAL_CAPACITY * sizeof(*(dict->entry)));
+    memset(dict->entry, 0, INITIAL_CAPACITY * sizeof(*(dict->entry)));
+
+    return dict;
+}
+
+/*
+ * atomdict_destroy()
+ * Destroys a dictionary and its elements
+ */
+atomdict_t* atomdict_destroy(atomdict_t* dict)
+{
+    for(uint32_t i = 0; i <= dict->mask; i++) {
+        if(dict->entry[i].distance != 0)
+            dict->dtor(dict->entry[i].value, dict->dtor_context);
+    }
+
+    free(dict->entry);
+    free(dict);
+
+    return NULL;
+}
+
+/*
+ * atomdict_get()
+ * Gets an element from the dictionary. Returns NULL if there is no such key
+ */
+void* atomdict_get(const atomdict_t* dict, atom_t key)
+{
+    uint32_t k = home_slot(dict, key);
+
+    for(uint32_t distance = 1; distance <= dict->entry[k].distance; distance++) {
+        if(dict->entry[k].key == key)
+            return dict->entry[k].value;
+
+        k = (k + 1) & dict->mask;
+    }
+
+    return NULL;
+}
+
+/*
+ * atomdict_put()
+ * Puts an element into the dictionary. If the key is already present,
+ * the previous element is destroyed and replaced by the new one
+ */
+void atomdict_put(atomdict_t* dict, atom_t key, void* element)
+{
+    uint32_t k = home_slot(dict, key);
+
+    /* replace an existing entry */
+    for(uint32_t distance = 1; distance <= dict->entry[k].distance; distance++) {
+        if(dict->entry[k].key == key) {
+            if(dict->entry[k].value != element) {
+                dict->dtor(dict->entry[k].value, dict->dtor_context);
+                dict->entry[k].value = element;
+            }
+            return;
+        }
+
+        k = (k + 1) & dict->mask;
+    }
+
+    /* add a new entry */
+    if(dict->count + 1 > MAX_LOAD_FACTOR(dict->mask + 1))
+        grow(dict);
+
+    insert(dict, key, element);
+    dict->count++;
+}
+
+/*
+ * atomdict_count()
+ * The number of entries of the dictionary
+ */
+int atomdict_count(const atomdict_t* dict)
+{
+    return dict->count;
+}
+
+/*
+ * atomdictiter_init()
+ * Initializes a value-type iterator over the entries of the dictionary
+ */
+void atomdictiter_init(atomdictiter_t* it, const atomdict_t* dict)
+{
+    it->dict = dict;
+    it->current_index = 0;
+}
+
+/*
+ * atomdictiter_next()
+ * Gets the next entry and advances the iteration pointer.
+ * Returns false if the iteration is over
+ */
+bool atomdictiter_next(atomdictiter_t* it, atom_t* key, void** element)
+{
+    const atomdict_t* dict = it->dict;
+
+    while(it->current_index <= (int)dict->mask) {
+        const atomdictentry_t* entry = &(dict->entry[it->current_index++]);
+
+        if(entry->distance != 0) {
+            if(key != NULL)
+                *key = entry->key;
+            if(element != NULL)
+                *element = entry->value;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+
+/*
+ *
+ * private
+ *
+ */
+
+/* the preferred slot of a key (Fibonacci hashing; atoms are small sequential integers) */
+uint32_t home_slot(const atomdict_t* dict, atom_t key)
+{
+    return (uint32_t)(key * UINT32_C(2654435769)) & dict->mask;
+}
+
+/* inserts a key that isn't in the dictionary, assuming there is room for it */
+void insert(atomdict_t* dict, atom_t key, void* value)
+{
+    atomdictentry_t incoming = { .key = key, .distance = 1, .value = value };
+    uint32_t k = home_slot(dict, key);
+
+    while(dict->entry[k].distance != 0) {
+        /* rob the rich: the incoming entry is farther from home */
+        if(dict->entry[k].distance < incoming.distance) {
+            atomdictentry_t tmp = dict->entry[k];
+            dict->entry[k] = incoming;
+            incoming = tmp;
+        }
+
+        k = (k + 1) & dict->mask;
+        incoming.distance++;
+    }
+
+    dict->entry[k] = incoming;
+}
+
+/* doubles the capacity of the dictionary */
+void grow(atomdict_t* dict)
+{
+    uint32_t old_capacity = dict->mask + 1;
+    atomdictentry_t* old_entry = dict->entry;
+
+    dict->mask = 2 * old_capacity - 1;
+    dict->entry = mallocx((dict->mask + 1) * sizeof(*(dict->entry)));
+    memset(dict->entry, 0, (dict->mask + 1) * sizeof(*(dict->entry)));
+
+    for(uint32_t i = 0; i < old_capacity; i++) {
+        if(old_entry[i].distance != 0)
+            insert(dict, old_entry[i].key, old_entry[i].value);
+    }
+
+    free(old_entry);
+}
+
+/* an element destructor that does nothing */
+void null_dtor(void* element, void* dtor_context)
+{
+    /* do nothing */
+}
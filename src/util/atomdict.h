@@ -0,0 +1,49 @@
+/*
+ * Open Surge Engine
+ * atomdict.h - a dictionary keyed by atoms
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ATOMDICT_H
+#define _ATOMDICT_H
+
+#include <stdbool.h>
+#include "atom.h"
+
+/* opaque type */
+typedef struct atomdict_t atomdict_t;
+
+/* API */
+atomdict_t* atomdict_create(void (*element_dtor)(void*,void*), void* dtor_context);
+atomdict_t* atomdict_destroy(atomdict_t* dict);
+void* atomdict_get(const atomdict_t* dict, atom_t key); /* returns NULL if there is no such key */
+void atomdict_put(atomdict_t* dict, atom_t key, void* element); /* replaces (and destroys) the previous element, if any */
+int atomdict_count(const atomdict_t* dict); /* number of entries */
+
+/* value-type iterator. The order of iteration is unspecified.
+   Do not modify the dictionary while iterating */
+typedef struct atomdictiter_t atomdictiter_t;
+struct atomdictiter_t
+{
+    const atomdict_t* dict;
+    int current_index;
+};
+
+void atomdictiter_init(atomdictiter_t* it, const atomdict_t* dict);
+bool atomdictiter_next(atomdictiter_t* it, atom_t* key, void** element); /* returns false when the iteration is over */
+
+#endif
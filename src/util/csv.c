@@ -18,14 +18,47 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <allegro5/allegro.h>
+#include <stdlib.h>
 #include <string.h>
 #include "stringutil.h"
+#include "darray.h"
+#include "util.h"
 #include "csv.h"
 #include "../core/logfile.h"
 
 /* Maximum supported number of fields per line */
 #define CSV_MAX_FIELDS 64
 
+/* Size of the buffer used when parsing a file in chunks */
+#define CSV_BUFFER_SIZE 4096
+
+/* a column of a CSV table */
+typedef struct csvcolumn_t csvcolumn_t;
+struct csvcolumn_t
+{
+    char* name;
+    DARRAY(int, offset); /* offset of the string of each row in the string pool */
+    DARRAY(double, number); /* numeric value of each row */
+    DARRAY(bool, is_number); /* is the field of each row numeric? */
+};
+
+/* CSV table */
+struct csvtable_t
+{
+    int row_count;
+    DARRAY(csvcolumn_t, column);
+    DARRAY(char, pool); /* the strings of all fields, NUL-terminated */
+};
+
+static int split_line(char* line, const char* delimiters, char** fields);
+static void add_row(int field_count, const char** fields, int line_number, void* table);
+static int add_string(csvtable_t* table, const char* str);
+static bool parse_number(const char* str, double* out_number);
+static inline const csvcolumn_t* find_field(const csvtable_t* table, int row, int column);
+
+
+
 /*
  * csv_parse()
  * Parse a CSV file stored in memory
@@ -33,7 +66,6 @@
 void csv_parse(const char* csv_content, const char* delimiters, csv_callback_t callback, void* user_data)
 {
     char* fields[CSV_MAX_FIELDS];
-    int field_count = 0;
     int line_number = 0;
 
     /* copy the contents of the csv file */
@@ -42,42 +74,320 @@ void csv_parse(const char* csv_content, const char* delimiters, csv_callback_t c
     /* for each line */
     char* line = strtok(csv, "\n");
     while(line != NULL) {
-
-        /* for each line field */
-        char* field = line;
-        while(field != NULL) {
-            /* store it in fields[] */
-            char* end_of_field = strpbrk(field, delimiters);
-            if(end_of_field != NULL) {
-                char delim = *end_of_field;
-                *end_of_field = 0;
-                fields[field_count++] = str_dup(field);
-                *end_of_field = delim;
-                field = end_of_field + 1;
-            }
-            else {
-                fields[field_count++] = str_dup(field);
-                field = NULL;
-            }
-
-            /* too many fields? */
-            if(field_count >= CSV_MAX_FIELDS) {
-                logfile_message("Too many CSV fields (%d)", field_count);
-                field = NULL;
-            }
-        }
+        /* the fields are split in place */
+        int field_count = split_line(line, delimiters, fields);
 
         /* callback */
         callback(field_count, (const char**)fields, line_number++, user_data);
 
-        /* clear up fields[] */
-        while(field_count != 0)
-            free(fields[--field_count]);
-
         /* read the next line */
         line = strtok(NULL, "\n");
     }
 
     /* release */
     free(csv);
-}
\ No newline at end of file
+}
+
+/*
+ * csv_parse_file()
+ * Parse a CSV file in chunks, without loading all of it into memory.
+ * The lines are handled just like in csv_parse()
+ */
+void csv_parse_file(ALLEGRO_FILE* fp, const char* delimiters, csv_callback_t callback, void* user_data)
+{
+    char* fields[CSV_MAX_FIELDS];
+    int line_number = 0;
+
+    /* the buffer only grows if a single line doesn't fit it */
+    size_t capacity = CSV_BUFFER_SIZE;
+    char* buffer = mallocx(capacity + 1);
+    size_t length = 0;
+    bool eof = false;
+
+    for(;;) {
+        /* fill the buffer */
+        if(!eof) {
+            size_t n = al_fread(fp, buffer + length, capacity - length);
+            eof = (n < capacity - length);
+            length += n;
+        }
+        buffer[length] = '\0';
+
+        /* for each complete line of the buffer */
+        char* line = buffer;
+        char* end_of_line;
+        while((end_of_line = memchr(line, '\n', length - (line - buffer))) != NULL) {
+            *end_of_line = '\0';
+
+            /* skip empty lines, just like csv_parse() does */
+            if(*line != '\0') {
+                int field_count = split_line(line, delimiters, fields);
+                callback(field_count, (const char**)fields, line_number++, user_data);
+            }
+
+            line = end_of_line + 1;
+        }
+
+        /* the last line may not end with a line break */
+        size_t remaining = length - (line - buffer);
+        if(eof) {
+            if(*line != '\0') {
+                int field_count = split_line(line, delimiters, fields);
+                callback(field_count, (const char**)fields, line_number++, user_data);
+            }
+
+            break;
+        }
+
+        /* keep the incomplete line for the next chunk */
+        if(remaining == capacity) {
+            /* a very long line */
+            capacity *= 2;
+            buffer = reallocx(buffer, capacity + 1);
+        }
+        else
+            memmove(buffer, line, remaining);
+
+        length = remaining;
+    }
+
+    /* release */
+    free(buffer);
+}
+
+/*
+ * csvtable_load()
+ * Loads a CSV file into a table. Returns NULL if the file has no header
+ */
+csvtable_t* csvtable_load(ALLEGRO_FILE* fp, const char* delimiters)
+{
+    csvtable_t* table = mallocx(sizeof *table);
+
+    table->row_count = -1; /* the header isn't a row */
+    darray_init(table->column);
+    darray_init_ex(table->pool, CSV_BUFFER_SIZE);
+    darray_push(table->pool, '\0'); /* offset zero is the empty string */
+
+    csv_parse_file(fp, delimiters, add_row, table);
+
+    if(table->row_count < 0) {
+        logfile_message("Can't load a CSV table without a header");
+        return csvtable_destroy(table);
+    }
+
+    return table;
+}
+
+/*
+ * csvtable_destroy()
+ * Destroys a CSV table
+ */
+csvtable_t* csvtable_destroy(csvtable_t* table)
+{
+    for(int j = 0; j < darray_length(table->column); j++) {
+        csvcolumn_t* column = &(table->column[j]);
+
+        darray_release(column->is_number);
+        darray_release(column->number);
+        darray_release(column->offset);
+        free(column->name);
+    }
+
+    darray_release(table->pool);
+    darray_release(table->column);
+    free(table);
+
+    return NULL;
+}
+
+/*
+ * csvtable_row_count()
+ * The number of rows of the table, not counting the header
+ */
+int csvtable_row_count(const csvtable_t* table)
+{
+    return table->row_count;
+}
+
+/*
+ * csvtable_column_count()
+ * The number of columns of the table
+ */
+int csvtable_column_count(const csvtable_t* table)
+{
+    return darray_length(table->column);
+}
+
+/*
+ * csvtable_column_index()
+ * The index of the column with the given name, or -1 if there is no such column
+ */
+int csvtable_column_index(const csvtable_t* table, const char* column_name)
+{
+    for(int j = 0; j < darray_length(table->column); j++) {
+        if(strcmp(table->column[j].name, column_name) == 0)
+            return j;
+    }
+
+    return -1;
+}
+
+/*
+ * csvtable_column_name()
+ * The name of a column, or NULL if there is no such column
+ */
+const char* csvtable_column_name(const csvtable_t* table, int column)
+{
+    if(column < 0 || column >= darray_length(table->column))
+        return NULL;
+
+    return table->column[column].name;
+}
+
+/*
+ * csvtable_string()
+ * The contents of a field, or "" if there is no such field
+ */
+const char* csvtable_string(const csvtable_t* table, int row, int column)
+{
+    const csvcolumn_t* col = find_field(table, row, column);
+    return col != NULL ? table->pool + col->offset[row] : "";
+}
+
+/*
+ * csvtable_number()
+ * The numeric value of a field, or 0 if the field isn't numeric
+ */
+double csvtable_number(const csvtable_t* table, int row, int column)
+{
+    const csvcolumn_t* col = find_field(table, row, column);
+    return col != NULL ? col->number[row] : 0.0;
+}
+
+/*
+ * csvtable_is_number()
+ * Checks if a field is numeric
+ */
+bool csvtable_is_number(const csvtable_t* table, int row, int column)
+{
+    const csvcolumn_t* col = find_field(table, row, column);
+    return col != NULL && col->is_number[row];
+}
+
+
+
+/* private */
+
+/* split a line into fields, in place. Returns the number of fields */
+int split_line(char* line, const char* delimiters, char** fields)
+{
+    int field_count = 0;
+
+    /* for each line field */
+    char* field = line;
+    while(field != NULL) {
+        /* store it in fields[] */
+        char* end_of_field = strpbrk(field, delimiters);
+        fields[field_count++] = field;
+        if(end_of_field != NULL) {
+            *end_of_field = 0;
+            field = end_of_field + 1;
+        }
+        else
+            field = NULL;
+
+        /* too many fields? */
+        if(field_count >= CSV_MAX_FIELDS) {
+            logfile_message("Too many CSV fields (%d)", field_count);
+            field = NULL;
+        }
+    }
+
+    return field_count;
+}
+
+/* a CSV callback that adds a line to a table */
+void add_row(int field_count, const char** fields, int line_number, void* user_data)
+{
+    csvtable_t* table = (csvtable_t*)user_data;
+
+    /* the header defines the columns */
+    if(line_number == 0) {
+        for(int j = 0; j < field_count; j++) {
+            csvcolumn_t column;
+
+            column.name = str_dup(fields[j]);
+            darray_init(column.offset);
+            darray_init(column.number);
+            darray_init(column.is_number);
+
+            darray_push(table->column, column);
+        }
+
+        table->row_count = 0;
+        return;
+    }
+
+    /* add the fields of the row. Missing fields are empty */
+    for(int j = 0; j < darray_length(table->column); j++) {
+        csvcolumn_t* column = &(table->column[j]);
+        const char* field = j < field_count ? fields[j] : "";
+        double number = 0.0;
+        bool is_number = parse_number(field, &number);
+
+        darray_push(column->offset, add_string(table, field));
+        darray_push(column->number, number);
+        darray_push(column->is_number, is_number);
+    }
+
+    /* extra fields are ignored */
+    if(field_count > darray_length(table->column))
+        logfile_message("CSV line %d has %d fields, but the header has %d", line_number, field_count, darray_length(table->column));
+
+    table->row_count++;
+}
+
+/* add a string to the string pool of the table, returning its offset */
+int add_string(csvtable_t* table, const char* str)
+{
+    int offset = darray_length(table->pool);
+
+    if(*str == '\0')
+        return 0;
+
+    while(*str)
+        darray_push(table->pool, *str++);
+    darray_push(table->pool, '\0');
+
+    return offset;
+}
+
+/* convert a string to a number, if it is numeric */
+bool parse_number(const char* str, double* out_number)
+{
+    char* end;
+
+    /* skip empty strings */
+    if(*str == '\0')
+        return false;
+
+    *out_number = strtod(str, &end);
+    while(*end == ' ' || *end == '\t' || *end == '\r')
+        end++;
+
+    if(*end != '\0') {
+        *out_number = 0.0;
+        return false;
+    }
+
+    return true;
+}
+
+/* the column of a valid field, or NULL if there is no such field */
+const csvcolumn_t* find_field(const csvtable_t* table, int row, int column)
+{
+    if(column < 0 || column >= darray_length(table->column) || row < 0 || row >= table->row_count)
+        return NULL;
+
+    return &(table->column[column]);
+}
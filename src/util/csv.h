@@ -30,7 +30,31 @@
  */
 typedef void (*csv_callback_t)(int,const char**,int,void*);
 
+#include <stdbool.h>
+
 /* Parse a CSV file stored in memory */
 void csv_parse(const char* csv_content, const char* delimiters, csv_callback_t callback, void* user_data);
 
+/* Parse a CSV file in chunks, without loading all of it into memory */
+struct ALLEGRO_FILE;
+void csv_parse_file(struct ALLEGRO_FILE* fp, const char* delimiters, csv_callback_t callback, void* user_data);
+
+/*
+ * A CSV table is a CSV file loaded into typed columns. The first line of
+ * the file is the header, which gives names to the columns. Rows are
+ * indexed from zero, not counting the header. Fields are split once, when
+ * loading the table, and numeric fields are converted to numbers as well
+ */
+typedef struct csvtable_t csvtable_t;
+
+csvtable_t* csvtable_load(struct ALLEGRO_FILE* fp, const char* delimiters);
+csvtable_t* csvtable_destroy(csvtable_t* table);
+int csvtable_row_count(const csvtable_t* table); /* number of rows, not counting the header */
+int csvtable_column_count(const csvtable_t* table); /* number of columns */
+int csvtable_column_index(const csvtable_t* table, const char* column_name); /* returns -1 if there is no such column */
+const char* csvtable_column_name(const csvtable_t* table, int column); /* returns NULL if there is no such column */
+const char* csvtable_string(const csvtable_t* table, int row, int column); /* returns "" if there is no such field */
+double csvtable_number(const csvtable_t* table, int row, int column); /* returns 0 if the field isn't numeric */
+bool csvtable_is_number(const csvtable_t* table, int row, int column); /* is the field numeric? */
+
 #endif
\ No newline at end of file
@@ -89,10 +89,23 @@
  */
 #define darray_clear(arr)                    (arr##_len = 0)
 
+/*
+ * darray_truncate()
+ * shrinks the array to the given length, without freeing any of its contents
+ */
+#define darray_truncate(arr, length)         \
+    do { if((length) < arr##_len && (length) >= 0) arr##_len = (length); } while(0)
+
 /*
  * darray_iterator()
  * returns a new iterator linked to the array; do not modify the array while iterating
  */
 #define darray_iterator(arr)                (iterator_create_from_array((arr), darray_length(arr), sizeof(*(arr))))
 
+/*
+ * darray_arrayiter()
+ * initializes a value-type arrayiter_t linked to the array; no heap allocations
+ */
+#define darray_arrayiter(it, arr)           (arrayiter_init((it), (arr), darray_length(arr), sizeof(*(arr))))
+
 #endif
\ No newline at end of file
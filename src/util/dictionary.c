@@ -50,12 +50,7 @@ static void release_entry(dictionary_t* dict, int entry_index);
 static void null_dtor(void* element, void* dtor_context);
 
 /* DictionaryIterator */
-typedef struct dictiterator_state_t dictiterator_state_t;
-struct dictiterator_state_t
-{
-    const dictionary_t* dict;
-    int current_index;
-};
+typedef dictionaryiter_t dictiterator_state_t;
 
 static iterator_state_t* dictiterator_copy_ctor(void* ctor_data);
 static void dictiterator_dtor(iterator_state_t* state);
@@ -188,6 +183,43 @@ iterator_t* dictionary_values(const dictionary_t* dict)
     return iterator_create(&state, dictiterator_copy_ctor, dictiterator_dtor, dictiterator_next_value, dictiterator_has_next);
 }
 
+/*
+ * dictionaryiter_init()
+ * Initializes a value-type iterator over the entries of the dictionary
+ */
+void dictionaryiter_init(dictionaryiter_t* it, const dictionary_t* dict)
+{
+    it->dict = dict;
+    it->current_index = 0;
+}
+
+/*
+ * dictionaryiter_has_next()
+ * Returns true if the iteration isn't over
+ */
+bool dictionaryiter_has_next(dictionaryiter_t* it)
+{
+    return dictiterator_has_next(it);
+}
+
+/*
+ * dictionaryiter_next_key()
+ * Returns the key of the next entry and advances the iteration pointer
+ */
+const char* dictionaryiter_next_key(dictionaryiter_t* it)
+{
+    return dictiterator_next_key(it);
+}
+
+/*
+ * dictionaryiter_next_value()
+ * Returns the value of the next entry and advances the iteration pointer
+ */
+void* dictionaryiter_next_value(dictionaryiter_t* it)
+{
+    return dictiterator_next_value(it);
+}
+
 
 
 
@@ -37,4 +37,18 @@ void dictionary_put(dictionary_t* dict, const char* key, void* element);
 struct iterator_t* dictionary_keys(const dictionary_t* dict);
 struct iterator_t* dictionary_values(const dictionary_t* dict);
 
+/* value-type iterator: the caller provides the storage (e.g., on the stack),
+   so no heap allocations are needed. Do not modify the dictionary while iterating */
+typedef struct dictionaryiter_t dictionaryiter_t;
+struct dictionaryiter_t
+{
+    const dictionary_t* dict;
+    int current_index;
+};
+
+void dictionaryiter_init(dictionaryiter_t* it, const dictionary_t* dict);
+bool dictionaryiter_has_next(dictionaryiter_t* it);
+const char* dictionaryiter_next_key(dictionaryiter_t* it);
+void* dictionaryiter_next_value(dictionaryiter_t* it);
+
 #endif
\ No newline at end of file
@@ -1,6 +1,6 @@
 /*
  * Open Surge Engine
- * fasthash.c - a fast hash table with integer keys and linear probing
+ * fasthash.c - a fast hash table with integer keys and group probing
  * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
  * http://opensurge2d.org
  *
@@ -19,40 +19,70 @@
  */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "fasthash.h"
+#include "simd.h"
 #include "util.h"
 
+/*
+
+This is an open addressing hash table in the style of Swiss tables. Next to
+the entries, we keep one control byte per slot: it's either EMPTY, DELETED or
+the 7 lowest bits of the hash of the key of an active entry. The slots are
+split into groups of 16, and the control bytes of a group are matched against
+the hash of a key all at once, using SIMD instructions when available. Only
+the entries whose control bytes match are compared with the key.
+
+A lookup probes the groups in a triangular sequence and stops at the first
+group that has an EMPTY slot.
+
+*/
+
 /* types */
-typedef enum fasthash_entry_state_t fasthash_entry_state_t;
 typedef struct fasthash_entry_t fasthash_entry_t;
-
-enum fasthash_entry_state_t {
-    BLANK,
-    ACTIVE,
-    DELETED
-};
+typedef uint64_t fasthash_mask_t;
 
 struct fasthash_entry_t
 {
     uint64_t key;
     void* value;
-    fasthash_entry_state_t state;
 };
 
 struct fasthash_t
 {
-    int length;
-    int capacity; /* a power of 2 */
+    int length; /* number of active entries */
+    int capacity; /* a power of 2, at least GROUP_SIZE */
+    int growth_left; /* how many EMPTY slots can still be taken before we rehash */
     uint64_t cap_mask; /* capacity - 1 */
+    int8_t* ctrl; /* control bytes */
     fasthash_entry_t* data;
     void (*destructor)(void*); /* element destructor */
 };
 
-/* static data */
-static const int SPARSITY = 4; /* 1 / load_factor */
-static fasthash_entry_t BLANK_ENTRY = { 0, NULL, BLANK };
+/* control bytes */
+#define GROUP_SIZE 16
+#define CTRL_EMPTY ((int8_t)-128)
+#define CTRL_DELETED ((int8_t)-2)
+#define IS_ACTIVE(ctrl) ((ctrl) >= 0)
+
+/* a group is matched into a bitmask. There are 1 (SSE2 & scalar) or 4 (NEON) bits per slot */
+#if defined(HAVE_NEON)
+#define MASK_SHIFT 2
+#else
+#define MASK_SHIFT 0
+#endif
+
+/* at most 7/8 of the slots may be taken */
+#define MAX_LOAD(capacity) ((capacity) - (capacity) / 8)
+
+/* private */
 static inline uint64_t hash(uint64_t x);
-static void grow(fasthash_t* hashtable);
+static inline fasthash_mask_t match_byte(const int8_t* group, int8_t byte);
+static inline fasthash_mask_t match_empty_or_deleted(const int8_t* group);
+static inline int next_match(fasthash_mask_t* mask);
+static inline int find_active_slot(const fasthash_t* hashtable, uint64_t key, uint64_t h);
+static inline int find_free_slot(const fasthash_t* hashtable, uint64_t h);
+static void rehash(fasthash_t* hashtable, int new_capacity);
 static void empty_destructor(void* data);
 
 
@@ -70,15 +100,17 @@ static void empty_destructor(void* data);
 fasthash_t* fasthash_create(void (*element_destructor)(void*), int lg2_cap)
 {
     fasthash_t* hashtable = mallocx(sizeof(fasthash_t));
+    int capacity = 1 << clip(lg2_cap, 4, 16); /* no more than 64K */
 
     hashtable->length = 0;
-    hashtable->capacity = 1 << clip(lg2_cap, 2, 16); /* no more than 64K */
-    hashtable->cap_mask = hashtable->capacity - 1;
+    hashtable->capacity = 0;
+    hashtable->growth_left = 0;
+    hashtable->cap_mask = 0;
+    hashtable->ctrl = NULL;
+    hashtable->data = NULL;
     hashtable->destructor = element_destructor ? element_destructor : empty_destructor;
-    hashtable->data = mallocx(hashtable->capacity * sizeof(fasthash_entry_t));
 
-    for(int i = 0; i < hashtable->capacity; i++)
-        hashtable->data[i] = BLANK_ENTRY;
+    rehash(hashtable, capacity);
 
     return hashtable;
 }
@@ -91,12 +123,13 @@ fasthash_t* fasthash_destroy(fasthash_t* hashtable)
 {
     /* destroy the remaining elements */
     for(int i = 0; i < hashtable->capacity; i++) {
-        if(hashtable->data[i].state == ACTIVE)
+        if(IS_ACTIVE(hashtable->ctrl[i]))
             hashtable->destructor(hashtable->data[i].value);
     }
     
     /* release the hash table */
     free(hashtable->data);
+    free(hashtable->ctrl);
     free(hashtable);
 
     /* omit warnings */
@@ -104,6 +137,10 @@ fasthash_t* fasthash_destroy(fasthash_t* hashtable)
     (void)fasthash_put;
     (void)fasthash_delete;
     (void)fasthash_find;
+    (void)fasthash_reserve;
+    (void)fasthash_put_many;
+    (void)fasthash_delete_many;
+    (void)fasthash_length;
 
     /* done */
     return NULL;
@@ -116,32 +153,8 @@ fasthash_t* fasthash_destroy(fasthash_t* hashtable)
  */
 void* fasthash_get(fasthash_t* hashtable, uint64_t key)
 {
-    uint32_t k = hash(key) & hashtable->cap_mask;
-    uint32_t marker = hashtable->capacity;
-
-    while(hashtable->data[k].state != BLANK) {
-        if(hashtable->data[k].state == ACTIVE) {
-            if(hashtable->data[k].key == key) {
-                /* swap marker */
-                if(marker < hashtable->capacity) {
-                    fasthash_entry_t deleted = hashtable->data[marker];
-                    hashtable->data[marker] = hashtable->data[k];
-                    hashtable->data[k] = deleted;
-                    return hashtable->data[marker].value;
-                }
-
-                /* return element */
-                return hashtable->data[k].value;
-            }
-        }
-        else if(marker == hashtable->capacity) /* state is DELETED */
-            marker = k; /* save first deleted entry */
-
-        /* probe */
-        ++k; k &= hashtable->cap_mask;
-    }
-
-    return NULL;
+    int k = find_active_slot(hashtable, key, hash(key));
+    return k >= 0 ? hashtable->data[k].value : NULL;
 }
 
 /*
@@ -150,46 +163,43 @@ void* fasthash_get(fasthash_t* hashtable, uint64_t key)
  */
 void fasthash_put(fasthash_t* hashtable, uint64_t key, void* value)
 {
+    uint64_t h = hash(key);
+    int k;
+
     /* won't accept NULL values */
     if(value == NULL)
         return;
 
-    /* make it sparse */
-    if(hashtable->length < hashtable->capacity / SPARSITY) {
-        uint32_t k = hash(key) & hashtable->cap_mask;
-
-        while(hashtable->data[k].state != BLANK) {
-            if(hashtable->data[k].state == DELETED) {
-                /* replace deleted element */
-                hashtable->data[k].key = key;
-                hashtable->data[k].value = value;
-                hashtable->data[k].state = ACTIVE;
-                return;
-            }
-            else if(hashtable->data[k].key == key) {
-                /* replace active element */
-                if(value != hashtable->data[k].value) {
-                    hashtable->destructor(hashtable->data[k].value); /* TODO: save until later? */
-                    hashtable->data[k].value = value;
-                }
-                return;
-            }
-
-            /* probe */
-            ++k; k &= hashtable->cap_mask;
+    /* replace active element */
+    if((k = find_active_slot(hashtable, key, h)) >= 0) {
+        if(value != hashtable->data[k].value) {
+            hashtable->destructor(hashtable->data[k].value); /* TODO: save until later? */
+            hashtable->data[k].value = value;
         }
-
-        /* insert new element */
-        hashtable->data[k].key = key;
-        hashtable->data[k].value = value;
-        hashtable->data[k].state = ACTIVE;
-        hashtable->length++;
+        return;
     }
-    else {
-        /* grow the hash table and try again */
-        grow(hashtable);
-        fasthash_put(hashtable, key, value);
+
+    /* we can reuse a DELETED slot at any time, but we can only
+       take an EMPTY slot if we haven't reached the maximum load */
+    k = find_free_slot(hashtable, h);
+    if(hashtable->ctrl[k] == CTRL_EMPTY && hashtable->growth_left == 0) {
+        /* get rid of the DELETED slots, or grow the hash table if there are few of them */
+        if(hashtable->length < MAX_LOAD(hashtable->capacity) / 2)
+            rehash(hashtable, hashtable->capacity);
+        else
+            rehash(hashtable, hashtable->capacity * 2);
+
+        k = find_free_slot(hashtable, h);
     }
+
+    /* insert new element */
+    if(hashtable->ctrl[k] == CTRL_EMPTY)
+        hashtable->growth_left--;
+
+    hashtable->ctrl[k] = (int8_t)(h & 0x7F);
+    hashtable->data[k].key = key;
+    hashtable->data[k].value = value;
+    hashtable->length++;
 }
 
 /*
@@ -199,26 +209,25 @@ void fasthash_put(fasthash_t* hashtable, uint64_t key, void* value)
  */
 bool fasthash_delete(fasthash_t* hashtable, uint64_t key)
 {
-    uint32_t k = hash(key) & hashtable->cap_mask;
-
-    while(hashtable->data[k].state != BLANK) {
-        if(hashtable->data[k].key == key) {
-            if(hashtable->data[k].state == ACTIVE) {
-                /* lazy removal of the entry */
-                hashtable->data[k].state = DELETED;
-                hashtable->destructor(hashtable->data[k].value);
-                return true;
-            }
-            else
-                return false; /* duplicate removal */
-        }
+    int k = find_active_slot(hashtable, key, hash(key));
 
-        /* probe */
-        ++k; k &= hashtable->cap_mask;
+    /* key not found */
+    if(k < 0)
+        return false;
+
+    /* if the group of the slot has an EMPTY slot, then no probe sequence
+       has ever gone past this group and we can mark the slot as EMPTY */
+    const int8_t* group = hashtable->ctrl + (k & ~(GROUP_SIZE - 1));
+    if(match_byte(group, CTRL_EMPTY) != 0) {
+        hashtable->ctrl[k] = CTRL_EMPTY;
+        hashtable->growth_left++;
     }
+    else
+        hashtable->ctrl[k] = CTRL_DELETED;
 
-    /* key not found */
-    return false;
+    hashtable->length--;
+    hashtable->destructor(hashtable->data[k].value);
+    return true;
 }
 
 /*
@@ -232,7 +241,7 @@ void* fasthash_find(fasthash_t* hashtable, bool (*test)(const void*,void*), void
     /* search the entire table */
     /* we could maintain a collection of active entries instead */
     for(int i = 0; i < hashtable->capacity; i++) {
-        if(hashtable->data[i].state == ACTIVE) {
+        if(IS_ACTIVE(hashtable->ctrl[i])) {
             if(test(hashtable->data[i].value, data))
                 return hashtable->data[i].value;
         }
@@ -242,32 +251,184 @@ void* fasthash_find(fasthash_t* hashtable, bool (*test)(const void*,void*), void
     return NULL;
 }
 
+/*
+ * fasthash_reserve()
+ * Makes room for the given number of elements, so that
+ * they can be put into the hash table without rehashing
+ */
+void fasthash_reserve(fasthash_t* hashtable, int count)
+{
+    int capacity = hashtable->capacity;
+
+    while(MAX_LOAD(capacity) < count && capacity < (1 << 30))
+        capacity *= 2;
+
+    if(capacity > hashtable->capacity)
+        rehash(hashtable, capacity);
+}
+
+/*
+ * fasthash_put_many()
+ * Puts many elements into the hash table at once
+ * values[i] is the element of keys[i]
+ */
+void fasthash_put_many(fasthash_t* hashtable, const uint64_t* keys, void* const* values, int count)
+{
+    fasthash_reserve(hashtable, hashtable->length + count);
+
+    for(int i = 0; i < count; i++)
+        fasthash_put(hashtable, keys[i], values[i]);
+}
+
+/*
+ * fasthash_delete_many()
+ * Deletes many elements from the hash table at once
+ * Returns the number of deleted elements
+ */
+int fasthash_delete_many(fasthash_t* hashtable, const uint64_t* keys, int count)
+{
+    int deleted = 0;
+
+    for(int i = 0; i < count; i++)
+        deleted += fasthash_delete(hashtable, keys[i]) ? 1 : 0;
+
+    return deleted;
+}
+
+/*
+ * fasthash_length()
+ * The number of elements of the hash table
+ */
+int fasthash_length(const fasthash_t* hashtable)
+{
+    return hashtable->length;
+}
+
 
 /* ----- private ----- */
 
-void grow(fasthash_t* hashtable)
+/* the slot of an active entry with the given key, or -1 if there is no such entry */
+int find_active_slot(const fasthash_t* hashtable, uint64_t key, uint64_t h)
+{
+    int8_t h2 = (int8_t)(h & 0x7F);
+    uint64_t pos = (h >> 7) & hashtable->cap_mask & ~(uint64_t)(GROUP_SIZE - 1);
+
+    for(uint64_t step = GROUP_SIZE; ; step += GROUP_SIZE) {
+        const int8_t* group = hashtable->ctrl + pos;
+        fasthash_mask_t mask = match_byte(group, h2);
+
+        while(mask != 0) {
+            int k = (int)pos + next_match(&mask);
+            if(hashtable->data[k].key == key)
+                return k;
+        }
+
+        if(match_byte(group, CTRL_EMPTY) != 0)
+            return -1;
+
+        /* triangular probing visits all groups, since their number is a power of 2 */
+        pos = (pos + step) & hashtable->cap_mask;
+    }
+}
+
+/* the first EMPTY or DELETED slot of the probe sequence of a hash */
+int find_free_slot(const fasthash_t* hashtable, uint64_t h)
+{
+    uint64_t pos = (h >> 7) & hashtable->cap_mask & ~(uint64_t)(GROUP_SIZE - 1);
+
+    for(uint64_t step = GROUP_SIZE; ; step += GROUP_SIZE) {
+        fasthash_mask_t mask = match_empty_or_deleted(hashtable->ctrl + pos);
+
+        if(mask != 0)
+            return (int)pos + next_match(&mask);
+
+        pos = (pos + step) & hashtable->cap_mask;
+    }
+}
+
+/* moves all active entries to new storage of the given capacity, dropping the DELETED slots */
+void rehash(fasthash_t* hashtable, int new_capacity)
 {
     int old_capacity = hashtable->capacity;
+    int8_t* old_ctrl = hashtable->ctrl;
     fasthash_entry_t* old_data = hashtable->data;
 
-    /* double the capacity */
-    hashtable->capacity *= 2;
-    hashtable->cap_mask = (hashtable->cap_mask << 1) | 1;
-    hashtable->data = mallocx(hashtable->capacity * sizeof(fasthash_entry_t));
+    /* allocate new storage */
+    hashtable->capacity = new_capacity;
+    hashtable->cap_mask = new_capacity - 1;
+    hashtable->growth_left = MAX_LOAD(new_capacity) - hashtable->length;
+    hashtable->ctrl = mallocx(new_capacity * sizeof(*(hashtable->ctrl)));
+    hashtable->data = mallocx(new_capacity * sizeof(*(hashtable->data)));
+    memset(hashtable->ctrl, CTRL_EMPTY, new_capacity * sizeof(*(hashtable->ctrl)));
 
-    /* clear the whole table */
-    hashtable->length = 0;
-    for(int i = 0; i < hashtable->capacity; i++)
-        hashtable->data[i] = BLANK_ENTRY;
-
-    /* reinsert all elements with a new cap_mask */
+    /* reinsert all elements; keys are unique */
     for(int i = 0; i < old_capacity; i++) {
-        if(old_data[i].state == ACTIVE)
-            fasthash_put(hashtable, old_data[i].key, old_data[i].value);
+        if(IS_ACTIVE(old_ctrl[i])) {
+            int k = find_free_slot(hashtable, hash(old_data[i].key));
+            hashtable->ctrl[k] = old_ctrl[i];
+            hashtable->data[k] = old_data[i];
+        }
     }
 
     /* clear old memory */
     free(old_data);
+    free(old_ctrl);
+}
+
+/* match the control bytes of a group against a byte */
+fasthash_mask_t match_byte(const int8_t* group, int8_t byte)
+{
+#if defined(HAVE_SSE2)
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    __m128i match = _mm_cmpeq_epi8(ctrl, _mm_set1_epi8(byte));
+    return (fasthash_mask_t)_mm_movemask_epi8(match);
+#elif defined(HAVE_NEON)
+    uint8x16_t ctrl = vld1q_u8((const uint8_t*)group);
+    uint8x16_t match = vceqq_u8(ctrl, vdupq_n_u8((uint8_t)byte));
+    uint64_t nibbles = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0);
+    return nibbles & UINT64_C(0x8888888888888888);
+#else
+    fasthash_mask_t mask = 0;
+    for(int i = 0; i < GROUP_SIZE; i++)
+        mask |= (fasthash_mask_t)(group[i] == byte) << i;
+    return mask;
+#endif
+}
+
+/* match the EMPTY and the DELETED slots of a group */
+fasthash_mask_t match_empty_or_deleted(const int8_t* group)
+{
+#if defined(HAVE_SSE2)
+    /* the sign bit is set for EMPTY and DELETED, but not for active slots */
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (fasthash_mask_t)_mm_movemask_epi8(ctrl);
+#elif defined(HAVE_NEON)
+    uint8x16_t match = vcltq_s8(vld1q_s8(group), vdupq_n_s8(0));
+    uint64_t nibbles = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0);
+    return nibbles & UINT64_C(0x8888888888888888);
+#else
+    fasthash_mask_t mask = 0;
+    for(int i = 0; i < GROUP_SIZE; i++)
+        mask |= (fasthash_mask_t)(!IS_ACTIVE(group[i])) << i;
+    return mask;
+#endif
+}
+
+/* the index of the first slot of a non-empty mask. The slot is removed from the mask */
+int next_match(fasthash_mask_t* mask)
+{
+    fasthash_mask_t m = *mask;
+    int bit;
+
+#if defined(__GNUC__) || defined(__clang__)
+    bit = __builtin_ctzll(m);
+#else
+    for(bit = 0; !(m & 1); bit++)
+        m >>= 1;
+#endif
+
+    *mask &= *mask - 1;
+    return bit >> MASK_SHIFT;
 }
 
 uint64_t hash(uint64_t x)
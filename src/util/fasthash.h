@@ -1,6 +1,6 @@
 /*
  * Open Surge Engine
- * fasthash.h - a fast hash table with integer keys and linear probing
+ * fasthash.h - a fast hash table with integer keys and group probing
  * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
  * http://opensurge2d.org
  *
@@ -42,6 +42,10 @@ FASTHASH_API void* fasthash_get(fasthash_t* hashtable, uint64_t key);
 FASTHASH_API void fasthash_put(fasthash_t* hashtable, uint64_t key, void* value);
 FASTHASH_API bool fasthash_delete(fasthash_t* hashtable, uint64_t key);
 FASTHASH_API void* fasthash_find(fasthash_t* hashtable, bool (*predicate)(const void*,void*), void* data);
+FASTHASH_API void fasthash_reserve(fasthash_t* hashtable, int count);
+FASTHASH_API void fasthash_put_many(fasthash_t* hashtable, const uint64_t* keys, void* const* values, int count);
+FASTHASH_API int fasthash_delete_many(fasthash_t* hashtable, const uint64_t* keys, int count);
+FASTHASH_API int fasthash_length(const fasthash_t* hashtable);
 
 #if defined(FASTHASH_INLINE)
 #include "fasthash.c"
@@ -0,0 +1,201 @@
+/*
+ * Open Surge Engine
+ * handletable.c - a table of handles with generation counters
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "handletable.h"
+#include "util.h"
+
+/* a slot of the table */
+typedef struct handleslot_t handleslot_t;
+struct handleslot_t
+{
+    void* ptr; /* NULL if the slot is free */
+    uint32_t generation;
+    int next_free; /* next free slot, or -1; valid only if the slot is free */
+};
+
+/* table */
+struct handletable_t
+{
+    handleslot_t* slot;
+    int capacity;
+    int count; /* number of live handles */
+    int first_free; /* first free slot, or -1 */
+};
+
+/* handle layout: the generation in the high bits and 1 + index in the low bits */
+#define INDEX_BITS 20
+#define INDEX_MASK ((UINT32_C(1) << INDEX_BITS) - 1)
+#define GENERATION_MASK ((UINT32_C(1) << (32 - INDEX_BITS)) - 1)
+#define MAX_SLOTS ((int)INDEX_MASK) /* 1 + index must fit in the low bits */
+
+#define INITIAL_CAPACITY 64
+
+static inline handle_t make_handle(int index, uint32_t generation);
+static inline int index_of(handle_t handle);
+static inline uint32_t generation_of(handle_t handle);
+static void grow(handletable_t* table);
+
+
+
+/*
+ * handletable_create()
+ * Creates an empty handle table
+ */
+handletable_t* handletable_create()
+{
+    handletable_t* table = mallocx(sizeof *table);
+
+    table->slot = NULL;
+    table->capacity = 0;
+    table->count = 0;
+    table->first_free = -1;
+
+    return table;
+}
+
+/*
+ * handletable_destroy()
+ * Destroys a handle table. The pointers it refers to are not destroyed
+ */
+handletable_t* handletable_destroy(handletable_t* table)
+{
+    free(table->slot);
+    free(table);
+
+    return NULL;
+}
+
+/*
+ * handletable_add()
+ * Adds a non-null pointer to the table and returns a new handle to it
+ */
+handle_t handletable_add(handletable_t* table, void* ptr)
+{
+    assertx(ptr != NULL);
+
+    if(table->first_free < 0)
+        grow(table);
+
+    int index = table->first_free;
+    handleslot_t* slot = &(table->slot[index]);
+
+    table->first_free = slot->next_free;
+    table->count++;
+
+    slot->ptr = ptr;
+    slot->next_free = -1;
+
+    return make_handle(index, slot->generation);
+}
+
+/*
+ * handletable_remove()
+ * Invalidates a handle and recycles its slot.
+ * Returns false if the handle was already stale
+ */
+bool handletable_remove(handletable_t* table, handle_t handle)
+{
+    if(handletable_get(table, handle) == NULL)
+        return false;
+
+    int index = index_of(handle);
+    handleslot_t* slot = &(table->slot[index]);
+
+    slot->ptr = NULL;
+    slot->generation = (slot->generation + 1) & GENERATION_MASK;
+    slot->next_free = table->first_free;
+
+    table->first_free = index;
+    table->count--;
+
+    return true;
+}
+
+/*
+ * handletable_get()
+ * The pointer referred to by a handle, or NULL if the handle is stale
+ */
+void* handletable_get(const handletable_t* table, handle_t handle)
+{
+    int index = index_of(handle);
+
+    if(index < 0 || index >= table->capacity)
+        return NULL;
+
+    const handleslot_t* slot = &(table->slot[index]);
+    return slot->generation == generation_of(handle) ? slot->ptr : NULL;
+}
+
+/*
+ * handletable_count()
+ * The number of live handles
+ */
+int handletable_count(const handletable_t* table)
+{
+    return table->count;
+}
+
+
+
+/*
+ *
+ * private
+ *
+ */
+
+/* builds a handle */
+handle_t make_handle(int index, uint32_t generation)
+{
+    return (generation << INDEX_BITS) | (uint32_t)(index + 1);
+}
+
+/* the index of the slot of a handle; -1 for NULL_HANDLE */
+int index_of(handle_t handle)
+{
+    return (int)(handle & INDEX_MASK) - 1;
+}
+
+/* the generation of a handle */
+uint32_t generation_of(handle_t handle)
+{
+    return handle >> INDEX_BITS;
+}
+
+/* doubles the capacity of the table, adding the new slots to the free list */
+void grow(handletable_t* table)
+{
+    int old_capacity = table->capacity;
+    int new_capacity = max(INITIAL_CAPACITY, 2 * old_capacity);
+
+    new_capacity = min(new_capacity, MAX_SLOTS);
+    if(new_capacity <= old_capacity)
+        fatal_error("Can't add more than %d handles to a handle table", MAX_SLOTS);
+
+    table->slot = reallocx(table->slot, new_capacity * sizeof(*(table->slot)));
+    table->capacity = new_capacity;
+
+    /* the new slots are free; keep the lower indices first */
+    for(int i = new_capacity - 1; i >= old_capacity; i--) {
+        table->slot[i].ptr = NULL;
+        table->slot[i].generation = 0;
+        table->slot[i].next_free = table->first_free;
+        table->first_free = i;
+    }
+}
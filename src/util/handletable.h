@@ -0,0 +1,57 @@
+/*
+ * Open Surge Engine
+ * handletable.h - a table of handles with generation counters
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HANDLETABLE_H
+#define _HANDLETABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+
+A handle table maps handles to pointers. A handle is made of the index of a
+slot of the table and of the generation of that slot. Dereferencing a handle
+is an array lookup and a comparison.
+
+When a pointer is removed from the table, the generation of its slot is
+incremented and the slot is recycled. The handles that referred to it become
+stale and dereference to NULL, so they can be kept around safely.
+
+The generation counters have 12 bits: a stale handle could be mistaken for a
+live one only after its slot has been recycled 4096 times.
+
+*/
+
+/* a handle. NULL_HANDLE is never issued */
+typedef uint32_t handle_t;
+#define NULL_HANDLE ((handle_t)0)
+
+/* opaque type */
+typedef struct handletable_t handletable_t;
+
+/* API */
+handletable_t* handletable_create();
+handletable_t* handletable_destroy(handletable_t* table);
+handle_t handletable_add(handletable_t* table, void* ptr); /* adds a non-null pointer and returns a new handle to it */
+bool handletable_remove(handletable_t* table, handle_t handle); /* invalidates a handle. Returns false if it was stale */
+void* handletable_get(const handletable_t* table, handle_t handle); /* returns NULL if the handle is stale */
+int handletable_count(const handletable_t* table); /* number of live handles */
+
+#endif
@@ -33,8 +33,9 @@
 #include "../core/logfile.h"
 
 /* utilities */
-#define __H_CAPACITY               727 /* prime number */
-#define __H_BUCKET(h, key)         ((h)->hash_function(key) % __H_CAPACITY)
+#define __H_INITIAL_CAPACITY       727 /* prime number */
+#define __H_MAX_LOAD               1 /* average length of the chains that triggers a rehash */
+#define __H_BUCKET(h, hash)        ((hash) % (uint32_t)((h)->capacity))
 #define __H_CONST(KEY_TYPE)        const KEY_TYPE
 
 /* hashtable_<typename> class: pretty much like C++ templates */
@@ -58,20 +59,26 @@ static int __h_default_compare_key_##T(__H_CONST(KEY_TYPE) key1, __H_CONST(KEY_T
 static KEY_TYPE __h_default_clone_key_##T(__H_CONST(KEY_TYPE) key); \
 static void __h_default_delete_key_##T(KEY_TYPE key); \
 static void __h_unused_##T(); \
+static void __h_rehash_##T(void *table); \
 typedef struct hashtable_##T hashtable_##T; \
 typedef struct hashtable_list_##T hashtable_list_##T; \
 struct hashtable_##T { \
-    hashtable_list_##T *data[__H_CAPACITY]; \
+    hashtable_list_##T **data; /* buckets */ \
+    int capacity; /* number of buckets; grows as needed */ \
+    int count; /* number of entries */ \
     void (*destructor)(T*); \
     uint32_t (*hash_function)(__H_CONST(KEY_TYPE)); \
     int (*key_compare)(__H_CONST(KEY_TYPE),__H_CONST(KEY_TYPE)); \
     KEY_TYPE (*key_clone)(__H_CONST(KEY_TYPE)); \
     void (*key_delete)(KEY_TYPE); \
+    uint32_t clock; /* incremented whenever an entry is used */ \
 }; \
 struct hashtable_list_##T { \
     KEY_TYPE key; \
+    uint32_t hash; /* cached hash of the key */ \
     T *value;\
     int reference_count;\
+    uint32_t last_use; /* the clock of the table when the entry was last referenced or unreferenced */ \
     hashtable_list_##T *next; \
 }; \
 static hashtable_##T* hashtable_##T##_create() \
@@ -92,8 +99,12 @@ static hashtable_##T* hashtable_##T##_create() \
         h->key_clone = __h_default_clone_key_##T; \
     if(h->key_delete == NULL) \
         h->key_delete = __h_default_delete_key_##T; \
-    for(i = 0; i < __H_CAPACITY; i++) \
+    h->capacity = __H_INITIAL_CAPACITY; \
+    h->count = 0; \
+    h->data = mallocx(h->capacity * sizeof(*(h->data))); \
+    for(i = 0; i < h->capacity; i++) \
         h->data[i] = NULL; \
+    h->clock = 0; \
     return h; \
 } \
 static hashtable_##T* hashtable_##T##_destroy(hashtable_##T *h) \
@@ -101,7 +112,7 @@ static hashtable_##T* hashtable_##T##_destroy(hashtable_##T *h) \
     int i; \
     hashtable_list_##T *p, *q; \
     logfile_message("hashtable_" #T "_destroy()"); \
-    for(i = 0; i < __H_CAPACITY; i++) { \
+    for(i = 0; i < h->capacity; i++) { \
         p = h->data[i]; \
         while(p != NULL) { \
             q = p->next; \
@@ -113,16 +124,17 @@ static hashtable_##T* hashtable_##T##_destroy(hashtable_##T *h) \
             p = q; \
         } \
     } \
+    free(h->data); \
     free(h); \
     __h_unused_##T(); \
     return NULL; \
 } \
 static T* hashtable_##T##_find(const hashtable_##T *h, __H_CONST(KEY_TYPE) key) \
 { \
-    uint32_t k = __H_BUCKET(h, key); \
-    hashtable_list_##T *q = h->data[k]; \
+    uint32_t hash = h->hash_function(key); \
+    hashtable_list_##T *q = h->data[__H_BUCKET(h, hash)]; \
     while(q != NULL) { \
-        if(h->key_compare(q->key, key) == 0) \
+        if(q->hash == hash && h->key_compare(q->key, key) == 0) \
             return q->value; \
         else \
             q = q->next; \
@@ -132,23 +144,31 @@ static T* hashtable_##T##_find(const hashtable_##T *h, __H_CONST(KEY_TYPE) key)
 static void hashtable_##T##_add(hashtable_##T *h, __H_CONST(KEY_TYPE) key, T *value) \
 { \
     if(NULL == hashtable_##T##_find(h, key)) { \
-        uint32_t k = __H_BUCKET(h, key); \
+        uint32_t hash = h->hash_function(key); \
+        uint32_t k; \
         hashtable_list_##T *q; \
+        if(h->count >= h->capacity * __H_MAX_LOAD) \
+            __h_rehash_##T(h); \
+        k = __H_BUCKET(h, hash); \
         q = mallocx(sizeof *q); \
         q->key = (h->key_clone != NULL) ? h->key_clone(key) : (KEY_TYPE)key; \
+        q->hash = hash; \
         q->value = value; \
         q->reference_count = 0;\
+        q->last_use = ++(h->clock); \
         q->next = h->data[k]; \
         h->data[k] = q; \
+        h->count++; \
     } \
 } \
 static void hashtable_##T##_remove(hashtable_##T *h, __H_CONST(KEY_TYPE) key) \
 { \
-    uint32_t k = __H_BUCKET(h, key); \
+    uint32_t hash = h->hash_function(key); \
+    uint32_t k = __H_BUCKET(h, hash); \
     hashtable_list_##T *p, *q; \
     if(h->data[k] != NULL) { \
         p = h->data[k]; \
-        if(h->key_compare(p->key, key) == 0) { \
+        if(p->hash == hash && h->key_compare(p->key, key) == 0) { \
             if(p->reference_count <= 0) { \
                 h->data[k] = p->next; \
                 if(h->destructor != NULL) \
@@ -156,6 +176,7 @@ static void hashtable_##T##_remove(hashtable_##T *h, __H_CONST(KEY_TYPE) key) \
                 if(h->key_delete != NULL) \
                     h->key_delete(p->key); \
                 free(p); \
+                h->count--; \
             } \
             else \
                 logfile_message("hashtable_" #T "_remove(): can't remove element with %d active references.", p->reference_count); \
@@ -163,7 +184,7 @@ static void hashtable_##T##_remove(hashtable_##T *h, __H_CONST(KEY_TYPE) key) \
         } \
         else { \
             while(p->next != NULL) { \
-                if(h->key_compare(p->next->key, key) == 0) { \
+                if(p->next->hash == hash && h->key_compare(p->next->key, key) == 0) { \
                     if(p->next->reference_count <= 0) { \
                         q = p->next; \
                         p->next = q->next; \
@@ -172,6 +193,7 @@ static void hashtable_##T##_remove(hashtable_##T *h, __H_CONST(KEY_TYPE) key) \
                         if(h->key_delete != NULL) \
                             h->key_delete(q->key); \
                         free(q); \
+                        h->count--; \
                     } \
                     else \
                         logfile_message("hashtable_" #T "_remove(): can't remove element with %d active references.", p->next->reference_count); \
@@ -184,10 +206,10 @@ static void hashtable_##T##_remove(hashtable_##T *h, __H_CONST(KEY_TYPE) key) \
 } \
 static bool hashtable_##T##_replace(const hashtable_##T *h, __H_CONST(KEY_TYPE) key, T *new_value) \
 { \
-    uint32_t k = __H_BUCKET(h, key); \
-    hashtable_list_##T *q = h->data[k]; \
+    uint32_t hash = h->hash_function(key); \
+    hashtable_list_##T *q = h->data[__H_BUCKET(h, hash)]; \
     while(q != NULL) { \
-        if(h->key_compare(q->key, key) == 0) { \
+        if(q->hash == hash && h->key_compare(q->key, key) == 0) { \
             if(q->reference_count <= 0) { \
                 if(h->destructor != NULL) \
                     h->destructor(q->value); \
@@ -208,7 +230,7 @@ static int hashtable_##T##_foreach(hashtable_##T *h, void *data, void (*callback
 { \
     int i, count = 0; \
     hashtable_list_##T *p; \
-    for(i = 0; i < __H_CAPACITY; i++) { \
+    for(i = 0; i < h->capacity; i++) { \
         for(p = h->data[i]; p != NULL; p = p->next) { \
             ++count; \
             callback(p->value, data); \
@@ -219,7 +241,7 @@ static int hashtable_##T##_foreach(hashtable_##T *h, void *data, void (*callback
 static T* hashtable_##T##_findsome(hashtable_##T *h, void *data, bool (*test_fn)(T*,void*)) \
 { \
     hashtable_list_##T *p; \
-    for(int i = 0; i < __H_CAPACITY; i++) { \
+    for(int i = 0; i < h->capacity; i++) { \
         for(p = h->data[i]; p != NULL; p = p->next) { \
             if(test_fn(p->value, data)) \
                 return p->value; \
@@ -229,11 +251,13 @@ static T* hashtable_##T##_findsome(hashtable_##T *h, void *data, bool (*test_fn)
 } \
 static int hashtable_##T##_ref(hashtable_##T *h, __H_CONST(KEY_TYPE) key) \
 { \
-    uint32_t k = __H_BUCKET(h, key); \
-    hashtable_list_##T *q = h->data[k]; \
+    uint32_t hash = h->hash_function(key); \
+    hashtable_list_##T *q = h->data[__H_BUCKET(h, hash)]; \
     while(q != NULL) { \
-        if(h->key_compare(q->key, key) == 0) \
+        if(q->hash == hash && h->key_compare(q->key, key) == 0) { \
+            q->last_use = ++(h->clock); \
             return ++(q->reference_count); \
+        } \
         else \
             q = q->next; \
     } \
@@ -242,11 +266,12 @@ static int hashtable_##T##_ref(hashtable_##T *h, __H_CONST(KEY_TYPE) key) \
 } \
 static int hashtable_##T##_unref(hashtable_##T *h, __H_CONST(KEY_TYPE) key) \
 { \
-    uint32_t k = __H_BUCKET(h, key); \
-    hashtable_list_##T *q = h->data[k]; \
+    uint32_t hash = h->hash_function(key); \
+    hashtable_list_##T *q = h->data[__H_BUCKET(h, hash)]; \
     while(q != NULL) { \
-        if(h->key_compare(q->key, key) == 0) { \
+        if(q->hash == hash && h->key_compare(q->key, key) == 0) { \
             q->reference_count = max(0, q->reference_count - 1); \
+            q->last_use = ++(h->clock); \
             return q->reference_count; \
         } \
         else \
@@ -257,30 +282,77 @@ static int hashtable_##T##_unref(hashtable_##T *h, __H_CONST(KEY_TYPE) key) \
 } \
 static int hashtable_##T##_refcount(const hashtable_##T *h, __H_CONST(KEY_TYPE) key) \
 { \
-    uint32_t k = __H_BUCKET(h, key); \
-    const hashtable_list_##T *q = h->data[k]; \
+    uint32_t hash = h->hash_function(key); \
+    const hashtable_list_##T *q = h->data[__H_BUCKET(h, hash)]; \
     while(q != NULL) { \
-        if(h->key_compare(q->key, key) == 0) \
+        if(q->hash == hash && h->key_compare(q->key, key) == 0) \
             return q->reference_count; \
         else \
             q = q->next; \
     } \
     return 0; \
 } \
+static int hashtable_##T##_bucket_count(const hashtable_##T *h) \
+{ \
+    return h->capacity; \
+} \
+static int hashtable_##T##_release_unreferenced_entries_of_bucket(hashtable_##T *h, int bucket) \
+{ \
+    /* releases the unreferenced entries of a single bucket, so that the
+       work can be spread over time; returns the number of released entries */ \
+    int count = 0; \
+    hashtable_list_##T **p, *q; \
+    if(bucket < 0 || bucket >= h->capacity) \
+        return 0; /* the table may have been rehashed */ \
+    p = &(h->data[bucket]); \
+    while((q = *p) != NULL) { \
+        if(q->reference_count <= 0) { \
+            *p = q->next; \
+            if(h->destructor != NULL) \
+                h->destructor(q->value); \
+            if(h->key_delete != NULL) \
+                h->key_delete(q->key); \
+            free(q); \
+            h->count--; \
+            ++count; \
+        } \
+        else \
+            p = &(q->next); \
+    } \
+    return count; \
+} \
 static void hashtable_##T##_release_unreferenced_entries(hashtable_##T *h) \
 { \
-    /* TODO: improve the performance of this routine by using a queue
-             to store the unreferenced entries */ \
-    int i; \
-    hashtable_list_##T *q; \
-    for(i = 0; i < __H_CAPACITY; i++) { \
-        for(q = h->data[i]; q != NULL; q = q->next) { \
-            if(q->reference_count <= 0) { \
-                hashtable_##T##_remove(h, q->key); \
-                break; /* fast hack */ \
+    for(int i = 0; i < h->capacity; i++) \
+        hashtable_##T##_release_unreferenced_entries_of_bucket(h, i); \
+} \
+static bool hashtable_##T##_release_least_recently_used_entry(hashtable_##T *h) \
+{ \
+    /* releases the unreferenced entry that has been used least recently;
+       returns false if all entries are referenced */ \
+    hashtable_list_##T **lru = NULL, **p; \
+    uint32_t lru_age = 0; \
+    for(int i = 0; i < h->capacity; i++) { \
+        for(p = &(h->data[i]); *p != NULL; p = &((*p)->next)) { \
+            uint32_t age = h->clock - (*p)->last_use; /* wraps around */ \
+            if((*p)->reference_count <= 0 && (lru == NULL || age > lru_age)) { \
+                lru = p; \
+                lru_age = age; \
             } \
         } \
     } \
+    if(lru != NULL) { \
+        hashtable_list_##T *q = *lru; \
+        *lru = q->next; \
+        if(h->destructor != NULL) \
+            h->destructor(q->value); \
+        if(h->key_delete != NULL) \
+            h->key_delete(q->key); \
+        free(q); \
+        h->count--; \
+        return true; \
+    } \
+    return false; \
 } \
 static uint32_t __h_hash_string_##T(const char *key) \
 { \
@@ -308,7 +380,7 @@ static uint32_t __h_default_hash_key_##T(__H_CONST(KEY_TYPE) key) \
     const uint8_t* data = (const uint8_t*)key; \
     for(size_t j = 0; j < sizeof *key; j++) \
         hash = (uint32_t)(data[j]) + (hash << 6) + (hash << 16) - hash; \
-    return 0; \
+    return hash; \
 } \
 static int __h_default_compare_key_##T(__H_CONST(KEY_TYPE) key1, __H_CONST(KEY_TYPE) key2) \
 { \
@@ -322,6 +394,26 @@ static void __h_default_delete_key_##T(KEY_TYPE key) \
 { \
     free(key); \
 } \
+static void __h_rehash_##T(void *table) \
+{ \
+    /* doubles the number of buckets, reusing the cached hashes */ \
+    hashtable_##T *h = (hashtable_##T*)table; \
+    int old_capacity = h->capacity; \
+    hashtable_list_##T **old_data = h->data, *p, *q; \
+    h->capacity = 2 * old_capacity + 1; \
+    h->data = mallocx(h->capacity * sizeof(*(h->data))); \
+    for(int i = 0; i < h->capacity; i++) \
+        h->data[i] = NULL; \
+    for(int i = 0; i < old_capacity; i++) { \
+        for(p = old_data[i]; p != NULL; p = q) { \
+            uint32_t k = __H_BUCKET(h, p->hash); \
+            q = p->next; \
+            p->next = h->data[k]; \
+            h->data[k] = p; \
+        } \
+    } \
+    free(old_data); \
+} \
 static void __h_unused_##T() \
 { \
     /* omit compiler warnings */ \
@@ -337,6 +429,9 @@ static void __h_unused_##T() \
     (void)hashtable_##T##_refcount; \
     (void)hashtable_##T##_unref; \
     (void)hashtable_##T##_release_unreferenced_entries; \
+    (void)hashtable_##T##_release_unreferenced_entries_of_bucket; \
+    (void)hashtable_##T##_release_least_recently_used_entry; \
+    (void)hashtable_##T##_bucket_count; \
     (void)__h_hash_string_##T; \
     (void)__h_compare_string_##T; \
     (void)__h_clone_string_##T; \
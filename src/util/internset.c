@@ -0,0 +1,168 @@
+/*
+ * Open Surge Engine
+ * internset.c - a hash set of interned strings
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "internset.h"
+#include "djb2.h"
+#include "util.h"
+
+/* a slot of the set */
+typedef struct internslot_t internslot_t;
+struct internslot_t
+{
+    uint32_t hash; /* hash of the string */
+    uintptr_t key; /* EMPTY if the slot is empty */
+};
+
+/* set */
+struct internset_t
+{
+    internslot_t* slot; /* open addressing with linear probing */
+    uint32_t mask; /* capacity - 1, where capacity is a power of two */
+    int count; /* number of interned strings */
+
+    internset_store_t store;
+    internset_lookup_t lookup;
+    void* context;
+};
+
+#define EMPTY UINTPTR_MAX /* neither a pointer nor an offset */
+#define MIN_CAPACITY 16
+
+static void grow(internset_t* set);
+static inline uint32_t hash_of(const char* str);
+
+
+
+/*
+ * internset_create()
+ * Creates an empty intern set. store() and lookup() map strings to keys
+ */
+internset_t* internset_create(int initial_capacity, internset_store_t store, internset_lookup_t lookup, void* context)
+{
+    internset_t* set = mallocx(sizeof *set);
+    uint32_t capacity = MIN_CAPACITY;
+
+    while(capacity < (uint32_t)initial_capacity)
+        capacity *= 2;
+
+    set->slot = mallocx(capacity * sizeof(*(set->slot)));
+    set->mask = capacity - 1;
+    set->count = 0;
+    for(uint32_t i = 0; i < capacity; i++)
+        set->slot[i].key = EMPTY;
+
+    set->store = store;
+    set->lookup = lookup;
+    set->context = context;
+
+    return set;
+}
+
+/*
+ * internset_destroy()
+ * Destroys an intern set. The strings it refers to are not destroyed
+ */
+internset_t* internset_destroy(internset_t* set)
+{
+    free(set->slot);
+    free(set);
+
+    return NULL;
+}
+
+/*
+ * internset_intern()
+ * The key of a string. If an equal string isn't in the set,
+ * a copy of it is stored and its new key is returned
+ */
+uintptr_t internset_intern(internset_t* set, const char* string)
+{
+    uint32_t hash = hash_of(string);
+    uint32_t k;
+
+    /* is the string already in the set? */
+    for(k = hash & set->mask; set->slot[k].key != EMPTY; k = (k + 1) & set->mask) {
+        if(set->slot[k].hash == hash && 0 == strcmp(set->lookup(set->slot[k].key, set->context), string))
+            return set->slot[k].key;
+    }
+
+    /* store the string */
+    uintptr_t key = set->store(string, set->context);
+    assertx(key != EMPTY);
+
+    set->slot[k].hash = hash;
+    set->slot[k].key = key;
+
+    /* keep the load factor at most 1/2 */
+    if(2 * (uint32_t)(++set->count) > set->mask + 1)
+        grow(set);
+
+    return key;
+}
+
+/*
+ * internset_count()
+ * The number of interned strings
+ */
+int internset_count(const internset_t* set)
+{
+    return set->count;
+}
+
+
+
+/*
+ *
+ * private
+ *
+ */
+
+/* doubles the capacity of the set */
+void grow(internset_t* set)
+{
+    uint32_t old_capacity = set->mask + 1;
+    internslot_t* old_slot = set->slot;
+
+    set->mask = 2 * old_capacity - 1;
+    set->slot = mallocx((set->mask + 1) * sizeof(*(set->slot)));
+    for(uint32_t i = 0; i <= set->mask; i++)
+        set->slot[i].key = EMPTY;
+
+    /* the strings need not be looked up: their hashes are kept */
+    for(uint32_t i = 0; i < old_capacity; i++) {
+        if(old_slot[i].key != EMPTY) {
+            uint32_t k = old_slot[i].hash & set->mask;
+            while(set->slot[k].key != EMPTY)
+                k = (k + 1) & set->mask;
+
+            set->slot[k] = old_slot[i];
+        }
+    }
+
+    free(old_slot);
+}
+
+/* hash function */
+uint32_t hash_of(const char* str)
+{
+    uint64_t h = djb2(str);
+    return (uint32_t)(h ^ (h >> 32));
+}
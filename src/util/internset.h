@@ -0,0 +1,48 @@
+/*
+ * Open Surge Engine
+ * internset.h - a hash set of interned strings
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _INTERNSET_H
+#define _INTERNSET_H
+
+#include <stdint.h>
+
+/*
+
+An intern set stores each distinct string only once. The set doesn't own the
+strings: it keeps a key of each of them, such as a pointer or an offset into a
+string table, and it calls back its owner to store a new string and to get the
+string of a key. It's an open addressing hash set with linear probing.
+
+*/
+
+/* callbacks */
+typedef uintptr_t (*internset_store_t)(const char* string, void* context); /* stores a copy of a new string and returns its key */
+typedef const char* (*internset_lookup_t)(uintptr_t key, const void* context); /* the string of a key */
+
+/* opaque type */
+typedef struct internset_t internset_t;
+
+/* API */
+internset_t* internset_create(int initial_capacity, internset_store_t store, internset_lookup_t lookup, void* context);
+internset_t* internset_destroy(internset_t* set);
+uintptr_t internset_intern(internset_t* set, const char* string); /* the key of a string, stored if it's not in the set yet */
+int internset_count(const internset_t* set); /* number of interned strings */
+
+#endif
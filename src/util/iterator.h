@@ -35,10 +35,20 @@ while(iterator_has_next(it)) {
 }
 iterator_destroy(it);
 
+Iterating over a C array without touching the heap:
+
+arrayiter_t it;
+arrayiter_init(&it, arr, n, sizeof *arr);
+while(arrayiter_has_next(&it)) {
+    int* element = arrayiter_next(&it);
+    printf("%d ", *element);
+}
+
 */
 
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 /* opaque type */
 typedef struct iterator_t iterator_t;
@@ -55,6 +65,44 @@ bool iterator_foreach(iterator_t* it, void* data, bool (*callback)(void* element
 typedef iterator_t arrayiterator_t;
 arrayiterator_t* iterator_create_from_array(void* array, size_t length, size_t element_size_in_bytes); /* creates a new iterator suitable for iterating over a fixed-size array */
 
+/* value-type iterator over C arrays: the caller provides the storage
+   (e.g., on the stack), so no heap allocations are needed */
+typedef struct arrayiter_t arrayiter_t;
+struct arrayiter_t
+{
+    uint8_t* current; /* pointer to the next element */
+    uint8_t* end; /* one past the last element */
+    size_t element_size_in_bytes;
+};
+
+static inline void arrayiter_init(arrayiter_t* it, void* array, size_t length, size_t element_size_in_bytes); /* initializes a value-type iterator suitable for iterating over a fixed-size array */
+static inline bool arrayiter_has_next(const arrayiter_t* it); /* returns true if the iteration isn't over */
+static inline void* arrayiter_next(arrayiter_t* it); /* returns a pointer to the next element of the array and advances the iteration pointer */
+
+/* inline implementation */
+void arrayiter_init(arrayiter_t* it, void* array, size_t length, size_t element_size_in_bytes)
+{
+    it->current = (uint8_t*)array;
+    it->end = (uint8_t*)array + length * element_size_in_bytes;
+    it->element_size_in_bytes = element_size_in_bytes;
+}
+
+bool arrayiter_has_next(const arrayiter_t* it)
+{
+    return it->current < it->end;
+}
+
+void* arrayiter_next(arrayiter_t* it)
+{
+    if(it->current < it->end) {
+        void* element = it->current;
+        it->current += it->element_size_in_bytes;
+        return element;
+    }
+
+    return NULL;
+}
+
 /*
 #define ITERATOR_STATE(it) (*((iterator_state_t**)(it)))
 */
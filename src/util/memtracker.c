@@ -0,0 +1,572 @@
+/*
+ * Open Surge Engine
+ * memtracker.c - tracking of the allocations of mallocx() & friends
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "memtracker.h"
+
+#if WANT_MEMTRACKER
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <allegro5/allegro.h>
+#include "util.h"
+#include "../core/logfile.h"
+#include "../core/video.h"
+#include "../core/timer.h"
+
+/*
+
+The tables of the tracker are allocated with malloc() rather than with
+mallocx(), which would call the tracker back. For the same reason, nothing
+that may allocate is called while the mutex is locked.
+
+*/
+
+/* a call site of mallocx() or reallocx() */
+typedef struct memsite_t memsite_t;
+struct memsite_t
+{
+    const char* location; /* __FILE__; NULL if the slot is empty */
+    int line;
+    memtag_t tag;
+
+    size_t live_bytes;
+    int live_count;
+    int64_t total_count; /* number of allocations since memtracker_init() */
+    int64_t frames_allocating; /* number of frames in which the site allocated */
+    int64_t last_frame; /* the last frame in which the site allocated */
+};
+
+/* a live allocation */
+typedef struct memblock_t memblock_t;
+struct memblock_t
+{
+    void* ptr; /* NULL if the slot is empty */
+    size_t bytes;
+    int site; /* index of the call site */
+};
+
+/* statistics of a subsystem */
+typedef struct memstats_t memstats_t;
+struct memstats_t
+{
+    size_t live_bytes;
+    int live_count;
+    int frame_count; /* number of allocations in the current frame */
+    int last_frame_count; /* number of allocations in the previous frame */
+    int max_frame_count; /* the largest number of allocations in a frame */
+};
+
+/* internal data */
+#define SITE_CAPACITY 4096 /* a power of two */
+#define OVERFLOW_SITE 0 /* used when there are too many call sites */
+#define INITIAL_BLOCK_CAPACITY 65536 /* a power of two */
+#define REPORT_INTERVAL 600.0 /* seconds between periodic reports */
+#define TOP_SITES 16 /* the number of call sites listed in a report */
+static const char* TAG_NAME[MEMTAG_COUNT] = {
+    [MEMTAG_OTHER] = "other",
+    [MEMTAG_RENDER] = "render",
+    [MEMTAG_PHYSICS] = "physics",
+    [MEMTAG_SCRIPTING] = "scripting",
+    [MEMTAG_ASSETS] = "assets",
+    [MEMTAG_LEGACY] = "legacy"
+};
+static const struct { const char* pattern; memtag_t tag; } TAG_RULE[] = { /* the first match of the location wins */
+    { "legacy", MEMTAG_LEGACY },
+    { "scripting", MEMTAG_SCRIPTING },
+    { "physics", MEMTAG_PHYSICS },
+    { "renderqueue", MEMTAG_RENDER },
+    { "video", MEMTAG_RENDER },
+    { "shader", MEMTAG_RENDER },
+    { "image", MEMTAG_RENDER },
+    { "brickbatch", MEMTAG_RENDER },
+    { "asset", MEMTAG_ASSETS },
+    { "resourcemanager", MEMTAG_ASSETS },
+    { "sprite", MEMTAG_ASSETS },
+    { "animation", MEMTAG_ASSETS },
+    { "font", MEMTAG_ASSETS },
+    { "audio", MEMTAG_ASSETS },
+    { "nanoparser", MEMTAG_ASSETS },
+    { "csv", MEMTAG_ASSETS },
+    { "lang", MEMTAG_ASSETS }
+};
+static memsite_t* site = NULL; /* site[SITE_CAPACITY] */
+static int site_count = 0;
+static memblock_t* block = NULL; /* open addressing with linear probing */
+static uint32_t block_mask = 0; /* capacity - 1 */
+static int block_count = 0;
+static memstats_t stats[MEMTAG_COUNT];
+static size_t peak_live_bytes = 0;
+static int64_t frame = 0;
+static double last_report_time = 0.0;
+static bool want_report = false; /* overlay */
+static ALLEGRO_MUTEX* mutex = NULL;
+static volatile bool enabled = false;
+
+static int find_site(const char* location, int line);
+static memtag_t classify(const char* location);
+static void add_block(void* ptr, size_t bytes, int site_index);
+static void remove_block(void* ptr);
+static void grow_blocks();
+static inline uint32_t hash_ptr(const void* ptr);
+static size_t total_live_bytes();
+static void snapshot(memstats_t* out_stats, memsite_t** out_sites, int* out_site_count, int64_t* out_frame);
+static int compare_live_bytes(const void* a, const void* b);
+static int compare_frames_allocating(const void* a, const void* b);
+static void show_overlay();
+
+
+
+/*
+ * memtracker_init()
+ * Initializes the memory tracker
+ */
+void memtracker_init()
+{
+    if(enabled)
+        return;
+
+    site = calloc(SITE_CAPACITY, sizeof(*site));
+    block = calloc(INITIAL_BLOCK_CAPACITY, sizeof(*block));
+    mutex = al_create_mutex();
+    if(site == NULL || block == NULL || mutex == NULL) {
+        logfile_message("Can't initialize the memory tracker");
+        return;
+    }
+
+    site[OVERFLOW_SITE].location = "(other call sites)";
+    site[OVERFLOW_SITE].tag = MEMTAG_OTHER;
+    site_count = 1;
+
+    block_mask = INITIAL_BLOCK_CAPACITY - 1;
+    block_count = 0;
+
+    memset(stats, 0, sizeof(stats));
+    peak_live_bytes = 0;
+    frame = 0;
+    last_report_time = timer_get_now();
+    want_report = false;
+
+    enabled = true;
+    logfile_message("The memory tracker is enabled. Press F5 to toggle its overlay");
+}
+
+/*
+ * memtracker_release()
+ * Releases the memory tracker, writing a final report to the logfile.
+ * The memory that is still live at this point has probably leaked
+ */
+void memtracker_release()
+{
+    if(!enabled)
+        return;
+
+    logfile_message("Memory tracker: final report (what's still live has probably leaked)");
+    memtracker_write_report();
+
+    al_lock_mutex(mutex);
+    enabled = false;
+    al_unlock_mutex(mutex);
+
+    al_destroy_mutex(mutex);
+    (free)(block);
+    (free)(site);
+    mutex = NULL;
+    block = NULL;
+    site = NULL;
+}
+
+/*
+ * memtracker_begin_frame()
+ * Begins a new frame. Call at the start of each update of the main loop
+ */
+void memtracker_begin_frame()
+{
+    if(!enabled)
+        return;
+
+    /* close the previous frame */
+    al_lock_mutex(mutex);
+    for(int i = 0; i < MEMTAG_COUNT; i++) {
+        stats[i].last_frame_count = stats[i].frame_count;
+        stats[i].max_frame_count = max(stats[i].max_frame_count, stats[i].frame_count);
+        stats[i].frame_count = 0;
+    }
+    frame++;
+    al_unlock_mutex(mutex);
+
+    /* periodic report, for long sessions */
+    double now = timer_get_now();
+    if(now - last_report_time >= REPORT_INTERVAL) {
+        last_report_time = now;
+        memtracker_write_report();
+    }
+
+    /* overlay */
+    if(want_report)
+        show_overlay();
+}
+
+/*
+ * memtracker_write_report()
+ * Writes the live bytes and the allocations per frame of each
+ * subsystem and of the top call sites to the logfile
+ */
+void memtracker_write_report()
+{
+    memstats_t s[MEMTAG_COUNT];
+    memsite_t* sites;
+    int count;
+    int64_t frames;
+
+    if(!enabled)
+        return;
+
+    snapshot(s, &sites, &count, &frames);
+    if(sites == NULL)
+        return;
+
+    /* subsystems */
+    size_t total = 0;
+    for(int i = 0; i < MEMTAG_COUNT; i++)
+        total += s[i].live_bytes;
+
+    logfile_message("Memory tracker: %.1f KB live, peak %.1f KB, %d call sites, %.0f frames",
+        total / 1024.0, peak_live_bytes / 1024.0, count, (double)frames);
+
+    for(int i = 0; i < MEMTAG_COUNT; i++) {
+        logfile_message("  %-9s: %10.1f KB live in %7d blocks, %5d allocs last frame, %5d max",
+            TAG_NAME[i], s[i].live_bytes / 1024.0, s[i].live_count, s[i].last_frame_count, s[i].max_frame_count);
+    }
+
+    /* the call sites that hold the most memory */
+    qsort(sites, count, sizeof(*sites), compare_live_bytes);
+    logfile_message("  Top call sites by live bytes:");
+    for(int i = 0; i < min(count, TOP_SITES) && sites[i].live_bytes > 0; i++) {
+        logfile_message("    %10.1f KB in %7d blocks: %s:%d (%s)",
+            sites[i].live_bytes / 1024.0, sites[i].live_count, sites[i].location, sites[i].line, TAG_NAME[sites[i].tag]);
+    }
+
+    /* the call sites that allocate in most frames */
+    qsort(sites, count, sizeof(*sites), compare_frames_allocating);
+    logfile_message("  Top call sites by frames allocating:");
+    for(int i = 0; i < min(count, TOP_SITES) && sites[i].frames_allocating > 0; i++) {
+        logfile_message("    %5.1f%% of the frames, %8.2f allocs/frame: %s:%d (%s)",
+            100.0 * sites[i].frames_allocating / max(frames, 1),
+            (double)sites[i].total_count / max(frames, 1),
+            sites[i].location, sites[i].line, TAG_NAME[sites[i].tag]);
+    }
+
+    (free)(sites);
+}
+
+/*
+ * memtracker_toggle_report()
+ * Show/hide the overlay
+ */
+bool memtracker_toggle_report()
+{
+    if(!enabled)
+        return false;
+
+    want_report = !want_report;
+    if(!want_report)
+        video_clearmessages();
+
+    return true;
+}
+
+/*
+ * memtracker_track_alloc()
+ * Records an allocation of mallocx()
+ */
+void memtracker_track_alloc(void* ptr, size_t bytes, const char* location, int line)
+{
+    if(!enabled)
+        return;
+
+    al_lock_mutex(mutex);
+    if(enabled)
+        add_block(ptr, bytes, find_site(location, line));
+    al_unlock_mutex(mutex);
+}
+
+/*
+ * memtracker_track_realloc()
+ * Records a reallocation of reallocx(). old_ptr may be NULL
+ */
+void memtracker_track_realloc(void* old_ptr, void* new_ptr, size_t bytes, const char* location, int line)
+{
+    if(!enabled)
+        return;
+
+    al_lock_mutex(mutex);
+    if(enabled) {
+        if(old_ptr != NULL)
+            remove_block(old_ptr);
+        add_block(new_ptr, bytes, find_site(location, line));
+    }
+    al_unlock_mutex(mutex);
+}
+
+/*
+ * memtracker_track_free()
+ * Records a call to free(). Pointers that are not tracked are ignored
+ */
+void memtracker_track_free(void* ptr)
+{
+    if(!enabled || ptr == NULL)
+        return;
+
+    al_lock_mutex(mutex);
+    if(enabled)
+        remove_block(ptr);
+    al_unlock_mutex(mutex);
+}
+
+
+
+/*
+ * private
+ */
+
+/* finds or adds a call site, returning its index */
+int find_site(const char* location, int line)
+{
+    uint32_t k = (hash_ptr(location) ^ ((uint32_t)line * UINT32_C(2654435761))) & (SITE_CAPACITY - 1);
+
+    /* __FILE__ is a string literal, so we compare pointers */
+    while(site[k].location != NULL) {
+        if(site[k].location == location && site[k].line == line)
+            return k;
+
+        k = (k + 1) & (SITE_CAPACITY - 1);
+    }
+
+    /* keep the load factor at most 3/4 */
+    if(4 * (site_count + 1) > 3 * SITE_CAPACITY)
+        return OVERFLOW_SITE;
+
+    site[k].location = location;
+    site[k].line = line;
+    site[k].tag = classify(location);
+    site[k].last_frame = -1;
+    site_count++;
+
+    return k;
+}
+
+/* the subsystem of a source file */
+memtag_t classify(const char* location)
+{
+    for(int i = 0; i < sizeof(TAG_RULE) / sizeof(TAG_RULE[0]); i++) {
+        if(strstr(location, TAG_RULE[i].pattern) != NULL)
+            return TAG_RULE[i].tag;
+    }
+
+    return MEMTAG_OTHER;
+}
+
+/* adds a live allocation */
+void add_block(void* ptr, size_t bytes, int site_index)
+{
+    /* a block at the same address was freed without us noticing */
+    remove_block(ptr);
+
+    /* keep the load factor at most 1/2 */
+    if(2 * (block_count + 1) > (int)(block_mask + 1))
+        grow_blocks();
+
+    uint32_t k = hash_ptr(ptr) & block_mask;
+    while(block[k].ptr != NULL)
+        k = (k + 1) & block_mask;
+
+    block[k].ptr = ptr;
+    block[k].bytes = bytes;
+    block[k].site = site_index;
+    block_count++;
+
+    /* update the statistics */
+    memsite_t* s = &site[site_index];
+    s->live_bytes += bytes;
+    s->live_count++;
+    s->total_count++;
+    if(s->last_frame != frame) {
+        s->last_frame = frame;
+        s->frames_allocating++;
+    }
+
+    memstats_t* t = &stats[s->tag];
+    t->live_bytes += bytes;
+    t->live_count++;
+    t->frame_count++;
+
+    peak_live_bytes = max(peak_live_bytes, total_live_bytes());
+}
+
+/* removes a live allocation, if it exists */
+void remove_block(void* ptr)
+{
+    uint32_t k = hash_ptr(ptr) & block_mask;
+
+    while(block[k].ptr != ptr) {
+        if(block[k].ptr == NULL)
+            return;
+
+        k = (k + 1) & block_mask;
+    }
+
+    /* update the statistics */
+    memsite_t* s = &site[block[k].site];
+    s->live_bytes -= block[k].bytes;
+    s->live_count--;
+
+    memstats_t* t = &stats[s->tag];
+    t->live_bytes -= block[k].bytes;
+    t->live_count--;
+
+    /* backward shift deletion: no tombstones */
+    uint32_t hole = k;
+    for(;;) {
+        k = (k + 1) & block_mask;
+        if(block[k].ptr == NULL)
+            break;
+
+        /* move the entry to the hole if the hole is between its home slot and k */
+        uint32_t home = hash_ptr(block[k].ptr) & block_mask;
+        if(((k - home) & block_mask) >= ((k - hole) & block_mask)) {
+            block[hole] = block[k];
+            hole = k;
+        }
+    }
+
+    block[hole].ptr = NULL;
+    block_count--;
+}
+
+/* doubles the capacity of the table of live allocations */
+void grow_blocks()
+{
+    uint32_t old_capacity = block_mask + 1;
+    memblock_t* new_block = calloc(2 * old_capacity, sizeof(*new_block));
+    memblock_t* old_block = block;
+
+    if(new_block == NULL)
+        return; /* we'll probe longer */
+
+    block = new_block;
+    block_mask = 2 * old_capacity - 1;
+
+    for(uint32_t i = 0; i < old_capacity; i++) {
+        if(old_block[i].ptr != NULL) {
+            uint32_t k = hash_ptr(old_block[i].ptr) & block_mask;
+            while(block[k].ptr != NULL)
+                k = (k + 1) & block_mask;
+
+            block[k] = old_block[i];
+        }
+    }
+
+    (free)(old_block);
+}
+
+/* hash of a pointer */
+uint32_t hash_ptr(const void* ptr)
+{
+    uint64_t x = (uint64_t)(uintptr_t)ptr;
+
+    x ^= x >> 33;
+    x *= UINT64_C(0xff51afd7ed558ccd);
+    x ^= x >> 33;
+
+    return (uint32_t)x;
+}
+
+/* the live bytes of all subsystems */
+size_t total_live_bytes()
+{
+    size_t total = 0;
+
+    for(int i = 0; i < MEMTAG_COUNT; i++)
+        total += stats[i].live_bytes;
+
+    return total;
+}
+
+/* copies the statistics, so that they can be reported without holding the
+   mutex. *out_sites must be released with free(); it's NULL on failure */
+void snapshot(memstats_t* out_stats, memsite_t** out_sites, int* out_site_count, int64_t* out_frame)
+{
+    memsite_t* sites = malloc(SITE_CAPACITY * sizeof(*sites));
+    int count = 0;
+
+    al_lock_mutex(mutex);
+
+    memcpy(out_stats, stats, sizeof(stats));
+    *out_frame = frame;
+
+    if(sites != NULL) {
+        for(int i = 0; i < SITE_CAPACITY; i++) {
+            if(site[i].location != NULL)
+                sites[count++] = site[i];
+        }
+    }
+
+    al_unlock_mutex(mutex);
+
+    *out_sites = sites;
+    *out_site_count = count;
+}
+
+/* sort by live bytes, in descending order */
+int compare_live_bytes(const void* a, const void* b)
+{
+    size_t x = ((const memsite_t*)a)->live_bytes;
+    size_t y = ((const memsite_t*)b)->live_bytes;
+
+    return (x < y) - (x > y);
+}
+
+/* sort by the number of frames in which the sites allocated, in descending order */
+int compare_frames_allocating(const void* a, const void* b)
+{
+    int64_t x = ((const memsite_t*)a)->frames_allocating;
+    int64_t y = ((const memsite_t*)b)->frames_allocating;
+
+    return (x < y) - (x > y);
+}
+
+/* shows the live bytes and the allocations of the previous frame of each subsystem */
+void show_overlay()
+{
+    memstats_t s[MEMTAG_COUNT];
+
+    al_lock_mutex(mutex);
+    memcpy(s, stats, sizeof(stats));
+    al_unlock_mutex(mutex);
+
+    video_clearmessages();
+    video_showmessage("Memory tracker");
+    video_showmessage("--------------");
+    for(int i = 0; i < MEMTAG_COUNT; i++)
+        video_showmessage("%-9s: %8.1f KB, %4d allocs/frame", TAG_NAME[i], s[i].live_bytes / 1024.0, s[i].last_frame_count);
+}
+
+#endif
@@ -0,0 +1,86 @@
+/*
+ * Open Surge Engine
+ * memtracker.h - tracking of the allocations of mallocx() & friends
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MEMTRACKER_H
+#define _MEMTRACKER_H
+
+/*
+ * Memory tracker
+ *
+ * When the engine is built with WANT_MEMTRACKER, the allocations made with
+ * mallocx() and reallocx() are recorded per call site, and the call sites are
+ * tagged by subsystem according to their source files. free() is redirected
+ * to the tracker in the files that include util.h. The tracker counts the
+ * allocations of each frame and the live bytes of each subsystem. It writes a
+ * report to the logfile periodically and on exit (what's still live on exit
+ * has leaked), and F5 toggles an overlay with the live breakdown.
+ *
+ * Memory released with free() in a file that doesn't include util.h is not
+ * seen by the tracker and stays live in the reports until its address is
+ * reused.
+ *
+ * The tracker compiles to nothing unless the engine is built with WANT_MEMTRACKER
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifndef WANT_MEMTRACKER
+#define WANT_MEMTRACKER 0
+#endif
+
+/* subsystems */
+typedef enum memtag_t {
+    MEMTAG_OTHER,
+    MEMTAG_RENDER,
+    MEMTAG_PHYSICS,
+    MEMTAG_SCRIPTING,
+    MEMTAG_ASSETS,
+    MEMTAG_LEGACY,
+
+    MEMTAG_COUNT
+} memtag_t;
+
+#if WANT_MEMTRACKER
+
+#define MEMTRACKER_INIT()           memtracker_init()
+#define MEMTRACKER_RELEASE()        memtracker_release()
+#define MEMTRACKER_BEGIN_FRAME()    memtracker_begin_frame()
+
+void memtracker_init();
+void memtracker_release(); /* writes the final report */
+void memtracker_begin_frame(); /* call at the start of each update of the main loop */
+void memtracker_write_report(); /* writes a report to the logfile */
+bool memtracker_toggle_report(); /* show/hide the overlay */
+
+/* hooks of mallocx(), reallocx() and free() */
+void memtracker_track_alloc(void* ptr, size_t bytes, const char* location, int line);
+void memtracker_track_realloc(void* old_ptr, void* new_ptr, size_t bytes, const char* location, int line);
+void memtracker_track_free(void* ptr);
+
+#else
+
+#define MEMTRACKER_INIT()           ((void)0)
+#define MEMTRACKER_RELEASE()        ((void)0)
+#define MEMTRACKER_BEGIN_FRAME()    ((void)0)
+
+#endif
+
+#endif
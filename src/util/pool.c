@@ -0,0 +1,159 @@
+/*
+ * Open Surge Engine
+ * pool.c - allocator of fixed-size objects
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include "pool.h"
+#include "util.h"
+
+/* a free object stores a pointer to the next free object */
+typedef struct poolnode_t poolnode_t;
+struct poolnode_t
+{
+    poolnode_t* next;
+};
+
+/* a slab is a block of memory holding many objects */
+typedef struct poolslab_t poolslab_t;
+struct poolslab_t
+{
+    poolslab_t* next;
+};
+
+/* pool */
+struct pool_t
+{
+    size_t stride; /* distance between two consecutive objects of a slab, in bytes */
+    int objects_per_slab;
+    int count; /* number of allocated objects */
+
+    poolnode_t* free_list;
+    poolslab_t* slab;
+};
+
+/* alignment of the slabs, in bytes */
+#define CACHE_LINE_SIZE 64
+
+/* alignment of the objects, in bytes */
+#define OBJECT_ALIGNMENT 16
+
+#define ALIGN_UP(n, a) (((n) + ((a) - 1)) & ~((size_t)((a) - 1)))
+
+static void add_slab(pool_t* pool);
+
+
+
+/*
+ * pool_create()
+ * Creates a new pool of objects of the given size
+ */
+pool_t* pool_create(size_t object_size, int objects_per_slab)
+{
+    pool_t* pool = mallocx(sizeof *pool);
+
+    pool->stride = ALIGN_UP(max(object_size, sizeof(poolnode_t)), OBJECT_ALIGNMENT);
+    pool->objects_per_slab = max(objects_per_slab, 1);
+    pool->count = 0;
+
+    pool->free_list = NULL;
+    pool->slab = NULL;
+
+    return pool;
+}
+
+/*
+ * pool_destroy()
+ * Destroys a pool and all of its objects
+ */
+pool_t* pool_destroy(pool_t* pool)
+{
+    while(pool->slab != NULL) {
+        poolslab_t* next = pool->slab->next;
+        free(pool->slab);
+        pool->slab = next;
+    }
+
+    free(pool);
+    return NULL;
+}
+
+/*
+ * pool_alloc()
+ * Allocates an object. Its contents are undefined. This never returns NULL
+ */
+void* pool_alloc(pool_t* pool)
+{
+    if(pool->free_list == NULL)
+        add_slab(pool);
+
+    poolnode_t* node = pool->free_list;
+    pool->free_list = node->next;
+    pool->count++;
+
+    return node;
+}
+
+/*
+ * pool_free()
+ * Gives an object, previously allocated with pool_alloc(), back to the pool
+ */
+void pool_free(pool_t* pool, void* object)
+{
+    poolnode_t* node = (poolnode_t*)object;
+
+    node->next = pool->free_list;
+    pool->free_list = node;
+    pool->count--;
+}
+
+/*
+ * pool_count()
+ * The number of objects currently allocated
+ */
+int pool_count(const pool_t* pool)
+{
+    return pool->count;
+}
+
+
+
+/* private */
+
+/* allocates a new slab and adds its objects to the free list */
+void add_slab(pool_t* pool)
+{
+    /* the objects are placed after the header of the slab, at a cache line boundary */
+    size_t header_size = ALIGN_UP(sizeof(poolslab_t), OBJECT_ALIGNMENT);
+    size_t size = header_size + CACHE_LINE_SIZE + pool->stride * pool->objects_per_slab;
+    uint8_t* block = mallocx(size);
+
+    poolslab_t* slab = (poolslab_t*)block;
+    slab->next = pool->slab;
+    pool->slab = slab;
+
+    uintptr_t data = (uintptr_t)(block + header_size);
+    data = (data + (CACHE_LINE_SIZE - 1)) & ~((uintptr_t)(CACHE_LINE_SIZE - 1));
+
+    /* thread the objects into the free list, in address order */
+    for(int i = pool->objects_per_slab - 1; i >= 0; i--) {
+        poolnode_t* node = (poolnode_t*)(data + i * pool->stride);
+        node->next = pool->free_list;
+        pool->free_list = node;
+    }
+}
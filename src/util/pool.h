@@ -0,0 +1,56 @@
+/*
+ * Open Surge Engine
+ * pool.h - allocator of fixed-size objects
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _POOL_H
+#define _POOL_H
+
+/*
+
+A pool hands out objects of a fixed size. Objects are carved out of slabs
+(large, cache-line aligned blocks of memory) and recycled via a free list,
+so allocating and freeing objects doesn't touch the heap in the long run.
+Slabs are kept until the pool is destroyed.
+
+Usage example:
+
+pool_t* pool = pool_create(sizeof(foo_t), 64);
+
+foo_t* foo = pool_alloc(pool);
+...
+pool_free(pool, foo);
+
+pool_destroy(pool);
+
+*/
+
+#include <stddef.h>
+
+/* opaque type */
+typedef struct pool_t pool_t;
+
+pool_t* pool_create(size_t object_size, int objects_per_slab); /* creates a new pool */
+pool_t* pool_destroy(pool_t* pool); /* destroys a pool and all of its objects */
+
+void* pool_alloc(pool_t* pool); /* allocates an object; never returns NULL */
+void pool_free(pool_t* pool, void* object); /* gives an object back to the pool */
+
+int pool_count(const pool_t* pool); /* number of objects currently allocated */
+
+#endif
@@ -0,0 +1,319 @@
+/*
+ * Open Surge Engine
+ * profiler.c - profiling zones of the hot paths
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "profiler.h"
+
+#if WANT_PROFILER
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <allegro5/allegro.h>
+#include "darray.h"
+#include "util.h"
+#include "../core/logfile.h"
+
+/* thread-local storage */
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+/* an event of a zone */
+typedef struct zoneevent_t zoneevent_t;
+struct zoneevent_t
+{
+    double timestamp; /* in seconds, since profiler_init() */
+    int zone_id; /* the zone that begins, or END_OF_ZONE */
+};
+
+/* the events of a thread */
+#define RING_CAPACITY 65536 /* a power of two */
+typedef struct threadbuffer_t threadbuffer_t;
+struct threadbuffer_t
+{
+    zoneevent_t event[RING_CAPACITY]; /* the most recent events */
+    unsigned head; /* index of the next event */
+    bool wrapped; /* true if older events have been overwritten */
+    int tid; /* identifies the thread */
+};
+
+/* statistics of a zone */
+typedef struct zone_t zone_t;
+struct zone_t
+{
+    const char* name; /* a string literal */
+    int calls; /* number of complete calls in the trace */
+    double total_time; /* inclusive time, in seconds */
+};
+
+/* internal data */
+#define END_OF_ZONE 0
+#define MAX_DEPTH 64 /* deeper zones are exported, but not measured */
+static const char TRACE_FILE[] = "profile_trace.json";
+STATIC_DARRAY(zone_t, zone); /* zone[id - 1] */
+STATIC_DARRAY(threadbuffer_t*, buffer);
+static THREAD_LOCAL threadbuffer_t* thread_buffer = NULL;
+static ALLEGRO_MUTEX* mutex = NULL;
+static double start_time = 0.0;
+static bool enabled = false;
+
+static void register_zone(int* zone_id, const char* zone_name);
+static threadbuffer_t* create_thread_buffer();
+static void record_event(int zone_id);
+static bool write_trace_file(const char* filepath);
+static void write_summary();
+static void write_thread(ALLEGRO_FILE* fp, threadbuffer_t* buf, bool* first);
+static int sort_zones_by_time(const void* a, const void* b);
+
+
+
+/*
+ * profiler_init()
+ * Initializes the profiler. Allegro must be initialized
+ */
+void profiler_init()
+{
+    profiler_release();
+
+    mutex = al_create_mutex();
+    darray_init(zone);
+    darray_init(buffer);
+    start_time = al_get_time();
+    enabled = true;
+
+    logfile_message("The profiling zones are enabled");
+}
+
+/*
+ * profiler_release()
+ * Writes the trace and releases the profiler. Call it
+ * after the threads that record zones have finished
+ */
+void profiler_release()
+{
+    if(mutex == NULL)
+        return;
+
+    al_lock_mutex(mutex);
+    enabled = false;
+
+    /* report */
+    if(write_trace_file(TRACE_FILE))
+        logfile_message("The profiling trace has been written to %s", TRACE_FILE);
+    else
+        logfile_message("Can't write the profiling trace to %s", TRACE_FILE);
+    write_summary();
+
+    /* release the buffers. This assumes that no other zones will be recorded */
+    for(int i = 0; i < darray_length(buffer); i++)
+        free(buffer[i]);
+    darray_release(buffer);
+    darray_release(zone);
+
+    al_unlock_mutex(mutex);
+    al_destroy_mutex(mutex);
+    mutex = NULL;
+}
+
+/*
+ * profiler_begin()
+ * Begins a zone in the calling thread. zone_id points to a static
+ * variable of the call site, initially zero
+ */
+void profiler_begin(int* zone_id, const char* zone_name)
+{
+    if(!enabled)
+        return;
+
+    if(*zone_id == 0)
+        register_zone(zone_id, zone_name);
+
+    record_event(*zone_id);
+}
+
+/*
+ * profiler_end()
+ * Ends the innermost zone of the calling thread
+ */
+void profiler_end()
+{
+    if(!enabled)
+        return;
+
+    record_event(END_OF_ZONE);
+}
+
+
+
+/*
+ * private
+ */
+
+/* assigns an ID to a call site */
+void register_zone(int* zone_id, const char* zone_name)
+{
+    al_lock_mutex(mutex);
+
+    /* another thread may have registered it in the meantime */
+    if(*zone_id == 0) {
+        zone_t z = { .name = zone_name, .calls = 0, .total_time = 0.0 };
+        *zone_id = darray_push(zone, z); /* the IDs start at 1 */
+    }
+
+    al_unlock_mutex(mutex);
+}
+
+/* creates the buffer of the calling thread */
+threadbuffer_t* create_thread_buffer()
+{
+    threadbuffer_t* buf = mallocx(sizeof *buf);
+    buf->head = 0;
+    buf->wrapped = false;
+
+    al_lock_mutex(mutex);
+    buf->tid = darray_length(buffer) + 1;
+    darray_push(buffer, buf);
+    al_unlock_mutex(mutex);
+
+    return buf;
+}
+
+/* records an event in the buffer of the calling thread */
+void record_event(int zone_id)
+{
+    if(thread_buffer == NULL)
+        thread_buffer = create_thread_buffer();
+
+    zoneevent_t* e = &thread_buffer->event[thread_buffer->head];
+    e->timestamp = al_get_time() - start_time;
+    e->zone_id = zone_id;
+
+    if(++thread_buffer->head == RING_CAPACITY) {
+        thread_buffer->head = 0;
+        thread_buffer->wrapped = true;
+    }
+}
+
+/* writes the trace in the Chrome trace format to a file of the virtual filesystem.
+   Call with the mutex locked */
+bool write_trace_file(const char* filepath)
+{
+    ALLEGRO_FILE* fp = al_fopen(filepath, "wb");
+    bool first = true;
+
+    if(fp == NULL)
+        return false;
+
+    al_fputs(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for(int i = 0; i < darray_length(buffer); i++)
+        write_thread(fp, buffer[i], &first);
+    al_fputs(fp, "\n]}\n");
+
+    return al_fclose(fp);
+}
+
+/* writes the events of a thread, oldest first, and accumulates the statistics of
+   the zones. Ends that lost their beginnings to the ring buffer are discarded and
+   zones that are still open are closed at the last event. Call with the mutex locked */
+void write_thread(ALLEGRO_FILE* fp, threadbuffer_t* buf, bool* first)
+{
+    int count = buf->wrapped ? RING_CAPACITY : buf->head;
+    int start = buf->wrapped ? buf->head : 0;
+    double begin_time[MAX_DEPTH];
+    int open_zone[MAX_DEPTH];
+    double last_timestamp = 0.0;
+    int depth = 0;
+
+    for(int k = 0; k < count; k++) {
+        const zoneevent_t* e = &buf->event[(start + k) & (RING_CAPACITY - 1)];
+        last_timestamp = e->timestamp;
+
+        if(e->zone_id != END_OF_ZONE) {
+            if(depth < MAX_DEPTH) {
+                begin_time[depth] = e->timestamp;
+                open_zone[depth] = e->zone_id;
+            }
+            depth++;
+
+            al_fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"B\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}",
+                *first ? "" : ",\n", zone[e->zone_id - 1].name, buf->tid, 1000000.0 * e->timestamp);
+            *first = false;
+        }
+        else if(depth > 0) {
+            if(--depth < MAX_DEPTH) {
+                zone_t* z = &zone[open_zone[depth] - 1];
+                z->total_time += e->timestamp - begin_time[depth];
+                z->calls++;
+            }
+
+            al_fprintf(fp, ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}",
+                buf->tid, 1000000.0 * e->timestamp);
+        }
+    }
+
+    while(depth-- > 0) {
+        al_fprintf(fp, ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}",
+            buf->tid, 1000000.0 * last_timestamp);
+    }
+}
+
+/* writes the statistics of the zones to the logfile, the most costly first.
+   Call after write_trace_file(), with the mutex locked */
+void write_summary()
+{
+    int count = darray_length(zone);
+    zone_t* sorted;
+
+    if(count == 0)
+        return;
+
+    sorted = mallocx(count * sizeof(*sorted));
+    memcpy(sorted, zone, count * sizeof(*sorted));
+    qsort(sorted, count, sizeof(*sorted), sort_zones_by_time);
+
+    logfile_message("Profiling zones (inclusive time of the recorded events):");
+    for(int i = 0; i < count; i++) {
+        logfile_message("  %s: %d calls, %.3f ms (%.3f ms per call)",
+            sorted[i].name, sorted[i].calls,
+            1000.0 * sorted[i].total_time,
+            1000.0 * sorted[i].total_time / max(1, sorted[i].calls)
+        );
+    }
+
+    free(sorted);
+}
+
+/* sorts the zones by total time, in descending order */
+int sort_zones_by_time(const void* a, const void* b)
+{
+    const zone_t* za = (const zone_t*)a;
+    const zone_t* zb = (const zone_t*)b;
+
+    if(za->total_time > zb->total_time)
+        return -1;
+    else if(za->total_time < zb->total_time)
+        return 1;
+    else
+        return 0;
+}
+
+#endif
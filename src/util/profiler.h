@@ -0,0 +1,62 @@
+/*
+ * Open Surge Engine
+ * profiler.h - profiling zones of the hot paths
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+/*
+ * Profiling zones
+ *
+ * A zone is delimited by PROFILER_BEGIN("name") and PROFILER_END() in the same
+ * function. Zones may be nested and their names must be string literals. Each
+ * call site gets a static ID when it first runs, and the events are recorded in
+ * a ring buffer of the calling thread. The trace is exported on exit in the
+ * Chrome trace format: open it at chrome://tracing, in Perfetto or in Tracy
+ * (with its import-chrome tool).
+ *
+ * The zones compile to nothing unless the engine is built with WANT_PROFILER
+ */
+
+#ifndef WANT_PROFILER
+#define WANT_PROFILER 0
+#endif
+
+#if WANT_PROFILER
+
+#define PROFILER_INIT()             profiler_init()
+#define PROFILER_RELEASE()          profiler_release()
+#define PROFILER_BEGIN(zone_name)   do { static int zone_id_ = 0; profiler_begin(&zone_id_, "" zone_name); } while(0)
+#define PROFILER_END()              profiler_end()
+
+void profiler_init();
+void profiler_release(); /* writes the trace */
+void profiler_begin(int* zone_id, const char* zone_name);
+void profiler_end();
+
+#else
+
+#define PROFILER_INIT()             ((void)0)
+#define PROFILER_RELEASE()          ((void)0)
+#define PROFILER_BEGIN(zone_name)   ((void)0)
+#define PROFILER_END()              ((void)0)
+
+#endif
+
+#endif
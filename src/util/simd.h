@@ -0,0 +1,56 @@
+/*
+ * Open Surge Engine
+ * simd.h - detection of SIMD instruction sets
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SIMD_H
+#define _SIMD_H
+
+/*
+
+We use SIMD instructions in batch operations if the target supports them.
+Only one of the following is defined to 1:
+
+- HAVE_SSE: x86 and x86-64 (SSE is part of the x86-64 baseline)
+- HAVE_NEON: ARM (part of the AArch64 baseline)
+- HAVE_NO_SIMD: fallback to scalar code
+
+HAVE_SSE2 is also defined if HAVE_SSE is and the target supports SSE2, which
+adds integer operations on 128-bit vectors (SSE2 is part of the x86-64 baseline).
+
+Define DISABLE_SIMD to force the scalar code.
+
+*/
+
+#if defined(DISABLE_SIMD)
+#define HAVE_NO_SIMD 1
+#elif defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define HAVE_SSE 1
+#include <xmmintrin.h>
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_NEON 1
+#include <arm_neon.h>
+#else
+#define HAVE_NO_SIMD 1
+#endif
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ * Open Surge Engine
+ * snapshot.c - compact binary snapshots
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "snapshot.h"
+#include "util.h"
+
+/* snapshot */
+struct snapshot_t
+{
+    uint8_t* data; /* contents */
+    size_t size; /* size of the contents, in bytes */
+    size_t capacity; /* allocated bytes */
+    size_t cursor; /* read cursor */
+};
+
+#define INITIAL_CAPACITY 1024
+
+static void reserve(snapshot_t* snapshot, size_t size);
+
+
+
+/*
+ * snapshot_create()
+ * Creates an empty snapshot
+ */
+snapshot_t* snapshot_create()
+{
+    snapshot_t* snapshot = mallocx(sizeof *snapshot);
+
+    snapshot->data = mallocx(INITIAL_CAPACITY);
+    snapshot->capacity = INITIAL_CAPACITY;
+    snapshot->size = 0;
+    snapshot->cursor = 0;
+
+    return snapshot;
+}
+
+/*
+ * snapshot_destroy()
+ * Destroys a snapshot
+ */
+snapshot_t* snapshot_destroy(snapshot_t* snapshot)
+{
+    free(snapshot->data);
+    free(snapshot);
+    return NULL;
+}
+
+/*
+ * snapshot_clear()
+ * Empties the snapshot, keeping its memory
+ */
+void snapshot_clear(snapshot_t* snapshot)
+{
+    snapshot->size = 0;
+    snapshot->cursor = 0;
+}
+
+/*
+ * snapshot_copy()
+ * Replaces the contents of the snapshot
+ */
+void snapshot_copy(snapshot_t* snapshot, const void* data, size_t size)
+{
+    snapshot_clear(snapshot);
+    snapshot_write(snapshot, data, size);
+}
+
+/*
+ * snapshot_data()
+ * The contents of the snapshot
+ */
+const void* snapshot_data(const snapshot_t* snapshot)
+{
+    return snapshot->data;
+}
+
+/*
+ * snapshot_size()
+ * The size of the contents of the snapshot, in bytes
+ */
+size_t snapshot_size(const snapshot_t* snapshot)
+{
+    return snapshot->size;
+}
+
+/*
+ * snapshot_capacity()
+ * The memory allocated to the snapshot, in bytes
+ */
+size_t snapshot_capacity(const snapshot_t* snapshot)
+{
+    return snapshot->capacity;
+}
+
+/*
+ * snapshot_write()
+ * Appends bytes to the snapshot
+ */
+void snapshot_write(snapshot_t* snapshot, const void* data, size_t size)
+{
+    reserve(snapshot, snapshot->size + size);
+    memcpy(snapshot->data + snapshot->size, data, size);
+    snapshot->size += size;
+}
+
+/*
+ * snapshot_write_string()
+ * Appends a string to the snapshot
+ */
+void snapshot_write_string(snapshot_t* snapshot, const char* str)
+{
+    uint32_t length = (uint32_t)strlen(str);
+
+    snapshot_put(snapshot, length);
+    snapshot_write(snapshot, str, length);
+}
+
+/*
+ * snapshot_seek_start()
+ * Moves the read cursor to the beginning of the snapshot
+ */
+void snapshot_seek_start(snapshot_t* snapshot)
+{
+    snapshot->cursor = 0;
+}
+
+/*
+ * snapshot_read()
+ * Reads bytes from the snapshot. Returns false and zero-fills
+ * the output if there aren't enough bytes left
+ */
+bool snapshot_read(snapshot_t* snapshot, void* data, size_t size)
+{
+    if(size > snapshot->size - snapshot->cursor) {
+        snapshot->cursor = snapshot->size;
+        memset(data, 0, size);
+        return false;
+    }
+
+    memcpy(data, snapshot->data + snapshot->cursor, size);
+    snapshot->cursor += size;
+    return true;
+}
+
+/*
+ * snapshot_read_string()
+ * Reads a string from the snapshot, truncating it if it doesn't fit the buffer
+ */
+bool snapshot_read_string(snapshot_t* snapshot, char* buffer, size_t buffer_size)
+{
+    uint32_t length = 0;
+
+    if(buffer_size > 0)
+        *buffer = '\0';
+
+    if(!snapshot_get(snapshot, length) || length > snapshot->size - snapshot->cursor) {
+        snapshot->cursor = snapshot->size;
+        return false;
+    }
+
+    if(buffer_size > 0) {
+        size_t n = min((size_t)length, buffer_size - 1);
+        memcpy(buffer, snapshot->data + snapshot->cursor, n);
+        buffer[n] = '\0';
+    }
+
+    snapshot->cursor += length;
+    return true;
+}
+
+/*
+ * snapshot_at_end()
+ * Has the read cursor reached the end of the snapshot?
+ */
+bool snapshot_at_end(const snapshot_t* snapshot)
+{
+    return snapshot->cursor >= snapshot->size;
+}
+
+
+
+/* private */
+
+/* makes sure that the snapshot can store at least size bytes */
+void reserve(snapshot_t* snapshot, size_t size)
+{
+    if(size <= snapshot->capacity)
+        return;
+
+    while(snapshot->capacity < size)
+        snapshot->capacity *= 2;
+
+    snapshot->data = reallocx(snapshot->data, snapshot->capacity);
+}
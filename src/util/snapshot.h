@@ -0,0 +1,75 @@
+/*
+ * Open Surge Engine
+ * snapshot.h - compact binary snapshots
+ * Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+ * http://opensurge2d.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+/*
+
+A snapshot is a growable buffer of bytes in which state is serialized in a
+compact binary form. Values are written and read back in the same order, in
+the native byte order of the machine, so snapshots are meant to be read by
+the same build that wrote them. Clearing a snapshot keeps its memory, so a
+snapshot that is reused (e.g., in a ring buffer) doesn't touch the heap in
+the long run.
+
+Usage example:
+
+snapshot_t* snapshot = snapshot_create();
+
+snapshot_put(snapshot, player->xpos);
+snapshot_put(snapshot, player->ypos);
+...
+snapshot_seek_start(snapshot);
+snapshot_get(snapshot, player->xpos);
+snapshot_get(snapshot, player->ypos);
+
+snapshot_destroy(snapshot);
+
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* opaque type */
+typedef struct snapshot_t snapshot_t;
+
+snapshot_t* snapshot_create(); /* creates an empty snapshot */
+snapshot_t* snapshot_destroy(snapshot_t* snapshot); /* destroys a snapshot */
+
+void snapshot_clear(snapshot_t* snapshot); /* empties the snapshot, keeping its memory */
+void snapshot_copy(snapshot_t* snapshot, const void* data, size_t size); /* replaces the contents of the snapshot */
+const void* snapshot_data(const snapshot_t* snapshot); /* the contents of the snapshot */
+size_t snapshot_size(const snapshot_t* snapshot); /* the size of the contents, in bytes */
+size_t snapshot_capacity(const snapshot_t* snapshot); /* the memory allocated to the snapshot, in bytes */
+
+void snapshot_write(snapshot_t* snapshot, const void* data, size_t size); /* appends bytes */
+void snapshot_write_string(snapshot_t* snapshot, const char* str); /* appends a string */
+
+void snapshot_seek_start(snapshot_t* snapshot); /* moves the read cursor to the beginning */
+bool snapshot_read(snapshot_t* snapshot, void* data, size_t size); /* reads bytes; returns false (and zero-fills data) if there aren't enough bytes */
+bool snapshot_read_string(snapshot_t* snapshot, char* buffer, size_t buffer_size); /* reads a string, truncating it if needed */
+bool snapshot_at_end(const snapshot_t* snapshot); /* has the read cursor reached the end? */
+
+/* write and read variables of fixed size */
+#define snapshot_put(snapshot, var)     snapshot_write((snapshot), &(var), sizeof(var))
+#define snapshot_get(snapshot, var)     snapshot_read((snapshot), &(var), sizeof(var))
+
+#endif
@@ -22,35 +22,8 @@
 #include <math.h>
 #include "transform.h"
 #include "numeric.h"
-
-/*
- * transform_identity()
- * Create an identity transform
- */
-transform_t* transform_identity(transform_t* t)
-{
-    t->m[0] = 1.0f;
-    t->m[1] = 0.0f;
-    t->m[2] = 0.0f;
-    t->m[3] = 0.0f;
-
-    t->m[4] = 0.0f;
-    t->m[5] = 1.0f;
-    t->m[6] = 0.0f;
-    t->m[7] = 0.0f;
-
-    t->m[8] = 0.0f;
-    t->m[9] = 0.0f;
-    t->m[10] = 1.0f;
-    t->m[11] = 0.0f;
-
-    t->m[12] = 0.0f;
-    t->m[13] = 0.0f;
-    t->m[14] = 0.0f;
-    t->m[15] = 1.0f;
-
-    return t;
-}
+#include "simd.h"
+#include "util.h"
 
 /*
  * transform_build()
@@ -95,43 +68,6 @@ transform_t* transform_build(transform_t* t, v2d_t translation, float rotation,
    return t;
 }
 
-/*
- * transform_copy()
- * Copy src to dest
- */
-transform_t* transform_copy(transform_t* dest, const transform_t* src)
-{
-    *dest = *src;
-    return dest;
-}
-
-/*
- * transform_translate()
- * Translation
- */
-transform_t* transform_translate(transform_t* t, v2d_t offset)
-{
-    /*
-
-    pre-multiply by
-
-    [ 1  .  .  tx ]
-    [ .  1  .  ty ]
-    [ .  .  1  .  ]
-    [ .  .  .  1  ]
-
-    */
-
-    /*float one = t->m[15];
-    t->m[12] += offset.x * one;
-    t->m[13] += offset.y * one;*/
-
-    t->m[12] += offset.x;
-    t->m[13] += offset.y;
-
-    return t;
-}
-
 /*
  * transform_rotate()
  * Rotation
@@ -172,72 +108,106 @@ transform_t* transform_rotate(transform_t* t, float radians)
 }
 
 /*
- * transform_scale()
- * Scale
+ * transform_compose_all()
+ * Pre-multiplies each of T[0..n-1] by the same A, i.e., T[i] := A * T[i]
  */
-transform_t* transform_scale(transform_t* t, v2d_t scale)
+void transform_compose_all(transform_t* t, int n, const transform_t* a)
 {
-    /*
-
-    pre-multiply by
-
-    [ sx  .  .  . ]
-    [ .  sy  .  . ]
-    [ .   .  1  . ]
-    [ .   .  .  1 ]
-
-    */
-
-    t->m[0] *= scale.x;
-    t->m[1] *= scale.y;
-
-    t->m[4] *= scale.x;
-    t->m[5] *= scale.y;
-
-    t->m[8] *= scale.x;
-    t->m[9] *= scale.y;
-
-    t->m[12] *= scale.x;
-    t->m[13] *= scale.y;
-
-    return t;
+#if defined(HAVE_SSE)
+    /* each column of the result is a linear combination of the columns of A */
+    __m128 a0 = _mm_loadu_ps(a->m + 0);
+    __m128 a1 = _mm_loadu_ps(a->m + 4);
+    __m128 a2 = _mm_loadu_ps(a->m + 8);
+    __m128 a3 = _mm_loadu_ps(a->m + 12);
+
+    for(int i = 0; i < n; i++) {
+        for(int col = 0; col < 4; col++) {
+            const float* c = t[i].m + 4 * col;
+            __m128 r = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(c[0])), _mm_mul_ps(a1, _mm_set1_ps(c[1]))),
+                _mm_add_ps(_mm_mul_ps(a2, _mm_set1_ps(c[2])), _mm_mul_ps(a3, _mm_set1_ps(c[3])))
+            );
+            _mm_storeu_ps(t[i].m + 4 * col, r);
+        }
+    }
+#elif defined(HAVE_NEON)
+    /* each column of the result is a linear combination of the columns of A */
+    float32x4_t a0 = vld1q_f32(a->m + 0);
+    float32x4_t a1 = vld1q_f32(a->m + 4);
+    float32x4_t a2 = vld1q_f32(a->m + 8);
+    float32x4_t a3 = vld1q_f32(a->m + 12);
+
+    for(int i = 0; i < n; i++) {
+        for(int col = 0; col < 4; col++) {
+            const float* c = t[i].m + 4 * col;
+            float32x4_t r = vmulq_n_f32(a0, c[0]);
+            r = vmlaq_n_f32(r, a1, c[1]);
+            r = vmlaq_n_f32(r, a2, c[2]);
+            r = vmlaq_n_f32(r, a3, c[3]);
+            vst1q_f32(t[i].m + 4 * col, r);
+        }
+    }
+#else
+    for(int i = 0; i < n; i++)
+        transform_compose(&t[i], a);
+#endif
 }
 
 /*
- * transform_compose()
- * Pre-multiplies T by A, i.e., T := A * T
+ * transform_apply_all()
+ * Transforms n 2D points, v[0..n-1], by the same T
  */
-transform_t* transform_compose(transform_t* t, const transform_t* a)
+void transform_apply_all(const transform_t* t, v2d_t* v, int n)
 {
-    #define DOT(row, col) ( \
-        a->m[(row) + 0] * t->m[(col) * 4 + 0] + \
-        a->m[(row) + 4] * t->m[(col) * 4 + 1] + \
-        a->m[(row) + 8] * t->m[(col) * 4 + 2] + \
-        a->m[(row) + 12] * t->m[(col) * 4 + 3] \
-    )
-
-    *t = (const transform_t){ .m = {
-        DOT(0, 0),
-        DOT(1, 0),
-        DOT(2, 0),
-        DOT(3, 0),
-                    DOT(0, 1),
-                    DOT(1, 1),
-                    DOT(2, 1),
-                    DOT(3, 1),
-                                DOT(0, 2),
-                                DOT(1, 2),
-                                DOT(2, 2),
-                                DOT(3, 2),
-                                            DOT(0, 3),
-                                            DOT(1, 3),
-                                            DOT(2, 3),
-                                            DOT(3, 3)
-    }};
+    int i = 0;
+
+#if defined(HAVE_SSE)
+    /* two points at a time: (x0, y0, x1, y1) */
+    __m128 mx = _mm_setr_ps(t->m[0], t->m[1], t->m[0], t->m[1]);
+    __m128 my = _mm_setr_ps(t->m[4], t->m[5], t->m[4], t->m[5]);
+    __m128 mt = _mm_setr_ps(t->m[12], t->m[13], t->m[12], t->m[13]);
+
+    for(; i + 2 <= n; i += 2) {
+        __m128 xy = _mm_loadu_ps(&v[i].x);
+        __m128 xx = _mm_shuffle_ps(xy, xy, _MM_SHUFFLE(2, 2, 0, 0));
+        __m128 yy = _mm_shuffle_ps(xy, xy, _MM_SHUFFLE(3, 3, 1, 1));
+        _mm_storeu_ps(&v[i].x, _mm_add_ps(_mm_add_ps(_mm_mul_ps(xx, mx), _mm_mul_ps(yy, my)), mt));
+    }
+#elif defined(HAVE_NEON)
+    /* four points at a time, deinterleaved */
+    for(; i + 4 <= n; i += 4) {
+        float32x4x2_t xy = vld2q_f32(&v[i].x), r;
+        r.val[0] = vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(t->m[12]), xy.val[0], t->m[0]), xy.val[1], t->m[4]);
+        r.val[1] = vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(t->m[13]), xy.val[0], t->m[1]), xy.val[1], t->m[5]);
+        vst2q_f32(&v[i].x, r);
+    }
+#endif
 
-    return t;
+    for(; i < n; i++)
+        v[i] = transform_apply(t, v[i]);
+}
 
-    #undef DOT
+/*
+ * transform_bounds_all()
+ * Computes the axis-aligned bounding boxes of n boxes transformed by the same
+ * T. The i-th box spans from box_min[i] to box_max[i] before the transform
+ */
+void transform_bounds_all(const transform_t* t, int n, const v2d_t* box_min, const v2d_t* box_max, v2d_t* out_min, v2d_t* out_max)
+{
+    /* the extent of a transformed box along each axis is given by the
+       absolute values of the 2x2 block of T applied to its half-size */
+    float a = fabsf(t->m[0]), b = fabsf(t->m[4]);
+    float c = fabsf(t->m[1]), d = fabsf(t->m[5]);
+
+    for(int i = 0; i < n; i++) {
+        v2d_t center = v2d_new(0.5f * (box_min[i].x + box_max[i].x), 0.5f * (box_min[i].y + box_max[i].y));
+        v2d_t half = v2d_new(0.5f * (box_max[i].x - box_min[i].x), 0.5f * (box_max[i].y - box_min[i].y));
+        v2d_t new_center = transform_apply(t, center);
+        v2d_t new_half = v2d_new(a * half.x + b * half.y, c * half.x + d * half.y);
+
+        out_min[i] = v2d_subtract(new_center, new_half);
+        out_max[i] = v2d_add(new_center, new_half);
+    }
 }
 
 /*
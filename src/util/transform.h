@@ -33,15 +33,21 @@ struct transform_t {
 struct ALLEGRO_TRANSFORM;
 
 /* basic API */
-transform_t* transform_identity(transform_t* t); /* create an identity transform */
+static inline transform_t* transform_identity(transform_t* t); /* create an identity transform */
 transform_t* transform_build(transform_t* t, v2d_t translation, float rotation, v2d_t scale, v2d_t anchor_point); /* build a standard transform */
-transform_t* transform_copy(transform_t* dest, const transform_t* src); /* copy src to dest */
-transform_t* transform_translate(transform_t* t, v2d_t offset); /* translation */
+static inline transform_t* transform_copy(transform_t* dest, const transform_t* src); /* copy src to dest */
+static inline transform_t* transform_translate(transform_t* t, v2d_t offset); /* translation */
 transform_t* transform_rotate(transform_t* t, float radians); /* rotation */
-transform_t* transform_scale(transform_t* t, v2d_t scale); /* scale */
+static inline transform_t* transform_scale(transform_t* t, v2d_t scale); /* scale */
 
 /* composition */
-transform_t* transform_compose(transform_t* t, const transform_t* a); /* T := A * T */
+static inline transform_t* transform_compose(transform_t* t, const transform_t* a); /* T := A * T */
+void transform_compose_all(transform_t* t, int n, const transform_t* a); /* T[i] := A * T[i] for 0 <= i < n */
+
+/* application */
+static inline v2d_t transform_apply(const transform_t* t, v2d_t v); /* returns T * v */
+void transform_apply_all(const transform_t* t, v2d_t* v, int n); /* v[i] := T * v[i] for 0 <= i < n */
+void transform_bounds_all(const transform_t* t, int n, const v2d_t* box_min, const v2d_t* box_max, v2d_t* out_min, v2d_t* out_max); /* axis-aligned bounding boxes of n transformed boxes */
 
 /* decomposition */
 void transform_decompose(const transform_t* t, v2d_t* translation, float* rotation, v2d_t* scale, v2d_t anchor_point); /* give an anchor point as input */
@@ -49,4 +55,115 @@ void transform_decompose(const transform_t* t, v2d_t* translation, float* rotati
 /* misc */
 struct ALLEGRO_TRANSFORM* transform_to_allegro(struct ALLEGRO_TRANSFORM* al_transform, const transform_t* t);
 
-#endif
\ No newline at end of file
+
+
+/* these are called in the innermost loops of the engine, so we inline them */
+
+transform_t* transform_identity(transform_t* t)
+{
+    *t = (const transform_t){ .m = {
+        1.0f, 0.0f, 0.0f, 0.0f,
+        0.0f, 1.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 1.0f, 0.0f,
+        0.0f, 0.0f, 0.0f, 1.0f
+    }};
+
+    return t;
+}
+
+transform_t* transform_copy(transform_t* dest, const transform_t* src)
+{
+    *dest = *src;
+    return dest;
+}
+
+transform_t* transform_translate(transform_t* t, v2d_t offset)
+{
+    /*
+
+    pre-multiply by
+
+    [ 1  .  .  tx ]
+    [ .  1  .  ty ]
+    [ .  .  1  .  ]
+    [ .  .  .  1  ]
+
+    */
+
+    t->m[12] += offset.x;
+    t->m[13] += offset.y;
+
+    return t;
+}
+
+transform_t* transform_scale(transform_t* t, v2d_t scale)
+{
+    /*
+
+    pre-multiply by
+
+    [ sx  .  .  . ]
+    [ .  sy  .  . ]
+    [ .   .  1  . ]
+    [ .   .  .  1 ]
+
+    */
+
+    t->m[0] *= scale.x;
+    t->m[1] *= scale.y;
+
+    t->m[4] *= scale.x;
+    t->m[5] *= scale.y;
+
+    t->m[8] *= scale.x;
+    t->m[9] *= scale.y;
+
+    t->m[12] *= scale.x;
+    t->m[13] *= scale.y;
+
+    return t;
+}
+
+transform_t* transform_compose(transform_t* t, const transform_t* a)
+{
+    #define DOT(row, col) ( \
+        a->m[(row) + 0] * t->m[(col) * 4 + 0] + \
+        a->m[(row) + 4] * t->m[(col) * 4 + 1] + \
+        a->m[(row) + 8] * t->m[(col) * 4 + 2] + \
+        a->m[(row) + 12] * t->m[(col) * 4 + 3] \
+    )
+
+    *t = (const transform_t){ .m = {
+        DOT(0, 0),
+        DOT(1, 0),
+        DOT(2, 0),
+        DOT(3, 0),
+                    DOT(0, 1),
+                    DOT(1, 1),
+                    DOT(2, 1),
+                    DOT(3, 1),
+                                DOT(0, 2),
+                                DOT(1, 2),
+                                DOT(2, 2),
+                                DOT(3, 2),
+                                            DOT(0, 3),
+                                            DOT(1, 3),
+                                            DOT(2, 3),
+                                            DOT(3, 3)
+    }};
+
+    return t;
+
+    #undef DOT
+}
+
+v2d_t transform_apply(const transform_t* t, v2d_t v)
+{
+    /* 2D point (x, y, 0, 1) */
+    return v2d_new(
+        t->m[0] * v.x + t->m[4] * v.y + t->m[12],
+        t->m[1] * v.x + t->m[5] * v.y + t->m[13]
+    );
+}
+
+#endif
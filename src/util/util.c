@@ -95,6 +95,10 @@ void *__mallocx(size_t bytes, const char* location, int line)
     if(!p)
         fatal_error("Out of memory in %s(%u) at %s:%d", __func__, bytes, location, line);
 
+#if WANT_MEMTRACKER
+    memtracker_track_alloc(p, bytes, location, line);
+#endif
+
     return p;
 }
 
@@ -111,10 +115,27 @@ void* __reallocx(void *ptr, size_t bytes, const char* location, int line)
     if(!p)
         fatal_error("Out of memory in %s(%u) at %s:%d", __func__, bytes, location, line);
 
+#if WANT_MEMTRACKER
+    memtracker_track_realloc(ptr, p, bytes, location, line);
+#endif
+
     return p;
 }
 
 
+#if WANT_MEMTRACKER
+/*
+ * __freex()
+ * Similar to free(), but seen by the memory tracker
+ */
+void __freex(void* ptr)
+{
+    memtracker_track_free(ptr);
+    (free)(ptr);
+}
+#endif
+
+
 
 /* General utilities */
 
@@ -140,7 +161,7 @@ int game_version_compare(int sup_version, int sub_version, int wip_version)
  */
 void fatal_error(const char *fmt, ...)
 {
-    char buf[1024];
+    char buf[1024], recent[8192];
     va_list args;
 
     /* format message */
@@ -151,7 +172,9 @@ void fatal_error(const char *fmt, ...)
     /* display an error */
     logfile_message("----- crash -----");
     logfile_message("%s", buf);
+    logfile_flush();
     fprintf(stderr, "%s\n", buf);
+    fprintf(stderr, "\nRecent log messages:\n%s", logfile_recent(recent, sizeof(recent)));
 
 #if defined(__ANDROID__)
     __android_log_print(ANDROID_LOG_FATAL, GAME_UNIXNAME, "Surgexception Error: %s", buf);
@@ -314,6 +337,40 @@ FILE* fopen_utf8(const char* filepath, const char* mode)
 #endif
 }
 
+/*
+ * rename_utf8()
+ * rename() with support for UTF-8 filenames. If newpath
+ * exists, it's atomically replaced. Returns true on success
+ */
+bool rename_utf8(const char* oldpath, const char* newpath)
+{
+#if defined(_WIN32)
+    bool success = false;
+    int wold_size = MultiByteToWideChar(CP_UTF8, 0, oldpath, -1, NULL, 0);
+    int wnew_size = MultiByteToWideChar(CP_UTF8, 0, newpath, -1, NULL, 0);
+
+    if(wold_size > 0 && wnew_size > 0) {
+        wchar_t* wold = mallocx(wold_size * sizeof(*wold));
+        wchar_t* wnew = mallocx(wnew_size * sizeof(*wnew));
+
+        /* rename() fails on Windows if newpath exists */
+        MultiByteToWideChar(CP_UTF8, 0, oldpath, -1, wold, wold_size);
+        MultiByteToWideChar(CP_UTF8, 0, newpath, -1, wnew, wnew_size);
+        success = MoveFileExW(wold, wnew, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+
+        free(wnew);
+        free(wold);
+    }
+
+    if(!success)
+        logfile_message("%s(\"%s\", \"%s\") ERROR %d", __func__, oldpath, newpath, GetLastError());
+
+    return success;
+#else
+    return rename(oldpath, newpath) == 0;
+#endif
+}
+
 /*
  * file_exists()
  * Checks if a regular file exists, given its absolute path
@@ -636,6 +693,17 @@ void merge_sort(void *base, int num, size_t size, int (*comparator)(const void*,
         free(heap_mem);
 }
 
+/*
+ * merge_sort_with_buffer()
+ * Similar to merge_sort(), but it uses the given scratch
+ * memory instead of allocating it. tmp must point to a
+ * buffer of at least num * size bytes
+ */
+void merge_sort_with_buffer(void *base, int num, size_t size, int (*comparator)(const void*,const void*), void *tmp)
+{
+    merge_sort_recursive(base, size, comparator, 0, num-1, tmp, (size_t)num * size);
+}
+
 
 
 
@@ -755,4 +823,56 @@ bool is_tv_device()
     return false;
 
 #endif
-}
\ No newline at end of file
+}
+
+/* Is the device saving battery or under thermal pressure? */
+bool is_power_constrained()
+{
+#if defined(__ANDROID__)
+
+    const jint THERMAL_STATUS_MODERATE = 2; /* see android.os.PowerManager */
+    bool constrained = false;
+
+    JNIEnv* env = al_android_get_jni_env();
+    jobject activity = al_android_get_activity();
+
+    /* get the PowerManager */
+    jclass class_id = (*env)->GetObjectClass(env, activity);
+    jmethodID method_id = (*env)->GetMethodID(env, class_id, "getSystemService", "(Ljava/lang/String;)Ljava/lang/Object;");
+
+    jstring jname = (*env)->NewStringUTF(env, "power");
+    jobject power_manager = (*env)->CallObjectMethod(env, activity, method_id, jname);
+    (*env)->DeleteLocalRef(env, jname);
+
+    (*env)->DeleteLocalRef(env, class_id);
+
+    if(power_manager == NULL) {
+        (*env)->ExceptionClear(env);
+        return false;
+    }
+
+    class_id = (*env)->GetObjectClass(env, power_manager);
+
+    /* battery saver (API level 21) */
+    method_id = (*env)->GetMethodID(env, class_id, "isPowerSaveMode", "()Z");
+    if(method_id != NULL)
+        constrained = constrained || (*env)->CallBooleanMethod(env, power_manager, method_id);
+    (*env)->ExceptionClear(env);
+
+    /* thermal status (API level 29) */
+    method_id = (*env)->GetMethodID(env, class_id, "getCurrentThermalStatus", "()I");
+    if(method_id != NULL)
+        constrained = constrained || (*env)->CallIntMethod(env, power_manager, method_id) >= THERMAL_STATUS_MODERATE;
+    (*env)->ExceptionClear(env);
+
+    (*env)->DeleteLocalRef(env, class_id);
+    (*env)->DeleteLocalRef(env, power_manager);
+
+    return constrained;
+
+#else
+
+    return false;
+
+#endif
+}
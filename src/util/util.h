@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "memtracker.h"
 
 /* redefinitions */
 #ifdef min
@@ -57,6 +58,10 @@
 /* Memory management */
 void* __mallocx(size_t bytes, const char* location, int line);
 void* __reallocx(void *ptr, size_t bytes, const char* location, int line);
+#if WANT_MEMTRACKER
+#define free(ptr)               __freex(ptr)
+void __freex(void* ptr); /* free() seen by the memory tracker */
+#endif
 
 /* General utilities */
 int game_version_compare(int sup_version, int sub_version, int wip_version); /* compare to this version of the game engine */
@@ -64,8 +69,10 @@ void fatal_error(const char *fmt, ...); /* crash the program with a message */
 void alert(const char* fmt, ...); /* display a message box with an OK button */
 bool confirm(const char* fmt, ...); /* display a message box with Yes/No buttons */
 void merge_sort(void *base, int num, size_t size, int (*comparator)(const void*,const void*)); /* similar to stdlib's qsort, but merge_sort is a stable sorting algorithm */
+void merge_sort_with_buffer(void *base, int num, size_t size, int (*comparator)(const void*,const void*), void *tmp); /* merge_sort without allocations; tmp must hold num * size bytes */
 uint64_t random64(); /* pseudo-random 64-bit number */
 FILE* fopen_utf8(const char* filepath, const char* mode); /* fopen() with UTF-8 filename support */
+bool rename_utf8(const char* oldpath, const char* newpath); /* atomically replaces newpath, if it exists */
 bool file_exists(const char* filepath); /* checks if a regular file exists */
 bool directory_exists(const char* dirpath); /* checks if a directory exists */
 int mkpath(const char* filepath, uint32_t mode); /* mkdir() for paths */
@@ -78,5 +85,6 @@ char* stringify_version_number(int version_code, char* buffer, size_t buffer_siz
 const char* opensurge_game_version(); /* the version of the game / MOD that is being run in the engine */
 const char* opensurge_game_name(); /* the name of the game / MOD that is being run in the engine */
 bool is_tv_device(); /* are we in a Smart TV? */
+bool is_power_constrained(); /* is the device saving battery or under thermal pressure? */
 
 #endif
\ No newline at end of file
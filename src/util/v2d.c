@@ -20,89 +20,117 @@
 
 #include <math.h>
 #include "v2d.h"
+#include "simd.h"
 #include "../util/numeric.h"
 #include "../util/util.h"
 
-
-/*
- * v2d_add()
- * Adds two vectors
- */
-v2d_t v2d_add(v2d_t u, v2d_t v)
-{
-    return v2d_new(u.x + v.x , u.y + v.y);
-}
-
-
-/*
- * v2d_subtract()
- * Subtracts two vectors
- */
-v2d_t v2d_subtract(v2d_t u, v2d_t v)
-{
-    return v2d_new(u.x - v.x , u.y - v.y);
-}
+/* v2d_t must be tightly packed, so that we can load arrays of vectors into SIMD registers */
+typedef char __v2d_packing_check[1 - 2 * (sizeof(v2d_t) != 2 * sizeof(float))];
 
 
 /*
- * v2d_multiply()
- * Multiplies a vector by a scalar
- */
-v2d_t v2d_multiply(v2d_t u, float h)
-{
-    return v2d_new(h * u.x , h * u.y);
-}
-
-
-/*
- * v2d_magnitude()
- * Returns the length of a vector
- */
-float v2d_magnitude(v2d_t v)
-{
-    return sqrtf(v.x * v.x + v.y * v.y);
-}
-
-
-/*
- * v2d_dot()
- * Returns the dot product between u and v
+ * v2d_rotate_all()
+ * Rotates n vectors, v[0..n-1], by an angle
  */
-float v2d_dot(v2d_t u, v2d_t v)
+void v2d_rotate_all(v2d_t* v, int n, float radians)
 {
-    return (u.x * v.x + u.y * v.y);
-}
+    float c = cosf(radians), s = sinf(radians);
+    int i = 0;
 
+#if defined(HAVE_SSE)
+    /* two vectors at a time: (x0, y0, x1, y1) */
+    __m128 cc = _mm_set1_ps(c);
+    __m128 ss = _mm_setr_ps(-s, s, -s, s);
 
-/*
- * v2d_rotate()
- * Rotates a vector by an angle given in radians
- */
-v2d_t v2d_rotate(v2d_t v, float radians)
-{
-    float c = cosf(radians), s = sinf(radians);
+    for(; i + 2 <= n; i += 2) {
+        __m128 xy = _mm_loadu_ps(&v[i].x);
+        __m128 yx = _mm_shuffle_ps(xy, xy, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_ps(&v[i].x, _mm_add_ps(_mm_mul_ps(xy, cc), _mm_mul_ps(yx, ss)));
+    }
+#elif defined(HAVE_NEON)
+    /* four vectors at a time, deinterleaved */
+    for(; i + 4 <= n; i += 4) {
+        float32x4x2_t xy = vld2q_f32(&v[i].x), r;
+        r.val[0] = vmlsq_n_f32(vmulq_n_f32(xy.val[0], c), xy.val[1], s);
+        r.val[1] = vmlaq_n_f32(vmulq_n_f32(xy.val[1], c), xy.val[0], s);
+        vst2q_f32(&v[i].x, r);
+    }
+#endif
 
-    return v2d_new(
-        v.x * c - v.y * s,
-        v.y * c + v.x * s
-    );
+    for(; i < n; i++) {
+        v[i] = v2d_new(
+            v[i].x * c - v[i].y * s,
+            v[i].y * c + v[i].x * s
+        );
+    }
 }
 
 
 /*
- * v2d_rotate_all()
- * Rotates n vectors, v[0..n-1], by an angle
+ * v2d_bounds()
+ * Computes the axis-aligned bounding box of n > 0 vectors, v[0..n-1]
  */
-void v2d_rotate_all(v2d_t* v, int n, float radians)
+void v2d_bounds(const v2d_t* v, int n, v2d_t* out_min, v2d_t* out_max)
 {
-    float c = cosf(radians), s = sinf(radians);
+    v2d_t lo = v[0], hi = v[0];
+    int i = 1;
+
+#if defined(HAVE_SSE)
+    if(n >= 4) {
+        /* two vectors at a time: (x0, y0, x1, y1) */
+        __m128 mn = _mm_loadu_ps(&v[0].x);
+        __m128 mx = mn;
+
+        for(i = 2; i + 2 <= n; i += 2) {
+            __m128 xy = _mm_loadu_ps(&v[i].x);
+            mn = _mm_min_ps(mn, xy);
+            mx = _mm_max_ps(mx, xy);
+        }
+
+        /* combine the lanes */
+        mn = _mm_min_ps(mn, _mm_movehl_ps(mn, mn));
+        mx = _mm_max_ps(mx, _mm_movehl_ps(mx, mx));
+
+        float tmp[4];
+        _mm_storeu_ps(tmp, mn);
+        lo = v2d_new(tmp[0], tmp[1]);
+        _mm_storeu_ps(tmp, mx);
+        hi = v2d_new(tmp[0], tmp[1]);
+    }
+#elif defined(HAVE_NEON)
+    if(n >= 4) {
+        /* four vectors at a time, deinterleaved */
+        float32x4x2_t xy = vld2q_f32(&v[0].x);
+        float32x4_t min_x = xy.val[0], min_y = xy.val[1];
+        float32x4_t max_x = xy.val[0], max_y = xy.val[1];
+
+        for(i = 4; i + 4 <= n; i += 4) {
+            xy = vld2q_f32(&v[i].x);
+            min_x = vminq_f32(min_x, xy.val[0]);
+            min_y = vminq_f32(min_y, xy.val[1]);
+            max_x = vmaxq_f32(max_x, xy.val[0]);
+            max_y = vmaxq_f32(max_y, xy.val[1]);
+        }
+
+        /* combine the lanes */
+        float32x2_t lo_x = vpmin_f32(vget_low_f32(min_x), vget_high_f32(min_x));
+        float32x2_t lo_y = vpmin_f32(vget_low_f32(min_y), vget_high_f32(min_y));
+        float32x2_t hi_x = vpmax_f32(vget_low_f32(max_x), vget_high_f32(max_x));
+        float32x2_t hi_y = vpmax_f32(vget_low_f32(max_y), vget_high_f32(max_y));
+        lo = v2d_new(vget_lane_f32(vpmin_f32(lo_x, lo_x), 0), vget_lane_f32(vpmin_f32(lo_y, lo_y), 0));
+        hi = v2d_new(vget_lane_f32(vpmax_f32(hi_x, hi_x), 0), vget_lane_f32(vpmax_f32(hi_y, hi_y), 0));
+    }
+#endif
 
-    for(int i = 0; i < n; i++) {
-        v[i] = v2d_new(
-            v[i].x * c - v[i].y * s,
-            v[i].y * c + v[i].x * s
-        );
+    for(; i < n; i++) {
+        lo.x = min(lo.x, v[i].x);
+        lo.y = min(lo.y, v[i].y);
+        hi.x = max(hi.x, v[i].x);
+        hi.y = max(hi.y, v[i].y);
     }
+
+    *out_min = lo;
+    *out_max = hi;
 }
 
 
@@ -119,30 +147,3 @@ v2d_t v2d_normalize(v2d_t v)
     else
         return v2d_new(0.0f, 0.0f);
 }
-
-
-/*
- * v2d_lerp()
- * Linear interpolation between u and v
- * The same as: (1-t) * u + t * v, where 0 <= t <= 1
- */
-v2d_t v2d_lerp(v2d_t u, v2d_t v, float t)
-{
-    if(t < 0.0f)
-        t = 0.0f;
-    else if(t > 1.0f)
-        t = 1.0f;
-
-    float r = 1.0f - t;
-    return v2d_new(r * u.x + t * v.x, r * u.y + t * v.y);
-}
-
-
-/*
- * v2d_compmult()
- * Performs component-wise multiplication
- */
-v2d_t v2d_compmult(v2d_t u, v2d_t v)
-{
-    return v2d_new(u.x * v.x, u.y * v.y);
-}
\ No newline at end of file
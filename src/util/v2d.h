@@ -21,6 +21,8 @@
 #ifndef _V2D_H
 #define _V2D_H
 
+#include <math.h>
+
 /* 2D vector structure */
 typedef struct v2d_t {
     float x, y;
@@ -30,15 +32,71 @@ typedef struct v2d_t {
 #define v2d_new(x, y)            (v2d_t){ (x), (y) }
 
 /* interface */
-v2d_t v2d_add(v2d_t u, v2d_t v); /* returns u+v */
-v2d_t v2d_subtract(v2d_t u, v2d_t v); /* returns u-v */
-v2d_t v2d_multiply(v2d_t u, float h); /* returns h*u */
-v2d_t v2d_rotate(v2d_t v, float radians); /* returns v rotated by an angle */
+static inline v2d_t v2d_add(v2d_t u, v2d_t v); /* returns u+v */
+static inline v2d_t v2d_subtract(v2d_t u, v2d_t v); /* returns u-v */
+static inline v2d_t v2d_multiply(v2d_t u, float h); /* returns h*u */
+static inline v2d_t v2d_rotate(v2d_t v, float radians); /* returns v rotated by an angle */
 void v2d_rotate_all(v2d_t* v, int n, float radians); /* rotates v[0..n-1] by an angle */
 v2d_t v2d_normalize(v2d_t v); /* returns a normalized copy of v */
-float v2d_magnitude(v2d_t v); /* returns the length of v */
-float v2d_dot(v2d_t u, v2d_t v); /* returns the dot product u.v */
-v2d_t v2d_lerp(v2d_t u, v2d_t v, float t); /* linear interpolation; 0.0 <= t <= 1.0 */
-v2d_t v2d_compmult(v2d_t u, v2d_t v); /* component-wise multiplication */
+static inline float v2d_magnitude(v2d_t v); /* returns the length of v */
+static inline float v2d_dot(v2d_t u, v2d_t v); /* returns the dot product u.v */
+static inline v2d_t v2d_lerp(v2d_t u, v2d_t v, float t); /* linear interpolation; 0.0 <= t <= 1.0 */
+static inline v2d_t v2d_compmult(v2d_t u, v2d_t v); /* component-wise multiplication */
+void v2d_bounds(const v2d_t* v, int n, v2d_t* out_min, v2d_t* out_max); /* axis-aligned bounding box of v[0..n-1]; n > 0 */
+
+
+
+/* these are called in the innermost loops of the engine, so we inline them */
+
+v2d_t v2d_add(v2d_t u, v2d_t v)
+{
+    return v2d_new(u.x + v.x, u.y + v.y);
+}
+
+v2d_t v2d_subtract(v2d_t u, v2d_t v)
+{
+    return v2d_new(u.x - v.x, u.y - v.y);
+}
+
+v2d_t v2d_multiply(v2d_t u, float h)
+{
+    return v2d_new(h * u.x, h * u.y);
+}
+
+v2d_t v2d_rotate(v2d_t v, float radians)
+{
+    float c = cosf(radians), s = sinf(radians);
+
+    return v2d_new(
+        v.x * c - v.y * s,
+        v.y * c + v.x * s
+    );
+}
+
+float v2d_magnitude(v2d_t v)
+{
+    return sqrtf(v.x * v.x + v.y * v.y);
+}
+
+float v2d_dot(v2d_t u, v2d_t v)
+{
+    return u.x * v.x + u.y * v.y;
+}
+
+v2d_t v2d_lerp(v2d_t u, v2d_t v, float t)
+{
+    if(t < 0.0f)
+        t = 0.0f;
+    else if(t > 1.0f)
+        t = 1.0f;
+
+    float r = 1.0f - t;
+    return v2d_new(r * u.x + t * v.x, r * u.y + t * v.y);
+}
+
+v2d_t v2d_compmult(v2d_t u, v2d_t v)
+{
+    return v2d_new(u.x * v.x, u.y * v.y);
+}
 
 #endif
@@ -0,0 +1,258 @@
+#!/usr/bin/env python3
+#
+# Open Surge Engine
+# tools/perf/generate.py - generates the corpus of synthetic stress levels
+# Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+# http://opensurge2d.org
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+"""
+Generates a corpus of synthetic stress levels in levels/perf/ of the game
+folder. Each level stresses one subsystem of the engine:
+
+  bricks      100k bricks                  brick manager, obstacle map, render queue
+  entities    10k SurgeScript entities     entity manager, ROI tests, the VM
+  colliders   1k colliders near the player collision system
+  legacy      2k legacy objects            legacy entity system, nanocalc
+  text        300 changing texts           font layout and rendering
+  water       water covering the view      water rendering, bubbles
+
+The output is deterministic: the same seed generates the same files, so that
+the results of different builds are comparable. Use run.py to run the corpus.
+"""
+
+import argparse
+import os
+import random
+import shutil
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+DEFAULT_GAME_FOLDER = os.path.normpath(os.path.join(HERE, "..", ".."))
+
+LEVEL_FOLDER = os.path.join("levels", "perf")
+SCRIPT_FOLDER = os.path.join("scripts", "perf")
+SCRIPTS = ["perf_text.ss"]  # copied from this folder to the scripts of the game
+
+THEME = "themes/waterworks.brk"
+BGTHEME = "themes/waterworks.bg"
+SETUP = ["Surge Gameplay", "Default Camera", "Default Pause and Quit", "Default HUD"]
+PLAYERS = ["Surge"]
+
+BRICK_SIZE = 128  # the bricks we use are 128x128
+SOLID_BRICKS = list(range(16, 36))  # see themes/waterworks.brk
+PASSABLE_BRICKS = list(range(1, 12))
+FLOOR_BRICK = 16
+
+SPAWN_X, SPAWN_Y = 256, 1024
+SCREEN_W, SCREEN_H = 426, 240
+
+
+class Level:
+    """A .lev file being generated"""
+
+    def __init__(self, name, rng):
+        self.name = name
+        self.rng = rng
+        self.header = []
+        self.bricks = []
+        self.entities = []
+        self.spawn_point = (SPAWN_X, SPAWN_Y)
+
+    def add_header(self, line):
+        self.header.append(line)
+
+    def add_brick(self, brick_id, x, y):
+        self.bricks.append("brick %d %d %d" % (brick_id, x, y))
+
+    def add_entity(self, name, x, y):
+        # entity ids are 64-bit hex strings; keep them deterministic
+        self.entities.append('entity "%s" %d %d "%x"' % (name, x, y, self.rng.getrandbits(63) | 1))
+
+    def add_legacy_object(self, name, x, y):
+        self.entities.append('object "%s" %d %d' % (name, x, y))
+
+    def add_floor(self, width):
+        """a floor under the spawn point, so that the player stands still"""
+        y = self.spawn_point[1] + 64
+        for x in range(0, width, BRICK_SIZE):
+            self.add_brick(FLOOR_BRICK, x, y)
+
+    def write(self, filepath):
+        lines = [
+            "// ------------------------------------------------------------",
+            "// Open Surge Engine - performance corpus",
+            "// This file was generated by tools/perf/generate.py. Do not edit.",
+            "// ------------------------------------------------------------",
+            "",
+            "// header",
+            'name "Perf: %s"' % self.name,
+            'author "tools/perf"',
+            'version "1.0"',
+            'requires "0.6.1"',
+            "act 1",
+            'theme "%s"' % THEME,
+            'bgtheme "%s"' % BGTHEME,
+            "spawn_point %d %d" % self.spawn_point,
+            "setup " + " ".join('"%s"' % s for s in SETUP),
+            "players " + " ".join('"%s"' % p for p in PLAYERS),
+        ]
+        lines += self.header
+        lines += ["", "// bricks"] + self.bricks
+        lines += ["", "// entities"] + self.entities
+        lines += [""]
+
+        with open(filepath, "w", newline="\n") as f:
+            f.write("\n".join(lines))
+
+
+def grid(count, columns, spacing, origin):
+    """count positions on a grid with the given number of columns"""
+    for i in range(count):
+        yield (origin[0] + (i % columns) * spacing[0], origin[1] + (i // columns) * spacing[1])
+
+
+def make_bricks(level, scale):
+    """100k bricks: a large level filled with solid and passable bricks"""
+    count = int(100000 * scale)
+    columns = 250
+    level.add_floor(columns * BRICK_SIZE)
+    for x, y in grid(count, columns, (BRICK_SIZE, BRICK_SIZE), (0, SPAWN_Y + 64 + BRICK_SIZE)):
+        bricks = SOLID_BRICKS if level.rng.random() < 0.5 else PASSABLE_BRICKS
+        level.add_brick(level.rng.choice(bricks), x, y)
+
+    # bricks above the floor too, so that the view is full of them
+    for x, y in grid(columns * 8, columns, (BRICK_SIZE, BRICK_SIZE), (0, SPAWN_Y - 8 * BRICK_SIZE)):
+        level.add_brick(level.rng.choice(PASSABLE_BRICKS), x, y)
+
+
+def make_entities(level, scale):
+    """10k SurgeScript entities spread over a large level"""
+    count = int(10000 * scale)
+    width = 32000
+    level.add_floor(width)
+    for _ in range(count):
+        x = level.rng.randrange(0, width)
+        y = level.rng.randrange(0, SPAWN_Y + 64)
+        level.add_entity(level.rng.choice(["Layer Green", "Layer Yellow"]), x, y)
+
+
+def make_colliders(level, scale):
+    """1k colliders packed around the player, inside the region of interest"""
+    count = int(1000 * scale)
+    level.add_floor(4096)
+    columns = 40
+    origin = (SPAWN_X + 96, SPAWN_Y - 384)
+    for x, y in grid(count, columns, (24, 16), origin):
+        level.add_entity("Collectible", x, y)
+
+
+def make_legacy(level, scale):
+    """dense legacy objects around the player"""
+    count = int(2000 * scale)
+    level.add_floor(8192)
+    columns = 50
+    origin = (SPAWN_X + 256, SPAWN_Y - 1024)
+    for x, y in grid(count, columns, (48, 48), origin):
+        level.add_legacy_object("Barrel - right,rotation", x, y)
+
+
+def make_text(level, scale):
+    """heavy text on the screen. Perf Text changes its contents every frame"""
+    count = int(300 * scale)
+    level.add_floor(4096)
+    columns = 10
+    origin = (SPAWN_X - SCREEN_W // 2, SPAWN_Y - SCREEN_H)
+    for x, y in grid(count, columns, (48, 8), origin):
+        level.add_entity("Perf Text", x, y)
+
+
+def make_water(level, scale):
+    """water covering the view, with bubbles"""
+    count = int(200 * scale)
+    width = 8192
+    level.add_floor(width)
+    level.add_header("waterlevel %d" % (SPAWN_Y - 2 * SCREEN_H))
+    level.add_header("watercolor 0 64 255 128")
+    for _ in range(count):
+        x = level.rng.randrange(0, width)
+        y = level.rng.randrange(SPAWN_Y - SCREEN_H, SPAWN_Y + 64)
+        level.add_entity("Water Bubbles", x, y)
+
+
+WORKLOADS = {
+    "bricks": make_bricks,
+    "entities": make_entities,
+    "colliders": make_colliders,
+    "legacy": make_legacy,
+    "text": make_text,
+    "water": make_water,
+}
+
+
+def generate(game_folder, workloads, seed, scale):
+    level_folder = os.path.join(game_folder, LEVEL_FOLDER)
+    script_folder = os.path.join(game_folder, SCRIPT_FOLDER)
+    os.makedirs(level_folder, exist_ok=True)
+    os.makedirs(script_folder, exist_ok=True)
+
+    for script in SCRIPTS:
+        shutil.copyfile(os.path.join(HERE, script), os.path.join(script_folder, script))
+
+    for name in workloads:
+        level = Level(name, random.Random("%s/%d" % (name, seed)))
+        WORKLOADS[name](level, scale)
+
+        filepath = os.path.join(level_folder, name + ".lev")
+        level.write(filepath)
+        print("%s: %d bricks, %d entities" % (filepath, len(level.bricks), len(level.entities)))
+
+
+def clean(game_folder):
+    for folder in [LEVEL_FOLDER, SCRIPT_FOLDER]:
+        path = os.path.join(game_folder, folder)
+        if os.path.isdir(path):
+            shutil.rmtree(path)
+            print("removed %s" % path)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("workloads", nargs="*", metavar="workload",
+                        help="the levels to generate: %s (default: all of them)" % ", ".join(sorted(WORKLOADS)))
+    parser.add_argument("--game-folder", default=DEFAULT_GAME_FOLDER, help="the folder of the game assets (default: %(default)s)")
+    parser.add_argument("--seed", type=int, default=1, help="seed of the generator (default: %(default)s)")
+    parser.add_argument("--scale", type=float, default=1.0, help="multiply the size of the workloads (default: %(default)s)")
+    parser.add_argument("--clean", action="store_true", help="remove the generated files and quit")
+    args = parser.parse_args()
+
+    if args.clean:
+        clean(args.game_folder)
+        return 0
+
+    if args.scale <= 0:
+        parser.error("the scale must be positive")
+
+    for workload in args.workloads:
+        if workload not in WORKLOADS:
+            parser.error("unknown workload: %s" % workload)
+
+    generate(args.game_folder, args.workloads or sorted(WORKLOADS), args.seed, args.scale)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
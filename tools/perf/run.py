@@ -0,0 +1,178 @@
+#!/usr/bin/env python3
+#
+# Open Surge Engine
+# tools/perf/run.py - runs the performance corpus and writes the results as JSON
+# Copyright 2008-2024 Alexandre Martins <alemartf(at)gmail.com>
+# http://opensurge2d.org
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+"""
+Runs each level of the performance corpus (see generate.py) in the benchmark
+mode of the engine and writes the results of this build to a JSON file:
+
+  { "build": ..., "date": ..., "frames": ..., "headless": ...,
+    "results": { "bricks": { "update_mean_ms": ..., ... }, ... } }
+
+With --baseline, the results are compared to those of a previous build, and
+the exit status is 1 if a timing regressed by more than --threshold.
+"""
+
+import argparse
+import datetime
+import glob
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+DEFAULT_GAME_FOLDER = os.path.normpath(os.path.join(HERE, "..", ".."))
+DEFAULT_ENGINE = os.path.join(DEFAULT_GAME_FOLDER, "opensurge")
+DEFAULT_OUTPUT_FOLDER = os.path.join(HERE, "results")
+LEVEL_FOLDER = "levels/perf"  # a virtual path
+
+# the metrics compared against the baseline. Lower is better
+TIMINGS = [
+    "load_ms",
+    "update_mean_ms", "update_p99_ms",
+    "render_mean_ms", "render_p99_ms",
+    "gc_max_pause_ms",
+]
+
+
+def build_name():
+    """a name for this build: the git revision of the source tree, if available"""
+    try:
+        return subprocess.check_output(
+            ["git", "describe", "--always", "--dirty"],
+            cwd=HERE, stderr=subprocess.DEVNULL, universal_newlines=True
+        ).strip()
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+
+
+def list_workloads(game_folder):
+    files = glob.glob(os.path.join(game_folder, LEVEL_FOLDER, "*.lev"))
+    return sorted(os.path.splitext(os.path.basename(f))[0] for f in files)
+
+
+def run_workload(args, workload):
+    """runs a level of the corpus and returns its metrics"""
+    fd, json_path = tempfile.mkstemp(prefix="opensurge-perf-", suffix=".json")
+    os.close(fd)
+
+    command = [
+        args.engine,
+        "--game-folder", args.game_folder,
+        "--benchmark", "%s/%s.lev" % (LEVEL_FOLDER, workload),
+        "--frames", str(args.frames),
+        "--benchmark-json", json_path,
+        "--seed", "1",
+    ]
+    if args.headless:
+        command.append("--headless")
+
+    try:
+        subprocess.run(command, stdout=subprocess.DEVNULL, check=True, timeout=args.timeout)
+        with open(json_path) as f:
+            return json.load(f)
+    except (OSError, ValueError, subprocess.SubprocessError) as e:
+        print("%s: failed (%s)" % (workload, e), file=sys.stderr)
+        return None
+    finally:
+        os.remove(json_path)
+
+
+def compare(results, baseline, threshold):
+    """prints the changes of the timings. Returns the number of regressions"""
+    regressions = 0
+
+    for workload, metrics in sorted(results.items()):
+        base = baseline.get("results", {}).get(workload)
+        if base is None:
+            continue
+
+        for key in TIMINGS:
+            old, new = base.get(key), metrics.get(key)
+            if old is None or new is None or old <= 0.0:
+                continue
+
+            change = (new - old) / old
+            regressed = change > threshold
+            regressions += int(regressed)
+            print("%-10s %-16s %10.3f -> %10.3f  %+6.1f%%%s" % (
+                workload, key, old, new, 100.0 * change, "  REGRESSION" if regressed else ""
+            ))
+
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("workloads", nargs="*", metavar="workload", help="the levels to run (default: all of levels/perf)")
+    parser.add_argument("--engine", default=DEFAULT_ENGINE, help="the executable of the engine (default: %(default)s)")
+    parser.add_argument("--game-folder", default=DEFAULT_GAME_FOLDER, help="the folder of the game assets (default: %(default)s)")
+    parser.add_argument("--build", help="the name of this build (default: the git revision)")
+    parser.add_argument("--frames", type=int, default=600, help="frames per level (default: %(default)s)")
+    parser.add_argument("--headless", action="store_true", help="simulate without rendering")
+    parser.add_argument("--timeout", type=float, default=600.0, help="seconds per level (default: %(default)s)")
+    parser.add_argument("--output", help="the JSON file of the results (default: results/<build>.json)")
+    parser.add_argument("--baseline", help="compare to the JSON file of the results of a previous build")
+    parser.add_argument("--threshold", type=float, default=0.1, help="relative change considered a regression (default: %(default)s)")
+    args = parser.parse_args()
+
+    workloads = args.workloads or list_workloads(args.game_folder)
+    if not workloads:
+        parser.error("the corpus is empty. Run generate.py first")
+
+    build = args.build or build_name()
+    output = args.output or os.path.join(DEFAULT_OUTPUT_FOLDER, build + ".json")
+
+    report = {
+        "build": build,
+        "date": datetime.datetime.now(datetime.timezone.utc).isoformat(timespec="seconds"),
+        "frames": args.frames,
+        "headless": args.headless,
+        "results": {},
+    }
+
+    failures = 0
+    for workload in workloads:
+        print("running %s..." % workload)
+        metrics = run_workload(args, workload)
+        if metrics is not None:
+            report["results"][workload] = metrics
+        else:
+            failures += 1
+
+    os.makedirs(os.path.dirname(os.path.abspath(output)), exist_ok=True)
+    with open(output, "w") as f:
+        json.dump(report, f, indent=2, sort_keys=True)
+        f.write("\n")
+    print("results written to %s" % output)
+
+    regressions = 0
+    if args.baseline:
+        with open(args.baseline) as f:
+            regressions = compare(report["results"], json.load(f), args.threshold)
+        print("%d regression(s)" % regressions)
+
+    return 1 if failures > 0 or regressions > 0 else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())